@@ -357,11 +357,36 @@ macro(GENERATE_TABLES TABLES_PATH)
   endforeach()
   set_property(GLOBAL PROPERTY AMALGAMATE_TARGETS "${NEW_TARGETS}")
   set_property(GLOBAL PROPERTY AMALGAMATE_FOREIGN_TARGETS "${TABLE_FILES_FOREIGN}")
+  set_property(GLOBAL APPEND PROPERTY AMALGAMATE_BENCHMARK_TARGETS "${NEW_TARGETS}")
 endmacro()
 
+# Generate the row struct headers of table specs with typed_rows.
+macro(GENERATE_TABLE_ROWS BASE_PATH)
+  # Implementations include the headers, they are generated when configuring
+  # and a spec change will configure again.
+  file(GLOB_RECURSE TABLE_FILES_ALL "${BASE_PATH}/specs/*.table")
+  foreach(TABLE_FILE ${TABLE_FILES_ALL})
+    file(STRINGS "${TABLE_FILE}" TYPED_ROWS REGEX "typed_rows *= *True")
+    if(NOT "${TYPED_ROWS}" STREQUAL "")
+      get_filename_component(TABLE_NAME "${TABLE_FILE}" NAME_WE)
+      execute_process(
+        COMMAND "${PYTHON_EXECUTABLE}"
+          "${BASE_PATH}/tools/codegen/gentable.py"
+          "--header"
+          "${TABLE_FILE}"
+          "${CMAKE_BINARY_DIR}/generated/rows/${TABLE_NAME}.h"
+        WORKING_DIRECTORY "${CMAKE_SOURCE_DIR}"
+      )
+      set_property(DIRECTORY APPEND PROPERTY
+        CMAKE_CONFIGURE_DEPENDS "${TABLE_FILE}")
+    endif()
+  endforeach()
+endmacro(GENERATE_TABLE_ROWS)
+
 macro(GENERATE_UTILITIES TABLES_PATH)
   file(GLOB TABLE_FILES_UTILITY "${TABLES_PATH}/specs/utility/*.table")
   set_property(GLOBAL APPEND PROPERTY AMALGAMATE_TARGETS "${TABLE_FILES_UTILITY}")
+  set_property(GLOBAL APPEND PROPERTY AMALGAMATE_BENCHMARK_TARGETS "${TABLE_FILES_UTILITY}")
 endmacro(GENERATE_UTILITIES)
 
 macro(GENERATE_TABLE TABLE_FILE FOREIGN NAME BASE_PATH OUTPUT)
@@ -393,6 +418,10 @@ macro(AMALGAMATE BASE_PATH NAME OUTPUT)
   if("${NAME}" STREQUAL "foreign")
     get_property(TARGETS GLOBAL PROPERTY AMALGAMATE_FOREIGN_TARGETS)
     set(FOREIGN "--foreign")
+  elseif("${NAME}" STREQUAL "benchmarks")
+    # Generate a benchmark of each utility and platform table.
+    get_property(TARGETS GLOBAL PROPERTY AMALGAMATE_BENCHMARK_TARGETS)
+    set(FOREIGN "--benchmark")
   else()
     get_property(TARGETS GLOBAL PROPERTY AMALGAMATE_TARGETS)
   endif()
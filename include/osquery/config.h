@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <list>
 #include <map>
 #include <memory>
@@ -81,6 +82,49 @@ class Config : private boost::noncopyable {
                               const Row& r0,
                               const Row& r1);
 
+  /**
+   * @brief Record the CPU and memory differences of a query's execution.
+   *
+   * @param name The unique name of the scheduled item
+   * @param delay Number of seconds (wall time) taken by the query
+   * @param size Number of characters generated by query
+   * @param user_time The change in the worker's user CPU time
+   * @param system_time The change in the worker's system CPU time
+   * @param memory The change in the worker's resident memory in bytes
+   */
+  void recordQueryPerformance(const std::string& name,
+                              size_t delay,
+                              size_t size,
+                              int64_t user_time,
+                              int64_t system_time,
+                              int64_t memory);
+
+  /**
+   * @brief Record the table result cache use of a scheduled query execution.
+   *
+   * @param name The unique name of the scheduled item
+   * @param hits Number of table scans answered by the table result cache
+   * @param misses Number of cacheable table scans that generated results
+   */
+  void recordQueryCacheResults(const std::string& name,
+                               size_t hits,
+                               size_t misses);
+
+  /**
+   * @brief Record result rows a scheduled query's output limits suppressed.
+   *
+   * @param name The unique name of the scheduled item
+   * @param rows Number of result rows that were not logged
+   */
+  void recordQuerySuppressedRows(const std::string& name, size_t rows);
+
+  /**
+   * @brief Record a scheduled query execution cancelled at its deadline.
+   *
+   * @param name The unique name of the scheduled item
+   */
+  void recordQueryTimeout(const std::string& name);
+
   /**
    * @brief Record a query 'initialization', meaning the query will run.
    *
@@ -115,6 +159,14 @@ class Config : private boost::noncopyable {
   /// Get start time of config.
   size_t getStartTime() const { return start_time_; }
 
+  /**
+   * @brief Purge once if the initial config load skipped the purge.
+   *
+   * Expiring results is not needed for the first scheduled queries, the
+   * scheduler calls this after its first step.
+   */
+  void purgeDeferred();
+
   /**
    * @brief Add a pack to the osquery schedule
    */
@@ -165,6 +217,29 @@ class Config : private boost::noncopyable {
       std::function<void(const std::string& name, const ScheduledQuery& query)>
           predicate);
 
+  /**
+   * @brief Map a function across every pack's scheduled queries.
+   *
+   * Unlike scheduledQueries, the queries of inactive packs and blacklisted
+   * queries are included. A scheduler compiling the queries ahead of time
+   * checks each with shouldQueryExecute when the query is due.
+   *
+   * @param predicate is called with the query name, the query, and its pack.
+   */
+  void allScheduledQueries(
+      std::function<void(const std::string& name,
+                         const ScheduledQuery& query,
+                         const std::shared_ptr<Pack>& pack)> predicate);
+
+  /// Check if a query's pack is active and the query is not blacklisted.
+  bool shouldQueryExecute(const std::shared_ptr<Pack>& pack,
+                          const std::string& name);
+
+  /// A counter changed whenever packs are added to or removed from the config.
+  size_t getScheduleGeneration() const {
+    return schedule_generation_;
+  }
+
   /**
    * @brief Map a function across the set of configured files
    *
@@ -278,6 +353,9 @@ class Config : private boost::noncopyable {
    */
   void purge();
 
+  /// Check and expire a query in the schedule's blacklist.
+  bool isBlacklisted(const std::string& name);
+
   /**
    * @brief Reset the configuration state, reserved for testing only.
    */
@@ -304,9 +382,15 @@ class Config : private boost::noncopyable {
   /// or the initialization load step.
   bool loaded_{false};
 
+  /// The initial load did not purge stale query results.
+  std::atomic<bool> purge_deferred_{false};
+
   /// A UNIX timestamp recorded when the config started.
   size_t start_time_{0};
 
+  /// Changed when packs are added or removed, see getScheduleGeneration.
+  std::atomic<size_t> schedule_generation_{0};
+
  private:
   friend class Initializer;
 
@@ -321,6 +405,7 @@ class Config : private boost::noncopyable {
   FRIEND_TEST(PacksTests, test_discovery_cache);
   FRIEND_TEST(SchedulerTests, test_monitor);
   FRIEND_TEST(SchedulerTests, test_config_results_purge);
+  FRIEND_TEST(SchedulerTests, test_config_results_purge_deferred);
   FRIEND_TEST(EventsTests, test_event_subscriber_configure);
 };
 
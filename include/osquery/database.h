@@ -11,6 +11,7 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
@@ -59,6 +60,12 @@ extern const std::string kEvents;
  */
 extern const std::string kLogs;
 
+/// The "domain" where file digests are stored, see cachedHashMultiFromFile.
+extern const std::string kHashes;
+
+/// The "domain" where file carve requests and their upload progress are kept.
+extern const std::string kCarves;
+
 /**
  * @brief A variant type for the SQLite type affinities.
  */
@@ -92,6 +99,9 @@ Status serializeRow(const Row& r, boost::property_tree::ptree& tree);
  */
 Status serializeRowJSON(const Row& r, std::string& json);
 
+/// Append a quoted JSON string, escaped as serializeRowJSON escapes values.
+void writeJSONString(const std::string& s, std::string& json);
+
 /**
  * @brief Deserialize a Row object from a property tree
  *
@@ -148,6 +158,28 @@ Status deserializeQueryData(const boost::property_tree::ptree& tree,
 /// Inverse of serializeQueryDataJSON, convert a JSON string to QueryData.
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd);
 
+/// Inverse of serializeQueryDataJSON, parse JSON in place from a buffer.
+Status deserializeQueryDataJSON(const char* json, size_t size, QueryData& qd);
+
+/**
+ * @brief Parse JSON from a buffer into a property tree.
+ *
+ * This produces the same tree as read_json without copying the content into
+ * a stream. Config content may include comment lines, starting with '#' or
+ * '//', which are skipped when comments is true.
+ *
+ * @param json the JSON content
+ * @param size the size of the content
+ * @param tree output property tree, unchanged if the content is malformed
+ * @param comments true if comment lines are allowed
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status deserializeTreeJSON(const char* json,
+                           size_t size,
+                           boost::property_tree::ptree& tree,
+                           bool comments = false);
+
 /**
  * @brief Data structure representing the difference between the results of
  * two queries
@@ -155,6 +187,9 @@ Status deserializeQueryDataJSON(const std::string& json, QueryData& qd);
  * The representation of two diffed QueryData result sets. Given and old and
  * new QueryData, DiffResults indicates the "added" subset of rows and the
  * "removed" subset of rows.
+ *
+ * A differential calculated with key columns pairs a removed and an added
+ * row sharing a key as an "updated" row instead.
  */
 struct DiffResults {
   /// vector of added rows
@@ -163,9 +198,18 @@ struct DiffResults {
   /// vector of removed rows
   QueryData removed;
 
+  /// vector of updated rows, the key columns and the changed column values
+  QueryData updated;
+
+  /// Check if there are no added, removed, or updated rows.
+  bool empty() const {
+    return added.empty() && removed.empty() && updated.empty();
+  }
+
   /// equals operator
   bool operator==(const DiffResults& comp) const {
-    return (comp.added == added) && (comp.removed == removed);
+    return (comp.added == added) && (comp.removed == removed) &&
+           (comp.updated == updated);
   }
 
   /// not equals operator
@@ -196,18 +240,54 @@ Status serializeDiffResults(const DiffResults& d,
  */
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json);
 
+/**
+ * @brief Compute a 64-bit digest of a Row's column and value pairs.
+ *
+ * The digest is used to index rows when calculating differentials. It is not
+ * a cryptographic hash and must not be used to compare rows without a
+ * follow-up content comparison.
+ *
+ * @param r the Row to digest
+ *
+ * @return a 64-bit digest of the Row
+ */
+uint64_t hashRow(const Row& r);
+
 /**
  * @brief Diff two QueryData objects and create a DiffResults object
  *
  * @param old_ the "old" set of results
  * @param new_ the "new" set of results
  *
+ * Both result sets are indexed by a row digest, so the differential is linear
+ * in the number of old and new rows. Removed rows are emitted in the order
+ * they appear within the old results.
+ *
  * @return a DiffResults object which indicates the change from old_ to new_
  *
  * @see DiffResults
  */
 DiffResults diff(const QueryData& old_, const QueryData& new_);
 
+/**
+ * @brief Diff two QueryData objects, pairing changed rows by key columns.
+ *
+ * A removed row and an added row with the same values for every key column
+ * are reported as a single updated row. The updated row holds the key
+ * columns and each other column whose value changed, with the new value. A
+ * column missing from the new row is reported with an empty value. Rows
+ * missing a key column are never paired.
+ *
+ * @param old_ the "old" set of results
+ * @param new_ the "new" set of results
+ * @param key the columns identifying a row, empty for a plain differential
+ *
+ * @return a DiffResults object which indicates the change from old_ to new_
+ */
+DiffResults diff(const QueryData& old_,
+                 const QueryData& new_,
+                 const std::vector<std::string>& key);
+
 /**
  * @brief Add a Row to a QueryData if the Row hasn't appeared in the QueryData
  * already
@@ -263,6 +343,18 @@ struct QueryPerformance {
   /// Total characters, bytes, generated by query.
   unsigned long long int output_size;
 
+  /// Total table scans answered by the shared table result cache.
+  unsigned long long int cache_hits;
+
+  /// Total cacheable table scans that generated results.
+  unsigned long long int cache_misses;
+
+  /// Total result rows not logged because of the query's output limits.
+  unsigned long long int suppressed_rows;
+
+  /// Total executions cancelled at the query's deadline.
+  unsigned long long int timeouts;
+
   QueryPerformance()
       : executions(0),
         last_executed(0),
@@ -270,7 +362,11 @@ struct QueryPerformance {
         user_time(0),
         system_time(0),
         average_memory(0),
-        output_size(0) {}
+        output_size(0),
+        cache_hits(0),
+        cache_misses(0),
+        suppressed_rows(0),
+        timeouts(0) {}
 };
 
 /**
@@ -292,7 +388,36 @@ struct ScheduledQuery {
   /// Set of query options.
   std::map<std::string, bool> options;
 
-  ScheduledQuery() : interval(0), splayed_interval(0) {}
+  /// Maximum number of result rows logged per execution, 0 is unlimited.
+  size_t max_rows;
+
+  /// Maximum number of result bytes logged per execution, 0 is unlimited.
+  size_t max_bytes;
+
+  /// Log a deterministic sample of 1 of every N result rows, 0 logs all.
+  size_t sample;
+
+  /// Scan 1 of N slices of a dataset shared by N hosts, 0 scans all.
+  size_t split;
+
+  /// This host's slice of a split query, see --split_index.
+  size_t split_index;
+
+  /// Columns identifying a row, changed rows are logged as updated.
+  std::vector<std::string> key;
+
+  /// Seconds an execution may run, 0 uses --schedule_query_timeout.
+  size_t timeout;
+
+  ScheduledQuery()
+      : interval(0),
+        splayed_interval(0),
+        max_rows(0),
+        max_bytes(0),
+        sample(0),
+        split(0),
+        split_index(0),
+        timeout(0) {}
 
   /// equals operator
   bool operator==(const ScheduledQuery& comp) const {
@@ -334,6 +459,12 @@ struct QueryLogItem {
   /// A set of additional fields to emit with the log line.
   std::map<std::string, std::string> decorations;
 
+  /// The index of this part of a snapshot split across log items.
+  size_t chunk{0};
+
+  /// The number of log items a snapshot was split across, 0 if not split.
+  size_t chunks{0};
+
   /// equals operator
   bool operator==(const QueryLogItem& comp) const {
     return (comp.results == results) && (comp.name == name);
@@ -397,6 +528,156 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& item,
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items);
 
+/// Receives each serialized event, a JSON line without the newline.
+using QueryLogEventCallback = std::function<void(const std::string& event)>;
+
+/**
+ * @brief Serialize a QueryLogItem object into JSON events, one for each
+ * added or removed row.
+ *
+ * The name, hostIdentifier, calendarTime, unixTime, and decorations are
+ * serialized once and shared by every event. The event string provided to
+ * the callback is reused, it is only valid during the call.
+ *
+ * @param item the QueryLogItem to serialize
+ * @param callback called with each serialized event
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& item,
+                                         const QueryLogEventCallback& callback);
+
+/// The encodings a logger plugin may request for query results.
+enum ResultEncoding {
+  /// A JSON object, see serializeQueryLogItemJSON.
+  RESULT_ENCODING_JSON = 0,
+
+  /// A MessagePack map using the JSON object's keys.
+  RESULT_ENCODING_MSGPACK = 1,
+
+  /// A protocol buffers QueryLogItem message.
+  RESULT_ENCODING_PROTOBUF = 2,
+};
+
+/// Parse a result encoding name, json, msgpack, or protobuf.
+bool getResultEncoding(const std::string& name, ResultEncoding& encoding);
+
+/// The HTTP content type of a result encoding.
+const std::string& getResultContentType(ResultEncoding encoding);
+
+/**
+ * @brief Serialize a DiffResults object into a MessagePack map
+ *
+ * The map contains "added" and "removed" arrays of row maps.
+ *
+ * @param d the DiffResults to serialize
+ * @param data the output MessagePack bytes
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeDiffResultsMsgPack(const DiffResults& d, std::string& data);
+
+/**
+ * @brief Serialize a QueryLogItem object into a MessagePack map
+ *
+ * The map uses the keys of serializeQueryLogItemJSON, the unixTime is an
+ * unsigned integer.
+ *
+ * @param item the QueryLogItem to serialize
+ * @param data the output MessagePack bytes
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryLogItemMsgPack(const QueryLogItem& item,
+                                    std::string& data);
+
+/**
+ * @brief Serialize a DiffResults object into a protobuf DiffResults message
+ *
+ * See the result encodings documentation for the message definitions.
+ *
+ * @param d the DiffResults to serialize
+ * @param data the output protobuf bytes
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeDiffResultsProtobuf(const DiffResults& d, std::string& data);
+
+/**
+ * @brief Serialize a QueryLogItem object into a protobuf QueryLogItem message
+ *
+ * @param item the QueryLogItem to serialize
+ * @param data the output protobuf bytes
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryLogItemProtobuf(const QueryLogItem& item,
+                                     std::string& data);
+
+/**
+ * @brief Serialize a QueryLogItem object using a result encoding
+ *
+ * JSON output does not include a trailing newline.
+ *
+ * @param item the QueryLogItem to serialize
+ * @param encoding the requested result encoding
+ * @param data the output bytes
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeQueryLogItemAs(const QueryLogItem& item,
+                               ResultEncoding encoding,
+                               std::string& data);
+
+/**
+ * @brief Wrap encoded results and request fields into one message
+ *
+ * A MessagePack batch is a map of the fields and a "data" array of the
+ * results. A protobuf batch is a ResultBatch message, with a fields map and
+ * the repeated, length-delimited, QueryLogItem results. A JSON batch is
+ * written by serializeResultBatchJSON.
+ *
+ * @param encoding a result encoding
+ * @param fields request fields, such as a node key
+ * @param items results encoded with the same encoding
+ * @param data the output bytes
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeResultBatch(ResultEncoding encoding,
+                            const std::map<std::string, std::string>& fields,
+                            const std::vector<std::string>& items,
+                            std::string& data);
+
+/**
+ * @brief Wrap JSON log lines and request fields into one JSON object
+ *
+ * The lines are already serialized, they are spliced into the "data" array
+ * without being parsed and serialized again. Each line must be a JSON
+ * object, a cheap syntactic check skips the lines that are not.
+ *
+ * @param fields request fields, such as a node key
+ * @param items JSON log lines, surrounding whitespace is removed
+ * @param json the output JSON string
+ *
+ * @return Status indicating the success or failure of the operation
+ */
+Status serializeResultBatchJSON(
+    const std::map<std::string, std::string>& fields,
+    const std::vector<std::string>& items,
+    std::string& json);
+
+/// Ordered key and value pairs returned by a range scan.
+using DatabaseKeyValues = std::vector<std::pair<std::string, std::string>>;
+
+/// Receives each scanned key and value, returns false to stop the scan.
+using DatabaseScanCallback =
+    std::function<bool(const std::string& key, const std::string& value)>;
+
+/// Receives a read-only view of a value, valid only during the call.
+using DatabaseReadCallback =
+    std::function<Status(const char* data, size_t size)>;
+
 /**
  * @brief An osquery backing storage (database) type that persists executions.
  *
@@ -429,6 +710,22 @@ class DatabasePlugin : public Plugin {
                      const std::string& key,
                      std::string& value) const = 0;
 
+  /**
+   * @brief Perform a domain and key lookup without copying the value.
+   *
+   * The reader is given a view of the stored bytes that is only valid until
+   * it returns, it should decode the value in place and must not call back
+   * into the database. The default implementation reads a copy using get.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param key A string value representing the lookup/retrieval key.
+   * @param reader Called once with the value if the key exists.
+   * @return Failure if the key does not exist, otherwise the reader's status.
+   */
+  virtual Status read(const std::string& domain,
+                      const std::string& key,
+                      const DatabaseReadCallback& reader) const;
+
   /**
    * @brief Store a string-represented value using a domain and key index.
    *
@@ -447,6 +744,67 @@ class DatabasePlugin : public Plugin {
   /// Data removal method.
   virtual Status remove(const std::string& domain, const std::string& k) = 0;
 
+  /**
+   * @brief Retrieve the values of several keys within a domain.
+   *
+   * The default implementation performs a get for each key.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param keys The lookup/retrieval keys.
+   * @param values Output, a value for each key, left empty if the key does not
+   * exist.
+   * @return Failure if the data could not be accessed.
+   */
+  virtual Status multiGet(const std::string& domain,
+                          const std::vector<std::string>& keys,
+                          std::vector<std::string>& values) const;
+
+  /**
+   * @brief Store several keys and values within a domain as a single write.
+   *
+   * Readers observe either none or all of the batch. The default
+   * implementation performs a put for each pair and is not atomic.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param data The keys and values to store.
+   * @return Failure if the batch could not be stored.
+   */
+  virtual Status putBatch(const std::string& domain,
+                          const DatabaseKeyValues& data);
+
+  /**
+   * @brief Remove several keys within a domain as a single write.
+   *
+   * See DatabasePlugin::putBatch for discussion around atomicity.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param keys The keys to remove.
+   * @return Failure if the batch could not be removed.
+   */
+  virtual Status removeBatch(const std::string& domain,
+                             const std::vector<std::string>& keys);
+
+  /**
+   * @brief Append a string-represented value to an existing value.
+   *
+   * Append-only storage, such as event records, may avoid reading and
+   * rewriting the complete value. The default implementation performs a get
+   * followed by a put and callers must serialize appends to the same key.
+   * A missing key is treated as an empty value.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param key A string value representing the lookup/retrieval key.
+   * @param value A string value appended to the existing data.
+   * @return Failure if the data could not be stored.
+   */
+  virtual Status append(const std::string& domain,
+                        const std::string& key,
+                        const std::string& value) {
+    std::string existing;
+    get(domain, key, existing);
+    return put(domain, key, existing + value);
+  }
+
   virtual Status scan(const std::string& domain,
                       std::vector<std::string>& results,
                       const std::string& prefix,
@@ -454,6 +812,74 @@ class DatabasePlugin : public Plugin {
     return Status(0, "Not used");
   }
 
+  /**
+   * @brief Stream the keys and values sharing a prefix.
+   *
+   * Plugins with ordered storage should read each value with the key from
+   * the same iterator. The default implementation scans the keys then gets
+   * each value. The callback may stop the scan early by returning false.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param prefix The common key prefix, empty for every key.
+   * @param max Optionally stop after max pairs, 0 for no limit.
+   * @param callback Called for each key and value in key order.
+   * @return Failure if the data could not be accessed.
+   */
+  virtual Status scanValues(const std::string& domain,
+                            const std::string& prefix,
+                            size_t max,
+                            const DatabaseScanCallback& callback) const;
+
+  /**
+   * @brief Retrieve the keys and values within an inclusive key range.
+   *
+   * Keys are compared bytewise. Plugins with ordered storage should seek to
+   * the first key instead of scanning the domain. The default implementation
+   * scans the keys sharing the common prefix of the range bounds then gets
+   * each value.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param begin The first key within the range.
+   * @param end The last key within the range.
+   * @param results Output, the ordered key and value pairs.
+   * @param max Optionally stop after max pairs, 0 for no limit.
+   * @return Failure if the data could not be accessed.
+   */
+  virtual Status scanRange(const std::string& domain,
+                           const std::string& begin,
+                           const std::string& end,
+                           DatabaseKeyValues& results,
+                           size_t max = 0) const;
+
+  /**
+   * @brief Remove the keys within a half-open key range.
+   *
+   * Keys are compared bytewise, begin is removed and end is not. The default
+   * implementation scans the keys sharing the common prefix of the range
+   * bounds then removes each key.
+   *
+   * @param domain A string value representing abstract storage indexing.
+   * @param begin The first key within the range.
+   * @param end The key following the range.
+   * @return Failure if the data could not be removed.
+   */
+  virtual Status removeRange(const std::string& domain,
+                             const std::string& begin,
+                             const std::string& end);
+
+  /**
+   * @brief Report storage statistics.
+   *
+   * Each statistic includes a "domain", empty for the entire store, a "name",
+   * and a "value". Plugins without statistics report nothing.
+   *
+   * @param stats Output, the statistics.
+   * @return Failure if the statistics could not be collected.
+   */
+  virtual Status getStats(PluginResponse& stats) const {
+    return Status(0, "Not used");
+  }
+
   /**
    * @brief Shutdown the database and release initialization resources.
    *
@@ -558,9 +984,45 @@ Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value);
 
+/**
+ * @brief Append to a value in the active osquery DatabasePlugin storage.
+ *
+ * See DatabasePlugin::append for discussion around atomicity.
+ *
+ * @param domain A string value representing abstract storage indexing.
+ * @param key A string value representing the lookup/retrieval key.
+ * @param value A string value appended to the existing data.
+ * @return Storage operation status.
+ */
+Status appendDatabaseValue(const std::string& domain,
+                           const std::string& key,
+                           const std::string& value);
+
 /// Remove a domain/key identified value from backing-store.
 Status deleteDatabaseValue(const std::string& domain, const std::string& key);
 
+/**
+ * @brief Lookup several values from the active DatabasePlugin storage.
+ *
+ * See DatabasePlugin::multiGet, missing keys have an empty value.
+ */
+Status getDatabaseValues(const std::string& domain,
+                         const std::vector<std::string>& keys,
+                         std::vector<std::string>& values);
+
+/**
+ * @brief Put several values into the active DatabasePlugin storage.
+ *
+ * See DatabasePlugin::putBatch for discussion around atomicity. Extensions
+ * route each value separately.
+ */
+Status setDatabaseValues(const std::string& domain,
+                         const DatabaseKeyValues& data);
+
+/// Remove several domain/key identified values from backing-store.
+Status deleteDatabaseValues(const std::string& domain,
+                            const std::vector<std::string>& keys);
+
 /// Get a list of keys for a given domain.
 Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys,
@@ -572,6 +1034,41 @@ Status scanDatabaseKeys(const std::string& domain,
                         const std::string& prefix,
                         size_t max = 0);
 
+/**
+ * @brief Read a value in place from the active DatabasePlugin storage.
+ *
+ * See DatabasePlugin::read, the view is only valid during the reader call.
+ */
+Status readDatabaseValue(const std::string& domain,
+                         const std::string& key,
+                         const DatabaseReadCallback& reader);
+
+/**
+ * @brief Stream the keys and values sharing a prefix from the active
+ * DatabasePlugin storage.
+ *
+ * See DatabasePlugin::scanValues, the callback returns false to stop.
+ */
+Status scanDatabase(const std::string& domain,
+                    const std::string& prefix,
+                    size_t max,
+                    const DatabaseScanCallback& callback);
+
+/// Get the ordered keys and values within an inclusive key range.
+Status scanDatabaseRange(const std::string& domain,
+                         const std::string& begin,
+                         const std::string& end,
+                         DatabaseKeyValues& results,
+                         size_t max = 0);
+
+/// Remove the keys within a half-open [begin, end) key range.
+Status deleteDatabaseRange(const std::string& domain,
+                           const std::string& begin,
+                           const std::string& end);
+
+/// Get the active database plugin's storage statistics.
+Status getDatabaseStats(PluginResponse& stats);
+
 /// Allow callers to scan each column family and print each value.
 void dumpDatabase();
 }
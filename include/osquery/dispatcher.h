@@ -25,6 +25,31 @@ namespace osquery {
 
 class Dispatcher;
 
+/**
+ * @brief The scheduling class of a thread.
+ *
+ * Each role is configured with a nice level and an optional set of CPUs, see
+ * applyThreadRole.
+ */
+enum class ThreadRole {
+  /// Keep the priority of the process.
+  NORMAL,
+
+  /// Threads draining kernel and subscriber queues, such as event publishers.
+  LATENCY,
+
+  /// Scheduled and distributed queries, and the work they start.
+  BEST_EFFORT,
+};
+
+/**
+ * @brief Apply a role's priority and CPU affinity to the calling thread.
+ *
+ * A failure, such as lowering the nice level without privileges, is logged
+ * and the thread keeps its priority.
+ */
+void applyThreadRole(ThreadRole role);
+
 /// A throw/catch relay between a pause request and cancel event.
 struct RunnerInterruptError {};
 
@@ -140,6 +165,11 @@ class InternalRunnable : private boost::noncopyable,
   /// Require the runnable thread define an entrypoint.
   virtual void start() = 0;
 
+  /// The role applied to the service thread before start.
+  virtual ThreadRole role() const {
+    return ThreadRole::NORMAL;
+  }
+
   /// The runnable thread may optionally define a stop/interrupt point.
   virtual void stop() {}
 
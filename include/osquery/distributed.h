@@ -36,6 +36,9 @@ struct DistributedQueryRequest {
 
   std::string query;
   std::string id;
+
+  /// Seconds a recent result of the same query may be reused, 0 disables.
+  size_t max_age{0};
 };
 
 /**
@@ -99,6 +102,13 @@ struct DistributedQueryResult {
 
   DistributedQueryRequest request;
   QueryData results;
+
+  /// The UNIX time the results were generated, set if the request has a
+  /// max_age.
+  size_t freshness{0};
+
+  /// The results match those last written for the query, they are not sent.
+  bool unchanged{false};
 };
 
 /**
@@ -238,6 +248,15 @@ class Distributed {
   /// Process and execute queued queries
   Status runQueries();
 
+  /**
+   * @brief The id of the distributed query executing in the calling thread
+   *
+   * Tables that start work outliving the query, such as a file carve, use
+   * this to associate the work with the request. The id is empty when the
+   * caller is not executing a distributed query.
+   */
+  static std::string getCurrentRequestId();
+
  protected:
   /**
    * @brief Process several queries from a distributed plugin
@@ -253,7 +272,8 @@ class Distributed {
   /**
    * @brief Pop a request object off of the queries_ member
    *
-   * @return a DistributedQueryRequest object which needs to be executed
+   * @return a DistributedQueryRequest object which needs to be executed, the
+   * request has an empty id if no queries are pending.
    */
   DistributedQueryRequest popRequest();
 
@@ -264,8 +284,30 @@ class Distributed {
    */
   void addResult(const DistributedQueryResult& result);
 
+  /**
+   * @brief Execute pending queries until none remain
+   *
+   * Several workers may run at once, each result is written when its query
+   * completes.
+   */
+  void runWorker();
+
+  /**
+   * @brief Write a single query's results to the server
+   *
+   * Results larger than the max write size are sent in several writes, each
+   * containing a subset of the rows for the query. If a write fails, the rows
+   * of the accepted writes are removed from the result before it is retried.
+   *
+   * @param result is a DistributedQueryResult object to be sent to the server
+   */
+  Status writeResult(DistributedQueryResult& result);
+
   /**
    * @brief Flush all of the collected results to the server
+   *
+   * Each result is written with writeResult, results that are not accepted
+   * are kept for the next flush.
    */
   Status flushCompleted();
 
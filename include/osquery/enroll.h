@@ -61,20 +61,45 @@ class EnrollPlugin : public Plugin {
  * the plugin implementation, the endpoint may return a "node secret".
  *
  * If a node_key is requested from an enroll plugin because no current key
- * exists in the backing store, the result will be cached.
+ * exists in the backing store, the result will be cached. The key is also
+ * kept in memory and shared by every remote plugin. Concurrent callers wait
+ * for a single enrollment, and a failed enrollment is not retried until a
+ * jittered, exponentially increasing backoff passes.
  *
  * @param enroll_plugin Name of the enroll plugin to use if no node_key set.
  * @return A unique, often private, node secret key.
  */
 std::string getNodeKey(const std::string& enroll_plugin);
 
+/**
+ * @brief Get a node key and the generation of the in-memory key.
+ *
+ * A plugin whose request is rejected passes the generation to clearNodeKey,
+ * so several plugins rejected with the same key cause a single enrollment.
+ *
+ * @param enroll_plugin Name of the enroll plugin to use if no node_key set.
+ * @param generation Output, the generation of the returned key.
+ * @return A unique, often private, node secret key.
+ */
+std::string getNodeKey(const std::string& enroll_plugin, size_t& generation);
+
 /**
  * @brief Delete the existing node key from the persistent storage
  *
+ * This also resets the enrollment backoff.
+ *
  * @return a Status indicating the success or failure of the operation
  */
 Status clearNodeKey();
 
+/**
+ * @brief Delete a rejected node key if it has not already been replaced.
+ *
+ * @param generation The generation returned with the rejected key.
+ * @return a Status indicating the success or failure of the operation
+ */
+Status clearNodeKey(size_t generation);
+
 /**
  * @brief Read the enrollment secret from disk.
  *
@@ -27,6 +27,8 @@
 namespace osquery {
 
 struct Subscription;
+class EventDispatchQueue;
+class EventForwarder;
 template <class SC, class EC>
 class EventPublisher;
 template <class PUB>
@@ -40,6 +42,24 @@ using EventContextID = uint64_t;
 using EventTime = uint64_t;
 using EventRecord = std::pair<EventID, EventTime>;
 
+/// The most released EventContext%s a publisher keeps for reuse.
+const size_t kEventContextPoolSize = 32;
+
+/// An event row waiting to be written with a batch.
+struct BufferedEvent {
+  /// The event's unique storage ID.
+  EventID eid;
+
+  /// The index time of the event.
+  EventTime time;
+
+  /// The serialized event row.
+  std::string data;
+
+  /// The column index keys the event is recorded within.
+  std::vector<std::string> columns;
+};
+
 /**
  * @brief An EventPublisher will define a SubscriptionContext for
  * EventSubscriber%s to use.
@@ -109,6 +129,9 @@ using EventCallback = std::function<Status(const EventContextRef&,
 /// An EventPublisher must track every subscription added.
 using SubscriptionVector = std::vector<SubscriptionRef>;
 
+/// Publisher-defined keys used to bucket subscriptions for `fire`.
+using DispatchKeys = std::vector<size_t>;
+
 /// The set of search-time binned lookup tables.
 extern const std::vector<size_t> kEventTimeLists;
 
@@ -213,6 +236,16 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
    */
   virtual Status run() { return Status(1, "No run loop required"); }
 
+  /**
+   * @brief Check if each step of the run loop waits for its descriptors.
+   *
+   * The EventFactory pauses between steps so a publisher that polls does not
+   * thrash through its checks. A publisher that blocks until its descriptors
+   * are readable, with a timeout to observe `isEnding`, is stepped again
+   * without the pause and receives events as soon as they are ready.
+   */
+  virtual bool waitsForReadiness() const { return false; }
+
   /**
    * @brief Allow the EventFactory to interrupt the run loop.
    *
@@ -236,6 +269,17 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
   /// Remove all subscriptions from a named subscriber.
   virtual void removeSubscriptions(const std::string& subscriber);
 
+  /**
+   * @brief Remove the subscription using a SubscriptionContext.
+   *
+   * Subscribers that diff their configuration remove only the subscriptions
+   * no longer configured. Publishers may keep the state shared with the
+   * remaining subscriptions.
+   *
+   * @param context The context given to `subscribe`.
+   */
+  virtual void removeSubscription(const SubscriptionContextRef& context);
+
  public:
   /// Overriding the EventPublisher constructor is not recommended.
   EventPublisherPlugin() {}
@@ -270,6 +314,9 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
   /// Get the number of publisher restarts.
   size_t restartCount() const { return restart_count_; }
 
+  /// Get the number of run loop steps that ended with input still pending.
+  size_t backlogCount() const { return backlog_count_; }
+
  public:
   explicit EventPublisherPlugin(EventPublisherPlugin const&) = delete;
   EventPublisherPlugin& operator=(EventPublisherPlugin const&) = delete;
@@ -290,6 +337,24 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
   virtual void fireCallback(const SubscriptionRef& sub,
                             const EventContextRef& ec) const = 0;
 
+  /// Check if a subscription's callback should receive an event.
+  virtual bool shouldFireCallback(const SubscriptionRef& sub,
+                                  const EventContextRef& ec) const {
+    return true;
+  }
+
+  /// The internal dispatch keys of a subscription, see `subscriptionKeys`.
+  virtual bool getSubscriptionKeys(const SubscriptionRef& sub,
+                                   DispatchKeys& keys) const {
+    return false;
+  }
+
+  /// The internal dispatch keys of an event, see `eventKeys`.
+  virtual bool getEventKeys(const EventContextRef& ec,
+                            DispatchKeys& keys) const {
+    return false;
+  }
+
   /// The EventPublisher will keep track of Subscription%s that contain callins.
   SubscriptionVector subscriptions_;
 
@@ -297,6 +362,15 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
   /// This is not used to store event date in the backing store.
   std::atomic<EventContextID> next_ec_id_{0};
 
+  /**
+   * @brief A count of run loop steps that left input unread.
+   *
+   * Publishers that bound the time spent in each step increment this when
+   * their source has more to read, a growing count means the producer is
+   * writing faster than events are fired.
+   */
+  std::atomic<size_t> backlog_count_{0};
+
  private:
   /// Set ending to True to cause event type run loops to finish.
   std::atomic<bool> ending_{false};
@@ -310,6 +384,29 @@ class EventPublisherPlugin : public Plugin, public InterruptableRunnable {
   /// A lock for subscription manipulation.
   std::mutex subscription_lock_;
 
+  /**
+   * @brief Bucket the subscriptions by their dispatch keys.
+   *
+   * Each bucket holds the positions, in subscriptions_, of the subscriptions
+   * with the key and of those accepting any key, in subscription order.
+   */
+  void indexDispatchKeys();
+
+  /// Subscription positions for each dispatch key.
+  std::map<size_t, std::vector<size_t>> dispatch_index_;
+
+  /// Positions of the subscriptions accepting events with any key.
+  std::vector<size_t> dispatch_any_;
+
+  /// The keys of the event being fired, reused across events.
+  DispatchKeys dispatch_keys_;
+
+  /// Set when the subscriptions change, the index is rebuilt when fired.
+  bool dispatch_dirty_{true};
+
+  /// The number of subscriptions when the index was built.
+  size_t dispatch_count_{0};
+
   /// A helper count of event publisher runloop iterations.
   std::atomic<size_t> restart_count_{0};
 
@@ -350,6 +447,18 @@ class EventSubscriberPlugin : public Plugin {
    */
   virtual Status add(Row& r, EventTime event_time) final;
 
+  /// Give an added event to the forwarding loggers without storing it.
+  Status forward(Row& r, EventTime event_time);
+
+  /**
+   * @brief A reusable Row to build the next added event.
+   *
+   * The columns of the previous event are kept with empty values, so an
+   * EventCallback setting the same columns for each event reuses the Row's
+   * nodes and string capacity. Use this only when every column is set.
+   */
+  Row& scratchRow();
+
   /**
    * @brief Return all events added by this EventSubscriber within start, stop.
    *
@@ -375,6 +484,120 @@ class EventSubscriberPlugin : public Plugin {
    */
   std::vector<EventRecord> getRecords(const std::set<std::string>& indexes);
 
+  /// Return the comma-joined records written by previous versions.
+  std::vector<EventRecord> getLegacyRecords(
+      const std::set<std::string>& indexes);
+
+  /**
+   * @brief Return EventID, EventTime%s from the bins covering a time range.
+   *
+   * The finest list type's record logs are keyed in time order, so the range
+   * is read using a single backing store range scan.
+   *
+   * @param start an inclusive time to begin searching.
+   * @param stop an inclusive time to end searching.
+   */
+  std::vector<EventRecord> getTimeRecords(EventTime start, EventTime stop);
+
+  /**
+   * @brief Return EventID, EventTime%s recorded after an EventID.
+   *
+   * Every record is also appended to an EventID-ordered log, bucketed by
+   * EventID, so the events added since a cursor are read with one backing
+   * store range scan beginning at the cursor's bucket.
+   *
+   * @param after the exclusive EventID to begin after.
+   * @param last Output, the greatest EventID returned, or after.
+   */
+  std::vector<EventRecord> getEventIDRecords(size_t after, size_t& last);
+
+  /// Remove the EventID log buckets holding only expired records.
+  void expireEventIDLog(EventTime expire_time);
+
+  /// Check, and remember, if comma-joined records exist for this subscriber.
+  bool hasLegacyRecords();
+
+  /// Return the column index keys for an event row.
+  std::vector<std::string> getColumnKeys(const Row& r, EventTime time);
+
+  /// Append the events' records to their column index keys.
+  void recordColumns(const std::vector<BufferedEvent>& events);
+
+  /**
+   * @brief Return EventID, EventTime%s using the column indexes.
+   *
+   * @param context The query context holding the column constraints.
+   * @param start an inclusive time to begin searching.
+   * @param stop an inclusive time to end searching.
+   * @param records Output, the events matching every usable constraint.
+   *
+   * @return true if an indexed column constraint was usable.
+   */
+  bool getColumnRecords(QueryContext& context,
+                        EventTime start,
+                        EventTime stop,
+                        std::vector<EventRecord>& records);
+
+  /// Write buffered events and apply expirations before a retrieval.
+  void prepareRange(EventTime& start, EventTime& stop);
+
+  /// Load the table's column ordinals used to encode event rows.
+  void loadRowSchema();
+
+  /// Set the column ordinals used to encode event rows.
+  void setRowSchema(const std::vector<std::string>& columns);
+
+  /**
+   * @brief Serialize an event row for storage.
+   *
+   * Rows are encoded as a version tag, the row schema ID, then a sequence of
+   * length-prefixed (column ordinal, value) fields. Ordinals are taken from
+   * the subscriber's table schema. When --events_binary_rows is false the
+   * row is stored as JSON.
+   */
+  Status encodeRow(const Row& r, std::string& data);
+
+  /// Deserialize a stored event row, JSON rows are accepted.
+  Status decodeRow(const std::string& data, Row& r);
+
+  /// Select the rows for records within a time range.
+  QueryData getEvents(const std::vector<EventRecord>& records,
+                      EventTime start,
+                      EventTime stop,
+                      RowOrder order = RowOrder::NONE);
+
+  /**
+   * @brief Select the records a table scan reads, see genTable.
+   *
+   * This applies the 'time' constraints, the daemon's optimization time, the
+   * scheduled query's cursor, and the column indexes.
+   *
+   * @param context The query context of the scan.
+   * @param start Output, the inclusive lower bound time of the records.
+   * @param stop Output, the inclusive upper bound time of the records.
+   */
+  std::vector<EventRecord> getQueryRecords(QueryContext& context,
+                                           EventTime& start,
+                                           EventTime& stop);
+
+  /// The data keys of the records within a time range, in the given order.
+  std::vector<std::string> getEventKeys(const std::vector<EventRecord>& records,
+                                        EventTime start,
+                                        EventTime stop,
+                                        RowOrder order);
+
+  /// Read and append the rows of the data keys in [begin, end).
+  void getEventRows(const std::vector<std::string>& keys,
+                    size_t begin,
+                    size_t end,
+                    QueryData& results);
+
+  /// Move the expire time forward after the records of a scan are selected.
+  void updateExpireTime();
+
+  /// Select the time and legacy records within a time range, see get.
+  std::vector<EventRecord> getRangeRecords(EventTime& start, EventTime& stop);
+
   /**
    * @brief Get a unique storage-related EventID.
    *
@@ -434,19 +657,48 @@ class EventSubscriberPlugin : public Plugin {
   void expireCheck(bool cleanup = false);
 
   /**
-   * @brief Add an EventID, EventTime pair to all matching list types.
+   * @brief Expire the oldest events, doing at most a budget of work.
+   *
+   * The background expiration service calls this for each subscriber instead
+   * of expiring within `add`. Whole bins of the finest list type are expired
+   * oldest first, removing each event's data. The record logs and column
+   * indexes of the expired bins are removed as key ranges and each index list
+   * is rewritten once.
+   *
+   * @param budget The approximate max number of events to remove.
+   * @return The number of events removed.
+   */
+  size_t expireEvents(size_t budget);
+
+  /**
+   * @brief Add EventID, EventTime pairs to all matching list types.
    *
    * The list types are defined by time size. Based on the EventTime this pair
    * is added to the list bin for each list type. If there are two list types:
    * 60 seconds and 3600 seconds and `time` is 92, this pair will be added to
    * list type 1 bin 4 and list type 2 bin 1.
    *
-   * @param eid A unique EventID.
-   * @param time The time when this EventID%'s event occurred.
+   * Each bin is an append-only log of fixed-width records. The bin index is
+   * only read and rewritten when an event is recorded into a new bin.
+   *
+   * Records within the same bin are appended together.
+   *
+   * @param records A set of unique EventID%s and the times their events
+   * occurred.
    *
    * @return Were the indexes recorded.
    */
-  Status recordEvent(EventID& eid, EventTime time);
+  Status recordEvents(const std::vector<EventRecord>& records);
+
+  /**
+   * @brief Write buffered events to the backing store.
+   *
+   * When the subscriber batches events, this writes each buffered row,
+   * appends the records of each bin once, then checkpoints the EventID.
+   * This is called when the batch thresholds are reached, before events are
+   * retrieved, and when the EventFactory ends.
+   */
+  Status flushEvents();
 
   /**
    * @brief Get the expiration timeout for this event type
@@ -470,6 +722,27 @@ class EventSubscriberPlugin : public Plugin {
    */
   virtual size_t getEventsMax();
 
+  /**
+   * @brief Get the number of events to buffer before writing them
+   *
+   * The default implementation retrieves this value from
+   * FLAGS_events_batch_size. A value of 0 writes each event as it is added.
+   *
+   * @return The max number of events to buffer in memory
+   */
+  virtual size_t getEventsBatchSize();
+
+  /**
+   * @brief Get the columns this subscriber keeps secondary indexes for
+   *
+   * Each added event is recorded under its value for these columns. Queries
+   * with EQUALS or LIKE-prefix constraints on an indexed column read only the
+   * matching events instead of every retained event. The default keeps none.
+   *
+   * @return The set of indexed column names
+   */
+  virtual std::set<std::string> getIndexedColumns();
+
  public:
   /**
    * @brief A single instance requirement for static callback facilities.
@@ -494,12 +767,39 @@ class EventSubscriberPlugin : public Plugin {
    */
   virtual QueryData genTable(QueryContext& context) USED_SYMBOL;
 
+  /**
+   * @brief Stream the rows of a table scan ordered by 'time'.
+   *
+   * The records are selected and sorted as genTable would, then their rows
+   * are read a batch at a time. The first batch is sized to the LIMIT hint,
+   * a query ordered by time with a LIMIT reads only the newest (or oldest)
+   * rows it returns. Unordered scans use genTable.
+   *
+   * @param subscriber The subscriber, referenced by the generator.
+   * @param context The query context, owned by the cursor.
+   */
+  static RowGeneratorRef genTableRows(
+      const std::shared_ptr<EventSubscriberPlugin>& subscriber,
+      QueryContext& context);
+
   /// Number of Subscription%s this EventSubscriber has used.
   size_t numSubscriptions() const { return subscription_count_; }
 
   /// The number of events this EventSubscriber has received.
   EventContextID numEvents() const { return event_count_; }
 
+  /// The number of fired events dropped by the subscriber's dispatch queue.
+  size_t numDropped() const;
+
+  /**
+   * @brief Check if the subscriber forwards events without storing them.
+   *
+   * A subscriber named in the events config's "forward_only" list gives each
+   * added event to the forwarding loggers and does not write it to the
+   * backing store. Its table cannot be queried.
+   */
+  bool isForwardOnly() const { return forward_only_; }
+
  private:
   explicit EventSubscriberPlugin(EventSubscriberPlugin const&) = delete;
   EventSubscriberPlugin& operator=(EventSubscriberPlugin const&) = delete;
@@ -530,6 +830,9 @@ class EventSubscriberPlugin : public Plugin {
   /// Remove all subscriptions from this subscriber.
   void removeSubscriptions();
 
+  /// Remove a single subscription from this subscriber.
+  void removeSubscription(const SubscriptionContextRef& context);
+
  protected:
   /// A helper value counting the number of fired events tracked by publishers.
   EventContextID event_count_{0};
@@ -544,6 +847,9 @@ class EventSubscriberPlugin : public Plugin {
   /// Do not respond to periodic/scheduled/triggered event expiration requests.
   bool expire_events_{false};
 
+  /// Forward added events without storing them, see isForwardOnly.
+  bool forward_only_{false};
+
   /// Events before the expire_time_ are invalid and will be purged.
   EventTime expire_time_{0};
 
@@ -555,7 +861,9 @@ class EventSubscriberPlugin : public Plugin {
    *
    * Event subscribers may optimize selects when used in a daemon schedule by
    * requiring an event 'time' constraint and otherwise applying a minimum time
-   * as the last time the scheduled query ran.
+   * as the last time any query ran. Scheduled queries use their own
+   * EventCursorScope instead, this only applies to other daemon queries and
+   * to the first read of a new cursor.
    */
   EventTime optimize_time_{0};
 
@@ -565,17 +873,79 @@ class EventSubscriberPlugin : public Plugin {
   /// Lock used when recording an EventID and time into search bins.
   std::mutex event_record_lock_;
 
+  /// The most recent bin recorded for each list type, known to be indexed.
+  std::vector<std::string> record_bins_;
+
+  /// The finest bin of the expiration time when indexes were last expired.
+  EventTime expire_bin_{0};
+
+  /// Set if comma-joined records from previous versions may exist.
+  bool legacy_records_{false};
+
+  /// Set when legacy_records_ has been checked.
+  bool legacy_checked_{false};
+
+  /// Events added but not yet written to the backing store.
+  std::vector<BufferedEvent> batch_;
+
+  /// The Row returned by scratchRow, callbacks are not called concurrently.
+  Row scratch_row_;
+
+  /// The time the oldest buffered event was added.
+  size_t batch_time_{0};
+
+  /// Set when last_eid_ was loaded for in-memory EventID assignment.
+  bool eid_loaded_{false};
+
+  /// Lock used when buffering and writing batches of events.
+  std::mutex event_batch_lock_;
+
+  /// The schema ID for encoded rows, 0 if the subscriber has no table.
+  size_t row_schema_{0};
+
+  /// The table's column names, in ordinal order.
+  std::vector<std::string> row_columns_;
+
+  /// The 1-based ordinal of each table column.
+  std::map<std::string, size_t> row_ordinals_;
+
+  /// Known schemas, including previous versions, by schema ID.
+  std::map<size_t, std::vector<std::string>> row_schemas_;
+
+  /// Set when the table schema was loaded.
+  bool row_schema_loaded_{false};
+
+  /// Lock used when loading row schemas.
+  Mutex row_schema_lock_;
+
+  /**
+   * @brief Optional queue of fired events for this subscriber's callbacks.
+   *
+   * When set, publishers queue events and a dispatch service thread calls the
+   * callbacks, so a slow subscriber does not stall the publisher run loop.
+   */
+  std::shared_ptr<EventDispatchQueue> dispatch_queue_{nullptr};
+
  private:
   friend class EventFactory;
   friend class EventPublisherPlugin;
+  friend class EventExpirationRunner;
 
  private:
   FRIEND_TEST(EventsDatabaseTests, test_event_module_id);
   FRIEND_TEST(EventsDatabaseTests, test_record_indexing);
   FRIEND_TEST(EventsDatabaseTests, test_record_range);
+  FRIEND_TEST(EventsDatabaseTests, test_time_records);
   FRIEND_TEST(EventsDatabaseTests, test_record_expiration);
   FRIEND_TEST(EventsDatabaseTests, test_gentable);
   FRIEND_TEST(EventsDatabaseTests, test_expire_check);
+  FRIEND_TEST(EventsDatabaseTests, test_event_batching);
+  FRIEND_TEST(EventsDatabaseTests, test_column_indexes);
+  FRIEND_TEST(EventsDatabaseTests, test_row_encoding);
+  FRIEND_TEST(EventsDatabaseTests, test_incremental_expiry);
+  FRIEND_TEST(EventsDatabaseTests, test_forward_only);
+  FRIEND_TEST(EventsDatabaseTests, test_event_cursors);
+  FRIEND_TEST(EventsDatabaseTests, test_event_order);
   friend class BenchmarkEventSubscriber;
 };
 
@@ -703,8 +1073,19 @@ class EventFactory : private boost::noncopyable {
   /// Set log forwarding by adding a logger receiver.
   static void addForwarder(const std::string& logger);
 
-  /// Optionally forward events to loggers.
-  static void forwardEvent(const std::string& event);
+  /// Check if any logger plugins requested events to be forwarded.
+  static bool forwardsEvents();
+
+  /**
+   * @brief Optionally forward events to loggers.
+   *
+   * Once the event forwarding service starts events are queued and given to
+   * each logger in batches, otherwise each event is logged inline.
+   */
+  static void forwardEvent(std::string event);
+
+  /// Check if events are expired by the background expiration service.
+  static bool expiresInBackground();
 
  public:
   /// The dispatched event thread's entry-point (if needed).
@@ -767,6 +1148,12 @@ class EventFactory : private boost::noncopyable {
   /// Set of logger plugins to forward events.
   std::vector<std::string> loggers_;
 
+  /// Queued events for the forwarding service, if started.
+  std::shared_ptr<EventForwarder> forwarder_{nullptr};
+
+  /// Set when the background expiration service was started.
+  std::atomic<bool> background_expiry_{false};
+
   /// Factory publisher state manipulation.
   Mutex factory_lock_;
 };
@@ -825,8 +1212,18 @@ class EventPublisher : public EventPublisherPlugin {
     return std::static_pointer_cast<SC>(sc);
   }
 
-  /// Create a EventContext based on the templated type.
-  static ECRef createEventContext() { return std::make_shared<EC>(); }
+  /**
+   * @brief Create a EventContext based on the templated type.
+   *
+   * If the EventContext defines a `recycle` method then released contexts
+   * are pooled: when the publisher, queues, and subscribers drop the last
+   * reference the context is recycled and kept for the next event. Recycling
+   * keeps the capacity of strings and containers, so a busy publisher stops
+   * allocating for each event. `recycle` must reset every member it sets.
+   */
+  static ECRef createEventContext() {
+    return newEventContext(static_cast<EC*>(nullptr));
+  }
 
   /// Create a SubscriptionContext based on the templated type.
   static SCRef createSubscriptionContext() { return std::make_shared<SC>(); }
@@ -851,6 +1248,23 @@ class EventPublisher : public EventPublisherPlugin {
     }
   }
 
+  /// Apply `shouldFire` before an event is queued for a subscriber.
+  bool shouldFireCallback(const SubscriptionRef& sub,
+                          const EventContextRef& ec) const override {
+    return shouldFire(getSubscriptionContext(sub->context),
+                      getEventContext(ec));
+  }
+
+  bool getSubscriptionKeys(const SubscriptionRef& sub,
+                           DispatchKeys& keys) const override {
+    return subscriptionKeys(getSubscriptionContext(sub->context), keys);
+  }
+
+  bool getEventKeys(const EventContextRef& ec,
+                    DispatchKeys& keys) const override {
+    return eventKeys(getEventContext(ec), keys);
+  }
+
  protected:
   /**
    * @brief The generic `fire` will call `shouldFire` for each Subscription.
@@ -865,6 +1279,80 @@ class EventPublisher : public EventPublisherPlugin {
     return true;
   }
 
+  /**
+   * @brief Declare the dispatch keys a subscription accepts.
+   *
+   * A dispatch key is a cheap selector `shouldFire` would otherwise reject
+   * on, such as a record type or a mask bit. The generic `fire` buckets the
+   * subscriptions by key and only calls `shouldFire` for the subscriptions
+   * sharing a key with the event. The keys are read when the subscriptions
+   * change, not for each event.
+   *
+   * @param sc A SubscriptionContext.
+   * @param keys Output, the keys of events this subscription may fire for.
+   *
+   * @return false if the subscription may fire for events with any key.
+   */
+  virtual bool subscriptionKeys(const SCRef& sc, DispatchKeys& keys) const {
+    return false;
+  }
+
+  /**
+   * @brief Set the dispatch keys of an event, see `subscriptionKeys`.
+   *
+   * An event with several keys is dispatched to the subscriptions sharing
+   * any of them.
+   *
+   * @return false if the event may fire for every subscription.
+   */
+  virtual bool eventKeys(const ECRef& ec, DispatchKeys& keys) const {
+    return false;
+  }
+
+ private:
+  /// Released contexts kept by a publisher type for reuse.
+  struct EventContextPool {
+    Mutex mutex;
+    std::vector<std::unique_ptr<EC>> contexts;
+  };
+
+  /// Take a released context from the pool, or allocate one.
+  template <typename T>
+  static auto newEventContext(T*)
+      -> decltype(std::declval<T&>().recycle(), ECRef()) {
+    static auto pool = std::make_shared<EventContextPool>();
+
+    std::unique_ptr<EC> ec;
+    {
+      WriteLock lock(pool->mutex);
+      if (!pool->contexts.empty()) {
+        ec = std::move(pool->contexts.back());
+        pool->contexts.pop_back();
+      }
+    }
+    if (ec == nullptr) {
+      ec.reset(new EC());
+    }
+
+    // The deleter shares the pool, contexts may outlive the static.
+    auto owner = pool;
+    return ECRef(ec.release(), [owner](EC* released) {
+      released->recycle();
+      released->id = 0;
+      released->time = 0;
+
+      WriteLock lock(owner->mutex);
+      if (owner->contexts.size() < kEventContextPoolSize) {
+        owner->contexts.emplace_back(released);
+      } else {
+        delete released;
+      }
+    });
+  }
+
+  /// Contexts without a `recycle` method are not pooled.
+  static ECRef newEventContext(...) { return std::make_shared<EC>(); }
+
  private:
   FRIEND_TEST(EventsTests, test_event_subscriber_subscribe);
   FRIEND_TEST(EventsTests, test_event_subscriber_context);
@@ -982,6 +1470,54 @@ class EventSubscriber : public EventSubscriberPlugin {
   FRIEND_TEST(EventsTests, test_event_toggle_subscribers);
 };
 
+/**
+ * @brief The events read by a scheduled query, resumed on its next run.
+ *
+ * With --events_optimize, a daemon query without a 'time' constraint only
+ * returns the events added since the last query. A single time per
+ * subscriber lets two scheduled queries of the same table hide events from
+ * each other, and one second resolution repeats or drops events at the
+ * boundary. The scheduler opens a scope for each run, subscribers then read
+ * the EventIDs after the query's own cursor, and the cursors are stored only
+ * when the results were logged. A failed run reads the same events again.
+ */
+class EventCursorScope : private boost::noncopyable {
+ public:
+  explicit EventCursorScope(const std::string& query);
+  ~EventCursorScope();
+
+  /// The calling thread's scope, nullptr outside a scheduled query.
+  static EventCursorScope* current();
+
+  /**
+   * @brief Get the EventID a subscriber's read begins after.
+   *
+   * Every read of the subscriber within the same run begins at the same
+   * EventID, such as both sides of a self join.
+   *
+   * @param ns The subscriber's backing store namespace.
+   * @param after Output, the last EventID a previous run returned.
+   * @return false if the query has no stored cursor for the subscriber.
+   */
+  bool begin(const std::string& ns, size_t& after);
+
+  /// Record the greatest EventID a read returned.
+  void advance(const std::string& ns, size_t last);
+
+  /// Store the cursors of every subscriber read by the run.
+  void commit();
+
+ private:
+  /// The scheduled query name.
+  std::string query_;
+
+  /// Each subscriber's stored cursor and the greatest EventID read.
+  std::map<std::string, std::pair<size_t, size_t>> cursors_;
+
+  /// The scope replaced on this thread.
+  EventCursorScope* previous_{nullptr};
+};
+
 /// Iterate the event publisher registry and create run loops for each using
 /// the event factory.
 void attachEvents();
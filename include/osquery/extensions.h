@@ -85,6 +85,15 @@ Status pingExtension(const std::string& path);
  */
 void loadExtensions();
 
+/**
+ * @brief Wait for the watcher's autoloaded extensions to register.
+ *
+ * The watcher starts every autoloaded extension at once and hints their
+ * number to the worker. The worker waits, up to `extensions_timeout`, for the
+ * extensions to register and attaches all of their tables together.
+ */
+void waitForExtensions();
+
 /**
  * @brief Load extensions from a delimited search path string.
  *
@@ -137,6 +146,40 @@ Status callExtension(const std::string& extension_path,
                      const PluginRequest& request,
                      PluginResponse& response);
 
+/**
+ * @brief Generate the rows of a table exposed by an Extension.
+ *
+ * The query's constraints and used columns are sent in a structured form. An
+ * extension built with an earlier SDK is sent a serialized context instead.
+ *
+ * @param uuid Route UUID of the matched Extension, 0 for the core.
+ * @param table The table name.
+ * @param context The query's constraints and used columns.
+ * @param response The table rows output.
+ * @return Success indicates Extension API call success and table success.
+ */
+Status callExtensionTable(const RouteUUID uuid,
+                          const std::string& table,
+                          const QueryContext& context,
+                          PluginResponse& response);
+
+/**
+ * @brief Open a cursor generating the rows of a table exposed by an Extension.
+ *
+ * The returned generator fetches batches of rows from the extension as the
+ * caller consumes them. Destroying the generator early closes the cursor.
+ *
+ * @param uuid Route UUID of the matched Extension, 0 for the core.
+ * @param table The table name.
+ * @param context The query's constraints and used columns.
+ * @param generator The output row generator.
+ * @return Success if the table cursor was opened.
+ */
+Status callExtensionTable(const RouteUUID uuid,
+                          const std::string& table,
+                          const QueryContext& context,
+                          RowGeneratorRef& generator);
+
 /// The main runloop entered by an Extension, start an ExtensionRunner thread.
 Status startExtension(const std::string& name, const std::string& version);
 
@@ -16,6 +16,7 @@
 #include <vector>
 
 #include <boost/filesystem/path.hpp>
+#include <boost/noncopyable.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/status.h>
@@ -85,6 +86,94 @@ Status readFile(const boost::filesystem::path& path,
                 std::function<void(std::string& buffer, size_t size)> predicate,
                 bool blocking = false);
 
+/**
+ * @brief Stream a file's content in blocks through a single reused buffer.
+ *
+ * The privilege, read limit, and time preservation checks of readFile apply.
+ * Unlike readFile the content is never collected into one allocation, and
+ * the operating system is advised the file is read sequentially. This is
+ * used to hash large files.
+ *
+ * @param path the path of the file to read.
+ * @param block_size the size of each block given to the predicate.
+ * @param preserve_time Attempt to preserve file mtime and atime.
+ * @param predicate called with each block of content.
+ * @param offset (optional) the byte offset to start reading from.
+ * @param length (optional) the most bytes to read, 0 reads to the end.
+ */
+Status readFileBlocks(
+    const boost::filesystem::path& path,
+    size_t block_size,
+    bool preserve_time,
+    std::function<void(const char* buffer, size_t size)> predicate,
+    size_t offset = 0,
+    size_t length = 0);
+
+class FileView;
+
+/**
+ * @brief Read a file's content into a read-only view.
+ *
+ * The privilege, read limit, and time preservation checks of readFile apply.
+ * Regular files are memory mapped and the content is not copied, parsers
+ * that accept a buffer and size read the page cache directly. Small and
+ * special files, such as those in /proc, are read into a buffer owned by
+ * the view.
+ *
+ * A mapped file truncated while the view is used raises SIGBUS, views are
+ * meant for parsing a file and should be released soon after.
+ *
+ * @param path the path of the file to read.
+ * @param view output, the file's content.
+ * @param preserve_time Attempt to preserve file mtime and atime.
+ * @param blocking Request a blocking read.
+ */
+Status readFileView(const boost::filesystem::path& path,
+                    FileView& view,
+                    bool preserve_time = false,
+                    bool blocking = false);
+
+/// The content of a file read with readFileView.
+class FileView : private boost::noncopyable {
+ public:
+  FileView() = default;
+  ~FileView();
+
+  /// The file's content, valid until the view is released or read again.
+  const char* data() const {
+    return data_;
+  }
+
+  /// The size of the file's content.
+  size_t size() const {
+    return size_;
+  }
+
+  /// True if the content is memory mapped and not copied.
+  bool mapped() const {
+    return mapping_ != nullptr;
+  }
+
+ private:
+  /// Release the mapping or buffer.
+  void reset();
+
+ private:
+  const char* data_{nullptr};
+  size_t size_{0};
+
+  /// The mapped content, or nullptr if the content is in buffer_.
+  void* mapping_{nullptr};
+
+  std::string buffer_;
+
+ private:
+  friend Status readFileView(const boost::filesystem::path& path,
+                             FileView& view,
+                             bool preserve_time,
+                             bool blocking);
+};
+
 /**
  * @brief Write text to disk.
  *
@@ -226,6 +315,19 @@ Status remove(const boost::filesystem::path& path);
  */
 Status isDirectory(const boost::filesystem::path& path);
 
+/// Files modified this recently may change again within the same timestamp.
+extern const uint64_t kFileSettleNanos;
+
+/**
+ * @brief Check if a file was modified too recently to cache a result.
+ *
+ * A result derived from a file's content is only reusable by its identity
+ * once a later write would change the modification time.
+ *
+ * @param mtime the modification time in nanoseconds since the epoch.
+ */
+bool isRecentlyModified(uint64_t mtime);
+
 /**
  * @brief Return a vector of all home directories on the system.
  *
@@ -305,6 +407,26 @@ Status parsePlist(const boost::filesystem::path& path,
  */
 Status parsePlistContent(const std::string& content,
                          boost::property_tree::ptree& tree);
+
+/**
+ * @brief Parse a property list on disk, reusing the tree of an unchanged file.
+ *
+ * Parsed trees are kept in a compact serialized form keyed by path, and are
+ * reused while the file's device, inode, size, and modification time match.
+ * The memory used is bounded by --plist_cache_max_bytes, evicting the least
+ * recently used. A file modified within the last second is parsed but not
+ * kept, and failures are never kept.
+ *
+ * @param path the input path to a property list.
+ * @param tree the output property tree.
+ *
+ * @return an instance of Status, indicating success or failure if malformed.
+ */
+Status cachedParsePlist(const boost::filesystem::path& path,
+                        boost::property_tree::ptree& tree);
+
+/// Remove every parsed property list from the cache.
+void clearPlistCache();
 #endif
 
 #ifdef __linux__
@@ -361,6 +483,9 @@ Status procReadDescriptor(const std::string& process,
  * @param buffer The output buffer, caller is responsible for resources if
  * readRawMem returns success.
  * @return status The status of the read.
+ *
+ * Parsers reading several nearby ranges should use a PhysicalMemory reader,
+ * which keeps its mapping and returns the bytes in place.
  */
 Status readRawMem(size_t base, size_t length, void** buffer);
 
@@ -13,6 +13,7 @@
 #include <boost/noncopyable.hpp>
 
 #include <string>
+#include <vector>
 
 namespace osquery {
 
@@ -25,6 +26,7 @@ enum HashType {
   HASH_TYPE_MD5 = 2,
   HASH_TYPE_SHA1 = 4,
   HASH_TYPE_SHA256 = 8,
+  HASH_TYPE_XXH64 = 16,
 };
 
 /// A result structure for multiple hash requests.
@@ -33,6 +35,7 @@ struct MultiHashes {
   std::string md5;
   std::string sha1;
   std::string sha256;
+  std::string xxh64;
 };
 
 /**
@@ -123,4 +126,54 @@ std::string hashFromFile(HashType hash_type, const std::string& path);
 
 /// Get multiple hashes from a file simultaneously.
 MultiHashes hashMultiFromFile(int mask, const std::string& path);
+
+/// Statistics for the persistent file digest cache.
+struct HashCacheStats {
+  /// Requests answered entirely by stored digests.
+  size_t hits{0};
+
+  /// Requests for files without stored digests, or without a requested type.
+  size_t misses{0};
+
+  /// Requests for files whose stat metadata changed since they were hashed.
+  size_t stale{0};
+
+  /// Stale requests whose content fingerprint still matched, the stored
+  /// digests were reused without hashing the file again.
+  size_t unchanged{0};
+
+  /// Stored digests removed to stay within --hash_cache_max.
+  size_t evictions{0};
+
+  /// Files with stored digests known to this process.
+  size_t entries{0};
+};
+
+/**
+ * @brief Get multiple hashes from a file, reusing the digests of an unchanged
+ * file.
+ *
+ * Digests are stored in the backing store keyed by path and are reused while
+ * the file's device, inode, size, modification and change times match. The
+ * hash table and file event hashing share the stored digests. The number of
+ * stored files is bounded by --hash_cache_max, evicting the least recently
+ * used. A file modified within the last second is hashed but not stored.
+ *
+ * The XXH64 fingerprint is always stored with the digests. When the metadata
+ * of a file changes but its size does not, only the fingerprint is computed,
+ * and the stored cryptographic digests are reused if it matches.
+ */
+MultiHashes cachedHashMultiFromFile(int mask, const std::string& path);
+
+/**
+ * @brief Get multiple hashes from many files, using the digest cache.
+ *
+ * Files are spread across --hash_workers threads running with background CPU
+ * and I/O priority. The results are in the order of the paths.
+ */
+std::vector<MultiHashes> cachedHashMultiFromFiles(
+    int mask, const std::vector<std::string>& paths);
+
+/// Get the persistent file digest cache statistics.
+HashCacheStats getHashCacheStats();
 }
@@ -67,6 +67,8 @@ enum LoggerFeatures {
   LOGGER_FEATURE_BLANK = 0,
   LOGGER_FEATURE_LOGSTATUS = 1,
   LOGGER_FEATURE_LOGEVENT = 2,
+  LOGGER_FEATURE_MSGPACK = 4,
+  LOGGER_FEATURE_PROTOBUF = 8,
 };
 
 /**
@@ -88,6 +90,8 @@ enum LoggerFeatures {
  */
 #define RLOG(n) "[Ref #" #n "] "
 
+class BufferedLogSink;
+
 /**
  * @brief Superclass for the pluggable logging facilities.
  *
@@ -151,6 +155,20 @@ class LoggerPlugin : public Plugin {
     return false;
   }
 
+  /**
+   * @brief A feature method to request a binary encoding of query results.
+   *
+   * Query results are given to logString using the requested encoding. The
+   * results are encoded once for every active logger plugin requesting the
+   * same encoding. Results for the JSON encoding may be split into events,
+   * see the log_result_events flag, binary encodings are not.
+   *
+   * @return RESULT_ENCODING_JSON if this logger plugin expects JSON results.
+   */
+  virtual ResultEncoding resultEncoding() {
+    return RESULT_ENCODING_JSON;
+  }
+
  protected:
   /** @brief Virtual method which should implement custom logging.
    *
@@ -216,6 +234,21 @@ class LoggerPlugin : public Plugin {
   virtual Status logEvent(const std::string& s) {
     return Status(1, "Not enabled");
   }
+
+  /**
+   * @brief Optionally handle a batch of forwarded events.
+   *
+   * Events are forwarded in batches when the event forwarding queue is
+   * enabled. The default implementation calls logEvent for each event.
+   *
+   * @param events The serialized event rows, oldest first.
+   * @return the status of the last failed event, if any failed.
+   */
+  virtual Status logEvents(const std::vector<std::string>& events);
+
+ private:
+  /// The status log sink calls internal logger plugins directly.
+  friend class BufferedLogSink;
 };
 
 /// Set the verbose mode, changes Glog's sinking logic and will affect plugins.
@@ -298,6 +331,21 @@ Status logQueryLogItem(const QueryLogItem& item, const std::string& receiver);
  */
 Status logSnapshotQuery(const QueryLogItem& item);
 
+/// See logSnapshotQuery, the item's results are moved to the logger.
+Status logSnapshotQuery(QueryLogItem&& item);
+
+/**
+ * @brief Start the asynchronous result log pipeline.
+ *
+ * When --logger_async_threads is set, logQueryLogItem and logSnapshotQuery
+ * queue results for pipeline threads and return before the results are
+ * serialized or given to the logger plugins.
+ */
+void startLogPipeline();
+
+/// Wait for every queued result to reach the logger plugins.
+void flushLogPipeline();
+
 /**
  * @brief Sink a set of buffered status logs.
  *
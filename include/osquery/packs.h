@@ -29,6 +29,33 @@ struct PackStats {
   size_t misses{0};
 };
 
+/// Resources a pack's scheduled queries may use, 0 means no budget.
+struct PackBudget {
+  /// CPU seconds (user and system) the queries may use each hour.
+  size_t cpu_seconds{0};
+
+  /// Result bytes a single execution of a query may produce.
+  size_t result_bytes{0};
+};
+
+/// Resources the pack's scheduled queries used within the current hour.
+struct PackUsage {
+  /// The UNIX time of the start of the hour.
+  size_t window{0};
+
+  /// CPU milliseconds used by the executions.
+  size_t cpu_ms{0};
+
+  /// The largest result of an execution, in bytes.
+  size_t peak_result_bytes{0};
+
+  /// Executions charged to the pack.
+  size_t executions{0};
+
+  /// Due queries skipped because the budget was spent.
+  size_t skipped{0};
+};
+
 /**
  * @brief The programmatic representation of a query pack
  *
@@ -107,6 +134,33 @@ class Pack : private boost::noncopyable {
 
   const PackStats& getStats() const;
 
+  /// Returns the pack's CPU and result budgets.
+  const PackBudget& getBudget() const;
+
+  /// Returns the resources used within the current hour.
+  PackUsage getUsage() const;
+
+  /**
+   * @brief Charge a scheduled query execution to the pack.
+   *
+   * @param cpu_ms The user and system time of the execution.
+   * @param result_bytes The size of the execution's results.
+   * @param now The UNIX time of the execution, selecting the hour.
+   */
+  void recordUsage(size_t cpu_ms, size_t result_bytes, size_t now);
+
+  /**
+   * @brief Check if the pack's queries may run.
+   *
+   * Once the queries used the hour's CPU seconds, or an execution produced
+   * more than the result bytes, due queries are skipped until the next hour.
+   * A skipped query is counted in the usage.
+   *
+   * @param now The UNIX time the queries are due.
+   * @return false if a budget is spent.
+   */
+  bool withinBudget(size_t now);
+
  protected:
   /// List of query strings.
   std::vector<std::string> discovery_queries_;
@@ -132,6 +186,9 @@ class Pack : private boost::noncopyable {
   /// Cached time and result from previous discovery step.
   std::pair<size_t, bool> discovery_cache_;
 
+  /// The shared discovery result generation used by the cached result.
+  size_t discovery_cache_generation_{0};
+
   /// Aggregate appropriateness of pack for this host.
   std::atomic<bool> valid_{false};
 
@@ -141,6 +198,14 @@ class Pack : private boost::noncopyable {
   /// Pack discovery statistics.
   PackStats stats_;
 
+  /// Optional resource budgets for the scheduled queries.
+  PackBudget budget_;
+
+  /// Resources used within the current hour, protected by usage_mutex_.
+  PackUsage usage_;
+
+  mutable Mutex usage_mutex_;
+
  private:
   /**
    * @brief Private default constructor
@@ -153,6 +218,19 @@ class Pack : private boost::noncopyable {
   FRIEND_TEST(PacksTests, test_check_platform);
 };
 
+/**
+ * @brief Re-evaluate discovery queries that may be affected by new events.
+ *
+ * Discovery query results are shared by every pack using the same SQL and
+ * cached for the pack refresh interval. An event publisher or subscriber may
+ * report that a table's content changed, for example when a process is
+ * executed. Cached discovery queries using the table that returned no rows
+ * are evaluated again the next time a pack checks discovery.
+ *
+ * @param table The name of the table with new content.
+ */
+void invalidateDiscoveryQueries(const std::string& table);
+
 /**
  * @brief Generate a splayed interval.
  *
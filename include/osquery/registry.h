@@ -10,6 +10,8 @@
 
 #pragma once
 
+#include <atomic>
+#include <condition_variable>
 #include <map>
 #include <mutex>
 #include <set>
@@ -183,6 +185,31 @@ using ModuleInitalizer = void (*)(void);
 /// The registry includes a single optimization for table generation.
 struct QueryContext;
 
+/// Forward declaration of a table's row generator for table generation.
+class RowGenerator;
+
+class TablePlugin;
+
+/**
+ * @brief A table's resolved local plugin or extension route.
+ *
+ * Virtual tables keep the route and reuse it for every filter until the
+ * registry generation changes.
+ */
+struct TableRoute {
+  /// The registry generation when the route was resolved.
+  size_t generation{0};
+
+  /// The local table plugin, if the table is not within an extension.
+  std::shared_ptr<TablePlugin> plugin{nullptr};
+
+  /// Set if the table is within an extension, or the core for an extension.
+  bool external{false};
+
+  /// The extension's route UUID, 0 is the core.
+  RouteUUID uuid{0};
+};
+
 template <class PluginItem>
 class PluginFactory {};
 
@@ -208,6 +235,17 @@ class Plugin : private boost::noncopyable {
     return PluginResponse();
   }
 
+  /**
+   * @brief Seconds the core may reuse this plugin's responses, 0 disables.
+   *
+   * A plugin within an extension that returns the same response for the same
+   * request may opt in. The extension manager then answers identical requests
+   * from its cache until the interval expires.
+   */
+  virtual size_t responseCacheSeconds() const {
+    return 0;
+  }
+
   /**
    * @brief Plugins act by being called, using a request, returning a response.
    *
@@ -683,6 +721,15 @@ class RegistryFactory : private boost::noncopyable {
   /// Given an extension UUID remove all external registry items.
   static Status removeBroadcast(const RouteUUID& uuid);
 
+  /**
+   * @brief Wait for a number of extensions to add broadcasts.
+   *
+   * @param count The number of extension broadcasts expected.
+   * @param timeout The maximum milliseconds to wait.
+   * @return true if the broadcasts were added before the timeout.
+   */
+  static bool waitForBroadcasts(size_t count, size_t timeout);
+
   /// Adds an alias for an internal registry item. This registry will only
   /// broadcast the alias name.
   static Status addAlias(const std::string& registry_name,
@@ -737,6 +784,36 @@ class RegistryFactory : private boost::noncopyable {
                           QueryContext& context,
                           PluginResponse& response);
 
+  /**
+   * @brief Request a row generator for a table.
+   *
+   * Local tables create a generator that is consumed on demand. Extension
+   * tables are generated completely and the response is adapted.
+   */
+  static Status callTable(const std::string& table_name,
+                          QueryContext& context,
+                          std::shared_ptr<RowGenerator>& generator);
+
+  /// Request a row generator for a table using a resolved route.
+  static Status callTable(const TableRoute& route,
+                          const std::string& table_name,
+                          QueryContext& context,
+                          std::shared_ptr<RowGenerator>& generator);
+
+  /**
+   * @brief Resolve a table's local plugin or extension route.
+   *
+   * The route references the plugin, so a plugin removed while the route is
+   * used remains valid. Callers compare the route's generation with
+   * Registry::generation and resolve again when a registry changed.
+   */
+  static TableRoute resolveTable(const std::string& table_name);
+
+  /// Incremented whenever a registry item or extension route changes.
+  static size_t generation() {
+    return instance().generation_.load(std::memory_order_acquire);
+  }
+
   /// Set a registry's active plugin.
   static Status setActive(const std::string& registry_name,
                           const std::string& item_name);
@@ -870,6 +947,12 @@ class RegistryFactory : private boost::noncopyable {
   /// Protector for broadcast lookups and external registry mutations.
   mutable Mutex mutex_;
 
+  /// Notified when an extension adds a broadcast.
+  std::condition_variable broadcast_added_;
+
+  /// The registry generation, starting at 1 so unresolved routes differ.
+  std::atomic<size_t> generation_{1};
+
  private:
   friend class RegistryHelperCore;
   friend class RegistryModuleLoader;
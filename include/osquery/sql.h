@@ -80,6 +80,9 @@ class SQL {
   /// ASCII escape the results of the query.
   void escapeResults();
 
+  /// ASCII escape a copy of a query's results.
+  static void escapeResults(QueryData& results);
+
  public:
   /**
    * @brief Get all, 'SELECT * ...', results given a virtual table name.
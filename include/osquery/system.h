@@ -83,6 +83,9 @@ class Initializer : private boost::noncopyable {
   /// Assume initialization finished, start work.
   void start() const;
 
+  /// Milliseconds from construction until start finished, 0 before then.
+  static size_t getReadyTime();
+
   /**
    * @brief Forcefully request the application to stop.
    *
@@ -251,6 +254,9 @@ std::string getHostname();
  */
 Status getHostUUID(std::string& ident);
 
+/// Generate a random UUID string.
+std::string generateNewUUID();
+
 /**
  * @brief generate a uuid to uniquely identify this machine
  *
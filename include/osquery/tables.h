@@ -11,6 +11,7 @@
 #pragma once
 
 #include <deque>
+#include <functional>
 #include <map>
 #include <memory>
 #include <set>
@@ -18,6 +19,7 @@
 #include <vector>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/core.h>
@@ -216,6 +218,14 @@ enum class ColumnOptions {
 
   /// This column should be hidden from '*'' selects.
   HIDDEN = 16,
+
+  /*
+   * @brief Each value of this column identifies at most one row.
+   *
+   * An equality constraint on a unique column is a key lookup, the query
+   * planner expects one row. Use with INDEX when the table uses the lookup.
+   */
+  UNIQUE = 32,
 };
 
 /// Treat column options as a set of flags.
@@ -249,6 +259,9 @@ enum class TableAttributes {
 
   /// This table's data requires an osquery kernel extension/module.
   KERNEL_REQUIRED = 16,
+
+  /// Equal constraints return equal rows within a statement, see memo.
+  DETERMINISTIC = 32,
 };
 
 /// Treat table attributes as a set of flags.
@@ -437,6 +450,16 @@ using ConstraintMap = std::map<std::string, struct ConstraintList>;
 /// Populate a constraint list from a query's parsed predicate.
 using ConstraintSet = std::vector<std::pair<std::string, struct Constraint>>;
 
+/// The set of column names a query reads from a table.
+using UsedColumns = std::set<std::string>;
+
+/// The row order a table agreed to return, see QueryContext::order.
+enum class RowOrder {
+  NONE = 0,
+  TIME_ASCENDING = 1,
+  TIME_DESCENDING = 2,
+};
+
 /**
  * @brief osquery table content descriptor.
  *
@@ -458,10 +481,16 @@ struct VirtualTableContent {
   /// Table column structure, retrieved once via the TablePlugin call API.
   TableColumns columns;
 
+  /// Set if any column is REQUIRED, computed once when the table is created.
+  bool has_required{false};
+
   /// Attributes are copied into the content such that they can be quickly
   /// passed to the SQL and optional Query for inspection.
   TableAttributes attributes;
 
+  /// The event subscriber following changes to the table, if any.
+  std::string change_feed;
+
   /**
    * @brief Table column aliases structure.
    *
@@ -471,8 +500,8 @@ struct VirtualTableContent {
    */
   std::map<std::string, size_t> aliases;
 
-  /// Transient set of virtual table access constraints.
-  std::unordered_map<size_t, ConstraintSet> constraints;
+  /// The table's plugin or extension route, resolved by the first filter.
+  TableRoute route;
 
   /*
    * @brief A table implementation specific query result cache.
@@ -490,6 +519,15 @@ struct VirtualTableContent {
    * This caching does not affect or use the schedule results cache.
    */
   std::map<std::string, Row> cache;
+
+  /**
+   * @brief Complete filter results of a DETERMINISTIC table.
+   *
+   * Nested-loop joins filter the inner table once per outer row, often with
+   * the same constraints. Results are keyed by the constraints and used
+   * columns and are expired with the cache after each query run.
+   */
+  std::map<std::string, QueryData> memo;
 };
 
 /**
@@ -526,6 +564,15 @@ struct QueryContext : private boost::noncopyable {
   bool hasConstraint(const std::string& column,
                      ConstraintOperator op = EQUALS) const;
 
+  /**
+   * @brief Check if the query passed its deadline.
+   *
+   * Generators scanning an unbounded set of items, such as the paths matched
+   * by a glob, should stop producing rows once the query is cancelled. The
+   * query then fails and its partial results are discarded.
+   */
+  bool isCancelled() const;
+
   /**
    * @brief Apply a predicate function to each expression in a constraint list.
    *
@@ -594,6 +641,82 @@ struct QueryContext : private boost::noncopyable {
       std::function<Status(const std::string& constraint,
                            std::set<std::string>& output)> predicate);
 
+  /**
+   * @brief Generate the rows for each constraint value using worker threads.
+   *
+   * Tables reading a file or directory for each value, such as the paths of
+   * `WHERE path IN (...)`, would otherwise wait on each read in series. Up
+   * to --table_workers threads, including the caller, each take the next
+   * value. The rows are appended in the order of the values, as if they were
+   * generated in series. Helper threads are also limited by
+   * --table_workers_max across every concurrent scan, the caller generates
+   * the remaining values when none are available.
+   *
+   * The generator may be called concurrently and must only append to the
+   * rows it is given. Helper threads use the query's deadline and work shard.
+   *
+   * @param values The values, such as the expanded EQUALS constraints.
+   * @param generator Called with each value and the rows to append to.
+   * @param results The output rows.
+   * @param done An optional function each helper thread calls last, for
+   * example to release a library's thread state.
+   */
+  void generateEach(
+      const std::set<std::string>& values,
+      const std::function<void(const std::string& value, QueryData& rows)>&
+          generator,
+      QueryData& results,
+      const std::function<void()>& done = nullptr) const;
+
+  /**
+   * @brief Generate the rows for each of a list of rows using worker threads.
+   *
+   * See the overload for constraint values. Tables reading the files of each
+   * user, for example, generate the rows of each user from usersFromContext.
+   *
+   * A generator that drops privileges to read as each user is only run
+   * concurrently on Linux, where the file system user is changed for a single
+   * thread. Elsewhere the effective user of the process is changed.
+   *
+   * @param values The values, such as the rows of each user.
+   * @param generator Called with each value and the rows to append to.
+   * @param results The output rows.
+   * @param drops_privileges Set if the generator drops privileges.
+   * @param done An optional function each helper thread calls last.
+   */
+  void generateEach(
+      const QueryData& values,
+      const std::function<void(const Row& value, QueryData& rows)>& generator,
+      QueryData& results,
+      bool drops_privileges = false,
+      const std::function<void()>& done = nullptr) const;
+
+  /**
+   * @brief Check if a column is read by the query.
+   *
+   * SQLite reports the set of columns a statement uses from each table. Tables
+   * may skip expensive work for columns that are not used, such as reading a
+   * file or following a link, and leave those columns empty.
+   *
+   * If the set of used columns is not known, every column is used.
+   *
+   * @param column The name of a column within this table.
+   * @return true if the column is used or the projection is unknown.
+   */
+  bool isColumnUsed(const std::string& column) const {
+    return (!colsUsed.is_initialized() || colsUsed->count(column) > 0);
+  }
+
+  /// Check if any of a set of columns is read by the query.
+  bool isAnyColumnUsed(std::initializer_list<std::string> columns) const {
+    for (const auto& column : columns) {
+      if (isColumnUsed(column)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
   /// Check if a table-defined index exists within the query cache.
   bool isCached(const std::string& index) {
     return (table_->cache.count(index) != 0);
@@ -622,9 +745,37 @@ struct QueryContext : private boost::noncopyable {
     table_->cache[index][key] = std::move(_item);
   }
 
+  /**
+   * @brief Remove every constraint, the used columns, the order and limit.
+   *
+   * The constraint lists and their affinities are kept, a virtual table cursor
+   * reuses its context for each filter when no generator references it.
+   */
+  void reset();
+
   /// The map of column name to constraint list.
   ConstraintMap constraints;
 
+  /// The optional set of columns used by the query, see isColumnUsed.
+  boost::optional<UsedColumns> colsUsed;
+
+  /**
+   * @brief The order the rows must be returned in.
+   *
+   * Event-based tables consume an `ORDER BY time` and SQLite skips its sort.
+   * A table given an order must return every row in that order.
+   */
+  RowOrder order{RowOrder::NONE};
+
+  /**
+   * @brief The query's LIMIT plus OFFSET, or 0 if there is none.
+   *
+   * This is a hint: SQLite still applies the LIMIT and the other constraints
+   * of the query. A generator returning ordered rows may size its first batch
+   * to the limit, as SQLite stops pulling batches once the limit is reached.
+   */
+  size_t limit{0};
+
  private:
   /// If false then the context is maintaining a ephemeral cache.
   bool enable_cache_{false};
@@ -639,6 +790,285 @@ struct QueryContext : private boost::noncopyable {
 using QueryContext = struct QueryContext;
 using Constraint = struct Constraint;
 
+/**
+ * @brief A RowGenerator hands a table's rows to a virtual table cursor.
+ *
+ * Tables that can produce results incrementally may return a generator from
+ * TablePlugin::generator. The SQLite cursor pulls a batch of rows on demand
+ * when the previous batch is consumed. A query with a LIMIT or a selective
+ * join stops pulling, so rows that are never read are never generated.
+ *
+ * A generator may keep state between calls to RowGenerator::next. It is owned
+ * by the cursor, as is the QueryContext it was created with.
+ */
+class RowGenerator : private boost::noncopyable {
+ public:
+  virtual ~RowGenerator() {}
+
+  /**
+   * @brief Append the next batch of rows.
+   *
+   * @param batch The output container, the cursor provides an empty batch.
+   * @return false if the generator is exhausted and no rows were appended.
+   */
+  virtual bool next(QueryData& batch) = 0;
+};
+
+using RowGeneratorRef = std::shared_ptr<RowGenerator>;
+
+/**
+ * @brief Adapt a complete QueryData result into a single-batch generator.
+ *
+ * This is the legacy path for tables implementing TablePlugin::generate.
+ */
+class QueryDataGenerator : public RowGenerator {
+ public:
+  explicit QueryDataGenerator(QueryData results)
+      : results_(std::move(results)) {}
+
+  bool next(QueryData& batch) override {
+    if (done_) {
+      return false;
+    }
+    batch = std::move(results_);
+    done_ = true;
+    return true;
+  }
+
+ private:
+  /// The complete results, moved into the first batch.
+  QueryData results_;
+
+  /// Set after the results have been handed off.
+  bool done_{false};
+};
+
+/**
+ * @brief A generator calling a stateful lambda until it returns false.
+ *
+ * Tables may capture their iteration state (a directory handle, a list of
+ * pids and an offset) in the lambda and emit a few rows per call.
+ */
+class FunctionRowGenerator : public RowGenerator {
+ public:
+  using Function = std::function<bool(QueryData& batch)>;
+
+  explicit FunctionRowGenerator(Function func) : func_(std::move(func)) {}
+
+  bool next(QueryData& batch) override {
+    return (func_ != nullptr && func_(batch));
+  }
+
+ private:
+  Function func_;
+};
+
+/**
+ * @brief A single typed column value within a TypedRow.
+ *
+ * An UNKNOWN_TYPE value has not been set and is reported to SQLite as NULL.
+ * INTEGER, BIGINT, and UNSIGNED BIGINT columns share the integer slot.
+ */
+struct RowValue {
+  /// The type of the value that was set, not the declared column type.
+  ColumnType type{UNKNOWN_TYPE};
+
+  /// The integer slot, used for INTEGER_TYPE and BIGINT_TYPE values.
+  long long integer{0};
+
+  /// The floating point slot, used for DOUBLE_TYPE values.
+  double real{0};
+
+  /// The text slot, used for TEXT_TYPE values.
+  std::string text;
+};
+
+/**
+ * @brief A row addressed by column ordinal, with typed value slots.
+ *
+ * A Row is a map of column name to string value, which requires the SQLite
+ * cursor to perform a name lookup and a string to number conversion for every
+ * column it reads. A TypedRow is sized to the table's columns and a table may
+ * set each value by the column's ordinal within TablePlugin::columns using its
+ * native type. The cursor then reads values without parsing.
+ */
+class TypedRow {
+ public:
+  TypedRow() {}
+
+  /// Create a row with a NULL value for each of the table's columns.
+  explicit TypedRow(size_t columns) : values_(columns) {}
+
+  /// Set a TEXT value for the column at ordinal.
+  void setText(size_t ordinal, std::string value) {
+    auto& slot = slotAt(ordinal);
+    slot.type = TEXT_TYPE;
+    slot.text = std::move(value);
+  }
+
+  /// Set an INTEGER or BIGINT value for the column at ordinal.
+  void setInteger(size_t ordinal, long long value) {
+    auto& slot = slotAt(ordinal);
+    slot.type = BIGINT_TYPE;
+    slot.integer = value;
+  }
+
+  /// Set a DOUBLE value for the column at ordinal.
+  void setDouble(size_t ordinal, double value) {
+    auto& slot = slotAt(ordinal);
+    slot.type = DOUBLE_TYPE;
+    slot.real = value;
+  }
+
+  /// Access the value at ordinal, the caller must check size.
+  const RowValue& operator[](size_t ordinal) const {
+    return values_[ordinal];
+  }
+
+  /// The number of column slots in this row.
+  size_t size() const {
+    return values_.size();
+  }
+
+  /**
+   * @brief Convert to the name-addressed Row representation.
+   *
+   * NULL values are omitted and numeric values are lexically cast, matching
+   * the content a table would have generated using the INTEGER and DOUBLE
+   * affinity macros.
+   */
+  Row toRow(const TableColumns& columns) const;
+
+ private:
+  RowValue& slotAt(size_t ordinal) {
+    if (ordinal >= values_.size()) {
+      values_.resize(ordinal + 1);
+    }
+    return values_[ordinal];
+  }
+
+ private:
+  std::vector<RowValue> values_;
+};
+
+using TypedQueryData = std::vector<TypedRow>;
+
+/**
+ * @brief A generator that emits ordinal-addressed TypedRow%s.
+ *
+ * The SQLite cursor detects a TypedRowGenerator and pulls typed batches using
+ * TypedRowGenerator::nextTyped. Other callers, such as extension table calls,
+ * use RowGenerator::next and receive converted Row%s.
+ */
+class TypedRowGenerator : public RowGenerator {
+ public:
+  /// The columns are used to convert rows for the name-addressed interface.
+  explicit TypedRowGenerator(TableColumns columns)
+      : columns_(std::move(columns)) {}
+
+  /**
+   * @brief Append the next batch of typed rows.
+   *
+   * @param batch The output container, the cursor provides an empty batch.
+   * @return false if the generator is exhausted and no rows were appended.
+   */
+  virtual bool nextTyped(TypedQueryData& batch) = 0;
+
+  bool next(QueryData& batch) override;
+
+  /// The table's columns, the ordinals of TypedRow values index into these.
+  const TableColumns& columns() const {
+    return columns_;
+  }
+
+ private:
+  TableColumns columns_;
+};
+
+/**
+ * @brief A typed generator calling a stateful lambda until it returns false.
+ *
+ * This is the typed equivalent of FunctionRowGenerator.
+ */
+class FunctionTypedRowGenerator : public TypedRowGenerator {
+ public:
+  using Function = std::function<bool(TypedQueryData& batch)>;
+
+  FunctionTypedRowGenerator(TableColumns columns, Function func)
+      : TypedRowGenerator(std::move(columns)), func_(std::move(func)) {}
+
+  bool nextTyped(TypedQueryData& batch) override {
+    return (func_ != nullptr && func_(batch));
+  }
+
+ private:
+  Function func_;
+};
+
+/**
+ * @brief Conversions of a table's generated typed row struct.
+ *
+ * A table spec with the `typed_rows` attribute generates a struct with a
+ * member for each column, a constant ordinal for each column, and a
+ * specialization of this template. The table's implementation returns a
+ * std::vector of the struct instead of QueryData. The header is generated
+ * into the build directory, for example "generated/rows/uptime.h".
+ *
+ * A specialization provides:
+ *   static void toTypedRow(T& row, TypedRow& typed), which moves values;
+ *   static void serializeJSON(const T& row, std::string& json), which writes
+ *   the JSON serializeRowJSON would write for the equivalent Row.
+ */
+template <typename T>
+struct RowStructTraits;
+
+/// Convert generated typed rows for the name-addressed callers.
+template <typename T>
+QueryData toQueryData(std::vector<T>& rows, const TableColumns& columns) {
+  QueryData results;
+  results.reserve(rows.size());
+  for (auto& row : rows) {
+    TypedRow typed(T::kColumnCount);
+    RowStructTraits<T>::toTypedRow(row, typed);
+    results.push_back(typed.toRow(columns));
+  }
+  return results;
+}
+
+/**
+ * @brief A generator emitting a table's generated typed rows.
+ *
+ * The struct members are moved into TypedRow slots by ordinal, the cursor
+ * reads them without name lookups or string conversions.
+ */
+template <typename T>
+class RowStructGenerator : public TypedRowGenerator {
+ public:
+  RowStructGenerator(TableColumns columns, std::vector<T> rows)
+      : TypedRowGenerator(std::move(columns)), rows_(std::move(rows)) {}
+
+  bool nextTyped(TypedQueryData& batch) override {
+    if (done_) {
+      return false;
+    }
+    batch.reserve(batch.size() + rows_.size());
+    for (auto& row : rows_) {
+      batch.emplace_back(T::kColumnCount);
+      RowStructTraits<T>::toTypedRow(row, batch.back());
+    }
+    rows_.clear();
+    done_ = true;
+    return true;
+  }
+
+ private:
+  /// The complete results, moved into the first batch.
+  std::vector<T> rows_;
+
+  /// Set after the results have been handed off.
+  bool done_{false};
+};
+
 /**
  * @brief The TablePlugin defines the name, types, and column information.
  *
@@ -678,6 +1108,16 @@ class TablePlugin : public Plugin {
     return TableAttributes::NONE;
   }
 
+  /**
+   * @brief Name an event subscriber whose events follow changes to the rows.
+   *
+   * An incremental scheduled query reading only tables with change feeds is
+   * not executed again while its feeds have not received events.
+   */
+  virtual std::string changeFeed() const {
+    return "";
+  }
+
   /**
    * @brief Generate a complete table representation.
    *
@@ -699,6 +1139,22 @@ class TablePlugin : public Plugin {
     return QueryData();
   }
 
+  /**
+   * @brief Create a generator that streams the table's rows in batches.
+   *
+   * Virtual table cursors request rows through a generator. The default
+   * adapts TablePlugin::generate, which produces every row in the first batch.
+   * Tables that can yield incrementally should override this method.
+   *
+   * The context is owned by the cursor and outlives the generator.
+   *
+   * @param context A query context filled in by SQLite's virtual table API.
+   * @return A generator for the result rows, given the query context.
+   */
+  virtual RowGeneratorRef generator(QueryContext& context) {
+    return std::make_shared<QueryDataGenerator>(generate(context));
+  }
+
  protected:
   /// An SQL table containing the table definition/syntax.
   std::string columnDefinition() const;
@@ -753,16 +1209,16 @@ class TablePlugin : public Plugin {
 
  public:
   /**
-   * @brief The scheduled interval for the executing query.
+   * @brief The scheduled interval for the thread's executing query.
    *
-   * Scheduled queries execute within a pseudo-mutex, and each may communicate
-   * their scheduled interval to internal TablePlugin implementations. If the
-   * table is cachable then the interval can be used to calculate freshness.
+   * Each scheduled query communicates its scheduled interval to internal
+   * TablePlugin implementations on the thread executing it. If the table is
+   * cachable then the interval can be used to calculate freshness.
    */
-  static size_t kCacheInterval;
+  static thread_local size_t kCacheInterval;
 
-  /// The schedule step, this is the current position of the schedule.
-  static size_t kCacheStep;
+  /// The schedule step when the thread's executing query was started.
+  static thread_local size_t kCacheStep;
 
  public:
   /**
@@ -807,6 +1263,7 @@ class TablePlugin : public Plugin {
 
  private:
   friend class RegistryFactory;
+  friend class TableBenchmark;
   FRIEND_TEST(VirtualTableTests, test_tableplugin_columndefinition);
   FRIEND_TEST(VirtualTableTests, test_tableplugin_statement);
 };
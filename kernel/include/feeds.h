@@ -28,7 +28,7 @@
  *  A daemon may only connect to a kernel with the same communication version.
  *  Bump this number when changing or adding any event structs.
  */
-#define OSQUERY_KERNEL_COMMUNICATION_VERSION 4
+#define OSQUERY_KERNEL_COMMUNICATION_VERSION 6
 #ifdef KERNEL_TEST
 #define OSQUERY_KERNEL_COMM_VERSION \
   (OSQUERY_KERNEL_COMMUNICATION_VERSION | (1UL << 63))
@@ -122,10 +122,6 @@ typedef struct {
   char path[MAXPATHLEN];
 } osquery_file_event_t;
 
-typedef struct {
-  osquery_file_action_t actions;
-  char path[MAXPATHLEN];
-} osquery_file_event_subscription_t;
 
 #ifdef KERNEL_TEST
 typedef struct {
@@ -150,10 +146,16 @@ typedef struct {
   uint32_t uptime;
 } osquery_event_time_t;
 
+/// The maximum number of per-CPU queues within the shared buffer.
+#define OSQUERY_MAX_CPUS 64
+
 typedef struct {
   osquery_event_t event;
   int finished;
 
+  // Monotonic reservation time, used to merge events from per-CPU queues.
+  uint64_t timestamp;
+
   // Should be second to last member of header.
   size_t size;
 
@@ -170,6 +172,39 @@ typedef struct {
   int subscribe;
 } osquery_subscription_args_t;
 
+/// The maximum number of uids in the filter of an event type.
+#define OSQUERY_FILTER_MAX_UIDS 64
+
+/// The maximum number of paths in each path list of an event type's filter.
+#define OSQUERY_FILTER_MAX_PATHS 256
+
+typedef enum {
+  // Remove every filter of the event type.
+  OSQUERY_FILTER_CLEAR = 0,
+  // Add a file event path prefix and the actions enqueued for it.
+  OSQUERY_FILTER_PATH,
+  // Add a real uid, when set only events by these users are enqueued.
+  OSQUERY_FILTER_UID,
+  // Add a process executable path prefix, when set only these are enqueued.
+  OSQUERY_FILTER_EXEC_ALLOW,
+  // Add a process executable path prefix that is never enqueued.
+  OSQUERY_FILTER_EXEC_DENY,
+} osquery_filter_type_t;
+
+typedef struct {
+  osquery_event_t event;
+  osquery_filter_type_t type;
+
+  // The actions of an OSQUERY_FILTER_PATH.
+  osquery_file_action_t actions;
+
+  // The uid of an OSQUERY_FILTER_UID.
+  uint64_t uid;
+
+  // The prefix of a path filter.
+  char path[MAXPATHLEN];
+} osquery_filter_args_t;
+
 // Flags for buffer sync options.
 enum osquery_options {
   OSQUERY_OPTIONS_DEFAULT = 0,
@@ -180,14 +215,14 @@ typedef struct {
   // Option such as OSQUERY_NO_BLOCK.
   int options;
 
-  // Offset of daemon read pointer.
-  size_t read_offset;
+  // Offset of daemon read pointer, within each CPU queue.
+  size_t read_offsets[OSQUERY_MAX_CPUS];
 
-  // (Output) Offset of max_read pointer.
-  size_t max_read_offset;
+  // (Output) Offset of max_read pointer, within each CPU queue.
+  size_t max_read_offsets[OSQUERY_MAX_CPUS];
 
-  // (Output) Number of drops or negative on overflow.
-  int drops;
+  // (Output) Number of drops for each CPU queue or negative on overflow.
+  int drops[OSQUERY_MAX_CPUS];
 } osquery_buf_sync_args_t;
 
 typedef struct {
@@ -197,6 +232,10 @@ typedef struct {
   void *buffer;
   // osquery kernel communication version.
   uint64_t version;
+  // (Output) Number of per-CPU queues, each queue follows the previous.
+  uint32_t cpus;
+  // (Output) Size of each per-CPU queue.
+  size_t cpu_size;
 } osquery_buf_allocate_args_t;
 
 // TODO: Choose a proper IOCTL num.
@@ -211,6 +250,8 @@ typedef struct {
 #ifdef KERNEL_TEST
 #define OSQUERY_IOCTL_TEST _IOW(OSQUERY_IOCTL_NUM, 0x4, int)
 #endif // KERNEL_TEST
+#define OSQUERY_IOCTL_FILTER \
+  _IOW(OSQUERY_IOCTL_NUM, 0x5, osquery_filter_args_t)
 
 #ifdef __cplusplus
 } // end extern "c"
@@ -13,6 +13,9 @@
 #include <sys/proc.h>
 
 #include <kern/assert.h>
+#include <kern/cpu_number.h>
+#include <mach/mach_time.h>
+#include <sys/sysctl.h>
 
 #include "circular_queue_kern.h"
 
@@ -25,11 +28,15 @@ static inline void setup_queue_locks(osquery_cqueue_t *queue) {
 
   queue->lck_attr = lck_attr_alloc_init();
 
-  queue->lck = lck_spin_alloc_init(queue->lck_grp, queue->lck_attr);
+  for (uint32_t i = 0; i < OSQUERY_MAX_CPUS; i++) {
+    queue->cpus[i].lck = lck_spin_alloc_init(queue->lck_grp, queue->lck_attr);
+  }
 }
 
 static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
-  lck_spin_free(queue->lck, queue->lck_grp);
+  for (uint32_t i = 0; i < OSQUERY_MAX_CPUS; i++) {
+    lck_spin_free(queue->cpus[i].lck, queue->lck_grp);
+  }
 
   lck_attr_free(queue->lck_attr);
 
@@ -38,12 +45,12 @@ static inline void teardown_queue_locks(osquery_cqueue_t *queue) {
   lck_grp_attr_free(queue->lck_grp_attr);
 }
 
-static inline void *advance_pointer(osquery_cqueue_t *queue, void *ptr,
+static inline void *advance_pointer(osquery_cpu_cqueue_t *queue, void *ptr,
                                     size_t bytes) {
   return ((uint8_t *)ptr + bytes - queue->buffer) % queue->size + queue->buffer;
 }
 
-static inline size_t get_distance(osquery_cqueue_t *queue, void *lower,
+static inline size_t get_distance(osquery_cpu_cqueue_t *queue, void *lower,
                                   void *upper, int cannot_be_empty) {
   ssize_t size = (uint8_t *)upper - (uint8_t *)lower;
   if (size == 0) {
@@ -62,8 +69,8 @@ typedef enum {
   OSQUERY_NOT_IN_BUFFER = 1 << 2
 } osquery_between_t;
 
-static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
-                                           void *lower, void *upper,
+static inline osquery_between_t is_between(osquery_cpu_cqueue_t *queue,
+                                           void *ptr, void *lower, void *upper,
                                            size_t size) {
   osquery_between_t b = OSQUERY_BETWEEN_INIT;
   if (ptr < (void *)queue->buffer
@@ -84,14 +91,51 @@ static inline osquery_between_t is_between(osquery_cqueue_t *queue, void *ptr,
   return b;
 }
 
+/** @brief Find the queue of the current CPU.
+ *
+ *  A thread may move to another CPU after this returns, which is safe since
+ *  each queue is protected by its own lock.
+ */
+static inline osquery_cpu_cqueue_t *current_queue(osquery_cqueue_t *queue) {
+  if (queue->cpu_count == 0) {
+    return NULL;
+  }
+  return &queue->cpus[cpu_number() % queue->cpu_count];
+}
+
+/** @brief Find the queue containing a reserved space.
+ */
+static inline osquery_cpu_cqueue_t *space_queue(osquery_cqueue_t *queue,
+                                                void *space) {
+  if (queue->cpu_count == 0 || queue->cpu_size == 0 ||
+      (uint8_t *)space < queue->cpus[0].buffer) {
+    return NULL;
+  }
+
+  size_t cpu = ((uint8_t *)space - queue->cpus[0].buffer) / queue->cpu_size;
+  if (cpu >= queue->cpu_count) {
+    return NULL;
+  }
+  return &queue->cpus[cpu];
+}
+
 void osquery_cqueue_setup(osquery_cqueue_t *queue) {
   queue->last_destruction_time = 0;
-  queue->initialized = 0;
+  queue->cpu_count = 0;
+  queue->cpu_size = 0;
+  for (uint32_t i = 0; i < OSQUERY_MAX_CPUS; i++) {
+    queue->cpus[i].initialized = 0;
+  }
   setup_queue_locks(queue);
 }
 
 int osquery_cqueue_teardown(osquery_cqueue_t *queue) {
-  lck_spin_lock(queue->lck);
+  int initialized = 0;
+  for (uint32_t i = 0; i < OSQUERY_MAX_CPUS; i++) {
+    lck_spin_lock(queue->cpus[i].lck);
+    initialized |= queue->cpus[i].initialized;
+    lck_spin_unlock(queue->cpus[i].lck);
+  }
 
   // We make sure that the queue hasn't been serving requests for at least 1
   // second before we free up our locks.  This is in an attempt to make sure
@@ -104,41 +148,60 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue) {
   clock_sec_t seconds;
   clock_usec_t micro_sec;
   clock_get_system_microtime(&seconds, &micro_sec);
-  if (!queue->initialized && seconds > 2 + queue->last_destruction_time) {
-    lck_spin_unlock(queue->lck);
+  if (!initialized && seconds > 2 + queue->last_destruction_time) {
     teardown_queue_locks(queue);
     return 0;
   } else {
-    lck_spin_unlock(queue->lck);
     return -1;
   }
 }
 
 void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size) {
-  lck_spin_lock(queue->lck);
-  queue->buffer = (uint8_t *)buffer;
-  queue->size = size;
+  int cpus = 1;
+  size_t length = sizeof(cpus);
+  if (sysctlbyname("hw.ncpu", &cpus, &length, NULL, 0) != 0 || cpus < 1) {
+    cpus = 1;
+  }
 
-  queue->write = queue->buffer;
-  queue->max_read = queue->buffer;
-  queue->read = queue->buffer;
+  // Each queue is aligned for the event headers.
+  queue->cpu_count = (cpus > OSQUERY_MAX_CPUS) ? OSQUERY_MAX_CPUS : cpus;
+  queue->cpu_size = (size / queue->cpu_count) & ~(sizeof(uint64_t) - 1);
 
-  queue->drops = 0;
-  queue->initialized = 1;
-  queue->reservations = 0;
-  lck_spin_unlock(queue->lck);
+  for (uint32_t i = 0; i < queue->cpu_count; i++) {
+    osquery_cpu_cqueue_t *cpu = &queue->cpus[i];
+    lck_spin_lock(cpu->lck);
+    cpu->buffer = (uint8_t *)buffer + i * queue->cpu_size;
+    cpu->size = queue->cpu_size;
+
+    cpu->write = cpu->buffer;
+    cpu->max_read = cpu->buffer;
+    cpu->read = cpu->buffer;
+
+    cpu->drops = 0;
+    cpu->initialized = 1;
+    cpu->reservations = 0;
+    lck_spin_unlock(cpu->lck);
+  }
 }
 
 void osquery_cqueue_destroy(osquery_cqueue_t *queue) {
-  lck_spin_lock(queue->lck);
-  if (queue->initialized) {
-    queue->initialized = 0;
-
-    while (queue->reservations > 0) {
-      lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT, &queue->reservations,
-                     THREAD_UNINT);
+  int destroyed = 0;
+  for (uint32_t i = 0; i < queue->cpu_count; i++) {
+    osquery_cpu_cqueue_t *cpu = &queue->cpus[i];
+    lck_spin_lock(cpu->lck);
+    if (cpu->initialized) {
+      cpu->initialized = 0;
+      destroyed = 1;
+
+      while (cpu->reservations > 0) {
+        lck_spin_sleep(cpu->lck, LCK_SLEEP_DEFAULT, &cpu->reservations,
+                       THREAD_UNINT);
+      }
     }
+    lck_spin_unlock(cpu->lck);
+  }
 
+  if (destroyed) {
     // Time is recorded so we can fail cqueue_teardown (destruction of cqueue
     // locks) for a short period of time.  This should allow pending event
     // callbacks to notice ths cqueue has been unitialized and error out before
@@ -146,77 +209,103 @@ void osquery_cqueue_destroy(osquery_cqueue_t *queue) {
     clock_usec_t micro_sec;
     clock_get_system_microtime(&queue->last_destruction_time, &micro_sec);
   }
-
-  lck_spin_unlock(queue->lck);
 }
 
-int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
-                                size_t *max_read_offset) {
+int osquery_cqueue_advance_read(osquery_cqueue_t *queue, uint32_t cpu_index,
+                                size_t read_offset, size_t *max_read_offset) {
+  if (cpu_index >= queue->cpu_count) {
+    return -1;
+  }
+
   int err = 0;
-  lck_spin_lock(queue->lck);
+  osquery_cpu_cqueue_t *queue_cpu = &queue->cpus[cpu_index];
+  lck_spin_lock(queue_cpu->lck);
 
-  if (!queue->initialized) {
+  if (!queue_cpu->initialized) {
     err = -1;
     goto error_exit;
   }
 
-  uint8_t *new_read = queue->buffer + read_offset;
-  if (OSQUERY_BETWEEN == is_between(queue, new_read, queue->read,
-                                    queue->max_read, 0)) {
-    queue->read = new_read;
+  uint8_t *new_read = queue_cpu->buffer + read_offset;
+  if (OSQUERY_BETWEEN == is_between(queue_cpu, new_read, queue_cpu->read,
+                                    queue_cpu->max_read, 0)) {
+    queue_cpu->read = new_read;
   } else {
-    queue->read = queue->max_read;
+    queue_cpu->read = queue_cpu->max_read;
     err = -1;
   }
-  *max_read_offset = queue->max_read - queue->buffer;
+  *max_read_offset = queue_cpu->max_read - queue_cpu->buffer;
 
 error_exit:
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(queue_cpu->lck);
 
   return err;
 }
 
 ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue) {
-  ssize_t offset = 0;
-  lck_spin_lock(queue->lck);
-
-  if (!queue->initialized) {
-    offset = -1;
-    goto error_exit;
+  if (queue->cpu_count == 0) {
+    return -1;
   }
 
-  wait_result_t wait_result = THREAD_AWAKENED;
-  while (wait_result == THREAD_AWAKENED && queue->max_read == queue->read) {
-    wait_result = lck_spin_sleep(queue->lck, LCK_SLEEP_DEFAULT,
-                                 &queue->max_read, THREAD_ABORTSAFE);
-  }
-  offset = queue->max_read - queue->buffer;
+  wait_result_t wait_result = THREAD_TIMED_OUT;
+  while (wait_result != THREAD_INTERRUPTED) {
+    for (uint32_t i = 0; i < queue->cpu_count; i++) {
+      osquery_cpu_cqueue_t *cpu = &queue->cpus[i];
+      lck_spin_lock(cpu->lck);
+      int initialized = cpu->initialized;
+      int readable = cpu->max_read != cpu->read;
+      lck_spin_unlock(cpu->lck);
+
+      if (!initialized) {
+        return -1;
+      } else if (readable) {
+        return 0;
+      }
+    }
 
-error_exit:
-  lck_spin_unlock(queue->lck);
-  return offset;
+    // Producers on every CPU wake the queue, a short deadline covers a wake
+    // that happened after the checks above.
+    uint64_t deadline;
+    clock_interval_to_deadline(10, kMillisecondScale, &deadline);
+    lck_spin_lock(queue->cpus[0].lck);
+    wait_result = lck_spin_sleep_deadline(queue->cpus[0].lck,
+                                          LCK_SLEEP_DEFAULT, queue,
+                                          THREAD_ABORTSAFE, deadline);
+    lck_spin_unlock(queue->cpus[0].lck);
+  }
+  return -1;
 }
 
-int osquery_cqueue_dropped_data(osquery_cqueue_t *queue) {
+int osquery_cqueue_dropped_data(osquery_cqueue_t *queue, uint32_t cpu_index) {
+  if (cpu_index >= queue->cpu_count) {
+    return -1;
+  }
+
   int drops;
-  lck_spin_lock(queue->lck);
-  if (!queue->initialized) {
+  osquery_cpu_cqueue_t *queue_cpu = &queue->cpus[cpu_index];
+  lck_spin_lock(queue_cpu->lck);
+  if (!queue_cpu->initialized) {
     drops = -1;
     goto error_exit;
   }
 
-  drops = queue->drops;
-  queue->drops = 0;
+  drops = queue_cpu->drops;
+  queue_cpu->drops = 0;
 
 error_exit:
-  lck_spin_unlock(queue->lck);
+  lck_spin_unlock(queue_cpu->lck);
 
   return drops;
 }
 
-void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
+void *osquery_cqueue_reserve(osquery_cqueue_t *cqueue,
                              osquery_event_t event,
                              size_t size) {
+  osquery_cpu_cqueue_t *queue = current_queue(cqueue);
+  if (queue == NULL) {
+    return NULL;
+  }
+
   void *ret = NULL;
   lck_spin_lock(queue->lck);
   if (!queue->initialized) {
@@ -258,6 +347,8 @@ void *osquery_cqueue_reserve(osquery_cqueue_t *queue,
     header->event = event;
     header->size = contents_size;
     header->finished = 0;
+    // Reservations within a queue are ordered, so are their timestamps.
+    header->timestamp = mach_absolute_time();
 
     // Give them the pointer to the space not the header.
     ret = (void *)(header + 1);
@@ -279,15 +370,18 @@ error_exit:
  *
  *  REQUIRES the lock.
  *
+ *  @param cqueue The set of queues, woken waiting for data.
  *  @param queue The queue to create readable space in.
  *  @return Void.
  */
-static inline void coalesce_readable(osquery_cqueue_t *queue) {
+static inline void coalesce_readable(osquery_cqueue_t *cqueue,
+                                     osquery_cpu_cqueue_t *queue) {
   osquery_data_header_t *header = (osquery_data_header_t *)queue->max_read;
   osquery_between_t b;
 
-  while (OSQUERY_BETWEEN & (b = is_between(queue, header, queue->max_read,
-                                       queue->write, sizeof(osquery_data_header_t)))) {
+  while (OSQUERY_BETWEEN &
+         (b = is_between(queue, header, queue->max_read, queue->write,
+                         sizeof(osquery_data_header_t)))) {
     if (b & OSQUERY_NOT_IN_BUFFER || header->event == END_OF_BUFFER_EVENT) {
       queue->max_read = queue->buffer;
       header = (osquery_data_header_t *)queue->max_read;
@@ -300,16 +394,21 @@ static inline void coalesce_readable(osquery_cqueue_t *queue) {
         queue, queue->max_read, header->size + sizeof(osquery_data_header_t));
 
     header = (osquery_data_header_t *)queue->max_read;
-    wakeup(&queue->max_read);
+    wakeup(cqueue);
 
     lck_spin_unlock(queue->lck);
     lck_spin_lock(queue->lck);
   }
 }
 
-int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
+int osquery_cqueue_commit(osquery_cqueue_t *cqueue, void *space) {
   int err = 0;
 
+  osquery_cpu_cqueue_t *queue = space_queue(cqueue, space);
+  if (queue == NULL) {
+    return -1;
+  }
+
   lck_spin_lock(queue->lck);
 
   // Retrieve the header for the initialized space.
@@ -331,7 +430,7 @@ int osquery_cqueue_commit(osquery_cqueue_t *queue, void *space) {
   clock_get_system_microtime(&seconds, &microsecs);
   header->time.uptime = (uint64_t)seconds;
 
-  coalesce_readable(queue);
+  coalesce_readable(cqueue, queue);
 
   queue->reservations--;
   wakeup(&queue->reservations);
@@ -339,4 +438,3 @@ error_exit:
   lck_spin_unlock(queue->lck);
   return err;
 }
-
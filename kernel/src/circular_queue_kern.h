@@ -16,6 +16,11 @@
  *  For safety this queue on an error should log the error and reset to a known
  *  safe state possibly dropping all data in held within it.
  *
+ *  The shared buffer is split into one queue per CPU. Producers reserve space
+ *  in the queue of the CPU they run on, so producers on different CPUs do not
+ *  contend on a lock. The daemon merges events from every queue using the
+ *  reservation timestamp.
+ *
  */
 
 #pragma once
@@ -31,7 +36,7 @@
 extern "C" {
 #endif
 
-// Circular queue data structure.
+// Per-CPU circular queue data structure.
 typedef struct {
   uint8_t *buffer;
   size_t size;
@@ -41,12 +46,20 @@ typedef struct {
   int drops;
   int initialized;
   uint32_t reservations;
+
+  lck_spin_t *lck;
+} osquery_cpu_cqueue_t;
+
+// Circular queue data structure, a set of per-CPU queues.
+typedef struct {
+  osquery_cpu_cqueue_t cpus[OSQUERY_MAX_CPUS];
+  uint32_t cpu_count;
+  size_t cpu_size;
   clock_sec_t last_destruction_time;
 
   lck_grp_attr_t *lck_grp_attr;
   lck_grp_t *lck_grp;
   lck_attr_t *lck_attr;
-  lck_spin_t *lck;
 } osquery_cqueue_t;
 
 /** @brief Setup a circular queue lock system.
@@ -73,6 +86,7 @@ int osquery_cqueue_teardown(osquery_cqueue_t *queue);
 /** @brief Initialize a circular queue.
  *
  *  Initializes a circular queue given a preallocated buffer of a given size.
+ *  The buffer is split into equally sized queues, one for each CPU.
  *
  *  @param queue The circular queue structure to initialize.
  *  @param buffer The buffer to use in the queue.
@@ -99,35 +113,38 @@ void osquery_cqueue_init(osquery_cqueue_t *queue, void *buffer, size_t size);
 void osquery_cqueue_destroy(osquery_cqueue_t *queue);
 
 
-/** @brief Advance the read head in the buffer.
+/** @brief Advance the read head in a CPU's queue.
  *
  *  @param queue The circular queue structure to advance the read head in.
+ *  @param cpu The index of the CPU queue.
  *  @param read_offset Offset of pointer to new location of read head.
  *  @param max_read_offset (Output) Output the offset of the max_read pointer.
  *  @return Return negative on failure (invalid offset).
  */
-int osquery_cqueue_advance_read(osquery_cqueue_t *queue, size_t read_offset,
-                                size_t *max_read_offset);
+int osquery_cqueue_advance_read(osquery_cqueue_t *queue, uint32_t cpu,
+                                size_t read_offset, size_t *max_read_offset);
 
 
-/** @brief Find the position of the max_read pointer.  Block if buffer is empty.
+/** @brief Block until any CPU's queue has data.
  *
- *  @param queue The queue to find the offset of the max_read pointer in.
- *  @return Return offset of max_read pointer.  Negative on failure.
+ *  @param queue The queue to wait for data in.
+ *  @return Return 0 when data is available.  Negative on failure.
  */
 ssize_t osquery_cqueue_wait_for_data(osquery_cqueue_t *queue);
 
-/** @brief Returns if the cqueue has dropped data.
+/** @brief Returns if a CPU's queue has dropped data.
  *
- *  Returns whether data has been dropped since the last call of this function.
+ *  Returns the number of drops since the last call of this function.
  *
  *  @param queue The cqueue to look for dropped data in.
- *  @return 0 for no data dropped 1 for dropped data.
+ *  @param cpu The index of the CPU queue.
+ *  @return The number of drops, negative on failure.
  */
-int osquery_cqueue_dropped_data(osquery_cqueue_t *queue);
+int osquery_cqueue_dropped_data(osquery_cqueue_t *queue, uint32_t cpu);
 
 /** @brief Reserve space to store an event in the queue.
  *
+ *  Space is reserved in the queue of the current CPU.
  *  This gives you a brief moment to write data to the returned space.
  *  NOTE: You must call the commit function on your pointer shortly after
  *  reserving it.  Otherwise the buffer will become deadlocked.
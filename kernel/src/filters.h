@@ -0,0 +1,102 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <feeds.h>
+
+#include <sys/queue.h>
+
+#include <kern/locks.h>
+#include <libkern/OSMalloc.h>
+
+/** @brief A path prefix within a filter.
+ */
+typedef struct osquery_filter_path {
+  osquery_file_action_t actions;
+  size_t length;
+  SLIST_ENTRY(osquery_filter_path) next;
+
+  // The prefix is the last member, length bytes and a terminating null.
+  char path[0];
+} osquery_filter_path_t;
+
+SLIST_HEAD(osquery_filter_path_list, osquery_filter_path);
+
+/** @brief The filters of a publisher, evaluated before an event is reserved.
+ *
+ *  The daemon pushes filters with OSQUERY_IOCTL_FILTER, the ioctl lock
+ *  serializes updates. Callbacks take the filter's lock shared, so checking
+ *  an event does not wait for other callbacks.
+ */
+typedef struct {
+  lck_grp_t *lck_grp;
+  lck_rw_t *lck;
+  OSMallocTag malloc_tag;
+
+  /// The union of the actions of every path, read without the lock.
+  osquery_file_action_t actions;
+
+  /// Real uids, every user when empty.
+  uint64_t uids[OSQUERY_FILTER_MAX_UIDS];
+  size_t uid_count;
+
+  /// File event path prefixes.
+  struct osquery_filter_path_list paths;
+  size_t path_count;
+
+  /// Executable path prefixes enqueued, every executable when empty.
+  struct osquery_filter_path_list allow;
+  size_t allow_count;
+
+  /// Executable path prefixes never enqueued.
+  struct osquery_filter_path_list deny;
+  size_t deny_count;
+} osquery_filter_t;
+
+/** @brief Allocate the filter's lock and memory tag, if not yet allocated.
+ *
+ *  @return 0 on success, negative on failure.
+ */
+int osquery_filter_setup(osquery_filter_t *filter, const char *name);
+
+/** @brief Free the filters, the lock and the memory tag.
+ *
+ *  Callbacks must no longer be able to check the filter.
+ */
+void osquery_filter_teardown(osquery_filter_t *filter);
+
+/** @brief Apply an OSQUERY_IOCTL_FILTER request.
+ *
+ *  @return 0 on success, negative if the filter is full or invalid.
+ */
+int osquery_filter_update(osquery_filter_t *filter,
+                          const osquery_filter_args_t *args);
+
+/** @brief Check a file event, 1 if it should be enqueued.
+ *
+ *  A file event is enqueued if it matches a path prefix with the action.
+ */
+int osquery_filter_file(osquery_filter_t *filter,
+                        const char *path,
+                        osquery_file_action_t action,
+                        uint64_t uid);
+
+/** @brief Check the user of a process event, 1 if it should be enqueued.
+ */
+int osquery_filter_uid(osquery_filter_t *filter, uint64_t uid);
+
+/** @brief Check if the executable path is needed to check a process event.
+ */
+int osquery_filter_has_exec(osquery_filter_t *filter);
+
+/** @brief Check the executable of a process event, 1 if it should be enqueued.
+ */
+int osquery_filter_exec(osquery_filter_t *filter, const char *path);
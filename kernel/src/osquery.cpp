@@ -133,23 +133,54 @@ static int subscribe_to_event(osquery_event_t event, int subscribe) {
   return 0;
 }
 
+static int filter_event(const osquery_filter_args_t *args) {
+  if (osquery.buffer == NULL) {
+    return -EINVAL;
+  }
+  if (!(OSQUERY_NULL_EVENT < args->event && args->event < OSQUERY_NUM_EVENTS)) {
+    return -EINVAL;
+  }
+  if (!osquery_publishers[args->event] ||
+      !osquery_publishers[args->event]->filter) {
+    return -EINVAL;
+  }
+
+  return osquery_publishers[args->event]->filter(args);
+}
+
 static int update_user_kernel_buffer(int options,
-                                     size_t read_offset,
-                                     size_t *max_read_offset,
+                                     size_t *read_offsets,
+                                     size_t *max_read_offsets,
                                      int *drops) {
-  if (osquery_cqueue_advance_read(
-          &osquery.cqueue, read_offset, max_read_offset)) {
-    return -EINVAL;
+  // Each CPU queue is advanced independently, user space merges the events.
+  for (uint32_t cpu = 0; cpu < osquery.cqueue.cpu_count; cpu++) {
+    if (osquery_cqueue_advance_read(&osquery.cqueue,
+                                    cpu,
+                                    read_offsets[cpu],
+                                    &max_read_offsets[cpu])) {
+      return -EINVAL;
+    }
   }
+
   if (!(options & OSQUERY_OPTIONS_NO_BLOCK)) {
-    ssize_t offset = 0;
-    if ((offset = osquery_cqueue_wait_for_data(&osquery.cqueue)) < 0) {
+    if (osquery_cqueue_wait_for_data(&osquery.cqueue) < 0) {
       return -EINVAL;
     }
 
-    *max_read_offset = offset;
+    // Data is readable in at least one queue, collect every max read.
+    for (uint32_t cpu = 0; cpu < osquery.cqueue.cpu_count; cpu++) {
+      if (osquery_cqueue_advance_read(&osquery.cqueue,
+                                      cpu,
+                                      read_offsets[cpu],
+                                      &max_read_offsets[cpu])) {
+        return -EINVAL;
+      }
+    }
+  }
+
+  for (uint32_t cpu = 0; cpu < osquery.cqueue.cpu_count; cpu++) {
+    drops[cpu] = osquery_cqueue_dropped_data(&osquery.cqueue, cpu);
   }
-  *drops = osquery_cqueue_dropped_data(&osquery.cqueue);
   return 0;
 }
 
@@ -301,6 +332,7 @@ static int osquery_ioctl(
 
   int err = 0;
   osquery_subscription_args_t *sub = NULL;
+  osquery_filter_args_t *filter = NULL;
   osquery_buf_sync_args_t *sync = NULL;
   osquery_buf_allocate_args_t *alloc = NULL;
 
@@ -316,6 +348,14 @@ static int osquery_ioctl(
     }
     break;
 
+  // Daemon is pushing a filter evaluated before events are enqueued.
+  case OSQUERY_IOCTL_FILTER:
+    filter = (osquery_filter_args_t *)data;
+    if ((err = filter_event(filter))) {
+      goto error_exit;
+    }
+    break;
+
   // Daemon is requesting a synchronization of readable queue space.
   case OSQUERY_IOCTL_BUF_SYNC:
     // The queue buffer cannot be synchronized if it has not been allocated.
@@ -328,9 +368,9 @@ static int osquery_ioctl(
     lck_mtx_unlock(osquery.mtx);
     sync = (osquery_buf_sync_args_t *)data;
     if ((err = update_user_kernel_buffer(sync->options,
-                                         sync->read_offset,
-                                         &(sync->max_read_offset),
-                                         &(sync->drops)))) {
+                                         sync->read_offsets,
+                                         sync->max_read_offsets,
+                                         sync->drops))) {
       lck_mtx_lock(osquery.mtx);
       goto error_exit;
     }
@@ -358,6 +398,8 @@ static int osquery_ioctl(
     if ((err = allocate_user_kernel_buffer(alloc->size, &(alloc->buffer)))) {
       goto error_exit;
     }
+    alloc->cpus = osquery.cqueue.cpu_count;
+    alloc->cpu_size = osquery.cqueue.cpu_size;
 
     dbg_printf(
         "IOCTL alloc: size %lu, location %p\n", alloc->size, alloc->buffer);
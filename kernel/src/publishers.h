@@ -31,12 +31,22 @@ typedef int (*osquery_subscriber_t)(osquery_cqueue_t *queue);
  *  @return Void.
  */
 typedef void (*osquery_unsubscriber_t)();
+/** @brief Filter function type.
+ *
+ *  Functions of this type apply an OSQUERY_IOCTL_FILTER request. A publisher
+ *  checks its filters before reserving an event in the queue.
+ *
+ *  @param args The filter request.
+ *  @return 0 on success, negative on failure.
+ */
+typedef int (*osquery_filterer_t)(const osquery_filter_args_t *args);
 
 /** @brief A kernel publisher must provide the following function pointers.
  */
 typedef struct {
   osquery_subscriber_t subscribe;
   osquery_unsubscriber_t unsubscribe;
+  osquery_filterer_t filter;
 } osquery_kernel_event_publisher_t;
 
 //
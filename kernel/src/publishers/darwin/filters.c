@@ -0,0 +1,233 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/systm.h>
+
+#include "filters.h"
+
+static void free_paths(osquery_filter_t *filter,
+                       struct osquery_filter_path_list *list) {
+  while (!SLIST_EMPTY(list)) {
+    osquery_filter_path_t *entry = SLIST_FIRST(list);
+    SLIST_REMOVE_HEAD(list, next);
+    OSFree(entry,
+           sizeof(osquery_filter_path_t) + entry->length + 1,
+           filter->malloc_tag);
+  }
+}
+
+static void clear_filter(osquery_filter_t *filter) {
+  free_paths(filter, &filter->paths);
+  free_paths(filter, &filter->allow);
+  free_paths(filter, &filter->deny);
+  filter->path_count = 0;
+  filter->allow_count = 0;
+  filter->deny_count = 0;
+  filter->uid_count = 0;
+  filter->actions = OSQUERY_FILE_ACTION_NONE;
+}
+
+static int add_path(osquery_filter_t *filter,
+                    struct osquery_filter_path_list *list,
+                    size_t *count,
+                    const char *path,
+                    osquery_file_action_t actions) {
+  size_t length = strnlen(path, MAXPATHLEN);
+  if (length == 0 || length == MAXPATHLEN) {
+    return -EINVAL;
+  }
+
+  // A repeated prefix adds its actions to the existing entry.
+  osquery_filter_path_t *entry = NULL;
+  SLIST_FOREACH(entry, list, next) {
+    if (entry->length == length && strncmp(entry->path, path, length) == 0) {
+      entry->actions |= actions;
+      return 0;
+    }
+  }
+
+  if (*count >= OSQUERY_FILTER_MAX_PATHS) {
+    return -ENOMEM;
+  }
+  entry =
+      OSMalloc(sizeof(osquery_filter_path_t) + length + 1, filter->malloc_tag);
+  if (entry == NULL) {
+    return -ENOMEM;
+  }
+  entry->actions = actions;
+  entry->length = length;
+  memcpy(entry->path, path, length);
+  entry->path[length] = '\0';
+  SLIST_INSERT_HEAD(list, entry, next);
+  (*count)++;
+  return 0;
+}
+
+/// Executable prefixes have no actions, they are matched with NONE.
+static int match_path(struct osquery_filter_path_list *list,
+                      const char *path,
+                      osquery_file_action_t action) {
+  osquery_filter_path_t *entry = NULL;
+  SLIST_FOREACH(entry, list, next) {
+    if ((action == OSQUERY_FILE_ACTION_NONE || (entry->actions & action)) &&
+        strncmp(path, entry->path, entry->length) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static int match_uid(osquery_filter_t *filter, uint64_t uid) {
+  if (filter->uid_count == 0) {
+    return 1;
+  }
+  for (size_t i = 0; i < filter->uid_count; i++) {
+    if (filter->uids[i] == uid) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int osquery_filter_setup(osquery_filter_t *filter, const char *name) {
+  if (filter->lck != NULL) {
+    return 0;
+  }
+
+  filter->malloc_tag = OSMalloc_Tagalloc(name, OSMT_DEFAULT);
+  if (filter->malloc_tag == NULL) {
+    return -ENOMEM;
+  }
+  filter->lck_grp = lck_grp_alloc_init(name, LCK_GRP_ATTR_NULL);
+  filter->lck = lck_rw_alloc_init(filter->lck_grp, LCK_ATTR_NULL);
+  if (filter->lck == NULL) {
+    lck_grp_free(filter->lck_grp);
+    filter->lck_grp = NULL;
+    OSMalloc_Tagfree(filter->malloc_tag);
+    filter->malloc_tag = NULL;
+    return -ENOMEM;
+  }
+
+  SLIST_INIT(&filter->paths);
+  SLIST_INIT(&filter->allow);
+  SLIST_INIT(&filter->deny);
+  clear_filter(filter);
+  return 0;
+}
+
+void osquery_filter_teardown(osquery_filter_t *filter) {
+  if (filter->lck == NULL) {
+    return;
+  }
+
+  clear_filter(filter);
+  lck_rw_free(filter->lck, filter->lck_grp);
+  filter->lck = NULL;
+  lck_grp_free(filter->lck_grp);
+  filter->lck_grp = NULL;
+  OSMalloc_Tagfree(filter->malloc_tag);
+  filter->malloc_tag = NULL;
+}
+
+int osquery_filter_update(osquery_filter_t *filter,
+                          const osquery_filter_args_t *args) {
+  if (filter->lck == NULL) {
+    return -EINVAL;
+  }
+
+  int err = 0;
+  lck_rw_lock_exclusive(filter->lck);
+  switch (args->type) {
+  case OSQUERY_FILTER_CLEAR:
+    clear_filter(filter);
+    break;
+  case OSQUERY_FILTER_PATH:
+    err = add_path(filter,
+                   &filter->paths,
+                   &filter->path_count,
+                   args->path,
+                   args->actions);
+    if (err == 0) {
+      filter->actions |= args->actions;
+    }
+    break;
+  case OSQUERY_FILTER_UID:
+    if (match_uid(filter, args->uid) && filter->uid_count > 0) {
+      break;
+    }
+    if (filter->uid_count >= OSQUERY_FILTER_MAX_UIDS) {
+      err = -ENOMEM;
+      break;
+    }
+    filter->uids[filter->uid_count++] = args->uid;
+    break;
+  case OSQUERY_FILTER_EXEC_ALLOW:
+    err = add_path(filter,
+                   &filter->allow,
+                   &filter->allow_count,
+                   args->path,
+                   OSQUERY_FILE_ACTION_NONE);
+    break;
+  case OSQUERY_FILTER_EXEC_DENY:
+    err = add_path(filter,
+                   &filter->deny,
+                   &filter->deny_count,
+                   args->path,
+                   OSQUERY_FILE_ACTION_NONE);
+    break;
+  default:
+    err = -EINVAL;
+    break;
+  }
+  lck_rw_unlock_exclusive(filter->lck);
+  return err;
+}
+
+int osquery_filter_file(osquery_filter_t *filter,
+                        const char *path,
+                        osquery_file_action_t action,
+                        uint64_t uid) {
+  // Most file operations are not subscribed, check without the lock first.
+  if (!(filter->actions & action) || path == NULL) {
+    return 0;
+  }
+
+  lck_rw_lock_shared(filter->lck);
+  int match =
+      match_uid(filter, uid) && match_path(&filter->paths, path, action);
+  lck_rw_unlock_shared(filter->lck);
+  return match;
+}
+
+int osquery_filter_uid(osquery_filter_t *filter, uint64_t uid) {
+  lck_rw_lock_shared(filter->lck);
+  int match = match_uid(filter, uid);
+  lck_rw_unlock_shared(filter->lck);
+  return match;
+}
+
+int osquery_filter_has_exec(osquery_filter_t *filter) {
+  lck_rw_lock_shared(filter->lck);
+  int has_exec = (filter->allow_count > 0 || filter->deny_count > 0);
+  lck_rw_unlock_shared(filter->lck);
+  return has_exec;
+}
+
+int osquery_filter_exec(osquery_filter_t *filter, const char *path) {
+  lck_rw_lock_shared(filter->lck);
+  int match = 1;
+  if (match_path(&filter->deny, path, OSQUERY_FILE_ACTION_NONE)) {
+    match = 0;
+  } else if (filter->allow_count > 0) {
+    match = match_path(&filter->allow, path, OSQUERY_FILE_ACTION_NONE);
+  }
+  lck_rw_unlock_shared(filter->lck);
+  return match;
+}
@@ -12,29 +12,17 @@
 #include <sys/systm.h>
 #include <sys/kauth.h>
 #include <sys/vnode.h>
-#include <sys/queue.h>
-
-#include <libkern/OSMalloc.h>
 
 #define TAGNAME "com.facebook.security.osquery.file_events"
 
+#include "filters.h"
 #include "publishers.h"
 
 static osquery_cqueue_t *cqueue = NULL;
 static kauth_listener_t fileop_listener = NULL;
 
-typedef struct subscription {
-  osquery_file_event_subscription_t subscription;
-  size_t pathlen;
-  SLIST_ENTRY(subscription) next;
-} subscription_t;
-
-SLIST_HEAD(subscription_list, subscription);
-static struct subscription_list sub_list = SLIST_HEAD_INITIALIZER(sub_list);
-
-static osquery_file_action_t sub_actions = OSQUERY_FILE_ACTION_NONE;
-
-static OSMallocTag malloc_tag = NULL;
+/// Path prefixes and uids pushed by the daemon, see OSQUERY_FILTER_PATH.
+static osquery_filter_t filter = {0};
 
 static int fileop_scope_callback(kauth_cred_t credential,
                                  void *idata,
@@ -56,91 +44,69 @@ static int fileop_scope_callback(kauth_cred_t credential,
 
   vnode_t vp = (vnode_t)arg0;
   char *path = (char *)arg1;
-  if (sub_actions & file_action && vp != NULL && path != NULL) {
-    int subscribed_to_event = 0;
-    subscription_t *sub = NULL;
-    SLIST_FOREACH(sub, &sub_list, next) {
-      if (sub->subscription.actions & file_action &&
-          strncmp(path, sub->subscription.path, sub->pathlen) == 0) {
-        subscribed_to_event = 1;
-        break;
-      }
-    }
-    if (subscribed_to_event) {
-      // Someone is using a file in a way that we are subscribed to.
-      int path_len = MAXPATHLEN;
-
-      osquery_file_event_t *e = (osquery_file_event_t *)osquery_cqueue_reserve(
-          cqueue, OSQUERY_FILE_EVENT, sizeof(osquery_file_event_t));
-      if (e == NULL) {
-        // Failed to reserve space for the event.
-        return KAUTH_RESULT_DEFER;
-      }
-
-      e->action = OSQUERY_FILE_ACTION_NONE;
-      if (action == KAUTH_FILEOP_OPEN) {
-        e->action = OSQUERY_FILE_ACTION_OPEN;
-      } else if (arg2 & KAUTH_FILEOP_CLOSE_MODIFIED) {
-        e->action = OSQUERY_FILE_ACTION_CLOSE_MODIFIED;
-      } else {
-        e->action = OSQUERY_FILE_ACTION_CLOSE;
-      }
-
-      e->pid = proc_selfpid();
-      e->ppid = proc_selfppid();
-      e->owner_uid = 0;
-      e->owner_gid = 0;
-      e->mode = -1;
-      vfs_context_t context = vfs_context_create(NULL);
-      if (context) {
-        struct vnode_attr vattr = {0};
-        VATTR_INIT(&vattr);
-        VATTR_WANTED(&vattr, va_uid);
-        VATTR_WANTED(&vattr, va_gid);
-        VATTR_WANTED(&vattr, va_mode);
-        VATTR_WANTED(&vattr, va_create_time);
-        VATTR_WANTED(&vattr, va_access_time);
-        VATTR_WANTED(&vattr, va_modify_time);
-        VATTR_WANTED(&vattr, va_change_time);
-
-        if (vnode_getattr(vp, &vattr, context) == 0) {
-          e->owner_uid = vattr.va_uid;
-          e->owner_gid = vattr.va_gid;
-          e->mode = vattr.va_mode;
-          e->create_time = vattr.va_create_time.tv_sec;
-          e->access_time = vattr.va_access_time.tv_sec;
-          e->modify_time = vattr.va_modify_time.tv_sec;
-          e->change_time = vattr.va_change_time.tv_sec;
-        }
-
-        vfs_context_rele(context);
-      }
-
-      e->uid = kauth_cred_getruid(credential);
-      e->euid = kauth_cred_getuid(credential);
-
-      e->gid = kauth_cred_getrgid(credential);
-      e->egid = kauth_cred_getgid(credential);
-
-      vn_getpath(vp, e->path, &path_len);
-
-      osquery_cqueue_commit(cqueue, e);
+  if (vp == NULL ||
+      !osquery_filter_file(
+          &filter, path, file_action, kauth_cred_getruid(credential))) {
+    return KAUTH_RESULT_DEFER;
+  }
+
+  // Someone is using a file in a way that we are subscribed to.
+  int path_len = MAXPATHLEN;
+
+  osquery_file_event_t *e = (osquery_file_event_t *)osquery_cqueue_reserve(
+      cqueue, OSQUERY_FILE_EVENT, sizeof(osquery_file_event_t));
+  if (e == NULL) {
+    // Failed to reserve space for the event.
+    return KAUTH_RESULT_DEFER;
+  }
+
+  e->action = file_action;
+
+  e->pid = proc_selfpid();
+  e->ppid = proc_selfppid();
+  e->owner_uid = 0;
+  e->owner_gid = 0;
+  e->mode = -1;
+  vfs_context_t context = vfs_context_create(NULL);
+  if (context) {
+    struct vnode_attr vattr = {0};
+    VATTR_INIT(&vattr);
+    VATTR_WANTED(&vattr, va_uid);
+    VATTR_WANTED(&vattr, va_gid);
+    VATTR_WANTED(&vattr, va_mode);
+    VATTR_WANTED(&vattr, va_create_time);
+    VATTR_WANTED(&vattr, va_access_time);
+    VATTR_WANTED(&vattr, va_modify_time);
+    VATTR_WANTED(&vattr, va_change_time);
+
+    if (vnode_getattr(vp, &vattr, context) == 0) {
+      e->owner_uid = vattr.va_uid;
+      e->owner_gid = vattr.va_gid;
+      e->mode = vattr.va_mode;
+      e->create_time = vattr.va_create_time.tv_sec;
+      e->access_time = vattr.va_access_time.tv_sec;
+      e->modify_time = vattr.va_modify_time.tv_sec;
+      e->change_time = vattr.va_change_time.tv_sec;
     }
+
+    vfs_context_rele(context);
   }
+
+  e->uid = kauth_cred_getruid(credential);
+  e->euid = kauth_cred_getuid(credential);
+
+  e->gid = kauth_cred_getrgid(credential);
+  e->egid = kauth_cred_getgid(credential);
+
+  vn_getpath(vp, e->path, &path_len);
+
+  osquery_cqueue_commit(cqueue, e);
   return KAUTH_RESULT_DEFER;
 }
 
 static int subscribe(osquery_cqueue_t *queue) {
-  if (malloc_tag == NULL) {
-    malloc_tag = OSMalloc_Tagalloc(TAGNAME, OSMT_DEFAULT);
-    if (malloc_tag == NULL) {
-      return -1;
-    }
-  }
-
-  int err = 0;
-  subscription_t *sub = OSMalloc(sizeof(subscription_t), malloc_tag);
-  if (sub == NULL) {
+  // Nothing is enqueued until the daemon pushes a path prefix.
+  if (osquery_filter_setup(&filter, TAGNAME)) {
     return -1;
   }
 
@@ -150,53 +116,34 @@ static int subscribe(osquery_cqueue_t *queue) {
         kauth_listen_scope(KAUTH_SCOPE_FILEOP, fileop_scope_callback, NULL);
   }
   if (fileop_listener == NULL) {
-    err = -1;
-    goto error_exit;
-  }
-
-  sub->pathlen = strnlen(sub->subscription.path, MAXPATHLEN);
-
-  // Check if we are already subscribed to this event.
-  subscription_t *sub_entry = NULL;
-  SLIST_FOREACH(sub_entry, &sub_list, next) {
-    if (sub_entry->subscription.actions == sub->subscription.actions &&
-        strncmp(sub_entry->subscription.path,
-                sub->subscription.path,
-                MAXPATHLEN) == 0) {
-      // Already subscribed.
-      err = 0;
-      goto error_exit;
-    }
+    return -1;
   }
-
-  sub_actions |= sub->subscription.actions;
-
-  SLIST_INSERT_HEAD(&sub_list, sub, next);
   return 0;
-error_exit:
-  OSFree(sub, sizeof(subscription_t), malloc_tag);
-  return err;
 }
 
 static void unsubscribe() {
+  // The scope is unlistened after every callback in progress returns.
   if (fileop_listener) {
     kauth_unlisten_scope(fileop_listener);
     fileop_listener = NULL;
   }
 
-  while (!SLIST_EMPTY(&sub_list)) {
-    subscription_t *sub = SLIST_FIRST(&sub_list);
-    SLIST_REMOVE_HEAD(&sub_list, next);
-    OSFree(sub, sizeof(subscription_t), malloc_tag);
-  }
+  osquery_filter_teardown(&filter);
+}
 
-  if (malloc_tag) {
-    OSMalloc_Tagfree(malloc_tag);
-    malloc_tag = NULL;
+static int update_filter(const osquery_filter_args_t *args) {
+  switch (args->type) {
+  case OSQUERY_FILTER_CLEAR:
+  case OSQUERY_FILTER_PATH:
+  case OSQUERY_FILTER_UID:
+    return osquery_filter_update(&filter, args);
+  default:
+    // File events are not filtered by the executable.
+    return -EINVAL;
   }
-
-  sub_actions = OSQUERY_FILE_ACTION_NONE;
 }
 
 osquery_kernel_event_publisher_t kernel_file_events_publisher = {
-    .subscribe = &subscribe, .unsubscribe = &unsubscribe};
+    .subscribe = &subscribe,
+    .unsubscribe = &unsubscribe,
+    .filter = &update_filter};
@@ -17,10 +17,18 @@
 #include <security/mac.h>
 #include <security/mac_policy.h>
 
+#include <libkern/OSMalloc.h>
+
+#define TAGNAME "com.facebook.security.osquery.process_events"
+
+#include "filters.h"
 #include "publishers.h"
 
 static osquery_cqueue_t *cqueue = NULL;
 
+/// Uids and executable prefixes pushed by the daemon.
+static osquery_filter_t filter = {0};
+
 #define MAX_VECTOR_LENGTH 4096
 
 static inline int str_num(char *buf, size_t length) {
@@ -49,11 +57,27 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
                                              size_t macpolicyattrlen,
                                              int *disjointp) {
   int path_len = MAXPATHLEN;
+  char *path = NULL;
 
   if (!vnode_isreg(vp)) {
     goto error_exit;
   }
 
+  // Filtered executions are dropped before the event is reserved.
+  if (!osquery_filter_uid(&filter, kauth_cred_getruid(new_cred))) {
+    goto error_exit;
+  }
+  if (osquery_filter_has_exec(&filter)) {
+    path = OSMalloc(MAXPATHLEN, filter.malloc_tag);
+    if (path == NULL) {
+      goto error_exit;
+    }
+    if (vn_getpath(vp, path, &path_len) != 0 ||
+        !osquery_filter_exec(&filter, path)) {
+      goto error_exit;
+    }
+  }
+
   // Determine address of image_params based off of csflags pointer. (HACKY)
   struct image_params *img =
       (struct image_params *)((char *)csflags -
@@ -129,10 +153,17 @@ static int process_cred_label_update_execvew(kauth_cred_t old_cred,
   e->gid = kauth_cred_getrgid(new_cred);
   e->egid = kauth_cred_getgid(new_cred);
 
-  vn_getpath(vp, e->path, &path_len);
+  if (path != NULL) {
+    memcpy(e->path, path, path_len);
+  } else {
+    vn_getpath(vp, e->path, &path_len);
+  }
 
   osquery_cqueue_commit(cqueue, e);
 error_exit:
+  if (path != NULL) {
+    OSFree(path, MAXPATHLEN, filter.malloc_tag);
+  }
 
   return 0;
 }
@@ -158,6 +189,10 @@ static int subscribe(osquery_cqueue_t *queue) {
     return -1;
   }
 
+  if (osquery_filter_setup(&filter, TAGNAME)) {
+    return -1;
+  }
+
   mac_policy_register(&policy_conf, &handle, NULL);
 
   return 0;
@@ -168,7 +203,19 @@ static void unsubscribe() {
     mac_policy_unregister(handle);
     handle = 0;
   }
+
+  osquery_filter_teardown(&filter);
+}
+
+static int update_filter(const osquery_filter_args_t *args) {
+  if (args->type == OSQUERY_FILTER_PATH) {
+    // Process events are filtered by the executable, not by path.
+    return -EINVAL;
+  }
+  return osquery_filter_update(&filter, args);
 }
 
 osquery_kernel_event_publisher_t process_events_publisher = {
-    .subscribe = &subscribe, .unsubscribe = &unsubscribe};
+    .subscribe = &subscribe,
+    .unsubscribe = &unsubscribe,
+    .filter = &update_filter};
@@ -21,6 +21,8 @@ struct InternalExtensionInfo {
   2:string version,
   3:string sdk_version,
   4:string min_sdk_version,
+  /// The name of a shared memory region offered by the extension.
+  5:optional string shared_memory,
 }
 
 /// Unique ID for each extension.
@@ -44,6 +46,8 @@ struct ExtensionStatus {
   2:string message,
   /// Add a thrift Status parameter identifying the request/response.
   3:ExtensionRouteUUID uuid,
+  /// Set by registerExtension if the offered shared memory was opened.
+  4:optional string shared_memory,
 }
 
 struct ExtensionResponse {
@@ -51,6 +55,48 @@ struct ExtensionResponse {
   2:ExtensionPluginResponse response,
 }
 
+/// A registry response with the column names sent once.
+struct ExtensionColumnarResponse {
+  1:ExtensionStatus status,
+  /// The sorted column names shared by every row.
+  2:list<string> columns,
+  /// Each row's values, in the order of the column names.
+  3:list<list<string>> rows,
+  /// Rows with differing columns are sent in the row-map representation.
+  4:ExtensionPluginResponse response,
+  /// Set by fetchTable if the table cursor may have more rows.
+  5:bool more,
+  /// A large response may be written to shared memory, instead of the rows.
+  6:optional i64 shared_offset,
+  7:optional i64 shared_length,
+}
+
+/// An open table cursor, used to fetch the table's rows in batches.
+struct ExtensionTableCursor {
+  1:ExtensionStatus status,
+  2:i64 cursor,
+}
+
+/// A table constraint, a SQL operator and the expression it is compared to.
+struct InternalConstraint {
+  1:i32 op,
+  2:string expr,
+}
+
+/// A column's constraints and their type affinity.
+struct InternalConstraintList {
+  1:list<InternalConstraint> constraints,
+  2:string affinity,
+}
+
+/// The query context given to an extension table generating rows.
+struct InternalQueryContext {
+  /// Each constrained column's list of constraints.
+  1:map<string, InternalConstraintList> constraints,
+  /// The columns the query reads, if known, other columns may be skipped.
+  2:optional set<string> used_columns,
+}
+
 exception ExtensionException {
   1:i32 code,
   2:string message,
@@ -68,6 +114,26 @@ service Extension {
     2:string item,
     /// The thrift-equivilent of an osquery::PluginRequest.
     3:ExtensionPluginRequest request),
+  /// Call a registry plugin, receiving the response in columns (table rows).
+  ExtensionColumnarResponse callColumnar(
+    1:string registry,
+    2:string item,
+    3:ExtensionPluginRequest request),
+  /// Generate a table's rows using a structured query context.
+  ExtensionColumnarResponse generateTable(
+    1:string table,
+    2:InternalQueryContext context),
+  /// Start generating a table's rows, the rows are fetched from the cursor.
+  ExtensionTableCursor openTable(
+    1:string table,
+    2:InternalQueryContext context),
+  /// Fetch up to a number of rows from a table cursor.
+  ExtensionColumnarResponse fetchTable(
+    1:i64 cursor,
+    2:i32 max_rows),
+  /// Stop generating a table's rows before the cursor is exhausted.
+  void closeTable(
+    1:i64 cursor),
   /// Request that an extension shutdown (does not apply to managers).
   void shutdown(),
 }
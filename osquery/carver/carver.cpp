@@ -0,0 +1,508 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// clang-format off
+// This must be here to prevent a WinSock.h exists error
+#include "osquery/remote/transports/tls.h"
+// clang-format on
+
+#include <algorithm>
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+
+#include <boost/filesystem.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/carver/carver.h"
+#include "osquery/core/conversions.h"
+#include "osquery/core/json.h"
+#include "osquery/remote/requests.h"
+#include "osquery/remote/serializers/json.h"
+#include "osquery/remote/utility.h"
+
+namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+DECLARE_uint64(read_max);
+
+FLAG(bool, disable_carver, true, "Disable the osquery file carver");
+
+FLAG(string,
+     carver_start_endpoint,
+     "",
+     "TLS/HTTPS endpoint that starts a file carve upload session");
+
+FLAG(string,
+     carver_continue_endpoint,
+     "",
+     "TLS/HTTPS endpoint that receives each block of a file carve");
+
+FLAG(uint64,
+     carver_block_size,
+     256 * 1024,
+     "Size of each uncompressed block of a file carve upload");
+
+FLAG(bool,
+     carver_compression,
+     true,
+     "Compress each block of a file carve upload");
+
+const std::string kCarveStatusPending = "PENDING";
+const std::string kCarveStatusUploading = "UPLOADING";
+const std::string kCarveStatusSuccess = "SUCCESS";
+const std::string kCarveStatusFailed = "FAILED";
+
+/// The size of a tar header and the unit tar content is padded to.
+const size_t kTarBlockSize = 512;
+
+/// The largest file size a ustar header represents, 11 octal digits.
+const size_t kTarMaxFileSize = 077777777777ULL;
+
+/// The largest read from a carved file given to the block predicate.
+const size_t kCarverReadSize = 64 * 1024;
+
+/// Consecutive failed requests before a carve is marked failed.
+const size_t kCarverMaxFailures = 10;
+
+/// The pause after a failed request, multiplied by the failure count.
+const size_t kCarverRetryInterval = 30 * 1000;
+
+/// Only the first request to resume carves starts their services.
+static std::atomic<bool> kCarvesResumed{false};
+
+static size_t roundTarBlock(size_t size) {
+  return ((size + kTarBlockSize - 1) / kTarBlockSize) * kTarBlockSize;
+}
+
+static std::string tarOctal(size_t value, size_t width) {
+  std::ostringstream output;
+  output << std::oct << std::setw(width) << std::setfill('0') << value;
+  return output.str();
+}
+
+/// Create the ustar header for a carved file.
+static std::string tarHeader(const CarveFile& file) {
+  std::string header(kTarBlockSize, '\0');
+  auto put = ([&header](size_t offset, size_t width, const std::string& v) {
+    header.replace(offset, std::min(v.size(), width), v, 0, width);
+  });
+
+  // Names longer than 100 characters are split at a directory separator.
+  auto name = file.path;
+  while (!name.empty() && (name[0] == '/' || name[0] == '\\')) {
+    name.erase(0, 1);
+  }
+  std::string prefix;
+  if (name.size() > 100) {
+    auto split = name.rfind('/', 155);
+    if (split != std::string::npos && name.size() - split - 1 <= 100) {
+      prefix = name.substr(0, split);
+      name = name.substr(split + 1);
+    } else {
+      name = name.substr(name.size() - 100);
+    }
+  }
+
+  put(0, 100, name);
+  put(100, 8, tarOctal(0644, 7));
+  put(108, 8, tarOctal(0, 7));
+  put(116, 8, tarOctal(0, 7));
+  put(124, 12, tarOctal(file.size, 11));
+  put(136, 12, tarOctal(file.mtime, 11));
+  put(148, 8, "        ");
+  header[156] = '0';
+  put(257, 6, "ustar");
+  put(263, 2, "00");
+  put(345, 155, prefix);
+
+  // The checksum is computed with its own field filled with spaces.
+  size_t checksum = 0;
+  for (const auto& c : header) {
+    checksum += static_cast<unsigned char>(c);
+  }
+  put(148, 6, tarOctal(checksum, 6));
+  header[154] = '\0';
+  return header;
+}
+
+/// Append a range of a carved file, padded with zeros if it cannot be read.
+static void readCarveRange(const CarveFile& file,
+                           size_t offset,
+                           size_t length,
+                           std::string& block) {
+  auto expected = block.size() + length;
+  if (length > 0) {
+    auto status = readFileBlocks(
+        file.path,
+        std::min(length, kCarverReadSize),
+        true,
+        ([&block](const char* buffer, size_t size) {
+          block.append(buffer, size);
+        }),
+        offset,
+        length);
+    if (!status.ok()) {
+      VLOG(1) << "Cannot read carved file " << file.path << ": "
+              << status.what();
+    }
+  }
+
+  if (block.size() < expected) {
+    VLOG(1) << "Carved file changed size: " << file.path;
+    block.resize(expected, '\0');
+  }
+}
+
+size_t CarveState::size() const {
+  if (!tar) {
+    return (files.empty()) ? 0 : files[0].size;
+  }
+
+  // Each file is a header and padded content, two zero blocks end the tar.
+  size_t total = 2 * kTarBlockSize;
+  for (const auto& file : files) {
+    total += kTarBlockSize + roundTarBlock(file.size);
+  }
+  return total;
+}
+
+size_t CarveState::blockCount() const {
+  if (block_size == 0) {
+    return 1;
+  }
+  return std::max((size() + block_size - 1) / block_size, size_t(1));
+}
+
+Status CarveState::serialize(std::string& json) const {
+  pt::ptree tree;
+  tree.put("guid", guid);
+  tree.put("request_id", request_id);
+  tree.put("time", time);
+  tree.put("status", status);
+  tree.put("session_id", session_id);
+  tree.put("block_size", block_size);
+  tree.put("block_id", block_id);
+  tree.put("tar", tar);
+  tree.put("compressed", compressed);
+
+  pt::ptree file_tree;
+  for (const auto& file : files) {
+    pt::ptree entry;
+    entry.put("path", file.path);
+    entry.put("size", file.size);
+    entry.put("mtime", file.mtime);
+    file_tree.push_back(std::make_pair("", entry));
+  }
+  tree.add_child("files", file_tree);
+
+  std::stringstream output;
+  try {
+    pt::write_json(output, tree, false);
+  } catch (const pt::ptree_error& e) {
+    return Status(1, "Error writing JSON: " + std::string(e.what()));
+  }
+  json = output.str();
+  return Status(0, "OK");
+}
+
+Status CarveState::deserialize(const std::string& json) {
+  pt::ptree tree;
+  try {
+    std::stringstream input;
+    input << json;
+    pt::read_json(input, tree);
+
+    guid = tree.get<std::string>("guid", "");
+    request_id = tree.get<std::string>("request_id", "");
+    time = tree.get<size_t>("time", 0);
+    status = tree.get<std::string>("status", "");
+    session_id = tree.get<std::string>("session_id", "");
+    block_size = tree.get<size_t>("block_size", 0);
+    block_id = tree.get<size_t>("block_id", 0);
+    tar = tree.get<bool>("tar", false);
+    compressed = tree.get<bool>("compressed", false);
+
+    files.clear();
+    for (const auto& entry : tree.get_child("files")) {
+      CarveFile file;
+      file.path = entry.second.get<std::string>("path", "");
+      file.size = entry.second.get<size_t>("size", 0);
+      file.mtime = entry.second.get<size_t>("mtime", 0);
+      files.push_back(std::move(file));
+    }
+  } catch (const pt::ptree_error& e) {
+    return Status(1, "Error parsing JSON: " + std::string(e.what()));
+  }
+
+  if (guid.empty() || files.empty() || block_size == 0) {
+    return Status(1, "Incomplete carve state");
+  }
+  return Status(0, "OK");
+}
+
+Status Carver::create(const std::set<std::string>& paths,
+                      const std::string& request_id,
+                      std::string& guid) {
+  CarveState state;
+  for (const auto& path : paths) {
+    boost::system::error_code ec;
+    if (!fs::is_regular_file(path, ec)) {
+      VLOG(1) << "Cannot carve " << path << ": not a regular file";
+      continue;
+    }
+
+    auto size = static_cast<size_t>(fs::file_size(path, ec));
+    if (ec) {
+      continue;
+    }
+
+    // The blocks are read with readFileBlocks and are subject to its limits.
+    if (size > FLAGS_read_max || size > kTarMaxFileSize) {
+      LOG(WARNING) << "Cannot carve " << path
+                   << " size exceeds limit: " << size;
+      continue;
+    }
+
+    CarveFile file;
+    file.path = path;
+    file.size = size;
+    file.mtime = static_cast<size_t>(fs::last_write_time(path, ec));
+    state.files.push_back(std::move(file));
+  }
+
+  if (state.files.empty()) {
+    return Status(1, "No files to carve");
+  }
+
+  state.guid = generateNewUUID();
+  state.request_id = request_id;
+  state.time = getUnixTime();
+  state.status = kCarveStatusPending;
+  state.block_size = std::max(static_cast<size_t>(FLAGS_carver_block_size),
+                              kTarBlockSize);
+  state.tar = (state.files.size() > 1);
+  state.compressed = FLAGS_carver_compression;
+
+  guid = state.guid;
+  return save(state);
+}
+
+Status Carver::load(const std::string& guid, CarveState& state) {
+  std::string json;
+  auto status = getDatabaseValue(kCarves, guid, json);
+  if (!status.ok()) {
+    return status;
+  }
+  return state.deserialize(json);
+}
+
+Status Carver::save(const CarveState& state) {
+  std::string json;
+  auto status = state.serialize(json);
+  if (!status.ok()) {
+    return status;
+  }
+  return setDatabaseValue(kCarves, state.guid, json);
+}
+
+Status Carver::readBlock(size_t block_id, std::string& block) {
+  auto total = state_.size();
+  auto offset = block_id * state_.block_size;
+  if (block_id >= state_.blockCount()) {
+    return Status(1, "Invalid carve block");
+  }
+
+  auto length = std::min(state_.block_size, total - offset);
+  block.clear();
+  block.reserve(length);
+  if (!state_.tar) {
+    readCarveRange(state_.files[0], offset, length, block);
+    return Status(0, "OK");
+  }
+
+  // Copy the parts of each file's header, content, and padding in the block.
+  auto end = offset + length;
+  size_t position = 0;
+  for (const auto& file : state_.files) {
+    if (position >= end) {
+      break;
+    }
+
+    auto content = position + kTarBlockSize;
+    if (content > offset) {
+      auto first = (offset > position) ? offset - position : 0;
+      auto last = std::min(kTarBlockSize, end - position);
+      block.append(tarHeader(file), first, last - first);
+    }
+
+    auto padding = content + file.size;
+    if (padding > offset && content < end) {
+      auto first = (offset > content) ? offset - content : 0;
+      auto last = std::min(file.size, end - content);
+      readCarveRange(file, first, last - first, block);
+    }
+
+    auto next = content + roundTarBlock(file.size);
+    if (next > offset && padding < end) {
+      auto first = std::max(padding, offset);
+      auto last = std::min(next, end);
+      block.append(last - first, '\0');
+    }
+    position = next;
+  }
+
+  // The two zero blocks that end the archive.
+  block.resize(length, '\0');
+  return Status(0, "OK");
+}
+
+Status Carver::startSession() {
+  pt::ptree params;
+  params.put("carve_id", state_.guid);
+  params.put("request_id", state_.request_id);
+  params.put("block_count", state_.blockCount());
+  params.put("block_size", state_.block_size);
+  params.put("carve_size", state_.size());
+  params.put("archive", (state_.tar) ? "tar" : "none");
+  params.put("compression", (state_.compressed) ? "gzip" : "none");
+  params.put("verb", "POST");
+
+  pt::ptree output;
+  auto status = TLSRequestHelper::go<JSONSerializer>(
+      TLSRequestHelper::makeURI(FLAGS_carver_start_endpoint), params, output);
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto session_id = output.get<std::string>("session_id", "");
+  if (session_id.empty()) {
+    return Status(1, "Carve start response is missing a session_id");
+  }
+
+  state_.session_id = session_id;
+  state_.status = kCarveStatusUploading;
+  return save(state_);
+}
+
+Status Carver::uploadBlock(const std::string& block) {
+  auto data = (state_.compressed) ? compressString(block) : block;
+  if (state_.compressed && data.empty()) {
+    return Status(1, "Cannot compress carve block");
+  }
+
+  pt::ptree params;
+  params.put("session_id", state_.session_id);
+  params.put("block_id", state_.block_id);
+  params.put("data", base64Encode(data));
+  params.put("verb", "POST");
+
+  pt::ptree output;
+  return TLSRequestHelper::go<JSONSerializer>(
+      TLSRequestHelper::makeURI(FLAGS_carver_continue_endpoint),
+      params,
+      output);
+}
+
+void Carver::start() {
+  if (!load(guid_, state_).ok()) {
+    LOG(WARNING) << "Cannot read the state of carve " << guid_;
+    return;
+  }
+
+  size_t failures = 0;
+  while (!interrupted() && (state_.status == kCarveStatusPending ||
+                            state_.status == kCarveStatusUploading)) {
+    Status status;
+    if (state_.session_id.empty()) {
+      status = startSession();
+    } else if (state_.block_id < state_.blockCount()) {
+      // Only one block is held at a time, progress is kept after each.
+      std::string block;
+      status = readBlock(state_.block_id, block);
+      if (status.ok()) {
+        status = uploadBlock(block);
+      }
+      if (status.ok()) {
+        state_.block_id++;
+        status = save(state_);
+      }
+    } else {
+      state_.status = kCarveStatusSuccess;
+      save(state_);
+      LOG(INFO) << "Carve " << guid_ << " uploaded " << state_.blockCount()
+                << " blocks";
+      break;
+    }
+
+    if (status.ok()) {
+      failures = 0;
+      continue;
+    }
+
+    VLOG(1) << "Carve " << guid_ << " request failed: " << status.what();
+    if (++failures >= kCarverMaxFailures) {
+      state_.status = kCarveStatusFailed;
+      save(state_);
+      LOG(WARNING) << "Carve " << guid_ << " failed: " << status.what();
+      break;
+    }
+    pauseMilli(failures * kCarverRetryInterval);
+  }
+}
+
+Status carvePaths(const std::set<std::string>& paths,
+                  const std::string& request_id,
+                  std::string& guid) {
+  if (FLAGS_disable_carver) {
+    return Status(1, "Carver disabled");
+  }
+
+  if (FLAGS_carver_start_endpoint.empty() ||
+      FLAGS_carver_continue_endpoint.empty()) {
+    return Status(1, "Carver endpoints are not configured");
+  }
+
+  auto status = Carver::create(paths, request_id, guid);
+  if (!status.ok()) {
+    return status;
+  }
+  return Dispatcher::addService(std::make_shared<Carver>(guid));
+}
+
+void resumeCarves() {
+  if (FLAGS_disable_carver || kCarvesResumed.exchange(true)) {
+    return;
+  }
+
+  std::vector<std::string> guids;
+  scanDatabaseKeys(kCarves, guids);
+  for (const auto& guid : guids) {
+    CarveState state;
+    if (!Carver::load(guid, state).ok()) {
+      continue;
+    }
+
+    if (state.status == kCarveStatusPending ||
+        state.status == kCarveStatusUploading) {
+      LOG(INFO) << "Resuming carve " << guid << " at block " << state.block_id;
+      Dispatcher::addService(std::make_shared<Carver>(guid));
+    }
+  }
+}
+}
@@ -0,0 +1,165 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <osquery/core.h>
+#include <osquery/dispatcher.h>
+
+namespace osquery {
+
+/// A carve is waiting for a session from the carver start endpoint.
+extern const std::string kCarveStatusPending;
+
+/// A carve has a session and is uploading blocks.
+extern const std::string kCarveStatusUploading;
+
+/// Every block of a carve was uploaded.
+extern const std::string kCarveStatusSuccess;
+
+/// A carve stopped after repeated upload failures.
+extern const std::string kCarveStatusFailed;
+
+/// A file included in a carve, measured when the carve was requested.
+struct CarveFile {
+  std::string path;
+  size_t size{0};
+  size_t mtime{0};
+};
+
+/**
+ * @brief The persistent state of a file carve.
+ *
+ * A carve is an archive of one or more files, a single file is carved as is
+ * and several are packed as a tar. The archive is uploaded in fixed-size
+ * blocks, each compressed separately, so an upload resumes from the next
+ * block after a failure or restart. The state is written to the kCarves
+ * domain after each block.
+ */
+struct CarveState {
+  /// The unique carve identifier.
+  std::string guid;
+
+  /// The distributed query id that requested the carve, if any.
+  std::string request_id;
+
+  /// The UNIX time the carve was requested.
+  size_t time{0};
+
+  /// One of the kCarveStatus values.
+  std::string status;
+
+  /// The upload session returned by the carver start endpoint.
+  std::string session_id;
+
+  /// The size of each uncompressed block of the archive.
+  size_t block_size{0};
+
+  /// The next block to upload.
+  size_t block_id{0};
+
+  /// True if the files are packed as a tar archive.
+  bool tar{false};
+
+  /// True if each block is gzip compressed before it is uploaded.
+  bool compressed{false};
+
+  std::vector<CarveFile> files;
+
+  /// The size of the uncompressed archive.
+  size_t size() const;
+
+  /// The number of blocks uploaded for the archive, at least one.
+  size_t blockCount() const;
+
+  /// Serialize the state as JSON.
+  Status serialize(std::string& json) const;
+
+  /// Deserialize the state from JSON.
+  Status deserialize(const std::string& json);
+};
+
+/**
+ * @brief A dispatcher service uploading a single carve.
+ *
+ * Each block of the archive is read from the carved files with
+ * readFileBlocks, compressed, and sent to the carver continue endpoint.
+ * Memory use is bounded by the block size regardless of the file sizes.
+ */
+class Carver : public InternalRunnable {
+ public:
+  explicit Carver(const std::string& guid) : guid_(guid) {}
+
+  /// Upload each remaining block, then mark the carve complete.
+  void start() override;
+
+  /**
+   * @brief Measure and record a new carve without starting it.
+   *
+   * @param paths the regular files to carve, others are skipped.
+   * @param request_id the distributed query id requesting the carve.
+   * @param guid output, the identifier of the new carve.
+   */
+  static Status create(const std::set<std::string>& paths,
+                       const std::string& request_id,
+                       std::string& guid);
+
+  /// Read a carve's state from the database.
+  static Status load(const std::string& guid, CarveState& state);
+
+  /// Write a carve's state to the database.
+  static Status save(const CarveState& state);
+
+ private:
+  /**
+   * @brief Read one uncompressed block of the archive.
+   *
+   * Files that shrank or became unreadable since the carve was requested are
+   * padded with zeros, so every block and file keeps its recorded size.
+   */
+  Status readBlock(size_t block_id, std::string& block);
+
+  /// Request an upload session from the carver start endpoint.
+  Status startSession();
+
+  /// Upload a block to the carver continue endpoint.
+  Status uploadBlock(const std::string& block);
+
+ private:
+  /// The carve identifier, the state is loaded when the service starts.
+  std::string guid_;
+
+  CarveState state_;
+
+ private:
+  friend class CarverTests;
+  FRIEND_TEST(CarverTests, test_carve_single_file);
+  FRIEND_TEST(CarverTests, test_carve_tar_archive);
+};
+
+/**
+ * @brief Request a carve of a set of files and start uploading it.
+ *
+ * @param paths the files to carve.
+ * @param request_id the distributed query id requesting the carve.
+ * @param guid output, the identifier of the new carve.
+ * @return failure if the carver is disabled or no file can be carved.
+ */
+Status carvePaths(const std::set<std::string>& paths,
+                  const std::string& request_id,
+                  std::string& guid);
+
+/// Start uploading the carves that did not complete before a restart.
+void resumeCarves();
+}
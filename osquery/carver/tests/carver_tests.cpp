@@ -0,0 +1,166 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/filesystem.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/database.h>
+#include <osquery/enroll.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/carver/carver.h"
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+
+DECLARE_bool(disable_carver);
+DECLARE_uint64(carver_block_size);
+DECLARE_string(carver_start_endpoint);
+DECLARE_string(carver_continue_endpoint);
+
+class CarverTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    block_size_ = FLAGS_carver_block_size;
+    FLAGS_carver_block_size = 512;
+
+    first_ = kTestWorkingDirectory + "carver-first";
+    second_ = kTestWorkingDirectory + "carver-second";
+    boost::filesystem::remove(first_);
+    boost::filesystem::remove(second_);
+    writeTextFile(first_, std::string(1300, 'a'));
+    writeTextFile(second_, "second");
+  }
+
+  void TearDown() override {
+    FLAGS_carver_block_size = block_size_;
+    boost::filesystem::remove(first_);
+    boost::filesystem::remove(second_);
+  }
+
+  /// Read every block of a carve's archive.
+  std::string readArchive(Carver& carver) {
+    std::string archive;
+    for (size_t i = 0; i < carver.state_.blockCount(); i++) {
+      std::string block;
+      EXPECT_TRUE(carver.readBlock(i, block).ok());
+      EXPECT_LE(block.size(), carver.state_.block_size);
+      archive += block;
+    }
+    return archive;
+  }
+
+ protected:
+  std::string first_;
+  std::string second_;
+
+ private:
+  size_t block_size_{0};
+};
+
+TEST_F(CarverTests, test_carve_single_file) {
+  std::string guid;
+  ASSERT_TRUE(Carver::create({first_}, "request", guid).ok());
+
+  Carver carver(guid);
+  ASSERT_TRUE(Carver::load(guid, carver.state_).ok());
+  EXPECT_EQ(carver.state_.request_id, "request");
+  EXPECT_EQ(carver.state_.status, kCarveStatusPending);
+  EXPECT_FALSE(carver.state_.tar);
+
+  // A single file is carved as is, in fixed-size blocks.
+  EXPECT_EQ(carver.state_.blockCount(), 3U);
+  EXPECT_EQ(readArchive(carver), std::string(1300, 'a'));
+
+  // Files that shrank are padded to the size measured for the carve.
+  boost::filesystem::remove(first_);
+  writeTextFile(first_, "short");
+  auto archive = readArchive(carver);
+  EXPECT_EQ(archive.size(), 1300U);
+  EXPECT_EQ(archive.substr(0, 5), "short");
+  EXPECT_EQ(archive[5], '\0');
+
+  deleteDatabaseValue(kCarves, guid);
+}
+
+TEST_F(CarverTests, test_carve_tar_archive) {
+  std::string guid;
+  ASSERT_TRUE(
+      Carver::create({first_, second_, kTestWorkingDirectory}, "", guid).ok());
+
+  Carver carver(guid);
+  ASSERT_TRUE(Carver::load(guid, carver.state_).ok());
+  EXPECT_TRUE(carver.state_.tar);
+
+  // The directory is skipped, each file is a header and padded content.
+  ASSERT_EQ(carver.state_.files.size(), 2U);
+  auto archive = readArchive(carver);
+  ASSERT_EQ(archive.size(), 512U + 1536U + 512U + 512U + 1024U);
+  ASSERT_EQ(archive.size(), carver.state_.size());
+
+  EXPECT_EQ(archive.substr(257, 5), "ustar");
+  EXPECT_EQ(archive.substr(124, 11), "00000002424");
+  EXPECT_EQ(archive.substr(512, 1300), std::string(1300, 'a'));
+  EXPECT_EQ(archive[512 + 1300], '\0');
+  EXPECT_EQ(archive.substr(2048 + 257, 5), "ustar");
+  EXPECT_EQ(archive.substr(2560, 6), "second");
+  EXPECT_EQ(archive.substr(3072), std::string(1024, '\0'));
+
+  // Names are stored relative to the root.
+  auto name = first_.substr(first_.find_first_not_of('/'));
+  EXPECT_EQ(archive.substr(0, name.size()), name);
+
+  deleteDatabaseValue(kCarves, guid);
+}
+
+TEST_F(CarverTests, test_carve_upload) {
+  TLSServerRunner::start();
+  TLSServerRunner::setClientConfig();
+  clearNodeKey();
+
+  auto start_endpoint = FLAGS_carver_start_endpoint;
+  auto continue_endpoint = FLAGS_carver_continue_endpoint;
+  FLAGS_carver_start_endpoint = "/carve_init";
+  FLAGS_carver_continue_endpoint = "/carve_block";
+
+  std::string guid;
+  ASSERT_TRUE(Carver::create({first_, second_}, "", guid).ok());
+  Carver carver(guid);
+  carver.start();
+
+  // Each block was uploaded and the progress was kept.
+  CarveState state;
+  ASSERT_TRUE(Carver::load(guid, state).ok());
+  EXPECT_EQ(state.status, kCarveStatusSuccess);
+  EXPECT_EQ(state.session_id, "session_" + guid);
+  EXPECT_EQ(state.block_id, state.blockCount());
+
+  deleteDatabaseValue(kCarves, guid);
+  FLAGS_carver_start_endpoint = start_endpoint;
+  FLAGS_carver_continue_endpoint = continue_endpoint;
+
+  TLSServerRunner::stop();
+  TLSServerRunner::unsetClientConfig();
+  clearNodeKey();
+}
+
+TEST_F(CarverTests, test_carver_disabled) {
+  auto disabled = FLAGS_disable_carver;
+  FLAGS_disable_carver = true;
+
+  std::string guid;
+  EXPECT_FALSE(carvePaths({first_}, "", guid).ok());
+  EXPECT_TRUE(guid.empty());
+
+  FLAGS_disable_carver = disabled;
+}
+}
@@ -11,6 +11,8 @@
 #include <chrono>
 #include <mutex>
 #include <random>
+#include <set>
+#include <thread>
 
 #include <boost/algorithm/string/trim.hpp>
 
@@ -66,11 +68,14 @@ DECLARE_string(pack_delimiter);
 DECLARE_bool(disable_events);
 
 /**
- * @brief The backing store key name for the executing query.
+ * @brief The backing store key name for the executing queries.
  *
  * The config maintains schedule statistics and tracks failed executions.
  * On process or worker resume an initializer or config may check if the
  * resume was the result of a failure during an executing query.
+ *
+ * Each line is an execution, the names sharing it are separated by tabs.
+ * Scheduler workers run several executions at once.
  */
 const std::string kExecutingQuery = "executing_query";
 const std::string kFailedQueries = "failed_queries";
@@ -87,6 +92,10 @@ RecursiveMutex config_schedule_mutex_;
 RecursiveMutex config_files_mutex_;
 RecursiveMutex config_performance_mutex_;
 
+/// The names within each thread's executing query.
+Mutex config_executing_mutex_;
+std::map<std::thread::id, std::set<std::string>> kExecutingQueries;
+
 using PackRef = std::shared_ptr<Pack>;
 
 /**
@@ -225,14 +234,41 @@ Schedule::Schedule() {
   restoreScheduleBlacklist(blacklist_);
 
   // Check if any queries were executing when the tool last stopped.
-  getDatabaseValue(kPersistentSettings, kExecutingQuery, failed_query_);
-  if (!failed_query_.empty()) {
-    LOG(WARNING) << "Scheduled query may have failed: " << failed_query_;
-    setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
-    // Add this query name to the blacklist and save the blacklist.
-    blacklist_[failed_query_] = getUnixTime() + 86400;
-    saveScheduleBlacklist(blacklist_);
+  std::string executing;
+  getDatabaseValue(kPersistentSettings, kExecutingQuery, executing);
+  auto executions = osquery::split(executing, "\n");
+  if (executions.empty()) {
+    return;
+  }
+
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
+  if (executions.size() > 1) {
+    // Concurrent executions cannot be told apart, none are blacklisted.
+    for (const auto& execution : executions) {
+      LOG(WARNING) << "Scheduled query may have failed: " << execution;
+    }
+    return;
+  }
+
+  // Add the names sharing the execution to the blacklist and save it.
+  for (const auto& name : osquery::split(executions[0], "\t")) {
+    LOG(WARNING) << "Scheduled query may have failed: " << name;
+    failed_query_ = name;
+    blacklist_[name] = getUnixTime() + 86400;
   }
+  saveScheduleBlacklist(blacklist_);
+}
+
+/// Save the executing queries of every thread, the caller holds the lock.
+static void saveExecutingQueries() {
+  std::string content;
+  for (const auto& execution : kExecutingQueries) {
+    std::vector<std::string> names(execution.second.begin(),
+                                   execution.second.end());
+    content += (content.empty()) ? "" : "\n";
+    content += osquery::join(names, "\t");
+  }
+  setDatabaseValue(kPersistentSettings, kExecutingQuery, content);
 }
 
 Config::Config()
@@ -244,6 +280,7 @@ void Config::addPack(const std::string& name,
                      const std::string& source,
                      const pt::ptree& tree) {
   RecursiveLock wlock(config_schedule_mutex_);
+  schedule_generation_++;
   try {
     schedule_->add(std::make_shared<Pack>(name, source, tree));
     if (schedule_->last()->shouldPackExecute()) {
@@ -256,6 +293,7 @@ void Config::addPack(const std::string& name,
 
 void Config::removePack(const std::string& pack) {
   RecursiveLock wlock(config_schedule_mutex_);
+  schedule_generation_++;
   return schedule_->remove(pack);
 }
 
@@ -273,29 +311,43 @@ void Config::removeFiles(const std::string& source) {
   }
 }
 
+/// The unique name of a scheduled query, the name may be synthetic.
+static std::string getScheduledQueryName(const PackRef& pack,
+                                         const std::string& query) {
+  if (pack->getName() != "main" && pack->getName() != "legacy_main") {
+    return "pack" + FLAGS_pack_delimiter + pack->getName() +
+           FLAGS_pack_delimiter + query;
+  }
+  return query;
+}
+
+bool Config::isBlacklisted(const std::string& name) {
+  RecursiveLock lock(config_schedule_mutex_);
+  // They query may have failed and been added to the schedule's blacklist.
+  auto blacklisted_query = schedule_->blacklist_.find(name);
+  if (blacklisted_query == schedule_->blacklist_.end()) {
+    return false;
+  }
+
+  if (getUnixTime() > blacklisted_query->second) {
+    // The blacklisted query passed the expiration time (remove).
+    schedule_->blacklist_.erase(blacklisted_query);
+    saveScheduleBlacklist(schedule_->blacklist_);
+    return false;
+  }
+  // The query is still blacklisted.
+  return true;
+}
+
 void Config::scheduledQueries(
     std::function<void(const std::string& name, const ScheduledQuery& query)>
         predicate) {
   RecursiveLock lock(config_schedule_mutex_);
   for (const PackRef& pack : *schedule_) {
     for (const auto& it : pack->getSchedule()) {
-      std::string name = it.first;
-      // The query name may be synthetic.
-      if (pack->getName() != "main" && pack->getName() != "legacy_main") {
-        name = "pack" + FLAGS_pack_delimiter + pack->getName() +
-               FLAGS_pack_delimiter + it.first;
-      }
-      // They query may have failed and been added to the schedule's blacklist.
-      if (schedule_->blacklist_.count(name) > 0) {
-        auto blacklisted_query = schedule_->blacklist_.find(name);
-        if (getUnixTime() > blacklisted_query->second) {
-          // The blacklisted query passed the expiration time (remove).
-          schedule_->blacklist_.erase(blacklisted_query);
-          saveScheduleBlacklist(schedule_->blacklist_);
-        } else {
-          // The query is still blacklisted.
-          continue;
-        }
+      auto name = getScheduledQueryName(pack, it.first);
+      if (isBlacklisted(name)) {
+        continue;
       }
       // Call the predicate.
       predicate(name, it.second);
@@ -303,6 +355,23 @@ void Config::scheduledQueries(
   }
 }
 
+void Config::allScheduledQueries(
+    std::function<void(const std::string& name,
+                       const ScheduledQuery& query,
+                       const PackRef& pack)> predicate) {
+  RecursiveLock lock(config_schedule_mutex_);
+  for (const PackRef& pack : schedule_->packs_) {
+    for (const auto& it : pack->getSchedule()) {
+      predicate(getScheduledQueryName(pack, it.first), it.second, pack);
+    }
+  }
+}
+
+bool Config::shouldQueryExecute(const PackRef& pack, const std::string& name) {
+  RecursiveLock lock(config_schedule_mutex_);
+  return pack->shouldPackExecute() && !isBlacklisted(name);
+}
+
 void Config::packs(std::function<void(PackRef& pack)> predicate) {
   RecursiveLock lock(config_schedule_mutex_);
   for (PackRef& pack : schedule_->packs_) {
@@ -378,15 +447,9 @@ Status Config::updateSource(const std::string& source,
   // Remove all files from this source.
   removeFiles(source);
 
-  // load the config (source.second) into a pt::ptree
+  // load the config (source.second) into a pt::ptree, skipping comments
   pt::ptree tree;
-  try {
-    auto clone = json;
-    stripConfigComments(clone);
-    std::stringstream json_stream;
-    json_stream << clone;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  if (!deserializeTreeJSON(json.data(), json.size(), tree, true).ok()) {
     return Status(1, "Error parsing the config JSON");
   }
 
@@ -445,15 +508,13 @@ Status Config::genPack(const std::string& name,
     return Status(1, "Invalid plugin response");
   }
 
-  try {
-    pt::ptree pack_tree;
-    std::stringstream pack_stream;
-    pack_stream << response[0][name];
-    pt::read_json(pack_stream, pack_tree);
-    addPack(name, source, pack_tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  pt::ptree pack_tree;
+  const auto& pack = response[0][name];
+  if (!deserializeTreeJSON(pack.data(), pack.size(), pack_tree).ok()) {
     LOG(WARNING) << "Error parsing the pack JSON: " << name;
+    return Status(0);
   }
+  addPack(name, source, pack_tree);
   return Status(0);
 }
 
@@ -506,15 +567,43 @@ Status Config::update(const std::map<std::string, std::string>& config) {
     }
   }
 
+  // Only sources with new content are parsed and applied again.
+  std::vector<std::string> changed;
+  {
+    WriteLock lock(config_hash_mutex_);
+    for (const auto& source : config) {
+      auto hash = hash_.find(source.first);
+      if (hash == hash_.end() ||
+          hash->second != hashFromBuffer(HASH_TYPE_MD5,
+                                         source.second.c_str(),
+                                         source.second.size())) {
+        changed.push_back(source.first);
+      }
+    }
+  }
+
+  if (changed.empty()) {
+    VLOG(1) << "Config content is unchanged";
+    return Status(0, "OK");
+  }
+
   // Iterate though each source and overwrite config data.
   // This will add/overwrite pack data, append to the schedule, change watched
   // files, set options, etc.
   // Before this occurs, take an opportunity to purge stale state.
-  purge();
+  // The initial load leaves this for after the scheduler starts.
+  if (loaded_) {
+    purge();
+  } else {
+    purge_deferred_ = true;
+  }
 
-  for (const auto& source : config) {
-    auto status = updateSource(source.first, source.second);
+  for (const auto& source : changed) {
+    auto status = updateSource(source, config.at(source));
     if (!status.ok()) {
+      // Parse the content again on the next update.
+      WriteLock lock(config_hash_mutex_);
+      hash_.erase(source);
       return status;
     }
   }
@@ -595,8 +684,15 @@ void Config::purge() {
   }
 }
 
+void Config::purgeDeferred() {
+  if (purge_deferred_.exchange(false)) {
+    purge();
+  }
+}
+
 void Config::reset() {
   schedule_ = std::make_shared<Schedule>();
+  schedule_generation_++;
   std::map<std::string, QueryPerformance>().swap(performance_);
   std::map<std::string, FileCategories>().swap(files_);
   std::map<std::string, std::string>().swap(hash_);
@@ -631,6 +727,30 @@ void Config::recordQueryPerformance(const std::string& name,
                                     size_t size,
                                     const Row& r0,
                                     const Row& r1) {
+  // Each column difference is only recorded if both samples are known.
+  auto difference = [&r0, &r1](const std::string& column) -> BIGINT_LITERAL {
+    if (r0.count(column) == 0 || r1.count(column) == 0 ||
+        r0.at(column).empty() || r1.at(column).empty()) {
+      return 0;
+    }
+    return AS_LITERAL(BIGINT_LITERAL, r1.at(column)) -
+           AS_LITERAL(BIGINT_LITERAL, r0.at(column));
+  };
+
+  recordQueryPerformance(name,
+                         delay,
+                         size,
+                         difference("user_time"),
+                         difference("system_time"),
+                         difference("resident_size"));
+}
+
+void Config::recordQueryPerformance(const std::string& name,
+                                    size_t delay,
+                                    size_t size,
+                                    int64_t user_time,
+                                    int64_t system_time,
+                                    int64_t memory) {
   RecursiveLock lock(config_performance_mutex_);
   if (performance_.count(name) == 0) {
     performance_[name] = QueryPerformance();
@@ -638,31 +758,18 @@ void Config::recordQueryPerformance(const std::string& name,
 
   // Grab access to the non-const schedule item.
   auto& query = performance_.at(name);
-  BIGINT_LITERAL diff = 0;
-  if (!r1.at("user_time").empty() && !r0.at("user_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("user_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("user_time"));
-    if (diff > 0) {
-      query.user_time += diff;
-    }
+  if (user_time > 0) {
+    query.user_time += user_time;
   }
 
-  if (!r1.at("system_time").empty() && !r0.at("system_time").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("system_time")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("system_time"));
-    if (diff > 0) {
-      query.system_time += diff;
-    }
+  if (system_time > 0) {
+    query.system_time += system_time;
   }
 
-  if (!r1.at("resident_size").empty() && !r0.at("resident_size").empty()) {
-    diff = AS_LITERAL(BIGINT_LITERAL, r1.at("resident_size")) -
-           AS_LITERAL(BIGINT_LITERAL, r0.at("resident_size"));
-    if (diff > 0) {
-      // Memory is stored as an average of RSS changes between query executions.
-      query.average_memory = (query.average_memory * query.executions) + diff;
-      query.average_memory = (query.average_memory / (query.executions + 1));
-    }
+  if (memory > 0) {
+    // Memory is stored as an average of RSS changes between query executions.
+    query.average_memory = (query.average_memory * query.executions) + memory;
+    query.average_memory = (query.average_memory / (query.executions + 1));
   }
 
   query.wall_time += delay;
@@ -671,12 +778,51 @@ void Config::recordQueryPerformance(const std::string& name,
   query.last_executed = getUnixTime();
 
   // Clear the executing query (remove the dirty bit).
-  setDatabaseValue(kPersistentSettings, kExecutingQuery, "");
+  WriteLock executing_lock(config_executing_mutex_);
+  auto execution = kExecutingQueries.find(std::this_thread::get_id());
+  if (execution != kExecutingQueries.end()) {
+    execution->second.erase(name);
+    if (execution->second.empty()) {
+      kExecutingQueries.erase(execution);
+    }
+  }
+  saveExecutingQueries();
+}
+
+void Config::recordQueryCacheResults(const std::string& name,
+                                     size_t hits,
+                                     size_t misses) {
+  if (hits == 0 && misses == 0) {
+    return;
+  }
+
+  RecursiveLock lock(config_performance_mutex_);
+  auto& query = performance_[name];
+  query.cache_hits += hits;
+  query.cache_misses += misses;
+}
+
+void Config::recordQuerySuppressedRows(const std::string& name, size_t rows) {
+  if (rows == 0) {
+    return;
+  }
+
+  RecursiveLock lock(config_performance_mutex_);
+  performance_[name].suppressed_rows += rows;
+}
+
+void Config::recordQueryTimeout(const std::string& name) {
+  RecursiveLock lock(config_performance_mutex_);
+  performance_[name].timeouts++;
 }
 
 void Config::recordQueryStart(const std::string& name) {
-  // There should only ever be a single executing query in the schedule.
-  setDatabaseValue(kPersistentSettings, kExecutingQuery, name);
+  {
+    // Each worker thread records its own executing query.
+    WriteLock lock(config_executing_mutex_);
+    kExecutingQueries[std::this_thread::get_id()].insert(name);
+    saveExecutingQueries();
+  }
   // Store the time this query name last executed for later results eviction.
   // When configuration updates occur the previous schedule is searched for
   // 'stale' query names, aka those that have week-old or longer last execute
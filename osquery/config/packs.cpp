@@ -9,6 +9,9 @@
  */
 
 #include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <map>
 #include <random>
 
 #include <osquery/core.h>
@@ -34,6 +37,11 @@ FLAG(string, pack_delimiter, "_", "Delimiter for pack and query names");
 
 FLAG(uint64, schedule_splay_percent, 10, "Percent to splay config times");
 
+FLAG(int32,
+     split_index,
+     -1,
+     "This host's slice, from 0, of queries split across hosts (default none)");
+
 FLAG(uint64,
      schedule_default_interval,
      3600,
@@ -127,6 +135,14 @@ void Pack::initialize(const std::string& name,
     version_ = tree.get<std::string>("version", "");
   }
 
+  // Check for resource budgets, enforced by the scheduler each hour.
+  budget_ = PackBudget();
+  if (tree.count("budget") > 0) {
+    const auto& budget = tree.get_child("budget");
+    budget_.cpu_seconds = budget.get<size_t>("cpu_seconds", 0);
+    budget_.result_bytes = budget.get<size_t>("result_bytes", 0);
+  }
+
   // Apply the shard, platform, and version checking.
   // It is important to set each value such that the packs meta-table can report
   // each of the restrictions.
@@ -191,6 +207,34 @@ void Pack::initialize(const std::string& name,
     query.splayed_interval = restoreSplayedValue(q.first, query.interval);
     query.options["snapshot"] = q.second.get<bool>("snapshot", false);
     query.options["removed"] = q.second.get<bool>("removed", true);
+    query.options["incremental"] = q.second.get<bool>("incremental", false);
+    query.max_rows = q.second.get<size_t>("max_rows", 0);
+    query.max_bytes = q.second.get<size_t>("max_bytes", 0);
+    query.sample = q.second.get<size_t>("sample", 0);
+    query.timeout = q.second.get<size_t>("timeout", 0);
+
+    // Key columns are a list, or a comma-separated string.
+    if (q.second.count("key") > 0) {
+      const auto& key = q.second.get_child("key");
+      if (key.empty()) {
+        query.key = split(key.data(), ",");
+      } else {
+        for (const auto& column : key) {
+          query.key.push_back(column.second.data());
+        }
+      }
+    }
+
+    // A split query is scanned by hosts sharing storage, 1 slice per host.
+    query.split = q.second.get<size_t>("split", 0);
+    if (query.split > 1) {
+      if (FLAGS_split_index < 0 ||
+          static_cast<size_t>(FLAGS_split_index) >= query.split) {
+        VLOG(1) << "Query is split and this host has no slice: " << q.first;
+        continue;
+      }
+      query.split_index = static_cast<size_t>(FLAGS_split_index);
+    }
     schedule_[q.first] = query;
   }
 }
@@ -207,6 +251,46 @@ const PackStats& Pack::getStats() const {
   return stats_;
 }
 
+const PackBudget& Pack::getBudget() const {
+  return budget_;
+}
+
+/// Budgets are spent within each hour, starting on the hour.
+static inline void advanceBudgetWindow(PackUsage& usage, size_t now) {
+  auto window = now - (now % 3600);
+  if (window > usage.window) {
+    usage = PackUsage();
+    usage.window = window;
+  }
+}
+
+PackUsage Pack::getUsage() const {
+  WriteLock lock(usage_mutex_);
+  return usage_;
+}
+
+void Pack::recordUsage(size_t cpu_ms, size_t result_bytes, size_t now) {
+  WriteLock lock(usage_mutex_);
+  advanceBudgetWindow(usage_, now);
+  usage_.cpu_ms += cpu_ms;
+  usage_.peak_result_bytes = std::max(usage_.peak_result_bytes, result_bytes);
+  usage_.executions++;
+}
+
+bool Pack::withinBudget(size_t now) {
+  WriteLock lock(usage_mutex_);
+  advanceBudgetWindow(usage_, now);
+  bool cpu = budget_.cpu_seconds > 0 &&
+             usage_.cpu_ms >= budget_.cpu_seconds * 1000;
+  bool results = budget_.result_bytes > 0 &&
+                 usage_.peak_result_bytes > budget_.result_bytes;
+  if (cpu || results) {
+    usage_.skipped++;
+    return false;
+  }
+  return true;
+}
+
 const std::string& Pack::getPlatform() const {
   return platform_;
 }
@@ -287,10 +371,108 @@ bool Pack::checkVersion(const std::string& version) const {
   return true;
 }
 
+/// A discovery query result shared by every pack using the same SQL.
+struct DiscoveryResult {
+  /// The time the query was run.
+  size_t time{0};
+
+  /// True if the query returned rows.
+  bool found{false};
+
+  /// Set when an event may have changed the result.
+  bool stale{false};
+};
+
+Mutex discovery_results_mutex_;
+
+/// Discovery results by SQL text.
+std::map<std::string, DiscoveryResult> discovery_results_;
+
+/// Changed when results are invalidated, packs evaluate discovery again.
+std::atomic<size_t> discovery_generation_{0};
+
+/// Check if SQL text includes a table name, ignoring case.
+static bool usesTable(const std::string& query, const std::string& table) {
+  auto isName = [](char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+  };
+
+  auto it = query.begin();
+  while (true) {
+    it = std::search(it, query.end(), table.begin(), table.end(),
+                     [](char a, char b) {
+                       return std::tolower(static_cast<unsigned char>(a)) ==
+                              std::tolower(static_cast<unsigned char>(b));
+                     });
+    if (it == query.end()) {
+      return false;
+    }
+
+    auto end = it + table.size();
+    if ((it == query.begin() || !isName(*(it - 1))) &&
+        (end == query.end() || !isName(*end))) {
+      return true;
+    }
+    ++it;
+  }
+}
+
+/// Get a cached discovery result, or run the query once for every pack.
+static bool getDiscoveryResult(const std::string& query, size_t current) {
+  {
+    WriteLock lock(discovery_results_mutex_);
+    auto result = discovery_results_.find(query);
+    if (result != discovery_results_.end()) {
+      // Stale results are evaluated at most once a second.
+      const auto& cached = result->second;
+      auto age = current - cached.time;
+      if ((!cached.stale && age < FLAGS_pack_refresh_interval) ||
+          (cached.stale && age == 0)) {
+        return cached.found;
+      }
+    }
+  }
+
+  auto sql = SQL(query);
+  if (!sql.ok()) {
+    LOG(WARNING) << "Discovery query failed (" << query
+                 << "): " << sql.getMessageString();
+  }
+
+  DiscoveryResult result;
+  result.time = current;
+  result.found = (sql.ok() && sql.rows().size() > 0);
+
+  WriteLock lock(discovery_results_mutex_);
+  discovery_results_[query] = result;
+  return result.found;
+}
+
+void invalidateDiscoveryQueries(const std::string& table) {
+  bool invalidated = false;
+  {
+    WriteLock lock(discovery_results_mutex_);
+    for (auto& result : discovery_results_) {
+      // New events may only add rows, discovered packs stay active.
+      if (!result.second.found && !result.second.stale &&
+          usesTable(result.first, table)) {
+        result.second.stale = true;
+        invalidated = true;
+      }
+    }
+  }
+
+  if (invalidated) {
+    discovery_generation_++;
+  }
+}
+
 bool Pack::checkDiscovery() {
   stats_.total++;
   size_t current = osquery::getUnixTime();
-  if ((current - discovery_cache_.first) < FLAGS_pack_refresh_interval) {
+  size_t generation = discovery_generation_;
+  if ((current - discovery_cache_.first) < FLAGS_pack_refresh_interval &&
+      generation == discovery_cache_generation_) {
     stats_.hits++;
     return discovery_cache_.second;
   }
@@ -298,15 +480,9 @@ bool Pack::checkDiscovery() {
   stats_.misses++;
   discovery_cache_.first = current;
   discovery_cache_.second = true;
+  discovery_cache_generation_ = generation;
   for (const auto& q : discovery_queries_) {
-    auto sql = SQL(q);
-    if (!sql.ok()) {
-      LOG(WARNING) << "Discovery query failed (" << q
-                   << "): " << sql.getMessageString();
-      discovery_cache_.second = false;
-      break;
-    }
-    if (sql.rows().size() == 0) {
+    if (!getDiscoveryResult(q, current)) {
       discovery_cache_.second = false;
       break;
     }
@@ -12,6 +12,7 @@
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
+#include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
 
@@ -26,6 +27,11 @@ FLAG(bool,
      false,
      "Add decorators as top level JSON objects");
 
+FLAG(uint64,
+     decorations_ttl,
+     0,
+     "Seconds to reuse always decorator results (default 0 runs every query)");
+
 /// Statically define the parser name to avoid mistakes.
 #define PARSER_NAME "decorators"
 
@@ -38,6 +44,12 @@ const std::map<DecorationPoint, std::string> kDecorationPointKeys = {
 using KeyValueMap = std::map<std::string, std::string>;
 using DecorationStore = std::map<std::string, KeyValueMap>;
 
+/// An always decorator query and the time its results were last added.
+struct AlwaysDecorator {
+  std::string query;
+  size_t last_run{0};
+};
+
 namespace {
 
 /**
@@ -83,7 +95,7 @@ class DecoratorsConfigParserPlugin : public ConfigParserPlugin {
 
  public:
   /// Set of configuration sources to the set of decorator queries.
-  std::map<std::string, std::vector<std::string>> always_;
+  std::map<std::string, std::vector<AlwaysDecorator>> always_;
 
   /// Set of configuration sources to the set of on-load decorator queries.
   std::map<std::string, std::vector<std::string>> load_;
@@ -95,12 +107,16 @@ class DecoratorsConfigParserPlugin : public ConfigParserPlugin {
   /// The result set of decorations, column names and their values.
   static DecorationStore kDecorations;
 
+  /// The decorations of every source merged, replaced when a value changes.
+  static std::shared_ptr<const KeyValueMap> kSnapshot;
+
   /// Protect additions to the decorator set.
   static Mutex kDecorationsMutex;
 };
 }
 
 DecorationStore DecoratorsConfigParserPlugin::kDecorations;
+std::shared_ptr<const KeyValueMap> DecoratorsConfigParserPlugin::kSnapshot;
 Mutex DecoratorsConfigParserPlugin::kDecorationsMutex;
 
 Status DecoratorsConfigParserPlugin::setUp() {
@@ -163,7 +179,9 @@ void DecoratorsConfigParserPlugin::updateDecorations(
   auto& always_key = kDecorationPointKeys.at(DECORATE_ALWAYS);
   if (decorators.count(always_key) > 0) {
     for (const auto& item : decorators.get_child(always_key)) {
-      always_[source].push_back(item.second.data());
+      AlwaysDecorator decorator;
+      decorator.query = item.second.data();
+      always_[source].push_back(std::move(decorator));
     }
   }
 
@@ -189,35 +207,86 @@ void DecoratorsConfigParserPlugin::updateDecorations(
   }
 }
 
-inline void addDecoration(const std::string& source,
+/// Set a decoration, returns true if the value changed.
+inline bool addDecoration(const std::string& source,
                           const std::string& name,
                           const std::string& value) {
-  DecoratorsConfigParserPlugin::kDecorations[source][name] = value;
+  auto& decoration = DecoratorsConfigParserPlugin::kDecorations[source][name];
+  if (decoration == value) {
+    return false;
+  }
+  decoration = value;
+  return true;
+}
+
+/// Merge the decorations of every source into a new snapshot.
+inline void updateSnapshot() {
+  auto snapshot = std::make_shared<KeyValueMap>();
+  for (const auto& source : DecoratorsConfigParserPlugin::kDecorations) {
+    for (const auto& decoration : source.second) {
+      (*snapshot)[decoration.first] = decoration.second;
+    }
+  }
+  DecoratorsConfigParserPlugin::kSnapshot = std::move(snapshot);
+}
+
+/// Run a decorator query, returns true if a decoration changed.
+inline bool runDecorator(const std::string& source, const std::string& query) {
+  bool changed = false;
+  auto results = SQL(query);
+  if (results.rows().size() > 0) {
+    // Notice the warning above about undefined behavior when:
+    // 1: You include decorators that emit the same column name
+    // 2: You include a query that returns more than 1 row.
+    for (const auto& column : results.rows()[0]) {
+      changed = addDecoration(source, column.first, column.second) || changed;
+    }
+  }
+
+  if (results.rows().size() > 1) {
+    // Multiple rows exhibit undefined behavior.
+    LOG(WARNING) << "Multiple rows returned for decorator query: " << query;
+  }
+  return changed;
 }
 
-inline void runDecorators(const std::string& source,
+inline bool runDecorators(const std::string& source,
                           const std::vector<std::string>& queries) {
+  bool changed = false;
   for (const auto& query : queries) {
-    auto results = SQL(query);
-    if (results.rows().size() > 0) {
-      // Notice the warning above about undefined behavior when:
-      // 1: You include decorators that emit the same column name
-      // 2: You include a query that returns more than 1 row.
-      for (const auto& column : results.rows()[0]) {
-        addDecoration(source, column.first, column.second);
-      }
-    }
+    changed = runDecorator(source, query) || changed;
+  }
+  return changed;
+}
 
-    if (results.rows().size() > 1) {
-      // Multiple rows exhibit undefined behavior.
-      LOG(WARNING) << "Multiple rows returned for decorator query: " << query;
+/// Run the always decorators of a source whose results expired.
+inline bool runDecorators(const std::string& source,
+                          std::vector<AlwaysDecorator>& decorators) {
+  bool changed = false;
+  auto now = getUnixTime();
+  for (auto& decorator : decorators) {
+    if (FLAGS_decorations_ttl > 0 && decorator.last_run > 0 &&
+        now < decorator.last_run + FLAGS_decorations_ttl) {
+      continue;
     }
+    changed = runDecorator(source, decorator.query) || changed;
+    decorator.last_run = now;
   }
+  return changed;
 }
 
 void clearDecorations(const std::string& source) {
+  auto dp = std::dynamic_pointer_cast<DecoratorsConfigParserPlugin>(
+      Config::getParser(PARSER_NAME));
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
   DecoratorsConfigParserPlugin::kDecorations[source].clear();
+  updateSnapshot();
+  if (dp != nullptr && dp->always_.count(source) > 0) {
+    // The cleared always decorations are added again by their next run.
+    for (auto& decorator : dp->always_.at(source)) {
+      decorator.last_run = 0;
+    }
+  }
 }
 
 void runDecorators(DecorationPoint point,
@@ -236,16 +305,19 @@ void runDecorators(DecorationPoint point,
   // Abstract the use of the decorator parser API.
   auto dp = std::dynamic_pointer_cast<DecoratorsConfigParserPlugin>(parser);
   WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  bool changed = false;
   if (point == DECORATE_LOAD) {
     for (const auto& target_source : dp->load_) {
       if (source.empty() || target_source.first == source) {
-        runDecorators(target_source.first, target_source.second);
+        changed = runDecorators(target_source.first, target_source.second) ||
+                  changed;
       }
     }
   } else if (point == DECORATE_ALWAYS) {
-    for (const auto& target_source : dp->always_) {
+    for (auto& target_source : dp->always_) {
       if (source.empty() || target_source.first == source) {
-        runDecorators(target_source.first, target_source.second);
+        changed = runDecorators(target_source.first, target_source.second) ||
+                  changed;
       }
     }
   } else if (point == DECORATE_INTERVAL) {
@@ -253,12 +325,18 @@ void runDecorators(DecorationPoint point,
       for (const auto& interval : target_source.second) {
         if (time % interval.first == 0) {
           if (source.empty() || target_source.first == source) {
-            runDecorators(target_source.first, interval.second);
+            changed = runDecorators(target_source.first, interval.second) ||
+                      changed;
           }
         }
       }
     }
   }
+
+  if (changed) {
+    // Log items created after this point share the new decorations.
+    updateSnapshot();
+  }
 }
 
 void getDecorations(std::map<std::string, std::string>& results) {
@@ -266,10 +344,16 @@ void getDecorations(std::map<std::string, std::string>& results) {
     return;
   }
 
-  WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+  std::shared_ptr<const KeyValueMap> snapshot;
+  {
+    // The snapshot is immutable, copy it without holding the lock.
+    WriteLock lock(DecoratorsConfigParserPlugin::kDecorationsMutex);
+    snapshot = DecoratorsConfigParserPlugin::kSnapshot;
+  }
+
   // Copy the decorations into the log_item.
-  for (const auto& source : DecoratorsConfigParserPlugin::kDecorations) {
-    for (const auto& decoration : source.second) {
+  if (snapshot != nullptr) {
+    for (const auto& decoration : *snapshot) {
       results[decoration.first] = decoration.second;
     }
   }
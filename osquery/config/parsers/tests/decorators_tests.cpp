@@ -21,6 +21,7 @@ namespace osquery {
 
 DECLARE_bool(disable_decorators);
 DECLARE_bool(decorations_top_level);
+DECLARE_uint64(decorations_ttl);
 
 class DecoratorsConfigParserPluginTests : public testing::Test {
  public:
@@ -128,4 +129,35 @@ TEST_F(DecoratorsConfigParserPluginTests, test_decorators_run_load_top_level) {
   // disable top level decorations
   FLAGS_decorations_top_level = false;
 }
+
+TEST_F(DecoratorsConfigParserPluginTests, test_decorators_always_ttl) {
+  // The decoration reports the TTL used when the decorator last ran.
+  config_data_["awesome"] =
+      "{\"decorators\": {\"always\": [\"select value as ttl from "
+      "osquery_flags where name = 'decorations_ttl'\"]}}";
+  FLAGS_disable_decorators = false;
+  auto ttl = FLAGS_decorations_ttl;
+  FLAGS_decorations_ttl = 3600;
+  Config::getInstance().update(config_data_);
+
+  runDecorators(DECORATE_ALWAYS);
+  std::map<std::string, std::string> decorations;
+  getDecorations(decorations);
+  EXPECT_EQ(decorations["ttl"], "3600");
+
+  // Results within the TTL are reused.
+  FLAGS_decorations_ttl = 1800;
+  runDecorators(DECORATE_ALWAYS);
+  decorations.clear();
+  getDecorations(decorations);
+  EXPECT_EQ(decorations["ttl"], "3600");
+
+  // Without a TTL the decorator runs again.
+  FLAGS_decorations_ttl = 0;
+  runDecorators(DECORATE_ALWAYS);
+  decorations.clear();
+  getDecorations(decorations);
+  EXPECT_EQ(decorations["ttl"], "0");
+  FLAGS_decorations_ttl = ttl;
+}
 }
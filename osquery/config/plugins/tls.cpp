@@ -17,6 +17,7 @@
 #include <osquery/dispatcher.h>
 #include <osquery/enroll.h>
 #include <osquery/flags.h>
+#include <osquery/hash.h>
 #include <osquery/registry.h>
 
 #include "osquery/core/conversions.h"
@@ -61,6 +62,12 @@ class TLSConfigPlugin : public ConfigPlugin,
  protected:
   /// Calculate the URL once and cache the result.
   std::string uri_;
+
+  /// The last config content, returned when the server reports no change.
+  std::string config_;
+
+  /// The hash of the last config content, sent with each request.
+  std::string config_hash_;
 };
 
 class TLSConfigRefreshRunner : public InternalRunnable {
@@ -83,15 +90,40 @@ Status TLSConfigPlugin::setUp() {
   return Status(0, "OK");
 }
 
+/// The max size of a response that may report an unchanged config.
+const size_t kConfigUnchangedMaxSize = 256;
+
 Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
   std::string json;
 
+  // Send the hash of the last config, the server may respond without content.
+  pt::ptree params;
+  if (!config_hash_.empty() && !FLAGS_tls_node_api) {
+    params.put("config_hash", config_hash_);
+  }
+
   auto s = TLSRequestHelper::go<JSONSerializer>(
-      uri_, json, FLAGS_config_tls_max_attempts);
+      uri_, params, json, FLAGS_config_tls_max_attempts);
   if (!s.ok()) {
     return s;
   }
 
+  if (!config_hash_.empty() && json.size() < kConfigUnchangedMaxSize) {
+    pt::ptree tree;
+    try {
+      std::stringstream input(json);
+      pt::read_json(input, tree);
+    } catch (const pt::json_parser::json_parser_error& /* e */) {
+      // The content is not a small unchanged response.
+    }
+
+    auto unchanged = tree.get("config_unchanged", "");
+    if (unchanged == "1" || unchanged == "true" || unchanged == "True") {
+      config["tls_plugin"] = config_;
+      return s;
+    }
+  }
+
   if (FLAGS_tls_node_api) {
     // The node API embeds configuration data (JSON escaped).
     pt::ptree tree;
@@ -108,6 +140,9 @@ Status TLSConfigPlugin::genConfig(std::map<std::string, std::string>& config) {
   } else {
     config["tls_plugin"] = json;
   }
+
+  config_ = config["tls_plugin"];
+  config_hash_ = hashFromBuffer(HASH_TYPE_MD5, config_.c_str(), config_.size());
   return s;
 }
 
@@ -8,19 +8,23 @@
  *
  */
 
+#include <future>
 #include <memory>
+#include <thread>
 #include <vector>
 
 #include <gtest/gtest.h>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/packs.h>
 #include <osquery/registry.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
 #include "osquery/tests/test_util.h"
 
@@ -46,6 +50,7 @@ class ConfigTests : public testing::Test {
  protected:
   Status load() { return Config::getInstance().load(); }
   void setLoaded() { Config::getInstance().loaded_ = true; }
+  void reset() { Config::getInstance().reset(); }
   Config& get() { return Config::getInstance(); }
 };
 
@@ -139,6 +144,55 @@ TEST_F(ConfigTests, test_schedule_blacklist) {
   EXPECT_EQ(blacklist.size(), 1U);
 }
 
+TEST_F(ConfigTests, test_executing_queries) {
+  saveScheduleBlacklist({});
+
+  // Each thread records its own executing query.
+  std::promise<void> started;
+  std::promise<void> finish;
+  auto finished = finish.get_future().share();
+  std::thread worker([&started, finished]() {
+    Config::getInstance().recordQueryStart("worker_query");
+    started.set_value();
+    finished.wait();
+    Config::getInstance().recordQueryPerformance(
+        "worker_query", 0, 0, 0, 0, 0);
+  });
+  started.get_future().wait();
+  get().recordQueryStart("scheduler_query");
+
+  std::string executing;
+  getDatabaseValue(kPersistentSettings, "executing_query", executing);
+  auto executions = osquery::split(executing, "\n");
+  EXPECT_EQ(executions.size(), 2U);
+
+  // Completing one query leaves the other worker's query.
+  get().recordQueryPerformance("scheduler_query", 0, 0, 0, 0, 0);
+  getDatabaseValue(kPersistentSettings, "executing_query", executing);
+  EXPECT_EQ(executing, "worker_query");
+  finish.set_value();
+  worker.join();
+  getDatabaseValue(kPersistentSettings, "executing_query", executing);
+  EXPECT_TRUE(executing.empty());
+
+  // Concurrent executions found on start are not blacklisted.
+  setDatabaseValue(kPersistentSettings, "executing_query", "first\nsecond");
+  reset();
+  std::map<std::string, size_t> blacklist;
+  restoreScheduleBlacklist(blacklist);
+  EXPECT_TRUE(blacklist.empty());
+
+  // The names sharing a single execution are blacklisted.
+  setDatabaseValue(kPersistentSettings, "executing_query", "first\tsecond");
+  reset();
+  restoreScheduleBlacklist(blacklist);
+  EXPECT_EQ(blacklist.count("first"), 1U);
+  EXPECT_EQ(blacklist.count("second"), 1U);
+  getDatabaseValue(kPersistentSettings, "executing_query", executing);
+  EXPECT_TRUE(executing.empty());
+  saveScheduleBlacklist({});
+}
+
 TEST_F(ConfigTests, test_pack_noninline) {
   Registry::add<TestConfigPlugin>("config", "test");
   // Change the active config plugin.
@@ -313,6 +367,25 @@ TEST_F(ConfigTests, test_plugin_reconfigure) {
   EXPECT_EQ(placebo->configures, 1U);
 }
 
+TEST_F(ConfigTests, test_unchanged_update) {
+  Registry::add<PlaceboConfigParserPlugin>("config_parser", "placebo");
+  auto placebo = std::static_pointer_cast<PlaceboConfigParserPlugin>(
+      Registry::get("config_parser", "placebo"));
+  placebo->configures = 0;
+
+  setLoaded();
+  get().update({{"data", "{}"}});
+  EXPECT_EQ(placebo->configures, 1U);
+
+  // The same content is not applied again.
+  get().update({{"data", "{}"}});
+  EXPECT_EQ(placebo->configures, 1U);
+
+  // A changed source is applied.
+  get().update({{"data", "{\"options\": {}}"}});
+  EXPECT_EQ(placebo->configures, 2U);
+}
+
 TEST_F(ConfigTests, test_pack_file_paths) {
   size_t count = 0;
   auto fileCounter =
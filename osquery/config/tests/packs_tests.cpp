@@ -16,10 +16,13 @@
 #include <osquery/packs.h>
 
 #include "osquery/core/json.h"
+#include "osquery/core/work_shard.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 
+DECLARE_int32(split_index);
+
 extern size_t getMachineShard(const std::string& hostname = "",
                               bool force = false);
 
@@ -76,6 +79,90 @@ TEST_F(PacksTests, test_sharding) {
   EXPECT_NE(shard1, shard2);
 }
 
+TEST_F(PacksTests, test_split) {
+  pt::ptree tree;
+  std::stringstream json;
+  json << "{\"queries\": {\"split_query\": "
+       << "{\"query\": \"select * from hash\", \"interval\": 60, "
+       << "\"split\": 4}}}";
+  pt::read_json(json, tree);
+
+  // A host without a slice does not schedule the query.
+  auto index = FLAGS_split_index;
+  FLAGS_split_index = -1;
+  Pack unassigned("split_pack", tree);
+  EXPECT_EQ(unassigned.getSchedule().size(), 0U);
+
+  FLAGS_split_index = 2;
+  Pack assigned("split_pack", tree);
+  ASSERT_EQ(assigned.getSchedule().size(), 1U);
+  const auto& query = assigned.getSchedule().at("split_query");
+  EXPECT_EQ(query.split, 4U);
+  EXPECT_EQ(query.split_index, 2U);
+  FLAGS_split_index = index;
+
+  // Each item is scanned by exactly one slice.
+  std::vector<size_t> counts(4, 0);
+  for (size_t i = 0; i < 100; i++) {
+    auto path = "/mnt/shared/file" + std::to_string(i);
+    size_t owners = 0;
+    for (size_t slice = 0; slice < counts.size(); slice++) {
+      WorkShardScope shard(slice, counts.size());
+      if (inWorkShard(path)) {
+        owners++;
+        counts[slice]++;
+      }
+    }
+    EXPECT_EQ(owners, 1U);
+  }
+  for (const auto& count : counts) {
+    EXPECT_GT(count, 0U);
+  }
+
+  // Outside of a split query every item is scanned.
+  EXPECT_TRUE(inWorkShard("/mnt/shared/file0"));
+}
+
+TEST_F(PacksTests, test_budget) {
+  // A pack without a budget is always within it.
+  Pack unbudgeted("unrestricted_pack", getUnrestrictedPack());
+  EXPECT_EQ(unbudgeted.getBudget().cpu_seconds, 0U);
+  unbudgeted.recordUsage(1000000, 1000000, 3600);
+  EXPECT_TRUE(unbudgeted.withinBudget(3600));
+
+  pt::ptree tree;
+  std::stringstream json;
+  json << "{\"budget\": {\"cpu_seconds\": 2, \"result_bytes\": 100}, "
+       << "\"queries\": {\"budget_query\": "
+       << "{\"query\": \"select * from time\", \"interval\": 60}}}";
+  pt::read_json(json, tree);
+
+  Pack pack("budget_pack", tree);
+  EXPECT_EQ(pack.getBudget().cpu_seconds, 2U);
+  EXPECT_EQ(pack.getBudget().result_bytes, 100U);
+
+  // The CPU budget is spent across executions within the hour.
+  pack.recordUsage(1500, 10, 3600);
+  EXPECT_TRUE(pack.withinBudget(3660));
+  pack.recordUsage(500, 10, 3660);
+  EXPECT_FALSE(pack.withinBudget(3720));
+
+  auto usage = pack.getUsage();
+  EXPECT_EQ(usage.window, 3600U);
+  EXPECT_EQ(usage.cpu_ms, 2000U);
+  EXPECT_EQ(usage.executions, 2U);
+  EXPECT_EQ(usage.skipped, 1U);
+
+  // The next hour starts with a new budget.
+  EXPECT_TRUE(pack.withinBudget(7200));
+  EXPECT_EQ(pack.getUsage().cpu_ms, 0U);
+
+  // A single execution above the result bytes spends the budget.
+  pack.recordUsage(0, 101, 7260);
+  EXPECT_FALSE(pack.withinBudget(7320));
+  EXPECT_EQ(pack.getUsage().peak_result_bytes, 101U);
+}
+
 TEST_F(PacksTests, test_check_platform) {
   Pack fpack("discovery_pack", getPackWithDiscovery());
   EXPECT_TRUE(fpack.checkPlatform());
@@ -150,6 +237,26 @@ TEST_F(PacksTests, test_discovery_cache) {
   c.reset();
 }
 
+TEST_F(PacksTests, test_discovery_invalidation) {
+  Pack first("discovery_pack", getPackWithDiscovery());
+  Pack second("discovery_pack", getPackWithDiscovery());
+  EXPECT_FALSE(first.shouldPackExecute());
+  EXPECT_FALSE(second.shouldPackExecute());
+  EXPECT_EQ(first.getStats().misses, 1U);
+
+  // Content from an unrelated table does not change the cached result.
+  invalidateDiscoveryQueries("process_envs");
+  EXPECT_FALSE(first.shouldPackExecute());
+  EXPECT_EQ(first.getStats().hits, 1U);
+
+  // New processes may change the result, both packs evaluate again.
+  invalidateDiscoveryQueries("processes");
+  EXPECT_FALSE(first.shouldPackExecute());
+  EXPECT_FALSE(second.shouldPackExecute());
+  EXPECT_EQ(first.getStats().misses, 2U);
+  EXPECT_EQ(second.getStats().misses, 2U);
+}
+
 TEST_F(PacksTests, test_discovery_zero_state) {
   Pack pack("discovery_pack", getPackWithDiscovery());
   auto stats = pack.getStats();
@@ -0,0 +1,211 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define OSQUERY_SCAN_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__)
+// AVX2 is not enabled for the build, its kernel is selected at runtime.
+#define OSQUERY_SCAN_AVX2
+#include <immintrin.h>
+#endif
+#elif defined(__aarch64__)
+#define OSQUERY_SCAN_NEON
+#include <arm_neon.h>
+#endif
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "osquery/core/byte_scan.h"
+
+namespace osquery {
+
+/// The shortest input scanned with vector compares.
+const size_t kVectorScanMin = 16;
+
+static inline bool isJSONEscape(unsigned char c) {
+  return c < 0x20 || c == '"' || c == '/' || c == '\\';
+}
+
+static inline bool isNonPrintable(unsigned char c) {
+  return c < 0x20 || c >= 0x80;
+}
+
+template <bool (*Predicate)(unsigned char)>
+static inline size_t scanScalar(const char* data, size_t offset, size_t size) {
+  for (; offset < size; ++offset) {
+    if (Predicate(static_cast<unsigned char>(data[offset]))) {
+      break;
+    }
+  }
+  return offset;
+}
+
+#if defined(OSQUERY_SCAN_SSE2)
+static inline size_t firstSetBit(unsigned int mask) {
+#ifdef _MSC_VER
+  unsigned long index = 0;
+  _BitScanForward(&index, mask);
+  return index;
+#else
+  return __builtin_ctz(mask);
+#endif
+}
+
+static inline unsigned int jsonEscapeMask(__m128i v) {
+  // A byte is a control character if max(byte, 0x1F) is 0x1F.
+  const auto control = _mm_set1_epi8(0x1F);
+  auto mask = _mm_or_si128(
+      _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, control), control),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('"'))),
+      _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('/')),
+                   _mm_cmpeq_epi8(v, _mm_set1_epi8('\\'))));
+  return static_cast<unsigned int>(_mm_movemask_epi8(mask));
+}
+
+static inline unsigned int nonPrintableMask(__m128i v) {
+  // Bytes above 0x7F are negative, one signed compare finds both ranges.
+  auto mask = _mm_cmplt_epi8(v, _mm_set1_epi8(0x20));
+  return static_cast<unsigned int>(_mm_movemask_epi8(mask));
+}
+
+template <unsigned int (*Mask)(__m128i), bool (*Predicate)(unsigned char)>
+static size_t scanSSE2(const char* data, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+    auto mask = Mask(v);
+    if (mask != 0) {
+      return i + firstSetBit(mask);
+    }
+  }
+  return scanScalar<Predicate>(data, i, size);
+}
+#endif
+
+#if defined(OSQUERY_SCAN_AVX2)
+__attribute__((target("avx2"))) static size_t findJSONEscapeAVX2(
+    const char* data, size_t size) {
+  const auto control = _mm256_set1_epi8(0x1F);
+  const auto quote = _mm256_set1_epi8('"');
+  const auto solidus = _mm256_set1_epi8('/');
+  const auto reverse = _mm256_set1_epi8('\\');
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    auto mask = _mm256_or_si256(
+        _mm256_or_si256(
+            _mm256_cmpeq_epi8(_mm256_max_epu8(v, control), control),
+            _mm256_cmpeq_epi8(v, quote)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, solidus),
+                        _mm256_cmpeq_epi8(v, reverse)));
+    auto bits = static_cast<unsigned int>(_mm256_movemask_epi8(mask));
+    if (bits != 0) {
+      return i + __builtin_ctz(bits);
+    }
+  }
+  return i + scanSSE2<jsonEscapeMask, isJSONEscape>(data + i, size - i);
+}
+
+__attribute__((target("avx2"))) static size_t findNonPrintableAVX2(
+    const char* data, size_t size) {
+  const auto printable = _mm256_set1_epi8(0x20);
+
+  size_t i = 0;
+  for (; i + 32 <= size; i += 32) {
+    auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    // AVX2 has no less-than compare, check if 0x20 is greater (signed).
+    auto mask = _mm256_cmpgt_epi8(printable, v);
+    auto bits = static_cast<unsigned int>(_mm256_movemask_epi8(mask));
+    if (bits != 0) {
+      return i + __builtin_ctz(bits);
+    }
+  }
+  return i + scanSSE2<nonPrintableMask, isNonPrintable>(data + i, size - i);
+}
+
+static bool hasAVX2() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+#endif
+
+#if defined(OSQUERY_SCAN_NEON)
+static inline uint8x16_t jsonEscapeMask(uint8x16_t v) {
+  return vorrq_u8(vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x20)),
+                           vceqq_u8(v, vdupq_n_u8('"'))),
+                  vorrq_u8(vceqq_u8(v, vdupq_n_u8('/')),
+                           vceqq_u8(v, vdupq_n_u8('\\'))));
+}
+
+static inline uint8x16_t nonPrintableMask(uint8x16_t v) {
+  return vorrq_u8(vcltq_u8(v, vdupq_n_u8(0x20)),
+                  vcgeq_u8(v, vdupq_n_u8(0x80)));
+}
+
+template <uint8x16_t (*Mask)(uint8x16_t), bool (*Predicate)(unsigned char)>
+static size_t scanNEON(const char* data, size_t size) {
+  size_t i = 0;
+  for (; i + 16 <= size; i += 16) {
+    auto v = vld1q_u8(reinterpret_cast<const uint8_t*>(data + i));
+    if (vmaxvq_u8(Mask(v)) != 0) {
+      // The scalar scan stops within these 16 bytes.
+      break;
+    }
+  }
+  return scanScalar<Predicate>(data, i, size);
+}
+#endif
+
+using ScanFunction = size_t (*)(const char*, size_t);
+
+size_t findJSONEscape(const char* data, size_t size) {
+  if (size < kVectorScanMin) {
+    return scanScalar<isJSONEscape>(data, 0, size);
+  }
+
+#if defined(OSQUERY_SCAN_AVX2)
+  static const ScanFunction scan = (hasAVX2())
+                                       ? findJSONEscapeAVX2
+                                       : scanSSE2<jsonEscapeMask, isJSONEscape>;
+  return scan(data, size);
+#elif defined(OSQUERY_SCAN_SSE2)
+  return scanSSE2<jsonEscapeMask, isJSONEscape>(data, size);
+#elif defined(OSQUERY_SCAN_NEON)
+  return scanNEON<jsonEscapeMask, isJSONEscape>(data, size);
+#else
+  return scanScalar<isJSONEscape>(data, 0, size);
+#endif
+}
+
+size_t findNonPrintable(const char* data, size_t size) {
+  if (size < kVectorScanMin) {
+    return scanScalar<isNonPrintable>(data, 0, size);
+  }
+
+#if defined(OSQUERY_SCAN_AVX2)
+  static const ScanFunction scan =
+      (hasAVX2()) ? findNonPrintableAVX2
+                  : scanSSE2<nonPrintableMask, isNonPrintable>;
+  return scan(data, size);
+#elif defined(OSQUERY_SCAN_SSE2)
+  return scanSSE2<nonPrintableMask, isNonPrintable>(data, size);
+#elif defined(OSQUERY_SCAN_NEON)
+  return scanNEON<nonPrintableMask, isNonPrintable>(data, size);
+#else
+  return scanScalar<isNonPrintable>(data, 0, size);
+#endif
+}
+}
@@ -0,0 +1,41 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace osquery {
+
+/**
+ * @brief Find the first byte a JSON string writer must escape.
+ *
+ * These are the control characters below 0x20, the quote, the solidus, and
+ * the reverse solidus, matching property tree's write_json. Other bytes,
+ * including those above 0x7F, are written as they are.
+ *
+ * The scan compares 16 bytes (SSE2 or NEON) or 32 bytes (AVX2, selected at
+ * runtime) at a time, with a scalar loop for the tail and other platforms.
+ *
+ * @return The offset of the byte, or size if no byte needs escaping.
+ */
+size_t findJSONEscape(const char* data, size_t size);
+
+/**
+ * @brief Find the first byte that is not printable ASCII.
+ *
+ * These are the bytes below 0x20 and above 0x7F, which SQL::escapeResults
+ * replaces with a hex escape. Results are escaped byte by byte, multi-byte
+ * UTF-8 sequences included, so a clean scan also means the value is ASCII.
+ *
+ * @return The offset of the byte, or size if every byte is printable.
+ */
+size_t findNonPrintable(const char* data, size_t size);
+}
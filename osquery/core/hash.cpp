@@ -8,8 +8,8 @@
  *
  */
 
-#include <iomanip>
-#include <sstream>
+#include <cstdint>
+#include <cstring>
 #include <vector>
 
 #include <osquery/filesystem.h>
@@ -30,7 +30,144 @@ namespace osquery {
 #define SHA1_CTX SHA_CTX
 #endif
 
-#define HASH_CHUNK_SIZE 4096
+/// Hash in large blocks, reducing reads and digest update calls.
+#define HASH_CHUNK_SIZE (256 * 1024)
+
+/// The XXH64 digest length in bytes.
+#define XXH64_DIGEST_LENGTH 8
+
+/**
+ * @brief A streaming XXH64 state.
+ *
+ * XXH64 is a non-cryptographic hash that runs at memory bandwidth, it is only
+ * used to detect content changes and never as a security control.
+ */
+struct XXH64_CTX {
+  uint64_t total_length;
+  uint64_t v[4];
+  unsigned char buffer[32];
+  size_t buffered;
+};
+
+const uint64_t kXXH64Prime1 = 11400714785074694791ULL;
+const uint64_t kXXH64Prime2 = 14029467366897019727ULL;
+const uint64_t kXXH64Prime3 = 1609587929392839161ULL;
+const uint64_t kXXH64Prime4 = 9650029242287828579ULL;
+const uint64_t kXXH64Prime5 = 2870177450012600261ULL;
+
+static inline uint64_t xxh64Rotate(uint64_t value, int bits) {
+  return (value << bits) | (value >> (64 - bits));
+}
+
+/// Read a little-endian word, the supported platforms are little-endian.
+static inline uint64_t xxh64Read64(const unsigned char* data) {
+  uint64_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint64_t xxh64Read32(const unsigned char* data) {
+  uint32_t value;
+  memcpy(&value, data, sizeof(value));
+  return value;
+}
+
+static inline uint64_t xxh64Round(uint64_t acc, uint64_t input) {
+  acc += input * kXXH64Prime2;
+  return xxh64Rotate(acc, 31) * kXXH64Prime1;
+}
+
+static inline uint64_t xxh64Merge(uint64_t acc, uint64_t value) {
+  acc ^= xxh64Round(0, value);
+  return acc * kXXH64Prime1 + kXXH64Prime4;
+}
+
+static void XXH64_Init(XXH64_CTX* ctx) {
+  ctx->total_length = 0;
+  ctx->v[0] = kXXH64Prime1 + kXXH64Prime2;
+  ctx->v[1] = kXXH64Prime2;
+  ctx->v[2] = 0;
+  ctx->v[3] = 0 - kXXH64Prime1;
+  ctx->buffered = 0;
+}
+
+static void XXH64_Update(XXH64_CTX* ctx, const void* buffer, size_t size) {
+  auto data = static_cast<const unsigned char*>(buffer);
+  auto end = data + size;
+  ctx->total_length += size;
+
+  if (ctx->buffered + size < 32) {
+    memcpy(ctx->buffer + ctx->buffered, data, size);
+    ctx->buffered += size;
+    return;
+  }
+
+  if (ctx->buffered > 0) {
+    auto fill = 32 - ctx->buffered;
+    memcpy(ctx->buffer + ctx->buffered, data, fill);
+    for (size_t i = 0; i < 4; i++) {
+      ctx->v[i] = xxh64Round(ctx->v[i], xxh64Read64(ctx->buffer + i * 8));
+    }
+    data += fill;
+    ctx->buffered = 0;
+  }
+
+  // The four lanes are independent, the compiler keeps them in registers.
+  auto v0 = ctx->v[0], v1 = ctx->v[1], v2 = ctx->v[2], v3 = ctx->v[3];
+  for (; data + 32 <= end; data += 32) {
+    v0 = xxh64Round(v0, xxh64Read64(data));
+    v1 = xxh64Round(v1, xxh64Read64(data + 8));
+    v2 = xxh64Round(v2, xxh64Read64(data + 16));
+    v3 = xxh64Round(v3, xxh64Read64(data + 24));
+  }
+  ctx->v[0] = v0;
+  ctx->v[1] = v1;
+  ctx->v[2] = v2;
+  ctx->v[3] = v3;
+
+  ctx->buffered = static_cast<size_t>(end - data);
+  memcpy(ctx->buffer, data, ctx->buffered);
+}
+
+/// Finish the digest, written big-endian to match the canonical hex form.
+static void XXH64_Final(unsigned char* hash, XXH64_CTX* ctx) {
+  uint64_t h;
+  if (ctx->total_length >= 32) {
+    h = xxh64Rotate(ctx->v[0], 1) + xxh64Rotate(ctx->v[1], 7) +
+        xxh64Rotate(ctx->v[2], 12) + xxh64Rotate(ctx->v[3], 18);
+    for (size_t i = 0; i < 4; i++) {
+      h = xxh64Merge(h, ctx->v[i]);
+    }
+  } else {
+    h = kXXH64Prime5;
+  }
+  h += ctx->total_length;
+
+  const unsigned char* data = ctx->buffer;
+  auto end = data + ctx->buffered;
+  for (; data + 8 <= end; data += 8) {
+    h ^= xxh64Round(0, xxh64Read64(data));
+    h = xxh64Rotate(h, 27) * kXXH64Prime1 + kXXH64Prime4;
+  }
+  if (data + 4 <= end) {
+    h ^= xxh64Read32(data) * kXXH64Prime1;
+    h = xxh64Rotate(h, 23) * kXXH64Prime2 + kXXH64Prime3;
+    data += 4;
+  }
+  for (; data < end; data++) {
+    h ^= *data * kXXH64Prime5;
+    h = xxh64Rotate(h, 11) * kXXH64Prime1;
+  }
+
+  h ^= h >> 33;
+  h *= kXXH64Prime2;
+  h ^= h >> 29;
+  h *= kXXH64Prime3;
+  h ^= h >> 32;
+  for (size_t i = 0; i < XXH64_DIGEST_LENGTH; i++) {
+    hash[i] = static_cast<unsigned char>(h >> (56 - i * 8));
+  }
+}
 
 Hash::~Hash() {
   if (ctx_ != nullptr) {
@@ -51,6 +188,10 @@ Hash::Hash(HashType algorithm) : algorithm_(algorithm) {
     length_ = __HASH_API(SHA256_DIGEST_LENGTH);
     ctx_ = (__HASH_API(SHA256_CTX)*)malloc(sizeof(__HASH_API(SHA256_CTX)));
     __HASH_API(SHA256_Init)((__HASH_API(SHA256_CTX)*)ctx_);
+  } else if (algorithm_ == HASH_TYPE_XXH64) {
+    length_ = XXH64_DIGEST_LENGTH;
+    ctx_ = (XXH64_CTX*)malloc(sizeof(XXH64_CTX));
+    XXH64_Init((XXH64_CTX*)ctx_);
   } else {
     throw std::domain_error("Unknown hash function");
   }
@@ -63,9 +204,23 @@ void Hash::update(const void* buffer, size_t size) {
     __HASH_API(SHA1_Update)((__HASH_API(SHA1_CTX)*)ctx_, buffer, size);
   } else if (algorithm_ == HASH_TYPE_SHA256) {
     __HASH_API(SHA256_Update)((__HASH_API(SHA256_CTX)*)ctx_, buffer, size);
+  } else if (algorithm_ == HASH_TYPE_XXH64) {
+    XXH64_Update((XXH64_CTX*)ctx_, buffer, size);
   }
 }
 
+/// Format a digest as lowercase hex.
+static inline std::string getHexDigest(const unsigned char* hash,
+                                       size_t length) {
+  static const char kHexDigits[] = "0123456789abcdef";
+  std::string digest(length * 2, '\0');
+  for (size_t i = 0; i < length; i++) {
+    digest[i * 2] = kHexDigits[hash[i] >> 4];
+    digest[i * 2 + 1] = kHexDigits[hash[i] & 0x0F];
+  }
+  return digest;
+}
+
 std::string Hash::digest() {
   std::vector<unsigned char> hash;
   hash.assign(length_, '\0');
@@ -76,15 +231,12 @@ std::string Hash::digest() {
     __HASH_API(SHA1_Final)(hash.data(), (__HASH_API(SHA1_CTX)*)ctx_);
   } else if (algorithm_ == HASH_TYPE_SHA256) {
     __HASH_API(SHA256_Final)(hash.data(), (__HASH_API(SHA256_CTX)*)ctx_);
+  } else if (algorithm_ == HASH_TYPE_XXH64) {
+    XXH64_Final(hash.data(), (XXH64_CTX*)ctx_);
   }
 
   // The hash value is only relevant as a hex digest.
-  std::stringstream digest;
-  for (size_t i = 0; i < length_; i++) {
-    digest << std::hex << std::setw(2) << std::setfill('0') << (int)hash[i];
-  }
-
-  return digest.str();
+  return getHexDigest(hash.data(), length_);
 }
 
 std::string hashFromBuffer(HashType hash_type,
@@ -96,35 +248,60 @@ std::string hashFromBuffer(HashType hash_type,
 }
 
 MultiHashes hashMultiFromFile(int mask, const std::string& path) {
-  std::map<HashType, std::shared_ptr<Hash>> hashes = {
-      {HASH_TYPE_MD5, std::make_shared<Hash>(HASH_TYPE_MD5)},
-      {HASH_TYPE_SHA1, std::make_shared<Hash>(HASH_TYPE_SHA1)},
-      {HASH_TYPE_SHA256, std::make_shared<Hash>(HASH_TYPE_SHA256)},
-  };
-
-  readFile(path,
-           0,
-           HASH_CHUNK_SIZE,
-           false,
-           true,
-           ([&hashes, &mask](std::string& buffer, size_t size) {
-             for (auto& hash : hashes) {
-               if (mask & hash.first) {
-                 hash.second->update(&buffer[0], size);
-               }
-             }
-           }));
+  // Each requested context is kept on the stack, only for the requested types.
+  __HASH_API(MD5_CTX) md5;
+  __HASH_API(SHA1_CTX) sha1;
+  __HASH_API(SHA256_CTX) sha256;
+  XXH64_CTX xxh64;
+  if (mask & HASH_TYPE_MD5) {
+    __HASH_API(MD5_Init)(&md5);
+  }
+  if (mask & HASH_TYPE_SHA1) {
+    __HASH_API(SHA1_Init)(&sha1);
+  }
+  if (mask & HASH_TYPE_SHA256) {
+    __HASH_API(SHA256_Init)(&sha256);
+  }
+  if (mask & HASH_TYPE_XXH64) {
+    XXH64_Init(&xxh64);
+  }
+
+  readFileBlocks(path,
+                 HASH_CHUNK_SIZE,
+                 true,
+                 ([&](const char* buffer, size_t size) {
+                   if (mask & HASH_TYPE_MD5) {
+                     __HASH_API(MD5_Update)(&md5, buffer, size);
+                   }
+                   if (mask & HASH_TYPE_SHA1) {
+                     __HASH_API(SHA1_Update)(&sha1, buffer, size);
+                   }
+                   if (mask & HASH_TYPE_SHA256) {
+                     __HASH_API(SHA256_Update)(&sha256, buffer, size);
+                   }
+                   if (mask & HASH_TYPE_XXH64) {
+                     XXH64_Update(&xxh64, buffer, size);
+                   }
+                 }));
 
   MultiHashes mh;
   mh.mask = mask;
+  unsigned char hash[__HASH_API(SHA256_DIGEST_LENGTH)];
   if (mask & HASH_TYPE_MD5) {
-    mh.md5 = hashes.at(HASH_TYPE_MD5)->digest();
+    __HASH_API(MD5_Final)(hash, &md5);
+    mh.md5 = getHexDigest(hash, __HASH_API(MD5_DIGEST_LENGTH));
   }
   if (mask & HASH_TYPE_SHA1) {
-    mh.sha1 = hashes.at(HASH_TYPE_SHA1)->digest();
+    __HASH_API(SHA1_Final)(hash, &sha1);
+    mh.sha1 = getHexDigest(hash, __HASH_API(SHA1_DIGEST_LENGTH));
   }
   if (mask & HASH_TYPE_SHA256) {
-    mh.sha256 = hashes.at(HASH_TYPE_SHA256)->digest();
+    __HASH_API(SHA256_Final)(hash, &sha256);
+    mh.sha256 = getHexDigest(hash, __HASH_API(SHA256_DIGEST_LENGTH));
+  }
+  if (mask & HASH_TYPE_XXH64) {
+    XXH64_Final(hash, &xxh64);
+    mh.xxh64 = getHexDigest(hash, XXH64_DIGEST_LENGTH);
   }
   return mh;
 }
@@ -135,6 +312,8 @@ std::string hashFromFile(HashType hash_type, const std::string& path) {
     return hashes.md5;
   } else if (hash_type == HASH_TYPE_SHA1) {
     return hashes.sha1;
+  } else if (hash_type == HASH_TYPE_XXH64) {
+    return hashes.xxh64;
   } else {
     return hashes.sha256;
   }
@@ -0,0 +1,369 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <map>
+#include <thread>
+#include <vector>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/hash.h>
+#include <osquery/system.h>
+
+#include "osquery/core/process.h"
+#include "osquery/core/query_deadline.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     hash_cache_max,
+     10000,
+     "Maximum files with digests stored in the hash cache (0 disables)");
+
+FLAG(uint64,
+     hash_workers,
+     2,
+     "Threads hashing the files of a query (default 2, 0 hashes in series)");
+
+/// The stat metadata that must match for stored digests to be reused.
+struct HashFileIdentity {
+  uint64_t device{0};
+  uint64_t inode{0};
+  uint64_t size{0};
+  uint64_t mtime{0};
+  uint64_t ctime{0};
+
+  std::string toString() const {
+    return std::to_string(device) + ":" + std::to_string(inode) + ":" +
+           std::to_string(size) + ":" + std::to_string(mtime) + ":" +
+           std::to_string(ctime);
+  }
+
+  bool operator==(const HashFileIdentity& other) const {
+    return device == other.device && inode == other.inode &&
+           size == other.size && mtime == other.mtime && ctime == other.ctime;
+  }
+};
+
+/// Stat a file, times are in nanoseconds where the platform supports it.
+static bool getFileIdentity(const std::string& path, HashFileIdentity& id) {
+  struct stat file;
+  if (::stat(path.c_str(), &file) != 0) {
+    return false;
+  }
+
+  id.device = static_cast<uint64_t>(file.st_dev);
+  id.inode = static_cast<uint64_t>(file.st_ino);
+  id.size = static_cast<uint64_t>(file.st_size);
+#if defined(__linux__)
+  id.mtime = file.st_mtim.tv_sec * 1000000000ULL + file.st_mtim.tv_nsec;
+  id.ctime = file.st_ctim.tv_sec * 1000000000ULL + file.st_ctim.tv_nsec;
+#elif defined(__APPLE__)
+  id.mtime =
+      file.st_mtimespec.tv_sec * 1000000000ULL + file.st_mtimespec.tv_nsec;
+  id.ctime =
+      file.st_ctimespec.tv_sec * 1000000000ULL + file.st_ctimespec.tv_nsec;
+#else
+  id.mtime = static_cast<uint64_t>(file.st_mtime) * 1000000000ULL;
+  id.ctime = static_cast<uint64_t>(file.st_ctime) * 1000000000ULL;
+#endif
+  return true;
+}
+
+/**
+ * @brief The least recently used order of stored digests.
+ *
+ * The backing store does not track access, so the order is kept in memory and
+ * seeded, in no particular order, from the stored keys on first use.
+ */
+class HashCacheIndex : private boost::noncopyable {
+ public:
+  static HashCacheIndex& instance() {
+    static HashCacheIndex index;
+    return index;
+  }
+
+  /// Mark a path as the most recently used, evicting beyond the maximum.
+  void touch(const std::string& path, bool hit) {
+    std::vector<std::string> evicted;
+    {
+      WriteLock lock(mutex_);
+      load();
+      if (hit) {
+        stats_.hits++;
+      }
+
+      auto it = index_.find(path);
+      if (it != index_.end()) {
+        order_.splice(order_.begin(), order_, it->second);
+      } else {
+        order_.push_front(path);
+        index_[path] = order_.begin();
+      }
+
+      while (order_.size() > FLAGS_hash_cache_max) {
+        evicted.push_back(order_.back());
+        index_.erase(order_.back());
+        order_.pop_back();
+        stats_.evictions++;
+      }
+      stats_.entries = order_.size();
+    }
+
+    if (!evicted.empty()) {
+      deleteDatabaseValues(kHashes, evicted);
+    }
+  }
+
+  /// Count a request that hashed the file.
+  void miss(bool stale) {
+    WriteLock lock(mutex_);
+    if (stale) {
+      stats_.stale++;
+    } else {
+      stats_.misses++;
+    }
+  }
+
+  /// Count a stale request whose content fingerprint matched.
+  void unchanged() {
+    WriteLock lock(mutex_);
+    stats_.unchanged++;
+  }
+
+  HashCacheStats stats() {
+    WriteLock lock(mutex_);
+    load();
+    stats_.entries = order_.size();
+    return stats_;
+  }
+
+ private:
+  HashCacheIndex() {}
+
+  /// Seed the order from the stored keys, the caller holds the lock.
+  void load() {
+    if (loaded_) {
+      return;
+    }
+    loaded_ = true;
+
+    std::vector<std::string> keys;
+    if (scanDatabaseKeys(kHashes, keys).ok()) {
+      for (const auto& key : keys) {
+        order_.push_back(key);
+        index_[key] = std::prev(order_.end());
+      }
+    }
+  }
+
+ private:
+  /// Paths with stored digests, most recently used first.
+  std::list<std::string> order_;
+
+  /// Each path's position within the order.
+  std::map<std::string, std::list<std::string>::iterator> index_;
+
+  /// Set after the order is seeded from the backing store.
+  bool loaded_{false};
+
+  HashCacheStats stats_;
+
+  Mutex mutex_;
+};
+
+/// Copy only the requested digests.
+static inline MultiHashes selectHashes(int mask, MultiHashes& hashes) {
+  MultiHashes mh;
+  mh.mask = mask;
+  if (mask & HASH_TYPE_MD5) {
+    mh.md5 = std::move(hashes.md5);
+  }
+  if (mask & HASH_TYPE_SHA1) {
+    mh.sha1 = std::move(hashes.sha1);
+  }
+  if (mask & HASH_TYPE_SHA256) {
+    mh.sha256 = std::move(hashes.sha256);
+  }
+  if (mask & HASH_TYPE_XXH64) {
+    mh.xxh64 = std::move(hashes.xxh64);
+  }
+  return mh;
+}
+
+/// Parse the stored digests, an empty digest was never requested.
+static inline void parseStoredHashes(std::vector<std::string>& fields,
+                                     MultiHashes& stored) {
+  stored.md5 = std::move(fields[1]);
+  stored.sha1 = std::move(fields[2]);
+  stored.sha256 = std::move(fields[3]);
+  if (fields.size() > 4) {
+    stored.xxh64 = std::move(fields[4]);
+  }
+  stored.mask |= (stored.md5.empty()) ? 0 : HASH_TYPE_MD5;
+  stored.mask |= (stored.sha1.empty()) ? 0 : HASH_TYPE_SHA1;
+  stored.mask |= (stored.sha256.empty()) ? 0 : HASH_TYPE_SHA256;
+  stored.mask |= (stored.xxh64.empty()) ? 0 : HASH_TYPE_XXH64;
+}
+
+/// The size recorded within a stored identity.
+static inline std::string identitySize(const std::string& identity) {
+  std::vector<std::string> parts;
+  boost::split(parts, identity, boost::is_any_of(":"));
+  return (parts.size() == 5) ? parts[2] : "";
+}
+
+MultiHashes cachedHashMultiFromFile(int mask, const std::string& path) {
+  HashFileIdentity before;
+  if (FLAGS_hash_cache_max == 0 || !getFileIdentity(path, before)) {
+    return hashMultiFromFile(mask, path);
+  }
+
+  // A stored value is the identity followed by the MD5, SHA1, SHA256, and
+  // XXH64 digests, values stored before XXH64 have four fields.
+  std::string value;
+  if (!getDatabaseValue(kHashes, path, value).ok()) {
+    return hashMultiFromFile(mask, path);
+  }
+
+  auto identity = before.toString();
+  MultiHashes stored;
+  stored.mask = 0;
+  bool stale = false;
+  MultiHashes previous;
+  previous.mask = 0;
+  if (!value.empty()) {
+    std::vector<std::string> fields;
+    boost::split(fields, value, boost::is_any_of(","));
+    if (fields.size() != 4 && fields.size() != 5) {
+      stale = true;
+    } else if (fields[0] == identity) {
+      parseStoredHashes(fields, stored);
+    } else {
+      stale = true;
+      // Touching a file or restoring it from a backup changes the metadata,
+      // a file of the same size may still have the same content.
+      if (identitySize(fields[0]) == std::to_string(before.size)) {
+        parseStoredHashes(fields, previous);
+      }
+    }
+  }
+
+  auto& index = HashCacheIndex::instance();
+  int missing = mask & ~stored.mask;
+  if (missing == 0) {
+    index.touch(path, true);
+    return selectHashes(mask, stored);
+  }
+
+  // The fingerprint is always stored, it gates rehashing after a change.
+  missing |= HASH_TYPE_XXH64 & ~stored.mask;
+  if ((previous.mask & HASH_TYPE_XXH64) && (previous.mask & mask) == mask) {
+    // Only the fingerprint is computed, the other digests follow if the
+    // content did change.
+    auto fingerprint = hashMultiFromFile(HASH_TYPE_XXH64, path);
+    if (!fingerprint.xxh64.empty() && fingerprint.xxh64 == previous.xxh64) {
+      index.unchanged();
+      stored = std::move(previous);
+      missing = 0;
+    } else {
+      stored.xxh64 = std::move(fingerprint.xxh64);
+      missing &= ~HASH_TYPE_XXH64;
+    }
+  }
+
+  MultiHashes hashes;
+  if (missing != 0) {
+    index.miss(stale);
+    hashes = hashMultiFromFile(missing, path);
+  }
+  if (missing & HASH_TYPE_MD5) {
+    stored.md5 = hashes.md5;
+  }
+  if (missing & HASH_TYPE_SHA1) {
+    stored.sha1 = hashes.sha1;
+  }
+  if (missing & HASH_TYPE_SHA256) {
+    stored.sha256 = hashes.sha256;
+  }
+  if (missing & HASH_TYPE_XXH64) {
+    stored.xxh64 = hashes.xxh64;
+  }
+
+  // Only store digests if the file did not change while hashing and has
+  // settled, a later write within the same timestamp would go unnoticed.
+  HashFileIdentity after;
+  if (getFileIdentity(path, after) && after == before &&
+      !isRecentlyModified(after.mtime)) {
+    setDatabaseValue(kHashes,
+                     path,
+                     identity + "," + stored.md5 + "," + stored.sha1 + "," +
+                         stored.sha256 + "," + stored.xxh64);
+    index.touch(path, false);
+  }
+
+  return selectHashes(mask, stored);
+}
+
+std::vector<MultiHashes> cachedHashMultiFromFiles(
+    int mask, const std::vector<std::string>& paths) {
+  std::vector<MultiHashes> results(paths.size());
+  auto workers =
+      std::min(static_cast<size_t>(FLAGS_hash_workers), paths.size());
+#if !defined(__linux__) && !defined(WIN32)
+  // Reads drop privileges with the process-wide effective user, only Linux
+  // drops the file system user for a single thread.
+  workers = 0;
+#endif
+  if (workers <= 1) {
+    for (size_t i = 0; i < paths.size() && !isQueryCancelled(); i++) {
+      results[i] = cachedHashMultiFromFile(mask, paths[i]);
+    }
+    return results;
+  }
+
+  // Each worker takes the next unhashed path, so large files do not hold up
+  // a fixed share of the paths.
+  std::atomic<size_t> next{0};
+  auto deadline = getQueryDeadline();
+  auto worker = [&]() {
+    setThreadToBackgroundPriority();
+    // The workers stop with the query that requested the hashes.
+    setQueryDeadline(deadline);
+    for (auto i = next++; i < paths.size() && !isQueryCancelled();
+         i = next++) {
+      results[i] = cachedHashMultiFromFile(mask, paths[i]);
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < workers; i++) {
+    threads.emplace_back(worker);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return results;
+}
+
+HashCacheStats getHashCacheStats() {
+  return HashCacheIndex::instance().stats();
+}
+}
@@ -8,6 +8,7 @@
  *
  */
 
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <random>
@@ -208,6 +209,12 @@ volatile std::sig_atomic_t kExitCode{0};
 /// The saved thread ID for shutdown to short-circuit raising a signal.
 static std::thread::id kMainThreadId;
 
+/// The time the initializer was constructed, near the start of main.
+static chrono_clock::time_point kInitializeTime;
+
+/// Milliseconds until the initializer finished starting.
+static std::atomic<size_t> kReadyTime{0};
+
 static inline void printUsage(const std::string& binary, ToolType tool) {
   // Parse help options before gflags. Only display osquery-related options.
   fprintf(stdout, DESCRIPTION, kVersion.c_str());
@@ -242,6 +249,7 @@ Initializer::Initializer(int& argc, char**& argv, ToolType tool)
       argv_(&argv),
       tool_(tool),
       binary_((tool == ToolType::DAEMON) ? "osqueryd" : "osqueryi") {
+  kInitializeTime = chrono_clock::now();
   std::srand(static_cast<unsigned int>(
       chrono_clock::now().time_since_epoch().count()));
 
@@ -557,6 +565,10 @@ void Initializer::start() const {
   // internal 'shutdown' method.
   osquery::startExtensionManager();
 
+  // Autoloaded extensions register concurrently, wait for the set so their
+  // tables are attached together.
+  osquery::waitForExtensions();
+
   // Then set the config plugin, which uses a single/active plugin.
   initActivePlugin("config", FLAGS_config_plugin);
 
@@ -595,6 +607,7 @@ void Initializer::start() const {
     initActivePlugin("logger", FLAGS_logger_plugin);
   }
   initLogger(binary_);
+  startLogPipeline();
 
   // Initialize the distributed plugin, if necessary
   if (!FLAGS_disable_distributed) {
@@ -606,6 +619,16 @@ void Initializer::start() const {
   // Start event threads.
   osquery::attachEvents();
   EventFactory::delay();
+
+  kReadyTime = static_cast<size_t>(
+      std::chrono::duration_cast<std::chrono::milliseconds>(
+          chrono_clock::now() - kInitializeTime)
+          .count());
+  VLOG(1) << binary_ << " started in " << kReadyTime << "ms";
+}
+
+size_t Initializer::getReadyTime() {
+  return kReadyTime;
 }
 
 void Initializer::waitForShutdown() {
@@ -621,6 +644,9 @@ void Initializer::waitForShutdown() {
 }
 
 void Initializer::requestShutdown(int retcode) {
+  // Results queued by the scheduler are logged before services stop.
+  flushLogPipeline();
+
   // Stop thrift services/clients/and their thread pools.
   kExitCode = retcode;
   if (std::this_thread::get_id() != kMainThreadId) {
@@ -0,0 +1,194 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <set>
+
+#include <osquery/core.h>
+
+#include "osquery/core/perf.h"
+
+namespace osquery {
+
+FLAG(bool,
+     perf_counters,
+     false,
+     "Time hot-path stages for the osquery_perf table");
+
+const std::array<const char*, PERF_STAGE_COUNT> kPerfStageNames = {{
+    "filter",
+    "generate",
+    "diff",
+    "serialize",
+    "log",
+    "add_event",
+    "database_get",
+    "database_put",
+}};
+
+const std::array<uint64_t, 5> kPerfBounds = {{10, 100, 1000, 10000, 100000}};
+
+/// A thread's counters, written by the thread and summed by readers.
+struct PerfThreadCounters {
+  std::array<std::atomic<uint64_t>, PERF_STAGE_COUNT> calls;
+  std::array<std::atomic<uint64_t>, PERF_STAGE_COUNT> total_time;
+  std::array<std::atomic<uint64_t>, PERF_STAGE_COUNT> max_time;
+  std::array<std::array<std::atomic<uint64_t>, 6>, PERF_STAGE_COUNT> histogram;
+
+  PerfThreadCounters() {
+    clear();
+  }
+
+  void clear() {
+    for (size_t i = 0; i < PERF_STAGE_COUNT; i++) {
+      calls[i] = 0;
+      total_time[i] = 0;
+      max_time[i] = 0;
+      for (auto& bucket : histogram[i]) {
+        bucket = 0;
+      }
+    }
+  }
+
+  /// Add these counters to aggregated stats.
+  void add(std::vector<PerfStageStats>& stats) const {
+    for (size_t i = 0; i < PERF_STAGE_COUNT; i++) {
+      auto& stage = stats[i];
+      stage.calls += calls[i].load(std::memory_order_relaxed);
+      stage.total_time += total_time[i].load(std::memory_order_relaxed);
+      stage.max_time =
+          std::max(stage.max_time, max_time[i].load(std::memory_order_relaxed));
+      for (size_t j = 0; j < stage.histogram.size(); j++) {
+        stage.histogram[j] += histogram[i][j].load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// Set if the thread recorded a call.
+  bool used() const {
+    for (const auto& count : calls) {
+      if (count.load(std::memory_order_relaxed) > 0) {
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+/// The counters of every running thread, and of exited threads.
+class PerfCounters : private boost::noncopyable {
+ public:
+  static PerfCounters& instance() {
+    static PerfCounters counters;
+    return counters;
+  }
+
+  /// Create counters for a new thread.
+  std::shared_ptr<PerfThreadCounters> add() {
+    auto counters = std::make_shared<PerfThreadCounters>();
+    WriteLock lock(mutex_);
+    threads_.insert(counters);
+    return counters;
+  }
+
+  /// Keep the counts of an exiting thread.
+  void remove(const std::shared_ptr<PerfThreadCounters>& counters) {
+    std::vector<PerfStageStats> stats(PERF_STAGE_COUNT);
+    counters->add(stats);
+
+    WriteLock lock(mutex_);
+    for (size_t i = 0; i < PERF_STAGE_COUNT; i++) {
+      auto& exited = exited_[i];
+      exited.calls += stats[i].calls;
+      exited.total_time += stats[i].total_time;
+      exited.max_time = std::max(exited.max_time, stats[i].max_time);
+      for (size_t j = 0; j < exited.histogram.size(); j++) {
+        exited.histogram[j] += stats[i].histogram[j];
+      }
+    }
+    exited_threads_ += (counters->used()) ? 1 : 0;
+    threads_.erase(counters);
+  }
+
+  std::vector<PerfStageStats> get(size_t& threads) {
+    WriteLock lock(mutex_);
+    auto stats = exited_;
+    threads = exited_threads_;
+    for (const auto& counters : threads_) {
+      counters->add(stats);
+      threads += (counters->used()) ? 1 : 0;
+    }
+    return stats;
+  }
+
+  void clear() {
+    WriteLock lock(mutex_);
+    exited_ = std::vector<PerfStageStats>(PERF_STAGE_COUNT);
+    exited_threads_ = 0;
+    for (const auto& counters : threads_) {
+      counters->clear();
+    }
+  }
+
+ private:
+  PerfCounters() : exited_(PERF_STAGE_COUNT) {}
+
+ private:
+  /// Counters of running threads.
+  std::set<std::shared_ptr<PerfThreadCounters>> threads_;
+
+  /// Aggregated counts of exited threads.
+  std::vector<PerfStageStats> exited_;
+
+  /// Number of exited threads that recorded a call.
+  size_t exited_threads_{0};
+
+  Mutex mutex_;
+};
+
+/// Registers a thread's counters on first use, and keeps them on exit.
+struct PerfThreadHolder {
+  std::shared_ptr<PerfThreadCounters> counters;
+
+  PerfThreadHolder() : counters(PerfCounters::instance().add()) {}
+
+  ~PerfThreadHolder() {
+    PerfCounters::instance().remove(counters);
+  }
+};
+
+void recordPerf(PerfStage stage, uint64_t time) {
+  static thread_local PerfThreadHolder holder;
+  auto& counters = *holder.counters;
+
+  // The first bucket with a bound above the time, or the last bucket.
+  size_t bucket = std::upper_bound(kPerfBounds.begin(), kPerfBounds.end(),
+                                   time) -
+                  kPerfBounds.begin();
+
+  // Only this thread writes its counters, readers may see partial updates.
+  counters.calls[stage].fetch_add(1, std::memory_order_relaxed);
+  counters.total_time[stage].fetch_add(time, std::memory_order_relaxed);
+  counters.histogram[stage][bucket].fetch_add(1, std::memory_order_relaxed);
+  if (time > counters.max_time[stage].load(std::memory_order_relaxed)) {
+    counters.max_time[stage].store(time, std::memory_order_relaxed);
+  }
+}
+
+std::vector<PerfStageStats> getPerfStats(size_t& threads) {
+  return PerfCounters::instance().get(threads);
+}
+
+void clearPerfStats() {
+  PerfCounters::instance().clear();
+}
+}
@@ -0,0 +1,126 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_bool(perf_counters);
+
+/**
+ * @brief Hot-path stages timed when --perf_counters is set.
+ *
+ * Stages may nest: a filter includes its table's generate, and a diff or
+ * event may include database reads and writes.
+ */
+enum PerfStage {
+  /// A virtual table xFilter, building the context and the first batch.
+  PERF_FILTER = 0,
+
+  /// A call into a table plugin, or a batch pulled from its generator.
+  PERF_GENERATE,
+
+  /// The differential of a scheduled query's results against the previous.
+  PERF_DIFF,
+
+  /// Serializing a query log item for a logger.
+  PERF_SERIALIZE,
+
+  /// Logging a query log item, on the scheduler or a pipeline thread.
+  PERF_LOG,
+
+  /// An event subscriber adding an event.
+  PERF_ADD_EVENT,
+
+  /// A database read of a single key.
+  PERF_DATABASE_GET,
+
+  /// A database write of a single key or a batch.
+  PERF_DATABASE_PUT,
+
+  PERF_STAGE_COUNT,
+};
+
+/// The stage names, see the osquery_perf table.
+extern const std::array<const char*, PERF_STAGE_COUNT> kPerfStageNames;
+
+/// Upper bounds in microseconds of each stage time bucket but the last.
+extern const std::array<uint64_t, 5> kPerfBounds;
+
+/// Timings for one stage, aggregated across threads.
+struct PerfStageStats {
+  /// Number of timed calls.
+  uint64_t calls{0};
+
+  /// Total microseconds spent in the stage.
+  uint64_t total_time{0};
+
+  /// The longest call in microseconds.
+  uint64_t max_time{0};
+
+  /// Calls counted by time, see kPerfBounds.
+  std::array<uint64_t, 6> histogram{{0, 0, 0, 0, 0, 0}};
+};
+
+/// Add a timed call to the calling thread's counters.
+void recordPerf(PerfStage stage, uint64_t time);
+
+/**
+ * @brief Aggregate every thread's counters.
+ *
+ * Each thread counts into its own counters, which are only summed when read.
+ * The counters of exited threads are kept.
+ *
+ * @param threads Output, the number of threads that recorded a call.
+ * @return Stats for each stage, indexed by PerfStage.
+ */
+std::vector<PerfStageStats> getPerfStats(size_t& threads);
+
+/// Reset every thread's counters.
+void clearPerfStats();
+
+/**
+ * @brief Time a scope as a stage.
+ *
+ * When --perf_counters is not set the timer only reads the flag.
+ */
+class PerfTimer : private boost::noncopyable {
+ public:
+  explicit PerfTimer(PerfStage stage)
+      : stage_(stage), enabled_(FLAGS_perf_counters) {
+    if (enabled_) {
+      start_ = std::chrono::steady_clock::now();
+    }
+  }
+
+  ~PerfTimer() {
+    if (enabled_) {
+      recordPerf(stage_,
+                 std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start_)
+                     .count());
+    }
+  }
+
+ private:
+  PerfStage stage_;
+  bool enabled_{false};
+  std::chrono::steady_clock::time_point start_;
+};
+}
@@ -8,11 +8,27 @@
  *
  */
 
+#include <fcntl.h>
 #include <signal.h>
+#include <unistd.h>
 
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#if defined(__linux__)
+#include <malloc.h>
+#elif defined(__APPLE__)
+#include <libproc.h>
+#include <mach/mach.h>
+#include <malloc/malloc.h>
+#endif
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <utility>
 #include <vector>
 
 #include <osquery/logger.h>
@@ -70,6 +86,201 @@ ProcessState PlatformProcess::checkStatus(int& status) const {
   return PROCESS_STATE_CHANGE;
 }
 
+#if defined(__linux__)
+Status PlatformProcess::getResourceUsage(ProcessResourceUsage& usage) const {
+  if (id_ == kInvalidPid) {
+    return Status(1, "Invalid process");
+  }
+
+  // A single read of the stat file, the process name may contain spaces.
+  auto path = "/proc/" + std::to_string(id_) + "/stat";
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return Status(1, "Cannot read process stat");
+  }
+  char buffer[1024] = {0};
+  auto size = ::read(fd, buffer, sizeof(buffer) - 1);
+  ::close(fd);
+  if (size <= 0) {
+    return Status(1, "Cannot read process stat");
+  }
+
+  const char* fields = std::strrchr(buffer, ')');
+  if (fields == nullptr) {
+    return Status(1, "Malformed process stat");
+  }
+
+  // Fields following the name, from 0: state, parent (1), utime (11),
+  // stime (12), and rss in pages (21).
+  char state = 0;
+  unsigned long long parent = 0, user_time = 0, system_time = 0, pages = 0;
+  int parsed = sscanf(fields + 1,
+                      " %c %llu %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu %llu "
+                      "%*s %*s %*s %*s %*s %*s %*s %*s %llu",
+                      &state,
+                      &parent,
+                      &user_time,
+                      &system_time,
+                      &pages);
+  if (parsed != 5) {
+    return Status(1, "Malformed process stat");
+  }
+
+  static const auto page_size = static_cast<uint64_t>(::sysconf(_SC_PAGESIZE));
+  usage.parent = static_cast<pid_t>(parent);
+  usage.user_time = user_time;
+  usage.system_time = system_time;
+  usage.resident_size = pages * page_size;
+  return Status(0, "OK");
+}
+
+/// Convert a time to the clock ticks used by /proc/<pid>/stat.
+static inline uint64_t getTimeTicks(const struct timeval& time) {
+  static const auto ticks = static_cast<uint64_t>(::sysconf(_SC_CLK_TCK));
+  return static_cast<uint64_t>(time.tv_sec) * ticks +
+         static_cast<uint64_t>(time.tv_usec) * ticks / 1000000;
+}
+
+Status PlatformProcess::getThreadResourceUsage(ProcessResourceUsage& usage) {
+  struct rusage rusage;
+  if (::getrusage(RUSAGE_THREAD, &rusage) != 0) {
+    return Status(1, "Cannot read thread usage");
+  }
+
+  usage.user_time = getTimeTicks(rusage.ru_utime);
+  usage.system_time = getTimeTicks(rusage.ru_stime);
+
+  // Bytes allocated from the arenas and with mmap.
+  auto info = ::mallinfo();
+  usage.allocated_size = static_cast<unsigned>(info.uordblks);
+  usage.allocated_size += static_cast<unsigned>(info.hblkhd);
+  return Status(0, "OK");
+}
+#elif defined(__APPLE__)
+Status PlatformProcess::getResourceUsage(ProcessResourceUsage& usage) const {
+  if (id_ == kInvalidPid) {
+    return Status(1, "Invalid process");
+  }
+
+  struct proc_bsdshortinfo info;
+  if (proc_pidinfo(id_, PROC_PIDT_SHORTBSDINFO, 1, &info, sizeof(info)) !=
+      sizeof(info)) {
+    return Status(1, "Cannot read process info");
+  }
+
+  struct rusage_info_v2 rusage;
+  if (proc_pid_rusage(id_, RUSAGE_INFO_V2, (rusage_info_t*)&rusage) != 0) {
+    return Status(1, "Cannot read process usage");
+  }
+
+  // CPU times are reported in nanoseconds.
+  usage.parent = static_cast<pid_t>(info.pbsi_ppid);
+  usage.user_time = rusage.ri_user_time / 1000000;
+  usage.system_time = rusage.ri_system_time / 1000000;
+  usage.resident_size = rusage.ri_resident_size;
+  return Status(0, "OK");
+}
+
+Status PlatformProcess::getThreadResourceUsage(ProcessResourceUsage& usage) {
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  auto thread = mach_thread_self();
+  auto kr =
+      thread_info(thread, THREAD_BASIC_INFO, (thread_info_t)&info, &count);
+  mach_port_deallocate(mach_task_self(), thread);
+  if (kr != KERN_SUCCESS) {
+    return Status(1, "Cannot read thread usage");
+  }
+
+  usage.user_time = static_cast<uint64_t>(info.user_time.seconds) * 1000 +
+                    info.user_time.microseconds / 1000;
+  usage.system_time = static_cast<uint64_t>(info.system_time.seconds) * 1000 +
+                      info.system_time.microseconds / 1000;
+
+  malloc_statistics_t stats;
+  malloc_zone_statistics(nullptr, &stats);
+  usage.allocated_size = stats.size_in_use;
+  return Status(0, "OK");
+}
+#else
+Status PlatformProcess::getResourceUsage(ProcessResourceUsage& usage) const {
+  return Status(1, "Not supported");
+}
+
+Status PlatformProcess::getThreadResourceUsage(ProcessResourceUsage& usage) {
+  return Status(1, "Not supported");
+}
+#endif
+
+#if defined(__linux__)
+/// The leaf of the process placing a child under limits.
+const std::string kWatcherCgroup = "/osqueryd.watcher";
+
+/// The cgroup of a child under limits.
+const std::string kWorkerCgroup = "/osqueryd.worker";
+
+static Status writeCgroupFile(const std::string& path,
+                              const std::string& value) {
+  auto fd = ::open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return Status(1, "Cannot open " + path);
+  }
+  auto written = ::write(fd, value.data(), value.size());
+  ::close(fd);
+  if (written != static_cast<ssize_t>(value.size())) {
+    return Status(1, "Cannot write " + path + ": " + strerror(errno));
+  }
+  return Status(0, "OK");
+}
+
+Status PlatformProcess::limitResources(size_t memory, size_t cpu) const {
+  std::string parent;
+  auto status = getUnifiedCgroup(parent);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The caller is moved to a leaf once, later children share its parent.
+  if (parent.size() > kWatcherCgroup.size() &&
+      parent.compare(parent.size() - kWatcherCgroup.size(),
+                     kWatcherCgroup.size(),
+                     kWatcherCgroup) == 0) {
+    parent.erase(parent.size() - kWatcherCgroup.size());
+  } else {
+    ::mkdir((parent + kWatcherCgroup).c_str(), 0755);
+    status = writeCgroupFile(parent + kWatcherCgroup + "/cgroup.procs",
+                             std::to_string(::getpid()));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  status = writeCgroupFile(parent + "/cgroup.subtree_control", "+cpu +memory");
+  if (!status.ok()) {
+    return status;
+  }
+
+  auto child = parent + kWorkerCgroup;
+  ::mkdir(child.c_str(), 0755);
+  // The CPU quota is per 100ms period, a percent of one CPU is 1ms.
+  for (const auto& limit : std::vector<std::pair<std::string, std::string>>{
+           {"memory.high", std::to_string(memory)},
+           {"memory.max", std::to_string(memory * 2)},
+           {"cpu.max", std::to_string(cpu * 1000) + " 100000"},
+       }) {
+    status = writeCgroupFile(child + "/" + limit.first, limit.second);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return writeCgroupFile(child + "/cgroup.procs", std::to_string(id_));
+}
+#else
+Status PlatformProcess::limitResources(size_t memory, size_t cpu) const {
+  return Status(1, "Not supported");
+}
+#endif
+
 std::shared_ptr<PlatformProcess> PlatformProcess::getCurrentProcess() {
   pid_t pid = ::getpid();
   return std::make_shared<PlatformProcess>(pid);
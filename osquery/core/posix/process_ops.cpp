@@ -8,16 +8,31 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
 #include <string>
 
 #include <dlfcn.h>
+#if defined(__linux__)
+#include <malloc.h>
+#endif
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <sys/resource.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#elif defined(__APPLE__)
+#include <pthread.h>
+#endif
+
 #include <boost/optional.hpp>
 
 #include "osquery/core/process.h"
@@ -78,6 +93,134 @@ void setToBackgroundPriority() {
   setpriority(PRIO_PGRP, 0, 10);
 }
 
+void setThreadToBackgroundPriority() {
+#if defined(__linux__)
+  // Linux applies CPU and I/O priorities to a thread ID.
+  auto tid = static_cast<id_t>(::syscall(SYS_gettid));
+  setpriority(PRIO_PROCESS, tid, 19);
+
+  // Using: ioprio_set(IOPRIO_WHO_PROCESS, tid, IOPRIO_PRIO_VALUE(BE, 7)).
+  // The lowest best-effort level is used, the idle class may starve reads.
+  syscall(SYS_ioprio_set, 1, tid, (2 << 13) | 7);
+#elif defined(__APPLE__)
+  pthread_set_qos_class_self_np(QOS_CLASS_UTILITY, 0);
+  setiopolicy_np(IOPOL_TYPE_DISK, IOPOL_SCOPE_THREAD, IOPOL_THROTTLE);
+#endif
+}
+
+Status setThreadPriority(int nice, const std::vector<size_t>& cpus) {
+  nice = std::max(-20, std::min(19, nice));
+#if defined(__linux__)
+  auto tid = static_cast<id_t>(::syscall(SYS_gettid));
+  if (setpriority(PRIO_PROCESS, tid, nice) != 0) {
+    return Status(1, "Cannot set the thread nice level");
+  }
+
+  // The best-effort I/O level follows the nice level, as it does for threads
+  // without an I/O priority: ioprio_set(IOPRIO_WHO_PROCESS, tid, level).
+  syscall(SYS_ioprio_set, 1, tid, (2 << 13) | ((nice + 20) / 5));
+
+  if (!cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto& cpu : cpus) {
+      if (cpu < CPU_SETSIZE) {
+        CPU_SET(cpu, &set);
+      }
+    }
+    if (sched_setaffinity(static_cast<pid_t>(tid), sizeof(set), &set) != 0) {
+      return Status(1, "Cannot set the thread CPU affinity");
+    }
+  }
+  return Status(0, "OK");
+#elif defined(__APPLE__)
+  // Threads have a quality of service class instead of a nice level.
+  auto qos = (nice < 0) ? QOS_CLASS_USER_INITIATED
+                        : (nice < 10) ? QOS_CLASS_DEFAULT : QOS_CLASS_UTILITY;
+  if (pthread_set_qos_class_self_np(qos, 0) != 0) {
+    return Status(1, "Cannot set the thread QoS class");
+  }
+  setiopolicy_np(IOPOL_TYPE_DISK,
+                 IOPOL_SCOPE_THREAD,
+                 (nice < 10) ? IOPOL_DEFAULT : IOPOL_THROTTLE);
+  if (!cpus.empty()) {
+    return Status(1, "Thread CPU affinity is not supported");
+  }
+  return Status(0, "OK");
+#else
+  return Status(1, "Thread priorities are not supported");
+#endif
+}
+
+void releaseFreedMemory() {
+#if defined(__GLIBC__)
+  // Trims the top of the main heap and the free pages of every arena.
+  ::malloc_trim(0);
+#endif
+}
+
+#if defined(__linux__)
+Status getUnifiedCgroup(std::string& path) {
+  std::ifstream cgroups("/proc/self/cgroup");
+  std::string line;
+  while (std::getline(cgroups, line)) {
+    // The v2 hierarchy has the ID 0 and no controllers.
+    if (line.compare(0, 3, "0::") != 0) {
+      continue;
+    }
+    // Hybrid hosts mount the v2 hierarchy beside the v1 controllers.
+    for (const auto& root : {"/sys/fs/cgroup", "/sys/fs/cgroup/unified"}) {
+      path = std::string(root) + line.substr(3);
+      if (::access((path + "/cgroup.controllers").c_str(), F_OK) == 0) {
+        return Status(0, "OK");
+      }
+    }
+  }
+  return Status(1, "No cgroup v2 hierarchy");
+}
+#endif
+
+ResourcePressure getResourcePressure(size_t percent) {
+  ResourcePressure pressure;
+#if defined(__linux__)
+  std::string path;
+  if (!getUnifiedCgroup(path).ok()) {
+    return pressure;
+  }
+
+  auto stalled = [percent](const std::string& file) {
+    // The first line is: some avg10=1.23 avg60=0.50 avg300=0.10 total=N.
+    std::ifstream input(file);
+    std::string line;
+    if (!std::getline(input, line)) {
+      return false;
+    }
+    auto avg = line.find("avg10=");
+    return (avg != std::string::npos &&
+            std::strtod(line.c_str() + avg + 6, nullptr) >=
+                static_cast<double>(percent));
+  };
+  pressure.cpu = stalled(path + "/cpu.pressure");
+  pressure.memory = stalled(path + "/memory.pressure");
+
+  // The count of throttles at memory.high increased since the last read.
+  static std::atomic<long long> kMemoryHighEvents{-1};
+  std::ifstream events(path + "/memory.events");
+  std::string name;
+  long long count = 0;
+  while (events >> name >> count) {
+    if (name == "high") {
+      auto previous = kMemoryHighEvents.exchange(count);
+      if (previous >= 0 && count > previous) {
+        pressure.memory = true;
+      }
+      break;
+    }
+  }
+#endif
+  return pressure;
+}
+
 // Helper function to determine if thread is running with admin privilege.
 bool isUserAdmin() {
   return getuid() == 0;
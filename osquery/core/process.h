@@ -10,8 +10,10 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <string>
+#include <vector>
 
 #ifdef WIN32
 
@@ -66,6 +68,30 @@ enum ProcessState {
   PROCESS_STATE_CHANGE
 };
 
+/**
+ * @brief A process' CPU time and memory, sampled for self-monitoring.
+ *
+ * CPU times use the units of the processes table's user_time and system_time
+ * columns (clock ticks on Linux, milliseconds elsewhere) so watchdog limits
+ * and recorded query performance keep their meaning.
+ */
+struct ProcessResourceUsage {
+  /// The parent process ID.
+  pid_t parent{0};
+
+  /// CPU time spent in user mode.
+  uint64_t user_time{0};
+
+  /// CPU time spent in kernel mode.
+  uint64_t system_time{0};
+
+  /// Resident memory in bytes.
+  uint64_t resident_size{0};
+
+  /// Heap bytes in use by the allocator, 0 if the platform cannot report it.
+  uint64_t allocated_size{0};
+};
+
 /**
  * @brief Platform-agnostic process object.
  *
@@ -130,6 +156,41 @@ class PlatformProcess : private boost::noncopyable {
 
   virtual ProcessState checkStatus(int& status) const;
 
+  /**
+   * @brief Sample the process' resource usage.
+   *
+   * This reads the operating system's accounting for one process directly,
+   * without the SQL and Row overhead of selecting from the processes table,
+   * so the watchdog and schedule monitor may sample often.
+   */
+  Status getResourceUsage(ProcessResourceUsage& usage) const;
+
+  /**
+   * @brief Read the calling thread's CPU times and the allocator's usage.
+   *
+   * Only the user_time, system_time, and allocated_size members are set.
+   * Thread CPU times are not charged with work done concurrently by other
+   * threads, such as event publishers or other scheduled queries. The
+   * allocator's usage is process-wide, but tracks a query's heap growth more
+   * closely than resident memory.
+   */
+  static Status getThreadResourceUsage(ProcessResourceUsage& usage);
+
+  /**
+   * @brief Place the process under limits enforced by the operating system.
+   *
+   * On Linux the process is moved into a cgroup v2 child of the caller's
+   * cgroup, with memory.high, a memory.max of twice memory.high, and cpu.max.
+   * The caller is moved into a sibling leaf, a cgroup with processes cannot
+   * enable controllers for its children. On Windows the process is assigned
+   * to a job object with a committed memory limit of twice the memory and a
+   * hard CPU rate cap. Other platforms fail.
+   *
+   * @param memory The bytes of memory above which the process is throttled.
+   * @param cpu The percent of one CPU the process may use.
+   */
+  Status limitResources(size_t memory, size_t cpu) const;
+
   /// Returns the current process
   static std::shared_ptr<PlatformProcess> getCurrentProcess();
 
@@ -208,6 +269,31 @@ class SecurityDescriptor {
 };
 #endif
 
+/// Pressure the operating system reports for the calling process.
+struct ResourcePressure {
+  /// Runnable tasks were stalled waiting for CPU.
+  bool cpu{false};
+
+  /// Tasks were stalled on reclaim, or throttled at memory.high.
+  bool memory{false};
+};
+
+/**
+ * @brief Read the pressure on the calling process's resources.
+ *
+ * On Linux this is the pressure stall information (PSI) and the memory.high
+ * events of the process's cgroup v2. Other platforms report no pressure.
+ *
+ * @param percent The share of time stalled, averaged over 10 seconds, that
+ * is reported as pressure.
+ */
+ResourcePressure getResourcePressure(size_t percent);
+
+#ifdef __linux__
+/// The calling process's cgroup v2 directory.
+Status getUnifiedCgroup(std::string& path);
+#endif
+
 /// Returns the current user's ID (UID on POSIX systems and SID for Windows)
 std::string getUserId();
 
@@ -264,4 +350,28 @@ void cleanupDefunctProcesses();
 
 /// Sets the current process to run with background scheduling priority.
 void setToBackgroundPriority();
+
+/// Sets the calling thread to run with low CPU and I/O scheduling priority.
+void setThreadToBackgroundPriority();
+
+/**
+ * @brief Set the calling thread's scheduling priority and CPU affinity.
+ *
+ * Linux sets the thread's nice level and the matching best-effort I/O level.
+ * macOS maps the level to a QoS class, throttling disk I/O from 10, and
+ * Windows to a thread priority, using background mode from 15.
+ *
+ * @param nice A POSIX nice level, from -20 (highest) to 19 (lowest).
+ * @param cpus The CPUs the thread may run on, empty for any.
+ */
+Status setThreadPriority(int nice, const std::vector<size_t>& cpus);
+
+/**
+ * @brief Return freed heap memory to the operating system.
+ *
+ * Short-lived result sets free many small allocations together. The C
+ * runtime may keep the freed pages, and the fragments between live
+ * allocations, counted against the process's resident memory.
+ */
+void releaseFreedMemory();
 }
@@ -0,0 +1,44 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "osquery/core/query_deadline.h"
+
+namespace osquery {
+
+using Clock = std::chrono::steady_clock;
+
+/// The calling thread's deadline, and if it has passed.
+static thread_local Clock::time_point kQueryDeadline{Clock::time_point::max()};
+static thread_local bool kQueryCancelled{false};
+
+void setQueryDeadline(size_t seconds) {
+  setQueryDeadline((seconds > 0) ? Clock::now() + std::chrono::seconds(seconds)
+                                 : Clock::time_point::max());
+}
+
+Clock::time_point getQueryDeadline() {
+  return kQueryDeadline;
+}
+
+void setQueryDeadline(Clock::time_point deadline) {
+  kQueryDeadline = deadline;
+  kQueryCancelled = false;
+}
+
+bool isQueryCancelled() {
+  if (kQueryCancelled || kQueryDeadline == Clock::time_point::max()) {
+    return kQueryCancelled;
+  }
+
+  // Once passed, the query stays cancelled until the next deadline.
+  kQueryCancelled = (Clock::now() >= kQueryDeadline);
+  return kQueryCancelled;
+}
+}
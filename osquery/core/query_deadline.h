@@ -0,0 +1,55 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+#include <chrono>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief Limit the calling thread's query to a number of seconds.
+ *
+ * A runaway query, such as an unbounded glob or an expensive join, would
+ * otherwise run until the watchdog stops the worker and every buffered
+ * event is lost. SQLite's progress handler interrupts the statement after
+ * the deadline, and long running table generators stop producing rows when
+ * isQueryCancelled is true. The deadline is kept per thread since each
+ * query, including its table generators, runs on one thread.
+ *
+ * @param seconds the limit from now, 0 removes the deadline.
+ */
+void setQueryDeadline(size_t seconds);
+
+/// The calling thread's deadline, the maximum time point if there is none.
+std::chrono::steady_clock::time_point getQueryDeadline();
+
+/// Apply a query's deadline to a helper thread working for the query.
+void setQueryDeadline(std::chrono::steady_clock::time_point deadline);
+
+/// Check if the calling thread's query passed its deadline.
+bool isQueryCancelled();
+
+/// Apply a deadline for the duration of a query.
+class QueryDeadlineScope : private boost::noncopyable {
+ public:
+  explicit QueryDeadlineScope(size_t seconds) {
+    setQueryDeadline(seconds);
+  }
+
+  ~QueryDeadlineScope() {
+    setQueryDeadline(0);
+  }
+};
+}
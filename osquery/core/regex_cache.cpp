@@ -0,0 +1,178 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <list>
+#include <map>
+#include <stdexcept>
+
+#include "osquery/core/regex_cache.h"
+
+namespace osquery {
+
+const size_t kRegexCacheSize = 64;
+
+/// Characters escaped when a literal is copied into a regular expression.
+static const std::string kRegexSpecial = "\\^$.|?*+()[]{}";
+
+static inline void appendLiteral(std::string& out, char c) {
+  if (kRegexSpecial.find(c) != std::string::npos) {
+    out += '\\';
+  }
+  out += c;
+}
+
+/// Translate an SQL LIKE pattern, without an ESCAPE clause.
+static std::string translateLike(const std::string& pattern) {
+  std::string out;
+  for (const auto& c : pattern) {
+    if (c == '%') {
+      out += "[\\s\\S]*";
+    } else if (c == '_') {
+      out += "[\\s\\S]";
+    } else {
+      appendLiteral(out, c);
+    }
+  }
+  return out;
+}
+
+/// Translate an SQL GLOB pattern, see SQLite's patternCompare.
+static std::string translateGlob(const std::string& pattern) {
+  std::string out;
+  for (size_t i = 0; i < pattern.size(); i++) {
+    auto c = pattern[i];
+    if (c == '*') {
+      out += "[\\s\\S]*";
+    } else if (c == '?') {
+      out += "[\\s\\S]";
+    } else if (c == '[') {
+      // A ']' first in the set, or after '^', is a member of the set.
+      size_t start = i + 1;
+      if (start < pattern.size() && pattern[start] == '^') {
+        start++;
+      }
+      if (start < pattern.size() && pattern[start] == ']') {
+        start++;
+      }
+      auto end = (start < pattern.size()) ? pattern.find(']', start)
+                                          : std::string::npos;
+      if (end == std::string::npos) {
+        // An unterminated set matches the literal bracket.
+        appendLiteral(out, c);
+        continue;
+      }
+
+      out += '[';
+      size_t j = i + 1;
+      if (pattern[j] == '^') {
+        out += '^';
+        j++;
+      }
+      for (; j < end; j++) {
+        if (pattern[j] == '\\' || pattern[j] == '[' || pattern[j] == ']') {
+          out += '\\';
+        }
+        out += pattern[j];
+      }
+      out += ']';
+      i = end;
+    } else {
+      appendLiteral(out, c);
+    }
+  }
+  return out;
+}
+
+/// A thread's compiled patterns, ordered by use.
+class PatternCache {
+ public:
+  std::shared_ptr<const boost::regex> get(const std::string& pattern,
+                                          PatternType type) {
+    auto key = std::to_string(static_cast<int>(type)) + pattern;
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      order_.splice(order_.end(), order_, it->second.second);
+      return it->second.first;
+    }
+
+    std::shared_ptr<const boost::regex> compiled;
+    try {
+      if (type == PatternType::LIKE) {
+        compiled = std::make_shared<boost::regex>(
+            translateLike(pattern),
+            boost::regex::ECMAScript | boost::regex::icase);
+      } else if (type == PatternType::GLOB) {
+        compiled = std::make_shared<boost::regex>(translateGlob(pattern));
+      } else {
+        compiled = std::make_shared<boost::regex>(pattern);
+      }
+    } catch (const boost::regex_error& /* e */) {
+      // Invalid patterns are cached, they are often repeated for every row.
+      compiled = nullptr;
+    }
+
+    if (entries_.size() >= kRegexCacheSize) {
+      entries_.erase(order_.front());
+      order_.pop_front();
+    }
+    order_.push_back(key);
+    entries_[key] = std::make_pair(compiled, std::prev(order_.end()));
+    return compiled;
+  }
+
+  void clear() {
+    entries_.clear();
+    order_.clear();
+  }
+
+ private:
+  using Entry = std::pair<std::shared_ptr<const boost::regex>,
+                          std::list<std::string>::iterator>;
+
+  /// Compiled patterns keyed by type and pattern.
+  std::map<std::string, Entry> entries_;
+
+  /// Keys, the least recently used first.
+  std::list<std::string> order_;
+};
+
+static PatternCache& getPatternCache() {
+  static thread_local PatternCache cache;
+  return cache;
+}
+
+std::shared_ptr<const boost::regex> getCompiledPattern(
+    const std::string& pattern, PatternType type) {
+  return getPatternCache().get(pattern, type);
+}
+
+bool patternMatches(const std::string& pattern,
+                    const std::string& value,
+                    PatternType type) {
+  auto compiled = getCompiledPattern(pattern, type);
+  if (compiled == nullptr) {
+    return false;
+  }
+
+  try {
+    if (type == PatternType::REGEX) {
+      return boost::regex_search(value, *compiled);
+    }
+    return boost::regex_match(value, *compiled);
+  } catch (const std::runtime_error& /* e */) {
+    // The match exceeded the library's backtracking bound.
+    return false;
+  }
+}
+
+void clearPatternCache() {
+  getPatternCache().clear();
+}
+}
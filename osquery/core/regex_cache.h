@@ -0,0 +1,63 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <boost/regex.hpp>
+
+namespace osquery {
+
+/// The number of compiled patterns each thread keeps.
+extern const size_t kRegexCacheSize;
+
+/// Pattern syntaxes compiled by the regex cache.
+enum class PatternType {
+  /// An ECMAScript regular expression, used by REGEXP and regex_split.
+  REGEX = 0,
+
+  /// An SQL LIKE pattern with % and _ wildcards, ASCII case-insensitive.
+  LIKE,
+
+  /// An SQL GLOB pattern with *, ? and [...] wildcards.
+  GLOB,
+};
+
+/**
+ * @brief Get a compiled pattern from the calling thread's cache.
+ *
+ * Each SQLite connection is used by one thread at a time, so the cache is
+ * kept per thread and is not locked. SQL functions and constraint matching
+ * evaluating the same pattern for every row compile it once. The least
+ * recently used pattern is evicted when the cache is full.
+ *
+ * @param pattern The pattern text.
+ * @param type The pattern's syntax, LIKE and GLOB are translated.
+ * @return The compiled expression, or nullptr if the pattern is invalid.
+ */
+std::shared_ptr<const boost::regex> getCompiledPattern(
+    const std::string& pattern, PatternType type = PatternType::REGEX);
+
+/**
+ * @brief Check if a value matches a pattern.
+ *
+ * A REGEX pattern matches any part of the value, LIKE and GLOB patterns
+ * match the complete value. Invalid patterns, and matches exceeding the
+ * regex library's complexity bound, do not match.
+ */
+bool patternMatches(const std::string& pattern,
+                    const std::string& value,
+                    PatternType type = PatternType::REGEX);
+
+/// Remove the calling thread's compiled patterns.
+void clearPatternCache();
+}
@@ -8,12 +8,19 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include <osquery/database.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/json.h"
+#include "osquery/core/query_deadline.h"
+#include "osquery/core/regex_cache.h"
+#include "osquery/core/work_shard.h"
 
 namespace pt = boost::property_tree;
 
@@ -21,8 +28,21 @@ namespace osquery {
 
 FLAG(bool, disable_caching, false, "Disable scheduled query caching");
 
-size_t TablePlugin::kCacheInterval = 0;
-size_t TablePlugin::kCacheStep = 0;
+FLAG(uint64,
+     table_workers,
+     4,
+     "Threads generating the rows of a table's constraint values (default 4)");
+
+FLAG(uint64,
+     table_workers_max,
+     8,
+     "Helper threads generating table rows across all queries (default 8)");
+
+/// The helper threads of every concurrent QueryContext::generateEach.
+static std::atomic<size_t> kTableWorkersActive{0};
+
+thread_local size_t TablePlugin::kCacheInterval = 0;
+thread_local size_t TablePlugin::kCacheStep = 0;
 
 const std::map<ColumnType, std::string> kColumnTypeNames = {
     {UNKNOWN_TYPE, "UNKNOWN"},
@@ -69,6 +89,23 @@ void TablePlugin::setRequestFromContext(const QueryContext& context,
   }
   tree.add_child("constraints", constraints);
 
+  // The optional set of used columns allows extension tables to skip work.
+  if (context.colsUsed.is_initialized()) {
+    pt::ptree columns;
+    for (const auto& column : *context.colsUsed) {
+      columns.push_back(std::make_pair("", pt::ptree(column)));
+    }
+    tree.add_child("colsUsed", columns);
+  }
+
+  // Extension tables return the rows of an ordered scan in that order.
+  if (context.order != RowOrder::NONE) {
+    tree.put("order", static_cast<int>(context.order));
+  }
+  if (context.limit > 0) {
+    tree.put("limit", context.limit);
+  }
+
   // Write the property tree as a JSON string into the PluginRequest.
   std::ostringstream output;
   try {
@@ -100,6 +137,21 @@ void TablePlugin::setContextFromRequest(const PluginRequest& request,
     auto column_name = constraint.second.get<std::string>("name");
     context.constraints[column_name].unserialize(constraint.second);
   }
+
+  if (tree.count("colsUsed") > 0) {
+    UsedColumns columns;
+    for (const auto& column : tree.get_child("colsUsed")) {
+      columns.insert(column.second.data());
+    }
+    context.colsUsed = columns;
+  }
+
+  auto order = tree.get<int>("order", 0);
+  if (order == static_cast<int>(RowOrder::TIME_ASCENDING) ||
+      order == static_cast<int>(RowOrder::TIME_DESCENDING)) {
+    context.order = static_cast<RowOrder>(order);
+  }
+  context.limit = tree.get<size_t>("limit", 0);
 }
 
 Status TablePlugin::call(const PluginRequest& request,
@@ -168,6 +220,10 @@ PluginResponse TablePlugin::routeInfo() const {
   response.push_back(
       {{"id", "attributes"},
        {"attributes", INTEGER(static_cast<size_t>(attributes()))}});
+  auto feed = changeFeed();
+  if (!feed.empty()) {
+    response.back()["change_feed"] = feed;
+  }
   return response;
 }
 
@@ -190,6 +246,11 @@ void TablePlugin::setCache(size_t step,
                            const QueryData& results) {
   // Serialize QueryData and save to database.
   std::string content;
+  if (isQueryCancelled()) {
+    // A cancelled generator's results are incomplete.
+    return;
+  }
+
   if (!FLAGS_disable_caching && serializeQueryDataJSON(results, content)) {
     last_cached_ = step;
     last_interval_ = interval;
@@ -197,6 +258,34 @@ void TablePlugin::setCache(size_t step,
   }
 }
 
+Row TypedRow::toRow(const TableColumns& columns) const {
+  Row r;
+  for (size_t i = 0; i < values_.size() && i < columns.size(); ++i) {
+    const auto& value = values_[i];
+    const auto& name = std::get<0>(columns[i]);
+    if (value.type == TEXT_TYPE) {
+      r[name] = value.text;
+    } else if (value.type == BIGINT_TYPE) {
+      r[name] = BIGINT(value.integer);
+    } else if (value.type == DOUBLE_TYPE) {
+      r[name] = DOUBLE(value.real);
+    }
+  }
+  return r;
+}
+
+bool TypedRowGenerator::next(QueryData& batch) {
+  TypedQueryData typed;
+  if (!nextTyped(typed)) {
+    return false;
+  }
+  batch.reserve(batch.size() + typed.size());
+  for (const auto& row : typed) {
+    batch.push_back(row.toRow(columns_));
+  }
+  return true;
+}
+
 std::string columnDefinition(const TableColumns& columns) {
   std::map<std::string, bool> epilog;
   std::string statement = "(";
@@ -303,6 +392,20 @@ template <typename T>
 bool ConstraintList::literal_matches(const T& base_expr) const {
   bool aggregate = true;
   for (size_t i = 0; i < constraints_.size(); ++i) {
+    auto op = constraints_[i].op;
+    if (op == LIKE || op == GLOB || op == REGEXP) {
+      // Patterns are compiled once per thread, not for each row.
+      auto type = (op == LIKE) ? PatternType::LIKE
+                               : (op == GLOB) ? PatternType::GLOB
+                                              : PatternType::REGEX;
+      if (!patternMatches(constraints_[i].expr,
+                          AS_LITERAL(TEXT_LITERAL, base_expr),
+                          type)) {
+        return false;
+      }
+      continue;
+    }
+
     T constraint_expr = AS_LITERAL(T, constraints_[i].expr);
     if (constraints_[i].op == EQUALS) {
       aggregate = aggregate && (base_expr == constraint_expr);
@@ -368,6 +471,19 @@ bool QueryContext::hasConstraint(const std::string& column,
   return constraints.at(column).exists(op);
 }
 
+bool QueryContext::isCancelled() const {
+  return isQueryCancelled();
+}
+
+void QueryContext::reset() {
+  for (auto& list : constraints) {
+    list.second.constraints_.clear();
+  }
+  colsUsed = boost::none;
+  order = RowOrder::NONE;
+  limit = 0;
+}
+
 Status QueryContext::expandConstraints(
     const std::string& column,
     ConstraintOperator op,
@@ -382,4 +498,119 @@ Status QueryContext::expandConstraints(
   }
   return Status(0);
 }
+
+/// Reserve up to a number of helper threads within --table_workers_max.
+static size_t reserveTableWorkers(size_t wanted) {
+  auto active = kTableWorkersActive.load();
+  size_t reserved = 0;
+  do {
+    auto limit = static_cast<size_t>(FLAGS_table_workers_max);
+    reserved = (active < limit) ? std::min(wanted, limit - active) : 0;
+    if (reserved == 0) {
+      break;
+    }
+  } while (!kTableWorkersActive.compare_exchange_weak(active,
+                                                      active + reserved));
+  return reserved;
+}
+
+/**
+ * @brief Generate the rows of count items with up to a number of workers.
+ *
+ * See QueryContext::generateEach, each item's rows are appended in order.
+ */
+static void generateEachItem(
+    size_t count,
+    size_t workers,
+    const std::function<void(size_t item, QueryData& rows)>& generator,
+    QueryData& results,
+    const std::function<void()>& done) {
+  workers = std::min(workers, count);
+  auto helpers = (workers > 1) ? reserveTableWorkers(workers - 1) : 0;
+  if (helpers == 0) {
+    for (size_t i = 0; i < count; ++i) {
+      if (isQueryCancelled()) {
+        break;
+      }
+      generator(i, results);
+    }
+    return;
+  }
+
+  // Each item's rows are kept apart, then appended in the order of items.
+  std::vector<QueryData> rows(count);
+  std::atomic<size_t> next{0};
+  auto work = [&]() {
+    for (auto i = next++; i < count && !isQueryCancelled(); i = next++) {
+      generator(i, rows[i]);
+    }
+  };
+
+  auto deadline = getQueryDeadline();
+  size_t shard_index = 0;
+  size_t shard_count = 0;
+  getWorkShard(shard_index, shard_count);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < helpers; ++i) {
+    threads.emplace_back([&]() {
+      setQueryDeadline(deadline);
+      setWorkShard(shard_index, shard_count);
+      work();
+      if (done != nullptr) {
+        done();
+      }
+    });
+  }
+  work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  kTableWorkersActive -= helpers;
+
+  for (auto& item_rows : rows) {
+    std::move(item_rows.begin(), item_rows.end(), std::back_inserter(results));
+  }
+}
+
+void QueryContext::generateEach(
+    const std::set<std::string>& values,
+    const std::function<void(const std::string& value, QueryData& rows)>&
+        generator,
+    QueryData& results,
+    const std::function<void()>& done) const {
+  std::vector<const std::string*> items;
+  for (const auto& value : values) {
+    items.push_back(&value);
+  }
+  generateEachItem(items.size(),
+                   static_cast<size_t>(FLAGS_table_workers),
+                   [&items, &generator](size_t i, QueryData& rows) {
+                     generator(*items[i], rows);
+                   },
+                   results,
+                   done);
+}
+
+void QueryContext::generateEach(
+    const QueryData& values,
+    const std::function<void(const Row& value, QueryData& rows)>& generator,
+    QueryData& results,
+    bool drops_privileges,
+    const std::function<void()>& done) const {
+  auto workers = static_cast<size_t>(FLAGS_table_workers);
+#if !defined(__linux__)
+  // Only Linux changes the file system user of a single thread, elsewhere
+  // dropping privileges changes the effective user of the process.
+  if (drops_privileges) {
+    workers = 1;
+  }
+#endif
+  generateEachItem(values.size(),
+                   workers,
+                   [&values, &generator](size_t i, QueryData& rows) {
+                     generator(values[i], rows);
+                   },
+                   results,
+                   done);
+}
 }
@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/byte_scan.h"
+
+namespace osquery {
+
+class ByteScanTests : public testing::Test {};
+
+TEST_F(ByteScanTests, test_find_json_escape) {
+  EXPECT_EQ(findJSONEscape("", 0), 0U);
+  EXPECT_EQ(findJSONEscape("abc", 3), 3U);
+
+  // Place each escaped byte at every offset, covering the vector strides and
+  // the scalar tail.
+  for (const char c : {'\0', '\n', '\x1F', '"', '/', '\\'}) {
+    for (size_t size = 1; size < 80; ++size) {
+      for (size_t offset = 0; offset < size; ++offset) {
+        std::string value(size, 'a');
+        value[offset] = c;
+        EXPECT_EQ(findJSONEscape(value.data(), value.size()), offset);
+      }
+    }
+  }
+
+  // Bytes above 0x7F and DEL are written as they are.
+  std::string value(64, '\xE9');
+  value[40] = '\x7F';
+  EXPECT_EQ(findJSONEscape(value.data(), value.size()), value.size());
+}
+
+TEST_F(ByteScanTests, test_find_non_printable) {
+  EXPECT_EQ(findNonPrintable("", 0), 0U);
+
+  for (const char c : {'\0', '\t', '\x1F', '\x80', '\xFF'}) {
+    for (size_t size = 1; size < 80; ++size) {
+      for (size_t offset = 0; offset < size; ++offset) {
+        std::string value(size, ' ');
+        value[offset] = c;
+        EXPECT_EQ(findNonPrintable(value.data(), value.size()), offset);
+      }
+    }
+  }
+
+  // Quotes and DEL are printable.
+  std::string value(64, '"');
+  value[33] = '\x7F';
+  EXPECT_EQ(findNonPrintable(value.data(), value.size()), value.size());
+}
+}
@@ -8,8 +8,14 @@
  *
  */
 
+#include <algorithm>
+#include <ctime>
+
+#include <boost/filesystem.hpp>
+
 #include <gtest/gtest.h>
 
+#include <osquery/filesystem.h>
 #include <osquery/hash.h>
 
 #include "osquery/tests/test_util.h"
@@ -30,6 +36,30 @@ TEST_F(HashTests, test_algorithms) {
   digest = hashFromBuffer(HASH_TYPE_SHA256, buffer, 1);
   EXPECT_EQ(digest,
             "5feceb66ffc86f38d952786c6d696c79c2dbc239dd4e91b46729d73a27fb57e9");
+
+  digest = hashFromBuffer(HASH_TYPE_XXH64, buffer, 1);
+  EXPECT_EQ(digest, "633457081244afec");
+  EXPECT_EQ(hashFromBuffer(HASH_TYPE_XXH64, "", 0), "ef46db3751d8e999");
+}
+
+TEST_F(HashTests, test_xxh64_update) {
+  // Updates of every size cross the 32 byte stripes at different offsets.
+  std::string content;
+  for (size_t i = 0; i < 1000; i++) {
+    content.push_back(static_cast<char>(i * 7));
+  }
+  auto expected = hashFromBuffer(HASH_TYPE_XXH64, content.data(), 1000);
+  for (size_t chunk = 1; chunk < 70; chunk++) {
+    Hash hash(HASH_TYPE_XXH64);
+    for (size_t i = 0; i < content.size(); i += chunk) {
+      hash.update(content.data() + i, std::min(chunk, content.size() - i));
+    }
+    EXPECT_EQ(hash.digest(), expected);
+  }
+
+  const std::string fox = "The quick brown fox jumps over the lazy dog";
+  EXPECT_EQ(hashFromBuffer(HASH_TYPE_XXH64, fox.data(), fox.size()),
+            "0b242d361fda71bc");
 }
 
 TEST_F(HashTests, test_update) {
@@ -46,4 +76,121 @@ TEST_F(HashTests, test_file_hashing) {
   auto digest = hashFromFile(HASH_TYPE_MD5, kTestDataPath + "test_hashing.bin");
   EXPECT_EQ(digest, "88ee11f2aa7903f34b8b8785d92208b1");
 }
+
+TEST_F(HashTests, test_multi_file_hashing) {
+  auto path = kTestDataPath + "test_hashing.bin";
+  auto hashes = hashMultiFromFile(HASH_TYPE_SHA256, path);
+  EXPECT_EQ(hashes.mask, HASH_TYPE_SHA256);
+  EXPECT_TRUE(hashes.md5.empty());
+  EXPECT_TRUE(hashes.sha1.empty());
+  EXPECT_EQ(hashes.sha256,
+            "9b0fb422f1d46fd80df1c8c32fc9031a68a253706293fb8e540d3f88a65e0056");
+
+  auto all = HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256 |
+             HASH_TYPE_XXH64;
+  hashes = hashMultiFromFile(all, path);
+  EXPECT_EQ(hashes.xxh64, "6c33f867b51646e7");
+  EXPECT_EQ(hashes.md5, "88ee11f2aa7903f34b8b8785d92208b1");
+  EXPECT_EQ(hashes.sha1, "e436d0d03926f424ad8ebd17492f2f9c941e47ff");
+  EXPECT_EQ(hashes.sha256,
+            "9b0fb422f1d46fd80df1c8c32fc9031a68a253706293fb8e540d3f88a65e0056");
+}
+
+/// Write a file with a modification time old enough to have its digests stored.
+static void writeSettledFile(const std::string& path,
+                             const std::string& content) {
+  writeTextFile(path, content);
+  boost::filesystem::last_write_time(path, std::time(nullptr) - 10);
+}
+
+TEST_F(HashTests, test_cached_file_hashing) {
+  auto path = kTestWorkingDirectory + "cached_hashing.txt";
+  writeSettledFile(path, "0");
+
+  auto s0 = getHashCacheStats();
+  auto hashes = cachedHashMultiFromFile(HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.md5, "cfcd208495d565ef66e7dff9f98764da");
+  EXPECT_TRUE(hashes.sha1.empty());
+  auto s1 = getHashCacheStats();
+  EXPECT_EQ(s1.misses, s0.misses + 1);
+
+  // The unchanged file's digest is reused.
+  hashes = cachedHashMultiFromFile(HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.md5, "cfcd208495d565ef66e7dff9f98764da");
+  auto s2 = getHashCacheStats();
+  EXPECT_EQ(s2.hits, s1.hits + 1);
+
+  // A digest type that was not stored is computed and added.
+  hashes = cachedHashMultiFromFile(HASH_TYPE_MD5 | HASH_TYPE_SHA1, path);
+  EXPECT_EQ(hashes.md5, "cfcd208495d565ef66e7dff9f98764da");
+  EXPECT_EQ(hashes.sha1, "b6589fc6ab0dc82cf12099d1c2d40ab994e8410c");
+  auto s3 = getHashCacheStats();
+  EXPECT_EQ(s3.misses, s2.misses + 1);
+  hashes = cachedHashMultiFromFile(HASH_TYPE_SHA1, path);
+  EXPECT_EQ(hashes.sha1, "b6589fc6ab0dc82cf12099d1c2d40ab994e8410c");
+  EXPECT_TRUE(hashes.md5.empty());
+  EXPECT_EQ(getHashCacheStats().hits, s3.hits + 1);
+
+  // Changing the content invalidates the stored digests.
+  writeSettledFile(path, "10");
+  hashes = cachedHashMultiFromFile(HASH_TYPE_MD5, path);
+  EXPECT_EQ(hashes.md5, "d3d9446802a44259755d38e6d163e820");
+  EXPECT_EQ(getHashCacheStats().stale, s3.stale + 1);
+}
+
+TEST_F(HashTests, test_cached_fingerprint) {
+  auto path = kTestWorkingDirectory + "cached_fingerprint.txt";
+  writeSettledFile(path, "10");
+  auto hashes = cachedHashMultiFromFile(HASH_TYPE_SHA256, path);
+  EXPECT_EQ(hashes.sha256,
+            "4a44dc15364204a80fe80e9039455cc1608281820fe2b24f1e5233ade6af1dd5");
+  // The fingerprint is stored but only requested digests are returned.
+  EXPECT_TRUE(hashes.xxh64.empty());
+
+  // Rewriting the same content changes the metadata, not the fingerprint.
+  auto s0 = getHashCacheStats();
+  writeTextFile(path, "10");
+  boost::filesystem::last_write_time(path, std::time(nullptr) - 20);
+  hashes = cachedHashMultiFromFile(HASH_TYPE_SHA256 | HASH_TYPE_XXH64, path);
+  EXPECT_EQ(hashes.sha256,
+            "4a44dc15364204a80fe80e9039455cc1608281820fe2b24f1e5233ade6af1dd5");
+  EXPECT_EQ(hashes.xxh64, "4b48550ea3b07f17");
+  auto s1 = getHashCacheStats();
+  EXPECT_EQ(s1.unchanged, s0.unchanged + 1);
+  EXPECT_EQ(s1.stale, s0.stale);
+
+  // The reused digests are stored for the new metadata.
+  cachedHashMultiFromFile(HASH_TYPE_SHA256, path);
+  auto s2 = getHashCacheStats();
+  EXPECT_EQ(s2.hits, s1.hits + 1);
+
+  // New content of the same size is hashed again.
+  writeSettledFile(path, "11");
+  hashes = cachedHashMultiFromFile(HASH_TYPE_SHA256, path);
+  EXPECT_EQ(hashes.sha256,
+            "4fc82b26aecb47d2868c4efbe3581732a3e7cbcc6c2efb32062c08170a05eeb8");
+  auto s3 = getHashCacheStats();
+  EXPECT_EQ(s3.stale, s2.stale + 1);
+  EXPECT_EQ(s3.unchanged, s2.unchanged);
+}
+
+TEST_F(HashTests, test_cached_files_hashing) {
+  std::vector<std::string> paths;
+  for (size_t i = 0; i < 5; i++) {
+    paths.push_back(kTestWorkingDirectory + "hashing_" + std::to_string(i));
+    writeSettledFile(paths.back(), std::to_string(i));
+  }
+  paths.push_back(kTestDataPath + "test_hashing.bin");
+
+  // Results are in the order of the paths, regardless of the worker.
+  auto hashes = cachedHashMultiFromFiles(HASH_TYPE_MD5, paths);
+  ASSERT_EQ(hashes.size(), paths.size());
+  EXPECT_EQ(hashes[0].md5, "cfcd208495d565ef66e7dff9f98764da");
+  EXPECT_EQ(hashes[1].md5, "c4ca4238a0b923820dcc509a6f75849b");
+  EXPECT_EQ(hashes[5].md5, "88ee11f2aa7903f34b8b8785d92208b1");
+  for (const auto& file_hashes : hashes) {
+    EXPECT_EQ(file_hashes.mask, HASH_TYPE_MD5);
+    EXPECT_TRUE(file_hashes.sha256.empty());
+  }
+}
 }
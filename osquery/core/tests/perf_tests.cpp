@@ -0,0 +1,83 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include "osquery/core/perf.h"
+
+namespace osquery {
+
+class PerfTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    clearPerfStats();
+  }
+
+  void TearDown() override {
+    FLAGS_perf_counters = false;
+    clearPerfStats();
+  }
+};
+
+TEST_F(PerfTests, test_disabled_timer) {
+  FLAGS_perf_counters = false;
+  { PerfTimer timer(PERF_DIFF); }
+
+  size_t threads = 0;
+  auto stats = getPerfStats(threads);
+  ASSERT_EQ(stats.size(), static_cast<size_t>(PERF_STAGE_COUNT));
+  EXPECT_EQ(stats[PERF_DIFF].calls, 0U);
+  EXPECT_EQ(threads, 0U);
+}
+
+TEST_F(PerfTests, test_record) {
+  recordPerf(PERF_DATABASE_GET, 5);
+  recordPerf(PERF_DATABASE_GET, 50);
+  recordPerf(PERF_DATABASE_GET, 500000);
+
+  size_t threads = 0;
+  auto stats = getPerfStats(threads);
+  const auto& get = stats[PERF_DATABASE_GET];
+  EXPECT_EQ(get.calls, 3U);
+  EXPECT_EQ(get.total_time, 500055U);
+  EXPECT_EQ(get.max_time, 500000U);
+  EXPECT_EQ(get.histogram[0], 1U);
+  EXPECT_EQ(get.histogram[1], 1U);
+  EXPECT_EQ(get.histogram[5], 1U);
+  EXPECT_EQ(stats[PERF_DATABASE_PUT].calls, 0U);
+  EXPECT_EQ(threads, 1U);
+
+  clearPerfStats();
+  stats = getPerfStats(threads);
+  EXPECT_EQ(stats[PERF_DATABASE_GET].calls, 0U);
+}
+
+TEST_F(PerfTests, test_threads) {
+  FLAGS_perf_counters = true;
+  auto work = []() {
+    for (size_t i = 0; i < 10; i++) {
+      PerfTimer timer(PERF_GENERATE);
+    }
+  };
+
+  // Counts of exited threads are kept.
+  std::thread first(work);
+  std::thread second(work);
+  first.join();
+  second.join();
+
+  size_t threads = 0;
+  auto stats = getPerfStats(threads);
+  EXPECT_EQ(stats[PERF_GENERATE].calls, 20U);
+  EXPECT_EQ(threads, 2U);
+}
+}
@@ -8,6 +8,9 @@
  *
  */
 
+#include <chrono>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
@@ -102,6 +105,47 @@ TEST_F(ProcessTests, test_getpid) {
   EXPECT_EQ(process->pid(), pid);
 }
 
+#if defined(__linux__) || defined(__APPLE__) || defined(WIN32)
+TEST_F(ProcessTests, test_getResourceUsage) {
+  auto process = PlatformProcess::getCurrentProcess();
+  ProcessResourceUsage usage;
+  ASSERT_TRUE(process->getResourceUsage(usage).ok());
+  EXPECT_GT(usage.resident_size, 0U);
+#ifndef WIN32
+  EXPECT_EQ(usage.parent, getppid());
+#endif
+
+  PlatformProcess invalid;
+  EXPECT_FALSE(invalid.getResourceUsage(usage).ok());
+}
+
+TEST_F(ProcessTests, test_getThreadResourceUsage) {
+  ProcessResourceUsage u0, u1;
+  ASSERT_TRUE(PlatformProcess::getThreadResourceUsage(u0).ok());
+  EXPECT_GT(u0.allocated_size, 0U);
+
+  // Spin in another thread, the time is not charged to this thread.
+  uint64_t spun = 0;
+  std::thread spinner([&spun]() {
+    ProcessResourceUsage s0, s1;
+    PlatformProcess::getThreadResourceUsage(s0);
+    auto start = std::chrono::steady_clock::now();
+    while (std::chrono::steady_clock::now() - start <
+           std::chrono::milliseconds(300)) {
+    }
+    PlatformProcess::getThreadResourceUsage(s1);
+    spun = (s1.user_time + s1.system_time) - (s0.user_time + s0.system_time);
+  });
+  spinner.join();
+
+  ASSERT_TRUE(PlatformProcess::getThreadResourceUsage(u1).ok());
+  auto waited = (u1.user_time + u1.system_time) -
+                (u0.user_time + u0.system_time);
+  EXPECT_GT(spun, 0U);
+  EXPECT_LT(waited, spun);
+}
+#endif
+
 TEST_F(ProcessTests, test_envVar) {
   auto val = getEnvVar("GTEST_OSQUERY");
   EXPECT_FALSE(val);
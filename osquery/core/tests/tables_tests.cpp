@@ -8,12 +8,18 @@
  *
  */
 
+#include <atomic>
+#include <thread>
+
 #include <gtest/gtest.h>
 
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
 namespace osquery {
 
+DECLARE_uint64(table_workers);
+
 class TablesTests : public testing::Test {};
 
 TEST_F(TablesTests, test_constraint) {
@@ -129,6 +135,118 @@ TEST_F(TablesTests, test_constraint_map) {
   EXPECT_TRUE(cm["path"].existsAndMatches("some"));
 }
 
+TEST_F(TablesTests, test_constraint_patterns) {
+  struct ConstraintList cl;
+  cl.add(Constraint(LIKE, "/usr/%bin/_s"));
+  EXPECT_TRUE(cl.matches("/usr/bin/ls"));
+  EXPECT_TRUE(cl.matches("/USR/local/sbin/ps"));
+  EXPECT_FALSE(cl.matches("/usr/bin/cat"));
+
+  struct ConstraintList glob;
+  glob.add(Constraint(GLOB, "/etc/[a-c]*.conf"));
+  EXPECT_TRUE(glob.matches("/etc/adduser.conf"));
+  EXPECT_FALSE(glob.matches("/etc/hosts.conf"));
+  EXPECT_FALSE(glob.matches("/ETC/adduser.conf"));
+
+  // Regular expressions match any part of the value.
+  struct ConstraintList regex;
+  regex.add(Constraint(REGEXP, "bin/(ls|ps)$"));
+  EXPECT_TRUE(regex.matches("/usr/bin/ps"));
+  EXPECT_FALSE(regex.matches("/usr/bin/psql"));
+
+  // An invalid pattern does not match.
+  struct ConstraintList invalid;
+  invalid.add(Constraint(REGEXP, "(unclosed"));
+  EXPECT_FALSE(invalid.matches("(unclosed"));
+}
+
+TEST_F(TablesTests, test_context_reset) {
+  QueryContext context;
+  context.constraints["path"].affinity = INTEGER_TYPE;
+  context.constraints["path"].add(Constraint(EQUALS, "1"));
+  context.colsUsed = UsedColumns({"path"});
+
+  // The lists and affinities are kept for the next filter.
+  context.reset();
+  ASSERT_EQ(context.constraints.count("path"), 1U);
+  EXPECT_FALSE(context.constraints["path"].exists());
+  EXPECT_EQ(context.constraints["path"].affinity, INTEGER_TYPE);
+  EXPECT_FALSE(context.colsUsed.is_initialized());
+  EXPECT_TRUE(context.isColumnUsed("other"));
+}
+
+TEST_F(TablesTests, test_generate_each) {
+  std::set<std::string> values;
+  for (size_t i = 0; i < 64; ++i) {
+    values.insert(std::to_string(i));
+  }
+
+  Mutex mutex;
+  std::set<std::thread::id> threads;
+  std::atomic<size_t> done{0};
+  auto generator = [&](const std::string& value, QueryData& rows) {
+    {
+      WriteLock lock(mutex);
+      threads.insert(std::this_thread::get_id());
+    }
+    // Each value generates a varying number of rows.
+    for (size_t i = 0; i < value.size(); ++i) {
+      rows.push_back({{"value", value}, {"i", std::to_string(i)}});
+    }
+  };
+
+  QueryContext context;
+  QueryData serial;
+  auto workers = FLAGS_table_workers;
+  FLAGS_table_workers = 1;
+  context.generateEach(values, generator, serial);
+  EXPECT_EQ(threads.size(), 1U);
+
+  // The rows are in the order of the values regardless of the workers.
+  FLAGS_table_workers = 4;
+  QueryData parallel;
+  context.generateEach(values, generator, parallel, [&done]() { done++; });
+  EXPECT_EQ(parallel, serial);
+  EXPECT_EQ(parallel.size(), 10U + 54U * 2U);
+  EXPECT_LE(done.load(), 3U);
+  FLAGS_table_workers = workers;
+}
+
+TEST_F(TablesTests, test_generate_each_row) {
+  QueryData values;
+  for (size_t i = 0; i < 16; ++i) {
+    values.push_back({{"uid", std::to_string(i)}});
+  }
+
+  Mutex mutex;
+  std::set<std::thread::id> threads;
+  auto generator = [&](const Row& value, QueryData& rows) {
+    {
+      WriteLock lock(mutex);
+      threads.insert(std::this_thread::get_id());
+    }
+    rows.push_back({{"uid", value.at("uid")}});
+  };
+
+  // The rows are in the order of the values.
+  QueryContext context;
+  auto workers = FLAGS_table_workers;
+  FLAGS_table_workers = 4;
+  QueryData results;
+  context.generateEach(values, generator, results);
+  EXPECT_EQ(results, values);
+
+  // Generators dropping privileges only run concurrently on Linux.
+  threads.clear();
+  results.clear();
+  context.generateEach(values, generator, results, true);
+  EXPECT_EQ(results, values);
+#if !defined(__linux__)
+  EXPECT_EQ(threads.size(), 1U);
+#endif
+  FLAGS_table_workers = workers;
+}
+
 class TestTablePlugin : public TablePlugin {
  public:
   void testSetCache(size_t step, size_t interval) {
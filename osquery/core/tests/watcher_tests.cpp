@@ -194,28 +194,32 @@ class FakeWatcherRunner : public WatcherRunner {
   /**
   * @brief What the runner's internals will use as process state.
   *
-  * Internal calls to getProcessRow will return this structure.
+  * Internal calls to getProcessUsage will return this structure.
   */
-  void setProcessRow(QueryData qd) { qd_ = std::move(qd); }
+  void setProcessUsage(const ProcessResourceUsage& usage) { usage_ = usage; }
 
-  /// The tests do not have access to the processes table.
-  QueryData getProcessRow(pid_t pid) const override { return qd_; }
+  /// The tests do not sample real processes.
+  Status getProcessUsage(const PlatformProcess& process,
+                         ProcessResourceUsage& usage) const override {
+    usage = usage_;
+    return Status(0);
+  }
 
  private:
-  QueryData qd_;
+  ProcessResourceUsage usage_;
 };
 
 TEST_F(WatcherTests, test_watcherrunner_watcherhealth) {
   FakeWatcherRunner runner(0, nullptr, true);
 
-  // Construct a process state, assume this would have been returned from the
-  // processes table, which the WorkerRunner normally uses internally.
-  Row r;
-  r["parent"] = INTEGER(1);
-  r["user_time"] = INTEGER(100);
-  r["system_time"] = INTEGER(100);
-  r["resident_size"] = INTEGER(100);
-  runner.setProcessRow({r});
+  // Construct a process state, assume this would have been sampled from the
+  // process, which the WorkerRunner normally does internally.
+  ProcessResourceUsage usage;
+  usage.parent = 1;
+  usage.user_time = 100;
+  usage.system_time = 100;
+  usage.resident_size = 100;
+  runner.setProcessUsage(usage);
 
   // Hold the process and process state externally.
   // Normally the WatcherRunner's entry point will persist these and use them
@@ -238,22 +242,22 @@ TEST_F(WatcherTests, test_watcherrunner_watcherhealth) {
 
   // Now we can alter the performance.
   // Let us emulate the watcher having just allocated 1G of memory.
-  r["resident_size"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  usage.resident_size = 1024 * 1024 * 1024;
+  runner.setProcessUsage(usage);
 
   auto status = runner.isWatcherHealthy(*test_process, state);
   EXPECT_FALSE(status.ok());
   EXPECT_EQ(status.getMessage(), "Memory limits exceeded");
 
   // Now emulate a rapid increase in CPU requirements.
-  r["user_time"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  usage.user_time = 1024 * 1024 * 1024;
+  runner.setProcessUsage(usage);
   runner.isWatcherHealthy(*test_process, state);
   EXPECT_EQ(1U, state.sustained_latency);
 
   // And again, the CPU continues to increase from the system perspective.
-  r["system_time"] = INTEGER(1024 * 1024 * 1024);
-  runner.setProcessRow({r});
+  usage.system_time = 1024 * 1024 * 1024;
+  runner.setProcessUsage(usage);
   runner.isWatcherHealthy(*test_process, state);
   EXPECT_EQ(2U, state.sustained_latency);
 }
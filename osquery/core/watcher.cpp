@@ -70,6 +70,16 @@ CLI_FLAG(int32,
 
 CLI_FLAG(bool, disable_watchdog, false, "Disable userland watchdog process");
 
+CLI_FLAG(bool,
+         watchdog_kernel_limits,
+         false,
+         "Enforce the worker limits with a cgroup or job object, not restarts");
+
+FLAG(uint64,
+     watchdog_pressure_percent,
+     10,
+     "Percent of time stalled on CPU or memory the scheduler defers within");
+
 void Watcher::resetWorkerCounters(size_t respawn_time) {
   // Reset the monitoring counters for the watcher.
   auto& state = instance().state_;
@@ -77,6 +87,8 @@ void Watcher::resetWorkerCounters(size_t respawn_time) {
   state.user_time = 0;
   state.system_time = 0;
   state.last_respawn_time = respawn_time;
+  state.limits_requested = false;
+  state.kernel_limits = false;
 }
 
 void Watcher::resetExtensionCounters(const std::string& extension,
@@ -253,21 +265,16 @@ void WatcherRunner::stopChild(const PlatformProcess& child) const {
   cleanupDefunctProcesses();
 }
 
-PerformanceChange getChange(const Row& r, PerformanceState& state) {
+PerformanceChange getChange(const ProcessResourceUsage& usage,
+                            PerformanceState& state) {
   PerformanceChange change;
 
   // IV is the check interval in seconds, and utilization is set per-second.
   change.iv = std::max(getWorkerLimit(INTERVAL), (size_t)1);
-  UNSIGNED_BIGINT_LITERAL user_time = 0, system_time = 0;
-  try {
-    change.parent =
-        static_cast<pid_t>(AS_LITERAL(BIGINT_LITERAL, r.at("parent")));
-    user_time = AS_LITERAL(BIGINT_LITERAL, r.at("user_time")) / change.iv;
-    system_time = AS_LITERAL(BIGINT_LITERAL, r.at("system_time")) / change.iv;
-    change.footprint = AS_LITERAL(BIGINT_LITERAL, r.at("resident_size"));
-  } catch (const std::exception& /* e */) {
-    state.sustained_latency = 0;
-  }
+  change.parent = usage.parent;
+  UNSIGNED_BIGINT_LITERAL user_time = usage.user_time / change.iv;
+  UNSIGNED_BIGINT_LITERAL system_time = usage.system_time / change.iv;
+  change.footprint = usage.resident_size;
 
   // Check the difference of CPU time used since last check.
   if (user_time - state.user_time > getWorkerLimit(UTILIZATION_LIMIT) ||
@@ -319,13 +326,13 @@ static bool exceededCyclesLimit(const PerformanceChange& change) {
 
 Status WatcherRunner::isWatcherHealthy(const PlatformProcess& watcher,
                                        PerformanceState& watcher_state) const {
-  auto rows = getProcessRow(watcher.pid());
-  if (rows.size() == 0) {
+  ProcessResourceUsage usage;
+  if (!getProcessUsage(watcher, usage).ok()) {
     // Could not find worker process?
     return Status(1, "Cannot find watcher process");
   }
 
-  auto change = getChange(rows[0], watcher_state);
+  auto change = getChange(usage, watcher_state);
   if (exceededMemoryLimit(change)) {
     return Status(1, "Memory limits exceeded");
   }
@@ -333,22 +340,57 @@ Status WatcherRunner::isWatcherHealthy(const PlatformProcess& watcher,
   return Status(0);
 }
 
-QueryData WatcherRunner::getProcessRow(pid_t pid) const {
-  return SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(pid));
+Status WatcherRunner::getProcessUsage(const PlatformProcess& process,
+                                      ProcessResourceUsage& usage) const {
+  if (process.getResourceUsage(usage).ok()) {
+    return Status(0, "OK");
+  }
+
+  // Platforms without a resource usage API select from the processes table.
+  auto rows =
+      SQL::selectAllFrom("processes", "pid", EQUALS, INTEGER(process.pid()));
+  if (rows.empty()) {
+    return Status(1, "Cannot find process");
+  }
+
+  try {
+    const auto& r = rows[0];
+    usage.parent =
+        static_cast<pid_t>(AS_LITERAL(BIGINT_LITERAL, r.at("parent")));
+    usage.user_time = AS_LITERAL(BIGINT_LITERAL, r.at("user_time"));
+    usage.system_time = AS_LITERAL(BIGINT_LITERAL, r.at("system_time"));
+    usage.resident_size = AS_LITERAL(BIGINT_LITERAL, r.at("resident_size"));
+  } catch (const std::exception& /* e */) {
+    // An unknown parent is treated as a process no longer watched.
+    usage = ProcessResourceUsage();
+  }
+  return Status(0, "OK");
 }
 
 Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
-  auto rows = getProcessRow(child.pid());
-  if (rows.size() == 0) {
+  ProcessResourceUsage usage;
+  if (!getProcessUsage(child, usage).ok()) {
     // Could not find worker process?
     return Status(1, "Cannot find worker process");
   }
 
   PerformanceChange change;
+  bool request_limits = false;
+  bool kernel_limits = false;
+  size_t initial_footprint = 0;
   {
     WatcherLocker locker;
     auto& state = Watcher::getState(child);
-    change = getChange(rows[0], state);
+    change = getChange(usage, state);
+
+    // The limits allow the same growth above the launch footprint.
+    if (FLAGS_watchdog_kernel_limits && !state.limits_requested &&
+        child == Watcher::getWorker()) {
+      state.limits_requested = true;
+      request_limits = true;
+      initial_footprint = state.initial_footprint;
+    }
+    kernel_limits = state.kernel_limits;
   }
 
   // Only make a decision about the child sanity if it is still the watcher's
@@ -360,11 +402,28 @@ Status WatcherRunner::isChildSane(const PlatformProcess& child) const {
     return Status(0);
   }
 
-  if (exceededCyclesLimit(change)) {
+  if (request_limits) {
+    auto status = child.limitResources(
+        initial_footprint + getWorkerLimit(MEMORY_LIMIT) * 1024 * 1024,
+        getWorkerLimit(UTILIZATION_LIMIT));
+    if (status.ok()) {
+      WatcherLocker locker;
+      Watcher::getState(child).kernel_limits = true;
+      kernel_limits = true;
+      VLOG(1) << "osqueryd worker (" << child.pid()
+              << ") limits are enforced by the operating system";
+    } else {
+      LOG(WARNING) << "Cannot apply operating system limits to the worker: "
+                   << status.getMessage();
+    }
+  }
+
+  // The operating system throttles a worker with limits, it is not stopped.
+  if (!kernel_limits && exceededCyclesLimit(change)) {
     return Status(1, "System performance limits exceeded");
   }
   // Check if the private memory exceeds a memory limit.
-  if (exceededMemoryLimit(change)) {
+  if (!kernel_limits && exceededMemoryLimit(change)) {
     return Status(
         1, "Memory limits exceeded: " + std::to_string(change.footprint));
   }
@@ -408,9 +467,10 @@ void WatcherRunner::createWorker() {
   }
 
   // Set an environment signaling to potential plugin-dependent workers to wait
-  // for extensions to broadcast.
+  // for extensions to broadcast. The value is the number of extensions.
   if (Watcher::hasManagedExtensions()) {
-    setEnvVar("OSQUERY_EXTENSIONS", "true");
+    setEnvVar("OSQUERY_EXTENSIONS",
+              std::to_string(Watcher::extensions().size()));
   }
 
   // Get the complete path of the osquery process binary.
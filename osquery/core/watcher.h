@@ -70,6 +70,12 @@ struct PerformanceState {
   /// The initial (or as close as possible) process image footprint.
   size_t initial_footprint;
 
+  /// Set when the operating system's limits were requested for the process.
+  bool limits_requested{false};
+
+  /// Set when the operating system enforces the limits, see limitResources.
+  bool kernel_limits{false};
+
   PerformanceState() {
     sustained_latency = 0;
     user_time = 0;
@@ -272,8 +278,9 @@ class WatcherRunner : public InternalRunnable {
   virtual Status isWatcherHealthy(const PlatformProcess& watcher,
                                   PerformanceState& watcher_state) const;
 
-  /// Get row data from the processes table for a given pid.
-  virtual QueryData getProcessRow(pid_t pid) const;
+  /// Sample a process' resource usage, without the processes table if able.
+  virtual Status getProcessUsage(const PlatformProcess& process,
+                                 ProcessResourceUsage& usage) const;
 
  private:
   /// Fork and execute a worker process.
@@ -8,6 +8,7 @@
  *
  */
 
+#include <algorithm>
 #include <sstream>
 #include <vector>
 
@@ -17,6 +18,9 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include <psapi.h>
+#include <tlhelp32.h>
+
 #include "osquery/core/process.h"
 
 namespace osquery {
@@ -98,6 +102,115 @@ ProcessState PlatformProcess::checkStatus(int& status) const {
   return PROCESS_EXITED;
 }
 
+/// Convert a FILETIME duration, in 100-nanosecond intervals, to milliseconds.
+static inline uint64_t getFileTimeMS(const FILETIME& time) {
+  ULARGE_INTEGER value;
+  value.LowPart = time.dwLowDateTime;
+  value.HighPart = time.dwHighDateTime;
+  return value.QuadPart / 10000;
+}
+
+Status PlatformProcess::getResourceUsage(ProcessResourceUsage& usage) const {
+  if (id_ == kInvalidPid) {
+    return Status(1, "Invalid process");
+  }
+
+  FILETIME create_time, exit_time, kernel_time, user_time;
+  if (!::GetProcessTimes(
+          id_, &create_time, &exit_time, &kernel_time, &user_time)) {
+    return Status(1, "Cannot read process times");
+  }
+
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!::GetProcessMemoryInfo(id_, &counters, sizeof(counters))) {
+    return Status(1, "Cannot read process memory");
+  }
+
+  usage.user_time = getFileTimeMS(user_time);
+  usage.system_time = getFileTimeMS(kernel_time);
+  usage.resident_size = counters.WorkingSetSize;
+
+  // The parent is only available from a process snapshot.
+  usage.parent = 0;
+  auto pid = ::GetProcessId(id_);
+  HANDLE snapshot = ::CreateToolhelp32Snapshot(TH32CS_SNAPPROCESS, 0);
+  if (snapshot != INVALID_HANDLE_VALUE) {
+    PROCESSENTRY32 entry;
+    entry.dwSize = sizeof(entry);
+    for (auto found = ::Process32First(snapshot, &entry); found;
+         found = ::Process32Next(snapshot, &entry)) {
+      if (entry.th32ProcessID == pid) {
+        usage.parent = entry.th32ParentProcessID;
+        break;
+      }
+    }
+    ::CloseHandle(snapshot);
+  }
+  return Status(0, "OK");
+}
+
+Status PlatformProcess::getThreadResourceUsage(ProcessResourceUsage& usage) {
+  FILETIME create_time, exit_time, kernel_time, user_time;
+  if (!::GetThreadTimes(::GetCurrentThread(),
+                        &create_time,
+                        &exit_time,
+                        &kernel_time,
+                        &user_time)) {
+    return Status(1, "Cannot read thread times");
+  }
+
+  usage.user_time = getFileTimeMS(user_time);
+  usage.system_time = getFileTimeMS(kernel_time);
+
+  // The CRT heap cannot be summed cheaply, use the private committed bytes.
+  PROCESS_MEMORY_COUNTERS_EX counters;
+  if (::GetProcessMemoryInfo(::GetCurrentProcess(),
+                             (PROCESS_MEMORY_COUNTERS*)&counters,
+                             sizeof(counters))) {
+    usage.allocated_size = counters.PrivateUsage;
+  }
+  return Status(0, "OK");
+}
+
+Status PlatformProcess::limitResources(size_t memory, size_t cpu) const {
+  if (id_ == kInvalidPid) {
+    return Status(1, "Invalid process");
+  }
+
+  // The job is kept by the system while the process is assigned to it.
+  auto job = ::CreateJobObjectA(nullptr, nullptr);
+  if (job == nullptr) {
+    return Status(1, "Cannot create a job object");
+  }
+
+  // Windows has no throttling memory limit, allocations above it fail.
+  JOBOBJECT_EXTENDED_LIMIT_INFORMATION limits = {};
+  limits.BasicLimitInformation.LimitFlags = JOB_OBJECT_LIMIT_PROCESS_MEMORY;
+  limits.ProcessMemoryLimit = memory * 2;
+
+  // The CPU rate is in 1/100ths of a percent of every processor.
+  SYSTEM_INFO info;
+  ::GetSystemInfo(&info);
+  auto processors = std::max<size_t>(info.dwNumberOfProcessors, 1);
+  JOBOBJECT_CPU_RATE_CONTROL_INFORMATION rate = {};
+  rate.ControlFlags =
+      JOB_OBJECT_CPU_RATE_CONTROL_ENABLE | JOB_OBJECT_CPU_RATE_CONTROL_HARD_CAP;
+  rate.CpuRate = static_cast<DWORD>(
+      std::min<size_t>(std::max<size_t>(cpu * 100 / processors, 1), 10000));
+
+  bool limited =
+      ::SetInformationJobObject(job,
+                                JobObjectExtendedLimitInformation,
+                                &limits,
+                                sizeof(limits)) &&
+      ::SetInformationJobObject(
+          job, JobObjectCpuRateControlInformation, &rate, sizeof(rate)) &&
+      ::AssignProcessToJobObject(job, id_);
+  ::CloseHandle(job);
+  return (limited) ? Status(0, "OK")
+                   : Status(1, "Cannot assign the process to a job object");
+}
+
 std::shared_ptr<PlatformProcess> PlatformProcess::getCurrentProcess() {
   HANDLE handle =
       ::OpenProcess(PROCESS_ALL_ACCESS, FALSE, ::GetCurrentProcessId());
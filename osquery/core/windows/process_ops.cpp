@@ -11,6 +11,8 @@
 #include <string>
 #include <vector>
 
+#include <malloc.h>
+
 #include <boost/optional.hpp>
 
 #include "osquery/core/process.h"
@@ -128,6 +130,50 @@ void cleanupDefunctProcesses() {}
 
 void setToBackgroundPriority() {}
 
+void setThreadToBackgroundPriority() {
+  // Background mode lowers the thread's CPU, I/O, and memory priorities.
+  ::SetThreadPriority(::GetCurrentThread(), THREAD_MODE_BACKGROUND_BEGIN);
+}
+
+Status setThreadPriority(int nice, const std::vector<size_t>& cpus) {
+  // The lowest nice levels use background mode, which also lowers I/O.
+  auto thread = ::GetCurrentThread();
+  int priority = THREAD_PRIORITY_NORMAL;
+  if (nice >= 15) {
+    priority = THREAD_MODE_BACKGROUND_BEGIN;
+  } else if (nice > 0) {
+    priority = THREAD_PRIORITY_BELOW_NORMAL;
+  } else if (nice < 0) {
+    priority = THREAD_PRIORITY_ABOVE_NORMAL;
+  }
+  if (!::SetThreadPriority(thread, priority)) {
+    return Status(1, "Cannot set the thread priority");
+  }
+
+  if (!cpus.empty()) {
+    DWORD_PTR mask = 0;
+    for (const auto& cpu : cpus) {
+      if (cpu < sizeof(mask) * 8) {
+        mask |= static_cast<DWORD_PTR>(1) << cpu;
+      }
+    }
+    if (mask == 0 || ::SetThreadAffinityMask(thread, mask) == 0) {
+      return Status(1, "Cannot set the thread CPU affinity");
+    }
+  }
+  return Status(0, "OK");
+}
+
+void releaseFreedMemory() {
+  // Release the free blocks of the C runtime heap.
+  ::_heapmin();
+}
+
+ResourcePressure getResourcePressure(size_t percent) {
+  // Job objects enforce the limits but do not report stalls.
+  return ResourcePressure();
+}
+
 // Helper function to determine if thread is running with admin privilege.
 bool isUserAdmin() {
   HANDLE hToken = nullptr;
@@ -0,0 +1,44 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <stdint.h>
+
+#include "osquery/core/work_shard.h"
+
+namespace osquery {
+
+/// The calling thread's slice index and count.
+static thread_local size_t kWorkShardIndex{0};
+static thread_local size_t kWorkShardCount{0};
+
+void setWorkShard(size_t index, size_t count) {
+  kWorkShardIndex = index;
+  kWorkShardCount = count;
+}
+
+void getWorkShard(size_t& index, size_t& count) {
+  index = kWorkShardIndex;
+  count = kWorkShardCount;
+}
+
+bool inWorkShard(const std::string& item) {
+  if (kWorkShardCount <= 1) {
+    return true;
+  }
+
+  // A FNV-1a hash, independent of the platform's std::hash.
+  uint64_t hash = 14695981039346656037ULL;
+  for (const auto& c : item) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ULL;
+  }
+  return (hash % kWorkShardCount) == kWorkShardIndex;
+}
+}
@@ -0,0 +1,54 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+
+/**
+ * @brief Set the slice of shared work scanned by the calling thread.
+ *
+ * Hosts mounting the same storage may split an expensive query, see the
+ * scheduled query "split" option. Each host is configured with a distinct
+ * --split_index and scans the items, such as paths, that hash into its
+ * slice. The slice is kept per thread since each query runs on one thread.
+ *
+ * @param index this host's slice, from 0.
+ * @param count the number of slices, 0 or 1 scans every item.
+ */
+void setWorkShard(size_t index, size_t count);
+
+/// Get the calling thread's slice, to apply to helper threads of a query.
+void getWorkShard(size_t& index, size_t& count);
+
+/**
+ * @brief Check if an item is within the calling thread's slice.
+ *
+ * The item's hash is stable across hosts and executions, so every host
+ * agrees on the owner of each item and the slices cover the dataset.
+ */
+bool inWorkShard(const std::string& item);
+
+/// Apply a slice for the duration of a query.
+class WorkShardScope : private boost::noncopyable {
+ public:
+  WorkShardScope(size_t index, size_t count) {
+    setWorkShard(index, count);
+  }
+
+  ~WorkShardScope() {
+    setWorkShard(0, 0);
+  }
+};
+}
@@ -12,6 +12,7 @@
 
 #include <osquery/database.h>
 #include <osquery/filesystem.h>
+#include <osquery/sql.h>
 
 #include "osquery/tests/test_util.h"
 #include "osquery/database/query.h"
@@ -56,6 +57,42 @@ BENCHMARK(DATABASE_serialize_json)
     ->ArgPair(10, 10)
     ->ArgPair(10, 100);
 
+/// Create 100 rows of x columns, each a path-like value of y bytes.
+static QueryData getLongValueQueryData(size_t x, size_t y) {
+  std::string value;
+  while (value.size() < y) {
+    value += "/usr/local/osquery/bin/osqueryd --flagfile=osquery.flags ";
+  }
+  value.resize(y);
+
+  Row r;
+  for (size_t i = 0; i < x; i++) {
+    r["key" + std::to_string(i)] = value;
+  }
+  return QueryData(100, r);
+}
+
+static void DATABASE_serialize_json_long(benchmark::State& state) {
+  auto qd = getLongValueQueryData(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    std::string content;
+    serializeQueryDataJSON(qd, content);
+  }
+}
+
+// Values escape each solidus, the scan finds the runs between them.
+BENCHMARK(DATABASE_serialize_json_long)->ArgPair(10, 64)->ArgPair(10, 1024);
+
+static void DATABASE_escape_results(benchmark::State& state) {
+  auto qd = getLongValueQueryData(state.range_x(), state.range_y());
+  while (state.KeepRunning()) {
+    SQL::escapeResults(qd);
+  }
+}
+
+// Printable results are scanned and not copied.
+BENCHMARK(DATABASE_escape_results)->ArgPair(10, 64)->ArgPair(10, 1024);
+
 static void DATABASE_diff(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
   while (state.KeepRunning()) {
@@ -63,7 +100,35 @@ static void DATABASE_diff(benchmark::State& state) {
   }
 }
 
-BENCHMARK(DATABASE_diff)->ArgPair(1, 1)->ArgPair(10, 10)->ArgPair(10, 100);
+BENCHMARK(DATABASE_diff)
+    ->ArgPair(1, 1)
+    ->ArgPair(10, 10)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000)
+    ->ArgPair(10, 100000);
+
+static void DATABASE_diff_changed(benchmark::State& state) {
+  // Each row is distinct, the current results replace a quarter of the rows.
+  QueryData old_qd;
+  QueryData new_qd;
+  auto rows = static_cast<size_t>(state.range_y());
+  auto r = getExampleQueryData(state.range_x(), 1)[0];
+  for (size_t i = 0; i < rows; i++) {
+    r["id"] = std::to_string(i);
+    old_qd.push_back(r);
+    r["id"] = std::to_string(i + rows / 4);
+    new_qd.push_back(r);
+  }
+
+  while (state.KeepRunning()) {
+    auto d = diff(old_qd, new_qd);
+  }
+}
+
+BENCHMARK(DATABASE_diff_changed)
+    ->ArgPair(10, 100)
+    ->ArgPair(10, 10000)
+    ->ArgPair(10, 100000);
 
 static void DATABASE_query_results(benchmark::State& state) {
   auto qd = getExampleQueryData(state.range_x(), state.range_y());
@@ -92,7 +157,24 @@ static void DATABASE_get(benchmark::State& state) {
 
 BENCHMARK(DATABASE_get);
 
+/// The database plugins compared by the storage benchmarks, by argument.
+const std::vector<std::string> kBenchmarkDatabases = {"rocksdb", "sqlite"};
+
+/// Activate the database plugin selected by a benchmark argument.
+static void setBenchmarkDatabase(int index) {
+  const auto& name = kBenchmarkDatabases[index];
+  if (Registry::getActive("database") == name ||
+      !Registry::exists("database", name)) {
+    // The plugin may not be built, such as when RocksDB is skipped.
+    return;
+  }
+
+  Registry::get("database", Registry::getActive("database"))->tearDown();
+  Registry::setActive("database", name);
+}
+
 static void DATABASE_store(benchmark::State& state) {
+  setBenchmarkDatabase(state.range_x());
   while (state.KeepRunning()) {
     setDatabaseValue(kPersistentSettings, "benchmark", "1");
   }
@@ -100,7 +182,7 @@ static void DATABASE_store(benchmark::State& state) {
   deleteDatabaseValue(kPersistentSettings, "benchmark");
 }
 
-BENCHMARK(DATABASE_store);
+BENCHMARK(DATABASE_store)->Arg(0)->Arg(1);
 
 static void DATABASE_store_large(benchmark::State& state) {
   // Serialize the example result set into a string.
@@ -108,6 +190,7 @@ static void DATABASE_store_large(benchmark::State& state) {
   auto qd = getExampleQueryData(20, 100);
   serializeQueryDataJSON(qd, content);
 
+  setBenchmarkDatabase(state.range_x());
   while (state.KeepRunning()) {
     setDatabaseValue(kPersistentSettings, "benchmark", content);
   }
@@ -115,7 +198,7 @@ static void DATABASE_store_large(benchmark::State& state) {
   deleteDatabaseValue(kPersistentSettings, "benchmark");
 }
 
-BENCHMARK(DATABASE_store_large);
+BENCHMARK(DATABASE_store_large)->Arg(0)->Arg(1);
 
 static void DATABASE_store_append(benchmark::State& state) {
   // Serialize the example result set into a string.
@@ -123,6 +206,7 @@ static void DATABASE_store_append(benchmark::State& state) {
   auto qd = getExampleQueryData(20, 100);
   serializeQueryDataJSON(qd, content);
 
+  setBenchmarkDatabase(state.range_x());
   size_t k = 0;
   while (state.KeepRunning()) {
     setDatabaseValue(kPersistentSettings, "key" + std::to_string(k), content);
@@ -136,5 +220,5 @@ static void DATABASE_store_append(benchmark::State& state) {
   }
 }
 
-BENCHMARK(DATABASE_store_append);
+BENCHMARK(DATABASE_store_append)->Arg(0)->Arg(1);
 }
@@ -8,14 +8,21 @@
  *
  */
 
+#include <algorithm>
+#include <iterator>
+#include <map>
 #include <set>
+#include <unordered_map>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <osquery/database.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/byte_scan.h"
 #include "osquery/core/json.h"
+#include "osquery/core/perf.h"
 
 namespace pt = boost::property_tree;
 
@@ -52,14 +59,756 @@ const std::string kPersistentSettings = "configurations";
 const std::string kQueries = "queries";
 const std::string kEvents = "events";
 const std::string kLogs = "logs";
+const std::string kHashes = "hashes";
+const std::string kCarves = "carves";
 
-const std::vector<std::string> kDomains = {kPersistentSettings, kQueries,
-                                           kEvents, kLogs};
+const std::vector<std::string> kDomains = {
+    kPersistentSettings, kQueries, kEvents, kLogs, kHashes, kCarves};
 
 bool DatabasePlugin::kDBHandleOptionAllowOpen(false);
 bool DatabasePlugin::kDBHandleOptionRequireWrite(false);
 std::atomic<bool> DatabasePlugin::kCheckingDB(false);
 
+/// Keys the log item serializers write beside top-level decorations.
+static const std::set<std::string> kLogItemKeys = {
+    "diffResults",
+    "snapshot",
+    "action",
+    "name",
+    "hostIdentifier",
+    "calendarTime",
+    "unixTime",
+    "columns",
+    "decorations",
+    "chunk",
+    "chunks",
+};
+
+/**
+ * @brief Check if a key is written as-is by a property tree put.
+ *
+ * Property tree paths split on '.', and an empty path is the node itself.
+ * The direct writers fall back to a property tree for these keys to keep the
+ * output identical.
+ */
+static inline bool isPlainJSONKey(const std::string& key) {
+  return !key.empty() && key.find('.') == std::string::npos;
+}
+
+static bool isPlainJSONRow(const Row& r, size_t& size) {
+  for (const auto& column : r) {
+    if (!isPlainJSONKey(column.first)) {
+      return false;
+    }
+    size += column.first.size() + column.second.size() + 6;
+  }
+  size += 2;
+  return true;
+}
+
+static bool isPlainJSONQueryData(const QueryData& q, size_t& size) {
+  for (const auto& r : q) {
+    if (!isPlainJSONRow(r, size)) {
+      return false;
+    }
+    size += 4;
+  }
+  size += 2;
+  return true;
+}
+
+static bool isPlainJSONLogItem(const QueryLogItem& item, size_t& size) {
+  if (!isPlainJSONQueryData(item.results.added, size) ||
+      !isPlainJSONQueryData(item.results.removed, size) ||
+      !isPlainJSONQueryData(item.results.updated, size) ||
+      !isPlainJSONQueryData(item.snapshot_results, size)) {
+    return false;
+  }
+
+  for (const auto& name : item.decorations) {
+    if (!isPlainJSONKey(name.first) ||
+        (FLAGS_decorations_top_level && kLogItemKeys.count(name.first) > 0)) {
+      // Top-level decorations may replace a legacy field in place.
+      return false;
+    }
+    size += name.first.size() + name.second.size() + 6;
+  }
+  size += item.name.size() + item.identifier.size() +
+          item.calendar_time.size() + 128;
+  return true;
+}
+
+/// Append a quoted string, escaped exactly as property tree's write_json.
+void writeJSONString(const std::string& s, std::string& json) {
+  static const char* kHexDigits = "0123456789ABCDEF";
+
+  json.push_back('"');
+  size_t run = 0;
+  while (run < s.size()) {
+    // Append the run of bytes before the next byte to escape.
+    auto i = run + findJSONEscape(s.data() + run, s.size() - run);
+    json.append(s, run, i - run);
+    if (i == s.size()) {
+      break;
+    }
+
+    auto c = static_cast<unsigned char>(s[i]);
+    run = i + 1;
+    switch (c) {
+    case '\b':
+      json.append("\\b");
+      break;
+    case '\f':
+      json.append("\\f");
+      break;
+    case '\n':
+      json.append("\\n");
+      break;
+    case '\r':
+      json.append("\\r");
+      break;
+    case '\t':
+      json.append("\\t");
+      break;
+    case '/':
+      json.append("\\/");
+      break;
+    case '"':
+      json.append("\\\"");
+      break;
+    case '\\':
+      json.append("\\\\");
+      break;
+    default:
+      // The remaining characters are controls, below 0x20.
+      json.append("\\u00");
+      json.push_back(kHexDigits[c >> 4]);
+      json.push_back(kHexDigits[c & 0xF]);
+    }
+  }
+  json.push_back('"');
+}
+
+/**
+ * @brief Append the JSON for a row.
+ *
+ * A nested row without columns is an empty property tree node, which
+ * write_json represents as an empty string.
+ */
+static void writeJSONRow(const Row& r, bool nested, std::string& json) {
+  if (r.empty()) {
+    json.append((nested) ? "\"\"" : "{}");
+    return;
+  }
+
+  json.push_back('{');
+  for (const auto& column : r) {
+    if (json.back() != '{') {
+      json.push_back(',');
+    }
+    writeJSONString(column.first, json);
+    json.push_back(':');
+    writeJSONString(column.second, json);
+  }
+  json.push_back('}');
+}
+
+/**
+ * @brief Append the JSON for a list of rows.
+ *
+ * write_json only writes arrays below the root, a root list of rows is an
+ * object with empty keys.
+ */
+static void writeJSONQueryData(const QueryData& q,
+                               bool nested,
+                               std::string& json) {
+  if (q.empty()) {
+    json.append((nested) ? "\"\"" : "{}");
+    return;
+  }
+
+  json.push_back((nested) ? '[' : '{');
+  for (size_t i = 0; i < q.size(); ++i) {
+    if (i > 0) {
+      json.push_back(',');
+    }
+    if (!nested) {
+      json.append("\"\":");
+    }
+    writeJSONRow(q[i], true, json);
+  }
+  json.push_back((nested) ? ']' : '}');
+}
+
+static void writeJSONDiffResults(const DiffResults& d, std::string& json) {
+  json.append("{\"removed\":");
+  writeJSONQueryData(d.removed, true, json);
+  json.append(",\"added\":");
+  writeJSONQueryData(d.added, true, json);
+  if (!d.updated.empty()) {
+    json.append(",\"updated\":");
+    writeJSONQueryData(d.updated, true, json);
+  }
+  json.push_back('}');
+}
+
+/// Append the members written by addLegacyFieldsAndDecorations.
+static void writeJSONLegacyFields(const QueryLogItem& item,
+                                  std::string& json) {
+  json.append("\"name\":");
+  writeJSONString(item.name, json);
+  json.append(",\"hostIdentifier\":");
+  writeJSONString(item.identifier, json);
+  json.append(",\"calendarTime\":");
+  writeJSONString(item.calendar_time, json);
+  json.append(",\"unixTime\":\"");
+  json.append(std::to_string(item.time));
+  json.push_back('"');
+  if (item.chunks > 0) {
+    json.append(",\"chunk\":\"");
+    json.append(std::to_string(item.chunk));
+    json.append("\",\"chunks\":\"");
+    json.append(std::to_string(item.chunks));
+    json.push_back('"');
+  }
+
+  if (item.decorations.empty()) {
+    return;
+  }
+
+  if (!FLAGS_decorations_top_level) {
+    json.append(",\"decorations\":{");
+  }
+  for (const auto& name : item.decorations) {
+    if (json.back() != '{') {
+      json.push_back(',');
+    }
+    writeJSONString(name.first, json);
+    json.push_back(':');
+    writeJSONString(name.second, json);
+  }
+  if (!FLAGS_decorations_top_level) {
+    json.push_back('}');
+  }
+}
+
+/**
+ * @brief A single-pass reader from JSON text to rows or property trees.
+ *
+ * The reader builds rows as it scans, without an intermediate property tree.
+ * It accepts the same grammar as property tree's read_json and produces the
+ * same rows as deserializeQueryData and deserializeRow would from its tree:
+ * numbers and literals keep their text, nested values become empty strings,
+ * and members without a key are ignored.
+ *
+ * Trees are built directly from the buffer, matching read_json's output.
+ * With comments, lines starting with '#' or '//' are skipped between tokens.
+ */
+class JSONReader : private boost::noncopyable {
+ public:
+  JSONReader(const char* data, size_t size, bool comments = false)
+      : begin_(data), cur_(data), end_(data + size), comments_(comments) {}
+
+  /// Read a list of rows, an object or array of objects.
+  Status read(QueryData& qd) {
+    skipIntroduction();
+    skipWhitespace();
+    if (cur_ < end_ && (*cur_ == '{' || *cur_ == '[')) {
+      auto close = (*cur_ == '{') ? '}' : ']';
+      auto keyed = (*cur_ == '{');
+      ++cur_;
+      skipWhitespace();
+      if (!have(close)) {
+        do {
+          if (keyed && !parseKey(nullptr)) {
+            return getError();
+          }
+          qd.push_back(Row());
+          if (!parseRow(qd.back())) {
+            return getError();
+          }
+          skipWhitespace();
+        } while (have(','));
+        if (!have(close)) {
+          fail((keyed) ? "expected '}' or ','" : "expected ']' or ','");
+          return getError();
+        }
+      }
+    } else if (!parseValue(nullptr)) {
+      return getError();
+    }
+    return finish();
+  }
+
+  /// Read a single row, an object.
+  Status read(Row& r) {
+    skipIntroduction();
+    if (!parseRow(r)) {
+      return getError();
+    }
+    return finish();
+  }
+
+  /// Read any value into a property tree.
+  Status read(pt::ptree& tree) {
+    skipIntroduction();
+    if (!parseTree(tree)) {
+      return getError();
+    }
+    return finish();
+  }
+
+ private:
+  /// Parse a value into a tree node, containers become children.
+  bool parseTree(pt::ptree& node) {
+    skipWhitespace();
+    if (cur_ == end_ || (*cur_ != '{' && *cur_ != '[')) {
+      return parseValue(&node.data());
+    }
+
+    auto close = (*cur_ == '{') ? '}' : ']';
+    auto keyed = (*cur_ == '{');
+    ++cur_;
+    skipWhitespace();
+    if (have(close)) {
+      return true;
+    }
+
+    std::string key;
+    do {
+      key.clear();
+      if (keyed && !parseKey(&key)) {
+        return false;
+      }
+      auto child = node.push_back(std::make_pair(key, pt::ptree()));
+      if (!parseTree(child->second)) {
+        return false;
+      }
+      skipWhitespace();
+    } while (have(','));
+
+    if (!have(close)) {
+      return fail((keyed) ? "expected '}' or ','" : "expected ']' or ','");
+    }
+    return true;
+  }
+
+  /// Parse a row, any non-object value is a row without columns.
+  bool parseRow(Row& r) {
+    skipWhitespace();
+    if (cur_ == end_ || (*cur_ != '{' && *cur_ != '[')) {
+      return parseValue(nullptr);
+    }
+
+    auto close = (*cur_ == '{') ? '}' : ']';
+    auto keyed = (*cur_ == '{');
+    ++cur_;
+    skipWhitespace();
+    if (have(close)) {
+      return true;
+    }
+
+    std::string key;
+    do {
+      std::string* value = nullptr;
+      if (keyed) {
+        key.clear();
+        if (!parseKey(&key)) {
+          return false;
+        }
+        if (!key.empty()) {
+          value = &r[key];
+          value->clear();
+        }
+      }
+      if (!parseValue(value)) {
+        return false;
+      }
+      skipWhitespace();
+    } while (have(','));
+
+    if (!have(close)) {
+      return fail((keyed) ? "expected '}' or ','" : "expected ']' or ','");
+    }
+    return true;
+  }
+
+  /// Parse a member key and the following colon.
+  bool parseKey(std::string* key) {
+    skipWhitespace();
+    if (cur_ == end_ || *cur_ != '"') {
+      return fail("expected key string");
+    }
+    if (!parseString(key)) {
+      return false;
+    }
+    skipWhitespace();
+    if (!have(':')) {
+      return fail("expected ':'");
+    }
+    return true;
+  }
+
+  /**
+   * @brief Parse any value.
+   *
+   * Scalars are stored in the optional value, containers are validated and
+   * discarded, leaving the value empty.
+   */
+  bool parseValue(std::string* value) {
+    skipWhitespace();
+    if (cur_ == end_) {
+      return fail("expected value");
+    }
+
+    switch (*cur_) {
+    case '{':
+    case '[':
+      return skipContainer();
+    case '"':
+      return parseString(value);
+    case 't':
+      return parseLiteral("true", "expected 'true'", value);
+    case 'f':
+      return parseLiteral("false", "expected 'false'", value);
+    case 'n':
+      return parseLiteral("null", "expected 'null'", value);
+    default:
+      return parseNumber(value);
+    }
+  }
+
+  bool skipContainer() {
+    auto close = (*cur_ == '{') ? '}' : ']';
+    auto keyed = (*cur_ == '{');
+    ++cur_;
+    skipWhitespace();
+    if (have(close)) {
+      return true;
+    }
+
+    do {
+      if ((keyed && !parseKey(nullptr)) || !parseValue(nullptr)) {
+        return false;
+      }
+      skipWhitespace();
+    } while (have(','));
+
+    if (!have(close)) {
+      return fail((keyed) ? "expected '}' or ','" : "expected ']' or ','");
+    }
+    return true;
+  }
+
+  bool parseLiteral(const char* literal,
+                    const char* error,
+                    std::string* value) {
+    auto start = cur_;
+    for (auto c = literal; *c != '\0'; ++c) {
+      if (!have(*c)) {
+        return fail(error);
+      }
+    }
+    if (value != nullptr) {
+      value->assign(start, cur_ - start);
+    }
+    return true;
+  }
+
+  bool parseNumber(std::string* value) {
+    auto start = cur_;
+    auto negative = have('-');
+    if (!have('0')) {
+      if (!haveDigit('1')) {
+        return fail((negative) ? "expected digits after -" : "expected value");
+      }
+      while (haveDigit('0')) {
+      }
+    }
+
+    if (have('.')) {
+      if (!haveDigit('0')) {
+        return fail("need at least one digit after '.'");
+      }
+      while (haveDigit('0')) {
+      }
+    }
+
+    if (have('e') || have('E')) {
+      if (!have('+')) {
+        have('-');
+      }
+      if (!haveDigit('0')) {
+        return fail("need at least one digit in exponent");
+      }
+      while (haveDigit('0')) {
+      }
+    }
+
+    if (value != nullptr) {
+      value->assign(start, cur_ - start);
+    }
+    return true;
+  }
+
+  /// Parse a string, appending the unescaped UTF-8 to the optional value.
+  bool parseString(std::string* value) {
+    ++cur_;
+    while (true) {
+      auto run = cur_;
+      while (cur_ < end_ && *cur_ != '"' && *cur_ != '\\' &&
+             static_cast<unsigned char>(*cur_) >= 0x20 &&
+             static_cast<unsigned char>(*cur_) < 0x80) {
+        ++cur_;
+      }
+      if (value != nullptr) {
+        value->append(run, cur_ - run);
+      }
+
+      if (cur_ == end_) {
+        return fail("unterminated string");
+      }
+
+      auto c = static_cast<unsigned char>(*cur_);
+      if (c == '"') {
+        ++cur_;
+        return true;
+      } else if (c == '\\') {
+        ++cur_;
+        if (!parseEscape(value)) {
+          return false;
+        }
+      } else if (!parseCodeSequence(value)) {
+        return false;
+      }
+    }
+  }
+
+  /// Validate a control character or multi-byte UTF-8 sequence.
+  bool parseCodeSequence(std::string* value) {
+    auto c = static_cast<unsigned char>(*cur_);
+    int trailing = -1;
+    if (c >= 0xC0 && c < 0xE0) {
+      trailing = 1;
+    } else if (c >= 0xE0 && c < 0xF0) {
+      trailing = 2;
+    } else if (c >= 0xF0 && c < 0xF8) {
+      trailing = 3;
+    }
+
+    if (trailing == -1 || end_ - cur_ <= trailing) {
+      return fail("invalid code sequence");
+    }
+    for (int i = 1; i <= trailing; ++i) {
+      if ((static_cast<unsigned char>(cur_[i]) & 0xC0) != 0x80) {
+        return fail("invalid code sequence");
+      }
+    }
+
+    if (value != nullptr) {
+      value->append(cur_, trailing + 1);
+    }
+    cur_ += trailing + 1;
+    return true;
+  }
+
+  bool parseEscape(std::string* value) {
+    if (cur_ == end_) {
+      return fail("invalid escape sequence");
+    }
+
+    char c = *cur_++;
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+      break;
+    case 'b':
+      c = '\b';
+      break;
+    case 'f':
+      c = '\f';
+      break;
+    case 'n':
+      c = '\n';
+      break;
+    case 'r':
+      c = '\r';
+      break;
+    case 't':
+      c = '\t';
+      break;
+    case 'u':
+      return parseCodepoint(value);
+    default:
+      return fail("invalid escape sequence");
+    }
+
+    if (value != nullptr) {
+      value->push_back(c);
+    }
+    return true;
+  }
+
+  bool parseHexQuad(unsigned& codepoint) {
+    codepoint = 0;
+    for (size_t i = 0; i < 4; ++i, ++cur_) {
+      if (cur_ == end_) {
+        return fail("invalid escape sequence");
+      }
+
+      auto c = *cur_;
+      unsigned digit = 0;
+      if (c >= '0' && c <= '9') {
+        digit = c - '0';
+      } else if (c >= 'A' && c <= 'F') {
+        digit = c - 'A' + 10;
+      } else if (c >= 'a' && c <= 'f') {
+        digit = c - 'a' + 10;
+      } else {
+        return fail("invalid escape sequence");
+      }
+      codepoint = codepoint * 16 + digit;
+    }
+    return true;
+  }
+
+  /// Parse a \u reference, combining surrogate pairs, and encode as UTF-8.
+  bool parseCodepoint(std::string* value) {
+    unsigned codepoint = 0;
+    if (!parseHexQuad(codepoint)) {
+      return false;
+    }
+
+    if ((codepoint & 0xFC00) == 0xDC00) {
+      return fail("invalid codepoint, stray low surrogate");
+    } else if ((codepoint & 0xFC00) == 0xD800) {
+      if (!have('\\')) {
+        return fail("invalid codepoint, stray high surrogate");
+      }
+      if (!have('u')) {
+        return fail("expected codepoint reference after high surrogate");
+      }
+
+      unsigned low = 0;
+      if (!parseHexQuad(low)) {
+        return false;
+      }
+      if ((low & 0xFC00) != 0xDC00) {
+        return fail("expected low surrogate after high surrogate");
+      }
+      codepoint = 0x10000 + (((codepoint & 0x3FF) << 10) | (low & 0x3FF));
+    }
+
+    if (value == nullptr) {
+      return true;
+    }
+
+    if (codepoint <= 0x7F) {
+      value->push_back(static_cast<char>(codepoint));
+    } else if (codepoint <= 0x7FF) {
+      value->push_back(static_cast<char>(0xC0 | (codepoint >> 6)));
+      value->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else if (codepoint <= 0xFFFF) {
+      value->push_back(static_cast<char>(0xE0 | (codepoint >> 12)));
+      value->push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      value->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    } else {
+      value->push_back(static_cast<char>(0xF0 | (codepoint >> 18)));
+      value->push_back(static_cast<char>(0x80 | ((codepoint >> 12) & 0x3F)));
+      value->push_back(static_cast<char>(0x80 | ((codepoint >> 6) & 0x3F)));
+      value->push_back(static_cast<char>(0x80 | (codepoint & 0x3F)));
+    }
+    return true;
+  }
+
+  /// Skip a byte order mark, as read_json does.
+  void skipIntroduction() {
+    if (cur_ < end_ && static_cast<unsigned char>(*cur_) == 0xEF) {
+      cur_ += std::min<ptrdiff_t>(3, end_ - cur_);
+    }
+  }
+
+  void skipWhitespace() {
+    while (cur_ < end_) {
+      if (*cur_ == ' ' || *cur_ == '\t' || *cur_ == '\n' || *cur_ == '\r') {
+        ++cur_;
+      } else if (comments_ && isCommentLine()) {
+        while (cur_ < end_ && *cur_ != '\n') {
+          ++cur_;
+        }
+      } else {
+        break;
+      }
+    }
+  }
+
+  /// Check for a comment, only whitespace may precede it on the line.
+  bool isCommentLine() const {
+    if (*cur_ != '#' &&
+        (*cur_ != '/' || cur_ + 1 == end_ || *(cur_ + 1) != '/')) {
+      return false;
+    }
+
+    for (auto c = cur_; c > begin_ && *(c - 1) != '\n'; --c) {
+      if (!std::isspace(static_cast<unsigned char>(*(c - 1)))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool have(char c) {
+    if (cur_ < end_ && *cur_ == c) {
+      ++cur_;
+      return true;
+    }
+    return false;
+  }
+
+  /// Consume a digit no smaller than the minimum.
+  bool haveDigit(char min) {
+    if (cur_ < end_ && *cur_ >= min && *cur_ <= '9') {
+      ++cur_;
+      return true;
+    }
+    return false;
+  }
+
+  Status finish() {
+    skipWhitespace();
+    if (cur_ != end_) {
+      fail("garbage after data");
+      return getError();
+    }
+    return Status(0, "OK");
+  }
+
+  bool fail(const char* error) {
+    error_ = error;
+    return false;
+  }
+
+  /// Format the error like a json_parser_error, with the current line.
+  Status getError() const {
+    auto line = std::count(begin_, std::min(cur_, end_), '\n') + 1;
+    return Status(1,
+                  "<unspecified file>(" + std::to_string(line) + "): " +
+                      error_);
+  }
+
+ private:
+  const char* begin_{nullptr};
+  const char* cur_{nullptr};
+  const char* end_{nullptr};
+
+  /// Skip comment lines.
+  bool comments_{false};
+
+  /// The most recent parse error.
+  std::string error_;
+};
+
 Status serializeRow(const Row& r, pt::ptree& tree) {
   try {
     for (auto& i : r) {
@@ -72,6 +821,15 @@ Status serializeRow(const Row& r, pt::ptree& tree) {
 }
 
 Status serializeRowJSON(const Row& r, std::string& json) {
+  size_t size = 0;
+  if (isPlainJSONRow(r, size)) {
+    json.clear();
+    json.reserve(size + 1);
+    writeJSONRow(r, false, json);
+    json.push_back('\n');
+    return Status(0, "OK");
+  }
+
   pt::ptree tree;
   auto status = serializeRow(r, tree);
   if (!status.ok()) {
@@ -99,15 +857,16 @@ Status deserializeRow(const pt::ptree& tree, Row& r) {
 }
 
 Status deserializeRowJSON(const std::string& json, Row& r) {
-  pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  Row columns;
+  auto status = JSONReader(json.data(), json.size()).read(columns);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (auto& column : columns) {
+    r[column.first] = std::move(column.second);
   }
-  return deserializeRow(tree, r);
+  return Status(0, "OK");
 }
 
 Status serializeQueryData(const QueryData& q, pt::ptree& tree) {
@@ -123,6 +882,15 @@ Status serializeQueryData(const QueryData& q, pt::ptree& tree) {
 }
 
 Status serializeQueryDataJSON(const QueryData& q, std::string& json) {
+  size_t size = 0;
+  if (isPlainJSONQueryData(q, size)) {
+    json.clear();
+    json.reserve(size + 1);
+    writeJSONQueryData(q, false, json);
+    json.push_back('\n');
+    return Status(0, "OK");
+  }
+
   pt::ptree tree;
   auto status = serializeQueryData(q, tree);
   if (!status.ok()) {
@@ -152,16 +920,35 @@ Status deserializeQueryData(const pt::ptree& tree, QueryData& qd) {
   return Status(0, "OK");
 }
 
+Status deserializeQueryDataJSON(const char* json, size_t size, QueryData& qd) {
+  QueryData rows;
+  auto status = JSONReader(json, size).read(rows);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (qd.empty()) {
+    qd.swap(rows);
+  } else {
+    std::move(rows.begin(), rows.end(), std::back_inserter(qd));
+  }
+  return Status(0, "OK");
+}
+
 Status deserializeQueryDataJSON(const std::string& json, QueryData& qd) {
-  pt::ptree tree;
-  try {
-    std::stringstream input;
-    input << json;
-    pt::read_json(input, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
-    return Status(1, e.what());
+  return deserializeQueryDataJSON(json.data(), json.size(), qd);
+}
+
+Status deserializeTreeJSON(const char* json,
+                           size_t size,
+                           pt::ptree& tree,
+                           bool comments) {
+  pt::ptree output;
+  auto status = JSONReader(json, size, comments).read(output);
+  if (status.ok()) {
+    tree.swap(output);
   }
-  return deserializeQueryData(tree, qd);
+  return status;
 }
 
 Status serializeDiffResults(const DiffResults& d, pt::ptree& tree) {
@@ -182,6 +969,16 @@ Status serializeDiffResults(const DiffResults& d, pt::ptree& tree) {
     return status;
   }
   tree.add_child("added", added);
+
+  // Only keyed differentials have updated rows.
+  if (!d.updated.empty()) {
+    pt::ptree updated;
+    status = serializeQueryData(d.updated, updated);
+    if (!status.ok()) {
+      return status;
+    }
+    tree.add_child("updated", updated);
+  }
   return Status(0, "OK");
 }
 
@@ -199,10 +996,28 @@ Status deserializeDiffResults(const pt::ptree& tree, DiffResults& dr) {
       return status;
     }
   }
+
+  if (tree.count("updated") > 0) {
+    auto status = deserializeQueryData(tree.get_child("updated"), dr.updated);
+    if (!status.ok()) {
+      return status;
+    }
+  }
   return Status(0, "OK");
 }
 
 Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
+  size_t size = 0;
+  if (isPlainJSONQueryData(d.removed, size) &&
+      isPlainJSONQueryData(d.added, size) &&
+      isPlainJSONQueryData(d.updated, size)) {
+    json.clear();
+    json.reserve(size + 32);
+    writeJSONDiffResults(d, json);
+    json.push_back('\n');
+    return Status(0, "OK");
+  }
+
   pt::ptree tree;
   auto status = serializeDiffResults(d, tree);
   if (!status.ok()) {
@@ -220,26 +1035,144 @@ Status serializeDiffResultsJSON(const DiffResults& d, std::string& json) {
   return Status(0, "OK");
 }
 
+uint64_t hashRow(const Row& r) {
+  // A 64-bit FNV-1a digest over the (sorted) column and value pairs.
+  // Each component is terminated so that {"ab": "c"} and {"a": "bc"} differ.
+  uint64_t digest = 0xcbf29ce484222325ULL;
+  auto update = [&digest](const std::string& component) {
+    for (const auto& c : component) {
+      digest ^= static_cast<unsigned char>(c);
+      digest *= 0x100000001b3ULL;
+    }
+    digest ^= 0xff;
+    digest *= 0x100000001b3ULL;
+  };
+
+  for (const auto& column : r) {
+    update(column.first);
+    update(column.second);
+  }
+  return digest;
+}
+
 DiffResults diff(const QueryData& old, const QueryData& current) {
   DiffResults r;
-  QueryData overlap;
 
-  for (const auto& i : current) {
-    auto item = std::find(old.begin(), old.end(), i);
-    if (item != old.end()) {
-      overlap.push_back(i);
-    } else {
-      r.added.push_back(i);
+  // Index the old rows by their digest, the index list keeps multiplicity.
+  std::unordered_map<uint64_t, std::vector<size_t>> old_index;
+  old_index.reserve(old.size());
+  for (size_t i = 0; i < old.size(); ++i) {
+    old_index[hashRow(old[i])].push_back(i);
+  }
+
+  // Each old row may only satisfy a single current row.
+  std::vector<bool> matched(old.size(), false);
+  for (const auto& row : current) {
+    bool found = false;
+    auto bucket = old_index.find(hashRow(row));
+    if (bucket != old_index.end()) {
+      for (const auto& i : bucket->second) {
+        // Compare the content to protect against digest collisions.
+        if (!matched[i] && old[i] == row) {
+          matched[i] = true;
+          found = true;
+          break;
+        }
+      }
+    }
+
+    if (!found) {
+      r.added.push_back(row);
     }
   }
 
-  std::multiset<Row> overlap_set(overlap.begin(), overlap.end());
-  std::multiset<Row> old_set(old.begin(), old.end());
-  std::set_difference(old_set.begin(),
-                      old_set.end(),
-                      overlap_set.begin(),
-                      overlap_set.end(),
-                      std::back_inserter(r.removed));
+  // Every old row without a match in the current results was removed.
+  for (size_t i = 0; i < old.size(); ++i) {
+    if (!matched[i]) {
+      r.removed.push_back(old[i]);
+    }
+  }
+  return r;
+}
+
+/// Get a row's values for the key columns, false if any are missing.
+static bool getRowKey(const Row& row,
+                      const std::vector<std::string>& key,
+                      std::vector<std::string>& values) {
+  values.clear();
+  for (const auto& column : key) {
+    auto it = row.find(column);
+    if (it == row.end()) {
+      return false;
+    }
+    values.push_back(it->second);
+  }
+  return true;
+}
+
+DiffResults diff(const QueryData& old,
+                 const QueryData& current,
+                 const std::vector<std::string>& key) {
+  auto r = diff(old, current);
+  if (key.empty() || r.removed.empty() || r.added.empty()) {
+    return r;
+  }
+
+  // Index the removed rows by key, a key may repeat within the results.
+  // Each bucket is reversed so rows are paired from the back in order.
+  std::map<std::vector<std::string>, std::vector<size_t>> removed_index;
+  std::vector<std::string> values;
+  for (size_t i = r.removed.size(); i > 0; --i) {
+    if (getRowKey(r.removed[i - 1], key, values)) {
+      removed_index[values].push_back(i - 1);
+    }
+  }
+
+  // Pair each added row with the first unpaired removed row sharing its key.
+  std::vector<bool> paired(r.removed.size(), false);
+  QueryData added;
+  for (auto& row : r.added) {
+    auto bucket = removed_index.end();
+    if (getRowKey(row, key, values)) {
+      bucket = removed_index.find(values);
+    }
+    if (bucket == removed_index.end() || bucket->second.empty()) {
+      added.push_back(std::move(row));
+      continue;
+    }
+
+    auto i = bucket->second.back();
+    bucket->second.pop_back();
+    paired[i] = true;
+
+    // The update holds the key and the columns with a new value.
+    const auto& previous = r.removed[i];
+    Row update;
+    for (const auto& column : key) {
+      update[column] = row[column];
+    }
+    for (const auto& column : row) {
+      auto it = previous.find(column.first);
+      if (it == previous.end() || it->second != column.second) {
+        update[column.first] = column.second;
+      }
+    }
+    for (const auto& column : previous) {
+      if (row.count(column.first) == 0) {
+        update[column.first] = "";
+      }
+    }
+    r.updated.push_back(std::move(update));
+  }
+  r.added = std::move(added);
+
+  QueryData removed;
+  for (size_t i = 0; i < r.removed.size(); ++i) {
+    if (!paired[i]) {
+      removed.push_back(std::move(r.removed[i]));
+    }
+  }
+  r.removed = std::move(removed);
   return r;
 }
 
@@ -250,6 +1183,10 @@ inline void addLegacyFieldsAndDecorations(const QueryLogItem& item,
   tree.put<std::string>("hostIdentifier", item.identifier);
   tree.put<std::string>("calendarTime", item.calendar_time);
   tree.put<size_t>("unixTime", item.time);
+  if (item.chunks > 0) {
+    tree.put<size_t>("chunk", item.chunk);
+    tree.put<size_t>("chunks", item.chunks);
+  }
 
   // Append the decorations.
   if (item.decorations.size() > 0) {
@@ -277,11 +1214,13 @@ inline void getLegacyFieldsAndDecorations(const pt::ptree& tree,
   item.identifier = tree.get<std::string>("hostIdentifier", "");
   item.calendar_time = tree.get<std::string>("calendarTime", "");
   item.time = tree.get<int>("unixTime", 0);
+  item.chunk = tree.get<size_t>("chunk", 0);
+  item.chunks = tree.get<size_t>("chunks", 0);
 }
 
 Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
   pt::ptree results_tree;
-  if (item.results.added.size() > 0 || item.results.removed.size() > 0) {
+  if (!item.results.empty()) {
     auto status = serializeDiffResults(item.results, results_tree);
     if (!status.ok()) {
       return status;
@@ -301,6 +1240,25 @@ Status serializeQueryLogItem(const QueryLogItem& item, pt::ptree& tree) {
 }
 
 Status serializeQueryLogItemJSON(const QueryLogItem& i, std::string& json) {
+  PerfTimer timer(PERF_SERIALIZE);
+  size_t size = 0;
+  if (isPlainJSONLogItem(i, size)) {
+    json.clear();
+    json.reserve(size);
+    if (!i.results.empty()) {
+      json.append("{\"diffResults\":");
+      writeJSONDiffResults(i.results, json);
+    } else {
+      json.append("{\"snapshot\":");
+      writeJSONQueryData(i.snapshot_results, true, json);
+      json.append(",\"action\":\"snapshot\"");
+    }
+    json.push_back(',');
+    writeJSONLegacyFields(i, json);
+    json.append("}\n");
+    return Status(0, "OK");
+  }
+
   pt::ptree tree;
   auto status = serializeQueryLogItem(i, tree);
   if (!status.ok()) {
@@ -388,8 +1346,40 @@ Status serializeQueryLogItemAsEvents(const QueryLogItem& i, pt::ptree& tree) {
 
 Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
                                          std::vector<std::string>& items) {
+  items.reserve(items.size() + i.results.removed.size() +
+                i.results.added.size() + i.results.updated.size());
+  return serializeQueryLogItemAsEventsJSON(
+      i, [&items](const std::string& event) { items.push_back(event + '\n'); });
+}
+
+Status serializeQueryLogItemAsEventsJSON(
+    const QueryLogItem& item, const QueryLogEventCallback& callback) {
+  size_t size = 0;
+  if (isPlainJSONLogItem(item, size)) {
+    // Each event repeats the legacy fields and decorations.
+    std::string prefix("{");
+    writeJSONLegacyFields(item, prefix);
+    prefix.append(",\"columns\":");
+
+    std::string event;
+    for (const auto& action :
+         {std::make_pair("removed", &item.results.removed),
+          std::make_pair("added", &item.results.added),
+          std::make_pair("updated", &item.results.updated)}) {
+      for (const auto& row : *action.second) {
+        event.assign(prefix);
+        writeJSONRow(row, true, event);
+        event.append(",\"action\":\"");
+        event.append(action.first);
+        event.append("\"}");
+        callback(event);
+      }
+    }
+    return Status(0, "OK");
+  }
+
   pt::ptree tree;
-  auto status = serializeQueryLogItemAsEvents(i, tree);
+  auto status = serializeQueryLogItemAsEvents(item, tree);
   if (!status.ok()) {
     return status;
   }
@@ -401,11 +1391,112 @@ Status serializeQueryLogItemAsEventsJSON(const QueryLogItem& i,
     } catch (const pt::json_parser::json_parser_error& e) {
       return Status(1, e.what());
     }
-    items.push_back(output.str());
+
+    auto json = output.str();
+    if (!json.empty() && json.back() == '\n') {
+      json.pop_back();
+    }
+    callback(json);
   }
   return Status(0, "OK");
 }
 
+/**
+ * @brief A linear syntactic check that a line holds a single JSON object.
+ *
+ * Strings must terminate without raw control characters and brackets must
+ * balance, scalar tokens are not validated. The object ends at [begin, end).
+ */
+static bool isJSONObjectLine(const std::string& line,
+                             size_t& begin,
+                             size_t& end) {
+  begin = line.find_first_not_of(" \t\r\n");
+  end = line.find_last_not_of(" \t\r\n");
+  if (begin == std::string::npos || line[begin] != '{' || line[end] != '}') {
+    return false;
+  }
+  end++;
+
+  // Track the kind of the 64 innermost brackets, a set bit is an object.
+  uint64_t kinds = 0;
+  size_t depth = 0;
+  bool string = false;
+  for (size_t i = begin; i < end; i++) {
+    auto c = static_cast<unsigned char>(line[i]);
+    if (string) {
+      if (c == '\\') {
+        i++;
+      } else if (c == '"') {
+        string = false;
+      } else if (c < 0x20) {
+        return false;
+      }
+    } else if (c == '"') {
+      string = true;
+    } else if (c == '{' || c == '[') {
+      // Deeper brackets are only counted.
+      if (depth < 64) {
+        kinds = (kinds << 1) | ((c == '{') ? 1 : 0);
+      }
+      depth++;
+    } else if (c == '}' || c == ']') {
+      if (depth == 0) {
+        return false;
+      } else if (depth <= 64) {
+        if (((kinds & 1) == 1) != (c == '}')) {
+          return false;
+        }
+        kinds >>= 1;
+      }
+      depth--;
+      if (depth == 0 && i + 1 != end) {
+        return false;
+      }
+    }
+  }
+  return depth == 0 && !string;
+}
+
+Status serializeResultBatchJSON(
+    const std::map<std::string, std::string>& fields,
+    const std::vector<std::string>& items,
+    std::string& json) {
+  size_t size = 0;
+  for (const auto& field : fields) {
+    size += field.first.size() + field.second.size() + 6;
+  }
+  for (const auto& item : items) {
+    size += item.size() + 1;
+  }
+  json.clear();
+  json.reserve(size + 16);
+
+  json.push_back('{');
+  for (const auto& field : fields) {
+    writeJSONString(field.first, json);
+    json.push_back(':');
+    writeJSONString(field.second, json);
+    json.push_back(',');
+  }
+  json.append("\"data\":[");
+  bool first = true;
+  for (const auto& item : items) {
+    size_t begin = 0;
+    size_t end = 0;
+    if (!isJSONObjectLine(item, begin, end)) {
+      // The log line entered was not valid JSON, skip it.
+      continue;
+    }
+    if (!first) {
+      json.push_back(',');
+    }
+    first = false;
+    json.append(item, begin, end - begin);
+  }
+  json.append("]}\n");
+  return Status(0, "OK");
+}
+
 bool addUniqueRowToQueryData(QueryData& q, const Row& r) {
   if (std::find(q.begin(), q.end(), r) != q.end()) {
     return false;
@@ -471,6 +1562,11 @@ Status DatabasePlugin::call(const PluginRequest& request,
       return Status(1, "Database plugin put action requires a value");
     }
     return this->put(domain, key, request.at("value"));
+  } else if (request.at("action") == "append") {
+    if (request.count("value") == 0) {
+      return Status(1, "Database plugin append action requires a value");
+    }
+    return this->append(domain, key, request.at("value"));
   } else if (request.at("action") == "remove") {
     return this->remove(domain, key);
   } else if (request.at("action") == "scan") {
@@ -486,11 +1582,156 @@ Status DatabasePlugin::call(const PluginRequest& request,
       response.push_back({{"k", key}});
     }
     return status;
+  } else if (request.at("action") == "scan_range") {
+    if (request.count("begin") == 0 || request.count("end") == 0) {
+      return Status(1, "Database plugin scan_range requires a begin and end");
+    }
+
+    size_t max = 0;
+    if (request.count("max") > 0) {
+      max = std::stoul(request.at("max"));
+    }
+    DatabaseKeyValues pairs;
+    auto status = this->scanRange(
+        domain, request.at("begin"), request.at("end"), pairs, max);
+    for (const auto& pair : pairs) {
+      response.push_back({{"k", pair.first}, {"v", pair.second}});
+    }
+    return status;
+  } else if (request.at("action") == "remove_range") {
+    if (request.count("begin") == 0 || request.count("end") == 0) {
+      return Status(1, "Database plugin remove_range requires a begin and end");
+    }
+    return this->removeRange(domain, request.at("begin"), request.at("end"));
+  } else if (request.at("action") == "stats") {
+    return this->getStats(response);
   }
 
   return Status(1, "Unknown database plugin action");
 }
 
+Status DatabasePlugin::scanRange(const std::string& domain,
+                                 const std::string& begin,
+                                 const std::string& end,
+                                 DatabaseKeyValues& results,
+                                 size_t max) const {
+  // Only keys sharing the common prefix of both bounds may be in range.
+  auto length = std::min(begin.size(), end.size());
+  auto common =
+      std::mismatch(begin.begin(), begin.begin() + length, end.begin());
+  std::string prefix(begin.begin(), common.first);
+
+  std::vector<std::string> keys;
+  auto status = scan(domain, keys, prefix);
+  if (!status.ok()) {
+    return status;
+  }
+
+  std::sort(keys.begin(), keys.end());
+  for (const auto& key : keys) {
+    if (key < begin || key > end) {
+      continue;
+    }
+
+    std::string value;
+    if (get(domain, key, value).ok()) {
+      results.push_back(std::make_pair(key, std::move(value)));
+      if (max > 0 && results.size() >= max) {
+        break;
+      }
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::removeRange(const std::string& domain,
+                                   const std::string& begin,
+                                   const std::string& end) {
+  // Only keys sharing the common prefix of both bounds may be in range.
+  auto length = std::min(begin.size(), end.size());
+  auto common =
+      std::mismatch(begin.begin(), begin.begin() + length, end.begin());
+  std::string prefix(begin.begin(), common.first);
+
+  std::vector<std::string> keys;
+  auto status = scan(domain, keys, prefix);
+  if (!status.ok()) {
+    return status;
+  }
+
+  keys.erase(std::remove_if(keys.begin(),
+                            keys.end(),
+                            [&begin, &end](const std::string& key) {
+                              return key < begin || key >= end;
+                            }),
+             keys.end());
+  return removeBatch(domain, keys);
+}
+
+Status DatabasePlugin::scanValues(const std::string& domain,
+                                  const std::string& prefix,
+                                  size_t max,
+                                  const DatabaseScanCallback& callback) const {
+  std::vector<std::string> keys;
+  auto status = scan(domain, keys, prefix, max);
+  if (!status.ok()) {
+    return status;
+  }
+
+  for (const auto& key : keys) {
+    std::string value;
+    if (get(domain, key, value).ok() && !callback(key, value)) {
+      break;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::read(const std::string& domain,
+                            const std::string& key,
+                            const DatabaseReadCallback& reader) const {
+  std::string value;
+  auto status = get(domain, key, value);
+  if (!status.ok()) {
+    return status;
+  }
+  return reader(value.data(), value.size());
+}
+
+Status DatabasePlugin::multiGet(const std::string& domain,
+                                const std::vector<std::string>& keys,
+                                std::vector<std::string>& values) const {
+  values.clear();
+  values.resize(keys.size());
+  for (size_t i = 0; i < keys.size(); i++) {
+    // A missing key is left with an empty value.
+    get(domain, keys[i], values[i]);
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::putBatch(const std::string& domain,
+                                const DatabaseKeyValues& data) {
+  for (const auto& pair : data) {
+    auto status = put(domain, pair.first, pair.second);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status DatabasePlugin::removeBatch(const std::string& domain,
+                                   const std::vector<std::string>& keys) {
+  for (const auto& key : keys) {
+    auto status = remove(domain, key);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return Status(0, "OK");
+}
+
 static inline std::shared_ptr<DatabasePlugin> getDatabasePlugin() {
   if (!Registry::exists("database", Registry::getActive("database"), true)) {
     return nullptr;
@@ -503,6 +1744,7 @@ static inline std::shared_ptr<DatabasePlugin> getDatabasePlugin() {
 Status getDatabaseValue(const std::string& domain,
                         const std::string& key,
                         std::string& value) {
+  PerfTimer timer(PERF_DATABASE_GET);
   if (Registry::external()) {
     // External registries (extensions) do not have databases active.
     // It is not possible to use an extension-based database.
@@ -523,9 +1765,28 @@ Status getDatabaseValue(const std::string& domain,
   }
 }
 
+Status readDatabaseValue(const std::string& domain,
+                         const std::string& key,
+                         const DatabaseReadCallback& reader) {
+  if (Registry::external()) {
+    // Extensions receive a copy of the value through the core.
+    std::string value;
+    auto status = getDatabaseValue(domain, key, value);
+    if (!status.ok()) {
+      return status;
+    }
+    return reader(value.data(), value.size());
+  } else {
+    PerfTimer timer(PERF_DATABASE_GET);
+    auto plugin = getDatabasePlugin();
+    return plugin->read(domain, key, reader);
+  }
+}
+
 Status setDatabaseValue(const std::string& domain,
                         const std::string& key,
                         const std::string& value) {
+  PerfTimer timer(PERF_DATABASE_PUT);
   if (Registry::external()) {
     // External registries (extensions) do not have databases active.
     // It is not possible to use an extension-based database.
@@ -538,6 +1799,24 @@ Status setDatabaseValue(const std::string& domain,
   }
 }
 
+Status appendDatabaseValue(const std::string& domain,
+                           const std::string& key,
+                           const std::string& value) {
+  PerfTimer timer(PERF_DATABASE_PUT);
+  if (Registry::external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    PluginRequest request = {{"action", "append"},
+                             {"domain", domain},
+                             {"key", key},
+                             {"value", value}};
+    return Registry::call("database", request);
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->append(domain, key, value);
+  }
+}
+
 Status deleteDatabaseValue(const std::string& domain, const std::string& key) {
   if (Registry::external()) {
     // External registries (extensions) do not have databases active.
@@ -551,6 +1830,57 @@ Status deleteDatabaseValue(const std::string& domain, const std::string& key) {
   }
 }
 
+Status getDatabaseValues(const std::string& domain,
+                         const std::vector<std::string>& keys,
+                         std::vector<std::string>& values) {
+  if (Registry::external()) {
+    // Extensions route each lookup through the core.
+    values.clear();
+    values.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+      getDatabaseValue(domain, keys[i], values[i]);
+    }
+    return Status(0, "OK");
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->multiGet(domain, keys, values);
+  }
+}
+
+Status setDatabaseValues(const std::string& domain,
+                         const DatabaseKeyValues& data) {
+  if (Registry::external()) {
+    // Extensions route each value through the core, without atomicity.
+    for (const auto& pair : data) {
+      auto status = setDatabaseValue(domain, pair.first, pair.second);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    PerfTimer timer(PERF_DATABASE_PUT);
+    auto plugin = getDatabasePlugin();
+    return plugin->putBatch(domain, data);
+  }
+}
+
+Status deleteDatabaseValues(const std::string& domain,
+                            const std::vector<std::string>& keys) {
+  if (Registry::external()) {
+    for (const auto& key : keys) {
+      auto status = deleteDatabaseValue(domain, key);
+      if (!status.ok()) {
+        return status;
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->removeBatch(domain, keys);
+  }
+}
+
 Status scanDatabaseKeys(const std::string& domain,
                         std::vector<std::string>& keys,
                         size_t max) {
@@ -584,6 +1914,88 @@ Status scanDatabaseKeys(const std::string& domain,
   }
 }
 
+Status scanDatabase(const std::string& domain,
+                    const std::string& prefix,
+                    size_t max,
+                    const DatabaseScanCallback& callback) {
+  if (Registry::external()) {
+    // Extensions scan the keys then route each lookup through the core.
+    std::vector<std::string> keys;
+    auto status = scanDatabaseKeys(domain, keys, prefix, max);
+    if (!status.ok()) {
+      return status;
+    }
+
+    for (const auto& key : keys) {
+      std::string value;
+      if (getDatabaseValue(domain, key, value).ok() && !callback(key, value)) {
+        break;
+      }
+    }
+    return Status(0, "OK");
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->scanValues(domain, prefix, max, callback);
+  }
+}
+
+Status scanDatabaseRange(const std::string& domain,
+                         const std::string& begin,
+                         const std::string& end,
+                         DatabaseKeyValues& results,
+                         size_t max) {
+  if (Registry::external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    PluginRequest request = {{"action", "scan_range"},
+                             {"domain", domain},
+                             {"begin", begin},
+                             {"end", end},
+                             {"max", std::to_string(max)}};
+    PluginResponse response;
+    auto status = Registry::call("database", request, response);
+
+    for (const auto& item : response) {
+      if (item.count("k") > 0 && item.count("v") > 0) {
+        results.push_back(std::make_pair(item.at("k"), item.at("v")));
+      }
+    }
+    return status;
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->scanRange(domain, begin, end, results, max);
+  }
+}
+
+Status deleteDatabaseRange(const std::string& domain,
+                           const std::string& begin,
+                           const std::string& end) {
+  if (Registry::external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    PluginRequest request = {{"action", "remove_range"},
+                             {"domain", domain},
+                             {"begin", begin},
+                             {"end", end}};
+    return Registry::call("database", request);
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->removeRange(domain, begin, end);
+  }
+}
+
+Status getDatabaseStats(PluginResponse& stats) {
+  if (Registry::external()) {
+    // External registries (extensions) do not have databases active.
+    // It is not possible to use an extension-based database.
+    PluginRequest request = {{"action", "stats"}};
+    return Registry::call("database", request, stats);
+  } else {
+    auto plugin = getDatabasePlugin();
+    return plugin->getStats(stats);
+  }
+}
+
 void dumpDatabase() {
   for (const auto& domain : kDomains) {
     std::vector<std::string> keys;
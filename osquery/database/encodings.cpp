@@ -0,0 +1,361 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <string>
+
+#include <osquery/database.h>
+
+#include "osquery/core/perf.h"
+
+namespace osquery {
+
+/// The name and content type of each result encoding.
+static const std::map<ResultEncoding, std::pair<std::string, std::string>>
+    kResultEncodings = {
+        {RESULT_ENCODING_JSON, {"json", "application/json"}},
+        {RESULT_ENCODING_MSGPACK, {"msgpack", "application/msgpack"}},
+        {RESULT_ENCODING_PROTOBUF, {"protobuf", "application/x-protobuf"}},
+};
+
+bool getResultEncoding(const std::string& name, ResultEncoding& encoding) {
+  for (const auto& known : kResultEncodings) {
+    if (known.second.first == name) {
+      encoding = known.first;
+      return true;
+    }
+  }
+  return false;
+}
+
+const std::string& getResultContentType(ResultEncoding encoding) {
+  auto known = kResultEncodings.find(encoding);
+  if (known == kResultEncodings.end()) {
+    known = kResultEncodings.find(RESULT_ENCODING_JSON);
+  }
+  return known->second.second;
+}
+
+/// Append a big-endian integer of a fixed width.
+static inline void writeBigEndian(uint64_t value,
+                                  size_t width,
+                                  std::string& data) {
+  for (size_t i = width; i > 0; i--) {
+    data.push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xFF));
+  }
+}
+
+/// Append a MessagePack type with a fixed, 16-bit, or 32-bit length.
+static inline void writeMsgPackHeader(size_t size,
+                                      size_t fixed_max,
+                                      uint8_t fixed,
+                                      uint8_t size16,
+                                      std::string& data) {
+  if (size <= fixed_max) {
+    data.push_back(static_cast<char>(fixed | size));
+  } else if (size <= 0xFFFF) {
+    data.push_back(static_cast<char>(size16));
+    writeBigEndian(size, 2, data);
+  } else {
+    // The 32-bit type always follows the 16-bit type.
+    data.push_back(static_cast<char>(size16 + 1));
+    writeBigEndian(size, 4, data);
+  }
+}
+
+static inline void writeMsgPackMap(size_t size, std::string& data) {
+  writeMsgPackHeader(size, 0x0F, 0x80, 0xDE, data);
+}
+
+static inline void writeMsgPackArray(size_t size, std::string& data) {
+  writeMsgPackHeader(size, 0x0F, 0x90, 0xDC, data);
+}
+
+static inline void writeMsgPackString(const std::string& value,
+                                      std::string& data) {
+  if (value.size() > 0x1F && value.size() <= 0xFF) {
+    data.push_back(static_cast<char>(0xD9));
+    data.push_back(static_cast<char>(value.size()));
+  } else {
+    writeMsgPackHeader(value.size(), 0x1F, 0xA0, 0xDA, data);
+  }
+  data.append(value);
+}
+
+static inline void writeMsgPackUInt(uint64_t value, std::string& data) {
+  if (value <= 0x7F) {
+    data.push_back(static_cast<char>(value));
+  } else if (value <= 0xFF) {
+    data.push_back(static_cast<char>(0xCC));
+    writeBigEndian(value, 1, data);
+  } else if (value <= 0xFFFF) {
+    data.push_back(static_cast<char>(0xCD));
+    writeBigEndian(value, 2, data);
+  } else if (value <= 0xFFFFFFFF) {
+    data.push_back(static_cast<char>(0xCE));
+    writeBigEndian(value, 4, data);
+  } else {
+    data.push_back(static_cast<char>(0xCF));
+    writeBigEndian(value, 8, data);
+  }
+}
+
+static inline void writeMsgPackStrings(
+    const std::map<std::string, std::string>& values, std::string& data) {
+  writeMsgPackMap(values.size(), data);
+  for (const auto& value : values) {
+    writeMsgPackString(value.first, data);
+    writeMsgPackString(value.second, data);
+  }
+}
+
+static inline void writeMsgPackQueryData(const QueryData& rows,
+                                         std::string& data) {
+  writeMsgPackArray(rows.size(), data);
+  for (const auto& row : rows) {
+    writeMsgPackStrings(row, data);
+  }
+}
+
+static void writeMsgPackDiffResults(const DiffResults& d, std::string& data) {
+  writeMsgPackMap((d.updated.empty()) ? 2 : 3, data);
+  writeMsgPackString("added", data);
+  writeMsgPackQueryData(d.added, data);
+  writeMsgPackString("removed", data);
+  writeMsgPackQueryData(d.removed, data);
+  if (!d.updated.empty()) {
+    writeMsgPackString("updated", data);
+    writeMsgPackQueryData(d.updated, data);
+  }
+}
+
+Status serializeDiffResultsMsgPack(const DiffResults& d, std::string& data) {
+  data.clear();
+  writeMsgPackDiffResults(d, data);
+  return Status(0, "OK");
+}
+
+Status serializeQueryLogItemMsgPack(const QueryLogItem& item,
+                                    std::string& data) {
+  PerfTimer timer(PERF_SERIALIZE);
+  data.clear();
+  bool diff = !item.results.empty();
+  size_t members = (diff) ? 5 : 6;
+  if (!item.decorations.empty()) {
+    members++;
+  }
+
+  writeMsgPackMap(members, data);
+  if (diff) {
+    writeMsgPackString("diffResults", data);
+    writeMsgPackDiffResults(item.results, data);
+  } else {
+    writeMsgPackString("snapshot", data);
+    writeMsgPackQueryData(item.snapshot_results, data);
+    writeMsgPackString("action", data);
+    writeMsgPackString("snapshot", data);
+  }
+
+  writeMsgPackString("name", data);
+  writeMsgPackString(item.name, data);
+  writeMsgPackString("hostIdentifier", data);
+  writeMsgPackString(item.identifier, data);
+  writeMsgPackString("calendarTime", data);
+  writeMsgPackString(item.calendar_time, data);
+  writeMsgPackString("unixTime", data);
+  writeMsgPackUInt(item.time, data);
+  if (!item.decorations.empty()) {
+    writeMsgPackString("decorations", data);
+    writeMsgPackStrings(item.decorations, data);
+  }
+  return Status(0, "OK");
+}
+
+/// Protobuf wire types.
+enum ProtobufWireType {
+  PROTOBUF_VARINT = 0,
+  PROTOBUF_LENGTH_DELIMITED = 2,
+};
+
+static inline size_t getVarintSize(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+static inline void writeVarint(uint64_t value, std::string& data) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<char>((value & 0x7F) | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<char>(value));
+}
+
+/// Append a field's tag, all fields used here have numbers below 16.
+static inline void writeTag(size_t field,
+                            ProtobufWireType type,
+                            std::string& data) {
+  data.push_back(static_cast<char>((field << 3) | type));
+}
+
+/// The size of a length-delimited field with a payload size.
+static inline size_t getFieldSize(size_t size) {
+  return 1 + getVarintSize(size) + size;
+}
+
+static inline void writeBytes(size_t field,
+                              const std::string& value,
+                              std::string& data) {
+  writeTag(field, PROTOBUF_LENGTH_DELIMITED, data);
+  writeVarint(value.size(), data);
+  data.append(value);
+}
+
+/// The size of a map entry message, the key is field 1 and the value 2.
+static inline size_t getEntrySize(const std::string& key,
+                                  const std::string& value) {
+  return getFieldSize(key.size()) + getFieldSize(value.size());
+}
+
+static inline size_t getMapSize(
+    const std::map<std::string, std::string>& values) {
+  size_t size = 0;
+  for (const auto& value : values) {
+    size += getFieldSize(getEntrySize(value.first, value.second));
+  }
+  return size;
+}
+
+static inline void writeMap(size_t field,
+                            const std::map<std::string, std::string>& values,
+                            std::string& data) {
+  for (const auto& value : values) {
+    writeTag(field, PROTOBUF_LENGTH_DELIMITED, data);
+    writeVarint(getEntrySize(value.first, value.second), data);
+    writeBytes(1, value.first, data);
+    writeBytes(2, value.second, data);
+  }
+}
+
+/// The size of repeated Row messages.
+static inline size_t getRowsSize(const QueryData& rows) {
+  size_t size = 0;
+  for (const auto& row : rows) {
+    size += getFieldSize(getMapSize(row));
+  }
+  return size;
+}
+
+/// Append repeated Row messages, each Row's columns are field 1.
+static inline void writeRows(size_t field,
+                             const QueryData& rows,
+                             std::string& data) {
+  for (const auto& row : rows) {
+    writeTag(field, PROTOBUF_LENGTH_DELIMITED, data);
+    writeVarint(getMapSize(row), data);
+    writeMap(1, row, data);
+  }
+}
+
+static inline size_t getDiffResultsSize(const DiffResults& d) {
+  return getRowsSize(d.added) + getRowsSize(d.removed) +
+         getRowsSize(d.updated);
+}
+
+static inline void writeDiffResults(const DiffResults& d, std::string& data) {
+  writeRows(1, d.added, data);
+  writeRows(2, d.removed, data);
+  writeRows(3, d.updated, data);
+}
+
+Status serializeDiffResultsProtobuf(const DiffResults& d, std::string& data) {
+  data.clear();
+  data.reserve(getDiffResultsSize(d));
+  writeDiffResults(d, data);
+  return Status(0, "OK");
+}
+
+Status serializeQueryLogItemProtobuf(const QueryLogItem& item,
+                                     std::string& data) {
+  PerfTimer timer(PERF_SERIALIZE);
+  data.clear();
+  writeBytes(1, item.name, data);
+  writeBytes(2, item.identifier, data);
+  writeBytes(3, item.calendar_time, data);
+  writeTag(4, PROTOBUF_VARINT, data);
+  writeVarint(item.time, data);
+  writeMap(5, item.decorations, data);
+
+  if (!item.results.empty()) {
+    auto size = getDiffResultsSize(item.results);
+    data.reserve(data.size() + getFieldSize(size));
+    writeTag(6, PROTOBUF_LENGTH_DELIMITED, data);
+    writeVarint(size, data);
+    writeDiffResults(item.results, data);
+  } else {
+    data.reserve(data.size() + getRowsSize(item.snapshot_results) + 10);
+    writeRows(7, item.snapshot_results, data);
+    writeBytes(8, "snapshot", data);
+  }
+  return Status(0, "OK");
+}
+
+Status serializeResultBatch(ResultEncoding encoding,
+                            const std::map<std::string, std::string>& fields,
+                            const std::vector<std::string>& items,
+                            std::string& data) {
+  data.clear();
+  size_t size = 0;
+  for (const auto& item : items) {
+    size += getFieldSize(item.size());
+  }
+  data.reserve(size + getMapSize(fields) + 16);
+
+  if (encoding == RESULT_ENCODING_MSGPACK) {
+    writeMsgPackMap(fields.size() + 1, data);
+    for (const auto& field : fields) {
+      writeMsgPackString(field.first, data);
+      writeMsgPackString(field.second, data);
+    }
+    writeMsgPackString("data", data);
+    writeMsgPackArray(items.size(), data);
+    for (const auto& item : items) {
+      data.append(item);
+    }
+    return Status(0, "OK");
+  } else if (encoding == RESULT_ENCODING_PROTOBUF) {
+    writeMap(1, fields, data);
+    for (const auto& item : items) {
+      writeBytes(2, item, data);
+    }
+    return Status(0, "OK");
+  }
+  return serializeResultBatchJSON(fields, items, data);
+}
+
+Status serializeQueryLogItemAs(const QueryLogItem& item,
+                               ResultEncoding encoding,
+                               std::string& data) {
+  if (encoding == RESULT_ENCODING_MSGPACK) {
+    return serializeQueryLogItemMsgPack(item, data);
+  } else if (encoding == RESULT_ENCODING_PROTOBUF) {
+    return serializeQueryLogItemProtobuf(item, data);
+  }
+
+  auto status = serializeQueryLogItemJSON(item, data);
+  if (status.ok() && !data.empty() && data.back() == '\n') {
+    data.pop_back();
+  }
+  return status;
+}
+}
@@ -8,6 +8,8 @@
  *
  */
 
+#include <list>
+
 #include <osquery/database.h>
 #include <osquery/logger.h>
 
@@ -16,8 +18,42 @@ namespace osquery {
 DECLARE_string(database_path);
 DECLARE_bool(database_in_memory);
 
+FLAG(uint64,
+     ephemeral_events_bytes_max,
+     64 * 1024 * 1024,
+     "Bytes of in-memory event storage before the oldest are evicted");
+
+FLAG(uint64,
+     ephemeral_logs_bytes_max,
+     16 * 1024 * 1024,
+     "Bytes of in-memory buffered logs before the oldest are evicted");
+
 class EphemeralDatabasePlugin : public DatabasePlugin {
-  using DBType = std::map<std::string, std::map<std::string, std::string> >;
+  /// A stored value and its position in the domain's recently used list.
+  struct Entry {
+    std::string value;
+    std::list<std::string>::iterator recent;
+  };
+
+  /// The keys of a domain, and the memory accounting of the keys.
+  struct Domain {
+    /// The ordered keys and values.
+    std::map<std::string, Entry> data;
+
+    /// Keys ordered from least to most recently used.
+    std::list<std::string> recent;
+
+    /// The bytes of keys and values stored.
+    size_t bytes{0};
+
+    /// The number of keys evicted to remain within the domain budget.
+    size_t evicted{0};
+
+    /// The bytes of keys and values evicted.
+    size_t evicted_bytes{0};
+  };
+
+  using DBType = std::map<std::string, Domain>;
 
  public:
   /// Data retrieval method.
@@ -30,50 +66,242 @@ class EphemeralDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              const std::string& value) override;
 
+  /// Data append method.
+  Status append(const std::string& domain,
+                const std::string& key,
+                const std::string& value) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
+  /// Multiple key retrieval method, within a single lock hold.
+  Status multiGet(const std::string& domain,
+                  const std::vector<std::string>& keys,
+                  std::vector<std::string>& values) const override;
+
+  /// Multiple key storage method, within a single lock hold.
+  Status putBatch(const std::string& domain,
+                  const DatabaseKeyValues& data) override;
+
+  /// Multiple key removal method, within a single lock hold.
+  Status removeBatch(const std::string& domain,
+                     const std::vector<std::string>& keys) override;
+
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Key and value prefix lookup method.
+  Status scanValues(const std::string& domain,
+                    const std::string& prefix,
+                    size_t max,
+                    const DatabaseScanCallback& callback) const override;
+
+  /// Ordered key and value range lookup method.
+  Status scanRange(const std::string& domain,
+                   const std::string& begin,
+                   const std::string& end,
+                   DatabaseKeyValues& results,
+                   size_t max = 0) const override;
+
+  /// Ordered key range removal method.
+  Status removeRange(const std::string& domain,
+                     const std::string& begin,
+                     const std::string& end) override;
+
+  /// Report the bytes stored and evicted for each domain.
+  Status getStats(PluginResponse& stats) const override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override {
+    WriteLock lock(mutex_);
     DBType().swap(db_);
     return Status(0);
   }
 
  private:
-  DBType db_;
+  /// The byte budget of a domain, 0 if the domain is not bounded.
+  static size_t getBudget(const std::string& domain);
+
+  /// Mark a key as the most recently used. REQUIRES the lock.
+  void touch(Domain& domain, Entry& entry) const;
+
+  /// Replace or insert a value, accounting bytes. REQUIRES the lock.
+  void store(Domain& domain, const std::string& key, const std::string& value);
+
+  /// Remove a key, accounting bytes. REQUIRES the lock.
+  void erase(Domain& domain, std::map<std::string, Entry>::iterator it);
+
+  /// Evict the least recently used keys beyond the budget. REQUIRES the lock.
+  void evict(const std::string& name, Domain& domain);
+
+ private:
+  /// Reads update the recently used order, so the database is mutable.
+  mutable DBType db_;
+
+  /// Batches are applied while holding the lock, readers see all or none.
+  mutable Mutex mutex_;
 };
 
 /// Backing-storage provider for osquery internal/core.
 REGISTER_INTERNAL(EphemeralDatabasePlugin, "database", "ephemeral");
 
+size_t EphemeralDatabasePlugin::getBudget(const std::string& domain) {
+  if (domain == kEvents) {
+    return FLAGS_ephemeral_events_bytes_max;
+  } else if (domain == kLogs) {
+    return FLAGS_ephemeral_logs_bytes_max;
+  }
+  return 0;
+}
+
+void EphemeralDatabasePlugin::touch(Domain& domain, Entry& entry) const {
+  domain.recent.splice(domain.recent.end(), domain.recent, entry.recent);
+}
+
+void EphemeralDatabasePlugin::store(Domain& domain,
+                                    const std::string& key,
+                                    const std::string& value) {
+  auto it = domain.data.find(key);
+  if (it == domain.data.end()) {
+    auto& entry = domain.data[key];
+    entry.recent = domain.recent.insert(domain.recent.end(), key);
+    entry.value = value;
+    domain.bytes += key.size() + value.size();
+    return;
+  }
+
+  domain.bytes -= it->second.value.size();
+  domain.bytes += value.size();
+  it->second.value = value;
+  touch(domain, it->second);
+}
+
+void EphemeralDatabasePlugin::erase(
+    Domain& domain, std::map<std::string, Entry>::iterator it) {
+  domain.bytes -= it->first.size() + it->second.value.size();
+  domain.recent.erase(it->second.recent);
+  domain.data.erase(it);
+}
+
+void EphemeralDatabasePlugin::evict(const std::string& name, Domain& domain) {
+  auto budget = getBudget(name);
+  if (budget == 0) {
+    return;
+  }
+
+  // The most recently used key is kept even if it exceeds the budget alone.
+  while (domain.bytes > budget && domain.recent.size() > 1) {
+    auto it = domain.data.find(domain.recent.front());
+    domain.evicted++;
+    domain.evicted_bytes += it->first.size() + it->second.value.size();
+    erase(domain, it);
+  }
+}
+
 Status EphemeralDatabasePlugin::get(const std::string& domain,
                                     const std::string& key,
                                     std::string& value) const {
-  if (db_.count(domain) > 0 && db_.at(domain).count(key) > 0) {
-    value = db_.at(domain).at(key);
-    return Status(0);
-  } else {
+  WriteLock lock(mutex_);
+  auto data = db_.find(domain);
+  if (data == db_.end()) {
     return Status(1);
   }
+
+  auto it = data->second.data.find(key);
+  if (it == data->second.data.end()) {
+    return Status(1);
+  }
+
+  value = it->second.value;
+  touch(data->second, it->second);
+  return Status(0);
 }
 
 Status EphemeralDatabasePlugin::put(const std::string& domain,
                                     const std::string& key,
                                     const std::string& value) {
-  db_[domain][key] = value;
+  WriteLock lock(mutex_);
+  auto& data = db_[domain];
+  store(data, key, value);
+  evict(domain, data);
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::append(const std::string& domain,
+                                       const std::string& key,
+                                       const std::string& value) {
+  WriteLock lock(mutex_);
+  auto& data = db_[domain];
+  auto it = data.data.find(key);
+  if (it == data.data.end()) {
+    store(data, key, value);
+  } else {
+    it->second.value.append(value);
+    data.bytes += value.size();
+    touch(data, it->second);
+  }
+  evict(domain, data);
   return Status(0);
 }
 
 Status EphemeralDatabasePlugin::remove(const std::string& domain,
                                        const std::string& k) {
-  db_[domain].erase(k);
+  WriteLock lock(mutex_);
+  auto& data = db_[domain];
+  auto it = data.data.find(k);
+  if (it != data.data.end()) {
+    erase(data, it);
+  }
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::multiGet(
+    const std::string& domain,
+    const std::vector<std::string>& keys,
+    std::vector<std::string>& values) const {
+  WriteLock lock(mutex_);
+  values.clear();
+  values.resize(keys.size());
+  auto data = db_.find(domain);
+  if (data == db_.end()) {
+    return Status(0);
+  }
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    auto it = data->second.data.find(keys[i]);
+    if (it != data->second.data.end()) {
+      values[i] = it->second.value;
+      touch(data->second, it->second);
+    }
+  }
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::putBatch(const std::string& domain,
+                                         const DatabaseKeyValues& data) {
+  WriteLock lock(mutex_);
+  auto& domain_data = db_[domain];
+  for (const auto& pair : data) {
+    store(domain_data, pair.first, pair.second);
+  }
+  evict(domain, domain_data);
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::removeBatch(
+    const std::string& domain, const std::vector<std::string>& keys) {
+  WriteLock lock(mutex_);
+  auto& domain_data = db_[domain];
+  for (const auto& key : keys) {
+    auto it = domain_data.data.find(key);
+    if (it != domain_data.data.end()) {
+      erase(domain_data, it);
+    }
+  }
   return Status(0);
 }
 
@@ -81,11 +309,12 @@ Status EphemeralDatabasePlugin::scan(const std::string& domain,
                                      std::vector<std::string>& results,
                                      const std::string& prefix,
                                      size_t max) const {
+  WriteLock lock(mutex_);
   if (db_.count(domain) == 0) {
     return Status(0);
   }
 
-  for (const auto& key : db_.at(domain)) {
+  for (const auto& key : db_.at(domain).data) {
     if (!prefix.empty() &&
         !(std::mismatch(prefix.begin(), prefix.end(), key.first.begin())
               .first == prefix.end())) {
@@ -98,4 +327,104 @@ Status EphemeralDatabasePlugin::scan(const std::string& domain,
   }
   return Status(0);
 }
+
+Status EphemeralDatabasePlugin::scanValues(
+    const std::string& domain,
+    const std::string& prefix,
+    size_t max,
+    const DatabaseScanCallback& callback) const {
+  // The callback may access the database, it is called without the lock.
+  DatabaseKeyValues pairs;
+  {
+    WriteLock lock(mutex_);
+    if (db_.count(domain) == 0) {
+      return Status(0);
+    }
+
+    const auto& data = db_.at(domain).data;
+    for (auto it = data.lower_bound(prefix); it != data.end(); ++it) {
+      if (it->first.compare(0, prefix.size(), prefix) != 0) {
+        break;
+      }
+      pairs.push_back(std::make_pair(it->first, it->second.value));
+      if (max > 0 && pairs.size() >= max) {
+        break;
+      }
+    }
+  }
+
+  for (const auto& pair : pairs) {
+    if (!callback(pair.first, pair.second)) {
+      break;
+    }
+  }
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::scanRange(const std::string& domain,
+                                          const std::string& begin,
+                                          const std::string& end,
+                                          DatabaseKeyValues& results,
+                                          size_t max) const {
+  WriteLock lock(mutex_);
+  if (db_.count(domain) == 0) {
+    return Status(0);
+  }
+
+  const auto& data = db_.at(domain).data;
+  for (auto it = data.lower_bound(begin); it != data.end(); ++it) {
+    if (it->first > end) {
+      break;
+    }
+    results.push_back(std::make_pair(it->first, it->second.value));
+    if (max > 0 && results.size() >= max) {
+      break;
+    }
+  }
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::removeRange(const std::string& domain,
+                                            const std::string& begin,
+                                            const std::string& end) {
+  WriteLock lock(mutex_);
+  if (db_.count(domain) == 0 || end <= begin) {
+    return Status(0);
+  }
+
+  auto& data = db_.at(domain);
+  auto it = data.data.lower_bound(begin);
+  while (it != data.data.end() && it->first < end) {
+    erase(data, it++);
+  }
+  return Status(0);
+}
+
+Status EphemeralDatabasePlugin::getStats(PluginResponse& stats) const {
+  WriteLock lock(mutex_);
+  for (const auto& domain : kDomains) {
+    auto data = db_.find(domain);
+    if (data == db_.end()) {
+      continue;
+    }
+
+    const auto& d = data->second;
+    stats.push_back({{"domain", domain},
+                     {"name", "keys"},
+                     {"value", std::to_string(d.data.size())}});
+    stats.push_back({{"domain", domain},
+                     {"name", "bytes"},
+                     {"value", std::to_string(d.bytes)}});
+    stats.push_back({{"domain", domain},
+                     {"name", "bytes_max"},
+                     {"value", std::to_string(getBudget(domain))}});
+    stats.push_back({{"domain", domain},
+                     {"name", "evicted"},
+                     {"value", std::to_string(d.evicted)}});
+    stats.push_back({{"domain", domain},
+                     {"name", "evicted_bytes"},
+                     {"value", std::to_string(d.evicted_bytes)}});
+  }
+  return Status(0, "OK");
+}
 }
@@ -8,17 +8,32 @@
  *
  */
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <thread>
 
+#include <stdlib.h>
 #include <sys/stat.h>
 
 #include <snappy.h>
 
+#include <rocksdb/cache.h>
 #include <rocksdb/db.h>
 #include <rocksdb/env.h>
+#include <rocksdb/filter_policy.h>
+#include <rocksdb/merge_operator.h>
 #include <rocksdb/options.h>
+#include <rocksdb/rate_limiter.h>
+#include <rocksdb/slice_transform.h>
+#include <rocksdb/statistics.h>
+#include <rocksdb/table.h>
+#include <rocksdb/write_batch.h>
 
 #include <osquery/database.h>
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
@@ -29,6 +44,172 @@ namespace osquery {
 DECLARE_string(database_path);
 DECLARE_bool(database_in_memory);
 
+FLAG(string,
+     database_profile,
+     "default",
+     "RocksDB tuning profile: default, low_memory, throughput, or legacy");
+
+FLAG(uint64,
+     database_cache_size,
+     8,
+     "Megabytes of RocksDB block cache shared by every domain (0 disables)");
+
+FLAG(uint64,
+     database_io_rate,
+     0,
+     "RocksDB flush and compaction megabytes per second (0 unlimited)");
+
+FLAG(uint64,
+     database_io_idle_rate,
+     0,
+     "RocksDB background megabytes per second while idle (0 unlimited)");
+
+FLAG(uint64,
+     database_idle_load,
+     25,
+     "Percent of load per CPU below which RocksDB compacts at the idle rate");
+
+/// The background write limit used for an unlimited rate, 1GB per second.
+const int64_t kRocksDBUnlimitedRate{1024 * 1024 * 1024};
+
+/// Milliseconds between checks of the system load.
+const size_t kRocksDBIdleInterval{5000};
+
+/**
+ * @brief Default column family key recording the domain to handle layout.
+ *
+ * Databases written before the key existed looked up each domain with the
+ * handle of the previous column family (the first domain used the default).
+ */
+const std::string kRocksDBLayoutKey{"column_family_layout"};
+const std::string kRocksDBLayoutVersion{"1"};
+
+/**
+ * @brief The largest write batch used to move a legacy domain.
+ *
+ * A move that is interrupted keeps each completed batch. The layout key with
+ * a "." and the domain name marks a domain whose move completed.
+ */
+const size_t kRocksDBLayoutBatchBytes{4 * 1024 * 1024};
+
+/// The current background write limit in bytes per second, 0 if not limited.
+static std::atomic<int64_t> kRocksDBIORate{0};
+
+/// Set while the system is idle and the idle rate applies.
+static std::atomic<bool> kRocksDBIdle{false};
+
+/// Memtable and background work settings chosen by a tuning profile.
+struct RocksDBProfile {
+  /// The memtable size of the events domain, which receives most writes.
+  size_t events_write_buffer_size;
+
+  /// The memtable size of the other domains.
+  size_t write_buffer_size;
+
+  /// The number of memtables, including those waiting for a flush.
+  int max_write_buffer_number;
+
+  /// The number of background compaction and flush threads.
+  int max_background_jobs;
+
+  /// Use the block cache, bloom filters, and compression.
+  bool tuned;
+};
+
+const std::map<std::string, RocksDBProfile> kRocksDBProfiles = {
+    {"default", {4 * 1024 * 1024, 1024 * 1024, 2, 2, true}},
+    {"low_memory", {1024 * 1024, 256 * 1024, 2, 1, true}},
+    {"throughput", {16 * 1024 * 1024, 4 * 1024 * 1024, 4, 4, true}},
+    // The settings used before profiles were introduced.
+    {"legacy", {(4 * 1024) * 100, (4 * 1024) * 100, 3, 2, false}},
+};
+
+/// RocksDB statistics tickers reported as database stats.
+const std::vector<std::pair<rocksdb::Tickers, std::string>> kRocksDBTickers = {
+    {rocksdb::BLOCK_CACHE_HIT, "block_cache_hit"},
+    {rocksdb::BLOCK_CACHE_MISS, "block_cache_miss"},
+    {rocksdb::BLOOM_FILTER_USEFUL, "bloom_filter_useful"},
+    {rocksdb::NUMBER_KEYS_WRITTEN, "keys_written"},
+    {rocksdb::NUMBER_KEYS_READ, "keys_read"},
+    {rocksdb::BYTES_WRITTEN, "bytes_written"},
+    {rocksdb::BYTES_READ, "bytes_read"},
+    {rocksdb::COMPACT_READ_BYTES, "compact_read_bytes"},
+    {rocksdb::COMPACT_WRITE_BYTES, "compact_write_bytes"},
+    {rocksdb::STALL_MICROS, "stall_micros"},
+};
+
+/// RocksDB database properties reported as database stats.
+const std::vector<std::string> kRocksDBDatabaseProperties = {
+    "num-running-compactions",
+    "num-running-flushes",
+    "actual-delayed-write-rate",
+    "is-write-stopped",
+};
+
+/// RocksDB column family properties reported as database stats per domain.
+const std::vector<std::string> kRocksDBProperties = {
+    "estimate-num-keys",
+    "estimate-live-data-size",
+    "cur-size-all-mem-tables",
+    "estimate-table-readers-mem",
+    "compaction-pending",
+    "estimate-pending-compaction-bytes",
+    "num-files-at-level0",
+};
+
+/// The background write limit in bytes per second while busy or idle.
+static int64_t getIORate(bool idle) {
+  auto rate = (idle) ? FLAGS_database_io_idle_rate : FLAGS_database_io_rate;
+  if (rate == 0) {
+    return kRocksDBUnlimitedRate;
+  }
+  return std::min(static_cast<int64_t>(rate * 1024 * 1024),
+                  kRocksDBUnlimitedRate);
+}
+
+/// Check if the recent load per CPU is below --database_idle_load.
+static bool isSystemIdle() {
+#ifndef WIN32
+  static const auto cpus = std::max(1U, std::thread::hardware_concurrency());
+  double load = 0;
+  if (getloadavg(&load, 1) != 1) {
+    return false;
+  }
+  return (load * 100 / cpus) < FLAGS_database_idle_load;
+#else
+  return false;
+#endif
+}
+
+/**
+ * @brief Move RocksDB background writes to idle periods.
+ *
+ * Flushes and compactions share a rate limiter. While the system is busy
+ * they are limited to --database_io_rate, after bursts of events the work
+ * is deferred until the load drops and the --database_io_idle_rate applies.
+ */
+class RocksDBIdleRunner : public InternalRunnable {
+ public:
+  explicit RocksDBIdleRunner(std::shared_ptr<rocksdb::RateLimiter> limiter)
+      : limiter_(std::move(limiter)) {}
+
+  /// The Dispatcher thread entry point.
+  void start() override {
+    while (!interrupted()) {
+      auto idle = isSystemIdle();
+      if (idle != kRocksDBIdle) {
+        kRocksDBIdle = idle;
+        kRocksDBIORate = getIORate(idle);
+        limiter_->SetBytesPerSecond(kRocksDBIORate);
+      }
+      pauseMilli(kRocksDBIdleInterval);
+    }
+  }
+
+ private:
+  std::shared_ptr<rocksdb::RateLimiter> limiter_;
+};
+
 class GlogRocksDBLogger : public rocksdb::Logger {
  public:
   // We intend to override a virtual method that is overloaded.
@@ -36,6 +217,58 @@ class GlogRocksDBLogger : public rocksdb::Logger {
   void Logv(const char* format, va_list ap) override;
 };
 
+/// Concatenate merge operands, used by DatabasePlugin::append.
+class AppendMergeOperator : public rocksdb::AssociativeMergeOperator {
+ public:
+  bool Merge(const rocksdb::Slice& key,
+             const rocksdb::Slice* existing_value,
+             const rocksdb::Slice& value,
+             std::string* new_value,
+             rocksdb::Logger* logger) const override;
+
+  const char* Name() const override {
+    return "osquery.AppendMergeOperator";
+  }
+};
+
+/**
+ * @brief Use an event namespace as a key prefix.
+ *
+ * Event keys begin with a type and the publisher and subscriber namespace,
+ * such as "data.inotify.file_events.". Prefix bloom filters skip tables that
+ * do not contain keys for a subscriber.
+ */
+class EventKeyPrefixTransform : public rocksdb::SliceTransform {
+ public:
+  const char* Name() const override {
+    return "osquery.EventKeyPrefixTransform";
+  }
+
+  rocksdb::Slice Transform(const rocksdb::Slice& key) const override {
+    return rocksdb::Slice(key.data(), getPrefixSize(key));
+  }
+
+  bool InDomain(const rocksdb::Slice& key) const override {
+    return getPrefixSize(key) > 0;
+  }
+
+  bool InRange(const rocksdb::Slice& dst) const override {
+    return getPrefixSize(dst) == dst.size() && dst.size() > 0;
+  }
+
+ private:
+  /// The size of the key up to and including the third '.', or 0.
+  static size_t getPrefixSize(const rocksdb::Slice& key) {
+    size_t separators = 0;
+    for (size_t i = 0; i < key.size(); i++) {
+      if (key[i] == '.' && ++separators == 3) {
+        return i + 1;
+      }
+    }
+    return 0;
+  }
+};
+
 class RocksDBDatabasePlugin : public DatabasePlugin {
  public:
   /// Data retrieval method.
@@ -43,20 +276,64 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
              const std::string& key,
              std::string& value) const override;
 
+  /// In-place retrieval method, reading from an iterator's pinned block.
+  Status read(const std::string& domain,
+              const std::string& key,
+              const DatabaseReadCallback& reader) const override;
+
   /// Data storage method.
   Status put(const std::string& domain,
              const std::string& key,
              const std::string& value) override;
 
+  /// Data append method, using a merge operand.
+  Status append(const std::string& domain,
+                const std::string& key,
+                const std::string& value) override;
+
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
+  /// Multiple key retrieval method, using a single MultiGet.
+  Status multiGet(const std::string& domain,
+                  const std::vector<std::string>& keys,
+                  std::vector<std::string>& values) const override;
+
+  /// Multiple key storage method, using a single write batch.
+  Status putBatch(const std::string& domain,
+                  const DatabaseKeyValues& data) override;
+
+  /// Multiple key removal method, using a single write batch.
+  Status removeBatch(const std::string& domain,
+                     const std::vector<std::string>& keys) override;
+
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Key and value prefix lookup method, using an iterator seek.
+  Status scanValues(const std::string& domain,
+                    const std::string& prefix,
+                    size_t max,
+                    const DatabaseScanCallback& callback) const override;
+
+  /// Ordered key and value range lookup method, using an iterator seek.
+  Status scanRange(const std::string& domain,
+                   const std::string& begin,
+                   const std::string& end,
+                   DatabaseKeyValues& results,
+                   size_t max = 0) const override;
+
+  /// Ordered key range removal method, using a single write batch.
+  Status removeRange(const std::string& domain,
+                     const std::string& begin,
+                     const std::string& end) override;
+
+  /// Report the profile, statistics tickers, and domain properties.
+  Status getStats(PluginResponse& stats) const override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override;
@@ -90,6 +367,13 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
    */
   rocksdb::DB* getDB() const;
 
+  /// Apply the table, compression, and memtable settings for a domain.
+  rocksdb::ColumnFamilyOptions getDomainOptions(
+      const std::string& domain, const RocksDBProfile& profile) const;
+
+  /// Move the domains of a database written with the legacy handle layout.
+  Status migrateLayout();
+
  private:
   bool initialized_{false};
 
@@ -108,6 +392,24 @@ class RocksDBDatabasePlugin : public DatabasePlugin {
   /// The RocksDB connection options that are used to connect to RocksDB
   rocksdb::Options options_;
 
+  /// The block cache shared by every domain.
+  std::shared_ptr<rocksdb::Cache> cache_{nullptr};
+
+  /// The flush and compaction rate limiter, if --database_io_rate is set.
+  std::shared_ptr<rocksdb::RateLimiter> rate_limiter_{nullptr};
+
+  /// The name of the tuning profile applied at setUp.
+  std::string profile_;
+
+  /**
+   * @brief The handle of kDomains[i] is handles_[i + handle_offsets_[i]].
+   *
+   * The default column family is the first handle. A read-only open of a
+   * database that was not migrated keeps the legacy layout, offset 0, for
+   * each domain that was not moved.
+   */
+  std::vector<size_t> handle_offsets_;
+
   /// Deconstruction mutex.
   std::mutex close_mutex_;
 };
@@ -135,6 +437,20 @@ void GlogRocksDBLogger::Logv(const char* format, va_list ap) {
   }
 }
 
+bool AppendMergeOperator::Merge(const rocksdb::Slice& key,
+                                const rocksdb::Slice* existing_value,
+                                const rocksdb::Slice& value,
+                                std::string* new_value,
+                                rocksdb::Logger* logger) const {
+  new_value->clear();
+  if (existing_value != nullptr) {
+    new_value->reserve(existing_value->size() + value.size());
+    new_value->assign(existing_value->data(), existing_value->size());
+  }
+  new_value->append(value.data(), value.size());
+  return true;
+}
+
 Status RocksDBDatabasePlugin::setUp() {
   if (!kDBHandleOptionAllowOpen) {
     LOG(WARNING) << RLOG(1629) << "Not allowed to create DBHandle instance";
@@ -151,15 +467,41 @@ Status RocksDBDatabasePlugin::setUp() {
     options_.max_log_file_size = 1024 * 1024 * 1;
     options_.stats_dump_period_sec = 0;
 
+    auto profile = kRocksDBProfiles.find(FLAGS_database_profile);
+    if (profile == kRocksDBProfiles.end()) {
+      LOG(WARNING) << "Unknown RocksDB profile: " << FLAGS_database_profile;
+      profile = kRocksDBProfiles.find("default");
+    }
+    profile_ = profile->first;
+
     // Performance and optimization settings.
     options_.compression = rocksdb::kNoCompression;
     options_.compaction_style = rocksdb::kCompactionStyleLevel;
-    options_.arena_block_size = (4 * 1024);
-    options_.write_buffer_size = (4 * 1024) * 100; // 100 blocks.
-    options_.max_write_buffer_number = 3;
+    options_.write_buffer_size = profile->second.write_buffer_size;
+    options_.max_write_buffer_number = profile->second.max_write_buffer_number;
     options_.min_write_buffer_number_to_merge = 1;
-    options_.max_background_compactions = 2;
-    options_.max_background_flushes = 2;
+    options_.max_background_compactions = profile->second.max_background_jobs;
+    options_.max_background_flushes = profile->second.max_background_jobs;
+    if (!profile->second.tuned) {
+      options_.arena_block_size = (4 * 1024);
+    } else if (FLAGS_database_cache_size > 0) {
+      cache_ = rocksdb::NewLRUCache(FLAGS_database_cache_size * 1024 * 1024);
+    }
+    options_.statistics = rocksdb::CreateDBStatistics();
+
+    if (FLAGS_database_io_rate > 0) {
+      // Flushes and compactions share the limit, foreground writes do not.
+      kRocksDBIORate = getIORate(false);
+      rate_limiter_.reset(rocksdb::NewGenericRateLimiter(kRocksDBIORate));
+      options_.rate_limiter = rate_limiter_;
+      // Write table files in small increments instead of one burst.
+      options_.bytes_per_sync = 1024 * 1024;
+      Dispatcher::addService(
+          std::make_shared<RocksDBIdleRunner>(rate_limiter_));
+    }
+
+    // Allow append-only values to be written without a read.
+    options_.merge_operator = std::make_shared<AppendMergeOperator>();
 
     // Create an environment to replace the default logger.
     if (logger_ == nullptr) {
@@ -171,8 +513,8 @@ Status RocksDBDatabasePlugin::setUp() {
         rocksdb::kDefaultColumnFamilyName, options_));
 
     for (const auto& cf_name : kDomains) {
-      column_families_.push_back(
-          rocksdb::ColumnFamilyDescriptor(cf_name, options_));
+      column_families_.push_back(rocksdb::ColumnFamilyDescriptor(
+          cf_name, getDomainOptions(cf_name, profile->second)));
     }
   }
 
@@ -223,7 +565,109 @@ Status RocksDBDatabasePlugin::setUp() {
   if (!read_only_ && platformChmod(path_, S_IRWXU) == false) {
     return Status(1, "Cannot set permissions on RocksDB path: " + path_);
   }
-  return Status(0);
+  return migrateLayout();
+}
+
+Status RocksDBDatabasePlugin::migrateLayout() {
+  handle_offsets_.assign(kDomains.size(), 1);
+  if (db_ == nullptr || handles_.size() != kDomains.size() + 1) {
+    return Status(0);
+  }
+
+  std::string version;
+  auto s = db_->Get(
+      rocksdb::ReadOptions(), handles_[0], kRocksDBLayoutKey, &version);
+  if (s.ok() && version == kRocksDBLayoutVersion) {
+    return Status(0);
+  }
+
+  // A domain is moved once its marker exists, even if the layout key does not.
+  std::vector<bool> moved(kDomains.size(), false);
+  for (size_t i = 0; i < kDomains.size(); i++) {
+    s = db_->Get(rocksdb::ReadOptions(),
+                 handles_[0],
+                 kRocksDBLayoutKey + "." + kDomains[i],
+                 &version);
+    moved[i] = (s.ok() && version == kRocksDBLayoutVersion);
+  }
+
+  if (read_only_) {
+    // The legacy layout can still be read, the move happens on a R/W open.
+    for (size_t i = 0; i < kDomains.size(); i++) {
+      handle_offsets_[i] = (moved[i]) ? 1 : 0;
+    }
+    return Status(0);
+  }
+
+  // The content of kDomains[i] is within handles_[i]. The last column family
+  // was never written, so moving from the last domain to the first never
+  // overwrites content that has not moved yet.
+  auto read_options = rocksdb::ReadOptions();
+  read_options.fill_cache = false;
+  read_options.total_order_seek = true;
+  auto write_options = rocksdb::WriteOptions();
+  write_options.sync = true;
+  for (size_t i = kDomains.size(); i > 0; i--) {
+    const auto& domain = kDomains[i - 1];
+    if (moved[i - 1]) {
+      // A previous open moved this domain before it was interrupted.
+      continue;
+    }
+
+    auto source = handles_[i - 1];
+    auto target = handles_[i];
+    std::unique_ptr<rocksdb::Iterator> it(
+        db_->NewIterator(read_options, source));
+    if (it == nullptr) {
+      return Status(1, "Could not get iterator for " + domain);
+    }
+
+    // Each key is copied and deleted in the same batch, so an interrupted
+    // move resumes with the keys that are still in the source.
+    rocksdb::WriteBatch batch;
+    bool logged = false;
+    for (it->SeekToFirst(); it->Valid(); it->Next()) {
+      if (!logged) {
+        LOG(INFO) << "Moving RocksDB domain " << domain << " to its "
+                  << "column family";
+        logged = true;
+      }
+
+      batch.Put(target, it->key(), it->value());
+      batch.Delete(source, it->key());
+      if (batch.GetDataSize() < kRocksDBLayoutBatchBytes) {
+        continue;
+      }
+
+      s = db_->Write(write_options, &batch);
+      if (!s.ok()) {
+        return Status(1, "Cannot move RocksDB domain: " + s.ToString());
+      }
+      batch.Clear();
+    }
+
+    if (!it->status().ok()) {
+      return Status(1,
+                    "Cannot read RocksDB domain: " + it->status().ToString());
+    }
+
+    // The marker is written with the last keys of the domain.
+    batch.Put(
+        handles_[0], kRocksDBLayoutKey + "." + domain, kRocksDBLayoutVersion);
+    s = db_->Write(write_options, &batch);
+    if (!s.ok()) {
+      return Status(1, "Cannot move RocksDB domain: " + s.ToString());
+    }
+  }
+
+  // The layout key replaces the domain markers.
+  rocksdb::WriteBatch batch;
+  for (const auto& domain : kDomains) {
+    batch.Delete(handles_[0], kRocksDBLayoutKey + "." + domain);
+  }
+  batch.Put(handles_[0], kRocksDBLayoutKey, kRocksDBLayoutVersion);
+  s = db_->Write(write_options, &batch);
+  return Status(s.code(), s.ToString());
 }
 
 void RocksDBDatabasePlugin::close() {
@@ -243,12 +687,40 @@ rocksdb::DB* RocksDBDatabasePlugin::getDB() const {
   return db_;
 }
 
+rocksdb::ColumnFamilyOptions RocksDBDatabasePlugin::getDomainOptions(
+    const std::string& domain, const RocksDBProfile& profile) const {
+  rocksdb::ColumnFamilyOptions options(options_);
+  if (!profile.tuned) {
+    return options;
+  }
+
+  rocksdb::BlockBasedTableOptions table_options;
+  if (cache_ != nullptr) {
+    table_options.block_cache = cache_;
+  } else {
+    table_options.no_block_cache = true;
+  }
+  table_options.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, false));
+  options.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_options));
+
+  if (domain == kEvents) {
+    // Events are written in bursts and most lookups are within a namespace.
+    options.write_buffer_size = profile.events_write_buffer_size;
+    options.prefix_extractor = std::make_shared<EventKeyPrefixTransform>();
+  } else if (domain == kQueries) {
+    // Query snapshots are large JSON values that compress well.
+    options.compression = rocksdb::kLZ4Compression;
+  }
+  return options;
+}
+
 rocksdb::ColumnFamilyHandle* RocksDBDatabasePlugin::getHandleForColumnFamily(
     const std::string& cf) const {
   try {
     for (size_t i = 0; i < kDomains.size(); i++) {
       if (kDomains[i] == cf) {
-        return handles_[i];
+        return handles_.at(i + handle_offsets_.at(i));
       }
     }
   } catch (const std::exception& /* e */) {
@@ -271,6 +743,41 @@ Status RocksDBDatabasePlugin::get(const std::string& domain,
   return Status(s.code(), s.ToString());
 }
 
+Status RocksDBDatabasePlugin::read(const std::string& domain,
+                                   const std::string& key,
+                                   const DatabaseReadCallback& reader) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  // A positioned iterator keeps the memtable or block holding the value
+  // alive, the value slice is handed to the reader without a copy.
+  auto options = rocksdb::ReadOptions();
+  options.verify_checksums = false;
+  options.total_order_seek = true;
+  auto it = getDB()->NewIterator(options, cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+
+  Status status;
+  it->Seek(key);
+  if (it->Valid() && it->key() == rocksdb::Slice(key)) {
+    auto value = it->value();
+    status = reader(value.data(), value.size());
+  } else {
+    auto s = (it->status().ok()) ? rocksdb::Status::NotFound() : it->status();
+    status = Status(s.code(), s.ToString());
+  }
+  delete it;
+  return status;
+}
+
 Status RocksDBDatabasePlugin::put(const std::string& domain,
                                   const std::string& key,
                                   const std::string& value) {
@@ -301,6 +808,27 @@ Status RocksDBDatabasePlugin::put(const std::string& domain,
   return Status(s.code(), s.ToString());
 }
 
+Status RocksDBDatabasePlugin::append(const std::string& domain,
+                                     const std::string& key,
+                                     const std::string& value) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  auto options = rocksdb::WriteOptions();
+  // Events should be fast, and do not need to force syncs.
+  if (kEvents != domain) {
+    options.sync = true;
+  }
+  auto s = getDB()->Merge(options, cfh, key, value);
+  return Status(s.code(), s.ToString());
+}
+
 Status RocksDBDatabasePlugin::remove(const std::string& domain,
                                      const std::string& key) {
   if (read_only_) {
@@ -322,6 +850,91 @@ Status RocksDBDatabasePlugin::remove(const std::string& domain,
   return Status(s.code(), s.ToString());
 }
 
+Status RocksDBDatabasePlugin::multiGet(const std::string& domain,
+                                       const std::vector<std::string>& keys,
+                                       std::vector<std::string>& values) const {
+  values.clear();
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  std::vector<rocksdb::Slice> slices(keys.begin(), keys.end());
+  std::vector<rocksdb::ColumnFamilyHandle*> handles(keys.size(), cfh);
+  auto statuses =
+      getDB()->MultiGet(rocksdb::ReadOptions(), handles, slices, &values);
+  values.resize(keys.size());
+  for (size_t i = 0; i < statuses.size(); i++) {
+    if (statuses[i].IsNotFound()) {
+      values[i].clear();
+    } else if (!statuses[i].ok()) {
+      return Status(statuses[i].code(), statuses[i].ToString());
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::putBatch(const std::string& domain,
+                                       const DatabaseKeyValues& data) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  rocksdb::WriteBatch batch;
+  for (const auto& pair : data) {
+    batch.Put(cfh, pair.first, pair.second);
+  }
+
+  if (batch.Count() == 0) {
+    return Status(0, "OK");
+  }
+
+  // The batch is applied, and synced, as a single write.
+  auto options = rocksdb::WriteOptions();
+  if (kEvents != domain) {
+    options.sync = true;
+  }
+  auto s = getDB()->Write(options, &batch);
+  return Status(s.code(), s.ToString());
+}
+
+Status RocksDBDatabasePlugin::removeBatch(
+    const std::string& domain, const std::vector<std::string>& keys) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+
+  rocksdb::WriteBatch batch;
+  for (const auto& key : keys) {
+    batch.Delete(cfh, key);
+  }
+
+  if (batch.Count() == 0) {
+    return Status(0, "OK");
+  }
+
+  auto options = rocksdb::WriteOptions();
+  if (kEvents != domain) {
+    options.sync = true;
+  }
+  auto s = getDB()->Write(options, &batch);
+  return Status(s.code(), s.ToString());
+}
+
 Status RocksDBDatabasePlugin::scan(const std::string& domain,
                                    std::vector<std::string>& results,
                                    const std::string& prefix,
@@ -337,6 +950,8 @@ Status RocksDBDatabasePlugin::scan(const std::string& domain,
   auto options = rocksdb::ReadOptions();
   options.verify_checksums = false;
   options.fill_cache = false;
+  // Scans may cross event key prefixes.
+  options.total_order_seek = true;
   auto it = getDB()->NewIterator(options, cfh);
   if (it == nullptr) {
     return Status(1, "Could not get iterator for " + domain);
@@ -355,4 +970,204 @@ Status RocksDBDatabasePlugin::scan(const std::string& domain,
   delete it;
   return Status(0, "OK");
 }
+
+Status RocksDBDatabasePlugin::scanValues(
+    const std::string& domain,
+    const std::string& prefix,
+    size_t max,
+    const DatabaseScanCallback& callback) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  auto options = rocksdb::ReadOptions();
+  options.verify_checksums = false;
+  options.fill_cache = false;
+  options.total_order_seek = true;
+  auto it = getDB()->NewIterator(options, cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+
+  // Keys sharing the prefix are contiguous and begin at the seek.
+  size_t count = 0;
+  rocksdb::Slice start(prefix);
+  for (it->Seek(start); it->Valid() && it->key().starts_with(start);
+       it->Next()) {
+    if (!callback(it->key().ToString(), it->value().ToString())) {
+      break;
+    }
+    if (max > 0 && ++count >= max) {
+      break;
+    }
+  }
+  delete it;
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::scanRange(const std::string& domain,
+                                        const std::string& begin,
+                                        const std::string& end,
+                                        DatabaseKeyValues& results,
+                                        size_t max) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  auto options = rocksdb::ReadOptions();
+  options.verify_checksums = false;
+  options.total_order_seek = true;
+  auto it = getDB()->NewIterator(options, cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+
+  rocksdb::Slice last(end);
+  for (it->Seek(begin); it->Valid(); it->Next()) {
+    if (it->key().compare(last) > 0) {
+      break;
+    }
+    results.push_back(
+        std::make_pair(it->key().ToString(), it->value().ToString()));
+    if (max > 0 && results.size() >= max) {
+      break;
+    }
+  }
+  delete it;
+  return Status(0, "OK");
+}
+
+Status RocksDBDatabasePlugin::removeRange(const std::string& domain,
+                                          const std::string& begin,
+                                          const std::string& end) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  }
+
+  auto cfh = getHandleForColumnFamily(domain);
+  if (cfh == nullptr) {
+    return Status(1, "Could not get column family for " + domain);
+  }
+  auto read_options = rocksdb::ReadOptions();
+  read_options.verify_checksums = false;
+  read_options.fill_cache = false;
+  read_options.total_order_seek = true;
+  auto it = getDB()->NewIterator(read_options, cfh);
+  if (it == nullptr) {
+    return Status(1, "Could not get iterator for " + domain);
+  }
+
+  // The bundled RocksDB does not provide DeleteRange, so the deletes of each
+  // key within the range are applied as a single write.
+  rocksdb::WriteBatch batch;
+  rocksdb::Slice last(end);
+  for (it->Seek(begin); it->Valid(); it->Next()) {
+    if (it->key().compare(last) >= 0) {
+      break;
+    }
+    batch.Delete(cfh, it->key());
+  }
+  delete it;
+
+  if (batch.Count() == 0) {
+    return Status(0, "OK");
+  }
+
+  auto options = rocksdb::WriteOptions();
+  if (kEvents != domain) {
+    options.sync = true;
+  }
+  auto s = getDB()->Write(options, &batch);
+  return Status(s.code(), s.ToString());
+}
+
+Status RocksDBDatabasePlugin::getStats(PluginResponse& stats) const {
+  if (getDB() == nullptr) {
+    return Status(1, "Database not opened");
+  }
+
+  stats.push_back({{"domain", ""}, {"name", "profile"}, {"value", profile_}});
+  if (cache_ != nullptr) {
+    stats.push_back({{"domain", ""},
+                     {"name", "block_cache_usage"},
+                     {"value", std::to_string(cache_->GetUsage())}});
+    stats.push_back({{"domain", ""},
+                     {"name", "block_cache_capacity"},
+                     {"value", std::to_string(cache_->GetCapacity())}});
+  }
+
+  if (rate_limiter_ != nullptr) {
+    stats.push_back({{"domain", ""},
+                     {"name", "io_rate_limit"},
+                     {"value", std::to_string(kRocksDBIORate.load())}});
+    stats.push_back(
+        {{"domain", ""},
+         {"name", "io_rate_bytes"},
+         {"value", std::to_string(rate_limiter_->GetTotalBytesThrough())}});
+    stats.push_back({{"domain", ""},
+                     {"name", "system_idle"},
+                     {"value", (kRocksDBIdle) ? "1" : "0"}});
+  }
+
+  for (const auto& property : kRocksDBDatabaseProperties) {
+    std::string value;
+    if (getDB()->GetProperty("rocksdb." + property, &value)) {
+      stats.push_back({{"domain", ""}, {"name", property}, {"value", value}});
+    }
+  }
+
+  if (options_.statistics != nullptr) {
+    for (const auto& ticker : kRocksDBTickers) {
+      auto count = options_.statistics->getTickerCount(ticker.first);
+      stats.push_back({{"domain", ""},
+                       {"name", ticker.second},
+                       {"value", std::to_string(count)}});
+    }
+  }
+
+  for (const auto& domain : kDomains) {
+    auto cfh = getHandleForColumnFamily(domain);
+    if (cfh == nullptr) {
+      continue;
+    }
+
+    // Report the options of the handle serving the domain.
+    auto options = getDB()->GetOptions(cfh);
+    std::string prefix;
+    if (options.prefix_extractor != nullptr) {
+      prefix = options.prefix_extractor->Name();
+    }
+    stats.push_back({{"domain", domain},
+                     {"name", "column_family"},
+                     {"value", cfh->GetName()}});
+    stats.push_back(
+        {{"domain", domain}, {"name", "prefix_extractor"}, {"value", prefix}});
+    stats.push_back({{"domain", domain},
+                     {"name", "compression"},
+                     {"value",
+                      (options.compression == rocksdb::kLZ4Compression)
+                          ? "lz4"
+                          : std::to_string(options.compression)}});
+    stats.push_back({{"domain", domain},
+                     {"name", "write_buffer_size"},
+                     {"value", std::to_string(options.write_buffer_size)}});
+
+    for (const auto& property : kRocksDBProperties) {
+      std::string value;
+      if (getDB()->GetProperty(cfh, "rocksdb." + property, &value)) {
+        stats.push_back(
+            {{"domain", domain}, {"name", property}, {"value", value}});
+      }
+    }
+  }
+  return Status(0, "OK");
+}
 }
@@ -25,10 +25,11 @@ namespace osquery {
 DECLARE_string(database_path);
 DECLARE_bool(database_in_memory);
 
+/// Write-ahead logging allows reads during writes and defers syncs.
 const std::map<std::string, std::string> kDBSettings = {
-    {"synchronous", "OFF"},      {"count_changes", "OFF"},
+    {"synchronous", "NORMAL"},   {"count_changes", "OFF"},
     {"default_temp_store", "2"}, {"auto_vacuum", "FULL"},
-    {"journal_mode", "OFF"},     {"cache_size", "1000"},
+    {"journal_mode", "WAL"},     {"cache_size", "1000"},
     {"page_count", "1000"},
 };
 
@@ -47,12 +48,26 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
   /// Data removal method.
   Status remove(const std::string& domain, const std::string& k) override;
 
+  /// Multiple key storage method, within a transaction.
+  Status putBatch(const std::string& domain,
+                  const DatabaseKeyValues& data) override;
+
+  /// Multiple key removal method, within a transaction.
+  Status removeBatch(const std::string& domain,
+                     const std::vector<std::string>& keys) override;
+
   /// Key/index lookup method.
   Status scan(const std::string& domain,
               std::vector<std::string>& results,
               const std::string& prefix,
               size_t max = 0) const override;
 
+  /// Key and value prefix lookup method, stepping a single statement.
+  Status scanValues(const std::string& domain,
+                    const std::string& prefix,
+                    size_t max,
+                    const DatabaseScanCallback& callback) const override;
+
  public:
   /// Database workflow: open and setup.
   Status setUp() override;
@@ -66,10 +81,36 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
  private:
   void close();
 
+  /**
+   * @brief Return a cached prepared statement, reset for new bindings.
+   *
+   * Statements are prepared once for each domain and query.
+   * REQUIRES the statement lock.
+   *
+   * @param domain The domain (table) the statement accesses.
+   * @param query The query text, the domain is substituted for "%s".
+   * @return The statement, nullptr if the statement could not be prepared.
+   */
+  sqlite3_stmt* getStatement(const std::string& domain,
+                             const std::string& query) const;
+
+  /// Run a write statement for each item within a transaction.
+  template <typename T, typename B>
+  Status runBatch(const std::string& domain,
+                  const std::string& query,
+                  const std::vector<T>& items,
+                  B bind);
+
  private:
   /// The long-lived sqlite3 database.
   sqlite3* db_{nullptr};
 
+  /// Prepared statements, indexed by the statement text.
+  mutable std::map<std::string, sqlite3_stmt*> statements_;
+
+  /// A cached statement, or transaction, is used by one thread at a time.
+  mutable std::mutex statement_mutex_;
+
   /// Deconstruction mutex.
   std::mutex close_mutex_;
 };
@@ -77,6 +118,28 @@ class SQLiteDatabasePlugin : public DatabasePlugin {
 /// Backing-storage provider for osquery internal/core.
 REGISTER_INTERNAL(SQLiteDatabasePlugin, "database", "sqlite");
 
+/// Insert or replace a key and value.
+const std::string kSQLitePut = "insert or replace into %s values (?1, ?2);";
+
+/// Remove a key.
+const std::string kSQLiteRemove = "delete from %s where key = ?1;";
+
+/// Find the value of a key.
+const std::string kSQLiteGet = "select value from %s where key = ?1;";
+
+/**
+ * @brief Find keys starting at a prefix in key order.
+ *
+ * The primary key index covers the key column, key-only scans do not read
+ * the table rows.
+ */
+const std::string kSQLiteScan =
+    "select key from %s where key >= ?1 order by key;";
+
+/// Find keys and values starting at a prefix in key order.
+const std::string kSQLiteScanValues =
+    "select key, value from %s where key >= ?1 order by key;";
+
 Status SQLiteDatabasePlugin::setUp() {
   if (!DatabasePlugin::kDBHandleOptionAllowOpen) {
     LOG(WARNING) << RLOG(1629) << "Not allowed to create DBHandle instance";
@@ -121,6 +184,13 @@ Status SQLiteDatabasePlugin::setUp() {
   }
 
   if (!read_only_) {
+    // Settings such as auto_vacuum must be applied before creating tables.
+    std::string settings;
+    for (const auto& setting : kDBSettings) {
+      settings += "PRAGMA " + setting.first + "=" + setting.second + "; ";
+    }
+    sqlite3_exec(db_, settings.c_str(), nullptr, nullptr, nullptr);
+
     for (const auto& domain : kDomains) {
       std::string q = "create table if not exists " + domain +
                       " (key TEXT PRIMARY KEY, value TEXT);";
@@ -130,12 +200,6 @@ Status SQLiteDatabasePlugin::setUp() {
         return Status(1, "Cannot create domain: " + domain);
       }
     }
-
-    std::string settings;
-    for (const auto& setting : kDBSettings) {
-      settings += "PRAGMA " + setting.first + "=" + setting.second + "; ";
-    }
-    sqlite3_exec(db_, settings.c_str(), nullptr, nullptr, nullptr);
   }
 
   // RocksDB may not create/append a directory with acceptable permissions.
@@ -148,12 +212,45 @@ Status SQLiteDatabasePlugin::setUp() {
 
 void SQLiteDatabasePlugin::close() {
   std::unique_lock<std::mutex> lock(close_mutex_);
+  {
+    std::unique_lock<std::mutex> statement_lock(statement_mutex_);
+    for (auto& statement : statements_) {
+      sqlite3_finalize(statement.second);
+    }
+    statements_.clear();
+  }
+
   if (db_ != nullptr) {
     sqlite3_close(db_);
     db_ = nullptr;
   }
 }
 
+sqlite3_stmt* SQLiteDatabasePlugin::getStatement(
+    const std::string& domain, const std::string& query) const {
+  if (db_ == nullptr) {
+    return nullptr;
+  }
+
+  auto q = query;
+  q.replace(q.find("%s"), 2, domain);
+  auto it = statements_.find(q);
+  if (it != statements_.end()) {
+    sqlite3_reset(it->second);
+    sqlite3_clear_bindings(it->second);
+    return it->second;
+  }
+
+  sqlite3_stmt* stmt = nullptr;
+  if (sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+    sqlite3_finalize(stmt);
+    return nullptr;
+  }
+
+  statements_[q] = stmt;
+  return stmt;
+}
+
 static int getData(void* argument, int argc, char* argv[], char* column[]) {
   if (argument == nullptr) {
     return SQLITE_MISUSE;
@@ -170,23 +267,33 @@ static int getData(void* argument, int argc, char* argv[], char* column[]) {
   return 0;
 }
 
+/// Copy a text column, an empty string if the column is NULL.
+static inline std::string getColumnText(sqlite3_stmt* stmt, int column) {
+  auto text = sqlite3_column_text(stmt, column);
+  if (text == nullptr) {
+    return "";
+  }
+  return std::string(reinterpret_cast<const char*>(text),
+                     sqlite3_column_bytes(stmt, column));
+}
+
 Status SQLiteDatabasePlugin::get(const std::string& domain,
                                  const std::string& key,
                                  std::string& value) const {
-  QueryData results;
-  char* err = nullptr;
-  std::string q = "select value from " + domain + " where key = '" + key + "';";
-  sqlite3_exec(db_, q.c_str(), getData, &results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto stmt = getStatement(domain, kSQLiteGet);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare lookup for domain: " + domain);
   }
 
   // Only assign value if the query found a result.
-  if (results.size() > 0) {
-    value = std::move(results[0]["value"]);
-    return Status(0);
+  sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
+  auto rc = sqlite3_step(stmt);
+  if (rc == SQLITE_ROW) {
+    value = getColumnText(stmt, 0);
   }
-  return Status(1);
+  sqlite3_reset(stmt);
+  return Status((rc == SQLITE_ROW) ? 0 : 1);
 }
 
 static void tryVacuum(sqlite3* db) {
@@ -211,18 +318,20 @@ Status SQLiteDatabasePlugin::put(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "insert or replace into " + domain + " values (?1, ?2);";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto stmt = getStatement(domain, kSQLitePut);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare write for domain: " + domain);
+  }
 
   sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
   sqlite3_bind_text(stmt, 2, value.c_str(), -1, SQLITE_STATIC);
   auto rc = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
   if (rc != SQLITE_DONE) {
     return Status(1);
   }
 
-  sqlite3_finalize(stmt);
   if (rand() % 10 == 0) {
     tryVacuum(db_);
   }
@@ -235,45 +344,155 @@ Status SQLiteDatabasePlugin::remove(const std::string& domain,
     return Status(0, "Database in readonly mode");
   }
 
-  sqlite3_stmt* stmt = nullptr;
-  std::string q = "delete from " + domain + " where key IN (?1);";
-  sqlite3_prepare_v2(db_, q.c_str(), -1, &stmt, nullptr);
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto stmt = getStatement(domain, kSQLiteRemove);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare removal for domain: " + domain);
+  }
 
   sqlite3_bind_text(stmt, 1, key.c_str(), -1, SQLITE_STATIC);
   auto rc = sqlite3_step(stmt);
+  sqlite3_reset(stmt);
   if (rc != SQLITE_DONE) {
     return Status(1);
   }
 
-  sqlite3_finalize(stmt);
   if (rand() % 10 == 0) {
     tryVacuum(db_);
   }
   return Status(0);
 }
 
+template <typename T, typename B>
+Status SQLiteDatabasePlugin::runBatch(const std::string& domain,
+                                      const std::string& query,
+                                      const std::vector<T>& items,
+                                      B bind) {
+  if (read_only_) {
+    return Status(0, "Database in readonly mode");
+  } else if (items.empty()) {
+    return Status(0);
+  }
+
+  // The lock also keeps other writes out of the transaction.
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto stmt = getStatement(domain, query);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot prepare batch for domain: " + domain);
+  }
+
+  // The batch is committed, or rolled back, as a single transaction.
+  sqlite3_exec(db_, "begin transaction;", nullptr, nullptr, nullptr);
+  auto rc = SQLITE_DONE;
+  for (const auto& item : items) {
+    bind(stmt, item);
+    rc = sqlite3_step(stmt);
+    sqlite3_reset(stmt);
+    if (rc != SQLITE_DONE) {
+      break;
+    }
+  }
+
+  if (rc != SQLITE_DONE) {
+    sqlite3_exec(db_, "rollback;", nullptr, nullptr, nullptr);
+    return Status(1);
+  }
+  sqlite3_exec(db_, "commit;", nullptr, nullptr, nullptr);
+  return Status(0);
+}
+
+Status SQLiteDatabasePlugin::putBatch(const std::string& domain,
+                                      const DatabaseKeyValues& data) {
+  return runBatch(domain,
+                  kSQLitePut,
+                  data,
+                  [](sqlite3_stmt* stmt,
+                     const std::pair<std::string, std::string>& pair) {
+                    sqlite3_bind_text(
+                        stmt, 1, pair.first.c_str(), -1, SQLITE_STATIC);
+                    sqlite3_bind_text(
+                        stmt, 2, pair.second.c_str(), -1, SQLITE_STATIC);
+                  });
+}
+
+Status SQLiteDatabasePlugin::removeBatch(const std::string& domain,
+                                         const std::vector<std::string>& keys) {
+  auto status = runBatch(domain,
+                         kSQLiteRemove,
+                         keys,
+                         [](sqlite3_stmt* stmt, const std::string& key) {
+                           sqlite3_bind_text(
+                               stmt, 1, key.c_str(), -1, SQLITE_STATIC);
+                         });
+  if (status.ok() && !keys.empty() && rand() % 10 == 0) {
+    std::unique_lock<std::mutex> lock(statement_mutex_);
+    tryVacuum(db_);
+  }
+  return status;
+}
+
 Status SQLiteDatabasePlugin::scan(const std::string& domain,
                                   std::vector<std::string>& results,
                                   const std::string& prefix,
                                   size_t max) const {
-  QueryData _results;
-  char* err = nullptr;
-
-  std::string q =
-      "select key from " + domain + " where key LIKE '" + prefix + "%'";
-  if (max > 0) {
-    q += " limit " + std::to_string(max);
+  std::unique_lock<std::mutex> lock(statement_mutex_);
+  auto stmt = getStatement(domain, kSQLiteScan);
+  if (stmt == nullptr) {
+    return Status(1, "Cannot scan domain: " + domain);
   }
-  sqlite3_exec(db_, q.c_str(), getData, &_results, &err);
-  if (err != nullptr) {
-    sqlite3_free(err);
+
+  size_t count = 0;
+  sqlite3_bind_text(stmt, 1, prefix.c_str(), -1, SQLITE_STATIC);
+  while (sqlite3_step(stmt) == SQLITE_ROW) {
+    auto key = getColumnText(stmt, 0);
+    if (key.compare(0, prefix.size(), prefix) != 0) {
+      break;
+    }
+
+    results.push_back(std::move(key));
+    if (max > 0 && ++count >= max) {
+      break;
+    }
   }
+  sqlite3_reset(stmt);
+  return Status(0, "OK");
+}
 
-  // Only assign value if the query found a result.
-  for (auto& r : _results) {
-    results.push_back(std::move(r["key"]));
+Status SQLiteDatabasePlugin::scanValues(
+    const std::string& domain,
+    const std::string& prefix,
+    size_t max,
+    const DatabaseScanCallback& callback) const {
+  // The callback may access the database, the rows are read first.
+  DatabaseKeyValues pairs;
+  {
+    std::unique_lock<std::mutex> lock(statement_mutex_);
+    auto stmt = getStatement(domain, kSQLiteScanValues);
+    if (stmt == nullptr) {
+      return Status(1, "Cannot scan domain: " + domain);
+    }
+
+    // The primary key index returns keys sharing the prefix contiguously.
+    sqlite3_bind_text(stmt, 1, prefix.c_str(), -1, SQLITE_STATIC);
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+      auto key = getColumnText(stmt, 0);
+      if (key.compare(0, prefix.size(), prefix) != 0) {
+        break;
+      }
+
+      pairs.push_back(std::make_pair(std::move(key), getColumnText(stmt, 1)));
+      if (max > 0 && pairs.size() >= max) {
+        break;
+      }
+    }
+    sqlite3_reset(stmt);
   }
 
+  for (const auto& pair : pairs) {
+    if (!callback(pair.first, pair.second)) {
+      break;
+    }
+  }
   return Status(0, "OK");
 }
 }
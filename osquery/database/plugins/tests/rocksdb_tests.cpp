@@ -8,6 +8,8 @@
  *
  */
 
+#include <rocksdb/db.h>
+
 #include <osquery/sql.h>
 
 #include "osquery/database/tests/plugin_tests.h"
@@ -31,4 +33,169 @@ TEST_F(RocksDBDatabasePluginTests, test_rocksdb_loglevel) {
   auto details = SQL::selectAllFrom("file", "path", EQUALS, path_ + "/LOG");
   ASSERT_EQ(details.size(), 0U);
 }
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_stats) {
+  auto plugin = Registry::get("database", "rocksdb");
+  auto db = std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+  EXPECT_TRUE(db->put(kEvents, "data.publisher.subscriber.1", "value"));
+
+  PluginResponse stats;
+  ASSERT_TRUE(db->getStats(stats));
+
+  std::map<std::string, std::string> events;
+  std::string profile;
+  for (const auto& stat : stats) {
+    if (stat.at("domain") == kEvents) {
+      events[stat.at("name")] = stat.at("value");
+    } else if (stat.at("name") == "profile") {
+      profile = stat.at("value");
+    }
+  }
+
+  EXPECT_EQ(profile, "default");
+  EXPECT_EQ(events.count("estimate-num-keys"), 1U);
+  EXPECT_EQ(events.count("estimate-pending-compaction-bytes"), 1U);
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_domain_options) {
+  auto plugin = Registry::get("database", "rocksdb");
+  auto db = std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+
+  PluginResponse stats;
+  ASSERT_TRUE(db->getStats(stats));
+
+  std::map<std::string, std::map<std::string, std::string>> domains;
+  for (const auto& stat : stats) {
+    if (!stat.at("domain").empty()) {
+      domains[stat.at("domain")][stat.at("name")] = stat.at("value");
+    }
+  }
+
+  // Each domain is served by the column family of the same name.
+  ASSERT_EQ(domains.size(), kDomains.size());
+  for (const auto& domain : kDomains) {
+    EXPECT_EQ(domains[domain]["column_family"], domain);
+    if (domain != kEvents) {
+      EXPECT_TRUE(domains[domain]["prefix_extractor"].empty());
+    }
+    if (domain != kQueries) {
+      EXPECT_NE(domains[domain]["compression"], "lz4");
+    }
+  }
+
+  // The event key layout and query snapshot settings apply to their domains.
+  EXPECT_EQ(domains[kEvents]["prefix_extractor"],
+            "osquery.EventKeyPrefixTransform");
+  EXPECT_EQ(domains[kQueries]["compression"], "lz4");
+  EXPECT_NE(domains[kEvents]["write_buffer_size"],
+            domains[kLogs]["write_buffer_size"]);
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_legacy_layout) {
+  auto plugin = Registry::get("database", "rocksdb");
+  auto db = std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+  db->tearDown();
+  boost::filesystem::remove_all(path_);
+
+  // Previous versions used the handle before each domain's column family.
+  std::vector<rocksdb::ColumnFamilyDescriptor> families;
+  families.push_back(rocksdb::ColumnFamilyDescriptor(
+      rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
+  for (const auto& domain : kDomains) {
+    families.push_back(rocksdb::ColumnFamilyDescriptor(
+        domain, rocksdb::ColumnFamilyOptions()));
+  }
+
+  rocksdb::Options options;
+  options.create_if_missing = true;
+  options.create_missing_column_families = true;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  rocksdb::DB* legacy = nullptr;
+  ASSERT_TRUE(
+      rocksdb::DB::Open(options, path_, families, &handles, &legacy).ok());
+  for (size_t i = 0; i < kDomains.size(); i++) {
+    legacy->Put(rocksdb::WriteOptions(), handles[i], "legacy", kDomains[i]);
+  }
+  for (auto handle : handles) {
+    delete handle;
+  }
+  delete legacy;
+
+  // Opening the database moves each domain to its column family.
+  ASSERT_TRUE(db->setUp());
+  for (const auto& domain : kDomains) {
+    std::string value;
+    EXPECT_TRUE(db->get(domain, "legacy", value));
+    EXPECT_EQ(value, domain);
+  }
+
+  // A second open does not move them again.
+  db->tearDown();
+  ASSERT_TRUE(db->setUp());
+  for (const auto& domain : kDomains) {
+    std::string value;
+    EXPECT_TRUE(db->get(domain, "legacy", value));
+    EXPECT_EQ(value, domain);
+  }
+}
+
+TEST_F(RocksDBDatabasePluginTests, test_rocksdb_interrupted_layout) {
+  auto plugin = Registry::get("database", "rocksdb");
+  auto db = std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+  db->tearDown();
+  boost::filesystem::remove_all(path_);
+
+  std::vector<rocksdb::ColumnFamilyDescriptor> families;
+  families.push_back(rocksdb::ColumnFamilyDescriptor(
+      rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
+  for (const auto& domain : kDomains) {
+    families.push_back(rocksdb::ColumnFamilyDescriptor(
+        domain, rocksdb::ColumnFamilyOptions()));
+  }
+
+  rocksdb::Options options;
+  options.create_if_missing = true;
+  options.create_missing_column_families = true;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  rocksdb::DB* legacy = nullptr;
+  ASSERT_TRUE(
+      rocksdb::DB::Open(options, path_, families, &handles, &legacy).ok());
+
+  // The last domain was moved and marked before the process stopped.
+  auto last = kDomains.size() - 1;
+  legacy->Put(
+      rocksdb::WriteOptions(), handles[last + 1], "legacy", kDomains[last]);
+  legacy->Put(rocksdb::WriteOptions(),
+              handles[0],
+              "column_family_layout." + kDomains[last],
+              "1");
+
+  // The domain before it was partially moved.
+  legacy->Put(
+      rocksdb::WriteOptions(), handles[last], "moved", kDomains[last - 1]);
+  legacy->Put(
+      rocksdb::WriteOptions(), handles[last - 1], "legacy", kDomains[last - 1]);
+
+  // The other domains were not moved.
+  for (size_t i = 0; i < last - 1; i++) {
+    legacy->Put(rocksdb::WriteOptions(), handles[i], "legacy", kDomains[i]);
+  }
+  for (auto handle : handles) {
+    delete handle;
+  }
+  delete legacy;
+
+  // The moved domain is not moved again and the move of the others resumes.
+  ASSERT_TRUE(db->setUp());
+  for (const auto& domain : kDomains) {
+    std::string value;
+    EXPECT_TRUE(db->get(domain, "legacy", value));
+    EXPECT_EQ(value, domain);
+  }
+
+  std::string value;
+  EXPECT_TRUE(db->get(kDomains[last - 1], "moved", value));
+  EXPECT_EQ(value, kDomains[last - 1]);
+  EXPECT_FALSE(db->get(kDomains[last], "moved", value));
+}
 }
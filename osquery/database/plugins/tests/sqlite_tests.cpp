@@ -19,4 +19,23 @@ class SQLiteDatabasePluginTests : public DatabasePluginTests {
 
 // Define the default set of database plugin operation tests.
 CREATE_DATABASE_TESTS(SQLiteDatabasePluginTests);
+
+TEST_F(SQLiteDatabasePluginTests, test_sqlite_bound_keys) {
+  auto plugin = Registry::get("database", "sqlite");
+  auto db = std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+
+  // Keys are bound to cached statements and never part of the query text.
+  EXPECT_TRUE(db->put(kQueries, "it's_1", "a"));
+  std::string value;
+  EXPECT_TRUE(db->get(kQueries, "it's_1", value));
+  EXPECT_EQ(value, "a");
+
+  // Prefixes are not patterns, an underscore only matches itself.
+  db->put(kQueries, "test_bound_1", "b");
+  db->put(kQueries, "testxbound_2", "c");
+  std::vector<std::string> keys;
+  db->scan(kQueries, keys, "test_");
+  ASSERT_EQ(keys.size(), 1U);
+  EXPECT_EQ(keys[0], "test_bound_1");
+}
 }
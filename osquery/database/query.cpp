@@ -9,27 +9,97 @@
  */
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/perf.h"
 #include "osquery/database/query.h"
 
 namespace osquery {
 
-Status Query::getPreviousQueryResults(QueryData& results) {
-  std::string raw;
-  auto status = getDatabaseValue(kQueries, name_, raw);
-  if (!status.ok()) {
-    return status;
+FLAG(bool,
+     query_result_digests,
+     true,
+     "Store sorted row digests to skip unchanged differential results");
+
+/// The key prefix for the sorted row digests of a query's last results.
+const std::string kQueryDigestsPrefix = "digests.";
+
+/// Each digest is stored as a fixed-width hex string.
+#define QUERY_DIGEST_WIDTH 16
+
+QueryDigests getQueryDigests(const QueryData& qd) {
+  QueryDigests digests;
+  digests.reserve(qd.size());
+  for (const auto& row : qd) {
+    digests.push_back(hashRow(row));
   }
+  std::sort(digests.begin(), digests.end());
+  return digests;
+}
 
-  status = deserializeQueryDataJSON(raw, results);
-  if (!status.ok()) {
-    return status;
+std::string serializeQueryDigests(const QueryDigests& digests) {
+  std::string content(digests.size() * QUERY_DIGEST_WIDTH, '\0');
+  char digest[QUERY_DIGEST_WIDTH + 1] = {0};
+  for (size_t i = 0; i < digests.size(); ++i) {
+    snprintf(digest,
+             sizeof(digest),
+             "%016llx",
+             static_cast<unsigned long long>(digests[i]));
+    content.replace(i * QUERY_DIGEST_WIDTH, QUERY_DIGEST_WIDTH, digest);
+  }
+  return content;
+}
+
+Status deserializeQueryDigests(const char* content,
+                               size_t size,
+                               QueryDigests& digests) {
+  if (size % QUERY_DIGEST_WIDTH != 0) {
+    return Status(1, "Invalid query digest content");
+  }
+
+  digests.clear();
+  digests.reserve(size / QUERY_DIGEST_WIDTH);
+  char digest[QUERY_DIGEST_WIDTH + 1] = {0};
+  for (size_t i = 0; i < size; i += QUERY_DIGEST_WIDTH) {
+    char* end = nullptr;
+    memcpy(digest, content + i, QUERY_DIGEST_WIDTH);
+    digests.push_back(strtoull(digest, &end, 16));
+    if (end == nullptr || *end != '\0') {
+      return Status(1, "Invalid query digest content");
+    }
   }
   return Status(0, "OK");
 }
 
+Status deserializeQueryDigests(const std::string& content,
+                               QueryDigests& digests) {
+  return deserializeQueryDigests(content.data(), content.size(), digests);
+}
+
+Status Query::getPreviousQueryDigests(QueryDigests& digests) {
+  return readDatabaseValue(
+      kQueries,
+      kQueryDigestsPrefix + name_,
+      [&digests](const char* data, size_t size) {
+        if (size == 0) {
+          return Status(1, "No digests stored for query");
+        }
+        return deserializeQueryDigests(data, size, digests);
+      });
+}
+
+Status Query::getPreviousQueryResults(QueryData& results) {
+  // Snapshots may be large, decode them in place from the backing store.
+  return readDatabaseValue(
+      kQueries, name_, [&results](const char* data, size_t size) {
+        return deserializeQueryDataJSON(data, size, results);
+      });
+}
+
 std::vector<std::string> Query::getStoredQueryNames() {
   std::vector<std::string> results;
   scanDatabaseKeys(kQueries, results);
@@ -60,6 +130,19 @@ Status Query::addNewResults(const QueryData& qd) {
 Status Query::addNewResults(const QueryData& current_qd,
                             DiffResults& dr,
                             bool calculate_diff) {
+  return addResults(current_qd, nullptr, dr, calculate_diff);
+}
+
+Status Query::addNewResults(QueryData&& current_qd,
+                            DiffResults& dr,
+                            bool calculate_diff) {
+  return addResults(current_qd, &current_qd, dr, calculate_diff);
+}
+
+Status Query::addResults(const QueryData& current_qd,
+                         QueryData* owned,
+                         DiffResults& dr,
+                         bool calculate_diff) {
   // The current results are 'fresh' when not calculating a differential.
   bool fresh_results = !calculate_diff;
   if (!isQueryNameInDatabase()) {
@@ -77,7 +160,24 @@ Status Query::addNewResults(const QueryData& current_qd,
   // If a differential is requested and needed the target remains the original
   // query data, otherwise the content is moved to the differential's added set.
   const auto* target_gd = &current_qd;
+  // The sorted digests of the current results, only used for differentials.
+  QueryDigests current_digests;
+  // With digests enabled they are written on every add, matching digests
+  // return before reaching the write.
+  bool write_digests = FLAGS_query_result_digests;
   if (!fresh_results && calculate_diff) {
+    if (FLAGS_query_result_digests) {
+      // When the sorted digests match there is no differential to calculate.
+      // This avoids reading and parsing the previous results entirely.
+      current_digests = getQueryDigests(current_qd);
+      QueryDigests previous_digests;
+      if (getPreviousQueryDigests(previous_digests).ok()) {
+        if (previous_digests == current_digests) {
+          return Status(0, "OK");
+        }
+      }
+    }
+
     // Get the rows from the last run of this query name.
     QueryData previous_qd;
     auto status = getPreviousQueryResults(previous_qd);
@@ -86,13 +186,23 @@ Status Query::addNewResults(const QueryData& current_qd,
     }
 
     // Calculate the differential between previous and current query results.
-    dr = diff(previous_qd, current_qd);
-    fresh_results = (!dr.added.empty() || !dr.removed.empty());
+    PerfTimer timer(PERF_DIFF);
+    dr = diff(previous_qd, current_qd, query_.key);
+    fresh_results = !dr.empty();
   } else {
-    dr.added = std::move(current_qd);
+    if (owned != nullptr) {
+      dr.added = std::move(*owned);
+    } else {
+      dr.added = current_qd;
+    }
     target_gd = &dr.added;
+    if (write_digests) {
+      current_digests = getQueryDigests(*target_gd);
+    }
   }
 
+  // The results and digests are stored with a single batch.
+  DatabaseKeyValues writes;
   if (fresh_results) {
     // Replace the "previous" query data with the current.
     std::string json;
@@ -100,11 +210,18 @@ Status Query::addNewResults(const QueryData& current_qd,
     if (!status.ok()) {
       return status;
     }
+    writes.push_back(std::make_pair(name_, std::move(json)));
+  }
 
-    status = setDatabaseValue(kQueries, name_, json);
-    if (!status.ok()) {
-      return status;
-    }
+  if (write_digests) {
+    // The digests describe the results written with them, and may be
+    // rewritten without new results if they were missing or malformed.
+    writes.push_back(std::make_pair(kQueryDigestsPrefix + name_,
+                                    serializeQueryDigests(current_digests)));
+  }
+
+  if (!writes.empty()) {
+    return setDatabaseValues(kQueries, writes);
   }
   return Status(0, "OK");
 }
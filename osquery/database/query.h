@@ -22,6 +22,24 @@ namespace osquery {
 /// Error message used when a query name isn't found in the database
 extern const std::string kQueryNameNotFoundError;
 
+/// A sorted set of row digests, see hashRow.
+using QueryDigests = std::vector<uint64_t>;
+
+/// Compute the sorted row digests for a set of results.
+QueryDigests getQueryDigests(const QueryData& qd);
+
+/// Encode digests as fixed-width hex, suitable for every backing store.
+std::string serializeQueryDigests(const QueryDigests& digests);
+
+/// Inverse of serializeQueryDigests.
+Status deserializeQueryDigests(const std::string& content,
+                               QueryDigests& digests);
+
+/// Inverse of serializeQueryDigests, decode in place from a buffer.
+Status deserializeQueryDigests(const char* content,
+                               size_t size,
+                               QueryDigests& digests);
+
 /**
  * @brief Interact with the historical on-disk storage for a given query.
  */
@@ -50,6 +68,19 @@ class Query {
    */
   Status getPreviousQueryResults(QueryData& results);
 
+  /**
+   * @brief Retrieve the sorted row digests from the last run of this query.
+   *
+   * Differential queries store the digests next to their results. If the
+   * current results have identical digests the previous results do not need
+   * to be read or parsed.
+   *
+   * @param digests the output sorted set of row digests.
+   *
+   * @return failure if no (or malformed) digests are stored.
+   */
+  Status getPreviousQueryDigests(QueryDigests& digests);
+
   /**
    * @brief Get the names of all historical queries.
    *
@@ -105,6 +136,16 @@ class Query {
                        DiffResults& dr,
                        bool calculate_diff = true);
 
+  /**
+   * @brief See addNewResults, taking ownership of the results.
+   *
+   * Without a differential, such as the first execution, the results are
+   * moved into the differential's added set instead of copied.
+   */
+  Status addNewResults(QueryData&& qd,
+                       DiffResults& dr,
+                       bool calculate_diff = true);
+
   /**
    * @brief The most recent result set for a scheduled query.
    *
@@ -114,6 +155,13 @@ class Query {
    */
   Status getCurrentResults(QueryData& qd);
 
+ private:
+  /// Implements addNewResults, owned is the results if they may be moved.
+  Status addResults(const QueryData& current_qd,
+                    QueryData* owned,
+                    DiffResults& dr,
+                    bool calculate_diff);
+
  private:
   /// The scheduled query and internal
   ScheduledQuery query_;
@@ -129,5 +177,6 @@ class Query {
   FRIEND_TEST(QueryTests, test_get_executions);
   FRIEND_TEST(QueryTests, test_get_query_results);
   FRIEND_TEST(QueryTests, test_query_name_not_found_in_db);
+  FRIEND_TEST(QueryTests, test_query_digests);
 };
 }
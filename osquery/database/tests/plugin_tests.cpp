@@ -20,6 +20,54 @@ class EphemeralDatabasePluginTests : public DatabasePluginTests {
 // Define the default set of database plugin operation tests.
 CREATE_DATABASE_TESTS(EphemeralDatabasePluginTests);
 
+DECLARE_uint64(ephemeral_events_bytes_max);
+
+TEST_F(EphemeralDatabasePluginTests, test_ephemeral_eviction) {
+  auto plugin = Registry::get("database", "ephemeral");
+  auto db = std::dynamic_pointer_cast<DatabasePlugin>(plugin);
+
+  auto events_bytes_max = FLAGS_ephemeral_events_bytes_max;
+  FLAGS_ephemeral_events_bytes_max = 100;
+
+  // Each key and value is 20 bytes, the budget fits 5.
+  for (size_t i = 0; i < 10; i++) {
+    db->put(kEvents, "event_" + std::to_string(i), std::string(13, 'x'));
+  }
+
+  // A read makes the oldest key the most recently used.
+  std::string value;
+  EXPECT_TRUE(db->get(kEvents, "event_5", value));
+  db->put(kEvents, "event_10", std::string(12, 'x'));
+
+  std::vector<std::string> keys;
+  db->scan(kEvents, keys, "event_");
+  ASSERT_EQ(keys.size(), 5U);
+  EXPECT_EQ(keys[0], "event_10");
+  EXPECT_EQ(keys[1], "event_5");
+  EXPECT_EQ(keys[2], "event_7");
+
+  // Unbounded domains are not evicted.
+  for (size_t i = 0; i < 10; i++) {
+    db->put(kQueries, "query_" + std::to_string(i), std::string(13, 'x'));
+  }
+  keys.clear();
+  db->scan(kQueries, keys, "query_");
+  EXPECT_EQ(keys.size(), 10U);
+
+  PluginResponse stats;
+  db->getStats(stats);
+  std::map<std::string, std::string> events;
+  for (const auto& stat : stats) {
+    if (stat.at("domain") == kEvents) {
+      events[stat.at("name")] = stat.at("value");
+    }
+  }
+  EXPECT_EQ(events["evicted"], "6");
+  EXPECT_EQ(events["bytes"], "100");
+
+  FLAGS_ephemeral_events_bytes_max = events_bytes_max;
+}
+
 void DatabasePluginTests::testPluginCheck() {
   // Do not worry about multiple set-active calls.
   // For testing purposes they should be idempotent.
@@ -57,6 +105,26 @@ void DatabasePluginTests::testDelete() {
   EXPECT_EQ(s.getMessage(), "OK");
 }
 
+void DatabasePluginTests::testAppend() {
+  // Appending to a missing key creates the value.
+  auto s = getPlugin()->append(kEvents, "test_append", "foo");
+  EXPECT_TRUE(s.ok());
+  s = getPlugin()->append(kEvents, "test_append", "bar");
+  EXPECT_TRUE(s.ok());
+
+  std::string r;
+  s = getPlugin()->get(kEvents, "test_append", r);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(r, "foobar");
+
+  // A put replaces the appended value.
+  getPlugin()->put(kEvents, "test_append", "baz");
+  getPlugin()->append(kEvents, "test_append", "qux");
+  r.clear();
+  getPlugin()->get(kEvents, "test_append", r);
+  EXPECT_EQ(r, "bazqux");
+}
+
 void DatabasePluginTests::testScan() {
   getPlugin()->put(kQueries, "test_scan_foo1", "baz");
   getPlugin()->put(kQueries, "test_scan_foo2", "baz");
@@ -85,4 +153,131 @@ void DatabasePluginTests::testScanLimit() {
   EXPECT_EQ(s.getMessage(), "OK");
   EXPECT_EQ(keys.size(), 2U);
 }
+
+void DatabasePluginTests::testScanRange() {
+  getPlugin()->put(kQueries, "test_range_1", "a");
+  getPlugin()->put(kQueries, "test_range_2", "b");
+  getPlugin()->put(kQueries, "test_range_3", "c");
+  getPlugin()->put(kQueries, "test_range_4", "d");
+
+  DatabaseKeyValues results;
+  auto s = getPlugin()->scanRange(
+      kQueries, "test_range_2", "test_range_3", results);
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0].first, "test_range_2");
+  EXPECT_EQ(results[0].second, "b");
+  EXPECT_EQ(results[1].first, "test_range_3");
+
+  results.clear();
+  getPlugin()->scanRange(kQueries, "test_range_1", "test_range_4", results, 3);
+  EXPECT_EQ(results.size(), 3U);
+}
+
+void DatabasePluginTests::testRemoveRange() {
+  getPlugin()->put(kQueries, "test_remove_1", "a");
+  getPlugin()->put(kQueries, "test_remove_2", "b");
+  getPlugin()->put(kQueries, "test_remove_3", "c");
+  getPlugin()->put(kQueries, "test_remove_4", "d");
+
+  // The end of the range is not removed.
+  auto s = getPlugin()->removeRange(kQueries, "test_remove_2", "test_remove_4");
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::string> keys;
+  getPlugin()->scan(kQueries, keys, "test_remove_");
+  ASSERT_EQ(keys.size(), 2U);
+  EXPECT_EQ(keys[0], "test_remove_1");
+  EXPECT_EQ(keys[1], "test_remove_4");
+}
+
+void DatabasePluginTests::testBatch() {
+  DatabaseKeyValues data = {
+      {"test_batch_1", "a"}, {"test_batch_2", "b"}, {"test_batch_3", "c"}};
+  auto s = getPlugin()->putBatch(kQueries, data);
+  EXPECT_TRUE(s.ok());
+
+  // Missing keys have an empty value.
+  std::vector<std::string> values;
+  s = getPlugin()->multiGet(
+      kQueries, {"test_batch_1", "test_batch_missing", "test_batch_3"}, values);
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(values.size(), 3U);
+  EXPECT_EQ(values[0], "a");
+  EXPECT_TRUE(values[1].empty());
+  EXPECT_EQ(values[2], "c");
+
+  s = getPlugin()->removeBatch(kQueries, {"test_batch_1", "test_batch_3"});
+  EXPECT_TRUE(s.ok());
+
+  std::vector<std::string> keys;
+  getPlugin()->scan(kQueries, keys, "test_batch_");
+  ASSERT_EQ(keys.size(), 1U);
+  EXPECT_EQ(keys[0], "test_batch_2");
+}
+
+void DatabasePluginTests::testScanValues() {
+  getPlugin()->put(kQueries, "test_values_1", "a");
+  getPlugin()->put(kQueries, "test_values_2", "b");
+  getPlugin()->put(kQueries, "test_values_3", "c");
+  getPlugin()->put(kQueries, "test_valuesx", "d");
+
+  DatabaseKeyValues pairs;
+  auto s = getPlugin()->scanValues(
+      kQueries,
+      "test_values_",
+      0,
+      [&pairs](const std::string& key, const std::string& value) {
+        pairs.push_back(std::make_pair(key, value));
+        return true;
+      });
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(pairs.size(), 3U);
+  EXPECT_EQ(pairs[0].first, "test_values_1");
+  EXPECT_EQ(pairs[0].second, "a");
+  EXPECT_EQ(pairs[2].second, "c");
+
+  // The callback may stop the scan.
+  pairs.clear();
+  s = getPlugin()->scanValues(
+      kQueries,
+      "test_values_",
+      0,
+      [&pairs](const std::string& key, const std::string& value) {
+        pairs.push_back(std::make_pair(key, value));
+        return false;
+      });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(pairs.size(), 1U);
+}
+
+void DatabasePluginTests::testRead() {
+  getPlugin()->put(kQueries, "test_read", "{\"a\": 1}");
+
+  std::string value;
+  auto s = getPlugin()->read(
+      kQueries, "test_read", [&value](const char* data, size_t size) {
+        value.assign(data, size);
+        return Status(0, "OK");
+      });
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(value, "{\"a\": 1}");
+
+  // The reader's status is returned.
+  s = getPlugin()->read(kQueries, "test_read", [](const char*, size_t) {
+    return Status(1, "Decode failed");
+  });
+  EXPECT_FALSE(s.ok());
+  EXPECT_EQ(s.getMessage(), "Decode failed");
+
+  // The reader is not called for a missing key.
+  bool called = false;
+  s = getPlugin()->read(
+      kQueries, "test_read_missing", [&called](const char*, size_t) {
+        called = true;
+        return Status(0, "OK");
+      });
+  EXPECT_FALSE(s.ok());
+  EXPECT_FALSE(called);
+}
 }
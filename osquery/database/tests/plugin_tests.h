@@ -20,13 +20,19 @@
 #include "osquery/tests/test_util.h"
 
 /// The following test macros allow pretty test output.
-#define CREATE_DATABASE_TESTS(n)                      \
-  TEST_F(n, test_plugin_check) { testPluginCheck(); } \
-  TEST_F(n, test_put) { testPut(); }                  \
-  TEST_F(n, test_get) { testGet(); }                  \
-  TEST_F(n, test_delete) { testDelete(); }            \
-  TEST_F(n, test_scan) { testScan(); }                \
-  TEST_F(n, test_scan_limit) { testScanLimit(); }
+#define CREATE_DATABASE_TESTS(n)                       \
+  TEST_F(n, test_plugin_check) { testPluginCheck(); }  \
+  TEST_F(n, test_put) { testPut(); }                   \
+  TEST_F(n, test_get) { testGet(); }                   \
+  TEST_F(n, test_delete) { testDelete(); }             \
+  TEST_F(n, test_append) { testAppend(); }             \
+  TEST_F(n, test_scan) { testScan(); }                 \
+  TEST_F(n, test_scan_limit) { testScanLimit(); }      \
+  TEST_F(n, test_scan_range) { testScanRange(); }      \
+  TEST_F(n, test_remove_range) { testRemoveRange(); }  \
+  TEST_F(n, test_batch) { testBatch(); }               \
+  TEST_F(n, test_scan_values) { testScanValues(); }    \
+  TEST_F(n, test_read) { testRead(); }
 
 namespace osquery {
 
@@ -80,7 +86,13 @@ class DatabasePluginTests : public testing::Test {
   void testPut();
   void testGet();
   void testDelete();
+  void testAppend();
   void testScan();
   void testScanLimit();
+  void testScanRange();
+  void testRemoveRange();
+  void testBatch();
+  void testScanValues();
+  void testRead();
 };
 }
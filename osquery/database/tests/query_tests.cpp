@@ -61,6 +61,53 @@ TEST_F(QueryTests, test_add_and_get_current_results) {
   }
 }
 
+TEST_F(QueryTests, test_query_digests) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("digests", query);
+  auto results = getTestDBExpectedResults();
+  DiffResults dr;
+  EXPECT_TRUE(cf.addNewResults(results, dr));
+
+  // The sorted digests of the results are stored alongside the results.
+  QueryDigests digests;
+  EXPECT_TRUE(cf.getPreviousQueryDigests(digests));
+  EXPECT_EQ(digests, getQueryDigests(results));
+
+  // Identical results short-circuit the differential.
+  dr = DiffResults();
+  EXPECT_TRUE(cf.addNewResults(results, dr));
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+
+  // The encoding is fixed-width and reversible.
+  auto content = serializeQueryDigests(digests);
+  EXPECT_EQ(content.size(), digests.size() * 16);
+  QueryDigests output;
+  EXPECT_TRUE(deserializeQueryDigests(content, output));
+  EXPECT_EQ(output, digests);
+  EXPECT_FALSE(deserializeQueryDigests("abc", output));
+}
+
+TEST_F(QueryTests, test_add_moved_results) {
+  auto query = getOsqueryScheduledQuery();
+  auto cf = Query("moved", query);
+  auto results = getTestDBExpectedResults();
+
+  // The first execution moves the results into the differential.
+  auto moved = results;
+  DiffResults dr;
+  EXPECT_TRUE(cf.addNewResults(std::move(moved), dr));
+  EXPECT_EQ(dr.added, results);
+  EXPECT_TRUE(dr.removed.empty());
+
+  // Later executions are compared to the stored results.
+  moved = results;
+  dr = DiffResults();
+  EXPECT_TRUE(cf.addNewResults(std::move(moved), dr));
+  EXPECT_TRUE(dr.added.empty());
+  EXPECT_TRUE(dr.removed.empty());
+}
+
 TEST_F(QueryTests, test_get_query_results) {
   // Grab an expected set of query data and add it as the previous result.
   auto encoded_qd = getSerializedQueryDataJSON();
@@ -17,6 +17,7 @@
 #include <osquery/database.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/json.h"
 #include "osquery/tests/test_util.h"
 
 namespace pt = boost::property_tree;
@@ -38,6 +39,63 @@ TEST_F(ResultsTests, test_simple_diff) {
   EXPECT_EQ(results.removed, o);
 }
 
+TEST_F(ResultsTests, test_diff_duplicate_rows) {
+  Row r1 = {{"foo", "bar"}};
+  Row r2 = {{"foo", "baz"}};
+  Row r3 = {{"fo", "obar"}};
+
+  // Duplicate rows are accounted for by multiplicity.
+  QueryData o = {r1, r1, r2};
+  QueryData n = {r1, r3, r3};
+
+  auto results = diff(o, n);
+  EXPECT_EQ(results.added, QueryData({r3, r3}));
+  EXPECT_EQ(results.removed, QueryData({r1, r2}));
+
+  // An unchanged result set yields an empty differential.
+  results = diff(n, n);
+  EXPECT_TRUE(results.added.empty());
+  EXPECT_TRUE(results.removed.empty());
+}
+
+TEST_F(ResultsTests, test_diff_keyed) {
+  Row r1 = {{"pid", "1"}, {"name", "init"}, {"state", "S"}};
+  Row r2 = {{"pid", "2"}, {"name", "kthreadd"}, {"state", "S"}};
+  Row r3 = {{"pid", "3"}, {"name", "ksoftirqd"}, {"state", "S"}};
+  Row r1_changed = {{"pid", "1"}, {"name", "init"}, {"state", "R"}};
+  Row r4 = {{"pid", "4"}, {"name", "kworker"}, {"state", "S"}};
+
+  QueryData o = {r1, r2, r3};
+  QueryData n = {r1_changed, r2, r4};
+
+  // Without a key a changed row is removed and added.
+  auto results = diff(o, n, {});
+  EXPECT_EQ(results.added, QueryData({r1_changed, r4}));
+  EXPECT_EQ(results.removed, QueryData({r1, r3}));
+  EXPECT_TRUE(results.updated.empty());
+
+  // With a key the change is an update holding the key and changed columns.
+  results = diff(o, n, {"pid"});
+  EXPECT_EQ(results.added, QueryData({r4}));
+  EXPECT_EQ(results.removed, QueryData({r3}));
+  ASSERT_EQ(results.updated.size(), 1U);
+  EXPECT_EQ(results.updated[0], Row({{"pid", "1"}, {"state", "R"}}));
+
+  // Rows missing a key column are not paired.
+  results = diff(o, n, {"pid", "missing"});
+  EXPECT_TRUE(results.updated.empty());
+  EXPECT_EQ(results.added.size(), 2U);
+
+  EXPECT_TRUE(diff(n, n, {"pid"}).empty());
+}
+
+TEST_F(ResultsTests, test_hash_row) {
+  Row r1 = {{"ab", "c"}};
+  Row r2 = {{"a", "bc"}};
+  EXPECT_NE(hashRow(r1), hashRow(r2));
+  EXPECT_EQ(hashRow(r1), hashRow(Row({{"ab", "c"}})));
+}
+
 TEST_F(ResultsTests, test_serialize_row) {
   auto results = getSerializedRow();
   pt::ptree tree;
@@ -89,6 +147,77 @@ TEST_F(ResultsTests, test_deserialize_query_data_json) {
   EXPECT_EQ(output, results.second);
 }
 
+TEST_F(ResultsTests, test_serialize_query_data_json_compatibility) {
+  QueryData qd = {
+      {{"escapes", "\"quoted\" a/b\\c\n\t\x01\x7f"}, {"utf8", "\xc3\xa9"}},
+      {},
+      {{"dotted.name", "nested"}, {"dotted", ""}},
+  };
+
+  // The output must match a property tree written with write_json.
+  for (const auto& results : {QueryData(), QueryData({qd[0], qd[1]}), qd}) {
+    pt::ptree tree;
+    serializeQueryData(results, tree);
+    std::ostringstream expected;
+    pt::write_json(expected, tree, false);
+
+    std::string json;
+    auto s = serializeQueryDataJSON(results, json);
+    EXPECT_TRUE(s.ok());
+    EXPECT_EQ(expected.str(), json);
+  }
+}
+
+TEST_F(ResultsTests, test_deserialize_query_data_json_values) {
+  std::string json =
+      "[{\"a\": 1.5e+2, \"b\": true, \"c\": null, \"d\": {\"e\": \"f\"},"
+      " \"\": \"g\", \"h\": \"\\u00e9\\ud83d\\ude00\\/\"}, \"\"]";
+
+  // Non-string values keep their text, nested values are empty.
+  QueryData output;
+  auto s = deserializeQueryDataJSON(json, output);
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(output.size(), 2U);
+  EXPECT_EQ(output[0],
+            Row({{"a", "1.5e+2"},
+                 {"b", "true"},
+                 {"c", "null"},
+                 {"d", ""},
+                 {"h", "\xc3\xa9\xf0\x9f\x98\x80/"}}));
+  EXPECT_TRUE(output[1].empty());
+
+  // Malformed content does not modify the output.
+  for (const auto& malformed : {"", "[{\"a\": 01}]", "[{\"a\" \"b\"}]",
+                                "[{\"a\": \"\\ud83d\"}]", "{} {}"}) {
+    QueryData partial;
+    s = deserializeQueryDataJSON(malformed, partial);
+    EXPECT_FALSE(s.ok());
+    EXPECT_TRUE(partial.empty());
+  }
+}
+
+TEST_F(ResultsTests, test_deserialize_tree_json) {
+  std::string json =
+      "{\"a\": {\"b\": [1, {\"c\": null}, []]}, \"a\": \"\\u00e9\"}";
+
+  // The tree matches a property tree read with read_json.
+  pt::ptree expected;
+  std::stringstream input(json);
+  pt::read_json(input, expected);
+  pt::ptree tree;
+  auto s = deserializeTreeJSON(json.data(), json.size(), tree);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(expected, tree);
+
+  // Comment lines are only allowed when requested.
+  std::string comments = "# comment\n{\n  // comment\n  \"a\": 1\n}\n";
+  s = deserializeTreeJSON(comments.data(), comments.size(), tree);
+  EXPECT_FALSE(s.ok());
+  s = deserializeTreeJSON(comments.data(), comments.size(), tree, true);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(tree.get<std::string>("a"), "1");
+}
+
 TEST_F(ResultsTests, test_serialize_diff_results) {
   auto results = getSerializedDiffResults();
   pt::ptree tree;
@@ -125,6 +254,172 @@ TEST_F(ResultsTests, test_serialize_query_log_item_json) {
   EXPECT_EQ(results.first, json);
 }
 
+TEST_F(ResultsTests, test_serialize_query_log_item_events) {
+  auto results = getSerializedQueryLogItem();
+  std::vector<std::string> events;
+  auto s = serializeQueryLogItemAsEventsJSON(results.second, events);
+  EXPECT_TRUE(s.ok());
+
+  // The callback receives the same events without the trailing newline.
+  std::vector<std::string> streamed;
+  s = serializeQueryLogItemAsEventsJSON(
+      results.second,
+      [&streamed](const std::string& event) { streamed.push_back(event); });
+  EXPECT_TRUE(s.ok());
+  ASSERT_EQ(events.size(), streamed.size());
+  for (size_t i = 0; i < events.size(); i++) {
+    EXPECT_EQ(events[i], streamed[i] + '\n');
+  }
+}
+
+TEST_F(ResultsTests, test_serialize_query_log_item_events_updated) {
+  QueryLogItem item;
+  item.name = "processes";
+  item.identifier = "host";
+  item.time = 1;
+  item.results.updated.push_back({{"pid", "1"}, {"state", "R"}});
+
+  std::vector<std::string> events;
+  EXPECT_TRUE(serializeQueryLogItemAsEventsJSON(item, events));
+  ASSERT_EQ(events.size(), 1U);
+  EXPECT_NE(events[0].find("\"action\":\"updated\""), std::string::npos);
+  EXPECT_NE(events[0].find("\"columns\":{\"pid\":\"1\",\"state\":\"R\"}"),
+            std::string::npos);
+
+  // The batch format only includes updated rows when there are any.
+  std::string json;
+  EXPECT_TRUE(serializeQueryLogItemJSON(item, json));
+  QueryLogItem output;
+  EXPECT_TRUE(deserializeQueryLogItemJSON(json, output));
+  EXPECT_EQ(output.results, item.results);
+
+  item.results.updated.clear();
+  item.results.added.push_back({{"pid", "2"}});
+  EXPECT_TRUE(serializeQueryLogItemJSON(item, json));
+  EXPECT_EQ(json.find("updated"), std::string::npos);
+}
+
+TEST_F(ResultsTests, test_serialize_query_log_item_msgpack) {
+  QueryLogItem item;
+  item.name = "n";
+  item.identifier = "h";
+  item.calendar_time = "c";
+  item.time = 1;
+  item.results.added.push_back({{"a", "1"}});
+
+  std::string data;
+  auto s = serializeQueryLogItemMsgPack(item, data);
+  EXPECT_TRUE(s.ok());
+  std::string expected =
+      "\x85\xab"
+      "diffResults"
+      "\x82\xa5"
+      "added"
+      "\x91\x81\xa1"
+      "a"
+      "\xa1"
+      "1"
+      "\xa7"
+      "removed"
+      "\x90\xa4"
+      "name"
+      "\xa1"
+      "n"
+      "\xae"
+      "hostIdentifier"
+      "\xa1"
+      "h"
+      "\xac"
+      "calendarTime"
+      "\xa1"
+      "c"
+      "\xa8"
+      "unixTime"
+      "\x01";
+  EXPECT_EQ(expected, data);
+
+  // The same item is encoded once for each requested encoding.
+  std::string encoded;
+  s = serializeQueryLogItemAs(item, RESULT_ENCODING_MSGPACK, encoded);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(data, encoded);
+}
+
+TEST_F(ResultsTests, test_serialize_query_log_item_protobuf) {
+  QueryLogItem item;
+  item.name = "n";
+  item.identifier = "h";
+  item.calendar_time = "c";
+  item.time = 1;
+  item.results.added.push_back({{"a", "1"}});
+
+  std::string data;
+  auto s = serializeQueryLogItemProtobuf(item, data);
+  EXPECT_TRUE(s.ok());
+  std::string expected =
+      "\x0a\x01"
+      "n"
+      "\x12\x01"
+      "h"
+      "\x1a\x01"
+      "c"
+      "\x20\x01\x32\x0a\x0a\x08\x0a\x06\x0a\x01"
+      "a"
+      "\x12\x01"
+      "1";
+  EXPECT_EQ(expected, data);
+
+  // Encoded results are wrapped with request fields into a batch.
+  std::string batch;
+  s = serializeResultBatch(
+      RESULT_ENCODING_PROTOBUF, {{"k", "v"}}, {data, data}, batch);
+  EXPECT_TRUE(s.ok());
+  std::string item_field = "\x12\x17" + data;
+  EXPECT_EQ(
+      "\x0a\x06\x0a\x01"
+      "k"
+      "\x12\x01"
+      "v" +
+          item_field + item_field,
+      batch);
+}
+
+TEST_F(ResultsTests, test_serialize_result_batch_json) {
+  // Lines are spliced without parsing, lines that are not objects are skipped.
+  std::vector<std::string> items = {
+      "{\"a\":\"1\",\"b\":[{\"c\":\"}\"}]}\n",
+      "not json",
+      "{\"a\":[}",
+      "{\"a\":\"2\"} {}",
+      "  {\"a\":\"\\\"\"}",
+  };
+  std::string batch;
+  auto s = serializeResultBatch(
+      RESULT_ENCODING_JSON, {{"node_key", "k\""}}, items, batch);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(
+      "{\"node_key\":\"k\\\"\",\"data\":[{\"a\":\"1\",\"b\":[{\"c\":\"}\"}]},"
+      "{\"a\":\"\\\"\"}]}\n",
+      batch);
+
+  // The batch is valid JSON.
+  pt::ptree tree;
+  EXPECT_TRUE(deserializeTreeJSON(batch.data(), batch.size(), tree).ok());
+  EXPECT_EQ(tree.get_child("data").size(), 2U);
+}
+
+TEST_F(ResultsTests, test_result_encoding_names) {
+  ResultEncoding encoding;
+  EXPECT_TRUE(getResultEncoding("msgpack", encoding));
+  EXPECT_EQ(encoding, RESULT_ENCODING_MSGPACK);
+  EXPECT_EQ(getResultContentType(encoding), "application/msgpack");
+  EXPECT_TRUE(getResultEncoding("protobuf", encoding));
+  EXPECT_EQ(encoding, RESULT_ENCODING_PROTOBUF);
+  EXPECT_TRUE(getResultEncoding("json", encoding));
+  EXPECT_EQ(getResultContentType(encoding), "application/json");
+  EXPECT_FALSE(getResultEncoding("xml", encoding));
+}
+
 TEST_F(ResultsTests, test_deserialize_query_log_item_json) {
   auto results = getSerializedQueryLogItemJSON();
 
@@ -136,6 +431,34 @@ TEST_F(ResultsTests, test_deserialize_query_log_item_json) {
   EXPECT_EQ(output, results.second);
 }
 
+TEST_F(ResultsTests, test_serialize_snapshot_chunk) {
+  QueryLogItem item;
+  item.name = "snapshot";
+  item.identifier = "host";
+  item.time = 1;
+  item.calendar_time = "time";
+  item.snapshot_results = {{{"a", "b"}}};
+  item.chunk = 1;
+  item.chunks = 3;
+
+  // The chunk sequence is written the same by either serializer.
+  std::string json;
+  ASSERT_TRUE(serializeQueryLogItemJSON(item, json));
+  EXPECT_NE(json.find("\"chunk\":\"1\",\"chunks\":\"3\""),
+            std::string::npos);
+
+  pt::ptree tree;
+  ASSERT_TRUE(serializeQueryLogItem(item, tree));
+  std::ostringstream output;
+  pt::write_json(output, tree, false);
+  EXPECT_EQ(output.str(), json);
+
+  QueryLogItem parsed;
+  ASSERT_TRUE(deserializeQueryLogItemJSON(json, parsed));
+  EXPECT_EQ(parsed.chunk, 1U);
+  EXPECT_EQ(parsed.chunks, 3U);
+}
+
 TEST_F(ResultsTests, test_adding_duplicate_rows_to_query_data) {
   Row r1, r2, r3;
   r1["foo"] = "bar";
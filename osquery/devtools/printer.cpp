@@ -91,12 +91,12 @@ std::string generateRow(const Row& r,
       size = column.size() - utf8StringSize(FLAGS_nullvalue);
       out += FLAGS_nullvalue;
     } else {
-      int buffer_size =
-          static_cast<int>(lengths.at(column) - utf8StringSize(r.at(column)));
-      if (buffer_size >= 0) {
-        size = static_cast<size_t>(buffer_size);
-        out += r.at(column);
-      }
+      int buffer_size = static_cast<int>(lengths.at(column)) -
+                        static_cast<int>(utf8StringSize(r.at(column)));
+      // A value wider than its column, which was sized from a sample of the
+      // rows, is printed without padding.
+      size = (buffer_size > 0) ? static_cast<size_t>(buffer_size) : 0;
+      out += r.at(column);
     }
     out += std::string(size + 1, ' ');
   }
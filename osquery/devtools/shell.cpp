@@ -42,6 +42,7 @@
 
 #include "osquery/devtools/devtools.h"
 #include "osquery/filesystem/fileops.h"
+#include "osquery/sql/table_stats.h"
 #include "osquery/sql/virtual_table.h"
 
 #if defined(SQLITE_ENABLE_WHERETRACE)
@@ -60,6 +61,14 @@ SHELL_FLAG(bool, list, false, "Set output mode to 'list'");
 SHELL_FLAG(string, separator, "|", "Set output field separator, default '|'");
 SHELL_FLAG(bool, header, true, "Toggle column headers true/false");
 SHELL_FLAG(string, pack, "", "Run all queries in a pack");
+SHELL_FLAG(bool,
+           profile,
+           false,
+           "Print the generate statistics of each table after a query");
+SHELL_FLAG(uint64,
+           pretty_sample,
+           1000,
+           "Rows used to size pretty columns before printing as rows arrive");
 
 /// Define short-hand shell switches.
 SHELL_FLAG(bool, L, false, "List all table names");
@@ -84,9 +93,11 @@ static char zHelp[] =
     "                     column   Left-aligned columns.  (See .width)\n"
     "                     line     One value per line\n"
     "                     list     Values delimited by .separator string\n"
+    "                     json     JSON array of rows\n"
     "                     pretty   Pretty printed SQL results (default)\n"
     ".nullvalue STR     Use STRING in place of NULL values\n"
     ".print STR...      Print literal STRING\n"
+    ".profile ON|OFF    Print table generate statistics after each query\n"
     ".quit              Exit this program\n"
     ".schema [TABLE]    Show the CREATE statements\n"
     ".separator STR     Change separator used by output mode and .import\n"
@@ -106,9 +117,10 @@ static char zTimerHelp[] =
 #define MODE_Semi 3 // Same as MODE_List but append ";" to each line
 #define MODE_Csv 4 // Quote strings, numbers are plain
 #define MODE_Pretty 5 // Pretty print the SQL results
+#define MODE_Json 6 // A JSON array with an object per row
 
 static const char* modeDescr[] = {
-    "line", "column", "list", "semi", "csv", "pretty",
+    "line", "column", "list", "semi", "csv", "pretty", "json",
 };
 
 // ctype macros that work with signed characters
@@ -328,11 +340,39 @@ static char* one_input_line(FILE* in, char* zPrior, int isContinuation) {
 ** Pretty print structure
  */
 struct prettyprint_data {
+  /// Rows buffered to compute the column lengths.
   osquery::QueryData results;
   std::vector<std::string> columns;
   std::map<std::string, size_t> lengths;
+
+  /// Set when the header is printed and rows are printed as they arrive.
+  bool streaming{false};
+
+  /// The separator printed around the header and after the last row.
+  std::string separator;
+
+  /// Rows printed in JSON mode.
+  size_t json_rows{0};
 };
 
+/// Print the header and the buffered rows, later rows are printed directly.
+static void prettyStream(struct prettyprint_data* pp) {
+  // Columns are at least as wide as their names.
+  if (!pp->results.empty()) {
+    osquery::computeRowLengths(pp->results.front(), pp->lengths, true);
+  }
+  pp->separator = osquery::generateToken(pp->lengths, pp->columns);
+  auto header = pp->separator +
+                osquery::generateHeader(pp->lengths, pp->columns) +
+                pp->separator;
+  printf("%s", header.c_str());
+  for (const auto& row : pp->results) {
+    printf("%s", osquery::generateRow(row, pp->lengths, pp->columns).c_str());
+  }
+  osquery::QueryData().swap(pp->results);
+  pp->streaming = true;
+}
+
 /*
 ** An pointer to an instance of this structure is passed from
 ** the main program to the callback.  This is used to communicate
@@ -498,6 +538,25 @@ static int shell_callback(
   struct callback_data* p = (struct callback_data*)pArg;
 
   switch (p->mode) {
+  case MODE_Json: {
+    osquery::Row r;
+    for (i = 0; i < nArg; ++i) {
+      if (azCol[i] != nullptr) {
+        r[std::string(azCol[i])] = (azArg[i] == nullptr)
+                                       ? osquery::FLAGS_nullvalue
+                                       : std::string(azArg[i]);
+      }
+    }
+
+    std::string row_string;
+    if (osquery::serializeRowJSON(r, row_string).ok()) {
+      row_string.pop_back();
+      printf("%s  %s",
+             (p->prettyPrint->json_rows++ == 0) ? "[\n" : ",\n",
+             row_string.c_str());
+    }
+    break;
+  }
   case MODE_Pretty: {
     if (p->prettyPrint->columns.size() == 0) {
       for (i = 0; i < nArg; i++) {
@@ -513,8 +572,20 @@ static int shell_callback(
                                        : std::string(azArg[i]);
       }
     }
+    if (p->prettyPrint->streaming) {
+      // Values wider than the sampled column lengths are not padded.
+      printf("%s",
+             osquery::generateRow(
+                 r, p->prettyPrint->lengths, p->prettyPrint->columns)
+                 .c_str());
+      break;
+    }
+
     osquery::computeRowLengths(r, p->prettyPrint->lengths);
-    p->prettyPrint->results.push_back(r);
+    p->prettyPrint->results.push_back(std::move(r));
+    if (p->prettyPrint->results.size() >= osquery::FLAGS_pretty_sample) {
+      prettyStream(p->prettyPrint);
+    }
     break;
   }
   case MODE_Line: {
@@ -754,6 +825,40 @@ static char* save_err_msg(sqlite3* db) {
 ** function except it takes a slightly different callback
 ** and callback data argument.
 */
+/*
+** Print the table statistics collected while executing a query, and the
+** high-water mark of SQLite's memory use.
+*/
+static void print_profile() {
+  auto tables = osquery::QueryProfile::instance().stop();
+  int current = 0;
+  int highwater = 0;
+  sqlite3_status(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 0);
+
+  const std::vector<std::string> columns = {
+      "table", "filters", "cached", "generated", "consumed", "ms", "bytes"};
+  osquery::QueryData rows;
+  std::map<std::string, size_t> lengths;
+  for (const auto& table : tables) {
+    const auto& stats = table.second;
+    osquery::Row r;
+    r["table"] = table.first;
+    r["filters"] = std::to_string(stats.filters);
+    r["cached"] = std::to_string(stats.cached);
+    r["generated"] = std::to_string(stats.generated);
+    r["consumed"] = std::to_string(stats.consumed);
+    char ms[32];
+    snprintf(ms, sizeof(ms), "%.3f", stats.generate_time / 1000.0);
+    r["ms"] = ms;
+    r["bytes"] = std::to_string(stats.bytes);
+    osquery::computeRowLengths(r, lengths);
+    rows.push_back(std::move(r));
+  }
+
+  osquery::prettyPrint(rows, columns, lengths);
+  printf("SQLite memory high-water: %d bytes\n", highwater);
+}
+
 static int shell_exec(
     const char* zSql, /* SQL to be evaluated */
     int (*xCallback)(void*, int, char**, char**, int*), /* Callback function */
@@ -774,6 +879,15 @@ static int shell_exec(
     *pzErrMsg = nullptr;
   }
 
+  bool profile = osquery::FLAGS_profile;
+  if (profile) {
+    // Count each table scan, and reset SQLite's memory high-water mark.
+    int current = 0;
+    int highwater = 0;
+    sqlite3_status(SQLITE_STATUS_MEMORY_USED, &current, &highwater, 1);
+    osquery::QueryProfile::instance().start();
+  }
+
   while (zSql[0] && (SQLITE_OK == rc)) {
     rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, &zLeftover);
     if (SQLITE_OK != rc) {
@@ -880,8 +994,8 @@ static int shell_exec(
   dbc->clearAffectedTables();
 
   if (pArg && pArg->mode == MODE_Pretty) {
-    if (osquery::FLAGS_json) {
-      osquery::jsonPrint(pArg->prettyPrint->results);
+    if (pArg->prettyPrint->streaming) {
+      printf("%s", pArg->prettyPrint->separator.c_str());
     } else {
       osquery::prettyPrint(pArg->prettyPrint->results,
                            pArg->prettyPrint->columns,
@@ -890,8 +1004,16 @@ static int shell_exec(
     pArg->prettyPrint->results.clear();
     pArg->prettyPrint->columns.clear();
     pArg->prettyPrint->lengths.clear();
+    pArg->prettyPrint->streaming = false;
+  } else if (pArg && pArg->mode == MODE_Json) {
+    // The rows of every statement are one array, as the rows were buffered.
+    printf("%s\n]\n", (pArg->prettyPrint->json_rows == 0) ? "[\n" : "");
+    pArg->prettyPrint->json_rows = 0;
   }
 
+  if (profile) {
+    print_profile();
+  }
   return rc;
 }
 
@@ -1204,13 +1326,15 @@ static int do_meta_command(char* zLine, struct callback_data* p) {
       p->mode = MODE_List;
     } else if (n2 == 6 && strncmp(azArg[1], "pretty", n2) == 0) {
       p->mode = MODE_Pretty;
+    } else if (n2 == 4 && strncmp(azArg[1], "json", n2) == 0) {
+      p->mode = MODE_Json;
     } else if (n2 == 3 && strncmp(azArg[1], "csv", n2) == 0) {
       p->mode = MODE_Csv;
       sqlite3_snprintf(sizeof(p->separator), p->separator, ",");
     } else {
       fprintf(stderr,
               "Error: mode should be one of: "
-              "column csv line list pretty\n");
+              "column csv json line list pretty\n");
       rc = 1;
     }
   } else if (c == 'n' && strncmp(azArg[0], "nullvalue", n) == 0 && nArg == 2) {
@@ -1219,6 +1343,9 @@ static int do_meta_command(char* zLine, struct callback_data* p) {
                      "%.*s",
                      ArraySize(p->nullvalue) - 1,
                      azArg[1]);
+  } else if (c == 'p' && n >= 3 && strncmp(azArg[0], "profile", n) == 0 &&
+             nArg == 2) {
+    osquery::FLAGS_profile = booleanValue(azArg[1]);
   } else if (c == 'p' && n >= 3 && strncmp(azArg[0], "print", n) == 0) {
     int i;
     for (i = 1; i < nArg; i++) {
@@ -1243,6 +1370,10 @@ static int do_meta_command(char* zLine, struct callback_data* p) {
     fprintf(p->out, "%9.9s: %s\n", "echo", p->echoOn ? "on" : "off");
     fprintf(p->out, "%9.9s: %s\n", "headers", p->showHeader ? "on" : "off");
     fprintf(p->out, "%9.9s: %s\n", "mode", modeDescr[p->mode]);
+    fprintf(p->out,
+            "%9.9s: %s\n",
+            "profile",
+            osquery::FLAGS_profile ? "on" : "off");
     fprintf(p->out, "%9.9s: ", "nullvalue");
     output_c_string(p->out, p->nullvalue);
     fprintf(p->out, "\n");
@@ -1523,6 +1654,8 @@ int launchIntoShell(int argc, char** argv) {
   } else if (FLAGS_csv) {
     data.mode = MODE_Csv;
     data.separator[0] = ',';
+  } else if (FLAGS_json) {
+    data.mode = MODE_Json;
   } else {
     data.mode = MODE_Pretty;
   }
@@ -95,6 +95,14 @@ TEST_F(PrinterTests, test_generate_row) {
   EXPECT_EQ(results, expected);
 }
 
+TEST_F(PrinterTests, test_generate_row_wider_value) {
+  // Columns sized from a sample of rows may be narrower than later values.
+  std::map<std::string, size_t> lengths = {{"name", 4}};
+  Row r = {{"name", "Mike Jones"}};
+  auto results = generateRow(r, lengths, {"name"});
+  EXPECT_EQ(results, "| Mike Jones |\n");
+}
+
 TEST_F(PrinterTests, test_unicode) {
   Row r = {{"name", "Àlex Smith"}};
   std::map<std::string, size_t> lengths;
@@ -22,6 +22,73 @@ namespace osquery {
 /// The worker_threads define the default thread pool size.
 FLAG(int32, worker_threads, 4, "Number of work dispatch threads");
 
+FLAG(bool,
+     thread_roles,
+     false,
+     "Apply the priority and CPU affinity of each service thread's role");
+
+FLAG(int32,
+     thread_latency_nice,
+     0,
+     "Nice level (-20 to 19) of latency-sensitive threads such as event "
+     "publishers");
+
+FLAG(string,
+     thread_latency_cpus,
+     "",
+     "CPUs for latency-sensitive threads, such as 0-1,4 (default any)");
+
+FLAG(int32,
+     thread_best_effort_nice,
+     19,
+     "Nice level (-20 to 19) of scheduled and distributed query threads");
+
+FLAG(string,
+     thread_best_effort_cpus,
+     "",
+     "CPUs for scheduled and distributed query threads (default any)");
+
+/// Parse a list of CPU indexes and ranges, such as 0-1,4.
+static bool parseCPUList(const std::string& list, std::vector<size_t>& cpus) {
+  for (const auto& item : split(list, ",")) {
+    auto range = split(item, "-");
+    unsigned long long first = 0;
+    unsigned long long last = 0;
+    if (range.empty() || range.size() > 2 ||
+        !safeStrtoull(range.front(), 10, first).ok() ||
+        !safeStrtoull(range.back(), 10, last).ok() || first > last ||
+        last >= 1024) {
+      return false;
+    }
+    for (auto cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(static_cast<size_t>(cpu));
+    }
+  }
+  return true;
+}
+
+void applyThreadRole(ThreadRole role) {
+  if (!FLAGS_thread_roles || role == ThreadRole::NORMAL) {
+    return;
+  }
+
+  auto latency = (role == ThreadRole::LATENCY);
+  const auto& list =
+      (latency) ? FLAGS_thread_latency_cpus : FLAGS_thread_best_effort_cpus;
+  std::vector<size_t> cpus;
+  if (!parseCPUList(list, cpus)) {
+    LOG(WARNING) << "Invalid thread CPU list: " << list;
+    cpus.clear();
+  }
+
+  auto nice =
+      (latency) ? FLAGS_thread_latency_nice : FLAGS_thread_best_effort_nice;
+  auto status = setThreadPriority(nice, cpus);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot apply the thread role: " << status.getMessage();
+  }
+}
+
 /// Cancel the pause request.
 void RunnerInterruptPoint::cancel() {
   WriteLock lock(mutex_);
@@ -69,6 +136,7 @@ void InterruptableRunnable::pauseMilli(std::chrono::milliseconds milli) {
 
 void InternalRunnable::run() {
   run_ = true;
+  applyThreadRole(role());
   start();
 
   // The service is complete.
@@ -8,6 +8,8 @@
  *
  */
 
+#include <algorithm>
+
 #include <osquery/database.h>
 #include <osquery/distributed.h>
 #include <osquery/flags.h>
@@ -23,18 +25,57 @@ FLAG(uint64,
      60,
      "Seconds between polling for new queries (default 60)")
 
+FLAG(uint64,
+     distributed_long_poll,
+     0,
+     "Seconds a distributed read may wait for new queries (default 0)");
+
 DECLARE_bool(disable_distributed);
 DECLARE_string(distributed_plugin);
 
 const size_t kDistributedAccelerationInterval = 5;
 
+size_t getDistributedRetryPause(size_t failures) {
+  // Back off exponentially up to the polling interval.
+  size_t limit =
+      std::max(static_cast<size_t>(FLAGS_distributed_interval), size_t(1)) *
+      1000;
+  size_t pause = 1000;
+  for (size_t i = 1; i < failures && pause < limit; i++) {
+    pause *= 2;
+  }
+  pause = std::min(pause, limit);
+
+  // Spread reconnecting hosts over the second half of the pause.
+  return pause / 2 + static_cast<size_t>(rand()) % (pause / 2 + 1);
+}
+
 void DistributedRunner::start() {
   auto dist = Distributed();
+  size_t failures = 0;
   while (!interrupted()) {
-    dist.pullUpdates();
-    if (dist.getPendingQueryCount() > 0) {
+    auto started = getUnixTime();
+    auto status = dist.pullUpdates();
+    auto pending = dist.getPendingQueryCount();
+    if (pending > 0) {
       dist.runQueries();
     }
+
+    if (FLAGS_distributed_long_poll > 0) {
+      if (!status.ok()) {
+        // Reconnect with jitter so hosts do not return at the same time.
+        pauseMilli(getDistributedRetryPause(++failures));
+        continue;
+      }
+
+      // The server returned work or held the read open, read again now.
+      // A server without long-poll support returns at once and is polled.
+      failures = 0;
+      if (pending > 0 || getUnixTime() > started) {
+        continue;
+      }
+    }
+
     std::string str_acu = "0";
     Status database = getDatabaseValue(
         kPersistentSettings, "distributed_accelerate_checkins_expire", str_acu);
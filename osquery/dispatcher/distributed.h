@@ -22,8 +22,25 @@ class DistributedRunner : public InternalRunnable {
 
  public:
   /// The Dispatcher thread entry point.
-  void start();
+  void start() override;
+
+ protected:
+  /// Distributed queries run best-effort, like scheduled queries.
+  ThreadRole role() const override {
+    return ThreadRole::BEST_EFFORT;
+  }
 };
 
+/**
+ * @brief The milliseconds to wait before reconnecting a long-poll read.
+ *
+ * The pause doubles for each consecutive failure, starting at 1 second, and
+ * is limited to the distributed interval. A random jitter of up to half the
+ * pause is removed.
+ *
+ * @param failures The number of consecutive failed reads.
+ */
+size_t getDistributedRetryPause(size_t failures);
+
 Status startDistributed();
 }
@@ -8,66 +8,497 @@
  *
  */
 
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cctype>
 #include <ctime>
+#include <tuple>
 
 #include <osquery/config.h>
 #include <osquery/core.h>
 #include <osquery/database.h>
+#include <osquery/events.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/packs.h>
 #include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
 #include "osquery/core/process.h"
+#include "osquery/core/query_deadline.h"
+#include "osquery/core/work_shard.h"
 #include "osquery/database/query.h"
 #include "osquery/dispatcher/scheduler.h"
+#include "osquery/sql/table_cache.h"
 
 namespace osquery {
 
+DECLARE_uint64(decorations_ttl);
+DECLARE_bool(watchdog_kernel_limits);
+DECLARE_uint64(watchdog_pressure_percent);
+
 FLAG(bool, enable_monitor, false, "Enable the schedule monitor");
 
 FLAG(uint64, schedule_timeout, 0, "Limit the schedule, 0 for no limit")
 
-SQLInternal monitor(const std::string& name, const ScheduledQuery& query) {
-  // Snapshot the performance and times for the worker before running.
-  auto pid = std::to_string(PlatformProcess::getCurrentProcess()->pid());
-  auto r0 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  auto t0 = getUnixTime();
-  Config::getInstance().recordQueryStart(name);
-  auto sql = SQLInternal(query.query);
+FLAG(uint64,
+     schedule_step_budget,
+     0,
+     "Average CPU time of queries started per schedule step (default 0 "
+     "disables)");
+
+FLAG(uint64,
+     schedule_workers,
+     0,
+     "Number of scheduled query worker threads (default 0 runs in series)");
+
+FLAG(uint64,
+     schedule_query_timeout,
+     0,
+     "Seconds a scheduled query may run before it is cancelled (default 0 "
+     "for no limit)");
+
+FLAG(uint64,
+     schedule_reconcile_interval,
+     3600,
+     "Seconds an incremental query is skipped while its feeds are unchanged");
+
+FLAG(uint64,
+     snapshot_chunk_rows,
+     0,
+     "Maximum rows in each snapshot log item (default 0 for no limit)");
+
+FLAG(uint64,
+     snapshot_chunk_bytes,
+     0,
+     "Approximate maximum bytes in each snapshot log item (default 0 for no "
+     "limit)");
+
+FLAG(bool,
+     schedule_dedup,
+     true,
+     "Run scheduled queries with the same statement once per schedule step");
+
+FLAG(uint64,
+     schedule_release_rows,
+     10000,
+     "Release freed memory after a query with this many rows (0 disables)");
+
+/**
+ * @brief Release a large result set's memory when a query completes.
+ *
+ * The rows of a scheduled query are copied between the SQL results, the
+ * differential, and the log item, then freed together when launchQuery
+ * returns. Declared first, the scope is destroyed after every container.
+ */
+class QueryMemoryScope : private boost::noncopyable {
+ public:
+  ~QueryMemoryScope() {
+    if (FLAGS_schedule_release_rows > 0 &&
+        rows >= FLAGS_schedule_release_rows) {
+      releaseFreedMemory();
+    }
+  }
+
+  /// The number of rows returned by the query.
+  size_t rows{0};
+};
+
+/// Run a query using a worker's connection or the primary connection.
+static inline SQLInternal runInternal(const std::string& query,
+                                      const SQLiteDBInstanceRef& instance) {
+  return (instance != nullptr) ? SQLInternal(query, instance)
+                               : SQLInternal(query);
+}
+
+/// The calling thread's user and system time in milliseconds, 0 if unknown.
+static size_t getThreadCPUTime() {
+  ProcessResourceUsage usage;
+  if (!PlatformProcess::getThreadResourceUsage(usage).ok()) {
+    return 0;
+  }
+  auto time = usage.user_time + usage.system_time;
+#ifdef __linux__
+  // Linux reports clock ticks, like the times in /proc/<pid>/stat.
+  static const auto ticks = static_cast<uint64_t>(::sysconf(_SC_CLK_TCK));
+  time = time * 1000 / ticks;
+#endif
+  return static_cast<size_t>(time);
+}
+
+/// The expected byte output of a result row.
+static inline size_t getRowSize(const Row& row) {
+  size_t size = 0;
+  for (const auto& column : row) {
+    size += column.first.size();
+    size += column.second.size();
+  }
+  return size;
+}
+
+/// A FNV-1a hash of a row's content, stable across executions and hosts.
+static inline uint64_t getRowHash(const Row& row) {
+  uint64_t hash = 14695981039346656037ULL;
+  auto update = [&hash](const std::string& value) {
+    for (const auto& c : value) {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ULL;
+    }
+    // Delimit each name and value.
+    hash ^= 0xFF;
+    hash *= 1099511628211ULL;
+  };
+
+  for (const auto& column : row) {
+    update(column.first);
+    update(column.second);
+  }
+  return hash;
+}
+
+/// Remove rows outside of the sample or beyond the remaining output limits.
+static size_t limitRows(const ScheduledQuery& query,
+                        QueryData& rows,
+                        size_t& count,
+                        size_t& bytes,
+                        bool& full) {
+  size_t kept = 0;
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (full) {
+      break;
+    } else if (query.sample > 1 && getRowHash(rows[i]) % query.sample != 0) {
+      continue;
+    }
+
+    auto size = getRowSize(rows[i]);
+    if ((query.max_rows > 0 && count >= query.max_rows) ||
+        (query.max_bytes > 0 && bytes + size > query.max_bytes)) {
+      // The results are truncated at the first row over a limit.
+      full = true;
+      break;
+    }
+
+    count++;
+    bytes += size;
+    if (kept != i) {
+      rows[kept] = std::move(rows[i]);
+    }
+    kept++;
+  }
+
+  auto suppressed = rows.size() - kept;
+  rows.erase(rows.begin() + kept, rows.end());
+  return suppressed;
+}
+
+size_t limitQueryResults(const ScheduledQuery& query, QueryLogItem& item) {
+  if (query.max_rows == 0 && query.max_bytes == 0 && query.sample <= 1) {
+    return 0;
+  }
+
+  size_t count = 0;
+  size_t bytes = 0;
+  bool full = false;
+  auto suppressed =
+      limitRows(query, item.snapshot_results, count, bytes, full);
+  suppressed += limitRows(query, item.results.added, count, bytes, full);
+  suppressed += limitRows(query, item.results.removed, count, bytes, full);
+  suppressed += limitRows(query, item.results.updated, count, bytes, full);
+  return suppressed;
+}
+
+SQLInternal monitor(const std::string& name,
+                    const ScheduledQuery& query,
+                    const SQLiteDBInstanceRef& instance,
+                    const std::vector<std::string>& shared) {
+  std::vector<std::string> names = {name};
+  names.insert(names.end(), shared.begin(), shared.end());
+
+  // Snapshot the performance and times for the query's thread before running.
+  // Queries on other workers and event publishers run concurrently, so the
+  // thread's CPU times are used when available. Otherwise the process usage
+  // is sampled, and platforms without a resource usage API select from the
+  // processes table.
+  auto process = PlatformProcess::getCurrentProcess();
+  auto pid = std::to_string(process->pid());
+  ProcessResourceUsage t0, t1, u0, u1;
+  QueryData r0, r1;
+  bool threaded = PlatformProcess::getThreadResourceUsage(t0).ok();
+  bool allocated = threaded && t0.allocated_size > 0;
+  bool sampled = !allocated && process->getResourceUsage(u0).ok();
+  if (!sampled && !threaded) {
+    r0 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
+  }
+  auto w0 = getUnixTime();
+  for (const auto& n : names) {
+    Config::getInstance().recordQueryStart(n);
+  }
+  auto sql = [&query, &instance]() {
+    // Tables scanning a shared dataset skip items outside this host's slice.
+    WorkShardScope shard(query.split_index, query.split);
+    return runInternal(query.query, instance);
+  }();
   // Snapshot the performance after, and compare.
-  auto t1 = getUnixTime();
-  auto r1 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
-  if (r0.size() > 0 && r1.size() > 0) {
-    // Calculate a size as the expected byte output of results.
-    // This does not dedup result differentials and is not aware of snapshots.
-    size_t size = 0;
-    for (const auto& row : sql.rows()) {
-      for (const auto& column : row) {
-        size += column.first.size();
-        size += column.second.size();
-      }
+  auto w1 = getUnixTime();
+  if (threaded) {
+    threaded = PlatformProcess::getThreadResourceUsage(t1).ok();
+  }
+  if (sampled) {
+    sampled = process->getResourceUsage(u1).ok();
+  }
+  if (!sampled && !threaded) {
+    r1 = SQL::selectAllFrom("processes", "pid", EQUALS, pid);
+    if (r0.empty() || r1.empty()) {
+      return sql;
+    }
+  }
+
+  // The expected byte output of results, counted as the rows were read.
+  // This does not dedup result differentials and is not aware of snapshots.
+  size_t size = sql.resultBytes();
+
+  if (!sampled && !threaded) {
+    for (const auto& n : names) {
+      Config::getInstance().recordQueryPerformance(
+          n, w1 - w0, size, r0[0], r1[0]);
     }
-    // Always called while processes table is working.
+    return sql;
+  }
+
+  // Prefer the thread's CPU times, and the allocator's growth over resident
+  // memory, then fall back to the process usage.
+  const auto& cpu0 = (threaded) ? t0 : u0;
+  const auto& cpu1 = (threaded) ? t1 : u1;
+  int64_t memory = 0;
+  if (threaded && allocated) {
+    memory = static_cast<int64_t>(t1.allocated_size) -
+             static_cast<int64_t>(t0.allocated_size);
+  } else if (sampled) {
+    memory = static_cast<int64_t>(u1.resident_size) -
+             static_cast<int64_t>(u0.resident_size);
+  }
+  for (const auto& n : names) {
     Config::getInstance().recordQueryPerformance(
-        name, t1 - t0, size, r0[0], r1[0]);
+        n,
+        w1 - w0,
+        size,
+        static_cast<int64_t>(cpu1.user_time - cpu0.user_time),
+        static_cast<int64_t>(cpu1.system_time - cpu0.system_time),
+        memory);
   }
   return sql;
 }
 
-inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
-  // Execute the scheduled query and create a named query object.
-  LOG(INFO) << "Executing scheduled query: " << name << ": " << query.query;
-  runDecorators(DECORATE_ALWAYS);
-  auto sql =
-      (FLAGS_enable_monitor) ? monitor(name, query) : SQLInternal(query.query);
+std::vector<size_t> getSnapshotChunks(const QueryData& rows,
+                                      size_t max_rows,
+                                      size_t max_bytes) {
+  std::vector<size_t> ends;
+  size_t count = 0;
+  size_t bytes = 0;
+  for (size_t i = 0; i < rows.size(); ++i) {
+    auto size = getRowSize(rows[i]);
+    if (count > 0 && ((max_rows > 0 && count >= max_rows) ||
+                      (max_bytes > 0 && bytes + size > max_bytes))) {
+      ends.push_back(i);
+      count = 0;
+      bytes = 0;
+    }
+    count++;
+    bytes += size;
+  }
 
-  if (!sql.ok()) {
-    LOG(ERROR) << "Error executing scheduled query: " << name << ": "
-               << sql.getMessageString();
+  if (!rows.empty()) {
+    ends.push_back(rows.size());
+  }
+  return ends;
+}
+
+/**
+ * @brief Log a snapshot as a sequence of log items.
+ *
+ * Each chunk's rows are moved out of the snapshot and freed once logged,
+ * so a large snapshot is never serialized into a single log line.
+ */
+static void logSnapshotChunks(QueryLogItem& item) {
+  auto ends = getSnapshotChunks(item.snapshot_results,
+                                FLAGS_snapshot_chunk_rows,
+                                FLAGS_snapshot_chunk_bytes);
+  if (ends.size() <= 1) {
+    logSnapshotQuery(std::move(item));
+    return;
+  }
+
+  size_t start = 0;
+  for (size_t i = 0; i < ends.size(); ++i) {
+    QueryLogItem chunk;
+    chunk.name = item.name;
+    chunk.identifier = item.identifier;
+    chunk.time = item.time;
+    chunk.calendar_time = item.calendar_time;
+    chunk.decorations = item.decorations;
+    chunk.chunk = i;
+    chunk.chunks = ends.size();
+
+    chunk.snapshot_results.reserve(ends[i] - start);
+    for (; start < ends[i]; ++start) {
+      chunk.snapshot_results.push_back(
+          std::move(item.snapshot_results[start]));
+    }
+    logSnapshotQuery(std::move(chunk));
+  }
+  item.snapshot_results.clear();
+}
+
+/// Count rows suppressed by a query's output limits.
+static inline void recordSuppressedRows(const std::string& name,
+                                        size_t suppressed) {
+  if (suppressed > 0) {
+    VLOG(1) << "Output limits suppressed " << suppressed
+            << " rows for query: " << name;
+    Config::getInstance().recordQuerySuppressedRows(name, suppressed);
+  }
+}
+
+std::vector<std::string> IncrementalQueries::feeds(
+    const std::string& name) const {
+  WriteLock lock(mutex_);
+  auto it = queries_.find(name);
+  return (it != queries_.end()) ? it->second.feeds
+                                : std::vector<std::string>();
+}
+
+bool IncrementalQueries::changed(const std::string& name,
+                                 const std::vector<size_t>& versions,
+                                 size_t now) const {
+  WriteLock lock(mutex_);
+  auto it = queries_.find(name);
+  if (it == queries_.end() || it->second.feeds.empty()) {
+    return true;
+  }
+
+  if (now >= it->second.executed + FLAGS_schedule_reconcile_interval) {
+    // Reconcile changes the feeds may have missed.
+    return true;
+  }
+  return versions.empty() || versions != it->second.versions;
+}
+
+void IncrementalQueries::record(const std::string& name,
+                                const std::vector<std::string>& feeds,
+                                const std::vector<size_t>& versions,
+                                size_t now) {
+  WriteLock lock(mutex_);
+  auto& state = queries_[name];
+  state.feeds = feeds;
+  state.versions = versions;
+  state.executed = now;
+}
+
+void IncrementalQueries::clear() {
+  WriteLock lock(mutex_);
+  queries_.clear();
+}
+
+bool getChangeFeedVersions(const std::vector<std::string>& feeds,
+                           std::vector<size_t>& versions) {
+  versions.clear();
+  for (const auto& feed : feeds) {
+    if (!EventFactory::exists(feed)) {
+      return false;
+    }
+
+    auto subscriber = EventFactory::getEventSubscriber(feed);
+    if (subscriber == nullptr || subscriber->state() != SUBSCRIBER_RUNNING) {
+      return false;
+    }
+    versions.push_back(static_cast<size_t>(subscriber->numEvents()));
+  }
+  return true;
+}
+
+std::string normalizeStatement(const std::string& query) {
+  std::string statement;
+  statement.reserve(query.size());
+  char quote = 0;
+  bool space = false;
+  for (const auto& c : query) {
+    if (quote == 0 && isspace(static_cast<unsigned char>(c))) {
+      space = true;
+      continue;
+    }
+
+    if (space && !statement.empty()) {
+      statement += ' ';
+    }
+    space = false;
+    statement += c;
+    if (quote == 0 && (c == '\'' || c == '"')) {
+      quote = c;
+    } else if (c == quote) {
+      // A doubled quote escapes itself and is read as two literals.
+      quote = 0;
+    }
+  }
+
+  while (!statement.empty() &&
+         (statement.back() == ';' || statement.back() == ' ')) {
+    statement.pop_back();
+  }
+  return statement;
+}
+
+void groupDuplicateJobs(std::vector<ScheduledQueryJob>& jobs) {
+  if (!FLAGS_schedule_dedup) {
     return;
   }
 
+  std::map<std::tuple<std::string, size_t, size_t>, size_t> statements;
+  std::vector<ScheduledQueryJob> grouped;
+  for (auto& job : jobs) {
+    if (job.query.options.count("incremental") > 0 &&
+        job.query.options.at("incremental")) {
+      grouped.push_back(std::move(job));
+      continue;
+    }
+
+    auto statement = std::make_tuple(normalizeStatement(job.query.query),
+                                     job.query.split,
+                                     job.query.split_index);
+    auto it = statements.find(statement);
+    if (it == statements.end()) {
+      statements[statement] = grouped.size();
+      grouped.push_back(std::move(job));
+      continue;
+    }
+
+    auto& primary = grouped[it->second];
+    VLOG(1) << "Scheduled query " << job.name << " shares the execution of "
+            << primary.name;
+    primary.duplicates.push_back(
+        std::make_pair(std::move(job.name), std::move(job.query)));
+    primary.packs.insert(
+        primary.packs.end(), job.packs.begin(), job.packs.end());
+    for (auto& duplicate : job.duplicates) {
+      primary.duplicates.push_back(std::move(duplicate));
+    }
+  }
+  jobs.swap(grouped);
+}
+
+/// Diff and log one scheduled query's copy of an execution's results.
+static void logQueryResults(const std::string& name,
+                            const ScheduledQuery& query,
+                            const SQLInternal& sql,
+                            QueryData&& rows,
+                            bool incremental,
+                            std::vector<std::string>& feeds,
+                            std::vector<size_t>& versions) {
+  Config::getInstance().recordQueryCacheResults(
+      name, sql.cacheHits(), sql.cacheMisses());
+
   // Fill in a host identifier fields based on configuration or availability.
   std::string ident = getHostIdentifier();
 
@@ -82,15 +513,16 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
 
   if (query.options.count("snapshot") && query.options.at("snapshot")) {
     // This is a snapshot query, emit results with a differential or state.
-    item.snapshot_results = std::move(sql.rows());
-    logSnapshotQuery(item);
+    item.snapshot_results = std::move(rows);
+    recordSuppressedRows(name, limitQueryResults(query, item));
+    logSnapshotChunks(item);
     return;
   }
 
   // Create a database-backed set of query results.
   auto dbQuery = Query(name, query);
   // Comparisons and stores must include escaped data.
-  sql.escapeResults();
+  SQL::escapeResults(rows);
 
   Status status;
   DiffResults diff_results;
@@ -98,7 +530,7 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   // We can then ask for a differential from the last time this named query
   // was executed by exact matching each row.
   if (!sql.eventBased()) {
-    status = dbQuery.addNewResults(sql.rows(), diff_results);
+    status = dbQuery.addNewResults(std::move(rows), diff_results);
     if (!status.ok()) {
       std::string line =
           "Error adding new results to database: " + status.what();
@@ -106,22 +538,35 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
 
       // If the database is not available then the daemon cannot continue.
       Initializer::requestShutdown(EXIT_CATASTROPHIC, line);
+    } else if (incremental) {
+      if (sql.changeFeeds() != feeds) {
+        // The first execution discovers the feeds of the query's tables.
+        feeds = sql.changeFeeds();
+        getChangeFeedVersions(feeds, versions);
+      }
+      IncrementalQueries::instance().record(name, feeds, versions, item.time);
     }
   } else {
-    diff_results.added = std::move(sql.rows());
+    diff_results.added = std::move(rows);
   }
 
-  if (diff_results.added.empty() && diff_results.removed.empty()) {
+  if (diff_results.empty()) {
     // No diff results or events to emit.
     return;
   }
 
   VLOG(1) << "Found results for query: " << name;
-  item.results = diff_results;
+  item.results = std::move(diff_results);
   if (query.options.count("removed") && !query.options.at("removed")) {
     item.results.removed.clear();
   }
 
+  recordSuppressedRows(name, limitQueryResults(query, item));
+  if (item.results.empty()) {
+    // Every result was suppressed by the output limits.
+    return;
+  }
+
   status = logQueryLogItem(item);
   if (!status.ok()) {
     LOG(ERROR) << "Error logging the results of query: " << name << ": "
@@ -129,18 +574,450 @@ inline void launchQuery(const std::string& name, const ScheduledQuery& query) {
   }
 }
 
+void launchQuery(const std::string& name,
+                 const ScheduledQuery& query,
+                 const SQLiteDBInstanceRef& instance) {
+  ScheduledQueryJob job;
+  job.name = name;
+  job.query = query;
+  launchQuery(job, instance);
+}
+
+void launchQuery(const ScheduledQueryJob& job,
+                 const SQLiteDBInstanceRef& instance) {
+  const auto& name = job.name;
+  const auto& query = job.query;
+  auto incremental =
+      query.options.count("incremental") > 0 && query.options.at("incremental");
+  std::vector<std::string> feeds;
+  std::vector<size_t> versions;
+  if (incremental) {
+    // The feeds are read before the query, events during it are not missed.
+    auto& queries = IncrementalQueries::instance();
+    feeds = queries.feeds(name);
+    if (!feeds.empty() && getChangeFeedVersions(feeds, versions) &&
+        !queries.changed(name, versions, osquery::getUnixTime())) {
+      VLOG(1) << "Change feeds are unchanged, skipping scheduled query: "
+              << name;
+      return;
+    }
+  }
+
+  if (job.launch_step > 0) {
+    // Tables executed by this thread cache relative to the job's step.
+    TablePlugin::kCacheInterval = query.splayed_interval;
+    TablePlugin::kCacheStep = job.launch_step;
+  }
+
+  std::vector<std::string> shared;
+  for (const auto& duplicate : job.duplicates) {
+    shared.push_back(duplicate.first);
+  }
+
+  // Execute the scheduled query and create a named query object.
+  LOG(INFO) << "Executing scheduled query: " << name << ": " << query.query;
+  QueryMemoryScope memory;
+  runDecorators(DECORATE_ALWAYS);
+  auto timeout = (query.timeout > 0) ? query.timeout
+                                     : FLAGS_schedule_query_timeout;
+  bool cancelled = false;
+  // Event subscribers resume from the events this query last returned.
+  EventCursorScope cursors(name);
+  auto cpu = (job.packs.empty()) ? 0 : getThreadCPUTime();
+  auto sql = [&]() {
+    // A runaway query fails at its deadline instead of stalling the worker.
+    QueryDeadlineScope deadline(timeout);
+    auto results = (FLAGS_enable_monitor)
+                       ? monitor(name, query, instance, shared)
+                       : runInternal(query.query, instance);
+    cancelled = isQueryCancelled();
+    return results;
+  }();
+
+  if (!job.packs.empty()) {
+    // Each query sharing the execution is charged to its pack's budget.
+    auto used = getThreadCPUTime();
+    cpu = (used > cpu) ? used - cpu : 0;
+    auto now = getUnixTime();
+    for (const auto& pack : job.packs) {
+      pack->recordUsage(cpu, sql.resultBytes(), now);
+    }
+  }
+
+  if (!sql.ok()) {
+    LOG(ERROR) << "Error executing scheduled query: " << name << ": "
+               << sql.getMessageString();
+    if (cancelled) {
+      Config::getInstance().recordQueryTimeout(name);
+      for (const auto& duplicate : shared) {
+        Config::getInstance().recordQueryTimeout(duplicate);
+      }
+    }
+    return;
+  }
+  memory.rows = sql.rows().size();
+
+  // Each query diffs a copy of the results against its own stored results.
+  for (const auto& duplicate : job.duplicates) {
+    std::vector<std::string> no_feeds;
+    std::vector<size_t> no_versions;
+    logQueryResults(duplicate.first,
+                    duplicate.second,
+                    sql,
+                    QueryData(sql.rows()),
+                    false,
+                    no_feeds,
+                    no_versions);
+  }
+  logQueryResults(
+      name, query, sql, QueryData(sql.rows()), incremental, feeds, versions);
+  cursors.commit();
+}
+
+bool SchedulerQueue::push(ScheduledQueryJob job) {
+  {
+    WriteLock lock(mutex_);
+    if (active_.count(job.name) > 0) {
+      // The query is already queued or running, do not overlap.
+      return false;
+    }
+    for (const auto& duplicate : job.duplicates) {
+      if (active_.count(duplicate.first) > 0) {
+        return false;
+      }
+    }
+    active_.insert(job.name);
+    for (const auto& duplicate : job.duplicates) {
+      active_.insert(duplicate.first);
+    }
+    job.sequence = sequence_++;
+    jobs_.push_back(std::move(job));
+  }
+  condition_.notify_one();
+  return true;
+}
+
+bool SchedulerQueue::pop(ScheduledQueryJob& job,
+                         std::chrono::milliseconds timeout) {
+  std::unique_lock<Mutex> lock(mutex_);
+  if (jobs_.empty()) {
+    condition_.wait_for(lock, timeout);
+    if (jobs_.empty()) {
+      return false;
+    }
+  }
+
+  // Prefer the oldest step, then the lowest expected cost, then queue order.
+  auto next = jobs_.begin();
+  for (auto it = jobs_.begin(); it != jobs_.end(); ++it) {
+    if (std::tie(it->step, it->cost, it->sequence) <
+        std::tie(next->step, next->cost, next->sequence)) {
+      next = it;
+    }
+  }
+  job = std::move(*next);
+  jobs_.erase(next);
+  return true;
+}
+
+void SchedulerQueue::finish(const std::string& name) {
+  WriteLock lock(mutex_);
+  active_.erase(name);
+}
+
+void SchedulerQueue::wake() {
+  condition_.notify_all();
+}
+
+size_t SchedulerQueue::size() const {
+  WriteLock lock(mutex_);
+  return jobs_.size();
+}
+
+void SchedulerWorker::start() {
+  while (!interrupted()) {
+    ScheduledQueryJob job;
+    if (!queue_->pop(job, std::chrono::milliseconds(1000))) {
+      continue;
+    }
+
+    // Each worker owns a connection, recreated if tables were registered.
+    auto tables = Registry::count("table");
+    if (instance_ == nullptr || tables != tables_) {
+      instance_ = SQLiteDBManager::getUnique();
+      tables_ = tables;
+    }
+
+    launchQuery(job, instance_);
+    queue_->finish(job.name);
+    for (const auto& duplicate : job.duplicates) {
+      queue_->finish(duplicate.first);
+    }
+  }
+}
+
+/// Estimate the wall time and CPU time of a scheduled query execution.
+static void expectedCost(ScheduledQueryJob& job) {
+  Config::getInstance().getPerformanceStats(
+      job.name, ([&job](const QueryPerformance& perf) {
+        if (perf.executions > 0) {
+          job.cost = static_cast<size_t>(perf.wall_time / perf.executions);
+          job.cpu_cost = static_cast<size_t>(
+              (perf.user_time + perf.system_time) / perf.executions);
+        }
+      }));
+}
+
+std::vector<ScheduledQueryJob> planScheduleStep(
+    std::vector<ScheduledQueryJob>& jobs, size_t step, size_t budget) {
+  std::vector<ScheduledQueryJob> selected;
+  if (budget == 0) {
+    // Without a budget every due query runs in the step it is due.
+    selected.swap(jobs);
+    return selected;
+  }
+
+  // Consider the queries with the earliest deadline, then the cheapest, first.
+  auto deadline = [](const ScheduledQueryJob& job) {
+    return job.step + std::max<size_t>(job.query.splayed_interval, 1) - 1;
+  };
+  std::stable_sort(jobs.begin(),
+                   jobs.end(),
+                   [&deadline](const ScheduledQueryJob& l,
+                               const ScheduledQueryJob& r) {
+                     return std::make_pair(deadline(l), l.cpu_cost) <
+                            std::make_pair(deadline(r), r.cpu_cost);
+                   });
+
+  size_t spent = 0;
+  std::vector<ScheduledQueryJob> deferred;
+  for (auto& job : jobs) {
+    // A query at its deadline must run, otherwise it would miss its interval.
+    // A step with no other work runs a query even if it exceeds the budget.
+    if (deadline(job) <= step || spent + job.cpu_cost <= budget ||
+        selected.empty()) {
+      spent += job.cpu_cost;
+      selected.push_back(std::move(job));
+    } else {
+      deferred.push_back(std::move(job));
+    }
+  }
+  jobs.swap(deferred);
+  return selected;
+}
+
+void ScheduleWheel::place(Entry&& entry, std::vector<std::string>& due) {
+  if (entry.second <= step_) {
+    due.push_back(std::move(entry.first));
+    return;
+  }
+
+  // Use the lowest level where the entry and the current step share a slot
+  // in the level above, the entry's slot is then reached by advancing.
+  for (size_t level = 0; level < kWheelLevels; ++level) {
+    auto shift = kWheelBits * (level + 1);
+    if ((entry.second >> shift) == (step_ >> shift)) {
+      auto slot = (entry.second >> (kWheelBits * level)) & (kWheelSlots - 1);
+      slots_[level][slot].push_back(std::move(entry));
+      return;
+    }
+  }
+  overflow_.push_back(std::move(entry));
+}
+
+void ScheduleWheel::insert(const std::string& name, size_t due) {
+  std::vector<std::string> now;
+  place(std::make_pair(name, std::max(due, step_ + 1)), now);
+}
+
+void ScheduleWheel::reset(size_t step) {
+  for (auto& level : slots_) {
+    for (auto& slot : level) {
+      slot.clear();
+    }
+  }
+  overflow_.clear();
+  step_ = step;
+}
+
+std::vector<std::string> ScheduleWheel::advance() {
+  std::vector<std::string> due;
+  ++step_;
+
+  // Move entries down when the step crosses a higher level's slot boundary.
+  std::vector<Entry> moving;
+  if ((step_ & ((1ULL << (kWheelBits * kWheelLevels)) - 1)) == 0) {
+    moving.swap(overflow_);
+    for (auto& entry : moving) {
+      place(std::move(entry), due);
+    }
+  }
+
+  for (size_t level = kWheelLevels - 1; level > 0; --level) {
+    auto shift = kWheelBits * level;
+    if ((step_ & ((1ULL << shift) - 1)) != 0) {
+      continue;
+    }
+    moving.clear();
+    moving.swap(slots_[level][(step_ >> shift) & (kWheelSlots - 1)]);
+    for (auto& entry : moving) {
+      place(std::move(entry), due);
+    }
+  }
+
+  for (auto& entry : slots_[0][step_ & (kWheelSlots - 1)]) {
+    due.push_back(std::move(entry.first));
+  }
+  slots_[0][step_ & (kWheelSlots - 1)].clear();
+  return due;
+}
+
+void SchedulerRunner::compile(size_t step) {
+  auto& config = Config::getInstance();
+  generation_ = config.getScheduleGeneration();
+  compiled_ = true;
+
+  std::map<std::string, ScheduledQueryEntry> entries;
+  config.allScheduledQueries(([this, &entries, step](
+      const std::string& name,
+      const ScheduledQuery& query,
+      const std::shared_ptr<Pack>& pack) {
+    if (query.splayed_interval == 0) {
+      return;
+    }
+
+    auto& entry = entries[name];
+    entry.query = query;
+    entry.pack = pack;
+    auto existing = entries_.find(name);
+    if (existing != entries_.end() &&
+        existing->second.query.splayed_interval == query.splayed_interval) {
+      // The query keeps its place in the wheel.
+      entry.due = existing->second.due;
+      return;
+    }
+
+    // The query is next due at the first multiple of its interval.
+    auto interval = query.splayed_interval;
+    entry.due = ((step + interval - 1) / interval) * interval;
+    wheel_.insert(name, entry.due);
+  }));
+  entries_.swap(entries);
+}
+
+void SchedulerRunner::collect(std::vector<ScheduledQueryJob>& due) {
+  auto& config = Config::getInstance();
+  auto names = wheel_.advance();
+  auto step = wheel_.step();
+
+  // Previously-deferred queries keep the step they were due.
+  for (const auto& deferred : deferred_) {
+    names.push_back(deferred.first);
+  }
+
+  std::set<std::string> collected;
+  for (const auto& name : names) {
+    auto entry = entries_.find(name);
+    if (entry == entries_.end()) {
+      // The query was removed from the schedule.
+      continue;
+    }
+
+    auto deferred = deferred_.find(name);
+    if (entry->second.due == step) {
+      // Place the query at its next step, it may also be deferred.
+      entry->second.due += entry->second.query.splayed_interval;
+      wheel_.insert(name, entry->second.due);
+    } else if (deferred == deferred_.end()) {
+      // A stale wheel entry, the query was rescheduled.
+      continue;
+    }
+
+    if (!collected.insert(name).second ||
+        !config.shouldQueryExecute(entry->second.pack, name)) {
+      continue;
+    }
+
+    if (!entry->second.pack->withinBudget(step)) {
+      VLOG(1) << "Pack budget is spent, skipping scheduled query: " << name;
+      continue;
+    }
+
+    ScheduledQueryJob job;
+    job.step = (deferred != deferred_.end()) ? deferred->second : step;
+    job.name = name;
+    job.query = entry->second.query;
+    job.packs.push_back(entry->second.pack);
+    expectedCost(job);
+    due.push_back(std::move(job));
+  }
+}
+
 void SchedulerRunner::start() {
+  if (FLAGS_schedule_workers > 0 && queue_ == nullptr) {
+    // Scheduled queries are executed by a pool of workers.
+    queue_ = std::make_shared<SchedulerQueue>();
+    for (size_t w = 0; w < FLAGS_schedule_workers; ++w) {
+      Dispatcher::addService(std::make_shared<SchedulerWorker>(queue_));
+    }
+  }
+
   // Start the counter at the second.
   auto i = osquery::getUnixTime();
+  wheel_.reset(i - 1);
+  compiled_ = false;
+  entries_.clear();
   for (; (timeout_ == 0) || (i <= timeout_); ++i) {
-    Config::getInstance().scheduledQueries(
-        ([&i](const std::string& name, const ScheduledQuery& query) {
-          if (query.splayed_interval > 0 && i % query.splayed_interval == 0) {
-            TablePlugin::kCacheInterval = query.splayed_interval;
-            TablePlugin::kCacheStep = i;
-            launchQuery(name, query);
-          }
-        }));
+    if (!compiled_ ||
+        generation_ != Config::getInstance().getScheduleGeneration()) {
+      // The packs changed, update the compiled schedule.
+      compile(i);
+    }
+
+    // Collect the queries due in this step and those deferred by the budget.
+    std::vector<ScheduledQueryJob> due;
+    collect(due);
+
+    auto budget = FLAGS_schedule_step_budget;
+    if (FLAGS_watchdog_kernel_limits) {
+      auto pressure = getResourcePressure(FLAGS_watchdog_pressure_percent);
+      if (pressure.memory) {
+        // Give memory back before the kernel reclaims or reaches memory.max.
+        TableResultCache::instance().clear();
+        releaseFreedMemory();
+      }
+      if (pressure.cpu || pressure.memory) {
+        // Queries with time left in their interval are deferred.
+        budget = 1;
+      }
+    }
+
+    auto selected = planScheduleStep(due, i, budget);
+    deferred_.clear();
+    for (const auto& job : due) {
+      VLOG(1) << "Deferring scheduled query within its interval: " << job.name;
+      deferred_[job.name] = job.step;
+    }
+
+    if (FLAGS_decorations_ttl > 0 && !selected.empty()) {
+      // Refresh expired decorators once, not within each launched query.
+      runDecorators(DECORATE_ALWAYS);
+    }
+
+    // Identical statements from different packs run once for the step.
+    groupDuplicateJobs(selected);
+    for (auto& job : selected) {
+      job.launch_step = i;
+      if (queue_ == nullptr) {
+        launchQuery(job);
+      } else if (!queue_->push(job)) {
+        VLOG(1) << "Scheduled query is still running, skipping: " << job.name;
+      }
+    }
+
+    // Expire results of removed queries once the first queries started.
+    Config::getInstance().purgeDeferred();
+
     // Configuration decorators run on 60 second intervals only.
     if (i % 60 == 0) {
       runDecorators(DECORATE_INTERVAL, i);
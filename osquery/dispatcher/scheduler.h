@@ -10,14 +10,192 @@
 
 #pragma once
 
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <set>
+#include <vector>
 
+#include <osquery/config.h>
 #include <osquery/dispatcher.h>
 
 #include "osquery/sql/sqlite_util.h"
 
 namespace osquery {
 
+/// A due scheduled query waiting for a worker.
+struct ScheduledQueryJob {
+  /// The unique name of the scheduled query, also its serialization key.
+  std::string name;
+
+  /// A copy of the scheduled query.
+  ScheduledQuery query;
+
+  /// The schedule step (UNIX time) when the query was due.
+  size_t step{0};
+
+  /// The schedule step when the job was started, the step of table caches.
+  size_t launch_step{0};
+
+  /// The expected wall time in seconds, from the query's performance.
+  size_t cost{0};
+
+  /// The expected user and system time, from the query's performance.
+  size_t cpu_cost{0};
+
+  /// The order the job was queued.
+  size_t sequence{0};
+
+  /// Other due queries with the same statement, sharing this execution.
+  std::vector<std::pair<std::string, ScheduledQuery>> duplicates;
+
+  /// The packs of the query and its duplicates, charged for the execution.
+  std::vector<std::shared_ptr<Pack>> packs;
+};
+
+/**
+ * @brief A queue of due scheduled queries shared by the scheduler workers.
+ *
+ * A query is never queued again while it is queued or running, so a slow query
+ * cannot overlap itself. Jobs from an earlier schedule step are handed out
+ * first, within a step the queries with the lowest expected cost go first so
+ * short queries are not stuck behind expensive ones.
+ */
+class SchedulerQueue : private boost::noncopyable {
+ public:
+  /// Queue a due query, returns false if the query is queued or running.
+  bool push(ScheduledQueryJob job);
+
+  /// Wait for the next job, returns false if none was available.
+  bool pop(ScheduledQueryJob& job, std::chrono::milliseconds timeout);
+
+  /// Release the serialization key of a completed job.
+  void finish(const std::string& name);
+
+  /// Wake every waiting worker, used when workers are interrupted.
+  void wake();
+
+  /// The number of jobs waiting for a worker.
+  size_t size() const;
+
+ private:
+  /// Jobs waiting for a worker.
+  std::vector<ScheduledQueryJob> jobs_;
+
+  /// The names of queued and running jobs.
+  std::set<std::string> active_;
+
+  /// A counter for job ordering.
+  size_t sequence_{0};
+
+  /// Protect the jobs and names.
+  mutable Mutex mutex_;
+
+  /// Signal waiting workers.
+  std::condition_variable condition_;
+};
+
+using SchedulerQueueRef = std::shared_ptr<SchedulerQueue>;
+
+/// A Dispatcher service thread that executes queued scheduled queries.
+class SchedulerWorker : public InternalRunnable {
+ public:
+  explicit SchedulerWorker(SchedulerQueueRef queue)
+      : queue_(std::move(queue)) {}
+
+ public:
+  /// The Dispatcher thread entry point.
+  void start() override;
+
+  /// The Dispatcher interrupt point.
+  void stop() override {
+    queue_->wake();
+  }
+
+ protected:
+  /// Scheduled queries run best-effort.
+  ThreadRole role() const override {
+    return ThreadRole::BEST_EFFORT;
+  }
+
+ private:
+  /// The shared queue of due queries.
+  SchedulerQueueRef queue_;
+
+  /// The worker's own database connection and virtual tables.
+  SQLiteDBInstanceRef instance_{nullptr};
+
+  /// The number of tables attached to the connection when it was created.
+  size_t tables_{0};
+};
+
+/**
+ * @brief A hierarchical timer wheel of scheduled query names due at a step.
+ *
+ * Each level has 64 slots, a level 0 slot is one step and each higher level's
+ * slots span 64 times the steps of the level below. An entry moves to a lower
+ * level as its step nears, so advancing a step only touches the entries that
+ * are due or moving down. Entries are never removed, the owner of the wheel
+ * ignores names it no longer expects at the step.
+ */
+class ScheduleWheel : private boost::noncopyable {
+ public:
+  /// Create a wheel at a step, the first advance returns the next step.
+  explicit ScheduleWheel(size_t step = 0) : step_(step) {}
+
+  /// Add a name due at a step after the current step.
+  void insert(const std::string& name, size_t due);
+
+  /// Move to the next step and return the names due at that step.
+  std::vector<std::string> advance();
+
+  /// Remove every entry and move to a step.
+  void reset(size_t step);
+
+  /// The current step.
+  size_t step() const {
+    return step_;
+  }
+
+ private:
+  /// A name and the step it is due.
+  using Entry = std::pair<std::string, size_t>;
+
+  /// Place an entry, or add it to the due names if it is due at this step.
+  void place(Entry&& entry, std::vector<std::string>& due);
+
+ private:
+  /// The bits of the step's value covered by each level.
+  static const size_t kWheelBits = 6;
+
+  /// The number of slots in each level.
+  static const size_t kWheelSlots = 1 << kWheelBits;
+
+  /// Four levels cover more than 190 days of steps.
+  static const size_t kWheelLevels = 4;
+
+  /// The slots of each level.
+  std::vector<Entry> slots_[kWheelLevels][kWheelSlots];
+
+  /// Entries due beyond the last level.
+  std::vector<Entry> overflow_;
+
+  /// The last step advanced to.
+  size_t step_{0};
+};
+
+/// A scheduled query compiled into the scheduler's timer wheel.
+struct ScheduledQueryEntry {
+  /// A copy of the scheduled query.
+  ScheduledQuery query;
+
+  /// The query's pack, checked for activity when the query is due.
+  std::shared_ptr<Pack> pack;
+
+  /// The next step the query is due.
+  size_t due{0};
+};
+
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
 class SchedulerRunner : public InternalRunnable {
  public:
@@ -31,6 +209,12 @@ class SchedulerRunner : public InternalRunnable {
   /// The Dispatcher interrupt point.
   void stop() override {}
 
+ protected:
+  /// Scheduled queries run best-effort.
+  ThreadRole role() const override {
+    return ThreadRole::BEST_EFFORT;
+  }
+
  protected:
   /// The UNIX domain socket path for the ExtensionManager.
   std::map<std::string, size_t> splay_;
@@ -40,9 +224,201 @@ class SchedulerRunner : public InternalRunnable {
 
   /// Maximum number of steps.
   unsigned long int timeout_;
+
+  /// The queue of due queries, used if scheduler workers are enabled.
+  SchedulerQueueRef queue_{nullptr};
+
+  /// Queries deferred by the step budget, and the step they were due.
+  std::map<std::string, size_t> deferred_;
+
+ private:
+  /**
+   * @brief Compile the config's schedule into the timer wheel.
+   *
+   * A query already in the wheel keeps its next step unless its interval
+   * changed. Removed queries are forgotten and skipped when their step is due.
+   *
+   * @param step The next schedule step.
+   */
+  void compile(size_t step);
+
+  /// Collect the queries due at the wheel's next step.
+  void collect(std::vector<ScheduledQueryJob>& due);
+
+ private:
+  /// The wheel of scheduled query names, keyed by their next step.
+  ScheduleWheel wheel_;
+
+  /// The compiled scheduled queries by name.
+  std::map<std::string, ScheduledQueryEntry> entries_;
+
+  /// The config schedule generation last compiled.
+  size_t generation_{0};
+
+  /// Set after the first compile.
+  bool compiled_{false};
+
+ private:
+  FRIEND_TEST(SchedulerTests, test_schedule_compile);
 };
 
-SQLInternal monitor(const std::string& name, const ScheduledQuery& query);
+/**
+ * @brief The change feeds of incremental scheduled queries.
+ *
+ * A scheduled query with the `incremental` option that reads only tables
+ * with change feeds is skipped while none of its feeds, event subscribers,
+ * received events since its last execution. The differential of a skipped
+ * query would be empty unless a change was missed by the feeds, so a query
+ * is executed at least every --schedule_reconcile_interval seconds.
+ */
+class IncrementalQueries : private boost::noncopyable {
+ public:
+  static IncrementalQueries& instance() {
+    static IncrementalQueries queries;
+    return queries;
+  }
+
+  /// The change feeds recorded by the last execution of a query.
+  std::vector<std::string> feeds(const std::string& name) const;
+
+  /// Check if a query must be executed, given its feeds' versions.
+  bool changed(const std::string& name,
+               const std::vector<size_t>& versions,
+               size_t now) const;
+
+  /// Record the change feeds and their versions of an execution.
+  void record(const std::string& name,
+              const std::vector<std::string>& feeds,
+              const std::vector<size_t>& versions,
+              size_t now);
+
+  /// Forget every query.
+  void clear();
+
+ private:
+  struct State {
+    /// The event subscribers following the query's tables.
+    std::vector<std::string> feeds;
+
+    /// The number of events received by each feed.
+    std::vector<size_t> versions;
+
+    /// The time of the last execution.
+    size_t executed{0};
+  };
+
+  /// Incremental queries by name.
+  std::map<std::string, State> queries_;
+
+  /// Protect the queries, scheduler workers execute concurrently.
+  mutable Mutex mutex_;
+};
+
+/**
+ * @brief Read the number of events received by each change feed.
+ *
+ * @return false if a feed is not a running event subscriber.
+ */
+bool getChangeFeedVersions(const std::vector<std::string>& feeds,
+                           std::vector<size_t>& versions);
+
+/**
+ * @brief Select the due queries to start within a schedule step.
+ *
+ * Each query has a deadline at the end of its interval. Queries with the
+ * earliest deadline are selected until their expected CPU cost exceeds the
+ * budget, the remaining queries are deferred to a later step. A query is never
+ * deferred past its deadline.
+ *
+ * @param jobs The due and previously-deferred queries, output as the deferred.
+ * @param step The current schedule step.
+ * @param budget The expected CPU cost allowed per step, 0 selects every job.
+ * @return The queries to start in this step.
+ */
+std::vector<ScheduledQueryJob> planScheduleStep(
+    std::vector<ScheduledQueryJob>& jobs, size_t step, size_t budget);
+
+/**
+ * @brief Apply a scheduled query's output limits to its results.
+ *
+ * A sampled query keeps the rows whose content hashes into the sample, so an
+ * unchanged row is consistently logged or suppressed. The max rows and bytes
+ * then truncate the snapshot, or the added rows followed by the removed rows.
+ *
+ * @param query The scheduled query and its output limits.
+ * @param item The results to log, suppressed rows are removed.
+ * @return The number of suppressed rows.
+ */
+size_t limitQueryResults(const ScheduledQuery& query, QueryLogItem& item);
+
+/**
+ * @brief Split snapshot results into chunks of at most rows or bytes.
+ *
+ * A chunk holds at least one row, a row larger than the bytes limit is a
+ * chunk by itself.
+ *
+ * @param rows The snapshot results.
+ * @param max_rows The maximum rows per chunk, 0 for no limit.
+ * @param max_bytes The maximum column name and value bytes, 0 for no limit.
+ * @return The end index of each chunk, empty if there are no rows.
+ */
+std::vector<size_t> getSnapshotChunks(const QueryData& rows,
+                                      size_t max_rows,
+                                      size_t max_bytes);
+
+/**
+ * @brief Run a scheduled query and record its performance.
+ *
+ * @param name The unique name of the scheduled query.
+ * @param query The scheduled query.
+ * @param instance A worker's SQLite connection, or the primary connection.
+ * @param shared The names of duplicate queries sharing the execution, each
+ * records the same performance.
+ */
+SQLInternal monitor(const std::string& name,
+                    const ScheduledQuery& query,
+                    const SQLiteDBInstanceRef& instance = nullptr,
+                    const std::vector<std::string>& shared = {});
+
+/**
+ * @brief Normalize a statement for comparison with other scheduled queries.
+ *
+ * Whitespace outside of quoted strings is collapsed to a single space, and
+ * leading and trailing whitespace and semicolons are removed.
+ */
+std::string normalizeStatement(const std::string& query);
+
+/**
+ * @brief Merge due queries running the same statement into a single job.
+ *
+ * Packs from different teams often schedule the same SQL. Jobs whose
+ * normalized statements and work shards match are moved into the
+ * duplicates of the first such job, the statement then runs once and each
+ * query diffs and logs the results with its own options and stored results.
+ * Incremental queries keep their own jobs, they skip on their own feeds.
+ *
+ * @param jobs The due jobs, duplicates are removed in place.
+ */
+void groupDuplicateJobs(std::vector<ScheduledQueryJob>& jobs);
+
+/**
+ * @brief Run a scheduled query, diff its results, and log them.
+ *
+ * This is the complete path of a due query: the SQL, an optional monitor,
+ * the differential against the stored results, the output limits, and the
+ * serialization to the active logger.
+ *
+ * @param name The unique name of the scheduled query.
+ * @param query The scheduled query.
+ * @param instance A worker's SQLite connection, or the primary connection.
+ */
+void launchQuery(const std::string& name,
+                 const ScheduledQuery& query,
+                 const SQLiteDBInstanceRef& instance = nullptr);
+
+/// Run a job's statement once, then diff and log it for each of its queries.
+void launchQuery(const ScheduledQueryJob& job,
+                 const SQLiteDBInstanceRef& instance = nullptr);
 
 /// Start querying according to the config's schedule
 void startScheduler();
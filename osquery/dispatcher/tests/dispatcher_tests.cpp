@@ -8,12 +8,25 @@
  *
  */
 
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <gtest/gtest.h>
 
 #include <osquery/dispatcher.h>
+#include <osquery/flags.h>
+
+#include "osquery/dispatcher/distributed.h"
 
 namespace osquery {
 
+DECLARE_uint64(distributed_interval);
+DECLARE_bool(thread_roles);
+DECLARE_int32(thread_best_effort_nice);
+
 class DispatcherTests : public testing::Test {
   void TearDown() override { Dispatcher::instance().resetStopping(); }
 };
@@ -130,4 +143,79 @@ TEST_F(DispatcherTests, test_stop_dispatcher) {
   auto s = Dispatcher::addService(r1);
   EXPECT_FALSE(s);
 }
+
+class RoleTestRunnable : public InternalRunnable {
+ public:
+  void start() override {
+#ifdef __linux__
+    auto tid = static_cast<id_t>(::syscall(SYS_gettid));
+    nice = getpriority(PRIO_PROCESS, tid);
+#endif
+  }
+
+  int nice{0};
+
+ protected:
+  ThreadRole role() const override {
+    return ThreadRole::BEST_EFFORT;
+  }
+};
+
+TEST_F(DispatcherTests, test_thread_role) {
+  auto roles = FLAGS_thread_roles;
+  auto nice = FLAGS_thread_best_effort_nice;
+  FLAGS_thread_roles = true;
+  FLAGS_thread_best_effort_nice = 15;
+
+  // The role is applied to the service thread, not the dispatching thread.
+  auto runnable = std::make_shared<RoleTestRunnable>();
+  Dispatcher::addService(runnable);
+  Dispatcher::joinServices();
+  EXPECT_TRUE(runnable->hasRun());
+#ifdef __linux__
+  EXPECT_EQ(runnable->nice, 15);
+  EXPECT_NE(getpriority(PRIO_PROCESS, 0), 15);
+#endif
+  FLAGS_thread_roles = roles;
+  FLAGS_thread_best_effort_nice = nice;
+}
+
+TEST_F(DispatcherTests, test_thread_role_disabled) {
+  auto roles = FLAGS_thread_roles;
+  auto nice = FLAGS_thread_best_effort_nice;
+  FLAGS_thread_roles = false;
+  FLAGS_thread_best_effort_nice = 15;
+
+  // Without --thread_roles service threads keep the priority of the process.
+  auto runnable = std::make_shared<RoleTestRunnable>();
+  Dispatcher::addService(runnable);
+  Dispatcher::joinServices();
+  EXPECT_TRUE(runnable->hasRun());
+#ifdef __linux__
+  EXPECT_EQ(runnable->nice, getpriority(PRIO_PROCESS, 0));
+#endif
+  FLAGS_thread_roles = roles;
+  FLAGS_thread_best_effort_nice = nice;
+}
+
+TEST_F(DispatcherTests, test_distributed_retry_pause) {
+  auto interval = FLAGS_distributed_interval;
+  FLAGS_distributed_interval = 8;
+
+  // Each failure doubles the pause, jitter removes up to half.
+  for (size_t i = 0; i < 16; i++) {
+    auto pause = getDistributedRetryPause(1);
+    EXPECT_GE(pause, 500U);
+    EXPECT_LE(pause, 1000U);
+    pause = getDistributedRetryPause(3);
+    EXPECT_GE(pause, 2000U);
+    EXPECT_LE(pause, 4000U);
+
+    // The pause does not exceed the polling interval.
+    pause = getDistributedRetryPause(10);
+    EXPECT_GE(pause, 4000U);
+    EXPECT_LE(pause, 8000U);
+  }
+  FLAGS_distributed_interval = interval;
+}
 }
@@ -20,6 +20,7 @@
 namespace osquery {
 
 DECLARE_bool(disable_logging);
+DECLARE_uint64(schedule_reconcile_interval);
 
 class SchedulerTests : public testing::Test {
   void SetUp() override {
@@ -136,6 +137,71 @@ TEST_F(SchedulerTests, test_config_results_purge) {
   }
 }
 
+TEST_F(SchedulerTests, test_config_results_purge_deferred) {
+  auto query_time = osquery::getUnixTime() - (84600 * (7 + 1));
+  setDatabaseValue(
+      kPersistentSettings, "timestamp.test_query", std::to_string(query_time));
+  setDatabaseValue(kQueries, "test_query", "{}");
+
+  // Without a deferred purge the stale results are kept.
+  auto& c = Config::getInstance();
+  c.purge_deferred_ = false;
+  c.purgeDeferred();
+  std::string content;
+  getDatabaseValue(kQueries, "test_query", content);
+  EXPECT_FALSE(content.empty());
+
+  // The initial load deferred the purge, it runs once.
+  c.purge_deferred_ = true;
+  c.purgeDeferred();
+  content.clear();
+  getDatabaseValue(kQueries, "test_query", content);
+  EXPECT_TRUE(content.empty());
+  EXPECT_FALSE(c.purge_deferred_);
+}
+
+TEST_F(SchedulerTests, test_snapshot_chunks) {
+  QueryData rows;
+  for (size_t i = 0; i < 5; i++) {
+    rows.push_back({{"name", "value"}});
+  }
+
+  // Without limits a snapshot is a single chunk.
+  EXPECT_EQ(getSnapshotChunks(rows, 0, 0), std::vector<size_t>({5}));
+  EXPECT_TRUE(getSnapshotChunks(QueryData(), 2, 0).empty());
+
+  EXPECT_EQ(getSnapshotChunks(rows, 2, 0), std::vector<size_t>({2, 4, 5}));
+
+  // Each row is 9 bytes, a row larger than the limit is a chunk by itself.
+  EXPECT_EQ(getSnapshotChunks(rows, 0, 20), std::vector<size_t>({2, 4, 5}));
+  EXPECT_EQ(getSnapshotChunks(rows, 0, 5),
+            std::vector<size_t>({1, 2, 3, 4, 5}));
+}
+
+TEST_F(SchedulerTests, test_incremental_queries) {
+  auto& queries = IncrementalQueries::instance();
+  queries.clear();
+
+  // A query is executed until it records change feeds.
+  EXPECT_TRUE(queries.changed("incremental", {1}, 100));
+  queries.record("incremental", {}, {}, 100);
+  EXPECT_TRUE(queries.changed("incremental", {}, 101));
+
+  // Unchanged feeds skip the query until the reconcile interval.
+  queries.record("incremental", {"file_events"}, {3}, 100);
+  EXPECT_EQ(queries.feeds("incremental"),
+            std::vector<std::string>{"file_events"});
+  EXPECT_FALSE(queries.changed("incremental", {3}, 101));
+  EXPECT_TRUE(queries.changed("incremental", {4}, 101));
+  EXPECT_TRUE(queries.changed(
+      "incremental", {3}, 100 + FLAGS_schedule_reconcile_interval));
+
+  // A feed that is not a running subscriber has no version.
+  std::vector<size_t> versions;
+  EXPECT_FALSE(getChangeFeedVersions({"not_a_subscriber"}, versions));
+  queries.clear();
+}
+
 TEST_F(SchedulerTests, test_scheduler) {
   auto backup_step = TablePlugin::kCacheStep;
   auto backup_interval = TablePlugin::kCacheInterval;
@@ -171,4 +237,237 @@ TEST_F(SchedulerTests, test_scheduler) {
   TablePlugin::kCacheStep = backup_step;
   TablePlugin::kCacheInterval = backup_interval;
 }
+
+TEST_F(SchedulerTests, test_scheduler_queue) {
+  SchedulerQueue queue;
+
+  auto make_job = [](const std::string& name, size_t step, size_t cost) {
+    ScheduledQueryJob job;
+    job.name = name;
+    job.step = step;
+    job.cost = cost;
+    return job;
+  };
+
+  EXPECT_TRUE(queue.push(make_job("slow", 10, 30)));
+  EXPECT_TRUE(queue.push(make_job("fast", 10, 1)));
+  EXPECT_TRUE(queue.push(make_job("late", 11, 0)));
+  // A queued query is not queued again.
+  EXPECT_FALSE(queue.push(make_job("slow", 11, 30)));
+  EXPECT_EQ(queue.size(), 3U);
+
+  // The lowest cost within the oldest step is handed out first.
+  ScheduledQueryJob job;
+  ASSERT_TRUE(queue.pop(job, std::chrono::milliseconds(0)));
+  EXPECT_EQ(job.name, "fast");
+  ASSERT_TRUE(queue.pop(job, std::chrono::milliseconds(0)));
+  EXPECT_EQ(job.name, "slow");
+
+  // A running query is not queued again until it finishes.
+  EXPECT_FALSE(queue.push(make_job("slow", 12, 30)));
+  queue.finish("slow");
+  EXPECT_TRUE(queue.push(make_job("slow", 12, 30)));
+
+  ASSERT_TRUE(queue.pop(job, std::chrono::milliseconds(0)));
+  EXPECT_EQ(job.name, "late");
+  ASSERT_TRUE(queue.pop(job, std::chrono::milliseconds(0)));
+  EXPECT_EQ(job.name, "slow");
+  EXPECT_FALSE(queue.pop(job, std::chrono::milliseconds(0)));
+}
+
+TEST_F(SchedulerTests, test_group_duplicate_jobs) {
+  EXPECT_EQ(normalizeStatement("  select *\n\tfrom time;  "),
+            "select * from time");
+  // Whitespace within quoted strings is significant.
+  EXPECT_EQ(normalizeStatement("select 'a  b' ,  \"c  d\";;"),
+            "select 'a  b' , \"c  d\"");
+  EXPECT_EQ(normalizeStatement("select 'it''s  so'"), "select 'it''s  so'");
+
+  auto make_job = [](const std::string& name, const std::string& query) {
+    ScheduledQueryJob job;
+    job.name = name;
+    job.query.query = query;
+    return job;
+  };
+
+  std::vector<ScheduledQueryJob> jobs = {
+      make_job("a", "select * from time"),
+      make_job("b", "select 1"),
+      make_job("c", "SELECT * FROM time"),
+      make_job("d", "select *  from time;"),
+      make_job("e", "select 1"),
+  };
+  jobs[4].query.options["incremental"] = true;
+  groupDuplicateJobs(jobs);
+
+  // Statements differing in case are not merged, incremental queries run alone.
+  ASSERT_EQ(jobs.size(), 4U);
+  EXPECT_EQ(jobs[0].name, "a");
+  ASSERT_EQ(jobs[0].duplicates.size(), 1U);
+  EXPECT_EQ(jobs[0].duplicates[0].first, "d");
+  EXPECT_EQ(jobs[1].name, "b");
+  EXPECT_TRUE(jobs[1].duplicates.empty());
+  EXPECT_EQ(jobs[2].name, "c");
+  EXPECT_EQ(jobs[3].name, "e");
+
+  // A queued job holds the names of its duplicates.
+  SchedulerQueue queue;
+  EXPECT_TRUE(queue.push(jobs[0]));
+  EXPECT_FALSE(queue.push(make_job("d", "select *  from time;")));
+}
+
+TEST_F(SchedulerTests, test_limit_query_results) {
+  QueryLogItem item;
+  for (size_t i = 0; i < 100; i++) {
+    item.results.added.push_back({{"i", std::to_string(i)}});
+  }
+  item.results.removed.push_back({{"i", "removed"}});
+
+  // Without limits every row is logged.
+  ScheduledQuery query;
+  EXPECT_EQ(limitQueryResults(query, item), 0U);
+  EXPECT_EQ(item.results.added.size(), 100U);
+
+  // The sample is deterministic.
+  query.sample = 4;
+  auto sampled = item;
+  auto suppressed = limitQueryResults(query, sampled);
+  EXPECT_GT(suppressed, 0U);
+  EXPECT_EQ(sampled.results.added.size() + sampled.results.removed.size(),
+            101U - suppressed);
+  auto resampled = item;
+  limitQueryResults(query, resampled);
+  EXPECT_EQ(sampled.results.added, resampled.results.added);
+
+  // Added rows fill the row limit before removed rows.
+  query.sample = 0;
+  query.max_rows = 10;
+  auto limited = item;
+  EXPECT_EQ(limitQueryResults(query, limited), 91U);
+  EXPECT_EQ(limited.results.added.size(), 10U);
+  EXPECT_EQ(limited.results.added[9]["i"], "9");
+  EXPECT_TRUE(limited.results.removed.empty());
+
+  // Each row is 2 bytes ("i" and a digit) for the first 10 rows.
+  query.max_rows = 0;
+  query.max_bytes = 11;
+  limited = item;
+  EXPECT_EQ(limitQueryResults(query, limited), 96U);
+  EXPECT_EQ(limited.results.added.size(), 5U);
+}
+
+TEST_F(SchedulerTests, test_plan_schedule_step) {
+  auto make_job = [](const std::string& name, size_t step, size_t cost) {
+    ScheduledQueryJob job;
+    job.name = name;
+    job.step = step;
+    job.cpu_cost = cost;
+    job.query.splayed_interval = 60;
+    return job;
+  };
+
+  // Without a budget every query is selected.
+  std::vector<ScheduledQueryJob> jobs = {make_job("a", 60, 50),
+                                         make_job("b", 60, 50)};
+  auto selected = planScheduleStep(jobs, 60, 0);
+  EXPECT_EQ(selected.size(), 2U);
+  EXPECT_TRUE(jobs.empty());
+
+  // The cheapest queries fit within the budget, the others are deferred.
+  jobs = {make_job("heavy1", 60, 80),
+          make_job("light", 60, 10),
+          make_job("heavy2", 60, 80)};
+  selected = planScheduleStep(jobs, 60, 100);
+  ASSERT_EQ(selected.size(), 2U);
+  EXPECT_EQ(selected[0].name, "light");
+  EXPECT_EQ(selected[1].name, "heavy1");
+  ASSERT_EQ(jobs.size(), 1U);
+  EXPECT_EQ(jobs[0].name, "heavy2");
+
+  // A step without other work runs a query exceeding the budget.
+  jobs = {make_job("huge", 60, 500)};
+  selected = planScheduleStep(jobs, 61, 100);
+  EXPECT_EQ(selected.size(), 1U);
+
+  // A deferred query runs at its deadline regardless of the budget.
+  jobs = {make_job("first", 60, 100), make_job("deferred", 60, 100)};
+  selected = planScheduleStep(jobs, 119, 100);
+  EXPECT_EQ(selected.size(), 2U);
+  EXPECT_TRUE(jobs.empty());
+}
+
+TEST_F(SchedulerTests, test_schedule_wheel) {
+  // Start near a boundary of each level.
+  size_t start = (1 << 18) - 70;
+  ScheduleWheel wheel(start);
+  std::map<std::string, size_t> expected = {
+      {"next", start + 1},
+      {"slot", start + 63},
+      {"level1", start + 64},
+      {"level2", start + 5000},
+      {"level3", start + 300000},
+      {"overflow", start + (1 << 24) + 10},
+  };
+  for (const auto& entry : expected) {
+    wheel.insert(entry.first, entry.second);
+  }
+
+  std::map<std::string, size_t> actual;
+  while (wheel.step() < start + (1 << 24) + 20) {
+    for (const auto& name : wheel.advance()) {
+      EXPECT_EQ(actual.count(name), 0U);
+      actual[name] = wheel.step();
+    }
+  }
+  EXPECT_EQ(actual, expected);
+}
+
+TEST_F(SchedulerTests, test_schedule_compile) {
+  std::string config =
+      "{"
+      "\"packs\": {"
+      "\"compile\": {"
+      "\"queries\": {"
+      "\"fast\": {\"query\": \"select 1\", \"interval\": 1},"
+      "\"slow\": {\"query\": \"select 2\", \"interval\": 60}"
+      "}"
+      "}"
+      "}"
+      "}";
+  Config::getInstance().update({{"data", config}});
+
+  size_t step = 1200;
+  SchedulerRunner runner(0, 1);
+  runner.wheel_.reset(step - 1);
+  runner.compile(step);
+  ASSERT_EQ(runner.entries_.size(), 2U);
+
+  // Each query is collected once per splayed interval.
+  std::map<std::string, size_t> counts;
+  for (size_t i = 0; i < 600; ++i) {
+    std::vector<ScheduledQueryJob> due;
+    runner.collect(due);
+    for (const auto& job : due) {
+      EXPECT_EQ(job.step, runner.wheel_.step());
+      EXPECT_EQ(job.step % job.query.splayed_interval, 0U);
+      counts[job.name]++;
+    }
+  }
+  for (const auto& entry : runner.entries_) {
+    EXPECT_EQ(counts[entry.first], 600 / entry.second.query.splayed_interval);
+  }
+
+  // Removing the pack changes the generation, the queries are no longer due.
+  auto generation = Config::getInstance().getScheduleGeneration();
+  Config::getInstance().removePack("compile");
+  EXPECT_NE(Config::getInstance().getScheduleGeneration(), generation);
+  runner.compile(runner.wheel_.step() + 1);
+  EXPECT_TRUE(runner.entries_.empty());
+
+  std::vector<ScheduledQueryJob> due;
+  for (size_t i = 0; i < 120; ++i) {
+    runner.collect(due);
+  }
+  EXPECT_TRUE(due.empty());
+}
 }
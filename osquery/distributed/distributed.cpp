@@ -8,7 +8,10 @@
  *
  */
 
+#include <algorithm>
+#include <map>
 #include <sstream>
+#include <thread>
 #include <utility>
 
 #include <osquery/core.h>
@@ -19,6 +22,7 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/query_deadline.h"
 
 namespace pt = boost::property_tree;
 
@@ -33,9 +37,51 @@ FLAG(bool,
      true,
      "Disable distributed queries (default true)");
 
+FLAG(uint64,
+     distributed_concurrency,
+     1,
+     "Number of distributed queries executed at once (default 1)");
+
+FLAG(uint64,
+     distributed_timeout,
+     0,
+     "Seconds a distributed query may run before it is cancelled (default 0 "
+     "for no limit)");
+
+FLAG(uint64,
+     distributed_write_max_bytes,
+     0,
+     "Split distributed results larger than this into several writes");
+
 Mutex distributed_queries_mutex_;
 Mutex distributed_results_mutex_;
 const std::string kDistributedQueryPrefix = "distributed.";
+const std::string kDistributedMaxAgePrefix = "distributed_max_age.";
+
+/// The most recent results of a query requested with a max_age.
+struct DistributedCacheEntry {
+  /// The UNIX time the results were generated.
+  size_t time{0};
+
+  QueryData results;
+
+  /// Set when the results were written.
+  bool uploaded{false};
+};
+
+/// The number of distinct queries with cached results.
+const size_t kDistributedCacheMax = 64;
+
+/// Cached results keyed by the query's SQL.
+static std::map<std::string, DistributedCacheEntry> kDistributedCache;
+static Mutex kDistributedCacheMutex;
+
+/// The id of the query each distributed worker is executing.
+static thread_local std::string kCurrentRequestId;
+
+std::string Distributed::getCurrentRequestId() {
+  return kCurrentRequestId;
+}
 
 Status DistributedPlugin::call(const PluginRequest& request,
                                PluginResponse& response) {
@@ -90,27 +136,93 @@ size_t Distributed::getCompletedCount() {
   return results_.size();
 }
 
-Status Distributed::serializeResults(std::string& json) {
+/// Get the cached results of a query if they are within its max_age.
+static bool getCachedResult(const DistributedQueryRequest& request,
+                            DistributedQueryResult& result) {
+  WriteLock lock(kDistributedCacheMutex);
+  auto it = kDistributedCache.find(request.query);
+  if (it == kDistributedCache.end() ||
+      it->second.time + request.max_age < getUnixTime()) {
+    return false;
+  }
+
+  result.results = it->second.results;
+  result.freshness = it->second.time;
+  result.unchanged = it->second.uploaded;
+  return true;
+}
+
+/// Cache the results of a query, and check if they match the last written.
+static void cacheResult(DistributedQueryResult& result) {
+  WriteLock lock(kDistributedCacheMutex);
+  if (kDistributedCache.count(result.request.query) == 0 &&
+      kDistributedCache.size() >= kDistributedCacheMax) {
+    // Replace the oldest results.
+    auto oldest = std::min_element(
+        kDistributedCache.begin(),
+        kDistributedCache.end(),
+        [](const std::pair<const std::string, DistributedCacheEntry>& a,
+           const std::pair<const std::string, DistributedCacheEntry>& b) {
+          return a.second.time < b.second.time;
+        });
+    kDistributedCache.erase(oldest);
+  }
+
+  auto& entry = kDistributedCache[result.request.query];
+  result.unchanged = (entry.uploaded && entry.results == result.results);
+  entry.uploaded = result.unchanged;
+  entry.time = result.freshness;
+  entry.results = result.results;
+}
+
+/// Record that cached results were written.
+static void setResultUploaded(const DistributedQueryResult& result) {
+  WriteLock lock(kDistributedCacheMutex);
+  auto it = kDistributedCache.find(result.request.query);
+  if (it != kDistributedCache.end() && it->second.time == result.freshness) {
+    it->second.uploaded = true;
+  }
+}
+
+/// Serialize results into the queries object sent to writeResults.
+static Status serializeResultQueries(
+    const std::vector<DistributedQueryResult>& results, std::string& json) {
   pt::ptree tree;
+  pt::ptree freshness;
+  pt::ptree unchanged;
+  for (const auto& result : results) {
+    if (result.request.max_age > 0) {
+      freshness.push_back(std::make_pair(
+          result.request.id, pt::ptree(std::to_string(result.freshness))));
+    }
 
-  {
-    WriteLock lock(distributed_results_mutex_);
-    for (const auto& result : results_) {
-      pt::ptree qd;
-      auto s = serializeQueryData(result.results, qd);
-      if (!s.ok()) {
-        return s;
-      }
-      tree.add_child(result.request.id, qd);
+    if (result.unchanged) {
+      // The server already has these results, only the id is sent.
+      unchanged.push_back(
+          std::make_pair("", pt::ptree(result.request.id)));
+      continue;
+    }
+
+    pt::ptree qd;
+    auto s = serializeQueryData(result.results, qd);
+    if (!s.ok()) {
+      return s;
     }
+    tree.add_child(result.request.id, qd);
   }
 
-  pt::ptree results;
-  results.add_child("queries", tree);
+  pt::ptree queries;
+  queries.add_child("queries", tree);
+  if (!freshness.empty()) {
+    queries.add_child("freshness", freshness);
+  }
+  if (!unchanged.empty()) {
+    queries.add_child("unchanged", unchanged);
+  }
 
   std::stringstream ss;
   try {
-    pt::write_json(ss, results, false);
+    pt::write_json(ss, queries, false);
   } catch (const pt::ptree_error& e) {
     return Status(1, "Error writing JSON: " + std::string(e.what()));
   }
@@ -119,26 +231,136 @@ Status Distributed::serializeResults(std::string& json) {
   return Status(0, "OK");
 }
 
+/// An estimate of the serialized size of a row.
+static size_t getRowSize(const Row& row) {
+  size_t size = 2;
+  for (const auto& column : row) {
+    size += column.first.size() + column.second.size() + 6;
+  }
+  return size;
+}
+
+Status Distributed::serializeResults(std::string& json) {
+  WriteLock lock(distributed_results_mutex_);
+  return serializeResultQueries(results_, json);
+}
+
+Status Distributed::writeResult(DistributedQueryResult& result) {
+  // Split the rows into groups below the max write size.
+  std::vector<size_t> splits;
+  if (FLAGS_distributed_write_max_bytes > 0) {
+    size_t size = 0;
+    for (size_t i = 0; i < result.results.size(); i++) {
+      auto row_size = getRowSize(result.results[i]);
+      if (size > 0 && size + row_size > FLAGS_distributed_write_max_bytes) {
+        splits.push_back(i);
+        size = 0;
+      }
+      size += row_size;
+    }
+  }
+  splits.push_back(result.results.size());
+
+  size_t start = 0;
+  for (const auto& end : splits) {
+    std::vector<DistributedQueryResult> chunk(1);
+    chunk[0].request = result.request;
+    chunk[0].freshness = result.freshness;
+    chunk[0].unchanged = result.unchanged;
+    chunk[0].results.assign(result.results.begin() + start,
+                            result.results.begin() + end);
+
+    std::string json;
+    auto s = serializeResultQueries(chunk, json);
+    if (!s.ok()) {
+      return s;
+    }
+
+    PluginResponse response;
+    s = Registry::call("distributed",
+                       {{"action", "writeResults"}, {"results", json}},
+                       response);
+    if (!s.ok()) {
+      // Only the rows that were not accepted are kept for a retry.
+      result.results.erase(result.results.begin(),
+                           result.results.begin() + start);
+      return s;
+    }
+    start = end;
+  }
+  return Status(0, "OK");
+}
+
 void Distributed::addResult(const DistributedQueryResult& result) {
   WriteLock wlock_results(distributed_results_mutex_);
   results_.push_back(result);
 }
 
-Status Distributed::runQueries() {
-  while (getPendingQueryCount() > 0) {
+void Distributed::runWorker() {
+  while (true) {
     auto query = popRequest();
-    LOG(INFO) << "Executing distributed query: " << query.id << ": "
-              << query.query;
+    if (query.id.empty()) {
+      break;
+    }
 
-    auto sql = SQL(query.query);
-    if (!sql.getStatus().ok()) {
-      LOG(ERROR) << "Error executing distributed query: " << query.id << ": "
-                 << sql.getMessageString();
-      continue;
+    DistributedQueryResult result;
+    if (query.max_age > 0 && getCachedResult(query, result)) {
+      // The server allows recent results of the same query to be reused.
+      LOG(INFO) << "Answering distributed query from cached results: "
+                << query.id << ": " << query.query;
+      result.request = std::move(query);
+    } else {
+      LOG(INFO) << "Executing distributed query: " << query.id << ": "
+                << query.query;
+
+      kCurrentRequestId = query.id;
+      auto sql = [&query]() {
+        QueryDeadlineScope deadline(FLAGS_distributed_timeout);
+        return SQL(query.query);
+      }();
+      kCurrentRequestId.clear();
+      if (!sql.getStatus().ok()) {
+        LOG(ERROR) << "Error executing distributed query: " << query.id
+                   << ": " << sql.getMessageString();
+        continue;
+      }
+
+      result.request = std::move(query);
+      result.results = std::move(sql.rows());
+      if (result.request.max_age > 0) {
+        result.freshness = getUnixTime();
+        cacheResult(result);
+      }
     }
 
-    DistributedQueryResult result(std::move(query), std::move(sql.rows()));
-    addResult(result);
+    // Results are written as each query completes, the rows of failed writes
+    // are kept and retried when the queries are finished.
+    if (!writeResult(result).ok()) {
+      addResult(result);
+    } else if (result.request.max_age > 0 && !result.unchanged) {
+      setResultUploaded(result);
+    }
+  }
+}
+
+Status Distributed::runQueries() {
+  auto& distributed_plugin = Registry::getActive("distributed");
+  if (!Registry::exists("distributed", distributed_plugin)) {
+    return Status(1, "Missing distributed plugin " + distributed_plugin);
+  }
+
+  auto workers = std::min(static_cast<size_t>(FLAGS_distributed_concurrency),
+                          getPendingQueryCount());
+  if (workers <= 1) {
+    runWorker();
+  } else {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; i++) {
+      threads.emplace_back([this]() { runWorker(); });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
   }
   return flushCompleted();
 }
@@ -153,20 +375,26 @@ Status Distributed::flushCompleted() {
     return Status(1, "Missing distributed plugin " + distributed_plugin);
   }
 
-  std::string results;
-  auto s = serializeResults(results);
-  if (!s.ok()) {
-    return s;
+  std::vector<DistributedQueryResult> results;
+  {
+    WriteLock lock(distributed_results_mutex_);
+    results.swap(results_);
   }
 
-  PluginResponse response;
-  s = Registry::call("distributed",
-                     {{"action", "writeResults"}, {"results", results}},
-                     response);
-  if (s.ok()) {
-    results_.clear();
+  // Retries are written like completed queries, split below the max size.
+  for (size_t i = 0; i < results.size(); i++) {
+    auto s = writeResult(results[i]);
+    if (!s.ok()) {
+      WriteLock lock(distributed_results_mutex_);
+      results_.insert(results_.end(), results.begin() + i, results.end());
+      return s;
+    }
+
+    if (results[i].request.max_age > 0 && !results[i].unchanged) {
+      setResultUploaded(results[i]);
+    }
   }
-  return s;
+  return Status(0, "OK");
 }
 
 Status Distributed::acceptWork(const std::string& work) {
@@ -177,11 +405,25 @@ Status Distributed::acceptWork(const std::string& work) {
 
     auto& queries = tree.get_child("queries");
     for (const auto& node : queries) {
-      auto query = queries.get<std::string>(node.first, "");
+      // A query is the SQL, or an object with the SQL and a max_age.
+      std::string query;
+      size_t max_age = 0;
+      if (node.second.empty()) {
+        query = node.second.data();
+      } else {
+        query = node.second.get<std::string>("query", "");
+        max_age = node.second.get<size_t>("max_age", 0);
+      }
+
       if (query.empty() || node.first.empty()) {
         return Status(1, "Distributed query does not have complete attributes");
       }
       setDatabaseValue(kQueries, kDistributedQueryPrefix + node.first, query);
+      if (max_age > 0) {
+        setDatabaseValue(kQueries,
+                         kDistributedMaxAgePrefix + node.first,
+                         std::to_string(max_age));
+      }
     }
     if (tree.count("accelerate") > 0) {
       auto new_time = tree.get<std::string>("accelerate", "");
@@ -210,10 +452,24 @@ DistributedQueryRequest Distributed::popRequest() {
   std::vector<std::string> distributed_queries;
   scanDatabaseKeys(kQueries, distributed_queries, kDistributedQueryPrefix);
   DistributedQueryRequest request;
+  if (distributed_queries.empty()) {
+    return request;
+  }
+
   request.id =
       distributed_queries.front().substr(kDistributedQueryPrefix.size());
   getDatabaseValue(kQueries, distributed_queries.front(), request.query);
   deleteDatabaseValue(kQueries, distributed_queries.front());
+
+  std::string max_age;
+  if (getDatabaseValue(kQueries, kDistributedMaxAgePrefix + request.id, max_age)
+          .ok()) {
+    unsigned long seconds = 0;
+    if (safeStrtoul(max_age, 10, seconds).ok()) {
+      request.max_age = seconds;
+    }
+    deleteDatabaseValue(kQueries, kDistributedMaxAgePrefix + request.id);
+  }
   return request;
 }
 
@@ -23,6 +23,7 @@
 #include <osquery/flags.h>
 #include <osquery/registry.h>
 
+#include "osquery/carver/carver.h"
 #include "osquery/core/json.h"
 #include "osquery/remote/requests.h"
 #include "osquery/remote/serializers/json.h"
@@ -33,6 +34,7 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_bool(tls_node_api);
+DECLARE_uint64(distributed_long_poll);
 
 FLAG(string,
      distributed_tls_read_endpoint,
@@ -67,10 +69,27 @@ REGISTER(TLSDistributedPlugin, "distributed", "tls");
 Status TLSDistributedPlugin::setUp() {
   read_uri_ = TLSRequestHelper::makeURI(FLAGS_distributed_tls_read_endpoint);
   write_uri_ = TLSRequestHelper::makeURI(FLAGS_distributed_tls_write_endpoint);
+
+  // Carves are requested by distributed queries and uploaded to the same
+  // server, continue those interrupted by a restart.
+  resumeCarves();
   return Status(0, "OK");
 }
 
+/// Seconds allowed for the server to respond after a long-poll wait.
+const size_t kLongPollResponseTime = 16;
+
 Status TLSDistributedPlugin::getQueries(std::string& json) {
+  if (FLAGS_distributed_long_poll > 0) {
+    // Ask the server to hold the read until queries are available.
+    pt::ptree params;
+    params.put("verb", "POST");
+    params.put<size_t>("long_poll", FLAGS_distributed_long_poll);
+    params.put<size_t>("timeout",
+                       FLAGS_distributed_long_poll + kLongPollResponseTime);
+    return TLSRequestHelper::go<JSONSerializer>(read_uri_, params, json, 1);
+  }
+
   if (FLAGS_tls_node_api) {
     pt::ptree params;
     params.put("verb", "POST");
@@ -30,6 +30,9 @@ DECLARE_string(distributed_tls_write_endpoint);
 
 namespace osquery {
 
+DECLARE_uint64(distributed_concurrency);
+DECLARE_uint64(distributed_write_max_bytes);
+
 class DistributedTests : public testing::Test {
  protected:
   void SetUp() {
@@ -184,4 +187,164 @@ TEST_F(DistributedTests, test_workflow) {
   EXPECT_EQ(dist.getPendingQueryCount(), 0U);
   EXPECT_EQ(dist.results_.size(), 0U);
 }
+
+class MockDistributedPlugin : public DistributedPlugin {
+ public:
+  Status getQueries(std::string& json) override {
+    json =
+        "{\"queries\": {\"one\": \"select 1 as a union all select 2 as a\","
+        " \"two\": \"select 3 as b\"}}";
+    return Status(0, "OK");
+  }
+
+  Status writeResults(const std::string& json) override {
+    WriteLock lock(mutex);
+    writes.push_back(json);
+    return Status(0, "OK");
+  }
+
+  /// Each writeResults body.
+  static std::vector<std::string> writes;
+
+  /// Protect concurrent writes.
+  static Mutex mutex;
+};
+
+std::vector<std::string> MockDistributedPlugin::writes;
+Mutex MockDistributedPlugin::mutex;
+
+TEST_F(DistributedTests, test_concurrent_chunked_writes) {
+  Registry::add<MockDistributedPlugin>("distributed", "mock");
+  Registry::setActive("distributed", "mock");
+  auto concurrency = FLAGS_distributed_concurrency;
+  auto max_bytes = FLAGS_distributed_write_max_bytes;
+  FLAGS_distributed_concurrency = 2;
+  FLAGS_distributed_write_max_bytes = 10;
+
+  auto dist = Distributed();
+  EXPECT_TRUE(dist.pullUpdates().ok());
+  EXPECT_EQ(dist.getPendingQueryCount(), 2U);
+  EXPECT_TRUE(dist.runQueries().ok());
+  EXPECT_EQ(dist.getPendingQueryCount(), 0U);
+
+  // Each query writes as it completes, the rows of "one" are split.
+  std::map<std::string, size_t> rows;
+  EXPECT_EQ(MockDistributedPlugin::writes.size(), 3U);
+  for (const auto& json : MockDistributedPlugin::writes) {
+    pt::ptree tree;
+    std::stringstream ss(json);
+    pt::read_json(ss, tree);
+    for (const auto& query : tree.get_child("queries")) {
+      rows[query.first] += query.second.size();
+    }
+  }
+  EXPECT_EQ(rows["one"], 2U);
+  EXPECT_EQ(rows["two"], 1U);
+
+  FLAGS_distributed_concurrency = concurrency;
+  FLAGS_distributed_write_max_bytes = max_bytes;
+}
+
+class MockCachedDistributedPlugin : public MockDistributedPlugin {
+ public:
+  Status getQueries(std::string& json) override {
+    json =
+        "{\"queries\": {\"cached\": {\"query\": \"select 4 as c\","
+        " \"max_age\": 600}}}";
+    return Status(0, "OK");
+  }
+};
+
+TEST_F(DistributedTests, test_cached_results) {
+  Registry::add<MockCachedDistributedPlugin>("distributed", "mock_cached");
+  Registry::setActive("distributed", "mock_cached");
+  MockDistributedPlugin::writes.clear();
+
+  // The same query is requested twice within its max_age.
+  auto dist = Distributed();
+  for (size_t i = 0; i < 2; i++) {
+    EXPECT_TRUE(dist.pullUpdates().ok());
+    EXPECT_EQ(dist.getPendingQueryCount(), 1U);
+    EXPECT_TRUE(dist.runQueries().ok());
+  }
+  EXPECT_EQ(dist.getPendingQueryCount(), 0U);
+
+  // Both writes include the time the results were generated, the second
+  // reuses the results and only marks them unchanged.
+  ASSERT_EQ(MockDistributedPlugin::writes.size(), 2U);
+  std::vector<pt::ptree> trees(2);
+  for (size_t i = 0; i < 2; i++) {
+    std::stringstream ss(MockDistributedPlugin::writes[i]);
+    pt::read_json(ss, trees[i]);
+  }
+
+  EXPECT_EQ(trees[0].get_child("queries").count("cached"), 1U);
+  EXPECT_EQ(trees[0].count("unchanged"), 0U);
+  EXPECT_EQ(trees[1].get_child("queries").count("cached"), 0U);
+  ASSERT_EQ(trees[1].count("unchanged"), 1U);
+  EXPECT_EQ(trees[1].get_child("unchanged").front().second.data(), "cached");
+  EXPECT_EQ(trees[0].get<std::string>("freshness.cached"),
+            trees[1].get<std::string>("freshness.cached"));
+  MockDistributedPlugin::writes.clear();
+}
+
+class MockFailingDistributedPlugin : public MockDistributedPlugin {
+ public:
+  Status getQueries(std::string& json) override {
+    json =
+        "{\"queries\": {\"three\": \"select 1 as a union all select 2 as a "
+        "union all select 3 as a\"}}";
+    return Status(0, "OK");
+  }
+
+  Status writeResults(const std::string& json) override {
+    WriteLock lock(mutex);
+    if (++attempts == 2) {
+      return Status(1, "Write failed");
+    }
+    writes.push_back(json);
+    return Status(0, "OK");
+  }
+
+  /// The number of writeResults calls, including the failed write.
+  static size_t attempts;
+};
+
+size_t MockFailingDistributedPlugin::attempts{0};
+
+TEST_F(DistributedTests, test_chunked_write_retry) {
+  Registry::add<MockFailingDistributedPlugin>("distributed", "mock_failing");
+  Registry::setActive("distributed", "mock_failing");
+  MockDistributedPlugin::writes.clear();
+  auto concurrency = FLAGS_distributed_concurrency;
+  auto max_bytes = FLAGS_distributed_write_max_bytes;
+  FLAGS_distributed_concurrency = 1;
+  FLAGS_distributed_write_max_bytes = 10;
+
+  auto dist = Distributed();
+  EXPECT_TRUE(dist.pullUpdates().ok());
+  EXPECT_TRUE(dist.runQueries().ok());
+  EXPECT_EQ(dist.results_.size(), 0U);
+
+  // The second of three chunks failed, the retry sends the rows that were
+  // not accepted, one per write.
+  EXPECT_EQ(MockFailingDistributedPlugin::attempts, 4U);
+  ASSERT_EQ(MockDistributedPlugin::writes.size(), 3U);
+  std::vector<std::string> values;
+  for (const auto& json : MockDistributedPlugin::writes) {
+    pt::ptree tree;
+    std::stringstream ss(json);
+    pt::read_json(ss, tree);
+    const auto& rows = tree.get_child("queries.three");
+    EXPECT_EQ(rows.size(), 1U);
+    for (const auto& row : rows) {
+      values.push_back(row.second.get<std::string>("a"));
+    }
+  }
+  EXPECT_EQ(values, std::vector<std::string>({"1", "2", "3"}));
+
+  FLAGS_distributed_concurrency = concurrency;
+  FLAGS_distributed_write_max_bytes = max_bytes;
+  MockDistributedPlugin::writes.clear();
+}
 }
@@ -12,10 +12,14 @@
 
 #include <osquery/config.h>
 #include <osquery/events.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
 namespace osquery {
 
+DECLARE_uint64(events_batch_size);
+DECLARE_bool(events_binary_rows);
+
 class BenchmarkEventPublisher
     : public EventPublisher<SubscriptionContext, EventContext> {
   DECLARE_PUBLISHER("benchmark");
@@ -57,6 +61,25 @@ class BenchmarkEventSubscriber
     add(r, t);
   }
 
+  /// Add an event shaped like an audit row.
+  void benchmarkAddRow(int t) {
+    Row r = {{"pid", "6421"},
+             {"path", "/usr/bin/curl"},
+             {"mode", "0100755"},
+             {"cmdline", "curl -s https://osquery.io"},
+             {"cwd", "/home/osquery"},
+             {"auid", "1000"},
+             {"uid", "1000"},
+             {"gid", "1000"},
+             {"euid", "1000"},
+             {"egid", "1000"},
+             {"owner_uid", "0"},
+             {"owner_gid", "0"},
+             {"parent", "6400"},
+             {"uptime", "36000"}};
+    add(r, t);
+  }
+
   void clearRows() {
     auto ee = expire_events_;
     auto et = expire_time_;
@@ -68,6 +91,8 @@ class BenchmarkEventSubscriber
   }
 
   void benchmarkGet(int low, int high) { auto results = get(low, high); }
+
+  void benchmarkFlush() { flushEvents(); }
 };
 
 static void EVENTS_subscribe_fire(benchmark::State& state) {
@@ -95,6 +120,116 @@ static void EVENTS_subscribe_fire(benchmark::State& state) {
 
 BENCHMARK(EVENTS_subscribe_fire);
 
+struct BenchmarkKeyedSubscriptionContext : public SubscriptionContext {
+  size_t type{0};
+};
+
+struct BenchmarkKeyedEventContext : public EventContext {
+  size_t type{0};
+};
+
+/// A publisher whose subscriptions only accept events of their type.
+class BenchmarkKeyedEventPublisher
+    : public EventPublisher<BenchmarkKeyedSubscriptionContext,
+                            BenchmarkKeyedEventContext> {
+  DECLARE_PUBLISHER("benchmark_keyed");
+
+ public:
+  void benchmarkFire(size_t type) {
+    auto ec = createEventContext();
+    ec->type = type;
+    fire(ec, 0);
+  }
+
+ public:
+  /// Declare the type as the dispatch key.
+  bool keyed{false};
+
+ private:
+  bool shouldFire(const SCRef& sc, const ECRef& ec) const override {
+    return sc->type == ec->type;
+  }
+
+  bool subscriptionKeys(const SCRef& sc, DispatchKeys& keys) const override {
+    keys.push_back(sc->type);
+    return keyed;
+  }
+
+  bool eventKeys(const ECRef& ec, DispatchKeys& keys) const override {
+    keys.push_back(ec->type);
+    return keyed;
+  }
+};
+
+class BenchmarkKeyedEventSubscriber
+    : public EventSubscriber<BenchmarkKeyedEventPublisher> {
+ public:
+  BenchmarkKeyedEventSubscriber() { setName("benchmark_keyed"); }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) { return Status(0, "OK"); }
+
+  void benchmarkInit(size_t subscriptions) {
+    for (size_t i = 0; i < subscriptions; ++i) {
+      auto sub_ctx = createSubscriptionContext();
+      sub_ctx->type = i;
+      subscribe(&BenchmarkKeyedEventSubscriber::Callback, sub_ctx);
+    }
+  }
+};
+
+/// Fire to 100 subscriptions, of which one accepts the event.
+static void EVENTS_subscribe_fire_keyed(benchmark::State& state) {
+  auto pub = std::make_shared<BenchmarkKeyedEventPublisher>();
+  pub->keyed = (state.range_x() > 0);
+  EventFactory::registerEventPublisher(pub);
+
+  auto sub = std::make_shared<BenchmarkKeyedEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  sub->benchmarkInit(100);
+
+  size_t type = 0;
+  while (state.KeepRunning()) {
+    pub->benchmarkFire(type++ % 100);
+  }
+  EventFactory::deregisterEventPublisher(pub->type());
+}
+
+// An argument of 0 calls shouldFire for each subscription, 1 uses the keys.
+BENCHMARK(EVENTS_subscribe_fire_keyed)->Arg(0)->Arg(1);
+
+struct BenchmarkPathEventContext : public EventContext {
+  std::string path;
+  std::vector<std::string> fields;
+};
+
+/// The same context, recycled by its publisher's pool.
+struct BenchmarkPooledEventContext : public BenchmarkPathEventContext {
+  void recycle() {
+    path.clear();
+    fields.clear();
+  }
+};
+
+template <typename EC>
+static void createPathEvent() {
+  auto ec = EventPublisher<SubscriptionContext, EC>::createEventContext();
+  ec->path = "/home/osquery/.config/osquery/osquery.conf.swp";
+  ec->fields.resize(8, "0123456789abcdef0123456789abcdef");
+}
+
+static void EVENTS_create_context(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    if (state.range_x() == 0) {
+      createPathEvent<BenchmarkPathEventContext>();
+    } else {
+      createPathEvent<BenchmarkPooledEventContext>();
+    }
+  }
+}
+
+// An argument of 0 allocates each context, 1 uses the context pool.
+BENCHMARK(EVENTS_create_context)->Arg(0)->Arg(1);
+
 static void EVENTS_add_events(benchmark::State& state) {
   auto pub = std::make_shared<BenchmarkEventPublisher>();
   EventFactory::registerEventPublisher(pub);
@@ -114,18 +249,47 @@ static void EVENTS_add_events(benchmark::State& state) {
 
 BENCHMARK(EVENTS_add_events);
 
-static void EVENTS_retrieve_events(benchmark::State& state) {
+static void EVENTS_add_events_batched(benchmark::State& state) {
+  auto pub = std::make_shared<BenchmarkEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+
   auto sub = std::make_shared<BenchmarkEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
 
-  for (int i = 0; i < 1000; i++) {
+  // Simulate the event factory initialization.
+  sub->benchmarkInit();
+
+  FLAGS_events_batch_size = state.range_x();
+  int i = 0;
+  while (state.KeepRunning()) {
     sub->benchmarkAdd(i++);
   }
+  sub->benchmarkFlush();
+  FLAGS_events_batch_size = 0;
+  sub->clearRows();
+}
+
+BENCHMARK(EVENTS_add_events_batched)->Arg(16)->Arg(64)->Arg(256);
+
+static void retrieveEvents(benchmark::State& state, bool binary) {
+  auto binary_rows = FLAGS_events_binary_rows;
+  FLAGS_events_binary_rows = binary;
+  auto sub = std::make_shared<BenchmarkEventSubscriber>();
+
+  for (int i = 0; i < 1000; i++) {
+    sub->benchmarkAddRow(i++);
+  }
 
   while (state.KeepRunning()) {
     sub->benchmarkGet(state.range_x(), state.range_y());
   }
 
   sub->clearRows();
+  FLAGS_events_binary_rows = binary_rows;
+}
+
+static void EVENTS_retrieve_events(benchmark::State& state) {
+  retrieveEvents(state, true);
 }
 
 BENCHMARK(EVENTS_retrieve_events)
@@ -133,4 +297,14 @@ BENCHMARK(EVENTS_retrieve_events)
     ->ArgPair(0, 50)
     ->ArgPair(0, 100)
     ->ArgPair(0, 1000);
+
+static void EVENTS_retrieve_events_json(benchmark::State& state) {
+  retrieveEvents(state, false);
+}
+
+BENCHMARK(EVENTS_retrieve_events_json)
+    ->ArgPair(0, 10)
+    ->ArgPair(0, 50)
+    ->ArgPair(0, 100)
+    ->ArgPair(0, 1000);
 }
@@ -13,6 +13,7 @@
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -31,6 +32,16 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
+FLAG(uint64,
+     fsevents_latency,
+     1000,
+     "Milliseconds FSEvents coalesces changes before publishing them");
+
+FLAG(bool,
+     fsevents_file_events,
+     true,
+     "Request FSEvents for each file, instead of each changed directory");
+
 std::map<FSEventStreamEventFlags, std::string> kMaskActions = {
     {kFSEventStreamEventFlagItemChangeOwner, "ATTRIBUTES_MODIFIED"},
     {kFSEventStreamEventFlagItemXattrMod, "ATTRIBUTES_MODIFIED"},
@@ -85,8 +96,10 @@ void FSEventsEventPublisher::restart() {
                       &kCFTypeArrayCallBacks);
 
     // Set stream flags.
-    auto flags =
-        kFSEventStreamCreateFlagFileEvents | kFSEventStreamCreateFlagWatchRoot;
+    FSEventStreamCreateFlags flags = kFSEventStreamCreateFlagWatchRoot;
+    if (FLAGS_fsevents_file_events) {
+      flags |= kFSEventStreamCreateFlagFileEvents;
+    }
     if (no_defer_) {
       flags |= kFSEventStreamCreateFlagNoDefer;
     }
@@ -94,13 +107,14 @@ void FSEventsEventPublisher::restart() {
       flags |= kFSEventStreamCreateFlagIgnoreSelf;
     }
 
-    // Create the FSEvent stream.
+    // Create the FSEvent stream, the callback matches with this publisher.
+    FSEventStreamContext context = {0, this, nullptr, nullptr, nullptr};
     stream_ = FSEventStreamCreate(nullptr,
                                   &FSEventsEventPublisher::Callback,
-                                  nullptr,
+                                  &context,
                                   watch_list,
                                   kFSEventStreamEventIdSinceNow,
-                                  1,
+                                  FLAGS_fsevents_latency / 1000.0,
                                   flags);
     if (stream_ != nullptr) {
       // Schedule the stream on the run loop.
@@ -195,13 +209,15 @@ void FSEventsEventPublisher::configure() {
   {
     WriteLock lock(mutex_);
     paths_.clear();
+    index_.clear();
     for (auto& sub : subscriptions_) {
       auto sc = getSubscriptionContext(sub->context);
-      if (sc->discovered_.size() > 0) {
-        continue;
+      if (sc->discovered_.size() == 0) {
+        auto paths = transformSubscription(sc);
+        paths_.insert(paths.begin(), paths.end());
       }
-      auto paths = transformSubscription(sc);
-      paths_.insert(paths.begin(), paths.end());
+      index_.insert(sc->path, sc.get());
+      sc->indexed_ = true;
     }
   }
 
@@ -228,12 +244,33 @@ void FSEventsEventPublisher::Callback(
     void* event_paths,
     const FSEventStreamEventFlags fsevent_flags[],
     const FSEventStreamEventId fsevent_ids[]) {
+  // Coalesce the events of each path reported within this callback.
+  std::vector<FSEventsEventContextRef> events;
+  std::map<std::string, size_t> paths;
   for (size_t i = 0; i < num_events; ++i) {
+    auto path = std::string(((char**)event_paths)[i]);
+    auto existing = paths.find(path);
+    if (existing != paths.end()) {
+      auto& ec = events[existing->second];
+      ec->fsevent_flags |= fsevent_flags[i];
+      ec->transaction_id = fsevent_ids[i];
+      continue;
+    }
+
     auto ec = createEventContext();
     ec->fsevent_stream = stream;
     ec->fsevent_flags = fsevent_flags[i];
     ec->transaction_id = fsevent_ids[i];
-    ec->path = std::string(((char**)event_paths)[i]);
+    ec->path = std::move(path);
+    paths[ec->path] = events.size();
+    events.push_back(ec);
+  }
+
+  auto* publisher = static_cast<FSEventsEventPublisher*>(callback_info);
+  for (const auto& ec : events) {
+    if (publisher != nullptr) {
+      publisher->matchSubscriptions(ec);
+    }
 
     if (ec->fsevent_flags & kFSEventStreamEventFlagMustScanSubDirs) {
       // The FSEvents thread coalesced events within and will report a root.
@@ -252,9 +289,12 @@ void FSEventsEventPublisher::Callback(
     bool has_action = false;
     for (const auto& action : kMaskActions) {
       if (ec->fsevent_flags & action.first) {
-        // Actions may be multiplexed. Fire and event for each.
-        ec->action = action.second;
-        EventFactory::fire<FSEventsEventPublisher>(ec);
+        // Actions may be multiplexed. Fire and event for each, each event
+        // is a copy since queued subscribers may hold a fired event.
+        auto action_ec = createEventContext();
+        *action_ec = *ec;
+        action_ec->action = action.second;
+        EventFactory::fire<FSEventsEventPublisher>(action_ec);
         has_action = true;
       }
     }
@@ -267,9 +307,21 @@ void FSEventsEventPublisher::Callback(
   }
 }
 
+void FSEventsEventPublisher::matchSubscriptions(
+    const FSEventsEventContextRef& ec) const {
+  WriteLock lock(mutex_);
+  index_.match(ec->path, ec->candidates);
+  ec->indexed = true;
+}
+
 bool FSEventsEventPublisher::shouldFire(
     const FSEventsSubscriptionContextRef& sc,
     const FSEventsEventContextRef& ec) const {
+  if (ec->indexed && sc->indexed_ && ec->candidates.count(sc.get()) == 0) {
+    // The subscription's path prefix is not along the event path.
+    return false;
+  }
+
   if (sc->recursive && !sc->recursive_match) {
     ssize_t found = ec->path.find(sc->path);
     if (found != 0) {
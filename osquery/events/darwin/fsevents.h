@@ -11,6 +11,8 @@
 #pragma once
 
 #include <map>
+#include <memory>
+#include <set>
 #include <string>
 #include <vector>
 
@@ -21,6 +23,8 @@
 #include <osquery/events.h>
 #include <osquery/status.h>
 
+#include "osquery/events/path_index.h"
+
 namespace osquery {
 
 struct FSEventsSubscriptionContext : public SubscriptionContext {
@@ -59,6 +63,9 @@ struct FSEventsSubscriptionContext : public SubscriptionContext {
   /// A configure-time pattern was expanded to match absolute paths.
   bool recursive_match{false};
 
+  /// The subscription was added to the publisher's path index.
+  bool indexed_{false};
+
  private:
   friend class FSEventsEventPublisher;
 };
@@ -71,6 +78,12 @@ struct FSEventsEventContext : public EventContext {
 
   std::string path;
   std::string action;
+
+  /// Set if the subscriptions that may match the path were found.
+  bool indexed{false};
+
+  /// Subscriptions that may match the path, see PathPatternIndex.
+  std::set<const SubscriptionContext*> candidates;
 };
 
 using FSEventsEventContextRef = std::shared_ptr<FSEventsEventContext>;
@@ -142,6 +155,9 @@ class FSEventsEventPublisher
   /// Count the number of subscriptioned paths.
   size_t numSubscriptionedPaths() const;
 
+  /// Find the subscriptions that may match an event's path.
+  void matchSubscriptions(const FSEventsEventContextRef& ec) const;
+
  private:
   /// Local reference to the start, stop, restart event stream.
   FSEventStreamRef stream_{nullptr};
@@ -152,6 +168,9 @@ class FSEventsEventPublisher
   /// Set of paths to monitor, determined by a configure step.
   std::set<std::string> paths_;
 
+  /// Subscriptions indexed by path, built by the configure step.
+  PathPatternIndex index_;
+
   /// Reference to the run loop for this thread.
   CFRunLoopRef run_loop_{nullptr};
 
@@ -174,5 +193,6 @@ class FSEventsEventPublisher
   FRIEND_TEST(FSEventsTests, test_fsevents_fire_event);
   FRIEND_TEST(FSEventsTests, test_fsevents_event_action);
   FRIEND_TEST(FSEventsTests, test_fsevents_embedded_wildcards);
+  FRIEND_TEST(FSEventsTests, test_fsevents_path_index);
 };
 }
@@ -376,4 +376,50 @@ TEST_F(FSEventsTests, test_fsevents_embedded_wildcards) {
   std::set<std::string> expected = {real_test_dir + "/2/1/"};
   EXPECT_EQ(event_pub_->paths_, expected);
 }
+
+TEST_F(FSEventsTests, test_fsevents_path_index) {
+  event_pub_ = std::make_shared<FSEventsEventPublisher>();
+  EventFactory::registerEventPublisher(event_pub_);
+
+  auto sub = std::make_shared<TestFSEventsEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+
+  auto recursive = sub->GetSubscription("/tmp/osquery-fsevents/**");
+  sub->subscribe(&TestFSEventsEventSubscriber::SimpleCallback, recursive);
+  auto other = sub->GetSubscription("/var/log/other.log");
+  sub->subscribe(&TestFSEventsEventSubscriber::SimpleCallback, other);
+  event_pub_->configure();
+
+  // Only subscriptions with a prefix along the event path are candidates.
+  auto ec = event_pub_->createEventContext();
+  ec->path = "/tmp/osquery-fsevents/1/2";
+  event_pub_->matchSubscriptions(ec);
+  EXPECT_EQ(ec->candidates.size(), 1U);
+  EXPECT_TRUE(event_pub_->shouldFire(recursive, ec));
+  EXPECT_FALSE(event_pub_->shouldFire(other, ec));
+
+  // Path components are compared without case.
+  ec = event_pub_->createEventContext();
+  ec->path = "/VAR/log/other.log";
+  event_pub_->matchSubscriptions(ec);
+  EXPECT_EQ(ec->candidates.count(other.get()), 1U);
+
+  ec = event_pub_->createEventContext();
+  ec->path = "/usr/bin/true";
+  event_pub_->matchSubscriptions(ec);
+  EXPECT_TRUE(ec->candidates.empty());
+  EXPECT_FALSE(event_pub_->shouldFire(recursive, ec));
+
+  // Wildcard directories are matched as components of the event path.
+  auto ssh = sub->GetSubscription("/Users/*/.ssh/*");
+  sub->subscribe(&TestFSEventsEventSubscriber::SimpleCallback, ssh);
+  event_pub_->configure();
+  ec = event_pub_->createEventContext();
+  ec->path = "/Users/user/.ssh/authorized_keys";
+  event_pub_->matchSubscriptions(ec);
+  EXPECT_EQ(ec->candidates.size(), 1U);
+  EXPECT_EQ(ec->candidates.count(ssh.get()), 1U);
+
+  EventFactory::deregisterEventPublisher("fsevents");
+}
 }
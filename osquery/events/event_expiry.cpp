@@ -0,0 +1,48 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/events.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/event_expiry.h"
+
+namespace osquery {
+
+bool EventExpirationRunner::expire() {
+  bool remaining = false;
+  for (const auto& name : EventFactory::subscriberNames()) {
+    auto subscriber = EventFactory::getEventSubscriber(name);
+    if (subscriber == nullptr) {
+      continue;
+    }
+
+    auto removed = subscriber->expireEvents(budget_);
+    if (removed > 0) {
+      VLOG(1) << "Expired " << removed << " events for subscriber: " << name;
+    }
+    remaining = remaining || (removed >= budget_);
+    if (interrupted()) {
+      break;
+    }
+  }
+  return remaining;
+}
+
+void EventExpirationRunner::start() {
+  while (!interrupted()) {
+    if (expire()) {
+      // Continue expiring soon, but yield between passes.
+      pause();
+    } else {
+      pauseMilli(interval_ * 1000);
+    }
+  }
+}
+}
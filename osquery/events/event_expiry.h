@@ -0,0 +1,44 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <osquery/dispatcher.h>
+
+namespace osquery {
+
+/**
+ * @brief A Dispatcher service expiring stored events incrementally.
+ *
+ * Each pass asks every subscriber to expire up to a budget of events. When a
+ * subscriber exhausts its budget the next pass starts shortly after,
+ * otherwise the service waits for the expiration interval.
+ */
+class EventExpirationRunner : public InternalRunnable {
+ public:
+  EventExpirationRunner(size_t interval, size_t budget)
+      : interval_(interval), budget_(budget) {}
+
+ public:
+  /// The Dispatcher thread entry point.
+  void start() override;
+
+ private:
+  /// Expire events for each subscriber, return true if work remains.
+  bool expire();
+
+ private:
+  /// Seconds between expiration passes.
+  size_t interval_{0};
+
+  /// Approximate max events each subscriber expires per pass.
+  size_t budget_{0};
+};
+}
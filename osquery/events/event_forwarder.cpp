@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+
+#include "osquery/events/event_forwarder.h"
+
+namespace osquery {
+
+EventForwarder::EventForwarder(std::vector<std::string> loggers,
+                               size_t size,
+                               size_t batch,
+                               size_t rate)
+    : loggers_(std::move(loggers)),
+      ring_(std::max(size, static_cast<size_t>(1))),
+      batch_(std::max(batch, static_cast<size_t>(1))),
+      rate_(rate) {
+  auto now = std::chrono::steady_clock::now();
+  for (const auto& logger : loggers_) {
+    // Each logger starts with a full second of tokens.
+    auto& limiter = limiters_[logger];
+    limiter.tokens = static_cast<double>(rate_);
+    limiter.refilled = now;
+    stats_[logger] = EventForwarderStats();
+  }
+}
+
+void EventForwarder::push(std::string&& event) {
+  bool notify = false;
+  {
+    WriteLock lock(mutex_);
+    if (count_ == ring_.size()) {
+      // The ring is full, replace the oldest event.
+      ring_[head_] = std::move(event);
+      head_ = (head_ + 1) % ring_.size();
+      dropped_++;
+    } else {
+      ring_[(head_ + count_) % ring_.size()] = std::move(event);
+      count_++;
+    }
+    notify = (count_ == batch_);
+  }
+
+  if (notify) {
+    queued_.notify_one();
+  }
+}
+
+size_t EventForwarder::limit(const std::string& logger, size_t count) {
+  if (rate_ == 0) {
+    return count;
+  }
+
+  auto& limiter = limiters_[logger];
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed = now - limiter.refilled;
+  limiter.refilled = now;
+  limiter.tokens = std::min(static_cast<double>(rate_),
+                            limiter.tokens + elapsed.count() * rate_);
+
+  auto allowed = std::min(count, static_cast<size_t>(limiter.tokens));
+  limiter.tokens -= allowed;
+  return allowed;
+}
+
+size_t EventForwarder::flush() {
+  WriteLock flush_lock(flush_mutex_);
+
+  // Join a batch of events, recording where each event ends.
+  std::string events;
+  std::vector<size_t> ends;
+  {
+    WriteLock lock(mutex_);
+    auto count = std::min(count_, batch_);
+    ends.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      auto& event = ring_[head_];
+      if (!events.empty()) {
+        events += '\n';
+      }
+      events += event;
+      ends.push_back(events.size());
+      event.clear();
+      head_ = (head_ + 1) % ring_.size();
+      count_--;
+    }
+  }
+
+  if (ends.empty()) {
+    return 0;
+  }
+
+  for (const auto& logger : loggers_) {
+    size_t allowed = 0;
+    {
+      WriteLock lock(mutex_);
+      allowed = limit(logger, ends.size());
+      stats_[logger].limited += ends.size() - allowed;
+    }
+
+    if (allowed == 0) {
+      continue;
+    }
+
+    // A rate limited logger receives the oldest events in the batch.
+    auto status = Registry::call(
+        "logger",
+        logger,
+        {{"events",
+          (allowed == ends.size()) ? events
+                                   : events.substr(0, ends[allowed - 1])}});
+
+    WriteLock lock(mutex_);
+    if (status.ok()) {
+      stats_[logger].forwarded += allowed;
+    } else {
+      stats_[logger].failed += allowed;
+    }
+  }
+  return ends.size();
+}
+
+void EventForwarder::wait(std::chrono::milliseconds timeout) {
+  std::unique_lock<Mutex> lock(mutex_);
+  queued_.wait_for(
+      lock, timeout, [this]() { return stopping_ || count_ >= batch_; });
+}
+
+void EventForwarder::stop() {
+  {
+    WriteLock lock(mutex_);
+    stopping_ = true;
+  }
+  queued_.notify_all();
+}
+
+size_t EventForwarder::size() const {
+  WriteLock lock(mutex_);
+  return count_;
+}
+
+size_t EventForwarder::dropped() const {
+  WriteLock lock(mutex_);
+  return dropped_;
+}
+
+std::map<std::string, EventForwarderStats> EventForwarder::stats() const {
+  WriteLock lock(mutex_);
+  return stats_;
+}
+
+void EventForwardRunner::start() {
+  size_t dropped = 0;
+  while (!interrupted()) {
+    forwarder_->wait(std::chrono::milliseconds(interval_));
+    while (forwarder_->flush() > 0 && !interrupted()) {
+      // Continue while a backlog exists.
+    }
+
+    auto total = forwarder_->dropped();
+    if (total > dropped) {
+      LOG(WARNING) << "Event forwarding queue dropped " << total - dropped
+                   << " events";
+      dropped = total;
+    }
+  }
+
+  // Forward the remaining events before stopping.
+  while (forwarder_->flush() > 0) {
+    // Each flush forwards up to a batch.
+  }
+}
+}
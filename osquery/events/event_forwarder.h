@@ -0,0 +1,165 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/dispatcher.h>
+
+namespace osquery {
+
+/// Counters describing the events forwarded to one logger plugin.
+struct EventForwarderStats {
+  /// The number of events given to the logger plugin.
+  size_t forwarded{0};
+
+  /// The number of events dropped by the rate limit.
+  size_t limited{0};
+
+  /// The number of events the logger plugin could not log.
+  size_t failed{0};
+};
+
+/**
+ * @brief A bounded ring of serialized event rows waiting for logger plugins.
+ *
+ * Subscribers push each added row and continue, a service thread flushes the
+ * rows to every forwarding logger plugin in groups. When the ring is full the
+ * oldest row is dropped. Each logger plugin may be limited to a number of
+ * events per second, events over the limit are dropped for that logger.
+ */
+class EventForwarder : private boost::noncopyable {
+ public:
+  /**
+   * @brief Create a forwarder.
+   *
+   * @param loggers The logger plugins receiving events.
+   * @param size The max number of queued events.
+   * @param batch The max number of events in each logger call.
+   * @param rate The max events per second for each logger, 0 is unlimited.
+   */
+  EventForwarder(std::vector<std::string> loggers,
+                 size_t size,
+                 size_t batch,
+                 size_t rate);
+
+  /// Queue a serialized event row, drops the oldest row if full.
+  void push(std::string&& event);
+
+  /**
+   * @brief Forward up to a batch of queued events to each logger.
+   *
+   * @return the number of events removed from the ring.
+   */
+  size_t flush();
+
+  /// Wait up to a timeout for a full batch of events.
+  void wait(std::chrono::milliseconds timeout);
+
+  /// Wake a waiting service thread before stopping.
+  void stop();
+
+  /// The number of queued events.
+  size_t size() const;
+
+  /// The number of events dropped because the ring was full.
+  size_t dropped() const;
+
+  /// Get a copy of the counters for each logger.
+  std::map<std::string, EventForwarderStats> stats() const;
+
+ private:
+  /// Remove the rate limited events for a logger, refill its tokens.
+  size_t limit(const std::string& logger, size_t count);
+
+ private:
+  /// A per-logger token bucket.
+  struct Limiter {
+    /// The available event tokens.
+    double tokens{0};
+
+    /// The last refill time.
+    std::chrono::steady_clock::time_point refilled;
+  };
+
+  /// The logger plugins receiving events.
+  std::vector<std::string> loggers_;
+
+  /// The ring of queued events.
+  std::vector<std::string> ring_;
+
+  /// The position of the oldest queued event.
+  size_t head_{0};
+
+  /// The number of queued events.
+  size_t count_{0};
+
+  /// The max number of events in each logger call.
+  size_t batch_{1};
+
+  /// The max events per second for each logger.
+  size_t rate_{0};
+
+  /// The number of rows dropped because the ring was full.
+  size_t dropped_{0};
+
+  /// Set when stopping, waiting threads return.
+  bool stopping_{false};
+
+  /// Per-logger rate limits.
+  std::map<std::string, Limiter> limiters_;
+
+  /// Per-logger counters.
+  std::map<std::string, EventForwarderStats> stats_;
+
+  /// Protect the ring and counters.
+  mutable Mutex mutex_;
+
+  /// Serialize flushes, the logger calls happen outside of the ring lock.
+  Mutex flush_mutex_;
+
+  /// Signaled when a full batch is queued.
+  std::condition_variable queued_;
+};
+
+using EventForwarderRef = std::shared_ptr<EventForwarder>;
+
+/// A Dispatcher service thread that flushes forwarded events.
+class EventForwardRunner : public InternalRunnable {
+ public:
+  EventForwardRunner(EventForwarderRef forwarder, size_t interval)
+      : forwarder_(std::move(forwarder)), interval_(interval) {}
+
+ public:
+  /// The Dispatcher thread entry point.
+  void start() override;
+
+  /// The Dispatcher interrupt point.
+  void stop() override {
+    forwarder_->stop();
+  }
+
+ private:
+  /// The forwarder this thread flushes.
+  EventForwarderRef forwarder_;
+
+  /// Max milliseconds an event waits for a full batch.
+  size_t interval_{0};
+};
+}
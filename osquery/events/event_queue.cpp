@@ -0,0 +1,179 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <thread>
+
+#include <osquery/logger.h>
+
+#include "osquery/events/event_queue.h"
+
+namespace osquery {
+
+bool getDispatchPolicy(const std::string& name, EventDispatchPolicy& policy) {
+  if (name == "drop_oldest") {
+    policy = DISPATCH_DROP_OLDEST;
+  } else if (name == "block") {
+    policy = DISPATCH_BLOCK;
+  } else if (name == "sample") {
+    policy = DISPATCH_SAMPLE;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+EventDispatchQueue::EventDispatchQueue(size_t size,
+                                       EventDispatchPolicy policy,
+                                       size_t sample_rate)
+    : policy_(policy), sample_rate_((sample_rate > 0) ? sample_rate : 1) {
+  size_t capacity = 2;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+
+  mask_ = capacity - 1;
+  cells_.reset(new Cell[capacity]);
+  for (size_t i = 0; i < capacity; ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+bool EventDispatchQueue::tryPush(const EventDispatchItem& item) {
+  Cell* cell = nullptr;
+  auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos & mask_];
+    auto sequence = cell->sequence.load(std::memory_order_acquire);
+    auto diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      // The cell is free, claim the position.
+      if (enqueue_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // The cell has not been consumed, the queue is full.
+      return false;
+    } else {
+      pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  cell->item = item;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool EventDispatchQueue::pop(EventDispatchItem& item) {
+  Cell* cell = nullptr;
+  auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+  while (true) {
+    cell = &cells_[pos & mask_];
+    auto sequence = cell->sequence.load(std::memory_order_acquire);
+    auto diff =
+        static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+    if (diff == 0) {
+      // The cell was produced, claim the position.
+      if (dequeue_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // The queue is empty.
+      return false;
+    } else {
+      pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+  }
+
+  item = std::move(cell->item);
+  cell->item = EventDispatchItem();
+  cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+bool EventDispatchQueue::push(const SubscriptionRef& subscription,
+                              const EventContextRef& ec) {
+  EventDispatchItem item = {subscription, ec};
+
+  if (policy_ == DISPATCH_SAMPLE && size() > capacity() / 2) {
+    // Only queue 1 of every sample_rate_ events while the queue is backed up.
+    if (sampled_++ % sample_rate_ != 0) {
+      dropped_++;
+      return false;
+    }
+  }
+
+  bool queued = true;
+  while (!tryPush(item)) {
+    if (policy_ == DISPATCH_DROP_OLDEST) {
+      // Make room by discarding the oldest event.
+      EventDispatchItem oldest;
+      if (pop(oldest)) {
+        dropped_++;
+        queued = false;
+      }
+    } else if (policy_ == DISPATCH_BLOCK && !stopping_) {
+      notify();
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    } else {
+      dropped_++;
+      return false;
+    }
+  }
+
+  notify();
+  return queued;
+}
+
+void EventDispatchQueue::notify() {
+  if (waiting_) {
+    std::lock_guard<std::mutex> lock(wait_mutex_);
+    wait_condition_.notify_one();
+  }
+}
+
+void EventDispatchQueue::wait(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(wait_mutex_);
+  waiting_ = true;
+  // Check again after announcing the wait, a push may have been missed.
+  if (size() == 0 && !stopping_) {
+    wait_condition_.wait_for(lock, timeout);
+  }
+  waiting_ = false;
+}
+
+void EventDispatchQueue::stop() {
+  stopping_ = true;
+  std::lock_guard<std::mutex> lock(wait_mutex_);
+  wait_condition_.notify_all();
+}
+
+size_t EventDispatchQueue::size() const {
+  auto enqueue = enqueue_pos_.load(std::memory_order_relaxed);
+  auto dequeue = dequeue_pos_.load(std::memory_order_relaxed);
+  return (enqueue > dequeue) ? enqueue - dequeue : 0;
+}
+
+void EventDispatchRunner::start() {
+  VLOG(1) << "Starting event dispatch for subscriber: " << name_;
+  while (!interrupted()) {
+    EventDispatchItem item;
+    if (!queue_->pop(item)) {
+      queue_->wait(std::chrono::milliseconds(200));
+      continue;
+    }
+
+    if (item.subscription->callback != nullptr) {
+      item.subscription->callback(item.ec, item.subscription->context);
+    }
+  }
+}
+}
@@ -0,0 +1,184 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/dispatcher.h>
+#include <osquery/events.h>
+
+namespace osquery {
+
+/// How a full dispatch queue treats a newly fired event.
+enum EventDispatchPolicy {
+  /// Remove the oldest queued event to make room.
+  DISPATCH_DROP_OLDEST,
+
+  /// Wait on the publisher thread until the subscriber makes room.
+  DISPATCH_BLOCK,
+
+  /// Queue a sample of events once the queue is half full, drop when full.
+  DISPATCH_SAMPLE,
+};
+
+/// Parse a policy name, drop_oldest, block, or sample.
+bool getDispatchPolicy(const std::string& name, EventDispatchPolicy& policy);
+
+/// A fired event waiting for a subscriber callback.
+struct EventDispatchItem {
+  /// The subscription whose callback will receive the event.
+  SubscriptionRef subscription;
+
+  /// The fired event.
+  EventContextRef ec;
+};
+
+/**
+ * @brief A bounded lock-free queue between publishers and a subscriber.
+ *
+ * Publisher threads push (produce) fired events and a single subscriber
+ * worker pops (consumes) them. The queue is an array of sequenced cells, a
+ * producer or consumer claims a cell with a compare-and-swap on its position
+ * and publishes the cell by advancing the cell's sequence. This allows a
+ * producer to also consume when dropping the oldest event.
+ *
+ * The worker sleeps on a condition only when the queue is empty.
+ */
+class EventDispatchQueue : private boost::noncopyable {
+ public:
+  /**
+   * @brief Create a queue.
+   *
+   * @param size The requested capacity, rounded up to a power of 2.
+   * @param policy The overflow policy applied when the queue is full.
+   * @param sample_rate When sampling, queue 1 of every sample_rate events.
+   */
+  EventDispatchQueue(size_t size,
+                     EventDispatchPolicy policy,
+                     size_t sample_rate = 10);
+
+  /**
+   * @brief Queue a fired event, applying the overflow policy.
+   *
+   * @return false if the event (or an older event) was dropped.
+   */
+  bool push(const SubscriptionRef& subscription, const EventContextRef& ec);
+
+  /// Dequeue the oldest event, returns false if the queue is empty.
+  bool pop(EventDispatchItem& item);
+
+  /// Wait up to a timeout for an event to be pushed.
+  void wait(std::chrono::milliseconds timeout);
+
+  /// Wake a waiting worker, and unblock publishers, before stopping.
+  void stop();
+
+  /// The approximate number of queued events.
+  size_t size() const;
+
+  /// The queue capacity.
+  size_t capacity() const {
+    return mask_ + 1;
+  }
+
+  /// The number of events dropped because of the overflow policy.
+  size_t dropped() const {
+    return dropped_;
+  }
+
+ private:
+  /// Attempt to queue an event without applying a policy.
+  bool tryPush(const EventDispatchItem& item);
+
+  /// Wake a waiting worker.
+  void notify();
+
+ private:
+  struct Cell {
+    std::atomic<size_t> sequence;
+    EventDispatchItem item;
+  };
+
+  /// The ring of cells.
+  std::unique_ptr<Cell[]> cells_;
+
+  /// The capacity - 1, used to map positions to cells.
+  size_t mask_{0};
+
+  /// The next position to produce.
+  std::atomic<size_t> enqueue_pos_{0};
+
+  /// The next position to consume.
+  std::atomic<size_t> dequeue_pos_{0};
+
+  /// The overflow policy.
+  EventDispatchPolicy policy_;
+
+  /// The sampling rate when the queue is half full.
+  size_t sample_rate_{1};
+
+  /// A count of events offered while sampling.
+  std::atomic<size_t> sampled_{0};
+
+  /// The number of dropped events.
+  std::atomic<size_t> dropped_{0};
+
+  /// Set while the worker is waiting for events.
+  std::atomic<bool> waiting_{false};
+
+  /// Set when the queue is stopping, publishers no longer block.
+  std::atomic<bool> stopping_{false};
+
+  /// Protects the wait condition.
+  std::mutex wait_mutex_;
+
+  /// Signaled when an event is pushed while the worker is waiting.
+  std::condition_variable wait_condition_;
+};
+
+using EventDispatchQueueRef = std::shared_ptr<EventDispatchQueue>;
+
+/// A Dispatcher service calling a subscriber's callbacks for queued events.
+class EventDispatchRunner : public InternalRunnable {
+ public:
+  EventDispatchRunner(EventSubscriberID name, EventDispatchQueueRef queue)
+      : name_(std::move(name)), queue_(std::move(queue)) {}
+
+ public:
+  /// The Dispatcher thread entry point.
+  void start() override;
+
+  /// The Dispatcher interrupt point.
+  void stop() override {
+    queue_->stop();
+  }
+
+ protected:
+  /// Subscribers drain their queue before it drops events.
+  ThreadRole role() const override {
+    return ThreadRole::LATENCY;
+  }
+
+ private:
+  /// The subscriber name, used for logging.
+  EventSubscriberID name_;
+
+  /// The subscriber's queue.
+  EventDispatchQueueRef queue_;
+};
+}
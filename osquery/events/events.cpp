@@ -8,8 +8,10 @@
  *
  */
 
+#include <algorithm>
 #include <chrono>
 #include <exception>
+#include <future>
 #include <thread>
 
 #include <boost/algorithm/string.hpp>
@@ -24,6 +26,10 @@
 #include <osquery/system.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/perf.h"
+#include "osquery/events/event_expiry.h"
+#include "osquery/events/event_forwarder.h"
+#include "osquery/events/event_queue.h"
 
 namespace osquery {
 
@@ -51,12 +57,251 @@ FLAG(uint64,
 // overriding in subclasses
 FLAG(uint64, events_max, 1000, "Maximum number of events per type to buffer");
 
+// Access this flag through EventSubscriberPlugin::getEventsBatchSize to allow
+// for overriding in subclasses
+FLAG(uint64,
+     events_batch_size,
+     0,
+     "Number of events per subscriber to write together (default 0 disables)");
+
+FLAG(uint64,
+     events_dispatch_queue_size,
+     0,
+     "Queue fired events for subscriber threads (default 0 calls inline)");
+
+FLAG(string,
+     events_dispatch_policy,
+     "drop_oldest",
+     "Full dispatch queue policy: drop_oldest, block, or sample");
+
+FLAG(uint64,
+     events_dispatch_sample_rate,
+     10,
+     "When sampling, queue 1 of N events while the queue is half full");
+
+FLAG(bool,
+     events_binary_rows,
+     true,
+     "Store event rows using the compact binary encoding instead of JSON");
+
+FLAG(uint64,
+     events_expiry_interval,
+     10,
+     "Seconds between background event expiration passes (0 expires inline)");
+
+FLAG(uint64,
+     events_expiry_budget,
+     1024,
+     "Approximate max events each subscriber expires per expiration pass");
+
+FLAG(uint64,
+     events_batch_interval,
+     1,
+     "Maximum seconds an event may wait in a batch while events are added");
+
+FLAG(uint64,
+     events_forward_queue_size,
+     8192,
+     "Max events queued for forwarding loggers (default 0 forwards inline)");
+
+FLAG(uint64,
+     events_forward_batch_size,
+     256,
+     "Max events given to a forwarding logger in each call");
+
+FLAG(uint64,
+     events_forward_latency,
+     100,
+     "Max milliseconds a forwarded event waits for a full batch");
+
+FLAG(uint64,
+     events_forward_rate,
+     0,
+     "Max events per second forwarded to each logger (default 0 unlimited)");
+
 const std::vector<size_t> kEventTimeLists = {
     1 * 60 * 60, // 1 hour
     1 * 60, // 1 minute
     10, // 10 seconds
 };
 
+/// Width of each hex-encoded field within a fixed-width event record.
+const size_t kEventRecordFieldSize = 16;
+
+/// Width of an (EventID, EventTime) entry within a record log.
+const size_t kEventRecordSize = kEventRecordFieldSize * 2;
+
+/// Width of the zero-padded bin within a record log key.
+const size_t kEventBinWidth = 20;
+
+/// The number of event rows requested by each multiple key lookup.
+const size_t kEventsMultiGetSize = 1024;
+
+/// The number of EventIDs within each bucket of the EventID-ordered log.
+const size_t kEventIDLogSize = 1024;
+
+/// Zero-pad a bin such that keys sort by time.
+static inline std::string padBin(const std::string& bin) {
+  if (bin.size() >= kEventBinWidth) {
+    return bin;
+  }
+  return std::string(kEventBinWidth - bin.size(), '0') + bin;
+}
+
+/**
+ * @brief Create the record log key for a list type's bin.
+ *
+ * Bins are zero-padded so the keys of a list type sort by time, allowing the
+ * finest list type to be read with a single range scan.
+ */
+static inline std::string recordLogKey(const std::string& ns,
+                                       const std::string& list_type,
+                                       const std::string& bin) {
+  return "log." + ns + "." + list_type + "." + padBin(bin);
+}
+
+/// Create the EventID-ordered log key for a bucket of EventIDs.
+static inline std::string eventIDLogKey(const std::string& ns,
+                                        const std::string& bucket) {
+  return "eids." + ns + "." + padBin(bucket);
+}
+
+/// The version tag beginning a binary-encoded event row.
+const char kEventRowVersion = '\x01';
+
+/// Append a LEB128 variable-length integer.
+static inline void appendVarint(size_t value, std::string& data) {
+  while (value >= 0x80) {
+    data.push_back(static_cast<char>((value & 0x7f) | 0x80));
+    value >>= 7;
+  }
+  data.push_back(static_cast<char>(value));
+}
+
+/// Read a LEB128 variable-length integer, advancing the offset.
+static inline bool readVarint(const std::string& data,
+                              size_t& offset,
+                              size_t& value) {
+  value = 0;
+  for (size_t shift = 0; offset < data.size() && shift < 64; shift += 7) {
+    auto byte = static_cast<unsigned char>(data[offset++]);
+    value |= static_cast<size_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Read a length-prefixed string, advancing the offset.
+static inline bool readField(const std::string& data,
+                             size_t& offset,
+                             std::string& field) {
+  size_t length = 0;
+  if (!readVarint(data, offset, length) || length > data.size() - offset) {
+    return false;
+  }
+  field.assign(data, offset, length);
+  offset += length;
+  return true;
+}
+
+/// Column values are truncated within column index keys.
+const size_t kEventColumnValueMax = 255;
+
+/**
+ * @brief Create the column index key prefix for a coarsest bin.
+ *
+ * Column indexes are kept per coarsest bin so they expire with that bin.
+ */
+static inline std::string columnBinKey(const std::string& ns,
+                                       const std::string& bin) {
+  return "column." + ns + "." + padBin(bin) + ".";
+}
+
+/// Create the column index key prefix for a coarsest bin and column.
+static inline std::string columnIndexKey(const std::string& ns,
+                                         const std::string& bin,
+                                         const std::string& column) {
+  return columnBinKey(ns, bin) + column + ".";
+}
+
+/**
+ * @brief Normalize a column value for a column index key.
+ *
+ * SQLite's LIKE is case-insensitive so values are indexed in lowercase, and
+ * truncated. An index lookup may return extra events, never fewer, and the
+ * query constraints are still applied to the rows.
+ */
+static inline std::string columnIndexValue(const std::string& value) {
+  return boost::algorithm::to_lower_copy(
+      value.substr(0, kEventColumnValueMax));
+}
+
+/// Encode a fixed-width hex field.
+static inline void encodeRecordField(unsigned long long value,
+                                     std::string& record) {
+  static const char* kHex = "0123456789abcdef";
+  for (size_t i = kEventRecordFieldSize; i > 0; --i) {
+    record.push_back(kHex[(value >> ((i - 1) * 4)) & 0xf]);
+  }
+}
+
+/// Decode a fixed-width hex field.
+static inline bool decodeRecordField(const char* field,
+                                     unsigned long long& value) {
+  value = 0;
+  for (size_t i = 0; i < kEventRecordFieldSize; ++i) {
+    auto c = field[i];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= (c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      value |= (c - 'a' + 10);
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Decode the entries of a fixed-width record log.
+static void decodeRecordLog(const std::string& log,
+                            std::vector<EventRecord>& records) {
+  records.reserve(records.size() + log.size() / kEventRecordSize);
+  for (size_t i = 0; i + kEventRecordSize <= log.size();
+       i += kEventRecordSize) {
+    unsigned long long eid, time;
+    if (decodeRecordField(log.data() + i, eid) &&
+        decodeRecordField(log.data() + i + kEventRecordFieldSize, time)) {
+      records.push_back(std::make_pair(std::to_string(eid), time));
+    }
+  }
+}
+
+/// Encode an (eid, time) record entry for a record log or column index.
+static inline bool encodeRecord(const EventRecord& record,
+                                std::string& entries) {
+  unsigned long long eid = 0;
+  if (!safeStrtoull(record.first, 10, eid)) {
+    LOG(ERROR) << "Invalid EventID: " << record.first;
+    return false;
+  }
+  encodeRecordField(eid, entries);
+  encodeRecordField(record.second, entries);
+  return true;
+}
+
+/// Append each key's encoded record entries.
+static void appendRecords(const std::map<std::string, std::string>& appends) {
+  for (const auto& entries : appends) {
+    auto status = appendDatabaseValue(kEvents, entries.first, entries.second);
+    if (!status.ok()) {
+      LOG(ERROR) << "Could not append Event Record key: " << entries.first;
+    }
+  }
+}
+
 static inline EventTime timeFromRecord(const std::string& record) {
   // Convert a stored index "as string bytes" to a time value.
   long long afinite;
@@ -66,9 +311,133 @@ static inline EventTime timeFromRecord(const std::string& record) {
   return afinite;
 }
 
+/// Decode the comma-joined EID:TIME records written by previous versions.
+static void decodeLegacyRecords(const std::string& value,
+                                std::vector<EventRecord>& records) {
+  // Each list is tokenized into a record=event_id:time.
+  std::vector<std::string> bin_records;
+  boost::split(bin_records, value, boost::is_any_of(",:"));
+
+  auto bin_it = bin_records.begin();
+  // Iterate over every 2 items: EID:TIME.
+  for (; bin_it != bin_records.end(); bin_it++) {
+    const auto& eid = *bin_it;
+    if (++bin_it == bin_records.end()) {
+      break;
+    }
+    EventTime time = timeFromRecord(*bin_it);
+    records.push_back(std::make_pair(eid, time));
+  }
+}
+
+/// The calling thread's scheduled query cursors.
+static thread_local EventCursorScope* kEventCursors{nullptr};
+
+EventCursorScope::EventCursorScope(const std::string& query)
+    : query_(query), previous_(kEventCursors) {
+  kEventCursors = this;
+}
+
+EventCursorScope::~EventCursorScope() {
+  kEventCursors = previous_;
+}
+
+EventCursorScope* EventCursorScope::current() {
+  return kEventCursors;
+}
+
+bool EventCursorScope::begin(const std::string& ns, size_t& after) {
+  auto cursor = cursors_.find(ns);
+  if (cursor != cursors_.end()) {
+    after = cursor->second.first;
+    return true;
+  }
+
+  std::string value;
+  getDatabaseValue(kEvents, "cursor." + ns + "." + query_, value);
+  unsigned long long eid = 0;
+  bool stored = !value.empty() && safeStrtoull(value, 10, eid);
+  after = static_cast<size_t>(eid);
+  cursors_[ns] = std::make_pair(after, after);
+  return stored;
+}
+
+void EventCursorScope::advance(const std::string& ns, size_t last) {
+  auto& cursor = cursors_[ns];
+  cursor.second = std::max(cursor.second, last);
+}
+
+void EventCursorScope::commit() {
+  for (const auto& cursor : cursors_) {
+    setDatabaseValue(kEvents,
+                     "cursor." + cursor.first + "." + query_,
+                     std::to_string(cursor.second.second));
+  }
+}
+
 QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
+  if (forward_only_) {
+    // Events were forwarded and never stored, an empty result would mislead.
+    LOG(WARNING) << "Cannot query forward-only event subscriber: " << getName();
+    return QueryData();
+  }
+
   // Stop is an unsigned (-1), our end of time equivalent.
   EventTime start = 0, stop = -1;
+  auto records = getQueryRecords(context, start, stop);
+  return getEvents(records, start, stop, context.order);
+}
+
+RowGeneratorRef EventSubscriberPlugin::genTableRows(
+    const std::shared_ptr<EventSubscriberPlugin>& subscriber,
+    QueryContext& context) {
+  if (subscriber->forward_only_ || context.order == RowOrder::NONE) {
+    return std::make_shared<QueryDataGenerator>(subscriber->genTable(context));
+  }
+
+  EventTime start = 0, stop = -1;
+  auto records = subscriber->getQueryRecords(context, start, stop);
+  auto keys = std::make_shared<std::vector<std::string>>(
+      subscriber->getEventKeys(records, start, stop, context.order));
+  subscriber->updateExpireTime();
+
+  size_t offset = 0;
+  size_t batch = kEventsMultiGetSize;
+  if (context.limit > 0) {
+    batch = std::min(context.limit, kEventsMultiGetSize);
+  }
+  return std::make_shared<FunctionRowGenerator>(
+      [subscriber, keys, offset, batch](QueryData& rows) mutable {
+        if (offset >= keys->size()) {
+          return false;
+        }
+        auto last = std::min(offset + batch, keys->size());
+        subscriber->getEventRows(*keys, offset, last, rows);
+        offset = last;
+        batch = kEventsMultiGetSize;
+        return true;
+      });
+}
+
+std::vector<EventRecord> EventSubscriberPlugin::getQueryRecords(
+    QueryContext& context, EventTime& start, EventTime& stop) {
+  auto cursors = EventCursorScope::current();
+  if (cursors != nullptr && kToolType == ToolType::DAEMON &&
+      FLAGS_events_optimize && context.constraints["time"].getAll().empty()) {
+    // A scheduled query reads exactly the events added since its last run.
+    size_t after = 0;
+    if (!cursors->begin(dbNamespace(), after)) {
+      // A new cursor continues from the previous optimization time.
+      start = optimize_time_;
+    }
+    prepareRange(start, stop);
+
+    size_t last = after;
+    auto records = getEventIDRecords(after, last);
+    cursors->advance(dbNamespace(), last);
+    return records;
+  }
+
   if (context.constraints["time"].getAll().size() > 0) {
     // Use the 'time' constraint to optimize backing-store lookups.
     for (const auto& constraint : context.constraints["time"].getAll()) {
@@ -98,7 +467,15 @@ QueryData EventSubscriberPlugin::genTable(QueryContext& context) {
     setDatabaseValue(kEvents, index_key, std::to_string(optimize_time_));
   }
 
-  return get(start, stop);
+  // Use the column indexes if the subscriber keeps any for the constraints.
+  if (!getIndexedColumns().empty()) {
+    prepareRange(start, stop);
+    std::vector<EventRecord> records;
+    if (getColumnRecords(context, start, stop, records)) {
+      return records;
+    }
+  }
+  return getRangeRecords(start, stop);
 }
 
 void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
@@ -125,14 +502,97 @@ void EventPublisherPlugin::fire(const EventContextRef& ec, EventTime time) {
   }
 
   WriteLock lock(subscription_lock_);
-  for (const auto& subscription : subscriptions_) {
+  auto dispatch = [this, &ec](const SubscriptionRef& subscription) {
     auto es = EventFactory::getEventSubscriber(subscription->subscriber_name);
     if (es != nullptr && es->state() == SUBSCRIBER_RUNNING) {
-      fireCallback(subscription, ec);
+      if (es->dispatch_queue_ == nullptr) {
+        fireCallback(subscription, ec);
+      } else if (shouldFireCallback(subscription, ec)) {
+        // The subscriber's dispatch thread will call the callback.
+        es->dispatch_queue_->push(subscription, ec);
+      }
+    }
+  };
+
+  // Subscriptions may also be changed by the publisher itself.
+  if (dispatch_dirty_ || dispatch_count_ != subscriptions_.size()) {
+    indexDispatchKeys();
+  }
+
+  // Without keyed subscriptions, every event scans every subscription.
+  dispatch_keys_.clear();
+  if (ec == nullptr || dispatch_index_.empty() ||
+      !getEventKeys(ec, dispatch_keys_)) {
+    for (const auto& subscription : subscriptions_) {
+      dispatch(subscription);
     }
+    return;
+  }
+
+  // Only the subscriptions sharing a key with the event are candidates.
+  auto bucket = [this](size_t key) -> const std::vector<size_t>& {
+    auto candidates = dispatch_index_.find(key);
+    return (candidates == dispatch_index_.end()) ? dispatch_any_
+                                                 : candidates->second;
+  };
+
+  if (dispatch_keys_.size() == 1) {
+    for (const auto& position : bucket(dispatch_keys_[0])) {
+      dispatch(subscriptions_[position]);
+    }
+    return;
+  }
+
+  std::vector<size_t> positions;
+  if (dispatch_keys_.empty()) {
+    positions = dispatch_any_;
+  }
+  for (const auto& key : dispatch_keys_) {
+    const auto& candidates = bucket(key);
+    positions.insert(positions.end(), candidates.begin(), candidates.end());
+  }
+  std::sort(positions.begin(), positions.end());
+  positions.erase(std::unique(positions.begin(), positions.end()),
+                  positions.end());
+  for (const auto& position : positions) {
+    dispatch(subscriptions_[position]);
   }
 }
 
+void EventPublisherPlugin::indexDispatchKeys() {
+  dispatch_index_.clear();
+  dispatch_any_.clear();
+
+  // The keys of each subscription, false if it accepts any key.
+  std::vector<std::pair<bool, DispatchKeys>> keys(subscriptions_.size());
+  for (size_t i = 0; i < subscriptions_.size(); ++i) {
+    keys[i].first = getSubscriptionKeys(subscriptions_[i], keys[i].second);
+    for (const auto& key : keys[i].second) {
+      dispatch_index_[key];
+    }
+  }
+
+  for (size_t i = 0; i < subscriptions_.size(); ++i) {
+    if (!keys[i].first) {
+      dispatch_any_.push_back(i);
+      for (auto& candidates : dispatch_index_) {
+        candidates.second.push_back(i);
+      }
+      continue;
+    }
+
+    for (const auto& key : keys[i].second) {
+      auto& candidates = dispatch_index_[key];
+      if (candidates.empty() || candidates.back() != i) {
+        candidates.push_back(i);
+      }
+    }
+  }
+
+  dispatch_dirty_ = false;
+  dispatch_count_ = subscriptions_.size();
+}
+
 std::set<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
                                                         EventTime stop,
                                                         size_t list_key) {
@@ -240,29 +700,42 @@ std::set<std::string> EventSubscriberPlugin::getIndexes(EventTime start,
 void EventSubscriberPlugin::expireRecords(const std::string& list_type,
                                           const std::string& index,
                                           bool all) {
-  auto record_key = "records." + dbNamespace();
+  auto record_key = "records." + dbNamespace() + "." + list_type + "." + index;
+  auto log_key = recordLogKey(dbNamespace(), list_type, index);
   auto data_key = "data." + dbNamespace();
 
+  // Appends to the record log must not interleave with the rewrite.
+  WriteLock lock(event_record_lock_);
+
   // If the expirations is not removing all records, rewrite the persisting.
-  std::vector<std::string> persisting_records;
+  std::string persisting_records;
+  // The expired event data is removed as a single batch.
+  std::vector<std::string> expired_keys;
   // Request all records within this list-size + bin offset.
   auto expired_records = getRecords({list_type + "." + index});
   for (const auto& record : expired_records) {
     if (all || record.second <= expire_time_) {
-      deleteDatabaseValue(kEvents, data_key + "." + record.first);
+      expired_keys.push_back(data_key + "." + record.first);
     } else {
-      persisting_records.push_back(record.first + ":" +
-                                   std::to_string(record.second));
+      unsigned long long eid = 0;
+      safeStrtoull(record.first, 10, eid);
+      encodeRecordField(eid, persisting_records);
+      encodeRecordField(record.second, persisting_records);
     }
   }
 
-  // Either drop or overwrite the record list.
+  // Either drop or overwrite the record log, legacy records are migrated.
   if (all) {
-    deleteDatabaseValue(kEvents, record_key + "." + list_type + "." + index);
-  } else if (persisting_records.size() < expired_records.size()) {
-    auto new_records = boost::algorithm::join(persisting_records, ",");
-    setDatabaseValue(
-        kEvents, record_key + "." + list_type + "." + index, new_records);
+    expired_keys.push_back(log_key);
+    expired_keys.push_back(record_key);
+    deleteDatabaseValues(kEvents, expired_keys);
+    return;
+  }
+
+  deleteDatabaseValues(kEvents, expired_keys);
+  if (persisting_records.size() / kEventRecordSize < expired_records.size()) {
+    setDatabaseValue(kEvents, log_key, persisting_records);
+    deleteDatabaseValue(kEvents, record_key);
   }
 }
 
@@ -275,8 +748,15 @@ void EventSubscriberPlugin::expireIndexes(
   // Construct a mutable list of persisting indexes to rewrite as records.
   std::vector<std::string> persisting_indexes = indexes;
   // Remove the records using the list of expired indexes.
+  auto column_bins = (list_type == std::to_string(kEventTimeLists.front()));
   for (const auto& bin : expirations) {
     expireRecords(list_type, bin, true);
+    if (column_bins) {
+      // Column indexes for the coarsest bins expire with the bin.
+      std::vector<std::string> keys;
+      scanDatabaseKeys(kEvents, keys, columnBinKey(dbNamespace(), bin));
+      deleteDatabaseValues(kEvents, keys);
+    }
     persisting_indexes.erase(
         std::remove(persisting_indexes.begin(), persisting_indexes.end(), bin),
         persisting_indexes.end());
@@ -284,7 +764,10 @@ void EventSubscriberPlugin::expireIndexes(
 
   // Update the list of indexes with the non-expired indexes.
   auto new_indexes = boost::algorithm::join(persisting_indexes, ",");
+  WriteLock lock(event_record_lock_);
   setDatabaseValue(kEvents, index_key + "." + list_type, new_indexes);
+  // An expired bin may be reused, check the indexes on the next record.
+  record_bins_.clear();
 }
 
 void EventSubscriberPlugin::expireCheck(bool cleanup) {
@@ -315,11 +798,13 @@ void EventSubscriberPlugin::expireCheck(bool cleanup) {
     if (cleanup) {
       // Scan each of the keys in keys, if their ID portion is < min_key.
       // Nix them, this requires lots of conversions, use with care.
+      std::vector<std::string> expired_keys;
       for (const auto& key : keys) {
         if (std::stoul(key.substr(key.rfind('.') + 1)) < min_key) {
-          deleteDatabaseValue(kEvents, key);
+          expired_keys.push_back(key);
         }
       }
+      deleteDatabaseValues(kEvents, expired_keys);
     }
   }
 
@@ -331,7 +816,7 @@ void EventSubscriberPlugin::expireCheck(bool cleanup) {
 
   // Decode the value into a row structure to extract the time.
   Row r;
-  if (!deserializeRowJSON(content, r) || r.count("time") == 0) {
+  if (!decodeRow(content, r) || r.count("time") == 0) {
     return;
   }
 
@@ -346,91 +831,450 @@ void EventSubscriberPlugin::expireCheck(bool cleanup) {
   getIndexes(expire_time_, 0);
 }
 
+size_t EventSubscriberPlugin::expireEvents(size_t budget) {
+  if (!expire_events_) {
+    return 0;
+  }
+
+  // Buffered events must be written before their bins are expired.
+  flushEvents();
+
+  // Expire events older than the expiry, or overflowing events_max.
+  auto expire_time = expire_time_;
+  if (getEventsExpiry() > 0) {
+    expire_time = std::max<EventTime>(expire_time,
+                                      getUnixTime() - getEventsExpiry());
+  }
+
+  std::string eid_value;
+  getDatabaseValue(kEvents, "eid." + dbNamespace(), eid_value);
+  unsigned long long last_eid = 0;
+  if (safeStrtoull(eid_value, 10, last_eid) && last_eid > getEventsMax()) {
+    // The time of the most-recent overflowing event is the expiration time.
+    std::string content;
+    getDatabaseValue(kEvents,
+                     "data." + dbNamespace() + "." +
+                         std::to_string(last_eid - getEventsMax()),
+                     content);
+    Row r;
+    if (!content.empty() && decodeRow(content, r).ok() && r.count("time")) {
+      expire_time = std::max(expire_time, timeFromRecord(r.at("time")));
+    }
+  }
+
+  expire_time_ = expire_time;
+  if (expire_time == 0) {
+    return 0;
+  }
+
+  // Read the oldest whole bins of the finest list type that have expired.
+  // Every bin holds at least one event, so the budget bounds the bins read.
+  auto size = kEventTimeLists.back();
+  auto list_type = std::to_string(size);
+  auto expire_bin = expire_time / size;
+  DatabaseKeyValues bins;
+  scanDatabaseRange(kEvents,
+                    recordLogKey(dbNamespace(), list_type, "0"),
+                    recordLogKey(dbNamespace(), list_type,
+                                 std::to_string(expire_bin)),
+                    bins,
+                    budget + 1);
+
+  auto data_key = "data." + dbNamespace() + ".";
+  auto prefix_size = recordLogKey(dbNamespace(), list_type, "").size() -
+                     kEventBinWidth;
+  size_t removed = 0;
+  EventTime next_bin = 0;
+  bool exhausted = (bins.size() > budget);
+  for (const auto& bin : bins) {
+    auto step = timeFromRecord(bin.first.substr(prefix_size));
+    if (step >= expire_bin) {
+      // This bin is only partially expired.
+      break;
+    }
+
+    std::vector<EventRecord> records;
+    decodeRecordLog(bin.second, records);
+    if (removed > 0 && removed + records.size() > budget) {
+      exhausted = true;
+      break;
+    }
+
+    std::vector<std::string> expired_keys;
+    for (const auto& record : records) {
+      expired_keys.push_back(data_key + record.first);
+    }
+    deleteDatabaseValues(kEvents, expired_keys);
+    removed += records.size();
+    next_bin = step + 1;
+  }
+
+  if (next_bin > 0) {
+    // Every event before the next bin's start time was removed.
+    auto cutoff = next_bin * size;
+    {
+      WriteLock lock(event_record_lock_);
+      for (const auto& list_size : kEventTimeLists) {
+        auto list_key = std::to_string(list_size);
+        auto cutoff_bin = cutoff / list_size;
+        deleteDatabaseRange(kEvents,
+                            recordLogKey(dbNamespace(), list_key, "0"),
+                            recordLogKey(dbNamespace(), list_key,
+                                         std::to_string(cutoff_bin)));
+
+        // Rewrite the index list once, without the removed bins.
+        auto index_key = "indexes." + dbNamespace() + "." + list_key;
+        std::string index_value;
+        getDatabaseValue(kEvents, index_key, index_value);
+        std::vector<std::string> indexes, persisting_indexes;
+        boost::split(indexes, index_value, boost::is_any_of(","));
+        for (const auto& index : indexes) {
+          if (!index.empty() && timeFromRecord(index) >= cutoff_bin) {
+            persisting_indexes.push_back(index);
+          }
+        }
+        if (persisting_indexes.size() != indexes.size()) {
+          setDatabaseValue(kEvents,
+                           index_key,
+                           boost::algorithm::join(persisting_indexes, ","));
+        }
+      }
+      record_bins_.clear();
+    }
+
+    // Column indexes are kept per coarsest bin.
+    deleteDatabaseRange(
+        kEvents,
+        columnBinKey(dbNamespace(), "0"),
+        columnBinKey(dbNamespace(),
+                     std::to_string(cutoff / kEventTimeLists.front())));
+  }
+
+  if (!exhausted) {
+    // All whole bins were expired, rewrite the partially-expired bin.
+    expireRecords(list_type, std::to_string(expire_bin), false);
+    expireEventIDLog(expire_time_);
+  } else if (next_bin > 0) {
+    expireEventIDLog(next_bin * size - 1);
+  }
+
+  if (hasLegacyRecords()) {
+    // Records written by previous versions use the index lists.
+    getIndexes(expire_time_, 0);
+    legacy_checked_ = false;
+  }
+  return removed;
+}
+
 std::vector<EventRecord> EventSubscriberPlugin::getRecords(
     const std::set<std::string>& indexes) {
+  std::vector<EventRecord> records;
+  for (const auto& index : indexes) {
+    auto delim = index.find('.');
+    if (delim == std::string::npos) {
+      continue;
+    }
+
+    std::string record_value;
+    getDatabaseValue(
+        kEvents,
+        recordLogKey(
+            dbNamespace(), index.substr(0, delim), index.substr(delim + 1)),
+        record_value);
+    decodeRecordLog(record_value, records);
+  }
+
+  // Bins written by previous versions may still hold comma-joined records.
+  for (const auto& record : getLegacyRecords(indexes)) {
+    records.push_back(record);
+  }
+  return records;
+}
+
+std::vector<EventRecord> EventSubscriberPlugin::getLegacyRecords(
+    const std::set<std::string>& indexes) {
   auto record_key = "records." + dbNamespace();
 
   std::vector<EventRecord> records;
   for (const auto& index : indexes) {
-    std::vector<std::string> bin_records;
-    {
-      std::string record_value;
-      getDatabaseValue(kEvents, record_key + "." + index, record_value);
-      if (record_value.empty()) {
-        // There are actually no events in this bin, interesting error case.
-        continue;
-      }
-
-      // Each list is tokenized into a record=event_id:time.
-      boost::split(bin_records, record_value, boost::is_any_of(",:"));
+    std::string record_value;
+    getDatabaseValue(kEvents, record_key + "." + index, record_value);
+    if (!record_value.empty()) {
+      decodeLegacyRecords(record_value, records);
     }
+  }
+  return records;
+}
 
-    auto bin_it = bin_records.begin();
-    // Iterate over every 2 items: EID:TIME.
-    for (; bin_it != bin_records.end(); bin_it++) {
-      const auto& eid = *bin_it;
-      EventTime time = timeFromRecord(*(++bin_it));
-      records.push_back(std::make_pair(eid, time));
-    }
+std::vector<EventRecord> EventSubscriberPlugin::getTimeRecords(
+    EventTime start, EventTime stop) {
+  // The finest list type is ordered by time, scan the bins within the range.
+  auto size = kEventTimeLists.back();
+  auto list_type = std::to_string(size);
+  DatabaseKeyValues bins;
+  scanDatabaseRange(
+      kEvents,
+      recordLogKey(dbNamespace(), list_type, std::to_string(start / size)),
+      recordLogKey(dbNamespace(), list_type, std::to_string(stop / size)),
+      bins);
+
+  std::vector<EventRecord> records;
+  for (const auto& bin : bins) {
+    decodeRecordLog(bin.second, records);
   }
+  return records;
+}
 
+std::vector<EventRecord> EventSubscriberPlugin::getEventIDRecords(
+    size_t after, size_t& last) {
+  // The buckets from the cursor's bucket onward hold every later EventID.
+  auto bucket = std::to_string((after + 1) / kEventIDLogSize);
+  DatabaseKeyValues buckets;
+  scanDatabaseRange(kEvents,
+                    eventIDLogKey(dbNamespace(), bucket),
+                    eventIDLogKey(dbNamespace(), std::to_string(-1ULL)),
+                    buckets);
+
+  std::vector<EventRecord> bucket_records, records;
+  last = after;
+  for (const auto& bucket : buckets) {
+    bucket_records.clear();
+    decodeRecordLog(bucket.second, bucket_records);
+    for (auto& record : bucket_records) {
+      unsigned long long eid = 0;
+      if (safeStrtoull(record.first, 10, eid) && eid > after) {
+        last = std::max(last, static_cast<size_t>(eid));
+        records.push_back(std::move(record));
+      }
+    }
+  }
   return records;
 }
 
-Status EventSubscriberPlugin::recordEvent(EventID& eid, EventTime time) {
-  Status status;
-  std::string time_value = boost::lexical_cast<std::string>(time);
+void EventSubscriberPlugin::expireEventIDLog(EventTime expire_time) {
+  // Buckets are expired oldest first, until one holds a retained record.
+  auto prefix = eventIDLogKey(dbNamespace(), "");
+  prefix.resize(prefix.size() - kEventBinWidth);
+  std::vector<std::string> expired;
+  WriteLock lock(event_record_lock_);
+  scanDatabase(kEvents,
+               prefix,
+               0,
+               ([&expired, expire_time](const std::string& key,
+                                        const std::string& value) {
+                 std::vector<EventRecord> records;
+                 decodeRecordLog(value, records);
+                 for (const auto& record : records) {
+                   if (record.second > expire_time) {
+                     return false;
+                   }
+                 }
+                 expired.push_back(key);
+                 return true;
+               }));
+  deleteDatabaseValues(kEvents, expired);
+}
+
+bool EventSubscriberPlugin::hasLegacyRecords() {
+  if (!legacy_checked_) {
+    std::vector<std::string> keys;
+    scanDatabaseKeys(kEvents, keys, "records." + dbNamespace() + ".", 1);
+    legacy_records_ = !keys.empty();
+    legacy_checked_ = true;
+  }
+  return legacy_records_;
+}
 
+Status EventSubscriberPlugin::recordEvents(
+    const std::vector<EventRecord>& records) {
   // The record is identified by the event type then module name.
   std::string index_key = "indexes." + dbNamespace();
-  std::string record_key = "records." + dbNamespace();
-  // The list key includes the list type (bin size) and the list ID (bin).
-  std::string list_key;
-  std::string list_id;
-
-  for (const auto& time_list : kEventTimeLists) {
-    // The list_id is the MOST-Specific key ID, the bin for this list.
-    // If the event time was 13 and the time_list is 5 seconds, lid = 2.
-    list_id = boost::lexical_cast<std::string>(time / time_list);
-    // The list name identifies the 'type' of list.
-    list_key = boost::lexical_cast<std::string>(time_list);
-    // list_key = list_key + "." + list_id;
 
-    {
-      WriteLock lock(event_record_lock_);
-      // Append the record (eid, unix_time) to the list bin.
-      std::string record_value;
-      status = getDatabaseValue(
-          kEvents, record_key + "." + list_key + "." + list_id, record_value);
-
-      if (record_value.length() == 0) {
-        // This is a new list_id for list_key, append the ID to the indirect
-        // lookup for this list_key.
+  WriteLock lock(event_record_lock_);
+  record_bins_.resize(kEventTimeLists.size());
+
+  // Each record is a fixed-width (eid, time) entry appended to a bin's log.
+  std::map<std::string, std::string> appends;
+  for (const auto& record : records) {
+    std::string entry;
+    if (!encodeRecord(record, entry)) {
+      continue;
+    }
+
+    // The EventID-ordered log is read by scheduled query cursors.
+    unsigned long long eid = 0;
+    safeStrtoull(record.first, 10, eid);
+    appends[eventIDLogKey(dbNamespace(),
+                          std::to_string(eid / kEventIDLogSize))] += entry;
+
+    for (size_t i = 0; i < kEventTimeLists.size(); ++i) {
+      // The list_id is the MOST-Specific key ID, the bin for this list.
+      // If the event time was 13 and the time_list is 5 seconds, lid = 2.
+      auto list_id = std::to_string(record.second / kEventTimeLists[i]);
+      // The list name identifies the 'type' of list.
+      auto list_key = std::to_string(kEventTimeLists[i]);
+
+      if (record_bins_[i] != list_id) {
+        // This may be a new list_id for list_key, append the ID to the
+        // indirect lookup for this list_key if it is not already indexed.
         std::string index_value;
-        status =
-            getDatabaseValue(kEvents, index_key + "." + list_key, index_value);
-        if (index_value.length() == 0) {
-          // A new index.
-          index_value = list_id;
+        getDatabaseValue(kEvents, index_key + "." + list_key, index_value);
+        std::vector<std::string> bins;
+        boost::split(bins, index_value, boost::is_any_of(","));
+        if (std::find(bins.begin(), bins.end(), list_id) == bins.end()) {
+          index_value += (index_value.empty()) ? list_id : "," + list_id;
+          setDatabaseValue(kEvents, index_key + "." + list_key, index_value);
+        }
+        record_bins_[i] = list_id;
+      }
+
+      appends[recordLogKey(dbNamespace(), list_key, list_id)] += entry;
+    }
+  }
+
+  appendRecords(appends);
+  return Status(0, "OK");
+}
+
+std::vector<std::string> EventSubscriberPlugin::getColumnKeys(
+    const Row& r, EventTime time) {
+  std::vector<std::string> keys;
+  auto bin = std::to_string(time / kEventTimeLists.front());
+  for (const auto& column : getIndexedColumns()) {
+    auto value = r.find(column);
+    if (value != r.end() && !value->second.empty()) {
+      keys.push_back(columnIndexKey(dbNamespace(), bin, column) +
+                     columnIndexValue(value->second));
+    }
+  }
+  return keys;
+}
+
+void EventSubscriberPlugin::recordColumns(
+    const std::vector<BufferedEvent>& events) {
+  std::map<std::string, std::string> appends;
+  for (const auto& event : events) {
+    if (event.columns.empty()) {
+      continue;
+    }
+
+    std::string entry;
+    if (encodeRecord(std::make_pair(event.eid, event.time), entry)) {
+      for (const auto& key : event.columns) {
+        appends[key] += entry;
+      }
+    }
+  }
+  appendRecords(appends);
+}
+
+bool EventSubscriberPlugin::getColumnRecords(
+    QueryContext& context,
+    EventTime start,
+    EventTime stop,
+    std::vector<EventRecord>& records) {
+  // Column indexes are kept per coarsest bin, find the bins within range.
+  auto size = kEventTimeLists.front();
+  std::string index_value;
+  getDatabaseValue(
+      kEvents, "indexes." + dbNamespace() + "." + std::to_string(size),
+      index_value);
+  std::vector<std::string> all_bins, bins;
+  boost::split(all_bins, index_value, boost::is_any_of(","));
+  for (const auto& bin : all_bins) {
+    auto step = timeFromRecord(bin);
+    if (!bin.empty() && step >= start / size && step <= stop / size) {
+      bins.push_back(bin);
+    }
+  }
+
+  // Each usable constraint narrows the set of candidate events.
+  bool indexed = false;
+  std::map<std::string, EventTime> candidates;
+  for (const auto& column : getIndexedColumns()) {
+    if (context.constraints.count(column) == 0) {
+      continue;
+    }
+
+    for (const auto& constraint : context.constraints[column].getAll()) {
+      // A LIKE pattern is usable if it begins with a literal prefix.
+      bool prefix = false;
+      auto value = constraint.expr;
+      if (constraint.op == LIKE) {
+        auto wildcard = value.find_first_of("%_");
+        prefix = (wildcard != std::string::npos);
+        value = value.substr(0, wildcard);
+        if (value.empty()) {
+          continue;
+        }
+      } else if (constraint.op != EQUALS) {
+        continue;
+      }
+
+      std::vector<EventRecord> matches;
+      for (const auto& bin : bins) {
+        auto key = columnIndexKey(dbNamespace(), bin, column) +
+                   columnIndexValue(value);
+        if (prefix) {
+          DatabaseKeyValues values;
+          scanDatabaseRange(kEvents, key, key + '\xff', values);
+          for (const auto& entries : values) {
+            decodeRecordLog(entries.second, matches);
+          }
         } else {
-          index_value += "," + list_id;
+          std::string entries;
+          getDatabaseValue(kEvents, key, entries);
+          decodeRecordLog(entries, matches);
         }
-        status =
-            setDatabaseValue(kEvents, index_key + "." + list_key, index_value);
-        record_value = eid + ":" + time_value;
-      } else {
-        // Tokenize a record using ',' and the EID/time using ':'.
-        record_value += "," + eid + ":" + time_value;
       }
-      status = setDatabaseValue(
-          kEvents, record_key + "." + list_key + "." + list_id, record_value);
-      if (!status.ok()) {
-        LOG(ERROR) << "Could not put Event Record key: " << record_key;
+
+      std::map<std::string, EventTime> narrowed;
+      for (const auto& match : matches) {
+        if (!indexed || candidates.count(match.first) > 0) {
+          narrowed[match.first] = match.second;
+        }
       }
+      candidates.swap(narrowed);
+      indexed = true;
     }
   }
 
-  return Status(0, "OK");
+  for (const auto& candidate : candidates) {
+    records.push_back(candidate);
+  }
+  return indexed;
+}
+
+Status EventSubscriberPlugin::flushEvents() {
+  WriteLock lock(event_batch_lock_);
+  if (batch_.empty()) {
+    return Status(0, "OK");
+  }
+
+  // Store the event data, then record each event in the indexing bins.
+  Status status;
+  std::string data_key = "data." + dbNamespace() + ".";
+  std::vector<EventRecord> records;
+  records.reserve(batch_.size());
+  for (const auto& event : batch_) {
+    auto s = setDatabaseValue(kEvents, data_key + event.eid, event.data);
+    if (!s.ok()) {
+      status = s;
+    }
+    records.push_back(std::make_pair(event.eid, event.time));
+  }
+  recordEvents(records);
+  recordColumns(batch_);
+  std::vector<BufferedEvent>().swap(batch_);
+
+  // Checkpoint the EventID after the events it identifies are stored.
+  std::string eid_value;
+  {
+    WriteLock id_lock(event_id_lock_);
+    eid_value = std::to_string(last_eid_);
+  }
+  setDatabaseValue(kEvents, "eid." + dbNamespace(), eid_value);
+  return status;
 }
 
 size_t EventSubscriberPlugin::getEventsExpiry() {
@@ -441,6 +1285,14 @@ size_t EventSubscriberPlugin::getEventsMax() {
   return FLAGS_events_max;
 }
 
+std::set<std::string> EventSubscriberPlugin::getIndexedColumns() {
+  return {};
+}
+
+size_t EventSubscriberPlugin::getEventsBatchSize() {
+  return FLAGS_events_batch_size;
+}
+
 EventID EventSubscriberPlugin::getEventID() {
   Status status;
   // First get an event ID from the meta key.
@@ -448,8 +1300,23 @@ EventID EventSubscriberPlugin::getEventID() {
   std::string last_eid_value;
   std::string eid_value;
 
+  if (getEventsBatchSize() > 0) {
+    // EventIDs are assigned in memory and checkpointed when a batch is
+    // written. Buffered events lost in a crash do not need their IDs.
+    WriteLock lock(event_id_lock_);
+    if (!eid_loaded_) {
+      getDatabaseValue(kEvents, eid_key, last_eid_value);
+      unsigned long long last_eid = 0;
+      safeStrtoull(last_eid_value, 10, last_eid);
+      last_eid_ = static_cast<size_t>(last_eid);
+      eid_loaded_ = true;
+    }
+    return std::to_string(++last_eid_);
+  }
+
   {
     WriteLock lock(event_id_lock_);
+    eid_loaded_ = false;
     status = getDatabaseValue(kEvents, eid_key, last_eid_value);
     if (!status.ok() || last_eid_value.empty()) {
       last_eid_value = "0";
@@ -467,80 +1334,368 @@ EventID EventSubscriberPlugin::getEventID() {
   return eid_value;
 }
 
+void EventSubscriberPlugin::prepareRange(EventTime& start, EventTime& stop) {
+  // Buffered events must be visible to the query.
+  flushEvents();
+
+  if (stop == 0) {
+    // A stop of 0 is an alias for everything.
+    stop = -1;
+  }
+
+  // Index retrieval applies expirations, retrieval uses the time-ordered log.
+  // Only inspect the indexes once the expiration time enters a new bin.
+  if (expire_events_ && expire_time_ > 0) {
+    auto expire_bin = expire_time_ / kEventTimeLists.back();
+    if (expire_bin != expire_bin_ && !EventFactory::expiresInBackground()) {
+      getIndexes(expire_time_, 0);
+      expireEventIDLog(expire_time_);
+      expire_bin_ = expire_bin;
+      legacy_checked_ = false;
+    }
+    // Records in a partially-expired bin may not be removed yet.
+    start = std::max(start, expire_time_ + 1);
+  }
+}
+
 QueryData EventSubscriberPlugin::get(EventTime start, EventTime stop) {
-  QueryData results;
+  auto records = getRangeRecords(start, stop);
+  return getEvents(records, start, stop);
+}
+
+std::vector<EventRecord> EventSubscriberPlugin::getRangeRecords(
+    EventTime& start, EventTime& stop) {
+  prepareRange(start, stop);
 
   // Get the records for this time range.
-  auto indexes = getIndexes(start, stop);
-  auto records = getRecords(indexes);
-  std::string events_key = "data." + dbNamespace();
+  auto records = getTimeRecords(start, stop);
+  if (hasLegacyRecords()) {
+    for (const auto& record : getLegacyRecords(getIndexes(start, stop))) {
+      records.push_back(record);
+    }
+  }
+  return records;
+}
 
-  std::vector<std::string> mapped_records;
-  for (const auto& record : records) {
+QueryData EventSubscriberPlugin::getEvents(
+    const std::vector<EventRecord>& records,
+    EventTime start,
+    EventTime stop,
+    RowOrder order) {
+  auto keys = getEventKeys(records, start, stop, order);
+
+  // Select the rows using event_ids as keys, a chunk at a time.
+  QueryData results;
+  for (size_t i = 0; i < keys.size(); i += kEventsMultiGetSize) {
+    getEventRows(keys, i, std::min(i + kEventsMultiGetSize, keys.size()),
+                 results);
+  }
+  updateExpireTime();
+  return results;
+}
+
+std::vector<std::string> EventSubscriberPlugin::getEventKeys(
+    const std::vector<EventRecord>& records,
+    EventTime start,
+    EventTime stop,
+    RowOrder order) {
+  std::vector<size_t> selected;
+  for (size_t i = 0; i < records.size(); i++) {
+    const auto& record = records[i];
     if (record.second >= start && (record.second <= stop || stop == 0)) {
-      mapped_records.push_back(events_key + "." + record.first);
+      selected.push_back(i);
     }
   }
 
-  // Select mapped_records using event_ids as keys.
-  std::string data_value;
-  for (const auto& record : mapped_records) {
-    Row r;
-    auto status = getDatabaseValue(kEvents, record, data_value);
+  if (order != RowOrder::NONE) {
+    // Records of the same time keep the order they were added in, newest
+    // first when descending.
+    std::stable_sort(selected.begin(),
+                     selected.end(),
+                     [&records](size_t left, size_t right) {
+                       return records[left].second < records[right].second;
+                     });
+    if (order == RowOrder::TIME_DESCENDING) {
+      std::reverse(selected.begin(), selected.end());
+    }
+  }
+
+  std::string events_key = "data." + dbNamespace() + ".";
+  std::vector<std::string> keys;
+  keys.reserve(selected.size());
+  for (const auto& i : selected) {
+    keys.push_back(events_key + records[i].first);
+  }
+  return keys;
+}
+
+void EventSubscriberPlugin::getEventRows(const std::vector<std::string>& keys,
+                                         size_t begin,
+                                         size_t end,
+                                         QueryData& results) {
+  std::vector<std::string> chunk(keys.begin() + begin, keys.begin() + end);
+  std::vector<std::string> data_values;
+  getDatabaseValues(kEvents, chunk, data_values);
+  for (auto& data_value : data_values) {
     if (data_value.length() == 0) {
       // There is no record here, interesting error case.
       continue;
     }
-    status = deserializeRowJSON(data_value, r);
+
+    Row r;
+    auto status = decodeRow(data_value, r);
     data_value.clear();
     if (status.ok()) {
       results.push_back(std::move(r));
     }
   }
+}
 
+void EventSubscriberPlugin::updateExpireTime() {
   if (getEventsExpiry() > 0) {
     // Set the expire time to NOW - "configured lifetime".
     // Index retrieval will apply the constraints checking and auto-expire.
     expire_time_ = getUnixTime() - getEventsExpiry();
   }
-  return results;
 }
 
 Status EventSubscriberPlugin::add(Row& r, EventTime event_time) {
+  PerfTimer timer(PERF_ADD_EVENT);
+  if (forward_only_) {
+    return forward(r, event_time);
+  }
+
+  auto batch_size = getEventsBatchSize();
   // Get and increment the EID for this module.
   EventID eid = getEventID();
   // Without encouraging a missing event time, do not support a 0-time.
   r["time"] = std::to_string((event_time == 0) ? getUnixTime() : event_time);
   // Serialize and store the row data, for query-time retrieval.
   std::string data;
-  auto status = serializeRowJSON(r, data);
+  auto status = encodeRow(r, data);
   if (!status.ok()) {
     return status;
   }
-  // Then remove the newline.
-  if (data.size() > 0 && data.back() == '\n') {
-    data.pop_back();
-  }
 
   // Use the last EventID and a checkpoint bucket size to periodically apply
   // buffer eviction. Eviction occurs if the total count exceeds events_max.
-  if (last_eid_ % EVENTS_CHECKPOINT == 0) {
+  if (last_eid_ % EVENTS_CHECKPOINT == 0 &&
+      !EventFactory::expiresInBackground()) {
+    // The expiration inspects stored events, write any buffered events.
+    flushEvents();
     expireCheck();
   }
 
   // Logger plugins may request events to be forwarded directly.
   // If no active logger is marked 'usesLogEvent' then this is a no-op.
-  EventFactory::forwardEvent(data);
+  if (EventFactory::forwardsEvents()) {
+    std::string json;
+    if (kEventRowVersion != data[0]) {
+      json = data;
+    } else if (serializeRowJSON(r, json).ok() && !json.empty() &&
+               json.back() == '\n') {
+      json.pop_back();
+    }
+    EventFactory::forwardEvent(std::move(json));
+  }
+
+  if (batch_size > 0) {
+    // Buffer the event and write the batch once it is large or old enough.
+    bool flush = false;
+    {
+      WriteLock lock(event_batch_lock_);
+      auto now = getUnixTime();
+      if (batch_.empty()) {
+        batch_time_ = now;
+      }
+      batch_.push_back(
+          {eid, event_time, std::move(data), getColumnKeys(r, event_time)});
+      flush = (batch_.size() >= batch_size ||
+               now - batch_time_ >= FLAGS_events_batch_interval);
+    }
+    event_count_++;
+    return (flush) ? flushEvents() : Status(0, "OK");
+  }
+
+  // Batching may have been disabled, write events buffered beforehand.
+  flushEvents();
 
   // Store the event data.
   std::string event_key = "data." + dbNamespace() + "." + eid;
   status = setDatabaseValue(kEvents, event_key, data);
   // Record the event in the indexing bins, using the index time.
-  recordEvent(eid, event_time);
+  recordEvents({std::make_pair(eid, event_time)});
+  recordColumns({{eid, event_time, "", getColumnKeys(r, event_time)}});
   event_count_++;
   return status;
 }
 
+Status EventSubscriberPlugin::forward(Row& r, EventTime event_time) {
+  r["time"] = std::to_string((event_time == 0) ? getUnixTime() : event_time);
+  event_count_++;
+  if (!EventFactory::forwardsEvents()) {
+    return Status(0, "OK");
+  }
+
+  // Serialize once, no EventID, record, or index is written.
+  std::string json;
+  auto status = serializeRowJSON(r, json);
+  if (!status.ok()) {
+    return status;
+  }
+  if (!json.empty() && json.back() == '\n') {
+    json.pop_back();
+  }
+  EventFactory::forwardEvent(std::move(json));
+  return Status(0, "OK");
+}
+
+Row& EventSubscriberPlugin::scratchRow() {
+  for (auto& column : scratch_row_) {
+    column.second.clear();
+  }
+  return scratch_row_;
+}
+
+void EventSubscriberPlugin::loadRowSchema() {
+  if (row_schema_loaded_) {
+    return;
+  }
+
+  // Column ordinals are taken from the subscriber's table schema.
+  std::vector<std::string> columns;
+  if (Registry::exists("table", getName())) {
+    auto plugin = Registry::get("table", getName());
+    for (const auto& column : plugin->routeInfo()) {
+      if (column.at("id") == "column") {
+        columns.push_back(column.at("name"));
+      }
+    }
+  }
+  setRowSchema(columns);
+}
+
+void EventSubscriberPlugin::setRowSchema(
+    const std::vector<std::string>& columns) {
+  // The schema ID is an FNV-1a hash of the ordered column names.
+  auto joined = boost::algorithm::join(columns, ",");
+  uint32_t id = 2166136261U;
+  for (const auto& c : joined) {
+    id = (id ^ static_cast<unsigned char>(c)) * 16777619U;
+  }
+
+  row_schema_ = (columns.empty()) ? 0 : id;
+  row_columns_ = columns;
+  row_ordinals_.clear();
+  for (size_t i = 0; i < columns.size(); ++i) {
+    row_ordinals_[columns[i]] = i + 1;
+  }
+  row_schemas_[row_schema_] = columns;
+  row_schema_loaded_ = true;
+
+  // Events encoded with this schema must remain readable if it changes.
+  if (row_schema_ != 0) {
+    setDatabaseValue(kEvents,
+                     "schema." + dbNamespace() + "." +
+                         std::to_string(row_schema_),
+                     joined);
+  }
+}
+
+Status EventSubscriberPlugin::encodeRow(const Row& r, std::string& data) {
+  if (!FLAGS_events_binary_rows) {
+    auto status = serializeRowJSON(r, data);
+    // Remove the newline.
+    if (data.size() > 0 && data.back() == '\n') {
+      data.pop_back();
+    }
+    return status;
+  }
+
+  {
+    WriteLock lock(row_schema_lock_);
+    loadRowSchema();
+  }
+
+  // The version tag and schema ID are followed by (ordinal, value) fields.
+  // Columns missing from the schema use ordinal 0 followed by the name.
+  data.push_back(kEventRowVersion);
+  appendVarint(row_schema_, data);
+  for (const auto& column : r) {
+    auto ordinal = row_ordinals_.find(column.first);
+    if (ordinal != row_ordinals_.end()) {
+      appendVarint(ordinal->second, data);
+    } else {
+      appendVarint(0, data);
+      appendVarint(column.first.size(), data);
+      data += column.first;
+    }
+    appendVarint(column.second.size(), data);
+    data += column.second;
+  }
+  return Status(0, "OK");
+}
+
+Status EventSubscriberPlugin::decodeRow(const std::string& data, Row& r) {
+  if (data.empty() || data[0] != kEventRowVersion) {
+    // Events stored by previous versions are JSON.
+    return deserializeRowJSON(data, r);
+  }
+
+  size_t offset = 1;
+  size_t schema = 0;
+  if (!readVarint(data, offset, schema)) {
+    return Status(1, "Invalid event row");
+  }
+
+  const std::vector<std::string>* columns = nullptr;
+  {
+    WriteLock lock(row_schema_lock_);
+    loadRowSchema();
+    auto it = row_schemas_.find(schema);
+    if (it == row_schemas_.end()) {
+      // The row was encoded using a previous table schema.
+      std::string joined;
+      getDatabaseValue(kEvents,
+                       "schema." + dbNamespace() + "." + std::to_string(schema),
+                       joined);
+      if (joined.empty()) {
+        return Status(1, "Unknown event row schema");
+      }
+      it = row_schemas_.insert({schema, {}}).first;
+      boost::split(it->second, joined, boost::is_any_of(","));
+    }
+    // Schemas are never removed, the pointer remains valid.
+    columns = &it->second;
+  }
+
+  std::string name, value;
+  while (offset < data.size()) {
+    size_t ordinal = 0;
+    if (!readVarint(data, offset, ordinal)) {
+      return Status(1, "Invalid event row");
+    }
+
+    if (ordinal == 0) {
+      if (!readField(data, offset, name)) {
+        return Status(1, "Invalid event row");
+      }
+    } else if (ordinal > columns->size()) {
+      return Status(1, "Invalid event row column");
+    }
+
+    if (!readField(data, offset, value)) {
+      return Status(1, "Invalid event row");
+    }
+    r[(ordinal == 0) ? name : (*columns)[ordinal - 1]] = std::move(value);
+  }
+  return Status(0, "OK");
+}
+
+size_t EventSubscriberPlugin::numDropped() const {
+  return (dispatch_queue_ != nullptr) ? dispatch_queue_->dropped() : 0;
+}
+
 EventPublisherRef EventSubscriberPlugin::getPublisher() const {
   return EventFactory::getEventPublisher(getType());
 }
@@ -550,6 +1705,14 @@ void EventSubscriberPlugin::removeSubscriptions() {
   getPublisher()->removeSubscriptions(getName());
 }
 
+void EventSubscriberPlugin::removeSubscription(
+    const SubscriptionContextRef& context) {
+  if (subscription_count_ > 0) {
+    subscription_count_--;
+  }
+  getPublisher()->removeSubscription(context);
+}
+
 void EventFactory::delay() {
   // Caller may disable event publisher threads.
   if (FLAGS_disable_events) {
@@ -558,6 +1721,23 @@ void EventFactory::delay() {
 
   // Create a thread for each event publisher.
   auto& ef = EventFactory::getInstance();
+  if (FLAGS_events_expiry_interval > 0 && !ef.background_expiry_) {
+    // Expire events in a service thread, not while publishers add events.
+    ef.background_expiry_ = true;
+    Dispatcher::addService(std::make_shared<EventExpirationRunner>(
+        FLAGS_events_expiry_interval, FLAGS_events_expiry_budget));
+  }
+  if (FLAGS_events_forward_queue_size > 0 && !ef.loggers_.empty() &&
+      ef.forwarder_ == nullptr) {
+    // Forward events in groups from a service thread, not within add.
+    ef.forwarder_ =
+        std::make_shared<EventForwarder>(ef.loggers_,
+                                         FLAGS_events_forward_queue_size,
+                                         FLAGS_events_forward_batch_size,
+                                         FLAGS_events_forward_rate);
+    Dispatcher::addService(std::make_shared<EventForwardRunner>(
+        ef.forwarder_, FLAGS_events_forward_latency));
+  }
   for (const auto& publisher : EventFactory::getInstance().event_pubs_) {
     // Publishers that did not set up correctly are put into an ending state.
     if (!publisher.second->isEnding()) {
@@ -574,6 +1754,7 @@ Status EventPublisherPlugin::addSubscription(
   // subscriptions will be walked.
   WriteLock lock(subscription_lock_);
   subscriptions_.push_back(subscription);
+  dispatch_dirty_ = true;
   return Status(0);
 }
 
@@ -587,14 +1768,42 @@ void EventPublisherPlugin::removeSubscriptions(const std::string& subscriber) {
                        return (subscription->subscriber_name == subscriber);
                      });
   subscriptions_.erase(end, subscriptions_.end());
+  dispatch_dirty_ = true;
+}
+
+void EventPublisherPlugin::removeSubscription(
+    const SubscriptionContextRef& context) {
+  WriteLock lock(subscription_lock_);
+  auto end =
+      std::remove_if(subscriptions_.begin(),
+                     subscriptions_.end(),
+                     [&context](const SubscriptionRef& subscription) {
+                       return (subscription->context == context);
+                     });
+  subscriptions_.erase(end, subscriptions_.end());
+  dispatch_dirty_ = true;
 }
 
 void EventFactory::addForwarder(const std::string& logger) {
   getInstance().loggers_.push_back(logger);
 }
 
-void EventFactory::forwardEvent(const std::string& event) {
-  for (const auto& logger : getInstance().loggers_) {
+bool EventFactory::expiresInBackground() {
+  return getInstance().background_expiry_;
+}
+
+bool EventFactory::forwardsEvents() {
+  return !getInstance().loggers_.empty();
+}
+
+void EventFactory::forwardEvent(std::string event) {
+  auto& ef = getInstance();
+  if (ef.forwarder_ != nullptr) {
+    ef.forwarder_->push(std::move(event));
+    return;
+  }
+
+  for (const auto& logger : ef.loggers_) {
     Registry::call("logger", logger, {{"event", event}});
   }
 }
@@ -624,6 +1833,9 @@ Status EventFactory::run(EventPublisherID& type_id) {
   VLOG(1) << "Starting event publisher run loop: " + type_id;
   publisher->hasStarted(true);
 
+  // Publishers drain kernel and OS queues that drop events when full.
+  applyThreadRole(ThreadRole::LATENCY);
+
   auto status = Status(0, "OK");
   while (!publisher->isEnding()) {
     // Can optionally implement a global cooloff latency here.
@@ -632,6 +1844,10 @@ Status EventFactory::run(EventPublisherID& type_id) {
       break;
     }
     publisher->restart_count_++;
+    if (publisher->waitsForReadiness()) {
+      // The step blocked until its descriptors were ready or timed out.
+      continue;
+    }
     // This is a 'default' cool-off implemented in InterruptableRunnable.
     // If a publisher fails to perform some sort of interruption point, this
     // prevents the thread from thrashing through exiting checks.
@@ -674,13 +1890,17 @@ Status EventFactory::registerEventPublisher(const PluginRef& pub) {
 
   auto& ef = EventFactory::getInstance();
   auto type_id = specialized_pub->type();
-  if (ef.event_pubs_.count(type_id) != 0) {
-    // This is a duplicate event publisher.
-    return Status(1, "Duplicate publisher type");
+  {
+    // Publishers may be registered concurrently, see attachEvents.
+    WriteLock lock(ef.factory_lock_);
+    if (ef.event_pubs_.count(type_id) != 0) {
+      // This is a duplicate event publisher.
+      return Status(1, "Duplicate publisher type");
+    }
+    ef.event_pubs_[type_id] = specialized_pub;
   }
 
   // Do not set up event publisher if events are disabled.
-  ef.event_pubs_[type_id] = specialized_pub;
   if (!FLAGS_disable_events) {
     auto status = specialized_pub->setUp();
     if (!status.ok()) {
@@ -712,9 +1932,30 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
   // The config may use an "events" key to explicitly enabled or disable
   // event subscribers. See EventSubscriber::disable.
   auto name = specialized_sub->getName();
+  auto policy_name = FLAGS_events_dispatch_policy;
   auto plugin = Config::getInstance().getParser("events");
   if (plugin != nullptr && plugin.get() != nullptr) {
     const auto& data = plugin->getData();
+    // A subscriber may use a specific dispatch queue overflow policy.
+    if (data.get_child("events").count("dispatch_policies") > 0) {
+      const auto& policies = data.get_child("events.dispatch_policies");
+      if (policies.count(name) > 0) {
+        policy_name = policies.get<std::string>(name, policy_name);
+      }
+    }
+    // A subscriber may forward its events without storing them.
+    if (data.get_child("events").count("forward_only") > 0) {
+      for (const auto& item : data.get_child("events.forward_only")) {
+        if (item.second.data() == name) {
+          VLOG(1) << "Forwarding events without storage: " << name;
+          specialized_sub->forward_only_ = true;
+        }
+      }
+      if (specialized_sub->forward_only_ && !forwardsEvents()) {
+        LOG(WARNING) << "Forward-only event subscriber " << name
+                     << " has no forwarding logger, events are dropped";
+      }
+    }
     // First perform explicit enabling.
     if (data.get_child("events").count("enable_subscribers") > 0) {
       for (const auto& item : data.get_child("events.enable_subscribers")) {
@@ -741,6 +1982,22 @@ Status EventFactory::registerEventSubscriber(const PluginRef& sub) {
     specialized_sub->expireCheck(true);
     status = specialized_sub->init();
     specialized_sub->state(SUBSCRIBER_RUNNING);
+
+    if (FLAGS_events_dispatch_queue_size > 0 &&
+        specialized_sub->dispatch_queue_ == nullptr) {
+      EventDispatchPolicy policy = DISPATCH_DROP_OLDEST;
+      if (!getDispatchPolicy(policy_name, policy)) {
+        LOG(WARNING) << "Unknown event dispatch policy: " << policy_name;
+      }
+
+      // Fired events are queued and the callbacks run in a service thread.
+      specialized_sub->dispatch_queue_ =
+          std::make_shared<EventDispatchQueue>(FLAGS_events_dispatch_queue_size,
+                                               policy,
+                                               FLAGS_events_dispatch_sample_rate);
+      Dispatcher::addService(std::make_shared<EventDispatchRunner>(
+          name, specialized_sub->dispatch_queue_));
+    }
   } else {
     specialized_sub->state(SUBSCRIBER_PAUSED);
   }
@@ -888,6 +2145,11 @@ void EventFactory::end(bool join) {
       ef.threads_.clear();
     }
 
+    // Write events still buffered by batching subscribers.
+    for (const auto& subscriber : ef.event_subs_) {
+      subscriber.second->flushEvents();
+    }
+
     // Threads may still be executing, when they finish, release publishers.
     ef.event_pubs_.clear();
     ef.event_subs_.clear();
@@ -895,9 +2157,20 @@ void EventFactory::end(bool join) {
 }
 
 void attachEvents() {
+  // Each publisher sets up its own OS resources, some wait for a service or
+  // device. Set them up concurrently, subscribers need them all registered.
   const auto& publishers = Registry::all("event_publisher");
+  std::vector<std::future<Status>> registrations;
   for (const auto& publisher : publishers) {
-    EventFactory::registerEventPublisher(publisher.second);
+    registrations.push_back(std::async(std::launch::async,
+                                       [publisher]() {
+                                         return EventFactory::
+                                             registerEventPublisher(
+                                                 publisher.second);
+                                       }));
+  }
+  for (auto& registration : registrations) {
+    registration.wait();
   }
 
   const auto& subscribers = Registry::all("event_subscriber");
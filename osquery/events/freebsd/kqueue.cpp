@@ -0,0 +1,463 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <unistd.h>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+#include "osquery/events/freebsd/kqueue.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(uint64,
+     kqueue_max_watches,
+     8192,
+     "Maximum number of files and directories watched by kqueue");
+
+std::map<uint32_t, std::string> kKqueueActions = {
+    {NOTE_ATTRIB, "ATTRIBUTES_MODIFIED"},
+    {NOTE_DELETE, "DELETED"},
+    {NOTE_EXTEND, "UPDATED"},
+    {NOTE_RENAME, "MOVED_FROM"},
+    {NOTE_WRITE, "UPDATED"},
+#ifdef NOTE_OPEN
+    {NOTE_OPEN, "OPENED"},
+    {NOTE_READ, "ACCESSED"},
+#endif
+};
+
+const uint32_t kFileDefaultMasks =
+    NOTE_DELETE | NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_RENAME;
+
+#ifdef NOTE_OPEN
+const uint32_t kFileAccessMasks = NOTE_OPEN | NOTE_READ;
+#else
+const uint32_t kFileAccessMasks = 0;
+#endif
+
+/// The max time to wait for notes before checking for an interrupt.
+static const long kKqueueMLatency = 1000;
+
+/// The number of notes read by each wait.
+static const int kKqueueBatchSize = 256;
+
+REGISTER(KqueueEventPublisher, "event_publisher", "kqueue");
+
+/// The entry names of a directory.
+static void listEntries(const std::string& path,
+                        std::set<std::string>& entries) {
+  boost::system::error_code ec;
+  for (fs::directory_iterator it(path, ec), end; !ec && it != end;
+       it.increment(ec)) {
+    entries.insert(it->path().filename().string());
+  }
+}
+
+/// Join a directory and an entry name.
+static std::string joinPath(const std::string& directory,
+                            const std::string& name) {
+  return (directory == "/") ? directory + name : directory + '/' + name;
+}
+
+Status KqueueEventPublisher::setUp() {
+  kqueue_handle_ = ::kqueue();
+  if (kqueue_handle_ == -1) {
+    return Status(1, "Could not create kqueue");
+  }
+  ::fcntl(kqueue_handle_, F_SETFD, FD_CLOEXEC);
+  return Status(0, "OK");
+}
+
+void KqueueEventPublisher::normalizeSubscription(
+    const KqueueSubscriptionContextRef& sc) const {
+  sc->discovered_ = sc->path;
+  if (sc->path.find("**") != std::string::npos) {
+    sc->recursive = true;
+    sc->path = sc->path.substr(0, sc->path.find("**"));
+  }
+
+  if (sc->path.find('*') == std::string::npos && sc->path.back() != '/' &&
+      isDirectory(sc->path).ok()) {
+    sc->path += '/';
+  }
+}
+
+void KqueueEventPublisher::expandDirectory(const std::string& path,
+                                           bool recursive,
+                                           std::set<std::string>& paths) const {
+  std::set<std::string> entries;
+  listEntries(path, entries);
+  for (const auto& name : entries) {
+    if (paths.size() >= FLAGS_kqueue_max_watches) {
+      return;
+    }
+
+    auto child = joinPath(path, name);
+    paths.insert(child);
+    boost::system::error_code ec;
+    if (recursive && fs::is_directory(fs::symlink_status(child, ec))) {
+      expandDirectory(child, true, paths);
+    }
+  }
+}
+
+void KqueueEventPublisher::expandSubscription(
+    const KqueueSubscriptionContextRef& sc,
+    std::set<std::string>& paths) const {
+  auto pattern = sc->path;
+  bool directory = (pattern.back() == '/');
+  if (directory && pattern.size() > 1) {
+    pattern.pop_back();
+  }
+
+  // Wildcards are resolved at configure time like inotify.
+  std::vector<std::string> resolved;
+  if (pattern.find('*') == std::string::npos) {
+    resolved.push_back(pattern);
+  } else {
+    resolveFilePattern(pattern, resolved, GLOB_ALL);
+  }
+
+  // A file's directory reports the file being created or replaced, and a
+  // leaf wildcard's directory reports new matching entries.
+  auto parent = fs::path(pattern).parent_path().string();
+  if (!directory && !parent.empty() &&
+      parent.find('*') == std::string::npos && isDirectory(parent).ok()) {
+    paths.insert(parent);
+  }
+
+  for (auto& path : resolved) {
+    if (path.size() > 1 && path.back() == '/') {
+      path.pop_back();
+    }
+
+    if (isDirectory(path).ok()) {
+      paths.insert(path);
+      if (directory) {
+        expandDirectory(path, sc->recursive, paths);
+      }
+    } else if (pathExists(path).ok()) {
+      paths.insert(path);
+    }
+  }
+}
+
+bool KqueueEventPublisher::isPathMonitored(const std::string& path) const {
+  for (const auto& sub : subscriptions_) {
+    if (matchPath(getSubscriptionContext(sub->context), path)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void KqueueEventPublisher::configure() {
+  std::set<std::string> paths;
+  uint32_t notes = kFileDefaultMasks;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->discovered_.empty()) {
+      normalizeSubscription(sc);
+    }
+    notes |= (sc->mask & kFileAccessMasks);
+    expandSubscription(sc, paths);
+  }
+
+  WriteLock lock(watch_mutex_);
+  // Close the descriptors of paths no longer needed, the others are kept.
+  std::vector<int> unused;
+  for (const auto& path : path_descriptors_) {
+    if (paths.count(path.first) == 0) {
+      unused.push_back(path.second);
+    }
+  }
+  for (const auto& fd : unused) {
+    removeWatch(fd);
+  }
+
+  if (notes != notes_) {
+    // Access notes were requested or released, update the existing watches.
+    notes_ = notes;
+    for (const auto& watch : watches_) {
+      struct kevent change;
+      EV_SET(&change,
+             watch.first,
+             EVFILT_VNODE,
+             EV_ADD | EV_CLEAR,
+             notes_,
+             0,
+             nullptr);
+      ::kevent(kqueue_handle_, &change, 1, nullptr, 0, nullptr);
+    }
+  }
+
+  for (const auto& path : paths) {
+    if (path_descriptors_.count(path) == 0 && !addWatch(path) &&
+        watches_.size() >= FLAGS_kqueue_max_watches) {
+      LOG(WARNING) << "Reached the kqueue watch limit: "
+                   << FLAGS_kqueue_max_watches;
+      break;
+    }
+  }
+}
+
+bool KqueueEventPublisher::addWatch(const std::string& path) {
+  if (path_descriptors_.count(path) > 0) {
+    return true;
+  }
+
+  if (watches_.size() >= FLAGS_kqueue_max_watches) {
+    return false;
+  }
+
+  // Do not block on FIFOs, the descriptor is only used for notes.
+  int fd = ::open(path.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd == -1) {
+    VLOG(1) << "Could not open " << path << " for kqueue";
+    return false;
+  }
+
+  struct kevent change;
+  EV_SET(&change, fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, notes_, 0, nullptr);
+  if (::kevent(kqueue_handle_, &change, 1, nullptr, 0, nullptr) == -1) {
+    ::close(fd);
+    return false;
+  }
+
+  auto& watch = watches_[fd];
+  watch.path = path;
+  watch.directory = isDirectory(path).ok();
+  if (watch.directory) {
+    listEntries(path, watch.entries);
+  }
+  path_descriptors_[path] = fd;
+  return true;
+}
+
+void KqueueEventPublisher::removeWatch(int fd) {
+  auto watch = watches_.find(fd);
+  if (watch == watches_.end()) {
+    return;
+  }
+
+  // Closing the descriptor removes its kqueue registration.
+  path_descriptors_.erase(watch->second.path);
+  watches_.erase(watch);
+  ::close(fd);
+}
+
+void KqueueEventPublisher::tearDown() {
+  WriteLock lock(watch_mutex_);
+  for (const auto& watch : watches_) {
+    ::close(watch.first);
+  }
+  watches_.clear();
+  path_descriptors_.clear();
+
+  if (kqueue_handle_ != -1) {
+    ::close(kqueue_handle_);
+    kqueue_handle_ = -1;
+  }
+}
+
+Status KqueueEventPublisher::run() {
+  struct timespec timeout = {kKqueueMLatency / 1000,
+                             (kKqueueMLatency % 1000) * 1000000L};
+
+  struct kevent events[kKqueueBatchSize];
+  int count =
+      ::kevent(kqueue_handle_, nullptr, 0, events, kKqueueBatchSize, &timeout);
+  if (count == -1 && errno != EINTR) {
+    LOG(WARNING) << "Could not read kqueue handle";
+    return Status(1, "kqueue handle failed");
+  }
+
+  // Merge the notes of each descriptor, keeping the order they arrived.
+  std::vector<std::pair<int, uint32_t>> notes;
+  std::map<int, size_t> positions;
+  for (int i = 0; i < count; i++) {
+    auto fd = static_cast<int>(events[i].ident);
+    auto position = positions.find(fd);
+    if (position == positions.end()) {
+      positions[fd] = notes.size();
+      notes.push_back(std::make_pair(fd, events[i].fflags));
+    } else {
+      notes[position->second].second |= events[i].fflags;
+    }
+  }
+
+  WriteLock lock(watch_mutex_);
+  for (const auto& note : notes) {
+    handleNotes(note.first, note.second);
+  }
+  return Status(0, "OK");
+}
+
+void KqueueEventPublisher::handleNotes(int fd, uint32_t fflags) {
+  auto it = watches_.find(fd);
+  if (it == watches_.end()) {
+    // The watch was removed by an earlier note in the batch.
+    return;
+  }
+
+  auto& watch = it->second;
+  if (fflags & (NOTE_DELETE | NOTE_RENAME | NOTE_REVOKE)) {
+    // The descriptor no longer names the path.
+    auto path = watch.path;
+    removeWatch(fd);
+    if (fflags & NOTE_DELETE) {
+      fireEvent(path, "DELETED", NOTE_DELETE);
+    } else if (fflags & NOTE_RENAME) {
+      fireEvent(path, "MOVED_FROM", NOTE_RENAME);
+    }
+
+    // A file replaced by a rename over its path is watched again.
+    if (pathExists(path).ok() && isPathMonitored(path) && addWatch(path)) {
+      fireEvent(path, "CREATED", NOTE_WRITE);
+    }
+    return;
+  }
+
+  if (watch.directory) {
+    if (fflags & NOTE_WRITE) {
+      scanDirectory(watch);
+    }
+    if (fflags & NOTE_ATTRIB) {
+      fireEvent(watch.path, "ATTRIBUTES_MODIFIED", NOTE_ATTRIB);
+    }
+    return;
+  }
+
+  // Writes and attribute changes between reads are fired once.
+  if (fflags & (NOTE_WRITE | NOTE_EXTEND)) {
+    fireEvent(watch.path, "UPDATED", fflags & (NOTE_WRITE | NOTE_EXTEND));
+  } else if (fflags & NOTE_ATTRIB) {
+    fireEvent(watch.path, "ATTRIBUTES_MODIFIED", NOTE_ATTRIB);
+  }
+
+#ifdef NOTE_OPEN
+  if (fflags & NOTE_OPEN) {
+    fireEvent(watch.path, "OPENED", NOTE_OPEN);
+  }
+  if (fflags & NOTE_READ) {
+    fireEvent(watch.path, "ACCESSED", NOTE_READ);
+  }
+#endif
+}
+
+void KqueueEventPublisher::scanDirectory(Watch& watch) {
+  std::set<std::string> entries;
+  listEntries(watch.path, entries);
+
+  for (const auto& name : entries) {
+    if (watch.entries.count(name) > 0) {
+      continue;
+    }
+
+    auto child = joinPath(watch.path, name);
+    if (!isPathMonitored(child)) {
+      continue;
+    }
+
+    // Watch the new entry, and a new directory's tree if it is monitored.
+    std::set<std::string> paths = {child};
+    if (isDirectory(child).ok()) {
+      expandDirectory(child, true, paths);
+    }
+    for (const auto& path : paths) {
+      if (isPathMonitored(path)) {
+        addWatch(path);
+      }
+    }
+    fireEvent(child, "CREATED", NOTE_WRITE);
+  }
+
+  for (const auto& name : watch.entries) {
+    if (entries.count(name) > 0) {
+      continue;
+    }
+
+    // Watched entries fire their own NOTE_DELETE or NOTE_RENAME.
+    auto child = joinPath(watch.path, name);
+    if (path_descriptors_.count(child) == 0 && isPathMonitored(child)) {
+      fireEvent(child, "DELETED", NOTE_DELETE);
+    }
+  }
+  watch.entries.swap(entries);
+}
+
+void KqueueEventPublisher::fireEvent(const std::string& path,
+                                     const std::string& action,
+                                     uint32_t fflags) {
+  auto ec = createEventContext();
+  ec->path = path;
+  ec->action = action;
+  ec->fflags = fflags;
+  fire(ec);
+}
+
+bool KqueueEventPublisher::matchPath(const KqueueSubscriptionContextRef& sc,
+                                     const std::string& path) {
+  const auto& pattern = sc->path;
+  if (pattern.empty()) {
+    return false;
+  }
+
+  bool directory = (pattern.back() == '/');
+  if (path == pattern || (directory && path + '/' == pattern)) {
+    return true;
+  }
+
+  if (pattern.find('*') != std::string::npos) {
+    // A recursive pattern also matches the trees below its matches.
+    auto stem = (directory) ? pattern.substr(0, pattern.size() - 1) : pattern;
+    int flags = FNM_PATHNAME | ((sc->recursive) ? FNM_LEADING_DIR : 0);
+    if (::fnmatch(stem.c_str(), path.c_str(), flags) == 0) {
+      return true;
+    }
+
+    // A directory pattern matches the entries of its matches.
+    auto entries = pattern + '*';
+    return (directory &&
+            ::fnmatch(entries.c_str(), path.c_str(), FNM_PATHNAME) == 0);
+  }
+
+  if (!directory) {
+    return false;
+  }
+
+  if (sc->recursive) {
+    return (path.compare(0, pattern.size(), pattern) == 0);
+  }
+
+  // A directory subscription matches the directory's entries.
+  auto slash = path.rfind('/');
+  return (slash != std::string::npos &&
+          path.compare(0, slash + 1, pattern) == 0 &&
+          slash + 1 == pattern.size());
+}
+
+bool KqueueEventPublisher::shouldFire(const KqueueSubscriptionContextRef& sc,
+                                      const KqueueEventContextRef& ec) const {
+  // The subscription may supply a required note mask.
+  if (sc->mask != 0 && !(ec->fflags & sc->mask)) {
+    return false;
+  }
+  return matchPath(sc, ec->path);
+}
+}
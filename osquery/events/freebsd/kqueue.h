@@ -0,0 +1,204 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/event.h>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+extern std::map<uint32_t, std::string> kKqueueActions;
+
+extern const uint32_t kFileDefaultMasks;
+extern const uint32_t kFileAccessMasks;
+
+/**
+ * @brief Subscription details for KqueueEventPublisher events.
+ *
+ * A subscription path is a file, a directory, or a pattern using the same
+ * wildcards as the `inotify` publisher. A trailing `**` watches the tree
+ * below the path. Events are passed to the EventSubscriber if the path
+ * matches and the event's note is part of the mask, a mask of 0 passes
+ * every note.
+ */
+struct KqueueSubscriptionContext : public SubscriptionContext {
+  /// Subscription the following filesystem path.
+  std::string path;
+
+  /// Limit the `kqueue` notes to the subscription mask (if not 0).
+  uint32_t mask{0};
+
+  /// Treat this path as a directory and subscription recursively.
+  bool recursive{false};
+
+  /// Save the category this path originated form within the config.
+  std::string category;
+
+  /// Set the `mask` bits for a string action, a value in kKqueueActions.
+  void requireAction(const std::string& action) {
+    for (const auto& bit : kKqueueActions) {
+      if (action == bit.second) {
+        mask = mask | bit.first;
+      }
+    }
+  }
+
+ private:
+  /// The configured path, set when a recursive wildcard is split from it.
+  std::string discovered_;
+
+ private:
+  friend class KqueueEventPublisher;
+};
+
+/**
+ * @brief Event details for KqueueEventPublisher events.
+ */
+struct KqueueEventContext : public EventContext {
+  /// The path of the watched file, or of an entry of a watched directory.
+  std::string path;
+
+  /// A string action representing the event's note.
+  std::string action;
+
+  /// The `kqueue` note the action was decoded from. Entries created in a
+  /// watched directory report NOTE_WRITE, entries removed report NOTE_DELETE.
+  uint32_t fflags{0};
+
+  /// A no-op event transaction id.
+  uint32_t transaction_id{0};
+};
+
+using KqueueEventContextRef = std::shared_ptr<KqueueEventContext>;
+using KqueueSubscriptionContextRef =
+    std::shared_ptr<KqueueSubscriptionContext>;
+
+/**
+ * @brief A FreeBSD `kqueue` EVFILT_VNODE EventPublisher.
+ *
+ * Each watched file and directory is opened and registered with the kqueue.
+ * The descriptors are cached across configuration updates, a path keeps
+ * its descriptor while any subscription needs it and is only opened or
+ * closed when the set of watched paths changes.
+ *
+ * Like the Linux publishers, the run loop waits for readiness: kevent
+ * blocks until notes are pending, or a short timeout to observe `isEnding`.
+ * Each wait reads a batch of notes and merges the notes of each descriptor,
+ * so a file written many times between reads fires a single UPDATED.
+ *
+ * A vnode note does not name the directory entry that changed, a NOTE_WRITE
+ * on a watched directory rescans it to find created and removed entries.
+ */
+class KqueueEventPublisher
+    : public EventPublisher<KqueueSubscriptionContext, KqueueEventContext> {
+  DECLARE_PUBLISHER("kqueue");
+
+ public:
+  /// Create the kqueue descriptor.
+  Status setUp() override;
+
+  /// Watch the paths of new subscriptions and release the unused paths.
+  void configure() override;
+
+  /// Close the kqueue and every watched descriptor.
+  void tearDown() override;
+
+  /// Wait for and handle a batch of notes.
+  Status run() override;
+
+  /// The run loop waits for the kqueue descriptor.
+  bool waitsForReadiness() const override {
+    return true;
+  }
+
+ private:
+  /// A watched file or directory.
+  struct Watch {
+    /// The watched path.
+    std::string path;
+
+    /// True if the path is a directory, its entries are tracked.
+    bool directory{false};
+
+    /// The entry names of a directory, from the last scan.
+    std::set<std::string> entries;
+  };
+
+  /// Split a recursive wildcard from a subscription path.
+  void normalizeSubscription(const KqueueSubscriptionContextRef& sc) const;
+
+  /// Add the paths a subscription needs watched.
+  void expandSubscription(const KqueueSubscriptionContextRef& sc,
+                          std::set<std::string>& paths) const;
+
+  /// Add a directory's entries, and their trees if recursive.
+  void expandDirectory(const std::string& path,
+                       bool recursive,
+                       std::set<std::string>& paths) const;
+
+  /// Check if any subscription matches a path, so it should be watched.
+  bool isPathMonitored(const std::string& path) const;
+
+  /// Open and register a watch for a path, reusing a cached descriptor.
+  bool addWatch(const std::string& path);
+
+  /// Close a watch and forget its path.
+  void removeWatch(int fd);
+
+  /// Handle the merged notes of a descriptor.
+  void handleNotes(int fd, uint32_t fflags);
+
+  /// Rescan a directory and fire its created and removed entries.
+  void scanDirectory(Watch& watch);
+
+  /// Create and fire an event context.
+  void fireEvent(const std::string& path,
+                 const std::string& action,
+                 uint32_t fflags);
+
+  /// Given a SubscriptionContext and KqueueEventContext match path and note.
+  bool shouldFire(const KqueueSubscriptionContextRef& sc,
+                  const KqueueEventContextRef& ec) const override;
+
+  /// Check a path against a subscription's path or pattern.
+  static bool matchPath(const KqueueSubscriptionContextRef& sc,
+                        const std::string& path);
+
+ private:
+  /// The kqueue descriptor.
+  int kqueue_handle_{-1};
+
+  /// Watches by descriptor.
+  std::map<int, Watch> watches_;
+
+  /// Watched descriptors by path.
+  std::map<std::string, int> path_descriptors_;
+
+  /// The notes registered for each watch, access notes are only requested
+  /// if a subscription's mask includes them.
+  uint32_t notes_{0};
+
+  /// Access to the watches.
+  mutable Mutex watch_mutex_;
+
+ private:
+  friend class KqueueTests;
+  FRIEND_TEST(KqueueTests, test_kqueue_match_subscription);
+  FRIEND_TEST(KqueueTests, test_kqueue_configure);
+};
+}
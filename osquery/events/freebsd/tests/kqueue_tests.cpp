@@ -0,0 +1,134 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/filesystem.hpp>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+
+#include "osquery/events/freebsd/kqueue.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+class KqueueTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    test_dir_ = kTestWorkingDirectory + "kqueue-triggers" +
+                std::to_string(rand() % 10000 + 10000);
+    fs::create_directories(test_dir_ + "/sub");
+    writeTextFile(test_dir_ + "/1", "1");
+    writeTextFile(test_dir_ + "/sub/2", "2");
+  }
+
+  void TearDown() override {
+    fs::remove_all(test_dir_);
+  }
+
+  KqueueSubscriptionContextRef subscribe(
+      const std::shared_ptr<KqueueEventPublisher>& pub,
+      const std::string& path) {
+    auto sc = pub->createSubscriptionContext();
+    sc->path = path;
+    pub->subscriptions_.push_back(Subscription::create("TestSubscriber", sc));
+    return sc;
+  }
+
+ protected:
+  std::string test_dir_;
+};
+
+TEST_F(KqueueTests, test_kqueue_match_subscription) {
+  auto pub = std::make_shared<KqueueEventPublisher>();
+
+  // Directories are matched with their entries.
+  std::vector<std::string> valid_dirs = {"/etc", "/etc/", "/etc/*"};
+  for (const auto& dir : valid_dirs) {
+    auto sc = pub->createSubscriptionContext();
+    sc->path = dir;
+    pub->normalizeSubscription(sc);
+    auto ec = pub->createEventContext();
+    ec->path = "/etc/";
+    EXPECT_TRUE(pub->shouldFire(sc, ec));
+    ec->path = "/etc/passwd";
+    EXPECT_TRUE(pub->shouldFire(sc, ec));
+    ec->path = "/etc/ssh/sshd_config";
+    EXPECT_FALSE(pub->shouldFire(sc, ec));
+  }
+
+  // Recursive wildcards match the tree.
+  auto sc = pub->createSubscriptionContext();
+  sc->path = "/home/*/.ssh/**";
+  pub->normalizeSubscription(sc);
+  EXPECT_TRUE(sc->recursive);
+  EXPECT_EQ(sc->path, "/home/*/.ssh/");
+  auto ec = pub->createEventContext();
+  ec->path = "/home/user/.ssh/keys/authorized_keys";
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+  ec->path = "/home/user/.bashrc";
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+
+  // The subscription mask filters notes.
+  sc = pub->createSubscriptionContext();
+  sc->path = "/etc/passwd";
+  sc->requireAction("DELETED");
+  ec->path = "/etc/passwd";
+  ec->fflags = NOTE_WRITE;
+  EXPECT_FALSE(pub->shouldFire(sc, ec));
+  ec->fflags = NOTE_DELETE;
+  EXPECT_TRUE(pub->shouldFire(sc, ec));
+}
+
+TEST_F(KqueueTests, test_kqueue_configure) {
+  auto pub = std::make_shared<KqueueEventPublisher>();
+  ASSERT_TRUE(pub->setUp().ok());
+
+  // A recursive directory watches every file and directory in the tree.
+  subscribe(pub, test_dir_ + "/**");
+  pub->configure();
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_), 1U);
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_ + "/1"), 1U);
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_ + "/sub/2"), 1U);
+
+  // A literal file is watched with its directory.
+  pub->subscriptions_.clear();
+  subscribe(pub, test_dir_ + "/sub/2");
+  pub->configure();
+  EXPECT_EQ(pub->path_descriptors_.size(), 2U);
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_ + "/sub"), 1U);
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_ + "/1"), 0U);
+
+  // Descriptors of paths still watched are kept.
+  subscribe(pub, test_dir_ + "/1");
+  pub->configure();
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_ + "/sub/2"), 1U);
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_ + "/1"), 1U);
+  auto fd = pub->path_descriptors_.at(test_dir_ + "/sub/2");
+  pub->configure();
+  EXPECT_EQ(pub->path_descriptors_.at(test_dir_ + "/sub/2"), fd);
+
+  // A deleted file's watch is removed by its note.
+  fs::remove(test_dir_ + "/sub/2");
+  EXPECT_TRUE(pub->run().ok());
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_ + "/sub/2"), 0U);
+
+  // A file created in a watched directory is watched.
+  writeTextFile(test_dir_ + "/sub/2", "2");
+  EXPECT_TRUE(pub->run().ok());
+  EXPECT_EQ(pub->path_descriptors_.count(test_dir_ + "/sub/2"), 1U);
+
+  pub->subscriptions_.clear();
+  pub->tearDown();
+}
+}
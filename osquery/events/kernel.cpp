@@ -8,9 +8,14 @@
  *
  */
 
+#include <string.h>
+
+#include <algorithm>
+
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/kernel.h"
 
 namespace osquery {
@@ -22,14 +27,143 @@ const std::string kKernelDevice = "/dev/osquery";
 /// Kernel shared buffer size in bytes.
 static const size_t kKernelQueueSize = (20 * (1 << 20));
 
-/// Handle a maximum of 1000 events before requesting a resync.
-static const int kKernelEventsSyncMax = 1000;
+/// Handle a maximum of 4096 events before requesting a resync.
+static const size_t kKernelEventsSyncMax = 4096;
+
+/// Handle a maximum of 256 contiguous events before request another lock.
+static const size_t kKernelEventsBatch = 256;
 
-/// Handle a maximum of 10 events before request another lock.
-static const int kKernelEventsIterate = 10;
+/// File event actions recorded when a subscription does not choose.
+static const int kKernelFileActions =
+    OSQUERY_FILE_ACTION_OPEN | OSQUERY_FILE_ACTION_CLOSE |
+    OSQUERY_FILE_ACTION_CLOSE_MODIFIED;
 
 REGISTER(KernelEventPublisher, "event_publisher", "kernel");
 
+std::set<uint64_t> parseKernelFilterUIDs(const std::string &list) {
+  std::set<uint64_t> uids;
+  for (const auto &uid : split(list, ",")) {
+    unsigned long long value = 0;
+    if (safeStrtoull(uid, 10, value)) {
+      uids.insert(value);
+    } else {
+      LOG(WARNING) << "Invalid kernel event filter uid: " << uid;
+    }
+  }
+  return uids;
+}
+
+static inline bool matchesPrefix(const std::vector<std::string> &prefixes,
+                                 const std::string &path) {
+  for (const auto &prefix : prefixes) {
+    if (path.compare(0, prefix.size(), prefix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static inline osquery_filter_args_t makeFilter(osquery_event_t event_type,
+                                               osquery_filter_type_t type) {
+  osquery_filter_args_t filter;
+  memset(&filter, 0, sizeof(filter));
+  filter.event = event_type;
+  filter.type = type;
+  return filter;
+}
+
+static inline osquery_filter_args_t makePathFilter(
+    osquery_event_t event_type,
+    osquery_filter_type_t type,
+    const std::string &path) {
+  auto filter = makeFilter(event_type, type);
+  strncpy(filter.path, path.c_str(), MAXPATHLEN - 1);
+  return filter;
+}
+
+/**
+ * @brief Combine the filters of an event type's subscriptions.
+ *
+ * The kernel enqueues an event if any subscription may want it. Path
+ * prefixes and allowed executables are the union of the subscriptions, which
+ * only applies if every subscription has some. An executable is denied if
+ * every subscription denies it.
+ */
+static std::vector<osquery_filter_args_t> getKernelFilters(
+    osquery_event_t event_type,
+    const std::vector<KernelSubscriptionContextRef> &subs) {
+  std::vector<osquery_filter_args_t> filters;
+  filters.push_back(makeFilter(event_type, OSQUERY_FILTER_CLEAR));
+
+  if (event_type == OSQUERY_FILE_EVENT) {
+    std::map<std::string, int> paths;
+    for (const auto &sc : subs) {
+      auto actions = (sc->actions == OSQUERY_FILE_ACTION_NONE)
+                         ? kKernelFileActions
+                         : sc->actions;
+      if (sc->paths.empty()) {
+        paths["/"] |= actions;
+      }
+      for (const auto &path : sc->paths) {
+        paths[(path.empty()) ? "/" : path] |= actions;
+      }
+    }
+    for (const auto &path : paths) {
+      auto filter = makePathFilter(event_type, OSQUERY_FILTER_PATH, path.first);
+      filter.actions = static_cast<osquery_file_action_t>(path.second);
+      filters.push_back(filter);
+    }
+  }
+
+  bool every_uid = false;
+  bool every_exec = false;
+  std::set<uint64_t> uids;
+  std::set<std::string> allow;
+  std::set<std::string> deny;
+  for (size_t i = 0; i < subs.size(); i++) {
+    const auto &sc = subs[i];
+    every_uid = every_uid || sc->uids.empty();
+    every_exec = every_exec || sc->exec_allow.empty();
+    uids.insert(sc->uids.begin(), sc->uids.end());
+    allow.insert(sc->exec_allow.begin(), sc->exec_allow.end());
+
+    std::set<std::string> denied(sc->exec_deny.begin(), sc->exec_deny.end());
+    if (i == 0) {
+      deny = std::move(denied);
+    } else {
+      std::set<std::string> both;
+      std::set_intersection(deny.begin(),
+                            deny.end(),
+                            denied.begin(),
+                            denied.end(),
+                            std::inserter(both, both.begin()));
+      deny = std::move(both);
+    }
+  }
+
+  if (!every_uid && uids.size() <= OSQUERY_FILTER_MAX_UIDS) {
+    for (const auto &uid : uids) {
+      auto filter = makeFilter(event_type, OSQUERY_FILTER_UID);
+      filter.uid = uid;
+      filters.push_back(filter);
+    }
+  }
+
+  if (event_type == OSQUERY_PROCESS_EVENT) {
+    if (!every_exec) {
+      for (const auto &path : allow) {
+        filters.push_back(
+            makePathFilter(event_type, OSQUERY_FILTER_EXEC_ALLOW, path));
+      }
+    }
+    for (const auto &path : deny) {
+      filters.push_back(
+          makePathFilter(event_type, OSQUERY_FILTER_EXEC_DENY, path));
+    }
+  }
+  return filters;
+}
+
 Status KernelEventPublisher::setUp() {
   // A daemon should attempt to autoload kernel extensions/modules.
   if (kToolType == ToolType::DAEMON) {
@@ -63,11 +197,53 @@ Status KernelEventPublisher::setUp() {
 
 void KernelEventPublisher::configure() {
   WriteLock lock(mutex_);
+  if (queue_ == nullptr) {
+    return;
+  }
+
+  std::map<osquery_event_t, std::vector<KernelSubscriptionContextRef>> events;
   for (const auto &sub : subscriptions_) {
-    if (queue_ != nullptr) {
-      auto sc = getSubscriptionContext(sub->context);
-      queue_->subscribe(sc->event_type);
+    auto sc = getSubscriptionContext(sub->context);
+    events[sc->event_type].push_back(sc);
+  }
+
+  for (const auto &event : events) {
+    try {
+      // A kernel publisher is subscribed once, its filters are replaced.
+      if (subscribed_.count(event.first) == 0) {
+        queue_->subscribe(event.first);
+        subscribed_.insert(event.first);
+      }
+    } catch (const CQueueException &e) {
+      LOG(WARNING) << "Kernel subscription error: " << e.what();
+      continue;
+    }
+    filterEvent(event.first, event.second);
+  }
+}
+
+void KernelEventPublisher::filterEvent(
+    osquery_event_t event_type,
+    const std::vector<KernelSubscriptionContextRef> &subs) {
+  try {
+    for (const auto &filter : getKernelFilters(event_type, subs)) {
+      queue_->filter(filter);
+    }
+    return;
+  } catch (const CQueueException &e) {
+    VLOG(1) << "Kernel event filters not applied: " << e.what();
+  }
+
+  // Without filters every event is enqueued, and checked by shouldFire.
+  try {
+    queue_->filter(makeFilter(event_type, OSQUERY_FILTER_CLEAR));
+    if (event_type == OSQUERY_FILE_EVENT) {
+      auto filter = makePathFilter(event_type, OSQUERY_FILTER_PATH, "/");
+      filter.actions = static_cast<osquery_file_action_t>(kKernelFileActions);
+      queue_->filter(filter);
     }
+  } catch (const CQueueException &e) {
+    LOG(WARNING) << "Kernel event filter error: " << e.what();
   }
 }
 
@@ -77,6 +253,7 @@ void KernelEventPublisher::stop() {
     delete queue_;
     queue_ = nullptr;
   }
+  subscribed_.clear();
 }
 
 Status KernelEventPublisher::run() {
@@ -99,17 +276,26 @@ Status KernelEventPublisher::run() {
     LOG(WARNING) << "Queue synchronization error: " << e.what();
   }
 
-  auto dequeueEvents = [this]() {
-    // Dequeue several events while holding the lock.
-    int max_before_lock = kKernelEventsIterate;
-    while (max_before_lock > 0) {
-      // Request an event from the synchronized, safe, portion of the queue.
-      CQueue::event *event = nullptr;
-      auto event_type = queue_->dequeue(&event);
-      if (event_type == OSQUERY_NULL_EVENT) {
-        return false;
-      }
+  // Iterate over each span of events in the queue and appropriately fire each.
+  // The next synchronization returns every dequeued span to the kernel.
+  size_t events = 0;
+  while (events < kKernelEventsSyncMax) {
+    WriteLock lock(mutex_);
+    // The kernel publisher may have been torn down.
+    if (queue_ == nullptr) {
+      break;
+    }
 
+    // Request a span of events from the synchronized, safe, portion.
+    CQueue::batch batch;
+    if (queue_->dequeueBatch(batch, kKernelEventsBatch) == 0) {
+      break;
+    }
+    events += batch.count;
+
+    CQueue::event *event = nullptr;
+    osquery_event_t event_type = OSQUERY_NULL_EVENT;
+    while ((event_type = batch.next(&event)) != OSQUERY_NULL_EVENT) {
       // Each event type may use a specific event type structure.
       KernelEventContextRef ec = nullptr;
       switch (event_type) {
@@ -125,29 +311,13 @@ Status KernelEventPublisher::run() {
         LOG(WARNING) << "Unknown kernel event received: " << event_type;
         break;
       }
-      max_before_lock--;
-    }
-    return true;
-  };
-
-  // Iterate over each event type in the queue and appropriately fire each.
-  int max_before_sync = kKernelEventsSyncMax;
-  while (max_before_sync > 0) {
-    WriteLock lock(mutex_);
-    // The kernel publisher may have been torn down.
-    if (queue_ == nullptr) {
-      break;
     }
-    // A NULL event occurred, stop dequeuing.
-    if (!dequeueEvents()) {
-      break;
-    }
-    // Append the number of dequeue events to the synchronization counter.
-    max_before_sync -= kKernelEventsIterate;
   }
 
-  // Pause for a cool-off since we implement comms in a no-blocking mode.
-  pauseMilli(1000);
+  if (events < kKernelEventsSyncMax) {
+    // Pause for a cool-off since we implement comms in a no-blocking mode.
+    pauseMilli(1000);
+  }
   return Status(0, "Continue");
 }
 
@@ -170,6 +340,36 @@ KernelEventContextRef KernelEventPublisher::createEventContextFrom(
 
 bool KernelEventPublisher::shouldFire(const KernelSubscriptionContextRef &sc,
                                       const KernelEventContextRef &ec) const {
-  return ec->event_type == sc->event_type;
+  if (ec->event_type != sc->event_type) {
+    return false;
+  }
+
+  // The kernel enqueues events wanted by any of the subscriptions.
+  using FileEventContext = TypedKernelEventContext<osquery_file_event_t>;
+  using ProcessEventContext = TypedKernelEventContext<osquery_process_event_t>;
+  if (ec->event_type == OSQUERY_FILE_EVENT) {
+    const auto &event = std::static_pointer_cast<FileEventContext>(ec)->event;
+    if (!sc->uids.empty() && sc->uids.count(event.uid) == 0) {
+      return false;
+    }
+    if (sc->actions != OSQUERY_FILE_ACTION_NONE &&
+        !(sc->actions & event.action)) {
+      return false;
+    }
+    std::string path(event.path, strnlen(event.path, MAXPATHLEN));
+    return sc->paths.empty() || matchesPrefix(sc->paths, path);
+  } else if (ec->event_type == OSQUERY_PROCESS_EVENT) {
+    const auto &event =
+        std::static_pointer_cast<ProcessEventContext>(ec)->event;
+    if (!sc->uids.empty() && sc->uids.count(event.uid) == 0) {
+      return false;
+    }
+    std::string path(event.path, strnlen(event.path, MAXPATHLEN));
+    if (matchesPrefix(sc->exec_deny, path)) {
+      return false;
+    }
+    return sc->exec_allow.empty() || matchesPrefix(sc->exec_allow, path);
+  }
+  return true;
 }
 } // namespace osquery
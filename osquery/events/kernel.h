@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <set>
 #include <vector>
 
 #include <osquery/events.h>
@@ -32,6 +33,9 @@ extern const std::string kKernelDevice;
  */
 void loadKernelExtension();
 
+/// Parse a comma-delimited list of uids, invalid uids are skipped.
+std::set<uint64_t> parseKernelFilterUIDs(const std::string &list);
+
 /**
  * @brief Subscription details for KernelEventPublisher events.
  */
@@ -41,6 +45,21 @@ struct KernelSubscriptionContext : public SubscriptionContext {
 
   /// Optional category passed to the callback.
   std::string category;
+
+  /// File event path prefixes, every path if empty.
+  std::vector<std::string> paths;
+
+  /// File event actions, see osquery_file_action_t, every action if NONE.
+  int actions{OSQUERY_FILE_ACTION_NONE};
+
+  /// Real uids of the acting process, every user if empty.
+  std::set<uint64_t> uids;
+
+  /// Process executable path prefixes, every executable if empty.
+  std::vector<std::string> exec_allow;
+
+  /// Process executable path prefixes that are never recorded.
+  std::vector<std::string> exec_deny;
 };
 
 /**
@@ -99,6 +118,10 @@ class KernelEventPublisher
    * register kernel-based callbacks or start kernel threads that publish into
    * a circular queue. When the queue is initialized it may communicate to each
    * of these kernel publishers.
+   *
+   * The subscriptions' paths, uids, and executables are pushed as filters,
+   * so the kernel only enqueues events matching at least one subscription.
+   * Each subscription still checks its own filters in shouldFire.
    */
   void configure() override;
 
@@ -120,6 +143,13 @@ class KernelEventPublisher
 
   CQueue *queue_{nullptr};
 
+  /// Event types subscribed in the kernel since the queue was created.
+  std::set<osquery_event_t> subscribed_;
+
+  /// Push the filters of an event type's subscriptions.
+  void filterEvent(osquery_event_t event_type,
+                   const std::vector<KernelSubscriptionContextRef> &subs);
+
   /// Check whether the subscription matches the event.
   bool shouldFire(const KernelSubscriptionContextRef &sc,
                   const KernelEventContextRef &ec) const override;
@@ -78,6 +78,40 @@ static inline void consumerThread(benchmark::State &state) {
   close(fd);
 }
 
+static inline void batchProducerThread(benchmark::State &state) {
+  std::unique_ptr<CQueue> queue = nullptr;
+  try {
+    queue = std::unique_ptr<CQueue>(new CQueue(kKernelDevice, 8 * (1 << 20)));
+  } catch (const CQueueException &e) {
+    // The device interface cannot be found or cannot be opened.
+  }
+
+  size_t batch_size = static_cast<size_t>(state.range_x());
+  CQueue::batch batch;
+  osquery_event_t event;
+  osquery::CQueue::event *event_buf = nullptr;
+  int drops = 0;
+  size_t reads = 0;
+  size_t syncs = 0;
+  while (state.KeepRunning()) {
+    if (queue == nullptr) {
+      continue;
+    }
+    drops += queue->kernelSync(OSQUERY_OPTIONS_NO_BLOCK);
+    syncs++;
+    while (queue->dequeueBatch(batch, batch_size) > 0) {
+      while ((event = batch.next(&event_buf))) {
+        reads++;
+      }
+    }
+  }
+
+  state.SetItemsProcessed(reads);
+  auto label = std::string("dropped: ") + std::to_string(drops) + "  syncs: " +
+               std::to_string(syncs);
+  state.SetLabel(label);
+}
+
 static void CommunicationBenchmark(benchmark::State &state) {
   if (state.thread_index == 0) {
     producerThread(state);
@@ -88,5 +122,21 @@ static void CommunicationBenchmark(benchmark::State &state) {
 
 BENCHMARK(CommunicationBenchmark)->UseRealTime()->ThreadRange(2, 32);
 
+static void CommunicationBatchBenchmark(benchmark::State &state) {
+  if (state.thread_index == 0) {
+    batchProducerThread(state);
+  } else {
+    consumerThread(state);
+  }
+}
+
+BENCHMARK(CommunicationBatchBenchmark)
+    ->UseRealTime()
+    ->Threads(8)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(256)
+    ->Arg(4096);
+
 #endif // KERNEL_TEST
 }
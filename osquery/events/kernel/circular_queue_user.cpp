@@ -10,8 +10,11 @@
 
 #include <sys/ioctl.h>
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <limits>
+
 #include "osquery/events/kernel/circular_queue_user.h"
 
 namespace osquery {
@@ -21,6 +24,8 @@ CQueue::CQueue(const std::string &device, size_t size) {
   alloc.size = size;
   alloc.buffer = nullptr;
   alloc.version = OSQUERY_KERNEL_COMM_VERSION;
+  alloc.cpus = 0;
+  alloc.cpu_size = 0;
 
   fd_ = open(device.c_str(), O_RDWR);
   if (fd_ < 0) {
@@ -31,10 +36,21 @@ CQueue::CQueue(const std::string &device, size_t size) {
     throw CQueueException("Could not allocate shared buffer");
   }
 
+  if (alloc.cpus == 0 || alloc.cpus > OSQUERY_MAX_CPUS ||
+      alloc.cpus * alloc.cpu_size > size) {
+    throw CQueueException("Invalid shared buffer layout");
+  }
+
   buffer_ = (uint8_t *)alloc.buffer;
   size_ = size;
-  read_ = (uint8_t *)alloc.buffer;
-  max_read_ = (uint8_t *)alloc.buffer;
+  rings_.resize(alloc.cpus);
+  for (size_t i = 0; i < rings_.size(); i++) {
+    auto &ring = rings_[i];
+    ring.buffer = buffer_ + i * alloc.cpu_size;
+    ring.size = alloc.cpu_size;
+    ring.read = ring.buffer;
+    ring.max_read = ring.buffer;
+  }
 }
 
 CQueue::~CQueue() {
@@ -54,45 +70,143 @@ void CQueue::subscribe(osquery_event_t event) {
   }
 }
 
-osquery_event_t CQueue::dequeue(CQueue::event **event) {
-  if (read_ == max_read_ || event == nullptr) {
-    return (osquery_event_t)0;
+void CQueue::filter(const osquery_filter_args_t &filter) {
+  // The ioctl does not modify the request.
+  auto args = filter;
+  if (ioctl(fd_, OSQUERY_IOCTL_FILTER, &args)) {
+    throw CQueueException("Could not filter event");
   }
-  osquery_data_header_t *header = (osquery_data_header_t *)read_;
-  if (read_ + sizeof(osquery_data_header_t) > buffer_ + size_ ||
+}
+
+osquery_data_header_t *CQueue::head(CQueue::ring &ring) {
+  if (ring.read == ring.max_read) {
+    return nullptr;
+  }
+
+  osquery_data_header_t *header = (osquery_data_header_t *)ring.read;
+  if (ring.read + sizeof(osquery_data_header_t) > ring.buffer + ring.size ||
       header->event == END_OF_BUFFER_EVENT) {
-    read_ = buffer_;
-    if (read_ == max_read_) {
-      return (osquery_event_t)0;
+    ring.read = ring.buffer;
+    if (ring.read == ring.max_read) {
+      return nullptr;
     }
   }
-  header = (osquery_data_header_t *)read_;
-  if (header->event != END_OF_BUFFER_EVENT) {
-    size_t size = header->size + sizeof(osquery_data_header_t);
-    read_ = (read_ + size - buffer_) % size_ + buffer_;
+  return (osquery_data_header_t *)ring.read;
+}
+
+CQueue::ring *CQueue::earliest() {
+  ring *earliest = nullptr;
+  uint64_t timestamp = 0;
+  for (auto &ring : rings_) {
+    auto header = head(ring);
+    if (header != nullptr &&
+        (earliest == nullptr || header->timestamp < timestamp)) {
+      earliest = &ring;
+      timestamp = header->timestamp;
+    }
+  }
+  return earliest;
+}
+
+osquery_event_t CQueue::dequeue(CQueue::event **event) {
+  if (event == nullptr) {
+    return (osquery_event_t)0;
+  }
+
+  auto ring = earliest();
+  if (ring == nullptr) {
+    return (osquery_event_t)0;
   }
 
+  osquery_data_header_t *header = (osquery_data_header_t *)ring->read;
+  size_t size = header->size + sizeof(osquery_data_header_t);
+  ring->read = (ring->read + size - ring->buffer) % ring->size + ring->buffer;
+
   *event = (CQueue::event *)&(header->size);
   return header->event;
 }
 
+size_t CQueue::dequeueBatch(CQueue::batch &batch, size_t max) {
+  batch.position = nullptr;
+  batch.end = nullptr;
+  batch.count = 0;
+
+  auto ring = earliest();
+  if (ring == nullptr) {
+    return 0;
+  }
+
+  // Events later than the next event of another CPU must wait for a span.
+  uint64_t limit = std::numeric_limits<uint64_t>::max();
+  for (auto &other : rings_) {
+    if (&other == ring) {
+      continue;
+    }
+    auto header = head(other);
+    if (header != nullptr && header->timestamp < limit) {
+      limit = header->timestamp;
+    }
+  }
+
+  // Walk the event headers until the span ends.
+  auto end = ring->buffer + ring->size;
+  auto position = ring->read;
+  while (batch.count < max && position != ring->max_read) {
+    auto header = (osquery_data_header_t *)position;
+    if (position + sizeof(osquery_data_header_t) > end ||
+        header->event == END_OF_BUFFER_EVENT) {
+      // The kernel continued writing at the start of the queue.
+      break;
+    } else if (batch.count > 0 && header->timestamp > limit) {
+      break;
+    }
+    position += sizeof(osquery_data_header_t) + header->size;
+    batch.count++;
+    if (position >= end) {
+      break;
+    }
+  }
+
+  batch.position = ring->read;
+  batch.end = position;
+  ring->read = (position - ring->buffer) % ring->size + ring->buffer;
+  return batch.count;
+}
+
 int CQueue::kernelSync(int options) {
   // A positive return indicates drops, 0 is all good in the hood.
   // Options are listed in kernel feeds; primarily OSQUERY_OPTIONS_NO_BLOCK.
   osquery_buf_sync_args_t sync;
-  sync.read_offset = read_ - buffer_;
+  memset(&sync, 0, sizeof(sync));
+  for (size_t i = 0; i < rings_.size(); i++) {
+    sync.read_offsets[i] = rings_[i].read - rings_[i].buffer;
+  }
   sync.options = options;
 
   int err = 0;
   err = ioctl(fd_, OSQUERY_IOCTL_BUF_SYNC, &sync);
-  uint8_t *new_max_read = sync.max_read_offset + buffer_;
-  max_read_ = new_max_read;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    rings_[i].max_read = rings_[i].buffer + sync.max_read_offsets[i];
+  }
   if (err) {
-    read_ = max_read_;
+    for (auto &ring : rings_) {
+      ring.read = ring.max_read;
+    }
     throw CQueueException("Could not sync buffer with kernel properly");
   }
 
-  return sync.drops;
+  // Drops are counted per CPU, an overflow on any CPU is reported.
+  int drops = 0;
+  bool overflow = false;
+  for (size_t i = 0; i < rings_.size(); i++) {
+    if (sync.drops[i] < 0) {
+      overflow = true;
+    } else {
+      rings_[i].drops += sync.drops[i];
+      drops += sync.drops[i];
+    }
+  }
+  return (overflow) ? -1 : drops;
 }
 
 } // namespace osquery
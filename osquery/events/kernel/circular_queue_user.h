@@ -12,6 +12,7 @@
 
 #include <stdexcept>
 #include <string>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 
@@ -37,6 +38,40 @@ class CQueue : private boost::noncopyable {
     char buf[];
   };
 
+  /**
+   * @brief A contiguous span of events within the shared buffer.
+   *
+   * The events are read in place and remain valid until the next kernelSync,
+   * which returns the span to the kernel.
+   */
+  struct batch {
+    /// The header of the next event in the span.
+    uint8_t *position{nullptr};
+
+    /// The end of the span.
+    uint8_t *end{nullptr};
+
+    /// The number of events in the span.
+    size_t count{0};
+
+    /**
+     * @brief Read the next event in the span.
+     *
+     * @param event (output) A pointer to the event within the shared buffer.
+     * @return Returns 0 if the span is exhausted, otherwise the event type.
+     */
+    osquery_event_t next(event **event) {
+      if (position >= end || event == nullptr) {
+        return (osquery_event_t)0;
+      }
+
+      auto header = (osquery_data_header_t *)position;
+      position += sizeof(osquery_data_header_t) + header->size;
+      *event = (CQueue::event *)&(header->size);
+      return header->event;
+    }
+  };
+
   /**
    * @brief Creates cqueue.
    *
@@ -66,15 +101,43 @@ class CQueue : private boost::noncopyable {
    */
   void subscribe(osquery_event_t event);
 
+  /**
+   * @brief Push a filter into the kernel extension.
+   *
+   * The kernel publisher of the event type checks its filters before an
+   * event is enqueued, so filtered events never reach the shared buffer.
+   *
+   * @param filter The filter request, see osquery_filter_type_t.
+   */
+  void filter(const osquery_filter_args_t &filter);
+
   /**
    * @brief Dequeue's an event from the shared buffer.
    *
+   * The kernel writes events into a queue per CPU, the event with the earliest
+   * reservation timestamp across the queues is dequeued first.
+   *
    * @param event (output) A pointer to the event dequeue if any.
    * @return Returns 0 if queue is empty, otherwise the number of the event put
    * into event.
    */
   osquery_event_t dequeue(event **event);
 
+  /**
+   * @brief Dequeue a contiguous span of events from the shared buffer.
+   *
+   * The span is taken from the CPU queue holding the earliest event. It ends
+   * at the synchronized max read position, at the end of the queue where the
+   * kernel wraps events, after max events, or before an event that is later
+   * than the next event of another CPU queue. A following call continues with
+   * the next span.
+   *
+   * @param batch (output) The span of events.
+   * @param max The maximum number of events in the span.
+   * @return Returns the number of events in the span, 0 if queue is empty.
+   */
+  size_t dequeueBatch(batch &batch, size_t max);
+
   /**
    * @brief Sync the cqueue structure with the cqueue structure in the kernel.
    *
@@ -87,11 +150,42 @@ class CQueue : private boost::noncopyable {
    */
   int kernelSync(int options);
 
+  /// The number of per-CPU queues within the shared buffer.
+  size_t cpus() const {
+    return rings_.size();
+  }
+
+  /// The number of events the kernel dropped on a CPU queue since creation.
+  int drops(size_t cpu) const {
+    return (cpu < rings_.size()) ? rings_[cpu].drops : 0;
+  }
+
+ private:
+  /// The user view of a single CPU queue.
+  struct ring {
+    uint8_t *buffer{nullptr};
+    size_t size{0};
+    uint8_t *max_read{nullptr};
+    uint8_t *read{nullptr};
+    int drops{0};
+  };
+
+  /**
+   * @brief Find the next readable event header in a CPU queue.
+   *
+   * This skips the kernel's wrap to the start of the queue.
+   *
+   * @return The header, or nullptr if the queue is empty.
+   */
+  osquery_data_header_t *head(ring &ring);
+
+  /// Find the CPU queue holding the earliest event, or nullptr if all empty.
+  ring *earliest();
+
  private:
   uint8_t *buffer_{nullptr};
   size_t size_{0};
-  uint8_t *max_read_{nullptr};
-  uint8_t *read_{nullptr};
+  std::vector<ring> rings_;
   int fd_{-1};
 };
 
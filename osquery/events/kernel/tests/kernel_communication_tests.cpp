@@ -93,6 +93,61 @@ TEST_F(KernelCommunicationTests, test_communication) {
   // Since the sync is opened non-blocking we allow a 5% drop rate.
   EXPECT_GT(total_events, expected_events * 0.95);
   EXPECT_LE(total_events, expected_events);
+
+  // Drops are accounted for each CPU queue.
+  unsigned int cpu_drops = 0;
+  EXPECT_GT(queue.cpus(), 0U);
+  for (size_t cpu = 0; cpu < queue.cpus(); cpu++) {
+    cpu_drops += queue.drops(cpu);
+  }
+  EXPECT_EQ(cpu_drops, drops);
+}
+
+TEST_F(KernelCommunicationTests, test_communication_batch) {
+  unsigned int num_threads = 20;
+  unsigned int events_per_thread = 100000;
+  unsigned int drops = 0;
+  unsigned int reads = 0;
+
+  CQueue queue(kKernelDevice, 8 * (1 << 20));
+
+  auto& dispatcher = Dispatcher::instance();
+
+  for (unsigned int c = 0; c < num_threads; ++c) {
+    dispatcher.addService(
+        std::make_shared<KernelProducerRunnable>(events_per_thread, c % 2));
+  }
+
+  osquery_event_t event;
+  osquery::CQueue::event* event_buf = nullptr;
+  CQueue::batch batch;
+  unsigned int tasks = 0;
+  do {
+    tasks = dispatcher.serviceCount();
+    drops += queue.kernelSync(OSQUERY_OPTIONS_NO_BLOCK);
+    while (queue.dequeueBatch(batch, 256) > 0) {
+      size_t count = 0;
+      while ((event = batch.next(&event_buf))) {
+        switch (event) {
+        case OSQUERY_TEST_EVENT_0:
+        case OSQUERY_TEST_EVENT_1:
+          reads++;
+          break;
+        default:
+          throw std::runtime_error("Uh oh. Unknown event.");
+        }
+        count++;
+      }
+      EXPECT_EQ(count, batch.count);
+    }
+  } while (tasks > 0);
+
+  auto total_events = reads + drops;
+  auto expected_events = num_threads * events_per_thread;
+
+  // Since the sync is opened non-blocking we allow a 5% drop rate.
+  EXPECT_GT(total_events, expected_events * 0.95);
+  EXPECT_LE(total_events, expected_events);
 }
 #endif // KERNEL_TEST
 }
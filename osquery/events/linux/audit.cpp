@@ -8,6 +8,12 @@
  *
  */
 
+#include <algorithm>
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+
 #include <boost/algorithm/string/classification.hpp>
 #include <boost/algorithm/string/split.hpp>
 #include <boost/filesystem.hpp>
@@ -15,6 +21,7 @@
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
@@ -36,6 +43,18 @@ FLAG(bool,
      false,
      "Allow the audit publisher to change auditing configuration");
 
+/// Read netlink replies in batches and fire one event per multi-record event.
+FLAG(bool,
+     audit_assemble_events,
+     false,
+     "Batch audit reads and fire one event per multi-record audit event");
+
+/// Bursts of audit messages may overflow the default netlink buffer.
+FLAG(uint64,
+     audit_socket_buffer_size,
+     0,
+     "Audit netlink receive buffer bytes (default 0 uses the system default)");
+
 REGISTER(AuditEventPublisher, "event_publisher", "audit");
 
 enum AuditStatus {
@@ -44,8 +63,18 @@ enum AuditStatus {
   AUDIT_IMMUTABLE = 2,
 };
 
+/// Wait for replies, at most this long, before checking for interruption.
 static const int kAuditMLatency = 1000;
 
+/// Seconds between requests for the audit status.
+static const size_t kAuditStatusInterval = 10;
+
+/// The number of netlink messages read with each recvmmsg.
+static const size_t kAuditReadBatch = 64;
+
+/// The max number of multi-record events awaiting an end-of-event record.
+static const size_t kAuditMaxPending = 256;
+
 Status AuditEventPublisher::setUp() {
   if (FLAGS_disable_audit) {
     return Status(1, "Publisher disabled via configuration");
@@ -57,6 +86,16 @@ Status AuditEventPublisher::setUp() {
     return Status(1, "Could not open audit subsystem");
   }
 
+  if (FLAGS_audit_socket_buffer_size > 0) {
+    // Prefer forcing the size, allowed for root, beyond the rmem_max limit.
+    int size = static_cast<int>(FLAGS_audit_socket_buffer_size);
+    if (setsockopt(handle_, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) <
+            0 &&
+        setsockopt(handle_, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) < 0) {
+      LOG(WARNING) << "Could not set the audit socket buffer size: " << size;
+    }
+  }
+
   // The setup can try to enable auditing.
   if (FLAGS_audit_allow_config) {
     audit_set_enabled(handle_, AUDIT_ENABLED);
@@ -92,10 +131,63 @@ Status AuditEventPublisher::setUp() {
   return Status(0, "OK");
 }
 
-void AuditEventPublisher::configure() {
-  // Able to issue libaudit API calls.
-  struct AuditRuleInternal rule;
+Status parseAuditRuleFields(const std::string& filters,
+                            std::vector<AuditRuleField>& fields) {
+  for (const auto& filter : osquery::split(filters, ",")) {
+    auto op_start = filter.find_first_of("!<>=");
+    if (op_start == 0 || op_start == std::string::npos) {
+      return Status(1, "Invalid audit rule field: " + filter);
+    }
+
+    auto op_end = filter.find_first_not_of("!<>=", op_start);
+    AuditRuleField field;
+    field.field = filter.substr(0, op_start);
+    field.op = filter.substr(op_start, op_end - op_start);
+    if (op_end != std::string::npos) {
+      field.value = filter.substr(op_end);
+    }
+
+    if (field.value.empty() ||
+        (field.op != "=" && field.op != "!=" && field.op != "<" &&
+         field.op != "<=" && field.op != ">" && field.op != ">=")) {
+      return Status(1, "Invalid audit rule field: " + filter);
+    }
+    fields.push_back(std::move(field));
+  }
+  return Status(0, "OK");
+}
+
+/// Allocate libaudit rule data for a subscription rule.
+static struct audit_rule_data* createAuditRule(const AuditRule& scr,
+                                               bool with_fields) {
+  auto rule = static_cast<struct audit_rule_data*>(
+      calloc(1, sizeof(struct audit_rule_data)));
+  if (rule == nullptr) {
+    return nullptr;
+  }
 
+  if (scr.syscall != 0) {
+    audit_rule_syscall_data(rule, scr.syscall);
+  }
+
+  if (scr.filter.size() > 0) {
+    // Fill in rule's filter data.
+    audit_rule_fieldpair_data(&rule, scr.filter.c_str(), scr.flags);
+  }
+
+  if (with_fields) {
+    for (const auto& field : scr.fields) {
+      // Field pairs with string values, such as exe, may reallocate the rule.
+      if (audit_rule_fieldpair_data(&rule, field.str().c_str(), scr.flags) <
+          0) {
+        LOG(WARNING) << "Cannot add audit rule field: " << field.str();
+      }
+    }
+  }
+  return rule;
+}
+
+void AuditEventPublisher::configure() {
   // Before reply data is ever filled in, assure an empty message.
   memset(&reply_, 0, sizeof(struct audit_reply));
 
@@ -113,23 +205,30 @@ void AuditEventPublisher::configure() {
   for (auto& sub : subscriptions_) {
     auto sc = getSubscriptionContext(sub->context);
     for (const auto& scr : sc->rules) {
-      // Reset all members to nothing.
-      memset(&rule.rule, 0, sizeof(struct audit_rule_data));
-
-      if (scr.syscall != 0) {
-        audit_rule_syscall_data(&rule.rule, scr.syscall);
-      }
-
-      if (scr.filter.size() > 0) {
-        // Fill in rule's filter data.
-        auto* rrule = &rule.rule;
-        audit_rule_fieldpair_data(&rrule, scr.filter.c_str(), scr.flags);
+      struct AuditRuleInternal rule;
+      rule.rule = createAuditRule(scr, true);
+      if (rule.rule == nullptr) {
+        continue;
       }
 
       // Apply this rule to the EXIT filter, ALWAYS.
       VLOG(1) << "Adding audit rule: syscall=" << scr.syscall
-              << " action=" << scr.action << " filter='" << scr.filter << "'";
-      int rc = audit_add_rule_data(handle_, &rule.rule, scr.flags, scr.action);
+              << " action=" << scr.action << " filter='" << scr.filter << "'"
+              << " fields=" << scr.fields.size();
+      int rc = audit_add_rule_data(handle_, rule.rule, scr.flags, scr.action);
+      if (rc < 0 && rc != -EEXIST && !scr.fields.empty()) {
+        // The kernel may not support a field, such as exe, fall back to the
+        // rule without fields and compare fields of the received records.
+        LOG(WARNING) << "Cannot add audit rule fields: syscall=" << scr.syscall
+                     << ": error " << rc;
+        free(rule.rule);
+        rule.rule = createAuditRule(scr, false);
+        if (rule.rule == nullptr) {
+          continue;
+        }
+        rc = audit_add_rule_data(handle_, rule.rule, scr.flags, scr.action);
+      }
+
       if (rc < 0) {
         // Problem adding rule. If errno == EEXIST then fine.
         LOG(WARNING) << "Cannot add audit rule: syscall=" << scr.syscall
@@ -164,10 +263,15 @@ void AuditEventPublisher::tearDown() {
   // when the process tears down.
   if (!immutable_) {
     for (auto& rule : transient_rules_) {
-      audit_delete_rule_data(handle_, &rule.rule, rule.flags, rule.action);
+      audit_delete_rule_data(handle_, rule.rule, rule.flags, rule.action);
     }
   }
 
+  for (auto& rule : transient_rules_) {
+    free(rule.rule);
+  }
+  transient_rules_.clear();
+
   audit_close(handle_);
 }
 
@@ -175,65 +279,115 @@ inline void handleAuditConfigChange(const struct audit_reply& reply) {
   // Another daemon may have taken control.
 }
 
-inline bool handleAuditReply(const struct audit_reply& reply,
-                             AuditEventContextRef& ec) {
-  // Build an event context around this reply.
-  ec->type = reply.type;
+void AuditFields::parse(const char* message, size_t size) {
+  message_.assign(message, size);
+  views_.clear();
 
-  // Tokenize the message.
-  auto message = std::string(reply.message, reply.len);
-  auto preamble_end = message.find("): ");
-  if (preamble_end == std::string::npos) {
-    return false;
-  } else {
-    ec->preamble = message.substr(0, preamble_end + 1);
-    message = message.substr(preamble_end + 3);
-  }
-
-  // The linear search will construct series of key value pairs.
-  std::string key, value;
+  // The linear search will construct series of key value ranges.
+  View view;
+  view.key = 0;
   // There are several ways of representing value data (enclosed strings, etc).
   bool found_assignment{false}, found_enclose{false};
-  for (const auto& c : message) {
+  for (size_t i = 0; i <= size; ++i) {
     // Iterate over each character in the audit message.
-    if ((found_enclose && c == '"') || (!found_enclose && c == ' ')) {
-      if (c == '"') {
-        value += c;
-      }
+    char c = (i < size) ? message[i] : ' ';
+    if ((found_enclose && c == '"') || (!found_enclose && c == ' ') ||
+        i == size) {
       // This is a terminating sequence, the end of an enclosure or space tok.
-      if (!key.empty()) {
+      // The closing quote of an enclosure is part of the value.
+      auto end = (found_enclose && c == '"' && i < size) ? i + 1 : i;
+      if (view.key_size > 0) {
         // Multiple space tokens are supported.
-        ec->fields[key] = value;
+        view.value_size =
+            (found_assignment) ? static_cast<uint32_t>(end - view.value) : 0;
+        views_.push_back(view);
       }
       found_enclose = false;
       found_assignment = false;
-      key.clear();
-      value.clear();
-    } else if (!found_assignment && c == ' ') {
-      // A field tokenizer.
+      view = View();
+      view.key = static_cast<uint32_t>(i + 1);
     } else if (found_assignment) {
       // Enclosure sequences appear immediately following assignment.
       if (c == '"') {
         found_enclose = true;
       }
-      value += c;
     } else if (c == '=') {
       found_assignment = true;
+      view.value = static_cast<uint32_t>(i + 1);
     } else {
-      key += c;
+      view.key_size++;
     }
   }
+}
+
+void AuditFields::set(const std::string& key, const std::string& value) {
+  auto existing = const_cast<View*>(find(key));
+  if (existing == nullptr) {
+    View view;
+    view.key = static_cast<uint32_t>(message_.size());
+    view.key_size = static_cast<uint32_t>(key.size());
+    message_.append(key);
+    views_.push_back(view);
+    existing = &views_.back();
+  }
+  existing->value = static_cast<uint32_t>(message_.size());
+  existing->value_size = static_cast<uint32_t>(value.size());
+  message_.append(value);
+}
 
-  // Last step, if there was no trailing tokenizer.
-  if (!key.empty()) {
-    ec->fields[key] = value;
+const AuditFields::View* AuditFields::find(const std::string& key) const {
+  for (auto view = views_.rbegin(); view != views_.rend(); ++view) {
+    if (view->key_size == key.size() &&
+        message_.compare(view->key, view->key_size, key) == 0) {
+      return &(*view);
+    }
   }
+  return nullptr;
+}
+
+std::string AuditFields::get(const std::string& key,
+                             const char* missing) const {
+  auto view = find(key);
+  if (view == nullptr) {
+    return missing;
+  }
+  return message_.substr(view->value, view->value_size);
+}
+
+bool AuditFields::equals(const std::string& key,
+                         const std::string& value) const {
+  auto view = find(key);
+  return view != nullptr && view->value_size == value.size() &&
+         message_.compare(view->value, view->value_size, value) == 0;
+}
+
+inline bool handleAuditReply(const struct audit_reply& reply,
+                             AuditEventContextRef& ec) {
+  // Build an event context around this reply.
+  ec->type = reply.type;
+
+  // Tokenize the message in place, only the fields are copied.
+  const char* message = reply.message;
+  size_t size = static_cast<size_t>(std::max(reply.len, 0));
+  const char* preamble_end = nullptr;
+  for (size_t i = 0; i + 2 < size; ++i) {
+    if (message[i] == ')' && message[i + 1] == ':' && message[i + 2] == ' ') {
+      preamble_end = message + i;
+      break;
+    }
+  }
+  if (preamble_end == nullptr) {
+    return false;
+  }
+
+  ec->preamble.assign(message, preamble_end + 1);
+  auto body = preamble_end + 3;
+  ec->fields.parse(body, size - (body - message));
 
   // There is a special field for syscalls.
   if (ec->fields.count("syscall") == 1) {
-    const auto& syscall_string = ec->fields.at("syscall").c_str();
     long long syscall{0};
-    if (!safeStrtoll(syscall_string, 10, syscall)) {
+    if (!safeStrtoll(ec->fields.get("syscall"), 10, syscall)) {
       syscall = 0;
     }
     ec->syscall = syscall;
@@ -247,79 +401,212 @@ void AuditEventPublisher::handleListRules() {
   // This is not needed until there are audit meta-tables listing the rules.
 }
 
-Status AuditEventPublisher::run() {
-  if (!FLAGS_disable_audit && (count_ == 0 || count_++ % 10 == 0)) {
-    // Request an update to the audit status.
-    // This will also fill in the status on first run.
-    audit_request_status(handle_);
+/// Parse the serial from an audit preamble: audit(time:serial).
+static inline bool getAuditSerial(const std::string& preamble, size_t& serial) {
+  auto start = preamble.find(':');
+  auto end = preamble.find(')');
+  if (start == std::string::npos || end == std::string::npos || end < start) {
+    return false;
+  }
+
+  unsigned long long value = 0;
+  if (!safeStrtoull(preamble.substr(start + 1, end - start - 1), 10, value)) {
+    return false;
+  }
+  serial = value;
+  return true;
+}
+
+AuditEventContextRef AuditEventPublisher::assemble(
+    const AuditEventContextRef& ec) {
+  size_t serial = 0;
+  if (!getAuditSerial(ec->preamble, serial)) {
+    return (ec->type == AUDIT_EOE) ? nullptr : ec;
   }
 
-  // Reset the reply data.
-  int result = 0;
+  auto pending = pending_.find(serial);
+  if (ec->type == AUDIT_SYSCALL) {
+    // A syscall record begins a multi-record event.
+    if (pending_.size() >= kAuditMaxPending) {
+      // The end-of-event was lost, fire the oldest event as it is.
+      auto oldest = pending_.begin();
+      fire(oldest->second);
+      pending_.erase(oldest);
+    }
+
+    auto& event = pending_[serial];
+    event = ec;
+    event->records.push_back({ec->type, ec->fields});
+    return nullptr;
+  }
+
+  if (pending == pending_.end()) {
+    // This record is not part of a pending event.
+    return (ec->type == AUDIT_EOE) ? nullptr : ec;
+  }
+
+  if (ec->type == AUDIT_EOE) {
+    auto event = pending->second;
+    pending_.erase(pending);
+    return event;
+  }
+
+  pending->second->records.push_back({ec->type, std::move(ec->fields)});
+  return nullptr;
+}
+
+void AuditEventPublisher::processReply(const struct audit_reply& reply) {
   bool handle_reply = false;
+  switch (reply.type) {
+  case NLMSG_NOOP:
+  case NLMSG_DONE:
+  case NLMSG_ERROR:
+    // Not handled, request another reply.
+    break;
+  case AUDIT_LIST_RULES:
+    // Build rules cache.
+    handleListRules();
+    break;
+  case AUDIT_GET:
+    // Make a copy of the status reply and store as the most-recent.
+    if (reply.status != nullptr) {
+      memcpy(&status_, reply.status, sizeof(struct audit_status));
+    }
+    break;
+  case AUDIT_FIRST_USER_MSG... AUDIT_LAST_USER_MSG:
+    handle_reply = true;
+    break;
+  case (AUDIT_GET + 1)...(AUDIT_LIST_RULES - 1):
+  case (AUDIT_LIST_RULES + 1)...(AUDIT_FIRST_USER_MSG - 1):
+    // Not interested in handling meta-commands and actions.
+    break;
+  case AUDIT_DAEMON_START... AUDIT_DAEMON_CONFIG: // 1200 - 1203
+  case AUDIT_CONFIG_CHANGE:
+    handleAuditConfigChange(reply);
+    break;
+  case AUDIT_SYSCALL: // 1300
+    // A monitored syscall was issued, most likely part of a multi-record.
+    handle_reply = true;
+    break;
+  case AUDIT_CWD: // 1307
+  case AUDIT_PATH: // 1302
+  case AUDIT_EXECVE: // // 1309 (execve arguments).
+    handle_reply = true;
+  case AUDIT_EOE: // 1320 (multi-record event).
+    // The end-of-event completes an assembled event.
+    handle_reply = handle_reply || FLAGS_audit_assemble_events;
+    break;
+  default:
+    // All other cases, pass to reply.
+    handle_reply = true;
+  }
+
+  // Replies are 'handled' as potential events for several audit types.
+  if (handle_reply) {
+    auto ec = createEventContext();
+    // Build the event context from the reply type and parse the message.
+    if (!handleAuditReply(reply, ec)) {
+      return;
+    }
+
+    if (FLAGS_audit_assemble_events) {
+      ec = assemble(ec);
+    }
+    if (ec != nullptr) {
+      fire(ec);
+    }
+  }
+}
+
+void AuditEventPublisher::readReplies() {
+  if (buffer_.empty()) {
+    buffer_.resize(kAuditReadBatch * MAX_AUDIT_MESSAGE_LENGTH);
+  }
+
+  struct mmsghdr messages[kAuditReadBatch];
+  struct iovec vectors[kAuditReadBatch];
+  struct sockaddr_nl addresses[kAuditReadBatch];
   while (true) {
-    handle_reply = false;
-
-    // Request a reply in a non-blocking mode.
-    // This allows the publisher's run loop to periodically request an audit
-    // status update. These updates can check for other processes attempting to
-    // gain control over the audit sink.
-    // This non-blocking also allows faster receipt of multi-message events.
-    result = audit_get_reply(handle_, &reply_, GET_REPLY_NONBLOCKING, 0);
-    if (result > 0) {
-      switch (reply_.type) {
-      case NLMSG_NOOP:
-      case NLMSG_DONE:
-      case NLMSG_ERROR:
-        // Not handled, request another reply.
-        break;
-      case AUDIT_LIST_RULES:
-        // Build rules cache.
-        handleListRules();
-        break;
-      case AUDIT_GET:
-        // Make a copy of the status reply and store as the most-recent.
-        if (reply_.status != nullptr) {
-          memcpy(&status_, reply_.status, sizeof(struct audit_status));
+    memset(messages, 0, sizeof(messages));
+    for (size_t i = 0; i < kAuditReadBatch; ++i) {
+      vectors[i].iov_base = &buffer_[i * MAX_AUDIT_MESSAGE_LENGTH];
+      vectors[i].iov_len = MAX_AUDIT_MESSAGE_LENGTH;
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_name = &addresses[i];
+      messages[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_nl);
+    }
+
+    // Read every queued message, without blocking, several at a time.
+    int count = recvmmsg(handle_, messages, kAuditReadBatch, MSG_DONTWAIT,
+                         nullptr);
+    if (count <= 0) {
+      break;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      // Only accept messages sent from the kernel.
+      size_t length = messages[i].msg_len;
+      if (addresses[i].nl_pid != 0 || length < NLMSG_HDRLEN) {
+        continue;
+      }
+
+      // The kernel audit message length does not reliably include the
+      // header, use the size of the datagram.
+      auto nlh = reinterpret_cast<struct nlmsghdr*>(vectors[i].iov_base);
+      reply_.nlh = nlh;
+      reply_.type = nlh->nlmsg_type;
+      reply_.len = static_cast<int>(length - NLMSG_HDRLEN);
+      if (reply_.type == AUDIT_GET) {
+        reply_.status = static_cast<struct audit_status*>(NLMSG_DATA(nlh));
+      } else {
+        reply_.message = static_cast<const char*>(NLMSG_DATA(nlh));
+        while (reply_.len > 0 && reply_.message[reply_.len - 1] == '\0') {
+          reply_.len--;
         }
-        break;
-      case AUDIT_FIRST_USER_MSG... AUDIT_LAST_USER_MSG:
-        handle_reply = true;
-        break;
-      case (AUDIT_GET + 1)...(AUDIT_LIST_RULES - 1):
-      case (AUDIT_LIST_RULES + 1)...(AUDIT_FIRST_USER_MSG - 1):
-        // Not interested in handling meta-commands and actions.
-        break;
-      case AUDIT_DAEMON_START... AUDIT_DAEMON_CONFIG: // 1200 - 1203
-      case AUDIT_CONFIG_CHANGE:
-        handleAuditConfigChange(reply_);
-        break;
-      case AUDIT_SYSCALL: // 1300
-        // A monitored syscall was issued, most likely part of a multi-record.
-        handle_reply = true;
-        break;
-      case AUDIT_CWD: // 1307
-      case AUDIT_PATH: // 1302
-      case AUDIT_EXECVE: // // 1309 (execve arguments).
-        handle_reply = true;
-      case AUDIT_EOE: // 1320 (multi-record event).
-        break;
-      default:
-        // All other cases, pass to reply.
-        handle_reply = true;
       }
-    } else {
-      // Fall through to the run loop cool down.
+      processReply(reply_);
+    }
+
+    if (static_cast<size_t>(count) < kAuditReadBatch) {
+      // The socket was drained.
       break;
     }
+  }
+}
+
+Status AuditEventPublisher::run() {
+  auto now = getUnixTime();
+  if (!FLAGS_disable_audit &&
+      (status_time_ == 0 || now >= status_time_ + kAuditStatusInterval)) {
+    // Request an update to the audit status.
+    // This will also fill in the status on first run.
+    audit_request_status(handle_);
+    status_time_ = now;
+  }
+
+  // Block until replies are queued, the reads below will not block.
+  struct pollfd pfd = {handle_, POLLIN, 0};
+  if (::poll(&pfd, 1, kAuditMLatency) == -1 && errno != EINTR) {
+    LOG(WARNING) << "Could not read audit handle";
+    return Status(1, "Audit handle failed");
+  }
 
-    // Replies are 'handled' as potential events for several audit types.
-    if (handle_reply) {
-      auto ec = createEventContext();
-      // Build the event context from the reply type and parse the message.
-      if (handleAuditReply(reply_, ec)) {
-        fire(ec);
+  if (FLAGS_audit_assemble_events) {
+    readReplies();
+  } else {
+    while (true) {
+      // Request a reply in a non-blocking mode.
+      // This allows the publisher's run loop to periodically request an audit
+      // status update. These updates can check for other processes attempting
+      // to gain control over the audit sink.
+      // This non-blocking also allows faster receipt of multi-message events.
+      auto result = audit_get_reply(handle_, &reply_, GET_REPLY_NONBLOCKING, 0);
+      if (result <= 0) {
+        // The queue was drained, wait for readiness in the next step.
+        break;
       }
+      processReply(reply_);
     }
   }
 
@@ -337,14 +624,73 @@ Status AuditEventPublisher::run() {
       control_ = true;
     }
   }
-
-  // Only apply a cool down if the reply request failed.
-  pauseMilli(kAuditMLatency);
   return Status(0, "OK");
 }
 
+/// Compare a record's field value with a rule field's value.
+static bool matchRuleField(const AuditRuleField& field,
+                           const std::string& record) {
+  auto value = record;
+  if (field.field == "success") {
+    // The kernel compares success as 1 or 0, records contain yes or no.
+    value = (record == "yes") ? "1" : (record == "no") ? "0" : record;
+  } else if (value.size() > 1 && value.front() == '"' && value.back() == '"') {
+    value = value.substr(1, value.size() - 2);
+  }
+
+  long long left = 0, right = 0;
+  bool numeric = safeStrtoll(value, 10, left) &&
+                 safeStrtoll(field.value, 10, right);
+  if (field.op == "=") {
+    return (numeric) ? left == right : value == field.value;
+  } else if (field.op == "!=") {
+    return (numeric) ? left != right : value != field.value;
+  } else if (!numeric) {
+    return false;
+  } else if (field.op == "<") {
+    return left < right;
+  } else if (field.op == "<=") {
+    return left <= right;
+  } else if (field.op == ">") {
+    return left > right;
+  }
+  return left >= right;
+}
+
+bool AuditEventPublisher::matchRuleFields(
+    const AuditSubscriptionContextRef& sc, const AuditEventContextRef& ec) {
+  bool matched_syscall = false;
+  for (const auto& rule : sc->rules) {
+    if (rule.syscall != ec->syscall) {
+      continue;
+    }
+
+    matched_syscall = true;
+    bool matched = true;
+    for (const auto& field : rule.fields) {
+      if (ec->fields.count(field.field) == 0 ||
+          !matchRuleField(field, ec->fields.get(field.field))) {
+        matched = false;
+        break;
+      }
+    }
+
+    if (matched) {
+      return true;
+    }
+  }
+
+  // Syscalls without a rule are not filtered.
+  return !matched_syscall;
+}
+
 bool AuditEventPublisher::shouldFire(const AuditSubscriptionContextRef& sc,
                                      const AuditEventContextRef& ec) const {
+  // Syscall records must match the fields of their rule.
+  if (ec->type == AUDIT_SYSCALL && !matchRuleFields(sc, ec)) {
+    return false;
+  }
+
   // User messages allow a catch all configuration.
   if (sc->user_types &&
       (ec->type >= AUDIT_FIRST_USER_MSG && ec->type <= AUDIT_LAST_USER_MSG)) {
@@ -368,4 +714,37 @@ bool AuditEventPublisher::shouldFire(const AuditSubscriptionContextRef& sc,
 
   return false;
 }
+
+bool AuditEventPublisher::subscriptionKeys(
+    const AuditSubscriptionContextRef& sc, DispatchKeys& keys) const {
+  if (sc->user_types) {
+    // The catch all matches a range of user message types.
+    return false;
+  }
+
+  for (const auto& type : sc->types) {
+    if (type != 0) {
+      keys.push_back(static_cast<size_t>(type));
+    }
+  }
+
+  for (const auto& rule : sc->rules) {
+    if (rule.syscall != 0) {
+      keys.push_back(AUDIT_SYSCALL);
+      break;
+    }
+  }
+  return true;
+}
+
+bool AuditEventPublisher::eventKeys(const AuditEventContextRef& ec,
+                                    DispatchKeys& keys) const {
+  if (ec->syscall != 0 && ec->type != AUDIT_SYSCALL) {
+    // Other records with a syscall field may match a rule's syscall.
+    return false;
+  }
+
+  keys.push_back(static_cast<size_t>(ec->type));
+  return true;
+}
 }
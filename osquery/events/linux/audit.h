@@ -12,17 +12,54 @@
 
 #include <map>
 #include <set>
+#include <string>
 #include <vector>
 
 #include <libaudit.h>
 
 #include <osquery/events.h>
+#include <osquery/flags.h>
 
 namespace osquery {
 
 #define AUDIT_TYPE_SYSCALL 1300
 #define AUDIT_TYPE_SOCKADDR 1306
 
+DECLARE_bool(audit_assemble_events);
+
+/**
+ * @brief A field comparison appended to an audit rule, such as uid>=1000.
+ *
+ * The kernel evaluates rule fields before emitting a message, so events that
+ * do not match never cross the netlink socket. The publisher also compares
+ * the fields of syscall records in case the kernel rejected a field.
+ */
+struct AuditRuleField {
+  /// The audit field name, such as uid, auid, exe, or success.
+  std::string field;
+
+  /// The comparison operator: =, !=, <, <=, >, or >=.
+  std::string op;
+
+  /// The compared value.
+  std::string value;
+
+  /// The libaudit field pair representation.
+  std::string str() const {
+    return field + op + value;
+  }
+};
+
+/**
+ * @brief Parse a comma-delimited list of audit rule fields.
+ *
+ * @param filters A list such as "uid>=1000,uid<2000,success=1".
+ * @param fields Output, the parsed comparisons.
+ * @return Failure if a comparison could not be parsed.
+ */
+Status parseAuditRuleFields(const std::string& filters,
+                            std::vector<AuditRuleField>& fields);
+
 /**
  * @brief A simple audit rule description that can be populated via a config.
  *
@@ -38,6 +75,9 @@ struct AuditRule {
   /// The rule may either contain a filter or a syscall number.
   std::string filter;
 
+  /// Optional field comparisons the kernel applies to matching syscalls.
+  std::vector<AuditRuleField> fields;
+
   /// All rules must include an action and set of flags.
   int flags{AUDIT_FILTER_EXIT};
   int action{AUDIT_ALWAYS};
@@ -53,7 +93,8 @@ struct AuditRule {
 
 /// Internal rule storage for transient rule additions/removals.
 struct AuditRuleInternal {
-  struct audit_rule_data rule;
+  /// Rule data is allocated, libaudit reallocates it when adding strings.
+  struct audit_rule_data* rule{nullptr};
   int flags{0};
   int action{0};
 };
@@ -101,6 +142,93 @@ struct AuditSubscriptionContext : public SubscriptionContext {
   friend class AuditEventPublisher;
 };
 
+/**
+ * @brief The key and value fields of an audit message.
+ *
+ * The message body is copied once and tokenized in a single pass. Each field
+ * is a pair of offset ranges into the stored message, so tokenizing does not
+ * allocate per field and a value is only copied when it is read. Fields are
+ * kept in message order, if a key repeats its last value is used.
+ */
+class AuditFields {
+ public:
+  /// Store and tokenize an audit message body, following the preamble.
+  void parse(const char* message, size_t size);
+
+  /// Set or replace the value of a field.
+  void set(const std::string& key, const std::string& value);
+
+  /// The number of tokenized fields.
+  size_t size() const {
+    return views_.size();
+  }
+
+  /// Check if there are no fields.
+  bool empty() const {
+    return views_.empty();
+  }
+
+  /// Remove every field, keeping the capacity of the stored message.
+  void clear() {
+    message_.clear();
+    views_.clear();
+  }
+
+  /// 1 if the message includes the key, otherwise 0.
+  size_t count(const std::string& key) const {
+    return (find(key) != nullptr) ? 1 : 0;
+  }
+
+  /// Copy the value of a field, the missing value if the key is not included.
+  std::string get(const std::string& key, const char* missing = "") const;
+
+  /// Compare the value of a field without copying it.
+  bool equals(const std::string& key, const std::string& value) const;
+
+  /// Copy the key of the field at an index, in message order.
+  std::string key(size_t index) const {
+    const auto& view = views_[index];
+    return message_.substr(view.key, view.key_size);
+  }
+
+  /// Copy the value of the field at an index, in message order.
+  std::string value(size_t index) const {
+    const auto& view = views_[index];
+    return message_.substr(view.value, view.value_size);
+  }
+
+ private:
+  /// The offsets and sizes of a field's key and value within the message.
+  struct View {
+    uint32_t key{0};
+    uint32_t key_size{0};
+    uint32_t value{0};
+    uint32_t value_size{0};
+  };
+
+  /// Find the last field with a key.
+  const View* find(const std::string& key) const;
+
+ private:
+  /// The stored message body, and any values that were set.
+  std::string message_;
+
+  /// The fields in message order.
+  std::vector<View> views_;
+};
+
+/// A single record of a multi-record audit event.
+struct AuditEventRecord {
+  /// The audit reply type of the record.
+  int type{0};
+
+  /// The record's audit message tokenized into fields.
+  AuditFields fields;
+
+  AuditEventRecord(int _type, AuditFields _fields)
+      : type(_type), fields(std::move(_fields)) {}
+};
+
 struct AuditEventContext : public EventContext {
   /// The audit reply type.
   int type{0};
@@ -115,10 +243,29 @@ struct AuditEventContext : public EventContext {
    * If the field contained a space in the value the data will be hex encoded.
    * It is the responsibility of the subscription callback/handler to parse.
    */
-  std::map<std::string, std::string> fields;
+  AuditFields fields;
 
   /// Each message will contain the audit time.
   std::string preamble;
+
+  /**
+   * @brief The records of an assembled multi-record audit event.
+   *
+   * When --audit_assemble_events is set, the records sharing an audit serial
+   * are collected until the end-of-event record and fired as one event. The
+   * type, syscall, and fields are those of the first (SYSCALL) record and
+   * every record, including the first, is included in order.
+   */
+  std::vector<AuditEventRecord> records;
+
+  /// Reset a released context, the publisher pools and reuses contexts.
+  void recycle() {
+    type = 0;
+    syscall = 0;
+    fields.clear();
+    preamble.clear();
+    records.clear();
+  }
 };
 
 using AuditEventContextRef = std::shared_ptr<AuditEventContext>;
@@ -155,9 +302,14 @@ class AuditEventPublisher
   /// Remove audit rules and close the handle.
   void tearDown() override;
 
-  /// Poll for replies to the netlink handle in a non-blocking mode.
+  /// Wait for replies to the netlink handle, then read them without blocking.
   Status run() override;
 
+  /// The run loop waits for the netlink handle.
+  bool waitsForReadiness() const override {
+    return true;
+  }
+
  public:
   AuditEventPublisher() : EventPublisher(){};
 
@@ -165,10 +317,36 @@ class AuditEventPublisher
   /// Maintain a list of audit rule data for displaying or deleting.
   void handleListRules();
 
+  /// Handle a single netlink reply, firing events for audit messages.
+  void processReply(const struct audit_reply& reply);
+
+  /// Read batches of netlink replies using recvmmsg.
+  void readReplies();
+
+  /**
+   * @brief Add a parsed record to a pending multi-record event.
+   *
+   * @return The event to fire, either a completed assembled event, the input
+   * for records that are not part of a multi-record event, or nullptr.
+   */
+  AuditEventContextRef assemble(const AuditEventContextRef& ec);
+
+  /// Check a syscall record against the fields of its subscription's rules.
+  static bool matchRuleFields(const AuditSubscriptionContextRef& sc,
+                              const AuditEventContextRef& ec);
+
   /// Apply normal subscription to event matching logic.
   bool shouldFire(const AuditSubscriptionContextRef& mc,
                   const AuditEventContextRef& ec) const override;
 
+  /// Dispatch records by type, syscall rules subscribe to syscall records.
+  bool subscriptionKeys(const AuditSubscriptionContextRef& sc,
+                        DispatchKeys& keys) const override;
+
+  /// The record type is the dispatch key.
+  bool eventKeys(const AuditEventContextRef& ec,
+                 DispatchKeys& keys) const override;
+
  private:
   /// Audit subsystem (netlink) socket descriptor.
   int handle_{0};
@@ -185,13 +363,13 @@ class AuditEventPublisher
   struct audit_status status_;
 
   /**
-   * @brief A counter of non-blocking netlink reads that contained no data.
+   * @brief The time of the last audit status request.
    *
-   * After several iterations of no data, the audit run loop will request a
-   * status. It is possible another user land daemon requested control of the
-   * audit subsystem. The kernel thread will only emit to a single handle.
+   * The audit run loop will periodically request a status. It is possible
+   * another user land daemon requested control of the audit subsystem. The
+   * kernel thread will only emit to a single handle.
    */
-  size_t count_{0};
+  size_t status_time_{0};
 
   /// Is this process in control of the audit subsystem.
   bool control_{false};
@@ -201,5 +379,16 @@ class AuditEventPublisher
 
   /// Track all rule data added by the publisher.
   std::vector<struct AuditRuleInternal> transient_rules_;
+
+  /// Multi-record events awaiting the end-of-event record, by audit serial.
+  std::map<size_t, AuditEventContextRef> pending_;
+
+  /// The recvmmsg buffer, allocated on the first batched read.
+  std::vector<char> buffer_;
+
+ private:
+  FRIEND_TEST(AuditTests, test_assemble_events);
+  FRIEND_TEST(AuditTests, test_rule_fields);
+  friend class BenchmarkAuditPublisher;
 };
 }
@@ -0,0 +1,393 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/inotify.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/config.h>
+#include <osquery/database.h>
+#include <osquery/events.h>
+#include <osquery/filesystem.h>
+#include <osquery/registry.h>
+#include <osquery/sql.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/events/linux/audit.h"
+#include "osquery/events/linux/inotify.h"
+#include "osquery/tests/test_util.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+DECLARE_bool(disable_database);
+
+/// Replayed events between queries for an event's row.
+const size_t kReplayProbeInterval = 1000;
+
+/// Give up on a probed event after 10 seconds.
+const std::chrono::milliseconds kReplayProbeTimeout(10000);
+
+/// A recorded audit message, replayed as a netlink reply.
+struct AuditTraceRecord {
+  int type{0};
+  std::string message;
+
+  /// The offset and length of a syscall record's pid value.
+  size_t pid{std::string::npos};
+  size_t pid_size{0};
+};
+
+/// An audit publisher that reads replies from a trace instead of netlink.
+class BenchmarkAuditPublisher : public AuditEventPublisher {
+ public:
+  Status setUp() override { return Status(0, "OK"); }
+  void configure() override {}
+  void tearDown() override {}
+
+  /// Replay one record, using the marker as the pid of syscall records.
+  void replay(const AuditTraceRecord& record, const std::string& marker) {
+    auto message = record.message;
+    if (record.pid != std::string::npos) {
+      message.replace(record.pid, record.pid_size, marker);
+    }
+
+    struct audit_reply reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.type = record.type;
+    reply.len = static_cast<int>(message.size());
+    reply.message = message.c_str();
+    processReply(reply);
+  }
+};
+
+/// An inotify publisher that fires events from a trace.
+class BenchmarkINotifyPublisher : public INotifyEventPublisher {
+ public:
+  /// Replay one action, the marker is appended to the path.
+  void replay(uint32_t mask,
+              const std::string& path,
+              const std::string& marker) {
+    auto ec = createEventContext();
+    ec->event = std::make_shared<struct inotify_event>();
+    ec->event->mask = mask;
+    ec->path = path + "." + marker;
+    for (const auto& action : kMaskActions) {
+      if (mask & action.first) {
+        ec->action = action.second;
+        break;
+      }
+    }
+    fire(ec);
+  }
+};
+
+/**
+ * @brief Parse an audit.log-formatted trace into events.
+ *
+ * Each event is the records from a SYSCALL record up to the next. Traces
+ * should include the EOE records, which auditd does not write, so events are
+ * complete when --audit_assemble_events is used.
+ */
+static std::vector<std::vector<AuditTraceRecord>> getAuditTrace() {
+  std::string content;
+  readFile(kTestDataPath + "test_audit_trace.log", content);
+
+  std::vector<std::vector<AuditTraceRecord>> trace;
+  for (const auto& line : osquery::split(content, "\n")) {
+    auto message = line.find(" msg=");
+    if (line.compare(0, 5, "type=") != 0 || message == std::string::npos) {
+      continue;
+    }
+
+    AuditTraceRecord record;
+    record.type = audit_name_to_msg_type(line.substr(5, message - 5).c_str());
+    record.message = line.substr(message + 5);
+    if (record.type == AUDIT_SYSCALL) {
+      trace.push_back({});
+      auto pid = record.message.find(" pid=");
+      if (pid != std::string::npos) {
+        record.pid = pid + 5;
+        record.pid_size = record.message.find(' ', record.pid) - record.pid;
+      }
+    }
+    // split removes the trailing space of an empty message.
+    if (record.message.back() == ':') {
+      record.message += ' ';
+    }
+    if (record.type > 0 && !trace.empty()) {
+      trace.back().push_back(std::move(record));
+    }
+  }
+  return trace;
+}
+
+/// Parse an inotify trace of action and relative path lines.
+static std::vector<std::pair<uint32_t, std::string>> getINotifyTrace() {
+  static const std::map<std::string, uint32_t> kMasks = {
+      {"IN_ACCESS", IN_ACCESS},
+      {"IN_ATTRIB", IN_ATTRIB},
+      {"IN_CLOSE_WRITE", IN_CLOSE_WRITE},
+      {"IN_CREATE", IN_CREATE},
+      {"IN_DELETE", IN_DELETE},
+      {"IN_MODIFY", IN_MODIFY},
+      {"IN_MOVED_FROM", IN_MOVED_FROM},
+      {"IN_MOVED_TO", IN_MOVED_TO},
+      {"IN_OPEN", IN_OPEN},
+  };
+
+  std::string content;
+  readFile(kTestDataPath + "test_inotify_trace.txt", content);
+
+  std::vector<std::pair<uint32_t, std::string>> trace;
+  for (const auto& line : osquery::split(content, "\n")) {
+    auto action = osquery::split(line, " ");
+    if (action.size() == 2 && kMasks.count(action[0]) > 0) {
+      trace.push_back(std::make_pair(kMasks.at(action[0]), action[1]));
+    }
+  }
+  return trace;
+}
+
+/// Markers are unique across runs using the same database.
+static size_t getReplayMarker() {
+  static size_t marker = getUnixTime() * 1000000;
+  return marker++;
+}
+
+/// Query the event's row until it is returned, the latency in microseconds.
+static bool probeEvent(const std::string& query,
+                       std::chrono::steady_clock::time_point fired,
+                       size_t& latency) {
+  while (std::chrono::steady_clock::now() - fired < kReplayProbeTimeout) {
+    SQL sql(query);
+    if (!sql.rows().empty()) {
+      latency = static_cast<size_t>(
+          std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - fired)
+              .count());
+      return true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+/// Replace the registered publisher of the same type.
+template <class PUB>
+static std::shared_ptr<PUB> getReplayPublisher() {
+  auto pub = std::make_shared<PUB>();
+  auto types = EventFactory::publisherTypes();
+  if (std::find(types.begin(), types.end(), pub->type()) != types.end()) {
+    EventFactory::deregisterEventPublisher(pub->type());
+  }
+  EventFactory::registerEventPublisher(pub);
+  return pub;
+}
+
+/// Register a table's subscriber, the callbacks of the replayed events.
+static EventSubscriberRef getReplaySubscriber(const std::string& name) {
+  if (!EventFactory::exists(name)) {
+    auto plugin = Registry::get("event_subscriber", name);
+    EventFactory::registerEventSubscriber(plugin);
+  }
+  return EventFactory::getEventSubscriber(name);
+}
+
+/**
+ * @brief Replay a trace at a target rate of events per second.
+ *
+ * Each iteration fires one recorded event into the subscriber's callbacks,
+ * which add rows to RocksDB. Every kReplayProbeInterval events, and after the
+ * last event, the timer is paused while the table is queried for the
+ * event's marker until its row is returned.
+ *
+ * The label reports the sustained rate of events added by the subscriber,
+ * including the final probe, the percent of fired records dropped by a
+ * --events_dispatch_queue_size queue, and the latency from firing an event
+ * to its row being queryable.
+ *
+ * @param fire replay an event given its index and marker, returning the
+ * number of records fired.
+ * @param query the query for the row of an event's index and marker.
+ */
+static void replayEvents(
+    benchmark::State& state,
+    const EventSubscriberRef& sub,
+    const std::function<size_t(size_t, const std::string&)>& fire,
+    const std::function<std::string(size_t, const std::string&)>& query) {
+  auto rate = static_cast<size_t>(state.range_x());
+  auto events = sub->numEvents();
+  auto dropped = sub->numDropped();
+
+  size_t fired = 0;
+  size_t records = 0;
+  size_t lost = 0;
+  std::string marker;
+  std::vector<size_t> latencies;
+  auto start = std::chrono::steady_clock::now();
+  auto probe = [&](std::chrono::steady_clock::time_point fired_at) {
+    size_t latency = 0;
+    if (probeEvent(query(fired - 1, marker), fired_at, latency)) {
+      latencies.push_back(latency);
+    } else {
+      lost++;
+    }
+  };
+
+  while (state.KeepRunning()) {
+    if (rate > 0) {
+      std::this_thread::sleep_until(start +
+                                    std::chrono::microseconds(
+                                        fired * 1000000 / rate));
+    }
+
+    marker = std::to_string(getReplayMarker());
+    records += fire(fired++, marker);
+    if (fired % kReplayProbeInterval == 0) {
+      state.PauseTiming();
+      auto paused = std::chrono::steady_clock::now();
+      probe(paused);
+      // The paused time is not part of the replay schedule.
+      start += std::chrono::steady_clock::now() - paused;
+      state.ResumeTiming();
+    }
+  }
+
+  // The final probe includes the time to drain queued and batched events.
+  if (fired > 0) {
+    probe(std::chrono::steady_clock::now());
+  }
+  auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                     std::chrono::steady_clock::now() - start)
+                     .count();
+
+  events = sub->numEvents() - events;
+  dropped = sub->numDropped() - dropped;
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](size_t p) {
+    return (latencies.empty())
+               ? 0
+               : latencies[std::min(latencies.size() - 1,
+                                    latencies.size() * p / 100)];
+  };
+
+  state.SetItemsProcessed(fired);
+  auto label =
+      "events/s: " +
+      std::to_string((elapsed > 0) ? events * 1000000 / elapsed : 0) +
+      "  dropped: " +
+      std::to_string((records > 0) ? dropped * 100.0 / records : 0.0) + "%" +
+      "  latency_p50_us: " + std::to_string(percentile(50)) +
+      "  latency_p99_us: " + std::to_string(percentile(99)) +
+      "  lost: " + std::to_string(lost);
+  state.SetLabel(label);
+}
+
+/// Use RocksDB, as the daemon does, for the replayed events.
+static void setUpReplay() {
+  FLAGS_disable_database = false;
+  DatabasePlugin::initPlugin();
+  Config::getInstance().getParser("events")->setUp();
+}
+
+static void tearDownReplay() {
+  FLAGS_disable_database = true;
+  DatabasePlugin::initPlugin();
+}
+
+static void EVENTS_replay_audit_trace(benchmark::State& state) {
+  setUpReplay();
+  static auto pub = getReplayPublisher<BenchmarkAuditPublisher>();
+
+  auto trace = getAuditTrace();
+  auto sub = getReplaySubscriber("process_events");
+  if (trace.empty() || sub == nullptr) {
+    while (state.KeepRunning()) {
+    }
+    state.SetLabel("missing trace or subscriber");
+    tearDownReplay();
+    return;
+  }
+
+  auto fire = [&trace](size_t index, const std::string& marker) {
+    const auto& event = trace[index % trace.size()];
+    for (const auto& record : event) {
+      pub->replay(record, marker);
+    }
+    return event.size();
+  };
+  auto query = [](size_t index, const std::string& marker) {
+    return "select pid from process_events where time >= " +
+           std::to_string(getUnixTime() - 1) + " and pid = " + marker;
+  };
+  replayEvents(state, sub, fire, query);
+  tearDownReplay();
+}
+
+BENCHMARK(EVENTS_replay_audit_trace)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Arg(0)
+    ->UseRealTime();
+
+static void EVENTS_replay_inotify_trace(benchmark::State& state) {
+  setUpReplay();
+  auto root = kTestWorkingDirectory + "replay/";
+  fs::create_directories(root);
+  Config::getInstance().update(
+      {{"replay", "{\"file_paths\": {\"replay\": [\"" + root + "%%\"]}}"}});
+
+  static auto pub = getReplayPublisher<BenchmarkINotifyPublisher>();
+
+  auto trace = getINotifyTrace();
+  auto sub = getReplaySubscriber("file_events");
+  if (trace.empty() || sub == nullptr) {
+    while (state.KeepRunning()) {
+    }
+    state.SetLabel("missing trace or subscriber");
+    tearDownReplay();
+    return;
+  }
+  // Expand the configured path into the publisher's recursive subscription.
+  pub->configure();
+
+  auto fire = [&trace, &root](size_t index, const std::string& marker) {
+    const auto& action = trace[index % trace.size()];
+    pub->replay(action.first, root + action.second, marker);
+    return size_t{1};
+  };
+  auto query = [&trace, &root](size_t index, const std::string& marker) {
+    const auto& action = trace[index % trace.size()];
+    return "select target_path from file_events where time >= " +
+           std::to_string(getUnixTime() - 1) + " and target_path = '" + root +
+           action.second + "." + marker + "'";
+  };
+  replayEvents(state, sub, fire, query);
+  tearDownReplay();
+}
+
+BENCHMARK(EVENTS_replay_inotify_trace)
+    ->Arg(1000)
+    ->Arg(10000)
+    ->Arg(0)
+    ->UseRealTime();
+}
@@ -0,0 +1,224 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <sys/fanotify.h>
+#include <sys/stat.h>
+
+#include <boost/filesystem.hpp>
+
+#include <osquery/logger.h>
+
+#include "osquery/events/linux/fanotify.h"
+#include "osquery/events/linux/inotify.h"
+
+namespace fs = boost::filesystem;
+
+namespace osquery {
+
+FLAG(bool,
+     enable_fanotify,
+     false,
+     "Monitor file paths with fanotify mount marks instead of inotify watches");
+
+/// The fanotify event bits, each is equal to the inotify bit.
+static const uint64_t kFanotifyMasks =
+    FAN_ACCESS | FAN_MODIFY | FAN_CLOSE_WRITE | FAN_OPEN;
+
+void PathTrie::insert(const std::string& prefix) {
+  auto node = &root_;
+  for (const auto& c : prefix) {
+    auto& child = node->children[c];
+    if (child == nullptr) {
+      child.reset(new Node());
+    }
+    node = child.get();
+  }
+  node->terminal = true;
+}
+
+bool PathTrie::matches(const std::string& path) const {
+  auto node = &root_;
+  for (const auto& c : path) {
+    if (node->terminal) {
+      return true;
+    }
+
+    auto child = node->children.find(c);
+    if (child == node->children.end()) {
+      return false;
+    }
+    node = child->second.get();
+  }
+  return node->terminal;
+}
+
+void PathTrie::clear() {
+  root_.children.clear();
+  root_.terminal = false;
+}
+
+std::string getPatternPrefix(const std::string& pattern) {
+  return pattern.substr(0, pattern.find('*'));
+}
+
+bool getDescriptorPath(int fd, std::string& path) {
+  char buffer[PATH_MAX] = {0};
+  auto link = "/proc/self/fd/" + std::to_string(fd);
+  auto size = ::readlink(link.c_str(), buffer, sizeof(buffer) - 1);
+  if (size <= 0) {
+    return false;
+  }
+
+  path.assign(buffer, size);
+  return true;
+}
+
+void INotifyEventPublisher::setUpFanotify() {
+  if (!FLAGS_enable_fanotify) {
+    return;
+  }
+
+  fanotify_handle_ =
+      ::fanotify_init(FAN_CLOEXEC | FAN_NONBLOCK | FAN_CLASS_NOTIF,
+                      O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  if (fanotify_handle_ == -1) {
+    // This requires CAP_SYS_ADMIN.
+    LOG(WARNING) << "Could not start fanotify, using inotify watches";
+  }
+}
+
+void INotifyEventPublisher::configureFanotify() {
+  uint64_t mask = FAN_MODIFY | FAN_CLOSE_WRITE;
+  std::vector<std::string> prefixes;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->discovered_.empty()) {
+      normalizeSubscription(sc);
+    }
+
+    if (sc->mask & kFileAccessMasks) {
+      mask |= FAN_ACCESS | FAN_OPEN;
+    }
+    prefixes.push_back(getPatternPrefix(sc->path));
+  }
+
+  {
+    // Subscriptions may have been removed, rebuild the prefixes.
+    WriteLock lock(path_mutex_);
+    fanotify_paths_.clear();
+    for (const auto& prefix : prefixes) {
+      fanotify_paths_.insert(prefix);
+    }
+  }
+
+  for (const auto& prefix : prefixes) {
+    // Find the closest existing path, its mount contains the prefix.
+    boost::system::error_code ec;
+    auto path = fs::path(prefix);
+    while (!fs::exists(path, ec) && path.has_parent_path()) {
+      path = path.parent_path();
+    }
+
+    struct stat file_stat;
+    if (::stat(path.string().c_str(), &file_stat) != 0) {
+      continue;
+    }
+
+    auto& marked = fanotify_marks_[file_stat.st_dev];
+    if ((marked & mask) == mask) {
+      // The mount is already marked for every requested event.
+      continue;
+    }
+
+    VLOG(1) << "Adding fanotify mount mark for: " << path.string();
+    if (::fanotify_mark(fanotify_handle_,
+                        FAN_MARK_ADD | FAN_MARK_MOUNT,
+                        mask,
+                        AT_FDCWD,
+                        path.string().c_str()) == -1) {
+      LOG(WARNING) << "Could not add fanotify mark on: " << path.string();
+      continue;
+    }
+    marked |= mask;
+  }
+}
+
+Status INotifyEventPublisher::readFanotifyEvents(bool& overflow) {
+  if (buffer_.empty()) {
+    buffer_.resize(4096 * sizeof(struct fanotify_event_metadata));
+  }
+
+  // Events caused by osquery itself, such as hashing, are not reported.
+  auto self = ::getpid();
+  while (!isEnding()) {
+    ssize_t length = ::read(fanotify_handle_, buffer_.data(), buffer_.size());
+    if (length == -1 && (errno == EAGAIN || errno == EINTR)) {
+      break;
+    } else if (length <= 0) {
+      return Status(1, "fanotify read failed");
+    }
+
+    auto now = getMilliTime();
+    auto metadata =
+        reinterpret_cast<struct fanotify_event_metadata*>(buffer_.data());
+    for (; FAN_EVENT_OK(metadata, length);
+         metadata = FAN_EVENT_NEXT(metadata, length)) {
+      if (metadata->vers != FANOTIFY_METADATA_VERSION) {
+        return Status(1, "fanotify metadata version mismatch");
+      }
+
+      if (metadata->mask & FAN_Q_OVERFLOW) {
+        overflow = true;
+        continue;
+      } else if (metadata->fd < 0) {
+        continue;
+      }
+
+      // Each event includes an open descriptor for the file.
+      std::string path;
+      bool resolved = getDescriptorPath(metadata->fd, path);
+      ::close(metadata->fd);
+      if (!resolved || metadata->pid == self) {
+        continue;
+      }
+
+      {
+        WriteLock lock(path_mutex_);
+        if (!fanotify_paths_.matches(path)) {
+          continue;
+        }
+      }
+
+      auto ec = createEventContext();
+      ec->event = std::make_shared<struct inotify_event>();
+      ec->event->mask = static_cast<uint32_t>(metadata->mask & kFanotifyMasks);
+      ec->path = std::move(path);
+      ec->pid = metadata->pid;
+      for (const auto& action : kMaskActions) {
+        if (ec->event->mask & action.first) {
+          ec->action = action.second;
+          break;
+        }
+      }
+
+      if (!ec->action.empty()) {
+        matchSubscriptions(ec);
+        coalesceEvent(ec, now);
+      }
+    }
+
+    // Storms may continuously fill the queue, do not hold events forever.
+    flushEvents(now);
+  }
+  return Status(0, "OK");
+}
+}
@@ -0,0 +1,70 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_bool(enable_fanotify);
+
+/**
+ * @brief A character trie of monitored path prefixes.
+ *
+ * fanotify mount marks report every file on a filesystem. The trie discards
+ * events for paths outside of the configured file paths in time linear to
+ * the path length, independent of the number of configured paths.
+ */
+class PathTrie {
+ public:
+  /// Add a monitored path prefix.
+  void insert(const std::string& prefix);
+
+  /// Check if a path begins with any monitored prefix.
+  bool matches(const std::string& path) const;
+
+  /// Remove all prefixes.
+  void clear();
+
+  /// Check if no prefixes were added.
+  bool empty() const {
+    return root_.children.empty() && !root_.terminal;
+  }
+
+ private:
+  struct Node {
+    /// The children, by the next character of the prefix.
+    std::map<char, std::unique_ptr<Node>> children;
+
+    /// Set if a prefix ends at this node.
+    bool terminal{false};
+  };
+
+  /// The empty prefix.
+  Node root_;
+};
+
+/**
+ * @brief Return the literal prefix of a path pattern.
+ *
+ * The prefix ends before the first wildcard, a pattern for every user's
+ * .ssh directory monitors "/home/". Subscriptions apply the complete pattern
+ * to fired events.
+ */
+std::string getPatternPrefix(const std::string& pattern);
+
+/// Resolve the path of a descriptor reported by fanotify.
+bool getDescriptorPath(int fd, std::string& path);
+}
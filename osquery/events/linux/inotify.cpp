@@ -8,10 +8,12 @@
  *
  */
 
+#include <chrono>
 #include <sstream>
 
 #include <fnmatch.h>
 #include <linux/limits.h>
+#include <sys/epoll.h>
 
 #include <boost/filesystem.hpp>
 
@@ -25,9 +27,21 @@ namespace fs = boost::filesystem;
 
 namespace osquery {
 
-static const int kINotifyMLatency = 200;
+/// The max time to wait for events before checking for an interrupt.
+static const int kINotifyMLatency = 1000;
+
+/// The read buffer fits at least 256 events with names.
 static const uint32_t kINotifyBufferSize =
-    (10 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
+    (256 * ((sizeof(struct inotify_event)) + NAME_MAX + 1));
+
+/// Repeated modifications of a path within this window fire once.
+static const size_t kINotifyCoalesceMilli = 100;
+
+size_t INotifyEventPublisher::getMilliTime() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
 
 std::map<int, std::string> kMaskActions = {
     {IN_ACCESS, "ACCESSED"},
@@ -49,16 +63,32 @@ const uint32_t kFileAccessMasks = IN_OPEN | IN_ACCESS;
 REGISTER(INotifyEventPublisher, "event_publisher", "inotify");
 
 Status INotifyEventPublisher::setUp() {
-  inotify_handle_ = ::inotify_init();
+  inotify_handle_ = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
   // If this does not work throw an exception.
   if (inotify_handle_ == -1) {
     return Status(1, "Could not start inotify: inotify_init failed");
   }
+
+  epoll_handle_ = ::epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_handle_ == -1) {
+    return Status(1, "Could not start inotify: epoll_create failed");
+  }
+
+  setUpFanotify();
+  int handle = (fanotify_handle_ != -1) ? fanotify_handle_ : getHandle();
+
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.fd = handle;
+  if (::epoll_ctl(epoll_handle_, EPOLL_CTL_ADD, handle, &event) == -1) {
+    return Status(1, "Could not start inotify: epoll_ctl failed");
+  }
   return Status(0, "OK");
 }
 
-bool INotifyEventPublisher::monitorSubscription(
-    INotifySubscriptionContextRef& sc, bool add_watch) {
+void INotifyEventPublisher::normalizeSubscription(
+    INotifySubscriptionContextRef& sc) {
   sc->discovered_ = sc->path;
   if (sc->path.find("**") != std::string::npos) {
     sc->recursive = true;
@@ -75,15 +105,8 @@ bool INotifyEventPublisher::monitorSubscription(
     }
 
     if (sc->discovered_.find('*') != std::string::npos) {
-      // If a wildcard exists within the tree (stem), resolve at configure
-      // time and monitor each path.
-      std::vector<std::string> paths;
-      resolveFilePattern(sc->discovered_, paths);
-      for (const auto& _path : paths) {
-        addMonitor(_path, sc->mask, sc->recursive, add_watch);
-      }
       sc->recursive_match = sc->recursive;
-      return true;
+      return;
     }
   }
 
@@ -91,25 +114,90 @@ bool INotifyEventPublisher::monitorSubscription(
     sc->path += '/';
     sc->discovered_ += '/';
   }
-  return addMonitor(sc->discovered_, sc->mask, sc->recursive, add_watch);
+}
+
+bool INotifyEventPublisher::monitorSubscription(
+    INotifySubscriptionContextRef& sc, bool add_watch) {
+  normalizeSubscription(sc);
+  if (sc->discovered_.find('*') != std::string::npos) {
+    // If a wildcard exists within the tree (stem), resolve at configure
+    // time and monitor each path.
+    std::vector<std::string> paths;
+    resolveFilePattern(sc->discovered_, paths);
+    for (const auto& _path : paths) {
+      addMonitor(_path, sc->mask, sc->recursive, add_watch, sc.get());
+    }
+    return true;
+  }
+  return addMonitor(
+      sc->discovered_, sc->mask, sc->recursive, add_watch, sc.get());
 }
 
 void INotifyEventPublisher::configure() {
+  if (fanotify_handle_ != -1) {
+    // Mount marks replace the per-directory watches.
+    configureFanotify();
+    indexSubscriptions();
+    return;
+  }
+
   for (auto& sub : subscriptions_) {
-    // Anytime a configure is called, try to monitor all subscriptions.
-    // Configure is called as a response to removing/adding subscriptions.
-    // This means recalculating all monitored paths.
+    // Anytime a configure is called, monitor the new subscriptions.
+    // Subscriptions that still have a watch keep it, their patterns are not
+    // resolved again. A subscription whose watches were all removed, such as
+    // a deleted file or after an overflow, is monitored again.
     auto sc = getSubscriptionContext(sub->context);
-    if (sc->discovered_.size() > 0) {
+    if (sc->discovered_.size() > 0 && isSubscriptionMonitored(sc)) {
       continue;
     }
     monitorSubscription(sc);
   }
+  indexSubscriptions();
+}
+
+bool INotifyEventPublisher::isSubscriptionMonitored(
+    const INotifySubscriptionContextRef& sc) const {
+  WriteLock lock(path_mutex_);
+  for (const auto& watch : sc->watches_) {
+    if (path_descriptors_.count(watch) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void INotifyEventPublisher::indexSubscriptions() {
+  WriteLock lock(path_mutex_);
+  index_.clear();
+  for (auto& sub : subscriptions_) {
+    // Subscription paths were normalized when monitored.
+    auto sc = getSubscriptionContext(sub->context);
+    index_.insert(sc->path, sc.get());
+    sc->indexed_ = true;
+  }
+}
+
+void INotifyEventPublisher::matchSubscriptions(
+    const INotifyEventContextRef& ec) const {
+  WriteLock lock(path_mutex_);
+  index_.match(ec->path, ec->candidates);
+  ec->indexed = true;
 }
 
 void INotifyEventPublisher::tearDown() {
+  if (epoll_handle_ != -1) {
+    ::close(epoll_handle_);
+    epoll_handle_ = -1;
+  }
+  if (fanotify_handle_ != -1) {
+    // Closing the descriptor removes every mark.
+    ::close(fanotify_handle_);
+    fanotify_handle_ = -1;
+    fanotify_marks_.clear();
+  }
   ::close(inotify_handle_);
   inotify_handle_ = -1;
+  modified_.clear();
 }
 
 Status INotifyEventPublisher::restartMonitoring() {
@@ -139,63 +227,129 @@ Status INotifyEventPublisher::restartMonitoring() {
 }
 
 Status INotifyEventPublisher::run() {
-  // Get a while wrapper for free.
-  char buffer[kINotifyBufferSize];
-  fd_set set;
-
-  FD_ZERO(&set);
-  FD_SET(getHandle(), &set);
+  // Wait for events, or until the oldest held modification should fire.
+  int timeout = kINotifyMLatency;
+  if (!modified_.empty()) {
+    timeout = static_cast<int>(kINotifyCoalesceMilli);
+  }
 
-  struct timeval timeout = {1, 0};
-  int selector = ::select(getHandle() + 1, &set, nullptr, nullptr, &timeout);
-  if (selector == -1) {
+  struct epoll_event event;
+  int selector = ::epoll_wait(epoll_handle_, &event, 1, timeout);
+  if (selector == -1 && errno != EINTR) {
     LOG(WARNING) << "Could not read inotify handle";
     return Status(1, "INotify handle failed");
   }
 
-  if (selector == 0) {
-    // Read timeout.
-    return Status(0, "Continue");
+  bool overflow = false;
+  if (selector > 0) {
+    auto status = (fanotify_handle_ != -1) ? readFanotifyEvents(overflow)
+                                           : readEvents(overflow);
+    if (!status.ok()) {
+      return status;
+    }
   }
-  ssize_t record_num = ::read(getHandle(), buffer, kINotifyBufferSize);
-  if (record_num == 0 || record_num == -1) {
-    return Status(1, "INotify read failed");
+  flushEvents(getMilliTime(), overflow);
+
+  if (overflow && fanotify_handle_ != -1) {
+    // Mount marks are not lost when the fanotify queue overflows.
+    LOG(WARNING) << "fanotify queue overflowed, file events were dropped";
+    return Status(0, "OK");
   }
 
-  for (char* p = buffer; p < buffer + record_num;) {
-    // Cast the inotify struct, make shared pointer, and append to contexts.
-    auto event = reinterpret_cast<struct inotify_event*>(p);
-    if (event->mask & IN_Q_OVERFLOW) {
-      // The inotify queue was overflown (remove all paths).
-      Status stat = restartMonitoring();
-      if (!stat.ok()) {
-        return stat;
-      }
+  if (overflow) {
+    // The queue was drained, now the inotify watches can be restarted.
+    return restartMonitoring();
+  }
+  return Status(0, "OK");
+}
+
+Status INotifyEventPublisher::readEvents(bool& overflow) {
+  if (buffer_.empty()) {
+    buffer_.resize(kINotifyBufferSize);
+  }
+
+  // Drain the queue, the handle is non-blocking.
+  while (!isEnding()) {
+    ssize_t record_num = ::read(getHandle(), buffer_.data(), buffer_.size());
+    if (record_num == -1 && (errno == EAGAIN || errno == EINTR)) {
+      break;
+    } else if (record_num == 0 || record_num == -1) {
+      return Status(1, "INotify read failed");
     }
 
-    if (event->mask & IN_IGNORED) {
-      // This inotify watch was removed.
-      removeMonitor(event->wd, false);
-    } else if (event->mask & IN_MOVE_SELF) {
-      // This inotify path was moved, but is still watched.
-      removeMonitor(event->wd, true);
-    } else if (event->mask & IN_DELETE_SELF) {
-      // A file was moved to replace the watched path.
-      removeMonitor(event->wd, false);
-    } else {
-      auto ec = createEventContextFrom(event);
-      if (!ec->action.empty()) {
-        fire(ec);
+    auto now = getMilliTime();
+    auto buffer = buffer_.data();
+    for (char* p = buffer; p < buffer + record_num;) {
+      // Cast the inotify struct, make shared pointer, and append to contexts.
+      auto event = reinterpret_cast<struct inotify_event*>(p);
+      p += (sizeof(struct inotify_event)) + event->len;
+
+      if (event->mask & IN_Q_OVERFLOW) {
+        // The inotify queue was overflown, restart after reading all events.
+        overflow = true;
+      } else if (event->mask & IN_IGNORED) {
+        // This inotify watch was removed.
+        removeMonitor(event->wd, false);
+      } else if (event->mask & IN_MOVE_SELF) {
+        // This inotify path was moved, but is still watched.
+        removeMonitor(event->wd, true);
+      } else if (event->mask & IN_DELETE_SELF) {
+        // A file was moved to replace the watched path.
+        removeMonitor(event->wd, false);
+      } else {
+        {
+          WriteLock lock(path_mutex_);
+          if (descriptor_paths_.count(event->wd) == 0) {
+            // The watch was removed while the event was queued.
+            continue;
+          }
+        }
+
+        auto ec = createEventContextFrom(event);
+        if (!ec->action.empty()) {
+          coalesceEvent(ec, now);
+        }
       }
     }
-    // Continue to iterate
-    p += (sizeof(struct inotify_event)) + event->len;
-  }
 
-  pauseMilli(kINotifyMLatency);
+    // Storms may continuously fill the queue, do not hold events forever.
+    flushEvents(now);
+  }
   return Status(0, "OK");
 }
 
+void INotifyEventPublisher::coalesceEvent(const INotifyEventContextRef& ec,
+                                          size_t now) {
+  auto held = modified_.find(ec->path);
+  if (ec->event->mask == IN_MODIFY) {
+    if (held == modified_.end()) {
+      modified_[ec->path] = std::make_pair(ec, now);
+    }
+    // Otherwise this path's modification is already waiting to fire.
+    return;
+  }
+
+  if (held != modified_.end()) {
+    // Keep the order of events for a path.
+    auto modified = held->second.first;
+    modified_.erase(held);
+    fire(modified);
+  }
+  fire(ec);
+}
+
+void INotifyEventPublisher::flushEvents(size_t now, bool all) {
+  for (auto it = modified_.begin(); it != modified_.end();) {
+    if (all || now - it->second.second >= kINotifyCoalesceMilli) {
+      auto ec = it->second.first;
+      it = modified_.erase(it);
+      fire(ec);
+    } else {
+      ++it;
+    }
+  }
+}
+
 INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
     struct inotify_event* event) const {
   auto shared_event = std::make_shared<struct inotify_event>(*event);
@@ -217,6 +371,7 @@ INotifyEventContextRef INotifyEventPublisher::createEventContextFrom(
       break;
     }
   }
+  matchSubscriptions(ec);
   return ec;
 }
 
@@ -227,6 +382,11 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
     return false;
   }
 
+  if (ec->indexed && sc->indexed_ && ec->candidates.count(sc.get()) == 0) {
+    // The subscription's directories are not along the event path.
+    return false;
+  }
+
   if (sc->recursive && !sc->recursive_match) {
     ssize_t found = ec->path.find(sc->path);
     if (found != 0) {
@@ -245,18 +405,50 @@ bool INotifyEventPublisher::shouldFire(const INotifySubscriptionContextRef& sc,
 
   // inotify will not monitor recursively, new directories need watches.
   if (sc->recursive && ec->action == "CREATED" && isDirectory(ec->path)) {
-    const_cast<INotifyEventPublisher*>(this)
-        ->addMonitor(ec->path + '/', sc->mask, true);
+    const_cast<INotifyEventPublisher*>(this)->addMonitor(
+        ec->path + '/', sc->mask, true, true, sc.get());
+  }
+
+  return true;
+}
+
+/// Add the index of each set bit of a mask.
+static inline void addMaskKeys(uint32_t mask, DispatchKeys& keys) {
+  for (size_t bit = 0; bit < 32; ++bit) {
+    if (mask & (1U << bit)) {
+      keys.push_back(bit);
+    }
+  }
+}
+
+bool INotifyEventPublisher::subscriptionKeys(
+    const INotifySubscriptionContextRef& sc, DispatchKeys& keys) const {
+  if (sc->mask == 0) {
+    return false;
+  }
+
+  addMaskKeys(sc->mask, keys);
+  return true;
+}
+
+bool INotifyEventPublisher::eventKeys(const INotifyEventContextRef& ec,
+                                      DispatchKeys& keys) const {
+  if (ec->event == nullptr) {
+    return false;
   }
 
+  // A subscription mask matches if it shares any bit with the event.
+  addMaskKeys(ec->event->mask, keys);
   return true;
 }
 
 bool INotifyEventPublisher::addMonitor(const std::string& path,
                                        uint32_t mask,
                                        bool recursive,
-                                       bool add_watch) {
-  if (!isPathMonitored(path)) {
+                                       bool add_watch,
+                                       INotifySubscriptionContext* sc) {
+  auto monitored = getMonitoredPath(path);
+  if (monitored.empty()) {
     int watch = ::inotify_add_watch(
         getHandle(), path.c_str(), ((mask == 0) ? kFileDefaultMasks : mask));
     if (add_watch && watch == -1) {
@@ -273,6 +465,13 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
       // Keep a map of the opposite (descriptor -> path)
       descriptor_paths_[watch] = path;
     }
+    monitored = path;
+  }
+
+  if (sc != nullptr) {
+    // The subscription uses this watch, even if another subscription added it.
+    WriteLock lock(path_mutex_);
+    sc->watches_.insert(monitored);
   }
 
   if (recursive && isDirectory(path).ok()) {
@@ -283,7 +482,7 @@ bool INotifyEventPublisher::addMonitor(const std::string& path,
     boost::system::error_code ec;
     for (const auto& child : children) {
       auto canonicalized = fs::canonical(child, ec).string() + '/';
-      addMonitor(canonicalized, mask, false);
+      addMonitor(canonicalized, mask, false, true, sc);
     }
   }
 
@@ -329,20 +528,62 @@ bool INotifyEventPublisher::removeMonitor(int watch, bool force) {
 }
 
 void INotifyEventPublisher::removeSubscriptions(const std::string& subscriber) {
-  auto paths = descriptor_paths_;
-  for (const auto& path : paths) {
-    removeMonitor(path.first, true);
+  std::vector<INotifySubscriptionContextRef> removed;
+  for (const auto& sub : subscriptions_) {
+    if (sub->subscriber_name == subscriber) {
+      removed.push_back(getSubscriptionContext(sub->context));
+    }
   }
   EventPublisherPlugin::removeSubscriptions(subscriber);
+  releaseMonitors(removed);
+
+  // The path index must not refer to the removed subscriptions.
+  indexSubscriptions();
 }
 
-bool INotifyEventPublisher::isPathMonitored(const std::string& path) const {
+void INotifyEventPublisher::removeSubscription(
+    const SubscriptionContextRef& context) {
+  auto sc = getSubscriptionContext(context);
+  EventPublisherPlugin::removeSubscription(context);
+  releaseMonitors({sc});
+  indexSubscriptions();
+}
+
+void INotifyEventPublisher::releaseMonitors(
+    const std::vector<INotifySubscriptionContextRef>& removed) {
+  std::set<std::string> unused;
+  {
+    WriteLock lock(path_mutex_);
+    for (const auto& sc : removed) {
+      unused.insert(sc->watches_.begin(), sc->watches_.end());
+      sc->watches_.clear();
+    }
+
+    // Keep the watches used by the remaining subscriptions.
+    for (const auto& sub : subscriptions_) {
+      if (unused.empty()) {
+        break;
+      }
+      auto sc = getSubscriptionContext(sub->context);
+      for (const auto& watch : sc->watches_) {
+        unused.erase(watch);
+      }
+    }
+  }
+
+  for (const auto& path : unused) {
+    removeMonitor(path, true);
+  }
+}
+
+std::string INotifyEventPublisher::getMonitoredPath(
+    const std::string& path) const {
   WriteLock lock(path_mutex_);
   std::string parent_path;
   if (!isDirectory(path).ok()) {
     if (path_descriptors_.find(path) != path_descriptors_.end()) {
       // Path is a file, and is directly monitored.
-      return true;
+      return path;
     }
     // Important to add a trailing "/" for inotify.
     parent_path = fs::path(path).parent_path().string() + '/';
@@ -351,6 +592,10 @@ bool INotifyEventPublisher::isPathMonitored(const std::string& path) const {
   }
   // Directory or parent of file monitoring
   auto path_iterator = path_descriptors_.find(parent_path);
-  return (path_iterator != path_descriptors_.end());
+  return (path_iterator != path_descriptors_.end()) ? parent_path : "";
+}
+
+bool INotifyEventPublisher::isPathMonitored(const std::string& path) const {
+  return !getMonitoredPath(path).empty();
 }
 }
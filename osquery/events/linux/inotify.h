@@ -11,6 +11,7 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include <vector>
 
 #include <sys/inotify.h>
@@ -18,6 +19,9 @@
 
 #include <osquery/events.h>
 
+#include "osquery/events/linux/fanotify.h"
+#include "osquery/events/path_index.h"
+
 namespace osquery {
 
 extern std::map<int, std::string> kMaskActions;
@@ -71,6 +75,13 @@ struct INotifySubscriptionContext : public SubscriptionContext {
   /// A configure-time pattern was expanded to match absolute paths.
   bool recursive_match{false};
 
+  /// The subscription was added to the publisher's path index.
+  bool indexed_{false};
+
+  /// Watched paths serving this subscription, a watch is removed when no
+  /// remaining subscription uses it.
+  std::set<std::string> watches_;
+
  private:
   friend class INotifyEventPublisher;
 };
@@ -90,6 +101,26 @@ struct INotifyEventContext : public EventContext {
 
   /// A no-op event transaction id.
   uint32_t transaction_id{0};
+
+  /// The process causing the event, only reported when using fanotify.
+  int pid{0};
+
+  /// Set if the subscriptions that may match the path were found.
+  bool indexed{false};
+
+  /// Subscriptions that may match the path, see PathPatternIndex.
+  std::set<const SubscriptionContext*> candidates;
+
+  /// Reset a released context, the publisher pools and reuses contexts.
+  void recycle() {
+    event = nullptr;
+    path.clear();
+    action.clear();
+    transaction_id = 0;
+    pid = 0;
+    indexed = false;
+    candidates.clear();
+  }
 };
 
 using INotifyEventContextRef = std::shared_ptr<INotifyEventContext>;
@@ -130,20 +161,63 @@ class INotifyEventPublisher
   /// The calling for beginning the thread's run loop.
   Status run() override;
 
-  /// Remove all monitors and subscriptions.
+  /// The run loop waits for the epoll handle.
+  bool waitsForReadiness() const override {
+    return true;
+  }
+
+  /// Remove the subscriptions and the monitors no longer used.
   void removeSubscriptions(const std::string& subscriber) override;
 
+  /// Remove a subscription and the monitors no longer used.
+  void removeSubscription(const SubscriptionContextRef& context) override;
+
  private:
   /// Helper/specialized event context creation.
   INotifyEventContextRef createEventContextFrom(
       struct inotify_event* event) const;
 
+  /**
+   * @brief Read and handle events until the inotify queue is empty.
+   *
+   * @param overflow Output, set if the kernel's inotify queue overflowed.
+   * @return Failure if the read failed.
+   */
+  Status readEvents(bool& overflow);
+
+  /**
+   * @brief Fire an event, or hold a modification to coalesce repeats.
+   *
+   * Repeated modifications of the same path within a short window are fired
+   * once. Any other event for a path first fires its held modification.
+   *
+   * @param ec The event.
+   * @param now The current monotonic time in milliseconds.
+   */
+  void coalesceEvent(const INotifyEventContextRef& ec, size_t now);
+
+  /// Fire held modifications older than the coalescing window, or all.
+  void flushEvents(size_t now, bool all = false);
+
+  /// The current monotonic time in milliseconds.
+  static size_t getMilliTime();
+
   /// Check if the application-global `inotify` handle is alive.
   bool isHandleOpen() const { return inotify_handle_ > 0; }
 
   /// Check all added Subscription%s for a path.
   bool isPathMonitored(const std::string& path) const;
 
+  /// The watched path covering a path, the path or its parent directory.
+  std::string getMonitoredPath(const std::string& path) const;
+
+  /// Check if any watch recorded by a monitored subscription remains.
+  bool isSubscriptionMonitored(const INotifySubscriptionContextRef& sc) const;
+
+  /// Remove the watches of removed subscriptions not used by the others.
+  void releaseMonitors(
+      const std::vector<INotifySubscriptionContextRef>& removed);
+
   /**
    * @brief Add an INotify watch (monitor) on this path.
    *
@@ -157,25 +231,53 @@ class INotifyEventPublisher
    * @param path complete (non-glob) canonical path to monitor.
    * @param recursive perform a single recursive search of subdirectories.
    * @param add_watch (testing only) should an inotify watch be created.
+   * @param sc optional, the subscription recording each watch it uses.
    * @return success if the inotify watch was created.
    */
   bool addMonitor(const std::string& path,
                   uint32_t mask,
                   bool recursive,
-                  bool add_watch = true);
+                  bool add_watch = true,
+                  INotifySubscriptionContext* sc = nullptr);
 
   /// Helper method to parse a subscription and add an equivalent monitor.
   bool monitorSubscription(INotifySubscriptionContextRef& sc,
                            bool add_watch = true);
 
+  /// Expand recursive and wildcard subscription paths into a monitored path.
+  void normalizeSubscription(INotifySubscriptionContextRef& sc);
+
+  /// Open a fanotify handle if requested, falls back to inotify on failure.
+  void setUpFanotify();
+
+  /// Build the path trie from subscriptions and mark their mounts.
+  void configureFanotify();
+
+  /// Read and handle fanotify events until the queue is empty.
+  Status readFanotifyEvents(bool& overflow);
+
   /// Remove an INotify watch (monitor) from our tracking.
   bool removeMonitor(const std::string& path, bool force = false);
   bool removeMonitor(int watch, bool force = false);
 
+  /// Rebuild the path index from the normalized subscriptions.
+  void indexSubscriptions();
+
+  /// Find the subscriptions that may match an event's path.
+  void matchSubscriptions(const INotifyEventContextRef& ec) const;
+
   /// Given a SubscriptionContext and INotifyEventContext match path and action.
   bool shouldFire(const INotifySubscriptionContextRef& mc,
                   const INotifyEventContextRef& ec) const override;
 
+  /// Dispatch events by the bits of the subscription's mask.
+  bool subscriptionKeys(const INotifySubscriptionContextRef& sc,
+                        DispatchKeys& keys) const override;
+
+  /// Each bit of the event's mask is a dispatch key.
+  bool eventKeys(const INotifyEventContextRef& ec,
+                 DispatchKeys& keys) const override;
+
   /// Get the INotify file descriptor.
   int getHandle() const { return inotify_handle_; }
 
@@ -197,6 +299,27 @@ class INotifyEventPublisher
   /// The inotify file descriptor handle.
   std::atomic<int> inotify_handle_{-1};
 
+  /// The epoll descriptor waiting on the inotify or fanotify handle.
+  int epoll_handle_{-1};
+
+  /// The fanotify descriptor, used instead of inotify watches if opened.
+  int fanotify_handle_{-1};
+
+  /// The literal prefixes of subscribed paths, used to filter fanotify events.
+  PathTrie fanotify_paths_;
+
+  /// Subscriptions indexed by path, matched against inotify and fanotify.
+  PathPatternIndex index_;
+
+  /// The event masks of marked mounts, by device.
+  std::map<dev_t, uint64_t> fanotify_marks_;
+
+  /// The read buffer, sized for many events per read.
+  std::vector<char> buffer_;
+
+  /// Held modification events and their times, by path.
+  std::map<std::string, std::pair<INotifyEventContextRef, size_t>> modified_;
+
   /// Time in seconds of the last inotify restart.
   std::atomic<int> last_restart_{-1};
 
@@ -210,5 +333,9 @@ class INotifyEventPublisher
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
   FRIEND_TEST(INotifyTests, test_inotify_match_subscription);
   FRIEND_TEST(INotifyTests, test_inotify_embedded_wildcards);
+  FRIEND_TEST(INotifyTests, test_inotify_coalesce_events);
+  FRIEND_TEST(INotifyTests, test_fanotify_normalize_subscription);
+  FRIEND_TEST(INotifyTests, test_inotify_path_index);
+  FRIEND_TEST(INotifyTests, test_inotify_incremental_configure);
 };
 }
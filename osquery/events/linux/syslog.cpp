@@ -10,20 +10,21 @@
 
 #include <fcntl.h>
 #include <grp.h>
+#include <poll.h>
+#include <string.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
-#include <istream>
+#include <chrono>
 #include <string>
 
 #include <boost/algorithm/string/trim.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/property_tree/json_parser.hpp>
-#include <boost/tokenizer.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -48,9 +49,17 @@ const std::string kPipeGroupName = "syslog";
 const char* kTimeFormat = "%Y-%m-%dT%H:%M:%S";
 const std::vector<std::string> kCsvFields = {
     "time", "host", "severity", "facility", "tag", "message"};
-const size_t kMaxLogsPerRun = 10;
 const size_t kErrorThreshold = 10;
 
+/// Wait for input, at most this long, before checking for interruption.
+const int kSyslogMLatency = 1000;
+
+/// The read buffer size, and the longest line that is parsed.
+const size_t kSyslogBufferSize = 64 * 1024;
+
+/// The time spent reading and firing lines in each run loop step.
+const std::chrono::milliseconds kSyslogRunBudget(100);
+
 Status SyslogEventPublisher::setUp() {
   Status s;
   if (!pathExists(FLAGS_syslog_pipe_path)) {
@@ -76,11 +85,11 @@ Status SyslogEventPublisher::setUp() {
 
   // Opening with both flags appears to be the only way to open the pipe
   // without blocking for a writer. We won't ever write to the pipe, but we
-  // don't want to block here and will instead block waiting for a read in the
-  // run() method
-  readStream_.open(FLAGS_syslog_pipe_path,
-                   std::ifstream::in | std::ifstream::out);
-  if (!readStream_.good()) {
+  // don't want to block here and will instead wait for readiness in the
+  // run() method. Holding the write end also prevents reads of end-of-file
+  // when rsyslog closes the pipe.
+  readFd_ = open(FLAGS_syslog_pipe_path.c_str(), O_RDWR | O_NONBLOCK);
+  if (readFd_ == -1) {
     return Status(1,
                   "Error opening pipe for reading: " + FLAGS_syslog_pipe_path);
   }
@@ -139,60 +148,173 @@ void SyslogEventPublisher::unlockPipe() {
 }
 
 Status SyslogEventPublisher::run() {
-  // This run function will be called by the event factory with ~100ms pause
-  // (see InterruptableRunnable::pause()) between runs. In case something goes
-  // weird and there is a huge amount of input, we limit how many logs we
-  // take in per run to avoid pegging the CPU.
-  for (size_t i = 0; i < kMaxLogsPerRun; ++i) {
-    if (readStream_.rdbuf()->in_avail() == 0) {
-      // If there is no pending data, we have flushed everything and can wait
-      // until the next time EventFactory calls run(). This also allows the
-      // thread to join when it is stopped by EventFactory.
-      return Status(0, "OK");
+  // The event factory steps this publisher again without a pause, wait for
+  // rsyslog to write. The timeout allows the thread to join when it is
+  // stopped by EventFactory.
+  struct pollfd pfd = {readFd_, POLLIN, 0};
+  int selector = ::poll(&pfd, 1, kSyslogMLatency);
+  if (selector == -1 && errno != EINTR) {
+    return Status(1, "Error waiting for pipe: " + std::string(strerror(errno)));
+  }
+  if (selector <= 0) {
+    return Status(0, "OK");
+  }
+
+  if (buffer_.empty()) {
+    buffer_.resize(kSyslogBufferSize);
+  }
+
+  // In case something goes weird and there is a huge amount of input, we
+  // limit the time spent in each step to avoid pegging the CPU.
+  auto deadline = std::chrono::steady_clock::now() + kSyslogRunBudget;
+  while (!isEnding()) {
+    if (buffered_ == buffer_.size()) {
+      // The buffered bytes are a single partial line, skip to its end.
+      if (!discarding_) {
+        LOG(WARNING) << "Discarding syslog line longer than "
+                     << kSyslogBufferSize << " bytes";
+      }
+      buffered_ = 0;
+      discarding_ = true;
+    }
+
+    auto bytes = ::read(
+        readFd_, buffer_.data() + buffered_, buffer_.size() - buffered_);
+    if (bytes == -1 && (errno == EAGAIN || errno == EINTR)) {
+      // The pipe is drained.
+      break;
+    } else if (bytes <= 0) {
+      return Status(1, "Error reading pipe: " + std::string(strerror(errno)));
+    }
+    buffered_ += static_cast<size_t>(bytes);
+
+    auto status = fireLines();
+    if (!status.ok()) {
+      return status;
     }
-    std::string line;
-    std::getline(readStream_, line);
-    auto ec = createEventContext();
-    Status status = populateEventContext(line, ec);
-    if (status.ok()) {
-      fire(ec);
-      if (errorCount_ > 0) {
-        --errorCount_;
+
+    if (std::chrono::steady_clock::now() >= deadline) {
+      pfd.revents = 0;
+      if (::poll(&pfd, 1, 0) > 0) {
+        // rsyslog is writing faster than lines are fired.
+        backlog_count_++;
       }
+      break;
+    }
+  }
+  return Status(0, "OK");
+}
+
+Status SyslogEventPublisher::fireLines() {
+  auto begin = buffer_.data();
+  auto end = begin + buffered_;
+  auto line = begin;
+  while (line < end) {
+    auto newline = static_cast<char*>(memchr(line, '\n', end - line));
+    if (newline == nullptr) {
+      break;
+    }
+
+    if (discarding_) {
+      discarding_ = false;
     } else {
-      LOG(ERROR) << status.getMessage() << " in line: " << line;
-      ++errorCount_;
-      if (errorCount_ >= kErrorThreshold) {
-        return Status(1, "Too many errors in syslog parsing.");
+      auto status = fireLine(line, static_cast<size_t>(newline - line));
+      if (!status.ok()) {
+        return status;
       }
     }
+    line = newline + 1;
+  }
+
+  buffered_ = static_cast<size_t>(end - line);
+  if (buffered_ > 0 && line != begin) {
+    memmove(begin, line, buffered_);
+  }
+  return Status(0, "OK");
+}
+
+Status SyslogEventPublisher::fireLine(const char* line, size_t size) {
+  auto ec = createEventContext();
+  Status status = populateEventContext(line, size, ec);
+  if (status.ok()) {
+    fire(ec);
+    if (errorCount_ > 0) {
+      --errorCount_;
+    }
+  } else {
+    LOG(ERROR) << status.getMessage()
+               << " in line: " << std::string(line, size);
+    ++errorCount_;
+    if (errorCount_ >= kErrorThreshold) {
+      return Status(1, "Too many errors in syslog parsing.");
+    }
   }
   return Status(0, "OK");
 }
 
 void SyslogEventPublisher::tearDown() {
+  if (readFd_ != -1) {
+    close(readFd_);
+    readFd_ = -1;
+  }
   unlockPipe();
 }
 
-Status SyslogEventPublisher::populateEventContext(const std::string& line,
+Status SyslogEventPublisher::populateEventContext(const char* line,
+                                                  size_t size,
                                                   SyslogEventContextRef& ec) {
-  boost::tokenizer<RsyslogCsvSeparator> tokenizer(line);
+  if (size == 0) {
+    return Status(1, "Received fewer fields than expected");
+  }
+
+  // Fields follow the RsyslogCsvSeparator rules, without a copy of the line.
   auto key = kCsvFields.begin();
-  for (std::string value : tokenizer) {
-    if (key == kCsvFields.end()) {
-      return Status(1, "Received more fields than expected");
-    }
-    boost::trim(value);
-    if (*key == "time") {
-      ec->time = parseTimeString(value);
-    } else if (*key == "tag" && !value.empty() && value.back() == ':') {
-      // rsyslog sends "tag" with a trailing colon that we don't need
-      ec->fields.emplace(*key, value.substr(0, value.size() - 1));
+  auto end = line + size;
+  bool in_quote = false;
+  std::string value;
+  for (auto next = line;;) {
+    if (next == end || (*next == ',' && !in_quote)) {
+      if (key == kCsvFields.end()) {
+        return Status(1, "Received more fields than expected");
+      }
+      boost::trim(value);
+      if (*key == "time") {
+        ec->time = parseTimeString(value);
+      } else if (*key == "tag" && !value.empty() && value.back() == ':') {
+        // rsyslog sends "tag" with a trailing colon that we don't need
+        value.pop_back();
+        ec->fields.emplace(*key, std::move(value));
+      } else {
+        ec->fields.emplace(*key, std::move(value));
+      }
+      value.clear();
+      ++key;
+
+      if (next == end) {
+        break;
+      }
+      ++next;
+    } else if (*next == '"') {
+      if (!in_quote) {
+        in_quote = true;
+      } else if (next + 1 != end && *(next + 1) == '"') {
+        // rsyslog escapes " with "", so reverse this by inserting "
+        value += '"';
+        ++next;
+      } else {
+        in_quote = false;
+      }
+      ++next;
     } else {
-      ec->fields.emplace(*key, value);
+      // Append the run of characters until the next quote or separator.
+      auto run = next;
+      while (next != end && *next != '"' && (in_quote || *next != ',')) {
+        ++next;
+      }
+      value.append(run, next - run);
     }
-    ++key;
   }
+
   if (key == kCsvFields.end()) {
     return Status(0, "OK");
   } else {
@@ -12,8 +12,8 @@
 
 #include <stdio.h>
 
-#include <fstream>
 #include <map>
+#include <vector>
 
 #include <boost/property_tree/ptree.hpp>
 
@@ -69,6 +69,11 @@ class SyslogEventPublisher
 
   Status run() override;
 
+  /// The run loop waits for the pipe descriptor.
+  bool waitsForReadiness() const override {
+    return true;
+  }
+
  public:
   SyslogEventPublisher() : EventPublisher(), errorCount_(0), lockFd_(-1) {}
 
@@ -106,23 +111,48 @@ class SyslogEventPublisher
   void unlockPipe();
 
   /**
-   * @brief Populate the SyslogEventContext with the syslog JSON.
+   * @brief Fire an event for each complete line in the read buffer.
    *
-   * Performs basic cleanup on the JSON data as it is populated into the
-   * context.
+   * Lines are split and parsed in place, a trailing partial line is moved
+   * to the front of the buffer to be completed by the next read.
    */
-  static Status populateEventContext(const std::string& line,
+  Status fireLines();
+
+  /// Parse and fire a single line, counting errors.
+  Status fireLine(const char* line, size_t size);
+
+  /**
+   * @brief Populate the SyslogEventContext with the syslog CSV.
+   *
+   * Fields are unquoted and trimmed in a single pass over the line as they
+   * are populated into the context.
+   */
+  static Status populateEventContext(const char* line,
+                                     size_t size,
                                      SyslogEventContextRef& ec);
 
+  /// Populate the SyslogEventContext from a line string.
+  static Status populateEventContext(const std::string& line,
+                                     SyslogEventContextRef& ec) {
+    return populateEventContext(line.data(), line.size(), ec);
+  }
+
   /**
    * @brief Parse a time string from rsyslog into time_t.
    */
   static time_t parseTimeString(const std::string& time_str);
 
-  /**
-   * @brief Input stream for reading from the pipe.
-   */
-  std::fstream readStream_;
+  /// Non-blocking descriptor for reading from the pipe.
+  int readFd_{-1};
+
+  /// Bytes read from the pipe, starting with the oldest incomplete line.
+  std::vector<char> buffer_;
+
+  /// The number of buffered bytes.
+  size_t buffered_{0};
+
+  /// A line longer than the buffer is being discarded.
+  bool discarding_{false};
 
   /**
    * @brief Counter used to shut down thread when too many errors occur.
@@ -138,13 +168,14 @@ class SyslogEventPublisher
    * @brief File descriptor used to lock the pipe for reading.
    *
    * This fd should not be used for reading from the pipe, instead use
-   * readStream_.
+   * readFd_.
    */
   int lockFd_;
 
  private:
   FRIEND_TEST(SyslogTests, test_populate_event_context);
   FRIEND_TEST(SyslogTests, test_parse_time_string);
+  FRIEND_TEST(SyslogTests, test_fire_lines);
 };
 
 /**
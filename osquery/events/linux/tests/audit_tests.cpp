@@ -62,10 +62,42 @@ TEST_F(AuditTests, test_handle_reply) {
   EXPECT_EQ(ec->preamble, "audit(1440542781.644:403030)");
   EXPECT_EQ(ec->fields.size(), 4U);
   EXPECT_EQ(ec->fields.count("argc"), 1U);
-  EXPECT_EQ(ec->fields["argc"], "3");
-  EXPECT_EQ(ec->fields["a0"], "\"H=1 \"");
-  EXPECT_EQ(ec->fields["a1"], "\"/bin/sh\"");
-  EXPECT_EQ(ec->fields["a2"], "c");
+  EXPECT_EQ(ec->fields.get("argc"), "3");
+  EXPECT_EQ(ec->fields.get("a0"), "\"H=1 \"");
+  EXPECT_EQ(ec->fields.get("a1"), "\"/bin/sh\"");
+  EXPECT_EQ(ec->fields.get("a2"), "c");
+
+  // Fields are kept in message order.
+  EXPECT_EQ(ec->fields.key(1), "a0");
+  EXPECT_EQ(ec->fields.value(3), "c");
+}
+
+TEST_F(AuditTests, test_audit_fields) {
+  AuditFields fields;
+  std::string message = "a=1  b c=\"x y\"d=2 a=3 e=\"open f=1";
+  fields.parse(message.data(), message.size());
+
+  // A key without an assignment has an empty value, the last key repeats.
+  ASSERT_EQ(fields.size(), 6U);
+  EXPECT_EQ(fields.get("a"), "3");
+  EXPECT_EQ(fields.count("b"), 1U);
+  EXPECT_EQ(fields.get("b", "missing"), "");
+  EXPECT_EQ(fields.get("c"), "\"x y\"");
+  EXPECT_EQ(fields.get("d"), "2");
+  EXPECT_EQ(fields.get("e"), "\"open f=1");
+  EXPECT_EQ(fields.get("f", "missing"), "missing");
+  EXPECT_TRUE(fields.equals("d", "2"));
+  EXPECT_FALSE(fields.equals("d", "22"));
+
+  // Values may be replaced, a copy keeps its own message.
+  auto copy = fields;
+  fields.set("d", "4");
+  fields.set("g", "5");
+  EXPECT_EQ(fields.get("d"), "4");
+  EXPECT_EQ(fields.get("g"), "5");
+  EXPECT_EQ(fields.size(), 7U);
+  EXPECT_EQ(copy.get("d"), "2");
+  EXPECT_EQ(copy.count("g"), 0U);
 }
 
 TEST_F(AuditTests, test_audit_value_decode) {
@@ -169,4 +201,77 @@ TEST_F(AuditTests, test_parse_sock_addr) {
   parseSockAddr(msg3, r4, true);
   EXPECT_EQ(r4["socket"], "/tmp/osquery.em");
 }
+
+TEST_F(AuditTests, test_assemble_events) {
+  AuditEventPublisher pub;
+
+  // Records of the same event share a serial within the preamble.
+  auto record = [](int type) {
+    auto ec = std::make_shared<AuditEventContext>();
+    ec->type = type;
+    ec->preamble = "audit(1440542781.644:10)";
+    ec->fields.set("type", std::to_string(type));
+    return ec;
+  };
+
+  EXPECT_EQ(pub.assemble(record(AUDIT_SYSCALL)), nullptr);
+  EXPECT_EQ(pub.assemble(record(AUDIT_EXECVE)), nullptr);
+  EXPECT_EQ(pub.assemble(record(AUDIT_PATH)), nullptr);
+  EXPECT_EQ(pub.pending_.size(), 1U);
+
+  // The end-of-event completes the assembled event.
+  auto event = pub.assemble(record(AUDIT_EOE));
+  ASSERT_NE(event, nullptr);
+  EXPECT_EQ(event->type, AUDIT_SYSCALL);
+  ASSERT_EQ(event->records.size(), 3U);
+  EXPECT_EQ(event->records[1].type, AUDIT_EXECVE);
+  EXPECT_EQ(event->records[2].fields.get("type"), std::to_string(AUDIT_PATH));
+  EXPECT_TRUE(pub.pending_.empty());
+
+  // Records outside of a pending event pass through.
+  auto single = record(AUDIT_USER_AUTH);
+  EXPECT_EQ(pub.assemble(single), single);
+  EXPECT_EQ(pub.assemble(record(AUDIT_EOE)), nullptr);
+}
+
+TEST_F(AuditTests, test_rule_fields) {
+  std::vector<AuditRuleField> fields;
+  EXPECT_TRUE(parseAuditRuleFields("", fields).ok());
+  EXPECT_TRUE(fields.empty());
+
+  EXPECT_TRUE(parseAuditRuleFields("uid>=1000, uid<2000,success=1", fields));
+  ASSERT_EQ(fields.size(), 3U);
+  EXPECT_EQ(fields[0].field, "uid");
+  EXPECT_EQ(fields[0].op, ">=");
+  EXPECT_EQ(fields[0].value, "1000");
+  EXPECT_EQ(fields[1].str(), "uid<2000");
+
+  std::vector<AuditRuleField> invalid;
+  EXPECT_FALSE(parseAuditRuleFields("uid", invalid).ok());
+  EXPECT_FALSE(parseAuditRuleFields("=1", invalid).ok());
+  EXPECT_FALSE(parseAuditRuleFields("uid=>1", invalid).ok());
+
+  auto sc = std::make_shared<AuditSubscriptionContext>();
+  AuditRule rule(59, "");
+  rule.fields = fields;
+  sc->rules.push_back(rule);
+
+  auto ec = std::make_shared<AuditEventContext>();
+  ec->type = AUDIT_SYSCALL;
+  ec->syscall = 59;
+  ec->fields.set("uid", "1000");
+  ec->fields.set("success", "yes");
+  EXPECT_TRUE(AuditEventPublisher::matchRuleFields(sc, ec));
+
+  // Each of the fields must match.
+  ec->fields.set("uid", "2000");
+  EXPECT_FALSE(AuditEventPublisher::matchRuleFields(sc, ec));
+  ec->fields.set("uid", "1500");
+  ec->fields.set("success", "no");
+  EXPECT_FALSE(AuditEventPublisher::matchRuleFields(sc, ec));
+
+  // Syscalls without a rule are not filtered.
+  ec->syscall = 42;
+  EXPECT_TRUE(AuditEventPublisher::matchRuleFields(sc, ec));
+}
 }
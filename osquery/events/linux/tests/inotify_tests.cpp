@@ -298,6 +298,7 @@ class TestINotifyEventSubscriber
   FRIEND_TEST(INotifyTests, test_inotify_optimization);
   FRIEND_TEST(INotifyTests, test_inotify_directory_watch);
   FRIEND_TEST(INotifyTests, test_inotify_recursion);
+  FRIEND_TEST(INotifyTests, test_inotify_incremental_configure);
   FRIEND_TEST(INotifyTests, test_inotify_embedded_wildcards);
 };
 
@@ -471,6 +472,44 @@ TEST_F(INotifyTests, test_inotify_recursion) {
   EventFactory::deregisterEventPublisher("inotify");
 }
 
+TEST_F(INotifyTests, test_inotify_incremental_configure) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<TestINotifyEventSubscriber>();
+  createMockFileStructure();
+
+  auto sc = sub->createSubscriptionContext();
+  sc->path = kFakeDirectory + "/deep1/*";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc);
+  auto sc2 = sub->createSubscriptionContext();
+  sc2->path = kFakeDirectory + "/deep11/**";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc2);
+  pub->configure();
+  EXPECT_EQ(pub->numDescriptors(), 4U);
+  auto watch = pub->path_descriptors_.at(kFakeDirectory + "/deep1/");
+
+  // An added subscription keeps the existing watches.
+  auto sc3 = sub->createSubscriptionContext();
+  sc3->path = kFakeDirectory + "/deep1/level1.txt";
+  sub->subscribe(&TestINotifyEventSubscriber::Callback, sc3);
+  pub->configure();
+  EXPECT_EQ(pub->numDescriptors(), 4U);
+  EXPECT_EQ(pub->path_descriptors_.at(kFakeDirectory + "/deep1/"), watch);
+
+  // Removing a subscription only removes the watches no longer used.
+  pub->removeSubscription(sc2);
+  EXPECT_EQ(pub->numDescriptors(), 1U);
+  pub->removeSubscription(sc);
+  EXPECT_EQ(pub->numDescriptors(), 1U);
+  EXPECT_EQ(pub->path_descriptors_.at(kFakeDirectory + "/deep1/"), watch);
+  pub->removeSubscription(sc3);
+  EXPECT_EQ(pub->numDescriptors(), 0U);
+  EXPECT_EQ(pub->numSubscriptions(), 0U);
+
+  tearDownMockFileStructure();
+  EventFactory::deregisterEventPublisher("inotify");
+}
+
 TEST_F(INotifyTests, test_inotify_embedded_wildcards) {
   // Assume event type is not registered.
   event_pub_ = std::make_shared<INotifyEventPublisher>();
@@ -497,4 +536,121 @@ TEST_F(INotifyTests, test_inotify_embedded_wildcards) {
   ASSERT_EQ(event_pub_->numDescriptors(), 1U);
   EXPECT_EQ(event_pub_->path_descriptors_.count(real_test_dir + "/2/1/"), 1U);
 }
+
+TEST_F(INotifyTests, test_inotify_coalesce_events) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+
+  auto event = [](const std::string& path, uint32_t mask) {
+    auto ec = std::make_shared<INotifyEventContext>();
+    ec->event = std::make_shared<struct inotify_event>();
+    ec->event->mask = mask;
+    ec->path = path;
+    ec->action = "UPDATED";
+    return ec;
+  };
+
+  // Repeated modifications of a path are held and fired once.
+  pub->coalesceEvent(event("/tmp/a", IN_MODIFY), 1000);
+  pub->coalesceEvent(event("/tmp/a", IN_MODIFY), 1010);
+  pub->coalesceEvent(event("/tmp/b", IN_MODIFY), 1050);
+  EXPECT_EQ(pub->modified_.size(), 2U);
+  EXPECT_EQ(pub->numEvents(), 0U);
+
+  // Only modifications older than the window fire.
+  pub->flushEvents(1120);
+  EXPECT_EQ(pub->modified_.size(), 1U);
+  EXPECT_EQ(pub->numEvents(), 1U);
+
+  // Another event for the path fires the held modification first.
+  pub->coalesceEvent(event("/tmp/b", IN_CLOSE_WRITE), 1130);
+  EXPECT_TRUE(pub->modified_.empty());
+  EXPECT_EQ(pub->numEvents(), 3U);
+
+  pub->coalesceEvent(event("/tmp/c", IN_MODIFY), 1140);
+  pub->flushEvents(1140, true);
+  EXPECT_TRUE(pub->modified_.empty());
+  EXPECT_EQ(pub->numEvents(), 4U);
+}
+
+TEST_F(INotifyTests, test_fanotify_path_trie) {
+  PathTrie trie;
+  EXPECT_TRUE(trie.empty());
+  EXPECT_FALSE(trie.matches("/etc/passwd"));
+
+  trie.insert("/etc/");
+  trie.insert(getPatternPrefix("/home/*/.ssh/%%"));
+  EXPECT_FALSE(trie.empty());
+  EXPECT_TRUE(trie.matches("/etc/passwd"));
+  EXPECT_TRUE(trie.matches("/home/user/.ssh/authorized_keys"));
+  EXPECT_FALSE(trie.matches("/etc"));
+  EXPECT_FALSE(trie.matches("/usr/bin/ls"));
+
+  trie.clear();
+  EXPECT_TRUE(trie.empty());
+  EXPECT_FALSE(trie.matches("/etc/passwd"));
+}
+
+TEST_F(INotifyTests, test_fanotify_normalize_subscription) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+
+  // Recursive paths become a prefix without any watches.
+  auto sc = std::make_shared<INotifySubscriptionContext>();
+  sc->path = "/usr/**";
+  pub->normalizeSubscription(sc);
+  EXPECT_TRUE(sc->recursive);
+  EXPECT_EQ(sc->path, "/usr/");
+  EXPECT_EQ(getPatternPrefix(sc->path), "/usr/");
+  EXPECT_EQ(pub->numDescriptors(), 0U);
+
+  // Stem wildcards keep their pattern for matching fired events.
+  sc = std::make_shared<INotifySubscriptionContext>();
+  sc->path = "/home/*/.ssh/**";
+  pub->normalizeSubscription(sc);
+  EXPECT_EQ(sc->path, "/home/*/.ssh/");
+  EXPECT_EQ(getPatternPrefix(sc->path), "/home/");
+}
+
+TEST_F(INotifyTests, test_inotify_path_index) {
+  auto pub = std::make_shared<INotifyEventPublisher>();
+
+  auto ssh = std::make_shared<INotifySubscriptionContext>();
+  ssh->path = "/home/*/.ssh/**";
+  pub->normalizeSubscription(ssh);
+  auto etc = std::make_shared<INotifySubscriptionContext>();
+  etc->path = "/etc/passwd";
+  pub->normalizeSubscription(etc);
+
+  pub->subscriptions_.push_back(Subscription::create("TestSubscriber", ssh));
+  pub->subscriptions_.push_back(Subscription::create("TestSubscriber", etc));
+  pub->indexSubscriptions();
+  EXPECT_EQ(pub->index_.size(), 2U);
+
+  // Wildcard directories are matched as components of the event path.
+  auto ec = pub->createEventContext();
+  ec->event = std::make_shared<struct inotify_event>();
+  ec->path = "/home/user/.ssh/keys/authorized_keys";
+  pub->matchSubscriptions(ec);
+  EXPECT_EQ(ec->candidates.size(), 1U);
+  EXPECT_TRUE(pub->shouldFire(ssh, ec));
+  EXPECT_FALSE(pub->shouldFire(etc, ec));
+
+  // Literal components are compared without case.
+  ec = pub->createEventContext();
+  ec->event = std::make_shared<struct inotify_event>();
+  ec->path = "/ETC/passwd";
+  pub->matchSubscriptions(ec);
+  EXPECT_EQ(ec->candidates.count(etc.get()), 1U);
+
+  // No paths below the subscribed directories are candidates.
+  ec = pub->createEventContext();
+  ec->event = std::make_shared<struct inotify_event>();
+  ec->path = "/home/user/.bashrc";
+  pub->matchSubscriptions(ec);
+  EXPECT_TRUE(ec->candidates.empty());
+  EXPECT_FALSE(pub->shouldFire(ssh, ec));
+
+  pub->subscriptions_.clear();
+  pub->indexSubscriptions();
+  EXPECT_TRUE(pub->index_.empty());
+}
 }
@@ -60,6 +60,37 @@ TEST_F(SyslogTests, test_populate_event_context) {
   ASSERT_NE(std::string::npos, status.getMessage().find("more"));
 }
 
+TEST_F(SyslogTests, test_fire_lines) {
+  SyslogEventPublisher pub;
+  std::string input =
+      R"("2016-03-22T21:17:01.701882+00:00","host","6","cron","CRON:","a")"
+      "\n"
+      R"("2016-03-22T21:17:01.701882+00:00","host","6")"
+      "\n"
+      R"("2016-03-22T21:17:01.701882+00:00","host")";
+  pub.buffer_.assign(input.begin(), input.end());
+  pub.buffered_ = input.size();
+
+  // The second line is missing fields.
+  ASSERT_TRUE(pub.fireLines().ok());
+  EXPECT_EQ(1U, pub.errorCount_);
+
+  // The partial line is kept at the front of the buffer.
+  std::string partial = R"("2016-03-22T21:17:01.701882+00:00","host")";
+  ASSERT_EQ(partial.size(), pub.buffered_);
+  EXPECT_EQ(partial, std::string(pub.buffer_.data(), pub.buffered_));
+
+  // The remainder of a discarded line is skipped.
+  pub.discarding_ = true;
+  ASSERT_TRUE(pub.fireLines().ok());
+  EXPECT_EQ(partial.size(), pub.buffered_);
+  pub.buffer_[pub.buffered_++] = '\n';
+  ASSERT_TRUE(pub.fireLines().ok());
+  EXPECT_FALSE(pub.discarding_);
+  EXPECT_EQ(0U, pub.buffered_);
+  EXPECT_EQ(1U, pub.errorCount_);
+}
+
 TEST_F(SyslogTests, test_parse_time_string) {
   ASSERT_EQ((time_t)0,
             SyslogEventPublisher::parseTimeString("1970-01-01T00:00:00.000000+00:00"));
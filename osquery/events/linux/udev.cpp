@@ -8,6 +8,11 @@
  *
  */
 
+#include <errno.h>
+#include <poll.h>
+
+#include <atomic>
+
 #include <osquery/events.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
@@ -16,7 +21,19 @@
 
 namespace osquery {
 
-static const int kUdevMLatency = 200;
+/// Wait for a device, at most this long, before checking for interruption.
+static const int kUdevMLatency = 1000;
+
+/// Subsystems of the device inventory tables, always received by the monitor.
+static const std::set<std::string> kUdevInventorySubsystems = {
+    "block", "pci", "usb",
+};
+
+/// Set while the monitor is receiving, see getDeviceGeneration.
+static std::atomic<bool> kUdevMonitoring{false};
+
+/// Changed for each inventory device added or removed.
+static std::atomic<size_t> kUdevDeviceGeneration{0};
 
 REGISTER(UdevEventPublisher, "event_publisher", "udev");
 
@@ -40,17 +57,61 @@ Status UdevEventPublisher::setUp() {
   }
 
   udev_monitor_enable_receiving(monitor_);
+
+  // Devices may have changed while no monitor was receiving.
+  kUdevDeviceGeneration++;
+  kUdevMonitoring = true;
   return Status(0, "OK");
 }
 
-void UdevEventPublisher::configure() {}
+void UdevEventPublisher::configure() {
+  // Filters only select events, a subscription without a subsystem needs all.
+  std::set<std::pair<std::string, std::string>> filters;
+  for (auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->subsystem.empty()) {
+      filters.clear();
+      break;
+    }
+    filters.insert(std::make_pair(sc->subsystem, sc->devtype));
+  }
+
+  // The inventory tables rely on add and remove events for their subsystems.
+  if (!filters.empty()) {
+    for (const auto& subsystem : kUdevInventorySubsystems) {
+      filters.insert(std::make_pair(subsystem, ""));
+    }
+  }
+
+  WriteLock lock(mutex_);
+  if (monitor_ == nullptr || filters == filters_) {
+    return;
+  }
+
+  // The previous filters are detached from the monitor socket.
+  udev_monitor_filter_remove(monitor_);
+  for (const auto& filter : filters) {
+    auto devtype = (filter.second.empty()) ? nullptr : filter.second.c_str();
+    udev_monitor_filter_add_match_subsystem_devtype(
+        monitor_, filter.first.c_str(), devtype);
+  }
+
+  if (udev_monitor_filter_update(monitor_) != 0) {
+    LOG(WARNING) << "Could not apply udev monitor filters";
+  }
+  filters_ = std::move(filters);
+}
 
 void UdevEventPublisher::tearDown() {
+  kUdevMonitoring = false;
+  kUdevDeviceGeneration++;
+
   WriteLock lock(mutex_);
   if (monitor_ != nullptr) {
     udev_monitor_unref(monitor_);
     monitor_ = nullptr;
   }
+  filters_.clear();
 
   if (handle_ != nullptr) {
     udev_unref(handle_);
@@ -60,8 +121,6 @@ void UdevEventPublisher::tearDown() {
 
 Status UdevEventPublisher::run() {
   int fd = 0;
-  fd_set set;
-
   {
     WriteLock lock(mutex_);
     if (monitor_ == nullptr) {
@@ -70,17 +129,14 @@ Status UdevEventPublisher::run() {
     fd = udev_monitor_get_fd(monitor_);
   }
 
-  FD_ZERO(&set);
-  FD_SET(fd, &set);
-
-  struct timeval timeout = {1, 0};
-  int selector = ::select(fd + 1, &set, nullptr, nullptr, &timeout);
-  if (selector == -1) {
+  struct pollfd pfd = {fd, POLLIN, 0};
+  int selector = ::poll(&pfd, 1, kUdevMLatency);
+  if (selector == -1 && errno != EINTR) {
     LOG(ERROR) << "Could not read udev monitor";
     return Status(1, "udev monitor failed.");
   }
 
-  if (selector == 0 || !FD_ISSET(fd, &set)) {
+  if (selector <= 0 || !(pfd.revents & POLLIN)) {
     // Read timeout.
     return Status(0, "Finished");
   }
@@ -92,11 +148,14 @@ Status UdevEventPublisher::run() {
   }
 
   auto ec = createEventContextFrom(device);
+  if (kUdevInventorySubsystems.count(ec->subsystem) > 0 &&
+      (ec->action == UDEV_EVENT_ACTION_ADD ||
+       ec->action == UDEV_EVENT_ACTION_REMOVE)) {
+    kUdevDeviceGeneration++;
+  }
   fire(ec);
 
   udev_device_unref(device);
-
-  pauseMilli(kUdevMLatency);
   return Status(0, "OK");
 }
 
@@ -118,6 +177,11 @@ std::string UdevEventPublisher::getAttr(struct udev_device* device,
   return "";
 }
 
+bool UdevEventPublisher::getDeviceGeneration(size_t& generation) {
+  generation = kUdevDeviceGeneration;
+  return kUdevMonitoring;
+}
+
 UdevEventContextRef UdevEventPublisher::createEventContextFrom(
     struct udev_device* device) {
   auto ec = createEventContext();
@@ -177,4 +241,20 @@ bool UdevEventPublisher::shouldFire(const UdevSubscriptionContextRef& sc,
 
   return true;
 }
+
+bool UdevEventPublisher::subscriptionKeys(const UdevSubscriptionContextRef& sc,
+                                          DispatchKeys& keys) const {
+  if (sc->action == UDEV_EVENT_ACTION_ALL) {
+    return false;
+  }
+
+  keys.push_back(static_cast<size_t>(sc->action));
+  return true;
+}
+
+bool UdevEventPublisher::eventKeys(const UdevEventContextRef& ec,
+                                   DispatchKeys& keys) const {
+  keys.push_back(static_cast<size_t>(ec->action));
+  return true;
+}
 }
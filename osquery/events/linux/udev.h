@@ -10,6 +10,10 @@
 
 #pragma once
 
+#include <set>
+#include <string>
+#include <utility>
+
 #include <libudev.h>
 
 #include <osquery/events.h>
@@ -35,7 +39,12 @@ struct UdevSubscriptionContext : public SubscriptionContext {
   /// The hardware event action, add/remove/change.
   udev_event_action action;
 
-  /// Restrict to a specific subsystem.
+  /**
+   * @brief Restrict to a specific subsystem.
+   *
+   * When every subscription names a subsystem the kernel only sends the
+   * monitor events for those subsystems, and devtypes if set.
+   */
   std::string subsystem;
 
   /// Restrict to a specific devnode.
@@ -81,12 +90,18 @@ class UdevEventPublisher
  public:
   Status setUp() override;
 
+  /// Apply kernel-side filters for the subscribed subsystems.
   void configure() override;
 
   void tearDown() override;
 
   Status run() override;
 
+  /// The run loop waits for the monitor descriptor.
+  bool waitsForReadiness() const override {
+    return true;
+  }
+
   UdevEventPublisher() : EventPublisher(){};
 
   /**
@@ -109,6 +124,17 @@ class UdevEventPublisher
   static std::string getAttr(struct udev_device* device,
                              const std::string& attr);
 
+  /**
+   * @brief Get a counter that changes when a device is added or removed.
+   *
+   * Tables caching the device inventory compare the counter, see
+   * HardwareCache. The counter also changes when the monitor starts or stops.
+   *
+   * @param generation output, the current device generation.
+   * @return false if the monitor is not receiving and changes are unknown.
+   */
+  static bool getDeviceGeneration(size_t& generation);
+
  private:
   /// udev handle (socket descriptor contained within).
   struct udev* handle_{nullptr};
@@ -116,6 +142,9 @@ class UdevEventPublisher
   /// udev monitor.
   struct udev_monitor* monitor_{nullptr};
 
+  /// Subsystem and devtype pairs applied as monitor filters.
+  std::set<std::pair<std::string, std::string>> filters_;
+
   /// Protection around udev resources.
   Mutex mutex_;
 
@@ -124,6 +153,14 @@ class UdevEventPublisher
   bool shouldFire(const UdevSubscriptionContextRef& mc,
                   const UdevEventContextRef& ec) const override;
 
+  /// Dispatch events by the subscription's action.
+  bool subscriptionKeys(const UdevSubscriptionContextRef& sc,
+                        DispatchKeys& keys) const override;
+
+  /// The event's action is the dispatch key.
+  bool eventKeys(const UdevEventContextRef& ec,
+                 DispatchKeys& keys) const override;
+
   /// Helper function to create an EventContext using a udev_device pointer.
   UdevEventContextRef createEventContextFrom(struct udev_device* device);
 };
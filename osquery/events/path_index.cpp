@@ -0,0 +1,121 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <fnmatch.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+#include "osquery/events/path_index.h"
+
+namespace osquery {
+
+std::vector<std::string> getPathComponents(const std::string& path) {
+  std::vector<std::string> components;
+  size_t start = 0;
+  while (start < path.size()) {
+    auto end = path.find('/', start);
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+    if (end > start) {
+      components.push_back(path.substr(start, end - start));
+    }
+    start = end + 1;
+  }
+  return components;
+}
+
+void PathPatternIndex::insert(const std::string& pattern,
+                              const SubscriptionContext* sc) {
+  // The final component is matched as a prefix by the publishers.
+  auto directories = pattern.substr(0, pattern.rfind('/') + 1);
+
+  auto* node = &root_;
+  for (const auto& component : getPathComponents(directories)) {
+    if (component.find("**") != std::string::npos) {
+      // A recursive wildcard may match any number of components.
+      break;
+    }
+
+    std::unique_ptr<Node>* child = nullptr;
+    if (component.find_first_of("*?[") == std::string::npos) {
+      child = &node->children[boost::algorithm::to_lower_copy(component)];
+    } else {
+      for (auto& existing : node->patterns) {
+        if (existing.first == component) {
+          child = &existing.second;
+          break;
+        }
+      }
+      if (child == nullptr) {
+        node->patterns.push_back(std::make_pair(component, nullptr));
+        child = &node->patterns.back().second;
+      }
+    }
+
+    if (*child == nullptr) {
+      child->reset(new Node());
+    }
+    node = child->get();
+  }
+  node->subscriptions.push_back(sc);
+  size_++;
+}
+
+void PathPatternIndex::match(
+    const std::string& path,
+    std::set<const SubscriptionContext*>& candidates) const {
+  // Each node is reached by a single parent, the walk visits it at most once.
+  std::vector<const Node*> nodes = {&root_};
+  std::vector<const Node*> next;
+  for (const auto& component : getPathComponents(path)) {
+    for (const auto* node : nodes) {
+      candidates.insert(node->subscriptions.begin(), node->subscriptions.end());
+    }
+
+    next.clear();
+    std::string lower;
+    for (const auto* node : nodes) {
+      if (!node->children.empty()) {
+        if (lower.empty()) {
+          lower = boost::algorithm::to_lower_copy(component);
+        }
+        auto child = node->children.find(lower);
+        if (child != node->children.end()) {
+          next.push_back(child->second.get());
+        }
+      }
+
+      for (const auto& pattern : node->patterns) {
+        if (fnmatch(pattern.first.c_str(), component.c_str(), FNM_CASEFOLD) ==
+            0) {
+          next.push_back(pattern.second.get());
+        }
+      }
+    }
+
+    nodes.swap(next);
+    if (nodes.empty()) {
+      return;
+    }
+  }
+
+  for (const auto* node : nodes) {
+    candidates.insert(node->subscriptions.begin(), node->subscriptions.end());
+  }
+}
+
+void PathPatternIndex::clear() {
+  root_.children.clear();
+  root_.patterns.clear();
+  root_.subscriptions.clear();
+  size_ = 0;
+}
+}
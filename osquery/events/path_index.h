@@ -0,0 +1,85 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief Subscriptions indexed by the directory components of their paths.
+ *
+ * File event publishers compare every fired path to every subscription
+ * path pattern. The index is built once when subscriptions are configured,
+ * then an event path is walked a component at a time to find the
+ * subscriptions that may match it.
+ *
+ * A subscription is added to the node reached by the directory components
+ * of its pattern, before the final component or a recursive wildcard.
+ * Literal components are found without case by lookup. Components with a
+ * wildcard are compared once per event for every subscription sharing
+ * them, so thousands of patterns below a wildcard directory, such as
+ * files in every user's home, cost a single comparison per event.
+ *
+ * The candidates are a superset of the matching subscriptions, publishers
+ * still apply the complete pattern to each candidate.
+ */
+class PathPatternIndex {
+ public:
+  /// Add a subscription for the directories of its path pattern.
+  void insert(const std::string& pattern, const SubscriptionContext* sc);
+
+  /// Add the subscriptions that may match an event path to the candidates.
+  void match(const std::string& path,
+             std::set<const SubscriptionContext*>& candidates) const;
+
+  /// Remove every subscription.
+  void clear();
+
+  /// Check if no subscriptions were added.
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  /// The number of added subscriptions.
+  size_t size() const {
+    return size_;
+  }
+
+ private:
+  struct Node {
+    /// Children by a lowercase literal component.
+    std::map<std::string, std::unique_ptr<Node>> children;
+
+    /// Children by a component containing a wildcard.
+    std::vector<std::pair<std::string, std::unique_ptr<Node>>> patterns;
+
+    /// Subscriptions whose directory components end at this node.
+    std::vector<const SubscriptionContext*> subscriptions;
+  };
+
+  /// The path root, with subscriptions to relative or wildcard roots.
+  Node root_;
+
+  /// The number of added subscriptions.
+  size_t size_{0};
+};
+
+/// Split a path into directory components, skipping empty components.
+std::vector<std::string> getPathComponents(const std::string& path);
+}
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+
+#include "osquery/events/event_forwarder.h"
+
+namespace osquery {
+
+class EventForwarderTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    calls = 0;
+    events.clear();
+  }
+
+ public:
+  /// The number of logger calls.
+  static size_t calls;
+
+  /// The forwarded events, in order.
+  static std::vector<std::string> events;
+};
+
+size_t EventForwarderTests::calls = 0;
+std::vector<std::string> EventForwarderTests::events;
+
+class ForwardTestLoggerPlugin : public LoggerPlugin {
+ protected:
+  bool usesLogEvent() override {
+    return true;
+  }
+
+  Status logEvents(const std::vector<std::string>& events) override {
+    EventForwarderTests::calls++;
+    for (const auto& event : events) {
+      EventForwarderTests::events.push_back(event);
+    }
+    return Status(0, "OK");
+  }
+
+  Status logString(const std::string& s) override {
+    return Status(0, "OK");
+  }
+
+  void init(const std::string& name,
+            const std::vector<StatusLogLine>& log) override {}
+};
+
+TEST_F(EventForwarderTests, test_forward_batches) {
+  Registry::add<ForwardTestLoggerPlugin>("logger", "forward_test");
+  EventForwarder forwarder({"forward_test"}, 8, 2, 0);
+  for (const auto& event : {"a", "b", "c", "d", "e"}) {
+    forwarder.push(event);
+  }
+  EXPECT_EQ(forwarder.size(), 5U);
+
+  // Each flush forwards at most one batch, in a single logger call.
+  EXPECT_EQ(forwarder.flush(), 2U);
+  EXPECT_EQ(calls, 1U);
+  EXPECT_EQ(forwarder.flush(), 2U);
+  EXPECT_EQ(forwarder.flush(), 1U);
+  EXPECT_EQ(forwarder.flush(), 0U);
+  EXPECT_EQ(calls, 3U);
+
+  std::vector<std::string> expected = {"a", "b", "c", "d", "e"};
+  EXPECT_EQ(events, expected);
+  EXPECT_EQ(forwarder.stats()["forward_test"].forwarded, 5U);
+}
+
+TEST_F(EventForwarderTests, test_forward_drop_oldest) {
+  Registry::add<ForwardTestLoggerPlugin>("logger", "forward_test");
+  EventForwarder forwarder({"forward_test"}, 2, 4, 0);
+  forwarder.push("a");
+  forwarder.push("b");
+  forwarder.push("c");
+  EXPECT_EQ(forwarder.size(), 2U);
+  EXPECT_EQ(forwarder.dropped(), 1U);
+
+  EXPECT_EQ(forwarder.flush(), 2U);
+  std::vector<std::string> expected = {"b", "c"};
+  EXPECT_EQ(events, expected);
+}
+
+TEST_F(EventForwarderTests, test_forward_rate_limit) {
+  Registry::add<ForwardTestLoggerPlugin>("logger", "forward_test");
+  EventForwarder forwarder({"forward_test"}, 8, 8, 2);
+  for (const auto& event : {"a", "b", "c", "d", "e"}) {
+    forwarder.push(event);
+  }
+
+  // The logger receives the oldest events allowed by its rate.
+  EXPECT_EQ(forwarder.flush(), 5U);
+  std::vector<std::string> expected = {"a", "b"};
+  EXPECT_EQ(events, expected);
+
+  auto stats = forwarder.stats()["forward_test"];
+  EXPECT_EQ(stats.forwarded, 2U);
+  EXPECT_EQ(stats.limited, 3U);
+  EXPECT_EQ(stats.failed, 0U);
+}
+}
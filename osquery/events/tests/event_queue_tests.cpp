@@ -0,0 +1,142 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <thread>
+
+#include <gtest/gtest.h>
+
+#include <osquery/events.h>
+
+#include "osquery/events/event_queue.h"
+
+namespace osquery {
+
+class EventQueueTests : public testing::Test {
+ protected:
+  /// Create an event context identified by an ID.
+  EventContextRef makeEvent(EventContextID id) {
+    auto ec = std::make_shared<EventContext>();
+    ec->id = id;
+    return ec;
+  }
+
+  void SetUp() override {
+    std::string name = "queue_test";
+    subscription_ = Subscription::create(name);
+  }
+
+ protected:
+  SubscriptionRef subscription_;
+};
+
+TEST_F(EventQueueTests, test_dispatch_policy_names) {
+  EventDispatchPolicy policy;
+  EXPECT_TRUE(getDispatchPolicy("drop_oldest", policy));
+  EXPECT_EQ(policy, DISPATCH_DROP_OLDEST);
+  EXPECT_TRUE(getDispatchPolicy("block", policy));
+  EXPECT_EQ(policy, DISPATCH_BLOCK);
+  EXPECT_TRUE(getDispatchPolicy("sample", policy));
+  EXPECT_EQ(policy, DISPATCH_SAMPLE);
+  EXPECT_FALSE(getDispatchPolicy("unknown", policy));
+}
+
+TEST_F(EventQueueTests, test_queue_order) {
+  // The capacity is rounded up to a power of 2.
+  EventDispatchQueue queue(3, DISPATCH_DROP_OLDEST);
+  EXPECT_EQ(queue.capacity(), 4U);
+
+  for (EventContextID i = 0; i < 4; i++) {
+    EXPECT_TRUE(queue.push(subscription_, makeEvent(i)));
+  }
+  EXPECT_EQ(queue.size(), 4U);
+
+  EventDispatchItem item;
+  for (EventContextID i = 0; i < 4; i++) {
+    ASSERT_TRUE(queue.pop(item));
+    EXPECT_EQ(item.ec->id, i);
+    EXPECT_EQ(item.subscription, subscription_);
+  }
+  EXPECT_FALSE(queue.pop(item));
+  EXPECT_EQ(queue.dropped(), 0U);
+}
+
+TEST_F(EventQueueTests, test_queue_drop_oldest) {
+  EventDispatchQueue queue(4, DISPATCH_DROP_OLDEST);
+  for (EventContextID i = 0; i < 6; i++) {
+    queue.push(subscription_, makeEvent(i));
+  }
+
+  // The two oldest events were dropped to make room.
+  EXPECT_EQ(queue.dropped(), 2U);
+  EventDispatchItem item;
+  ASSERT_TRUE(queue.pop(item));
+  EXPECT_EQ(item.ec->id, 2U);
+}
+
+TEST_F(EventQueueTests, test_queue_sample) {
+  EventDispatchQueue queue(4, DISPATCH_SAMPLE, 2);
+  for (EventContextID i = 0; i < 8; i++) {
+    queue.push(subscription_, makeEvent(i));
+  }
+
+  // Events are sampled above half capacity and dropped when full.
+  EXPECT_EQ(queue.size(), 4U);
+  EXPECT_EQ(queue.dropped(), 4U);
+}
+
+TEST_F(EventQueueTests, test_queue_block) {
+  EventDispatchQueue queue(2, DISPATCH_BLOCK);
+  queue.push(subscription_, makeEvent(0));
+  queue.push(subscription_, makeEvent(1));
+
+  // The publisher waits until the consumer makes room.
+  std::thread consumer([&queue]() {
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    EventDispatchItem item;
+    queue.pop(item);
+  });
+  EXPECT_TRUE(queue.push(subscription_, makeEvent(2)));
+  consumer.join();
+  EXPECT_EQ(queue.dropped(), 0U);
+
+  // A stopping queue no longer blocks.
+  queue.stop();
+  EXPECT_FALSE(queue.push(subscription_, makeEvent(3)));
+  EXPECT_EQ(queue.dropped(), 1U);
+}
+
+TEST_F(EventQueueTests, test_queue_concurrent_producers) {
+  EventDispatchQueue queue(1024, DISPATCH_BLOCK);
+  std::vector<std::thread> producers;
+  for (size_t p = 0; p < 4; p++) {
+    producers.emplace_back([this, &queue]() {
+      for (EventContextID i = 0; i < 1000; i++) {
+        queue.push(subscription_, makeEvent(i));
+      }
+    });
+  }
+
+  size_t consumed = 0;
+  EventDispatchItem item;
+  while (consumed < 4000) {
+    if (queue.pop(item)) {
+      consumed++;
+    } else {
+      queue.wait(std::chrono::milliseconds(10));
+    }
+  }
+
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  EXPECT_EQ(queue.dropped(), 0U);
+  EXPECT_FALSE(queue.pop(item));
+}
+}
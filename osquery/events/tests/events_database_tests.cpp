@@ -132,6 +132,22 @@ TEST_F(EventsDatabaseTests, test_record_range) {
   EXPECT_EQ(records.size(), 8U);
 }
 
+TEST_F(EventsDatabaseTests, test_time_records) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+
+  // The finest bins covering 0-10 hold 1, 2 and 11.
+  auto records = sub->getTimeRecords(0, 10);
+  EXPECT_EQ(records.size(), 3U);
+
+  // Bins are ordered by time, not by their string representation.
+  records = sub->getTimeRecords(3600, 7209);
+  EXPECT_EQ(records.size(), 2U); // 3601, 7201
+
+  // Get all of the records.
+  records = sub->getTimeRecords(0, -1);
+  EXPECT_EQ(records.size(), 8U);
+}
+
 TEST_F(EventsDatabaseTests, test_record_expiration) {
   auto sub = std::make_shared<DBFakeEventSubscriber>();
 
@@ -253,7 +269,7 @@ TEST_F(EventsDatabaseTests, test_expire_check) {
 
       // Records hold the event_id + time indexes.
       // Data hosts the event_id + JSON content.
-      auto record_key = "records." + sub->dbNamespace();
+      auto record_key = "log." + sub->dbNamespace();
       auto data_key = "data." + sub->dbNamespace();
 
       std::vector<std::string> records, datas;
@@ -265,4 +281,280 @@ TEST_F(EventsDatabaseTests, test_expire_check) {
     }
   }
 }
+
+class DBBatchEventSubscriber : public DBFakeEventSubscriber {
+ public:
+  DBBatchEventSubscriber() { setName("DBBatchSubscriber"); }
+
+ private:
+  size_t getEventsBatchSize() override { return 3; }
+};
+
+TEST_F(EventsDatabaseTests, test_event_batching) {
+  auto sub = std::make_shared<DBBatchEventSubscriber>();
+  auto data_key = "data." + sub->dbNamespace();
+
+  // Events are buffered until the batch size is reached.
+  sub->testAdd(100);
+  sub->testAdd(101);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, data_key);
+  EXPECT_EQ(keys.size(), 0U);
+  EXPECT_EQ(sub->batch_.size(), 2U);
+
+  sub->testAdd(102);
+  scanDatabaseKeys(kEvents, keys, data_key);
+  EXPECT_EQ(keys.size(), 3U);
+  EXPECT_TRUE(sub->batch_.empty());
+
+  // The EventID is checkpointed with the batch.
+  std::string content;
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), content);
+  EXPECT_EQ(content, "3");
+
+  // Retrieving events writes the buffered events first.
+  sub->testAdd(103);
+  EXPECT_EQ(sub->batch_.size(), 1U);
+  auto results = sub->get(0, 0);
+  EXPECT_EQ(results.size(), 4U);
+  EXPECT_TRUE(sub->batch_.empty());
+}
+
+class DBIndexedEventSubscriber : public DBFakeEventSubscriber {
+ public:
+  DBIndexedEventSubscriber() { setName("DBIndexedSubscriber"); }
+
+  /// Add a fake event with a path at time t.
+  Status testAddPath(int t, const std::string& path) {
+    Row r;
+    r["path"] = path;
+    r["time"] = INTEGER(t);
+    return add(r, t);
+  }
+
+ private:
+  std::set<std::string> getIndexedColumns() override { return {"path"}; }
+};
+
+TEST_F(EventsDatabaseTests, test_column_indexes) {
+  auto sub = std::make_shared<DBIndexedEventSubscriber>();
+  sub->doNotExpire();
+
+  sub->testAddPath(100, "/usr/bin/curl");
+  sub->testAddPath(101, "/usr/bin/wget");
+  sub->testAddPath(3700, "/usr/bin/CURL");
+  sub->testAddPath(3701, "/bin/ls");
+
+  // An EQUALS constraint reads the matching events from every bin.
+  QueryContext context;
+  context.constraints["path"].add(Constraint(EQUALS, "/usr/bin/curl"));
+  std::vector<EventRecord> records;
+  EXPECT_TRUE(sub->getColumnRecords(context, 0, -1, records));
+  EXPECT_EQ(records.size(), 2U);
+
+  // The bins are limited by the time range.
+  records.clear();
+  EXPECT_TRUE(sub->getColumnRecords(context, 3600, -1, records));
+  EXPECT_EQ(records.size(), 1U);
+
+  // A LIKE prefix scans the matching values.
+  QueryContext like_context;
+  like_context.constraints["path"].add(Constraint(LIKE, "/usr/bin/%"));
+  auto results = sub->genTable(like_context);
+  EXPECT_EQ(results.size(), 3U);
+
+  // Constraints without a literal prefix cannot use the index.
+  QueryContext any_context;
+  any_context.constraints["path"].add(Constraint(LIKE, "%curl"));
+  records.clear();
+  EXPECT_FALSE(sub->getColumnRecords(any_context, 0, -1, records));
+  results = sub->genTable(any_context);
+  EXPECT_EQ(results.size(), 4U);
+}
+
+TEST_F(EventsDatabaseTests, test_row_encoding) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setRowSchema({"path", "pid", "time"});
+
+  Row r = {{"path", "/usr/bin/curl"}, {"pid", "100"}, {"extra", "value"}};
+  std::string data;
+  ASSERT_TRUE(sub->encodeRow(r, data).ok());
+  EXPECT_EQ(data[0], '\x01');
+
+  Row decoded;
+  ASSERT_TRUE(sub->decodeRow(data, decoded).ok());
+  EXPECT_EQ(decoded, r);
+
+  // Rows encoded with a previous schema remain readable.
+  sub->setRowSchema({"time", "pid", "path"});
+  decoded.clear();
+  ASSERT_TRUE(sub->decodeRow(data, decoded).ok());
+  EXPECT_EQ(decoded, r);
+
+  // Rows stored as JSON are also accepted.
+  std::string json;
+  serializeRowJSON(r, json);
+  decoded.clear();
+  ASSERT_TRUE(sub->decodeRow(json, decoded).ok());
+  EXPECT_EQ(decoded, r);
+
+  // A truncated row is an error.
+  decoded.clear();
+  EXPECT_FALSE(sub->decodeRow(data.substr(0, data.size() - 1), decoded).ok());
+}
+
+class DBExpiryEventSubscriber : public DBFakeEventSubscriber {
+ public:
+  DBExpiryEventSubscriber() { setName("DBExpirySubscriber"); }
+
+ private:
+  size_t getEventsExpiry() override { return 0; }
+  size_t getEventsMax() override { return 1000; }
+};
+
+TEST_F(EventsDatabaseTests, test_incremental_expiry) {
+  auto sub = std::make_shared<DBExpiryEventSubscriber>();
+  for (const auto& t : {100, 101, 105, 111, 125, 131}) {
+    sub->testAdd(t);
+  }
+
+  // The first pass expires a whole bin, even if it exceeds the budget.
+  sub->expire_time_ = 125;
+  EXPECT_EQ(sub->expireEvents(2), 3U);
+
+  auto data_key = "data." + sub->dbNamespace();
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, data_key);
+  EXPECT_EQ(keys.size(), 3U);
+
+  std::string indexes;
+  getDatabaseValue(kEvents, "indexes." + sub->dbNamespace() + ".10", indexes);
+  EXPECT_EQ(indexes, "11,12,13");
+
+  // The next pass expires the remaining bins then the partially-expired bin.
+  EXPECT_EQ(sub->expireEvents(10), 1U);
+  keys.clear();
+  scanDatabaseKeys(kEvents, keys, data_key);
+  EXPECT_EQ(keys.size(), 1U);
+
+  auto results = sub->get(0, 0);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["time"], "131");
+}
+
+TEST_F(EventsDatabaseTests, test_forward_only) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBForwardSubscriber");
+  sub->forward_only_ = true;
+  EXPECT_TRUE(sub->isForwardOnly());
+
+  EXPECT_TRUE(sub->testAdd(100).ok());
+  EXPECT_TRUE(sub->testAdd(101).ok());
+  EXPECT_EQ(sub->numEvents(), 2U);
+
+  // No event data, EventID, or record is written.
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "data." + sub->dbNamespace());
+  EXPECT_EQ(keys.size(), 0U);
+  std::string content;
+  getDatabaseValue(kEvents, "eid." + sub->dbNamespace(), content);
+  EXPECT_TRUE(content.empty());
+
+  QueryContext context;
+  EXPECT_TRUE(sub->genTable(context).empty());
+}
+
+TEST_F(EventsDatabaseTests, test_event_cursors) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBCursorSubscriber");
+  auto default_type = kToolType;
+  kToolType = ToolType::DAEMON;
+
+  auto now = getUnixTime();
+  sub->testAdd(now);
+  sub->testAdd(now);
+  QueryContext context;
+  {
+    EventCursorScope cursors("cursor_a");
+    EXPECT_EQ(sub->genTable(context).size(), 2U);
+    // Reads within the same run begin at the same cursor.
+    EXPECT_EQ(sub->genTable(context).size(), 2U);
+    cursors.commit();
+  }
+
+  // Events within the same second are returned once.
+  sub->testAdd(now);
+  {
+    EventCursorScope cursors("cursor_a");
+    EXPECT_EQ(sub->genTable(context).size(), 1U);
+    cursors.commit();
+  }
+
+  // Another query has its own cursor.
+  {
+    EventCursorScope cursors("cursor_b");
+    EXPECT_EQ(sub->genTable(context).size(), 3U);
+    cursors.commit();
+  }
+
+  // A run that is not committed is read again.
+  sub->testAdd(now);
+  {
+    EventCursorScope cursors("cursor_a");
+    EXPECT_EQ(sub->genTable(context).size(), 1U);
+  }
+  {
+    EventCursorScope cursors("cursor_a");
+    EXPECT_EQ(sub->genTable(context).size(), 1U);
+    cursors.commit();
+  }
+  {
+    EventCursorScope cursors("cursor_a");
+    EXPECT_TRUE(sub->genTable(context).empty());
+  }
+  EXPECT_EQ(EventCursorScope::current(), nullptr);
+  kToolType = default_type;
+
+  // The EventID log expires with the events.
+  sub->expire_time_ = now + 1;
+  sub->expireEvents(100);
+  std::vector<std::string> keys;
+  scanDatabaseKeys(kEvents, keys, "eids." + sub->dbNamespace());
+  EXPECT_TRUE(keys.empty());
+}
+
+TEST_F(EventsDatabaseTests, test_event_order) {
+  auto sub = std::make_shared<DBFakeEventSubscriber>();
+  sub->setName("DBOrderSubscriber");
+  auto now = getUnixTime();
+  sub->testAdd(now - 3);
+  sub->testAdd(now - 1);
+  sub->testAdd(now - 2);
+
+  QueryContext context;
+  context.order = RowOrder::TIME_DESCENDING;
+  auto results = sub->genTable(context);
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["time"], std::to_string(now - 1));
+  EXPECT_EQ(results[1]["time"], std::to_string(now - 2));
+  EXPECT_EQ(results[2]["time"], std::to_string(now - 3));
+
+  // The first batch of an ordered scan is sized to the LIMIT hint.
+  context.limit = 1;
+  auto generator = EventSubscriberPlugin::genTableRows(sub, context);
+  QueryData batch;
+  ASSERT_TRUE(generator->next(batch));
+  ASSERT_EQ(batch.size(), 1U);
+  EXPECT_EQ(batch[0]["time"], std::to_string(now - 1));
+  batch.clear();
+  ASSERT_TRUE(generator->next(batch));
+  EXPECT_EQ(batch.size(), 2U);
+  batch.clear();
+  EXPECT_FALSE(generator->next(batch));
+
+  context.order = RowOrder::TIME_ASCENDING;
+  results = sub->genTable(context);
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["time"], std::to_string(now - 3));
+}
 }
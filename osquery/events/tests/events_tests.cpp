@@ -397,6 +397,134 @@ TEST_F(EventsTests, test_fire_event) {
   EXPECT_EQ(kBellHathTolled, 4);
 }
 
+/// A publisher using the required value as the dispatch key, 0 is any key.
+class KeyedEventPublisher
+    : public EventPublisher<FakeSubscriptionContext, FakeEventContext> {
+  DECLARE_PUBLISHER("KeyedPublisher");
+
+ public:
+  /// The subscription values shouldFire was called for, in order.
+  mutable std::vector<int> checked;
+
+ private:
+  bool shouldFire(const SCRef& sc, const ECRef& ec) const override {
+    checked.push_back(sc->require_this_value);
+    return true;
+  }
+
+  bool subscriptionKeys(const SCRef& sc, DispatchKeys& keys) const override {
+    if (sc->require_this_value == 0) {
+      return false;
+    }
+    keys.push_back(sc->require_this_value);
+    return true;
+  }
+
+  bool eventKeys(const ECRef& ec, DispatchKeys& keys) const override {
+    if (ec->required_value < 0) {
+      return false;
+    }
+    keys.push_back(ec->required_value);
+    // A value above 10 also carries the key of its last digit.
+    if (ec->required_value > 10) {
+      keys.push_back(ec->required_value % 10);
+    }
+    return true;
+  }
+
+ private:
+  FRIEND_TEST(EventsTests, test_fire_event_keys);
+};
+
+class KeyedEventSubscriber : public EventSubscriber<KeyedEventPublisher> {
+ public:
+  KeyedEventSubscriber() { setName("KeyedSubscriber"); }
+
+  Status Callback(const ECRef& ec, const SCRef& sc) { return Status(0, "OK"); }
+
+  void subscribeValue(int value) {
+    auto sc = createSubscriptionContext();
+    sc->require_this_value = value;
+    subscribe(&KeyedEventSubscriber::Callback, sc);
+  }
+};
+
+TEST_F(EventsTests, test_fire_event_keys) {
+  auto pub = std::make_shared<KeyedEventPublisher>();
+  EventFactory::registerEventPublisher(pub);
+  auto sub = std::make_shared<KeyedEventSubscriber>();
+  EventFactory::registerEventSubscriber(sub);
+  for (const auto& value : {1, 0, 2, 3, 2}) {
+    sub->subscribeValue(value);
+  }
+
+  // Only the subscriptions with the key, and for any key, are checked.
+  auto ec = pub->createEventContext();
+  ec->required_value = 2;
+  pub->fire(ec, 0);
+  EXPECT_EQ(pub->checked, std::vector<int>({0, 2, 2}));
+
+  // An unknown key is only checked by the subscriptions for any key.
+  pub->checked.clear();
+  ec->required_value = 7;
+  pub->fire(ec, 0);
+  EXPECT_EQ(pub->checked, std::vector<int>({0}));
+
+  // Several keys are checked in subscription order.
+  pub->checked.clear();
+  ec->required_value = 13;
+  pub->fire(ec, 0);
+  EXPECT_EQ(pub->checked, std::vector<int>({0, 3}));
+
+  // An event without keys checks every subscription.
+  pub->checked.clear();
+  ec->required_value = -1;
+  pub->fire(ec, 0);
+  EXPECT_EQ(pub->checked, std::vector<int>({1, 0, 2, 3, 2}));
+
+  // The index follows added subscriptions.
+  sub->subscribeValue(7);
+  pub->checked.clear();
+  ec->required_value = 7;
+  pub->fire(ec, 0);
+  EXPECT_EQ(pub->checked, std::vector<int>({0, 7}));
+}
+
+struct PooledEventContext : public EventContext {
+  std::string path;
+
+  void recycle() {
+    path.clear();
+  }
+};
+
+using PooledEventPublisher =
+    EventPublisher<SubscriptionContext, PooledEventContext>;
+
+TEST_F(EventsTests, test_event_context_pool) {
+  auto ec = PooledEventPublisher::createEventContext();
+  ec->id = 5;
+  ec->path = "/tmp/osquery-pooled";
+  auto released = ec.get();
+
+  // A context is not reused while it is referenced.
+  auto held = ec;
+  ec = nullptr;
+  auto other = PooledEventPublisher::createEventContext();
+  EXPECT_NE(other.get(), released);
+
+  // Once released it is recycled and reused.
+  held = nullptr;
+  ec = PooledEventPublisher::createEventContext();
+  EXPECT_EQ(ec.get(), released);
+  EXPECT_EQ(ec->id, 0U);
+  EXPECT_TRUE(ec->path.empty());
+
+  // Contexts without a recycle method are allocated for each event.
+  auto fake = FakeEventPublisher::createEventContext();
+  EXPECT_NE(fake, nullptr);
+}
+
 class SubFakeEventSubscriber : public FakeEventSubscriber {
  public:
   SubFakeEventSubscriber() { setName("SubFakeSubscriber"); }
@@ -0,0 +1,470 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+// clang-format off
+#include "osquery/events/windows/etw.h"
+// clang-format on
+
+#include <Sddl.h>
+#include <WS2tcpip.h>
+
+#include <algorithm>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+
+namespace osquery {
+
+FLAG(bool,
+     disable_etw,
+     true,
+     "Disable receiving events from the NT Kernel Logger ETW session");
+
+FLAG(uint64,
+     etw_buffer_size,
+     1024,
+     "Size in KB of each kernel logger session buffer (default 1024)");
+
+FLAG(uint64,
+     etw_buffers,
+     64,
+     "Maximum number of kernel logger session buffers (default 64)");
+
+REGISTER(ETWEventPublisher, "event_publisher", "etw");
+
+ETWEventPublisher* ETWEventPublisher::instance_{nullptr};
+
+/// The kernel logger session controller, SystemTraceControlGuid.
+static const GUID kSystemTraceControlGuid = {
+    0x9e814aad,
+    0x3204,
+    0x11d2,
+    {0x9a, 0x82, 0x00, 0x60, 0x08, 0xa8, 0x69, 0x39}};
+
+/// The kernel event classes, the provider id of each event record.
+static const GUID kProcessGuid = {
+    0x3d6fa8d0,
+    0xfe05,
+    0x11d0,
+    {0x9d, 0xda, 0x00, 0xc0, 0x4f, 0xd7, 0xba, 0x7c}};
+
+static const GUID kTcpIpGuid = {
+    0x9a280ac0,
+    0xc8e0,
+    0x11d1,
+    {0x84, 0xe2, 0x00, 0xc0, 0x4f, 0xb9, 0x98, 0xa2}};
+
+/// The session name, OpenTrace requires a mutable string.
+static wchar_t kKernelLoggerName[] = KERNEL_LOGGER_NAMEW;
+
+/// The offset of 1601-01-01 from 1970-01-01 in 100ns intervals.
+const LONGLONG kFileTimeUnixEpoch = 116444736000000000LL;
+
+/// The kernel logger flushes buffers to the consumer at least this often.
+const ULONG kETWFlushTimer = 1;
+
+static std::string wideToString(const wchar_t* input, size_t size) {
+  if (size == 0) {
+    return "";
+  }
+
+  auto length = ::WideCharToMultiByte(CP_UTF8,
+                                      0,
+                                      input,
+                                      static_cast<int>(size),
+                                      nullptr,
+                                      0,
+                                      nullptr,
+                                      nullptr);
+  std::string output(static_cast<size_t>(std::max(length, 0)), '\0');
+  if (length > 0) {
+    ::WideCharToMultiByte(CP_UTF8,
+                          0,
+                          input,
+                          static_cast<int>(size),
+                          &output[0],
+                          length,
+                          nullptr,
+                          nullptr);
+  }
+  return output;
+}
+
+size_t ETWEventPublisher::toUnixTime(LONGLONG timestamp) {
+  if (timestamp < kFileTimeUnixEpoch) {
+    return 0;
+  }
+  return static_cast<size_t>((timestamp - kFileTimeUnixEpoch) / 10000000LL);
+}
+
+Status ETWEventPublisher::setUp() {
+  if (FLAGS_disable_etw) {
+    return Status(1, "Publisher disabled via configuration");
+  }
+
+  instance_ = this;
+  return Status(0, "OK");
+}
+
+ULONG ETWEventPublisher::getEnableFlags() {
+  ULONG flags = 0;
+  for (const auto& sub : subscriptions_) {
+    auto sc = getSubscriptionContext(sub->context);
+    if (sc->type == ETWEventClass::PROCESS) {
+      flags |= EVENT_TRACE_FLAG_PROCESS;
+    } else if (sc->type == ETWEventClass::TCPIP) {
+      flags |= EVENT_TRACE_FLAG_NETWORK_TCPIP;
+    }
+  }
+  return flags;
+}
+
+void ETWEventPublisher::configure() {
+  auto flags = getEnableFlags();
+  if (flags != flags_ && session_ != 0) {
+    // The consumer in run returns and starts a session with the new flags.
+    restart_ = true;
+    stopSession();
+  }
+}
+
+Status ETWEventPublisher::startSession(ULONG flags) {
+  std::vector<char> buffer(sizeof(EVENT_TRACE_PROPERTIES) +
+                           sizeof(kKernelLoggerName));
+  auto properties = reinterpret_cast<EVENT_TRACE_PROPERTIES*>(buffer.data());
+  auto initialize = [&buffer, properties, flags]() {
+    memset(buffer.data(), 0, buffer.size());
+    properties->Wnode.BufferSize = static_cast<ULONG>(buffer.size());
+    properties->Wnode.Flags = WNODE_FLAG_TRACED_GUID;
+    // Timestamps are system time, 100ns intervals since 1601.
+    properties->Wnode.ClientContext = 2;
+    properties->Wnode.Guid = kSystemTraceControlGuid;
+    properties->BufferSize = static_cast<ULONG>(FLAGS_etw_buffer_size);
+    properties->MaximumBuffers = static_cast<ULONG>(FLAGS_etw_buffers);
+    properties->MinimumBuffers = properties->MaximumBuffers / 2;
+    properties->FlushTimer = kETWFlushTimer;
+    properties->LogFileMode = EVENT_TRACE_REAL_TIME_MODE;
+    properties->EnableFlags = flags;
+    properties->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+  };
+
+  initialize();
+  auto result = ::StartTraceW(&session_, kKernelLoggerName, properties);
+  if (result == ERROR_ALREADY_EXISTS) {
+    // Only one kernel logger session may exist, replace the existing one.
+    VLOG(1) << "Stopping an existing NT Kernel Logger session";
+    ::ControlTraceW(0, kKernelLoggerName, properties, EVENT_TRACE_CONTROL_STOP);
+    initialize();
+    result = ::StartTraceW(&session_, kKernelLoggerName, properties);
+  }
+
+  if (result != ERROR_SUCCESS) {
+    session_ = 0;
+    return Status(1, "Cannot start kernel logger: " + std::to_string(result));
+  }
+
+  EVENT_TRACE_LOGFILEW logfile;
+  memset(&logfile, 0, sizeof(logfile));
+  logfile.LoggerName = kKernelLoggerName;
+  logfile.ProcessTraceMode =
+      PROCESS_TRACE_MODE_REAL_TIME | PROCESS_TRACE_MODE_EVENT_RECORD;
+  logfile.EventRecordCallback = ETWEventPublisher::eventCallback;
+  consumer_ = ::OpenTraceW(&logfile);
+  if (consumer_ == INVALID_PROCESSTRACE_HANDLE) {
+    stopSession();
+    return Status(1, "Cannot open the kernel logger session");
+  }
+
+  flags_ = flags;
+  restart_ = false;
+  return Status(0, "OK");
+}
+
+void ETWEventPublisher::stopSession() {
+  if (consumer_ != INVALID_PROCESSTRACE_HANDLE) {
+    ::CloseTrace(consumer_);
+    consumer_ = INVALID_PROCESSTRACE_HANDLE;
+  }
+
+  if (session_ != 0) {
+    std::vector<char> buffer(sizeof(EVENT_TRACE_PROPERTIES) +
+                             sizeof(kKernelLoggerName));
+    auto properties = reinterpret_cast<EVENT_TRACE_PROPERTIES*>(buffer.data());
+    properties->Wnode.BufferSize = static_cast<ULONG>(buffer.size());
+    properties->LoggerNameOffset = sizeof(EVENT_TRACE_PROPERTIES);
+    ::ControlTraceW(session_, nullptr, properties, EVENT_TRACE_CONTROL_STOP);
+    session_ = 0;
+  }
+  flags_ = 0;
+}
+
+Status ETWEventPublisher::run() {
+  auto flags = getEnableFlags();
+  if (flags == 0) {
+    // There are no subscriptions, the session is not started.
+    pause();
+    return Status(0, "OK");
+  }
+
+  if (session_ == 0 || restart_ || flags != flags_) {
+    stopSession();
+    auto status = startSession(flags);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  // Events are delivered to the callback until the session is stopped.
+  auto consumer = consumer_;
+  auto result = ::ProcessTrace(&consumer, 1, nullptr, nullptr);
+  if (result != ERROR_SUCCESS && result != ERROR_CANCELLED &&
+      !restart_ && !isEnding()) {
+    VLOG(1) << "Kernel logger consumer ended: " << result;
+    stopSession();
+    pause();
+  }
+  return Status(0, "OK");
+}
+
+void ETWEventPublisher::stop() {
+  stopSession();
+}
+
+void ETWEventPublisher::tearDown() {
+  stopSession();
+  schemas_.clear();
+  instance_ = nullptr;
+}
+
+VOID WINAPI ETWEventPublisher::eventCallback(PEVENT_RECORD record) {
+  auto publisher = instance_;
+  if (publisher != nullptr) {
+    publisher->handleEvent(record);
+  }
+}
+
+const TRACE_EVENT_INFO* ETWEventPublisher::getSchema(PEVENT_RECORD record) {
+  // Schemas are only read by the consumer thread.
+  const auto& header = record->EventHeader;
+  std::string key(reinterpret_cast<const char*>(&header.ProviderId),
+                  sizeof(GUID));
+  key += static_cast<char>(header.EventDescriptor.Opcode);
+  key += static_cast<char>(header.EventDescriptor.Version);
+  key += (header.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) ? '4' : '8';
+
+  auto it = schemas_.find(key);
+  if (it == schemas_.end()) {
+    std::vector<char> schema;
+    ULONG size = 0;
+    auto result = ::TdhGetEventInformation(record, 0, nullptr, nullptr, &size);
+    if (result == ERROR_INSUFFICIENT_BUFFER) {
+      schema.resize(size);
+      result = ::TdhGetEventInformation(
+          record,
+          0,
+          nullptr,
+          reinterpret_cast<PTRACE_EVENT_INFO>(schema.data()),
+          &size);
+    }
+    if (result != ERROR_SUCCESS) {
+      schema.clear();
+    }
+    it = schemas_.emplace(std::move(key), std::move(schema)).first;
+  }
+
+  if (it->second.empty()) {
+    return nullptr;
+  }
+  return reinterpret_cast<const TRACE_EVENT_INFO*>(it->second.data());
+}
+
+void ETWEventPublisher::decodeProperties(
+    PEVENT_RECORD record,
+    const TRACE_EVENT_INFO* info,
+    std::map<std::string, std::string>& data) {
+  auto base = reinterpret_cast<const char*>(info);
+  auto input = static_cast<const char*>(record->UserData);
+  auto end = input + record->UserDataLength;
+  size_t pointer_size =
+      (record->EventHeader.Flags & EVENT_HEADER_FLAG_32_BIT_HEADER) ? 4 : 8;
+
+  auto unsigned_value = [](const char* value, size_t size) -> ULONGLONG {
+    ULONGLONG output = 0;
+    memcpy(&output, value, size);
+    return output;
+  };
+
+  for (ULONG i = 0; i < info->TopLevelPropertyCount && input < end; i++) {
+    const auto& property = info->EventPropertyInfoArray[i];
+    if ((property.Flags & (PropertyStruct | PropertyParamCount)) != 0 ||
+        property.count > 1) {
+      // Structures and arrays are not decoded, nor is anything after them.
+      break;
+    }
+
+    auto name = wideToString(
+        reinterpret_cast<const wchar_t*>(base + property.NameOffset),
+        wcslen(reinterpret_cast<const wchar_t*>(base + property.NameOffset)));
+    auto in_type = property.nonStructType.InType;
+    auto out_type = property.nonStructType.OutType;
+    auto remaining = static_cast<size_t>(end - input);
+
+    size_t size = 0;
+    std::string value;
+    switch (in_type) {
+    case TDH_INTYPE_INT8:
+    case TDH_INTYPE_UINT8:
+      size = 1;
+      break;
+    case TDH_INTYPE_INT16:
+    case TDH_INTYPE_UINT16:
+      size = 2;
+      break;
+    case TDH_INTYPE_INT32:
+    case TDH_INTYPE_UINT32:
+    case TDH_INTYPE_HEXINT32:
+    case TDH_INTYPE_BOOLEAN:
+      size = 4;
+      break;
+    case TDH_INTYPE_INT64:
+    case TDH_INTYPE_UINT64:
+    case TDH_INTYPE_HEXINT64:
+      size = 8;
+      break;
+    case TDH_INTYPE_POINTER:
+    case TDH_INTYPE_SIZET:
+      size = pointer_size;
+      break;
+    case TDH_INTYPE_UNICODESTRING: {
+      auto chars = reinterpret_cast<const wchar_t*>(input);
+      auto limit = remaining / sizeof(wchar_t);
+      size_t length = 0;
+      while (length < limit && chars[length] != L'\0') {
+        length++;
+      }
+      value = wideToString(chars, length);
+      size = std::min((length + 1) * sizeof(wchar_t), remaining);
+      break;
+    }
+    case TDH_INTYPE_ANSISTRING: {
+      size_t length = 0;
+      while (length < remaining && input[length] != '\0') {
+        length++;
+      }
+      value.assign(input, length);
+      size = std::min(length + 1, remaining);
+      break;
+    }
+    case TDH_INTYPE_SID:
+    case TDH_INTYPE_WBEMSID: {
+      // A WBEM SID is preceded by a TOKEN_USER structure.
+      auto offset = (in_type == TDH_INTYPE_WBEMSID) ? 2 * pointer_size : 0;
+      if (remaining <= offset + 8) {
+        return;
+      }
+      auto sid = const_cast<char*>(input + offset);
+      if (!::IsValidSid(sid)) {
+        return;
+      }
+      size = offset + ::GetLengthSid(sid);
+      char* sid_string = nullptr;
+      if (::ConvertSidToStringSidA(sid, &sid_string)) {
+        value = sid_string;
+        ::LocalFree(sid_string);
+      }
+      break;
+    }
+    case TDH_INTYPE_BINARY:
+      size = property.length;
+      if (out_type == TDH_OUTTYPE_IPV6 && size == 16 && remaining >= 16) {
+        char address[INET6_ADDRSTRLEN] = {0};
+        ::InetNtopA(
+            AF_INET6, const_cast<char*>(input), address, sizeof(address));
+        value = address;
+      }
+      break;
+    default:
+      // The size of the remaining properties is unknown.
+      return;
+    }
+
+    if (size == 0 || size > remaining) {
+      return;
+    }
+
+    if (value.empty() && size <= 8 && in_type != TDH_INTYPE_BINARY &&
+        in_type != TDH_INTYPE_UNICODESTRING &&
+        in_type != TDH_INTYPE_ANSISTRING) {
+      auto number = unsigned_value(input, size);
+      if (out_type == TDH_OUTTYPE_IPV4 && size == 4) {
+        char address[INET_ADDRSTRLEN] = {0};
+        ::InetNtopA(AF_INET, &number, address, sizeof(address));
+        value = address;
+      } else if (out_type == TDH_OUTTYPE_PORT && size == 2) {
+        value = std::to_string(::ntohs(static_cast<u_short>(number)));
+      } else if (in_type == TDH_INTYPE_INT8 || in_type == TDH_INTYPE_INT16 ||
+                 in_type == TDH_INTYPE_INT32 || in_type == TDH_INTYPE_INT64) {
+        // Sign extend from the property size.
+        auto shift = static_cast<int>(64 - size * 8);
+        value = std::to_string(
+            static_cast<LONGLONG>(number << shift) >> shift);
+      } else {
+        value = std::to_string(number);
+      }
+    }
+
+    data[name] = std::move(value);
+    input += size;
+  }
+}
+
+void ETWEventPublisher::handleEvent(PEVENT_RECORD record) {
+  const auto& header = record->EventHeader;
+  auto ec = createEventContext();
+  if (IsEqualGUID(header.ProviderId, kProcessGuid)) {
+    ec->type = ETWEventClass::PROCESS;
+  } else if (IsEqualGUID(header.ProviderId, kTcpIpGuid)) {
+    ec->type = ETWEventClass::TCPIP;
+  } else {
+    // Session metadata and classes enabled as dependencies are ignored.
+    return;
+  }
+
+  ec->opcode = header.EventDescriptor.Opcode;
+  ec->pid = header.ProcessId;
+  ec->timestamp = toUnixTime(header.TimeStamp.QuadPart);
+
+  // Check subscriptions before the properties are decoded.
+  bool subscribed = false;
+  for (const auto& sub : subscriptions_) {
+    if (shouldFire(getSubscriptionContext(sub->context), ec)) {
+      subscribed = true;
+      break;
+    }
+  }
+  if (!subscribed) {
+    return;
+  }
+
+  auto info = getSchema(record);
+  if (info != nullptr) {
+    decodeProperties(record, info, ec->data);
+  }
+  fire(ec, ec->timestamp);
+}
+
+bool ETWEventPublisher::shouldFire(const ETWSubscriptionContextRef& sc,
+                                   const ETWEventContextRef& ec) const {
+  if (sc->type != ec->type) {
+    return false;
+  }
+  return sc->opcodes.empty() || sc->opcodes.count(ec->opcode) > 0;
+}
+}
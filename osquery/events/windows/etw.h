@@ -0,0 +1,183 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+
+#include <evntcons.h>
+#include <evntrace.h>
+#include <tdh.h>
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <osquery/events.h>
+
+namespace osquery {
+
+/**
+ * @brief The kernel logger event classes a subscription may request.
+ *
+ * Each class is enabled in the kernel logger session only while a
+ * subscriber requests it.
+ */
+enum class ETWEventClass {
+  PROCESS,
+  TCPIP,
+};
+
+/// Process class opcodes.
+#define ETW_PROCESS_START 1
+#define ETW_PROCESS_END 2
+
+/// TcpIp class opcodes, IPv6 events are offset by 16.
+#define ETW_TCPIP_CONNECT 12
+#define ETW_TCPIP_DISCONNECT 13
+#define ETW_TCPIP_ACCEPT 15
+#define ETW_TCPIP_IPV6 16
+
+struct ETWSubscriptionContext : public SubscriptionContext {
+  /// The kernel event class.
+  ETWEventClass type{ETWEventClass::PROCESS};
+
+  /// The opcodes to fire, empty fires every opcode of the class.
+  std::set<unsigned char> opcodes;
+
+ private:
+  friend class ETWEventPublisher;
+};
+
+struct ETWEventContext : public EventContext {
+  /// The kernel event class.
+  ETWEventClass type{ETWEventClass::PROCESS};
+
+  /// The event's opcode within its class.
+  unsigned char opcode{0};
+
+  /// The process id from the event header, kernel events may not set it.
+  unsigned long pid{0};
+
+  /// The UNIX time of the event.
+  size_t timestamp{0};
+
+  /**
+   * @brief The event properties decoded with the TDH schema.
+   *
+   * Integers are formatted as decimal, IP addresses and ports as text, SIDs
+   * as strings, and strings as UTF-8.
+   */
+  std::map<std::string, std::string> data;
+};
+
+using ETWEventContextRef = std::shared_ptr<ETWEventContext>;
+using ETWSubscriptionContextRef = std::shared_ptr<ETWSubscriptionContext>;
+
+/**
+ * @brief A real-time consumer of the NT Kernel Logger session.
+ *
+ * The session is started with the event classes the subscriptions request,
+ * large buffers controlled by --etw_buffer_size and --etw_buffers, and
+ * system timestamps. Events are decoded using the TDH schema of each
+ * (class, opcode, version), requested once and cached, then fired to the
+ * subscribers' dispatch queues.
+ *
+ * Only one NT Kernel Logger session may exist. A session started by another
+ * consumer is stopped and replaced when the publisher starts.
+ */
+class ETWEventPublisher
+    : public EventPublisher<ETWSubscriptionContext, ETWEventContext> {
+  DECLARE_PUBLISHER("etw");
+
+ public:
+  Status setUp() override;
+
+  /// Restart the session if the requested event classes changed.
+  void configure() override;
+
+  /// Stop the session and release the schemas.
+  void tearDown() override;
+
+  /// Start the session if needed and consume events until it is stopped.
+  Status run() override;
+
+  /// Stop the session, ending the blocking consumer in run.
+  void stop() override;
+
+  /// The consumer blocks in ProcessTrace.
+  bool waitsForReadiness() const override {
+    return true;
+  }
+
+ public:
+  /// Convert an event timestamp, 100ns intervals since 1601, to UNIX time.
+  static size_t toUnixTime(LONGLONG timestamp);
+
+ private:
+  /// Apply the class and opcode subscription filter.
+  bool shouldFire(const ETWSubscriptionContextRef& sc,
+                  const ETWEventContextRef& ec) const override;
+
+  /// The EnableFlags for the classes the subscriptions request.
+  ULONG getEnableFlags();
+
+  /// Start the NT Kernel Logger session and open a real-time consumer.
+  Status startSession(ULONG flags);
+
+  /// Stop the session and close the consumer.
+  void stopSession();
+
+  /// The consumer's event callback, forwarded to the publisher instance.
+  static VOID WINAPI eventCallback(PEVENT_RECORD record);
+
+  /// Decode and fire a single event.
+  void handleEvent(PEVENT_RECORD record);
+
+  /**
+   * @brief Get the cached TDH schema of an event.
+   *
+   * @return nullptr if the event has no schema, the failure is also cached.
+   */
+  const TRACE_EVENT_INFO* getSchema(PEVENT_RECORD record);
+
+  /// Decode the top-level properties of an event using its schema.
+  static void decodeProperties(PEVENT_RECORD record,
+                               const TRACE_EVENT_INFO* info,
+                               std::map<std::string, std::string>& data);
+
+ private:
+  /// The session handle from StartTrace.
+  TRACEHANDLE session_{0};
+
+  /// The consumer handle from OpenTrace.
+  TRACEHANDLE consumer_{INVALID_PROCESSTRACE_HANDLE};
+
+  /// The EnableFlags of the running session.
+  std::atomic<ULONG> flags_{0};
+
+  /// Set when configure changed the requested classes.
+  std::atomic<bool> restart_{false};
+
+  /// Schemas keyed by the bytes of the class GUID, opcode, version, and
+  /// pointer size. An empty schema is a cached lookup failure.
+  std::map<std::string, std::vector<char>> schemas_;
+
+  /// The publisher receiving the consumer's callbacks.
+  static ETWEventPublisher* instance_;
+
+ private:
+  friend class ETWTests;
+};
+}
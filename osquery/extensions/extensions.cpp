@@ -8,7 +8,15 @@
  *
  */
 
+#ifndef WIN32
+#include <poll.h>
+#endif
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <set>
 
 #include <boost/algorithm/string/predicate.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -19,12 +27,15 @@
 #include <osquery/registry.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
+#include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/process.h"
 #include "osquery/core/watcher.h"
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/response_cache.h"
 #include "osquery/filesystem/fileops.h"
+#include "osquery/sql/sqlite_util.h"
 
 using namespace osquery::extensions;
 
@@ -35,6 +46,9 @@ namespace osquery {
 // Millisecond latency between initalizing manager pings.
 const size_t kExtensionInitializeLatencyUS = 20000;
 
+/// Milliseconds of each poll on the health channels between interrupt checks.
+const size_t kHealthPollMilli = 200;
+
 #ifdef __APPLE__
 #define MODULE_EXTENSION ".dylib"
 #define EXT_EXTENSION ".ext"
@@ -77,6 +91,16 @@ CLI_FLAG(string,
          "3",
          "Seconds delay between connectivity checks")
 
+CLI_FLAG(uint64,
+         extensions_threads,
+         0,
+         "Threads serving extension API calls (default 0, thread per call)");
+
+CLI_FLAG(uint64,
+         extensions_queue_depth,
+         16,
+         "Extension API calls waiting for a thread before calls are refused");
+
 #ifndef WIN32
 CLI_FLAG(string,
          modules_autoload,
@@ -93,10 +117,77 @@ CLI_FLAG(string,
  * We include timeout and interval, where the 'extensions_' prefix is removed
  * in the alias since we are already within the context of an extension.
  */
+FLAG(uint64,
+     extensions_batch_rows,
+     1024,
+     "Rows fetched in each request to an extension table cursor");
+
+FLAG(uint64,
+     extensions_shared_memory,
+     0,
+     "Bytes of each shared memory ring used with extensions (0 disables)");
+
+FLAG(uint64,
+     extensions_cache_size,
+     256,
+     "Responses kept for extension plugins declaring a cache (0 disables)");
+
+FLAG(bool,
+     extensions_health_channel,
+     true,
+     "Keep a connection open to each extension for health checks");
+
+FLAG(uint64,
+     extensions_heartbeat_timeout,
+     1000,
+     "Milliseconds to wait for an extension health check response");
+
 EXTENSION_FLAG_ALIAS(socket, extensions_socket);
 EXTENSION_FLAG_ALIAS(timeout, extensions_timeout);
 EXTENSION_FLAG_ALIAS(interval, extensions_interval);
 
+/// Extension paths that do not implement the columnar call API.
+static std::set<std::string> kRowOnlyExtensions;
+
+/// Protect the set of extensions without the columnar call API.
+Mutex row_only_extensions_mutex_;
+
+/// Check if an extension was built with an SDK without the columnar calls.
+static bool isRowOnlyExtension(const std::string& path) {
+  WriteLock lock(row_only_extensions_mutex_);
+  return (kRowOnlyExtensions.count(path) > 0);
+}
+
+/// Remember an extension answered a columnar call as an unknown method.
+static void setRowOnlyExtension(const std::string& path) {
+  WriteLock lock(row_only_extensions_mutex_);
+  kRowOnlyExtensions.insert(path);
+}
+
+/// Move a columnar response's rows, which may be written to shared memory.
+static Status decodeExtensionResponse(const std::string& path,
+                                      ExtensionColumnarResponse& columnar,
+                                      PluginResponse& response) {
+  if (!columnar.__isset.shared_length) {
+    decodeColumnarResponse(columnar, response);
+    return Status(0, "OK");
+  }
+
+  auto shm = getSharedMemory(path);
+  if (shm == nullptr) {
+    return Status(1, "Extension responded using unknown shared memory");
+  }
+
+  std::string data;
+  auto status = shm->inbound().read(static_cast<size_t>(columnar.shared_offset),
+                                    static_cast<size_t>(columnar.shared_length),
+                                    data);
+  if (!status.ok()) {
+    return status;
+  }
+  return deserializeSharedPayload(data, response);
+}
+
 #ifdef WIN32
 // Time to wait for a busy named pipe, if it exists
 #define NAMED_PIPE_WAIT 500
@@ -122,13 +213,73 @@ static Status isNamedPipePathValid(const std::string& path) {
 }
 #endif
 
+/// Open a health channel, calls fail after the heartbeat timeout.
+template <typename Client>
+static std::shared_ptr<Client> openHealthChannel(const std::string& path) {
+  auto client = std::make_shared<Client>(path);
+  client->setTimeout(static_cast<int>(FLAGS_extensions_heartbeat_timeout));
+  return client;
+}
+
+std::vector<size_t> ExtensionWatcher::waitForHangup(
+    const std::vector<int>& fds) {
+  std::vector<size_t> closed;
+#ifndef WIN32
+  if (!fds.empty()) {
+    std::vector<struct pollfd> polls(fds.size());
+    for (size_t i = 0; i < fds.size(); i++) {
+      polls[i].fd = fds[i];
+      polls[i].events = POLLIN;
+    }
+
+    // A health channel has no input until the peer closes it.
+    auto end = std::chrono::steady_clock::now() +
+               std::chrono::milliseconds(interval_);
+    while (!interrupted()) {
+      auto now = std::chrono::steady_clock::now();
+      if (now >= end) {
+        break;
+      }
+      auto remaining =
+          std::chrono::duration_cast<std::chrono::milliseconds>(end - now);
+      auto timeout = std::min(static_cast<size_t>(remaining.count()) + 1,
+                              kHealthPollMilli);
+      int ready = ::poll(polls.data(), polls.size(), static_cast<int>(timeout));
+      if (ready < 0 && errno != EINTR) {
+        break;
+      }
+      if (ready > 0) {
+        for (size_t i = 0; i < polls.size(); i++) {
+          if (polls[i].revents != 0) {
+            closed.push_back(i);
+          }
+        }
+        return closed;
+      }
+    }
+    return closed;
+  }
+#endif
+
+  pauseMilli(interval_);
+  return closed;
+}
+
 void ExtensionWatcher::start() {
   // Watch the manager, if the socket is removed then the extension will die.
   // A check for sane paths and activity is applied before the watcher
   // service is added and started.
   while (!interrupted()) {
     watch();
-    pauseMilli(interval_);
+
+    // If the core closes the channel it is checked again immediately.
+    std::vector<int> fds;
+    if (manager_ != nullptr && manager_->getFD() >= 0) {
+      fds.push_back(manager_->getFD());
+    }
+    if (!waitForHangup(fds).empty()) {
+      manager_ = nullptr;
+    }
   }
 }
 
@@ -136,8 +287,26 @@ void ExtensionManagerWatcher::start() {
   // Watch each extension.
   while (!interrupted()) {
     watch();
-    pauseMilli(interval_);
+
+    std::vector<int> fds;
+    std::vector<RouteUUID> uuids;
+    for (const auto& channel : channels_) {
+      auto fd = channel.second.second->getFD();
+      if (fd >= 0) {
+        fds.push_back(fd);
+        uuids.push_back(channel.first);
+      }
+    }
+    for (const auto& closed : waitForHangup(fds)) {
+      // A closed channel counts as two missed checks, the next check
+      // removes the extension unless it answers a ping on a new channel.
+      const auto& uuid = uuids[closed];
+      VLOG(1) << "Extension UUID " << uuid << " closed its health channel";
+      channels_.erase(uuid);
+      failures_[uuid] = std::max(failures_[uuid], static_cast<size_t>(2));
+    }
   }
+  channels_.clear();
 
   // When interrupted, request each extension tear down.
   const auto uuids = Registry::routeUUIDs();
@@ -172,13 +341,29 @@ void ExtensionWatcher::watch() {
   }
 #else
   if (isWritable(path_)) {
-    try {
-      auto client = EXManagerClient(path_);
-      // Ping the extension manager until it goes down.
-      client.get()->ping(status);
+    // A kept channel may have been closed since the last ping, a new
+    // channel is opened before the core is considered gone.
+    for (size_t attempt = 0; attempt < 2; attempt++) {
+      bool kept = (manager_ != nullptr);
+      try {
+        if (!kept) {
+          manager_ = openHealthChannel<EXManagerClient>(path_);
+        }
+        // Ping the extension manager until it goes down.
+        manager_->get()->ping(status);
+        core_sane = true;
+        break;
+      } catch (const std::exception& e) {
+        manager_ = nullptr;
+        core_sane = false;
+        if (!kept) {
+          break;
+        }
+      }
+    }
 
-    } catch (const std::exception& e) {
-      core_sane = false;
+    if (!FLAGS_extensions_health_channel) {
+      manager_ = nullptr;
     }
   } else {
     // The previously-writable extension socket is not usable.
@@ -202,6 +387,15 @@ void ExtensionManagerWatcher::watch() {
   // will be deregistered.
   const auto uuids = Registry::routeUUIDs();
 
+  // Channels to extensions that are no longer registered are closed.
+  for (auto it = channels_.begin(); it != channels_.end();) {
+    if (std::find(uuids.begin(), uuids.end(), it->first) == uuids.end()) {
+      it = channels_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
   ExtensionStatus status;
   for (const auto& uuid : uuids) {
     auto path = getExtensionSocket(uuid);
@@ -215,16 +409,26 @@ void ExtensionManagerWatcher::watch() {
     }
 #else
     if (isWritable(path)) {
+      auto& channel = channels_[uuid];
       try {
-        auto client = EXClient(path);
+        if (channel.second == nullptr || channel.first != path) {
+          channel.first = path;
+          channel.second = openHealthChannel<EXClient>(path);
+        }
         // Ping the extension until it goes down.
-        client.get()->ping(status);
+        channel.second->get()->ping(status);
       } catch (const std::exception& e) {
+        // A failed or timed out call leaves the channel unusable.
+        channels_.erase(uuid);
         failures_[uuid] += 1;
         continue;
       }
+      if (!FLAGS_extensions_health_channel) {
+        channels_.erase(uuid);
+      }
     } else {
       // Immediate fail non-writable paths.
+      channels_.erase(uuid);
       failures_[uuid] = 3;
       continue;
     }
@@ -241,6 +445,7 @@ void ExtensionManagerWatcher::watch() {
   for (const auto& uuid : failures_) {
     if (uuid.second >= 3) {
       LOG(INFO) << "Extension UUID " << uuid.first << " has gone away";
+      channels_.erase(uuid.first);
       Registry::removeBroadcast(uuid.first);
       failures_[uuid.first] = 0;
     }
@@ -284,6 +489,33 @@ void loadExtensions() {
   }
 }
 
+void waitForExtensions() {
+  if (FLAGS_disable_extensions) {
+    return;
+  }
+
+  // The watcher hints the number of autoloaded extensions.
+  auto hint = getEnvVar("OSQUERY_EXTENSIONS");
+  unsigned long int count = 0;
+  if (!hint.is_initialized() || !safeStrtoul(*hint, 10, count).ok() ||
+      count == 0) {
+    return;
+  }
+
+  size_t timeout = atoi(FLAGS_extensions_timeout.c_str()) * 1000;
+  if (timeout < kExtensionInitializeLatencyUS * 10 / 1000) {
+    timeout = kExtensionInitializeLatencyUS * 10 / 1000;
+  }
+
+  // Tables broadcast while waiting are attached once the set is registered.
+  SQLiteDBManager::deferAttach();
+  if (!Registry::waitForBroadcasts(count, timeout)) {
+    LOG(WARNING) << "Not all autoloaded extensions registered within "
+                 << FLAGS_extensions_timeout << " seconds";
+  }
+  SQLiteDBManager::attachDeferred();
+}
+
 #ifndef WIN32
 void loadModules() {
   auto status =
@@ -449,6 +681,19 @@ Status startExtension(const std::string& manager_path,
   info.sdk_version = sdk_version;
   info.min_sdk_version = min_sdk_version;
 
+  // Offer memory for large responses, the manager may decline.
+  ExtensionSharedMemoryRef shm;
+  if (FLAGS_extensions_shared_memory > 0) {
+    auto shm_status =
+        ExtensionSharedMemory::create(FLAGS_extensions_shared_memory, shm);
+    if (shm_status.ok()) {
+      info.__set_shared_memory(shm->name());
+    } else {
+      VLOG(1) << "Cannot create extension shared memory: "
+              << shm_status.getMessage();
+    }
+  }
+
   // If registration is successful, we will also request the manager's options.
   InternalOptionList options;
   // Register the extension's registry broadcast with the manager.
@@ -471,6 +716,14 @@ Status startExtension(const std::string& manager_path,
 
   // Now that the uuid is known, try to clean up stale socket paths.
   auto extension_path = getExtensionSocket(ext_status.uuid, manager_path);
+  if (shm != nullptr) {
+    // Both processes have mapped the region, or the manager declined.
+    shm->unlink();
+    if (ext_status.__isset.shared_memory &&
+        ext_status.shared_memory == shm->name()) {
+      setSharedMemory(extension_path, std::move(shm));
+    }
+  }
 
 #ifdef WIN32
   status = isNamedPipePathValid(extension_path);
@@ -625,8 +878,25 @@ Status callExtension(const RouteUUID uuid,
   if (FLAGS_disable_extensions) {
     return Status(1, "Extensions disabled");
   }
-  return callExtension(
-      getExtensionSocket(uuid), registry, item, request, response);
+
+  auto& cache = ExtensionResponseCache::instance();
+  if (!cache.isCached(uuid, registry, item)) {
+    return callExtension(
+        getExtensionSocket(uuid), registry, item, request, response);
+  }
+
+  // The plugin declared its responses may be reused.
+  if (cache.get(uuid, registry, item, request, response)) {
+    return Status(0, "OK");
+  }
+  PluginResponse cached;
+  auto status = callExtension(
+      getExtensionSocket(uuid), registry, item, request, cached);
+  if (status.ok()) {
+    cache.set(uuid, registry, item, request, cached);
+  }
+  response.insert(response.end(), cached.begin(), cached.end());
+  return status;
 }
 
 Status callExtension(const std::string& extension_path,
@@ -640,6 +910,55 @@ Status callExtension(const std::string& extension_path,
     return status;
   }
 
+  bool columnar = !isRowOnlyExtension(extension_path);
+  if (columnar) {
+    // A large request, such as a logger payload, may use shared memory.
+    auto shm = getSharedMemory(extension_path);
+    PluginRequest reference;
+    bool shared = (shm != nullptr && !Registry::external() &&
+                   writeSharedRequest(*shm, request, reference));
+
+    // Prefer the response with each column name sent once.
+    ExtensionColumnarResponse ext_response;
+    try {
+      auto client = EXClient(extension_path);
+      client.get()->callColumnar(
+          ext_response, registry, item, (shared) ? reference : request);
+    } catch (const TApplicationException& e) {
+      if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+        if (shared) {
+          // The extension may be gone, abandon every unread segment.
+          shm->outbound().reset();
+        }
+        return Status(1, "Extension call failed: " + std::string(e.what()));
+      }
+      // An extension built with an earlier SDK, use the row-map API.
+      setRowOnlyExtension(extension_path);
+      columnar = false;
+    } catch (const std::exception& e) {
+      if (shared) {
+        shm->outbound().reset();
+      }
+      return Status(1, "Extension call failed: " + std::string(e.what()));
+    }
+
+    if (shared) {
+      // The call completed, a segment the extension did not read is freed.
+      releaseSharedRequest(*shm, reference);
+    }
+
+    if (columnar) {
+      if (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
+        status =
+            decodeExtensionResponse(extension_path, ext_response, response);
+        if (!status.ok()) {
+          return status;
+        }
+      }
+      return Status(ext_response.status.code, ext_response.status.message);
+    }
+  }
+
   ExtensionResponse ext_response;
   try {
     auto client = EXClient(extension_path);
@@ -650,13 +969,202 @@ Status callExtension(const std::string& extension_path,
 
   // Convert from Thrift-internal list type to PluginResponse type.
   if (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
-    for (const auto& item : ext_response.response) {
-      response.push_back(item);
+    response.reserve(response.size() + ext_response.response.size());
+    for (auto& item : ext_response.response) {
+      response.push_back(std::move(item));
     }
   }
   return Status(ext_response.status.code, ext_response.status.message);
 }
 
+/// Generate an extension table's rows with one call.
+static Status generateExtensionTable(const RouteUUID uuid,
+                                     const std::string& table,
+                                     const QueryContext& context,
+                                     PluginResponse& response) {
+  auto extension_path = getExtensionSocket(uuid);
+  auto status = extensionPathActive(extension_path);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (!isRowOnlyExtension(extension_path)) {
+    InternalQueryContext internal;
+    setInternalContext(context, internal);
+
+    ExtensionColumnarResponse ext_response;
+    try {
+      auto client = EXClient(extension_path);
+      client.get()->generateTable(ext_response, table, internal);
+      if (ext_response.status.code == ExtensionCode::EXT_SUCCESS) {
+        status =
+            decodeExtensionResponse(extension_path, ext_response, response);
+        if (!status.ok()) {
+          return status;
+        }
+      }
+      return Status(ext_response.status.code, ext_response.status.message);
+    } catch (const TApplicationException& e) {
+      if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+        return Status(1, "Extension call failed: " + std::string(e.what()));
+      }
+      setRowOnlyExtension(extension_path);
+    } catch (const std::exception& e) {
+      return Status(1, "Extension call failed: " + std::string(e.what()));
+    }
+  }
+
+  // An extension built with an earlier SDK reads a serialized context.
+  PluginRequest request = {{"action", "generate"}};
+  TablePlugin::setRequestFromContext(context, request);
+  return callExtension(extension_path, "table", table, request, response);
+}
+
+Status callExtensionTable(const RouteUUID uuid,
+                          const std::string& table,
+                          const QueryContext& context,
+                          PluginResponse& response) {
+  if (FLAGS_disable_extensions) {
+    return Status(1, "Extensions disabled");
+  }
+
+  auto& cache = ExtensionResponseCache::instance();
+  if (!cache.isCached(uuid, "table", table)) {
+    return generateExtensionTable(uuid, table, context, response);
+  }
+
+  // The table declared its rows may be reused, the cache key is the
+  // serialized context sent to extensions built with earlier SDKs.
+  PluginRequest request = {{"action", "generate"}};
+  TablePlugin::setRequestFromContext(context, request);
+  if (cache.get(uuid, "table", table, request, response)) {
+    return Status(0, "OK");
+  }
+
+  PluginResponse cached;
+  auto status = generateExtensionTable(uuid, table, context, cached);
+  if (status.ok()) {
+    cache.set(uuid, "table", table, request, cached);
+  }
+  response.insert(response.end(), cached.begin(), cached.end());
+  return status;
+}
+
+/**
+ * @brief Fetch an extension table's rows in batches through a table cursor.
+ *
+ * The extension generates rows as they are fetched. If the SQLite cursor is
+ * closed before the rows are exhausted the table cursor is closed, and the
+ * extension stops generating.
+ */
+class ExtensionTableGenerator : public RowGenerator {
+ public:
+  explicit ExtensionTableGenerator(const std::string& path)
+      : path_(path), client_(path) {}
+
+  ~ExtensionTableGenerator() {
+    if (cursor_ != 0 && !done_) {
+      try {
+        client_.get()->closeTable(cursor_);
+      } catch (const std::exception& /* e */) {
+        // The extension will expire the cursor.
+      }
+    }
+  }
+
+  /// Open the table cursor, this may throw a Thrift exception.
+  Status open(const std::string& table, const InternalQueryContext& context) {
+    ExtensionTableCursor cursor;
+    client_.get()->openTable(cursor, table, context);
+    cursor_ = cursor.cursor;
+    return Status(cursor.status.code, cursor.status.message);
+  }
+
+  bool next(QueryData& batch) override {
+    if (done_) {
+      return false;
+    }
+
+    ExtensionColumnarResponse response;
+    try {
+      client_.get()->fetchTable(
+          response, cursor_, static_cast<int32_t>(FLAGS_extensions_batch_rows));
+    } catch (const std::exception& e) {
+      LOG(WARNING) << "Extension table fetch failed: " << e.what();
+      done_ = true;
+      return false;
+    }
+
+    done_ = (response.status.code != ExtensionCode::EXT_SUCCESS ||
+             !response.more);
+    if (response.status.code == ExtensionCode::EXT_SUCCESS) {
+      auto status = decodeExtensionResponse(path_, response, batch);
+      if (!status.ok()) {
+        LOG(WARNING) << "Extension table fetch failed: "
+                     << status.getMessage();
+        done_ = true;
+      }
+    }
+    return (!batch.empty() || !done_);
+  }
+
+ private:
+  /// The extension's socket path.
+  std::string path_;
+
+  /// A connection to the extension, held while the cursor is open.
+  EXClient client_;
+
+  /// The extension's table cursor.
+  int64_t cursor_{0};
+
+  /// Set when the cursor is exhausted or failed.
+  bool done_{false};
+};
+
+Status callExtensionTable(const RouteUUID uuid,
+                          const std::string& table,
+                          const QueryContext& context,
+                          RowGeneratorRef& generator) {
+  if (FLAGS_disable_extensions) {
+    return Status(1, "Extensions disabled");
+  }
+
+  // Cached tables are generated at once, so the rows may be reused.
+  auto extension_path = getExtensionSocket(uuid);
+  if (!isRowOnlyExtension(extension_path) &&
+      !ExtensionResponseCache::instance().isCached(uuid, "table", table)) {
+    auto status = extensionPathActive(extension_path);
+    if (!status.ok()) {
+      return status;
+    }
+
+    InternalQueryContext internal;
+    setInternalContext(context, internal);
+    try {
+      auto cursor = std::make_shared<ExtensionTableGenerator>(extension_path);
+      status = cursor->open(table, internal);
+      if (status.ok()) {
+        generator = std::move(cursor);
+      }
+      return status;
+    } catch (const TApplicationException& e) {
+      if (e.getType() != TApplicationException::UNKNOWN_METHOD) {
+        return Status(1, "Extension call failed: " + std::string(e.what()));
+      }
+      setRowOnlyExtension(extension_path);
+    } catch (const std::exception& e) {
+      return Status(1, "Extension call failed: " + std::string(e.what()));
+    }
+  }
+
+  // An extension built with an earlier SDK responds with every row at once.
+  PluginResponse response;
+  auto status = callExtensionTable(uuid, table, context, response);
+  generator = std::make_shared<QueryDataGenerator>(std::move(response));
+  return status;
+}
+
 Status startExtensionWatcher(const std::string& manager_path,
                              size_t interval,
                              bool fatal) {
@@ -8,28 +8,41 @@
  *
  */
 
+#include <algorithm>
+#include <iterator>
+
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/response_cache.h"
+#include "osquery/sql/sqlite_util.h"
 
 using namespace osquery::extensions;
 
 namespace osquery {
+
+DECLARE_uint64(extensions_shared_memory);
+DECLARE_uint64(extensions_threads);
+DECLARE_uint64(extensions_queue_depth);
+
 namespace extensions {
 
+/// Seconds before an unused table cursor is closed, if the caller went away.
+const size_t kTableCursorExpiry = 600;
+
 void ExtensionHandler::ping(ExtensionStatus& _return) {
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.message = "pong";
   _return.uuid = uuid_;
 }
 
-void ExtensionHandler::call(ExtensionResponse& _return,
-                            const std::string& registry,
-                            const std::string& item,
-                            const ExtensionPluginRequest& request) {
+Status ExtensionHandler::callRegistry(const std::string& registry,
+                                      const std::string& item,
+                                      const ExtensionPluginRequest& request,
+                                      PluginResponse& response) {
   // Call will receive an extension or core's request to call the other's
   // internal registry call. It is the ONLY actor that resolves registry
   // item aliases.
@@ -39,21 +52,190 @@ void ExtensionHandler::call(ExtensionResponse& _return,
     local_item = Registry::getActive(registry);
   }
 
-  PluginResponse response;
   PluginRequest plugin_request;
-  for (const auto& request_item : request) {
-    // Create a PluginRequest from an ExtensionPluginRequest.
-    plugin_request[request_item.first] = request_item.second;
+  if (shared_memory_ != nullptr && isSharedRequest(request)) {
+    // A large request, such as a logger payload, was written to memory.
+    auto status = readSharedRequest(*shared_memory_, request, plugin_request);
+    if (!status.ok()) {
+      return status;
+    }
+  } else {
+    for (const auto& request_item : request) {
+      // Create a PluginRequest from an ExtensionPluginRequest.
+      plugin_request[request_item.first] = request_item.second;
+    }
   }
 
-  auto status = Registry::call(registry, local_item, plugin_request, response);
+  return Registry::call(registry, local_item, plugin_request, response);
+}
+
+void ExtensionHandler::setResponse(PluginResponse& response,
+                                   ExtensionColumnarResponse& columnar) {
+  if (shared_memory_ != nullptr &&
+      estimateSharedPayload(response) >= kSharedMemoryMinPayload) {
+    std::string data;
+    size_t offset = 0;
+    serializeSharedPayload(response, data);
+    if (shared_memory_->outbound().write(data, offset).ok()) {
+      columnar.__set_shared_offset(static_cast<int64_t>(offset));
+      columnar.__set_shared_length(static_cast<int64_t>(data.size()));
+      return;
+    }
+    // The ring is full, send the rows over the socket.
+  }
+  encodeColumnarResponse(response, columnar);
+}
+
+void ExtensionHandler::call(ExtensionResponse& _return,
+                            const std::string& registry,
+                            const std::string& item,
+                            const ExtensionPluginRequest& request) {
+  PluginResponse response;
+  auto status = callRegistry(registry, item, request, response);
   _return.status.code = status.getCode();
   _return.status.message = status.getMessage();
   _return.status.uuid = uuid_;
   if (status.ok()) {
-    for (const auto& response_item : response) {
-      // Translate a PluginResponse to an ExtensionPluginResponse.
-      _return.response.push_back(response_item);
+    // Translate a PluginResponse to an ExtensionPluginResponse.
+    _return.response.reserve(response.size());
+    for (auto& response_item : response) {
+      _return.response.push_back(std::move(response_item));
+    }
+  }
+}
+
+void ExtensionHandler::callColumnar(ExtensionColumnarResponse& _return,
+                                    const std::string& registry,
+                                    const std::string& item,
+                                    const ExtensionPluginRequest& request) {
+  PluginResponse response;
+  auto status = callRegistry(registry, item, request, response);
+  _return.status.code = status.getCode();
+  _return.status.message = status.getMessage();
+  _return.status.uuid = uuid_;
+  if (status.ok()) {
+    setResponse(response, _return);
+  }
+}
+
+void ExtensionHandler::generateTable(ExtensionColumnarResponse& _return,
+                                     const std::string& table,
+                                     const InternalQueryContext& context) {
+  auto local_table = Registry::getAlias("table", table);
+  QueryContext query_context;
+  setQueryContext(context, query_context);
+
+  PluginResponse response;
+  auto status = Registry::callTable(local_table, query_context, response);
+  _return.status.code = status.getCode();
+  _return.status.message = status.getMessage();
+  _return.status.uuid = uuid_;
+  if (status.ok()) {
+    setResponse(response, _return);
+  }
+}
+
+void ExtensionHandler::openTable(ExtensionTableCursor& _return,
+                                 const std::string& table,
+                                 const InternalQueryContext& context) {
+  expireCursors();
+
+  TableCursor cursor;
+  cursor.context = std::make_shared<QueryContext>();
+  setQueryContext(context, *cursor.context);
+
+  auto local_table = Registry::getAlias("table", table);
+  auto status = Registry::callTable(
+      local_table, *cursor.context, cursor.generator);
+  _return.status.code = status.getCode();
+  _return.status.message = status.getMessage();
+  _return.status.uuid = uuid_;
+  if (!status.ok()) {
+    return;
+  }
+
+  cursor.used = getUnixTime();
+  WriteLock lock(cursors_mutex_);
+  _return.cursor = next_cursor_++;
+  cursors_[_return.cursor] = std::move(cursor);
+}
+
+void ExtensionHandler::fetchTable(ExtensionColumnarResponse& _return,
+                                  const int64_t cursor,
+                                  const int32_t max_rows) {
+  _return.status.uuid = uuid_;
+  TableCursor state;
+  {
+    // Generate without the lock, each cursor is fetched by a single caller.
+    WriteLock lock(cursors_mutex_);
+    auto it = cursors_.find(cursor);
+    if (it == cursors_.end()) {
+      _return.status.code = ExtensionCode::EXT_FAILED;
+      _return.status.message = "Unknown table cursor";
+      return;
+    }
+    state = std::move(it->second);
+    cursors_.erase(it);
+  }
+
+  size_t limit = std::max<int32_t>(max_rows, 1);
+  while (state.pending.size() < limit && state.generator != nullptr) {
+    QueryData batch;
+    if (!state.generator->next(batch)) {
+      // The generator is exhausted, release its resources early.
+      state.generator = nullptr;
+    }
+    for (auto& row : batch) {
+      state.pending.push_back(std::move(row));
+    }
+  }
+
+  PluginResponse rows;
+  if (state.pending.size() <= limit) {
+    rows.swap(state.pending);
+  } else {
+    rows.assign(std::make_move_iterator(state.pending.begin()),
+                std::make_move_iterator(state.pending.begin() + limit));
+    state.pending.erase(state.pending.begin(), state.pending.begin() + limit);
+  }
+
+  _return.status.code = ExtensionCode::EXT_SUCCESS;
+  _return.status.message = "OK";
+  setResponse(rows, _return);
+  _return.more = (state.generator != nullptr || !state.pending.empty());
+  if (_return.more) {
+    state.used = getUnixTime();
+    WriteLock lock(cursors_mutex_);
+    cursors_[cursor] = std::move(state);
+  }
+}
+
+void ExtensionHandler::closeTable(const int64_t cursor) {
+  TableCursor state;
+  {
+    WriteLock lock(cursors_mutex_);
+    auto it = cursors_.find(cursor);
+    if (it == cursors_.end()) {
+      return;
+    }
+    state = std::move(it->second);
+    cursors_.erase(it);
+  }
+  // The generator and context are released outside of the lock.
+}
+
+void ExtensionHandler::expireCursors() {
+  std::vector<TableCursor> expired;
+  {
+    WriteLock lock(cursors_mutex_);
+    auto now = getUnixTime();
+    for (auto it = cursors_.begin(); it != cursors_.end();) {
+      if (it->second.used + kTableCursorExpiry < now) {
+        expired.push_back(std::move(it->second));
+        it = cursors_.erase(it);
+      } else {
+        ++it;
+      }
     }
   }
 }
@@ -95,7 +277,11 @@ void ExtensionManagerHandler::registerExtension(
             << ", version=" << info.version << ", sdk=" << info.sdk_version
             << ")";
 
-  if (!Registry::addBroadcast(uuid, registry).ok()) {
+  // The extension's tables are attached together after the broadcast.
+  SQLiteDBManager::deferAttach();
+  auto status = Registry::addBroadcast(uuid, registry);
+  SQLiteDBManager::attachDeferred();
+  if (!status.ok()) {
     LOG(WARNING) << "Could not add extension (" << info.name << ", " << uuid
                  << ") broadcast to registry";
     _return.code = ExtensionCode::EXT_FAILED;
@@ -103,6 +289,21 @@ void ExtensionManagerHandler::registerExtension(
     return;
   }
 
+  // Plugins may declare their responses are reused for an interval.
+  ExtensionResponseCache::instance().addBroadcast(uuid, registry);
+
+  if (info.__isset.shared_memory && FLAGS_extensions_shared_memory > 0) {
+    // The extension offered memory for large requests and responses.
+    ExtensionSharedMemoryRef shm;
+    if (ExtensionSharedMemory::open(info.shared_memory, shm).ok()) {
+      setSharedMemory(getExtensionSocket(uuid), std::move(shm));
+      _return.__set_shared_memory(info.shared_memory);
+    } else {
+      VLOG(1) << "Cannot open extension (" << info.name << ", " << uuid
+              << ") shared memory";
+    }
+  }
+
   extensions_[uuid] = info;
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.message = "OK";
@@ -120,6 +321,8 @@ void ExtensionManagerHandler::deregisterExtension(
 
   // On success return the uuid of the now de-registered extension.
   Registry::removeBroadcast(uuid);
+  setSharedMemory(getExtensionSocket(uuid), nullptr);
+  ExtensionResponseCache::instance().removeBroadcast(uuid);
   extensions_.erase(uuid);
   _return.code = ExtensionCode::EXT_SUCCESS;
   _return.uuid = uuid;
@@ -127,14 +330,15 @@ void ExtensionManagerHandler::deregisterExtension(
 
 void ExtensionManagerHandler::query(ExtensionResponse& _return,
                                     const std::string& sql) {
-  QueryData results;
-  auto status = osquery::query(sql, results);
-  _return.status.code = status.getCode();
-  _return.status.message = status.getMessage();
+  // Extension queries do not contend with the daemon's primary database.
+  SQLInternal results(sql, SQLiteDBManager::getPooled());
+  _return.status.code = results.getStatus().getCode();
+  _return.status.message = results.getStatus().getMessage();
   _return.status.uuid = uuid_;
 
-  if (status.ok()) {
-    for (const auto& row : results) {
+  if (results.ok()) {
+    _return.response.reserve(results.rows().size());
+    for (const auto& row : results.rows()) {
       _return.response.push_back(row);
     }
   }
@@ -143,7 +347,8 @@ void ExtensionManagerHandler::query(ExtensionResponse& _return,
 void ExtensionManagerHandler::getQueryColumns(ExtensionResponse& _return,
                                               const std::string& sql) {
   TableColumns columns;
-  auto status = osquery::getQueryColumns(sql, columns);
+  auto dbc = SQLiteDBManager::getPooled();
+  auto status = getQueryColumnsInternal(sql, columns, dbc->db());
   _return.status.code = status.getCode();
   _return.status.message = status.getMessage();
   _return.status.uuid = uuid_;
@@ -168,6 +373,8 @@ void ExtensionManagerHandler::refresh() {
 
   // Remove each from the manager's list of extension metadata.
   for (const auto& uuid : removed_routes) {
+    setSharedMemory(getExtensionSocket(uuid), nullptr);
+    ExtensionResponseCache::instance().removeBroadcast(uuid);
     extensions_.erase(uuid);
   }
 }
@@ -185,6 +392,104 @@ bool ExtensionManagerHandler::exists(const std::string& name) {
 }
 }
 
+void encodeColumnarResponse(PluginResponse& response,
+                            ExtensionColumnarResponse& columnar) {
+  bool uniform = true;
+  if (!response.empty()) {
+    for (const auto& column : response.front()) {
+      columnar.columns.push_back(column.first);
+    }
+  }
+
+  // Every row must have exactly the columns of the first row.
+  for (const auto& row : response) {
+    if (row.size() != columnar.columns.size() ||
+        !std::equal(row.begin(),
+                    row.end(),
+                    columnar.columns.begin(),
+                    [](const std::pair<const std::string, std::string>& l,
+                       const std::string& r) { return l.first == r; })) {
+      uniform = false;
+      break;
+    }
+  }
+
+  if (!uniform) {
+    columnar.columns.clear();
+    columnar.response.reserve(response.size());
+    for (auto& row : response) {
+      columnar.response.push_back(std::move(row));
+    }
+    return;
+  }
+
+  columnar.rows.resize(response.size());
+  for (size_t i = 0; i < response.size(); i++) {
+    auto& values = columnar.rows[i];
+    values.reserve(columnar.columns.size());
+    for (auto& column : response[i]) {
+      values.push_back(std::move(column.second));
+    }
+  }
+}
+
+void decodeColumnarResponse(ExtensionColumnarResponse& columnar,
+                            PluginResponse& response) {
+  response.reserve(response.size() + columnar.rows.size() +
+                   columnar.response.size());
+  for (auto& values : columnar.rows) {
+    if (values.size() != columnar.columns.size()) {
+      continue;
+    }
+
+    // The column names are sorted, each is inserted at the end of the row.
+    PluginResponse::value_type row;
+    for (size_t i = 0; i < values.size(); i++) {
+      row.emplace_hint(row.end(), columnar.columns[i], std::move(values[i]));
+    }
+    response.push_back(std::move(row));
+  }
+
+  for (auto& row : columnar.response) {
+    response.push_back(std::move(row));
+  }
+}
+
+void setInternalContext(const QueryContext& context,
+                        InternalQueryContext& internal) {
+  for (const auto& constraint : context.constraints) {
+    auto& list = internal.constraints[constraint.first];
+    list.affinity = columnTypeName(constraint.second.affinity);
+    for (const auto& expression : constraint.second.getAll()) {
+      InternalConstraint internal_constraint;
+      internal_constraint.op = expression.op;
+      internal_constraint.expr = expression.expr;
+      list.constraints.push_back(std::move(internal_constraint));
+    }
+  }
+
+  if (context.colsUsed.is_initialized()) {
+    internal.__set_used_columns(*context.colsUsed);
+  }
+}
+
+void setQueryContext(const InternalQueryContext& internal,
+                     QueryContext& context) {
+  for (const auto& constraint : internal.constraints) {
+    auto& list = context.constraints[constraint.first];
+    list.affinity = columnTypeName(constraint.second.affinity);
+    for (const auto& expression : constraint.second.constraints) {
+      Constraint query_constraint(static_cast<unsigned char>(expression.op));
+      query_constraint.expr = expression.expr;
+      list.add(query_constraint);
+    }
+  }
+
+  if (internal.__isset.used_columns) {
+    context.colsUsed = internal.used_columns;
+  }
+}
+
 ExtensionRunnerCore::~ExtensionRunnerCore() { remove(path_); }
 
 void ExtensionRunnerCore::stop() {
@@ -211,6 +516,30 @@ inline void removeStalePaths(const std::string& manager) {
   }
 }
 
+TServerRef ExtensionRunnerCore::createServer(
+    TProcessorRef processor,
+    TTransportFactoryRef transport_fac,
+    TProtocolFactoryRef protocol_fac) {
+#ifndef WIN32
+  if (FLAGS_extensions_threads > 0) {
+    // A bounded pool of workers serves connections, others wait in a queue.
+    auto workers = ThreadManager::newSimpleThreadManager(
+        FLAGS_extensions_threads, FLAGS_extensions_queue_depth);
+    workers->threadFactory(PosixThreadFactoryRef(new PosixThreadFactory()));
+    workers->start();
+
+    auto server = std::make_shared<TThreadPoolServer>(
+        processor, transport_, transport_fac, protocol_fac, workers);
+    // Refuse connections when the queue is full, the caller may retry.
+    server->setTimeout(-1);
+    return server;
+  }
+#endif
+
+  return std::make_shared<TThreadedServer>(
+      processor, transport_, transport_fac, protocol_fac);
+}
+
 void ExtensionRunnerCore::startServer(TProcessorRef processor) {
   {
     std::unique_lock<std::mutex> lock(service_start_);
@@ -232,8 +561,7 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
     auto protocol_fac = TProtocolFactoryRef(new TBinaryProtocolFactory());
 
     // Start the Thrift server's run loop.
-    server_ = TThreadedServerRef(new TThreadedServer(
-        processor, transport_, transport_fac, protocol_fac));
+    server_ = createServer(processor, transport_fac, protocol_fac);
   }
 
   server_->serve();
@@ -241,7 +569,8 @@ void ExtensionRunnerCore::startServer(TProcessorRef processor) {
 
 void ExtensionRunner::start() {
   // Create the thrift instances.
-  auto handler = ExtensionHandlerRef(new ExtensionHandler(uuid_));
+  auto handler = ExtensionHandlerRef(
+      new ExtensionHandler(uuid_, getSharedMemory(path_)));
   auto processor = TProcessorRef(new ExtensionProcessor(handler));
 
   VLOG(1) << "Extension service starting: " << path_;
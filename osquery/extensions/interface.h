@@ -12,6 +12,9 @@
 
 #include <osquery/dispatcher.h>
 #include <osquery/extensions.h>
+#include <osquery/tables.h>
+
+#include "osquery/extensions/shared_memory.h"
 
 #ifdef WIN32
 #pragma warning(push, 3)
@@ -31,6 +34,8 @@
 // possible in every build system.
 // clang-format off
 #include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadedServer.h)
+#include CONCAT(OSQUERY_THRIFT_SERVER_LIB,/TThreadPoolServer.h)
+#include CONCAT(OSQUERY_THRIFT_LIB,/TApplicationException.h)
 #include CONCAT(OSQUERY_THRIFT_LIB,/protocol/TBinaryProtocol.h)
 
 #ifdef WIN32
@@ -83,7 +88,7 @@ typedef SHARED_PTR_IMPL<ThreadManager> TThreadManagerRef;
 typedef SHARED_PTR_IMPL<PosixThreadFactory> PosixThreadFactoryRef;
 #endif
 
-using TThreadedServerRef = std::shared_ptr<TThreadedServer>;
+using TServerRef = std::shared_ptr<TServer>;
 
 namespace extensions {
 
@@ -99,6 +104,8 @@ class ExtensionHandler : virtual public ExtensionIf {
  public:
   ExtensionHandler() : uuid_(0) {}
   explicit ExtensionHandler(RouteUUID uuid) : uuid_(uuid) {}
+  ExtensionHandler(RouteUUID uuid, ExtensionSharedMemoryRef shm)
+      : uuid_(uuid), shared_memory_(std::move(shm)) {}
 
   /// Ping an Extension for status and metrics.
   void ping(ExtensionStatus& _return);
@@ -116,12 +123,114 @@ class ExtensionHandler : virtual public ExtensionIf {
             const std::string& item,
             const ExtensionPluginRequest& request);
 
+  /**
+   * @brief The columnar Thrift API used by Registry::call for an extension.
+   *
+   * The response's column names are sent once, instead of in every row. This
+   * is preferred when calling an extension that implements it.
+   *
+   * @param _return The return response (combo Status and columnar response).
+   * @param registry The name of the Extension registry.
+   * @param item The Extension plugin name.
+   * @param request The plugin request.
+   */
+  void callColumnar(ExtensionColumnarResponse& _return,
+                    const std::string& registry,
+                    const std::string& item,
+                    const ExtensionPluginRequest& request);
+
+  /**
+   * @brief Generate a table's rows with a structured query context.
+   *
+   * The constraints and used columns are passed as Thrift structures instead
+   * of a serialized JSON request, so the table may skip unused columns.
+   *
+   * @param _return The return response (combo Status and columnar response).
+   * @param table The table name, which may be an alias.
+   * @param context The query's constraints and used columns.
+   */
+  void generateTable(ExtensionColumnarResponse& _return,
+                     const std::string& table,
+                     const InternalQueryContext& context);
+
+  /**
+   * @brief Start generating a table's rows for a cursor.
+   *
+   * The caller fetches batches of rows using fetchTable. Rows are generated
+   * as they are fetched, and closing the cursor early stops the generation.
+   *
+   * @param _return The return Status and cursor.
+   * @param table The table name, which may be an alias.
+   * @param context The query's constraints and used columns.
+   */
+  void openTable(ExtensionTableCursor& _return,
+                 const std::string& table,
+                 const InternalQueryContext& context);
+
+  /**
+   * @brief Fetch the next batch of rows from a table cursor.
+   *
+   * An exhausted cursor is closed, the response's more member is false.
+   *
+   * @param _return The return Status and columnar rows.
+   * @param cursor The cursor returned by openTable.
+   * @param max_rows The max number of rows to return.
+   */
+  void fetchTable(ExtensionColumnarResponse& _return,
+                  const int64_t cursor,
+                  const int32_t max_rows);
+
+  /// Close a table cursor before its rows are exhausted.
+  void closeTable(const int64_t cursor);
+
   /// Request an extension to shutdown.
   void shutdown();
 
+ private:
+  /// Resolve a registry item alias and call the local registry.
+  Status callRegistry(const std::string& registry,
+                      const std::string& item,
+                      const ExtensionPluginRequest& request,
+                      PluginResponse& response);
+
+  /// Set a response's rows, a large response is written to shared memory.
+  void setResponse(PluginResponse& response,
+                   ExtensionColumnarResponse& columnar);
+
+  /// Close cursors that have not been fetched from recently.
+  void expireCursors();
+
  protected:
   /// Transient UUID assigned to the extension after registering.
   RouteUUID uuid_;
+
+  /// Memory shared with the extension manager, if it was negotiated.
+  ExtensionSharedMemoryRef shared_memory_{nullptr};
+
+ private:
+  /// An open table cursor and its generation state.
+  struct TableCursor {
+    /// The generator references the context, both are owned by the cursor.
+    std::shared_ptr<QueryContext> context;
+
+    /// The table's generator, empty when exhausted.
+    RowGeneratorRef generator;
+
+    /// Generated rows not yet fetched.
+    QueryData pending;
+
+    /// The last time the cursor was opened or fetched.
+    size_t used{0};
+  };
+
+  /// Open table cursors.
+  std::map<int64_t, TableCursor> cursors_;
+
+  /// The next table cursor identifier.
+  int64_t next_cursor_{1};
+
+  /// Protect the open table cursors.
+  Mutex cursors_mutex_;
 };
 
 /**
@@ -233,7 +342,31 @@ typedef SHARED_PTR_IMPL<ExtensionHandler> ExtensionHandlerRef;
 typedef SHARED_PTR_IMPL<ExtensionManagerHandler> ExtensionManagerHandlerRef;
 }
 
+/**
+ * @brief Move a plugin response into the columnar response representation.
+ *
+ * If every row has the same columns, the column names are set once and each
+ * row becomes a list of values. Otherwise the rows are moved unchanged.
+ */
+void encodeColumnarResponse(PluginResponse& response,
+                            extensions::ExtensionColumnarResponse& columnar);
+
+/// Move a columnar response's rows into a plugin response.
+void decodeColumnarResponse(extensions::ExtensionColumnarResponse& columnar,
+                            PluginResponse& response);
+
+/// Copy a query's constraints and used columns into the Thrift structure.
+void setInternalContext(const QueryContext& context,
+                        extensions::InternalQueryContext& internal);
+
+/// Copy the Thrift structure's constraints and used columns into a context.
+void setQueryContext(const extensions::InternalQueryContext& internal,
+                     QueryContext& context);
+
 /// A Dispatcher service thread that watches an ExtensionManagerHandler.
+class EXClient;
+class EXManagerClient;
+
 class ExtensionWatcher : public InternalRunnable {
  public:
   virtual ~ExtensionWatcher() {}
@@ -254,6 +387,17 @@ class ExtensionWatcher : public InternalRunnable {
   /// Exit the extension process with a fatal if the ExtensionManager dies.
   void exitFatal(int return_code = 1);
 
+  /**
+   * @brief Wait for the interval, ending early if a peer closes its channel.
+   *
+   * Health channels are idle between pings, the only input they may have is
+   * the peer closing the connection. One poll waits on every channel.
+   *
+   * @param fds The socket descriptors of the health channels.
+   * @return The positions within fds of the channels that were closed.
+   */
+  std::vector<size_t> waitForHangup(const std::vector<int>& fds);
+
  protected:
   /// The UNIX domain socket path for the ExtensionManager.
   std::string path_;
@@ -263,6 +407,13 @@ class ExtensionWatcher : public InternalRunnable {
 
   /// If the ExtensionManager socket is closed, should the extension exit.
   bool fatal_;
+
+ private:
+  /// The health channel to the ExtensionManager, kept between pings.
+  std::shared_ptr<EXManagerClient> manager_;
+
+ private:
+  FRIEND_TEST(ExtensionsTest, test_health_channel);
 };
 
 class ExtensionManagerWatcher : public ExtensionWatcher {
@@ -279,6 +430,10 @@ class ExtensionManagerWatcher : public ExtensionWatcher {
  private:
   /// Allow extensions to fail for several intervals.
   std::map<RouteUUID, size_t> failures_;
+
+  /// The health channel to each extension, and the socket path it uses.
+  std::map<RouteUUID, std::pair<std::string, std::shared_ptr<EXClient>>>
+      channels_;
 };
 
 class ExtensionRunnerCore : public InternalRunnable {
@@ -294,6 +449,12 @@ class ExtensionRunnerCore : public InternalRunnable {
   // The Dispatcher thread service stop point.
   void stop();
 
+ private:
+  /// Create a thread per connection server, or a bounded thread pool server.
+  TServerRef createServer(TProcessorRef processor,
+                          TTransportFactoryRef transport_fac,
+                          TProtocolFactoryRef protocol_fac);
+
  protected:
   /// The UNIX domain socket used for requests from the ExtensionManager.
   std::string path_;
@@ -302,7 +463,7 @@ class ExtensionRunnerCore : public InternalRunnable {
   TServerTransportRef transport_{nullptr};
 
   /// Server instance, will be stopped if thread service is removed.
-  TThreadedServerRef server_{nullptr};
+  TServerRef server_{nullptr};
 
   /// Protect the service start and stop, this mutex protects server creation.
   std::mutex service_start_;
@@ -368,6 +529,24 @@ class EXInternal {
     transport_->close();
   }
 
+  /// Bound each read and write of a call, in milliseconds.
+  void setTimeout(int timeout) {
+#ifndef WIN32
+    socket_->setRecvTimeout(timeout);
+    socket_->setSendTimeout(timeout);
+#endif
+  }
+
+  /// The connected socket descriptor, -1 if it cannot be polled.
+  int getFD() const {
+#ifndef WIN32
+    return (socket_->isOpen()) ? static_cast<int>(socket_->getSocketFD())
+                               : -1;
+#else
+    return -1;
+#endif
+  }
+
  protected:
   TPlatformSocketRef socket_;
   TTransportRef transport_;
@@ -0,0 +1,157 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/flags.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/extensions/response_cache.h"
+
+namespace osquery {
+
+DECLARE_uint64(extensions_cache_size);
+
+const std::string kResponseCacheRoute = "cache";
+
+/// The key of an extension's plugin, a prefix of its responses' keys.
+static inline std::string getPluginKey(const RouteUUID& uuid,
+                                       const std::string& registry,
+                                       const std::string& item) {
+  return std::to_string(uuid) + "." + registry + "." + item + "\n";
+}
+
+/// Append a length-prefixed string so distinct requests have distinct keys.
+static inline void appendKey(const std::string& value, std::string& key) {
+  key += std::to_string(value.size()) + ":" + value;
+}
+
+static std::string getResponseKey(const std::string& plugin_key,
+                                  const PluginRequest& request) {
+  auto key = plugin_key;
+  for (const auto& field : request) {
+    appendKey(field.first, key);
+    appendKey(field.second, key);
+  }
+  return key;
+}
+
+void ExtensionResponseCache::addBroadcast(const RouteUUID& uuid,
+                                          const RegistryBroadcast& broadcast) {
+  WriteLock lock(mutex_);
+  for (const auto& registry : broadcast) {
+    for (const auto& item : registry.second) {
+      for (const auto& route : item.second) {
+        if (route.count("id") == 0 || route.at("id") != kResponseCacheRoute ||
+            route.count("seconds") == 0) {
+          continue;
+        }
+
+        unsigned long long int seconds = 0;
+        if (safeStrtoull(route.at("seconds"), 10, seconds).ok() &&
+            seconds > 0) {
+          intervals_[getPluginKey(uuid, registry.first, item.first)] =
+              static_cast<size_t>(seconds);
+        }
+      }
+    }
+  }
+}
+
+void ExtensionResponseCache::removeBroadcast(const RouteUUID& uuid) {
+  WriteLock lock(mutex_);
+  auto prefix = std::to_string(uuid) + ".";
+  for (auto it = intervals_.begin(); it != intervals_.end();) {
+    it = (it->first.compare(0, prefix.size(), prefix) == 0)
+             ? intervals_.erase(it)
+             : std::next(it);
+  }
+
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    if (it->first.compare(0, prefix.size(), prefix) == 0) {
+      order_.erase(it->second.order);
+      it = entries_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+bool ExtensionResponseCache::isCached(const RouteUUID& uuid,
+                                      const std::string& registry,
+                                      const std::string& item) const {
+  if (FLAGS_extensions_cache_size == 0) {
+    return false;
+  }
+
+  WriteLock lock(mutex_);
+  return (intervals_.count(getPluginKey(uuid, registry, item)) > 0);
+}
+
+bool ExtensionResponseCache::get(const RouteUUID& uuid,
+                                 const std::string& registry,
+                                 const std::string& item,
+                                 const PluginRequest& request,
+                                 PluginResponse& response) {
+  auto key = getResponseKey(getPluginKey(uuid, registry, item), request);
+  WriteLock lock(mutex_);
+  auto entry = entries_.find(key);
+  if (entry == entries_.end()) {
+    return false;
+  }
+
+  if (entry->second.expires <= getUnixTime()) {
+    order_.erase(entry->second.order);
+    entries_.erase(entry);
+    return false;
+  }
+
+  // Move the entry to the front of the eviction order.
+  order_.splice(order_.begin(), order_, entry->second.order);
+  response.insert(response.end(),
+                  entry->second.response.begin(),
+                  entry->second.response.end());
+  return true;
+}
+
+void ExtensionResponseCache::set(const RouteUUID& uuid,
+                                 const std::string& registry,
+                                 const std::string& item,
+                                 const PluginRequest& request,
+                                 const PluginResponse& response) {
+  if (FLAGS_extensions_cache_size == 0) {
+    return;
+  }
+
+  auto plugin_key = getPluginKey(uuid, registry, item);
+  auto key = getResponseKey(plugin_key, request);
+  WriteLock lock(mutex_);
+  auto interval = intervals_.find(plugin_key);
+  if (interval == intervals_.end()) {
+    return;
+  }
+
+  auto entry = entries_.find(key);
+  if (entry != entries_.end()) {
+    order_.erase(entry->second.order);
+    entries_.erase(entry);
+  }
+
+  while (!order_.empty() && entries_.size() >= FLAGS_extensions_cache_size) {
+    entries_.erase(order_.back());
+    order_.pop_back();
+  }
+
+  order_.push_front(key);
+  auto& added = entries_[key];
+  added.expires = getUnixTime() + interval->second;
+  added.response = response;
+  added.order = order_.begin();
+}
+}
@@ -0,0 +1,95 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/registry.h>
+
+namespace osquery {
+
+/**
+ * @brief Responses of extension plugins that declared a cache interval.
+ *
+ * An extension plugin returning the same response for the same request may
+ * broadcast a response cache interval. The extension manager then answers
+ * identical requests, such as several packs selecting the same extension
+ * table in one schedule tick, without calling the extension. The cache holds
+ * a bounded number of responses and evicts the least recently used.
+ */
+class ExtensionResponseCache : private boost::noncopyable {
+ public:
+  static ExtensionResponseCache& instance() {
+    static ExtensionResponseCache instance;
+    return instance;
+  }
+
+  /// Read the cache intervals declared in a registered extension's broadcast.
+  void addBroadcast(const RouteUUID& uuid, const RegistryBroadcast& broadcast);
+
+  /// Forget an extension's cache intervals and cached responses.
+  void removeBroadcast(const RouteUUID& uuid);
+
+  /// Check if an extension plugin declared a cache interval.
+  bool isCached(const RouteUUID& uuid,
+                const std::string& registry,
+                const std::string& item) const;
+
+  /**
+   * @brief Copy a cached response for an identical request.
+   *
+   * @return true if a response was cached and has not expired.
+   */
+  bool get(const RouteUUID& uuid,
+           const std::string& registry,
+           const std::string& item,
+           const PluginRequest& request,
+           PluginResponse& response);
+
+  /// Keep a successful response if the plugin declared a cache interval.
+  void set(const RouteUUID& uuid,
+           const std::string& registry,
+           const std::string& item,
+           const PluginRequest& request,
+           const PluginResponse& response);
+
+ private:
+  ExtensionResponseCache() {}
+
+  /// A cached response and its position in the eviction order.
+  struct Entry {
+    size_t expires{0};
+    PluginResponse response;
+    std::list<std::string>::iterator order;
+  };
+
+ private:
+  /// Cache intervals in seconds, by extension, registry and plugin name.
+  std::map<std::string, size_t> intervals_;
+
+  /// Cached responses by plugin and request.
+  std::map<std::string, Entry> entries_;
+
+  /// Cached response keys, the most recently used first.
+  std::list<std::string> order_;
+
+  /// Protect the intervals and responses, extension calls are concurrent.
+  mutable Mutex mutex_;
+};
+
+/// The route info identifier used to broadcast a response cache interval.
+extern const std::string kResponseCacheRoute;
+}
@@ -0,0 +1,586 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <map>
+
+#include "osquery/core/conversions.h"
+#include "osquery/extensions/shared_memory.h"
+
+namespace osquery {
+
+const size_t kSharedMemoryMinPayload = 16 * 1024;
+
+/// Shared region names begin with this prefix.
+const std::string kSharedMemoryPrefix = "/osquery.";
+
+/// The request keys referencing a request written to shared memory.
+const std::string kSharedRequestOffset = "shared_memory_offset";
+const std::string kSharedRequestLength = "shared_memory_length";
+
+/// Identify an osquery shared region and its layout version.
+const uint32_t kSharedMemoryMagic = 0x6f737172;
+const uint32_t kSharedMemoryVersion = 1;
+
+/// The region header is followed by the rings, at this offset.
+const size_t kSharedMemoryHeaderSize = 64;
+
+/**
+ * @brief The segment states.
+ *
+ * The reader changes WRITTEN to READING, and READING to RELEASED. The writer
+ * may abandon a WRITTEN segment by changing it to RELEASED, the reader then
+ * cannot claim it.
+ */
+enum SegmentState : uint32_t {
+  SEGMENT_FREE = 0,
+  SEGMENT_WRITTEN = 1,
+  SEGMENT_RELEASED = 2,
+  SEGMENT_PADDING = 3,
+  SEGMENT_READING = 4,
+};
+
+/// Each segment begins with a header, segments are 8-byte aligned.
+struct SegmentHeader {
+  std::atomic<uint32_t> state;
+  uint32_t length;
+};
+
+static_assert(sizeof(SegmentHeader) == 8, "Unexpected segment header size");
+
+struct RegionHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t ring_size;
+};
+
+/// Regions used with each extension socket path.
+static std::map<std::string, ExtensionSharedMemoryRef> kSharedMemory;
+
+/// Protect the regions used with extension sockets.
+Mutex shared_memory_mutex_;
+
+static inline size_t alignSegment(size_t length) {
+  return (sizeof(SegmentHeader) + length + 7) & ~static_cast<size_t>(7);
+}
+
+static inline SegmentHeader* getSegment(char* data, size_t offset) {
+  return reinterpret_cast<SegmentHeader*>(data + offset);
+}
+
+void SharedMemoryRing::reclaim() {
+  while (used_ > 0) {
+    auto segment = getSegment(data_, tail_);
+    auto state = segment->state.load(std::memory_order_acquire);
+    if (state != SEGMENT_RELEASED && state != SEGMENT_PADDING) {
+      break;
+    }
+    auto size = alignSegment(segment->length);
+    segment->state.store(SEGMENT_FREE, std::memory_order_relaxed);
+    tail_ = (tail_ + size) % size_;
+    used_ -= size;
+  }
+
+  if (used_ == 0) {
+    // An empty ring restarts, the largest payloads fit without wrapping.
+    head_ = 0;
+    tail_ = 0;
+  }
+}
+
+Status SharedMemoryRing::write(const std::string& payload, size_t& offset) {
+  auto size = alignSegment(payload.size());
+  if (payload.size() > UINT32_MAX || size > size_) {
+    return Status(1, "Payload is larger than the ring");
+  }
+
+  WriteLock lock(mutex_);
+  reclaim();
+  if (head_ + size > size_) {
+    // The segment is contiguous, pad the end of the ring and wrap.
+    auto remaining = size_ - head_;
+    if (used_ + remaining + size > size_) {
+      return Status(1, "Ring is full");
+    }
+    auto padding = getSegment(data_, head_);
+    padding->length = static_cast<uint32_t>(remaining - sizeof(SegmentHeader));
+    padding->state.store(SEGMENT_PADDING, std::memory_order_release);
+    used_ += remaining;
+    head_ = 0;
+  } else if (used_ + size > size_) {
+    return Status(1, "Ring is full");
+  }
+
+  auto segment = getSegment(data_, head_);
+  segment->length = static_cast<uint32_t>(payload.size());
+  memcpy(data_ + head_ + sizeof(SegmentHeader), payload.data(), payload.size());
+  segment->state.store(SEGMENT_WRITTEN, std::memory_order_release);
+
+  offset = head_;
+  head_ = (head_ + size) % size_;
+  used_ += size;
+  return Status(0, "OK");
+}
+
+Status SharedMemoryRing::read(size_t offset,
+                              size_t length,
+                              std::string& payload) {
+  if (offset % 8 != 0 || offset >= size_ || length > UINT32_MAX ||
+      alignSegment(length) > size_ - offset) {
+    return Status(1, "Segment is outside of the ring");
+  }
+
+  // Claim the segment, the writer cannot abandon it while it is copied.
+  auto segment = getSegment(data_, offset);
+  uint32_t state = SEGMENT_WRITTEN;
+  if (!segment->state.compare_exchange_strong(
+          state, SEGMENT_READING, std::memory_order_acquire)) {
+    return Status(1, "Segment is not readable");
+  }
+
+  if (segment->length != length) {
+    segment->state.store(SEGMENT_WRITTEN, std::memory_order_release);
+    return Status(1, "Segment is not readable");
+  }
+
+  payload.assign(data_ + offset + sizeof(SegmentHeader), length);
+  segment->state.store(SEGMENT_RELEASED, std::memory_order_release);
+  return Status(0, "OK");
+}
+
+void SharedMemoryRing::release(size_t offset) {
+  WriteLock lock(mutex_);
+  if (offset % 8 != 0 || offset >= size_) {
+    return;
+  }
+
+  // A segment the reader claimed or released is left to the reader.
+  uint32_t state = SEGMENT_WRITTEN;
+  getSegment(data_, offset)
+      ->state.compare_exchange_strong(
+          state, SEGMENT_RELEASED, std::memory_order_relaxed);
+  reclaim();
+}
+
+void SharedMemoryRing::reset() {
+  WriteLock lock(mutex_);
+  size_t position = tail_;
+  for (size_t used = 0; used < used_;) {
+    auto segment = getSegment(data_, position);
+    uint32_t state = SEGMENT_WRITTEN;
+    segment->state.compare_exchange_strong(
+        state, SEGMENT_RELEASED, std::memory_order_relaxed);
+    auto size = alignSegment(segment->length);
+    position = (position + size) % size_;
+    used += size;
+  }
+  reclaim();
+}
+
+ExtensionSharedMemory::~ExtensionSharedMemory() {
+  unlink();
+#ifndef WIN32
+  if (region_ != nullptr) {
+    munmap(region_, region_size_);
+  }
+#endif
+}
+
+void ExtensionSharedMemory::unlink() {
+#ifndef WIN32
+  if (linked_) {
+    shm_unlink(name_.c_str());
+    linked_ = false;
+  }
+#endif
+}
+
+Status ExtensionSharedMemory::map(int fd, size_t size, bool creator) {
+#ifndef WIN32
+  auto region = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (region == MAP_FAILED) {
+    return Status(1, "Cannot map shared memory");
+  }
+  region_ = static_cast<char*>(region);
+  region_size_ = size;
+
+  auto header = reinterpret_cast<RegionHeader*>(region_);
+  if (creator) {
+    header->magic = kSharedMemoryMagic;
+    header->version = kSharedMemoryVersion;
+    header->ring_size = (size - kSharedMemoryHeaderSize) / 2;
+  } else if (header->magic != kSharedMemoryMagic ||
+             header->version != kSharedMemoryVersion ||
+             header->ring_size % 8 != 0 ||
+             kSharedMemoryHeaderSize + header->ring_size * 2 != size) {
+    return Status(1, "Unknown shared memory layout");
+  }
+
+  auto ring_size = static_cast<size_t>(header->ring_size);
+  auto first = std::unique_ptr<SharedMemoryRing>(
+      new SharedMemoryRing(region_ + kSharedMemoryHeaderSize, ring_size));
+  auto second = std::unique_ptr<SharedMemoryRing>(new SharedMemoryRing(
+      region_ + kSharedMemoryHeaderSize + ring_size, ring_size));
+  outbound_ = (creator) ? std::move(first) : std::move(second);
+  inbound_ = (creator) ? std::move(second) : std::move(first);
+  return Status(0, "OK");
+#else
+  return Status(1, "Shared memory is not supported");
+#endif
+}
+
+Status ExtensionSharedMemory::create(size_t size,
+                                     ExtensionSharedMemoryRef& shm) {
+#ifndef WIN32
+  // Round each ring to the segment alignment.
+  size = (size + 7) & ~static_cast<size_t>(7);
+  if (size < kSharedMemoryMinPayload) {
+    return Status(1, "Shared memory ring is too small");
+  }
+
+  shm = ExtensionSharedMemoryRef(new ExtensionSharedMemory());
+  shm->name_ = kSharedMemoryPrefix + std::to_string(getpid()) + "." +
+               std::to_string(rand());
+  auto fd = shm_open(shm->name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    shm = nullptr;
+    return Status(1, "Cannot create shared memory");
+  }
+  shm->linked_ = true;
+
+  auto region_size = kSharedMemoryHeaderSize + size * 2;
+  auto status = Status(1, "Cannot size shared memory");
+  if (ftruncate(fd, static_cast<off_t>(region_size)) == 0) {
+    status = shm->map(fd, region_size, true);
+  }
+  close(fd);
+  if (!status.ok()) {
+    shm = nullptr;
+  }
+  return status;
+#else
+  return Status(1, "Shared memory is not supported");
+#endif
+}
+
+Status ExtensionSharedMemory::open(const std::string& name,
+                                   ExtensionSharedMemoryRef& shm) {
+#ifndef WIN32
+  // Only open regions named by an osquery extension.
+  if (name.compare(0, kSharedMemoryPrefix.size(), kSharedMemoryPrefix) != 0 ||
+      name.find('/', 1) != std::string::npos) {
+    return Status(1, "Unexpected shared memory name");
+  }
+
+  auto fd = shm_open(name.c_str(), O_RDWR, 0600);
+  if (fd < 0) {
+    return Status(1, "Cannot open shared memory");
+  }
+
+  struct stat region;
+  auto status = Status(1, "Cannot size shared memory");
+  shm = ExtensionSharedMemoryRef(new ExtensionSharedMemory());
+  shm->name_ = name;
+  if (fstat(fd, &region) == 0 &&
+      static_cast<size_t>(region.st_size) > kSharedMemoryHeaderSize) {
+    status = shm->map(fd, static_cast<size_t>(region.st_size), false);
+  }
+  close(fd);
+  if (!status.ok()) {
+    shm = nullptr;
+  }
+  return status;
+#else
+  return Status(1, "Shared memory is not supported");
+#endif
+}
+
+void setSharedMemory(const std::string& path, ExtensionSharedMemoryRef shm) {
+  WriteLock lock(shared_memory_mutex_);
+  if (shm == nullptr) {
+    kSharedMemory.erase(path);
+  } else {
+    kSharedMemory[path] = std::move(shm);
+  }
+}
+
+ExtensionSharedMemoryRef getSharedMemory(const std::string& path) {
+  WriteLock lock(shared_memory_mutex_);
+  auto shm = kSharedMemory.find(path);
+  return (shm == kSharedMemory.end()) ? nullptr : shm->second;
+}
+
+/// Payload types, the first byte of each payload.
+enum SharedPayloadType : char {
+  SHARED_PAYLOAD_REQUEST = 'M',
+  SHARED_PAYLOAD_COLUMNS = 'C',
+  SHARED_PAYLOAD_ROWS = 'R',
+};
+
+static inline void writeSize(size_t size, std::string& data) {
+  auto value = static_cast<uint32_t>(size);
+  data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static inline void writeString(const std::string& value, std::string& data) {
+  writeSize(value.size(), data);
+  data.append(value);
+}
+
+static inline void writeMap(const std::map<std::string, std::string>& values,
+                            std::string& data) {
+  writeSize(values.size(), data);
+  for (const auto& value : values) {
+    writeString(value.first, data);
+    writeString(value.second, data);
+  }
+}
+
+/// Read from a payload, every read checks the remaining length.
+class SharedPayloadReader {
+ public:
+  explicit SharedPayloadReader(const std::string& data) : data_(data) {}
+
+  bool size(size_t& size) {
+    uint32_t value = 0;
+    if (data_.size() - position_ < sizeof(value)) {
+      return false;
+    }
+    memcpy(&value, data_.data() + position_, sizeof(value));
+    position_ += sizeof(value);
+    size = value;
+    return true;
+  }
+
+  bool string(std::string& value) {
+    size_t length = 0;
+    if (!size(length) || data_.size() - position_ < length) {
+      return false;
+    }
+    value.assign(data_, position_, length);
+    position_ += length;
+    return true;
+  }
+
+  bool map(std::map<std::string, std::string>& values) {
+    size_t count = 0;
+    if (!size(count)) {
+      return false;
+    }
+    for (size_t i = 0; i < count; i++) {
+      std::string key;
+      if (!string(key) || !string(values[key])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+ private:
+  const std::string& data_;
+
+  /// The first byte is the payload type.
+  size_t position_{1};
+};
+
+size_t estimateSharedPayload(const PluginRequest& request) {
+  size_t size = 5;
+  for (const auto& item : request) {
+    size += 8 + item.first.size() + item.second.size();
+  }
+  return size;
+}
+
+size_t estimateSharedPayload(const PluginResponse& response) {
+  size_t size = 5;
+  for (const auto& row : response) {
+    size += 4 + estimateSharedPayload(row);
+  }
+  return size;
+}
+
+void serializeSharedPayload(const PluginRequest& request, std::string& data) {
+  data.clear();
+  data.reserve(estimateSharedPayload(request));
+  data.push_back(SHARED_PAYLOAD_REQUEST);
+  writeMap(request, data);
+}
+
+void serializeSharedPayload(const PluginResponse& response, std::string& data) {
+  data.clear();
+  data.reserve(estimateSharedPayload(response));
+
+  // Every row must have exactly the columns of the first row.
+  bool uniform = true;
+  for (const auto& row : response) {
+    if (row.size() != response.front().size() ||
+        !std::equal(row.begin(),
+                    row.end(),
+                    response.front().begin(),
+                    [](const std::pair<const std::string, std::string>& l,
+                       const std::pair<const std::string, std::string>& r) {
+                      return l.first == r.first;
+                    })) {
+      uniform = false;
+      break;
+    }
+  }
+
+  if (!uniform) {
+    data.push_back(SHARED_PAYLOAD_ROWS);
+    writeSize(response.size(), data);
+    for (const auto& row : response) {
+      writeMap(row, data);
+    }
+    return;
+  }
+
+  data.push_back(SHARED_PAYLOAD_COLUMNS);
+  writeSize((response.empty()) ? 0 : response.front().size(), data);
+  if (!response.empty()) {
+    for (const auto& column : response.front()) {
+      writeString(column.first, data);
+    }
+  }
+
+  writeSize(response.size(), data);
+  for (const auto& row : response) {
+    for (const auto& column : row) {
+      writeString(column.second, data);
+    }
+  }
+}
+
+Status deserializeSharedPayload(const std::string& data,
+                                PluginRequest& request) {
+  SharedPayloadReader reader(data);
+  if (data.empty() || data[0] != SHARED_PAYLOAD_REQUEST ||
+      !reader.map(request)) {
+    return Status(1, "Malformed shared memory request");
+  }
+  return Status(0, "OK");
+}
+
+Status deserializeSharedPayload(const std::string& data,
+                                PluginResponse& response) {
+  SharedPayloadReader reader(data);
+  if (data.empty() ||
+      (data[0] != SHARED_PAYLOAD_COLUMNS && data[0] != SHARED_PAYLOAD_ROWS)) {
+    return Status(1, "Malformed shared memory response");
+  }
+
+  if (data[0] == SHARED_PAYLOAD_ROWS) {
+    size_t count = 0;
+    if (!reader.size(count)) {
+      return Status(1, "Malformed shared memory response");
+    }
+    for (size_t i = 0; i < count; i++) {
+      PluginResponse::value_type row;
+      if (!reader.map(row)) {
+        return Status(1, "Malformed shared memory response");
+      }
+      response.push_back(std::move(row));
+    }
+    return Status(0, "OK");
+  }
+
+  size_t count = 0;
+  std::vector<std::string> columns;
+  if (!reader.size(count)) {
+    return Status(1, "Malformed shared memory response");
+  }
+  for (size_t i = 0; i < count; i++) {
+    std::string column;
+    if (!reader.string(column)) {
+      return Status(1, "Malformed shared memory response");
+    }
+    columns.push_back(std::move(column));
+  }
+
+  // Rows without columns are not bounded by the payload's values.
+  if (!reader.size(count) || (columns.empty() && count > data.size())) {
+    return Status(1, "Malformed shared memory response");
+  }
+  for (size_t i = 0; i < count; i++) {
+    // The column names are sorted, each is inserted at the end of the row.
+    PluginResponse::value_type row;
+    for (const auto& column : columns) {
+      std::string value;
+      if (!reader.string(value)) {
+        return Status(1, "Malformed shared memory response");
+      }
+      row.emplace_hint(row.end(), column, std::move(value));
+    }
+    response.push_back(std::move(row));
+  }
+  return Status(0, "OK");
+}
+
+bool writeSharedRequest(ExtensionSharedMemory& shm,
+                        const PluginRequest& request,
+                        PluginRequest& reference) {
+  if (estimateSharedPayload(request) < kSharedMemoryMinPayload) {
+    return false;
+  }
+
+  std::string data;
+  size_t offset = 0;
+  serializeSharedPayload(request, data);
+  if (!shm.outbound().write(data, offset).ok()) {
+    return false;
+  }
+
+  reference = {{kSharedRequestOffset, std::to_string(offset)},
+               {kSharedRequestLength, std::to_string(data.size())}};
+  return true;
+}
+
+void releaseSharedRequest(ExtensionSharedMemory& shm,
+                          const PluginRequest& reference) {
+  unsigned long long offset = 0;
+  if (isSharedRequest(reference) &&
+      safeStrtoull(reference.at(kSharedRequestOffset), 10, offset).ok()) {
+    shm.outbound().release(static_cast<size_t>(offset));
+  }
+}
+
+bool isSharedRequest(const PluginRequest& request) {
+  return (request.size() == 2 && request.count(kSharedRequestOffset) > 0 &&
+          request.count(kSharedRequestLength) > 0);
+}
+
+Status readSharedRequest(ExtensionSharedMemory& shm,
+                         const PluginRequest& reference,
+                         PluginRequest& request) {
+  unsigned long long offset = 0;
+  unsigned long long length = 0;
+  if (!isSharedRequest(reference) ||
+      !safeStrtoull(reference.at(kSharedRequestOffset), 10, offset).ok() ||
+      !safeStrtoull(reference.at(kSharedRequestLength), 10, length).ok()) {
+    return Status(1, "Malformed shared memory request");
+  }
+
+  std::string data;
+  auto status = shm.inbound().read(offset, length, data);
+  if (!status.ok()) {
+    return status;
+  }
+  return deserializeSharedPayload(data, request);
+}
+}
@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/registry.h>
+
+namespace osquery {
+
+/// Payloads smaller than this are sent over the extension socket.
+extern const size_t kSharedMemoryMinPayload;
+
+/**
+ * @brief A ring of payload segments in memory shared by two processes.
+ *
+ * Each ring has a single writing process. The writer appends a segment and
+ * sends its offset and length over the extension socket, the reader copies
+ * the segment and marks it released. The writer reclaims released segments
+ * in order. If a call fails before the reader copies its segment, the writer
+ * abandons the segment, otherwise it would prevent every later reclaim.
+ */
+class SharedMemoryRing : private boost::noncopyable {
+ public:
+  SharedMemoryRing(char* data, size_t size) : data_(data), size_(size) {}
+
+  /**
+   * @brief Copy a payload into a new segment.
+   *
+   * @param payload The bytes to write.
+   * @param offset The output offset of the segment, sent to the reader.
+   * @return success if the ring had space for the payload.
+   */
+  Status write(const std::string& payload, size_t& offset);
+
+  /**
+   * @brief Copy a segment written by the other process and release it.
+   *
+   * The offset and length are received from the other process and checked
+   * against the ring bounds and the segment header.
+   */
+  Status read(size_t offset, size_t length, std::string& payload);
+
+  /// Abandon a segment this process wrote if the reader has not claimed it.
+  void release(size_t offset);
+
+  /// Abandon every segment the reader has not claimed.
+  void reset();
+
+ private:
+  /// Advance the tail past segments the reader released.
+  void reclaim();
+
+ private:
+  /// The start of the ring within the mapped region.
+  char* data_{nullptr};
+
+  /// The size of the ring in bytes.
+  size_t size_{0};
+
+  /// The writer's next segment offset.
+  size_t head_{0};
+
+  /// The writer's oldest unreclaimed segment offset.
+  size_t tail_{0};
+
+  /// The bytes used by unreclaimed segments.
+  size_t used_{0};
+
+  /// Protect the writer's offsets, handler threads write concurrently.
+  Mutex mutex_;
+};
+
+/**
+ * @brief A region shared by an extension and the extension manager.
+ *
+ * The extension creates the region and offers its name when registering. If
+ * the extension manager opens the region both processes map two rings, the
+ * extension writes large responses into the first, and the manager writes
+ * large requests, such as logger payloads, into the second. The socket is
+ * still used for every call.
+ */
+class ExtensionSharedMemory : private boost::noncopyable {
+ public:
+  ~ExtensionSharedMemory();
+
+  /// Create a new region with two rings of a size, used by extensions.
+  static Status create(size_t size,
+                       std::shared_ptr<ExtensionSharedMemory>& shm);
+
+  /// Open a region created by an extension, used by the extension manager.
+  static Status open(const std::string& name,
+                     std::shared_ptr<ExtensionSharedMemory>& shm);
+
+  /// The region's name, offered to the extension manager.
+  const std::string& name() const {
+    return name_;
+  }
+
+  /// Remove the region's name, the mappings remain until both processes end.
+  void unlink();
+
+  /// The ring this process writes.
+  SharedMemoryRing& outbound() {
+    return *outbound_;
+  }
+
+  /// The ring the other process writes.
+  SharedMemoryRing& inbound() {
+    return *inbound_;
+  }
+
+ private:
+  ExtensionSharedMemory() {}
+
+  /// Map a region and set the rings, the creator writes the first ring.
+  Status map(int fd, size_t size, bool creator);
+
+ private:
+  /// The region's name.
+  std::string name_;
+
+  /// The mapped region.
+  char* region_{nullptr};
+
+  /// The size of the mapped region.
+  size_t region_size_{0};
+
+  /// Set if this process has not removed the region's name.
+  bool linked_{false};
+
+  std::unique_ptr<SharedMemoryRing> outbound_;
+  std::unique_ptr<SharedMemoryRing> inbound_;
+};
+
+using ExtensionSharedMemoryRef = std::shared_ptr<ExtensionSharedMemory>;
+
+/// Set or remove (using nullptr) the region used with an extension socket.
+void setSharedMemory(const std::string& path, ExtensionSharedMemoryRef shm);
+
+/// Get the region used with an extension socket, nullptr if no region.
+ExtensionSharedMemoryRef getSharedMemory(const std::string& path);
+
+/// The approximate serialized size of a request or response.
+size_t estimateSharedPayload(const PluginRequest& request);
+size_t estimateSharedPayload(const PluginResponse& response);
+
+/// Flatten a request into a shared memory payload.
+void serializeSharedPayload(const PluginRequest& request, std::string& data);
+
+/// Flatten a response, each column name is written once if the rows agree.
+void serializeSharedPayload(const PluginResponse& response, std::string& data);
+
+/// Read a request from a shared memory payload.
+Status deserializeSharedPayload(const std::string& data,
+                                PluginRequest& request);
+
+/// Read a response from a shared memory payload, appending the rows.
+Status deserializeSharedPayload(const std::string& data,
+                                PluginResponse& response);
+
+/**
+ * @brief Write a large request to the outbound ring.
+ *
+ * @param shm The region used with the extension.
+ * @param request The request to send.
+ * @param reference The output request sent over the socket instead.
+ * @return true if the request was written, otherwise send the request.
+ */
+bool writeSharedRequest(ExtensionSharedMemory& shm,
+                        const PluginRequest& request,
+                        PluginRequest& reference);
+
+/// Abandon the segment of a sent request if the other process did not read it.
+void releaseSharedRequest(ExtensionSharedMemory& shm,
+                          const PluginRequest& reference);
+
+/// Check if a received request references a request in shared memory.
+bool isSharedRequest(const PluginRequest& request);
+
+/// Read a request referenced by a received request from the inbound ring.
+Status readSharedRequest(ExtensionSharedMemory& shm,
+                         const PluginRequest& reference,
+                         PluginRequest& request);
+}
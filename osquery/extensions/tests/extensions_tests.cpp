@@ -13,6 +13,11 @@
 #define GTEST_HAS_TR1_TUPLE 0
 #endif
 
+#ifndef WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
 #include <stdexcept>
 
 #include <gtest/gtest.h>
@@ -22,6 +27,7 @@
 
 #include "osquery/core/process.h"
 #include "osquery/extensions/interface.h"
+#include "osquery/extensions/response_cache.h"
 #include "osquery/filesystem/fileops.h"
 #include "osquery/tests/test_util.h"
 
@@ -29,6 +35,8 @@ using namespace osquery::extensions;
 
 namespace osquery {
 
+DECLARE_uint64(extensions_cache_size);
+
 const int kDelayUS = 2000;
 const int kTimeoutUS = 1000000;
 
@@ -172,6 +180,40 @@ TEST_F(ExtensionsTest, test_extension_start) {
   Registry::allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_health_channel) {
+  auto status = startExtensionManager(socket_path);
+  EXPECT_TRUE(status.ok());
+  EXPECT_TRUE(socketExists(socket_path));
+  ASSERT_TRUE(ping());
+
+  // One connection answers every health check.
+  EXManagerClient client(socket_path);
+  client.setTimeout(1000);
+  for (size_t i = 0; i < 3; i++) {
+    ExtensionStatus ping_status;
+    client.get()->ping(ping_status);
+    EXPECT_EQ(ping_status.code, ExtensionCode::EXT_SUCCESS);
+  }
+
+#ifndef WIN32
+  int fd = client.getFD();
+  EXPECT_GE(fd, 0);
+
+  // An idle channel waits for the interval.
+  ExtensionWatcher watcher(socket_path, 200, false);
+  EXPECT_TRUE(watcher.waitForHangup({fd}).empty());
+
+  // A channel closed by the peer ends the wait.
+  int pair[2];
+  ASSERT_EQ(socketpair(AF_UNIX, SOCK_STREAM, 0, pair), 0);
+  close(pair[1]);
+  auto closed = watcher.waitForHangup({fd, pair[0]});
+  ASSERT_EQ(closed.size(), 1U);
+  EXPECT_EQ(closed[0], 1U);
+  close(pair[0]);
+#endif
+}
+
 class ExtensionPlugin : public Plugin {
  public:
   Status call(const PluginRequest& request, PluginResponse& response) {
@@ -254,10 +296,280 @@ TEST_F(ExtensionsTest, test_extension_broadcast) {
   EXPECT_EQ(response.size(), 1U);
   EXPECT_EQ(response[0]["test_key"], "test_value");
 
+#ifndef WIN32
+  // The extension did not open the region, so it never reads the requests.
+  ExtensionSharedMemoryRef extension_shm;
+  ExtensionSharedMemoryRef manager_shm;
+  auto size = kSharedMemoryMinPayload * 4;
+  ASSERT_TRUE(ExtensionSharedMemory::create(size, extension_shm).ok());
+  ASSERT_TRUE(
+      ExtensionSharedMemory::open(extension_shm->name(), manager_shm).ok());
+  extension_shm->unlink();
+  setSharedMemory(ext_socket, manager_shm);
+
+  // Each unread request is abandoned once its call completes.
+  std::string payload(kSharedMemoryMinPayload * 3, 'a');
+  for (size_t i = 0; i < 2; i++) {
+    response.clear();
+    callExtension(ext_socket,
+                  "extension_test",
+                  "test_alias",
+                  {{"test_key", payload}},
+                  response);
+  }
+  size_t offset = 0;
+  EXPECT_TRUE(manager_shm->outbound().write(payload, offset).ok());
+  setSharedMemory(ext_socket, nullptr);
+#endif
+
   Registry::removeBroadcast(uuid);
   Registry::allowDuplicates(false);
 }
 
+TEST_F(ExtensionsTest, test_columnar_response) {
+  PluginResponse rows = {
+      {{"a", "1"}, {"b", "2"}}, {{"a", "3"}, {"b", "4"}},
+  };
+  auto expected = rows;
+
+  // Rows with the same columns are sent with the column names once.
+  ExtensionColumnarResponse columnar;
+  encodeColumnarResponse(rows, columnar);
+  std::vector<std::string> columns = {"a", "b"};
+  EXPECT_EQ(columnar.columns, columns);
+  ASSERT_EQ(columnar.rows.size(), 2U);
+  EXPECT_EQ(columnar.rows[1][0], "3");
+  EXPECT_TRUE(columnar.response.empty());
+
+  PluginResponse response;
+  decodeColumnarResponse(columnar, response);
+  EXPECT_EQ(response, expected);
+
+  // Rows with differing columns are sent unchanged.
+  rows = {{{"a", "1"}}, {{"b", "2"}}};
+  expected = rows;
+  ExtensionColumnarResponse mixed;
+  encodeColumnarResponse(rows, mixed);
+  EXPECT_TRUE(mixed.columns.empty());
+  EXPECT_TRUE(mixed.rows.empty());
+
+  response.clear();
+  decodeColumnarResponse(mixed, response);
+  EXPECT_EQ(response, expected);
+}
+
+TEST_F(ExtensionsTest, test_internal_query_context) {
+  QueryContext context;
+  context.constraints["path"].affinity = TEXT_TYPE;
+  context.constraints["path"].add(Constraint(EQUALS, "/bin"));
+  context.constraints["size"].affinity = BIGINT_TYPE;
+  context.constraints["size"].add(Constraint(GREATER_THAN, "10"));
+  context.colsUsed = UsedColumns({"path", "size"});
+
+  InternalQueryContext internal;
+  setInternalContext(context, internal);
+  ASSERT_EQ(internal.constraints.size(), 2U);
+  EXPECT_EQ(internal.constraints["size"].affinity, "BIGINT");
+  EXPECT_TRUE(internal.__isset.used_columns);
+
+  // The structured context restores the constraints and used columns.
+  QueryContext restored;
+  setQueryContext(internal, restored);
+  EXPECT_TRUE(restored.hasConstraint("path", EQUALS));
+  EXPECT_EQ(restored.constraints["path"].getAll(EQUALS),
+            std::set<std::string>({"/bin"}));
+  EXPECT_EQ(restored.constraints["size"].affinity, BIGINT_TYPE);
+  EXPECT_TRUE(restored.constraints["size"].exists(GREATER_THAN));
+  ASSERT_TRUE(restored.colsUsed.is_initialized());
+  EXPECT_EQ(*restored.colsUsed, *context.colsUsed);
+
+  // A context without used columns leaves them unknown.
+  InternalQueryContext unused;
+  setInternalContext(QueryContext(), unused);
+  EXPECT_FALSE(unused.__isset.used_columns);
+}
+
+/// The number of batches generated by the cursor test table.
+static size_t kCursorBatches{0};
+
+class CursorTestTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  RowGeneratorRef generator(QueryContext& context) override {
+    size_t i = 0;
+    return std::make_shared<FunctionRowGenerator>(
+        [i](QueryData& batch) mutable {
+          if (i >= 10) {
+            return false;
+          }
+          kCursorBatches++;
+          batch.push_back({{"i", INTEGER(i++)}});
+          batch.push_back({{"i", INTEGER(i++)}});
+          return true;
+        });
+  }
+};
+
+TEST_F(ExtensionsTest, test_table_cursor) {
+  Registry::add<CursorTestTablePlugin>("table", "cursor_test");
+  kCursorBatches = 0;
+
+  ExtensionHandler handler;
+  ExtensionTableCursor cursor;
+  handler.openTable(cursor, "cursor_test", InternalQueryContext());
+  ASSERT_EQ(cursor.status.code, ExtensionCode::EXT_SUCCESS);
+  // Nothing is generated until the rows are fetched.
+  EXPECT_EQ(kCursorBatches, 0U);
+
+  // Each fetch generates only the rows it returns.
+  ExtensionColumnarResponse response;
+  handler.fetchTable(response, cursor.cursor, 3);
+  EXPECT_EQ(response.rows.size(), 3U);
+  EXPECT_TRUE(response.more);
+  EXPECT_EQ(kCursorBatches, 2U);
+
+  size_t rows = response.rows.size();
+  while (response.more) {
+    response = ExtensionColumnarResponse();
+    handler.fetchTable(response, cursor.cursor, 3);
+    ASSERT_EQ(response.status.code, ExtensionCode::EXT_SUCCESS);
+    rows += response.rows.size();
+  }
+  EXPECT_EQ(rows, 10U);
+
+  // An exhausted cursor is closed.
+  response = ExtensionColumnarResponse();
+  handler.fetchTable(response, cursor.cursor, 3);
+  EXPECT_EQ(response.status.code, ExtensionCode::EXT_FAILED);
+
+  // Closing a cursor early stops the generation.
+  kCursorBatches = 0;
+  handler.openTable(cursor, "cursor_test", InternalQueryContext());
+  handler.fetchTable(response, cursor.cursor, 1);
+  handler.closeTable(cursor.cursor);
+  EXPECT_EQ(kCursorBatches, 1U);
+  response = ExtensionColumnarResponse();
+  handler.fetchTable(response, cursor.cursor, 1);
+  EXPECT_EQ(response.status.code, ExtensionCode::EXT_FAILED);
+}
+
+#ifndef WIN32
+TEST_F(ExtensionsTest, test_shared_memory_ring) {
+  ExtensionSharedMemoryRef extension;
+  auto size = kSharedMemoryMinPayload * 4;
+  ASSERT_TRUE(ExtensionSharedMemory::create(size, extension).ok());
+  ExtensionSharedMemoryRef manager;
+  ASSERT_TRUE(ExtensionSharedMemory::open(extension->name(), manager).ok());
+  extension->unlink();
+
+  // Each process reads the ring the other process writes.
+  std::string payload(kSharedMemoryMinPayload * 3, 'a');
+  size_t offset = 0;
+  ASSERT_TRUE(extension->outbound().write(payload, offset).ok());
+  EXPECT_FALSE(extension->outbound().write(payload, offset).ok());
+
+  std::string received;
+  EXPECT_FALSE(manager->inbound().read(offset + 8, 8, received).ok());
+  ASSERT_TRUE(manager->inbound().read(offset, payload.size(), received).ok());
+  EXPECT_EQ(received, payload);
+
+  // A segment is read once, and released segments are reused.
+  EXPECT_FALSE(manager->inbound().read(offset, payload.size(), received).ok());
+  EXPECT_TRUE(extension->outbound().write(payload, offset).ok());
+
+  // Large requests are referenced by a request sent over the socket.
+  PluginRequest request = {{"action", "log"}, {"string", payload}};
+  PluginRequest reference;
+  ASSERT_TRUE(writeSharedRequest(*manager, request, reference));
+  EXPECT_TRUE(isSharedRequest(reference));
+
+  PluginRequest shared_request;
+  ASSERT_TRUE(readSharedRequest(*extension, reference, shared_request).ok());
+  EXPECT_EQ(shared_request, request);
+  EXPECT_FALSE(writeSharedRequest(*manager, {{"action", "log"}}, reference));
+
+  // A request the extension never read is abandoned and cannot be read.
+  ASSERT_TRUE(writeSharedRequest(*manager, request, reference));
+  releaseSharedRequest(*manager, reference);
+  EXPECT_FALSE(readSharedRequest(*extension, reference, shared_request).ok());
+  ASSERT_TRUE(manager->outbound().write(payload, offset).ok());
+
+  // A reset abandons every unread segment.
+  manager->outbound().reset();
+  EXPECT_FALSE(
+      extension->inbound().read(offset, payload.size(), received).ok());
+  EXPECT_TRUE(manager->outbound().write(payload, offset).ok());
+}
+#endif
+
+TEST_F(ExtensionsTest, test_shared_memory_payload) {
+  PluginResponse response = {{{"a", "1"}, {"b", "2"}}, {{"a", "3"}, {"b", ""}}};
+  std::string data;
+  serializeSharedPayload(response, data);
+
+  PluginResponse decoded;
+  ASSERT_TRUE(deserializeSharedPayload(data, decoded).ok());
+  EXPECT_EQ(decoded, response);
+
+  // Rows with differing columns are written with each column name.
+  response.push_back({{"c", "4"}});
+  serializeSharedPayload(response, data);
+  decoded.clear();
+  ASSERT_TRUE(deserializeSharedPayload(data, decoded).ok());
+  EXPECT_EQ(decoded, response);
+
+  // Truncated payloads are rejected.
+  data.pop_back();
+  decoded.clear();
+  EXPECT_FALSE(deserializeSharedPayload(data, decoded).ok());
+  PluginRequest request;
+  EXPECT_FALSE(deserializeSharedPayload(data, request).ok());
+}
+
+TEST_F(ExtensionsTest, test_response_cache) {
+  auto& cache = ExtensionResponseCache::instance();
+  RegistryBroadcast broadcast;
+  broadcast["config"]["cached"] = {{{"id", "cache"}, {"seconds", "60"}}};
+  broadcast["config"]["uncached"] = {};
+  cache.addBroadcast(1, broadcast);
+  EXPECT_TRUE(cache.isCached(1, "config", "cached"));
+  EXPECT_FALSE(cache.isCached(1, "config", "uncached"));
+  EXPECT_FALSE(cache.isCached(2, "config", "cached"));
+
+  PluginRequest request = {{"action", "genConfig"}};
+  PluginResponse response;
+  EXPECT_FALSE(cache.get(1, "config", "cached", request, response));
+  cache.set(1, "config", "cached", request, {{{"data", "1"}}});
+  cache.set(1, "config", "uncached", request, {{{"data", "2"}}});
+  EXPECT_TRUE(cache.get(1, "config", "cached", request, response));
+  ASSERT_EQ(response.size(), 1U);
+  EXPECT_EQ(response[0]["data"], "1");
+  EXPECT_FALSE(cache.get(1, "config", "uncached", request, response));
+
+  // Each request has a distinct response.
+  PluginRequest other = {{"action", "genPack"}};
+  EXPECT_FALSE(cache.get(1, "config", "cached", other, response));
+
+  // The least recently used response is evicted.
+  auto cache_size = FLAGS_extensions_cache_size;
+  FLAGS_extensions_cache_size = 1;
+  cache.set(1, "config", "cached", other, {{{"data", "3"}}});
+  EXPECT_FALSE(cache.get(1, "config", "cached", request, response));
+  EXPECT_TRUE(cache.get(1, "config", "cached", other, response));
+  FLAGS_extensions_cache_size = cache_size;
+
+  // Responses are forgotten when the extension is removed.
+  cache.removeBroadcast(1);
+  EXPECT_FALSE(cache.isCached(1, "config", "cached"));
+  EXPECT_FALSE(cache.get(1, "config", "cached", other, response));
+}
+
 TEST_F(ExtensionsTest, test_extension_module_search) {
   createMockFileStructure();
   EXPECT_FALSE(loadModules(kFakeDirectory + "/root.txt"));
@@ -43,4 +43,13 @@ static void PLIST_parse_file(benchmark::State& state) {
 }
 
 BENCHMARK(PLIST_parse_file);
+
+static void PLIST_parse_file_cached(benchmark::State& state) {
+  while (state.KeepRunning()) {
+    pt::ptree tree;
+    auto status = cachedParsePlist(kTestDataPath + "test.plist", tree);
+  }
+}
+
+BENCHMARK(PLIST_parse_file_cached);
 }
@@ -0,0 +1,250 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/stat.h>
+
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/system.h>
+
+namespace fs = boost::filesystem;
+namespace pt = boost::property_tree;
+
+namespace osquery {
+
+FLAG(uint64,
+     plist_cache_max_bytes,
+     16 * 1024 * 1024,
+     "Maximum bytes of parsed property lists kept in memory (0 disables)");
+
+/// Stat a property list, the modification time is in nanoseconds.
+static bool getPlistIdentity(const fs::path& path,
+                             std::string& identity,
+                             uint64_t& mtime) {
+  struct stat file;
+  if (::stat(path.string().c_str(), &file) != 0) {
+    return false;
+  }
+
+#if defined(__APPLE__)
+  mtime = file.st_mtimespec.tv_sec * 1000000000ULL + file.st_mtimespec.tv_nsec;
+#else
+  mtime = static_cast<uint64_t>(file.st_mtime) * 1000000000ULL;
+#endif
+  identity = std::to_string(file.st_dev) + ":" + std::to_string(file.st_ino) +
+             ":" + std::to_string(file.st_size) + ":" + std::to_string(mtime);
+  return true;
+}
+
+/// Append a length-prefixed string.
+static inline void writeString(const std::string& value, std::string& out) {
+  auto size = static_cast<uint32_t>(value.size());
+  out.append(reinterpret_cast<const char*>(&size), sizeof(size));
+  out.append(value);
+}
+
+/// Read a length-prefixed string, see writeString.
+static inline bool readString(const std::string& in,
+                              size_t& offset,
+                              std::string& value) {
+  uint32_t size = 0;
+  if (offset + sizeof(size) > in.size()) {
+    return false;
+  }
+  memcpy(&size, in.data() + offset, sizeof(size));
+  offset += sizeof(size);
+  if (offset + size > in.size()) {
+    return false;
+  }
+  value.assign(in, offset, size);
+  offset += size;
+  return true;
+}
+
+/**
+ * @brief Serialize a tree as its value, child count, and keyed children.
+ *
+ * A property tree allocates a node and a multi-index entry per key, the
+ * serialized form is a single string about the size of the keys and values.
+ */
+static void serializeTree(const pt::ptree& tree, std::string& out) {
+  writeString(tree.data(), out);
+  auto count = static_cast<uint32_t>(tree.size());
+  out.append(reinterpret_cast<const char*>(&count), sizeof(count));
+  for (const auto& child : tree) {
+    writeString(child.first, out);
+    serializeTree(child.second, out);
+  }
+}
+
+/// Rebuild a tree from serializeTree's form.
+static bool deserializeTree(const std::string& in,
+                            size_t& offset,
+                            pt::ptree& tree) {
+  if (!readString(in, offset, tree.data())) {
+    return false;
+  }
+
+  uint32_t count = 0;
+  if (offset + sizeof(count) > in.size()) {
+    return false;
+  }
+  memcpy(&count, in.data() + offset, sizeof(count));
+  offset += sizeof(count);
+  for (uint32_t i = 0; i < count; i++) {
+    std::string key;
+    if (!readString(in, offset, key)) {
+      return false;
+    }
+    auto it = tree.push_back(pt::ptree::value_type(key, pt::ptree()));
+    if (!deserializeTree(in, offset, it->second)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// A parsed property list, see PlistCache.
+struct PlistCacheEntry {
+  /// The device, inode, size, and modification time in nanoseconds.
+  std::string identity;
+
+  /// The tree in serializeTree's form.
+  std::string content;
+
+  /// The request count when the entry was last used.
+  size_t used{0};
+};
+
+/**
+ * @brief Parsed property lists kept until the file changes.
+ *
+ * The launchd, apps, preferences, and startup_items tables, among others,
+ * parse hundreds of property lists per query, most of which rarely change.
+ */
+class PlistCache : private boost::noncopyable {
+ public:
+  static PlistCache& instance() {
+    static PlistCache cache;
+    return cache;
+  }
+
+  /// Copy the stored tree if the identity matches.
+  bool get(const std::string& path,
+           const std::string& identity,
+           pt::ptree& tree) {
+    WriteLock lock(mutex_);
+    auto it = entries_.find(path);
+    if (it == entries_.end() || it->second.identity != identity) {
+      return false;
+    }
+
+    size_t offset = 0;
+    tree.clear();
+    if (!deserializeTree(it->second.content, offset, tree)) {
+      tree.clear();
+      bytes_ -= it->second.content.size();
+      entries_.erase(it);
+      return false;
+    }
+    it->second.used = ++requests_;
+    return true;
+  }
+
+  /// Store a parsed tree, evicting beyond the memory limit.
+  void put(const std::string& path,
+           const std::string& identity,
+           const pt::ptree& tree) {
+    std::string content;
+    serializeTree(tree, content);
+    if (content.size() > FLAGS_plist_cache_max_bytes) {
+      return;
+    }
+
+    WriteLock lock(mutex_);
+    auto& entry = entries_[path];
+    bytes_ -= entry.content.size();
+    entry.identity = identity;
+    entry.content = std::move(content);
+    entry.used = ++requests_;
+    bytes_ += entry.content.size();
+    evict();
+  }
+
+  /// Remove every entry.
+  void clear() {
+    WriteLock lock(mutex_);
+    entries_.clear();
+    bytes_ = 0;
+  }
+
+ private:
+  PlistCache() {}
+
+  /// Remove the least recently used entries beyond the memory limit.
+  void evict() {
+    while (bytes_ > FLAGS_plist_cache_max_bytes && !entries_.empty()) {
+      auto oldest = entries_.begin();
+      for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+        if (it->second.used < oldest->second.used) {
+          oldest = it;
+        }
+      }
+      bytes_ -= oldest->second.content.size();
+      entries_.erase(oldest);
+    }
+  }
+
+ private:
+  /// Parsed trees keyed by path.
+  std::map<std::string, PlistCacheEntry> entries_;
+
+  /// The serialized bytes held across all entries.
+  size_t bytes_{0};
+
+  /// The number of requests, used to order entries by use.
+  size_t requests_{0};
+
+  Mutex mutex_;
+};
+
+Status cachedParsePlist(const fs::path& path, pt::ptree& tree) {
+  std::string identity;
+  uint64_t mtime = 0;
+  if (FLAGS_plist_cache_max_bytes == 0 ||
+      !getPlistIdentity(path, identity, mtime)) {
+    return parsePlist(path, tree);
+  }
+
+  auto& cache = PlistCache::instance();
+  if (cache.get(path.string(), identity, tree)) {
+    return Status(0, "OK");
+  }
+
+  auto status = parsePlist(path, tree);
+  // A file written within the last second may be written again without a
+  // change to its identity, parse again until it settles.
+  if (status.ok() && !isRecentlyModified(mtime)) {
+    cache.put(path.string(), identity, tree);
+  }
+  return status;
+}
+
+void clearPlistCache() {
+  PlistCache::instance().clear();
+}
+}
@@ -102,4 +102,38 @@ TEST_F(PlistTests, test_parse_plist_content_with_blobs) {
   // Verify we parsed the binary blob correctly
   EXPECT_NE(alias.find("Applications/Flux.app"), std::string::npos);
 }
+
+TEST_F(PlistTests, test_cached_parse_plist) {
+  clearPlistCache();
+
+  // Copy a plist so its modification time can be changed.
+  std::string content;
+  readFile(kTestDataPath + "test.plist", content);
+  auto path = kTestWorkingDirectory + "cached.plist";
+  writeTextFile(path, content);
+  fs::last_write_time(path, fs::last_write_time(path) - 60);
+
+  pt::ptree expected;
+  ASSERT_TRUE(parsePlist(path, expected).ok());
+
+  // The first request parses and stores the tree, the second reuses it.
+  pt::ptree tree;
+  ASSERT_TRUE(cachedParsePlist(path, tree).ok());
+  EXPECT_EQ(tree, expected);
+  pt::ptree cached;
+  ASSERT_TRUE(cachedParsePlist(path, cached).ok());
+  EXPECT_EQ(cached, expected);
+  EXPECT_EQ(cached.get("inetdCompatibility.Wait", ""), "0");
+
+  // A changed file is parsed again.
+  readFile(kTestDataPath + "test_array.plist", content);
+  writeTextFile(path, content);
+  fs::last_write_time(path, fs::last_write_time(path) - 30);
+  ASSERT_TRUE(parsePlist(path, expected).ok());
+  ASSERT_TRUE(cachedParsePlist(path, cached).ok());
+  EXPECT_EQ(cached, expected);
+
+  fs::remove(path);
+  clearPlistCache();
+}
 }
@@ -22,6 +22,7 @@
 #include <unistd.h>
 #endif
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -100,6 +101,14 @@ const PlatformHandle kInvalidHandle = (PlatformHandle)-1;
 #define PF_NONBLOCK 0x0020
 #define PF_APPEND 0x0040
 
+/**
+ * @brief The file is read from start to end.
+ *
+ * The platform is asked to read ahead. On Windows a read-only disk file is
+ * read with several overlapped requests outstanding, see ReadAheadRequest.
+ */
+#define PF_SEQUENTIAL 0x0080
+
 /**
  * @brief Modes for seeking through a file.
  *
@@ -136,6 +145,23 @@ struct AsyncEvent {
   bool is_active_{false};
 };
 
+/**
+ * @brief A fixed-size overlapped read issued ahead of a sequential reader.
+ *
+ * A PF_SEQUENTIAL file keeps a ring of requests for consecutive blocks, so
+ * the device has several outstanding while the caller consumes the oldest.
+ */
+struct ReadAheadRequest : public AsyncEvent {
+  /// The bytes read by the completed request.
+  DWORD size_{0};
+
+  /// The bytes already returned to the caller.
+  DWORD consumed_{0};
+
+  /// True when the request completed and is waiting to be consumed.
+  bool complete_{false};
+};
+
 #endif
 
 /**
@@ -211,6 +237,9 @@ class PlatformFile {
 
   ssize_t write(const void* buf, size_t nbyte);
 
+  /// Flush written data to the storage device.
+  bool sync();
+
   off_t seek(off_t offset, SeekMode mode);
 
   size_t size() const;
@@ -228,6 +257,40 @@ class PlatformFile {
   AsyncEvent last_read_;
 
   ssize_t getOverlappedResultForRead(void* buf, size_t requested_size);
+
+  /// True if reads are served from the read-ahead ring.
+  bool is_sequential_{false};
+
+  /// The ring of read-ahead requests, allocated on the first read.
+  std::vector<std::unique_ptr<ReadAheadRequest>> read_ahead_;
+
+  /// The number of requests the ring may have outstanding.
+  size_t read_ahead_depth_{0};
+
+  /// The index of the oldest request, which is read next.
+  size_t read_ahead_head_{0};
+
+  /// The number of requests issued and not yet consumed.
+  size_t read_ahead_count_{0};
+
+  /// The file offset of the next request to issue.
+  LONGLONG read_ahead_offset_{0};
+
+  /// Set when a request read nothing, no further requests are issued.
+  bool read_ahead_end_{false};
+
+  /// Set when a request failed.
+  bool read_ahead_error_{false};
+
+  /// Issue requests until the ring is full or the end of the file.
+  void issueReadAhead();
+
+  /// Cancel and wait for the outstanding requests, after which the ring
+  /// restarts at the cursor.
+  void cancelReadAhead();
+
+  /// Copy the next bytes of the file from the read-ahead ring.
+  ssize_t readSequential(void* buf, size_t nbyte);
 #endif
 };
 
@@ -276,6 +339,29 @@ bool platformChmod(const std::string& path, mode_t perms);
  */
 std::vector<std::string> platformGlob(const std::string& find_path);
 
+#ifndef WIN32
+/**
+ * @brief List the contents of directories as a recursive glob would.
+ *
+ * Each directory, with a trailing separator, is listed as if by a glob of
+ * "<directory>*", then again with another wildcard component for each level
+ * to a depth. Paths are ordered as these globs order them, by depth then
+ * name. Directory entry
+ * types are used to avoid a stat of each entry, only symlinks and entries of
+ * an unknown type are stat-ed. Directories are read by several workers
+ * sharing a queue.
+ *
+ * @param directories The directories to list, each ending in a separator.
+ * @param depth The number of levels listed below each directory.
+ * @param workers The number of threads reading directories.
+ * @param results The output paths, directories end in a separator.
+ */
+void platformWalkDirectories(const std::vector<std::string>& directories,
+                             size_t depth,
+                             size_t workers,
+                             std::vector<std::string>& results);
+#endif
+
 /**
  * @brief Checks to see if the current user has the permissions to perform a
  *        specified operation on a file.
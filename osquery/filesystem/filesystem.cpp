@@ -16,6 +16,7 @@
 #ifndef WIN32
 #include <glob.h>
 #include <pwd.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #endif
 
@@ -24,12 +25,14 @@
 #include <boost/filesystem/operations.hpp>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
 
 #include "osquery/core/json.h"
+#include "osquery/core/query_deadline.h"
 #include "osquery/filesystem/fileops.h"
 
 namespace pt = boost::property_tree;
@@ -47,6 +50,11 @@ HIDDEN_FLAG(bool, allow_unsafe, false, "Allow unsafe executable permissions");
 /// Disable forensics (atime/mtime preserving) file reads.
 HIDDEN_FLAG(bool, disable_forensic, true, "Disable atime/mtime preservation");
 
+FLAG(uint64,
+     glob_workers,
+     4,
+     "Threads listing directories for recursive globs (default 4)");
+
 static const size_t kMaxRecursiveGlobs = 64;
 
 Status writeTextFile(const fs::path& path,
@@ -77,7 +85,9 @@ Status writeTextFile(const fs::path& path,
 
 struct OpenReadableFile {
  public:
-  explicit OpenReadableFile(const fs::path& path, bool blocking = false) {
+  explicit OpenReadableFile(const fs::path& path,
+                            bool blocking = false,
+                            bool sequential = false) {
 #ifndef WIN32
     dropper_ = DropPrivileges::get();
     if (dropper_->dropToParent(path)) {
@@ -86,6 +96,9 @@ struct OpenReadableFile {
       if (!blocking) {
         mode |= PF_NONBLOCK;
       }
+      if (sequential) {
+        mode |= PF_SEQUENTIAL;
+      }
 
       // Open the file descriptor and allow caller to perform error checking.
       fd.reset(new PlatformFile(path.string(), mode));
@@ -111,7 +124,7 @@ Status readFile(const fs::path& path,
                 bool preserve_time,
                 std::function<void(std::string& buffer, size_t size)> predicate,
                 bool blocking) {
-  OpenReadableFile handle(path, blocking);
+  OpenReadableFile handle(path, blocking, true);
   if (handle.fd == nullptr || !handle.fd->isValid()) {
     return Status(1, "Cannot open file for reading: " + path.string());
   }
@@ -169,6 +182,153 @@ Status readFile(const fs::path& path,
   return Status(0, "OK");
 }
 
+Status readFileBlocks(
+    const fs::path& path,
+    size_t block_size,
+    bool preserve_time,
+    std::function<void(const char* buffer, size_t size)> predicate,
+    size_t offset,
+    size_t length) {
+  OpenReadableFile handle(path, false, true);
+  if (handle.fd == nullptr || !handle.fd->isValid()) {
+    return Status(1, "Cannot open file for reading: " + path.string());
+  }
+
+  off_t read_max =
+      static_cast<off_t>((handle.fd->isOwnerRoot().ok())
+                             ? FLAGS_read_max
+                             : std::min(FLAGS_read_max, FLAGS_read_user_max));
+  auto file_size = static_cast<off_t>(handle.fd->size());
+  if (file_size > read_max) {
+    VLOG(1) << "Cannot read " << path << " size exceeds limit: " << file_size
+            << " > " << read_max;
+    return Status(1, "File exceeds read limits");
+  }
+
+  PlatformTime times;
+  handle.fd->getFileTimes(times);
+
+  if (offset > 0 &&
+      handle.fd->seek(static_cast<off_t>(offset), PF_SEEK_BEGIN) < 0) {
+    return Status(1, "Cannot seek file: " + path.string());
+  }
+
+  // Special files report a size of 0, the limit is applied while reading.
+  std::string buffer(block_size, '\0');
+  off_t total_bytes = 0;
+  ssize_t part_bytes = 0;
+  do {
+    auto part_size = block_size;
+    if (length > 0) {
+      if (static_cast<size_t>(total_bytes) >= length) {
+        break;
+      }
+      part_size =
+          std::min(block_size, length - static_cast<size_t>(total_bytes));
+    }
+    part_bytes = handle.fd->read(&buffer[0], part_size);
+    if (part_bytes > 0) {
+      total_bytes += static_cast<off_t>(part_bytes);
+      if (total_bytes > read_max) {
+        return Status(1, "File exceeds read limits");
+      }
+      predicate(buffer.data(), static_cast<size_t>(part_bytes));
+    }
+  } while (part_bytes > 0);
+
+  if (preserve_time && !FLAGS_disable_forensic) {
+    handle.fd->setFileTimes(times);
+  }
+  return Status(0, "OK");
+}
+
+/// Files smaller than this are read into a view's buffer, not mapped.
+const size_t kFileViewMapSize = 16 * 1024;
+
+FileView::~FileView() {
+  reset();
+}
+
+void FileView::reset() {
+#ifndef WIN32
+  if (mapping_ != nullptr) {
+    munmap(mapping_, size_);
+  }
+#endif
+  mapping_ = nullptr;
+  data_ = nullptr;
+  size_ = 0;
+  buffer_.clear();
+}
+
+Status readFileView(const fs::path& path,
+                    FileView& view,
+                    bool preserve_time,
+                    bool blocking) {
+  view.reset();
+  OpenReadableFile handle(path, blocking);
+  if (handle.fd == nullptr || !handle.fd->isValid()) {
+    return Status(1, "Cannot open file for reading: " + path.string());
+  }
+
+  off_t read_max =
+      static_cast<off_t>((handle.fd->isOwnerRoot().ok())
+                             ? FLAGS_read_max
+                             : std::min(FLAGS_read_max, FLAGS_read_user_max));
+  auto file_size = static_cast<off_t>(handle.fd->size());
+  if (file_size > read_max) {
+    VLOG(1) << "Cannot read " << path << " size exceeds limit: " << file_size
+            << " > " << read_max;
+    return Status(1, "File exceeds read limits");
+  }
+
+  PlatformTime times;
+  handle.fd->getFileTimes(times);
+
+#ifndef WIN32
+  // The atime is updated when mapping, not when the pages are read.
+  if (static_cast<size_t>(file_size) >= kFileViewMapSize) {
+    auto mapping = mmap(nullptr,
+                        static_cast<size_t>(file_size),
+                        PROT_READ,
+                        MAP_PRIVATE,
+                        handle.fd->nativeHandle(),
+                        0);
+    if (mapping != MAP_FAILED) {
+      posix_madvise(
+          mapping, static_cast<size_t>(file_size), POSIX_MADV_SEQUENTIAL);
+      view.mapping_ = mapping;
+      view.data_ = static_cast<const char*>(mapping);
+      view.size_ = static_cast<size_t>(file_size);
+    }
+  }
+#endif
+
+  if (view.mapping_ == nullptr) {
+    // Special files report a size of 0, the limit is applied while reading.
+    view.buffer_.reserve(static_cast<size_t>(file_size));
+    std::string part(4096, '\0');
+    ssize_t part_bytes = 0;
+    do {
+      part_bytes = handle.fd->read(&part[0], part.size());
+      if (part_bytes > 0) {
+        view.buffer_.append(part, 0, static_cast<size_t>(part_bytes));
+        if (view.buffer_.size() > static_cast<size_t>(read_max)) {
+          view.reset();
+          return Status(1, "File exceeds read limits");
+        }
+      }
+    } while (part_bytes > 0);
+    view.data_ = view.buffer_.data();
+    view.size_ = view.buffer_.size();
+  }
+
+  if (preserve_time && !FLAGS_disable_forensic) {
+    handle.fd->setFileTimes(times);
+  }
+  return Status(0, "OK");
+}
+
 Status readFile(const fs::path& path,
                 std::string& content,
                 size_t size,
@@ -251,9 +411,30 @@ static void genGlobs(std::string path,
   // Use our helped escape/replace for wildcards.
   replaceGlobWildcards(path, limits);
 
+  bool walked = false;
+#ifndef WIN32
+  if (path.size() >= 2 && path.compare(path.size() - 2, 2, "**") == 0) {
+    // Glob the first level, then walk the matching directories instead of
+    // globbing each deeper level from the start.
+    auto glob_results = platformGlob(path);
+    std::vector<std::string> directories;
+    for (auto const& result_path : glob_results) {
+      if (result_path.back() == '/') {
+        directories.push_back(result_path);
+      }
+      results.push_back(result_path);
+    }
+    platformWalkDirectories(directories,
+                            kMaxRecursiveGlobs - 2,
+                            std::max<size_t>(FLAGS_glob_workers, 1),
+                            results);
+    walked = true;
+  }
+#endif
+
   // Generate a glob set and recurse for double star.
   size_t glob_index = 0;
-  while (++glob_index < kMaxRecursiveGlobs) {
+  while (!walked && ++glob_index < kMaxRecursiveGlobs && !isQueryCancelled()) {
     auto glob_results = platformGlob(path);
 
     for (auto const& result_path : glob_results) {
@@ -388,6 +569,13 @@ Status isDirectory(const fs::path& path) {
   return Status(ec.value(), ec.message());
 }
 
+const uint64_t kFileSettleNanos = 1000000000ULL;
+
+bool isRecentlyModified(uint64_t mtime) {
+  auto now = static_cast<uint64_t>(getUnixTime()) * 1000000000ULL;
+  return mtime + kFileSettleNanos > now;
+}
+
 std::set<fs::path> getHomeDirectories() {
   std::set<fs::path> results;
 
@@ -490,21 +678,21 @@ std::string lsperms(int mode) {
 }
 
 Status parseJSON(const fs::path& path, pt::ptree& tree) {
-  std::string json_data;
-  if (!readFile(path, json_data).ok()) {
+  FileView view;
+  if (!readFileView(path, view).ok()) {
     return Status(1, "Could not read JSON from file");
   }
 
-  return parseJSONContent(json_data, tree);
+  // Parse the file's content in place, without a copy.
+  if (!deserializeTreeJSON(view.data(), view.size(), tree).ok()) {
+    return Status(1, "Could not parse JSON from file");
+  }
+  return Status(0, "OK");
 }
 
 Status parseJSONContent(const std::string& content, pt::ptree& tree) {
   // Read the extensions data into a JSON blob, then property tree.
-  try {
-    std::stringstream json_stream;
-    json_stream << content;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& /* e */) {
+  if (!deserializeTreeJSON(content.data(), content.size(), tree).ok()) {
     return Status(1, "Could not parse JSON from file");
   }
   return Status(0, "OK");
@@ -15,13 +15,21 @@
 #include <fcntl.h>
 #include <unistd.h>
 
+#include <algorithm>
+
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 
+#include "osquery/filesystem/linux/mem.h"
+
 namespace osquery {
 
-#define kLinuxMaxMemRead 0x10000
+/// The largest read, and the size of aligned windows.
+const size_t kLinuxMaxMemRead = 0x10000;
+
+/// The end of the legacy BIOS area, always readable through /dev/mem.
+const size_t kLinuxLegacyMemEnd = 0x100000;
 
 const std::string kLinuxMemPath = "/dev/mem";
 
@@ -55,59 +63,109 @@ Status readMem(int fd, size_t base, size_t length, uint8_t* buffer) {
   return Status(0, "OK");
 }
 
-Status readRawMem(size_t base, size_t length, void** buffer) {
-  *buffer = 0;
+/// The page size used to align mappings.
+static size_t getMemPageSize() {
+#ifdef _SC_PAGESIZE
+  return sysconf(_SC_PAGESIZE);
+#else
+  // getpagesize() is more or less deprecated.
+  return getpagesize();
+#endif
+}
+
+PhysicalMemory::~PhysicalMemory() {
+  unmap();
+  if (fd_ >= 0) {
+    close(fd_);
+  }
+}
+
+void PhysicalMemory::unmap() {
+  if (map_ != nullptr) {
+    if (munmap(map_, map_length_) == -1) {
+      LOG(WARNING) << "Unable to unmap raw memory";
+    }
+    map_ = nullptr;
+    map_base_ = 0;
+    map_length_ = 0;
+  }
+}
 
+Status PhysicalMemory::read(size_t base, size_t length, const uint8_t*& data) {
+  data = nullptr;
   if (FLAGS_disable_memory) {
     return Status(1, "Configuration has disabled physical memory reads");
   }
 
-  if (length > kLinuxMaxMemRead) {
+  if (length == 0 || length > kLinuxMaxMemRead) {
     return Status(1, "Cowardly refusing to read a large number of bytes");
   }
 
-  auto status = isReadable(kLinuxMemPath);
-  if (!status.ok()) {
-    // For non-su users *hopefully* raw memory is not readable.
-    return status;
+  // Reuse the current mapping if it covers the range.
+  if (map_ != nullptr && base >= map_base_ &&
+      base + length <= map_base_ + map_length_) {
+    data = map_ + (base - map_base_);
+    return Status(0, "OK");
+  }
+
+  if (fd_ < 0) {
+    auto status = isReadable(path_);
+    if (!status.ok()) {
+      // For non-su users *hopefully* raw memory is not readable.
+      return status;
+    }
+
+    fd_ = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd_ < 0) {
+      return Status(1, std::string("Cannot open ") + path_);
+    }
+  }
+  unmap();
+
+  // Map whole pages, widened to the aligned window in the first megabyte.
+  auto page = getMemPageSize();
+  size_t start = base - base % page;
+  size_t end = base + length;
+  end += (end % page == 0) ? 0 : page - end % page;
+  if (end <= kLinuxLegacyMemEnd) {
+    start = base - base % kLinuxMaxMemRead;
+    end = std::max(end, start + kLinuxMaxMemRead);
+    end = std::min(end, kLinuxLegacyMemEnd);
   }
 
-  int fd = open(kLinuxMemPath.c_str(), O_RDONLY);
-  if (fd < 0) {
-    return Status(1, std::string("Cannot open ") + kLinuxMemPath);
+  // Use memmap for maximum portability over read().
+  auto map = mmap(0, end - start, PROT_READ, MAP_SHARED, fd_, start);
+  if (map != MAP_FAILED) {
+    map_ = static_cast<uint8_t*>(map);
+    map_base_ = start;
+    map_length_ = end - start;
+    data = map_ + (base - start);
+    return Status(0, "OK");
   }
 
-  if ((*buffer = malloc(length)) == nullptr) {
-    close(fd);
-    return Status(1, "Cannot allocate memory for read");
+  // Fallback to a lseek/read.
+  buffer_.resize(length);
+  if (!readMem(fd_, base, length, buffer_.data()).ok()) {
+    return Status(1, "Cannot memory map or seek/read memory");
   }
+  data = buffer_.data();
+  return Status(0, "OK");
+}
 
-#ifdef _SC_PAGESIZE
-  size_t offset = base % sysconf(_SC_PAGESIZE);
-#else
-  // getpagesize() is more or less deprecated.
-  size_t offset = base % getpagesize();
-#endif
+Status readRawMem(size_t base, size_t length, void** buffer) {
+  *buffer = nullptr;
 
-  // Use memmap for maximum portability over read().
-  auto map = mmap(0, offset + length, PROT_READ, MAP_SHARED, fd, base - offset);
-  if (map == MAP_FAILED) {
-    // Could fallback to a lseek/read.
-    if (!readMem(fd, base, length, (uint8_t*)*buffer).ok()) {
-      close(fd);
-      free(*buffer);
-      *buffer = nullptr;
-      return Status(1, "Cannot memory map or seek/read memory");
-    }
-  } else {
-    // Memory map succeeded, copy and unmap.
-    memcpy(*buffer, (uint8_t*)map + offset, length);
-    if (munmap(map, offset + length) == -1) {
-      LOG(WARNING) << "Unable to unmap raw memory";
-    }
+  PhysicalMemory memory;
+  const uint8_t* data = nullptr;
+  auto status = memory.read(base, length, data);
+  if (!status.ok()) {
+    return status;
   }
 
-  close(fd);
+  if ((*buffer = malloc(length)) == nullptr) {
+    return Status(1, "Cannot allocate memory for read");
+  }
+  memcpy(*buffer, data, length);
   return Status(0, "OK");
 }
 }
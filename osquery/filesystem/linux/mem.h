@@ -0,0 +1,74 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+
+namespace osquery {
+
+/// The physical memory device.
+extern const std::string kLinuxMemPath;
+
+/**
+ * @brief A reader of physical memory through mapped windows.
+ *
+ * readRawMem opens /dev/mem, maps, copies, and unmaps for each request. A
+ * reader keeps the device open and its last mapping, so nearby reads, such
+ * as an entry point followed by the structures it locates, are returned in
+ * place without another system call or copy.
+ *
+ * Within the first megabyte, where legacy firmware structures live and
+ * access is always allowed, a 64k aligned window around the request is
+ * mapped. Above it only the requested pages are mapped, since a kernel with
+ * strict /dev/mem access logs each attempt to map RAM.
+ */
+class PhysicalMemory : private boost::noncopyable {
+ public:
+  explicit PhysicalMemory(const std::string& path = kLinuxMemPath)
+      : path_(path) {}
+
+  ~PhysicalMemory();
+
+  /**
+   * @brief Read a range of physical memory in place.
+   *
+   * @param base the absolute address, which does not need to be aligned.
+   * @param length the number of bytes, with a max of 0x10000.
+   * @param data output, the bytes at base, valid until the next read.
+   * @return failure if memory reads are disabled or the range is unreadable.
+   */
+  Status read(size_t base, size_t length, const uint8_t*& data);
+
+ private:
+  /// Release the current mapping.
+  void unmap();
+
+ private:
+  /// The memory device, see kLinuxMemPath.
+  std::string path_;
+
+  /// The open device, or -1.
+  int fd_{-1};
+
+  /// The current mapping and the physical range it covers.
+  uint8_t* map_{nullptr};
+  size_t map_base_{0};
+  size_t map_length_{0};
+
+  /// The last range read with lseek/read when it could not be mapped.
+  std::vector<uint8_t> buffer_;
+};
+}
@@ -11,15 +11,88 @@
 #include <linux/limits.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cctype>
+
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
 
 namespace osquery {
 
 const std::string kLinuxProcPath = "/proc";
 
+/// Distinct cgroup files kept before the parsed cgroups are cleared.
+const size_t kMaxCgroupCache = 4096;
+
+/// Parsed cgroups keyed by the content of a cgroup file.
+static std::map<std::string, ProcCgroup> kCgroupCache;
+
+/// Protect the parsed cgroups, shared by every snapshot.
+static Mutex kCgroupCacheMutex;
+
+static inline bool isContainerID(const std::string& id) {
+  return id.size() == 64 && std::all_of(id.begin(), id.end(), [](char c) {
+           return std::isxdigit(static_cast<unsigned char>(c)) != 0;
+         });
+}
+
+ProcCgroup procParseCgroup(const std::string& content) {
+  ProcCgroup cgroup;
+  std::string unified;
+  bool memory = false;
+  for (const auto& line : split(content, "\n")) {
+    // Each line is formatted as hierarchy-ID:controller-list:cgroup-path.
+    auto first = line.find(':');
+    auto second =
+        (first == std::string::npos) ? first : line.find(':', first + 1);
+    if (second == std::string::npos) {
+      continue;
+    }
+
+    auto controllers = line.substr(first + 1, second - first - 1);
+    auto path = line.substr(second + 1);
+    if (line.compare(0, first, "0") == 0 && controllers.empty()) {
+      unified = path;
+      continue;
+    }
+
+    auto names = split(controllers, ",");
+    bool is_memory =
+        std::find(names.begin(), names.end(), "memory") != names.end();
+    if (!memory && (is_memory || cgroup.path.empty())) {
+      cgroup.path = path;
+      memory = is_memory;
+    }
+  }
+
+  // A hybrid hierarchy may leave processes in the root of the unified one.
+  if (!unified.empty() && (unified != "/" || cgroup.path.empty())) {
+    cgroup.path = unified;
+  }
+
+  auto components = split(cgroup.path, "/");
+  for (auto it = components.rbegin(); it != components.rend(); ++it) {
+    auto name = *it;
+    if (boost::algorithm::ends_with(name, ".scope")) {
+      name.erase(name.size() - 6);
+    }
+    auto dash = name.rfind('-');
+    auto id = (dash == std::string::npos) ? name : name.substr(dash + 1);
+    if (isContainerID(id)) {
+      cgroup.container_id = id;
+      break;
+    }
+  }
+  return cgroup;
+}
+
 Status procProcesses(std::set<std::string>& processes) {
   // Iterate over each process-like directory in proc.
   boost::filesystem::directory_iterator it(kLinuxProcPath), end;
@@ -77,4 +150,126 @@ Status procReadDescriptor(const std::string& process,
     return Status(1, "Could not read path");
   }
 }
+
+/// The current snapshot, see ProcSnapshot::get.
+static std::shared_ptr<ProcSnapshot> kProcSnapshot{nullptr};
+
+/// Protect the current snapshot.
+static Mutex kProcSnapshotMutex;
+
+std::shared_ptr<ProcSnapshot> ProcSnapshot::get() {
+  auto now = getUnixTime();
+  WriteLock lock(kProcSnapshotMutex);
+  if (kProcSnapshot == nullptr || kProcSnapshot->time_ != now) {
+    kProcSnapshot = std::shared_ptr<ProcSnapshot>(new ProcSnapshot(now));
+  }
+  return kProcSnapshot;
+}
+
+void ProcSnapshot::reset() {
+  WriteLock lock(kProcSnapshotMutex);
+  kProcSnapshot = nullptr;
+}
+
+const std::set<std::string>& ProcSnapshot::processes() {
+  WriteLock lock(mutex_);
+  if (!listed_) {
+    listed_ = true;
+    procProcesses(processes_);
+  }
+  return processes_;
+}
+
+Status ProcSnapshot::attribute(const std::string& pid,
+                               const std::string& attr,
+                               std::string& content) {
+  auto key = std::make_pair(pid, attr);
+  {
+    WriteLock lock(mutex_);
+    auto it = attributes_.find(key);
+    if (it != attributes_.end()) {
+      content = it->second.second;
+      return (it->second.first) ? Status(0, "OK")
+                                : Status(1, "Cannot read attribute");
+    }
+  }
+
+  // Read without holding the lock, a concurrent read stores the same content.
+  content.clear();
+  bool read = readFile(kLinuxProcPath + "/" + pid + "/" + attr, content).ok();
+  WriteLock lock(mutex_);
+  attributes_[key] = std::make_pair(read, content);
+  return (read) ? Status(0, "OK") : Status(1, "Cannot read attribute");
+}
+
+Status ProcSnapshot::descriptors(
+    const std::string& pid, std::map<std::string, std::string>& descriptors) {
+  {
+    WriteLock lock(mutex_);
+    auto it = descriptors_.find(pid);
+    if (it != descriptors_.end()) {
+      descriptors = it->second.second;
+      return (it->second.first) ? Status(0, "OK")
+                                : Status(1, "Cannot access descriptors");
+    }
+  }
+
+  descriptors.clear();
+  bool read = procDescriptors(pid, descriptors).ok();
+  WriteLock lock(mutex_);
+  descriptors_[pid] = std::make_pair(read, descriptors);
+  return (read) ? Status(0, "OK") : Status(1, "Cannot access descriptors");
+}
+
+Status ProcSnapshot::cgroup(const std::string& pid, ProcCgroup& cgroup) {
+  std::string content;
+  if (!attribute(pid, "cgroup", content).ok()) {
+    return Status(1, "Cannot read cgroup");
+  }
+
+  WriteLock lock(kCgroupCacheMutex);
+  auto it = kCgroupCache.find(content);
+  if (it == kCgroupCache.end()) {
+    if (kCgroupCache.size() >= kMaxCgroupCache) {
+      kCgroupCache.clear();
+    }
+    it = kCgroupCache.emplace(content, procParseCgroup(content)).first;
+  }
+  cgroup = it->second;
+  return Status(0, "OK");
+}
+
+Status ProcSnapshot::namespaceInode(const std::string& pid,
+                                    const std::string& type,
+                                    std::string& inode) {
+  auto key = std::make_pair(pid, type);
+  {
+    WriteLock lock(mutex_);
+    auto it = namespaces_.find(key);
+    if (it != namespaces_.end()) {
+      inode = it->second;
+      return (inode.empty()) ? Status(1, "Cannot read namespace")
+                             : Status(0, "OK");
+    }
+  }
+
+  // The link is formatted as type:[inode].
+  inode.clear();
+  auto link = kLinuxProcPath + "/" + pid + "/ns/" + type;
+  char link_path[PATH_MAX] = {0};
+  auto size = readlink(link.c_str(), link_path, sizeof(link_path) - 1);
+  if (size > 0) {
+    std::string value(link_path, size);
+    auto open = value.find('[');
+    auto close = value.rfind(']');
+    if (open != std::string::npos && close != std::string::npos &&
+        close > open) {
+      inode = value.substr(open + 1, close - open - 1);
+    }
+  }
+
+  WriteLock lock(mutex_);
+  namespaces_[key] = inode;
+  return (inode.empty()) ? Status(1, "Cannot read namespace") : Status(0, "OK");
+}
 }
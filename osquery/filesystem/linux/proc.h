@@ -0,0 +1,126 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+
+namespace osquery {
+
+/// The cgroup of a process, parsed from `/proc/<pid>/cgroup`.
+struct ProcCgroup {
+  /// The unified (v2) path, otherwise the path of the memory controller.
+  std::string path;
+
+  /// The 64-digit container ID within the path, empty if there is none.
+  std::string container_id;
+};
+
+/**
+ * @brief Parse the content of a `/proc/<pid>/cgroup` file.
+ *
+ * The container ID is the last 64-digit hex path component, allowing the
+ * ".scope" units of systemd, such as docker-<id>.scope, and runtime prefixes,
+ * such as cri-containerd-<id>.
+ */
+ProcCgroup procParseCgroup(const std::string& content);
+
+/**
+ * @brief A view of `/proc` shared by the process tables within a second.
+ *
+ * The processes, process_open_files, process_open_sockets, and
+ * process_memory_map tables, and queries joining them, each walked `/proc`
+ * and read the same files. A snapshot lists the processes once and reads
+ * each process's stat, status, cmdline, and descriptor table at most once,
+ * on first use. Rarely used or large attributes such as maps and environ are
+ * not kept. The snapshot is replaced when it is older than a second, so
+ * every table scanned within that second sees the same processes.
+ */
+class ProcSnapshot : private boost::noncopyable {
+ public:
+  /// Get the snapshot for the current second, creating it if needed.
+  static std::shared_ptr<ProcSnapshot> get();
+
+  /// Release the current snapshot, the next request reads `/proc` again.
+  static void reset();
+
+  /// The pids of every process, listed on first use.
+  const std::set<std::string>& processes();
+
+  /**
+   * @brief Read a small process attribute file, such as stat or cmdline.
+   *
+   * @param pid a string pid from proc.
+   * @param attr the name of the attribute, a file within `/proc/<pid>`.
+   * @param content output, the file's content.
+   * @return failure if the attribute could not be read.
+   */
+  Status attribute(const std::string& pid,
+                   const std::string& attr,
+                   std::string& content);
+
+  /// See procDescriptors, each process's table is read once.
+  Status descriptors(const std::string& pid,
+                     std::map<std::string, std::string>& descriptors);
+
+  /**
+   * @brief Read the cgroup of a process.
+   *
+   * The processes of a container have the same cgroup file. Each distinct file
+   * is parsed once and kept across snapshots, see procParseCgroup.
+   */
+  Status cgroup(const std::string& pid, ProcCgroup& cgroup);
+
+  /**
+   * @brief Read the inode of a process's namespace.
+   *
+   * @param pid a string pid from proc.
+   * @param type the namespace link within `/proc/<pid>/ns`, such as "mnt".
+   * @param inode output, the namespace inode as a string.
+   * @return failure if the link could not be read.
+   */
+  Status namespaceInode(const std::string& pid,
+                        const std::string& type,
+                        std::string& inode);
+
+ private:
+  explicit ProcSnapshot(size_t time) : time_(time) {}
+
+ private:
+  /// The UNIX time the snapshot was created.
+  size_t time_{0};
+
+  /// Set after the process list is read.
+  bool listed_{false};
+
+  std::set<std::string> processes_;
+
+  /// Attribute content keyed by pid and attribute name, empty if unreadable.
+  std::map<std::pair<std::string, std::string>, std::pair<bool, std::string>>
+      attributes_;
+
+  /// Descriptor tables keyed by pid.
+  std::map<std::string, std::pair<bool, std::map<std::string, std::string>>>
+      descriptors_;
+
+  /// Namespace inodes keyed by pid and namespace type, empty if unreadable.
+  std::map<std::pair<std::string, std::string>, std::string> namespaces_;
+
+  /// Protect the lazily populated content, tables may be scanned concurrently.
+  Mutex mutex_;
+};
+}
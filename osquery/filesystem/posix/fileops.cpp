@@ -8,6 +8,7 @@
  *
  */
 
+#include <dirent.h>
 #include <glob.h>
 #include <pwd.h>
 #include <stdio.h>
@@ -18,10 +19,17 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include <boost/filesystem.hpp>
 #include <boost/optional.hpp>
 
 #include "osquery/core/process.h"
+#include "osquery/core/query_deadline.h"
 #include "osquery/filesystem/fileops.h"
 
 namespace fs = boost::filesystem;
@@ -88,6 +96,14 @@ PlatformFile::PlatformFile(const std::string& path, int mode, int perms) {
   } else {
     handle_ = ::open(path.c_str(), oflag, perms);
   }
+
+  if (handle_ != kInvalidHandle && (mode & PF_SEQUENTIAL) == PF_SEQUENTIAL) {
+#if defined(__linux__)
+    posix_fadvise(handle_, 0, 0, POSIX_FADV_SEQUENTIAL);
+#elif defined(__APPLE__)
+    fcntl(handle_, F_RDAHEAD, 1);
+#endif
+  }
 }
 
 PlatformFile::~PlatformFile() {
@@ -227,6 +243,10 @@ ssize_t PlatformFile::write(const void* buf, size_t nbyte) {
   return ret;
 }
 
+bool PlatformFile::sync() {
+  return isValid() && ::fsync(handle_) == 0;
+}
+
 off_t PlatformFile::seek(off_t offset, SeekMode mode) {
   if (!isValid()) {
     return -1;
@@ -291,6 +311,155 @@ std::vector<std::string> platformGlob(const std::string& find_path) {
   return results;
 }
 
+/// A directory to list within a walk, or a path found.
+struct WalkEntry {
+  /// The level below the walked directories, starting at 1.
+  size_t depth;
+
+  /// The path, directories end in a separator.
+  std::string path;
+
+  bool operator<(const WalkEntry& other) const {
+    return (depth != other.depth) ? depth < other.depth : path < other.path;
+  }
+};
+
+/// The work shared by the threads of a walk.
+class DirectoryWalk {
+ public:
+  explicit DirectoryWalk(size_t depth)
+      : depth_(depth), deadline_(getQueryDeadline()) {}
+
+  void add(WalkEntry&& entry) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.push_back(std::move(entry));
+    cv_.notify_one();
+  }
+
+  /// Read directories until every directory is read.
+  void work() {
+    // Every thread of the walk stops with the query that requested it.
+    setQueryDeadline(deadline_);
+    std::vector<WalkEntry> found;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      cv_.wait(lock, [this]() { return !pending_.empty() || active_ == 0; });
+      if (isQueryCancelled()) {
+        pending_.clear();
+      }
+      if (pending_.empty()) {
+        break;
+      }
+
+      auto entry = std::move(pending_.front());
+      pending_.pop_front();
+      active_++;
+      lock.unlock();
+
+      std::vector<WalkEntry> directories;
+      read(entry, directories, found);
+
+      lock.lock();
+      active_--;
+      for (auto& directory : directories) {
+        pending_.push_back(std::move(directory));
+      }
+      // Wake the other workers for new directories or the end of the walk.
+      cv_.notify_all();
+    }
+
+    std::move(found.begin(), found.end(), std::back_inserter(found_));
+  }
+
+  /// The paths found, the caller sorts them.
+  std::vector<WalkEntry>& found() {
+    return found_;
+  }
+
+ private:
+  /// List a directory, adding subdirectories to walk to directories.
+  void read(const WalkEntry& entry,
+            std::vector<WalkEntry>& directories,
+            std::vector<WalkEntry>& found) {
+    auto dir = ::opendir(entry.path.c_str());
+    if (dir == nullptr) {
+      return;
+    }
+
+    struct dirent* ent = nullptr;
+    while ((ent = ::readdir(dir)) != nullptr) {
+      // A glob wildcard does not match hidden entries.
+      if (ent->d_name[0] == '.') {
+        continue;
+      }
+
+      auto path = entry.path + ent->d_name;
+      bool is_directory = (ent->d_type == DT_DIR);
+      if (ent->d_type == DT_LNK || ent->d_type == DT_UNKNOWN) {
+        // Globs follow symlinks, the walk depth bounds any link cycles.
+        struct stat st;
+        is_directory = (::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode));
+      }
+
+      if (is_directory) {
+        path += '/';
+        if (entry.depth < depth_) {
+          directories.push_back({entry.depth + 1, path});
+        }
+      }
+      found.push_back({entry.depth, std::move(path)});
+    }
+    ::closedir(dir);
+  }
+
+ private:
+  /// The deepest level listed.
+  size_t depth_{0};
+
+  /// The deadline of the query walking the directories.
+  std::chrono::steady_clock::time_point deadline_;
+
+  /// Directories waiting to be read.
+  std::deque<WalkEntry> pending_;
+
+  /// The number of directories being read.
+  size_t active_{0};
+
+  std::vector<WalkEntry> found_;
+
+  std::mutex mutex_;
+  std::condition_variable cv_;
+};
+
+void platformWalkDirectories(const std::vector<std::string>& directories,
+                             size_t depth,
+                             size_t workers,
+                             std::vector<std::string>& results) {
+  if (depth == 0 || directories.empty()) {
+    return;
+  }
+
+  DirectoryWalk walk(depth);
+  for (const auto& directory : directories) {
+    walk.add({1, directory});
+  }
+
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < workers; i++) {
+    threads.emplace_back([&walk]() { walk.work(); });
+  }
+  walk.work();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  auto& found = walk.found();
+  std::sort(found.begin(), found.end());
+  for (auto& entry : found) {
+    results.push_back(std::move(entry.path));
+  }
+}
+
 int platformAccess(const std::string& path, mode_t mode) {
   return ::access(path.c_str(), mode);
 }
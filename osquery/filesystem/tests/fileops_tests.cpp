@@ -223,6 +223,50 @@ TEST_F(FileOpsTests, test_seekFile) {
   }
 }
 
+TEST_F(FileOpsTests, test_sequentialIo) {
+  TempFile tmp_file;
+  std::string path = tmp_file.path();
+
+  // Larger than several read-ahead requests, and not a multiple of them.
+  std::string expected(3 * 1024 * 1024 + 17, '\0');
+  for (size_t i = 0; i < expected.size(); i++) {
+    expected[i] = static_cast<char>(i % 251);
+  }
+
+  {
+    PlatformFile fd(path, PF_CREATE_ALWAYS | PF_WRITE);
+    EXPECT_TRUE(fd.isValid());
+    EXPECT_EQ(static_cast<ssize_t>(expected.size()),
+              fd.write(expected.data(), expected.size()));
+  }
+
+  {
+    PlatformFile fd(path, PF_OPEN_EXISTING | PF_READ | PF_SEQUENTIAL);
+    EXPECT_TRUE(fd.isValid());
+
+    // Reads smaller than, and spanning, the read-ahead blocks.
+    std::string content;
+    std::vector<char> buffer(100000);
+    ssize_t part_bytes = 0;
+    do {
+      part_bytes = fd.read(buffer.data(), buffer.size());
+      if (part_bytes > 0) {
+        content.append(buffer.data(), part_bytes);
+      }
+    } while (part_bytes > 0);
+    EXPECT_EQ(0, part_bytes);
+    EXPECT_TRUE(content == expected);
+
+    // A seek discards the read ahead and reads from the new offset.
+    EXPECT_EQ(1000000, fd.seek(1000000, PF_SEEK_BEGIN));
+    EXPECT_EQ(10, fd.read(buffer.data(), 10));
+    EXPECT_EQ(0, ::memcmp(buffer.data(), &expected[1000000], 10));
+    EXPECT_EQ(1000020, fd.seek(10, PF_SEEK_CURRENT));
+    EXPECT_EQ(10, fd.read(buffer.data(), 10));
+    EXPECT_EQ(0, ::memcmp(buffer.data(), &expected[1000020], 10));
+  }
+}
+
 TEST_F(FileOpsTests, test_glob) {
   {
     std::vector<fs::path> expected{kFakeDirectory + "/door.txt",
@@ -300,4 +344,33 @@ TEST_F(FileOpsTests, test_glob) {
     EXPECT_TRUE(globResultsMatch(result, expected));
   }
 }
+
+#ifndef WIN32
+TEST_F(FileOpsTests, test_walkDirectories) {
+  // Directories at the deepest level are listed but not read.
+  std::vector<fs::path> expected{kFakeDirectory + "/deep11/deep2/",
+                                 kFakeDirectory + "/deep11/level1.txt",
+                                 kFakeDirectory + "/deep11/not_bash",
+                                 kFakeDirectory + "/deep11/deep2/deep3/",
+                                 kFakeDirectory + "/deep11/deep2/level2.txt"};
+  std::vector<std::string> result;
+  platformWalkDirectories({kFakeDirectory + "/deep11/"}, 2, 3, result);
+  EXPECT_TRUE(globResultsMatch(result, expected));
+
+  // A walk lists the same paths, in the same order, as a glob of each level.
+  std::vector<fs::path> levels;
+  std::string pattern = kFakeDirectory + "/*";
+  for (size_t depth = 0; depth < 4; depth++) {
+    pattern += "/*";
+    for (const auto& path : platformGlob(pattern)) {
+      levels.push_back(path);
+    }
+  }
+
+  result.clear();
+  platformWalkDirectories(
+      {kFakeDirectory + "/deep1/", kFakeDirectory + "/deep11/"}, 4, 3, result);
+  EXPECT_TRUE(globResultsMatch(result, levels));
+}
+#endif
 }
@@ -21,6 +21,10 @@
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
+#ifdef __linux__
+#include "osquery/filesystem/linux/mem.h"
+#include "osquery/filesystem/linux/proc.h"
+#endif
 #include "osquery/tests/test_util.h"
 
 namespace fs = boost::filesystem;
@@ -118,6 +122,77 @@ TEST_F(FilesystemTests, test_read_limit) {
 #endif
 }
 
+TEST_F(FilesystemTests, test_read_file_blocks) {
+  auto path = kTestWorkingDirectory + "fstests-blocks";
+  writeTextFile(path, "0123456789");
+
+  std::string content;
+  size_t blocks = 0;
+  auto s = readFileBlocks(
+      path, 4, false, ([&content, &blocks](const char* buffer, size_t size) {
+        content.append(buffer, size);
+        blocks++;
+      }));
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(content, "0123456789");
+  EXPECT_EQ(blocks, 3U);
+
+  // A range is read from an offset.
+  content.clear();
+  s = readFileBlocks(path,
+                     4,
+                     false,
+                     ([&content](const char* buffer, size_t size) {
+                       content.append(buffer, size);
+                     }),
+                     3,
+                     5);
+  EXPECT_TRUE(s.ok());
+  EXPECT_EQ(content, "34567");
+
+  // The read limits apply.
+  auto max = FLAGS_read_max;
+  FLAGS_read_max = 3;
+  s = readFileBlocks(path, 4, false, ([](const char*, size_t) {}));
+  EXPECT_FALSE(s.ok());
+  FLAGS_read_max = max;
+
+  remove(path);
+}
+
+TEST_F(FilesystemTests, test_read_file_view) {
+  auto path = kTestWorkingDirectory + "fstests-view";
+  writeTextFile(path, "small");
+
+  // Small files are read into the view's buffer.
+  FileView view;
+  auto s = readFileView(path, view);
+  EXPECT_TRUE(s.ok());
+  EXPECT_FALSE(view.mapped());
+  EXPECT_EQ(std::string(view.data(), view.size()), "small");
+  remove(path);
+
+  // Larger files are mapped.
+  auto content = std::string(64 * 1024, 'a');
+  writeTextFile(path, content);
+  s = readFileView(path, view);
+  EXPECT_TRUE(s.ok());
+#ifndef WIN32
+  EXPECT_TRUE(view.mapped());
+#endif
+  EXPECT_EQ(std::string(view.data(), view.size()), content);
+
+  // The read limits apply.
+  auto max = FLAGS_read_max;
+  FLAGS_read_max = 1024;
+  s = readFileView(path, view);
+  EXPECT_FALSE(s.ok());
+  EXPECT_EQ(view.size(), 0U);
+  FLAGS_read_max = max;
+
+  remove(path);
+}
+
 TEST_F(FilesystemTests, test_list_files_missing_directory) {
   std::vector<std::string> results;
   auto status = listFilesInDirectory("/foo/bar", results);
@@ -365,6 +440,84 @@ TEST_F(FilesystemTests, test_read_proc) {
   EXPECT_TRUE(readFile("/proc/" + std::to_string(getpid()) + "/stat", content));
   EXPECT_GT(content.size(), 0U);
 }
+
+TEST_F(FilesystemTests, test_proc_snapshot) {
+  ProcSnapshot::reset();
+  auto snapshot = ProcSnapshot::get();
+  auto pid = std::to_string(getpid());
+  EXPECT_EQ(snapshot->processes().count(pid), 1U);
+
+  // Attributes are read once and shared with later readers.
+  std::string first, second;
+  EXPECT_TRUE(snapshot->attribute(pid, "stat", first));
+  EXPECT_GT(first.size(), 0U);
+  EXPECT_TRUE(snapshot->attribute(pid, "stat", second));
+  EXPECT_EQ(first, second);
+
+  std::map<std::string, std::string> descriptors;
+  EXPECT_TRUE(snapshot->descriptors(pid, descriptors));
+  EXPECT_GT(descriptors.size(), 0U);
+  EXPECT_FALSE(snapshot->attribute("0", "stat", first));
+
+  // A reset starts a new snapshot.
+  ProcSnapshot::reset();
+  EXPECT_NE(snapshot, ProcSnapshot::get());
+}
+
+TEST_F(FilesystemTests, test_proc_cgroup) {
+  std::string id(64, 'a');
+  auto cgroup = procParseCgroup(
+      "0::/system.slice/docker-" + id + ".scope\n");
+  EXPECT_EQ(cgroup.path, "/system.slice/docker-" + id + ".scope");
+  EXPECT_EQ(cgroup.container_id, id);
+
+  // Version 1 hierarchies use the memory controller's path.
+  cgroup = procParseCgroup("4:cpu,cpuacct:/\n3:memory:/kubepods/burstable/"
+                           "pod1/" + id + "\n0::/\n");
+  EXPECT_EQ(cgroup.path, "/kubepods/burstable/pod1/" + id);
+  EXPECT_EQ(cgroup.container_id, id);
+
+  cgroup = procParseCgroup("0::/user.slice/user-1000.slice\n");
+  EXPECT_EQ(cgroup.path, "/user.slice/user-1000.slice");
+  EXPECT_TRUE(cgroup.container_id.empty());
+
+  auto snapshot = ProcSnapshot::get();
+  auto pid = std::to_string(getpid());
+  EXPECT_TRUE(snapshot->cgroup(pid, cgroup));
+  std::string inode;
+  EXPECT_TRUE(snapshot->namespaceInode(pid, "mnt", inode));
+  EXPECT_GT(inode.size(), 0U);
+  EXPECT_FALSE(snapshot->namespaceInode("0", "mnt", inode));
+}
+
+TEST_F(FilesystemTests, test_physical_memory_windows) {
+  // Stand in for the legacy first megabyte of physical memory.
+  std::string content(0x100000, '\0');
+  for (size_t i = 0; i < content.size(); i++) {
+    content[i] = static_cast<char>(i / 0x1000);
+  }
+  auto path = kTestWorkingDirectory + "physical_memory.bin";
+  writeTextFile(path, content);
+
+  PhysicalMemory memory(path);
+  const uint8_t* first = nullptr;
+  ASSERT_TRUE(memory.read(0xF1008, 16, first));
+  EXPECT_EQ(first[0], 0xF1);
+
+  // A read within the same window is returned in place.
+  const uint8_t* second = nullptr;
+  ASSERT_TRUE(memory.read(0xF2010, 16, second));
+  EXPECT_EQ(second, first + 0x1008);
+  EXPECT_EQ(second[0], 0xF2);
+
+  // A read across windows maps both.
+  ASSERT_TRUE(memory.read(0xEFFF8, 16, first));
+  EXPECT_EQ(first[0], 0xEF);
+  EXPECT_EQ(first[8], 0xF0);
+
+  EXPECT_FALSE(memory.read(0, 0x20000, first));
+  remove(path);
+}
 #endif
 
 #ifndef WIN32
@@ -15,6 +15,7 @@
 #include <io.h>
 #include <sddl.h>
 
+#include <algorithm>
 #include <memory>
 #include <regex>
 #include <string>
@@ -115,6 +116,12 @@ static bool hasGlobBraces(const std::string& glob) {
   return (brace_depth == 0 && has_brace);
 }
 
+/// The size of each read-ahead request of a sequential file.
+const DWORD kReadAheadBlockSize = 256 * 1024;
+
+/// The number of read-ahead requests outstanding for a sequential disk file.
+const size_t kReadAheadRequests = 4;
+
 AsyncEvent::AsyncEvent() {
   overlapped_.hEvent = ::CreateEventA(nullptr, FALSE, FALSE, nullptr);
 }
@@ -382,6 +389,15 @@ PlatformFile::PlatformFile(const std::string& path, int mode, int perms) {
     is_nonblock_ = true;
   }
 
+  if ((mode & PF_SEQUENTIAL) == PF_SEQUENTIAL) {
+    flags_and_attrs |= FILE_FLAG_SEQUENTIAL_SCAN;
+    if ((mode & PF_WRITE) == 0) {
+      // Read-ahead requests are overlapped, a blocking read waits for them.
+      flags_and_attrs |= FILE_FLAG_OVERLAPPED;
+      is_sequential_ = true;
+    }
+  }
+
   if (perms != -1) {
     // TODO(#2001): set up a security descriptor based off the perms
   }
@@ -394,6 +410,16 @@ PlatformFile::PlatformFile(const std::string& path, int mode, int perms) {
                           flags_and_attrs,
                           nullptr);
 
+  if (is_sequential_ && handle_ != INVALID_HANDLE_VALUE) {
+    read_ahead_depth_ = kReadAheadRequests;
+    if (isSpecialFile()) {
+      // Pipes and devices ignore offsets, only one request is outstanding.
+      // A non-blocking reader keeps the emulated POSIX semantics.
+      read_ahead_depth_ = 1;
+      is_sequential_ = !is_nonblock_;
+    }
+  }
+
   /// Normally, append is done via the FILE_APPEND_DATA access mask. However,
   /// because we are blanket using GENERIC_WRITE, this will not work. To
   /// compensate, we can emulate the behavior by seeking to the file end
@@ -409,6 +435,9 @@ PlatformFile::~PlatformFile() {
       ::CancelIo(handle_);
     }
 
+    // The read-ahead buffers must outlive their requests.
+    cancelReadAhead();
+
     ::CloseHandle(handle_);
     handle_ = kInvalidHandle;
   }
@@ -754,6 +783,120 @@ ssize_t PlatformFile::getOverlappedResultForRead(void* buf,
   return nret;
 }
 
+void PlatformFile::issueReadAhead() {
+  if (read_ahead_.empty()) {
+    for (size_t i = 0; i < read_ahead_depth_; i++) {
+      read_ahead_.push_back(std::make_unique<ReadAheadRequest>());
+      read_ahead_.back()->buffer_.reset(new char[kReadAheadBlockSize]);
+    }
+  }
+
+  while (!read_ahead_end_ && read_ahead_count_ < read_ahead_.size()) {
+    auto index = (read_ahead_head_ + read_ahead_count_) % read_ahead_.size();
+    auto& request = *read_ahead_[index];
+    request.overlapped_.Offset = static_cast<DWORD>(read_ahead_offset_);
+    request.overlapped_.OffsetHigh =
+        static_cast<DWORD>(read_ahead_offset_ >> 32);
+    request.overlapped_.Internal = 0;
+    request.overlapped_.InternalHigh = 0;
+
+    if (!::ReadFile(handle_,
+                    request.buffer_.get(),
+                    kReadAheadBlockSize,
+                    nullptr,
+                    &request.overlapped_)) {
+      auto last_error = ::GetLastError();
+      if (last_error != ERROR_IO_PENDING) {
+        // The end of the file, or an error, stops the read ahead.
+        read_ahead_error_ = (last_error != ERROR_HANDLE_EOF &&
+                             last_error != ERROR_BROKEN_PIPE);
+        read_ahead_end_ = true;
+        break;
+      }
+    }
+
+    // A request that completed immediately is collected like a pending one.
+    request.is_active_ = true;
+    request.complete_ = false;
+    read_ahead_offset_ += kReadAheadBlockSize;
+    read_ahead_count_++;
+  }
+}
+
+void PlatformFile::cancelReadAhead() {
+  for (auto& request : read_ahead_) {
+    if (request->is_active_) {
+      DWORD bytes_read = 0;
+      ::CancelIoEx(handle_, &request->overlapped_);
+      ::GetOverlappedResult(
+          handle_, &request->overlapped_, &bytes_read, TRUE);
+      request->is_active_ = false;
+    }
+    request->complete_ = false;
+  }
+
+  read_ahead_head_ = 0;
+  read_ahead_count_ = 0;
+  read_ahead_end_ = false;
+  read_ahead_error_ = false;
+}
+
+ssize_t PlatformFile::readSequential(void* buf, size_t nbyte) {
+  auto output = static_cast<char*>(buf);
+  size_t total = 0;
+  while (total < nbyte) {
+    issueReadAhead();
+    if (read_ahead_count_ == 0) {
+      break;
+    }
+
+    auto& request = *read_ahead_[read_ahead_head_];
+    if (!request.complete_) {
+      DWORD bytes_read = 0;
+      if (!::GetOverlappedResult(
+              handle_, &request.overlapped_, &bytes_read, TRUE)) {
+        auto last_error = ::GetLastError();
+        read_ahead_error_ = (last_error != ERROR_HANDLE_EOF &&
+                             last_error != ERROR_BROKEN_PIPE);
+        bytes_read = 0;
+      }
+      request.is_active_ = false;
+      request.complete_ = true;
+      request.size_ = bytes_read;
+      request.consumed_ = 0;
+      if (bytes_read == 0) {
+        read_ahead_end_ = true;
+      }
+    }
+
+    auto available = static_cast<size_t>(request.size_ - request.consumed_);
+    auto size = std::min(nbyte - total, available);
+    ::memcpy_s(output + total,
+               nbyte - total,
+               request.buffer_.get() + request.consumed_,
+               size);
+    request.consumed_ += static_cast<DWORD>(size);
+    total += size;
+
+    if (request.consumed_ == request.size_) {
+      // The request is reissued for the next block of the file.
+      request.complete_ = false;
+      read_ahead_head_ = (read_ahead_head_ + 1) % read_ahead_.size();
+      read_ahead_count_--;
+      if (read_ahead_depth_ == 1 && total > 0) {
+        // A pipe returns what is available, do not wait for more.
+        break;
+      }
+    }
+  }
+
+  cursor_ += static_cast<int>(total);
+  if (total == 0 && read_ahead_error_) {
+    return -1;
+  }
+  return static_cast<ssize_t>(total);
+}
+
 ssize_t PlatformFile::read(void* buf, size_t nbyte) {
   if (!isValid()) {
     return -1;
@@ -765,7 +908,9 @@ ssize_t PlatformFile::read(void* buf, size_t nbyte) {
 
   has_pending_io_ = false;
 
-  if (is_nonblock_) {
+  if (is_sequential_) {
+    nret = readSequential(buf, nbyte);
+  } else if (is_nonblock_) {
     if (last_read_.is_active_) {
       nret = getOverlappedResultForRead(buf, nbyte);
     } else {
@@ -875,10 +1020,25 @@ off_t PlatformFile::seek(off_t offset, SeekMode mode) {
     break;
   }
 
+  if (is_sequential_) {
+    // Requests issued ahead of the old cursor are discarded. The handle's
+    // file pointer is not moved by overlapped reads, seek from the cursor.
+    cancelReadAhead();
+    if (whence == FILE_CURRENT) {
+      offset += cursor_;
+      whence = FILE_BEGIN;
+    }
+  }
+
   cursor_ = ::SetFilePointer(handle_, offset, nullptr, whence);
+  read_ahead_offset_ = cursor_;
   return cursor_;
 }
 
+bool PlatformFile::sync() {
+  return isValid() && ::FlushFileBuffers(handle_) != FALSE;
+}
+
 size_t PlatformFile::size() const {
   return ::GetFileSize(handle_, nullptr);
 }
@@ -25,6 +25,8 @@
 
 #include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
+#include "osquery/core/perf.h"
+#include "osquery/logger/pipeline.h"
 
 namespace pt = boost::property_tree;
 
@@ -123,6 +125,15 @@ class BufferedLogSink : public google::LogSink, private boost::noncopyable {
     return instance().sinks_;
   }
 
+  /**
+   * @brief Send status logs to a logger plugin.
+   *
+   * Logger plugins within this process receive the status lines directly,
+   * only logger plugins within extensions need a serialized request.
+   */
+  static Status relay(const std::string& logger,
+                      const std::vector<StatusLogLine>& log);
+
  public:
   BufferedLogSink(BufferedLogSink const&) = delete;
   void operator=(BufferedLogSink const&) = delete;
@@ -179,6 +190,52 @@ class LoggerDisabler {
   bool enabled_;
 };
 
+/// Protect the result encodings requested by logger plugins.
+static Mutex kLoggerEncodingsMutex;
+
+/// The result encodings requested by initialized logger plugins.
+static std::map<std::string, ResultEncoding> kLoggerEncodings;
+
+/// Record the result encoding a logger requested in its features.
+static void setLoggerEncoding(const std::string& logger, int features) {
+  auto encoding = RESULT_ENCODING_JSON;
+  if ((features & LOGGER_FEATURE_MSGPACK) > 0) {
+    encoding = RESULT_ENCODING_MSGPACK;
+  } else if ((features & LOGGER_FEATURE_PROTOBUF) > 0) {
+    encoding = RESULT_ENCODING_PROTOBUF;
+  }
+
+  WriteLock lock(kLoggerEncodingsMutex);
+  kLoggerEncodings[logger] = encoding;
+}
+
+/// Group a comma-delimited list of loggers by their result encodings.
+static std::map<ResultEncoding, std::string> getEncodingReceivers(
+    const std::string& receiver) {
+  std::map<ResultEncoding, std::string> receivers;
+  {
+    WriteLock lock(kLoggerEncodingsMutex);
+    if (kLoggerEncodings.empty()) {
+      // Every logger uses JSON results.
+      receivers[RESULT_ENCODING_JSON] = receiver;
+      return receivers;
+    }
+
+    for (const auto& logger : osquery::split(receiver, ",")) {
+      auto encoding = kLoggerEncodings.find(logger);
+      auto& names = receivers[(encoding == kLoggerEncodings.end())
+                                  ? RESULT_ENCODING_JSON
+                                  : encoding->second];
+      names += (names.empty()) ? logger : "," + logger;
+    }
+  }
+
+  if (receivers.empty()) {
+    receivers[RESULT_ENCODING_JSON] = receiver;
+  }
+  return receivers;
+}
+
 static void serializeIntermediateLog(const std::vector<StatusLogLine>& log,
                                      PluginRequest& request) {
   pt::ptree tree;
@@ -309,6 +366,7 @@ void initLogger(const std::string& name) {
     if ((status.getCode() & LOGGER_FEATURE_LOGEVENT) > 0) {
       EventFactory::addForwarder(logger);
     }
+    setLoggerEncoding(logger, status.getCode());
   }
 
   if (forward) {
@@ -319,6 +377,24 @@ void initLogger(const std::string& name) {
   }
 }
 
+Status BufferedLogSink::relay(const std::string& logger,
+                              const std::vector<StatusLogLine>& log) {
+  if (Registry::exists("logger", logger, true)) {
+    auto plugin = std::dynamic_pointer_cast<LoggerPlugin>(
+        Registry::get("logger", logger));
+    if (plugin != nullptr) {
+      return plugin->logStatus(log);
+    }
+  }
+
+  PluginRequest request = {{"status", "true"}};
+  serializeIntermediateLog(log, request);
+  if (!request["log"].empty()) {
+    request["log"].pop_back();
+  }
+  return Registry::call("logger", logger, request);
+}
+
 void BufferedLogSink::send(google::LogSeverity severity,
                            const char* full_filename,
                            const char* base_filename,
@@ -338,12 +414,7 @@ void BufferedLogSink::send(google::LogSeverity severity,
                        std::string(base_filename),
                        line,
                        std::string(message, message_len)});
-        PluginRequest request = {{"status", "true"}};
-        serializeIntermediateLog(log, request);
-        if (!request["log"].empty()) {
-          request["log"].pop_back();
-        }
-        Registry::call("logger", logger, request);
+        relay(logger, log);
       }
     }
   } else {
@@ -371,16 +442,48 @@ Status LoggerPlugin::call(const PluginRequest& request,
     return this->logStatus(intermediate_logs);
   } else if (request.count("event") > 0) {
     return this->logEvent(request.at("event"));
+  } else if (request.count("events") > 0) {
+    // Forwarded events are newline-delimited serialized rows.
+    std::vector<std::string> events;
+    const auto& content = request.at("events");
+    size_t start = 0;
+    while (start < content.size()) {
+      auto end = content.find('\n', start);
+      if (end == std::string::npos) {
+        end = content.size();
+      }
+      if (end > start) {
+        events.push_back(content.substr(start, end - start));
+      }
+      start = end + 1;
+    }
+    return this->logEvents(events);
   } else if (request.count("action") && request.at("action") == "features") {
     size_t features = 0;
     features |= (usesLogStatus()) ? LOGGER_FEATURE_LOGSTATUS : 0;
     features |= (usesLogEvent()) ? LOGGER_FEATURE_LOGEVENT : 0;
+    if (resultEncoding() == RESULT_ENCODING_MSGPACK) {
+      features |= LOGGER_FEATURE_MSGPACK;
+    } else if (resultEncoding() == RESULT_ENCODING_PROTOBUF) {
+      features |= LOGGER_FEATURE_PROTOBUF;
+    }
     return Status(static_cast<int>(features));
   } else {
     return Status(1, "Unsupported call to logger plugin");
   }
 }
 
+Status LoggerPlugin::logEvents(const std::vector<std::string>& events) {
+  Status status(0, "OK");
+  for (const auto& event : events) {
+    auto s = logEvent(event);
+    if (!s.ok()) {
+      status = s;
+    }
+  }
+  return status;
+}
+
 Status logString(const std::string& message, const std::string& category) {
   return logString(message, category, Registry::getActive("logger"));
 }
@@ -406,23 +509,58 @@ Status logQueryLogItem(const QueryLogItem& results,
     return Status(0, "Logging disabled");
   }
 
-  std::vector<std::string> json_items;
+  LogPipelineItem item;
+  item.item = results;
+  item.receiver = receiver;
+  if (LogPipeline::get().push(std::move(item))) {
+    // A pipeline thread serializes and logs the results.
+    return Status(0, "OK");
+  }
+  return logQueryLogItemSync(results, receiver);
+}
+
+/// Log JSON results, optionally split into events.
+static Status logQueryLogItemJSON(const QueryLogItem& results,
+                                  const std::string& receiver) {
   Status status;
   if (FLAGS_log_result_events) {
-    status = serializeQueryLogItemAsEventsJSON(results, json_items);
-  } else {
-    std::string json;
-    status = serializeQueryLogItemJSON(results, json);
-    json_items.push_back(json);
+    // Each event is logged as it is serialized.
+    Status logged;
+    status = serializeQueryLogItemAsEventsJSON(
+        results, [&logged, &receiver](const std::string& event) {
+          logged = logString(event, "event", receiver);
+        });
+    return (status.ok()) ? logged : status;
   }
+
+  std::string json;
+  status = serializeQueryLogItemJSON(results, json);
   if (!status.ok()) {
     return status;
   }
 
-  for (auto& json : json_items) {
-    if (!json.empty() && json.back() == '\n') {
-      json.pop_back();
-      status = logString(json, "event", receiver);
+  if (!json.empty() && json.back() == '\n') {
+    json.pop_back();
+    status = logString(json, "event", receiver);
+  }
+  return status;
+}
+
+Status logQueryLogItemSync(const QueryLogItem& results,
+                           const std::string& receiver) {
+  PerfTimer timer(PERF_LOG);
+  Status status;
+  // Results are encoded once for each requested encoding.
+  for (const auto& group : getEncodingReceivers(receiver)) {
+    if (group.first == RESULT_ENCODING_JSON) {
+      status = logQueryLogItemJSON(results, group.second);
+      continue;
+    }
+
+    std::string data;
+    status = serializeQueryLogItemAs(results, group.first, data);
+    if (status.ok()) {
+      status = logString(data, "event", group.second);
     }
   }
   return status;
@@ -433,14 +571,41 @@ Status logSnapshotQuery(const QueryLogItem& item) {
     return Status(0, "Logging disabled");
   }
 
-  std::string json;
-  if (!serializeQueryLogItemJSON(item, json)) {
-    return Status(1, "Could not serialize snapshot");
+  LogPipelineItem snapshot;
+  snapshot.item = item;
+  snapshot.snapshot = true;
+  if (LogPipeline::get().push(std::move(snapshot))) {
+    return Status(0, "OK");
   }
-  if (!json.empty() && json.back() == '\n') {
-    json.pop_back();
+  return logSnapshotQuerySync(item);
+}
+
+Status logSnapshotQuery(QueryLogItem&& item) {
+  if (FLAGS_disable_logging) {
+    return Status(0, "Logging disabled");
+  }
+
+  LogPipelineItem snapshot;
+  snapshot.item = std::move(item);
+  snapshot.snapshot = true;
+  if (LogPipeline::get().push(std::move(snapshot))) {
+    return Status(0, "OK");
+  }
+  // The pipeline only takes the item when it is queued.
+  return logSnapshotQuerySync(snapshot.item);
+}
+
+Status logSnapshotQuerySync(const QueryLogItem& item) {
+  Status status;
+  const auto& logger_plugin = Registry::getActive("logger");
+  for (const auto& group : getEncodingReceivers(logger_plugin)) {
+    std::string data;
+    if (!serializeQueryLogItemAs(item, group.first, data)) {
+      return Status(1, "Could not serialize snapshot");
+    }
+    status = Registry::call("logger", group.second, {{"snapshot", data}});
   }
-  return Registry::call("logger", {{"snapshot", json}});
+  return status;
 }
 
 void relayStatusLogs() {
@@ -451,20 +616,16 @@ void relayStatusLogs() {
   // Prevent our dumping and registry calling from producing additional logs.
   LoggerDisabler disabler;
 
-  // Construct a status log plugin request.
-  PluginRequest request = {{"status", "true"}};
   auto& status_logs = BufferedLogSink::dump();
   if (status_logs.size() == 0) {
     return;
   }
-  serializeIntermediateLog(status_logs, request);
-  if (!request["log"].empty()) {
-    request["log"].pop_back();
-  }
 
   // Skip the registry's logic, and send directly to the core's logger.
-  PluginResponse response;
-  Registry::call("logger", request, response);
+  const auto& logger_plugin = Registry::getActive("logger");
+  for (const auto& logger : osquery::split(logger_plugin, ",")) {
+    BufferedLogSink::relay(logger, status_logs);
+  }
 
   // Flush the buffered status logs.
   // If the logger called failed then the logger is experiencing a catastrophic
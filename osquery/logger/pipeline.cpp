@@ -0,0 +1,186 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <osquery/logger.h>
+
+#include "osquery/logger/pipeline.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     logger_async_threads,
+     0,
+     "Threads that serialize and log results, 0 logs from the scheduler");
+
+FLAG(uint64,
+     logger_async_queue_size,
+     4096,
+     "Result log items queued before the scheduler waits for the logger");
+
+/// The longest a shutdown waits for queued results to be logged.
+static const std::chrono::milliseconds kLogPipelineFlushTimeout(10000);
+
+Status LogPipeline::start(size_t threads, size_t capacity) {
+  {
+    WriteLock lock(mutex_);
+    if (stats_.threads > 0) {
+      return Status(1, "Log pipeline is already running");
+    }
+    stats_.threads = threads;
+    stats_.capacity = std::max<size_t>(capacity, 1);
+  }
+
+  runners_.clear();
+  for (size_t i = 0; i < threads; ++i) {
+    auto runner = std::make_shared<LogPipelineRunner>(*this);
+    if (Dispatcher::addService(runner).ok()) {
+      runners_.push_back(runner);
+    } else {
+      // The runner will never drain, count it as stopped.
+      WriteLock lock(mutex_);
+      stats_.threads--;
+    }
+  }
+  return Status(0, "OK");
+}
+
+void LogPipeline::stop() {
+  for (const auto& runner : runners_) {
+    runner->interrupt();
+  }
+}
+
+bool LogPipeline::push(LogPipelineItem&& item) {
+  std::unique_lock<Mutex> lock(mutex_);
+  if (stats_.threads == 0) {
+    return false;
+  }
+
+  if (items_.size() >= stats_.capacity) {
+    // The logger plugins are behind, apply backpressure to the scheduler.
+    auto start = std::chrono::steady_clock::now();
+    stats_.blocked++;
+    logged_.wait(lock, [this]() {
+      return items_.size() < stats_.capacity || stats_.threads == 0;
+    });
+    stats_.blocked_ms += std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+    if (stats_.threads == 0) {
+      return false;
+    }
+  }
+
+  items_.push_back(std::move(item));
+  stats_.enqueued++;
+  stats_.max_depth = std::max(stats_.max_depth, items_.size());
+  lock.unlock();
+  queued_.notify_one();
+  return true;
+}
+
+bool LogPipeline::pop(LogPipelineItem& item,
+                      std::chrono::milliseconds timeout,
+                      bool draining) {
+  std::unique_lock<Mutex> lock(mutex_);
+  if (items_.empty() && !draining) {
+    queued_.wait_for(lock, timeout);
+  }
+
+  if (items_.empty()) {
+    if (draining && stats_.threads > 0) {
+      // This thread is stopping, items queued afterward are logged in place.
+      stats_.threads--;
+      lock.unlock();
+      logged_.notify_all();
+    }
+    return false;
+  }
+
+  item = std::move(items_.front());
+  items_.pop_front();
+  inflight_++;
+  return true;
+}
+
+void LogPipeline::finish(const Status& status) {
+  {
+    WriteLock lock(mutex_);
+    inflight_--;
+    stats_.logged++;
+    if (!status.ok()) {
+      stats_.failed++;
+    }
+  }
+  logged_.notify_all();
+}
+
+bool LogPipeline::flush(std::chrono::milliseconds timeout) {
+  std::unique_lock<Mutex> lock(mutex_);
+  return logged_.wait_for(lock, timeout, [this]() {
+    return (items_.empty() && inflight_ == 0) || stats_.threads == 0;
+  });
+}
+
+void LogPipeline::wake() {
+  queued_.notify_all();
+}
+
+LogPipelineStats LogPipeline::stats() const {
+  WriteLock lock(mutex_);
+  auto stats = stats_;
+  stats.depth = items_.size();
+  return stats;
+}
+
+void LogPipelineRunner::start() {
+  LogPipelineItem item;
+  while (!interrupted()) {
+    if (pipeline_.pop(item, std::chrono::milliseconds(1000), false)) {
+      pipeline_.finish(logPipelineItem(item));
+    }
+  }
+
+  // Results queued before the interruption are still logged.
+  while (pipeline_.pop(item, std::chrono::milliseconds(0), true)) {
+    pipeline_.finish(logPipelineItem(item));
+  }
+}
+
+Status logPipelineItem(const LogPipelineItem& item) {
+  auto status = (item.snapshot) ? logSnapshotQuerySync(item.item)
+                                : logQueryLogItemSync(item.item, item.receiver);
+  if (!status.ok()) {
+    LOG(ERROR) << "Error logging the results of query: " << item.item.name
+               << ": " << status.toString();
+  }
+  return status;
+}
+
+void startLogPipeline() {
+  if (FLAGS_logger_async_threads == 0) {
+    return;
+  }
+
+  auto status = LogPipeline::get().start(FLAGS_logger_async_threads,
+                                         FLAGS_logger_async_queue_size);
+  if (!status.ok()) {
+    VLOG(1) << "Cannot start the log pipeline: " << status.getMessage();
+  }
+}
+
+void flushLogPipeline() {
+  if (!LogPipeline::get().flush(kLogPipelineFlushTimeout)) {
+    LOG(WARNING) << "Timed out logging queued results";
+  }
+}
+}
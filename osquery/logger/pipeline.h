@@ -0,0 +1,181 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <osquery/database.h>
+#include <osquery/dispatcher.h>
+#include <osquery/flags.h>
+
+namespace osquery {
+
+DECLARE_uint64(logger_async_threads);
+DECLARE_uint64(logger_async_queue_size);
+
+/// A scheduled query's results waiting for a log pipeline thread.
+struct LogPipelineItem {
+  /// The results and query metadata.
+  QueryLogItem item;
+
+  /// Set for snapshot results, which use the logger's snapshot handler.
+  bool snapshot{false};
+
+  /// The logger plugin receiving the results.
+  std::string receiver;
+};
+
+/// Counters describing the log pipeline's queue and backpressure.
+struct LogPipelineStats {
+  /// The number of running pipeline threads.
+  size_t threads{0};
+
+  /// The maximum number of queued items.
+  size_t capacity{0};
+
+  /// The number of queued items.
+  size_t depth{0};
+
+  /// The largest number of queued items.
+  size_t max_depth{0};
+
+  /// The number of items queued since the pipeline started.
+  size_t enqueued{0};
+
+  /// The number of items given to a logger plugin.
+  size_t logged{0};
+
+  /// The number of items a logger plugin could not log.
+  size_t failed{0};
+
+  /// The number of times a full queue blocked the scheduler.
+  size_t blocked{0};
+
+  /// The total milliseconds the scheduler was blocked.
+  size_t blocked_ms{0};
+};
+
+class LogPipelineRunner;
+
+/**
+ * @brief A bounded queue between the scheduler and the logger plugins.
+ *
+ * Scheduled queries queue their results and continue, pipeline threads
+ * serialize and log each item. If the logger plugins fall behind and the
+ * queue fills the scheduler blocks until there is space, the blocked counts
+ * and time are reported as backpressure.
+ *
+ * Items are logged in queue order by a single thread, more threads may
+ * reorder the results of different queries.
+ */
+class LogPipeline : private boost::noncopyable {
+ public:
+  /// The process-wide pipeline used by logQueryLogItem.
+  static LogPipeline& get() {
+    static LogPipeline pipeline;
+    return pipeline;
+  }
+
+  /// Start the pipeline threads as Dispatcher services.
+  Status start(size_t threads, size_t capacity);
+
+  /// Interrupt the pipeline threads, they log the queued items and stop.
+  void stop();
+
+  /**
+   * @brief Queue an item for a pipeline thread.
+   *
+   * Blocks while the queue is full.
+   * @return false if no pipeline thread is running, log synchronously.
+   */
+  bool push(LogPipelineItem&& item);
+
+  /**
+   * @brief Wait for the next item.
+   *
+   * A draining thread does not wait, and the pipeline stops accepting items
+   * once every thread has drained its remaining items.
+   *
+   * @return false if no item was available.
+   */
+  bool pop(LogPipelineItem& item,
+           std::chrono::milliseconds timeout,
+           bool draining);
+
+  /// Record the result of logging a popped item.
+  void finish(const Status& status);
+
+  /// Wait until every queued item was logged, or the timeout expires.
+  bool flush(std::chrono::milliseconds timeout);
+
+  /// Wake every waiting thread, used when threads are interrupted.
+  void wake();
+
+  /// Get a copy of the pipeline counters.
+  LogPipelineStats stats() const;
+
+ private:
+  /// The pipeline threads.
+  std::vector<std::shared_ptr<LogPipelineRunner>> runners_;
+
+  /// Items waiting for a pipeline thread.
+  std::deque<LogPipelineItem> items_;
+
+  /// Counters, the depth is computed from the queue.
+  LogPipelineStats stats_;
+
+  /// The number of popped items not yet finished.
+  size_t inflight_{0};
+
+  /// Protect the queue and counters.
+  mutable Mutex mutex_;
+
+  /// Signal pipeline threads that an item was queued.
+  std::condition_variable queued_;
+
+  /// Signal blocked producers and flushes that an item was logged.
+  std::condition_variable logged_;
+};
+
+/// A Dispatcher service thread that logs queued results.
+class LogPipelineRunner : public InternalRunnable {
+ public:
+  explicit LogPipelineRunner(LogPipeline& pipeline) : pipeline_(pipeline) {}
+
+ public:
+  /// The Dispatcher thread entry point.
+  void start() override;
+
+  /// The Dispatcher interrupt point.
+  void stop() override {
+    pipeline_.wake();
+  }
+
+ private:
+  /// The pipeline this thread drains.
+  LogPipeline& pipeline_;
+};
+
+/// Serialize and log an item from the calling thread.
+Status logPipelineItem(const LogPipelineItem& item);
+
+/// See logQueryLogItem, always logs from the calling thread.
+Status logQueryLogItemSync(const QueryLogItem& item,
+                           const std::string& receiver);
+
+/// See logSnapshotQuery, always logs from the calling thread.
+Status logSnapshotQuerySync(const QueryLogItem& item);
+}
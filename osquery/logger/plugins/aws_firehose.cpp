@@ -35,11 +35,24 @@ FLAG(uint64,
      10,
      "Seconds between flushing logs to Firehose (default 10)");
 FLAG(string, aws_firehose_stream, "", "Name of Firehose stream for logging")
+FLAG(bool,
+     aws_firehose_aggregate,
+     false,
+     "Pack newline-separated logs into each Firehose record");
+
+DECLARE_uint64(aws_stream_retries);
 
 // This is the max per AWS docs
 const size_t FirehoseLogForwarder::kFirehoseMaxRecords = 500;
 // Max size of log + partition key is 1MB. Max size of partition key is 256B.
 const size_t FirehoseLogForwarder::kFirehoseMaxLogBytes = 1000000 - 256;
+// Max size of all records in a PutRecordBatch request, each adds a newline.
+const size_t FirehoseLogForwarder::kFirehoseMaxRequestBytes =
+    4 * 1024 * 1024 - 500;
+
+/// Per-record Firehose errors that succeed when retried.
+static const std::string kFirehoseThrottled = "ServiceUnavailableException";
+static const std::string kFirehoseInternalFailure = "InternalFailure";
 
 Status FirehoseLoggerPlugin::setUp() {
   initAwsSdk();
@@ -59,42 +72,81 @@ Status FirehoseLoggerPlugin::logString(const std::string& s) {
 
 Status FirehoseLogForwarder::send(std::vector<std::string>& log_data,
                                   const std::string& log_type) {
-  std::vector<Aws::Firehose::Model::Record> records;
+  // Firehose buffers together the individual records, so we must insert
+  // newlines here if we want newlines in the resultant files after Firehose
+  // processing. See http://goo.gl/Pz6XOj
+  // The same files are written when several newline-separated logs are
+  // packed into one record, and fewer records are billed.
+  std::vector<std::string> data;
   for (const std::string& log : log_data) {
     if (log.size() + 1 > kFirehoseMaxLogBytes) {
       LOG(ERROR) << "Firehose log too big, discarding!";
+      continue;
     }
+
+    if (!FLAGS_aws_firehose_aggregate || data.empty() ||
+        data.back().size() + log.size() + 1 > kFirehoseMaxLogBytes) {
+      data.push_back(std::string());
+    }
+    data.back().append(log);
+    data.back().push_back('\n');
+  }
+
+  std::vector<Aws::Firehose::Model::Record> records;
+  for (const auto& item : data) {
     Aws::Firehose::Model::Record record;
-    auto buffer =
-        Aws::Utils::ByteBuffer((unsigned char*)log.c_str(), log.length() + 1);
-    // Firehose buffers together the individual records, so we must insert
-    // newlines here if we want newlines in the resultant files after Firehose
-    // processing. See http://goo.gl/Pz6XOj
-    buffer[log.length()] = '\n';
-    record.SetData(buffer);
+    record.SetData(
+        Aws::Utils::ByteBuffer((unsigned char*)item.c_str(), item.length()));
     records.push_back(std::move(record));
   }
 
-  Aws::Firehose::Model::PutRecordBatchRequest request;
-  request.WithDeliveryStreamName(FLAGS_aws_firehose_stream)
-      .WithRecords(std::move(records));
+  // Retry only the failed records, the other records were written.
+  for (size_t attempt = 0; !records.empty(); ++attempt) {
+    Aws::Firehose::Model::PutRecordBatchRequest request;
+    request.WithDeliveryStreamName(FLAGS_aws_firehose_stream)
+        .WithRecords(records);
+
+    Aws::Firehose::Model::PutRecordBatchOutcome outcome =
+        client_->PutRecordBatch(request);
+    Aws::Firehose::Model::PutRecordBatchResult result = outcome.GetResult();
+    if (result.GetFailedPutCount() == 0) {
+      break;
+    }
+
+    // The responses are in the order of the request records.
+    const auto& responses = result.GetRequestResponses();
+    std::vector<Aws::Firehose::Model::Record> failed;
+    bool throttled = false;
+    for (size_t i = 0; i < responses.size() && i < records.size(); ++i) {
+      const auto& response = responses[i];
+      if (response.GetErrorCode().empty() &&
+          response.GetErrorMessage().empty()) {
+        continue;
+      }
 
-  Aws::Firehose::Model::PutRecordBatchOutcome outcome =
-      client_->PutRecordBatch(request);
-  Aws::Firehose::Model::PutRecordBatchResult result = outcome.GetResult();
-  if (result.GetFailedPutCount() != 0) {
-    for (const auto& record : result.GetRequestResponses()) {
-      if (!record.GetErrorMessage().empty()) {
+      throttled = throttled || response.GetErrorCode() == kFirehoseThrottled;
+      if ((response.GetErrorCode() != kFirehoseThrottled &&
+           response.GetErrorCode() != kFirehoseInternalFailure) ||
+          attempt >= FLAGS_aws_stream_retries) {
         VLOG(1) << "Firehose write for " << result.GetFailedPutCount() << " of "
-                << result.GetRequestResponses().size()
-                << " records failed with error " << record.GetErrorMessage();
-        return Status(1, record.GetErrorMessage());
+                << responses.size() << " records failed with error "
+                << response.GetErrorMessage();
+        return Status(1, response.GetErrorMessage());
+      }
+      failed.push_back(std::move(records[i]));
+    }
+
+    records = std::move(failed);
+    if (!records.empty()) {
+      VLOG(1) << "Retrying " << records.size() << " failed Firehose records";
+      if (throttled) {
+        awsThrottleBackoff(attempt);
       }
     }
   }
 
-  VLOG(1) << "Successfully sent " << result.GetRequestResponses().size()
-          << " logs to Firehose.";
+  VLOG(1) << "Successfully sent " << data.size() << " records with "
+          << log_data.size() << " logs to Firehose.";
   return Status(0);
 }
 
@@ -25,20 +25,31 @@
 namespace osquery {
 
 DECLARE_uint64(aws_firehose_period);
+DECLARE_bool(aws_firehose_aggregate);
 
 class FirehoseLogForwarder : public BufferedLogForwarder {
  private:
   static const size_t kFirehoseMaxLogBytes;
   static const size_t kFirehoseMaxRecords;
+  static const size_t kFirehoseMaxRequestBytes;
 
  public:
   FirehoseLogForwarder()
       : BufferedLogForwarder("firehose",
                              std::chrono::seconds(FLAGS_aws_firehose_period),
-                             kFirehoseMaxRecords) {}
+                             kFirehoseMaxRecords) {
+    max_batch_bytes_ = kFirehoseMaxRequestBytes;
+  }
   Status setUp() override;
 
  protected:
+  /**
+   * @brief Put the logs as newline-terminated Firehose records.
+   *
+   * With aws_firehose_aggregate several logs are packed into each record.
+   * Records failed by throttling or internal failures are retried alone, up
+   * to aws_stream_retries times, waiting after throttling.
+   */
   Status send(std::vector<std::string>& log_data,
               const std::string& log_type) override;
 
@@ -22,6 +22,7 @@
 #include <boost/uuid/uuid_io.hpp>
 
 #include <osquery/flags.h>
+#include <osquery/hash.h>
 #include <osquery/registry.h>
 #include <osquery/system.h>
 
@@ -41,11 +42,144 @@ FLAG(bool,
      aws_kinesis_random_partition_key,
      false,
      "Enable random kinesis partition keys");
+FLAG(bool,
+     aws_kinesis_aggregate,
+     false,
+     "Pack logs into KPL aggregated Kinesis records");
+FLAG(string,
+     aws_kinesis_encoding,
+     "json",
+     "Result encoding for Kinesis records: json, msgpack, or protobuf");
+
+DECLARE_uint64(aws_stream_retries);
 
 // This is the max per AWS docs
 const size_t KinesisLogForwarder::kKinesisMaxRecords = 500;
 // Max size of log + partition key is 1MB. Max size of partition key is 256B.
 const size_t KinesisLogForwarder::kKinesisMaxLogBytes = 1000000 - 256;
+// Max size of all records, including partition keys, in a PutRecords request.
+const size_t KinesisLogForwarder::kKinesisMaxRequestBytes =
+    5000000 - 500 * 256;
+
+/// The KPL aggregated record magic number.
+static const std::string kKPLMagic("\xF3\x89\x9A\xC2", 4);
+
+/// The KPL aggregated record MD5 digest size.
+static const size_t kKPLDigestSize = 16;
+
+/// Per-record Kinesis errors that succeed when retried.
+static const std::string kKinesisThrottled =
+    "ProvisionedThroughputExceededException";
+static const std::string kKinesisInternalFailure = "InternalFailure";
+
+/// Get the size of a protobuf varint.
+static size_t varintSize(size_t value) {
+  size_t size = 1;
+  for (; value >= 0x80; value >>= 7) {
+    size++;
+  }
+  return size;
+}
+
+/// Append a protobuf varint.
+static void appendVarint(std::string& message, size_t value) {
+  for (; value >= 0x80; value >>= 7) {
+    message.push_back(static_cast<char>((value & 0x7F) | 0x80));
+  }
+  message.push_back(static_cast<char>(value));
+}
+
+/// Append a protobuf length-delimited field.
+static void appendField(std::string& message,
+                        size_t field,
+                        const std::string& data) {
+  appendVarint(message, (field << 3) | 2);
+  appendVarint(message, data.size());
+  message.append(data);
+}
+
+/**
+ * @brief Pack small logs into KPL aggregated records.
+ *
+ * Each aggregated record is the KPL magic number, an AggregatedRecord
+ * protobuf message, and the message's MD5 digest. The message has a single
+ * partition key, used by every inner record. Consumers using the KCL or the
+ * KPL deaggregation modules read each log as a separate record.
+ */
+class KinesisAggregator {
+ public:
+  explicit KinesisAggregator(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+  /// Check if a log fits an AggregatedRecord with no other logs.
+  bool fits(const std::string& key, const std::string& log) const {
+    return overhead(key) + recordSize(log) <= max_bytes_;
+  }
+
+  /// Check if a log fits the current AggregatedRecord.
+  bool accepts(const std::string& log) const {
+    return message_.empty() ||
+           message_.size() + recordSize(log) + kKPLMagic.size() +
+                   kKPLDigestSize <=
+               max_bytes_;
+  }
+
+  /// Add a log to the current AggregatedRecord.
+  void add(const std::string& key, const std::string& log) {
+    if (message_.empty()) {
+      // partition_key_table, with the single key at index 0.
+      appendField(message_, 1, key);
+    }
+
+    // records, each with partition_key_index 0 and data.
+    std::string record("\x08\x00", 2);
+    appendField(record, 3, log);
+    appendField(message_, 3, record);
+    count_++;
+  }
+
+  /// The number of logs within the current AggregatedRecord.
+  size_t count() const {
+    return count_;
+  }
+
+  /// Complete the current AggregatedRecord and start another.
+  std::string finish() {
+    auto digest =
+        hashFromBuffer(HASH_TYPE_MD5, message_.data(), message_.size());
+    std::string data = kKPLMagic + message_;
+    for (size_t i = 0; i + 1 < digest.size(); i += 2) {
+      data.push_back(
+          static_cast<char>(std::stoul(digest.substr(i, 2), nullptr, 16)));
+    }
+
+    message_.clear();
+    count_ = 0;
+    return data;
+  }
+
+ private:
+  /// The size of a log as an AggregatedRecord record.
+  static size_t recordSize(const std::string& log) {
+    auto size = 2 + 1 + varintSize(log.size()) + log.size();
+    return 1 + varintSize(size) + size;
+  }
+
+  /// The size of an AggregatedRecord with no records.
+  static size_t overhead(const std::string& key) {
+    return kKPLMagic.size() + 1 + varintSize(key.size()) + key.size() +
+           kKPLDigestSize;
+  }
+
+ private:
+  /// The maximum size of an aggregated record, including the partition key.
+  size_t max_bytes_{0};
+
+  /// The current AggregatedRecord message.
+  std::string message_;
+
+  /// The number of logs in the message.
+  size_t count_{0};
+};
 
 Status KinesisLoggerPlugin::setUp() {
   initAwsSdk();
@@ -59,47 +193,109 @@ Status KinesisLoggerPlugin::setUp() {
   return Status(0, "OK");
 }
 
+ResultEncoding KinesisLoggerPlugin::resultEncoding() {
+  auto encoding = RESULT_ENCODING_JSON;
+  if (!getResultEncoding(FLAGS_aws_kinesis_encoding, encoding)) {
+    LOG(WARNING) << "Unknown Kinesis encoding: " << FLAGS_aws_kinesis_encoding;
+  }
+  return encoding;
+}
+
 Status KinesisLoggerPlugin::logString(const std::string& s) {
   return forwarder_->logString(s);
 }
 
+std::string KinesisLogForwarder::getPartitionKey() {
+  if (FLAGS_aws_kinesis_random_partition_key) {
+    boost::uuids::uuid uuid = boost::uuids::random_generator()();
+    return boost::uuids::to_string(uuid);
+  }
+  return partition_key_;
+}
+
 Status KinesisLogForwarder::send(std::vector<std::string>& log_data,
                                  const std::string& log_type) {
   std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry> entries;
+  auto append = [&entries](const std::string& key, const std::string& data) {
+    Aws::Kinesis::Model::PutRecordsRequestEntry entry;
+    entry.WithPartitionKey(key).WithData(Aws::Utils::ByteBuffer(
+        (unsigned char*)data.c_str(), data.length()));
+    entries.push_back(std::move(entry));
+  };
+
+  KinesisAggregator aggregator(kKinesisMaxLogBytes);
+  auto key = getPartitionKey();
   for (const std::string& log : log_data) {
     if (log.size() > kKinesisMaxLogBytes) {
       LOG(ERROR) << "Kinesis log too big, discarding!";
+      continue;
     }
-    Aws::Kinesis::Model::PutRecordsRequestEntry entry;
-    if (FLAGS_aws_kinesis_random_partition_key) {
-      boost::uuids::uuid uuid = boost::uuids::random_generator()();
-      partition_key_ = boost::uuids::to_string(uuid);
+
+    if (!FLAGS_aws_kinesis_aggregate || !aggregator.fits(key, log)) {
+      // A log too large to aggregate is sent as a plain record.
+      append(getPartitionKey(), log);
+      continue;
     }
-    entry.WithPartitionKey(partition_key_)
-        .WithData(
-            Aws::Utils::ByteBuffer((unsigned char*)log.c_str(), log.length()));
-    entries.push_back(std::move(entry));
+
+    if (!aggregator.accepts(log)) {
+      append(key, aggregator.finish());
+      key = getPartitionKey();
+    }
+    aggregator.add(key, log);
+  }
+
+  if (aggregator.count() > 0) {
+    append(key, aggregator.finish());
   }
 
-  Aws::Kinesis::Model::PutRecordsRequest request;
-  request.WithStreamName(FLAGS_aws_kinesis_stream)
-      .WithRecords(std::move(entries));
+  // Retry only the failed records, the other records were written.
+  size_t sent = 0;
+  for (size_t attempt = 0; !entries.empty(); ++attempt) {
+    Aws::Kinesis::Model::PutRecordsRequest request;
+    request.WithStreamName(FLAGS_aws_kinesis_stream).WithRecords(entries);
 
-  Aws::Kinesis::Model::PutRecordsOutcome outcome = client_->PutRecords(request);
-  Aws::Kinesis::Model::PutRecordsResult result = outcome.GetResult();
-  if (result.GetFailedRecordCount() != 0) {
-    for (const auto& record : result.GetRecords()) {
-      if (!record.GetErrorMessage().empty()) {
+    Aws::Kinesis::Model::PutRecordsOutcome outcome =
+        client_->PutRecords(request);
+    Aws::Kinesis::Model::PutRecordsResult result = outcome.GetResult();
+    if (result.GetFailedRecordCount() == 0) {
+      sent += entries.size();
+      break;
+    }
+
+    // The result records are in the order of the request records.
+    const auto& records = result.GetRecords();
+    std::vector<Aws::Kinesis::Model::PutRecordsRequestEntry> failed;
+    bool throttled = false;
+    for (size_t i = 0; i < records.size() && i < entries.size(); ++i) {
+      const auto& record = records[i];
+      if (record.GetErrorCode().empty() && record.GetErrorMessage().empty()) {
+        sent++;
+        continue;
+      }
+
+      throttled = throttled || record.GetErrorCode() == kKinesisThrottled;
+      if ((record.GetErrorCode() != kKinesisThrottled &&
+           record.GetErrorCode() != kKinesisInternalFailure) ||
+          attempt >= FLAGS_aws_stream_retries) {
         LOG(ERROR) << "Kinesis write for " << result.GetFailedRecordCount()
-                   << " of " << result.GetRecords().size()
-                   << " records failed with error " << record.GetErrorMessage();
+                   << " of " << records.size() << " records failed with error "
+                   << record.GetErrorMessage();
         return Status(1, record.GetErrorMessage());
       }
+      failed.push_back(std::move(entries[i]));
+    }
+
+    entries = std::move(failed);
+    if (!entries.empty()) {
+      VLOG(1) << "Retrying " << entries.size() << " failed Kinesis records";
+      if (throttled) {
+        awsThrottleBackoff(attempt);
+      }
     }
   }
 
-  VLOG(1) << "Successfully sent " << result.GetRecords().size()
-          << " logs to Kinesis.";
+  VLOG(1) << "Successfully sent " << sent << " records with "
+          << log_data.size() << " logs to Kinesis.";
   return Status(0);
 }
 
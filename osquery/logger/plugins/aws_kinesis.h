@@ -25,23 +25,38 @@
 namespace osquery {
 
 DECLARE_uint64(aws_kinesis_period);
+DECLARE_bool(aws_kinesis_aggregate);
 
 class KinesisLogForwarder : public BufferedLogForwarder {
  private:
   static const size_t kKinesisMaxLogBytes;
   static const size_t kKinesisMaxRecords;
+  static const size_t kKinesisMaxRequestBytes;
 
  public:
   KinesisLogForwarder()
       : BufferedLogForwarder("kinesis",
                              std::chrono::seconds(FLAGS_aws_kinesis_period),
-                             kKinesisMaxRecords) {}
+                             kKinesisMaxRecords) {
+    max_batch_bytes_ = kKinesisMaxRequestBytes;
+  }
   Status setUp() override;
 
  protected:
+  /**
+   * @brief Put the logs as Kinesis records.
+   *
+   * With aws_kinesis_aggregate the logs are packed into KPL aggregated
+   * records. Records failed by throttling or internal failures are retried
+   * alone, up to aws_stream_retries times, waiting after throttling.
+   */
   Status send(std::vector<std::string>& log_data,
               const std::string& log_type) override;
 
+ private:
+  /// The host partition key, or a random key for each record.
+  std::string getPartitionKey();
+
  private:
   std::string partition_key_;
   std::shared_ptr<Aws::Kinesis::KinesisClient> client_{nullptr};
@@ -55,6 +70,9 @@ class KinesisLoggerPlugin : public LoggerPlugin {
 
   Status setUp() override;
 
+  /// Request binary results, see aws_kinesis_encoding.
+  ResultEncoding resultEncoding() override;
+
  private:
   void init(const std::string& name,
             const std::vector<StatusLogLine>& log) override {}
@@ -8,9 +8,13 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
 #include <mutex>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include <boost/property_tree/ini_parser.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -55,6 +59,22 @@ FLAG(uint64,
      aws_sts_timeout,
      3600,
      "AWS STS assume role credential validity in seconds (default 3600)");
+FLAG(uint64,
+     aws_stream_retries,
+     3,
+     "Times to retry records failed by a Kinesis or Firehose stream");
+
+/// The first throttling backoff in milliseconds, doubled for each attempt.
+static const size_t kAWSBackoffBaseMilli = 100;
+
+/// The max throttling backoff in milliseconds.
+static const size_t kAWSBackoffMaxMilli = 5000;
+
+/// STS credentials are renewed within this fraction of their validity.
+static const size_t kAWSSTSRefreshDivisor = 5;
+
+/// Seconds to wait before renewing again after STS failed.
+static const size_t kAWSSTSRetrySeconds = 30;
 
 /// Map of AWS region name to AWS::Region enum.
 static const std::set<std::string> kAwsRegions = {"us-east-1",
@@ -110,7 +130,11 @@ std::shared_ptr<Aws::Http::HttpResponse> NetlibHttpClient::MakeRequest(
   uri.SetPath(Aws::Http::URI::URLEncodePath(uri.GetPath()));
   Aws::String url = uri.GetURIString();
 
-  bn::http::client client = TLSTransport().getClient();
+  // Pooled clients are keyed by the endpoint host, so each regional service
+  // endpoint keeps its connection between requests.
+  TLSTransport transport;
+  transport.setDestination(url);
+  bn::http::client client = transport.getClient();
   bn::http::client::request req(url);
 
   for (const auto& requestHeader : request.GetHeaders()) {
@@ -188,42 +212,81 @@ OsqueryFlagsAWSCredentialsProvider::GetAWSCredentials() {
                                    FLAGS_aws_secret_access_key);
 }
 
-Aws::Auth::AWSCredentials
-OsquerySTSAWSCredentialsProvider::GetAWSCredentials() {
+size_t OsquerySTSAWSCredentialsProvider::getRefreshWindow() const {
+  return FLAGS_aws_sts_timeout / kAWSSTSRefreshDivisor;
+}
+
+void OsquerySTSAWSCredentialsProvider::refresh() {
+  WriteLock refresh_lock(refresh_mutex_);
   // Grab system time in seconds-since-epoch for token expiration checks.
   size_t current_time = osquery::getUnixTime();
+  {
+    WriteLock lock(mutex_);
+    if (current_time + getRefreshWindow() < token_expire_time_) {
+      // Another caller renewed the credentials while this one waited.
+      return;
+    }
+  }
 
-  // Pull new STS credentials if not cached from a previous run.
-  if (token_expire_time_ <= current_time) {
-    // Create and setup a STS client to pull our temporary credentials.
-    VLOG(1) << "Generating new AWS STS credentials";
+  // Create and setup a STS client to pull our temporary credentials.
+  VLOG(1) << "Generating new AWS STS credentials";
 
-    // If we have not setup an AWS client yet, we must do so here.
-    if (access_key_id_.empty()) {
-      initAwsSdk();
+  // The client and its connection are kept for later refreshes.
+  if (client_ == nullptr) {
+    initAwsSdk();
+    makeAWSClient<Aws::STS::STSClient>(client_, false);
+    if (client_ == nullptr) {
+      return;
     }
+  }
 
-    makeAWSClient<Aws::STS::STSClient>(client_, false);
-    Model::AssumeRoleRequest sts_r;
-    sts_r.SetRoleArn(FLAGS_aws_sts_arn_role);
-    sts_r.SetRoleSessionName(FLAGS_aws_sts_session_name);
-    sts_r.SetDurationSeconds(FLAGS_aws_sts_timeout);
-
-    // Pull our STS credentials.
-    Model::AssumeRoleOutcome sts_outcome = client_->AssumeRole(sts_r);
-    if (sts_outcome.IsSuccess()) {
-      Model::AssumeRoleResult sts_result = sts_outcome.GetResult();
-      // Cache our credentials for later use.
-      access_key_id_ = sts_result.GetCredentials().GetAccessKeyId();
-      secret_access_key_ = sts_result.GetCredentials().GetSecretAccessKey();
-      session_token_ = sts_result.GetCredentials().GetSessionToken();
-      // Calculate when our credentials will expire.
-      token_expire_time_ = current_time + FLAGS_aws_sts_timeout;
-    } else {
-      LOG(ERROR) << "Failed to create STS temporary credentials: "
-                    "No STS policy exists for the AWS user/role";
+  Model::AssumeRoleRequest sts_r;
+  sts_r.SetRoleArn(FLAGS_aws_sts_arn_role);
+  sts_r.SetRoleSessionName(FLAGS_aws_sts_session_name);
+  sts_r.SetDurationSeconds(FLAGS_aws_sts_timeout);
+
+  // Pull our STS credentials.
+  Model::AssumeRoleOutcome sts_outcome = client_->AssumeRole(sts_r);
+  WriteLock lock(mutex_);
+  if (sts_outcome.IsSuccess()) {
+    Model::AssumeRoleResult sts_result = sts_outcome.GetResult();
+    // Cache our credentials for later use.
+    access_key_id_ = sts_result.GetCredentials().GetAccessKeyId();
+    secret_access_key_ = sts_result.GetCredentials().GetSecretAccessKey();
+    session_token_ = sts_result.GetCredentials().GetSessionToken();
+    // Calculate when our credentials will expire.
+    token_expire_time_ = current_time + FLAGS_aws_sts_timeout;
+  } else {
+    last_failure_time_ = current_time;
+    LOG(ERROR) << "Failed to create STS temporary credentials: "
+                  "No STS policy exists for the AWS user/role";
+  }
+}
+
+Aws::Auth::AWSCredentials
+OsquerySTSAWSCredentialsProvider::GetAWSCredentials() {
+  size_t current_time = osquery::getUnixTime();
+  {
+    WriteLock lock(mutex_);
+    if (current_time < token_expire_time_) {
+      // Renew credentials close to expiring without blocking the caller.
+      if (current_time + getRefreshWindow() >= token_expire_time_ &&
+          current_time >= last_failure_time_ + kAWSSTSRetrySeconds &&
+          !refreshing_.exchange(true)) {
+        auto self = shared_from_this();
+        std::thread([self]() {
+          self->refresh();
+          self->refreshing_ = false;
+        }).detach();
+      }
+      return Aws::Auth::AWSCredentials(
+          access_key_id_, secret_access_key_, session_token_);
     }
   }
+
+  // Without valid credentials the caller must wait for STS.
+  refresh();
+  WriteLock lock(mutex_);
   return Aws::Auth::AWSCredentials(
       access_key_id_, secret_access_key_, session_token_);
 }
@@ -306,6 +369,20 @@ void initAwsSdk() {
   }
 }
 
+void awsThrottleBackoff(size_t attempt) {
+  static thread_local std::mt19937 generator{std::random_device()()};
+
+  auto limit = kAWSBackoffMaxMilli;
+  if (attempt < 16) {
+    limit = std::min(limit, kAWSBackoffBaseMilli << attempt);
+  }
+
+  // Full jitter, throttled clients retrying together would be throttled again.
+  std::uniform_int_distribution<size_t> distribution(0, limit);
+  std::this_thread::sleep_for(
+      std::chrono::milliseconds(distribution(generator)));
+}
+
 Status getAWSRegion(std::string& region, bool sts) {
   // First try using the explicit region flags (STS or otherwise).
   if (sts && !FLAGS_aws_sts_region.empty()) {
@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include <aws/core/Region.h>
@@ -24,6 +25,7 @@
 
 #include <boost/property_tree/ptree.hpp>
 
+#include <osquery/core.h>
 #include <osquery/status.h>
 
 namespace osquery {
@@ -87,10 +89,13 @@ class OsqueryFlagsAWSCredentialsProvider
  * @brief AWS credentials provider that uses STS assume role auth
  *
  * This provider delegates temp AWS STS credentials via assume role
- * for an AWS arn.
+ * for an AWS arn. Only the first request waits for STS. Credentials that
+ * are close to expiring are returned while a background thread assumes the
+ * role again, so a logger's send path does not wait on the round trip.
  */
 class OsquerySTSAWSCredentialsProvider
-    : public Aws::Auth::AWSCredentialsProvider {
+    : public Aws::Auth::AWSCredentialsProvider,
+      public std::enable_shared_from_this<OsquerySTSAWSCredentialsProvider> {
  public:
   OsquerySTSAWSCredentialsProvider() : AWSCredentialsProvider() {}
 
@@ -98,9 +103,28 @@ class OsquerySTSAWSCredentialsProvider
   Aws::Auth::AWSCredentials GetAWSCredentials() override;
 
  private:
-  /// Internal API client.
+  /// Assume the role unless another caller already renewed the credentials.
+  void refresh();
+
+  /// Seconds before the expiration when the credentials are renewed.
+  size_t getRefreshWindow() const;
+
+ private:
+  /// Internal API client, reused by every refresh.
   std::shared_ptr<Aws::STS::STSClient> client_{nullptr};
 
+  /// Protect the cached credentials.
+  Mutex mutex_;
+
+  /// Serialize role assumptions.
+  Mutex refresh_mutex_;
+
+  /// Set while a background refresh is running.
+  std::atomic<bool> refreshing_{false};
+
+  /// Time of the last failed role assumption.
+  size_t last_failure_time_{0};
+
   /// Configuration details.
   Aws::String access_key_id_;
   Aws::String secret_access_key_;
@@ -138,6 +162,16 @@ class OsqueryAWSCredentialsProviderChain
  */
 void initAwsSdk();
 
+/**
+ * @brief Wait before retrying records throttled by an AWS stream.
+ *
+ * The wait is a random time up to 100ms doubled for each attempt, with a max
+ * of 5s, so clients throttled together do not retry together.
+ *
+ * @param attempt The number of retries already attempted.
+ */
+void awsThrottleBackoff(size_t attempt);
+
 /**
  * @brief Retrieve the Aws::Region from the aws_region flag
  *
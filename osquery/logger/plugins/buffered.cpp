@@ -10,8 +10,15 @@
 
 #include <algorithm>
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <iterator>
+#include <set>
 #include <thread>
 
+#include <zlib.h>
+
 #include <boost/property_tree/ptree.hpp>
 
 #include <osquery/database.h>
@@ -21,6 +28,7 @@
 #include <osquery/system.h>
 
 #include "osquery/config/parsers/decorators.h"
+#include "osquery/core/conversions.h"
 #include "osquery/core/json.h"
 #include "osquery/logger/plugins/buffered.h"
 
@@ -33,66 +41,538 @@ FLAG(uint64,
      1000000,
      "Maximum number of logs in buffered output plugins (0 = unlimited)");
 
+FLAG(uint64,
+     buffered_log_block_lines,
+     0,
+     "Pack unsent buffered logs into compressed blocks of this many lines "
+     "(0 = disabled)");
+
 const std::chrono::seconds BufferedLogForwarder::kLogPeriod =
     std::chrono::seconds(4);
 const size_t BufferedLogForwarder::kMaxLogLines = 1024;
 
+/// The number of digits in a buffered log sequence number.
+static const size_t kSequenceWidth = 20;
+
+/// The largest useful preset dictionary, the size of the deflate window.
+static const size_t kBlockDictionarySize = 32768;
+
+/// The most blocks packed by a single check.
+static const size_t kMaxCompactBlocks = 64;
+
+/// A compressed block of buffered lines of a single log type.
+struct BufferedLogBlock {
+  /// The first and last sequence numbers of the lines.
+  size_t first{0};
+  size_t last{0};
+
+  /// The number of lines, including empty lines.
+  size_t count{0};
+
+  /// The adler32 id of the block's dictionary, 0 if none was used.
+  uint32_t dictionary{0};
+};
+
+/// Zero padding keeps the bytewise index order equal to the sequence order.
+static std::string padSequence(size_t sequence) {
+  auto digits = std::to_string(sequence);
+  return std::string(kSequenceWidth - std::min(kSequenceWidth, digits.size()),
+                     '0') +
+         digits;
+}
+
+/// Parse the sequence number following an index prefix.
+static bool parseSequence(const std::string& index,
+                          size_t prefix_size,
+                          size_t& sequence) {
+  if (index.size() != prefix_size + kSequenceWidth) {
+    return false;
+  }
+
+  sequence = 0;
+  for (size_t i = prefix_size; i < index.size(); ++i) {
+    if (index[i] < '0' || index[i] > '9') {
+      return false;
+    }
+    sequence = sequence * 10 + (index[i] - '0');
+  }
+  return true;
+}
+
+/// Parse a block index: the padded last sequence, first, count, dictionary.
+static bool parseBlockIndex(const std::string& index,
+                            size_t prefix_size,
+                            BufferedLogBlock& block) {
+  auto fields = split(index.substr(std::min(prefix_size, index.size())), "_");
+  if (fields.size() != 4 || fields[0].size() != kSequenceWidth) {
+    return false;
+  }
+
+  unsigned long long values[4] = {0};
+  for (size_t i = 0; i < fields.size(); ++i) {
+    if (!safeStrtoull(fields[i], 10, values[i]).ok()) {
+      return false;
+    }
+  }
+  block.last = static_cast<size_t>(values[0]);
+  block.first = static_cast<size_t>(values[1]);
+  block.count = static_cast<size_t>(values[2]);
+  block.dictionary = static_cast<uint32_t>(values[3]);
+  return block.first <= block.last && block.count > 0;
+}
+
+/// Append a line and its sequence number to a block's content.
+static void encodeBlockLine(size_t sequence,
+                            const std::string& line,
+                            std::string& data) {
+  data += std::to_string(sequence);
+  data += ':';
+  data += std::to_string(line.size());
+  data += ':';
+  data += line;
+}
+
+/// Parse the next line of a block's content.
+static bool decodeBlockLine(const std::string& data,
+                            size_t& position,
+                            size_t& sequence,
+                            std::string& line) {
+  size_t values[2] = {0, 0};
+  for (auto& value : values) {
+    auto end = data.find(':', position);
+    if (end == std::string::npos || end == position ||
+        end - position > kSequenceWidth) {
+      return false;
+    }
+    for (; position < end; ++position) {
+      if (data[position] < '0' || data[position] > '9') {
+        return false;
+      }
+      value = value * 10 + (data[position] - '0');
+    }
+    position++;
+  }
+
+  if (values[1] > data.size() - position) {
+    return false;
+  }
+  sequence = values[0];
+  line.assign(data, position, values[1]);
+  position += values[1];
+  return true;
+}
+
+/**
+ * @brief Train a dictionary from the lines of a block.
+ *
+ * Lines are sampled across the block so the dictionary holds the content of
+ * many queries. Deflate prefers the closest match, so the sample is truncated
+ * to the last bytes of the deflate window.
+ */
+static std::string trainBlockDictionary(const DatabaseKeyValues& items) {
+  size_t bytes = 0;
+  for (const auto& item : items) {
+    bytes += item.second.size();
+  }
+
+  std::string dictionary;
+  auto stride = bytes / kBlockDictionarySize + 1;
+  for (size_t i = 0; i < items.size(); i += stride) {
+    dictionary += items[i].second;
+  }
+  if (dictionary.size() > kBlockDictionarySize) {
+    dictionary.erase(0, dictionary.size() - kBlockDictionarySize);
+  }
+  return dictionary;
+}
+
+/// Deflate a block's content with an optional preset dictionary.
+static Status deflateBlock(const std::string& data,
+                           const std::string& dictionary,
+                           std::string& output) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (deflateInit(&zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+    return Status(1, "Cannot initialize compression");
+  }
+
+  if (!dictionary.empty() &&
+      deflateSetDictionary(&zs,
+                           (const Bytef*)dictionary.data(),
+                           static_cast<uInt>(dictionary.size())) != Z_OK) {
+    deflateEnd(&zs);
+    return Status(1, "Cannot set the compression dictionary");
+  }
+
+  output.resize(deflateBound(&zs, static_cast<uLong>(data.size())));
+  zs.next_in = (Bytef*)data.data();
+  zs.avail_in = static_cast<uInt>(data.size());
+  zs.next_out = (Bytef*)&output[0];
+  zs.avail_out = static_cast<uInt>(output.size());
+  auto ret = deflate(&zs, Z_FINISH);
+  output.resize(zs.total_out);
+  deflateEnd(&zs);
+  if (ret != Z_STREAM_END) {
+    return Status(1, "Cannot compress block");
+  }
+  return Status(0, "OK");
+}
+
+/// Inflate a block's content, the dictionary must be the one it used.
+static Status inflateBlock(const std::string& data,
+                           const std::string& dictionary,
+                           std::string& output) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  if (inflateInit(&zs) != Z_OK) {
+    return Status(1, "Cannot initialize decompression");
+  }
+
+  zs.next_in = (Bytef*)data.data();
+  zs.avail_in = static_cast<uInt>(data.size());
+
+  int ret = Z_OK;
+  output.clear();
+  {
+    char buffer[16384] = {0};
+    while (ret == Z_OK) {
+      zs.next_out = reinterpret_cast<Bytef*>(buffer);
+      zs.avail_out = sizeof(buffer);
+
+      ret = inflate(&zs, Z_NO_FLUSH);
+      if (ret == Z_NEED_DICT && !dictionary.empty()) {
+        ret = inflateSetDictionary(&zs,
+                                   (const Bytef*)dictionary.data(),
+                                   static_cast<uInt>(dictionary.size()));
+      }
+      if (output.size() < zs.total_out) {
+        output.append(buffer, zs.total_out - output.size());
+      }
+    }
+  }
+
+  inflateEnd(&zs);
+  if (ret != Z_STREAM_END) {
+    return Status(1, "Cannot decompress block");
+  }
+  return Status(0, "OK");
+}
+
 Status BufferedLogForwarder::setUp() {
-  // initialize buffer_count_ by scanning the DB
-  std::vector<std::string> indexes;
-  auto status = scanDatabaseKeys(kLogs, indexes, index_name_, 0);
+  return load();
+}
 
-  if (!status.ok()) {
-    return Status(1, "Error scanning for buffered log count");
+Status BufferedLogForwarder::load() {
+  std::call_once(loaded_, [this]() { load_status_ = loadOffsets(); });
+  return load_status_;
+}
+
+Status BufferedLogForwarder::loadOffsets() {
+  size_t count = 0;
+  size_t last = 0;
+  std::vector<std::string> legacy;
+  std::set<uint32_t> dictionaries;
+  for (const auto results : {true, false}) {
+    auto& offset = (results) ? result_offset_ : status_offset_;
+    std::string value;
+    if (getDatabaseValue(kPersistentSettings, genOffsetKey(results), value)
+            .ok()) {
+      offset = std::strtoull(value.c_str(), nullptr, 10);
+    }
+    last = std::max(last, offset);
+
+    // Count the lines of the compressed blocks following the offset.
+    size_t packed = offset;
+    std::vector<std::string> blocks;
+    auto block_prefix_size = genBlockPrefix(results).size();
+    scanDatabaseKeys(kLogs, blocks, genBlockPrefix(results));
+    for (const auto& index : blocks) {
+      BufferedLogBlock block;
+      if (!parseBlockIndex(index, block_prefix_size, block)) {
+        continue;
+      }
+      if (block.last <= offset) {
+        // The removal of a sent block was interrupted.
+        deleteDatabaseValue(kLogs, index);
+        continue;
+      }
+
+      DatabaseKeyValues items;
+      if (block.first <= offset && getDatabaseValue(kLogs, index, value).ok() &&
+          readBlock(results, block, value, offset, items).ok()) {
+        count += items.size();
+      } else {
+        count += block.count;
+      }
+      dictionaries.insert(block.dictionary);
+      packed = std::max(packed, block.last);
+    }
+    last = std::max(last, packed);
+
+    // Find the last sequence number, this is the only scan of the buffer.
+    std::vector<std::string> indexes;
+    auto prefix_size = genIndexPrefix(results).size();
+    auto status = scanDatabaseKeys(kLogs, indexes, genIndexPrefix(results));
+    if (!status.ok()) {
+      return Status(1, "Error scanning for buffered log count");
+    }
+
+    for (auto& index : indexes) {
+      size_t sequence = 0;
+      if (!parseSequence(index, prefix_size, sequence)) {
+        legacy.push_back(std::move(index));
+      } else if (sequence > packed) {
+        last = std::max(last, sequence);
+        count++;
+      }
+    }
+
+    // Lines may remain if the previous acknowledgement, or the removal of
+    // lines packed into a block, was interrupted.
+    deleteDatabaseRange(
+        kLogs, genIndex(results, 0), genIndex(results, packed + 1));
   }
+  log_index_ = last;
+  buffer_count_ = count;
 
-  buffer_count_ = indexes.size();
-  return Status(0);
+  // Remove the dictionaries no longer used by a block.
+  std::vector<std::string> keys;
+  auto dictionary_prefix = index_name_ + "_d_";
+  scanDatabaseKeys(kLogs, keys, dictionary_prefix);
+  for (const auto& key : keys) {
+    unsigned long long id = 0;
+    if (!safeStrtoull(key.substr(dictionary_prefix.size()), 10, id).ok() ||
+        dictionaries.count(static_cast<uint32_t>(id)) == 0) {
+      deleteDatabaseValue(kLogs, key);
+    }
+  }
+
+  if (legacy.empty()) {
+    return Status(0);
+  }
+
+  // Lines buffered with the previous time-based indexes are assigned
+  // sequence numbers in the order of their time and index.
+  auto prefix_size = genIndexPrefix(true).size();
+  std::sort(legacy.begin(),
+            legacy.end(),
+            [prefix_size](const std::string& a, const std::string& b) {
+              return a.compare(prefix_size,
+                               std::string::npos,
+                               b,
+                               prefix_size,
+                               std::string::npos) < 0;
+            });
+
+  DatabaseKeyValues lines;
+  for (const auto& index : legacy) {
+    std::string value;
+    if (getDatabaseValue(kLogs, index, value).ok()) {
+      lines.push_back(
+          std::make_pair(genIndex(isResultIndex(index)), std::move(value)));
+    }
+  }
+
+  auto status = addValuesWithCount(kLogs, lines);
+  if (status.ok()) {
+    status = deleteDatabaseValues(kLogs, legacy);
+  }
+  return status;
 }
 
+/// Buffered lines of a single log type, forwarded with one send.
+struct BufferedLogBatch {
+  /// The log type, result or status.
+  bool results{true};
+
+  /// The first and last sequence numbers within the batch.
+  size_t first{0};
+  size_t last{0};
+
+  /// The number of buffered lines, including empty lines.
+  size_t count{0};
+
+  /// The number of those lines read from compressed blocks.
+  size_t packed{0};
+
+  /// The sequence number of the last line read from a compressed block.
+  size_t packed_last{0};
+
+  /// The non-empty buffered lines.
+  std::vector<std::string> lines;
+
+  /// The total size of the lines.
+  size_t bytes{0};
+
+  /// Set once the lines were sent.
+  bool sent{false};
+};
+
 void BufferedLogForwarder::check() {
-  // Get a list of all the buffered log items, with a max of 1024 lines.
-  std::vector<std::string> indexes;
-  auto status = scanDatabaseKeys(kLogs, indexes, index_name_, max_log_lines_);
-
-  // For each index, accumulate the log line into the result or status set.
-  std::vector<std::string> results, statuses;
-  iterate(indexes, ([&results, &statuses, this](std::string& index) {
-            std::string value;
-            auto& target = isResultIndex(index) ? results : statuses;
-            if (getDatabaseValue(kLogs, index, value)) {
-              target.push_back(std::move(value));
-            }
-          }));
-
-  // If any results/statuses were found in the flushed buffer, send.
-  if (results.size() > 0) {
-    status = send(results, "result");
+  load();
+
+  // Read the buffered log items following each committed offset, with a max
+  // of max_log_lines_ for each concurrent send, accumulating each line into
+  // a result or status batch. A batch is closed when it reaches the line
+  // count or payload size.
+  auto in_flight = std::max<size_t>(max_in_flight_, 1);
+  std::vector<BufferedLogBatch> batches;
+  for (const auto results : {true, false}) {
+    auto offset = (results) ? result_offset_ : status_offset_;
+    auto max = max_log_lines_ * in_flight;
+
+    // Blocks hold the oldest lines, the lines that follow are read as they
+    // are buffered.
+    DatabaseKeyValues items;
+    auto status = readBlocks(results, offset, max, items);
+    auto packed = items.size();
+    if (status.ok() && items.size() < max) {
+      DatabaseKeyValues lines;
+      status = scanDatabaseRange(kLogs,
+                                 genIndex(results, offset + 1),
+                                 genIndexPrefix(results) +
+                                     std::string(kSequenceWidth, '9'),
+                                 lines,
+                                 max - items.size());
+      std::move(lines.begin(), lines.end(), std::back_inserter(items));
+    }
     if (!status.ok()) {
-      VLOG(1) << "Error sending results to logger: " << status.getMessage();
-    } else {
-      // Clear the results logs once they were sent.
-      iterate(indexes, ([this](std::string& index) {
-                if (!isResultIndex(index)) {
-                  return;
-                }
-                deleteValueWithCount(kLogs, index);
-              }));
+      VLOG(1) << "Error reading buffered logs: " << status.getMessage();
+      continue;
+    }
+
+    auto prefix_size = genIndexPrefix(results).size();
+    BufferedLogBatch batch;
+    batch.results = results;
+    for (size_t i = 0; i < items.size(); ++i) {
+      auto& item = items[i];
+      size_t sequence = 0;
+      if (!parseSequence(item.first, prefix_size, sequence)) {
+        continue;
+      }
+
+      if (!batch.lines.empty() &&
+          (batch.lines.size() >= max_log_lines_ ||
+           (max_batch_bytes_ > 0 &&
+            batch.bytes + item.second.size() > max_batch_bytes_))) {
+        batches.push_back(std::move(batch));
+        batch = BufferedLogBatch();
+        batch.results = results;
+      }
+
+      if (batch.count++ == 0) {
+        batch.first = sequence;
+      }
+      // A packed line sent after a failed batch is acknowledged as if empty.
+      bool skip = false;
+      if (i < packed) {
+        batch.packed++;
+        batch.packed_last = sequence;
+        skip = isPackedSent(results, sequence);
+      }
+      batch.last = sequence;
+      if (!item.second.empty() && !skip) {
+        batch.bytes += item.second.size();
+        batch.lines.push_back(std::move(item.second));
+      }
+    }
+
+    if (batch.count > 0) {
+      batches.push_back(std::move(batch));
     }
   }
 
-  if (statuses.size() > 0) {
-    status = send(statuses, "status");
-    if (!status.ok()) {
-      VLOG(1) << "Error sending status to logger: " << status.getMessage();
-    } else {
-      // Clear the status logs once they were sent.
-      iterate(indexes, ([this](std::string& index) {
-                if (!isStatusIndex(index)) {
-                  return;
-                }
-                deleteValueWithCount(kLogs, index);
-              }));
+  // Batches of only empty lines are acknowledged without sending.
+  std::vector<BufferedLogBatch*> pending;
+  for (auto& batch : batches) {
+    batch.sent = batch.lines.empty();
+    if (!batch.sent) {
+      pending.push_back(&batch);
+    }
+  }
+
+  // Send up to in_flight batches at a time, the first from this thread.
+  for (size_t i = 0; i < pending.size(); i += in_flight) {
+    auto wave = std::min(pending.size(), i + in_flight);
+    std::vector<std::future<Status>> requests;
+    for (size_t j = i + 1; j < wave; ++j) {
+      auto batch = pending[j];
+      requests.push_back(std::async(std::launch::async, [this, batch]() {
+        return send(batch->lines, (batch->results) ? "result" : "status");
+      }));
+    }
+
+    for (size_t j = i; j < wave; ++j) {
+      auto batch = pending[j];
+      auto status = (j == i)
+                        ? send(batch->lines, (batch->results) ? "result"
+                                                              : "status")
+                        : requests[j - i - 1].get();
+      if (!status.ok()) {
+        VLOG(1) << "Error sending " << ((batch->results) ? "result" : "status")
+                << " logs to logger: " << status.getMessage();
+        continue;
+      }
+      batch->sent = true;
+    }
+  }
+
+  // Clear the logs once they were sent. Each run of sent batches is removed
+  // as a range, and the offset moves past the sent batches preceding the
+  // first failure. Lines of a block are only removed with the offset, the
+  // block lines sent after the first failure are remembered instead.
+  for (const auto results : {true, false}) {
+    auto offset = (results) ? result_offset_ : status_offset_;
+    auto committed = offset;
+    bool contiguous = true;
+    size_t first = 0;
+    size_t count = 0;
+    size_t last = 0;
+    size_t packed = 0;
+    for (const auto& batch : batches) {
+      if (batch.results != results) {
+        continue;
+      }
+
+      if (batch.sent) {
+        if (count == 0) {
+          first = batch.first;
+        }
+        last = batch.last;
+        count += batch.count - batch.packed;
+        if (contiguous) {
+          committed = batch.last;
+          packed += batch.packed;
+        } else if (batch.packed > 0) {
+          addPackedSent(results, batch.first, batch.packed_last);
+        }
+        continue;
+      }
+
+      contiguous = false;
+      if (count > 0) {
+        deleteRangeWithCount(results, first, last, count);
+        count = 0;
+      }
+    }
+
+    if (count > 0) {
+      deleteRangeWithCount(results, first, last, count);
+    }
+
+    if (committed != offset) {
+      commitOffset(results, committed);
+    }
+    if (packed > 0) {
+      deleteBlocksWithCount(results, committed, packed);
+    }
+
+    if (!contiguous && FLAGS_buffered_log_block_lines > 0) {
+      // The logger is failing, compress the backlog while it grows.
+      auto status = compact(results);
+      if (!status.ok()) {
+        VLOG(1) << "Error compressing buffered logs: " << status.getMessage();
+      }
     }
   }
 
@@ -103,64 +583,76 @@ void BufferedLogForwarder::check() {
 }
 
 void BufferedLogForwarder::purge() {
+  load();
   if (buffer_count_ <= FLAGS_buffered_log_max) {
     return;
   }
 
   size_t purge_count = buffer_count_ - FLAGS_buffered_log_max;
-
-  // Collect purge_count indexes of each type (result/status) before
-  // partitioning to find the oldest. Note this assumes that the indexes are
-  // returned in ascending lexicographic order (true for RocksDB).
-  std::vector<std::string> indexes;
-  auto status =
-      scanDatabaseKeys(kLogs, indexes, genIndexPrefix(true), purge_count);
-  if (!status.ok()) {
-    LOG(ERROR) << "Error scanning DB during buffered log purge";
-    return;
-  }
-
   LOG(WARNING) << "Purging buffered logs limit (" << FLAGS_buffered_log_max
                << ") exceeded: " << buffer_count_;
 
-  std::vector<std::string> status_indexes;
-  status = scanDatabaseKeys(
-      kLogs, status_indexes, genIndexPrefix(false), purge_count);
-  if (!status.ok()) {
-    LOG(ERROR) << "Error scanning DB during buffered log purge";
+  // Blocks hold the oldest lines of each type.
+  purge_count = purgeBlocks(purge_count);
+  if (purge_count == 0) {
     return;
   }
 
-  indexes.insert(indexes.end(), status_indexes.begin(), status_indexes.end());
+  // The oldest logs have the smallest sequence numbers, which are the first
+  // purge_count indexes of either type following the committed offsets.
+  // Note this assumes that the indexes are returned in ascending
+  // lexicographic order (true for RocksDB).
+  std::vector<size_t> sequences[2];
+  for (const auto results : {true, false}) {
+    std::vector<std::string> indexes;
+    auto status =
+        scanDatabaseKeys(kLogs, indexes, genIndexPrefix(results), purge_count);
+    if (!status.ok()) {
+      LOG(ERROR) << "Error scanning DB during buffered log purge";
+      return;
+    }
 
-  if (indexes.size() < purge_count) {
+    auto prefix_size = genIndexPrefix(results).size();
+    for (const auto& index : indexes) {
+      size_t sequence = 0;
+      if (parseSequence(index, prefix_size, sequence)) {
+        sequences[results].push_back(sequence);
+      }
+    }
+  }
+
+  std::vector<size_t> oldest;
+  std::merge(sequences[0].begin(),
+             sequences[0].end(),
+             sequences[1].begin(),
+             sequences[1].end(),
+             std::back_inserter(oldest));
+  if (oldest.size() < purge_count) {
     LOG(ERROR) << "Trying to purge " << purge_count << " logs but only found "
-               << indexes.size();
+               << oldest.size();
     return;
   }
 
-  size_t prefix_size = genIndexPrefix(true).size();
-  // Partition the indexes so that the first purge_count elements are the
-  // oldest indexes (the ones to be purged)
-  std::nth_element(indexes.begin(),
-                   indexes.begin() + purge_count - 1,
-                   indexes.end(),
-                   [&](const std::string& a, const std::string& b) {
-                     // Skip the prefix when doing comparisons
-                     return a.compare(prefix_size,
-                                      std::string::npos,
-                                      b,
-                                      prefix_size,
-                                      std::string::npos) < 0;
-                   });
-  indexes.erase(indexes.begin() + purge_count, indexes.end());
+  // Move both offsets past the newest purged log.
+  auto newest = oldest[purge_count - 1];
+  for (const auto results : {true, false}) {
+    auto& purged = sequences[results];
+    size_t count = std::upper_bound(purged.begin(), purged.end(), newest) -
+                 purged.begin();
+    if (count == 0) {
+      continue;
+    }
+
+    if (!deleteRangeWithCount(results, 0, newest, count).ok()) {
+      LOG(ERROR) << "Error deleting values during buffered log purge";
+      return;
+    }
 
-  // Now only indexes of logs to be deleted remain
-  iterate(indexes, [this](const std::string& index) {
-    if (!deleteValueWithCount(kLogs, index).ok()) {
-      LOG(ERROR) << "Error deleting value during buffered log purge";
+    auto offset = (results) ? result_offset_ : status_offset_;
+    if (newest > offset) {
+      commitOffset(results, newest);
     }
-  });
+  }
 }
 
 void BufferedLogForwarder::start() {
@@ -172,13 +664,17 @@ void BufferedLogForwarder::start() {
   }
 }
 
-Status BufferedLogForwarder::logString(const std::string& s, size_t time) {
-  std::string index = genResultIndex(time);
-  return addValueWithCount(kLogs, index, s);
+Status BufferedLogForwarder::logString(const std::string& s) {
+  load();
+
+  // Lines are written in sequence order, see sequence_mutex_.
+  WriteLock lock(sequence_mutex_);
+  return addValueWithCount(kLogs, genResultIndex(), s);
 }
 
-Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log,
-                                       size_t time) {
+Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log) {
+  load();
+
   // Append decorations to status
   // Assemble a decorations tree to append to each status buffer line.
   pt::ptree dtree;
@@ -188,6 +684,8 @@ Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log,
     dtree.put(decoration.first, decoration.second);
   }
 
+  // Every status line is stored with a single batch.
+  std::vector<std::string> lines;
   for (const auto& item : log) {
     // Convert the StatusLogLine into ptree format, to convert to JSON.
     pt::ptree buffer;
@@ -215,15 +713,15 @@ Status BufferedLogForwarder::logStatus(const std::vector<StatusLogLine>& log,
     if (!json.empty()) {
       json.pop_back();
     }
-    std::string index = genStatusIndex(time);
-    Status status = addValueWithCount(kLogs, index, json);
-    if (!status.ok()) {
-      // Do not continue if any line fails.
-      return status;
-    }
+    lines.push_back(std::move(json));
   }
 
-  return Status(0);
+  WriteLock lock(sequence_mutex_);
+  DatabaseKeyValues data;
+  for (auto& line : lines) {
+    data.push_back(std::make_pair(genStatusIndex(), std::move(line)));
+  }
+  return addValuesWithCount(kLogs, data);
 }
 
 bool BufferedLogForwarder::isIndex(const std::string& index, bool results) {
@@ -239,24 +737,314 @@ bool BufferedLogForwarder::isStatusIndex(const std::string& index) {
   return isIndex(index, false);
 }
 
-std::string BufferedLogForwarder::genResultIndex(size_t time) {
-  return genIndex(true, time);
+std::string BufferedLogForwarder::genResultIndex() {
+  return genIndex(true);
 }
 
-std::string BufferedLogForwarder::genStatusIndex(size_t time) {
-  return genIndex(false, time);
+std::string BufferedLogForwarder::genStatusIndex() {
+  return genIndex(false);
 }
 
 std::string BufferedLogForwarder::genIndexPrefix(bool results) {
   return index_name_ + "_" + ((results) ? "r" : "s") + "_";
 }
 
-std::string BufferedLogForwarder::genIndex(bool results, size_t time) {
-  if (time == 0) {
-    time = getUnixTime();
+std::string BufferedLogForwarder::genIndex(bool results) {
+  return genIndex(results, ++log_index_);
+}
+
+std::string BufferedLogForwarder::genIndex(bool results, size_t sequence) {
+  return genIndexPrefix(results) + padSequence(sequence);
+}
+
+std::string BufferedLogForwarder::genOffsetKey(bool results) {
+  return genIndexPrefix(results) + "offset";
+}
+
+std::string BufferedLogForwarder::genBlockPrefix(bool results) {
+  return index_name_ + "_" + ((results) ? "r" : "s") + "b_";
+}
+
+std::string BufferedLogForwarder::genBlockIndex(bool results,
+                                                const BufferedLogBlock& block) {
+  // Blocks are ordered by their last sequence number.
+  return genBlockPrefix(results) + padSequence(block.last) + "_" +
+         std::to_string(block.first) + "_" + std::to_string(block.count) +
+         "_" + std::to_string(block.dictionary);
+}
+
+std::string BufferedLogForwarder::genDictionaryKey(uint32_t id) {
+  return index_name_ + "_d_" + std::to_string(id);
+}
+
+Status BufferedLogForwarder::compact(bool results) {
+  auto block_lines = static_cast<size_t>(FLAGS_buffered_log_block_lines);
+  auto prefix_size = genIndexPrefix(results).size();
+  auto next = ((results) ? result_offset_ : status_offset_) + 1;
+  for (size_t i = 0; i < kMaxCompactBlocks; ++i) {
+    DatabaseKeyValues items;
+    auto status = scanDatabaseRange(kLogs,
+                                    genIndex(results, next),
+                                    genIndexPrefix(results) +
+                                        std::string(kSequenceWidth, '9'),
+                                    items,
+                                    block_lines);
+    if (!status.ok() || items.size() < block_lines) {
+      return status;
+    }
+
+    auto& dictionary = dictionary_[results];
+    if (dictionary.first == 0) {
+      // The dictionary is stored before the first block that uses it.
+      auto trained = trainBlockDictionary(items);
+      auto id = static_cast<uint32_t>(
+          adler32(adler32(0L, Z_NULL, 0),
+                  (const Bytef*)trained.data(),
+                  static_cast<uInt>(trained.size())));
+      if (!trained.empty()) {
+        status = setDatabaseValue(kLogs, genDictionaryKey(id), trained);
+        if (!status.ok()) {
+          return status;
+        }
+        dictionaries_[id] = trained;
+        dictionary = std::make_pair(id, std::move(trained));
+      }
+    }
+
+    BufferedLogBlock block;
+    block.dictionary = dictionary.first;
+    std::string data;
+    for (const auto& item : items) {
+      size_t sequence = 0;
+      if (!parseSequence(item.first, prefix_size, sequence)) {
+        continue;
+      }
+      if (block.count++ == 0) {
+        block.first = sequence;
+      }
+      block.last = sequence;
+      encodeBlockLine(sequence, item.second, data);
+    }
+    if (block.count == 0) {
+      return Status(0, "OK");
+    }
+
+    // The lines are removed once the block is written, see loadOffsets.
+    std::string compressed;
+    status = deflateBlock(data, dictionary.second, compressed);
+    if (status.ok()) {
+      status =
+          setDatabaseValue(kLogs, genBlockIndex(results, block), compressed);
+    }
+    if (status.ok()) {
+      status = deleteDatabaseRange(kLogs,
+                                   genIndex(results, block.first),
+                                   genIndex(results, block.last + 1));
+    }
+    if (!status.ok()) {
+      return status;
+    }
+    VLOG(1) << "Compressed " << block.count << " buffered logs from "
+            << data.size() << " to " << compressed.size() << " bytes";
+    next = block.last + 1;
   }
-  return genIndexPrefix(results) + std::to_string(time) + "_" +
-         std::to_string(++log_index_);
+  return Status(0, "OK");
+}
+
+Status BufferedLogForwarder::readBlocks(bool results,
+                                        size_t offset,
+                                        size_t max,
+                                        DatabaseKeyValues& items) {
+  auto prefix = genBlockPrefix(results);
+  std::vector<std::pair<std::string, BufferedLogBlock>> unreadable;
+  auto status = scanDatabase(
+      kLogs, prefix, 0, [&](const std::string& key, const std::string& value) {
+        BufferedLogBlock block;
+        if (!parseBlockIndex(key, prefix.size(), block) ||
+            block.last <= offset) {
+          return true;
+        }
+        if (!readBlock(results, block, value, offset, items).ok()) {
+          unreadable.push_back(std::make_pair(key, block));
+        }
+        return items.size() < max;
+      });
+
+  // A block that cannot be decompressed would stop the offset forever.
+  for (const auto& block : unreadable) {
+    LOG(WARNING) << "Dropping " << block.second.count
+                 << " buffered logs in an unreadable block";
+    if (deleteDatabaseValue(kLogs, block.first).ok()) {
+      buffer_count_ -= std::min(block.second.count, buffer_count_.load());
+    }
+  }
+
+  // The remaining lines of the last block are read by the next check.
+  if (items.size() > max) {
+    items.resize(max);
+  }
+  return status;
+}
+
+Status BufferedLogForwarder::readBlock(bool results,
+                                       const BufferedLogBlock& block,
+                                       const std::string& value,
+                                       size_t offset,
+                                       DatabaseKeyValues& items) {
+  std::string dictionary;
+  if (block.dictionary != 0) {
+    auto status = getDictionary(block.dictionary, dictionary);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  std::string data;
+  auto status = inflateBlock(value, dictionary, data);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Lines are appended only once the whole block was read.
+  DatabaseKeyValues lines;
+  size_t position = 0;
+  while (position < data.size()) {
+    size_t sequence = 0;
+    std::string line;
+    if (!decodeBlockLine(data, position, sequence, line)) {
+      return Status(1, "Malformed buffered log block");
+    }
+    if (sequence > offset) {
+      lines.push_back(
+          std::make_pair(genIndex(results, sequence), std::move(line)));
+    }
+  }
+  std::move(lines.begin(), lines.end(), std::back_inserter(items));
+  return Status(0, "OK");
+}
+
+Status BufferedLogForwarder::getDictionary(uint32_t id,
+                                           std::string& dictionary) {
+  auto cached = dictionaries_.find(id);
+  if (cached != dictionaries_.end()) {
+    dictionary = cached->second;
+    return Status(0, "OK");
+  }
+
+  auto status = getDatabaseValue(kLogs, genDictionaryKey(id), dictionary);
+  if (!status.ok()) {
+    return Status(1, "Missing buffered log dictionary");
+  }
+  dictionaries_[id] = dictionary;
+  return Status(0, "OK");
+}
+
+Status BufferedLogForwarder::deleteBlocksWithCount(bool results,
+                                                    size_t offset,
+                                                    size_t count) {
+  // A block's index sorts below the bound if its last line was sent.
+  auto prefix = genBlockPrefix(results);
+  auto status =
+      deleteDatabaseRange(kLogs, prefix, prefix + padSequence(offset + 1));
+  if (status.ok()) {
+    buffer_count_ -= std::min(count, buffer_count_.load());
+  }
+  return status;
+}
+
+size_t BufferedLogForwarder::purgeBlocks(size_t purge_count) {
+  struct PurgedBlock {
+    bool results;
+    std::string index;
+    BufferedLogBlock block;
+  };
+
+  std::vector<PurgedBlock> blocks;
+  for (const auto results : {true, false}) {
+    std::vector<std::string> indexes;
+    auto prefix_size = genBlockPrefix(results).size();
+    scanDatabaseKeys(kLogs, indexes, genBlockPrefix(results));
+    for (auto& index : indexes) {
+      PurgedBlock purged;
+      if (parseBlockIndex(index, prefix_size, purged.block)) {
+        purged.results = results;
+        purged.index = std::move(index);
+        blocks.push_back(std::move(purged));
+      }
+    }
+  }
+
+  // The oldest blocks, of either type, are purged first.
+  std::sort(blocks.begin(),
+            blocks.end(),
+            [](const PurgedBlock& a, const PurgedBlock& b) {
+              return a.block.last < b.block.last;
+            });
+  for (const auto& purged : blocks) {
+    if (purge_count == 0) {
+      break;
+    }
+
+    // The lines of a block up to the offset were already removed.
+    auto offset = (purged.results) ? result_offset_ : status_offset_;
+    auto count = purged.block.count;
+    std::string value;
+    DatabaseKeyValues items;
+    if (purged.block.first <= offset &&
+        getDatabaseValue(kLogs, purged.index, value).ok() &&
+        readBlock(purged.results, purged.block, value, offset, items).ok()) {
+      count = items.size();
+    }
+
+    if (!deleteDatabaseValue(kLogs, purged.index).ok()) {
+      LOG(ERROR) << "Error deleting values during buffered log purge";
+      return purge_count;
+    }
+    buffer_count_ -= std::min(count, buffer_count_.load());
+    purge_count -= std::min(count, purge_count);
+    if (purged.block.last > offset) {
+      commitOffset(purged.results, purged.block.last);
+    }
+  }
+  return purge_count;
+}
+
+bool BufferedLogForwarder::isPackedSent(bool results, size_t sequence) {
+  const auto& sent = packed_sent_[results];
+  auto it = sent.upper_bound(sequence);
+  if (it == sent.begin()) {
+    return false;
+  }
+  return sequence <= std::prev(it)->second;
+}
+
+void BufferedLogForwarder::addPackedSent(bool results,
+                                         size_t first,
+                                         size_t last) {
+  // Merge the overlapping ranges, a later check may batch lines differently.
+  auto& sent = packed_sent_[results];
+  auto it = sent.upper_bound(first);
+  if (it != sent.begin() && std::prev(it)->second >= first) {
+    --it;
+  }
+  while (it != sent.end() && it->first <= last) {
+    first = std::min(first, it->first);
+    last = std::max(last, it->second);
+    it = sent.erase(it);
+  }
+  sent[first] = last;
+}
+
+Status BufferedLogForwarder::commitOffset(bool results, size_t offset) {
+  ((results) ? result_offset_ : status_offset_) = offset;
+
+  // Sent block lines up to the offset are removed with their blocks.
+  auto& sent = packed_sent_[results];
+  while (!sent.empty() && sent.begin()->second <= offset) {
+    sent.erase(sent.begin());
+  }
+  return setDatabaseValue(
+      kPersistentSettings, genOffsetKey(results), std::to_string(offset));
 }
 
 Status BufferedLogForwarder::addValueWithCount(const std::string& domain,
@@ -269,11 +1057,23 @@ Status BufferedLogForwarder::addValueWithCount(const std::string& domain,
   return status;
 }
 
-Status BufferedLogForwarder::deleteValueWithCount(const std::string& domain,
-                                                  const std::string& key) {
-  Status status = deleteDatabaseValue(domain, key);
+Status BufferedLogForwarder::addValuesWithCount(const std::string& domain,
+                                                const DatabaseKeyValues& data) {
+  Status status = setDatabaseValues(domain, data);
+  if (status.ok()) {
+    buffer_count_ += data.size();
+  }
+  return status;
+}
+
+Status BufferedLogForwarder::deleteRangeWithCount(bool results,
+                                                   size_t first,
+                                                   size_t last,
+                                                   size_t count) {
+  Status status = deleteDatabaseRange(
+      kLogs, genIndex(results, first), genIndex(results, last + 1));
   if (status.ok()) {
-    buffer_count_--;
+    buffer_count_ -= std::min(count, buffer_count_.load());
   }
   return status;
 }
@@ -12,16 +12,20 @@
 
 #include <chrono>
 #include <functional>
+#include <map>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
 
+#include <osquery/database.h>
 #include <osquery/dispatcher.h>
 #include <osquery/logger.h>
 
 namespace osquery {
 
+struct BufferedLogBlock;
+
 /// Iterate through a vector, yielding during high utilization
 inline void iterate(std::vector<std::string>& input,
                     std::function<void(std::string&)> predicate) {
@@ -88,7 +92,8 @@ class BufferedLogForwarder : public InternalRunnable {
    * @brief Set up the forwarder. May be used to init remote clients, etc.
    *
    * This base class setUp() **MUST** be called by subclasses of
-   * BufferedLogForwarder in order to properly initialize the buffer count.
+   * BufferedLogForwarder in order to properly initialize the buffer count
+   * and committed offsets.
   */
   virtual Status setUp();
 
@@ -101,7 +106,7 @@ class BufferedLogForwarder : public InternalRunnable {
    *
    * @param s Results string to log
    */
-  Status logString(const std::string& s, size_t time = 0);
+  Status logString(const std::string& s);
 
   /**
    * @brief Log a vector of status lines
@@ -112,7 +117,7 @@ class BufferedLogForwarder : public InternalRunnable {
    *
    * @param log Vector of status lines to log
    */
-  Status logStatus(const std::vector<StatusLogLine>& log, size_t time = 0);
+  Status logStatus(const std::vector<StatusLogLine>& log);
 
  protected:
   /**
@@ -128,9 +133,16 @@ class BufferedLogForwarder : public InternalRunnable {
   /**
    * @brief Check for new logs and send.
    *
-   * Scan the logs domain for up to max_log_lines_ log lines.
-   * Sort those lines into status and request types then forward (send) each
-   * set. On success, clear the data and indexes. Calls purge upon completion.
+   * Read up to max_log_lines_ log lines per in-flight send of each type,
+   * following the type's committed offset. Split those lines into batches,
+   * limited by max_log_lines_ and max_batch_bytes_, then forward (send) up
+   * to max_in_flight_ batches concurrently. On success, remove the sent
+   * range of lines and move the offset. Calls purge upon completion.
+   *
+   * The oldest lines may be packed into compressed blocks, see compact. A
+   * block is removed once the offset moves past its last line. A block's
+   * lines sent after a failed batch are remembered and not sent again by
+   * this forwarder.
    */
   void check();
 
@@ -138,8 +150,9 @@ class BufferedLogForwarder : public InternalRunnable {
    * @brief Purge the oldest logs, if the max is exceeded
    *
    * Uses the buffered_log_max flag to determine the maximum number of buffered
-   * logs. If this number is exceeded, the logs with the oldest timestamp are
-   * purged. Order of purging for logs with the same timestamp is undefined.
+   * logs. If this number is exceeded, the logs with the oldest sequence
+   * numbers are purged by moving the committed offsets past them.
+   * Compressed blocks hold the oldest lines and are purged whole.
    */
   void purge();
 
@@ -156,15 +169,79 @@ class BufferedLogForwarder : public InternalRunnable {
 
  protected:
   /// Generate a result index string to use with the backing store
-  std::string genResultIndex(size_t time = 0);
+  std::string genResultIndex();
 
   /// Generate a status index string to use with the backing store
-  std::string genStatusIndex(size_t time = 0);
+  std::string genStatusIndex();
 
  private:
   std::string genIndexPrefix(bool results);
 
-  std::string genIndex(bool results, size_t time = 0);
+  /// Generate an index with the next sequence number.
+  std::string genIndex(bool results);
+
+  /// Generate the index of a sequence number.
+  std::string genIndex(bool results, size_t sequence);
+
+  /// The persistent settings key holding a log type's committed offset.
+  std::string genOffsetKey(bool results);
+
+  /// Load the committed offsets, sequence number, and count once.
+  Status load();
+
+  /// See load, read the offsets and scan the buffered indexes.
+  Status loadOffsets();
+
+  /// Move and persist the committed offset of a log type.
+  Status commitOffset(bool results, size_t offset);
+
+  /// The prefix of a log type's compressed blocks.
+  std::string genBlockPrefix(bool results);
+
+  /// The key of a compressed block.
+  std::string genBlockIndex(bool results, const BufferedLogBlock& block);
+
+  /// The key of a trained compression dictionary.
+  std::string genDictionaryKey(uint32_t id);
+
+  /**
+   * @brief Pack the oldest buffered lines of a log type into blocks.
+   *
+   * Called when a send fails, result lines are repetitive and the backlog
+   * compresses well. Each block of buffered_log_block_lines lines is
+   * deflated with a dictionary trained on the first lines packed by this
+   * process. Only full blocks are packed, the lines stay in sequence order
+   * and in the buffered count.
+   */
+  Status compact(bool results);
+
+  /// Read up to max lines following the offset from the compressed blocks.
+  Status readBlocks(bool results,
+                    size_t offset,
+                    size_t max,
+                    DatabaseKeyValues& items);
+
+  /// Decompress a block, appending the lines following the offset.
+  Status readBlock(bool results,
+                   const BufferedLogBlock& block,
+                   const std::string& value,
+                   size_t offset,
+                   DatabaseKeyValues& items);
+
+  /// Read a trained dictionary from the cache or the backing store.
+  Status getDictionary(uint32_t id, std::string& dictionary);
+
+  /// Check if a block line following the offset was already sent.
+  bool isPackedSent(bool results, size_t sequence);
+
+  /// Remember block lines from first to last sent after a failed batch.
+  void addPackedSent(bool results, size_t first, size_t last);
+
+  /// Delete the blocks sent up to the offset, maintaining count.
+  Status deleteBlocksWithCount(bool results, size_t offset, size_t count);
+
+  /// Purge whole blocks, oldest first, returns the count left to purge.
+  size_t purgeBlocks(size_t purge_count);
 
   /**
    * @brief Add a database value while maintaining count
@@ -174,12 +251,15 @@ class BufferedLogForwarder : public InternalRunnable {
                            const std::string& key,
                            const std::string& value);
 
-  /**
-   * @brief Delete a database value while maintaining count
-   *
-   */
-  Status deleteValueWithCount(const std::string& domain,
-                              const std::string& key);
+  /// Add several database values with a single batch while maintaining count.
+  Status addValuesWithCount(const std::string& domain,
+                            const DatabaseKeyValues& data);
+
+  /// Delete the count lines of a type from first to last, maintaining count.
+  Status deleteRangeWithCount(bool results,
+                              size_t first,
+                              size_t last,
+                              size_t count);
 
  protected:
   /// Seconds between flushing logs
@@ -188,6 +268,12 @@ class BufferedLogForwarder : public InternalRunnable {
   /// Max number of logs to flush per check
   size_t max_log_lines_;
 
+  /// Max number of concurrent sends per check, send must be thread safe.
+  size_t max_in_flight_{1};
+
+  /// Max total size of the lines in a send, 0 limits only the line count.
+  size_t max_batch_bytes_{0};
+
   /**
    * @brief Name to use in index
    *
@@ -198,10 +284,40 @@ class BufferedLogForwarder : public InternalRunnable {
   std::string index_name_;
 
  private:
-  /// Hold an incrementing index for buffering logs
+  /// Hold the last sequence number used for buffering logs, of either type
   std::atomic<size_t> log_index_{0};
 
+  /**
+   * @brief Serialize assigning and writing sequence numbers.
+   *
+   * Lines are visible in sequence order, so a check never acknowledges an
+   * offset past a line that is still being written.
+   */
+  Mutex sequence_mutex_;
+
+  /// The last sent, or purged, result sequence number
+  size_t result_offset_{0};
+
+  /// The last sent, or purged, status sequence number
+  size_t status_offset_{0};
+
+  /// Load the offsets before the first access
+  std::once_flag loaded_;
+
+  /// The result of loading the offsets
+  Status load_status_;
+
   /// Stores the count of buffered logs
   std::atomic<size_t> buffer_count_{0};
+
+  /// The dictionary id and content trained for each log type, by results.
+  std::pair<uint32_t, std::string> dictionary_[2];
+
+  /// Dictionaries read to decompress blocks, by id.
+  std::map<uint32_t, std::string> dictionaries_;
+
+  /// Ranges of block lines sent following the offset, first to last, by
+  /// results.
+  std::map<size_t, size_t> packed_sent_[2];
 };
 }
@@ -8,11 +8,19 @@
  *
  */
 
+#include <algorithm>
 #include <exception>
+#include <map>
+#include <memory>
 
+#include <osquery/dispatcher.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/filesystem/fileops.h"
+#include "osquery/remote/requests.h"
 
 namespace fs = boost::filesystem;
 
@@ -33,9 +41,257 @@ FLAG_ALIAS(std::string, osquery_log_dir, logger_path);
 
 FLAG(int32, logger_mode, 0640, "Decimal mode for log files (default '0640')");
 
+FLAG(uint64,
+     logger_write_buffer,
+     0,
+     "Bytes of result logs buffered before writing (default 0 = no buffer)");
+
+FLAG(uint64,
+     logger_flush_interval,
+     1,
+     "Max seconds result logs remain in the write buffer (default 1)");
+
+FLAG(uint64,
+     logger_fsync_interval,
+     0,
+     "Seconds between syncing result logs to disk (default 0 = never)");
+
+FLAG(uint64,
+     logger_fsync_bytes,
+     0,
+     "Bytes of result logs written between syncs (default 0 = never)");
+
+FLAG(uint64,
+     logger_rotate_size,
+     0,
+     "Rotate result logs larger than this many bytes (default 0 = never)");
+
+FLAG(uint64,
+     logger_rotate_period,
+     0,
+     "Seconds between rotating result logs (default 0 = never)");
+
+FLAG(uint64,
+     logger_rotate_max,
+     25,
+     "Number of rotated result logs kept (default 25)");
+
+FLAG(bool, logger_rotate_compress, false, "GZip compress rotated result logs");
+
 const std::string kFilesystemLoggerFilename = "osqueryd.results.log";
 const std::string kFilesystemLoggerSnapshots = "osqueryd.snapshots.log";
 
+/**
+ * @brief An open results or snapshot log file.
+ *
+ * Lines are appended to a buffer and written with a single write once the
+ * buffer exceeds logger_write_buffer, or when flushed. The file is synced and
+ * rotated according to the logger_fsync_* and logger_rotate_* flags. If the
+ * file is moved or removed, such as by an external logrotate, it is reopened.
+ *
+ * The caller must serialize access.
+ */
+class FilesystemLogFile {
+ public:
+  explicit FilesystemLogFile(const fs::path& path) : path_(path) {}
+
+  /// Open, and create, the log file.
+  Status open();
+
+  /// Append a line, writing the buffer if it is full.
+  Status append(const std::string& s);
+
+  /// Write the buffered lines, and sync if the interval elapsed.
+  Status flush();
+
+ private:
+  /// Write the buffered lines, rotating before if needed.
+  Status write();
+
+  /// Sync the written lines if the size or time policy is met.
+  void sync(bool force);
+
+  /// Move the file to the first rotated path, shifting the rotated files.
+  Status rotate();
+
+  /// The path of a rotated file.
+  std::string getRotatedPath(size_t index, bool compressed) const;
+
+ private:
+  /// The log file path.
+  fs::path path_;
+
+  /// The open log file.
+  std::unique_ptr<PlatformFile> file_;
+
+  /// Lines not yet written.
+  std::string buffer_;
+
+  /// The size of the open log file.
+  size_t size_{0};
+
+  /// Bytes written since the last sync.
+  size_t unsynced_{0};
+
+  /// The time of the last sync.
+  size_t synced_time_{0};
+
+  /// The time the log file was opened or rotated.
+  size_t opened_time_{0};
+};
+
+Status FilesystemLogFile::open() {
+  file_.reset(new PlatformFile(path_.string(),
+                               PF_OPEN_ALWAYS | PF_WRITE | PF_APPEND,
+                               FLAGS_logger_mode));
+  if (!file_->isValid()) {
+    file_.reset();
+    return Status(1, "Could not create file: " + path_.string());
+  }
+
+  // If the file existed with different permissions before our open
+  // they must be restricted.
+  if (!platformChmod(path_.string(), FLAGS_logger_mode)) {
+    file_.reset();
+    return Status(1,
+                  "Failed to change permissions for file: " + path_.string());
+  }
+
+  size_ = file_->size();
+  opened_time_ = synced_time_ = getUnixTime();
+  return Status(0, "OK");
+}
+
+Status FilesystemLogFile::append(const std::string& s) {
+  buffer_.append(s);
+  buffer_.push_back('\n');
+  if (buffer_.size() < FLAGS_logger_write_buffer) {
+    return Status(0, "OK");
+  }
+  return write();
+}
+
+Status FilesystemLogFile::flush() {
+  auto status = write();
+  sync(false);
+  return status;
+}
+
+Status FilesystemLogFile::write() {
+  if (buffer_.empty()) {
+    return Status(0, "OK");
+  }
+
+  // The file may have been moved by an external rotation.
+  boost::system::error_code ec;
+  if (file_ == nullptr || !fs::exists(path_, ec)) {
+    auto status = open();
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  auto now = getUnixTime();
+  if (size_ > 0 && ((FLAGS_logger_rotate_size > 0 &&
+                     size_ + buffer_.size() > FLAGS_logger_rotate_size) ||
+                    (FLAGS_logger_rotate_period > 0 &&
+                     now - opened_time_ >= FLAGS_logger_rotate_period))) {
+    auto status = rotate();
+    if (!status.ok()) {
+      LOG(WARNING) << "Could not rotate " << path_.string() << ": "
+                   << status.getMessage();
+    }
+
+    status = open();
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  auto bytes = file_->write(buffer_.data(), buffer_.size());
+  if (bytes < 0 || static_cast<size_t>(bytes) != buffer_.size()) {
+    buffer_.clear();
+    return Status(1, "Failed to write contents to file: " + path_.string());
+  }
+
+  size_ += buffer_.size();
+  unsynced_ += buffer_.size();
+  buffer_.clear();
+  sync(FLAGS_logger_fsync_bytes > 0 && unsynced_ >= FLAGS_logger_fsync_bytes);
+  return Status(0, "OK");
+}
+
+void FilesystemLogFile::sync(bool force) {
+  if (file_ == nullptr || unsynced_ == 0) {
+    return;
+  }
+
+  auto now = getUnixTime();
+  if (force || (FLAGS_logger_fsync_interval > 0 &&
+                now - synced_time_ >= FLAGS_logger_fsync_interval)) {
+    file_->sync();
+    unsynced_ = 0;
+    synced_time_ = now;
+  }
+}
+
+std::string FilesystemLogFile::getRotatedPath(size_t index,
+                                              bool compressed) const {
+  return path_.string() + "." + std::to_string(index) +
+         ((compressed) ? ".gz" : "");
+}
+
+Status FilesystemLogFile::rotate() {
+  // Written lines are synced before the file is moved.
+  sync(unsynced_ > 0);
+  file_.reset();
+
+  boost::system::error_code ec;
+  if (FLAGS_logger_rotate_max == 0) {
+    fs::remove(path_, ec);
+    return Status(0, "OK");
+  }
+
+  // Shift the rotated files, removing the oldest.
+  for (const auto compressed : {false, true}) {
+    fs::remove(getRotatedPath(FLAGS_logger_rotate_max, compressed), ec);
+  }
+  for (size_t index = FLAGS_logger_rotate_max - 1; index > 0; --index) {
+    for (const auto compressed : {false, true}) {
+      auto rotated = getRotatedPath(index, compressed);
+      if (fs::exists(rotated, ec)) {
+        fs::rename(rotated, getRotatedPath(index + 1, compressed), ec);
+      }
+    }
+  }
+
+  auto rotated = getRotatedPath(1, false);
+  fs::rename(path_, rotated, ec);
+  if (ec) {
+    return Status(1, ec.message());
+  }
+
+  if (FLAGS_logger_rotate_compress) {
+    std::string content;
+    if (!readFile(rotated, content).ok()) {
+      return Status(1, "Could not read rotated file: " + rotated);
+    }
+
+    auto compressed = compressString(content);
+    if (compressed.empty() && !content.empty()) {
+      return Status(1, "Could not compress rotated file: " + rotated);
+    }
+
+    auto status = writeTextFile(
+        getRotatedPath(1, true), compressed, FLAGS_logger_mode, true);
+    if (!status.ok()) {
+      return status;
+    }
+    fs::remove(rotated, ec);
+  }
+  return Status(0, "OK");
+}
+
 class FilesystemLoggerPlugin : public LoggerPlugin {
  public:
   Status setUp() override;
@@ -59,6 +315,9 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
   /// Write a status to Glog.
   Status logStatus(const std::vector<StatusLogLine>& log) override;
 
+  /// Write the buffered results and snapshots.
+  void flush();
+
  private:
   /// The plugin-internal filesystem writer method.
   Status logStringToFile(const std::string& s,
@@ -69,6 +328,9 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
   /// The folder where Glog and the result/snapshot files are written.
   fs::path log_path_;
 
+  /// The open result and snapshot logs, by filename.
+  std::map<std::string, std::unique_ptr<FilesystemLogFile>> files_;
+
   /// Filesystem writer mutex.
   Mutex mutex_;
 
@@ -76,6 +338,38 @@ class FilesystemLoggerPlugin : public LoggerPlugin {
   FRIEND_TEST(FilesystemLoggerTests, test_filesystem_init);
 };
 
+/// A Dispatcher service thread that writes buffered results and snapshots.
+class FilesystemLogFlusher : public InternalRunnable {
+ public:
+  explicit FilesystemLogFlusher(FilesystemLoggerPlugin& plugin)
+      : plugin_(plugin) {}
+
+  /// The Dispatcher thread entry point.
+  void start() override {
+    // Wake for the shorter of the buffer and sync intervals.
+    size_t interval = FLAGS_logger_flush_interval;
+    if (FLAGS_logger_fsync_interval > 0 &&
+        (FLAGS_logger_write_buffer == 0 ||
+         FLAGS_logger_fsync_interval < interval)) {
+      interval = FLAGS_logger_fsync_interval;
+    }
+
+    while (!interrupted()) {
+      pauseMilli(std::chrono::seconds(std::max<size_t>(interval, 1)));
+      plugin_.flush();
+    }
+  }
+
+  /// The Dispatcher interrupt point, pending lines are written.
+  void stop() override {
+    plugin_.flush();
+  }
+
+ private:
+  /// The plugin this thread flushes.
+  FilesystemLoggerPlugin& plugin_;
+};
+
 REGISTER(FilesystemLoggerPlugin, "logger", "filesystem");
 
 Status FilesystemLoggerPlugin::setUp() {
@@ -85,6 +379,11 @@ Status FilesystemLoggerPlugin::setUp() {
   // Glog 0.3.4 does not support a logfile mode.
   // FLAGS_logfile_mode = FLAGS_logger_mode;
 
+  // Buffered lines and elapsed sync intervals are written periodically.
+  if (FLAGS_logger_write_buffer > 0 || FLAGS_logger_fsync_interval > 0) {
+    Dispatcher::addService(std::make_shared<FilesystemLogFlusher>(*this));
+  }
+
   // Ensure that we create the results log here.
   return logStringToFile("", kFilesystemLoggerFilename, true);
 }
@@ -97,18 +396,31 @@ Status FilesystemLoggerPlugin::logStringToFile(const std::string& s,
                                                const std::string& filename,
                                                bool empty) {
   WriteLock lock(mutex_);
+  auto& file = files_[filename];
+  if (file == nullptr) {
+    file.reset(new FilesystemLogFile(log_path_ / filename));
+  }
+
   Status status;
   try {
-    status = writeTextFile((log_path_ / filename).string(),
-                           (empty) ? "" : s + '\n',
-                           FLAGS_logger_mode,
-                           true);
+    status = (empty) ? file->open() : file->append(s);
   } catch (const std::exception& e) {
     return Status(1, e.what());
   }
   return status;
 }
 
+void FilesystemLoggerPlugin::flush() {
+  WriteLock lock(mutex_);
+  for (auto& file : files_) {
+    try {
+      file.second->flush();
+    } catch (const std::exception& e) {
+      VLOG(1) << "Could not flush " << file.first << ": " << e.what();
+    }
+  }
+}
+
 Status FilesystemLoggerPlugin::logStatus(
     const std::vector<StatusLogLine>& log) {
   for (const auto& item : log) {
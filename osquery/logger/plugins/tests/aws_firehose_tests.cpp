@@ -28,6 +28,8 @@ using namespace testing;
 
 namespace osquery {
 
+DECLARE_uint64(aws_stream_retries);
+
 // Match on just the data element of a PutRecordBatchEntry
 MATCHER_P(MatchesEntry, data, "") {
   return data ==
@@ -78,4 +80,66 @@ TEST_F(FirehoseTests, test_send) {
       .WillOnce(Return(outcome));
   EXPECT_EQ(Status(1, "Foo error"), forwarder.send(logs, "results"));
 }
+
+TEST_F(FirehoseTests, test_send_retry) {
+  FirehoseLogForwarder forwarder;
+  auto client = std::make_shared<StrictMock<MockFirehoseClient>>();
+  forwarder.client_ = client;
+
+  // Only the throttled record is sent again.
+  std::vector<std::string> logs{"bar", "foo"};
+  Aws::Firehose::Model::PutRecordBatchOutcome throttled;
+  Aws::Firehose::Model::PutRecordBatchResponseEntry entry;
+  throttled.GetResult().AddRequestResponses(entry);
+  entry.SetErrorCode("ServiceUnavailableException");
+  entry.SetErrorMessage("Slow down");
+  throttled.GetResult().SetFailedPutCount(1);
+  throttled.GetResult().AddRequestResponses(entry);
+
+  Aws::Firehose::Model::PutRecordBatchOutcome outcome;
+  outcome.GetResult().SetFailedPutCount(0);
+
+  InSequence sequence;
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar\n"), MatchesEntry("foo\n")))))
+      .WillOnce(Return(throttled));
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("foo\n")))))
+      .WillOnce(Return(outcome));
+  EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
+
+  // The send fails once the retries are exhausted.
+  auto retries = FLAGS_aws_stream_retries;
+  FLAGS_aws_stream_retries = 0;
+  logs = {"bar", "foo"};
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar\n"), MatchesEntry("foo\n")))))
+      .WillOnce(Return(throttled));
+  EXPECT_EQ(Status(1, "Slow down"), forwarder.send(logs, "results"));
+  FLAGS_aws_stream_retries = retries;
+}
+
+TEST_F(FirehoseTests, test_send_aggregate) {
+  FirehoseLogForwarder forwarder;
+  auto client = std::make_shared<StrictMock<MockFirehoseClient>>();
+  forwarder.client_ = client;
+
+  FLAGS_aws_firehose_aggregate = true;
+  std::vector<std::string> logs{"bar", "foo"};
+  Aws::Firehose::Model::PutRecordBatchOutcome outcome;
+  outcome.GetResult().SetFailedPutCount(0);
+  EXPECT_CALL(*client,
+              PutRecordBatch(Property(
+                  &Aws::Firehose::Model::PutRecordBatchRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar\nfoo\n")))))
+      .WillOnce(Return(outcome));
+  EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
+  FLAGS_aws_firehose_aggregate = false;
+}
 }
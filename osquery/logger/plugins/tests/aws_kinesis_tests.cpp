@@ -26,6 +26,8 @@ using namespace testing;
 
 namespace osquery {
 
+DECLARE_uint64(aws_stream_retries);
+
 // Match on just the partition key and data elements of a PutRecordsRequestEntry
 MATCHER_P2(MatchesEntry, data, key, "") {
   return arg.GetPartitionKey() == key &&
@@ -79,4 +81,82 @@ TEST_F(KinesisTests, test_send) {
       .WillOnce(Return(outcome));
   EXPECT_EQ(Status(1, "Foo error"), forwarder.send(logs, "results"));
 }
+
+TEST_F(KinesisTests, test_send_retry) {
+  KinesisLogForwarder forwarder;
+  forwarder.partition_key_ = "fake_partition_key";
+  auto client = std::make_shared<StrictMock<MockKinesisClient>>();
+  forwarder.client_ = client;
+
+  // Only the throttled record is sent again.
+  std::vector<std::string> logs{"bar", "foo"};
+  Aws::Kinesis::Model::PutRecordsOutcome throttled;
+  Aws::Kinesis::Model::PutRecordsResultEntry entry;
+  throttled.GetResult().AddRecords(entry);
+  entry.SetErrorCode("ProvisionedThroughputExceededException");
+  entry.SetErrorMessage("Rate exceeded");
+  throttled.GetResult().SetFailedRecordCount(1);
+  throttled.GetResult().AddRecords(entry);
+
+  Aws::Kinesis::Model::PutRecordsOutcome outcome;
+  outcome.GetResult().SetFailedRecordCount(0);
+
+  InSequence sequence;
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar", "fake_partition_key"),
+                              MatchesEntry("foo", "fake_partition_key")))))
+      .WillOnce(Return(throttled));
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  ElementsAre(MatchesEntry("foo", "fake_partition_key")))))
+      .WillOnce(Return(outcome));
+  EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
+
+  // The send fails once the retries are exhausted.
+  auto retries = FLAGS_aws_stream_retries;
+  FLAGS_aws_stream_retries = 0;
+  logs = {"bar", "foo"};
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  ElementsAre(MatchesEntry("bar", "fake_partition_key"),
+                              MatchesEntry("foo", "fake_partition_key")))))
+      .WillOnce(Return(throttled));
+  EXPECT_EQ(Status(1, "Rate exceeded"), forwarder.send(logs, "results"));
+  FLAGS_aws_stream_retries = retries;
+}
+
+TEST_F(KinesisTests, test_send_aggregate) {
+  KinesisLogForwarder forwarder;
+  forwarder.partition_key_ = "fake_partition_key";
+  auto client = std::make_shared<StrictMock<MockKinesisClient>>();
+  forwarder.client_ = client;
+
+  // The KPL magic, an AggregatedRecord with both logs, and its MD5 digest.
+  std::string expected(
+      "\xf3\x89\x9a\xc2"
+      "\x0a\x12"
+      "fake_partition_key"
+      "\x1a\x07\x08\x00\x1a\x03"
+      "foo"
+      "\x1a\x07\x08\x00\x1a\x03"
+      "bar"
+      "\x56\x8c\xa7\xff\x44\xca\x78\x69\x49\x2d\x1e\xdf\x45\x78\x2c\xf6",
+      58);
+
+  FLAGS_aws_kinesis_aggregate = true;
+  std::vector<std::string> logs{"foo", "bar"};
+  Aws::Kinesis::Model::PutRecordsOutcome outcome;
+  outcome.GetResult().SetFailedRecordCount(0);
+  EXPECT_CALL(*client,
+              PutRecords(Property(
+                  &Aws::Kinesis::Model::PutRecordsRequest::GetRecords,
+                  ElementsAre(MatchesEntry(expected, "fake_partition_key")))))
+      .WillOnce(Return(outcome));
+  EXPECT_EQ(Status(0), forwarder.send(logs, "results"));
+  FLAGS_aws_kinesis_aggregate = false;
+}
 }
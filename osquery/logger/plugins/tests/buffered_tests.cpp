@@ -30,6 +30,7 @@ namespace pt = boost::property_tree;
 namespace osquery {
 
 DECLARE_uint64(buffered_log_max);
+DECLARE_uint64(buffered_log_block_lines);
 
 // Check that the string matches the StatusLogLine
 MATCHER_P(MatchesStatus, expected, "") {
@@ -77,16 +78,20 @@ class MockBufferedLogForwarder : public BufferedLogForwarder {
   FRIEND_TEST(BufferedLogForwarderTests, test_multiple);
   FRIEND_TEST(BufferedLogForwarderTests, test_async);
   FRIEND_TEST(BufferedLogForwarderTests, test_split);
+  FRIEND_TEST(BufferedLogForwarderTests, test_split_in_flight);
+  FRIEND_TEST(BufferedLogForwarderTests, test_legacy_index);
   FRIEND_TEST(BufferedLogForwarderTests, test_purge);
   FRIEND_TEST(BufferedLogForwarderTests, test_purge_max);
+  FRIEND_TEST(BufferedLogForwarderTests, test_compact);
+  FRIEND_TEST(BufferedLogForwarderTests, test_compact_in_flight);
 };
 
 TEST_F(BufferedLogForwarderTests, test_index) {
   MockBufferedLogForwarder runner;
-  EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_1"));
-  EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_2"));
-  EXPECT_THAT(runner.genResultIndex(), ContainsRegex("mock_r_[0-9]+_3"));
-  EXPECT_THAT(runner.genStatusIndex(), ContainsRegex("mock_s_[0-9]+_4"));
+  EXPECT_EQ("mock_r_00000000000000000001", runner.genResultIndex());
+  EXPECT_EQ("mock_s_00000000000000000002", runner.genStatusIndex());
+  EXPECT_EQ("mock_r_00000000000000000003", runner.genResultIndex());
+  EXPECT_EQ("mock_s_00000000000000000004", runner.genStatusIndex());
 
   EXPECT_TRUE(runner.isResultIndex(runner.genResultIndex()));
   EXPECT_FALSE(runner.isResultIndex(runner.genStatusIndex()));
@@ -270,23 +275,70 @@ TEST_F(BufferedLogForwarderTests, test_split) {
   runner2.check();
 }
 
+TEST_F(BufferedLogForwarderTests, test_split_in_flight) {
+  StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 2);
+  runner.max_in_flight_ = 2;
+  runner.max_batch_bytes_ = 6;
+  runner.logString("foo");
+  runner.logString("bar");
+  runner.logString("baz");
+  runner.logString("quux");
+  runner.logString("last");
+
+  // Four lines are scanned, then split by line count and payload size.
+  EXPECT_CALL(runner, send(ElementsAre("foo", "bar"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre("baz"), "result"))
+      .WillOnce(Return(Status(1, "fail")));
+  EXPECT_CALL(runner, send(ElementsAre("quux"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  // Only the failed batch is sent again.
+  EXPECT_CALL(runner, send(ElementsAre("baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre("last"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  // This call should not result in sending again
+  runner.check();
+}
+
+TEST_F(BufferedLogForwarderTests, test_legacy_index) {
+  // Lines buffered with time-based indexes are sent in time order.
+  setDatabaseValue(kLogs, "legacy_r_200_1", "bar");
+  setDatabaseValue(kLogs, "legacy_r_100_2", "foo");
+  setDatabaseValue(kLogs, "legacy_s_150_3", "");
+
+  StrictMock<MockBufferedLogForwarder> runner("legacy", kLogPeriod);
+  EXPECT_TRUE(runner.setUp().ok());
+  runner.logString("baz");
+
+  EXPECT_CALL(runner, send(ElementsAre("foo", "bar", "baz"), "result"))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  std::vector<std::string> indexes;
+  scanDatabaseKeys(kLogs, indexes, "legacy");
+  EXPECT_TRUE(indexes.empty());
+}
+
 // Test the purge() function independently of check()
 TEST_F(BufferedLogForwarderTests, test_purge) {
   FLAGS_buffered_log_max = 3;
   StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 100);
-  size_t time = getUnixTime();
   for (uint64_t i = 0; i < 10; ++i) {
-    runner.logString(std::to_string(i), time);
+    runner.logString(std::to_string(i));
     StatusLogLine log1 = makeStatusLogLine(O_INFO, "foo", 1, "foo status");
     StatusLogLine log2 = makeStatusLogLine(O_ERROR, "bar", 30, "bar error");
-    runner.logStatus({log1, log2}, time);
-    ++time;
+    runner.logStatus({log1, log2});
   }
-  runner.logString("foo", time);
+  runner.logString("foo");
   runner.purge();
-  runner.logString("bar", time);
+  runner.logString("bar");
   runner.purge();
-  runner.logString("baz", time);
+  runner.logString("baz");
   runner.purge();
   runner.purge();
 
@@ -305,15 +357,12 @@ TEST_F(BufferedLogForwarderTests, test_purge_max) {
   StrictMock<MockBufferedLogForwarder> runner("mock", kLogPeriod, 5);
   StatusLogLine log1 = makeStatusLogLine(O_INFO, "foo", 1, "foo status");
   StatusLogLine log2 = makeStatusLogLine(O_ERROR, "bar", 30, "bar error");
-  size_t time = getUnixTime();
 
-  runner.logString("foo", time);
-  runner.logStatus({log1}, time);
-  ++time;
-  runner.logString("bar", time);
-  ++time;
-  runner.logStatus({log2}, time);
-  runner.logString("baz", time);
+  runner.logString("foo");
+  runner.logStatus({log1});
+  runner.logString("bar");
+  runner.logStatus({log2});
+  runner.logString("baz");
 
   EXPECT_CALL(runner, send(ElementsAre("foo", "bar", "baz"), "result"))
       .WillOnce(Return(Status(1, "fail")));
@@ -329,10 +378,9 @@ TEST_F(BufferedLogForwarderTests, test_purge_max) {
       .WillOnce(Return(Status(0)));
   runner.check();
 
-  ++time;
-  runner.logString("1", time);
-  runner.logString("2", time);
-  runner.logString("3", time);
+  runner.logString("1");
+  runner.logString("2");
+  runner.logString("3");
 
   EXPECT_CALL(runner, send(ElementsAre("1", "2", "3"), "result"))
       .WillOnce(Return(Status(0)));
@@ -340,4 +388,125 @@ TEST_F(BufferedLogForwarderTests, test_purge_max) {
 
   runner.check();
 }
+
+TEST_F(BufferedLogForwarderTests, test_compact) {
+  auto max = FLAGS_buffered_log_max;
+  FLAGS_buffered_log_max = 0;
+  FLAGS_buffered_log_block_lines = 4;
+  std::vector<std::string> expected;
+  {
+    StrictMock<MockBufferedLogForwarder> runner("compact", kLogPeriod, 100);
+    for (size_t i = 0; i < 10; ++i) {
+      expected.push_back("{\"name\":\"pack_query\",\"pid\":" +
+                         std::to_string(i) + "}");
+      runner.logString(expected.back());
+    }
+
+    // The failed send packs the two full blocks, the newest lines remain.
+    EXPECT_CALL(runner, send(ElementsAreArray(expected), "result"))
+        .WillOnce(Return(Status(1, "fail")));
+    runner.check();
+
+    std::vector<std::string> indexes;
+    scanDatabaseKeys(kLogs, indexes, "compact_rb_");
+    EXPECT_EQ(indexes.size(), 2U);
+    indexes.clear();
+    scanDatabaseKeys(kLogs, indexes, "compact_r_");
+    EXPECT_EQ(indexes.size(), 2U);
+  }
+
+  // The blocks are read by a new forwarder in sequence order.
+  StrictMock<MockBufferedLogForwarder> runner("compact", kLogPeriod, 3);
+  EXPECT_TRUE(runner.setUp().ok());
+  runner.logString("last");
+  expected.push_back("last");
+
+  // A batch ending within a block moves the offset into the block.
+  Sequence s;
+  EXPECT_CALL(runner,
+              send(ElementsAre(expected[0], expected[1], expected[2]), _))
+      .InSequence(s)
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner,
+              send(ElementsAre(expected[3], expected[4], expected[5]), _))
+      .InSequence(s)
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner,
+              send(ElementsAre(expected[6], expected[7], expected[8]), _))
+      .InSequence(s)
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre(expected[9], expected[10]), _))
+      .InSequence(s)
+      .WillOnce(Return(Status(0)));
+  runner.check();
+  runner.check();
+  runner.check();
+  runner.check();
+
+  // Every block is removed once it was sent.
+  runner.check();
+  std::vector<std::string> indexes;
+  scanDatabaseKeys(kLogs, indexes, "compact_rb_");
+  EXPECT_TRUE(indexes.empty());
+  scanDatabaseKeys(kLogs, indexes, "compact_r_");
+  EXPECT_TRUE(indexes.empty());
+  FLAGS_buffered_log_block_lines = 0;
+  FLAGS_buffered_log_max = max;
+}
+
+TEST_F(BufferedLogForwarderTests, test_compact_in_flight) {
+  auto max = FLAGS_buffered_log_max;
+  FLAGS_buffered_log_max = 0;
+  FLAGS_buffered_log_block_lines = 4;
+  std::vector<std::string> expected;
+  {
+    StrictMock<MockBufferedLogForwarder> runner("packed", kLogPeriod, 100);
+    for (size_t i = 0; i < 10; ++i) {
+      expected.push_back("{\"name\":\"pack_query\",\"pid\":" +
+                         std::to_string(i) + "}");
+      runner.logString(expected.back());
+    }
+
+    // The failed send packs the two full blocks.
+    EXPECT_CALL(runner, send(ElementsAreArray(expected), "result"))
+        .WillOnce(Return(Status(1, "fail")));
+    runner.check();
+  }
+
+  StrictMock<MockBufferedLogForwarder> runner("packed", kLogPeriod, 3);
+  EXPECT_TRUE(runner.setUp().ok());
+  runner.max_in_flight_ = 2;
+
+  // A block's lines are sent after the batch before them failed.
+  EXPECT_CALL(runner,
+              send(ElementsAre(expected[0], expected[1], expected[2]), _))
+      .WillOnce(Return(Status(1, "fail")));
+  EXPECT_CALL(runner,
+              send(ElementsAre(expected[3], expected[4], expected[5]), _))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  // Only the failed batch is sent again, the offset moves past both.
+  EXPECT_CALL(runner,
+              send(ElementsAre(expected[0], expected[1], expected[2]), _))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  EXPECT_CALL(runner,
+              send(ElementsAre(expected[6], expected[7], expected[8]), _))
+      .WillOnce(Return(Status(0)));
+  EXPECT_CALL(runner, send(ElementsAre(expected[9]), _))
+      .WillOnce(Return(Status(0)));
+  runner.check();
+
+  // Every block is removed once it was sent.
+  runner.check();
+  std::vector<std::string> indexes;
+  scanDatabaseKeys(kLogs, indexes, "packed_rb_");
+  EXPECT_TRUE(indexes.empty());
+  scanDatabaseKeys(kLogs, indexes, "packed_r_");
+  EXPECT_TRUE(indexes.empty());
+  FLAGS_buffered_log_block_lines = 0;
+  FLAGS_buffered_log_max = max;
+}
 }
@@ -21,6 +21,9 @@ namespace fs = boost::filesystem;
 namespace osquery {
 
 DECLARE_string(logger_path);
+DECLARE_uint64(logger_write_buffer);
+DECLARE_uint64(logger_rotate_size);
+DECLARE_uint64(logger_rotate_max);
 
 class FilesystemLoggerTests : public testing::Test {
  public:
@@ -97,4 +100,47 @@ TEST_F(FilesystemLoggerTests, test_log_snapshot) {
       "\"unixTime\":\"0\"}\n";
   EXPECT_EQ(content, expected);
 }
+
+TEST_F(FilesystemLoggerTests, test_log_rotate) {
+  // Start from an empty results log, the plugin reopens the removed file.
+  for (const auto& path : {results_path_,
+                           results_path_ + ".1",
+                           results_path_ + ".2",
+                           results_path_ + ".3"}) {
+    fs::remove(path);
+  }
+
+  FLAGS_logger_rotate_size = 20;
+  FLAGS_logger_rotate_max = 2;
+  for (size_t i = 1; i <= 4; ++i) {
+    EXPECT_TRUE(logString("{\"line\": " + std::to_string(i) + "}", "event"));
+  }
+  FLAGS_logger_rotate_size = 0;
+  FLAGS_logger_rotate_max = 25;
+
+  // Each line exceeds half of the max size, and the oldest line was removed.
+  std::string content;
+  EXPECT_TRUE(readFile(results_path_, content));
+  EXPECT_EQ(content, "{\"line\": 4}\n");
+  EXPECT_TRUE(readFile(results_path_ + ".1", content));
+  EXPECT_EQ(content, "{\"line\": 3}\n");
+  EXPECT_TRUE(readFile(results_path_ + ".2", content));
+  EXPECT_EQ(content, "{\"line\": 2}\n");
+  EXPECT_FALSE(fs::exists(results_path_ + ".3"));
+}
+
+TEST_F(FilesystemLoggerTests, test_log_buffer) {
+  fs::remove(results_path_);
+
+  // Buffered lines are written together once the buffer is full.
+  FLAGS_logger_write_buffer = 24;
+  EXPECT_TRUE(logString("{\"line\": 1}", "event"));
+  EXPECT_FALSE(fs::exists(results_path_));
+  EXPECT_TRUE(logString("{\"line\": 2}", "event"));
+  FLAGS_logger_write_buffer = 0;
+
+  std::string content;
+  EXPECT_TRUE(readFile(results_path_, content));
+  EXPECT_EQ(content, "{\"line\": 1}\n{\"line\": 2}\n");
+}
 }
@@ -8,7 +8,7 @@
  *
  */
 
-#include <boost/property_tree/ptree.hpp>
+#include <algorithm>
 
 #include <osquery/enroll.h>
 #include <osquery/flags.h>
@@ -21,8 +21,6 @@
 #include "osquery/core/json.h"
 #include "osquery/logger/plugins/tls.h"
 
-namespace pt = boost::property_tree;
-
 namespace osquery {
 
 constexpr size_t kTLSMaxLogLines = 1024;
@@ -41,14 +39,48 @@ FLAG(uint64,
 
 FLAG(bool, logger_tls_compress, false, "GZip compress TLS/HTTPS request body");
 
+FLAG(uint64,
+     logger_tls_concurrency,
+     1,
+     "Max number of concurrent TLS/HTTPS log requests per period");
+
+FLAG(uint64,
+     logger_tls_batch_bytes,
+     0,
+     "Max size in bytes of the log lines in a request (default 0 = no limit)");
+
+FLAG(string,
+     logger_tls_encoding,
+     "json",
+     "Result encoding for TLS/HTTPS logging: json, msgpack, or protobuf");
+
 REGISTER(TLSLoggerPlugin, "logger", "tls");
 
+/// The result encoding requested with logger_tls_encoding.
+static ResultEncoding getTLSEncoding() {
+  auto encoding = RESULT_ENCODING_JSON;
+  if (!getResultEncoding(FLAGS_logger_tls_encoding, encoding)) {
+    LOG(WARNING) << "Unknown TLS logger encoding: "
+                 << FLAGS_logger_tls_encoding;
+  }
+  return encoding;
+}
+
 TLSLogForwarder::TLSLogForwarder(const std::string& node_key)
     : BufferedLogForwarder("tls",
                            std::chrono::seconds(FLAGS_logger_tls_period),
                            kTLSMaxLogLines),
-      node_key_(node_key) {
+      node_key_(node_key),
+      encoding_(getTLSEncoding()) {
   uri_ = TLSRequestHelper::makeURI(FLAGS_logger_tls_endpoint);
+
+  // Each send builds its own request, so batches may be sent concurrently.
+  max_in_flight_ = std::max<size_t>(FLAGS_logger_tls_concurrency, 1);
+  max_batch_bytes_ = FLAGS_logger_tls_batch_bytes;
+}
+
+ResultEncoding TLSLoggerPlugin::resultEncoding() {
+  return getTLSEncoding();
 }
 
 Status TLSLoggerPlugin::logString(const std::string& s) {
@@ -89,42 +121,35 @@ void TLSLoggerPlugin::init(const std::string& name,
 
 Status TLSLogForwarder::send(std::vector<std::string>& log_data,
                              const std::string& log_type) {
-  pt::ptree params;
-  params.put<std::string>("node_key", node_key_);
-  params.put<std::string>("log_type", log_type);
-
-  {
-    // Read each logged line into JSON and populate a list of lines.
-    // The result list will use the 'data' key.
-    pt::ptree children;
-    iterate(log_data,
-            ([&children](std::string& item) {
-              // Enforce a max log line size for TLS logging.
-              if (item.size() > FLAGS_logger_tls_max) {
-                LOG(WARNING) << "Line exceeds TLS logger max: " << item.size();
-                return;
-              }
-
-              pt::ptree child;
-              try {
-                std::stringstream input;
-                input << item;
-                std::string().swap(item);
-                pt::read_json(input, child);
-              } catch (const pt::json_parser::json_parser_error& /* e */) {
-                // The log line entered was not valid JSON, skip it.
-                return;
-              }
-              children.push_back(std::make_pair("", std::move(child)));
-            }));
-    params.add_child("data", std::move(children));
+  std::vector<std::string> items;
+  items.reserve(log_data.size());
+  for (auto& item : log_data) {
+    // Enforce a max log line size for TLS logging.
+    if (item.size() > FLAGS_logger_tls_max) {
+      LOG(WARNING) << "Line exceeds TLS logger max: " << item.size();
+      continue;
+    } else if (!item.empty()) {
+      items.push_back(std::move(item));
+    }
+  }
+
+  // Status logs are always JSON. The lines are already serialized, so they
+  // are wrapped with the request fields without being parsed again.
+  auto encoding = (log_type == "result") ? encoding_ : RESULT_ENCODING_JSON;
+  std::string body;
+  std::map<std::string, std::string> fields = {{"node_key", node_key_},
+                                               {"log_type", log_type}};
+  auto status = serializeResultBatch(encoding, fields, items, body);
+  if (!status.ok()) {
+    return status;
   }
 
   auto request = Request<TLSTransport, JSONSerializer>(uri_);
   request.setOption("hostname", FLAGS_tls_hostname);
+  request.setOption("content_type", getResultContentType(encoding));
   if (FLAGS_logger_tls_compress) {
     request.setOption("compress", true);
   }
-  return request.call(params);
+  return request.call(body);
 }
 }
@@ -35,6 +35,9 @@ class TLSLogForwarder : public BufferedLogForwarder {
   /// Receive an enrollment/node key from the backing store cache.
   std::string node_key_;
 
+  /// The encoding of buffered results, see logger_tls_encoding.
+  ResultEncoding encoding_{RESULT_ENCODING_JSON};
+
   /// Endpoint URI
   std::string uri_;
 
@@ -61,6 +64,9 @@ class TLSLoggerPlugin : public LoggerPlugin {
 
   bool usesLogStatus() override { return true; }
 
+  /// Request binary results, see logger_tls_encoding.
+  ResultEncoding resultEncoding() override;
+
  protected:
   /// Log a result string. This is the basic catch-all for snapshots and events.
   Status logString(const std::string& s) override;
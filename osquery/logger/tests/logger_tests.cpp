@@ -13,6 +13,8 @@
 #include <osquery/core.h>
 #include <osquery/logger.h>
 
+#include "osquery/logger/pipeline.h"
+
 namespace osquery {
 
 class LoggerTests : public testing::Test {
@@ -86,6 +88,9 @@ class TestLoggerPlugin : public LoggerPlugin {
 
   Status logStatus(const std::vector<StatusLogLine>& log) override {
     ++LoggerTests::statuses_logged;
+    if (log.size() > 0) {
+      LoggerTests::last_status = log.back();
+    }
     return Status(0, "OK");
   }
 
@@ -161,6 +166,16 @@ TEST_F(LoggerTests, test_logger_log_status) {
   EXPECT_EQ(LoggerTests::statuses_logged, 1);
 }
 
+TEST_F(LoggerTests, test_relay_status_logs) {
+  // Internal loggers receive the status lines as they were logged.
+  std::string message = "Logger test is relaying a \"status\" (6)";
+  LOG(WARNING) << message;
+  EXPECT_EQ(LoggerTests::statuses_logged, 1);
+  EXPECT_EQ(LoggerTests::last_status.severity, O_WARNING);
+  EXPECT_EQ(LoggerTests::last_status.filename, "logger_tests.cpp");
+  EXPECT_EQ(LoggerTests::last_status.message, message);
+}
+
 TEST_F(LoggerTests, test_feature_request) {
   // Retrieve the test logger plugin.
   auto plugin = Registry::get("logger", "test");
@@ -265,4 +280,78 @@ TEST_F(LoggerTests, test_logger_scheduled_query) {
       "column\":\"test_value\"},\"action\":\"added\"}";
   EXPECT_EQ(LoggerTests::log_lines.back(), expected);
 }
+
+TEST_F(LoggerTests, test_log_pipeline) {
+  LogPipeline pipeline;
+  ASSERT_TRUE(pipeline.start(1, 2).ok());
+  EXPECT_FALSE(pipeline.start(1, 2).ok());
+
+  LogPipelineItem item;
+  item.item.name = "test_query";
+  item.item.results.added.push_back({{"test_column", "test_value"}});
+  item.receiver = Registry::getActive("logger");
+  for (size_t i = 0; i < 4; ++i) {
+    // The queue holds two items, the pipeline thread makes space.
+    auto queued = item;
+    EXPECT_TRUE(pipeline.push(std::move(queued)));
+  }
+
+  EXPECT_TRUE(pipeline.flush(std::chrono::milliseconds(10000)));
+  EXPECT_EQ(LoggerTests::log_lines.size(), 4U);
+
+  auto stats = pipeline.stats();
+  EXPECT_EQ(stats.threads, 1U);
+  EXPECT_EQ(stats.depth, 0U);
+  EXPECT_LE(stats.max_depth, 2U);
+  EXPECT_EQ(stats.enqueued, 4U);
+  EXPECT_EQ(stats.logged, 4U);
+  EXPECT_EQ(stats.failed, 0U);
+
+  // A stopped pipeline leaves logging to the caller.
+  pipeline.stop();
+  Dispatcher::joinServices();
+  EXPECT_EQ(pipeline.stats().threads, 0U);
+  EXPECT_FALSE(pipeline.push(std::move(item)));
+}
+
+class EncodedTestLoggerPlugin : public LoggerPlugin {
+ public:
+  ResultEncoding resultEncoding() override {
+    return RESULT_ENCODING_MSGPACK;
+  }
+
+  Status logString(const std::string& s) override {
+    logged.push_back(s);
+    return Status(0, "OK");
+  }
+
+  /// The encoded results.
+  static std::vector<std::string> logged;
+
+ protected:
+  void init(const std::string& binary_name,
+            const std::vector<StatusLogLine>& log) override {}
+};
+
+std::vector<std::string> EncodedTestLoggerPlugin::logged;
+
+TEST_F(LoggerTests, test_logger_result_encodings) {
+  Registry::add<EncodedTestLoggerPlugin>("logger", "encoded_test");
+  Registry::setActive("logger", "test,encoded_test");
+  initLogger("logger_test");
+
+  QueryLogItem item;
+  item.name = "test_query";
+  item.results.added.push_back({{"test_column", "test_value"}});
+  EXPECT_TRUE(logQueryLogItemSync(item, "test,encoded_test").ok());
+
+  // Each logger receives results using its requested encoding.
+  std::string expected;
+  serializeQueryLogItemMsgPack(item, expected);
+  ASSERT_EQ(EncodedTestLoggerPlugin::logged.size(), 1U);
+  EXPECT_EQ(EncodedTestLoggerPlugin::logged[0], expected);
+  ASSERT_EQ(LoggerTests::log_lines.size(), 1U);
+  EXPECT_EQ(LoggerTests::log_lines[0].front(), '{');
+  Registry::setActive("logger", "test");
+}
 }
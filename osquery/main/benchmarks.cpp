@@ -8,14 +8,266 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <map>
+#include <vector>
+
 #include <benchmark/benchmark.h>
 
+#include <osquery/config.h>
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/registry.h>
+#include <osquery/system.h>
+
+#include "osquery/dispatcher/scheduler.h"
 #include "osquery/tests/test_util.h"
 
-int main(int argc, char *argv[]) {
+#ifdef ALLOCATION_BENCHMARKS
+#include "osquery/tests/allocations.h"
+#endif
+
+namespace osquery {
+
+DECLARE_bool(disable_database);
+DECLARE_bool(disable_logging);
+
+FLAG(string,
+     schedule_replay,
+     "",
+     "Replay the schedule of a config or pack file instead of benchmarks");
+
+FLAG(uint64,
+     schedule_replay_ticks,
+     60,
+     "Number of schedule ticks run by --schedule_replay");
+
+FLAG(uint64,
+     schedule_replay_step,
+     0,
+     "Schedule seconds per replayed tick (default 0 runs every query)");
+
+/// Results are serialized for the active logger, then discarded.
+class NullLoggerPlugin : public LoggerPlugin {
+ protected:
+  Status logString(const std::string& s) override {
+    return Status(0, "OK");
+  }
+
+  void init(const std::string& name,
+            const std::vector<StatusLogLine>& log) override {}
+};
+
+REGISTER(NullLoggerPlugin, "logger", "null");
+
+/// The RocksDB bytes written ticker, 0 if the database does not report it.
+static size_t getDatabaseBytesWritten() {
+  PluginResponse stats;
+  if (getDatabaseStats(stats).ok()) {
+    for (const auto& stat : stats) {
+      if (stat.count("name") > 0 && stat.at("name") == "bytes_written") {
+        return static_cast<size_t>(std::stoull(stat.at("value")));
+      }
+    }
+  }
+  return 0;
+}
+
+/// A scheduled query replayed from the config, see replaySchedule.
+struct ReplayQuery {
+  ScheduledQuery query;
+
+  /// The replayed schedule time the query is next due.
+  size_t due{0};
+
+  /// Executions and total process CPU time in microseconds.
+  size_t executions{0};
+  size_t cpu{0};
+};
+
+/**
+ * @brief Run a config's schedule through the complete query path.
+ *
+ * Each tick launches the due queries as the scheduler would: SQL, the
+ * differential against the results stored in RocksDB, the output limits, and
+ * serialization to a logger that discards the results. Ticks do not sleep,
+ * the replayed schedule time advances by --schedule_replay_step seconds.
+ */
+static int replaySchedule(const std::string& path) {
+  std::string content;
+  if (!readFile(path, content).ok()) {
+    std::cerr << "Cannot read schedule replay config: " << path << "\n";
+    return 1;
+  }
+
+  // A pack file is replayed as the only pack in a config.
+  auto& config = Config::getInstance();
+  if (content.find("\"packs\"") == std::string::npos &&
+      content.find("\"schedule\"") == std::string::npos) {
+    content = "{\"packs\": {\"replay\": " + content + "}}";
+  }
+  auto status = config.update({{"replay", content}});
+  if (!status.ok()) {
+    std::cerr << "Cannot parse schedule replay config: " << status.what()
+              << "\n";
+    return 1;
+  }
+
+  // Use RocksDB for the stored results, and the discarding logger.
+  FLAGS_disable_database = false;
+  DatabasePlugin::initPlugin();
+  FLAGS_disable_logging = false;
+  Registry::setActive("logger", "null");
+
+  std::map<std::string, ReplayQuery> queries;
+  config.allScheduledQueries(([&queries, &config](
+      const std::string& name,
+      const ScheduledQuery& query,
+      const std::shared_ptr<Pack>& pack) {
+    if (query.splayed_interval > 0 && config.shouldQueryExecute(pack, name)) {
+      queries[name].query = query;
+    }
+  }));
+
+  std::vector<size_t> ticks;
+  size_t step = getUnixTime();
+  auto bytes = getDatabaseBytesWritten();
+  for (size_t tick = 0; tick < FLAGS_schedule_replay_ticks; ++tick) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto& query : queries) {
+      auto& replay = query.second;
+      if (FLAGS_schedule_replay_step > 0 && replay.due > step) {
+        continue;
+      }
+
+      TablePlugin::kCacheInterval = replay.query.splayed_interval;
+      TablePlugin::kCacheStep = step;
+      auto cpu = std::clock();
+      launchQuery(query.first, replay.query);
+      replay.cpu += static_cast<size_t>((std::clock() - cpu) * 1000000.0 /
+                                        CLOCKS_PER_SEC);
+      replay.executions++;
+      // A query runs at most once per tick, as the scheduler does not
+      // overlap a query with itself.
+      while (replay.due <= step) {
+        replay.due += replay.query.splayed_interval;
+      }
+    }
+    ticks.push_back(static_cast<size_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count()));
+    step += (FLAGS_schedule_replay_step > 0) ? FLAGS_schedule_replay_step : 1;
+  }
+  bytes = getDatabaseBytesWritten() - bytes;
+
+  std::sort(ticks.begin(), ticks.end());
+  auto percentile = [&ticks](size_t p) {
+    return (ticks.empty())
+               ? 0
+               : ticks[std::min(ticks.size() - 1, ticks.size() * p / 100)];
+  };
+
+  std::cout << "ticks: " << ticks.size() << "\n"
+            << "tick_p50_us: " << percentile(50) << "\n"
+            << "tick_p99_us: " << percentile(99) << "\n"
+            << "rocksdb_bytes_written: " << bytes << "\n";
+  for (const auto& query : queries) {
+    const auto& replay = query.second;
+    auto cpu = (replay.executions > 0) ? replay.cpu / replay.executions : 0;
+    std::cout << "query: " << query.first
+              << " executions: " << replay.executions << " cpu_us: " << cpu
+              << "\n";
+  }
+  return 0;
+}
+
+#ifdef ALLOCATION_BENCHMARKS
+/**
+ * @brief Label each benchmark with its heap usage per iteration.
+ *
+ * The osquery_alloc_benchmarks executable replaces operator new and delete,
+ * see getAllocationCounts. The counts between two reports belong to a single
+ * benchmark, and are divided by the iterations of its runs: allocations and
+ * bytes requested per iteration, and the peak live bytes above the live
+ * bytes when the benchmark started.
+ */
+class AllocationReporter : public ::benchmark::ConsoleReporter {
+ public:
+  AllocationReporter() {
+    resetAllocationPeak();
+    last_ = getAllocationCounts();
+  }
+
+  void ReportRuns(const std::vector<Run>& reports) override {
+    auto counts = getAllocationCounts();
+    size_t iterations = 0;
+    for (const auto& run : reports) {
+      iterations += static_cast<size_t>(run.iterations);
+    }
+    iterations = std::max<size_t>(iterations, 1);
+
+    auto label = "allocations/iter: " +
+                 std::to_string((counts.allocations - last_.allocations) /
+                                iterations) +
+                 "  bytes/iter: " +
+                 std::to_string((counts.bytes - last_.bytes) / iterations) +
+                 "  peak_live: " +
+                 std::to_string(
+                     (counts.peak > last_.live) ? counts.peak - last_.live : 0);
+    auto labeled = reports;
+    for (auto& run : labeled) {
+      run.report_label = (run.report_label.empty())
+                             ? label
+                             : run.report_label + "  " + label;
+    }
+    ConsoleReporter::ReportRuns(labeled);
+
+    // Reporting allocates, start the next benchmark's counts afterward.
+    resetAllocationPeak();
+    last_ = getAllocationCounts();
+  }
+
+ private:
+  /// The counts when the current benchmark started.
+  AllocationCounts last_;
+};
+#endif
+}
+
+int main(int argc, char* argv[]) {
   osquery::initTesting();
+#ifdef ALLOCATION_BENCHMARKS
+  // A minimum time of 0 runs each repetition as a single trial, so every
+  // counted allocation belongs to a reported iteration. Use
+  // --benchmark_repetitions to average more iterations.
+  std::vector<char*> args(argv, argv + argc);
+  std::string min_time = "--benchmark_min_time=0";
+  args.insert(args.begin() + 1, &min_time[0]);
+  args.push_back(nullptr);
+  argc = static_cast<int>(args.size()) - 1;
+  argv = args.data();
+#endif
   ::benchmark::Initialize(&argc, argv);
+  // The benchmark flags are removed, parse the schedule replay flags.
+  GFLAGS_NAMESPACE::ParseCommandLineFlags(&argc, &argv, true);
+  if (!osquery::FLAGS_schedule_replay.empty()) {
+    auto code = osquery::replaySchedule(osquery::FLAGS_schedule_replay);
+    osquery::shutdownTesting();
+    return code;
+  }
+
+#ifdef ALLOCATION_BENCHMARKS
+  osquery::AllocationReporter reporter;
+  ::benchmark::RunSpecifiedBenchmarks(&reporter);
+#else
   ::benchmark::RunSpecifiedBenchmarks();
+#endif
   // Optionally enable Goggle Logging
   // google::InitGoogleLogging(argv[0]);
   return 0;
@@ -8,6 +8,7 @@
  *
  */
 
+#include <chrono>
 #include <cstdlib>
 #include <sstream>
 
@@ -79,6 +80,7 @@ void RegistryHelperCore::remove(const std::string& item_name) {
   for (const auto& alias : removed_aliases) {
     aliases_.erase(alias);
   }
+  RegistryFactory::instance().generation_++;
 }
 
 bool RegistryHelperCore::isInternal(const std::string& item_name) const {
@@ -118,6 +120,16 @@ const std::string& RegistryHelperCore::getActive() const {
   return active_;
 }
 
+/// A plugin's route info, including an optional response cache interval.
+static PluginResponse getRouteInfo(const PluginRef& plugin) {
+  auto info = plugin->routeInfo();
+  auto seconds = plugin->responseCacheSeconds();
+  if (seconds > 0) {
+    info.push_back({{"id", "cache"}, {"seconds", std::to_string(seconds)}});
+  }
+  return info;
+}
+
 RegistryRoutes RegistryHelperCore::getRoutes() const {
   RegistryRoutes route_table;
   for (const auto& item : items_) {
@@ -131,13 +143,13 @@ RegistryRoutes RegistryHelperCore::getRoutes() const {
       if (alias.second == item.first) {
         // If the item name is masked by at least one alias, it will not
         // broadcast under the internal item name.
-        route_table[alias.first] = item.second->routeInfo();
+        route_table[alias.first] = getRouteInfo(item.second);
         has_alias = true;
       }
     }
 
     if (!has_alias) {
-      route_table[item.first] = item.second->routeInfo();
+      route_table[item.first] = getRouteInfo(item.second);
     }
   }
   return route_table;
@@ -196,6 +208,7 @@ Status RegistryHelperCore::add(const std::string& item_name, bool internal) {
     modules_[item_name] = RegistryFactory::getModule();
   }
 
+  RegistryFactory::instance().generation_++;
   return Status(0, "OK");
 }
 
@@ -239,6 +252,7 @@ void RegistryHelperCore::configure() {
 Status RegistryHelperCore::addExternal(const RouteUUID& uuid,
                                        const RegistryRoutes& routes) {
   // Add each route name (item name) to the tracking.
+  RegistryFactory::instance().generation_++;
   for (const auto& route : routes) {
     // Keep the routes info assigned to the registry.
     routes_[route.first] = route.second;
@@ -266,6 +280,7 @@ void RegistryHelperCore::removeExternal(const RouteUUID& uuid) {
     external_.erase(item);
     routes_.erase(item);
   }
+  RegistryFactory::instance().generation_++;
 }
 
 /// Facility method to check if a registry item exists.
@@ -373,6 +388,7 @@ Status RegistryFactory::addBroadcast(const RouteUUID& uuid,
     }
   }
   self.extensions_.insert(uuid);
+  self.broadcast_added_.notify_all();
   return status;
 }
 
@@ -390,6 +406,15 @@ Status RegistryFactory::removeBroadcast(const RouteUUID& uuid) {
   return Status(0, "OK");
 }
 
+bool RegistryFactory::waitForBroadcasts(size_t count, size_t timeout) {
+  auto& self = instance();
+  std::unique_lock<Mutex> lock(self.mutex_);
+  return self.broadcast_added_.wait_for(
+      lock, std::chrono::milliseconds(timeout), [&self, count]() {
+        return self.extensions_.size() >= count;
+      });
+}
+
 /// Adds an alias for an internal registry item. This registry will only
 /// broadcast the alias name.
 Status RegistryFactory::addAlias(const std::string& registry_name,
@@ -463,21 +488,70 @@ Status RegistryFactory::call(const std::string& registry_name,
   return call(registry_name, request, response);
 }
 
+TableRoute RegistryFactory::resolveTable(const std::string& table_name) {
+  auto& self = instance();
+  TableRoute route;
+  route.generation = generation();
+
+  // Extension registration changes the routes while holding the lock.
+  WriteLock lock(self.mutex_);
+  auto tables = registry("table");
+  auto plugin = tables->items_.find(table_name);
+  if (plugin != tables->items_.end()) {
+    route.plugin = std::dynamic_pointer_cast<TablePlugin>(plugin->second);
+    return route;
+  }
+
+  // Extension tables, and core tables called from an extension, receive the
+  // structured query context.
+  auto external = tables->external_.find(table_name);
+  if (external != tables->external_.end()) {
+    route.external = true;
+    route.uuid = external->second;
+  } else if (Registry::external()) {
+    route.external = true;
+  }
+  return route;
+}
+
 Status RegistryFactory::callTable(const std::string& table_name,
                                   QueryContext& context,
                                   PluginResponse& response) {
-  auto& tables = registry("table")->items_;
-  // This only works for local tables.
-  if (tables.count(table_name) > 0) {
-    auto plugin = std::dynamic_pointer_cast<TablePlugin>(tables.at(table_name));
-    response = plugin->generate(context);
+  auto route = resolveTable(table_name);
+  if (route.plugin != nullptr) {
+    response = route.plugin->generate(context);
     return Status(0);
-  } else {
-    // If the table is not local then it does not benefit from complex contexts.
-    PluginRequest request = {{"action", "generate"}};
-    TablePlugin::setRequestFromContext(context, request);
-    return call("table", table_name, request, response);
+  } else if (route.external) {
+    return callExtensionTable(route.uuid, table_name, context, response);
   }
+
+  PluginRequest request = {{"action", "generate"}};
+  TablePlugin::setRequestFromContext(context, request);
+  return call("table", table_name, request, response);
+}
+
+Status RegistryFactory::callTable(const std::string& table_name,
+                                  QueryContext& context,
+                                  RowGeneratorRef& generator) {
+  return callTable(resolveTable(table_name), table_name, context, generator);
+}
+
+Status RegistryFactory::callTable(const TableRoute& route,
+                                  const std::string& table_name,
+                                  QueryContext& context,
+                                  RowGeneratorRef& generator) {
+  if (route.plugin != nullptr) {
+    generator = route.plugin->generator(context);
+    return Status(0);
+  } else if (route.external) {
+    // Extension tables are fetched in batches from a table cursor.
+    return callExtensionTable(route.uuid, table_name, context, generator);
+  }
+
+  PluginResponse response;
+  auto status = callTable(table_name, context, response);
+  generator = std::make_shared<QueryDataGenerator>(std::move(response));
+  return status;
 }
 
 Status RegistryFactory::setActive(const std::string& registry_name,
@@ -8,6 +8,8 @@
  *
  */
 
+#include <algorithm>
+
 #include <boost/algorithm/string/trim.hpp>
 
 #include <osquery/core.h>
@@ -45,30 +47,119 @@ CLI_FLAG(bool,
          false,
          "Disable re-enrollment attempts if related plugins return invalid");
 
+/// Max seconds between enrollment attempts after repeated failures.
+FLAG(uint64,
+     enroll_max_backoff,
+     3600,
+     "Max seconds between failed enrollment attempts (default 3600)");
+
+/// Seconds before the first retry of a failed enrollment.
+const size_t kEnrollBackoff = 60;
+
+/// The node key shared by every remote plugin.
+struct NodeKeyCache {
+  /// The node key, empty if not yet read or enrolled.
+  std::string node_key;
+
+  /// Changed whenever the node key is replaced or cleared.
+  size_t generation{0};
+
+  /// The number of consecutive failed enrollments.
+  size_t failures{0};
+
+  /// The earliest time another enrollment is attempted.
+  size_t next_attempt{0};
+};
+
+/// Protect the cached node key, only one thread enrolls at a time.
+Mutex enroll_mutex_;
+
+static NodeKeyCache node_key_cache_;
+
+/// Jittered exponential backoff, in seconds, after a failed enrollment.
+static size_t getEnrollBackoff(size_t failures) {
+  size_t limit = std::max(static_cast<size_t>(FLAGS_enroll_max_backoff),
+                          static_cast<size_t>(1));
+  size_t backoff = kEnrollBackoff;
+  for (size_t i = 1; i < failures && backoff < limit; i++) {
+    backoff *= 2;
+  }
+  backoff = std::min(backoff, limit);
+
+  // Spread the enrolling hosts over the second half of the backoff.
+  return backoff / 2 + static_cast<size_t>(rand()) % (backoff / 2 + 1);
+}
+
 Status clearNodeKey() {
+  WriteLock lock(enroll_mutex_);
+  node_key_cache_.node_key.clear();
+  node_key_cache_.generation++;
+  node_key_cache_.failures = 0;
+  node_key_cache_.next_attempt = 0;
+  return deleteDatabaseValue(kPersistentSettings, "nodeKey");
+}
+
+Status clearNodeKey(size_t generation) {
+  WriteLock lock(enroll_mutex_);
+  if (generation != node_key_cache_.generation) {
+    // Another plugin already replaced the rejected key.
+    return Status(0, "Node key already replaced");
+  }
+  node_key_cache_.node_key.clear();
+  node_key_cache_.generation++;
   return deleteDatabaseValue(kPersistentSettings, "nodeKey");
 }
 
 std::string getNodeKey(const std::string& enroll_plugin) {
+  size_t generation = 0;
+  return getNodeKey(enroll_plugin, generation);
+}
+
+std::string getNodeKey(const std::string& enroll_plugin, size_t& generation) {
+  // Concurrent callers wait for a single enrollment and share the key.
+  WriteLock lock(enroll_mutex_);
+  auto& cache = node_key_cache_;
+  generation = cache.generation;
+  if (!cache.node_key.empty()) {
+    return cache.node_key;
+  }
+
   std::string node_key;
   getDatabaseValue(kPersistentSettings, "nodeKey", node_key);
   if (node_key.size() > 0) {
     // A non-empty node key was found in the backing-store (cache).
+    cache.node_key = node_key;
+    generation = ++cache.generation;
     return node_key;
   }
 
-  // The node key request time is recorded before the enroll request occurs.
-  auto request_time = std::to_string(getUnixTime());
+  auto request_time = getUnixTime();
+  if (FLAGS_disable_enrollment || request_time < cache.next_attempt) {
+    // Enrollment is disabled or backing off after a failure.
+    return node_key;
+  }
 
   // Request the enroll plugin's node secret.
   PluginResponse response;
   Registry::call("enroll", enroll_plugin, {{"action", "enroll"}}, response);
   if (response.size() > 0 && response[0].count("node_key") != 0) {
     node_key = response[0].at("node_key");
-    setDatabaseValue(kPersistentSettings, "nodeKey", node_key);
-    // Set the last time a nodeKey was requested from an enrollment endpoint.
-    setDatabaseValue(kPersistentSettings, "nodeKeyTime", request_time);
   }
+
+  if (node_key.empty()) {
+    cache.failures++;
+    cache.next_attempt = request_time + getEnrollBackoff(cache.failures);
+    return node_key;
+  }
+
+  setDatabaseValue(kPersistentSettings, "nodeKey", node_key);
+  // Set the last time a nodeKey was requested from an enrollment endpoint.
+  setDatabaseValue(
+      kPersistentSettings, "nodeKeyTime", std::to_string(request_time));
+  cache.node_key = node_key;
+  cache.failures = 0;
+  cache.next_attempt = 0;
+  generation = ++cache.generation;
   return node_key;
 }
 
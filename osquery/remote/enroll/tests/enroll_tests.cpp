@@ -8,6 +8,10 @@
  *
  */
 
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include <gtest/gtest.h>
 
 #include <osquery/core.h>
@@ -27,7 +31,7 @@ DECLARE_string(enroll_secret_path);
 class EnrollTests : public testing::Test {
  public:
   void SetUp() {
-    deleteDatabaseValue(kPersistentSettings, "nodeKey");
+    clearNodeKey();
     deleteDatabaseValue(kPersistentSettings, "nodeKeyTime");
   }
 };
@@ -40,6 +44,34 @@ class SimpleEnrollPlugin : public EnrollPlugin {
 // Register our simple enroll plugin.
 REGISTER(SimpleEnrollPlugin, "enroll", "test_simple");
 
+/// The number of enrollments requested from the counting plugin.
+static std::atomic<size_t> kEnrollCalls{0};
+
+/// The node key returned by the counting plugin, empty to fail.
+static std::string kEnrollKey;
+
+class CountingEnrollPlugin : public EnrollPlugin {
+ protected:
+  std::string enroll() {
+    kEnrollCalls++;
+    // Give concurrent callers a chance to request enrollment.
+    sleepFor(100);
+    return kEnrollKey + std::to_string(kEnrollCalls);
+  }
+};
+
+REGISTER(CountingEnrollPlugin, "enroll", "test_counting");
+
+class FailingEnrollPlugin : public EnrollPlugin {
+ protected:
+  std::string enroll() {
+    kEnrollCalls++;
+    return "";
+  }
+};
+
+REGISTER(FailingEnrollPlugin, "enroll", "test_failing");
+
 TEST_F(EnrollTests, test_enroll_secret_retrieval) {
   // Write an example secret (deploy key).
   FLAGS_enroll_secret_path =
@@ -85,4 +117,47 @@ TEST_F(EnrollTests, test_enroll_key_caching) {
   getDatabaseValue(kPersistentSettings, "nodeKeyTime", key_time2);
   EXPECT_EQ(key_time2, key_time);
 }
+
+TEST_F(EnrollTests, test_enroll_single_flight) {
+  kEnrollCalls = 0;
+  kEnrollKey = "counted_";
+
+  // Concurrent requests share a single enrollment.
+  std::vector<std::thread> threads;
+  std::vector<std::string> keys(4);
+  for (size_t i = 0; i < keys.size(); i++) {
+    threads.emplace_back(
+        [&keys, i]() { keys[i] = getNodeKey("test_counting"); });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(kEnrollCalls, 1U);
+  for (const auto& key : keys) {
+    EXPECT_EQ(key, "counted_1");
+  }
+
+  // Only the first plugin rejected with a key clears it.
+  size_t generation = 0;
+  EXPECT_EQ(getNodeKey("test_counting", generation), "counted_1");
+  EXPECT_TRUE(clearNodeKey(generation).ok());
+  clearNodeKey(generation);
+  EXPECT_EQ(getNodeKey("test_counting"), "counted_2");
+  EXPECT_EQ(kEnrollCalls, 2U);
+}
+
+TEST_F(EnrollTests, test_enroll_backoff) {
+  kEnrollCalls = 0;
+  EXPECT_EQ(getNodeKey("test_failing"), "");
+  EXPECT_EQ(kEnrollCalls, 1U);
+
+  // A failed enrollment is not retried until the backoff passes.
+  EXPECT_EQ(getNodeKey("test_failing"), "");
+  EXPECT_EQ(kEnrollCalls, 1U);
+
+  // Clearing the node key resets the backoff.
+  clearNodeKey();
+  EXPECT_EQ(getNodeKey("test_failing"), "");
+  EXPECT_EQ(kEnrollCalls, 2U);
+}
 }
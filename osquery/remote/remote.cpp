@@ -13,6 +13,8 @@
 
 #include <zlib.h>
 
+#include <osquery/status.h>
+
 namespace osquery {
 
 #define MOD_GZIP_ZLIB_WINDOWSIZE 15
@@ -36,12 +38,13 @@ std::string compressString(const std::string& data) {
 
   int ret = Z_OK;
   std::string output;
+  output.reserve(deflateBound(&zs, zs.avail_in));
 
   {
     char buffer[16384] = {0};
     while (ret == Z_OK) {
       zs.next_out = reinterpret_cast<Bytef*>(buffer);
-      zs.avail_out = sizeof(output);
+      zs.avail_out = sizeof(buffer);
 
       ret = deflate(&zs, Z_FINISH);
       if (output.size() < zs.total_out) {
@@ -57,4 +60,42 @@ std::string compressString(const std::string& data) {
 
   return output;
 }
+
+Status decompressString(const std::string& data, std::string& output) {
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+
+  // Accept both gzip and zlib headers.
+  if (inflateInit2(&zs, MOD_GZIP_ZLIB_WINDOWSIZE + 32) != Z_OK) {
+    return Status(1, "Cannot initialize decompression");
+  }
+
+  zs.next_in = (Bytef*)data.data();
+  zs.avail_in = static_cast<uInt>(data.size());
+
+  int ret = Z_OK;
+  std::string decompressed;
+  decompressed.reserve(data.size() * 4);
+
+  {
+    char buffer[16384] = {0};
+    while (ret == Z_OK) {
+      zs.next_out = reinterpret_cast<Bytef*>(buffer);
+      zs.avail_out = sizeof(buffer);
+
+      ret = inflate(&zs, Z_NO_FLUSH);
+      if (decompressed.size() < zs.total_out) {
+        decompressed.append(buffer, zs.total_out - decompressed.size());
+      }
+    }
+  }
+
+  inflateEnd(&zs);
+  if (ret != Z_STREAM_END) {
+    return Status(1, "Cannot decompress data");
+  }
+
+  output.swap(decompressed);
+  return Status(0, "OK");
+}
 }
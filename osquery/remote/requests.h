@@ -34,6 +34,16 @@ class Serializer;
  */
 std::string compressString(const std::string& data);
 
+/**
+ * @brief Decompress GZip or zlib data.
+ *
+ * Transports may decompress a response body before it is deserialized.
+ *
+ * @param data The compressed input.
+ * @param output The decompressed output, unchanged if the input is malformed.
+ */
+Status decompressString(const std::string& data, std::string& output);
+
 /**
  * @brief Abstract base class for remote transport implementations
  *
@@ -236,6 +246,20 @@ class Request {
     return transport_->sendRequest(serialized, options_.get("compress", false));
   }
 
+  /**
+   * @brief Send an already-serialized request body to the destination
+   *
+   * Set the "content_type" option if the body does not use the serializer's
+   * content type, responses are still deserialized by the serializer.
+   *
+   * @param serialized The request body
+   *
+   * @return success or failure of the operation
+   */
+  Status call(const std::string& serialized) {
+    return transport_->sendRequest(serialized, options_.get("compress", false));
+  }
+
   /**
    * @brief Get the request response
    *
@@ -154,4 +154,22 @@ TEST_F(RequestsTests, test_compression) {
   EXPECT_EQ(compressed, expected);
   EXPECT_LT(compressed.size(), uncompressed.size());
 }
+
+TEST_F(RequestsTests, test_decompression) {
+  std::string uncompressed = "stringstringstringstring";
+  for (size_t i = 0; i < 10; i++) {
+    uncompressed += uncompressed;
+  }
+
+  // Compressed data is restored.
+  std::string output;
+  auto status = decompressString(compressString(uncompressed), output);
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(output, uncompressed);
+
+  // Malformed data does not change the output.
+  status = decompressString("not compressed", output);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(output, uncompressed);
+}
 }
@@ -46,7 +46,10 @@ class TLSTransportsTests : public testing::Test {
     port_ = TLSServerRunner::port();
   }
 
-  void TearDown() override { TLSServerRunner::stop(); }
+  void TearDown() override {
+    TLSServerRunner::stop();
+    TLSClientPool::get().clear();
+  }
 
  protected:
   std::string port_;
@@ -157,4 +160,33 @@ TEST_F(TLSTransportsTests, test_call_client_auth) {
     EXPECT_TRUE(status.ok());
   }
 }
+
+TEST_F(TLSTransportsTests, test_client_pool) {
+  auto url = "https://localhost:" + port_;
+  auto t1 = std::make_shared<TLSTransport>();
+  t1->setDestination(url + "/config");
+  auto t2 = std::make_shared<TLSTransport>();
+  t2->setDestination(url + "/log");
+
+  // Transports to the same host with the same TLS settings share a client.
+  t1->getClient();
+  t2->getClient();
+  EXPECT_EQ(t1->getClientKey(), t2->getClientKey());
+  EXPECT_EQ(TLSClientPool::get().size(), 1U);
+
+  // A different client certificate uses a separate client.
+  t2->setClientCertificate(kTestDataPath + "test_client.pem",
+                           kTestDataPath + "test_client.key");
+  t2->getClient();
+  EXPECT_NE(t1->getClientKey(), t2->getClientKey());
+  EXPECT_EQ(TLSClientPool::get().size(), 2U);
+
+  // Idle clients are released.
+  auto timeout = FLAGS_tls_idle_timeout;
+  FLAGS_tls_idle_timeout = 0;
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  t1->getClient();
+  EXPECT_EQ(TLSClientPool::get().size(), 1U);
+  FLAGS_tls_idle_timeout = timeout;
+}
 }
@@ -13,6 +13,7 @@
 #include "osquery/remote/transports/tls.h"
 // clang-format on
 
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/core.h>
@@ -28,6 +29,9 @@ const std::string kTLSCiphers =
     "DH+3DES:RSA+AESGCM:RSA+AES:RSA+3DES:!aNULL:!MD5";
 const std::string kTLSUserAgentBase = "osquery/";
 
+/// Default seconds to wait for a response.
+const size_t kTLSTimeout = 16;
+
 /// TLS server hostname.
 CLI_FLAG(string,
          tls_hostname,
@@ -64,6 +68,26 @@ HIDDEN_FLAG(bool, tls_dump, false, "Print remote requests and responses");
 /// Undocumented feature to override TLS endpoints.
 HIDDEN_FLAG(bool, tls_node_api, false, "Use node key as TLS endpoints");
 
+FLAG(bool,
+     tls_keepalive,
+     true,
+     "Reuse TLS clients and request persistent connections");
+
+FLAG(bool,
+     tls_compress,
+     false,
+     "GZip compress TLS/HTTPS request bodies for every remote plugin");
+
+FLAG(bool,
+     tls_accept_gzip,
+     true,
+     "Accept GZip compressed TLS/HTTPS responses");
+
+FLAG(uint64,
+     tls_idle_timeout,
+     60,
+     "Seconds an unused pooled TLS client is kept (default 60)");
+
 DECLARE_bool(verbose);
 
 TLSTransport::TLSTransport() : verify_peer_(true) {
@@ -77,17 +101,99 @@ TLSTransport::TLSTransport() : verify_peer_(true) {
   }
 }
 
+TLSClientPool& TLSClientPool::get() {
+  static TLSClientPool pool;
+  return pool;
+}
+
+TLSClientRef TLSClientPool::acquire(
+    const std::string& key, const std::function<TLSClientRef()>& create) {
+  auto now = std::chrono::steady_clock::now();
+  WriteLock lock(mutex_);
+  expire(now);
+
+  auto& entry = clients_[key];
+  if (entry.client == nullptr) {
+    entry.client = create();
+  }
+  entry.used = now;
+  return entry.client;
+}
+
+void TLSClientPool::expire(std::chrono::steady_clock::time_point now) {
+  auto timeout = std::chrono::seconds(FLAGS_tls_idle_timeout);
+  for (auto it = clients_.begin(); it != clients_.end();) {
+    if (now - it->second.used > timeout) {
+      it = clients_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void TLSClientPool::clear() {
+  WriteLock lock(mutex_);
+  clients_.clear();
+}
+
+size_t TLSClientPool::size() const {
+  WriteLock lock(mutex_);
+  return clients_.size();
+}
+
 void TLSTransport::decorateRequest(http::client::request& r) {
-  r << boost::network::header("Connection", "close");
-  r << boost::network::header("Content-Type", serializer_->getContentType());
+  r << boost::network::header("Connection",
+                              (FLAGS_tls_keepalive) ? "keep-alive" : "close");
+  r << boost::network::header(
+      "Content-Type",
+      options_.get<std::string>("content_type", serializer_->getContentType()));
   r << boost::network::header("Accept", serializer_->getContentType());
+  if (FLAGS_tls_accept_gzip) {
+    r << boost::network::header("Accept-Encoding", "gzip");
+  }
   r << boost::network::header("Host", FLAGS_tls_hostname);
   r << boost::network::header("User-Agent", kTLSUserAgentBase + kVersion);
 }
 
+std::string TLSTransport::getClientKey() const {
+  // Clients are shared by the destination's host and the TLS settings.
+  auto host = destination_;
+  auto scheme = host.find("://");
+  if (scheme != std::string::npos) {
+    host = host.substr(scheme + 3);
+  }
+  host = host.substr(0, host.find('/'));
+
+  bool verify_peer = verify_peer_;
+#if defined(DEBUG)
+  verify_peer = verify_peer && !FLAGS_tls_allow_unsafe;
+#endif
+
+  std::string key = host;
+  for (const auto& part : {client_certificate_file_,
+                           client_private_key_file_,
+                           server_certificate_file_,
+                           options_.get<std::string>("hostname", ""),
+                           options_.get<std::string>("timeout", "")}) {
+    key += '\0' + part;
+  }
+  return key + '\0' + ((verify_peer) ? "1" : "0");
+}
+
 http::client TLSTransport::getClient() {
+  if (!FLAGS_tls_keepalive) {
+    return *createClient();
+  }
+  return *TLSClientPool::get().acquire(getClientKey(),
+                                       [this]() { return createClient(); });
+}
+
+TLSClientRef TLSTransport::createClient() {
   http::client::options options;
-  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(16);
+  options.follow_redirects(true).always_verify_peer(verify_peer_).timeout(
+      options_.get<size_t>("timeout", kTLSTimeout));
+  // Pooled clients reuse name resolutions between requests.
+  options.cache_resolved(FLAGS_tls_keepalive);
 
   std::string ciphers = kTLSCiphers;
   if (!isPlatform(PlatformType::TYPE_OSX)) {
@@ -146,8 +252,23 @@ http::client TLSTransport::getClient() {
     options.openssl_sni_hostname(options_.get<std::string>("hostname"));
   }
 
-  http::client client(options);
-  return client;
+  return std::make_shared<http::client>(options);
+}
+
+std::string TLSTransport::getResponseBody() {
+  std::string response_body = body(response_);
+  for (const auto& header : response_.headers()) {
+    if (!boost::iequals(header.first, "Content-Encoding")) {
+      continue;
+    }
+
+    if (boost::iequals(header.second, "gzip") &&
+        !decompressString(response_body, response_body).ok()) {
+      throw std::runtime_error("Error decompressing response");
+    }
+    break;
+  }
+  return response_body;
 }
 
 inline bool tlsFailure(const std::string& what) {
@@ -169,7 +290,7 @@ Status TLSTransport::sendRequest() {
   VLOG(1) << "TLS/HTTPS GET request to URI: " << destination_;
   try {
     response_ = client.get(r);
-    const auto& response_body = body(response_);
+    const auto& response_body = getResponseBody();
     if (FLAGS_verbose && FLAGS_tls_dump) {
       fprintf(stdout, "%s\n", std::string(response_body).c_str());
     }
@@ -187,6 +308,9 @@ Status TLSTransport::sendRequest(const std::string& params, bool compress) {
     return Status(1, "Cannot create TLS request for non-HTTPS protocol URI");
   }
 
+  // Every remote plugin's request bodies may be compressed.
+  compress = compress || FLAGS_tls_compress;
+
   auto client = getClient();
   http::client::request r(destination_);
   decorateRequest(r);
@@ -214,7 +338,7 @@ Status TLSTransport::sendRequest(const std::string& params, bool compress) {
       response_ = client.put(r, (compress) ? compressString(params) : params);
     }
 
-    const auto& response_body = body(response_);
+    const auto& response_body = getResponseBody();
     if (FLAGS_verbose && FLAGS_tls_dump) {
       fprintf(stdout, "%s\n", std::string(response_body).c_str());
     }
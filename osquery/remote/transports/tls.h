@@ -71,6 +71,14 @@ SSL_METHOD* SSLv3_method(void);
 void ERR_remove_state(unsigned long);
 }
 
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
 #include <osquery/flags.h>
 
 #include "osquery/remote/requests.h"
@@ -87,6 +95,68 @@ DECLARE_string(tls_client_cert);
 /// TLS server hostname.
 DECLARE_string(tls_hostname);
 
+/// Reuse TLS clients and request persistent connections.
+DECLARE_bool(tls_keepalive);
+
+/// Seconds an unused pooled TLS client is kept.
+DECLARE_uint64(tls_idle_timeout);
+
+using TLSClientRef = std::shared_ptr<boost::network::http::client>;
+
+/**
+ * @brief A process-wide set of TLS clients shared by the remote plugins.
+ *
+ * The config, logger, distributed, and enroll plugins each create a transport
+ * per request. Without sharing, every request builds a new client and its
+ * connection, resolver, and I/O thread. Clients are keyed by the destination
+ * host and the TLS settings (client certificate, pinned server certificates,
+ * SNI hostname, and peer verification) so requests only share a client when
+ * they would negotiate the same session. Clients unused for longer than
+ * --tls_idle_timeout seconds are released.
+ */
+class TLSClientPool : private boost::noncopyable {
+ public:
+  /// The process-wide pool.
+  static TLSClientPool& get();
+
+  /**
+   * @brief Get the client for a key, creating it if none exists.
+   *
+   * @param key The destination host and TLS settings.
+   * @param create Used to build a client when the pool has none for the key.
+   * @return a shared client.
+   */
+  TLSClientRef acquire(const std::string& key,
+                       const std::function<TLSClientRef()>& create);
+
+  /// Release every pooled client.
+  void clear();
+
+  /// The number of pooled clients.
+  size_t size() const;
+
+ private:
+  TLSClientPool() = default;
+
+  /// Remove clients that are idle longer than the timeout.
+  void expire(std::chrono::steady_clock::time_point now);
+
+ private:
+  struct Entry {
+    /// The shared client.
+    TLSClientRef client{nullptr};
+
+    /// The last time a transport acquired the client.
+    std::chrono::steady_clock::time_point used;
+  };
+
+  /// Pooled clients by key.
+  std::map<std::string, Entry> clients_;
+
+  /// Protect the pooled clients.
+  mutable Mutex mutex_;
+};
+
 /**
  * @brief HTTP verb selections.
  */
@@ -128,8 +198,16 @@ class TLSTransport : public Transport {
  public:
   TLSTransport();
 
+  /// Get a client, shared through the TLSClientPool when keep-alive is used.
   boost::network::http::client getClient();
 
+ private:
+  /// Build a client with the transport's TLS settings.
+  TLSClientRef createClient();
+
+  /// The TLSClientPool key for the destination and TLS settings.
+  std::string getClientKey() const;
+
  private:
   /// Testing-only, disable peer verification.
   void disableVerifyPeer() {
@@ -169,6 +247,9 @@ class TLSTransport : public Transport {
     */
   void decorateRequest(boost::network::http::client::request& r);
 
+  /// Get the response body, decompressed if the server used GZip.
+  std::string getResponseBody();
+
  protected:
   /// Storage for the HTTP response object
   boost::network::http::client::response response_;
@@ -180,6 +261,7 @@ class TLSTransport : public Transport {
   FRIEND_TEST(TLSTransportsTests, test_call_server_cert_pinning);
   FRIEND_TEST(TLSTransportsTests, test_call_client_auth);
   FRIEND_TEST(TLSTransportsTests, test_call_http);
+  FRIEND_TEST(TLSTransportsTests, test_client_pool);
 
   friend class TestDistributedPlugin;
 };
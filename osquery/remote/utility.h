@@ -77,7 +77,8 @@ class TLSRequestHelper : private boost::noncopyable {
   static Status go(const std::string& uri,
                    boost::property_tree::ptree& params,
                    boost::property_tree::ptree& output) {
-    auto node_key = getNodeKey("tls");
+    size_t generation = 0;
+    auto node_key = getNodeKey("tls", generation);
 
     // If using a GET request, append the node_key to the URI variables.
     std::string uri_suffix;
@@ -97,12 +98,24 @@ class TLSRequestHelper : private boost::noncopyable {
       force_post = (params.get<std::string>("verb") == "POST");
       params.erase("verb");
     }
+
+    // The caller-supplied parameters may extend the response timeout.
+    size_t timeout = 0;
+    if (params.count("timeout")) {
+      timeout = params.get<size_t>("timeout", 0);
+      request.setOption("timeout", timeout);
+      params.erase("timeout");
+    }
+
     auto status = (FLAGS_tls_node_api && !force_post) ? request.call()
                                                       : request.call(params);
     // Restore caller-supplied parameters.
     if (force_post) {
       params.put("verb", "POST");
     }
+    if (timeout > 0) {
+      params.put("timeout", timeout);
+    }
     if (!status.ok()) {
       return status;
     }
@@ -120,7 +133,8 @@ class TLSRequestHelper : private boost::noncopyable {
       auto invalid = output.get("node_invalid", "");
       if (invalid == "1" || invalid == "true" || invalid == "True") {
         if (!FLAGS_disable_reenrollment) {
-          clearNodeKey();
+          // Only the first plugin rejected with this key clears it.
+          clearNodeKey(generation);
         }
         return Status(1, "Request failed: Invalid node key");
       }
@@ -134,6 +134,29 @@ static void SQL_virtual_table_internal_long(benchmark::State& state) {
 
 BENCHMARK(SQL_virtual_table_internal_long);
 
+static void SQL_virtual_table_internal_join(benchmark::State& state) {
+  Registry::add<BenchmarkTablePlugin>("table", "benchmark");
+  Registry::add<BenchmarkLongTablePlugin>("table", "long_benchmark");
+  auto dbc = SQLiteDBManager::getUnique();
+  for (const auto& name : {"benchmark", "long_benchmark"}) {
+    PluginResponse res;
+    Registry::call("table", name, {{"action", "columns"}}, res);
+    attachTableInternal(name, columnDefinition(res), dbc);
+  }
+
+  // The inner table is filtered once for each row of the outer table.
+  while (state.KeepRunning()) {
+    QueryData results;
+    queryInternal(
+        "select * from long_benchmark l, benchmark b "
+        "where b.test_int = l.test_int",
+        results,
+        dbc->db());
+  }
+}
+
+BENCHMARK(SQL_virtual_table_internal_join);
+
 class BenchmarkWideTablePlugin : public TablePlugin {
  private:
   TableColumns columns() const override {
@@ -16,6 +16,8 @@
 #include <osquery/sql.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/byte_scan.h"
+
 namespace osquery {
 
 FLAG(int32, value_max, 512, "Maximum returned row value size");
@@ -41,7 +43,12 @@ std::string SQL::getMessageString() {
 }
 
 static inline void escapeNonPrintableBytes(std::string& data) {
-  std::string escaped;
+  // Most values are printable, they are scanned without copying.
+  auto i = findNonPrintable(data.data(), data.size());
+  if (i == data.size()) {
+    return;
+  }
+
   // clang-format off
   char const hex_chars[16] = {
     '0', '1', '2', '3', '4', '5', '6', '7',
@@ -49,22 +56,21 @@ static inline void escapeNonPrintableBytes(std::string& data) {
   };
   // clang-format on
 
-  bool needs_replacement = false;
-  for (size_t i = 0; i < data.length(); i++) {
-    if (((unsigned char)data[i]) < 0x20 || ((unsigned char)data[i]) >= 0x80) {
-      needs_replacement = true;
-      escaped += "\\x";
-      escaped += hex_chars[(((unsigned char)data[i])) >> 4];
-      escaped += hex_chars[((unsigned char)data[i] & 0x0F) >> 0];
-    } else {
-      escaped += data[i];
-    }
-  }
-
-  // Only replace if any escapes were made.
-  if (needs_replacement) {
-    data = std::move(escaped);
+  std::string escaped;
+  escaped.reserve(data.size() + 16);
+  escaped.append(data, 0, i);
+  while (i < data.size()) {
+    auto c = static_cast<unsigned char>(data[i]);
+    escaped += "\\x";
+    escaped += hex_chars[c >> 4];
+    escaped += hex_chars[c & 0x0F];
+
+    // Append the run of printable bytes before the next escape.
+    auto run = ++i;
+    i += findNonPrintable(data.data() + run, data.size() - run);
+    escaped.append(data, run, i - run);
   }
+  data = std::move(escaped);
 }
 
 void escapeNonPrintableBytesEx(std::string& data) {
@@ -72,7 +78,11 @@ void escapeNonPrintableBytesEx(std::string& data) {
 }
 
 void SQL::escapeResults() {
-  for (auto& row : results_) {
+  escapeResults(results_);
+}
+
+void SQL::escapeResults(QueryData& results) {
+  for (auto& row : results) {
     for (auto& column : row) {
       escapeNonPrintableBytes(column.second);
     }
@@ -89,16 +99,12 @@ QueryData SQL::selectAllFrom(const std::string& table,
                              const std::string& column,
                              ConstraintOperator op,
                              const std::string& expr) {
-  PluginRequest request = {{"action", "generate"}};
-  {
-    // Create a fake content, there will be no caching.
-    QueryContext ctx;
-    ctx.constraints[column].add(Constraint(op, expr));
-    TablePlugin::setRequestFromContext(ctx, request);
-  }
+  // Create a fake content, there will be no caching.
+  QueryContext ctx;
+  ctx.constraints[column].add(Constraint(op, expr));
 
   PluginResponse response;
-  Registry::call("table", table, request, response);
+  Registry::callTable(table, ctx, response);
   return response;
 }
 
@@ -0,0 +1,858 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef WIN32
+#define _USE_MATH_DEFINES
+#endif
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sqlite3.h>
+
+#include "osquery/core/conversions.h"
+
+namespace osquery {
+
+/**
+ * Each sketch is serialized as base64 text, a type byte and format version
+ * followed by the sketch's content. A merge function accepts the sketches of
+ * many hosts and returns a sketch of the combined values, so a fleet may
+ * aggregate summaries instead of rows.
+ */
+const unsigned char kSketchVersion = 1;
+const unsigned char kHLLSketchType = 'H';
+const unsigned char kTDigestSketchType = 'T';
+const unsigned char kTopKSketchType = 'K';
+
+/// HyperLogLog index bits, 4096 registers with a 1.6% standard error.
+const size_t kHLLPrecision = 12;
+const size_t kHLLRegisters = 1 << kHLLPrecision;
+
+/// t-digest compression, the bound on retained centroids.
+const double kTDigestCompression = 100;
+
+/// Values added to a t-digest before its buffer is compressed.
+const size_t kTDigestBuffer = 500;
+
+/// Count-min rows and counters per row.
+const size_t kTopKDepth = 4;
+const size_t kTopKWidth = 256;
+
+/// The default and maximum number of heavy hitters kept by a top-k sketch.
+const size_t kTopKDefault = 10;
+const size_t kTopKMax = 100;
+
+/// A 64-bit hash that is stable across hosts and platforms.
+static uint64_t sketchHash(const std::string& value, uint64_t seed = 0) {
+  // FNV-1a, then the MurmurHash3 finalizer to mix the high bits.
+  uint64_t h = 14695981039346656037ULL ^ (seed * 0x9e3779b97f4a7c15ULL);
+  for (const unsigned char c : value) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+/// Little-endian serialization of a sketch.
+class SketchWriter {
+ public:
+  SketchWriter(unsigned char type) {
+    data_.push_back(static_cast<char>(type));
+    data_.push_back(static_cast<char>(kSketchVersion));
+  }
+
+  void u8(unsigned char value) {
+    data_.push_back(static_cast<char>(value));
+  }
+
+  /// Write an unsigned integer in 7-bit groups, small counts use one byte.
+  void varint(uint64_t value) {
+    while (value >= 0x80) {
+      u8(static_cast<unsigned char>(value | 0x80));
+      value >>= 7;
+    }
+    u8(static_cast<unsigned char>(value));
+  }
+
+  void f64(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    for (size_t i = 0; i < 8; i++) {
+      u8(static_cast<unsigned char>(bits >> (i * 8)));
+    }
+  }
+
+  void str(const std::string& value) {
+    varint(value.size());
+    data_ += value;
+  }
+
+  std::string encode() const {
+    return base64Encode(data_);
+  }
+
+ private:
+  std::string data_;
+};
+
+/// Parse a serialized sketch, any read past the content fails the reader.
+class SketchReader {
+ public:
+  SketchReader(const std::string& encoded, unsigned char type) {
+    try {
+      data_ = base64Decode(encoded);
+    } catch (const std::exception& /* e */) {
+      ok_ = false;
+      return;
+    }
+    ok_ = (data_.size() >= 2 && u8() == type && u8() == kSketchVersion);
+  }
+
+  bool ok() const {
+    return ok_;
+  }
+
+  /// Check that every byte was read.
+  bool done() const {
+    return ok_ && pos_ == data_.size();
+  }
+
+  unsigned char u8() {
+    if (pos_ >= data_.size()) {
+      ok_ = false;
+      return 0;
+    }
+    return static_cast<unsigned char>(data_[pos_++]);
+  }
+
+  uint64_t varint() {
+    uint64_t value = 0;
+    for (size_t shift = 0; shift < 64 && ok_; shift += 7) {
+      auto byte = u8();
+      value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    ok_ = false;
+    return 0;
+  }
+
+  double f64() {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < 8; i++) {
+      bits |= static_cast<uint64_t>(u8()) << (i * 8);
+    }
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+
+  std::string str() {
+    auto size = varint();
+    if (!ok_ || size > data_.size() - pos_) {
+      ok_ = false;
+      return "";
+    }
+    auto value = data_.substr(pos_, static_cast<size_t>(size));
+    pos_ += static_cast<size_t>(size);
+    return value;
+  }
+
+ private:
+  std::string data_;
+  size_t pos_{0};
+  bool ok_{true};
+};
+
+/// A HyperLogLog distinct count.
+struct HLLSketch {
+  std::vector<unsigned char> registers;
+
+  HLLSketch() : registers(kHLLRegisters, 0) {}
+
+  void add(const std::string& value) {
+    auto hash = sketchHash(value);
+    auto index = static_cast<size_t>(hash >> (64 - kHLLPrecision));
+    // The rank is the position of the first set bit after the index bits.
+    auto bits = hash << kHLLPrecision;
+    unsigned char rank = 1;
+    while (rank <= 64 - kHLLPrecision && (bits & (1ULL << 63)) == 0) {
+      bits <<= 1;
+      rank++;
+    }
+    registers[index] = std::max(registers[index], rank);
+  }
+
+  void merge(const HLLSketch& other) {
+    for (size_t i = 0; i < kHLLRegisters; i++) {
+      registers[i] = std::max(registers[i], other.registers[i]);
+    }
+  }
+
+  double estimate() const {
+    double sum = 0;
+    size_t zeros = 0;
+    for (const auto& rank : registers) {
+      sum += std::ldexp(1.0, -static_cast<int>(rank));
+      if (rank == 0) {
+        zeros++;
+      }
+    }
+
+    double m = static_cast<double>(kHLLRegisters);
+    double alpha = 0.7213 / (1.0 + 1.079 / m);
+    double estimate = alpha * m * m / sum;
+    if (estimate <= 2.5 * m && zeros > 0) {
+      // Use linear counting for small cardinalities.
+      estimate = m * std::log(m / static_cast<double>(zeros));
+    }
+    return estimate;
+  }
+
+  /// Serialize the set registers, or every register if most are set.
+  std::string serialize() const {
+    SketchWriter writer(kHLLSketchType);
+    writer.u8(kHLLPrecision);
+    std::vector<size_t> set;
+    for (size_t i = 0; i < kHLLRegisters; i++) {
+      if (registers[i] != 0) {
+        set.push_back(i);
+      }
+    }
+
+    if (set.size() * 3 < kHLLRegisters) {
+      writer.u8(1);
+      writer.varint(set.size());
+      size_t last = 0;
+      for (const auto& index : set) {
+        // Indexes are stored as deltas from the previous set register.
+        writer.varint(index - last);
+        writer.u8(registers[index]);
+        last = index;
+      }
+    } else {
+      writer.u8(0);
+      for (const auto& rank : registers) {
+        writer.u8(rank);
+      }
+    }
+    return writer.encode();
+  }
+
+  bool deserialize(const std::string& encoded) {
+    SketchReader reader(encoded, kHLLSketchType);
+    if (!reader.ok() || reader.u8() != kHLLPrecision) {
+      return false;
+    }
+
+    std::fill(registers.begin(), registers.end(), 0);
+    if (reader.u8() == 1) {
+      auto count = reader.varint();
+      size_t index = 0;
+      for (uint64_t i = 0; i < count && reader.ok(); i++) {
+        index += static_cast<size_t>(reader.varint());
+        if (index >= kHLLRegisters) {
+          return false;
+        }
+        registers[index] = reader.u8();
+      }
+    } else {
+      for (auto& rank : registers) {
+        rank = reader.u8();
+      }
+    }
+    return reader.done();
+  }
+};
+
+/// A t-digest of numeric values for quantile estimates.
+struct TDigestSketch {
+  /// Centroid means and weights, ordered by mean once compressed.
+  std::vector<std::pair<double, double>> centroids;
+
+  /// Values and centroids not yet compressed.
+  size_t buffered{0};
+
+  double total{0};
+  double min{0};
+  double max{0};
+
+  void add(double mean, double weight) {
+    if (total == 0) {
+      min = mean;
+      max = mean;
+    }
+    min = std::min(min, mean);
+    max = std::max(max, mean);
+    total += weight;
+    centroids.push_back(std::make_pair(mean, weight));
+    if (++buffered >= kTDigestBuffer) {
+      compress();
+    }
+  }
+
+  void merge(const TDigestSketch& other) {
+    if (other.total == 0) {
+      return;
+    }
+
+    auto other_min = other.min;
+    auto other_max = other.max;
+    for (const auto& centroid : other.centroids) {
+      add(centroid.first, centroid.second);
+    }
+    min = std::min(min, other_min);
+    max = std::max(max, other_max);
+  }
+
+  /// The t-digest k1 scale function, mapping a quantile to a centroid index.
+  static double scale(double q) {
+    q = std::min(1.0, std::max(0.0, q));
+    return kTDigestCompression / (2 * M_PI) * std::asin(2 * q - 1);
+  }
+
+  /// Merge neighboring centroids while each stays within its size bound.
+  void compress() {
+    buffered = 0;
+    if (centroids.size() <= 1) {
+      return;
+    }
+
+    std::sort(centroids.begin(), centroids.end());
+    std::vector<std::pair<double, double>> merged;
+    auto current = centroids[0];
+    double so_far = 0;
+    for (size_t i = 1; i < centroids.size(); i++) {
+      const auto& next = centroids[i];
+      auto proposed = current.second + next.second;
+      // A centroid may span one unit of the arcsine scale, so centroids near
+      // the tails are kept small for accurate extremes.
+      if (scale((so_far + proposed) / total) - scale(so_far / total) <= 1) {
+        current.first += (next.first - current.first) * next.second / proposed;
+        current.second = proposed;
+      } else {
+        so_far += current.second;
+        merged.push_back(current);
+        current = next;
+      }
+    }
+    merged.push_back(current);
+    centroids.swap(merged);
+  }
+
+  double quantile(double q) {
+    compress();
+    if (q <= 0) {
+      return min;
+    } else if (q >= 1) {
+      return max;
+    }
+
+    // Interpolate between the centers of the centroids around the rank.
+    auto rank = q * total;
+    double previous_center = 0;
+    double previous_mean = min;
+    double cumulative = 0;
+    for (const auto& centroid : centroids) {
+      auto center = cumulative + centroid.second / 2;
+      if (rank < center) {
+        auto span = center - previous_center;
+        auto offset = (span > 0) ? (rank - previous_center) / span : 0;
+        return previous_mean + (centroid.first - previous_mean) * offset;
+      }
+      previous_center = center;
+      previous_mean = centroid.first;
+      cumulative += centroid.second;
+    }
+
+    auto span = total - previous_center;
+    auto offset = (span > 0) ? (rank - previous_center) / span : 0;
+    return previous_mean + (max - previous_mean) * offset;
+  }
+
+  std::string serialize() {
+    compress();
+    SketchWriter writer(kTDigestSketchType);
+    writer.f64(total);
+    writer.f64(min);
+    writer.f64(max);
+    writer.varint(centroids.size());
+    for (const auto& centroid : centroids) {
+      writer.f64(centroid.first);
+      writer.f64(centroid.second);
+    }
+    return writer.encode();
+  }
+
+  bool deserialize(const std::string& encoded) {
+    SketchReader reader(encoded, kTDigestSketchType);
+    if (!reader.ok()) {
+      return false;
+    }
+
+    total = reader.f64();
+    min = reader.f64();
+    max = reader.f64();
+    auto count = reader.varint();
+    centroids.clear();
+    for (uint64_t i = 0; i < count && reader.ok(); i++) {
+      auto mean = reader.f64();
+      auto weight = reader.f64();
+      centroids.push_back(std::make_pair(mean, weight));
+    }
+    buffered = centroids.size();
+    return reader.done() && total >= 0;
+  }
+};
+
+/// A count-min sketch with the heavy hitters found while counting.
+struct TopKSketch {
+  std::vector<uint64_t> counters;
+
+  /// The most frequent values and their estimated counts.
+  std::map<std::string, uint64_t> candidates;
+
+  /// The number of heavy hitters kept, 0 until set by a value or a merge.
+  size_t k{0};
+
+  TopKSketch() : counters(kTopKDepth * kTopKWidth, 0) {}
+
+  size_t slot(const std::string& value, size_t row) const {
+    return row * kTopKWidth +
+           static_cast<size_t>(sketchHash(value, row + 1) % kTopKWidth);
+  }
+
+  size_t limit() const {
+    return (k == 0) ? kTopKDefault : k;
+  }
+
+  uint64_t estimate(const std::string& value) const {
+    uint64_t count = UINT64_MAX;
+    for (size_t row = 0; row < kTopKDepth; row++) {
+      count = std::min(count, counters[slot(value, row)]);
+    }
+    return count;
+  }
+
+  /// Keep a value if it is among the k largest counts.
+  void offer(const std::string& value, uint64_t count) {
+    auto it = candidates.find(value);
+    if (it != candidates.end() || candidates.size() < limit()) {
+      candidates[value] = count;
+      return;
+    }
+
+    auto smallest = std::min_element(
+        candidates.begin(),
+        candidates.end(),
+        [](const std::pair<const std::string, uint64_t>& a,
+           const std::pair<const std::string, uint64_t>& b) {
+          return a.second < b.second;
+        });
+    if (count > smallest->second) {
+      candidates.erase(smallest);
+      candidates[value] = count;
+    }
+  }
+
+  void add(const std::string& value) {
+    for (size_t row = 0; row < kTopKDepth; row++) {
+      counters[slot(value, row)]++;
+    }
+    offer(value, estimate(value));
+  }
+
+  void merge(const TopKSketch& other) {
+    for (size_t i = 0; i < counters.size(); i++) {
+      counters[i] += other.counters[i];
+    }
+    k = std::max(k, other.k);
+
+    // Estimate every candidate of both sketches with the merged counters.
+    std::vector<std::string> values;
+    for (const auto& candidate : candidates) {
+      values.push_back(candidate.first);
+    }
+    for (const auto& candidate : other.candidates) {
+      values.push_back(candidate.first);
+    }
+    candidates.clear();
+    for (const auto& value : values) {
+      offer(value, estimate(value));
+    }
+  }
+
+  /// The heavy hitters ordered by count as a JSON array.
+  std::string items() const {
+    std::vector<std::pair<uint64_t, std::string>> sorted;
+    for (const auto& candidate : candidates) {
+      sorted.push_back(std::make_pair(candidate.second, candidate.first));
+    }
+    std::sort(sorted.begin(),
+              sorted.end(),
+              [](const std::pair<uint64_t, std::string>& a,
+                 const std::pair<uint64_t, std::string>& b) {
+                return (a.first != b.first) ? a.first > b.first
+                                            : a.second < b.second;
+              });
+
+    std::string json = "[";
+    for (const auto& item : sorted) {
+      if (json.size() > 1) {
+        json += ",";
+      }
+      json += "{\"value\":\"";
+      for (const unsigned char c : item.second) {
+        if (c == '"' || c == '\\') {
+          json += '\\';
+          json += c;
+        } else if (c < 0x20) {
+          char escaped[8];
+          snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+          json += escaped;
+        } else {
+          json += c;
+        }
+      }
+      json += "\",\"count\":" + std::to_string(item.first) + "}";
+    }
+    return json + "]";
+  }
+
+  std::string serialize() const {
+    SketchWriter writer(kTopKSketchType);
+    writer.varint(limit());
+    for (const auto& count : counters) {
+      writer.varint(count);
+    }
+    writer.varint(candidates.size());
+    for (const auto& candidate : candidates) {
+      writer.str(candidate.first);
+      writer.varint(candidate.second);
+    }
+    return writer.encode();
+  }
+
+  bool deserialize(const std::string& encoded) {
+    SketchReader reader(encoded, kTopKSketchType);
+    if (!reader.ok()) {
+      return false;
+    }
+
+    k = static_cast<size_t>(reader.varint());
+    if (k == 0 || k > kTopKMax) {
+      return false;
+    }
+    for (auto& count : counters) {
+      count = reader.varint();
+    }
+    auto count = reader.varint();
+    candidates.clear();
+    for (uint64_t i = 0; i < count && reader.ok(); i++) {
+      auto value = reader.str();
+      candidates[value] = reader.varint();
+    }
+    return reader.done();
+  }
+};
+
+/// The sketch state of an aggregate, released by the final callback.
+template <typename T>
+struct SketchAggregate {
+  T* sketch{nullptr};
+  bool invalid{false};
+};
+
+template <typename T>
+static SketchAggregate<T>* getAggregate(sqlite3_context* context,
+                                        bool create) {
+  // SQLite zeroes the context when it is allocated by the first step.
+  auto aggregate = static_cast<SketchAggregate<T>*>(sqlite3_aggregate_context(
+      context, (create) ? sizeof(SketchAggregate<T>) : 0));
+  if (aggregate != nullptr && aggregate->sketch == nullptr && create) {
+    aggregate->sketch = new T();
+  }
+  return aggregate;
+}
+
+/// Merge a serialized sketch argument into the aggregate.
+template <typename T>
+static void mergeStep(sqlite3_context* context,
+                      int argc,
+                      sqlite3_value** argv) {
+  assert(argc == 1);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0])) {
+    return;
+  }
+
+  auto aggregate = getAggregate<T>(context, true);
+  if (aggregate == nullptr || aggregate->invalid) {
+    return;
+  }
+
+  T other;
+  if (!other.deserialize((const char*)sqlite3_value_text(argv[0]))) {
+    aggregate->invalid = true;
+    return;
+  }
+  aggregate->sketch->merge(other);
+}
+
+/// Return the serialized sketch of an aggregate.
+template <typename T>
+static void sketchFinal(sqlite3_context* context) {
+  auto aggregate = getAggregate<T>(context, false);
+  if (aggregate == nullptr || aggregate->sketch == nullptr) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  if (aggregate->invalid) {
+    sqlite3_result_error(context, "Invalid sketch", -1);
+  } else {
+    auto serialized = aggregate->sketch->serialize();
+    sqlite3_result_text(context,
+                        serialized.c_str(),
+                        static_cast<int>(serialized.size()),
+                        SQLITE_TRANSIENT);
+  }
+  delete aggregate->sketch;
+  aggregate->sketch = nullptr;
+}
+
+/// Parse a serialized sketch argument of a scalar function.
+template <typename T>
+static bool readSketchArgument(sqlite3_context* context,
+                               sqlite3_value* value,
+                               T& sketch) {
+  if (SQLITE_NULL == sqlite3_value_type(value)) {
+    sqlite3_result_null(context);
+    return false;
+  }
+
+  if (!sketch.deserialize((const char*)sqlite3_value_text(value))) {
+    sqlite3_result_error(context, "Invalid sketch", -1);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Add values to a HyperLogLog distinct count sketch.
+ *
+ * Values are counted by their text representation.
+ *
+ * Example:
+ *   SELECT hll_count(hll_sketch(remote_address)) FROM process_open_sockets;
+ */
+static void hllSketchStep(sqlite3_context* context,
+                          int argc,
+                          sqlite3_value** argv) {
+  assert(argc == 1);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0])) {
+    return;
+  }
+
+  auto aggregate = getAggregate<HLLSketch>(context, true);
+  if (aggregate != nullptr) {
+    aggregate->sketch->add((const char*)sqlite3_value_text(argv[0]));
+  }
+}
+
+/// Estimate the distinct values counted by a HyperLogLog sketch.
+static void hllCountFunc(sqlite3_context* context,
+                         int argc,
+                         sqlite3_value** argv) {
+  assert(argc == 1);
+  HLLSketch sketch;
+  if (readSketchArgument(context, argv[0], sketch)) {
+    sqlite3_result_int64(context, std::llround(sketch.estimate()));
+  }
+}
+
+/**
+ * @brief Add numeric values to a t-digest quantile sketch.
+ *
+ * Example:
+ *   SELECT tdigest_quantile(tdigest_sketch(resident_size), 0.99)
+ *     FROM processes;
+ */
+static void tdigestSketchStep(sqlite3_context* context,
+                              int argc,
+                              sqlite3_value** argv) {
+  assert(argc == 1);
+  auto type = sqlite3_value_numeric_type(argv[0]);
+  if (type != SQLITE_INTEGER && type != SQLITE_FLOAT) {
+    return;
+  }
+
+  auto aggregate = getAggregate<TDigestSketch>(context, true);
+  if (aggregate != nullptr) {
+    aggregate->sketch->add(sqlite3_value_double(argv[0]), 1);
+  }
+}
+
+/// Estimate a quantile, between 0 and 1, from a t-digest sketch.
+static void tdigestQuantileFunc(sqlite3_context* context,
+                                int argc,
+                                sqlite3_value** argv) {
+  assert(argc == 2);
+  TDigestSketch sketch;
+  if (!readSketchArgument(context, argv[0], sketch)) {
+    return;
+  }
+
+  if (sketch.total == 0 || SQLITE_NULL == sqlite3_value_type(argv[1])) {
+    sqlite3_result_null(context);
+    return;
+  }
+  sqlite3_result_double(context,
+                        sketch.quantile(sqlite3_value_double(argv[1])));
+}
+
+/**
+ * @brief Add values to a count-min top-k sketch.
+ *
+ * The optional second argument is the number of heavy hitters kept.
+ *
+ * Example:
+ *   SELECT topk_items(topk_sketch(name, 5)) FROM processes;
+ */
+static void topkSketchStep(sqlite3_context* context,
+                           int argc,
+                           sqlite3_value** argv) {
+  assert(argc == 1 || argc == 2);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0])) {
+    return;
+  }
+
+  auto aggregate = getAggregate<TopKSketch>(context, true);
+  if (aggregate == nullptr) {
+    return;
+  }
+
+  if (argc == 2) {
+    auto k = sqlite3_value_int64(argv[1]);
+    if (k <= 0 || k > static_cast<sqlite3_int64>(kTopKMax)) {
+      aggregate->invalid = true;
+      return;
+    }
+    aggregate->sketch->k = static_cast<size_t>(k);
+  }
+  aggregate->sketch->add((const char*)sqlite3_value_text(argv[0]));
+}
+
+/// List the heavy hitters of a top-k sketch as JSON.
+static void topkItemsFunc(sqlite3_context* context,
+                          int argc,
+                          sqlite3_value** argv) {
+  assert(argc == 1);
+  TopKSketch sketch;
+  if (readSketchArgument(context, argv[0], sketch)) {
+    auto items = sketch.items();
+    sqlite3_result_text(context,
+                        items.c_str(),
+                        static_cast<int>(items.size()),
+                        SQLITE_TRANSIENT);
+  }
+}
+
+void registerSketchExtensions(sqlite3* db) {
+  sqlite3_create_function(db,
+                          "hll_sketch",
+                          1,
+                          SQLITE_UTF8,
+                          nullptr,
+                          nullptr,
+                          hllSketchStep,
+                          sketchFinal<HLLSketch>);
+  sqlite3_create_function(db,
+                          "hll_merge",
+                          1,
+                          SQLITE_UTF8,
+                          nullptr,
+                          nullptr,
+                          mergeStep<HLLSketch>,
+                          sketchFinal<HLLSketch>);
+  sqlite3_create_function(db,
+                          "hll_count",
+                          1,
+                          SQLITE_UTF8,
+                          nullptr,
+                          hllCountFunc,
+                          nullptr,
+                          nullptr);
+  sqlite3_create_function(db,
+                          "tdigest_sketch",
+                          1,
+                          SQLITE_UTF8,
+                          nullptr,
+                          nullptr,
+                          tdigestSketchStep,
+                          sketchFinal<TDigestSketch>);
+  sqlite3_create_function(db,
+                          "tdigest_merge",
+                          1,
+                          SQLITE_UTF8,
+                          nullptr,
+                          nullptr,
+                          mergeStep<TDigestSketch>,
+                          sketchFinal<TDigestSketch>);
+  sqlite3_create_function(db,
+                          "tdigest_quantile",
+                          2,
+                          SQLITE_UTF8,
+                          nullptr,
+                          tdigestQuantileFunc,
+                          nullptr,
+                          nullptr);
+  for (int args = 1; args <= 2; args++) {
+    sqlite3_create_function(db,
+                            "topk_sketch",
+                            args,
+                            SQLITE_UTF8,
+                            nullptr,
+                            nullptr,
+                            topkSketchStep,
+                            sketchFinal<TopKSketch>);
+  }
+  sqlite3_create_function(db,
+                          "topk_merge",
+                          1,
+                          SQLITE_UTF8,
+                          nullptr,
+                          nullptr,
+                          mergeStep<TopKSketch>,
+                          sketchFinal<TopKSketch>);
+  sqlite3_create_function(db,
+                          "topk_items",
+                          1,
+                          SQLITE_UTF8,
+                          nullptr,
+                          topkItemsFunc,
+                          nullptr,
+                          nullptr);
+}
+}
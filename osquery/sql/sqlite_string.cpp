@@ -24,6 +24,7 @@
 #include <boost/regex.hpp>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/regex_cache.h"
 
 #include <sqlite3.h>
 
@@ -71,7 +72,15 @@ static SplitResult regexSplit(const std::string& input,
                               const std::string& token) {
   // Split using the token as a regex to support multi-character tokens.
   std::vector<std::string> result;
-  boost::algorithm::split_regex(result, input, boost::regex(token));
+  auto pattern = getCompiledPattern(token);
+  if (pattern == nullptr) {
+    return result;
+  }
+  try {
+    boost::algorithm::split_regex(result, input, *pattern);
+  } catch (const std::runtime_error& /* e */) {
+    result.clear();
+  }
   return result;
 }
 
@@ -124,6 +133,35 @@ static void regexStringSplitFunc(sqlite3_context* context,
   callStringSplitFunc(context, argc, argv, regexSplit);
 }
 
+/**
+ * @brief Implement the SQL REGEXP operator.
+ *
+ * SQLite rewrites `X REGEXP Y` as regexp(Y, X). The value matches if any part
+ * of it matches the regular expression.
+ *
+ * Example:
+ *   SELECT path FROM processes WHERE path REGEXP '^/usr/(s)?bin/';
+ */
+static void regexpFunc(sqlite3_context* context,
+                       int argc,
+                       sqlite3_value** argv) {
+  assert(argc == 2);
+  if (SQLITE_NULL == sqlite3_value_type(argv[0]) ||
+      SQLITE_NULL == sqlite3_value_type(argv[1])) {
+    sqlite3_result_null(context);
+    return;
+  }
+
+  std::string pattern((char*)sqlite3_value_text(argv[0]));
+  if (getCompiledPattern(pattern) == nullptr) {
+    sqlite3_result_error(context, "Invalid regular expression", -1);
+    return;
+  }
+
+  std::string value((char*)sqlite3_value_text(argv[1]));
+  sqlite3_result_int(context, patternMatches(pattern, value) ? 1 : 0);
+}
+
 /**
  * @brief Convert an IPv4 string address to decimal.
  */
@@ -169,6 +207,14 @@ void registerStringExtensions(sqlite3* db) {
                           regexStringSplitFunc,
                           nullptr,
                           nullptr);
+  sqlite3_create_function(db,
+                          "regexp",
+                          2,
+                          SQLITE_UTF8,
+                          nullptr,
+                          regexpFunc,
+                          nullptr,
+                          nullptr);
   sqlite3_create_function(db,
                           "inet_aton",
                           1,
@@ -8,11 +8,15 @@
  *
  */
 
+#include <algorithm>
+#include <set>
+
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/query_deadline.h"
 #include "osquery/sql/sqlite_util.h"
 #include "osquery/sql/virtual_table.h"
 
@@ -28,6 +32,31 @@ FLAG(string,
      "Not Specified",
      "Comma-delimited list of table names to be disabled");
 
+FLAG(bool,
+     sqlite_managed_memory,
+     false,
+     "Keep SQLite lookaside and page-cache memory between queries");
+
+FLAG(uint64,
+     sqlite_lookaside_slot_size,
+     128,
+     "Bytes in each lookaside slot of a connection (managed memory)");
+
+FLAG(uint64,
+     sqlite_lookaside_slots,
+     256,
+     "Lookaside slots preallocated for each connection (managed memory)");
+
+FLAG(uint64,
+     sqlite_page_cache_pages,
+     512,
+     "Pages in the page-cache pool shared by connections (managed memory)");
+
+FLAG(uint64,
+     sqlite_soft_heap_limit,
+     32,
+     "SQLite soft heap limit in MB, 0 for no limit (managed memory)");
+
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
 
 /**
@@ -130,34 +159,47 @@ Status SQLiteSQLPlugin::getQueryColumns(const std::string& q,
   return getQueryColumnsInternal(q, columns, dbc->db());
 }
 
-SQLInternal::SQLInternal(const std::string& q) {
-  auto dbc = SQLiteDBManager::get();
-  status_ = queryInternal(q, results_, dbc->db());
+SQLInternal::SQLInternal(const std::string& q)
+    : SQLInternal(q, SQLiteDBManager::get()) {}
+
+SQLInternal::SQLInternal(const std::string& q,
+                         const SQLiteDBInstanceRef& dbc) {
+  status_ = dbc->queryPrepared(q, results_, &bytes_);
 
   // One of the advantages of using SQLInternal (aside from the Registry-bypass)
   // is the ability to "deep-inspect" the table attributes and actions.
   event_based_ = (dbc->getAttributes() & TableAttributes::EVENT_BASED) != 0;
+  change_feeds_ = dbc->getChangeFeeds();
+  dbc->getCacheResults(cache_hits_, cache_misses_);
 
   dbc->clearAffectedTables();
 }
 
 Status SQLiteSQLPlugin::attach(const std::string& name) {
   PluginResponse response;
-  auto status =
-      Registry::call("table", name, {{"action", "columns"}}, response);
+  auto status = getTableColumns(name, response);
   if (!status.ok()) {
     return status;
   }
 
   auto statement = columnDefinition(response);
+  if (SQLiteDBManager::deferTable(name, statement)) {
+    // The table is attached with others when the attach hold is released.
+    return Status(0, "OK");
+  }
+
   // Attach requests occurring via the plugin/registry APIs must act on the
   // primary database. To allow this, getConnection can explicitly request the
   // primary instance and avoid the contention decisions.
   auto dbc = SQLiteDBManager::getConnection(true);
+  // Statements prepared before this table existed may prefer other plans.
+  SQLiteDBManager::resetStatements();
   return attachTableInternal(name, statement, dbc);
 }
 
 void SQLiteSQLPlugin::detach(const std::string& name) {
+  SQLiteDBManager::removeDeferred(name);
+  SQLiteDBManager::resetStatements();
   auto dbc = SQLiteDBManager::get();
   if (!dbc->isPrimary()) {
     return;
@@ -165,19 +207,84 @@ void SQLiteSQLPlugin::detach(const std::string& name) {
   detachTableInternal(name, dbc->db());
 }
 
-SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db, std::mutex& mtx)
-    : db_(db), lock_(mtx, std::try_to_lock) {
-  if (lock_.owns_lock()) {
-    primary_ = true;
-  } else {
-    db_ = nullptr;
-    VLOG(1) << "DBManager contention: opening transient SQLite database";
-    init();
+SQLiteDBInstance::SQLiteDBInstance(sqlite3*& db,
+                                   std::unique_lock<std::mutex> lock)
+    : primary_(true), db_(db), lock_(std::move(lock)) {}
+
+/// The virtual machine instructions between checks of a query's deadline.
+const int kQueryProgressOps{10000};
+
+/// The status message of a query stopped at its deadline.
+const std::string kQueryCancelledMessage{"Query cancelled at its deadline"};
+
+/// A progress handler returning non-zero interrupts the statement.
+static int queryProgress(void*) {
+  return (isQueryCancelled()) ? 1 : 0;
+}
+
+/// The page size of the in-memory databases, used to size the pool slots.
+const int kSQLitePageSize{4096};
+
+/// The page-cache pool, handed to SQLite before it is initialized.
+static std::vector<char> kPageCachePool;
+
+/// Open connections, and the sequence number given to each.
+static Mutex kConnectionsMutex;
+static std::map<sqlite3*, size_t> kConnections;
+static size_t kConnectionSequence{0};
+
+/**
+ * @brief Configure the SQLite memory allocator for managed memory.
+ *
+ * The page-cache pool and the default lookaside can only be set before
+ * SQLite is initialized, the first database opened in the process does that.
+ * Pages that do not fit in the pool are allocated with malloc.
+ */
+static void configureManagedMemory() {
+  auto pages = static_cast<int>(FLAGS_sqlite_page_cache_pages);
+  if (pages > 0) {
+    int header = 0;
+#if SQLITE_VERSION_NUMBER >= 3008008
+    if (sqlite3_config(SQLITE_CONFIG_PCACHE_HDRSZ, &header) != SQLITE_OK) {
+      LOG(WARNING) << "SQLite was initialized before its page cache was set";
+      pages = 0;
+    }
+#endif
+    auto slot = kSQLitePageSize + header;
+    kPageCachePool.resize(static_cast<size_t>(slot) * pages);
+    if (pages > 0 &&
+        sqlite3_config(SQLITE_CONFIG_PAGECACHE,
+                       kPageCachePool.data(),
+                       slot,
+                       pages) != SQLITE_OK) {
+      LOG(WARNING) << "Cannot configure the SQLite page-cache pool";
+      pages = 0;
+    }
+    if (pages == 0) {
+      kPageCachePool.clear();
+      kPageCachePool.shrink_to_fit();
+    }
   }
+
+  sqlite3_soft_heap_limit64(
+      static_cast<sqlite3_int64>(FLAGS_sqlite_soft_heap_limit) * 1024 * 1024);
 }
 
 static inline void openOptimized(sqlite3*& db) {
   sqlite3_open(":memory:", &db);
+  {
+    WriteLock lock(kConnectionsMutex);
+    kConnections[db] = ++kConnectionSequence;
+  }
+
+  // Lookaside is set before the connection allocates from it.
+  if (FLAGS_sqlite_managed_memory && FLAGS_sqlite_lookaside_slots > 0) {
+    sqlite3_db_config(db,
+                      SQLITE_DBCONFIG_LOOKASIDE,
+                      nullptr,
+                      static_cast<int>(FLAGS_sqlite_lookaside_slot_size),
+                      static_cast<int>(FLAGS_sqlite_lookaside_slots));
+  }
 
   std::string settings;
   for (const auto& setting : kMemoryDBSettings) {
@@ -188,6 +295,20 @@ static inline void openOptimized(sqlite3*& db) {
   // Register function extensions.
   registerMathExtensions(db);
   registerStringExtensions(db);
+  registerSketchExtensions(db);
+
+  // Queries with a deadline are interrupted, see QueryDeadlineScope.
+  sqlite3_progress_handler(db, kQueryProgressOps, queryProgress, nullptr);
+}
+
+static inline void closeOptimized(sqlite3*& db) {
+  {
+    // Counters are not read from a connection that is closing.
+    WriteLock lock(kConnectionsMutex);
+    kConnections.erase(db);
+  }
+  sqlite3_close(db);
+  db = nullptr;
 }
 
 void SQLiteDBInstance::init() {
@@ -214,6 +335,43 @@ TableAttributes SQLiteDBInstance::getAttributes() const {
   return attributes;
 }
 
+std::vector<std::string> SQLiteDBInstance::getChangeFeeds() const {
+  const SQLiteDBInstance* rdbc = this;
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the connection may be forwarded.
+    rdbc = SQLiteDBManager::getConnection(true).get();
+  }
+
+  std::set<std::string> feeds;
+  for (const auto& table : rdbc->affected_tables_) {
+    if (table.second->change_feed.empty()) {
+      // Changes to this table's rows are not followed.
+      return {};
+    }
+    feeds.insert(table.second->change_feed);
+  }
+  return std::vector<std::string>(feeds.begin(), feeds.end());
+}
+
+void SQLiteDBInstance::addCacheResult(bool hit) {
+  if (hit) {
+    cache_hits_++;
+  } else {
+    cache_misses_++;
+  }
+}
+
+void SQLiteDBInstance::getCacheResults(size_t& hits, size_t& misses) const {
+  const SQLiteDBInstance* rdbc = this;
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the connection may be forwarded.
+    rdbc = SQLiteDBManager::getConnection(true).get();
+  }
+
+  hits = rdbc->cache_hits_;
+  misses = rdbc->cache_misses_;
+}
+
 void SQLiteDBInstance::clearAffectedTables() {
   if (isPrimary() && !managed_) {
     // A primary instance must forward clear requests to the DB manager's
@@ -223,24 +381,195 @@ void SQLiteDBInstance::clearAffectedTables() {
   }
 
   for (const auto& table : affected_tables_) {
-    table.second->constraints.clear();
     table.second->cache.clear();
+    table.second->memo.clear();
   }
   // Since the affected tables are cleared, there are no more affected tables.
   // There is no concept of compounding tables between queries.
   affected_tables_.clear();
+  cache_hits_ = 0;
+  cache_misses_ = 0;
+}
+
+/// The maximum number of prepared statements cached per connection.
+const size_t kMaxPreparedStatements{128};
+
+/// Incremented to invalidate every connection's prepared statements.
+static std::atomic<size_t> kStatementsGeneration{0};
+
+void SQLiteDBManager::resetStatements() {
+  kStatementsGeneration++;
+}
+
+/// Check if only whitespace or a statement terminator remains.
+static inline bool isStatementTail(const char* tail) {
+  for (; tail != nullptr && *tail != 0; ++tail) {
+    if (!isspace(*tail) && *tail != ';') {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// Copy the result column names of a statement.
+static void readColumnNames(sqlite3_stmt* stmt,
+                            std::vector<std::string>& columns) {
+  auto count = sqlite3_column_count(stmt);
+  columns.clear();
+  columns.reserve(count);
+  for (int i = 0; i < count; i++) {
+    auto name = sqlite3_column_name(stmt, i);
+    columns.push_back((name != nullptr) ? name : "");
+  }
+}
+
+/**
+ * @brief Step a statement and accumulate each result row.
+ *
+ * Values are read using their storage class; integers are formatted directly
+ * and text is copied using its known length. NULL becomes an empty string.
+ * The optional byte count adds the size of each row's names and values.
+ *
+ * @return The final sqlite3_step return code, SQLITE_DONE on success.
+ */
+static int stepStatement(sqlite3_stmt* stmt,
+                         const std::vector<std::string>& columns,
+                         QueryData& results,
+                         size_t* bytes = nullptr) {
+  int rc = SQLITE_OK;
+  int count = static_cast<int>(columns.size());
+  size_t names = 0;
+  for (const auto& column : columns) {
+    names += column.size();
+  }
+
+  while ((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+    results.emplace_back();
+    auto& r = results.back();
+    size_t values = 0;
+    for (int i = 0; i < count; i++) {
+      auto& value = r[columns[i]];
+      switch (sqlite3_column_type(stmt, i)) {
+      case SQLITE_INTEGER:
+        value = std::to_string(sqlite3_column_int64(stmt, i));
+        break;
+      case SQLITE_NULL:
+        value.clear();
+        break;
+      default: {
+        // Floats use the SQLite text representation.
+        auto text = (const char*)sqlite3_column_text(stmt, i);
+        if (text != nullptr) {
+          value.assign(text, sqlite3_column_bytes(stmt, i));
+        } else {
+          value.clear();
+        }
+        break;
+      }
+      }
+      values += value.size();
+    }
+
+    if (bytes != nullptr) {
+      *bytes += names + values;
+    }
+  }
+  return rc;
+}
+
+Status SQLiteDBInstance::queryPrepared(const std::string& q,
+                                       QueryData& results,
+                                       size_t* bytes) {
+  if (isPrimary() && !managed_) {
+    // Similarly to clearAffectedTables, the statements belong to the manager's
+    // 'connection' instance. This instance holds the primary database lock.
+    return SQLiteDBManager::getConnection(true)->queryPrepared(
+        q, results, bytes);
+  }
+
+  if (statements_generation_ != kStatementsGeneration ||
+      statements_.size() >= kMaxPreparedStatements) {
+    for (auto& statement : statements_) {
+      sqlite3_finalize(statement.second.stmt);
+    }
+    statements_.clear();
+    statements_generation_ = kStatementsGeneration;
+  }
+
+  auto cached = statements_.find(q);
+  if (cached == statements_.end()) {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    auto rc = sqlite3_prepare_v2(
+        db_, q.c_str(), static_cast<int>(q.size()), &stmt, &tail);
+    if (rc != SQLITE_OK || stmt == nullptr) {
+      if (stmt != nullptr) {
+        sqlite3_finalize(stmt);
+      }
+      return Status(1,
+                    "Error running query: " + std::string(sqlite3_errmsg(db_)));
+    }
+
+    if (!isStatementTail(tail)) {
+      // Multiple statements are executed in sequence, without caching.
+      sqlite3_finalize(stmt);
+      auto existing = results.size();
+      auto status = queryInternal(q, results, db_);
+      for (size_t i = existing; bytes != nullptr && i < results.size(); ++i) {
+        for (const auto& column : results[i]) {
+          *bytes += column.first.size() + column.second.size();
+        }
+      }
+      return status;
+    }
+
+    cached = statements_.insert(std::make_pair(q, PreparedStatement())).first;
+    cached->second.stmt = stmt;
+    readColumnNames(stmt, cached->second.columns);
+  }
+
+  auto& statement = cached->second;
+  auto existing = results.size();
+  results.reserve(existing + statement.rows);
+  auto rc = stepStatement(statement.stmt, statement.columns, results, bytes);
+  statement.rows = results.size() - existing;
+
+  Status status;
+  if (isQueryCancelled()) {
+    // Generators stop early when cancelled, discard the partial results.
+    status = Status(1, kQueryCancelledMessage);
+    results.erase(results.begin() + existing, results.end());
+  } else if (rc != SQLITE_DONE) {
+    status =
+        Status(1, "Error running query: " + std::string(sqlite3_errmsg(db_)));
+  }
+  sqlite3_reset(statement.stmt);
+  if (!FLAGS_sqlite_managed_memory) {
+    sqlite3_db_release_memory(db_);
+  }
+  return status;
 }
 
 SQLiteDBInstance::~SQLiteDBInstance() {
+  for (auto& statement : statements_) {
+    sqlite3_finalize(statement.second.stmt);
+  }
+  statements_.clear();
+
   if (!isPrimary()) {
-    sqlite3_close(db_);
+    closeOptimized(db_);
   } else {
     db_ = nullptr;
   }
 }
 
 SQLiteDBManager::SQLiteDBManager() : db_(nullptr) {
-  sqlite3_soft_heap_limit64(1);
+  if (FLAGS_sqlite_managed_memory) {
+    configureManagedMemory();
+  } else {
+    // Release memory as aggressively as possible.
+    sqlite3_soft_heap_limit64(1);
+  }
   setDisabledTables(Flag::getValue("disable_tables"));
 }
 
@@ -249,6 +578,54 @@ bool SQLiteDBManager::isDisabled(const std::string& table_name) {
   return (element != instance().disabled_tables_.end());
 }
 
+void SQLiteDBManager::deferAttach() {
+  auto& self = instance();
+  std::lock_guard<std::mutex> lock(self.deferred_mutex_);
+  self.attach_holds_++;
+}
+
+Status SQLiteDBManager::attachDeferred() {
+  auto& self = instance();
+  std::vector<std::pair<std::string, std::string>> tables;
+  {
+    std::lock_guard<std::mutex> lock(self.deferred_mutex_);
+    if (self.attach_holds_ > 0) {
+      self.attach_holds_--;
+    }
+    if (self.attach_holds_ > 0 || self.deferred_.empty()) {
+      return Status(0, "OK");
+    }
+    tables.swap(self.deferred_);
+  }
+
+  VLOG(1) << "Attaching " << tables.size() << " deferred tables";
+  auto dbc = getConnection(true);
+  resetStatements();
+  return attachTablesInternal(tables, dbc);
+}
+
+bool SQLiteDBManager::deferTable(const std::string& name,
+                                 const std::string& statement) {
+  auto& self = instance();
+  std::lock_guard<std::mutex> lock(self.deferred_mutex_);
+  if (self.attach_holds_ == 0) {
+    return false;
+  }
+  self.deferred_.push_back(std::make_pair(name, statement));
+  return true;
+}
+
+void SQLiteDBManager::removeDeferred(const std::string& name) {
+  auto& self = instance();
+  std::lock_guard<std::mutex> lock(self.deferred_mutex_);
+  for (auto it = self.deferred_.begin(); it != self.deferred_.end(); ++it) {
+    if (it->first == name) {
+      self.deferred_.erase(it);
+      break;
+    }
+  }
+}
+
 void SQLiteDBManager::setDisabledTables(const std::string& list) {
   const auto& tables = split(list, ",");
   disabled_tables_ =
@@ -261,6 +638,51 @@ SQLiteDBInstanceRef SQLiteDBManager::getUnique() {
   return instance;
 }
 
+/// The max number of idle connections kept for getPooled.
+const size_t kMaxPooledConnections{4};
+
+SQLiteDBInstanceRef SQLiteDBManager::getPooled() {
+  auto& self = instance();
+  auto generation = Registry::generation();
+  std::unique_ptr<SQLiteDBInstance> pooled;
+  {
+    std::unique_lock<std::mutex> lock(self.pool_mutex_);
+    while (pooled == nullptr && !self.pool_.empty()) {
+      // Connections attached before the registry changed are closed.
+      if (self.pool_.back()->generation_ == generation) {
+        pooled = std::move(self.pool_.back());
+      }
+      self.pool_.pop_back();
+    }
+  }
+
+  bool attach = (pooled == nullptr);
+  if (attach) {
+    pooled.reset(new SQLiteDBInstance());
+    pooled->generation_ = generation;
+  }
+
+  auto instance = SQLiteDBInstanceRef(pooled.release(), &release);
+  if (attach) {
+    attachVirtualTables(instance);
+  }
+  return instance;
+}
+
+void SQLiteDBManager::release(SQLiteDBInstance* instance) {
+  std::unique_ptr<SQLiteDBInstance> pooled(instance);
+  // The next user of the connection starts without this query's table state.
+  pooled->clearAffectedTables();
+
+  // The lock is released before an unused connection is closed.
+  auto& self = SQLiteDBManager::instance();
+  std::unique_lock<std::mutex> lock(self.pool_mutex_);
+  if (pooled->generation_ == Registry::generation() &&
+      self.pool_.size() < kMaxPooledConnections) {
+    self.pool_.push_back(std::move(pooled));
+  }
+}
+
 SQLiteDBInstanceRef SQLiteDBManager::getConnection(bool primary) {
   auto& self = instance();
   std::unique_lock<std::mutex> lock(self.create_mutex_);
@@ -278,21 +700,91 @@ SQLiteDBInstanceRef SQLiteDBManager::getConnection(bool primary) {
   }
 
   // Create a 'database connection' for the managed database instance.
-  auto instance = std::make_shared<SQLiteDBInstance>(self.db_, self.mutex_);
-  if (!instance->isPrimary()) {
-    attachVirtualTables(instance);
+  std::unique_lock<std::mutex> primary_lock(self.mutex_, std::try_to_lock);
+  if (!primary_lock.owns_lock()) {
+    VLOG(1) << "DBManager contention: using a pooled SQLite database";
+    lock.unlock();
+    return getPooled();
   }
-  return instance;
+  return std::make_shared<SQLiteDBInstance>(self.db_, std::move(primary_lock));
 }
 
 SQLiteDBManager::~SQLiteDBManager() {
   connection_ = nullptr;
   if (db_ != nullptr) {
-    sqlite3_close(db_);
-    db_ = nullptr;
+    closeOptimized(db_);
   }
 }
 
+/// Process counters from sqlite3_status.
+const std::vector<std::pair<std::string, int>> kSQLiteStatusCounters = {
+    {"memory_used", SQLITE_STATUS_MEMORY_USED},
+    {"malloc_size", SQLITE_STATUS_MALLOC_SIZE},
+    {"malloc_count", SQLITE_STATUS_MALLOC_COUNT},
+    {"pagecache_used", SQLITE_STATUS_PAGECACHE_USED},
+    {"pagecache_overflow", SQLITE_STATUS_PAGECACHE_OVERFLOW},
+    {"pagecache_size", SQLITE_STATUS_PAGECACHE_SIZE},
+};
+
+/// Connection counters from sqlite3_db_status.
+const std::vector<std::pair<std::string, int>> kSQLiteDBStatusCounters = {
+    {"lookaside_used", SQLITE_DBSTATUS_LOOKASIDE_USED},
+    {"lookaside_hit", SQLITE_DBSTATUS_LOOKASIDE_HIT},
+    {"lookaside_miss_size", SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE},
+    {"lookaside_miss_full", SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL},
+    {"cache_used", SQLITE_DBSTATUS_CACHE_USED},
+    {"cache_hit", SQLITE_DBSTATUS_CACHE_HIT},
+    {"cache_miss", SQLITE_DBSTATUS_CACHE_MISS},
+    {"cache_write", SQLITE_DBSTATUS_CACHE_WRITE},
+    {"schema_used", SQLITE_DBSTATUS_SCHEMA_USED},
+    {"stmt_used", SQLITE_DBSTATUS_STMT_USED},
+};
+
+std::vector<SQLiteMemoryStat> getSQLiteMemoryStats() {
+  std::vector<SQLiteMemoryStat> stats;
+  for (const auto& counter : kSQLiteStatusCounters) {
+    SQLiteMemoryStat stat;
+    stat.name = counter.first;
+    stat.scope = "process";
+#if SQLITE_VERSION_NUMBER >= 3008009
+    sqlite3_int64 current = 0;
+    sqlite3_int64 highwater = 0;
+    sqlite3_status64(counter.second, &current, &highwater, 0);
+#else
+    int current = 0;
+    int highwater = 0;
+    sqlite3_status(counter.second, &current, &highwater, 0);
+#endif
+    stat.current = current;
+    stat.highwater = highwater;
+    stats.push_back(std::move(stat));
+  }
+
+  // Each connection's mutex is taken by sqlite3_db_status.
+  WriteLock lock(kConnectionsMutex);
+  std::vector<std::pair<size_t, sqlite3*>> connections;
+  for (const auto& connection : kConnections) {
+    connections.push_back(std::make_pair(connection.second, connection.first));
+  }
+  std::sort(connections.begin(), connections.end());
+  for (const auto& connection : connections) {
+    for (const auto& counter : kSQLiteDBStatusCounters) {
+      SQLiteMemoryStat stat;
+      stat.name = counter.first;
+      stat.scope = "connection";
+      stat.connection = connection.first;
+      int current = 0;
+      int highwater = 0;
+      sqlite3_db_status(
+          connection.second, counter.second, &current, &highwater, 0);
+      stat.current = current;
+      stat.highwater = highwater;
+      stats.push_back(std::move(stat));
+    }
+  }
+  return stats;
+}
+
 QueryPlanner::QueryPlanner(const std::string& query, sqlite3* db) {
   QueryData plan;
   queryInternal("EXPLAIN QUERY PLAN " + query, plan, db);
@@ -358,15 +850,46 @@ int queryDataCallback(void* argument, int argc, char* argv[], char* column[]) {
 }
 
 Status queryInternal(const std::string& q, QueryData& results, sqlite3* db) {
-  char* err = nullptr;
-  sqlite3_exec(db, q.c_str(), queryDataCallback, &results, &err);
-  sqlite3_db_release_memory(db);
-  if (err != nullptr) {
-    auto error_string = std::string(err);
-    sqlite3_free(err);
-    return Status(1, "Error running query: " + error_string);
+  Status status;
+  std::vector<std::string> columns;
+  const char* sql = q.c_str();
+  while (sql != nullptr && *sql != 0) {
+    sqlite3_stmt* stmt = nullptr;
+    const char* tail = nullptr;
+    auto rc = sqlite3_prepare_v2(db, sql, -1, &stmt, &tail);
+    if (rc != SQLITE_OK) {
+      if (stmt != nullptr) {
+        sqlite3_finalize(stmt);
+      }
+      status =
+          Status(1, "Error running query: " + std::string(sqlite3_errmsg(db)));
+      break;
+    }
+
+    sql = tail;
+    if (stmt == nullptr) {
+      // The remaining input was whitespace or a comment.
+      continue;
+    }
+
+    readColumnNames(stmt, columns);
+    rc = stepStatement(stmt, columns, results);
+    if (isQueryCancelled()) {
+      status = Status(1, kQueryCancelledMessage);
+      results.clear();
+      sqlite3_finalize(stmt);
+      break;
+    } else if (rc != SQLITE_DONE) {
+      status =
+          Status(1, "Error running query: " + std::string(sqlite3_errmsg(db)));
+      sqlite3_finalize(stmt);
+      break;
+    }
+    sqlite3_finalize(stmt);
   }
-  return Status(0, "OK");
+
+  sqlite3_db_release_memory(db);
+  return status;
 }
 
 Status getQueryColumnsInternal(const std::string& q,
@@ -14,6 +14,7 @@
 #include <map>
 #include <mutex>
 #include <unordered_set>
+#include <vector>
 
 #include <sqlite3.h>
 
@@ -27,6 +28,18 @@ namespace osquery {
 
 class SQLiteDBManager;
 
+/// A cached prepared statement and the result details reused between steps.
+struct PreparedStatement {
+  /// The prepared statement, finalized by the owning instance.
+  sqlite3_stmt* stmt{nullptr};
+
+  /// The result column names, copied once when the statement is prepared.
+  std::vector<std::string> columns;
+
+  /// The number of rows produced by the last execution, used as a size hint.
+  size_t rows{0};
+};
+
 /**
  * @brief An RAII wrapper around an `sqlite3` object.
  *
@@ -36,14 +49,14 @@ class SQLiteDBManager;
  *
  * If there is resource contention (multiple threads want access to the SQLite
  * abstraction layer), then the SQLiteDBManager will provide a transient
- * SQLiteDBInstance.
+ * SQLiteDBInstance from a pool of connections with the tables attached.
  */
 class SQLiteDBInstance : private boost::noncopyable {
  public:
   SQLiteDBInstance() {
     init();
   }
-  SQLiteDBInstance(sqlite3*& db, std::mutex& mtx);
+  SQLiteDBInstance(sqlite3*& db, std::unique_lock<std::mutex> lock);
   ~SQLiteDBInstance();
 
   /// Check if the instance is the osquery primary.
@@ -68,10 +81,36 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Clear per-query state of a table affected by the use of this instance.
   void clearAffectedTables();
 
+  /// Allow a virtual table implementation to record a result cache lookup.
+  void addCacheResult(bool hit);
+
+  /**
+   * @brief Execute a query using a cached prepared statement.
+   *
+   * Statements are prepared once per connection and query text, then reset
+   * and stepped for each execution. This avoids parsing and planning repeated
+   * queries, such as those in the schedule. A query with multiple statements
+   * is executed without caching.
+   *
+   * @param q An osquery SQL query.
+   * @param results Output, the query results.
+   * @param bytes Optional output, incremented by the size of each row read.
+   * @return An error if the query could not be prepared or executed.
+   */
+  Status queryPrepared(const std::string& q,
+                       QueryData& results,
+                       size_t* bytes = nullptr);
+
  private:
   /// Handle the primary/forwarding requests for table attribute accesses.
   TableAttributes getAttributes() const;
 
+  /// The change feeds of the affected tables, empty if a table has none.
+  std::vector<std::string> getChangeFeeds() const;
+
+  /// Handle the primary/forwarding requests for result cache statistics.
+  void getCacheResults(size_t& hits, size_t& misses) const;
+
  private:
   /// An opaque constructor only used by the DBManager.
   explicit SQLiteDBInstance(sqlite3* db)
@@ -93,12 +132,30 @@ class SQLiteDBInstance : private boost::noncopyable {
   /// Vector of tables that need their constraints cleared after execution.
   std::map<std::string, VirtualTableContent*> affected_tables_;
 
+  /// Table result cache hits since the affected tables were cleared.
+  size_t cache_hits_{0};
+
+  /// Table result cache misses since the affected tables were cleared.
+  size_t cache_misses_{0};
+
+  /// Prepared statements keyed by query text.
+  std::map<std::string, PreparedStatement> statements_;
+
+  /// The statement generation when the prepared statements were created.
+  size_t statements_generation_{0};
+
+  /// The registry generation when a pooled instance was attached.
+  size_t generation_{0};
+
  private:
   friend class SQLiteDBManager;
   friend class SQLInternal;
 
  private:
   FRIEND_TEST(SQLiteUtilTests, test_affected_tables);
+  FRIEND_TEST(SQLiteUtilTests, test_prepared_statements);
+  FRIEND_TEST(SQLiteUtilTests, test_pooled_connections);
+  FRIEND_TEST(SQLiteUtilTests, test_contention_uses_pool);
 };
 
 using SQLiteDBInstanceRef = std::shared_ptr<SQLiteDBInstance>;
@@ -142,6 +199,26 @@ class SQLiteDBManager : private boost::noncopyable {
   /// See `get` but always return a transient DB connection (for testing).
   static SQLiteDBInstanceRef getUnique();
 
+  /**
+   * @brief Return a transient DB connection from a pool of idle connections.
+   *
+   * Queries requested by extensions, and queries run while the primary
+   * database is in use, use pooled connections instead of attaching every
+   * table to a new database. A connection's per-query table state is cleared
+   * when it is released to the pool. Connections attached before a registry
+   * change, such as an extension adding or removing tables, are closed.
+   */
+  static SQLiteDBInstanceRef getPooled();
+
+  /**
+   * @brief Invalidate every connection's prepared statements.
+   *
+   * This is called when tables are attached or detached and when the
+   * configuration, and thus the schedule, is updated. Each connection
+   * finalizes its statements before the next prepared query.
+   */
+  static void resetStatements();
+
   /**
    * @brief Check if `table_name` is disabled.
    *
@@ -153,6 +230,19 @@ class SQLiteDBManager : private boost::noncopyable {
    */
   static bool isDisabled(const std::string& table_name);
 
+  /**
+   * @brief Hold table attaches until every hold is released.
+   *
+   * Extension registration attaches many tables, each a change to the
+   * primary database's schema. While a hold exists, attach requests are
+   * queued and the queued tables are attached with one schema change when
+   * the last hold is released by `attachDeferred`.
+   */
+  static void deferAttach();
+
+  /// Release a hold, attaching the queued tables if it was the last hold.
+  static Status attachDeferred();
+
  protected:
   SQLiteDBManager();
   virtual ~SQLiteDBManager();
@@ -180,14 +270,68 @@ class SQLiteDBManager : private boost::noncopyable {
   /// Parse a comma-delimited set of tables names, passed in as a flag.
   void setDisabledTables(const std::string& s);
 
+  /// Idle transient connections returned by getPooled.
+  std::vector<std::unique_ptr<SQLiteDBInstance>> pool_;
+
+  /// Protect the idle transient connections.
+  std::mutex pool_mutex_;
+
+  /// The number of holds on table attaches.
+  size_t attach_holds_{0};
+
+  /// Tables queued while attaches are held.
+  std::vector<std::pair<std::string, std::string>> deferred_;
+
+  /// Protect the holds and queued tables.
+  std::mutex deferred_mutex_;
+
+  /// Queue a table if attaches are held, otherwise return false.
+  static bool deferTable(const std::string& name, const std::string& statement);
+
+  /// Remove a queued table, used when a table is detached before attaching.
+  static void removeDeferred(const std::string& name);
+
   /// Request a connection, optionally request the primary connection.
   static SQLiteDBInstanceRef getConnection(bool primary = false);
 
+  /// Return a pooled connection to the pool, or close it.
+  static void release(SQLiteDBInstance* instance);
+
  private:
   friend class SQLiteDBInstance;
   friend class SQLiteSQLPlugin;
+
+ private:
+  FRIEND_TEST(SQLiteUtilTests, test_pooled_connections);
+  FRIEND_TEST(SQLiteUtilTests, test_contention_uses_pool);
+  FRIEND_TEST(SQLiteUtilTests, test_deferred_attach);
+};
+
+/// A SQLite memory counter for the process or for one connection.
+struct SQLiteMemoryStat {
+  /// The counter name, such as memory_used or lookaside_hit.
+  std::string name;
+
+  /// Either "process" or "connection".
+  std::string scope;
+
+  /// The connection's sequence number, 0 for process counters.
+  size_t connection{0};
+
+  /// The current value and the highest value SQLite has recorded.
+  int64_t current{0};
+  int64_t highwater{0};
 };
 
+/**
+ * @brief Read the sqlite3_status and sqlite3_db_status counters.
+ *
+ * Process counters are followed by the counters of each open connection,
+ * numbered from 1 in the order they were opened. Hit and miss counters only
+ * have a highwater value.
+ */
+std::vector<SQLiteMemoryStat> getSQLiteMemoryStats();
+
 /**
  * @brief A barebones query planner based on SQLite explain statement results.
  *
@@ -303,6 +447,11 @@ class SQLiteSQLPlugin : SQLPlugin {
 
   /// Detach a virtual table (DROP).
   void detach(const std::string& name) override;
+
+  /// A configuration update may change the schedule, reset statements.
+  void configure() override {
+    SQLiteDBManager::resetStatements();
+  }
 };
 
 /**
@@ -317,6 +466,14 @@ class SQLInternal : public SQL {
    */
   explicit SQLInternal(const std::string& q);
 
+  /**
+   * @brief Instantiate an instance of the class using a specific connection.
+   *
+   * @param q An osquery SQL query.
+   * @param instance A connection, for example one owned by a worker thread.
+   */
+  SQLInternal(const std::string& q, const SQLiteDBInstanceRef& instance);
+
  public:
   /**
    * @brief Check if the SQL query's results use event-based tables.
@@ -333,9 +490,41 @@ class SQLInternal : public SQL {
     return event_based_;
   }
 
+  /// The number of table scans answered by the shared table result cache.
+  size_t cacheHits() const {
+    return cache_hits_;
+  }
+
+  /// The number of cacheable table scans that generated results.
+  size_t cacheMisses() const {
+    return cache_misses_;
+  }
+
+  /// The bytes of column names and values in the results, before escaping.
+  size_t resultBytes() const {
+    return bytes_;
+  }
+
+  /// The change feeds of every table used, empty if any table has none.
+  const std::vector<std::string>& changeFeeds() const {
+    return change_feeds_;
+  }
+
  private:
   /// Before completing the execution, store a check for EVENT_BASED.
   bool event_based_{false};
+
+  /// Before completing the execution, store the result cache statistics.
+  size_t cache_hits_{0};
+
+  /// See SQLInternal::cache_hits_.
+  size_t cache_misses_{0};
+
+  /// Counted while the result rows are read.
+  size_t bytes_{0};
+
+  /// Before completing the execution, store the tables' change feeds.
+  std::vector<std::string> change_feeds_;
 };
 
 /**
@@ -360,4 +549,9 @@ void registerMathExtensions(sqlite3* db);
  * @brief Register string-related 'custom' functions.
  */
 void registerStringExtensions(sqlite3* db);
+
+/**
+ * @brief Register the mergeable approximate aggregate functions.
+ */
+void registerSketchExtensions(sqlite3* db);
 }
@@ -0,0 +1,180 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <osquery/flags.h>
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/core/query_deadline.h"
+#include "osquery/sql/table_cache.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     table_results_cache_ttl,
+     0,
+     "Seconds to share table results between queries (default 0 disables)");
+
+FLAG(uint64,
+     table_results_cache_size,
+     16 * 1024 * 1024,
+     "Maximum estimated bytes of shared table results");
+
+/// Append a length-prefixed field to a cache key.
+static inline void appendField(std::string& key, const std::string& field) {
+  key += std::to_string(field.size());
+  key += ':';
+  key += field;
+}
+
+bool TableResultCache::enabled(TableAttributes attributes) {
+  if (FLAGS_table_results_cache_ttl == 0) {
+    return false;
+  }
+
+  // Event-based results change as events are added and expired, and utility
+  // tables report on osquery itself.
+  return ((attributes & TableAttributes::EVENT_BASED) == 0 &&
+          (attributes & TableAttributes::UTILITY) == 0);
+}
+
+std::string TableResultCache::key(const std::string& table,
+                                  const QueryContext& context) {
+  std::string key;
+  appendField(key, table);
+
+  // The constraint map is ordered by column, order each column's constraints.
+  for (const auto& column : context.constraints) {
+    const auto& list = column.second.getAll();
+    if (list.empty()) {
+      continue;
+    }
+
+    std::vector<std::pair<unsigned char, std::string>> constraints;
+    for (const auto& constraint : list) {
+      constraints.push_back(std::make_pair(constraint.op, constraint.expr));
+    }
+    std::sort(constraints.begin(), constraints.end());
+
+    key += 'c';
+    appendField(key, column.first);
+    for (const auto& constraint : constraints) {
+      key += std::to_string(constraint.first);
+      appendField(key, constraint.second);
+    }
+  }
+
+  // Results generated for a projection may not contain every column.
+  if (context.colsUsed.is_initialized()) {
+    key += 'u';
+    for (const auto& column : *context.colsUsed) {
+      appendField(key, column);
+    }
+  }
+  return key;
+}
+
+size_t TableResultCache::estimateSize(const QueryData& results) {
+  size_t bytes = 0;
+  for (const auto& row : results) {
+    for (const auto& column : row) {
+      bytes += column.first.size() + column.second.size();
+    }
+  }
+  return bytes;
+}
+
+bool TableResultCache::get(const std::string& key, QueryData& results) {
+  WriteLock lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return false;
+  }
+
+  if (getUnixTime() - it->second.time >= FLAGS_table_results_cache_ttl) {
+    // The results are stale.
+    erase(it);
+    return false;
+  }
+
+  results = it->second.results;
+  return true;
+}
+
+void TableResultCache::set(const std::string& key, QueryData results) {
+  auto bytes = estimateSize(results) + key.size();
+  if (bytes > FLAGS_table_results_cache_size) {
+    return;
+  }
+
+  WriteLock lock(mutex_);
+  auto existing = entries_.find(key);
+  if (existing != entries_.end()) {
+    erase(existing);
+  }
+
+  // Evict the oldest results until the new results fit.
+  while (!order_.empty() && bytes_ + bytes > FLAGS_table_results_cache_size) {
+    erase(entries_.find(order_.front()));
+  }
+
+  order_.push_back(key);
+  auto& entry = entries_[key];
+  entry.results = std::move(results);
+  entry.time = getUnixTime();
+  entry.bytes = bytes;
+  entry.order = std::prev(order_.end());
+  bytes_ += bytes;
+}
+
+void TableResultCache::erase(
+    std::map<std::string, TableResultCacheEntry>::iterator it) {
+  bytes_ -= it->second.bytes;
+  order_.erase(it->second.order);
+  entries_.erase(it);
+}
+
+void TableResultCache::clear() {
+  WriteLock lock(mutex_);
+  entries_.clear();
+  order_.clear();
+  bytes_ = 0;
+}
+
+size_t TableResultCache::size() const {
+  WriteLock lock(mutex_);
+  return bytes_;
+}
+
+bool CachingRowGenerator::next(QueryData& batch) {
+  if (!generator_->next(batch)) {
+    // The table is exhausted, the collected results are complete unless the
+    // generator stopped because the query was cancelled.
+    if (!abandoned_ && !isQueryCancelled()) {
+      store(std::move(results_));
+    }
+    return false;
+  }
+
+  if (!abandoned_) {
+    bytes_ += TableResultCache::estimateSize(batch);
+    if (bytes_ > FLAGS_table_results_cache_size) {
+      // Stop collecting, these results will never fit.
+      abandoned_ = true;
+      QueryData().swap(results_);
+    } else {
+      results_.insert(results_.end(), batch.begin(), batch.end());
+    }
+  }
+  return true;
+}
+}
@@ -0,0 +1,168 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <list>
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/// A cached set of table results.
+struct TableResultCacheEntry {
+  /// The complete results of a table scan.
+  QueryData results;
+
+  /// The UNIX time the results were stored.
+  size_t time{0};
+
+  /// The estimated size of the results.
+  size_t bytes{0};
+
+  /// The key's position within the eviction order.
+  std::list<std::string>::iterator order;
+};
+
+/**
+ * @brief A short-lived table result cache shared between queries.
+ *
+ * Several scheduled queries, often from different packs, may scan the same
+ * expensive table within the same second. The cache stores complete table
+ * results keyed by the table name, the normalized set of constraints, and the
+ * set of used columns. Results are reused for a freshness window set by
+ * --table_results_cache_ttl and the cache is bounded by an estimated size in
+ * bytes, evicting the oldest results first.
+ *
+ * Event-based and utility tables are never cached.
+ */
+class TableResultCache : private boost::noncopyable {
+ public:
+  /// Access the process-wide result cache.
+  static TableResultCache& instance() {
+    static TableResultCache cache;
+    return cache;
+  }
+
+  /// Check if a table with the given attributes may use the cache.
+  static bool enabled(TableAttributes attributes);
+
+  /// Create a normalized cache key for a table and query context.
+  static std::string key(const std::string& table, const QueryContext& context);
+
+  /**
+   * @brief Retrieve fresh results for a key.
+   *
+   * @param key A key created with TableResultCache::key.
+   * @param results Output, a copy of the cached results.
+   * @return true if fresh results existed.
+   */
+  bool get(const std::string& key, QueryData& results);
+
+  /// Store the complete results for a key, evicting older results if needed.
+  void set(const std::string& key, QueryData results);
+
+  /// Remove all results.
+  void clear();
+
+  /// The estimated size in bytes of every cached result.
+  size_t size() const;
+
+  /// Estimate the content size in bytes of a set of rows.
+  static size_t estimateSize(const QueryData& results);
+
+ private:
+  TableResultCache() {}
+
+  /// Remove a cached result.
+  void erase(std::map<std::string, TableResultCacheEntry>::iterator it);
+
+ private:
+  /// Cached results keyed by TableResultCache::key.
+  std::map<std::string, TableResultCacheEntry> entries_;
+
+  /// Keys ordered by the time their results were stored, oldest first.
+  std::list<std::string> order_;
+
+  /// The estimated size of all cached results.
+  size_t bytes_{0};
+
+  /// Protect the cache, tables may be scanned concurrently.
+  mutable Mutex mutex_;
+};
+
+/**
+ * @brief Collect a table's rows while handing them to the cursor.
+ *
+ * When the generator is exhausted the complete results are stored in the
+ * TableResultCache. If the cursor stops early, for example because of a
+ * LIMIT, or the results exceed the cache size, nothing is stored.
+ */
+class CachingRowGenerator : public RowGenerator {
+ public:
+  CachingRowGenerator(std::string key, RowGeneratorRef generator)
+      : key_(std::move(key)), generator_(std::move(generator)) {}
+
+  bool next(QueryData& batch) override;
+
+ protected:
+  /// Store the complete results.
+  virtual void store(QueryData results) {
+    TableResultCache::instance().set(key_, std::move(results));
+  }
+
+ protected:
+  /// The cache key for the results.
+  std::string key_;
+
+ private:
+
+  /// The table's generator.
+  RowGeneratorRef generator_;
+
+  /// Rows collected so far.
+  QueryData results_;
+
+  /// The estimated size of the collected rows.
+  size_t bytes_{0};
+
+  /// Set if the results cannot be cached.
+  bool abandoned_{false};
+};
+
+/**
+ * @brief Collect a DETERMINISTIC table's rows into the statement's memo.
+ *
+ * The memo belongs to the table's content and is cleared when the query
+ * completes, see VirtualTableContent::memo.
+ */
+class MemoRowGenerator : public CachingRowGenerator {
+ public:
+  MemoRowGenerator(VirtualTableContent* content,
+                   std::string key,
+                   RowGeneratorRef generator)
+      : CachingRowGenerator(std::move(key), std::move(generator)),
+        content_(content) {}
+
+ protected:
+  void store(QueryData results) override {
+    content_->memo[key_] = std::move(results);
+  }
+
+ private:
+  /// The table content owning the memo.
+  VirtualTableContent* content_{nullptr};
+};
+}
@@ -0,0 +1,198 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <algorithm>
+
+#include <osquery/database.h>
+#include <osquery/registry.h>
+#include <osquery/system.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/sql/table_stats.h"
+
+namespace osquery {
+
+const std::array<uint64_t, 4> kTableStatsBounds = {
+    {1000, 10000, 100000, 1000000}};
+
+/// The weight of a new full scan in a table's estimate.
+const double kEstimateWeight = 0.2;
+
+/// Seconds between writes of a table's estimate.
+const size_t kEstimatePersistInterval = 60;
+
+/// The persistent settings key prefix of table estimates.
+const std::string kEstimateKeyPrefix = "table_stats.";
+
+/// The database may not be available, for example within some tools.
+static bool databaseAvailable() {
+  return Registry::exists("database", Registry::getActive("database"), true);
+}
+
+void TableStats::record(const std::string& table,
+                        uint64_t time,
+                        size_t rows,
+                        bool full) {
+  // The first bucket with a bound above the time, or the last bucket.
+  size_t bucket = std::upper_bound(kTableStatsBounds.begin(),
+                                   kTableStatsBounds.end(),
+                                   time) -
+                  kTableStatsBounds.begin();
+
+  std::string value;
+  {
+    WriteLock lock(mutex_);
+    auto& stats = tables_[table];
+    stats.scans++;
+    stats.rows += rows;
+    stats.total_time += time;
+    stats.max_time = std::max(stats.max_time, time);
+    stats.histogram[bucket]++;
+    if (!full) {
+      return;
+    }
+
+    auto& estimate = estimates_[table];
+    if (!estimate.known) {
+      estimate.rows = static_cast<double>(rows);
+      estimate.time = static_cast<double>(time);
+      estimate.known = true;
+    } else {
+      estimate.rows += kEstimateWeight * (rows - estimate.rows);
+      estimate.time += kEstimateWeight * (time - estimate.time);
+    }
+
+    auto now = getUnixTime();
+    if (now < estimate.persisted + kEstimatePersistInterval) {
+      return;
+    }
+    estimate.persisted = now;
+    value = std::to_string(static_cast<size_t>(estimate.rows)) + ":" +
+            std::to_string(static_cast<size_t>(estimate.time));
+  }
+
+  // Do not hold the lock while writing, the database may be slow.
+  if (databaseAvailable()) {
+    setDatabaseValue(kPersistentSettings, kEstimateKeyPrefix + table, value);
+  }
+}
+
+void TableStats::load(const std::string& table) {
+  {
+    WriteLock lock(mutex_);
+    if (!loaded_.insert(table).second) {
+      return;
+    }
+  }
+
+  std::string value;
+  if (!databaseAvailable() ||
+      !getDatabaseValue(kPersistentSettings, kEstimateKeyPrefix + table, value)
+           .ok()) {
+    return;
+  }
+
+  auto parts = osquery::split(value, ":");
+  unsigned long long rows = 0;
+  unsigned long long time = 0;
+  if (parts.size() != 2 || !safeStrtoull(parts[0], 10, rows).ok() ||
+      !safeStrtoull(parts[1], 10, time).ok()) {
+    return;
+  }
+
+  WriteLock lock(mutex_);
+  auto& estimate = estimates_[table];
+  if (!estimate.known) {
+    // A full scan recorded while reading is newer than the persisted value.
+    estimate.rows = static_cast<double>(rows);
+    estimate.time = static_cast<double>(time);
+    estimate.known = true;
+  }
+}
+
+bool TableStats::estimate(const std::string& table,
+                          double& rows,
+                          double& time) {
+  load(table);
+
+  WriteLock lock(mutex_);
+  auto it = estimates_.find(table);
+  if (it == estimates_.end() || !it->second.known) {
+    return false;
+  }
+  rows = it->second.rows;
+  time = it->second.time;
+  return true;
+}
+
+void TableStats::forEach(
+    std::function<void(const std::string& table,
+                       const TableGenerateStats& stats)> predicate) {
+  // Copy the statistics, the predicate may scan tables.
+  std::map<std::string, TableGenerateStats> tables;
+  {
+    WriteLock lock(mutex_);
+    tables = tables_;
+  }
+
+  for (const auto& table : tables) {
+    predicate(table.first, table.second);
+  }
+}
+
+void TableStats::clear() {
+  WriteLock lock(mutex_);
+  tables_.clear();
+  estimates_.clear();
+  loaded_.clear();
+}
+
+void QueryProfile::start() {
+  WriteLock lock(mutex_);
+  tables_.clear();
+  active_ = true;
+}
+
+std::map<std::string, TableProfileStats> QueryProfile::stop() {
+  WriteLock lock(mutex_);
+  active_ = false;
+  std::map<std::string, TableProfileStats> tables;
+  tables.swap(tables_);
+  return tables;
+}
+
+void QueryProfile::addFilter(const std::string& table,
+                             bool cached,
+                             uint64_t time) {
+  WriteLock lock(mutex_);
+  auto& stats = tables_[table];
+  stats.filters++;
+  if (cached) {
+    stats.cached++;
+  }
+  stats.generate_time += time;
+}
+
+void QueryProfile::addRows(const std::string& table,
+                           size_t rows,
+                           size_t bytes,
+                           uint64_t time) {
+  WriteLock lock(mutex_);
+  auto& stats = tables_[table];
+  stats.generated += rows;
+  stats.bytes += bytes;
+  stats.generate_time += time;
+}
+
+void QueryProfile::addConsumed(const std::string& table) {
+  WriteLock lock(mutex_);
+  tables_[table].consumed++;
+}
+}
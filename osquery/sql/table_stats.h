@@ -0,0 +1,197 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <set>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+
+namespace osquery {
+
+/// Upper bounds in microseconds of each generate time bucket but the last.
+extern const std::array<uint64_t, 4> kTableStatsBounds;
+
+/// Generate performance for one table.
+struct TableGenerateStats {
+  /// Number of scans that generated rows, scans using cached results are not
+  /// counted.
+  size_t scans{0};
+
+  /// Total rows generated.
+  size_t rows{0};
+
+  /// Total microseconds spent generating rows.
+  uint64_t total_time{0};
+
+  /// The longest scan in microseconds.
+  uint64_t max_time{0};
+
+  /// Scans counted by generate time, see kTableStatsBounds.
+  std::array<size_t, 5> histogram{{0, 0, 0, 0, 0}};
+};
+
+/**
+ * @brief Process-wide generate times for each table.
+ *
+ * The virtual table cursor times the table's row generation, the call into
+ * the table plugin and each batch pulled from its generator, but not the time
+ * SQLite spends filtering and joining rows. Each scan is recorded when the
+ * cursor is filtered again or closed.
+ */
+class TableStats : private boost::noncopyable {
+ public:
+  /// Access the process-wide table statistics.
+  static TableStats& instance() {
+    static TableStats stats;
+    return stats;
+  }
+
+  /**
+   * @brief Record a completed scan of a table.
+   *
+   * @param full Set if the scan had no constraints, the rows and time are
+   * used as the table's planner estimate.
+   */
+  void record(const std::string& table,
+              uint64_t time,
+              size_t rows,
+              bool full = false);
+
+  /**
+   * @brief The planner's estimate of a table's unconstrained scan.
+   *
+   * Estimates are moving averages of full scans. They are persisted in the
+   * database so a restarted daemon plans with the previous process's
+   * measurements.
+   *
+   * @param rows Output, the expected rows generated.
+   * @param time Output, the expected generate microseconds.
+   * @return true if the table has a recorded or persisted full scan.
+   */
+  bool estimate(const std::string& table, double& rows, double& time);
+
+  /// Iterate each table with recorded scans.
+  void forEach(std::function<void(const std::string& table,
+                                  const TableGenerateStats& stats)> predicate);
+
+  /// Remove all statistics and estimates, persisted estimates are reloaded.
+  void clear();
+
+ private:
+  TableStats() {}
+
+  /// Read a table's persisted estimate once.
+  void load(const std::string& table);
+
+ private:
+  /// A moving average of a table's full scans.
+  struct TableEstimate {
+    double rows{0};
+    double time{0};
+
+    /// Set once a full scan is recorded or a persisted estimate is read.
+    bool known{false};
+
+    /// The last time, in seconds, the estimate was written to the database.
+    size_t persisted{0};
+  };
+
+  /// Statistics keyed by table name.
+  std::map<std::string, TableGenerateStats> tables_;
+
+  /// Planner estimates keyed by table name.
+  std::map<std::string, TableEstimate> estimates_;
+
+  /// Tables with a persisted estimate read, or attempted.
+  std::set<std::string> loaded_;
+
+  /// Protect the statistics, tables may be scanned concurrently.
+  Mutex mutex_;
+};
+
+/// Counters for one table during a profiled query, see QueryProfile.
+struct TableProfileStats {
+  /// Number of xFilter calls, an inner table of a join is filtered per row.
+  size_t filters{0};
+
+  /// Filters answered by the statement's memo or the table result cache.
+  size_t cached{0};
+
+  /// Rows produced by the table's generator or a cache.
+  size_t generated{0};
+
+  /// Rows SQLite visited, fewer than generated if a scan ended early.
+  size_t consumed{0};
+
+  /// Microseconds spent calling the table and pulling its batches.
+  uint64_t generate_time{0};
+
+  /// Bytes of column names and values in the produced rows.
+  size_t bytes{0};
+};
+
+/**
+ * @brief Per-table counters for the queries run by the shell's profile mode.
+ *
+ * Unlike TableStats, which aggregates every scan for the life of the process,
+ * a profile is started before a query and read when it completes. Cursors
+ * only count while a profile is active.
+ */
+class QueryProfile : private boost::noncopyable {
+ public:
+  static QueryProfile& instance() {
+    static QueryProfile profile;
+    return profile;
+  }
+
+  /// Clear the counters and start counting.
+  void start();
+
+  /// Stop counting and return the counters of each scanned table.
+  std::map<std::string, TableProfileStats> stop();
+
+  /// Check if cursors should count, read once per filter.
+  bool active() const {
+    return active_;
+  }
+
+  /// Count a filter and the time spent calling the table.
+  void addFilter(const std::string& table, bool cached, uint64_t time);
+
+  /// Count a batch of produced rows.
+  void addRows(const std::string& table,
+               size_t rows,
+               size_t bytes,
+               uint64_t time);
+
+  /// Count a row visited by SQLite.
+  void addConsumed(const std::string& table);
+
+ private:
+  QueryProfile() {}
+
+ private:
+  std::atomic<bool> active_{false};
+
+  /// Counters keyed by table name.
+  std::map<std::string, TableProfileStats> tables_;
+
+  Mutex mutex_;
+};
+}
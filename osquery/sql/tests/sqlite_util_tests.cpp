@@ -15,8 +15,10 @@
 #include <osquery/core.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/query_deadline.h"
 #include "osquery/tests/test_util.h"
 #include "osquery/sql/sqlite_util.h"
+#include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
@@ -64,6 +66,64 @@ TEST_F(SQLiteUtilTests, test_sqlite_instance) {
   EXPECT_EQ(internal_db, SQLiteDBManager::get()->db());
 }
 
+TEST_F(SQLiteUtilTests, test_regexp_function) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT username FROM test_table WHERE username REGEXP '^ma'",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["username"], "matt");
+
+  results.clear();
+  status = queryInternal(
+      "SELECT regex_split('a1b22c', '[0-9]+', 2) AS part", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["part"], "c");
+
+  // An invalid expression is a query error.
+  results.clear();
+  status = queryInternal(
+      "SELECT 1 WHERE 'a' REGEXP '(unclosed'", results, dbc->db());
+  EXPECT_FALSE(status.ok());
+}
+
+TEST_F(SQLiteUtilTests, test_sketch_functions) {
+  auto dbc = getTestDBC();
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT hll_count(hll_sketch(username)) AS users, "
+      "CAST(tdigest_quantile(tdigest_sketch(age), 1) AS INTEGER) AS oldest, "
+      "topk_items(topk_sketch(username, 1)) AS top FROM test_table",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["users"], "2");
+  EXPECT_EQ(results[0]["oldest"], "24");
+  EXPECT_EQ(results[0]["top"].find("{\"value\":\"m"), 1U);
+
+  // Sketches of separate queries merge into a sketch of the combined rows.
+  results.clear();
+  status = queryInternal(
+      "SELECT hll_count(hll_merge(users)) AS users FROM ("
+      "SELECT hll_sketch(username) AS users FROM test_table UNION ALL "
+      "SELECT hll_sketch('mike') UNION ALL SELECT hll_sketch('other'))",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["users"], "3");
+
+  // A value that is not a sketch is a query error.
+  results.clear();
+  status = queryInternal("SELECT hll_count('invalid')", results, dbc->db());
+  EXPECT_FALSE(status.ok());
+}
+
 TEST_F(SQLiteUtilTests, test_direct_query_execution) {
   auto dbc = getTestDBC();
   QueryData results;
@@ -115,10 +175,237 @@ TEST_F(SQLiteUtilTests, test_affected_tables) {
 
   // Since the table scanned from "time", it should be recorded as affected.
   EXPECT_EQ(dbc->affected_tables_.count("time"), 1U);
+
+  // The time table has no change feed.
+  EXPECT_TRUE(dbc->getChangeFeeds().empty());
+  dbc->affected_tables_.at("time")->change_feed = "time_events";
+  EXPECT_EQ(dbc->getChangeFeeds(), std::vector<std::string>{"time_events"});
+  dbc->affected_tables_.at("time")->change_feed.clear();
+
   dbc->clearAffectedTables();
   EXPECT_EQ(dbc->affected_tables_.size(), 0U);
 }
 
+TEST_F(SQLiteUtilTests, test_result_bytes) {
+  auto dbc = getTestDBC();
+
+  // Each row adds the size of its column names and values.
+  QueryData results;
+  size_t bytes = 0;
+  EXPECT_TRUE(
+      dbc->queryPrepared("SELECT 'abc' AS name, 12 AS n", results, &bytes));
+  EXPECT_EQ(bytes, 10U);
+
+  // Multiple statements are counted after they are executed.
+  results.clear();
+  bytes = 0;
+  EXPECT_TRUE(dbc->queryPrepared(
+      "SELECT 'a' AS x; SELECT 'bc' AS y", results, &bytes));
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(bytes, 5U);
+
+  SQLInternal sql("SELECT 'abc' AS name, 12 AS n", dbc);
+  EXPECT_EQ(sql.resultBytes(), 10U);
+}
+
+TEST_F(SQLiteUtilTests, test_prepared_statements) {
+  auto dbc = getTestDBC();
+  std::string query = "SELECT * FROM test_table WHERE age > 23";
+
+  QueryData results;
+  auto status = dbc->queryPrepared(query, results);
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["username"], "matt");
+  EXPECT_EQ(dbc->statements_.count(query), 1U);
+
+  // The cached statement is reset and produces the same results.
+  QueryData cached_results;
+  status = dbc->queryPrepared(query, cached_results);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(cached_results, results);
+  EXPECT_EQ(dbc->statements_.size(), 1U);
+
+  // Constraints on virtual tables still apply to cached plans.
+  std::string vtable_query = "SELECT * FROM time WHERE seconds >= 0";
+  status = dbc->queryPrepared(vtable_query, results);
+  ASSERT_TRUE(status.ok());
+  status = dbc->queryPrepared(vtable_query, results);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(dbc->statements_.size(), 2U);
+
+  // Multiple statements are not cached.
+  results.clear();
+  status = dbc->queryPrepared("SELECT 1; SELECT 2", results);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(dbc->statements_.size(), 2U);
+
+  // Errors are reported and not cached.
+  status = dbc->queryPrepared("SELECT * FROM does_not_exist", results);
+  EXPECT_FALSE(status.ok());
+  EXPECT_EQ(dbc->statements_.size(), 2U);
+
+  // After a reset the statements are finalized before the next query.
+  SQLiteDBManager::resetStatements();
+  results.clear();
+  status = dbc->queryPrepared(query, results);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 1U);
+  EXPECT_EQ(dbc->statements_.size(), 1U);
+}
+
+TEST_F(SQLiteUtilTests, test_pooled_connections) {
+  auto& pool = SQLiteDBManager::instance().pool_;
+  pool.clear();
+
+  auto primary = SQLiteDBManager::get();
+  auto dbc1 = SQLiteDBManager::getPooled();
+  auto dbc2 = SQLiteDBManager::getPooled();
+  EXPECT_FALSE(dbc1->isPrimary());
+  EXPECT_NE(dbc1->db(), primary->db());
+  EXPECT_NE(dbc1->db(), dbc2->db());
+
+  // Pooled connections have the virtual tables attached.
+  SQLInternal sql("SELECT * FROM time", dbc1);
+  EXPECT_TRUE(sql.ok());
+  EXPECT_EQ(sql.rows().size(), 1U);
+
+  // A released connection is reused.
+  auto db = dbc1->db();
+  dbc1.reset();
+  dbc1 = SQLiteDBManager::getPooled();
+  EXPECT_EQ(dbc1->db(), db);
+
+  // Connections attached before the registry changed are closed.
+  dbc2.reset();
+  ASSERT_EQ(pool.size(), 1U);
+  pool.back()->generation_--;
+  dbc2 = SQLiteDBManager::getPooled();
+  EXPECT_TRUE(pool.empty());
+
+  dbc1->generation_--;
+  dbc1.reset();
+  EXPECT_TRUE(pool.empty());
+}
+
+TEST_F(SQLiteUtilTests, test_contention_uses_pool) {
+  auto& pool = SQLiteDBManager::instance().pool_;
+  pool.clear();
+
+  // While the primary database is in use, queries use pooled connections.
+  auto primary = SQLiteDBManager::get();
+  ASSERT_TRUE(primary->isPrimary());
+  auto dbc = SQLiteDBManager::get();
+  EXPECT_FALSE(dbc->isPrimary());
+  SQLInternal sql("SELECT * FROM time", dbc);
+  EXPECT_TRUE(sql.ok());
+
+  // The released connection keeps its tables and is reused.
+  auto db = dbc->db();
+  dbc.reset();
+  ASSERT_EQ(pool.size(), 1U);
+  EXPECT_TRUE(pool.back()->affected_tables_.empty());
+  dbc = SQLiteDBManager::get();
+  EXPECT_EQ(dbc->db(), db);
+}
+
+TEST_F(SQLiteUtilTests, test_deferred_attach) {
+  auto& deferred = SQLiteDBManager::instance().deferred_;
+  EXPECT_FALSE(SQLiteDBManager::deferTable("time", "(hour INTEGER)"));
+
+  // Tables are queued until the last hold is released.
+  SQLiteDBManager::deferAttach();
+  SQLiteDBManager::deferAttach();
+  EXPECT_TRUE(SQLiteDBManager::deferTable("time", "(hour INTEGER)"));
+  EXPECT_TRUE(SQLiteDBManager::attachDeferred().ok());
+  EXPECT_EQ(deferred.size(), 1U);
+
+  // A table detached before it is attached is removed from the queue.
+  SQLiteDBManager::removeDeferred("time");
+  EXPECT_TRUE(deferred.empty());
+  EXPECT_TRUE(SQLiteDBManager::attachDeferred().ok());
+  EXPECT_FALSE(SQLiteDBManager::deferTable("time", "(hour INTEGER)"));
+
+  // Several tables are attached within one schema change.
+  auto dbc = SQLiteDBManager::getUnique();
+  std::vector<TableDefinition> tables;
+  for (const auto& name : {"time", "osquery_info"}) {
+    PluginResponse response;
+    Registry::call("table", name, {{"action", "columns"}}, response);
+    detachTableInternal(name, dbc->db());
+    tables.push_back(std::make_pair(name, columnDefinition(response)));
+  }
+  EXPECT_TRUE(attachTablesInternal(tables, dbc).ok());
+
+  SQLInternal sql("SELECT * FROM time, osquery_info", dbc);
+  EXPECT_TRUE(sql.ok());
+  EXPECT_EQ(sql.rows().size(), 1U);
+}
+
+TEST_F(SQLiteUtilTests, test_query_value_types) {
+  auto dbc = getTestDBC();
+  std::string query =
+      "SELECT 1 AS i, -9223372036854775808 AS min, 0.5 AS f, NULL AS n, "
+      "'text' AS t, x'6f6b' AS b";
+
+  QueryData results;
+  auto status = queryInternal(query, results, dbc->db());
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["i"], "1");
+  EXPECT_EQ(results[0]["min"], "-9223372036854775808");
+  EXPECT_EQ(results[0]["f"], "0.5");
+  EXPECT_EQ(results[0]["n"], "");
+  EXPECT_EQ(results[0]["t"], "text");
+  EXPECT_EQ(results[0]["b"], "ok");
+
+  // The prepared path produces the same values.
+  QueryData prepared_results;
+  status = dbc->queryPrepared(query, prepared_results);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(prepared_results, results);
+
+  // Results from every statement are accumulated.
+  results.clear();
+  status = queryInternal(
+      "SELECT 1 AS a; /* comment */ SELECT 2 AS a;", results, dbc->db());
+  ASSERT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["a"], "2");
+}
+
+TEST_F(SQLiteUtilTests, test_query_deadline) {
+  auto dbc = getTestDBC();
+  std::string query =
+      "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c) "
+      "SELECT count(*) AS n FROM c";
+
+  {
+    // An unbounded statement is interrupted at its deadline.
+    QueryDeadlineScope deadline(1);
+    QueryData results;
+    auto status = dbc->queryPrepared(query, results);
+    EXPECT_FALSE(status.ok());
+    EXPECT_TRUE(results.empty());
+    EXPECT_TRUE(isQueryCancelled());
+  }
+
+  // The connection is usable after an interrupted statement.
+  EXPECT_FALSE(isQueryCancelled());
+  QueryData results;
+  EXPECT_TRUE(dbc->queryPrepared("SELECT 1 AS n", results).ok());
+  EXPECT_EQ(results.size(), 1U);
+
+  // A passed deadline cancels the query and its table generators.
+  setQueryDeadline(std::chrono::steady_clock::now());
+  results.clear();
+  EXPECT_FALSE(queryInternal("SELECT 1 AS n", results, dbc->db()).ok());
+  QueryContext context;
+  EXPECT_TRUE(context.isCancelled());
+  setQueryDeadline(0);
+  EXPECT_FALSE(context.isCancelled());
+}
+
 TEST_F(SQLiteUtilTests, test_table_attributes_event_based) {
   auto sql_internal = SQLInternal("select * from process_events");
   EXPECT_TRUE(sql_internal.ok());
@@ -220,4 +507,40 @@ TEST_F(SQLiteUtilTests, test_query_planner) {
   getQueryColumnsInternal(query, columns, dbc->db());
   EXPECT_EQ(getTypes(columns), TypeList({TEXT_TYPE, INTEGER_TYPE, TEXT_TYPE}));
 }
+
+TEST_F(SQLiteUtilTests, test_memory_stats) {
+  auto dbc = SQLiteDBManager::getUnique();
+  QueryData results;
+  EXPECT_TRUE(dbc->queryPrepared("SELECT * FROM time", results).ok());
+
+  bool memory_used = false;
+  size_t connection_counters = 0;
+  for (const auto& stat : getSQLiteMemoryStats()) {
+    if (stat.scope == "process") {
+      EXPECT_EQ(stat.connection, 0U);
+      if (stat.name == "memory_used") {
+        memory_used = true;
+        EXPECT_GT(stat.highwater, 0);
+      }
+    } else {
+      EXPECT_EQ(stat.scope, "connection");
+      EXPECT_GT(stat.connection, 0U);
+      if (stat.name == "schema_used") {
+        connection_counters++;
+      }
+    }
+  }
+  EXPECT_TRUE(memory_used);
+
+  // The unique connection is counted while it is open.
+  EXPECT_GE(connection_counters, 1U);
+  dbc.reset();
+  size_t remaining = 0;
+  for (const auto& stat : getSQLiteMemoryStats()) {
+    if (stat.name == "schema_used") {
+      remaining++;
+    }
+  }
+  EXPECT_EQ(remaining, connection_counters - 1);
+}
 }
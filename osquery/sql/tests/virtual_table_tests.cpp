@@ -15,10 +15,15 @@
 #include <osquery/registry.h>
 #include <osquery/sql.h>
 
+#include "osquery/sql/table_cache.h"
+#include "osquery/sql/table_stats.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
 
+DECLARE_uint64(table_results_cache_ttl);
+DECLARE_bool(lazy_tables);
+
 class VirtualTableTests : public testing::Test {};
 
 // sample plugin used on tests
@@ -425,4 +430,616 @@ TEST_F(VirtualTableTests, test_table_cache) {
   ASSERT_EQ(results.size(), 1U);
   ASSERT_EQ(results[0]["data"], "awesome_data");
 }
+
+/// Count the number of batches requested from the streaming table.
+static size_t kStreamBatches{0};
+
+class streamTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  RowGeneratorRef generator(QueryContext& context) override {
+    size_t i = 0;
+    return std::make_shared<FunctionRowGenerator>([i](QueryData& batch) mutable {
+      if (i >= 10) {
+        return false;
+      }
+      kStreamBatches++;
+      // Emit two rows per batch, the first batch is empty.
+      if (i > 0) {
+        batch.push_back({{"i", INTEGER(i)}});
+        batch.push_back({{"i", INTEGER(i + 1)}});
+      }
+      i += 2;
+      return true;
+    });
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_generator);
+};
+
+TEST_F(VirtualTableTests, test_table_generator) {
+  Registry::add<streamTablePlugin>("table", "stream");
+  auto dbc = SQLiteDBManager::getUnique();
+
+  {
+    auto stream = std::make_shared<streamTablePlugin>();
+    attachTableInternal("stream", stream->columnDefinition(), dbc);
+  }
+
+  // A complete scan pulls every batch.
+  QueryData results;
+  auto status = queryInternal("SELECT i FROM stream", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 8U);
+  EXPECT_EQ(kStreamBatches, 5U);
+  EXPECT_EQ(results[0]["i"], "2");
+  EXPECT_EQ(results[7]["i"], "9");
+
+  // A LIMIT stops pulling batches that are not needed.
+  kStreamBatches = 0;
+  results.clear();
+  status = queryInternal("SELECT i FROM stream LIMIT 3", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 3U);
+  EXPECT_EQ(kStreamBatches, 3U);
+}
+
+class typedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("name", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("size", BIGINT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("ratio", DOUBLE_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("label", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  RowGeneratorRef generator(QueryContext& context) override {
+    bool done = false;
+    return std::make_shared<FunctionTypedRowGenerator>(
+        columns(), [done](TypedQueryData& batch) mutable {
+          if (done) {
+            return false;
+          }
+          done = true;
+          TypedRow r(4);
+          r.setText(0, "first");
+          r.setInteger(1, 5000000000LL);
+          r.setDouble(2, 0.5);
+          r.setInteger(3, 7);
+          batch.push_back(std::move(r));
+          // The second row leaves the ratio and label NULL.
+          TypedRow r2(4);
+          r2.setText(0, "second");
+          r2.setText(1, "10");
+          batch.push_back(std::move(r2));
+          return true;
+        });
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_typed_generator);
+};
+
+TEST_F(VirtualTableTests, test_table_typed_generator) {
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto typed = std::make_shared<typedTablePlugin>();
+    attachTableInternal("typed", typed->columnDefinition(), dbc);
+  }
+  Registry::add<typedTablePlugin>("table", "typed");
+
+  QueryData results;
+  auto status =
+      queryInternal("SELECT * FROM typed WHERE size > 5", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["name"], "first");
+  EXPECT_EQ(results[0]["size"], "5000000000");
+  EXPECT_EQ(results[0]["ratio"], "0.5");
+  EXPECT_EQ(results[0]["label"], "7");
+  EXPECT_EQ(results[1]["size"], "10");
+  EXPECT_EQ(results[1]["ratio"], "");
+
+  // The name-addressed interface converts typed rows.
+  QueryContext context;
+  RowGeneratorRef generator;
+  status = Registry::callTable("typed", context, generator);
+  EXPECT_TRUE(status.ok());
+  QueryData rows;
+  EXPECT_TRUE(generator->next(rows));
+  ASSERT_EQ(rows.size(), 2U);
+  EXPECT_EQ(rows[0]["size"], "5000000000");
+  EXPECT_EQ(rows[1].count("ratio"), 0U);
+}
+
+static UsedColumns kProjectedColumns;
+
+class projectionTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("a", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("b", TEXT_TYPE, ColumnOptions::DEFAULT),
+        std::make_tuple("c", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kProjectedColumns.clear();
+    for (const auto& column : {"a", "b", "c"}) {
+      if (context.isColumnUsed(column)) {
+        kProjectedColumns.insert(column);
+      }
+    }
+    return {{{"a", "1"}, {"b", "2"}, {"c", "3"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_projection);
+};
+
+TEST_F(VirtualTableTests, test_table_projection) {
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto projection = std::make_shared<projectionTablePlugin>();
+    attachTableInternal("projection", projection->columnDefinition(), dbc);
+  }
+  Registry::add<projectionTablePlugin>("table", "projection");
+
+  // Only the selected and constrained columns are used.
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT a FROM projection WHERE c = '3'", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["a"], "1");
+  EXPECT_EQ(kProjectedColumns, UsedColumns({"a", "c"}));
+
+  results.clear();
+  status = queryInternal("SELECT * FROM projection", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(kProjectedColumns, UsedColumns({"a", "b", "c"}));
+
+  // A context without projection information uses every column.
+  QueryContext context;
+  EXPECT_TRUE(context.isColumnUsed("b"));
+  context.colsUsed = UsedColumns({"a"});
+  EXPECT_FALSE(context.isColumnUsed("b"));
+  EXPECT_TRUE(context.isAnyColumnUsed({"a", "b"}));
+}
+
+static RowOrder kRequestedOrder{RowOrder::NONE};
+static size_t kRequestedLimit{0};
+
+class orderedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("time", BIGINT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  TableAttributes attributes() const override {
+    return TableAttributes::EVENT_BASED;
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kRequestedOrder = context.order;
+    kRequestedLimit = context.limit;
+    if (context.order == RowOrder::TIME_DESCENDING) {
+      return {{{"time", "3"}}, {{"time", "2"}}, {{"time", "1"}}};
+    }
+    return {{{"time", "1"}}, {{"time", "2"}}, {{"time", "3"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_order);
+};
+
+TEST_F(VirtualTableTests, test_table_order) {
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto ordered = std::make_shared<orderedTablePlugin>();
+    attachTableInternal("ordered", ordered->columnDefinition(), dbc);
+  }
+  Registry::add<orderedTablePlugin>("table", "ordered");
+
+  // An event-based table returns rows in the order of its time column.
+  QueryData results;
+  auto status = queryInternal(
+      "SELECT time FROM ordered ORDER BY time DESC LIMIT 2 OFFSET 1",
+      results,
+      dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[0]["time"], "2");
+  EXPECT_EQ(results[1]["time"], "1");
+  EXPECT_EQ(kRequestedOrder, RowOrder::TIME_DESCENDING);
+#if SQLITE_VERSION_NUMBER >= 3038000
+  EXPECT_EQ(kRequestedLimit, 3U);
+#endif
+
+  results.clear();
+  status = queryInternal(
+      "SELECT time FROM ordered ORDER BY time", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  ASSERT_EQ(results.size(), 3U);
+  EXPECT_EQ(results[0]["time"], "1");
+  EXPECT_EQ(kRequestedOrder, RowOrder::TIME_ASCENDING);
+  EXPECT_EQ(kRequestedLimit, 0U);
+
+  // Without an ORDER BY the table returns rows in any order.
+  results.clear();
+  status = queryInternal("SELECT time FROM ordered", results, dbc->db());
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(results.size(), 3U);
+  EXPECT_EQ(kRequestedOrder, RowOrder::NONE);
+
+  // SQLite does not sort the rows of a local table.
+  auto sorted = [&dbc](const std::string& table) {
+    QueryData plan;
+    queryInternal("EXPLAIN QUERY PLAN SELECT time FROM " + table +
+                      " ORDER BY time",
+                  plan,
+                  dbc->db());
+    for (const auto& row : plan) {
+      if (row.count("detail") > 0 &&
+          row.at("detail").find("ORDER BY") != std::string::npos) {
+        return true;
+      }
+    }
+    return false;
+  };
+  EXPECT_FALSE(sorted("ordered"));
+
+  // A table without a local plugin, such as an extension's, may not read the
+  // requested order, SQLite sorts its rows.
+  Registry::add<orderedTablePlugin>("table", "ordered_remote");
+  {
+    auto ordered = std::make_shared<orderedTablePlugin>();
+    attachTableInternal("ordered_remote", ordered->columnDefinition(), dbc);
+  }
+  Registry::registry("table")->remove("ordered_remote");
+  EXPECT_TRUE(sorted("ordered_remote"));
+}
+
+static size_t kCachedGenerations{0};
+
+class cachedTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kCachedGenerations++;
+    return {{{"i", "1"}}, {{"i", "2"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_results_cache);
+};
+
+TEST_F(VirtualTableTests, test_table_results_cache) {
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto cached = std::make_shared<cachedTablePlugin>();
+    attachTableInternal("cached", cached->columnDefinition(), dbc);
+  }
+  Registry::add<cachedTablePlugin>("table", "cached");
+
+  auto ttl = FLAGS_table_results_cache_ttl;
+  FLAGS_table_results_cache_ttl = 60;
+  TableResultCache::instance().clear();
+
+  // The second query reuses the complete results of the first.
+  QueryData results;
+  EXPECT_TRUE(queryInternal("SELECT i FROM cached", results, dbc->db()));
+  dbc->clearAffectedTables();
+  results.clear();
+  EXPECT_TRUE(queryInternal("SELECT i FROM cached", results, dbc->db()));
+  dbc->clearAffectedTables();
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(kCachedGenerations, 1U);
+  EXPECT_GT(TableResultCache::instance().size(), 0U);
+
+  // A different constraint set is a different cache key.
+  results.clear();
+  EXPECT_TRUE(
+      queryInternal("SELECT i FROM cached WHERE i = 2", results, dbc->db()));
+  dbc->clearAffectedTables();
+  EXPECT_EQ(results.size(), 1U);
+  EXPECT_EQ(kCachedGenerations, 2U);
+
+  // A partially-read result set is not stored.
+  results.clear();
+  EXPECT_TRUE(queryInternal(
+      "SELECT i FROM cached WHERE i > 0 LIMIT 1", results, dbc->db()));
+  dbc->clearAffectedTables();
+  results.clear();
+  EXPECT_TRUE(queryInternal(
+      "SELECT i FROM cached WHERE i > 0 LIMIT 1", results, dbc->db()));
+  dbc->clearAffectedTables();
+  EXPECT_EQ(kCachedGenerations, 4U);
+
+  // Disabling the cache always generates.
+  FLAGS_table_results_cache_ttl = 0;
+  results.clear();
+  EXPECT_TRUE(queryInternal("SELECT i FROM cached", results, dbc->db()));
+  EXPECT_EQ(kCachedGenerations, 5U);
+
+  FLAGS_table_results_cache_ttl = ttl;
+  TableResultCache::instance().clear();
+}
+
+class routeTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("v", TEXT_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+  QueryData generate(QueryContext& context) override {
+    return {{{"v", "first"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_route);
+};
+
+class secondRouteTablePlugin : public routeTablePlugin {
+ private:
+  QueryData generate(QueryContext& context) override {
+    return {{{"v", "second"}}};
+  }
+};
+
+TEST_F(VirtualTableTests, test_table_route) {
+  Registry::add<routeTablePlugin>("table", "route");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto route = std::make_shared<routeTablePlugin>();
+    attachTableInternal("route", route->columnDefinition(), dbc);
+  }
+
+  auto route = Registry::resolveTable("route");
+  EXPECT_NE(route.plugin, nullptr);
+  EXPECT_FALSE(route.external);
+  EXPECT_EQ(route.generation, Registry::generation());
+
+  QueryData results;
+  EXPECT_TRUE(queryInternal("SELECT v FROM route", results, dbc->db()));
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["v"], "first");
+
+  // Replacing the plugin changes the generation, the table resolves again.
+  Registry::registry("table")->remove("route");
+  EXPECT_NE(route.generation, Registry::generation());
+  Registry::add<secondRouteTablePlugin>("table", "route");
+  results.clear();
+  EXPECT_TRUE(queryInternal("SELECT v FROM route", results, dbc->db()));
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["v"], "second");
+  Registry::registry("table")->remove("route");
+}
+
+class statsTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("i", INTEGER_TYPE, ColumnOptions::DEFAULT),
+    };
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    return {{{"i", "1"}}, {{"i", "2"}}, {{"i", "3"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_stats);
+  FRIEND_TEST(VirtualTableTests, test_table_estimates);
+  FRIEND_TEST(VirtualTableTests, test_table_memo);
+  FRIEND_TEST(VirtualTableTests, test_query_profile);
+};
+
+TEST_F(VirtualTableTests, test_table_stats) {
+  Registry::add<statsTablePlugin>("table", "stats");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto stats = std::make_shared<statsTablePlugin>();
+    attachTableInternal("stats", stats->columnDefinition(), dbc);
+  }
+
+  TableStats::instance().clear();
+  QueryData results;
+  EXPECT_TRUE(queryInternal("SELECT i FROM stats", results, dbc->db()));
+  EXPECT_EQ(results.size(), 3U);
+  results.clear();
+  EXPECT_TRUE(
+      queryInternal("SELECT i FROM stats WHERE i = 2", results, dbc->db()));
+  EXPECT_EQ(results.size(), 1U);
+
+  std::map<std::string, TableGenerateStats> tables;
+  TableStats::instance().forEach(
+      [&tables](const std::string& name, const TableGenerateStats& stats) {
+        tables[name] = stats;
+      });
+  ASSERT_EQ(tables.count("stats"), 1U);
+
+  // Each scan generates every row, SQLite filters the second query's rows.
+  const auto& stats = tables.at("stats");
+  EXPECT_EQ(stats.scans, 2U);
+  EXPECT_EQ(stats.rows, 6U);
+  EXPECT_GE(stats.total_time, stats.max_time);
+  size_t counted = 0;
+  for (const auto& bucket : stats.histogram) {
+    counted += bucket;
+  }
+  EXPECT_EQ(counted, 2U);
+}
+
+TEST_F(VirtualTableTests, test_table_estimates) {
+  Registry::add<statsTablePlugin>("table", "stats");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto stats = std::make_shared<statsTablePlugin>();
+    attachTableInternal("stats", stats->columnDefinition(), dbc);
+  }
+
+  TableStats::instance().clear();
+  TableStats::instance().record("stats", 100, 3, true);
+
+  // A constrained scan does not change the estimate.
+  QueryData results;
+  EXPECT_TRUE(
+      queryInternal("SELECT i FROM stats WHERE i = 2", results, dbc->db()));
+  double rows = 0;
+  double time = 0;
+  ASSERT_TRUE(TableStats::instance().estimate("stats", rows, time));
+  EXPECT_EQ(rows, 3);
+
+  // Full scans move the estimate.
+  TableStats::instance().record("stats", 100, 13, true);
+  ASSERT_TRUE(TableStats::instance().estimate("stats", rows, time));
+  EXPECT_GT(rows, 3);
+  EXPECT_LT(rows, 13);
+  EXPECT_EQ(time, 100);
+
+  double missing_rows = 0;
+  EXPECT_FALSE(
+      TableStats::instance().estimate("not_a_table", missing_rows, time));
+}
+
+TEST_F(VirtualTableTests, test_query_profile) {
+  Registry::add<statsTablePlugin>("table", "stats");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto stats = std::make_shared<statsTablePlugin>();
+    attachTableInternal("stats", stats->columnDefinition(), dbc);
+  }
+
+  // Scans are not recorded without an active profile.
+  QueryData results;
+  EXPECT_TRUE(queryInternal("SELECT i FROM stats", results, dbc->db()));
+  QueryProfile::instance().start();
+  EXPECT_TRUE(QueryProfile::instance().stop().empty());
+
+  // The limit stops SQLite after the first row of the single scan.
+  QueryProfile::instance().start();
+  results.clear();
+  EXPECT_TRUE(
+      queryInternal("SELECT i FROM stats LIMIT 1", results, dbc->db()));
+  auto tables = QueryProfile::instance().stop();
+  EXPECT_FALSE(QueryProfile::instance().active());
+  ASSERT_EQ(tables.count("stats"), 1U);
+
+  const auto& stats = tables.at("stats");
+  EXPECT_EQ(stats.filters, 1U);
+  EXPECT_EQ(stats.generated, 3U);
+  EXPECT_LE(stats.consumed, stats.generated);
+  EXPECT_GT(stats.bytes, 0U);
+}
+
+/// Count the number of times the deterministic table generates.
+static size_t kMemoGenerates{0};
+
+class memoTablePlugin : public TablePlugin {
+ private:
+  TableColumns columns() const override {
+    return {
+        std::make_tuple("v", INTEGER_TYPE, ColumnOptions::INDEX),
+    };
+  }
+
+  TableAttributes attributes() const override {
+    return TableAttributes::DETERMINISTIC;
+  }
+
+ public:
+  QueryData generate(QueryContext& context) override {
+    kMemoGenerates++;
+    return {{{"v", "0"}}, {{"v", "1"}}};
+  }
+
+ private:
+  FRIEND_TEST(VirtualTableTests, test_table_memo);
+};
+
+TEST_F(VirtualTableTests, test_table_memo) {
+  Registry::add<statsTablePlugin>("table", "stats");
+  Registry::add<memoTablePlugin>("table", "memo");
+  auto dbc = SQLiteDBManager::getUnique();
+  {
+    auto stats = std::make_shared<statsTablePlugin>();
+    attachTableInternal("stats", stats->columnDefinition(), dbc);
+    auto memo = std::make_shared<memoTablePlugin>();
+    attachTableInternal("memo", memo->columnDefinition(), dbc);
+  }
+
+  // The inner table is filtered for each outer row with the same constraints.
+  kMemoGenerates = 0;
+  QueryData results;
+  EXPECT_TRUE(queryInternal(
+      "SELECT s.i, m.v FROM stats s CROSS JOIN memo m", results, dbc->db()));
+  dbc->clearAffectedTables();
+  EXPECT_EQ(results.size(), 6U);
+  EXPECT_EQ(kMemoGenerates, 1U);
+
+  // Each distinct constraint generates once, the memo expired with the query.
+  kMemoGenerates = 0;
+  results.clear();
+  EXPECT_TRUE(queryInternal(
+      "SELECT s.i, m.v FROM stats s CROSS JOIN memo m WHERE m.v = s.i % 2",
+      results,
+      dbc->db()));
+  dbc->clearAffectedTables();
+  EXPECT_EQ(results.size(), 3U);
+  EXPECT_EQ(kMemoGenerates, 2U);
+}
+
+TEST_F(VirtualTableTests, test_lazy_tables) {
+  FLAGS_lazy_tables = true;
+  auto dbc = SQLiteDBManager::getUnique();
+  FLAGS_lazy_tables = false;
+
+  // Only the modules exist until a statement references a table.
+  QueryData results;
+  EXPECT_TRUE(queryInternal(
+      "SELECT name FROM sqlite_temp_master WHERE name = 'time'",
+      results,
+      dbc->db()));
+  EXPECT_TRUE(results.empty());
+
+  EXPECT_TRUE(queryInternal("SELECT hour FROM time", results, dbc->db()));
+  EXPECT_EQ(results.size(), 1U);
+
+  // A module is not created for an unregistered table.
+  results.clear();
+  EXPECT_FALSE(
+      queryInternal("SELECT * FROM not_a_table", results, dbc->db()).ok());
+
+  PluginResponse first;
+  PluginResponse second;
+  EXPECT_TRUE(getTableColumns("time", first).ok());
+  EXPECT_TRUE(getTableColumns("time", second).ok());
+  EXPECT_EQ(first, second);
+  EXPECT_FALSE(getTableColumns("not_a_table", first).ok());
+}
 }
@@ -8,13 +8,19 @@
  *
  */
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <limits>
 
 #include <osquery/core.h>
 #include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/system.h>
 
+#include "osquery/core/perf.h"
+#include "osquery/sql/table_cache.h"
+#include "osquery/sql/table_stats.h"
 #include "osquery/sql/virtual_table.h"
 
 namespace osquery {
@@ -23,6 +29,11 @@ FLAG(bool, enable_foreign, false, "Enable no-op foreign virtual tables");
 
 SHELL_FLAG(bool, planner, false, "Enable osquery runtime planner output");
 
+FLAG(bool,
+     lazy_tables,
+     false,
+     "Create each connection's virtual tables when a query references them");
+
 DECLARE_bool(disable_events);
 
 /**
@@ -111,20 +122,108 @@ int xOpen(sqlite3_vtab* tab, sqlite3_vtab_cursor** ppCursor) {
   return rc;
 }
 
+/// Microseconds elapsed since a time point.
+static inline uint64_t getElapsedTime(
+    const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/// Record the cursor's current scan if it generated rows.
+static void recordScan(BaseCursor* pCur) {
+  if (pCur->timed) {
+    auto* pVtab = (VirtualTable*)pCur->base.pVtab;
+    TableStats::instance().record(
+        pVtab->content->name, pCur->generate_time, pCur->generated, pCur->full);
+  }
+  pCur->timed = false;
+  pCur->full = false;
+  pCur->generate_time = 0;
+  pCur->generated = 0;
+}
+
 int xClose(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
+  recordScan(pCur);
   plan("Closing cursor (" + std::to_string(pCur->id) + ")");
   delete pCur;
   return SQLITE_OK;
 }
 
+/// The number of rows in the cursor's current batch.
+static inline size_t batchSize(const BaseCursor* pCur) {
+  return (pCur->typed) ? pCur->typed_data.size() : pCur->data.size();
+}
+
+/// The bytes of column names and values in the cursor's batch.
+static size_t batchBytes(const BaseCursor* pCur) {
+  size_t bytes = 0;
+  if (pCur->typed) {
+    for (const auto& row : pCur->typed_data) {
+      for (size_t i = 0; i < row.size(); i++) {
+        if (row[i].type == TEXT_TYPE) {
+          bytes += row[i].text.size();
+        } else if (row[i].type != UNKNOWN_TYPE) {
+          bytes += sizeof(long long);
+        }
+      }
+    }
+  } else {
+    for (const auto& row : pCur->data) {
+      for (const auto& column : row) {
+        bytes += column.first.size() + column.second.size();
+      }
+    }
+  }
+  return bytes;
+}
+
+/// Pull batches from the cursor's generator until a row is available.
+static void fetchRows(BaseCursor* pCur) {
+  pCur->data.clear();
+  pCur->typed_data.clear();
+  pCur->row = 0;
+  auto start = std::chrono::steady_clock::now();
+  PerfTimer timer(PERF_GENERATE);
+  while (pCur->generator != nullptr && batchSize(pCur) == 0) {
+    bool more = (pCur->typed)
+                    ? static_cast<TypedRowGenerator*>(pCur->generator.get())
+                          ->nextTyped(pCur->typed_data)
+                    : pCur->generator->next(pCur->data);
+    if (!more) {
+      // The generator is exhausted, release its resources early.
+      pCur->generator = nullptr;
+    }
+  }
+
+  if (pCur->timed) {
+    pCur->generate_time += getElapsedTime(start);
+    pCur->generated += batchSize(pCur);
+  }
+
+  if (pCur->profiled && batchSize(pCur) > 0) {
+    auto* pVtab = (VirtualTable*)pCur->base.pVtab;
+    QueryProfile::instance().addRows(pVtab->content->name,
+                                     batchSize(pCur),
+                                     batchBytes(pCur),
+                                     getElapsedTime(start));
+  }
+}
+
 int xEof(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
-  if (pCur->row >= pCur->n) {
+  if (pCur->row >= batchSize(pCur)) {
     // If the requested row exceeds the size of the row set then all rows
-    // have been visited, clear the data container.
+    // have been visited, and the generator did not provide another batch.
     return true;
   }
+
+  if (pCur->profiled) {
+    // SQLite checks for the end of the scan before visiting each row.
+    auto* pVtab = (VirtualTable*)pCur->base.pVtab;
+    QueryProfile::instance().addConsumed(pVtab->content->name);
+  }
   return false;
 }
 
@@ -138,15 +237,55 @@ int xDestroy(sqlite3_vtab* p) {
 int xNext(sqlite3_vtab_cursor* cur) {
   BaseCursor* pCur = (BaseCursor*)cur;
   pCur->row++;
+  pCur->rowid++;
+  if (pCur->row >= batchSize(pCur)) {
+    // The batch is consumed, pull the next batch on demand.
+    fetchRows(pCur);
+  }
   return SQLITE_OK;
 }
 
 int xRowid(sqlite3_vtab_cursor* cur, sqlite_int64* pRowid) {
   const BaseCursor* pCur = (BaseCursor*)cur;
-  *pRowid = pCur->row;
+  *pRowid = pCur->rowid;
   return SQLITE_OK;
 }
 
+/// Column responses and the registry generation they were requested in.
+static std::map<std::string, PluginResponse> kTableColumns;
+static size_t kTableColumnsGeneration{0};
+static Mutex kTableColumnsMutex;
+
+Status getTableColumns(const std::string& name, PluginResponse& response) {
+  auto generation = Registry::generation();
+  {
+    WriteLock lock(kTableColumnsMutex);
+    if (kTableColumnsGeneration != generation) {
+      // A table may have been added, removed, or replaced by an extension.
+      kTableColumns.clear();
+      kTableColumnsGeneration = generation;
+    }
+    auto it = kTableColumns.find(name);
+    if (it != kTableColumns.end()) {
+      response = it->second;
+      return Status(0, "OK");
+    }
+  }
+
+  response.clear();
+  auto status =
+      Registry::call("table", name, {{"action", "columns"}}, response);
+  if (!status.ok() || response.empty()) {
+    return Status(1, "Cannot get columns for table: " + name);
+  }
+
+  WriteLock lock(kTableColumnsMutex);
+  if (kTableColumnsGeneration == generation) {
+    kTableColumns[name] = response;
+  }
+  return Status(0, "OK");
+}
+
 int xCreate(sqlite3* db,
             void* pAux,
             int argc,
@@ -163,14 +302,13 @@ int xCreate(sqlite3* db,
   pVtab->content = new VirtualTableContent;
   pVtab->instance = (SQLiteDBInstance*)pAux;
 
-  // Create a TablePlugin Registry call, expect column details as the response.
+  // Request the table's column details, usually answered by the cache.
   PluginResponse response;
   pVtab->content->name = std::string(argv[0]);
   const auto& name = pVtab->content->name;
   // Get the table column information.
-  auto status =
-      Registry::call("table", name, {{"action", "columns"}}, response);
-  if (!status.ok() || response.size() == 0) {
+  auto status = getTableColumns(name, response);
+  if (!status.ok()) {
     delete pVtab->content;
     delete pVtab;
     return SQLITE_ERROR;
@@ -204,10 +342,13 @@ int xCreate(sqlite3* db,
         column.count("type")) {
       // This is a malformed column definition.
       // Populate the virtual table specific persistent column information.
+      auto options =
+          (ColumnOptions)AS_LITERAL(INTEGER_LITERAL, column.at("op"));
       pVtab->content->columns.push_back(std::make_tuple(
-          column.at("name"),
-          columnTypeName(column.at("type")),
-          (ColumnOptions)AS_LITERAL(INTEGER_LITERAL, column.at("op"))));
+          column.at("name"), columnTypeName(column.at("type")), options));
+      if (options & ColumnOptions::REQUIRED) {
+        pVtab->content->has_required = true;
+      }
     } else if (column.at("id") == "alias" && column.count("alias")) {
       // Create associated views for table aliases.
       views.insert(column.at("alias"));
@@ -232,47 +373,30 @@ int xCreate(sqlite3* db,
       // Store the attributes locally so they may be passed to the SQL object.
       pVtab->content->attributes =
           (TableAttributes)AS_LITERAL(INTEGER_LITERAL, column.at("attributes"));
+      if (column.count("change_feed") > 0) {
+        pVtab->content->change_feed = column.at("change_feed");
+      }
     }
   }
 
-  // Create the requested 'aliases'.
-  for (const auto& view : views) {
-    auto statement = "CREATE VIEW " + view + " AS SELECT * FROM " + name;
-    sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr);
+  // Create the requested 'aliases'. A table connected on first reference has
+  // no arguments, its views were created with the connection's modules.
+  if (argc > 3) {
+    for (const auto& view : views) {
+      auto statement = "CREATE VIEW " + view + " AS SELECT * FROM " + name;
+      sqlite3_exec(db, statement.c_str(), nullptr, nullptr, nullptr);
+    }
   }
   *ppVtab = (sqlite3_vtab*)pVtab;
   return rc;
 }
 
-int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
-  BaseCursor* pCur = (BaseCursor*)cur;
-  const auto* pVtab = (VirtualTable*)cur->pVtab;
-  if (col >= static_cast<int>(pVtab->content->columns.size())) {
-    // Requested column index greater than column set size.
-    return SQLITE_ERROR;
-  }
-  if (pCur->row >= pCur->data.size()) {
-    // Request row index greater than row set size.
-    return SQLITE_ERROR;
-  }
-
-  auto& column_name = std::get<0>(pVtab->content->columns[col]);
-  auto& type = std::get<1>(pVtab->content->columns[col]);
-  if (pVtab->content->aliases.count(column_name)) {
-    // Overwrite the aliased column with the type and name of the new column.
-    type = std::get<1>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-    column_name = std::get<0>(
-        pVtab->content->columns[pVtab->content->aliases.at(column_name)]);
-  }
-
-  // Attempt to cast each xFilter-populated row/column to the SQLite type.
-  const auto& value = pCur->data[pCur->row][column_name];
-  if (pCur->data[pCur->row].count(column_name) == 0) {
-    // Missing content.
-    VLOG(1) << "Error " << column_name << " is empty";
-    sqlite3_result_null(ctx);
-  } else if (type == TEXT_TYPE) {
+/// Report a string value to SQLite, casting to the column's type.
+static void resultString(sqlite3_context* ctx,
+                         const std::string& column_name,
+                         ColumnType type,
+                         const std::string& value) {
+  if (type == TEXT_TYPE) {
     sqlite3_result_text(
         ctx, value.c_str(), static_cast<int>(value.size()), SQLITE_STATIC);
   } else if (type == INTEGER_TYPE) {
@@ -307,20 +431,208 @@ int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
   } else {
     LOG(ERROR) << "Error unknown column type " << column_name;
   }
+}
+
+/// Report a typed value to SQLite, only parsing if a table set TEXT.
+static void resultTyped(sqlite3_context* ctx,
+                        const std::string& column_name,
+                        ColumnType type,
+                        const RowValue& value) {
+  if (value.type == TEXT_TYPE) {
+    resultString(ctx, column_name, type, value.text);
+  } else if (value.type == BIGINT_TYPE) {
+    if (type == TEXT_TYPE) {
+      auto text = std::to_string(value.integer);
+      sqlite3_result_text(
+          ctx, text.c_str(), static_cast<int>(text.size()), SQLITE_TRANSIENT);
+    } else if (type == INTEGER_TYPE &&
+               (value.integer < INT_MIN || value.integer > INT_MAX)) {
+      VLOG(1) << "Error casting " << column_name << " (" << value.integer
+              << ") to INTEGER";
+      sqlite3_result_null(ctx);
+    } else if (type == DOUBLE_TYPE) {
+      sqlite3_result_double(ctx, static_cast<double>(value.integer));
+    } else {
+      sqlite3_result_int64(ctx, value.integer);
+    }
+  } else if (value.type == DOUBLE_TYPE) {
+    if (type == TEXT_TYPE) {
+      auto text = DOUBLE(value.real);
+      sqlite3_result_text(
+          ctx, text.c_str(), static_cast<int>(text.size()), SQLITE_TRANSIENT);
+    } else {
+      sqlite3_result_double(ctx, value.real);
+    }
+  } else {
+    sqlite3_result_null(ctx);
+  }
+}
+
+int xColumn(sqlite3_vtab_cursor* cur, sqlite3_context* ctx, int col) {
+  BaseCursor* pCur = (BaseCursor*)cur;
+  const auto* pVtab = (VirtualTable*)cur->pVtab;
+  if (col >= static_cast<int>(pVtab->content->columns.size())) {
+    // Requested column index greater than column set size.
+    return SQLITE_ERROR;
+  }
+  if (pCur->row >= batchSize(pCur)) {
+    // Request row index greater than row set size.
+    return SQLITE_ERROR;
+  }
+
+  size_t ordinal = static_cast<size_t>(col);
+  const auto& aliases = pVtab->content->aliases;
+  if (!aliases.empty()) {
+    auto alias = aliases.find(std::get<0>(pVtab->content->columns[ordinal]));
+    if (alias != aliases.end()) {
+      // Read the aliased column using the type and name of the target column.
+      ordinal = alias->second;
+    }
+  }
+  const auto& column_name = std::get<0>(pVtab->content->columns[ordinal]);
+  auto type = std::get<1>(pVtab->content->columns[ordinal]);
+
+  if (pCur->typed) {
+    // Typed rows are addressed by the column ordinal and need no lookup.
+    const auto& typed_row = pCur->typed_data[pCur->row];
+    if (ordinal >= typed_row.size()) {
+      sqlite3_result_null(ctx);
+    } else {
+      resultTyped(ctx, column_name, type, typed_row[ordinal]);
+    }
+    return SQLITE_OK;
+  }
+
+  // Attempt to cast each xFilter-populated row/column to the SQLite type.
+  const auto& r = pCur->data[pCur->row];
+  auto value = r.find(column_name);
+  if (value == r.end()) {
+    // Missing content.
+    VLOG(1) << "Error " << column_name << " is empty";
+    sqlite3_result_null(ctx);
+  } else {
+    resultString(ctx, column_name, type, value->second);
+  }
 
   return SQLITE_OK;
 }
 
+/**
+ * @brief Translate the SQLite column-usage mask into column names.
+ *
+ * Bit N is set if column N is used, the last bit is set if any column with an
+ * index above 62 is used. Both an alias and its target column are included.
+ */
+static UsedColumns usedColumns(const VirtualTableContent* content,
+                               sqlite3_uint64 mask) {
+  UsedColumns used;
+  const auto& columns = content->columns;
+  for (size_t i = 0; i < columns.size(); ++i) {
+    bool is_used = (i < 63) ? ((mask & ((sqlite3_uint64)1 << i)) != 0)
+                            : ((mask & ((sqlite3_uint64)1 << 63)) != 0);
+    if (!is_used) {
+      continue;
+    }
+
+    const auto& name = std::get<0>(columns[i]);
+    used.insert(name);
+    auto alias = content->aliases.find(name);
+    if (alias != content->aliases.end() && alias->second < columns.size()) {
+      used.insert(std::get<0>(columns[alias->second]));
+    }
+  }
+  return used;
+}
+
+/// Planner assumptions for a table without a recorded full scan.
+const double kDefaultEstimatedRows = 100;
+const double kDefaultEstimatedTime = 1000;
+
+/**
+ * @brief The fraction of rows expected to match a constraint.
+ *
+ * The column options are the only hints of a column's values: an equality on
+ * a UNIQUE column expects one row.
+ */
+static double constraintSelectivity(unsigned char op,
+                                    ColumnOptions options,
+                                    double rows,
+                                    bool& unique) {
+  switch (op) {
+  case EQUALS:
+    if (options & ColumnOptions::UNIQUE) {
+      unique = true;
+      return (rows > 1) ? 1 / rows : 1;
+    }
+    return (options & ColumnOptions::INDEX) ? 0.01 : 0.1;
+  case LIKE:
+  case GLOB:
+  case MATCH:
+  case REGEXP:
+    return 0.25;
+  default:
+    // Range comparisons.
+    return 0.33;
+  }
+}
+
+/// Set if the table uses constraints on the column to generate fewer rows.
+static inline bool constraintLimitsGenerate(ColumnOptions options) {
+  return (options & ColumnOptions::INDEX) ||
+         (options & ColumnOptions::REQUIRED) ||
+         (options & ColumnOptions::ADDITIONAL) ||
+         (options & ColumnOptions::OPTIMIZED) ||
+         (options & ColumnOptions::UNIQUE);
+}
+
+/// Get the table's route, resolving the table only if the registry changed.
+static const TableRoute& getTableRoute(VirtualTableContent* content) {
+  if (content->route.generation != Registry::generation()) {
+    content->route = Registry::resolveTable(content->name);
+  }
+  return content->route;
+}
+
 static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
   auto* pVtab = (VirtualTable*)tab;
   const auto& columns = pVtab->content->columns;
 
+  // Costs are measured in rows: the expected rows returned to SQLite plus the
+  // expected generate time, scaled from the table's unconstrained scans.
+  double rows = kDefaultEstimatedRows;
+  double time = kDefaultEstimatedTime;
+  TableStats::instance().estimate(pVtab->content->name, rows, time);
+  double per_row = (rows > 0) ? time / rows : time;
+  double output_rows = rows;
+  double generate_rows = rows;
+  bool unique = false;
+
   ConstraintSet constraints;
+  // The constraint columns and operators are encoded into the index string.
+  std::string index;
+#if SQLITE_VERSION_NUMBER >= 3010000
+  index = std::to_string((unsigned long long)pIdxInfo->colUsed);
+#endif
+
+  // Event-based tables return rows in 'time' order when asked, so SQLite does
+  // not sort and stops reading the cursor at the query's LIMIT. Extensions may
+  // not read the requested order, SQLite sorts the rows of their tables.
+  bool ordered = false;
+  if ((pVtab->content->attributes & TableAttributes::EVENT_BASED) > 0 &&
+      pIdxInfo->nOrderBy == 1 &&
+      getTableRoute(pVtab->content).plugin != nullptr) {
+    const auto& order_by = pIdxInfo->aOrderBy[0];
+    if (order_by.iColumn >= 0 &&
+        static_cast<size_t>(order_by.iColumn) < columns.size() &&
+        std::get<0>(columns[order_by.iColumn]) == "time") {
+      pIdxInfo->orderByConsumed = 1;
+      index += (order_by.desc) ? "~d" : "~a";
+      ordered = true;
+    }
+  }
   // Keep track of the index used for each valid constraint.
   // Expect this index to correspond with argv within xFilter.
   size_t expr_index = 0;
-  // If any constraints are unusable increment the cost of the index.
-  double cost = 1;
   // Expressions operating on the same virtual table are loosely identified by
   // the consecutive sets of terms each of the constraint sets are applied onto.
   // Subsequent attempts from failed (unusable) constraints replace the set,
@@ -337,19 +649,39 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
            std::to_string((int)constraint_info.usable) + "]");
 #endif
       if (!constraint_info.usable) {
-        // A higher cost less priority, prefer more usable query constraints.
-        cost += 10;
+        // The estimate without this constraint is the higher cost.
+        continue;
+      }
+
+#if SQLITE_VERSION_NUMBER >= 3038000
+      if (constraint_info.op == SQLITE_INDEX_CONSTRAINT_LIMIT ||
+          constraint_info.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+        if (ordered) {
+          // The value is a hint for an ordered scan, SQLite still applies it.
+          index += "|-1:" + std::to_string((int)constraint_info.op);
+          pIdxInfo->aConstraintUsage[i].argvIndex =
+              static_cast<int>(++expr_index);
+        }
         continue;
       }
+#endif
 
       // Lookup the column name given an index into the table column set.
       if (constraint_info.iColumn < 0 ||
           static_cast<size_t>(constraint_info.iColumn) >=
               pVtab->content->columns.size()) {
-        cost += 10;
         continue;
       }
       const auto& name = std::get<0>(columns[constraint_info.iColumn]);
+      auto options = std::get<2>(columns[constraint_info.iColumn]);
+      auto selectivity =
+          constraintSelectivity(constraint_info.op, options, rows, unique);
+      output_rows *= selectivity;
+      if (constraintLimitsGenerate(options)) {
+        generate_rows *= selectivity;
+      }
+      index += "|" + std::to_string(constraint_info.iColumn) + ":" +
+               std::to_string((int)constraint_info.op);
       // Save a pair of the name and the constraint operator.
       // Use this constraint during xFilter by performing a scan and column
       // name lookup through out all cursor constraint lists.
@@ -391,6 +723,7 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
     }
   }
 
+  double cost = std::max(1.0, generate_rows * per_row + output_rows);
   // Check if a REQUIRED column exists but was not satisfied via a constraint.
   if (satisfied.is_initialized() && !*satisfied) {
     cost += 1e10;
@@ -403,31 +736,136 @@ static int xBestIndex(sqlite3_vtab* tab, sqlite3_index_info* pIdxInfo) {
        std::to_string(constraints.size()) + " idx=" +
        std::to_string(pIdxInfo->idxNum) + "]");
 #endif
-  // Add the constraint set to the table's tracked constraints.
-  pVtab->content->constraints[pIdxInfo->idxNum] = std::move(constraints);
+  // The index string is owned by SQLite and kept with the query plan. A
+  // prepared statement may run xFilter with this plan many times.
+  pIdxInfo->idxStr = sqlite3_mprintf("%s", index.c_str());
+  pIdxInfo->needToFreeIdxStr = 1;
   pIdxInfo->estimatedCost = cost;
+#if SQLITE_VERSION_NUMBER >= 3008002
+  pIdxInfo->estimatedRows =
+      static_cast<sqlite3_int64>(std::max(1.0, output_rows));
+#endif
+#if SQLITE_VERSION_NUMBER >= 3009000
+  if (unique) {
+    pIdxInfo->idxFlags |= SQLITE_INDEX_SCAN_UNIQUE;
+  }
+#endif
   return SQLITE_OK;
 }
 
+/**
+ * @brief Decode the constraints and used columns encoded by xBestIndex.
+ *
+ * The index string is formatted as the optional column-usage mask followed by
+ * a "|column:operator" pair for each usable constraint, in argv order. A
+ * consumed ORDER BY appends "~a" or "~d" to the mask, and the LIMIT and OFFSET
+ * of an ordered scan use the column -1.
+ */
+static void decodeIndex(const VirtualTableContent* content,
+                        const char* idxStr,
+                        ConstraintSet& constraints,
+                        std::vector<size_t>& ordinals,
+                        QueryContext& context) {
+  if (idxStr == nullptr) {
+    return;
+  }
+
+  std::string index(idxStr);
+  auto next = index.find('|');
+  auto mask = index.substr(0, next);
+  auto order = mask.find('~');
+  if (order != std::string::npos) {
+    context.order = (mask.substr(order + 1) == "d")
+                        ? RowOrder::TIME_DESCENDING
+                        : RowOrder::TIME_ASCENDING;
+    mask = mask.substr(0, order);
+  }
+  if (!mask.empty()) {
+    unsigned long long used = 0;
+    if (safeStrtoull(mask, 10, used)) {
+      context.colsUsed = usedColumns(content, used);
+    }
+  }
+
+  while (next != std::string::npos) {
+    auto start = next + 1;
+    next = index.find('|', start);
+    auto term = index.substr(start, next - start);
+    auto delim = term.find(':');
+    long column = 0;
+    long op = 0;
+    if (delim == std::string::npos ||
+        !safeStrtol(term.substr(0, delim), 10, column) ||
+        !safeStrtol(term.substr(delim + 1), 10, op)) {
+      column = -1;
+      op = 0;
+    }
+    if (column == -1 && op != 0) {
+      // The LIMIT or OFFSET of an ordered scan.
+      constraints.push_back(
+          std::make_pair("", Constraint(static_cast<unsigned char>(op))));
+      ordinals.push_back(content->columns.size());
+      continue;
+    }
+    if (column < 0 ||
+        static_cast<size_t>(column) >= content->columns.size()) {
+      // This is not expected, the string is created by xBestIndex.
+      constraints.push_back(std::make_pair("", Constraint(0)));
+      ordinals.push_back(content->columns.size());
+      continue;
+    }
+    ordinals.push_back(static_cast<size_t>(column));
+    constraints.push_back(
+        std::make_pair(std::get<0>(content->columns[column]),
+                       Constraint(static_cast<unsigned char>(op))));
+  }
+}
+
+/// Request a row generator, resolving the table only if the registry changed.
+static void callTable(VirtualTableContent* content,
+                      QueryContext& context,
+                      RowGeneratorRef& generator) {
+  Registry::callTable(
+      getTableRoute(content), content->name, context, generator);
+}
+
 static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
                    int idxNum,
                    const char* idxStr,
                    int argc,
                    sqlite3_value** argv) {
+  PerfTimer timer(PERF_FILTER);
   BaseCursor* pCur = (BaseCursor*)pVtabCursor;
   auto* pVtab = (VirtualTable*)pVtabCursor->pVtab;
   auto* content = pVtab->content;
   pVtab->instance->addAffectedTable(content);
 
+  // A cursor may be filtered many times, for example within a join.
+  recordScan(pCur);
   pCur->row = 0;
-  pCur->n = 0;
-  QueryContext context(content);
+  pCur->rowid = 0;
+  // The context is owned by the cursor since generators may reference it.
+  pCur->generator = nullptr;
+  if (pCur->context != nullptr && pCur->context.use_count() == 1) {
+    // Within a join the cursor is filtered for each outer row, keep the
+    // constraint lists of the previous filter.
+    pCur->context->reset();
+  } else {
+    pCur->context = std::make_shared<QueryContext>(content);
+    for (const auto& column : content->columns) {
+      // Set the column affinity for each optional constraint list.
+      // There is a separate list for each column name.
+      pCur->context->constraints[std::get<0>(column)].affinity =
+          std::get<1>(column);
+    }
+  }
+  auto& context = *pCur->context;
 
   // Track required columns, this is different than the requirements check
   // that occurs within BestIndex because this scan includes a cursor.
   // For each cursor used, if a requirement exists, we need to scan the
   // selected set of constraints for a match.
-  bool required_satisfied = true;
+  bool required_satisfied = !content->has_required;
 
   // The specialized table attribute USER_BASED imposes a special requirement
   // for UID. This may be represented in the requirements, but otherwise
@@ -440,33 +878,27 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
       ((content->attributes & TableAttributes::EVENT_BASED) == 0 ||
        !FLAGS_disable_events);
 
-  std::map<std::string, ColumnOptions> options;
-  for (size_t i = 0; i < content->columns.size(); ++i) {
-    // Set the column affinity for each optional constraint list.
-    // There is a separate list for each column name.
-    auto column_name = std::get<0>(content->columns[i]);
-    context.constraints[column_name].affinity =
-        std::get<1>(content->columns[i]);
-    // Save the column options for comparison within constraints enumeration.
-    options[column_name] = std::get<2>(content->columns[i]);
-    if (options[column_name] & ColumnOptions::REQUIRED) {
-      required_satisfied = false;
-    }
-  }
-
 // Filtering between cursors happens iteratively, not consecutively.
 // If there are multiple sets of constraints, they apply to each cursor.
+  // Provide the columns used by this access, tables may skip unused columns.
+  ConstraintSet constraints;
+  std::vector<size_t> ordinals;
+  decodeIndex(content, idxStr, constraints, ordinals, context);
 #if defined(DEBUG)
   plan("Filtering called for table: " + content->name + " [constraint_count=" +
-       std::to_string(content->constraints.size()) + " argc=" +
-       std::to_string(argc) + " idx=" + std::to_string(idxNum) + "]");
+       std::to_string(constraints.size()) + " argc=" + std::to_string(argc) +
+       " idx=" + std::to_string(idxNum) + "]");
 #endif
 
   // Iterate over every argument to xFilter, filling in constraint values.
-  if (content->constraints.size() > 0) {
-    auto& constraints = content->constraints[idxNum];
+  // A negative LIMIT has no limit.
+  long long limit = 0;
+  long long offset = 0;
+  if (constraints.size() > 0) {
     if (argc > 0) {
-      for (size_t i = 0; i < static_cast<size_t>(argc); ++i) {
+      for (size_t i = 0;
+           i < static_cast<size_t>(argc) && i < constraints.size();
+           ++i) {
         auto expr = (const char*)sqlite3_value_text(argv[i]);
         if (expr == nullptr || expr[0] == 0) {
           // SQLite did not expose the expression value.
@@ -474,6 +906,15 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
         }
         // Set the expression from SQLite's now-populated argv.
         auto& constraint = constraints[i];
+#if SQLITE_VERSION_NUMBER >= 3038000
+        if (constraint.second.op == SQLITE_INDEX_CONSTRAINT_LIMIT) {
+          safeStrtoll(expr, 10, limit);
+          continue;
+        } else if (constraint.second.op == SQLITE_INDEX_CONSTRAINT_OFFSET) {
+          safeStrtoll(expr, 10, offset);
+          continue;
+        }
+#endif
         constraint.second.expr = std::string(expr);
         plan("Adding constraint to cursor (" + std::to_string(pCur->id) +
              "): " + constraint.first + " " + opString(constraint.second.op) +
@@ -481,7 +922,9 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
         // Add the constraint to the column-sorted query request map.
         context.constraints[constraint.first].add(constraint.second);
 
-        if (options[constraint.first] & ColumnOptions::REQUIRED) {
+        if (ordinals[i] < content->columns.size() &&
+            (std::get<2>(content->columns[ordinals[i]]) &
+             ColumnOptions::REQUIRED)) {
           // A required option exists in the constraints.
           required_satisfied = true;
         }
@@ -495,6 +938,10 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
       // Constraints failed.
     }
   }
+  if (limit > 0 && offset >= 0 &&
+      offset < std::numeric_limits<long long>::max() - limit) {
+    context.limit = static_cast<size_t>(limit + offset);
+  }
 
   if (!user_based_satisfied) {
     LOG(WARNING) << "The " << pVtab->content->name
@@ -518,25 +965,81 @@ static int xFilter(sqlite3_vtab_cursor* pVtabCursor,
 
   // Reset the virtual table contents.
   pCur->data.clear();
-  options.clear();
+  pCur->typed_data.clear();
 
-  // Generate the row data set.
+  // Create the row generator, and pull the first batch of rows.
   plan("Scanning rows for cursor (" + std::to_string(pCur->id) + ")");
-  Registry::callTable(pVtab->content->name, context, pCur->data);
+  auto start = std::chrono::steady_clock::now();
+  pCur->timed = true;
+  pCur->full = (argc == 0);
+  bool memoize = (content->attributes & TableAttributes::DETERMINISTIC) > 0;
+  std::string memo_key;
+  if (memoize) {
+    // An inner table of a join may be filtered with the same constraints.
+    memo_key = TableResultCache::key(content->name, context);
+    auto memo = content->memo.find(memo_key);
+    if (memo != content->memo.end()) {
+      pCur->generator = std::make_shared<QueryDataGenerator>(memo->second);
+      pCur->timed = false;
+      memoize = false;
+    }
+  }
 
-  // Set the number of rows.
-  pCur->n = pCur->data.size();
+  if (pCur->generator != nullptr) {
+    // Rows are returned from the statement's memo.
+  } else if (TableResultCache::enabled(content->attributes)) {
+    // Complete results may be shared between queries for a short window.
+    auto key = TableResultCache::key(content->name, context);
+    QueryData cached;
+    if (TableResultCache::instance().get(key, cached)) {
+      pCur->generator = std::make_shared<QueryDataGenerator>(std::move(cached));
+      pVtab->instance->addCacheResult(true);
+      pCur->timed = false;
+    } else {
+      PerfTimer generate(PERF_GENERATE);
+      callTable(content, context, pCur->generator);
+      pCur->generator =
+          std::make_shared<CachingRowGenerator>(key, pCur->generator);
+      pVtab->instance->addCacheResult(false);
+    }
+  } else {
+    PerfTimer generate(PERF_GENERATE);
+    callTable(content, context, pCur->generator);
+  }
+  if (pCur->timed) {
+    pCur->generate_time = getElapsedTime(start);
+  }
+  pCur->profiled = QueryProfile::instance().active();
+  if (pCur->profiled) {
+    bool cached = !pCur->timed;
+    QueryProfile::instance().addFilter(
+        content->name, cached, (cached) ? 0 : getElapsedTime(start));
+  }
+  if (memoize && pCur->generator != nullptr) {
+    pCur->generator = std::make_shared<MemoRowGenerator>(
+        content, std::move(memo_key), pCur->generator);
+  }
+  pCur->typed = (std::dynamic_pointer_cast<TypedRowGenerator>(
+                     pCur->generator) != nullptr);
+  fetchRows(pCur);
   return SQLITE_OK;
 }
 }
 }
 
-Status attachTableInternal(const std::string& name,
-                           const std::string& statement,
-                           const SQLiteDBInstanceRef& instance) {
+/**
+ * @brief Create a table's module and virtual table.
+ *
+ * The caller holds kAttachMutex. If the table is eponymous only the module is
+ * created, SQLite connects the table when a statement first references it.
+ */
+static int createTableInternal(const std::string& name,
+                               const std::string& statement,
+                               const SQLiteDBInstanceRef& instance,
+                               bool eponymous = false) {
   if (SQLiteDBManager::isDisabled(name)) {
     VLOG(1) << "Table " << name << " is disabled, not attaching";
-    return Status(0, getStringForSQLiteReturnCode(0));
+    return SQLITE_OK;
   }
 
   // A static module structure does not need specific logic per-table.
@@ -570,9 +1073,12 @@ Status attachTableInternal(const std::string& name,
 
   // Note, if the clientData API is used then this will save a registry call
   // within xCreate.
-  WriteLock lock(kAttachMutex);
   int rc = sqlite3_create_module(
       instance->db(), name.c_str(), &module, (void*)&(*instance));
+  if (eponymous) {
+    // The module's xCreate is also its xConnect, the table is eponymous.
+    return rc;
+  }
   if (rc == SQLITE_OK || rc == SQLITE_MISUSE) {
     auto format =
         "CREATE VIRTUAL TABLE temp." + name + " USING " + name + statement;
@@ -580,6 +1086,41 @@ Status attachTableInternal(const std::string& name,
   } else {
     LOG(ERROR) << "Error attaching table: " << name << " (" << rc << ")";
   }
+  return rc;
+}
+
+Status attachTableInternal(const std::string& name,
+                           const std::string& statement,
+                           const SQLiteDBInstanceRef& instance) {
+  WriteLock lock(kAttachMutex);
+  int rc = createTableInternal(name, statement, instance);
+  return Status(rc, getStringForSQLiteReturnCode(rc));
+}
+
+Status attachTablesInternal(const std::vector<TableDefinition>& tables,
+                            const SQLiteDBInstanceRef& instance) {
+  WriteLock lock(kAttachMutex);
+  // The tables are created within a transaction so the schema changes once.
+  int rc = sqlite3_exec(instance->db(), "BEGIN", nullptr, nullptr, 0);
+  if (rc != SQLITE_OK) {
+    return Status(rc, getStringForSQLiteReturnCode(rc));
+  }
+
+  int failed = SQLITE_OK;
+  for (const auto& table : tables) {
+    // A failed table does not prevent the remaining tables from attaching.
+    rc = createTableInternal(table.first, table.second, instance);
+    if (rc != SQLITE_OK) {
+      LOG(ERROR) << "Error attaching table: " << table.first << " (" << rc
+                 << ")";
+      failed = rc;
+    }
+  }
+
+  rc = sqlite3_exec(instance->db(), "COMMIT", nullptr, nullptr, 0);
+  if (rc == SQLITE_OK) {
+    rc = failed;
+  }
   return Status(rc, getStringForSQLiteReturnCode(rc));
 }
 
@@ -590,6 +1131,12 @@ Status detachTableInternal(const std::string& name, sqlite3* db) {
   if (rc != SQLITE_OK) {
     LOG(ERROR) << "Error detaching table: " << name << " (" << rc << ")";
   }
+#if SQLITE_VERSION_NUMBER >= 3009000
+  if (FLAGS_lazy_tables) {
+    // Dropping the module disconnects an eponymous table.
+    sqlite3_create_module(db, name.c_str(), nullptr, nullptr);
+  }
+#endif
 
   return Status(rc, getStringForSQLiteReturnCode(rc));
 }
@@ -614,16 +1161,55 @@ Status attachFunctionInternal(
   return Status(rc);
 }
 
+/**
+ * @brief Create a module for each table, and the views for table aliases.
+ *
+ * A table's columns are requested and its virtual table is created only when
+ * a statement first references it. Views do not connect their tables.
+ */
+static void attachEponymousTables(const SQLiteDBInstanceRef& instance) {
+  WriteLock lock(kAttachMutex);
+  std::vector<std::string> views;
+  PluginResponse response;
+  for (const auto& name : Registry::names("table")) {
+    if (createTableInternal(name, "", instance, true) != SQLITE_OK) {
+      LOG(ERROR) << "Error attaching table: " << name;
+      continue;
+    }
+
+    if (!getTableColumns(name, response).ok()) {
+      continue;
+    }
+    for (const auto& column : response) {
+      if (column.count("id") > 0 && column.at("id") == "alias" &&
+          column.count("alias") > 0) {
+        views.push_back("CREATE VIEW " + column.at("alias") +
+                        " AS SELECT * FROM " + name);
+      }
+    }
+  }
+
+  for (const auto& view : views) {
+    sqlite3_exec(instance->db(), view.c_str(), nullptr, nullptr, nullptr);
+  }
+}
+
 void attachVirtualTables(const SQLiteDBInstanceRef& instance) {
   if (FLAGS_enable_foreign) {
     registerForeignTables();
   }
 
+#if SQLITE_VERSION_NUMBER >= 3009000
+  if (FLAGS_lazy_tables) {
+    attachEponymousTables(instance);
+    return;
+  }
+#endif
+
   PluginResponse response;
   for (const auto& name : Registry::names("table")) {
     // Column information is nice for virtual table create call.
-    auto status =
-        Registry::call("table", name, {{"action", "columns"}}, response);
+    auto status = getTableColumns(name, response);
     if (status.ok()) {
       auto statement = columnDefinition(response, true);
       attachTableInternal(name, statement, instance);
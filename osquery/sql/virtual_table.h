@@ -31,14 +31,41 @@ struct BaseCursor : private boost::noncopyable {
   /// Track cursors for optional planner output.
   size_t id{0};
 
-  /// Table data generated from last access.
+  /// The query context for the current filter, referenced by the generator.
+  std::shared_ptr<QueryContext> context{nullptr};
+
+  /// The table's row generator, reset when the generator is exhausted.
+  RowGeneratorRef generator{nullptr};
+
+  /// Set when the generator is a TypedRowGenerator.
+  bool typed{false};
+
+  /// The current batch of rows pulled from the generator.
   QueryData data;
 
-  /// Current cursor position.
+  /// The current batch of typed rows, used instead of data if typed is set.
+  TypedQueryData typed_data;
+
+  /// Current position within the batch of rows.
   size_t row{0};
 
-  /// Total number of rows.
-  size_t n{0};
+  /// Current cursor position across every batch, the SQLite rowid.
+  size_t rowid{0};
+
+  /// Set if the current scan generates rows and is recorded in TableStats.
+  bool timed{false};
+
+  /// Microseconds the current scan spent generating rows.
+  uint64_t generate_time{0};
+
+  /// Rows generated by the current scan.
+  size_t generated{0};
+
+  /// Set if the current scan has no constraints, see TableStats::estimate.
+  bool full{false};
+
+  /// Set if the current scan is counted by the active QueryProfile.
+  bool profiled{false};
 };
 
 /**
@@ -63,6 +90,13 @@ Status attachTableInternal(const std::string &name,
                            const std::string &statement,
                            const SQLiteDBInstanceRef &instance);
 
+/// A table plugin name and its column definition statement.
+using TableDefinition = std::pair<std::string, std::string>;
+
+/// Attach several table plugins within one SQLite schema change.
+Status attachTablesInternal(const std::vector<TableDefinition> &tables,
+                            const SQLiteDBInstanceRef &instance);
+
 /// Detach (drop) a table.
 Status detachTableInternal(const std::string &name, sqlite3 *db);
 
@@ -71,6 +105,19 @@ Status attachFunctionInternal(
     std::function<
         void(sqlite3_context *context, int argc, sqlite3_value **argv)> func);
 
-/// Attach all table plugins to an in-memory SQLite database.
+/**
+ * @brief Attach all table plugins to an in-memory SQLite database.
+ *
+ * With --lazy_tables only each table's module is created, and a table is
+ * created when a statement first references it.
+ */
 void attachVirtualTables(const SQLiteDBInstanceRef &instance);
+
+/**
+ * @brief Request a table's column details, see TablePlugin::routeInfo.
+ *
+ * Responses are cached until the registry changes, so creating the same
+ * table in many connections calls the table plugin once.
+ */
+Status getTableColumns(const std::string &name, PluginResponse &response);
 }
@@ -67,7 +67,7 @@ void genBrowserPlugin(const std::string& uid,
   if (!pathExists(info_path)) {
     return;
   }
-  if (osquery::parsePlist(info_path, tree).ok()) {
+  if (osquery::cachedParsePlist(info_path, tree).ok()) {
     // Plugin did not include an Info.plist, or it was invalid
     for (const auto& it : kBrowserPluginKeys) {
       r[it.second] = tree.get(it.first, "");
@@ -52,18 +52,16 @@ const std::map<std::string, std::string> kFirefoxAddonKeys = {
     {"descriptor", "path"},
 };
 
-void genFirefoxAddonsFromExtensions(const std::string& uid,
-                                    const std::string& path,
+void genFirefoxAddonsFromExtensions(const std::string& path,
                                     QueryData& results) {
   pt::ptree tree;
-  if (!osquery::parseJSON(path + kFirefoxExtensionsFile, tree).ok()) {
-    TLOG << "Could not parse JSON from: " << path + kFirefoxExtensionsFile;
+  if (!osquery::parseJSON(path, tree).ok()) {
+    TLOG << "Could not parse JSON from: " << path;
     return;
   }
 
   for (const auto& addon : tree.get_child("addons")) {
     Row r;
-    r["uid"] = uid;
     // Most of the keys are in the top-level JSON dictionary.
     for (const auto& it : kFirefoxAddonKeys) {
       r[it.second] = addon.second.get(it.first, "");
@@ -85,27 +83,25 @@ void genFirefoxAddonsFromExtensions(const std::string& uid,
 }
 
 QueryData genFirefoxAddons(QueryContext& context) {
-  QueryData results;
-
   // Iterate over each user
-  QueryData users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      // For each user, enumerate all of their Firefox profiles.
-      std::vector<std::string> profiles;
-      auto directory = fs::path(row.at("directory")) / kFirefoxPath;
-      if (!listDirectoriesInDirectory(directory, profiles).ok()) {
-        continue;
-      }
-
-      // Generate an addons list from their extensions JSON.
-      for (const auto& profile : profiles) {
-        genFirefoxAddonsFromExtensions(row.at("uid"), profile, results);
-      }
+  return genBrowserUsers(context,
+                         [](const std::string& uid,
+                            const fs::path& home,
+                            QueryData& results) {
+    // For each user, enumerate all of their Firefox profiles.
+    std::vector<std::string> profiles;
+    auto directory = home / kFirefoxPath;
+    listCachedDirectories(directory.string(), profiles);
+
+    // Generate an addons list from their extensions JSON, each profile's
+    // addons are parsed again only if the file changed.
+    for (const auto& profile : profiles) {
+      genCachedBrowserFile(uid,
+                           profile + kFirefoxExtensionsFile,
+                           genFirefoxAddonsFromExtensions,
+                           results);
     }
-  }
-
-  return results;
+  });
 }
 }
 }
@@ -8,12 +8,21 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <map>
+
+#include <osquery/core.h>
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 
 #include "osquery/tables/applications/posix/browser_utils.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
+
 namespace tables {
 
 #define kManifestFile "/manifest.json"
@@ -27,28 +36,150 @@ const std::map<std::string, std::string> kExtensionKeys = {
     {"author", "author"},
     {"background.persistent", "persistent"}};
 
-void genExtension(const std::string& uid,
-                  const std::string& path,
-                  QueryData& results) {
-  std::string json_data;
-  if (!forensicReadFile(path + kManifestFile, json_data).ok()) {
+/// The files and directories kept by the browser caches, each.
+const size_t kBrowserCacheMax = 16384;
+
+/// A parsed file's rows, or a directory's entries.
+struct BrowserCacheEntry {
+  /// The inode, size, and modification time.
+  std::string identity;
+
+  /// Rows parsed from a file, without the uid.
+  QueryData rows;
+
+  /// Directories within a directory.
+  std::vector<std::string> directories;
+};
+
+/// Parsed browser files and listed directories, keyed by path.
+static std::map<std::string, BrowserCacheEntry> kBrowserFiles;
+static std::map<std::string, BrowserCacheEntry> kBrowserDirectories;
+static Mutex kBrowserCacheMutex;
+
+/// Stat a path, returning the inode, size, and modification time.
+static bool getBrowserIdentity(const std::string& path, std::string& identity) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  identity = std::to_string(st.st_ino) + ":" + std::to_string(st.st_size);
+#if defined(__linux__)
+  identity += ":" + std::to_string(st.st_mtim.tv_sec) + "." +
+              std::to_string(st.st_mtim.tv_nsec);
+#elif defined(__APPLE__)
+  identity += ":" + std::to_string(st.st_mtimespec.tv_sec) + "." +
+              std::to_string(st.st_mtimespec.tv_nsec);
+#else
+  identity += ":" + std::to_string(st.st_mtime);
+#endif
+  return true;
+}
+
+/// Store a cache entry, the cache is emptied when it reaches the limit.
+static void storeBrowserEntry(std::map<std::string, BrowserCacheEntry>& cache,
+                              const std::string& path,
+                              BrowserCacheEntry entry) {
+  WriteLock lock(kBrowserCacheMutex);
+  if (cache.size() >= kBrowserCacheMax && cache.count(path) == 0) {
+    cache.clear();
+  }
+  cache[path] = std::move(entry);
+}
+
+void genCachedBrowserFile(const std::string& uid,
+                          const std::string& path,
+                          const BrowserFileParser& parser,
+                          QueryData& results) {
+  BrowserCacheEntry entry;
+  if (!getBrowserIdentity(path, entry.identity)) {
+    return;
+  }
+
+  bool cached = false;
+  {
+    WriteLock lock(kBrowserCacheMutex);
+    auto it = kBrowserFiles.find(path);
+    if (it != kBrowserFiles.end() && it->second.identity == entry.identity) {
+      entry.rows = it->second.rows;
+      cached = true;
+    }
+  }
+
+  if (!cached) {
+    // Failures are stored as a file without rows, and not parsed again until
+    // the file changes.
+    parser(path, entry.rows);
+    std::string after;
+    if (getBrowserIdentity(path, after) && after == entry.identity) {
+      storeBrowserEntry(kBrowserFiles, path, entry);
+    }
+  }
+
+  for (auto& row : entry.rows) {
+    row["uid"] = uid;
+    results.push_back(std::move(row));
+  }
+}
+
+void listCachedDirectories(const std::string& path,
+                           std::vector<std::string>& results) {
+  BrowserCacheEntry entry;
+  if (!getBrowserIdentity(path, entry.identity)) {
+    return;
+  }
+
+  {
+    WriteLock lock(kBrowserCacheMutex);
+    auto it = kBrowserDirectories.find(path);
+    if (it != kBrowserDirectories.end() &&
+        it->second.identity == entry.identity) {
+      results.insert(results.end(),
+                     it->second.directories.begin(),
+                     it->second.directories.end());
+      return;
+    }
+  }
+
+  listDirectoriesInDirectory(path, entry.directories);
+  results.insert(
+      results.end(), entry.directories.begin(), entry.directories.end());
+  std::string after;
+  if (getBrowserIdentity(path, after) && after == entry.identity) {
+    storeBrowserEntry(kBrowserDirectories, path, std::move(entry));
+  }
+}
+
+QueryData genBrowserUsers(QueryContext& context,
+                          const BrowserUserGenerator& generator) {
+  QueryData results;
+  context.generateEach(usersFromContext(context),
+                       [&generator](const Row& row, QueryData& rows) {
+                         if (row.count("uid") > 0 &&
+                             row.count("directory") > 0) {
+                           generator(row.at("uid"), row.at("directory"), rows);
+                         }
+                       },
+                       results,
+                       true);
+  return results;
+}
+
+void genExtension(const std::string& path, QueryData& results) {
+  FileView view;
+  if (!readFileView(path + kManifestFile, view, true).ok()) {
     VLOG(1) << "Could not read file: " << path + kManifestFile;
     return;
   }
 
-  // Read the extensions data into a JSON blob, then property tree.
+  // Parse the extensions data into a property tree without a copy.
   pt::ptree tree;
-  try {
-    std::stringstream json_stream;
-    json_stream << json_data;
-    pt::read_json(json_stream, tree);
-  } catch (const pt::json_parser::json_parser_error& e) {
+  if (!deserializeTreeJSON(view.data(), view.size(), tree).ok()) {
     VLOG(1) << "Could not parse JSON from: " << path + kManifestFile;
     return;
   }
 
   Row r;
-  r["uid"] = uid;
   // Most of the keys are in the top-level JSON dictionary.
   for (const auto& it : kExtensionKeys) {
     r[it.second] = tree.get<std::string>(it.first, "");
@@ -73,38 +204,40 @@ void genExtension(const std::string& uid,
 
 QueryData genChromeBasedExtensions(QueryContext& context,
                                    const fs::path& sub_dir) {
-  QueryData results;
+  return genBrowserUsers(context,
+                         [&sub_dir](const std::string& uid,
+                                    const fs::path& directory,
+                                    QueryData& results) {
+    // For each user, enumerate all of their chrome profiles.
+    std::vector<std::string> profiles;
+    fs::path extension_path = directory / sub_dir;
+    if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
+      return;
+    }
 
-  auto users = usersFromContext(context);
-  for (const auto& row : users) {
-    if (row.count("uid") > 0 && row.count("directory") > 0) {
-      // For each user, enumerate all of their chrome profiles.
-      std::vector<std::string> profiles;
-      fs::path extension_path = row.at("directory") / sub_dir;
-      if (!resolveFilePattern(extension_path, profiles, GLOB_FOLDERS).ok()) {
-        continue;
-      }
-
-      // For each profile list each extension in the Extensions directory.
-      std::vector<std::string> extensions;
-      for (const auto& profile : profiles) {
-        listDirectoriesInDirectory(profile, extensions);
-      }
-
-      // Generate an addons list from their extensions JSON.
-      std::vector<std::string> versions;
-      for (const auto& extension : extensions) {
-        listDirectoriesInDirectory(extension, versions);
-      }
-
-      // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
-      for (const auto& version : versions) {
-        genExtension(row.at("uid"), version, results);
-      }
+    // For each profile list each extension in the Extensions directory.
+    // Directory listings are reused while the directories are unchanged.
+    std::vector<std::string> extensions;
+    for (const auto& profile : profiles) {
+      listCachedDirectories(profile, extensions);
     }
-  }
 
-  return results;
+    std::vector<std::string> versions;
+    for (const auto& extension : extensions) {
+      listCachedDirectories(extension, versions);
+    }
+
+    // Extensions use /<EXTENSION>/<VERSION>/manifest.json.
+    for (const auto& version : versions) {
+      genCachedBrowserFile(
+          uid,
+          version + kManifestFile,
+          [&version](const std::string&, QueryData& rows) {
+            genExtension(version, rows);
+          },
+          results);
+    }
+  });
 }
 }
 }
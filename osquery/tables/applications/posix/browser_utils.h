@@ -10,6 +10,10 @@
 
 #pragma once
 
+#include <functional>
+#include <string>
+#include <vector>
+
 #include <boost/property_tree/json_parser.hpp>
 
 #include <osquery/filesystem.h>
@@ -24,6 +28,44 @@ namespace tables {
 QueryData genChromeBasedExtensions(QueryContext& context,
                                    const fs::path& sub_dir);
 
+/// Parse a browser file into rows, the rows do not include the uid.
+using BrowserFileParser =
+    std::function<void(const std::string& path, QueryData& rows)>;
+
+/// Generate the rows of a user's browser profiles.
+using BrowserUserGenerator = std::function<void(
+    const std::string& uid, const fs::path& directory, QueryData& results)>;
+
+/**
+ * @brief Get the rows parsed from a browser file, such as a manifest.
+ *
+ * The rows are kept until the file's modification time, size, or inode
+ * change, an unchanged file is not read or parsed again. Each row is given
+ * the user's uid.
+ */
+void genCachedBrowserFile(const std::string& uid,
+                          const std::string& path,
+                          const BrowserFileParser& parser,
+                          QueryData& results);
+
+/**
+ * @brief List the directories within a directory, see
+ * listDirectoriesInDirectory.
+ *
+ * Entries are only listed again if the directory's modification time changed.
+ */
+void listCachedDirectories(const std::string& path,
+                           std::vector<std::string>& results);
+
+/**
+ * @brief Call a generator for each user in the query context.
+ *
+ * Users are generated by the table workers, see QueryContext::generateEach,
+ * the results keep the order of the users.
+ */
+QueryData genBrowserUsers(QueryContext& context,
+                          const BrowserUserGenerator& generator);
+
 /// A helper check to rename bool-type values as 1 or 0.
 inline void jsonBoolAsInt(std::string& s) {
   if (s == "true" || s == "YES" || s == "Yes") {
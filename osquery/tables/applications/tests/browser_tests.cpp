@@ -0,0 +1,110 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <gtest/gtest.h>
+
+#include <boost/filesystem/operations.hpp>
+
+#include <osquery/filesystem.h>
+
+#ifndef WIN32
+#include "osquery/tables/applications/posix/browser_utils.h"
+#endif
+#include "osquery/tests/test_util.h"
+
+namespace osquery {
+namespace tables {
+
+#ifndef WIN32
+class BrowserTablesTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    root_ = fs::path(kTestWorkingDirectory) / "browser-tests";
+    fs::remove_all(root_);
+    fs::create_directories(root_);
+  }
+
+  void TearDown() override {
+    fs::remove_all(root_);
+  }
+
+ protected:
+  fs::path root_;
+};
+
+TEST_F(BrowserTablesTests, test_cached_browser_file) {
+  auto path = (root_ / "manifest.json").string();
+  writeTextFile(path, "{}");
+
+  size_t parsed = 0;
+  std::string name = "first";
+  auto parser = [&parsed, &name](const std::string&, QueryData& rows) {
+    parsed++;
+    rows.push_back({{"name", name}});
+  };
+
+  QueryData results;
+  genCachedBrowserFile("500", path, parser, results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["name"], "first");
+  EXPECT_EQ(results[0]["uid"], "500");
+  EXPECT_EQ(parsed, 1U);
+
+  // An unchanged file is not parsed again, each user gets its own uid.
+  name = "second";
+  results.clear();
+  genCachedBrowserFile("501", path, parser, results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["name"], "first");
+  EXPECT_EQ(results[0]["uid"], "501");
+  EXPECT_EQ(parsed, 1U);
+
+  // A changed file is parsed again.
+  writeTextFile(path, "{\"name\": \"second\"}");
+  results.clear();
+  genCachedBrowserFile("500", path, parser, results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["name"], "second");
+  EXPECT_EQ(parsed, 2U);
+
+  // A missing file has no rows.
+  fs::remove(path);
+  results.clear();
+  genCachedBrowserFile("500", path, parser, results);
+  EXPECT_TRUE(results.empty());
+  EXPECT_EQ(parsed, 2U);
+}
+
+TEST_F(BrowserTablesTests, test_cached_directories) {
+  fs::create_directories(root_ / "first");
+
+  std::vector<std::string> directories;
+  listCachedDirectories(root_.string(), directories);
+  ASSERT_EQ(directories.size(), 1U);
+  EXPECT_EQ(fs::path(directories[0]).filename().string(), "first");
+
+  // The listing is the same while the directory is unchanged.
+  directories.clear();
+  listCachedDirectories(root_.string(), directories);
+  EXPECT_EQ(directories.size(), 1U);
+
+  // A new directory changes the modification time and is listed.
+  fs::create_directories(root_ / "second");
+  directories.clear();
+  listCachedDirectories(root_.string(), directories);
+  EXPECT_EQ(directories.size(), 2U);
+
+  // Results are appended to the listings of other directories.
+  listCachedDirectories((root_ / "first").string(), directories);
+  EXPECT_EQ(directories.size(), 2U);
+}
+#endif
+}
+}
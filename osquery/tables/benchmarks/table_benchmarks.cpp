@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/registry.h>
+
+#include "osquery/tables/benchmarks/table_benchmarks.h"
+#include "osquery/tests/allocations.h"
+
+namespace osquery {
+
+void runTableBenchmark(benchmark::State& state,
+                       const std::string& name,
+                       QueryContext& context) {
+  std::shared_ptr<TablePlugin> table = nullptr;
+  if (Registry::exists("table", name)) {
+    auto plugin = Registry::get("table", name);
+    table = std::dynamic_pointer_cast<TablePlugin>(plugin);
+  }
+
+  size_t rows = 0;
+  size_t bytes = 0;
+  size_t allocations = 0;
+  size_t iterations = 0;
+  while (state.KeepRunning()) {
+    if (table == nullptr) {
+      continue;
+    }
+
+    auto before = getAllocationCounts().allocations;
+    auto results = TableBenchmark::generate(*table, context);
+    allocations += getAllocationCounts().allocations - before;
+    iterations++;
+
+    state.PauseTiming();
+    rows += results.size();
+    for (const auto& row : results) {
+      for (const auto& column : row) {
+        bytes += column.first.size() + column.second.size();
+      }
+    }
+    results.clear();
+    state.ResumeTiming();
+  }
+
+  if (table == nullptr) {
+    state.SetLabel("table not registered");
+    return;
+  }
+
+  state.SetItemsProcessed(rows);
+  state.SetBytesProcessed(bytes);
+  if (iterations > 0) {
+    auto label = "rows: " + std::to_string(rows / iterations) +
+                 "  bytes/row: " +
+                 std::to_string((rows > 0) ? bytes / rows : 0) +
+                 "  allocations: " + std::to_string(allocations / iterations);
+    state.SetLabel(label);
+  }
+}
+}
@@ -0,0 +1,46 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+#include <osquery/tables.h>
+
+namespace osquery {
+
+/**
+ * @brief Benchmark a registered table's generate method.
+ *
+ * Benchmarks are generated from each table spec, see gentable.py's benchmark
+ * template, using the equality constraints from the spec's examples. Each
+ * iteration calls the table's generate method directly, without SQLite or
+ * serialization. Rows per second are reported as items processed, the bytes
+ * of column names and values as bytes processed, and the label counts the
+ * rows, bytes, and heap allocations per generate.
+ *
+ * @param state the benchmark state.
+ * @param name the table name.
+ * @param context the constraints from the spec's examples.
+ */
+void runTableBenchmark(benchmark::State& state,
+                       const std::string& name,
+                       QueryContext& context);
+
+/// Access to TablePlugin::generate for the table benchmarks.
+class TableBenchmark {
+ public:
+  static QueryData generate(TablePlugin& table, QueryContext& context) {
+    return table.generate(context);
+  }
+};
+}
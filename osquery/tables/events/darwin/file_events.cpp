@@ -87,6 +87,9 @@ Status FileEventSubscriber::Callback(const FSEventsEventContextRef& ec,
   r["target_path"] = ec->path;
   r["category"] = sc->category;
   r["transaction_id"] = INTEGER(ec->transaction_id);
+  // FSEvents does not report the process causing the event.
+  r["pid"] = "0";
+  r["process_path"] = "";
 
   // Add hashing and 'join' against the file table for stat-information.
   decorateFileEvent(
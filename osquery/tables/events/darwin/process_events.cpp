@@ -9,14 +9,32 @@
  */
 
 #include <osquery/config.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/packs.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/kernel.h"
 
 namespace pt = boost::property_tree;
 
 namespace osquery {
 
+FLAG(string,
+     process_events_uids,
+     "",
+     "Comma-delimited uids whose executions are recorded (default all)");
+
+FLAG(string,
+     process_events_exec_allow,
+     "",
+     "Comma-delimited executable path prefixes to record (default all)");
+
+FLAG(string,
+     process_events_exec_deny,
+     "",
+     "Comma-delimited executable path prefixes to never record");
+
 class ProcessEventSubscriber : public EventSubscriber<KernelEventPublisher> {
  public:
   /// The process event subscriber declares a kernel event type subscription.
@@ -25,6 +43,11 @@ class ProcessEventSubscriber : public EventSubscriber<KernelEventPublisher> {
   /// Kernel events matching the event type will fire.
   Status Callback(const TypedKernelEventContextRef<osquery_process_event_t> &ec,
                   const KernelSubscriptionContextRef &sc);
+
+  /// Hunting queries commonly look for a process path or pid.
+  std::set<std::string> getIndexedColumns() override {
+    return {"path", "pid"};
+  }
 };
 
 REGISTER(ProcessEventSubscriber, "event_subscriber", "process_events");
@@ -35,8 +58,12 @@ Status ProcessEventSubscriber::init() {
     return Status(1, "No kernel event publisher");
   }
 
+  // The kernel checks these filters before enqueueing an execution.
   auto sc = createSubscriptionContext();
   sc->event_type = OSQUERY_PROCESS_EVENT;
+  sc->uids = parseKernelFilterUIDs(FLAGS_process_events_uids);
+  sc->exec_allow = split(FLAGS_process_events_exec_allow, ",");
+  sc->exec_deny = split(FLAGS_process_events_exec_deny, ",");
   subscribe(&ProcessEventSubscriber::Callback, sc);
 
   return Status(0, "OK");
@@ -123,6 +150,9 @@ Status ProcessEventSubscriber::Callback(
 
   add(r, ec->time);
 
+  // A new process may satisfy pack discovery queries.
+  invalidateDiscoveryQueries("processes");
+
   return Status(0, "OK");
 }
 } // namespace osquery
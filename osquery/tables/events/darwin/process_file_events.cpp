@@ -11,12 +11,18 @@
 #include <osquery/config.h>
 #include <osquery/events.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 
 #include "osquery/events/kernel.h"
 
 namespace osquery {
 
+FLAG(string,
+     process_file_events_uids,
+     "",
+     "Comma-delimited uids whose file accesses are recorded (default all)");
+
 class ProcessFileEventSubscriber
     : public EventSubscriber<KernelEventPublisher> {
  public:
@@ -44,19 +50,20 @@ void ProcessFileEventSubscriber::configure() {
   // There may be a better way to find the set intersection/difference.
   removeSubscriptions();
 
-  Config::getInstance().files([this](const std::string &category,
-                                     const std::vector<std::string> &files) {
+  auto uids = parseKernelFilterUIDs(FLAGS_process_file_events_uids);
+  Config::getInstance().files([this, &uids](
+      const std::string &category, const std::vector<std::string> &files) {
     for (const auto &file : files) {
       auto sc = createSubscriptionContext();
       sc->event_type = OSQUERY_FILE_EVENT;
-      osquery_file_event_subscription_t sub = {
-          .actions = (osquery_file_action_t)(
-              OSQUERY_FILE_ACTION_OPEN | OSQUERY_FILE_ACTION_CLOSE |
-              OSQUERY_FILE_ACTION_CLOSE_MODIFIED)};
+      sc->actions = OSQUERY_FILE_ACTION_OPEN | OSQUERY_FILE_ACTION_CLOSE |
+                    OSQUERY_FILE_ACTION_CLOSE_MODIFIED;
       auto path = file;
       replaceGlobWildcards(path);
       path = path.substr(0, path.find("*"));
-      strncpy(sub.path, path.c_str(), MAXPATHLEN);
+      // The kernel compares this prefix before enqueueing a file event.
+      sc->paths.push_back(path);
+      sc->uids = uids;
       sc->category = category;
       VLOG(1) << "Added process file event listener to: " << path;
       subscribe(&ProcessFileEventSubscriber::Callback, sc);
@@ -32,11 +32,13 @@ void decorateFileEvent(const std::string& path, bool hash, Row& r) {
   }
 
   if (hash) {
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
+    auto mask =
+        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256 | HASH_TYPE_XXH64;
+    auto hashes = cachedHashMultiFromFile(mask, path);
     r["md5"] = std::move(hashes.md5);
     r["sha1"] = std::move(hashes.sha1);
     r["sha256"] = std::move(hashes.sha256);
+    r["xxh64"] = std::move(hashes.xxh64);
     // Hashed determines the success/status of hashing, -1 failed, 1 success.
     r["hashed"] = (r.at("md5").empty()) ? "-1" : "1";
   } else {
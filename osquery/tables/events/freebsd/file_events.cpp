@@ -0,0 +1,113 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include <osquery/config.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/events/freebsd/kqueue.h"
+#include "osquery/tables/events/event_utils.h"
+
+namespace osquery {
+
+/**
+ * @brief Track time, action changes to the configured file paths.
+ */
+class FileEventSubscriber : public EventSubscriber<KqueueEventPublisher> {
+ public:
+  Status init() override {
+    configure();
+    return Status(0);
+  }
+
+  /// Walk the configuration's file paths, create subscriptions.
+  void configure() override;
+
+  /// Fire a row for each KqueueEventPublisher event.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+
+ private:
+  /// Subscriptions keyed by category, path, and mask, kept across configures.
+  std::map<std::string, SCRef> paths_;
+};
+
+REGISTER(FileEventSubscriber, "event_subscriber", "file_events");
+
+void FileEventSubscriber::configure() {
+  // Only subscribe the added paths and remove the paths no longer configured.
+  // Unchanged paths keep their kqueue descriptors.
+  std::map<std::string, SCRef> paths;
+
+  auto parser = Config::getParser("file_paths");
+  auto& accesses = parser->getData().get_child("file_accesses");
+  Config::getInstance().files([this, &accesses, &paths](
+      const std::string& category, const std::vector<std::string>& files) {
+    auto mask = kFileDefaultMasks;
+    if (accesses.count(category) > 0) {
+      mask |= kFileAccessMasks;
+    }
+
+    for (const auto& file : files) {
+      auto key = category + '\0' + file + '\0' + std::to_string(mask);
+      if (paths.count(key) > 0) {
+        continue;
+      }
+
+      auto existing = paths_.find(key);
+      if (existing != paths_.end()) {
+        paths[key] = existing->second;
+        paths_.erase(existing);
+        continue;
+      }
+
+      VLOG(1) << "Added file event listener to: " << file;
+      auto sc = createSubscriptionContext();
+      sc->path = file;
+      sc->mask = mask;
+      sc->category = category;
+      subscribe(&FileEventSubscriber::Callback, sc);
+      paths[key] = sc;
+    }
+  });
+
+  // The remaining subscriptions are no longer configured.
+  for (const auto& path : paths_) {
+    VLOG(1) << "Removed file event listener from: " << path.second->path;
+    removeSubscription(path.second);
+  }
+  paths_.swap(paths);
+}
+
+Status FileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  if (ec->action.empty()) {
+    return Status(0);
+  }
+
+  Row r;
+  r["action"] = ec->action;
+  r["target_path"] = ec->path;
+  r["category"] = sc->category;
+  r["transaction_id"] = INTEGER(ec->transaction_id);
+  // kqueue does not report the process causing the event.
+  r["pid"] = "0";
+  r["process_path"] = "";
+
+  // Add hashing and 'join' against the file table for stat-information.
+  decorateFileEvent(
+      ec->path, (ec->action == "CREATED" || ec->action == "UPDATED"), r);
+
+  add(r, ec->time);
+  return Status(0, "OK");
+}
+}
@@ -8,6 +8,7 @@
  *
  */
 
+#include <map>
 #include <vector>
 #include <string>
 
@@ -18,6 +19,7 @@
 
 #include "osquery/events/linux/inotify.h"
 #include "osquery/tables/events/event_utils.h"
+#include "osquery/tables/events/linux/process_lineage.h"
 
 namespace osquery {
 
@@ -45,6 +47,10 @@ class FileEventSubscriber : public EventSubscriber<INotifyEventPublisher> {
    * @return Was the callback successful.
    */
   Status Callback(const ECRef& ec, const SCRef& sc);
+
+ private:
+  /// Subscriptions keyed by category, path, and mask, kept across configures.
+  std::map<std::string, SCRef> paths_;
 };
 
 /**
@@ -57,28 +63,51 @@ class FileEventSubscriber : public EventSubscriber<INotifyEventPublisher> {
 REGISTER(FileEventSubscriber, "event_subscriber", "file_events");
 
 void FileEventSubscriber::configure() {
-  // Clear all monitors from INotify.
-  // There may be a better way to find the set intersection/difference.
-  removeSubscriptions();
+  // Only subscribe the added paths and remove the paths no longer configured.
+  // Unchanged paths keep their inotify watches, no events are missed and
+  // their patterns are not resolved again.
+  std::map<std::string, SCRef> paths;
 
   auto parser = Config::getParser("file_paths");
   auto& accesses = parser->getData().get_child("file_accesses");
-  Config::getInstance().files([this, &accesses](
+  Config::getInstance().files([this, &accesses, &paths](
       const std::string& category, const std::vector<std::string>& files) {
+    auto mask = kFileDefaultMasks;
+    if (accesses.count(category) > 0) {
+      mask |= kFileAccessMasks;
+    }
+
     for (const auto& file : files) {
+      auto key = category + '\0' + file + '\0' + std::to_string(mask);
+      if (paths.count(key) > 0) {
+        continue;
+      }
+
+      auto existing = paths_.find(key);
+      if (existing != paths_.end()) {
+        paths[key] = existing->second;
+        paths_.erase(existing);
+        continue;
+      }
+
       VLOG(1) << "Added file event listener to: " << file;
       auto sc = createSubscriptionContext();
       // Use the filesystem globbing pattern to determine recursiveness.
       sc->recursive = 0;
       sc->path = file;
-      sc->mask = kFileDefaultMasks;
-      if (accesses.count(category) > 0) {
-        sc->mask |= kFileAccessMasks;
-      }
+      sc->mask = mask;
       sc->category = category;
       subscribe(&FileEventSubscriber::Callback, sc);
+      paths[key] = sc;
     }
   });
+
+  // The remaining subscriptions are no longer configured.
+  for (const auto& path : paths_) {
+    VLOG(1) << "Removed file event listener from: " << path.second->path;
+    removeSubscription(path.second);
+  }
+  paths_.swap(paths);
 }
 
 Status FileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
@@ -91,6 +120,11 @@ Status FileEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   r["target_path"] = ec->path;
   r["category"] = sc->category;
   r["transaction_id"] = INTEGER(ec->event->cookie);
+  r["pid"] = INTEGER(ec->pid);
+  // The fanotify pid may have exited, the lineage cache keeps its path.
+  r["process_path"] = (ec->pid > 0)
+                          ? tables::ProcessLineage::instance().getPath(ec->pid)
+                          : "";
 
   if ((sc->mask & kFileAccessMasks) != kFileAccessMasks) {
     // Add hashing and 'join' against the file table for stat-information.
@@ -12,13 +12,20 @@
 #include <string>
 
 #include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/linux/udev.h"
 
 namespace osquery {
 
+FLAG(string,
+     hardware_events_subsystems,
+     "",
+     "Comma-separated udev subsystems for hardware_events (default all)");
+
 /**
  * @brief Track udev events in Linux
  */
@@ -32,10 +39,18 @@ class HardwareEventSubscriber : public EventSubscriber<UdevEventPublisher> {
 REGISTER(HardwareEventSubscriber, "event_subscriber", "hardware_events");
 
 Status HardwareEventSubscriber::init() {
-  auto subscription = createSubscriptionContext();
-  subscription->action = UDEV_EVENT_ACTION_ALL;
+  // A subscription per subsystem lets the kernel filter the monitor events.
+  auto subsystems = split(FLAGS_hardware_events_subsystems, ",");
+  if (subsystems.empty()) {
+    subsystems.push_back("");
+  }
 
-  subscribe(&HardwareEventSubscriber::Callback, subscription);
+  for (const auto& subsystem : subsystems) {
+    auto subscription = createSubscriptionContext();
+    subscription->action = UDEV_EVENT_ACTION_ALL;
+    subscription->subsystem = subsystem;
+    subscribe(&HardwareEventSubscriber::Callback, subscription);
+  }
   return Status(0, "OK");
 }
 
@@ -11,16 +11,25 @@
 #include <boost/algorithm/hex.hpp>
 
 #include <osquery/config.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/packs.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
 
+#include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
+#include "osquery/tables/events/linux/process_lineage.h"
 
 namespace osquery {
 
 #define AUDIT_SYSCALL_EXECVE 59
 
+FLAG(string,
+     audit_process_filters,
+     "",
+     "Comma-delimited audit fields for execve rules (uid>=1000,exe=/bin/sh)");
+
 // Depend on the external getUptime table method.
 namespace tables {
 extern long getUptime();
@@ -34,6 +43,17 @@ class ProcessEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   /// Kernel events matching the event type will fire.
   Status Callback(const ECRef& ec, const SCRef& sc);
 
+  /// Assembled multi-record events contain every record of the process event.
+  Status AssembledCallback(const ECRef& ec);
+
+  /// Fill in the final details of a completed row and add the event.
+  void addRow(Row& r);
+
+  /// Hunting queries commonly look for a process path or pid.
+  std::set<std::string> getIndexedColumns() override {
+    return {"path", "pid"};
+  }
+
  private:
   /// The next expected process event state.
   AuditProcessEventState state_{STATE_SYSCALL};
@@ -76,19 +96,18 @@ Status validAuditState(int type, AuditProcessEventState& state) {
   return Status(0, "OK");
 }
 
-inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
-  const auto& fields = ec->fields;
-  if (ec->type == AUDIT_SYSCALL) {
-    r["pid"] = (fields.count("pid")) ? fields.at("pid") : "0";
-    r["parent"] = fields.count("ppid") ? fields.at("ppid") : "0";
-    r["uid"] = fields.count("uid") ? fields.at("uid") : "0";
-    r["euid"] = fields.count("euid") ? fields.at("euid") : "0";
-    r["gid"] = fields.count("gid") ? fields.at("gid") : "0";
-    r["egid"] = fields.count("egid") ? fields.at("euid") : "0";
-    r["path"] = (fields.count("exe")) ? decodeAuditValue(fields.at("exe")) : "";
+inline void updateAuditRow(int type, const AuditFields& fields, Row& r) {
+  if (type == AUDIT_SYSCALL) {
+    r["pid"] = fields.get("pid", "0");
+    r["parent"] = fields.get("ppid", "0");
+    r["uid"] = fields.get("uid", "0");
+    r["euid"] = fields.get("euid", "0");
+    r["gid"] = fields.get("gid", "0");
+    r["egid"] = fields.get("egid", "0");
+    r["path"] = decodeAuditValue(fields.get("exe"));
 
     // This should get overwritten during the EXECVE state.
-    r["cmdline"] = (fields.count("comm")) ? fields.at("comm") : "";
+    r["cmdline"] = fields.get("comm");
     // Do not record a cmdline size. If the final state is reached and no 'argc'
     // has been filled in then the EXECVE state was not used.
     r["cmdline_size"] = "";
@@ -99,11 +118,11 @@ inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
     r["env"] = "";
   }
 
-  if (ec->type == AUDIT_EXECVE) {
+  if (type == AUDIT_EXECVE) {
     // Reset the temporary storage from the SYSCALL state.
     r["cmdline"] = "";
-    for (const auto& arg : fields) {
-      if (arg.first == "argc") {
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields.key(i) == "argc") {
         continue;
       }
 
@@ -111,7 +130,7 @@ inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
       if (r.at("cmdline").size() > 0) {
         r["cmdline"] += " ";
       }
-      r["cmdline"] += decodeAuditValue(arg.second);
+      r["cmdline"] += decodeAuditValue(fields.value(i));
     }
 
     // There may be a better way to calculate actual size from audit.
@@ -119,10 +138,10 @@ inline void updateAuditRow(const AuditEventContextRef& ec, Row& r) {
     r["cmdline_size"] = std::to_string(r.at("cmdline").size());
   }
 
-  if (ec->type == AUDIT_PATH) {
-    r["mode"] = (fields.count("mode")) ? fields.at("mode") : "";
-    r["owner_uid"] = fields.count("ouid") ? fields.at("ouid") : "0";
-    r["owner_gid"] = fields.count("ogid") ? fields.at("ogid") : "0";
+  if (type == AUDIT_PATH) {
+    r["mode"] = fields.get("mode");
+    r["owner_uid"] = fields.get("ouid", "0");
+    r["owner_gid"] = fields.get("ogid", "0");
 
     auto qd = SQL::selectAllFrom("file", "path", EQUALS, r.at("path"));
     if (qd.size() == 1) {
@@ -142,24 +161,37 @@ REGISTER(ProcessEventSubscriber, "event_subscriber", "process_events");
 Status ProcessEventSubscriber::init() {
   auto sc = createSubscriptionContext();
 
-  // Monitor for execve syscalls.
-  sc->rules.push_back({AUDIT_SYSCALL_EXECVE, ""});
+  // Monitor for successful execve syscalls.
+  AuditRule rule(AUDIT_SYSCALL_EXECVE, "");
+  rule.fields.push_back({"success", "=", "1"});
+  auto s = parseAuditRuleFields(FLAGS_audit_process_filters, rule.fields);
+  if (!s.ok()) {
+    return s;
+  }
+  sc->rules.push_back(std::move(rule));
 
   // Request call backs for all parts of the process execution state.
   // Drop events if they are encountered outside of the expected state.
   sc->types = {AUDIT_SYSCALL, AUDIT_EXECVE, AUDIT_CWD, AUDIT_PATH};
   subscribe(&ProcessEventSubscriber::Callback, sc);
 
+  // Executed processes are resolved against the processes already running.
+  tables::ProcessLineage::instance().seed();
+
   return Status(0, "OK");
 }
 
 Status ProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   // Check and set the valid state change.
   // If this is an unacceptable change reset the state and clear row data.
-  if (ec->fields.count("success") && ec->fields.at("success") == "no") {
+  if (ec->fields.equals("success", "no")) {
     return Status(0, "OK");
   }
 
+  if (!ec->records.empty()) {
+    return AssembledCallback(ec);
+  }
+
   if (!validAuditState(ec->type, state_).ok()) {
     state_ = STATE_SYSCALL;
     Row().swap(row_);
@@ -167,21 +199,64 @@ Status ProcessEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
   }
 
   // Fill in row fields based on the event state.
-  updateAuditRow(ec, row_);
+  updateAuditRow(ec->type, ec->fields, row_);
 
   // Only add the event if finished (aka a PATH event was emitted).
   if (state_ == STATE_SYSCALL) {
-    // If the EXECVE state was not used, decode the cmdline value.
-    if (row_.at("cmdline_size").size() == 0) {
-      // This allows at most 1 decode call per potentially-encoded item.
-      row_["cmdline"] = decodeAuditValue(row_.at("cmdline"));
-      row_["cmdline_size"] = "1";
-    }
-
-    add(row_, getUnixTime());
+    addRow(row_);
     Row().swap(row_);
   }
 
   return Status(0, "OK");
 }
+
+Status ProcessEventSubscriber::AssembledCallback(const ECRef& ec) {
+  // Apply the records in the same order allowed by the streaming states.
+  Row r;
+  AuditProcessEventState state = STATE_SYSCALL;
+  for (const auto& record : ec->records) {
+    if (!validAuditState(record.type, state).ok()) {
+      // Only the first PATH record, the executed file, is used.
+      continue;
+    }
+
+    updateAuditRow(record.type, record.fields, r);
+    if (state == STATE_SYSCALL) {
+      addRow(r);
+      break;
+    }
+  }
+  return Status(0, "OK");
+}
+
+void ProcessEventSubscriber::addRow(Row& r) {
+  // If the EXECVE state was not used, decode the cmdline value.
+  if (r.at("cmdline_size").size() == 0) {
+    // This allows at most 1 decode call per potentially-encoded item.
+    r["cmdline"] = decodeAuditValue(r.at("cmdline"));
+    r["cmdline_size"] = "1";
+  }
+
+  auto time = getUnixTime();
+  add(r, time);
+
+  // Keep the process for process_ancestry and the other event tables.
+  long long pid = 0;
+  long long parent = 0;
+  if (safeStrtoll(r.at("pid"), 10, pid).ok() && pid > 0) {
+    tables::ProcessLineageEntry entry;
+    entry.pid = static_cast<pid_t>(pid);
+    entry.start_time = time;
+    if (safeStrtoll(r.at("parent"), 10, parent).ok()) {
+      entry.parent = static_cast<pid_t>(parent);
+    }
+    entry.path = r.at("path");
+    entry.cmdline = r.at("cmdline");
+    entry.uid = r.at("uid");
+    tables::ProcessLineage::instance().add(std::move(entry));
+  }
+
+  // A new process may satisfy pack discovery queries.
+  invalidateDiscoveryQueries("processes");
+}
 } // namespace osquery
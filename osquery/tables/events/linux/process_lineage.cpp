@@ -0,0 +1,330 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/tables.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/tables/events/linux/process_lineage.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     process_ancestry_size,
+     16384,
+     "Processes kept by the process_ancestry cache (default 16384)");
+
+namespace tables {
+
+/// Stop walking a chain beyond this many ancestors.
+const size_t kProcessAncestryDepth{64};
+
+/// The UNIX time the system booted, from /proc/stat.
+static size_t getBootTime() {
+  static size_t boot_time = []() {
+    std::string content;
+    if (!readFile("/proc/stat", content).ok()) {
+      return size_t{0};
+    }
+
+    for (const auto& line : osquery::split(content, "\n")) {
+      if (line.find("btime ") == 0) {
+        auto value = line.substr(6);
+        boost::algorithm::trim(value);
+        long long btime = 0;
+        if (safeStrtoll(value, 10, btime).ok()) {
+          return static_cast<size_t>(btime);
+        }
+      }
+    }
+    return size_t{0};
+  }();
+  return boot_time;
+}
+
+bool readProcessLineage(pid_t pid, ProcessLineageEntry& entry) {
+  auto path = "/proc/" + std::to_string(pid);
+  std::string content;
+  if (!readFile(path + "/stat", content).ok()) {
+    return false;
+  }
+
+  // The comm field may contain spaces and parentheses, the fields following
+  // the last ')' start with the state.
+  auto end = content.rfind(')');
+  if (end == std::string::npos) {
+    return false;
+  }
+  auto fields = osquery::split(content.substr(end + 1), " ");
+  // Fields 3 (state) through 22 (starttime), the state is the first.
+  if (fields.size() < 20) {
+    return false;
+  }
+
+  long long parent = 0;
+  long long ticks = 0;
+  if (!safeStrtoll(fields[1], 10, parent).ok() ||
+      !safeStrtoll(fields[19], 10, ticks).ok()) {
+    return false;
+  }
+
+  static const auto ticks_per_second = ::sysconf(_SC_CLK_TCK);
+  entry.pid = pid;
+  entry.parent = static_cast<pid_t>(parent);
+  entry.parent_start_time = 0;
+  entry.start_time =
+      getBootTime() +
+      static_cast<size_t>(ticks / ((ticks_per_second > 0) ? ticks_per_second
+                                                          : 100));
+
+  char link_path[PATH_MAX] = {0};
+  auto bytes =
+      readlink((path + "/exe").c_str(), link_path, sizeof(link_path) - 1);
+  entry.path = (bytes > 0) ? std::string(link_path, bytes) : "";
+
+  entry.cmdline.clear();
+  if (readFile(path + "/cmdline", entry.cmdline).ok()) {
+    std::replace(entry.cmdline.begin(), entry.cmdline.end(), '\0', ' ');
+    boost::algorithm::trim(entry.cmdline);
+  }
+
+  struct stat st;
+  entry.uid = (stat(path.c_str(), &st) == 0) ? std::to_string(st.st_uid) : "";
+  return true;
+}
+
+const ProcessLineageEntry* ProcessLineage::find(pid_t pid,
+                                                size_t before) const {
+  auto it = processes_.find(pid);
+  if (it == processes_.end() || it->second.empty()) {
+    return nullptr;
+  }
+
+  // The latest entry started at or before the time.
+  auto entry = it->second.upper_bound(before);
+  if (entry == it->second.begin()) {
+    return nullptr;
+  }
+  return &(--entry)->second;
+}
+
+void ProcessLineage::insert(ProcessLineageEntry entry) {
+  if (entry.parent_start_time == 0 && entry.parent != 0) {
+    auto parent = find(entry.parent, entry.start_time);
+    if (parent != nullptr) {
+      entry.parent_start_time = parent->start_time;
+    }
+  }
+
+  auto& entries = processes_[entry.pid];
+  auto start_time = entry.start_time;
+  if (entries.count(start_time) == 0) {
+    order_.push_back(std::make_pair(entry.pid, start_time));
+  }
+  entries[start_time] = std::move(entry);
+
+  // Evict the oldest entries.
+  while (order_.size() > FLAGS_process_ancestry_size && !order_.empty()) {
+    const auto& oldest = order_.front();
+    auto it = processes_.find(oldest.first);
+    if (it != processes_.end()) {
+      it->second.erase(oldest.second);
+      if (it->second.empty()) {
+        processes_.erase(it);
+      }
+    }
+    order_.pop_front();
+  }
+}
+
+void ProcessLineage::add(ProcessLineageEntry entry) {
+  seed();
+
+  WriteLock lock(mutex_);
+  if (entry.parent != 0 && find(entry.parent, entry.start_time) == nullptr) {
+    // The parent started before the cache was seeded, or was evicted.
+    ProcessLineageEntry parent;
+    if (readProcessLineage(entry.parent, parent) &&
+        parent.start_time <= entry.start_time) {
+      insert(std::move(parent));
+    }
+  }
+  insert(std::move(entry));
+}
+
+bool ProcessLineage::get(pid_t pid, ProcessLineageEntry& entry) {
+  seed();
+
+  {
+    WriteLock lock(mutex_);
+    auto found = find(pid, std::numeric_limits<size_t>::max());
+    if (found != nullptr) {
+      entry = *found;
+      return true;
+    }
+  }
+
+  if (!readProcessLineage(pid, entry)) {
+    return false;
+  }
+
+  WriteLock lock(mutex_);
+  insert(entry);
+  return true;
+}
+
+std::vector<ProcessLineageEntry> ProcessLineage::getAncestry(pid_t pid) {
+  std::vector<ProcessLineageEntry> ancestry;
+  ProcessLineageEntry entry;
+  if (!get(pid, entry)) {
+    return ancestry;
+  }
+
+  WriteLock lock(mutex_);
+  std::set<std::pair<pid_t, size_t>> visited;
+  visited.insert(std::make_pair(entry.pid, entry.start_time));
+  ancestry.push_back(entry);
+  while (ancestry.size() <= kProcessAncestryDepth) {
+    const auto& child = ancestry.back();
+    if (child.parent == 0 || child.parent_start_time == 0) {
+      break;
+    }
+
+    auto parent = find(child.parent, child.parent_start_time);
+    if (parent == nullptr || parent->start_time != child.parent_start_time ||
+        !visited.insert(std::make_pair(parent->pid, parent->start_time))
+             .second) {
+      // The parent was evicted, or a chain loops.
+      break;
+    }
+    ancestry.push_back(*parent);
+  }
+  return ancestry;
+}
+
+std::vector<ProcessLineageEntry> ProcessLineage::getAll() {
+  seed();
+
+  std::vector<ProcessLineageEntry> entries;
+  WriteLock lock(mutex_);
+  for (const auto& process : processes_) {
+    if (!process.second.empty()) {
+      entries.push_back(process.second.rbegin()->second);
+    }
+  }
+  return entries;
+}
+
+std::string ProcessLineage::getPath(pid_t pid) {
+  ProcessLineageEntry entry;
+  return (get(pid, entry)) ? entry.path : "";
+}
+
+void ProcessLineage::seed() {
+  {
+    WriteLock lock(mutex_);
+    if (seeded_) {
+      return;
+    }
+    seeded_ = true;
+  }
+
+  std::vector<ProcessLineageEntry> running;
+  auto proc = opendir("/proc");
+  if (proc == nullptr) {
+    return;
+  }
+
+  struct dirent* item = nullptr;
+  while ((item = readdir(proc)) != nullptr) {
+    long long pid = 0;
+    if (!safeStrtoll(item->d_name, 10, pid).ok() || pid <= 0) {
+      continue;
+    }
+
+    ProcessLineageEntry entry;
+    if (readProcessLineage(static_cast<pid_t>(pid), entry)) {
+      running.push_back(std::move(entry));
+    }
+  }
+  closedir(proc);
+
+  // Add parents before their children so each parent is resolved.
+  std::sort(running.begin(),
+            running.end(),
+            [](const ProcessLineageEntry& l, const ProcessLineageEntry& r) {
+              return (l.start_time == r.start_time) ? l.pid < r.pid
+                                                    : l.start_time <
+                                                          r.start_time;
+            });
+
+  WriteLock lock(mutex_);
+  for (auto& entry : running) {
+    insert(std::move(entry));
+  }
+}
+
+void ProcessLineage::clear() {
+  WriteLock lock(mutex_);
+  processes_.clear();
+  order_.clear();
+  seeded_ = false;
+}
+
+static void genAncestryRow(const ProcessLineageEntry& entry,
+                           pid_t pid,
+                           size_t depth,
+                           QueryData& results) {
+  Row r;
+  r["pid"] = INTEGER(pid);
+  r["depth"] = INTEGER(depth);
+  r["ancestor_pid"] = INTEGER(entry.pid);
+  r["start_time"] = BIGINT(entry.start_time);
+  r["parent"] = INTEGER(entry.parent);
+  r["path"] = entry.path;
+  r["cmdline"] = entry.cmdline;
+  r["uid"] = entry.uid;
+  results.push_back(std::move(r));
+}
+
+QueryData genProcessAncestry(QueryContext& context) {
+  QueryData results;
+  auto& lineage = ProcessLineage::instance();
+
+  if (!context.hasConstraint("pid", EQUALS)) {
+    // Without a pid list each cached process once.
+    for (const auto& entry : lineage.getAll()) {
+      genAncestryRow(entry, entry.pid, 0, results);
+    }
+    return results;
+  }
+
+  for (const auto& pid : context.constraints["pid"].getAll<int>(EQUALS)) {
+    size_t depth = 0;
+    for (const auto& entry : lineage.getAncestry(static_cast<pid_t>(pid))) {
+      genAncestryRow(entry, static_cast<pid_t>(pid), depth++, results);
+    }
+  }
+  return results;
+}
+}
+}
@@ -0,0 +1,111 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <deque>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+
+namespace osquery {
+namespace tables {
+
+/// A process and the start of the parent it was created by.
+struct ProcessLineageEntry {
+  pid_t pid{0};
+
+  /// The UNIX time the process started, or executed, with the pid.
+  size_t start_time{0};
+
+  pid_t parent{0};
+
+  /// The start time of the parent entry, 0 if the parent is unknown.
+  size_t parent_start_time{0};
+
+  std::string path;
+  std::string cmdline;
+  std::string uid;
+};
+
+/**
+ * @brief A bounded cache of process lineage keyed by pid and start time.
+ *
+ * Hunting queries walk parent chains by self-joining process_events or
+ * processes, each hop reading events from the database, and short-lived
+ * parents are no longer in /proc. Each process executed is added by the
+ * process_events subscriber, and the cache is seeded from /proc. An entry's
+ * parent is resolved when it is added, so a chain follows the parent that
+ * existed at the time even if its pid was reused since.
+ *
+ * Lookups by pid are constant time. The oldest entries are evicted beyond
+ * --process_ancestry_size entries.
+ */
+class ProcessLineage : private boost::noncopyable {
+ public:
+  static ProcessLineage& instance() {
+    static ProcessLineage lineage;
+    return lineage;
+  }
+
+  /// Add an executed process, resolving the parent entry.
+  void add(ProcessLineageEntry entry);
+
+  /// Find the latest process with a pid, reading /proc when it is missing.
+  bool get(pid_t pid, ProcessLineageEntry& entry);
+
+  /// The process and each known ancestor, nearest first.
+  std::vector<ProcessLineageEntry> getAncestry(pid_t pid);
+
+  /// Every cached process, the latest entry of each pid.
+  std::vector<ProcessLineageEntry> getAll();
+
+  /// The executable of the latest process with a pid, or an empty string.
+  std::string getPath(pid_t pid);
+
+  /// Add each running process, once.
+  void seed();
+
+  /// Drop every entry, the next request seeds the cache again.
+  void clear();
+
+ private:
+  ProcessLineage() = default;
+
+  /// Insert an entry, the caller holds the mutex.
+  void insert(ProcessLineageEntry entry);
+
+  /// Find the latest entry of a pid started at or before a time.
+  const ProcessLineageEntry* find(pid_t pid, size_t before) const;
+
+ private:
+  /// Entries of each pid keyed by start time.
+  std::unordered_map<pid_t, std::map<size_t, ProcessLineageEntry>> processes_;
+
+  /// The pid and start time of each entry in the order added.
+  std::deque<std::pair<pid_t, size_t>> order_;
+
+  /// Set once the running processes were added.
+  bool seeded_{false};
+
+  Mutex mutex_;
+};
+
+/// Read a running process from /proc.
+bool readProcessLineage(pid_t pid, ProcessLineageEntry& entry);
+}
+}
@@ -11,11 +11,13 @@
 #include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string.hpp>
 
+#include <osquery/flags.h>
 #include <osquery/sql.h>
 #include <osquery/system.h>
 
 #include "osquery/core/conversions.h"
 #include "osquery/events/linux/audit.h"
+#include "osquery/tables/events/linux/process_lineage.h"
 
 namespace osquery {
 
@@ -27,6 +29,11 @@ FLAG(bool,
      false,
      "Allow the audit publisher to install socket-related rules");
 
+FLAG(string,
+     audit_socket_filters,
+     "",
+     "Comma-delimited audit fields for bind and connect rules (uid>=1000)");
+
 // Depend on the external getUptime table method.
 namespace tables {
 extern long getUptime();
@@ -48,6 +55,17 @@ class SocketEventSubscriber : public EventSubscriber<AuditEventPublisher> {
   /// Kernel events matching the event type will fire.
   Status Callback(const ECRef& ec, const SCRef& sc);
 
+  /// Fill in the row details of a bind or connect syscall.
+  bool handleSyscall(const ECRef& ec, Row& r);
+
+  /// Parse the socket address structure and add the event.
+  void handleSockAddr(const std::string& saddr, Row& r);
+
+  /// Hunting queries commonly look for a process or remote address.
+  std::set<std::string> getIndexedColumns() override {
+    return {"path", "pid", "remote_address"};
+  }
+
  private:
   /// Socket events come in pairs, first the syscall then the structure.
   bool waiting_for_saddr_{false};
@@ -61,9 +79,19 @@ REGISTER(SocketEventSubscriber, "event_subscriber", "socket_events");
 Status SocketEventSubscriber::init() {
   auto sc = createSubscriptionContext();
 
+  // Filter bind and connect syscalls in the kernel.
+  std::vector<AuditRuleField> fields;
+  auto s = parseAuditRuleFields(FLAGS_audit_socket_filters, fields);
+  if (!s.ok()) {
+    return s;
+  }
+
   // Monitor for bind and connect syscalls.
-  sc->rules.push_back({AUDIT_SYSCALL_BIND, ""});
-  sc->rules.push_back({AUDIT_SYSCALL_CONNECT, ""});
+  for (const auto& syscall : {AUDIT_SYSCALL_BIND, AUDIT_SYSCALL_CONNECT}) {
+    AuditRule rule(syscall, "");
+    rule.fields = fields;
+    sc->rules.push_back(std::move(rule));
+  }
   // Also grab SADDR structures
   sc->types.insert(AUDIT_TYPE_SOCKADDR);
 
@@ -125,18 +153,24 @@ void parseSockAddr(const std::string& saddr, Row& r, bool local) {
 }
 
 Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
+  if (!ec->records.empty()) {
+    // An assembled event includes the syscall and structure records.
+    Row r;
+    if (ec->type == AUDIT_TYPE_SYSCALL && handleSyscall(ec, r)) {
+      for (const auto& record : ec->records) {
+        if (record.type == AUDIT_TYPE_SOCKADDR &&
+            record.fields.count("saddr") > 0) {
+          handleSockAddr(record.fields.get("saddr"), r);
+          break;
+        }
+      }
+    }
+    return Status(0);
+  }
+
   if (waiting_for_saddr_) {
     if (ec->type == AUDIT_TYPE_SOCKADDR) {
-      auto& saddr = ec->fields["saddr"];
-      if (saddr.size() < 4 || saddr[0] == '1') {
-        return Status(0);
-      }
-      row_["protocol"] = "0";
-      row_["local_port"] = "0";
-      row_["remote_port"] = "0";
-      // Parse the struct and emit the row.
-      parseSockAddr(saddr, row_, (row_.at("action") == "bind"));
-      add(row_, getUnixTime());
+      handleSockAddr(ec->fields.get("saddr"), row_);
       Row().swap(row_);
       waiting_for_saddr_ = false;
     }
@@ -144,26 +178,48 @@ Status SocketEventSubscriber::Callback(const ECRef& ec, const SCRef&) {
     return Status(0);
   }
 
+  waiting_for_saddr_ = handleSyscall(ec, row_);
+  return Status(0);
+}
+
+bool SocketEventSubscriber::handleSyscall(const ECRef& ec, Row& r) {
   if (ec->syscall == AUDIT_SYSCALL_CONNECT) {
     // The connect syscall must exit with EINPROGRESS
-    if (ec->fields.count("exit") && ec->fields.at("exit") != "-115") {
-      return Status(0);
+    if (ec->fields.count("exit") && !ec->fields.equals("exit", "-115")) {
+      return false;
     }
-    row_["action"] = "connect";
+    r["action"] = "connect";
   } else if (ec->syscall == AUDIT_SYSCALL_BIND) {
-    row_["action"] = "bind";
+    r["action"] = "bind";
   } else {
-    return Status(0);
+    return false;
   }
 
-  row_["pid"] = ec->fields["pid"];
-  row_["path"] = decodeAuditValue(ec->fields["exe"]);
+  r["pid"] = ec->fields.get("pid");
+  r["path"] = decodeAuditValue(ec->fields.get("exe"));
+  long long pid = 0;
+  if (r.at("path").empty() && safeStrtoll(r.at("pid"), 10, pid).ok()) {
+    // The exe field is not included by every audit configuration.
+    r["path"] = tables::ProcessLineage::instance().getPath(
+        static_cast<pid_t>(pid));
+  }
   // TODO: This is a hex value.
-  row_["fd"] = ec->fields["a0"];
+  r["fd"] = ec->fields.get("a0");
   // The open/bind success status.
-  row_["success"] = (ec->fields["success"] == "yes") ? "1" : "0";
-  row_["uptime"] = BIGINT(tables::getUptime());
-  waiting_for_saddr_ = true;
-  return Status(0);
+  r["success"] = (ec->fields.equals("success", "yes")) ? "1" : "0";
+  r["uptime"] = BIGINT(tables::getUptime());
+  return true;
+}
+
+void SocketEventSubscriber::handleSockAddr(const std::string& saddr, Row& r) {
+  if (saddr.size() < 4 || saddr[0] == '1') {
+    return;
+  }
+  r["protocol"] = "0";
+  r["local_port"] = "0";
+  r["remote_port"] = "0";
+  // Parse the struct and emit the row.
+  parseSockAddr(saddr, r, (r.at("action") == "bind"));
+  add(r, getUnixTime());
 }
 } // namespace osquery
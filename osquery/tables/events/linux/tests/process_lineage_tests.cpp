@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/events/linux/process_lineage.h"
+
+namespace osquery {
+
+DECLARE_uint64(process_ancestry_size);
+
+namespace tables {
+
+/// Processes beyond the largest pid_max, never read from /proc.
+const pid_t kTestPid{5000000};
+
+class ProcessLineageTests : public testing::Test {
+ protected:
+  void SetUp() override {
+    size_ = FLAGS_process_ancestry_size;
+    ProcessLineage::instance().clear();
+    ProcessLineage::instance().seed();
+  }
+
+  void TearDown() override {
+    FLAGS_process_ancestry_size = size_;
+    ProcessLineage::instance().clear();
+  }
+
+  static ProcessLineageEntry makeEntry(pid_t pid,
+                                       pid_t parent,
+                                       size_t start_time,
+                                       const std::string& path) {
+    ProcessLineageEntry entry;
+    entry.pid = pid;
+    entry.parent = parent;
+    entry.start_time = start_time;
+    entry.path = path;
+    return entry;
+  }
+
+ private:
+  size_t size_{0};
+};
+
+TEST_F(ProcessLineageTests, test_read_process_lineage) {
+  ProcessLineageEntry entry;
+  EXPECT_TRUE(readProcessLineage(getpid(), entry));
+  EXPECT_EQ(getpid(), entry.pid);
+  EXPECT_EQ(getppid(), entry.parent);
+  EXPECT_GT(entry.start_time, 0U);
+  EXPECT_FALSE(entry.path.empty());
+
+  EXPECT_FALSE(readProcessLineage(kTestPid, entry));
+}
+
+TEST_F(ProcessLineageTests, test_ancestry) {
+  auto& lineage = ProcessLineage::instance();
+  lineage.add(makeEntry(kTestPid, 0, 100, "/bin/init"));
+  lineage.add(makeEntry(kTestPid + 1, kTestPid, 110, "/bin/sh"));
+  lineage.add(makeEntry(kTestPid + 2, kTestPid + 1, 120, "/bin/curl"));
+
+  // The parent pid is reused after the child started.
+  lineage.add(makeEntry(kTestPid + 1, kTestPid, 130, "/bin/reused"));
+
+  auto ancestry = lineage.getAncestry(kTestPid + 2);
+  ASSERT_EQ(3U, ancestry.size());
+  EXPECT_EQ("/bin/curl", ancestry[0].path);
+  EXPECT_EQ("/bin/sh", ancestry[1].path);
+  EXPECT_EQ(110U, ancestry[1].start_time);
+  EXPECT_EQ("/bin/init", ancestry[2].path);
+
+  // A lookup by pid returns the latest process.
+  EXPECT_EQ("/bin/reused", lineage.getPath(kTestPid + 1));
+  EXPECT_EQ("", lineage.getPath(kTestPid + 3));
+  EXPECT_TRUE(lineage.getAncestry(kTestPid + 3).empty());
+}
+
+TEST_F(ProcessLineageTests, test_eviction) {
+  auto& lineage = ProcessLineage::instance();
+  FLAGS_process_ancestry_size = 2;
+  lineage.add(makeEntry(kTestPid, 0, 100, "/bin/init"));
+  lineage.add(makeEntry(kTestPid + 1, kTestPid, 110, "/bin/sh"));
+  lineage.add(makeEntry(kTestPid + 2, kTestPid + 1, 120, "/bin/curl"));
+
+  EXPECT_EQ(2U, lineage.getAll().size());
+  EXPECT_EQ("", lineage.getPath(kTestPid));
+
+  // The chain ends at the evicted ancestor.
+  EXPECT_EQ(2U, lineage.getAncestry(kTestPid + 2).size());
+}
+}
+}
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/logger.h>
+
+#include "osquery/events/windows/etw.h"
+
+namespace osquery {
+
+class ProcessETWEventSubscriber : public EventSubscriber<ETWEventPublisher> {
+ public:
+  /// Subscribe to process start and end events of the kernel logger.
+  Status init() override;
+
+  /// Kernel logger process events matching the opcodes will fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+
+  /// Hunting queries commonly look for a process name or pid.
+  std::set<std::string> getIndexedColumns() override {
+    return {"name", "pid"};
+  }
+};
+
+REGISTER(ProcessETWEventSubscriber, "event_subscriber", "process_etw_events");
+
+Status ProcessETWEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->type = ETWEventClass::PROCESS;
+  sc->opcodes = {ETW_PROCESS_START, ETW_PROCESS_END};
+  subscribe(&ProcessETWEventSubscriber::Callback, sc);
+
+  return Status(0, "OK");
+}
+
+Status ProcessETWEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  r["action"] = (ec->opcode == ETW_PROCESS_START) ? "start" : "end";
+
+  // The header's process id is the creating process, use the event's.
+  r["pid"] = ec->data["ProcessId"];
+  r["parent"] = ec->data["ParentId"];
+  r["session_id"] = ec->data["SessionId"];
+  r["exit_code"] = ec->data["ExitStatus"];
+  r["name"] = ec->data["ImageFileName"];
+  r["cmdline"] = ec->data["CommandLine"];
+  r["sid"] = ec->data["UserSID"];
+  r["time"] = BIGINT(ec->timestamp);
+
+  add(r, ec->timestamp);
+  return Status(0, "OK");
+}
+}
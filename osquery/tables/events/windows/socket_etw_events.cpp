@@ -0,0 +1,76 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <osquery/logger.h>
+
+#include "osquery/events/windows/etw.h"
+
+namespace osquery {
+
+class SocketETWEventSubscriber : public EventSubscriber<ETWEventPublisher> {
+ public:
+  /// Subscribe to TCP connect, accept, and disconnect events.
+  Status init() override;
+
+  /// Kernel logger TcpIp events matching the opcodes will fire.
+  Status Callback(const ECRef& ec, const SCRef& sc);
+
+  /// Hunting queries commonly look for a process or remote address.
+  std::set<std::string> getIndexedColumns() override {
+    return {"pid", "remote_address"};
+  }
+};
+
+REGISTER(SocketETWEventSubscriber, "event_subscriber", "socket_etw_events");
+
+Status SocketETWEventSubscriber::init() {
+  auto sc = createSubscriptionContext();
+  sc->type = ETWEventClass::TCPIP;
+  for (unsigned char opcode :
+       {ETW_TCPIP_CONNECT, ETW_TCPIP_DISCONNECT, ETW_TCPIP_ACCEPT}) {
+    sc->opcodes.insert(opcode);
+    sc->opcodes.insert(opcode + ETW_TCPIP_IPV6);
+  }
+  subscribe(&SocketETWEventSubscriber::Callback, sc);
+
+  return Status(0, "OK");
+}
+
+Status SocketETWEventSubscriber::Callback(const ECRef& ec, const SCRef& sc) {
+  Row r;
+  auto opcode = ec->opcode;
+  if (opcode > ETW_TCPIP_IPV6) {
+    opcode -= ETW_TCPIP_IPV6;
+    r["family"] = "23";
+  } else {
+    r["family"] = "2";
+  }
+
+  if (opcode == ETW_TCPIP_CONNECT) {
+    r["action"] = "connect";
+  } else if (opcode == ETW_TCPIP_ACCEPT) {
+    r["action"] = "accept";
+  } else {
+    r["action"] = "disconnect";
+  }
+
+  // The header's process id is not set for network events, use the event's.
+  r["pid"] = ec->data["PID"];
+  r["protocol"] = "6";
+  r["local_address"] = ec->data["saddr"];
+  r["local_port"] = ec->data["sport"];
+  r["remote_address"] = ec->data["daddr"];
+  r["remote_port"] = ec->data["dport"];
+  r["time"] = BIGINT(ec->timestamp);
+
+  add(r, ec->timestamp);
+  return Status(0, "OK");
+}
+}
@@ -8,11 +8,19 @@
  *
  */
 
+#include <sys/stat.h>
+
+#include <chrono>
 #include <map>
+#include <mutex>
 #include <string>
 
 #include <osquery/config.h>
+#include <osquery/dispatcher.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 
 /// The file change event publishers are slightly different in OS X and Linux.
 #ifdef __APPLE__
@@ -21,6 +29,7 @@
 #include "osquery/events/linux/inotify.h"
 #endif
 
+#include "osquery/tables/events/yara_events.h"
 #include "osquery/tables/other/yara_utils.h"
 
 #ifdef CONCAT
@@ -29,8 +38,27 @@
 #include <yara.h>
 
 namespace osquery {
+
+FLAG(uint64,
+     yara_scan_workers,
+     2,
+     "Threads scanning changed files for YARA events (0 scans inline)");
+
+FLAG(uint64,
+     yara_scan_queue_size,
+     1000,
+     "Maximum changed files waiting for a YARA events scan");
+
+FLAG(uint64,
+     yara_scan_delay,
+     1,
+     "Seconds a changed file waits for a YARA scan, merging repeated changes");
+
 namespace tables {
 
+/// The maximum scanned file identities kept to skip unchanged files.
+const size_t kYARAScannedMax = 10000;
+
 /// The file change event publishers are slightly different in OS X and Linux.
 #ifdef __APPLE__
 using FileEventSubscriber = EventSubscriber<FSEventsEventPublisher>;
@@ -47,18 +75,56 @@ using FileSubscriptionContextRef = INotifySubscriptionContextRef;
   ((IN_CREATE) | (IN_CLOSE_WRITE) | (IN_MODIFY) | (IN_MOVED_TO))
 #endif
 
+bool YARAScanQueue::push(YARAScanItem item) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  const auto& path = item.r.at("target_path");
+  if (pending_.count(path) > 0) {
+    return true;
+  }
+
+  if (items_.size() >= FLAGS_yara_scan_queue_size) {
+    return false;
+  }
+
+  pending_.insert(path);
+  items_.push_back(std::move(item));
+  condition_.notify_one();
+  return true;
+}
+
+bool YARAScanQueue::pop(YARAScanItem& item, std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (items_.empty() || items_.front().due > getUnixTime()) {
+    condition_.wait_for(lock, timeout);
+    if (stopping_ || items_.empty() || items_.front().due > getUnixTime()) {
+      return false;
+    }
+  }
+
+  item = std::move(items_.front());
+  items_.pop_front();
+  pending_.erase(item.r.at("target_path"));
+  return true;
+}
+
+void YARAScanQueue::stop() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  stopping_ = true;
+  condition_.notify_all();
+}
+
 /**
  * @brief Track YARA matches to files.
  */
 class YARAEventSubscriber : public FileEventSubscriber {
  public:
-  Status init() override {
-    configure();
-    return Status(0);
-  }
+  Status init() override;
 
   void configure() override;
 
+  /// Scan a changed file and add the event if there are matches.
+  Status scan(YARAScanItem& item);
+
  private:
   /**
    * @brief This exports a single Callback for FSEventsEventPublisher events.
@@ -70,8 +136,72 @@ class YARAEventSubscriber : public FileEventSubscriber {
    */
   Status Callback(const FileEventContextRef& ec,
                   const FileSubscriptionContextRef& sc);
+
+  /// Check if a file is unchanged since it was scanned with the same rules.
+  bool scanned(const std::string& path, const std::string& identity);
+
+ private:
+  /// Changed files waiting for the scan workers.
+  YARAScanQueueRef queue_{nullptr};
+
+  /// The identity and rule generation of scanned files, by path.
+  std::map<std::string, std::string> scanned_;
+
+  /// Protects the scanned file identities.
+  Mutex scanned_mutex_;
+};
+
+/// A Dispatcher service scanning the files queued by the subscriber.
+class YARAScanRunner : public InternalRunnable {
+ public:
+  YARAScanRunner(YARAEventSubscriber* subscriber, YARAScanQueueRef queue)
+      : subscriber_(subscriber), queue_(std::move(queue)) {}
+
+ public:
+  /// The Dispatcher thread entry point.
+  void start() override {
+    while (!interrupted()) {
+      YARAScanItem item;
+      if (queue_->pop(item, std::chrono::milliseconds(200))) {
+        subscriber_->scan(item);
+      }
+    }
+    yr_finalize_thread();
+  }
+
+  /// The Dispatcher interrupt point.
+  void stop() override {
+    queue_->stop();
+  }
+
+ private:
+  /// The subscriber adding events, which outlives its services.
+  YARAEventSubscriber* subscriber_{nullptr};
+
+  YARAScanQueueRef queue_;
 };
 
+/// Stat a file, the modification time is in nanoseconds.
+static bool getScanIdentity(const std::string& path,
+                            std::string& identity,
+                            uint64_t& mtime) {
+  struct stat file;
+  if (::stat(path.c_str(), &file) != 0) {
+    return false;
+  }
+
+#if defined(__linux__)
+  mtime = file.st_mtim.tv_sec * 1000000000ULL + file.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+  mtime = file.st_mtimespec.tv_sec * 1000000000ULL + file.st_mtimespec.tv_nsec;
+#else
+  mtime = static_cast<uint64_t>(file.st_mtime) * 1000000000ULL;
+#endif
+  identity = std::to_string(file.st_dev) + ":" + std::to_string(file.st_ino) +
+             ":" + std::to_string(file.st_size) + ":" + std::to_string(mtime);
+  return true;
+}
+
 /**
  * @brief Each EventSubscriber must register itself so the init method is
  * called.
@@ -81,6 +211,19 @@ class YARAEventSubscriber : public FileEventSubscriber {
  */
 REGISTER(YARAEventSubscriber, "event_subscriber", "yara_events");
 
+Status YARAEventSubscriber::init() {
+  configure();
+
+  // Scan changed files in worker services, publishers only queue the files.
+  if (FLAGS_yara_scan_workers > 0 && queue_ == nullptr) {
+    queue_ = std::make_shared<YARAScanQueue>();
+    for (size_t i = 0; i < FLAGS_yara_scan_workers; i++) {
+      Dispatcher::addService(std::make_shared<YARAScanRunner>(this, queue_));
+    }
+  }
+  return Status(0);
+}
+
 void YARAEventSubscriber::configure() {
   removeSubscriptions();
 
@@ -134,7 +277,8 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
     return Status(1, "Invalid action");
   }
 
-  Row r;
+  YARAScanItem item;
+  auto& r = item.r;
   r["action"] = ec->action;
   r["target_path"] = ec->path;
   r["category"] = sc->category;
@@ -148,6 +292,30 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
   r["strings"] = std::string("");
   r["tags"] = std::string("");
 
+  item.time = ec->time;
+  if (queue_ == nullptr) {
+    return scan(item);
+  }
+
+  item.due = getUnixTime() + FLAGS_yara_scan_delay;
+  if (!queue_->push(std::move(item))) {
+    VLOG(1) << "YARA scan queue is full, dropping: " << ec->path;
+    return Status(1, "YARA scan queue is full");
+  }
+  return Status(0, "OK");
+}
+
+bool YARAEventSubscriber::scanned(const std::string& path,
+                                  const std::string& identity) {
+  WriteLock lock(scanned_mutex_);
+  auto it = scanned_.find(path);
+  return (it != scanned_.end() && it->second == identity);
+}
+
+Status YARAEventSubscriber::scan(YARAScanItem& item) {
+  auto& r = item.r;
+  const auto& path = r.at("target_path");
+
   auto parser = Config::getParser("yara");
   if (parser == nullptr || parser.get() == nullptr) {
     return Status(1, "ConfigParser unknown.");
@@ -163,7 +331,17 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
     return Status(1, "Yara parser unknown.");
   }
 
-  auto rules = yaraParser->rules();
+  // Skip a file that is unchanged since it was scanned with the same rules.
+  std::string identity;
+  uint64_t mtime = 0;
+  if (getScanIdentity(path, identity, mtime)) {
+    identity += ":" + std::to_string(yaraParser->generation());
+    if (scanned(path, identity)) {
+      return Status(0, "OK");
+    }
+  }
+
+  const auto& rules = yaraParser->rules();
 
   // Use the category as a lookup into the yara file_paths. The value will be
   // a list of signature groups to scan with.
@@ -171,10 +349,21 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
   const auto& yara_config = parser->getData();
   const auto& yara_paths = yara_config.get_child("file_paths");
   const auto& sig_groups = yara_paths.find(category);
+  if (sig_groups == yara_paths.not_found()) {
+    return Status(1, "YARA category not found: " + category);
+  }
+
   for (const auto& rule : sig_groups->second) {
     const std::string group = rule.second.data();
-    int result = yr_rules_scan_file(rules[group],
-                                    ec->path.c_str(),
+    // Workers scan concurrently, a missing group must not insert into rules.
+    auto group_rules = rules.find(group);
+    if (group_rules == rules.end()) {
+      VLOG(1) << "YARA signature group not found: " << group;
+      continue;
+    }
+
+    int result = yr_rules_scan_file(group_rules->second,
+                                    path.c_str(),
                                     SCAN_FLAGS_FAST_MODE,
                                     YARACallback,
                                     (void*)&r,
@@ -185,8 +374,21 @@ Status YARAEventSubscriber::Callback(const FileEventContextRef& ec,
     }
   }
 
-  if (ec->action != "" && r.at("matches").size() > 0) {
-    add(r, ec->time);
+  // Only remember files that did not change while scanning and have settled,
+  // a later write within the same timestamp would go unnoticed.
+  std::string after;
+  if (!identity.empty() && getScanIdentity(path, after, mtime) &&
+      after + ":" + std::to_string(yaraParser->generation()) == identity &&
+      !isRecentlyModified(mtime)) {
+    WriteLock lock(scanned_mutex_);
+    if (scanned_.size() >= kYARAScannedMax) {
+      scanned_.clear();
+    }
+    scanned_[path] = identity;
+  }
+
+  if (r.at("action") != "" && r.at("matches").size() > 0) {
+    add(r, item.time);
   }
 
   return Status(0, "OK");
@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/events.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// A changed file waiting to be scanned.
+struct YARAScanItem {
+  /// The event row, without matches.
+  Row r;
+
+  /// The event time.
+  EventTime time{0};
+
+  /// The time the file may be scanned.
+  size_t due{0};
+};
+
+/**
+ * @brief Changed files waiting for a YARA scan.
+ *
+ * A file is queued once, changes reported while the file waits are merged.
+ * Files are scanned in the order they changed, after a short delay, so a
+ * file written in several steps is scanned once it is complete.
+ */
+class YARAScanQueue : private boost::noncopyable {
+ public:
+  /// Queue a changed file, returns false if the queue is full.
+  bool push(YARAScanItem item);
+
+  /// Wait up to a timeout for a file due to be scanned.
+  bool pop(YARAScanItem& item, std::chrono::milliseconds timeout);
+
+  /// Wake the waiting workers before stopping.
+  void stop();
+
+ private:
+  /// Files in the order they changed.
+  std::deque<YARAScanItem> items_;
+
+  /// The paths of queued files.
+  std::set<std::string> pending_;
+
+  /// Set when the workers are stopping.
+  bool stopping_{false};
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+};
+
+using YARAScanQueueRef = std::shared_ptr<YARAScanQueue>;
+}
+}
@@ -0,0 +1,90 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <set>
+#include <string>
+#include <vector>
+
+#include <osquery/database.h>
+#include <osquery/distributed.h>
+#include <osquery/filesystem.h>
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/carver/carver.h"
+
+namespace osquery {
+namespace tables {
+
+/// Start a carve of the files matching the path constraints.
+static void startCarve(QueryContext& context) {
+  auto paths = context.constraints["path"].getAll(EQUALS);
+  context.expandConstraints(
+      "path",
+      LIKE,
+      paths,
+      ([&](const std::string& pattern, std::set<std::string>& out) {
+        std::vector<std::string> patterns;
+        auto status =
+            resolveFilePattern(pattern, patterns, GLOB_FILES | GLOB_NO_CANON);
+        if (status.ok()) {
+          for (const auto& resolved : patterns) {
+            out.insert(resolved);
+          }
+        }
+        return status;
+      }));
+
+  std::string guid;
+  auto status = carvePaths(paths, Distributed::getCurrentRequestId(), guid);
+  if (!status.ok()) {
+    LOG(WARNING) << "Cannot start carve: " << status.what();
+  } else {
+    LOG(INFO) << "Started carve " << guid << " of " << paths.size()
+              << " paths";
+  }
+}
+
+QueryData genCarves(QueryContext& context) {
+  QueryData results;
+
+  // A request with carve = 1 starts a carve, its rows are reported with it.
+  auto carve = context.constraints["carve"].getAll<int>(EQUALS);
+  auto requested = (carve.count(1) > 0);
+  if (requested) {
+    startCarve(context);
+  }
+
+  std::vector<std::string> guids;
+  scanDatabaseKeys(kCarves, guids);
+  for (const auto& guid : guids) {
+    CarveState state;
+    if (!Carver::load(guid, state).ok()) {
+      continue;
+    }
+
+    for (const auto& file : state.files) {
+      Row r;
+      r["time"] = BIGINT(state.time);
+      r["path"] = file.path;
+      r["size"] = BIGINT(state.size());
+      r["blocks"] = BIGINT(state.blockCount());
+      r["blocks_uploaded"] = BIGINT(state.block_id);
+      r["status"] = state.status;
+      r["carve_guid"] = state.guid;
+      r["request_id"] = state.request_id;
+      r["carve"] = INTEGER((requested) ? 1 : 0);
+      results.push_back(r);
+    }
+  }
+  return results;
+}
+}
+}
@@ -8,8 +8,12 @@
  *
  */
 
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include <boost/noncopyable.hpp>
 #include <boost/filesystem.hpp>
@@ -17,17 +21,27 @@
 #include <tsk/libtsk.h>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/hash.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/core/process.h"
+#include "osquery/core/query_deadline.h"
 
 namespace fs = boost::filesystem;
 
 namespace osquery {
+
+DECLARE_uint64(hash_cache_max);
+DECLARE_uint64(hash_workers);
+
 namespace tables {
 
+/// Inode content is read and hashed in blocks of this size.
+const TSK_OFF_T kTSKHashBlockSize = 1024 * 1024;
+
 const std::map<TSK_FS_META_TYPE_ENUM, std::string> kTSKTypeNames{
     {TSK_FS_META_TYPE_REG, "regular"},   {TSK_FS_META_TYPE_DIR, "directory"},
     {TSK_FS_META_TYPE_LNK, "symlink"},   {TSK_FS_META_TYPE_BLK, "block"},
@@ -200,7 +214,8 @@ void DeviceHelper::generateFiles(const std::string& partition,
                                  const std::string& path,
                                  QueryData& results,
                                  TSK_INUM_T inode) {
-  if (stack_++ > 1024) {
+  // A walk of a large partition stops with the query's deadline.
+  if (stack_++ > 1024 || isQueryCancelled()) {
     return;
   }
 
@@ -213,7 +228,7 @@ void DeviceHelper::generateFiles(const std::string& partition,
   // Iterate through the directory.
   std::map<TSK_INUM_T, std::string> additional;
   for (size_t i = 0; i < dir->getSize(); i++) {
-    if (count_++ > 1024 * 10) {
+    if (count_++ > 1024 * 10 || isQueryCancelled()) {
       break;
     }
 
@@ -271,14 +286,17 @@ MultiHashes hashInode(TskFsFile* file) {
     return MultiHashes();
   }
 
-  // Set a maximum 'chunk' or block size to 1 page or the file size.
+  // Set a maximum 'chunk' or block size to the hash block or the file size.
   TSK_OFF_T size = meta->getSize();
   if (size == 0) {
+    delete meta;
     return MultiHashes();
   }
 
   // Allocate some heap memory and iterate over reading a chunk and updating.
-  auto buffer_size = (size < 4096) ? size : 4096;
+  // Large reads, aligned to the block size, let the image layer read runs of
+  // sectors together.
+  auto buffer_size = (size < kTSKHashBlockSize) ? size : kTSKHashBlockSize;
   auto* buffer = (char*)malloc(buffer_size * sizeof(char));
   if (buffer != nullptr) {
     ssize_t chunk_size = 0;
@@ -310,53 +328,152 @@ MultiHashes hashInode(TskFsFile* file) {
   return dhs;
 }
 
-QueryData genDeviceHash(QueryContext& context) {
-  QueryData results;
+/**
+ * @brief Inode digests kept while the inode's modification time and size are
+ * unchanged.
+ *
+ * Keys are the device, partition, inode, modification time, and size.
+ */
+class DeviceHashCache : private boost::noncopyable {
+ public:
+  static DeviceHashCache& instance() {
+    static DeviceHashCache cache;
+    return cache;
+  }
 
-  auto devices = context.constraints["device"].getAll(EQUALS);
-  // This table requires three columns to determine an action.
-  auto parts = context.constraints["partition"].getAll(EQUALS);
-  auto inodes = context.constraints["inode"].getAll(EQUALS);
+  /// Get the digests of an inode, hashing the content if it changed.
+  MultiHashes get(const std::string& device,
+                  const std::string& partition,
+                  TskFsFile* file) {
+    auto* meta = file->getMeta();
+    if (meta == nullptr) {
+      return MultiHashes();
+    }
 
-  for (const auto& dev : devices) {
-    // For each require device path, open a device helper that checks the
-    // image, checks the volume, and allows partition iteration.
-    DeviceHelper dh(dev);
-    dh.partitions(([&results, &dev, &dh, &parts, &inodes](
-        const TskVsPartInfo* part) {
-      // The table also requires a partition for searching.
-      auto address = std::to_string(part->getAddr());
-      if (address != *parts.begin()) {
-        // If this partition does not match the requested, continue.
-        return;
+    auto key = device + ":" + partition + ":" +
+               std::to_string(meta->getAddr()) + ":" +
+               std::to_string(meta->getMTime()) + ":" +
+               std::to_string(meta->getSize());
+    delete meta;
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = hashes_.find(key);
+      if (it != hashes_.end()) {
+        return it->second;
       }
+    }
 
-      auto* fs = new TskFsInfo();
-      auto status = fs->open(part, TSK_FS_TYPE_DETECT);
-      // Cannot retrieve file information without accessing the filesystem.
-      if (status) {
-        delete fs;
-        return;
+    auto hashes = hashInode(file);
+    if (FLAGS_hash_cache_max > 0 && !hashes.sha256.empty()) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (hashes_.size() >= FLAGS_hash_cache_max) {
+        hashes_.clear();
       }
+      hashes_[key] = hashes;
+    }
+    return hashes;
+  }
 
-      dh.inodes(inodes,
+ private:
+  DeviceHashCache() {}
+
+ private:
+  std::map<std::string, MultiHashes> hashes_;
+
+  std::mutex mutex_;
+};
+
+/**
+ * @brief Hash the next unhashed inodes of a partition.
+ *
+ * Each worker opens its own image, volume, and filesystem, TSK handles are
+ * not shared between threads. The digests are written to the inode's row.
+ */
+static void hashDeviceInodes(const std::string& dev,
+                             const std::string& address,
+                             const std::vector<std::string>& inodes,
+                             std::atomic<size_t>& next,
+                             QueryData& rows) {
+  DeviceHelper dh(dev);
+  dh.partitions(([&](const TskVsPartInfo* part) {
+    if (std::to_string(part->getAddr()) != address) {
+      return;
+    }
+
+    auto* fs = new TskFsInfo();
+    auto status = fs->open(part, TSK_FS_TYPE_DETECT);
+    // Cannot retrieve file information without accessing the filesystem.
+    if (status) {
+      delete fs;
+      return;
+    }
+
+    for (auto i = next++; i < inodes.size() && !isQueryCancelled();
+         i = next++) {
+      dh.inodes({inodes[i]},
                 fs,
-                ([&results, &address, &dev, &dh, &fs](const std::string& inode,
-                                                      TskFsFile* file,
-                                                      const std::string& path) {
-                  Row r;
+                ([&rows, &dev, &address, i](const std::string& inode,
+                                            TskFsFile* file,
+                                            const std::string& path) {
+                  auto& r = rows[i];
                   r["device"] = dev;
                   r["partition"] = address;
                   r["inode"] = inode;
 
-                  auto hashes = hashInode(file);
+                  auto hashes =
+                      DeviceHashCache::instance().get(dev, address, file);
                   r["md5"] = std::move(hashes.md5);
                   r["sha1"] = std::move(hashes.sha1);
                   r["sha256"] = std::move(hashes.sha256);
-                  results.push_back(r);
                 }));
-      delete fs;
-    }));
+    }
+    delete fs;
+  }));
+}
+
+QueryData genDeviceHash(QueryContext& context) {
+  QueryData results;
+
+  auto devices = context.constraints["device"].getAll(EQUALS);
+  // This table requires three columns to determine an action.
+  auto parts = context.constraints["partition"].getAll(EQUALS);
+  auto inode_set = context.constraints["inode"].getAll(EQUALS);
+  if (parts.empty()) {
+    return results;
+  }
+
+  const auto& address = *parts.begin();
+  std::vector<std::string> inodes(inode_set.begin(), inode_set.end());
+  for (const auto& dev : devices) {
+    // Each inode's row is filled by the worker that hashed it, rows of inodes
+    // that could not be opened are left empty.
+    QueryData rows(inodes.size());
+    std::atomic<size_t> next{0};
+    auto workers =
+        std::min(static_cast<size_t>(FLAGS_hash_workers), inodes.size());
+    if (workers <= 1) {
+      hashDeviceInodes(dev, address, inodes, next, rows);
+    } else {
+      std::vector<std::thread> threads;
+      auto deadline = getQueryDeadline();
+      for (size_t i = 0; i < workers; i++) {
+        threads.emplace_back([&]() {
+          setThreadToBackgroundPriority();
+          setQueryDeadline(deadline);
+          hashDeviceInodes(dev, address, inodes, next, rows);
+        });
+      }
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    }
+
+    for (auto& r : rows) {
+      if (!r.empty()) {
+        results.push_back(std::move(r));
+      }
+    }
   }
 
   return results;
@@ -8,71 +8,69 @@
  *
  */
 
-#include <fstream>
+#include <linux/neighbour.h>
+#include <linux/rtnetlink.h>
 
-#include <boost/algorithm/string/split.hpp>
-#include <boost/algorithm/string/trim.hpp>
-
-#include <osquery/tables.h>
-#include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+#include "osquery/tables/networking/utils.h"
 
 namespace osquery {
 namespace tables {
 
-const std::string kLinuxArpTable = "/proc/net/arp";
+std::string getNetlinkIP(int family, const char* buffer);
 
-QueryData genArpCache(QueryContext& context) {
-  QueryData results;
-
-  boost::filesystem::path arp_path = kLinuxArpTable;
-  if (!osquery::isReadable(arp_path).ok()) {
-    VLOG(1) << "Cannot read arp table";
-    return results;
+void genNetlinkNeighbor(const struct nlmsghdr* netlink_msg,
+                        NetlinkSnapshot& snapshot,
+                        QueryData& results) {
+  if (netlink_msg->nlmsg_type != RTM_NEWNEIGH) {
+    return;
   }
 
-  std::ifstream fd(arp_path.string(), std::ios::in | std::ios::binary);
-  std::string line;
-
-  if (fd.fail() || fd.eof()) {
-    VLOG(1) << "Empty or failed arp table";
-    return results;
+  auto message = static_cast<struct ndmsg*>(NLMSG_DATA(netlink_msg));
+  if (message->ndm_family != AF_INET || (message->ndm_state & NUD_NOARP)) {
+    // The cache lists IPv4 neighbors, as /proc/net/arp did.
+    return;
   }
 
-  // Read the header line.
-  std::getline(fd, line, '\n');
-  while (!(fd.fail() || fd.eof())) {
-    std::getline(fd, line, '\n');
-
-    // IP address, HW type, Flags, HW address, Mask Device
-    std::vector<std::string> fields;
-    boost::split(fields, line, boost::is_any_of(" "), boost::token_compress_on);
-    for (auto& f : fields) {
-      // Inline trim each split.
-      boost::trim(f);
+  Row r;
+  r["mac"] = "00:00:00:00:00:00";
+  auto attr = reinterpret_cast<struct rtattr*>(
+      reinterpret_cast<char*>(message) + NLMSG_ALIGN(sizeof(struct ndmsg)));
+  auto attr_size = static_cast<int>(
+      NLMSG_PAYLOAD(netlink_msg, sizeof(struct ndmsg)));
+  for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+    if (attr->rta_type == NDA_DST) {
+      r["address"] =
+          getNetlinkIP(message->ndm_family, (char*)RTA_DATA(attr));
+    } else if (attr->rta_type == NDA_LLADDR && RTA_PAYLOAD(attr) == 6) {
+      r["mac"] = macAsString((const char*)RTA_DATA(attr));
     }
+  }
 
-    if (fields.size() != 6) {
-      // An unhandled error case.
-      continue;
-    }
+  if (r.count("address") == 0) {
+    return;
+  }
 
-    Row r;
-    r["address"] = fields[0];
-    r["mac"] = fields[3];
-    r["interface"] = fields[5];
+  r["interface"] = snapshot.getInterfaceName(message->ndm_ifindex);
+  // Note: it's also possible to detect proxy entries (NTF_PROXY).
+  r["permanent"] = (message->ndm_state & NUD_PERMANENT) ? "1" : "0";
+  results.push_back(r);
+}
 
-    // Note: it's also possible to detect publish entries (ATF_PUB).
-    if (fields[2] == "0x6") {
-      // The string representation of ATF_COM | ATF_PERM.
-      r["permanent"] = "1";
-    } else {
-      r["permanent"] = "0";
-    }
+QueryData genArpCache(QueryContext& context) {
+  QueryData results;
 
-    results.push_back(r);
+  auto snapshot = NetlinkSnapshot::get();
+  auto status = snapshot->forEach(
+      RTM_GETNEIGH, [&snapshot, &results](const struct nlmsghdr* netlink_msg) {
+        genNetlinkNeighbor(netlink_msg, *snapshot, results);
+      });
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read arp table: " << status.getMessage();
   }
-
   return results;
 }
 }
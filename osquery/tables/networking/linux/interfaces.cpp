@@ -0,0 +1,177 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <linux/if_addr.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+#include "osquery/tables/networking/utils.h"
+
+namespace osquery {
+namespace tables {
+
+std::string getNetlinkIP(int family, const char* buffer);
+
+/// Format a prefix length as an address mask of a family.
+std::string getNetlinkMask(int family, unsigned int prefix) {
+  unsigned char mask[16] = {0};
+  size_t size = (family == AF_INET6) ? 16 : 4;
+  for (size_t i = 0; i < size && prefix > 0; i++) {
+    auto bits = (prefix > 8) ? 8 : prefix;
+    mask[i] = static_cast<unsigned char>(0xff << (8 - bits));
+    prefix -= bits;
+  }
+  return getNetlinkIP(family, reinterpret_cast<const char*>(mask));
+}
+
+void genNetlinkAddress(const struct nlmsghdr* netlink_msg,
+                       NetlinkSnapshot& snapshot,
+                       QueryData& results) {
+  if (netlink_msg->nlmsg_type != RTM_NEWADDR) {
+    return;
+  }
+
+  auto message = static_cast<struct ifaddrmsg*>(NLMSG_DATA(netlink_msg));
+  if (message->ifa_family != AF_INET && message->ifa_family != AF_INET6) {
+    return;
+  }
+
+  std::string label, address, local, broadcast;
+  auto attr = IFA_RTA(message);
+  auto attr_size = static_cast<int>(IFA_PAYLOAD(netlink_msg));
+  for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+    auto data = static_cast<const char*>(RTA_DATA(attr));
+    if (attr->rta_type == IFA_ADDRESS) {
+      address = getNetlinkIP(message->ifa_family, data);
+    } else if (attr->rta_type == IFA_LOCAL) {
+      local = getNetlinkIP(message->ifa_family, data);
+    } else if (attr->rta_type == IFA_BROADCAST) {
+      broadcast = getNetlinkIP(message->ifa_family, data);
+    } else if (attr->rta_type == IFA_LABEL) {
+      label = data;
+    }
+  }
+
+  Row r;
+  r["interface"] = (label.empty())
+                       ? snapshot.getInterfaceName(message->ifa_index)
+                       : label;
+
+  // A point to point address has a local and a peer address.
+  r["address"] = (local.empty()) ? address : local;
+  r["mask"] = getNetlinkMask(message->ifa_family, message->ifa_prefixlen);
+
+  auto destination = broadcast;
+  if (destination.empty() && !local.empty() && local != address) {
+    destination = address;
+  }
+
+  if (!destination.empty()) {
+    auto flags = snapshot.getInterfaceFlags(message->ifa_index);
+    if ((flags & IFF_BROADCAST) == IFF_BROADCAST) {
+      r["broadcast"] = destination;
+    } else {
+      r["point_to_point"] = destination;
+    }
+  }
+  results.push_back(r);
+}
+
+void genNetlinkLink(const struct nlmsghdr* netlink_msg, QueryData& results) {
+  if (netlink_msg->nlmsg_type != RTM_NEWLINK) {
+    return;
+  }
+
+  auto link = static_cast<struct ifinfomsg*>(NLMSG_DATA(netlink_msg));
+
+  Row r;
+  r["interface"] = "";
+  r["mac"] = "00:00:00:00:00:00";
+  r["type"] = INTEGER(link->ifi_type);
+  r["mtu"] = "0";
+  r["metric"] = "0";
+
+  const struct rtnl_link_stats* stats = nullptr;
+  const struct rtnl_link_stats64* stats64 = nullptr;
+  auto attr = IFLA_RTA(link);
+  auto attr_size = static_cast<int>(IFLA_PAYLOAD(netlink_msg));
+  for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+    auto data = static_cast<const char*>(RTA_DATA(attr));
+    if (attr->rta_type == IFLA_IFNAME) {
+      r["interface"] = data;
+    } else if (attr->rta_type == IFLA_ADDRESS && RTA_PAYLOAD(attr) == 6) {
+      r["mac"] = macAsString(data);
+    } else if (attr->rta_type == IFLA_MTU) {
+      r["mtu"] = BIGINT(*reinterpret_cast<const uint32_t*>(data));
+    } else if (attr->rta_type == IFLA_STATS &&
+               RTA_PAYLOAD(attr) >= sizeof(struct rtnl_link_stats)) {
+      stats = reinterpret_cast<const struct rtnl_link_stats*>(data);
+    } else if (attr->rta_type == IFLA_STATS64 &&
+               RTA_PAYLOAD(attr) >= sizeof(struct rtnl_link_stats64)) {
+      stats64 = reinterpret_cast<const struct rtnl_link_stats64*>(data);
+    }
+  }
+
+  // The 64bit counters do not wrap on busy interfaces.
+  if (stats64 != nullptr) {
+    r["ipackets"] = BIGINT(stats64->rx_packets);
+    r["opackets"] = BIGINT(stats64->tx_packets);
+    r["ibytes"] = BIGINT(stats64->rx_bytes);
+    r["obytes"] = BIGINT(stats64->tx_bytes);
+    r["ierrors"] = BIGINT(stats64->rx_errors);
+    r["oerrors"] = BIGINT(stats64->tx_errors);
+  } else if (stats != nullptr) {
+    r["ipackets"] = BIGINT(stats->rx_packets);
+    r["opackets"] = BIGINT(stats->tx_packets);
+    r["ibytes"] = BIGINT(stats->rx_bytes);
+    r["obytes"] = BIGINT(stats->tx_bytes);
+    r["ierrors"] = BIGINT(stats->rx_errors);
+    r["oerrors"] = BIGINT(stats->tx_errors);
+  }
+
+  // Last change is not implemented in Linux.
+  r["last_change"] = "-1";
+  results.push_back(r);
+}
+
+QueryData genInterfaceAddresses(QueryContext& context) {
+  QueryData results;
+
+  auto snapshot = NetlinkSnapshot::get();
+  auto status = snapshot->forEach(
+      RTM_GETADDR, [&snapshot, &results](const struct nlmsghdr* netlink_msg) {
+        genNetlinkAddress(netlink_msg, *snapshot, results);
+      });
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read interface addresses: " << status.getMessage();
+  }
+  return results;
+}
+
+QueryData genInterfaceDetails(QueryContext& context) {
+  QueryData results;
+
+  auto snapshot = NetlinkSnapshot::get();
+  auto status = snapshot->forEach(
+      RTM_GETLINK, [&results](const struct nlmsghdr* netlink_msg) {
+        genNetlinkLink(netlink_msg, results);
+      });
+  if (!status.ok()) {
+    VLOG(1) << "Cannot read interface details: " << status.getMessage();
+  }
+  return results;
+}
+}
+}
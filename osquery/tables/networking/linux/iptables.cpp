@@ -8,6 +8,7 @@
  *
  */
 
+#include <set>
 #include <sstream>
 
 #include <arpa/inet.h>
@@ -71,61 +72,88 @@ void parseIpEntry(const ipt_ip *ip, Row &r) {
   r["outiface_mask"] = TEXT(outiface_mask);
 }
 
-void genIPTablesRules(const std::string &filter, QueryData &results) {
-  Row r;
-  r["filter_name"] = filter;
+Status genNftablesRules(const std::set<std::string> &filters,
+                        const std::set<std::string> &chains,
+                        QueryData &results);
 
-  // Initialize the access to iptc
-  auto handle = (struct iptc_handle *)iptc_init(filter.c_str());
-  if (handle == nullptr) {
-    return;
-  }
+void genIPTablesChain(const char *chain,
+                      struct iptc_handle *handle,
+                      bool parse_ip,
+                      Row &r,
+                      QueryData &results) {
+  r["chain"] = TEXT(chain);
 
-  // Iterate through chains
-  for (auto chain = iptc_first_chain(handle); chain != nullptr;
-       chain = iptc_next_chain(handle)) {
-    r["chain"] = TEXT(chain);
+  struct ipt_counters counters;
+  auto policy = iptc_get_policy(chain, &counters, handle);
+
+  if (policy != nullptr) {
+    r["policy"] = TEXT(policy);
+    r["packets"] = INTEGER(counters.pcnt);
+    r["bytes"] = INTEGER(counters.bcnt);
+  } else {
+    r["policy"] = "";
+    r["packets"] = "0";
+    r["bytes"] = "0";
+  }
 
-    struct ipt_counters counters;
-    auto policy = iptc_get_policy(chain, &counters, handle);
+  const struct ipt_entry *prev_rule = nullptr;
+  // Iterating through all the rules per chain
+  for (const struct ipt_entry *chain_rule = iptc_first_rule(chain, handle);
+       chain_rule;
+       chain_rule = iptc_next_rule(prev_rule, handle)) {
+    prev_rule = chain_rule;
 
-    if (policy != nullptr) {
-      r["policy"] = TEXT(policy);
-      r["packets"] = INTEGER(counters.pcnt);
-      r["bytes"] = INTEGER(counters.bcnt);
+    auto target = iptc_get_target(chain_rule, handle);
+    if (target != nullptr) {
+      r["target"] = TEXT(target);
     } else {
-      r["policy"] = "";
-      r["packets"] = "0";
-      r["bytes"] = "0";
+      r["target"] = "";
     }
 
-    const struct ipt_entry *prev_rule = nullptr;
-    // Iterating through all the rules per chain
-    for (const struct ipt_entry *chain_rule = iptc_first_rule(chain, handle);
-         chain_rule;
-         chain_rule = iptc_next_rule(prev_rule, handle)) {
-      prev_rule = chain_rule;
-
-      auto target = iptc_get_target(chain_rule, handle);
-      if (target != nullptr) {
-        r["target"] = TEXT(target);
-      } else {
-        r["target"] = "";
-      }
-
-      if (chain_rule->target_offset) {
-        r["match"] = "yes";
-      } else {
-        r["match"] = "no";
-      }
+    if (chain_rule->target_offset) {
+      r["match"] = "yes";
+    } else {
+      r["match"] = "no";
+    }
 
+    // The address and interface strings are only built when selected.
+    if (parse_ip) {
       const struct ipt_ip *ip = &chain_rule->ip;
       parseIpEntry(ip, r);
+    }
 
-      results.push_back(r);
-    } // Rule iteration
     results.push_back(r);
-  } // Chain iteration
+  } // Rule iteration
+  results.push_back(r);
+}
+
+void genIPTablesRules(const std::string &filter,
+                      const std::set<std::string> &chains,
+                      bool parse_ip,
+                      QueryData &results) {
+  Row r;
+  r["filter_name"] = filter;
+
+  // Initialize the access to iptc
+  auto handle = (struct iptc_handle *)iptc_init(filter.c_str());
+  if (handle == nullptr) {
+    return;
+  }
+
+  if (chains.empty()) {
+    // Iterate through chains
+    for (auto chain = iptc_first_chain(handle); chain != nullptr;
+         chain = iptc_next_chain(handle)) {
+      genIPTablesChain(chain, handle, parse_ip, r, results);
+    }
+  } else {
+    // Only the requested chains are walked.
+    for (const auto &chain : chains) {
+      if (iptc_is_chain(chain.c_str(), handle)) {
+        genIPTablesChain(chain.c_str(), handle, parse_ip, r, results);
+      }
+    }
+  }
 
   iptc_free(handle);
 }
@@ -133,17 +161,33 @@ void genIPTablesRules(const std::string &filter, QueryData &results) {
 QueryData genIptables(QueryContext &context) {
   QueryData results;
 
+  auto filters = context.constraints["filter_name"].getAll(EQUALS);
+  auto chains = context.constraints["chain"].getAll(EQUALS);
+  bool parse_ip = context.isAnyColumnUsed({"protocol",
+                                           "src_ip",
+                                           "src_mask",
+                                           "iniface",
+                                           "iniface_mask",
+                                           "dst_ip",
+                                           "dst_mask",
+                                           "outiface",
+                                           "outiface_mask"});
+
   // Read in table names
   std::string content;
   auto s = osquery::readFile(kLinuxIpTablesNames, content);
   if (s.ok()) {
     for (auto &line : split(content, "\n")) {
       boost::trim(line);
-      if (line.size() > 0) {
-        genIPTablesRules(line, results);
+      if (line.size() > 0 && (filters.empty() || filters.count(line) > 0)) {
+        genIPTablesRules(line, chains, parse_ip, results);
       }
     }
-  } else {
+  }
+
+  // Hosts using iptables-nft keep their rules in nf_tables.
+  auto nft_status = genNftablesRules(filters, chains, results);
+  if (!s.ok() && !nft_status.ok()) {
     // Permissions issue or iptables modules are not loaded.
     TLOG << "Error reading " << kLinuxIpTablesNames << " : " << s.toString();
   }
@@ -0,0 +1,227 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <linux/rtnetlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <osquery/logger.h>
+#include <osquery/system.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+
+namespace osquery {
+namespace tables {
+
+const int kNetlinkReceiveBuffer{4 * 1024 * 1024};
+
+/// The initial read buffer, grown to fit larger datagrams.
+const size_t kNetlinkReadSize{32768};
+
+Status dumpNetlink(int protocol,
+                   const struct nlmsghdr* request,
+                   std::string& messages) {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, protocol);
+  if (fd < 0) {
+    return Status(1, "Cannot open NETLINK socket");
+  }
+
+  // A dump of thousands of routes or rules is sent faster than it is read.
+  // The kernel limits the size to net.core.rmem_max.
+  int receive_buffer = kNetlinkReceiveBuffer;
+  setsockopt(
+      fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer, sizeof(receive_buffer));
+
+  // Do not wait indefinitely for a dump.
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  if (send(fd, request, request->nlmsg_len, 0) < 0) {
+    close(fd);
+    return Status(1, "Cannot write NETLINK request");
+  }
+
+  Status status;
+  bool done = false;
+  std::vector<char> buffer(kNetlinkReadSize);
+  while (!done) {
+    // Measure the next datagram, a read into a smaller buffer truncates it.
+    auto size = recv(fd, nullptr, 0, MSG_PEEK | MSG_TRUNC);
+    if (size < 0 && errno == EINTR) {
+      continue;
+    } else if (size <= 0) {
+      status = Status(1, "Cannot read NETLINK response");
+      break;
+    }
+
+    if (static_cast<size_t>(size) > buffer.size()) {
+      buffer.resize(size);
+    }
+    size = recv(fd, buffer.data(), buffer.size(), 0);
+    if (size <= 0) {
+      status = Status(1, "Cannot read NETLINK response");
+      break;
+    }
+
+    auto header = reinterpret_cast<struct nlmsghdr*>(buffer.data());
+    auto remaining = static_cast<unsigned int>(size);
+    for (; NLMSG_OK(header, remaining);
+         header = NLMSG_NEXT(header, remaining)) {
+      if (header->nlmsg_seq != request->nlmsg_seq) {
+        // A reply to an earlier request.
+        continue;
+      }
+
+      if (header->nlmsg_type == NLMSG_DONE) {
+        done = true;
+        break;
+      } else if (header->nlmsg_type == NLMSG_ERROR) {
+        status = Status(1, "NETLINK request failed");
+        done = true;
+        break;
+      }
+
+      // Keep each message aligned for NLMSG_NEXT.
+      messages.append(reinterpret_cast<const char*>(header),
+                      header->nlmsg_len);
+      messages.resize(NLMSG_ALIGN(messages.size()), '\0');
+    }
+  }
+
+  close(fd);
+  if (!status.ok()) {
+    messages.clear();
+  }
+  return status;
+}
+
+Status dumpNetlink(int type, std::string& messages) {
+  struct {
+    struct nlmsghdr header;
+    struct rtgenmsg message;
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtgenmsg));
+  request.header.nlmsg_type = static_cast<__u16>(type);
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.header.nlmsg_seq = static_cast<__u32>(type);
+  request.message.rtgen_family = AF_UNSPEC;
+  return dumpNetlink(NETLINK_ROUTE, &request.header, messages);
+}
+
+/// The current snapshot, see NetlinkSnapshot::get.
+static std::shared_ptr<NetlinkSnapshot> kNetlinkSnapshot{nullptr};
+
+/// Protect the current snapshot.
+static Mutex kNetlinkSnapshotMutex;
+
+std::shared_ptr<NetlinkSnapshot> NetlinkSnapshot::get() {
+  auto now = getUnixTime();
+  WriteLock lock(kNetlinkSnapshotMutex);
+  if (kNetlinkSnapshot == nullptr || kNetlinkSnapshot->time_ != now) {
+    kNetlinkSnapshot =
+        std::shared_ptr<NetlinkSnapshot>(new NetlinkSnapshot(now));
+  }
+  return kNetlinkSnapshot;
+}
+
+void NetlinkSnapshot::reset() {
+  WriteLock lock(kNetlinkSnapshotMutex);
+  kNetlinkSnapshot = nullptr;
+}
+
+Status NetlinkSnapshot::getDump(int type, const std::string*& messages) {
+  // The caller holds the mutex, a concurrent scan waits for the same dump.
+  auto it = dumps_.find(type);
+  if (it == dumps_.end()) {
+    std::string content;
+    bool read = dumpNetlink(type, content).ok();
+    if (!read) {
+      VLOG(1) << "Cannot dump NETLINK request type " << type;
+    }
+    it = dumps_.emplace(type, std::make_pair(read, std::move(content))).first;
+  }
+
+  messages = &it->second.second;
+  return (it->second.first) ? Status(0, "OK")
+                            : Status(1, "Cannot dump NETLINK messages");
+}
+
+Status NetlinkSnapshot::forEach(
+    int type, const std::function<void(const struct nlmsghdr*)>& visitor) {
+  const std::string* messages = nullptr;
+  {
+    WriteLock lock(mutex_);
+    auto status = getDump(type, messages);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  // A dump is never modified once stored, visit without the lock.
+  auto header = reinterpret_cast<const struct nlmsghdr*>(messages->data());
+  auto remaining = static_cast<unsigned int>(messages->size());
+  for (; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+    visitor(header);
+  }
+  return Status(0, "OK");
+}
+
+void NetlinkSnapshot::indexLinks() {
+  if (indexed_) {
+    return;
+  }
+  indexed_ = true;
+
+  const std::string* messages = nullptr;
+  if (!getDump(RTM_GETLINK, messages).ok()) {
+    return;
+  }
+
+  auto header = reinterpret_cast<const struct nlmsghdr*>(messages->data());
+  auto remaining = static_cast<unsigned int>(messages->size());
+  for (; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+    if (header->nlmsg_type != RTM_NEWLINK) {
+      continue;
+    }
+
+    auto link = static_cast<struct ifinfomsg*>(NLMSG_DATA(header));
+    auto& entry = links_[link->ifi_index];
+    entry.second = link->ifi_flags;
+
+    auto attr = IFLA_RTA(link);
+    auto attr_size = static_cast<int>(IFLA_PAYLOAD(header));
+    for (; RTA_OK(attr, attr_size); attr = RTA_NEXT(attr, attr_size)) {
+      if (attr->rta_type == IFLA_IFNAME) {
+        entry.first = static_cast<const char*>(RTA_DATA(attr));
+        break;
+      }
+    }
+  }
+}
+
+std::string NetlinkSnapshot::getInterfaceName(int index) {
+  WriteLock lock(mutex_);
+  indexLinks();
+  auto it = links_.find(index);
+  return (it != links_.end()) ? it->second.first : "";
+}
+
+unsigned int NetlinkSnapshot::getInterfaceFlags(int index) {
+  WriteLock lock(mutex_);
+  indexLinks();
+  auto it = links_.find(index);
+  return (it != links_.end()) ? it->second.second : 0;
+}
+}
+}
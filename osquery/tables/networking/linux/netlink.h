@@ -0,0 +1,108 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <linux/netlink.h>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+
+namespace osquery {
+namespace tables {
+
+/// Each dump's socket requests a receive buffer of this many bytes.
+extern const int kNetlinkReceiveBuffer;
+
+/**
+ * @brief Send a dump request and read every reply message.
+ *
+ * Each datagram is measured before it is read, so no message is truncated
+ * regardless of the size of the dump.
+ *
+ * @param protocol the netlink family, such as NETLINK_ROUTE.
+ * @param request a complete request message with the NLM_F_DUMP flag.
+ * @param messages output, the aligned reply messages appended together.
+ * @return failure if the kernel rejects or does not complete the dump.
+ */
+Status dumpNetlink(int protocol,
+                   const struct nlmsghdr* request,
+                   std::string& messages);
+
+/// Request a complete rtnetlink dump, such as RTM_GETLINK or RTM_GETROUTE.
+Status dumpNetlink(int type, std::string& messages);
+
+/**
+ * @brief The rtnetlink state shared by the networking tables within a second.
+ *
+ * The routes, arp_cache, interface_addresses and interface_details tables
+ * are views over the link, address, route and neighbor dumps. Each dump is
+ * requested at most once per snapshot, on first use, and shared with every
+ * table scanned, or joined, within that second. Interface names are
+ * resolved from the link dump instead of an ioctl per row.
+ */
+class NetlinkSnapshot : private boost::noncopyable {
+ public:
+  /// Get the snapshot for the current second, creating it if needed.
+  static std::shared_ptr<NetlinkSnapshot> get();
+
+  /// Release the current snapshot, the next request dumps again.
+  static void reset();
+
+  /**
+   * @brief Call a visitor with each message of a dump.
+   *
+   * @param type the dump request, RTM_GETLINK, RTM_GETADDR, RTM_GETROUTE or
+   * RTM_GETNEIGH.
+   * @param visitor called with each message, in the kernel's order.
+   * @return failure if the dump could not be read, no messages are visited.
+   */
+  Status forEach(int type,
+                 const std::function<void(const struct nlmsghdr*)>& visitor);
+
+  /// The name of an interface index, or an empty string.
+  std::string getInterfaceName(int index);
+
+  /// The interface flags, IFF_*, of an interface index.
+  unsigned int getInterfaceFlags(int index);
+
+ private:
+  explicit NetlinkSnapshot(size_t time) : time_(time) {}
+
+  /// Get a dump's messages, requesting it on first use.
+  Status getDump(int type, const std::string*& messages);
+
+  /// Index the link dump's names and flags on first use.
+  void indexLinks();
+
+ private:
+  /// The UNIX time the snapshot was created.
+  size_t time_{0};
+
+  /// Dumped messages keyed by request type, empty if the dump failed.
+  std::map<int, std::pair<bool, std::string>> dumps_;
+
+  /// Set after the link dump is indexed.
+  bool indexed_{false};
+
+  /// Interface names and flags keyed by index.
+  std::map<int, std::pair<std::string, unsigned int>> links_;
+
+  /// Protect the lazily populated dumps, tables may be scanned concurrently.
+  Mutex mutex_;
+};
+}
+}
@@ -0,0 +1,471 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <endian.h>
+#include <linux/netfilter.h>
+#include <linux/netlink.h>
+
+#include <functional>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <osquery/logger.h>
+#include <osquery/tables.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+#include "osquery/tables/networking/linux/nf_tables.h"
+
+namespace osquery {
+namespace tables {
+
+/// The IPv4 header offsets compared by iptables-nft rules.
+static const uint32_t kIpProtocolOffset = 9;
+static const uint32_t kIpSourceOffset = 12;
+static const uint32_t kIpDestinationOffset = 16;
+
+/// An attribute visitor, called with the type, payload and payload size.
+using NftablesVisitor = std::function<void(uint16_t, const char*, size_t)>;
+
+/// Call a visitor with each attribute in a buffer of attributes.
+static void forEachAttribute(const char* data,
+                             size_t size,
+                             const NftablesVisitor& visitor) {
+  while (size >= NLA_HDRLEN) {
+    auto attr = reinterpret_cast<const struct nlattr*>(data);
+    if (attr->nla_len < NLA_HDRLEN || attr->nla_len > size) {
+      break;
+    }
+
+    visitor(attr->nla_type & NLA_TYPE_MASK,
+            data + NLA_HDRLEN,
+            attr->nla_len - NLA_HDRLEN);
+    size_t aligned = NLA_ALIGN(attr->nla_len);
+    if (aligned >= size) {
+      break;
+    }
+    data += aligned;
+    size -= aligned;
+  }
+}
+
+static inline uint32_t getU32(const char* data, size_t size) {
+  return (size >= sizeof(uint32_t))
+             ? ntohl(*reinterpret_cast<const uint32_t*>(data))
+             : 0;
+}
+
+static inline uint64_t getU64(const char* data, size_t size) {
+  return (size >= sizeof(uint64_t))
+             ? be64toh(*reinterpret_cast<const uint64_t*>(data))
+             : 0;
+}
+
+/// Read the NFTA_DATA_VALUE of a nested nft_data attribute.
+static std::string getDataValue(const char* data, size_t size) {
+  std::string value;
+  forEachAttribute(
+      data, size, [&value](uint16_t type, const char* data, size_t size) {
+        if (type == NFTA_DATA_VALUE) {
+          value.assign(data, size);
+        }
+      });
+  return value;
+}
+
+/// Format an interface name compared by a rule, a prefix ends with a '+'.
+static void setInterface(const std::string& value,
+                         const std::string& column,
+                         Row& r) {
+  std::string mask;
+  for (size_t i = 0; i < value.size(); i++) {
+    mask += "FF";
+  }
+
+  auto end = value.find('\0');
+  r[column] = (end == std::string::npos) ? value + "+" : value.substr(0, end);
+  r[column + "_mask"] = mask;
+}
+
+static std::string getAddress(const std::string& value) {
+  char dst[INET_ADDRSTRLEN] = {0};
+  if (value.size() == 4) {
+    inet_ntop(AF_INET, value.data(), dst, sizeof(dst));
+  }
+  return dst;
+}
+
+/// The field loaded into a register by the last meta or payload expression.
+enum NftablesLoad {
+  NFT_LOAD_NONE,
+  NFT_LOAD_IIFNAME,
+  NFT_LOAD_OIFNAME,
+  NFT_LOAD_PROTOCOL,
+  NFT_LOAD_SOURCE,
+  NFT_LOAD_DESTINATION,
+};
+
+/// The state of a rule's expressions, iptables-nft emits load, mask, compare.
+struct NftablesExpressionState {
+  NftablesLoad load{NFT_LOAD_NONE};
+
+  /// A bitwise mask applied to the loaded address.
+  std::string mask;
+};
+
+std::string getNftablesVerdict(int code, const std::string& chain) {
+  switch (code) {
+  case NF_ACCEPT:
+    return "ACCEPT";
+  case NF_DROP:
+    return "DROP";
+  case NF_QUEUE:
+    return "QUEUE";
+  case NFT_RETURN:
+    return "RETURN";
+  case NFT_JUMP:
+  case NFT_GOTO:
+    return chain;
+  default:
+    return "";
+  }
+}
+
+/// Read the verdict of a nested nft_data attribute, as a target.
+static std::string getImmediateVerdict(const char* data, size_t size) {
+  std::string verdict;
+  forEachAttribute(
+      data, size, [&verdict](uint16_t type, const char* data, size_t size) {
+        if (type != NFTA_DATA_VERDICT) {
+          return;
+        }
+
+        int code = 0;
+        std::string chain;
+        forEachAttribute(
+            data, size, [&](uint16_t type, const char* data, size_t size) {
+              if (type == NFTA_VERDICT_CODE) {
+                code = static_cast<int>(getU32(data, size));
+              } else if (type == NFTA_VERDICT_CHAIN) {
+                chain = data;
+              }
+            });
+        verdict = getNftablesVerdict(code, chain);
+      });
+  return verdict;
+}
+
+static void parseNftablesExpression(const std::string& name,
+                                    const char* data,
+                                    size_t size,
+                                    NftablesExpressionState& state,
+                                    Row& r) {
+  if (name == "meta") {
+    forEachAttribute(
+        data, size, [&state](uint16_t type, const char* data, size_t size) {
+          if (type != NFTA_META_KEY) {
+            return;
+          }
+          auto key = getU32(data, size);
+          if (key == NFT_META_IIFNAME) {
+            state.load = NFT_LOAD_IIFNAME;
+          } else if (key == NFT_META_OIFNAME) {
+            state.load = NFT_LOAD_OIFNAME;
+          } else if (key == NFT_META_L4PROTO) {
+            state.load = NFT_LOAD_PROTOCOL;
+          } else {
+            state.load = NFT_LOAD_NONE;
+          }
+        });
+    state.mask.clear();
+  } else if (name == "payload") {
+    uint32_t base = 0, offset = 0, length = 0;
+    forEachAttribute(
+        data, size, [&](uint16_t type, const char* data, size_t size) {
+          if (type == NFTA_PAYLOAD_BASE) {
+            base = getU32(data, size);
+          } else if (type == NFTA_PAYLOAD_OFFSET) {
+            offset = getU32(data, size);
+          } else if (type == NFTA_PAYLOAD_LEN) {
+            length = getU32(data, size);
+          }
+        });
+
+    state.load = NFT_LOAD_NONE;
+    state.mask.clear();
+    if (base == NFT_PAYLOAD_NETWORK_HEADER) {
+      if (offset == kIpProtocolOffset && length == 1) {
+        state.load = NFT_LOAD_PROTOCOL;
+      } else if (offset == kIpSourceOffset && length == 4) {
+        state.load = NFT_LOAD_SOURCE;
+      } else if (offset == kIpDestinationOffset && length == 4) {
+        state.load = NFT_LOAD_DESTINATION;
+      }
+    }
+  } else if (name == "bitwise") {
+    forEachAttribute(
+        data, size, [&state](uint16_t type, const char* data, size_t size) {
+          if (type == NFTA_BITWISE_MASK) {
+            state.mask = getDataValue(data, size);
+          }
+        });
+  } else if (name == "cmp") {
+    std::string value;
+    forEachAttribute(
+        data, size, [&value](uint16_t type, const char* data, size_t size) {
+          if (type == NFTA_CMP_DATA) {
+            value = getDataValue(data, size);
+          }
+        });
+
+    r["match"] = "yes";
+    if (state.load == NFT_LOAD_IIFNAME) {
+      setInterface(value, "iniface", r);
+    } else if (state.load == NFT_LOAD_OIFNAME) {
+      setInterface(value, "outiface", r);
+    } else if (state.load == NFT_LOAD_PROTOCOL && value.size() == 1) {
+      r["protocol"] = INTEGER(static_cast<int>(static_cast<uint8_t>(value[0])));
+    } else if (state.load == NFT_LOAD_SOURCE ||
+               state.load == NFT_LOAD_DESTINATION) {
+      auto prefix = (state.load == NFT_LOAD_SOURCE) ? "src" : "dst";
+      r[std::string(prefix) + "_ip"] = getAddress(value);
+      r[std::string(prefix) + "_mask"] = (state.mask.empty())
+                                             ? "255.255.255.255"
+                                             : getAddress(state.mask);
+    }
+    state.load = NFT_LOAD_NONE;
+  } else if (name == "immediate") {
+    forEachAttribute(
+        data, size, [&r](uint16_t type, const char* data, size_t size) {
+          if (type == NFTA_IMMEDIATE_DATA) {
+            r["target"] = getImmediateVerdict(data, size);
+          }
+        });
+  } else if (name == "target") {
+    // An xtables target, such as REJECT or MASQUERADE.
+    forEachAttribute(
+        data, size, [&r](uint16_t type, const char* data, size_t size) {
+          if (type == NFTA_TARGET_NAME) {
+            r["target"] = data;
+          }
+        });
+  } else if (name == "match") {
+    // An xtables match, such as a conntrack state or comment.
+    r["match"] = "yes";
+  }
+}
+
+void parseNftablesExpressions(const char* data, size_t size, Row& r) {
+  r["protocol"] = "0";
+  r["iniface"] = "all";
+  r["outiface"] = "all";
+  r["iniface_mask"] = "";
+  r["outiface_mask"] = "";
+  r["src_ip"] = "0.0.0.0";
+  r["dst_ip"] = "0.0.0.0";
+  r["src_mask"] = "0.0.0.0";
+  r["dst_mask"] = "0.0.0.0";
+  r["target"] = "";
+  r["match"] = "no";
+
+  NftablesExpressionState state;
+  forEachAttribute(
+      data, size, [&](uint16_t type, const char* data, size_t size) {
+        if (type != NFTA_LIST_ELEM) {
+          return;
+        }
+
+        std::string name;
+        const char* expression = nullptr;
+        size_t expression_size = 0;
+        forEachAttribute(
+            data, size, [&](uint16_t type, const char* data, size_t size) {
+              if (type == NFTA_EXPR_NAME) {
+                name = data;
+              } else if (type == NFTA_EXPR_DATA) {
+                expression = data;
+                expression_size = size;
+              }
+            });
+
+        if (expression != nullptr) {
+          parseNftablesExpression(name, expression, expression_size, state, r);
+        }
+      });
+}
+
+/// Append a string attribute to a request.
+static void addAttribute(std::string& request,
+                         uint16_t type,
+                         const std::string& value) {
+  struct nlattr attr;
+  attr.nla_type = type;
+  attr.nla_len = static_cast<uint16_t>(NLA_HDRLEN + value.size() + 1);
+  request.append(reinterpret_cast<const char*>(&attr), sizeof(attr));
+  request.append(value.c_str(), value.size() + 1);
+  request.resize(NLA_ALIGN(request.size()), '\0');
+}
+
+/// Dump nf_tables chains or rules of the IPv4 family.
+static Status dumpNftables(int type,
+                           const std::string& table,
+                           const std::string& chain,
+                           std::string& messages) {
+  struct {
+    struct nlmsghdr header;
+    struct nfgenmsg message;
+  } request;
+  memset(&request, 0, sizeof(request));
+  request.header.nlmsg_type =
+      static_cast<__u16>((NFNL_SUBSYS_NFTABLES << 8) | type);
+  request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  request.header.nlmsg_seq = static_cast<__u32>(type);
+  request.message.nfgen_family = NFPROTO_IPV4;
+  request.message.version = NFNETLINK_V0;
+
+  std::string buffer(reinterpret_cast<const char*>(&request),
+                     NLMSG_LENGTH(sizeof(struct nfgenmsg)));
+  buffer.resize(NLMSG_ALIGN(buffer.size()), '\0');
+
+  // Kernels that filter rule dumps by table and chain skip other rules.
+  if (!table.empty()) {
+    addAttribute(buffer, NFTA_RULE_TABLE, table);
+    if (!chain.empty()) {
+      addAttribute(buffer, NFTA_RULE_CHAIN, chain);
+    }
+  }
+
+  auto header = reinterpret_cast<struct nlmsghdr*>(&buffer[0]);
+  header->nlmsg_len = static_cast<__u32>(buffer.size());
+  return dumpNetlink(NETLINK_NETFILTER, header, messages);
+}
+
+/// Call a visitor with each message of a type in a dump, and its attributes.
+static void forEachMessage(
+    const std::string& messages,
+    int type,
+    const std::function<void(const char*, size_t)>& visitor) {
+  auto header = reinterpret_cast<const struct nlmsghdr*>(messages.data());
+  auto remaining = static_cast<unsigned int>(messages.size());
+  auto message_type = (NFNL_SUBSYS_NFTABLES << 8) | type;
+  auto offset = NLMSG_LENGTH(NLMSG_ALIGN(sizeof(struct nfgenmsg)));
+  for (; NLMSG_OK(header, remaining); header = NLMSG_NEXT(header, remaining)) {
+    if (header->nlmsg_type == message_type && header->nlmsg_len >= offset) {
+      visitor(reinterpret_cast<const char*>(header) + offset,
+              header->nlmsg_len - offset);
+    }
+  }
+}
+
+/// Parse a chain message's name, table, policy and counters.
+static void parseNftablesChain(const char* data, size_t size, Row& r) {
+  r["policy"] = "";
+  r["packets"] = "0";
+  r["bytes"] = "0";
+  forEachAttribute(
+      data, size, [&r](uint16_t type, const char* data, size_t size) {
+        if (type == NFTA_CHAIN_TABLE) {
+          r["filter_name"] = data;
+        } else if (type == NFTA_CHAIN_NAME) {
+          r["chain"] = data;
+        } else if (type == NFTA_CHAIN_POLICY) {
+          auto policy = static_cast<int>(getU32(data, size));
+          r["policy"] = getNftablesVerdict(policy, "");
+        } else if (type == NFTA_CHAIN_COUNTERS) {
+          forEachAttribute(
+              data, size, [&r](uint16_t type, const char* data, size_t size) {
+                if (type == NFTA_COUNTER_PACKETS) {
+                  r["packets"] = INTEGER(getU64(data, size));
+                } else if (type == NFTA_COUNTER_BYTES) {
+                  r["bytes"] = INTEGER(getU64(data, size));
+                }
+              });
+        }
+      });
+}
+
+/// A chain row and the rows of its rules.
+struct NftablesChain {
+  Row row;
+  std::vector<Row> rules;
+};
+
+Status genNftablesRules(const std::set<std::string>& filters,
+                        const std::set<std::string>& chains,
+                        QueryData& results) {
+  std::string messages;
+  auto status = dumpNftables(NFT_MSG_GETCHAIN, "", "", messages);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // Chains in the kernel's order, indexed by table and chain names.
+  std::vector<NftablesChain> rows;
+  std::map<std::pair<std::string, std::string>, size_t> indexes;
+  forEachMessage(
+      messages, NFT_MSG_NEWCHAIN, [&](const char* data, size_t size) {
+        Row r;
+        parseNftablesChain(data, size, r);
+        if ((filters.empty() || filters.count(r["filter_name"]) > 0) &&
+            (chains.empty() || chains.count(r["chain"]) > 0)) {
+          indexes[std::make_pair(r["filter_name"], r["chain"])] = rows.size();
+          rows.push_back({std::move(r), {}});
+        }
+      });
+
+  if (rows.empty()) {
+    return Status(0, "OK");
+  }
+
+  messages.clear();
+  auto table_filter = (filters.size() == 1) ? *filters.begin() : "";
+  auto chain_filter = (chains.size() == 1) ? *chains.begin() : "";
+  status = dumpNftables(NFT_MSG_GETRULE, table_filter, chain_filter, messages);
+  if (!status.ok()) {
+    return status;
+  }
+
+  forEachMessage(
+      messages, NFT_MSG_NEWRULE, [&](const char* data, size_t size) {
+        std::string table, chain;
+        const char* expressions = nullptr;
+        size_t expressions_size = 0;
+        forEachAttribute(
+            data, size, [&](uint16_t type, const char* data, size_t size) {
+              if (type == NFTA_RULE_TABLE) {
+                table = data;
+              } else if (type == NFTA_RULE_CHAIN) {
+                chain = data;
+              } else if (type == NFTA_RULE_EXPRESSIONS) {
+                expressions = data;
+                expressions_size = size;
+              }
+            });
+
+        auto index = indexes.find(std::make_pair(table, chain));
+        if (index != indexes.end() && expressions != nullptr) {
+          auto& rules = rows[index->second].rules;
+          rules.push_back(rows[index->second].row);
+          parseNftablesExpressions(expressions, expressions_size, rules.back());
+        }
+      });
+
+  // Like libiptc, each chain's rules are followed by the chain.
+  for (auto& chain : rows) {
+    for (auto& rule : chain.rules) {
+      results.push_back(std::move(rule));
+    }
+    results.push_back(std::move(chain.row));
+  }
+  return Status(0, "OK");
+}
+}
+}
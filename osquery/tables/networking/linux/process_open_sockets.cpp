@@ -9,12 +9,22 @@
  */
 
 #include <arpa/inet.h>
+#include <linux/netlink.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
+#include "osquery/tables/networking/linux/inet_diag.h"
+
+#ifndef SOCK_DIAG_BY_FAMILY
+#define SOCK_DIAG_BY_FAMILY 20
+#endif
 
 namespace osquery {
 namespace tables {
@@ -63,7 +73,228 @@ unsigned short portFromHex(const std::string &encoded_port) {
   return decoded;
 }
 
+/// The kernel's socket filters, see buildSocketFilter.
+struct SocketFilter {
+  /// Socket states requested, a mask of (1 << state).
+  uint32_t states{0xffffffff};
+
+  /// Filter bytecode comparing the local and remote ports.
+  std::vector<inet_diag_bc_op> bytecode;
+
+  /// Only emit sockets owned by a process in the inode map.
+  bool owned{false};
+
+  /// UNIX domain sockets report no ports, false if a port must be non-zero.
+  bool portless{true};
+};
+
+/// Append a port comparison, each compare rejects by jumping past the end.
+static void addPortFilter(std::vector<inet_diag_bc_op> &bytecode,
+                          unsigned char code,
+                          unsigned short port) {
+  inet_diag_bc_op op;
+  op.code = code;
+  op.yes = sizeof(inet_diag_bc_op) * 2;
+  op.no = 0;
+  bytecode.push_back(op);
+  op.code = INET_DIAG_BC_NOP;
+  op.yes = 0;
+  op.no = port;
+  bytecode.push_back(op);
+}
+
+/// Get the single port an equality constraint requires, if any.
+static bool getConstrainedPort(QueryContext &context,
+                               const std::string &column,
+                               unsigned short &port) {
+  if (!context.constraints[column].exists(EQUALS)) {
+    return false;
+  }
+
+  auto ports = context.constraints[column].getAll(EQUALS);
+  long int value = 0;
+  if (ports.size() != 1 || !safeStrtol(*ports.begin(), 10, value).ok() ||
+      value < 0 || value > 0xffff) {
+    return false;
+  }
+  port = static_cast<unsigned short>(value);
+  return true;
+}
+
+SocketFilter buildSocketFilter(QueryContext &context) {
+  SocketFilter filter;
+  filter.owned = context.constraints["pid"].exists(EQUALS);
+
+  unsigned short port = 0;
+  if (getConstrainedPort(context, "local_port", port)) {
+    filter.portless = (port == 0);
+    addPortFilter(filter.bytecode, INET_DIAG_BC_S_GE, port);
+    addPortFilter(filter.bytecode, INET_DIAG_BC_S_LE, port);
+  }
+
+  if (getConstrainedPort(context, "remote_port", port)) {
+    filter.portless = filter.portless && (port == 0);
+    addPortFilter(filter.bytecode, INET_DIAG_BC_D_GE, port);
+    addPortFilter(filter.bytecode, INET_DIAG_BC_D_LE, port);
+    if (port == 0) {
+      // Only listening and bound (or unconnected UDP) sockets have no peer.
+      filter.states = (1 << TCP_LISTEN) | (1 << TCP_CLOSE);
+    }
+  }
+
+  // A failed compare jumps past the end of the bytecode, rejecting the socket.
+  auto size = filter.bytecode.size() * sizeof(inet_diag_bc_op);
+  for (size_t i = 0; i < filter.bytecode.size(); i += 2) {
+    filter.bytecode[i].no =
+        static_cast<unsigned short>(size - i * sizeof(inet_diag_bc_op) + 4);
+  }
+  return filter;
+}
+
+/// Add the owning pid and descriptor, false if the socket should be skipped.
+static bool addSocketOwner(const InodeMap &inodes,
+                           const SocketFilter &filter,
+                           Row &r) {
+  auto owner = inodes.find(r["socket"]);
+  if (owner != inodes.end()) {
+    r["pid"] = owner->second.second;
+    r["fd"] = owner->second.first;
+  } else if (filter.owned) {
+    return false;
+  } else {
+    r["pid"] = "-1";
+    r["fd"] = "-1";
+  }
+  return true;
+}
+
+/**
+ * @brief Request sockets of a protocol and family using NETLINK_SOCK_DIAG.
+ *
+ * The kernel applies the state and port filters and returns binary socket
+ * identities, avoiding a read and parse of every socket in /proc/net.
+ *
+ * @return failure if the kernel does not support the request, no rows added.
+ */
+Status genSocketsFromNetlink(const InodeMap &inodes,
+                             const SocketFilter &filter,
+                             int protocol,
+                             int family,
+                             QueryData &results) {
+  int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_INET_DIAG);
+  if (fd < 0) {
+    return Status(1, "Cannot open NETLINK_SOCK_DIAG socket");
+  }
+
+  // Do not wait indefinitely for a dump.
+  struct timeval timeout = {1, 0};
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  struct {
+    struct nlmsghdr header;
+    struct inet_diag_req_v2 request;
+  } message;
+  memset(&message, 0, sizeof(message));
+  message.header.nlmsg_type = SOCK_DIAG_BY_FAMILY;
+  message.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+  message.request.sdiag_family = static_cast<__u8>(family);
+  message.request.sdiag_protocol = static_cast<__u8>(protocol);
+  message.request.idiag_states = filter.states;
+
+  struct nlattr attribute;
+  auto bytecode_size = filter.bytecode.size() * sizeof(inet_diag_bc_op);
+  attribute.nla_type = INET_DIAG_REQ_BYTECODE;
+  attribute.nla_len = static_cast<__u16>(NLA_HDRLEN + bytecode_size);
+
+  struct iovec iov[3];
+  iov[0].iov_base = &message;
+  iov[0].iov_len = sizeof(message);
+  iov[1].iov_base = &attribute;
+  iov[1].iov_len = NLA_HDRLEN;
+  iov[2].iov_base = const_cast<inet_diag_bc_op *>(filter.bytecode.data());
+  iov[2].iov_len = bytecode_size;
+
+  size_t iov_count = (bytecode_size > 0) ? 3 : 1;
+  message.header.nlmsg_len = static_cast<__u32>(
+      sizeof(message) + ((bytecode_size > 0) ? attribute.nla_len : 0));
+
+  struct sockaddr_nl address;
+  memset(&address, 0, sizeof(address));
+  address.nl_family = AF_NETLINK;
+
+  struct msghdr request;
+  memset(&request, 0, sizeof(request));
+  request.msg_name = &address;
+  request.msg_namelen = sizeof(address);
+  request.msg_iov = iov;
+  request.msg_iovlen = iov_count;
+  if (sendmsg(fd, &request, 0) < 0) {
+    close(fd);
+    return Status(1, "Cannot send NETLINK_SOCK_DIAG request");
+  }
+
+  auto first_row = results.size();
+  Status status;
+  bool done = false;
+  std::vector<char> buffer(32768);
+  while (!done) {
+    auto size = recv(fd, buffer.data(), buffer.size(), 0);
+    if (size <= 0) {
+      status = Status(1, "Cannot receive NETLINK_SOCK_DIAG response");
+      break;
+    }
+
+    auto header = reinterpret_cast<struct nlmsghdr *>(buffer.data());
+    auto remaining = static_cast<unsigned int>(size);
+    for (; NLMSG_OK(header, remaining);
+         header = NLMSG_NEXT(header, remaining)) {
+      if (header->nlmsg_type == NLMSG_DONE) {
+        done = true;
+        break;
+      } else if (header->nlmsg_type == NLMSG_ERROR) {
+        // The kernel does not support this family or protocol.
+        status = Status(1, "NETLINK_SOCK_DIAG request failed");
+        done = true;
+        break;
+      }
+
+      auto diag = reinterpret_cast<struct inet_diag_msg *>(NLMSG_DATA(header));
+      if (header->nlmsg_len < NLMSG_LENGTH(sizeof(*diag))) {
+        continue;
+      }
+
+      char local[INET6_ADDRSTRLEN] = {0};
+      char remote[INET6_ADDRSTRLEN] = {0};
+      inet_ntop(family, diag->id.idiag_src, local, sizeof(local));
+      inet_ntop(family, diag->id.idiag_dst, remote, sizeof(remote));
+
+      Row r;
+      r["socket"] = BIGINT(diag->idiag_inode);
+      if (!addSocketOwner(inodes, filter, r)) {
+        continue;
+      }
+
+      r["family"] = INTEGER(family);
+      r["protocol"] = INTEGER(protocol);
+      r["local_address"] = local;
+      r["local_port"] = INTEGER(ntohs(diag->id.idiag_sport));
+      r["remote_address"] = remote;
+      r["remote_port"] = INTEGER(ntohs(diag->id.idiag_dport));
+      r["path"] = "";
+      results.push_back(std::move(r));
+    }
+  }
+
+  close(fd);
+  if (!status.ok()) {
+    // The caller falls back to /proc, drop any partial dump.
+    results.resize(first_row);
+  }
+  return status;
+}
+
 void genSocketsFromProc(const InodeMap &inodes,
+                        const SocketFilter &filter,
                         int protocol,
                         int family,
                         QueryData &results) {
@@ -133,15 +364,9 @@ void genSocketsFromProc(const InodeMap &inodes,
       r["path"] = "";
     }
 
-    if (inodes.count(r["socket"]) > 0) {
-      r["pid"] = inodes.at(r["socket"]).second;
-      r["fd"] = inodes.at(r["socket"]).first;
-    } else {
-      r["pid"] = "-1";
-      r["fd"] = "-1";
+    if (addSocketOwner(inodes, filter, r)) {
+      results.push_back(r);
     }
-
-    results.push_back(r);
   }
 }
 
@@ -149,18 +374,20 @@ QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
   // If a pid is given then set that as the only item in processes.
+  // The process descriptors are only inspected if the pid or fd is used.
+  auto snapshot = ProcSnapshot::get();
   std::set<std::string> pids;
   if (context.constraints["pid"].exists(EQUALS)) {
     pids = context.constraints["pid"].getAll(EQUALS);
-  } else {
-    osquery::procProcesses(pids);
+  } else if (context.isAnyColumnUsed({"pid", "fd"})) {
+    pids = snapshot->processes();
   }
 
   // Generate a map of socket inode to process tid.
   InodeMap socket_inodes;
   for (const auto &process : pids) {
     std::map<std::string, std::string> descriptors;
-    if (osquery::procDescriptors(process, descriptors).ok()) {
+    if (snapshot->descriptors(process, descriptors).ok()) {
       for (const auto &fd : descriptors) {
         if (fd.second.find("socket:[") == 0) {
           // See #792: std::regex is incomplete until GCC 4.9 (skip 8 chars)
@@ -172,14 +399,26 @@ QueryData genOpenSockets(QueryContext &context) {
     }
   }
 
-  // This used to use netlink (Ref: #1094) to request socket information.
-  // Use proc messages to query socket information.
+  // Request TCP and UDP sockets using netlink (Ref: #1094), the kernel
+  // filters by state and port. Other protocols, and kernels without
+  // NETLINK_SOCK_DIAG support, use proc messages.
+  auto filter = buildSocketFilter(context);
   for (const auto &protocol : kLinuxProtocolNames) {
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET, results);
-    genSocketsFromProc(socket_inodes, protocol.first, AF_INET6, results);
+    for (const auto &family : {AF_INET, AF_INET6}) {
+      if ((protocol.first == IPPROTO_TCP || protocol.first == IPPROTO_UDP) &&
+          genSocketsFromNetlink(
+              socket_inodes, filter, protocol.first, family, results)
+              .ok()) {
+        continue;
+      }
+      genSocketsFromProc(
+          socket_inodes, filter, protocol.first, family, results);
+    }
   }
 
-  genSocketsFromProc(socket_inodes, IPPROTO_IP, AF_UNIX, results);
+  if (filter.portless) {
+    genSocketsFromProc(socket_inodes, filter, IPPROTO_IP, AF_UNIX, results);
+  }
   return results;
 }
 }
@@ -14,13 +14,17 @@
 
 #include <libiptc/libiptc.h>
 #include <arpa/inet.h>
+#include <linux/netfilter.h>
+#include <linux/netlink.h>
 
+#include "osquery/tables/networking/linux/nf_tables.h"
 #include "osquery/tests/test_util.h"
 
 namespace osquery {
 namespace tables {
 
 void parseIpEntry(const ipt_ip *ip, Row &row);
+void parseNftablesExpressions(const char *data, size_t size, Row &r);
 
 ipt_ip* getIpEntryContent() {
   static ipt_ip ip_entry;
@@ -55,6 +59,35 @@ Row getIpEntryExpectedResults() {
   return row;
 }
 
+/// Encode a netlink attribute, nested attributes are encoded payloads.
+std::string getAttribute(uint16_t type, const std::string &payload) {
+  struct nlattr attr;
+  attr.nla_type = type;
+  attr.nla_len = static_cast<uint16_t>(NLA_HDRLEN + payload.size());
+  std::string encoded((const char *)&attr, sizeof(attr));
+  encoded += payload;
+  encoded.resize(NLA_ALIGN(encoded.size()), '\0');
+  return encoded;
+}
+
+std::string getU32Attribute(uint16_t type, uint32_t value) {
+  value = htonl(value);
+  return getAttribute(type, std::string((const char *)&value, sizeof(value)));
+}
+
+/// Encode an nf_tables expression list element.
+std::string getExpression(const std::string &name, const std::string &data) {
+  return getAttribute(
+      NFTA_LIST_ELEM,
+      getAttribute(NFTA_EXPR_NAME, std::string(name.c_str(), name.size() + 1)) +
+          getAttribute(NFTA_EXPR_DATA, data));
+}
+
+std::string getCompare(const std::string &value) {
+  return getExpression(
+      "cmp", getAttribute(NFTA_CMP_DATA, getAttribute(NFTA_DATA_VALUE, value)));
+}
+
 class IptablesTests : public testing::Test {};
 
 TEST_F(IptablesTests, test_iptables_ip_entry) {
@@ -62,5 +95,47 @@ TEST_F(IptablesTests, test_iptables_ip_entry) {
   parseIpEntry(getIpEntryContent(), row);
   EXPECT_EQ(row, getIpEntryExpectedResults());
 }
+
+TEST_F(IptablesTests, test_nftables_expressions) {
+  // The expressions of: -i eth0 -s 10.0.0.0/24 -j ACCEPT
+  struct in_addr source, mask;
+  inet_aton("10.0.0.0", &source);
+  inet_aton("255.255.255.0", &mask);
+
+  std::string expressions;
+  expressions += getExpression(
+      "meta", getU32Attribute(NFTA_META_KEY, NFT_META_IIFNAME));
+  expressions += getCompare(std::string("eth0", 5));
+  expressions += getExpression(
+      "payload",
+      getU32Attribute(NFTA_PAYLOAD_BASE, NFT_PAYLOAD_NETWORK_HEADER) +
+          getU32Attribute(NFTA_PAYLOAD_OFFSET, 12) +
+          getU32Attribute(NFTA_PAYLOAD_LEN, 4));
+  expressions += getExpression(
+      "bitwise",
+      getAttribute(
+          NFTA_BITWISE_MASK,
+          getAttribute(NFTA_DATA_VALUE,
+                       std::string((const char *)&mask, sizeof(mask)))));
+  expressions += getCompare(std::string((const char *)&source, sizeof(source)));
+  expressions += getExpression(
+      "immediate",
+      getAttribute(
+          NFTA_IMMEDIATE_DATA,
+          getAttribute(NFTA_DATA_VERDICT,
+                       getU32Attribute(NFTA_VERDICT_CODE, NF_ACCEPT))));
+
+  Row row;
+  parseNftablesExpressions(expressions.data(), expressions.size(), row);
+  EXPECT_EQ(row["iniface"], "eth0");
+  EXPECT_EQ(row["iniface_mask"], "FFFFFFFFFF");
+  EXPECT_EQ(row["outiface"], "all");
+  EXPECT_EQ(row["src_ip"], "10.0.0.0");
+  EXPECT_EQ(row["src_mask"], "255.255.255.0");
+  EXPECT_EQ(row["dst_ip"], "0.0.0.0");
+  EXPECT_EQ(row["protocol"], "0");
+  EXPECT_EQ(row["target"], "ACCEPT");
+  EXPECT_EQ(row["match"], "yes");
+}
 }
 }
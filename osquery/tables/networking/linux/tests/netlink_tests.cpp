@@ -0,0 +1,109 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <arpa/inet.h>
+#include <linux/rtnetlink.h>
+
+#include <gtest/gtest.h>
+
+#include <osquery/tables.h>
+
+#include "osquery/tables/networking/linux/netlink.h"
+
+namespace osquery {
+namespace tables {
+
+std::string getNetlinkMask(int family, unsigned int prefix);
+void genNetlinkRoutes(const struct nlmsghdr* netlink_msg,
+                      NetlinkSnapshot& snapshot,
+                      QueryData& results);
+
+class NetlinkTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    NetlinkSnapshot::reset();
+  }
+};
+
+/// Append an attribute to a netlink message.
+static void addAttribute(struct nlmsghdr* header,
+                         unsigned short type,
+                         const void* data,
+                         size_t size) {
+  auto attr = reinterpret_cast<struct rtattr*>(
+      reinterpret_cast<char*>(header) + NLMSG_ALIGN(header->nlmsg_len));
+  attr->rta_type = type;
+  attr->rta_len = static_cast<unsigned short>(RTA_LENGTH(size));
+  memcpy(RTA_DATA(attr), data, size);
+  header->nlmsg_len = NLMSG_ALIGN(header->nlmsg_len) + RTA_ALIGN(attr->rta_len);
+}
+
+TEST_F(NetlinkTests, test_netlink_mask) {
+  EXPECT_EQ(getNetlinkMask(AF_INET, 24), "255.255.255.0");
+  EXPECT_EQ(getNetlinkMask(AF_INET, 0), "0.0.0.0");
+  EXPECT_EQ(getNetlinkMask(AF_INET, 32), "255.255.255.255");
+  EXPECT_EQ(getNetlinkMask(AF_INET6, 64), "ffff:ffff:ffff:ffff::");
+}
+
+TEST_F(NetlinkTests, test_netlink_routes) {
+  union {
+    struct nlmsghdr header;
+    char buffer[256];
+  } message;
+  memset(&message, 0, sizeof(message));
+  message.header.nlmsg_type = RTM_NEWROUTE;
+  message.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+
+  auto route = static_cast<struct rtmsg*>(NLMSG_DATA(&message.header));
+  route->rtm_family = AF_INET;
+  route->rtm_dst_len = 8;
+  route->rtm_type = RTN_UNICAST;
+
+  struct in_addr address;
+  inet_pton(AF_INET, "10.0.0.0", &address);
+  addAttribute(&message.header, RTA_DST, &address, sizeof(address));
+  inet_pton(AF_INET, "10.0.0.1", &address);
+  addAttribute(&message.header, RTA_GATEWAY, &address, sizeof(address));
+  int priority = 100;
+  addAttribute(&message.header, RTA_PRIORITY, &priority, sizeof(priority));
+
+  QueryData results;
+  auto snapshot = NetlinkSnapshot::get();
+  genNetlinkRoutes(&message.header, *snapshot, results);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["destination"], "10.0.0.0");
+  EXPECT_EQ(results[0]["netmask"], "8");
+  EXPECT_EQ(results[0]["gateway"], "10.0.0.1");
+  EXPECT_EQ(results[0]["metric"], "100");
+  EXPECT_EQ(results[0]["type"], "gateway");
+
+  // Other message types in a dump are skipped.
+  message.header.nlmsg_type = RTM_NEWADDR;
+  genNetlinkRoutes(&message.header, *snapshot, results);
+  EXPECT_EQ(results.size(), 1U);
+}
+
+TEST_F(NetlinkTests, test_netlink_snapshot) {
+  auto snapshot = NetlinkSnapshot::get();
+  size_t links = 0;
+  EXPECT_TRUE(snapshot->forEach(
+      RTM_GETLINK, [&links](const struct nlmsghdr* header) { links++; }));
+  EXPECT_GT(links, 0U);
+
+  // Every network namespace has a loopback interface as the first index.
+  EXPECT_EQ(snapshot->getInterfaceName(1), "lo");
+  EXPECT_EQ(snapshot->getInterfaceName(-1), "");
+
+  // The snapshot is shared within a second, a reset starts a new snapshot.
+  NetlinkSnapshot::reset();
+  EXPECT_NE(snapshot, NetlinkSnapshot::get());
+}
+}
+}
@@ -16,11 +16,6 @@
 #include <net/if.h>
 #include <sys/socket.h>
 
-#ifdef __linux__
-#include <linux/if_link.h>
-#include <sys/ioctl.h>
-#endif
-
 #include <osquery/core.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
@@ -30,6 +25,8 @@
 namespace osquery {
 namespace tables {
 
+// Linux interfaces are read from the shared rtnetlink snapshot.
+#ifndef __linux__
 // Functions for safe sign-extension
 std::basic_string<char> INTEGER_FROM_UCHAR(unsigned char x) {
   return INTEGER(static_cast<uint16_t>(x));
@@ -76,42 +73,6 @@ void genDetailsFromAddr(const struct ifaddrs* addr, QueryData& results) {
   r["mac"] = macAsString(addr);
 
   if (addr->ifa_data != nullptr && addr->ifa_name != nullptr) {
-#ifdef __linux__
-    // Linux/Netlink interface details parsing.
-    auto ifd = static_cast<struct rtnl_link_stats*>(addr->ifa_data);
-    r["mtu"] = "0";
-    r["metric"] = "0";
-    r["type"] = "0";
-    r["ipackets"] = BIGINT_FROM_UINT32(ifd->rx_packets);
-    r["opackets"] = BIGINT_FROM_UINT32(ifd->tx_packets);
-    r["ibytes"] = BIGINT_FROM_UINT32(ifd->rx_bytes);
-    r["obytes"] = BIGINT_FROM_UINT32(ifd->tx_bytes);
-    r["ierrors"] = BIGINT_FROM_UINT32(ifd->rx_errors);
-    r["oerrors"] = BIGINT_FROM_UINT32(ifd->tx_errors);
-
-    // Get Linux physical properties for the AF_PACKET entry.
-    int fd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (fd >= 0) {
-      struct ifreq ifr;
-      memcpy(ifr.ifr_name, addr->ifa_name, IFNAMSIZ);
-      if (ioctl(fd, SIOCGIFMTU, &ifr) >= 0) {
-        r["mtu"] = BIGINT_FROM_UINT32(ifr.ifr_mtu);
-      }
-
-      if (ioctl(fd, SIOCGIFMETRIC, &ifr) >= 0) {
-        r["metric"] = BIGINT_FROM_UINT32(ifr.ifr_metric);
-      }
-
-      if (ioctl(fd, SIOCGIFHWADDR, &ifr) >= 0) {
-        r["type"] = INTEGER_FROM_UCHAR(ifr.ifr_hwaddr.sa_family);
-      }
-
-      close(fd);
-    }
-
-    // Last change is not implemented in Linux.
-    r["last_change"] = "-1";
-#else
     // Apple and FreeBSD interface details parsing.
     auto ifd = (struct if_data*)addr->ifa_data;
     r["type"] = INTEGER_FROM_UCHAR(ifd->ifi_type);
@@ -124,7 +85,6 @@ void genDetailsFromAddr(const struct ifaddrs* addr, QueryData& results) {
     r["ierrors"] = BIGINT_FROM_UINT32(ifd->ifi_ierrors);
     r["oerrors"] = BIGINT_FROM_UINT32(ifd->ifi_oerrors);
     r["last_change"] = BIGINT_FROM_UINT32(ifd->ifi_lastchange.tv_sec);
-#endif
   }
 
   results.push_back(r);
@@ -175,5 +135,6 @@ QueryData genInterfaceDetails(QueryContext& context) {
   freeifaddrs(if_addrs);
   return results;
 }
+#endif
 }
 }
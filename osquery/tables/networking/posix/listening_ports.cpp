@@ -20,7 +20,9 @@ typedef std::map<std::string, std::vector<ProtoFamilyPair>> PortMap;
 QueryData genListeningPorts(QueryContext& context) {
   QueryData results;
 
-  auto sockets = SQL::selectAllFrom("process_open_sockets");
+  // Sockets without a peer, on Linux the kernel filters the sockets.
+  auto sockets =
+      SQL::selectAllFrom("process_open_sockets", "remote_port", EQUALS, "0");
 
   PortMap ports;
   for (const auto& socket : sockets) {
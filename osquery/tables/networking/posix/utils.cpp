@@ -90,7 +90,7 @@ int netmaskFromIP(const struct sockaddr* in) {
   return mask;
 }
 
-inline std::string macAsString(const char* addr) {
+std::string macAsString(const char* addr) {
   std::stringstream mac;
 
   for (size_t i = 0; i < 6; i++) {
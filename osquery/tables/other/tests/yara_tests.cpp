@@ -11,11 +11,16 @@
 #include <gtest/gtest.h>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/system.h>
 
+#include "osquery/tables/events/yara_events.h"
 #include "osquery/tables/other/yara_utils.h"
 
 namespace osquery {
 
+DECLARE_uint64(yara_scan_queue_size);
+
 const std::string ruleFile = "/tmp/osquery-yara.sig";
 const std::string ls = "/bin/ls";
 const std::string alwaysTrue = "rule always_true { condition: true }";
@@ -73,4 +78,92 @@ TEST_F(YARATest, test_match_false) {
   // Should have 0 count
   EXPECT_TRUE(r["count"] == "0");
 }
+
+TEST_F(YARATest, test_compiled_rules_cache) {
+  writeTextFile(ruleFile, alwaysTrue);
+  auto hash = getRuleFilesHash({ruleFile});
+  ASSERT_FALSE(hash.empty());
+  remove(getCompiledRulesPath(hash));
+
+  // The first compile saves the rules, keyed by the source hash.
+  Row r = scanFile(alwaysTrue);
+  EXPECT_TRUE(r["count"] == "1");
+  EXPECT_TRUE(pathExists(getCompiledRulesPath(hash)).ok());
+
+  // The saved rules are loaded for the same source.
+  r = scanFile(alwaysTrue);
+  EXPECT_TRUE(r["count"] == "1");
+
+  // Changed sources have a different hash.
+  writeTextFile(ruleFile, alwaysFalse);
+  EXPECT_NE(hash, getRuleFilesHash({ruleFile}));
+  remove(getCompiledRulesPath(hash));
+}
+
+/// A changed file due to be scanned after a delay in seconds.
+static tables::YARAScanItem getScanItem(const std::string& path,
+                                        size_t delay) {
+  tables::YARAScanItem item;
+  item.r["target_path"] = path;
+  item.due = getUnixTime() + delay;
+  return item;
+}
+
+TEST_F(YARATest, test_scan_queue_merge) {
+  tables::YARAScanQueue queue;
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/first", 0)));
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/second", 0)));
+
+  // A change to a queued file is merged with the queued change.
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/first", 0)));
+
+  tables::YARAScanItem item;
+  ASSERT_TRUE(queue.pop(item, std::chrono::milliseconds(10)));
+  EXPECT_EQ(item.r["target_path"], "/tmp/first");
+  ASSERT_TRUE(queue.pop(item, std::chrono::milliseconds(10)));
+  EXPECT_EQ(item.r["target_path"], "/tmp/second");
+  EXPECT_FALSE(queue.pop(item, std::chrono::milliseconds(10)));
+
+  // A file is queued again once it was taken for a scan.
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/first", 0)));
+  EXPECT_TRUE(queue.pop(item, std::chrono::milliseconds(10)));
+}
+
+TEST_F(YARATest, test_scan_queue_full) {
+  auto queue_size = FLAGS_yara_scan_queue_size;
+  FLAGS_yara_scan_queue_size = 2;
+
+  tables::YARAScanQueue queue;
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/first", 0)));
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/second", 0)));
+
+  // A new file is dropped when the queue is full, a queued file is merged.
+  EXPECT_FALSE(queue.push(getScanItem("/tmp/third", 0)));
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/second", 0)));
+
+  tables::YARAScanItem item;
+  ASSERT_TRUE(queue.pop(item, std::chrono::milliseconds(10)));
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/third", 0)));
+  FLAGS_yara_scan_queue_size = queue_size;
+}
+
+TEST_F(YARATest, test_scan_queue_due) {
+  tables::YARAScanQueue queue;
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/first", 0)));
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/second", 100)));
+
+  // Files are scanned in the order they changed once they are due.
+  tables::YARAScanItem item;
+  ASSERT_TRUE(queue.pop(item, std::chrono::milliseconds(10)));
+  EXPECT_EQ(item.r["target_path"], "/tmp/first");
+  EXPECT_FALSE(queue.pop(item, std::chrono::milliseconds(10)));
+
+  // A file changed later waits behind a file that is not due.
+  EXPECT_TRUE(queue.push(getScanItem("/tmp/third", 0)));
+  EXPECT_FALSE(queue.pop(item, std::chrono::milliseconds(10)));
+
+  // Stopping wakes a waiting worker without a file.
+  queue.stop();
+  EXPECT_FALSE(queue.pop(item, std::chrono::milliseconds(10)));
+}
 }
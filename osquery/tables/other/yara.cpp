@@ -8,13 +8,28 @@
  *
  */
 
+#ifdef __linux__
+#include <sys/uio.h>
+#endif
+
+#include <chrono>
+#include <set>
+#include <sstream>
+#include <thread>
+
+#include <boost/algorithm/string/predicate.hpp>
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
+#include <osquery/sql.h>
 #include <osquery/tables.h>
 #include <osquery/status.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/core/process.h"
+#include "osquery/core/query_deadline.h"
 #include "osquery/tables/other/yara_utils.h"
 
 #ifdef CONCAT
@@ -23,8 +38,35 @@
 #include <yara.h>
 
 namespace osquery {
+
+FLAG(uint64,
+     yara_process_max_bytes,
+     128 * 1024 * 1024,
+     "Maximum bytes of memory read from each process by a YARA pid scan");
+
+FLAG(uint64,
+     yara_process_max_seconds,
+     10,
+     "Maximum seconds spent scanning each process by a YARA pid scan");
+
+FLAG(bool,
+     yara_process_skip_mapped,
+     true,
+     "Skip read-only file mapped regions, such as libraries, in pid scans");
+
+FLAG(string,
+     yara_process_skip_paths,
+     "",
+     "Comma-separated path prefixes of mapped regions skipped by pid scans");
+
 namespace tables {
 
+/// Process memory is read and scanned in chunks of this size.
+const size_t kYARAProcessChunkSize = 4 * 1024 * 1024;
+
+/// Chunks of a region overlap, so short strings across chunks are matched.
+const size_t kYARAProcessChunkOverlap = 4096;
+
 void doYARAScan(YR_RULES* rules,
                 const std::string& path,
                 QueryData& results,
@@ -51,10 +93,199 @@ void doYARAScan(YR_RULES* rules,
   }
 }
 
+#ifdef __linux__
+/// The matches of a process scan, accumulated across memory chunks.
+struct YARAProcessScan {
+  /// The row of matches.
+  Row* r{nullptr};
+
+  /// The virtual address of the scanned chunk.
+  uint64_t base{0};
+
+  /// The rules matched in any chunk.
+  std::set<std::string> rules;
+
+  /// The string identifiers and addresses matched.
+  std::set<std::string> strings;
+};
+
+/**
+ * @brief A YARA callback for memory chunks of a process.
+ *
+ * Similar to YARACallback, but a rule matched in several chunks is counted
+ * once and string offsets are virtual addresses within the process.
+ */
+static int YARAProcessCallback(int message,
+                               void* message_data,
+                               void* user_data) {
+  if (message != CALLBACK_MSG_RULE_MATCHING) {
+    return CALLBACK_CONTINUE;
+  }
+
+  auto scan = static_cast<YARAProcessScan*>(user_data);
+  auto& r = *scan->r;
+  YR_RULE* rule = (YR_RULE*)message_data;
+  if (scan->rules.insert(rule->identifier).second) {
+    if (r["matches"].length() > 0) {
+      r["matches"] += ",";
+    }
+    r["matches"] += std::string(rule->identifier);
+
+    const char* tag = nullptr;
+    yr_rule_tags_foreach(rule, tag) {
+      if (r["tags"].length() > 0) {
+        r["tags"] += ",";
+      }
+      r["tags"] += std::string(tag);
+    }
+    r["count"] = INTEGER(scan->rules.size());
+  }
+
+  YR_STRING* string = nullptr;
+  yr_rule_strings_foreach(rule, string) {
+    YR_MATCH* match = nullptr;
+    yr_string_matches_foreach(string, match) {
+      std::stringstream ss;
+      ss << std::string(string->identifier) << ":" << std::hex
+         << (scan->base + match->base + match->offset);
+      if (!scan->strings.insert(ss.str()).second) {
+        // Matched within the overlap of the previous chunk.
+        continue;
+      }
+
+      if (r["strings"].length() > 0) {
+        r["strings"] += ",";
+      }
+      r["strings"] += ss.str();
+    }
+  }
+
+  return CALLBACK_CONTINUE;
+}
+
+/// Check if a mapped region should be read by a process scan.
+static bool isScannedRegion(const Row& region,
+                            const std::vector<std::string>& skip_paths) {
+  const auto& permissions = region.at("permissions");
+  if (permissions.empty() || permissions[0] != 'r') {
+    return false;
+  }
+
+  // Read-only mappings of a file are the same in every process.
+  const auto& path = region.at("path");
+  if (FLAGS_yara_process_skip_mapped && region.at("pseudo") == "0" &&
+      region.at("inode") != "0" && permissions.size() > 1 &&
+      permissions[1] != 'w') {
+    return false;
+  }
+
+  for (const auto& prefix : skip_paths) {
+    if (!prefix.empty() && boost::starts_with(path, prefix)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Scan the readable memory of a process within the byte and time
+ * budgets.
+ *
+ * Regions are read from the process_memory_map table, each region is copied
+ * in chunks using process_vm_readv and scanned with yr_rules_scan_mem.
+ */
+void doYARAProcessScan(YR_RULES* rules,
+                       const std::string& pid,
+                       QueryData& results,
+                       const std::string& group,
+                       const std::string& sigfile) {
+  auto regions = SQL::selectAllFrom("process_memory_map", "pid", EQUALS, pid);
+  if (regions.empty()) {
+    // The process does not exist or its maps cannot be read.
+    return;
+  }
+
+  Row r;
+  r["count"] = INTEGER(0);
+  r["matches"] = std::string("");
+  r["strings"] = std::string("");
+  r["tags"] = std::string("");
+  r["path"] = std::string("");
+  r["pid"] = pid;
+  r["sig_group"] = std::string(group);
+  r["sigfile"] = std::string(sigfile);
+
+  YARAProcessScan scan;
+  scan.r = &r;
+
+  auto skip_paths = osquery::split(FLAGS_yara_process_skip_paths, ",");
+  auto deadline = std::chrono::steady_clock::now() +
+                  std::chrono::seconds(FLAGS_yara_process_max_seconds);
+  size_t budget = FLAGS_yara_process_max_bytes;
+  std::vector<unsigned char> buffer(kYARAProcessChunkSize);
+  auto remote_pid = static_cast<pid_t>(std::stoul(pid));
+
+  for (const auto& region : regions) {
+    if (budget == 0 || std::chrono::steady_clock::now() >= deadline) {
+      VLOG(1) << "YARA scan budget exhausted for pid: " << pid;
+      break;
+    }
+
+    if (!isScannedRegion(region, skip_paths)) {
+      continue;
+    }
+
+    uint64_t start = 0;
+    uint64_t end = 0;
+    try {
+      start = std::stoull(region.at("start"), nullptr, 16);
+      end = std::stoull(region.at("end"), nullptr, 16);
+    } catch (const std::exception& e) {
+      continue;
+    }
+
+    for (auto address = start; address < end && budget > 0;) {
+      auto remaining = std::chrono::duration_cast<std::chrono::seconds>(
+          deadline - std::chrono::steady_clock::now());
+      if (remaining.count() <= 0) {
+        break;
+      }
+
+      size_t length = std::min(
+          static_cast<size_t>(end - address), std::min(buffer.size(), budget));
+      struct iovec local = {buffer.data(), length};
+      struct iovec remote = {reinterpret_cast<void*>(address), length};
+      auto bytes = process_vm_readv(remote_pid, &local, 1, &remote, 1, 0);
+      if (bytes <= 0) {
+        // The region is not readable, such as [vvar] or a guard page.
+        break;
+      }
+
+      scan.base = address;
+      yr_rules_scan_mem(rules,
+                        buffer.data(),
+                        static_cast<size_t>(bytes),
+                        SCAN_FLAGS_FAST_MODE,
+                        YARAProcessCallback,
+                        (void*)&scan,
+                        static_cast<int>(remaining.count()));
+      budget -= static_cast<size_t>(bytes);
+      if (static_cast<size_t>(bytes) < length || address + bytes >= end) {
+        break;
+      }
+      address += bytes - kYARAProcessChunkOverlap;
+    }
+  }
+
+  results.push_back(std::move(r));
+}
+#endif
+
 QueryData genYara(QueryContext& context) {
   QueryData results;
 
-  // Must specify a path constraint and at least one of sig_group or sigfile.
+  // Must specify a path or pid constraint and at least one of sig_group or
+  // sigfile.
   auto groups = context.constraints["sig_group"].getAll(EQUALS);
   auto sigfiles = context.constraints["sigfile"].getAll(EQUALS);
   if (groups.size() == 0 && sigfiles.size() == 0) {
@@ -125,14 +356,50 @@ QueryData genYara(QueryContext& context) {
     groups.insert(file);
   }
 
-  // Scan every path pair.
-  for (const auto& path : paths) {
-    // Scan using the signature groups.
-    for (const auto& group : groups) {
-      if (rules.count(group) > 0) {
-        doYARAScan(rules[group], path.c_str(), results, group, group);
+  // Scan several paths at once, YARA rules may be shared between threads.
+  context.generateEach(
+      paths,
+      ([&rules, &groups](const std::string& path, QueryData& rows) {
+        // Scan using the signature groups.
+        for (const auto& group : groups) {
+          auto group_rules = rules.find(group);
+          if (group_rules != rules.end()) {
+            doYARAScan(group_rules->second, path, rows, group, group);
+          }
+        }
+      }),
+      results,
+      yr_finalize_thread);
+
+  auto pids = context.constraints["pid"].getAll(EQUALS);
+  if (!pids.empty()) {
+#ifdef __linux__
+    // Process memory is scanned by a background priority thread, so a
+    // large scan does not compete with the host's workloads.
+    auto deadline = getQueryDeadline();
+    std::thread worker([&]() {
+      setThreadToBackgroundPriority();
+      setQueryDeadline(deadline);
+      for (const auto& pid : pids) {
+        if (isQueryCancelled()) {
+          break;
+        } else if (pid.empty() || pid.find_first_not_of("0123456789") !=
+                                      std::string::npos) {
+          continue;
+        }
+
+        for (const auto& group : groups) {
+          if (rules.count(group) > 0) {
+            doYARAProcessScan(rules[group], pid, results, group, group);
+          }
+        }
       }
-    }
+      yr_finalize_thread();
+    });
+    worker.join();
+#else
+    VLOG(1) << "YARA process scans are only supported on Linux";
+#endif
   }
 
   return results;
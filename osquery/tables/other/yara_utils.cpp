@@ -10,14 +10,100 @@
 
 #include <map>
 #include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
 
 #include <osquery/config.h>
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+#include <osquery/hash.h>
 #include <osquery/logger.h>
 
 #include "osquery/tables/other/yara_utils.h"
 
+namespace fs = boost::filesystem;
+
 namespace osquery {
 
+FLAG(bool,
+     yara_cache_rules,
+     true,
+     "Store compiled YARA rules in the database path, keyed by source hashes");
+
+DECLARE_string(database_path);
+
+std::string getRuleFilesHash(const std::vector<std::string> &files) {
+  std::string content;
+  for (const auto &file : files) {
+    auto hash = hashFromFile(HASH_TYPE_SHA256, file);
+    if (hash.empty()) {
+      return "";
+    }
+    content += file + ":" + hash + "\n";
+  }
+  return hashFromBuffer(HASH_TYPE_SHA256, content.data(), content.size());
+}
+
+std::string getCompiledRulesPath(const std::string &hash) {
+  return (fs::path(FLAGS_database_path) / "yara" / (hash + ".yarc")).string();
+}
+
+/// Load rules compiled from sources with the same hash.
+static bool loadCompiledRules(const std::string &hash, YR_RULES **rules) {
+  if (!FLAGS_yara_cache_rules || hash.empty()) {
+    return false;
+  }
+
+  auto path = getCompiledRulesPath(hash);
+  if (!pathExists(path).ok()) {
+    return false;
+  }
+
+  if (yr_rules_load(path.c_str(), rules) != ERROR_SUCCESS) {
+    // Compiled by a different YARA version, or incomplete.
+    VLOG(1) << "Removing unusable compiled YARA rules: " << path;
+    remove(path);
+    return false;
+  }
+  VLOG(1) << "Loaded compiled YARA rules: " << path;
+  return true;
+}
+
+/// Save compiled rules, replacing the file only once it is complete.
+static void saveCompiledRules(const std::string &hash, YR_RULES *rules) {
+  if (!FLAGS_yara_cache_rules || hash.empty()) {
+    return;
+  }
+
+  auto path = getCompiledRulesPath(hash);
+  boost::system::error_code ec;
+  fs::create_directories(fs::path(path).parent_path(), ec);
+  auto temporary = path + ".tmp";
+  if (yr_rules_save(rules, temporary.c_str()) != ERROR_SUCCESS) {
+    VLOG(1) << "Could not save compiled YARA rules: " << path;
+    remove(temporary);
+    return;
+  }
+
+  fs::rename(temporary, path, ec);
+  if (ec) {
+    remove(temporary);
+  }
+}
+
+std::vector<std::string> getRuleFilePaths(const pt::ptree &rule_files) {
+  std::vector<std::string> paths;
+  for (const auto &item : rule_files) {
+    auto rule = item.second.get("", "");
+    if (rule[0] != '/') {
+      rule = std::string("/etc/osquery/yara/") + rule;
+    }
+    paths.push_back(std::move(rule));
+  }
+  return paths;
+}
+
 /**
  * The callback used when there are compilation problems in the rules.
  */
@@ -37,6 +123,11 @@ void YARACompilerCallback(int error_level,
  * Compile a single rule file and load it into rule pointer.
  */
 Status compileSingleFile(const std::string &file, YR_RULES **rules) {
+  auto hash = getRuleFilesHash({file});
+  if (loadCompiledRules(hash, rules)) {
+    return Status(0, "OK");
+  }
+
   YR_COMPILER *compiler = nullptr;
   int result = yr_compiler_create(&compiler);
   if (result != ERROR_SUCCESS) {
@@ -92,6 +183,7 @@ Status compileSingleFile(const std::string &file, YR_RULES **rules) {
       yr_compiler_destroy(compiler);
       return Status(1, "Insufficient memory to get YARA rules");
     }
+    saveCompiledRules(hash, *rules);
   }
 
   if (compiler != nullptr) {
@@ -108,7 +200,17 @@ Status compileSingleFile(const std::string &file, YR_RULES **rules) {
  */
 Status handleRuleFiles(const std::string &category,
                        const pt::ptree &rule_files,
+                       const std::string &hash,
                        std::map<std::string, YR_RULES *> &rules) {
+  YR_RULES *saved_rules = nullptr;
+  if (loadCompiledRules(hash, &saved_rules)) {
+    if (rules.count(category) > 0) {
+      yr_rules_destroy(rules[category]);
+    }
+    rules[category] = saved_rules;
+    return Status(0, "OK");
+  }
+
   YR_COMPILER *compiler = nullptr;
   int result = yr_compiler_create(&compiler);
   if (result != ERROR_SUCCESS) {
@@ -119,12 +221,8 @@ Status handleRuleFiles(const std::string &category,
   yr_compiler_set_callback(compiler, YARACompilerCallback, nullptr);
 
   bool compiled = false;
-  for (const auto &item : rule_files) {
+  for (const auto &rule : getRuleFilePaths(rule_files)) {
     YR_RULES *tmp_rules = nullptr;
-    auto rule = item.second.get("", "");
-    if (rule[0] != '/') {
-      rule = std::string("/etc/osquery/yara/") + rule;
-    }
 
     // First attempt to load the file, in case it is saved (pre-compiled)
     // rules. Sadly there is no way to load multiple compiled rules in
@@ -178,12 +276,19 @@ Status handleRuleFiles(const std::string &category,
 
   if (compiled) {
     // All the rules for this category have been compiled, save them in the map.
-    result = yr_compiler_get_rules(compiler, &rules[category]);
+    YR_RULES *tmp_rules = nullptr;
+    result = yr_compiler_get_rules(compiler, &tmp_rules);
 
     if (result != ERROR_SUCCESS) {
       yr_compiler_destroy(compiler);
       return Status(1, "Insufficient memory to get YARA rules");
     }
+
+    if (rules.count(category) > 0) {
+      yr_rules_destroy(rules[category]);
+    }
+    rules[category] = tmp_rules;
+    saveCompiledRules(hash, tmp_rules);
   }
 
   if (compiler != nullptr) {
@@ -260,12 +365,28 @@ Status YARAConfigParserPlugin::update(const std::string &source,
     const auto &signatures = yara_config.get_child("signatures");
     data_.add_child("signatures", signatures);
     for (const auto &element : signatures) {
+      // Keep the rules of groups whose sources did not change.
+      auto hash = getRuleFilesHash(getRuleFilePaths(element.second));
+      if (!hash.empty() && rules_.count(element.first) > 0 &&
+          hashes_[element.first] == hash) {
+        continue;
+      }
+
+      // Saved rules of the previous sources are no longer needed.
+      if (!hashes_[element.first].empty()) {
+        remove(getCompiledRulesPath(hashes_[element.first]));
+      }
+
       VLOG(1) << "Compiling YARA signature group: " << element.first;
-      auto status = handleRuleFiles(element.first, element.second, rules_);
+      auto status =
+          handleRuleFiles(element.first, element.second, hash, rules_);
       if (!status.ok()) {
         VLOG(1) << "YARA rule compile error: " << status.getMessage();
+        hashes_.erase(element.first);
+        generation_++;
         return status;
       }
+      hashes_[element.first] = hash;
     }
   }
 
@@ -275,6 +396,7 @@ Status YARAConfigParserPlugin::update(const std::string &source,
     const auto &file_paths = yara_config.get_child("file_paths");
     data_.add_child("file_paths", file_paths);
   }
+  generation_++;
   return Status(0, "OK");
 }
 
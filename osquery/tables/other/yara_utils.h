@@ -8,6 +8,8 @@
  *
  */
 
+#include <atomic>
+
 #include <osquery/config.h>
 #include <osquery/tables.h>
 
@@ -26,10 +28,20 @@ void YARACompilerCallback(int error_level,
                           const char* message,
                           void* user_data);
 
+/// Hash the paths and content of rule source files, empty if unreadable.
+std::string getRuleFilesHash(const std::vector<std::string>& files);
+
+/// The saved rules compiled from sources with the given hash.
+std::string getCompiledRulesPath(const std::string& hash);
+
+/// The absolute paths of a signature group's rule files.
+std::vector<std::string> getRuleFilePaths(const pt::ptree& rule_files);
+
 Status compileSingleFile(const std::string& file, YR_RULES** rule);
 
 Status handleRuleFiles(const std::string& category,
                        const pt::ptree& rule_files,
+                       const std::string& hash,
                        std::map<std::string, YR_RULES*>& rules);
 
 int YARACallback(int message, void* message_data, void* user_data);
@@ -52,12 +64,22 @@ class YARAConfigParserPlugin : public ConfigParserPlugin {
   // Retrieve compiled rules.
   std::map<std::string, YR_RULES*>& rules() { return rules_; }
 
+  /// The number of configuration updates, a scanned file is scanned again
+  /// after the rules change.
+  size_t generation() const { return generation_; }
+
   Status setUp() override;
 
  private:
   // Store compiled rules in a map (group => rules).
   std::map<std::string, YR_RULES*> rules_;
 
+  /// The source hash of each group's compiled rules.
+  std::map<std::string, std::string> hashes_;
+
+  /// Incremented after the rules are compiled.
+  std::atomic<size_t> generation_{0};
+
   /// Store the signatures and file_paths and compile the rules.
   Status update(const std::string& source, const ParserConfig& config) override;
 };
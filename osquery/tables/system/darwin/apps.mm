@@ -274,7 +274,7 @@ QueryData genApps(QueryContext& context) {
       continue;
     }
 
-    if (!osquery::parsePlist(path, tree).ok()) {
+    if (!osquery::cachedParsePlist(path, tree).ok()) {
       TLOG << "Error parsing application plist: " << path;
       continue;
     }
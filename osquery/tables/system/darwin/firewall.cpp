@@ -58,7 +58,7 @@ const std::map<std::string, std::string> kTopLevelStringKeys = {
 };
 
 Status genALFTreeFromFilesystem(pt::ptree& tree) {
-  Status s = osquery::parsePlist(kALFPlistPath, tree);
+  Status s = osquery::cachedParsePlist(kALFPlistPath, tree);
   if (!s.ok()) {
     TLOG << "Error parsing " << kALFPlistPath << ": " << s.toString();
   }
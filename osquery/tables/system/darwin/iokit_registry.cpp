@@ -8,6 +8,10 @@
  *
  */
 
+#include <set>
+#include <string>
+#include <vector>
+
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
@@ -16,10 +20,35 @@
 namespace osquery {
 namespace tables {
 
+/// EQUALS constraints applied to each registry entry while walking a plane.
+struct IOKitRegistryFilter {
+  std::set<std::string> names;
+  std::set<std::string> classes;
+};
+
+/// The depth of an entry in a plane, children of the root are depth 0.
+static int getIOKitDepth(const io_registry_entry_t& device,
+                         const io_name_t plane) {
+  int depth = -1;
+  io_registry_entry_t entry = device;
+  IOObjectRetain(entry);
+  io_registry_entry_t parent;
+  while (IORegistryEntryGetParentEntry(entry, plane, &parent) ==
+         KERN_SUCCESS) {
+    IOObjectRelease(entry);
+    entry = parent;
+    depth++;
+  }
+  IOObjectRelease(entry);
+  return (depth < 0) ? 0 : depth;
+}
+
 void genIOKitDevice(const io_service_t& device,
                     const io_service_t& parent,
                     const io_name_t plane,
                     int depth,
+                    const IOKitRegistryFilter& filter,
+                    QueryContext& context,
                     QueryData& results) {
   Row r;
   io_name_t name, device_class;
@@ -27,12 +56,18 @@ void genIOKitDevice(const io_service_t& device,
   if (kr == KERN_SUCCESS) {
     r["name"] = std::string(name);
   }
+  if (!filter.names.empty() && filter.names.count(r["name"]) == 0) {
+    return;
+  }
 
   // Get the device class.
   kr = IOObjectGetClass(device, device_class);
   if (kr == KERN_SUCCESS) {
     r["class"] = std::string(device_class);
   }
+  if (!filter.classes.empty() && filter.classes.count(r["class"]) == 0) {
+    return;
+  }
 
   // The entry into the registry is the ID, and is used for children as parent.
   uint64_t device_id, parent_id;
@@ -52,7 +87,9 @@ void genIOKitDevice(const io_service_t& device,
 
   r["depth"] = INTEGER(depth);
 
-  if (IORegistryEntryInPlane(device, kIODeviceTreePlane)) {
+  // The remaining columns are each a registry call, skip the unused columns.
+  if (context.isColumnUsed("device_path") &&
+      IORegistryEntryInPlane(device, kIODeviceTreePlane)) {
     io_string_t device_path;
     kr = IORegistryEntryGetPath(device, kIODeviceTreePlane, device_path);
     if (kr == KERN_SUCCESS) {
@@ -62,22 +99,28 @@ void genIOKitDevice(const io_service_t& device,
   }
 
   // Fill in service bits and busy/latency time.
-  if (IOObjectConformsTo(device, "IOService")) {
-    r["service"] = "1";
-  } else {
-    r["service"] = "0";
+  if (context.isColumnUsed("service")) {
+    if (IOObjectConformsTo(device, "IOService")) {
+      r["service"] = "1";
+    } else {
+      r["service"] = "0";
+    }
   }
 
-  uint32_t busy_state;
-  kr = IOServiceGetBusyState(device, &busy_state);
-  if (kr == KERN_SUCCESS) {
-    r["busy_state"] = INTEGER(busy_state);
-  } else {
-    r["busy_state"] = "0";
+  if (context.isColumnUsed("busy_state")) {
+    uint32_t busy_state;
+    kr = IOServiceGetBusyState(device, &busy_state);
+    if (kr == KERN_SUCCESS) {
+      r["busy_state"] = INTEGER(busy_state);
+    } else {
+      r["busy_state"] = "0";
+    }
   }
 
-  auto retain_count = IOObjectGetKernelRetainCount(device);
-  r["retain_count"] = INTEGER(retain_count);
+  if (context.isColumnUsed("retain_count")) {
+    auto retain_count = IOObjectGetKernelRetainCount(device);
+    r["retain_count"] = INTEGER(retain_count);
+  }
 
   results.push_back(r);
 }
@@ -85,6 +128,9 @@ void genIOKitDevice(const io_service_t& device,
 void genIOKitDeviceChildren(const io_registry_entry_t& service,
                             const io_name_t plane,
                             int depth,
+                            bool recursive,
+                            const IOKitRegistryFilter& filter,
+                            QueryContext& context,
                             QueryData& results) {
   io_iterator_t it;
   auto kr = IORegistryEntryGetChildIterator(service, plane, &it);
@@ -95,37 +141,125 @@ void genIOKitDeviceChildren(const io_registry_entry_t& service,
   io_service_t device;
   while ((device = IOIteratorNext(it))) {
     // Use this entry as the parent, and generate a result row.
-    genIOKitDevice(device, service, plane, depth, results);
-    genIOKitDeviceChildren(device, plane, depth + 1, results);
+    genIOKitDevice(device, service, plane, depth, filter, context, results);
+    if (recursive) {
+      genIOKitDeviceChildren(
+          device, plane, depth + 1, true, filter, context, results);
+    }
     IOObjectRelease(device);
   }
 
   IOObjectRelease(it);
 }
 
-QueryData genIOKitDeviceTree(QueryContext& context) {
-  QueryData results;
+/// Generate the children of each entry named by a parent constraint.
+static bool genIOKitParents(const io_name_t plane,
+                            const IOKitRegistryFilter& filter,
+                            QueryContext& context,
+                            QueryData& results) {
+  auto parents = context.constraints["parent"].getAll<long long>(EQUALS);
+  std::vector<io_service_t> entries;
+  for (const auto& parent_id : parents) {
+    // The lookup only finds IOService entries, walk the plane otherwise.
+    auto matching = IORegistryEntryIDMatching(parent_id);
+    auto entry = IOServiceGetMatchingService(kIOMasterPortDefault, matching);
+    if (entry == 0 || !IORegistryEntryInPlane(entry, plane)) {
+      if (entry != 0) {
+        IOObjectRelease(entry);
+      }
+      for (auto& found : entries) {
+        IOObjectRelease(found);
+      }
+      return false;
+    }
+    entries.push_back(entry);
+  }
 
-  // Get the IO registry root node.
-  auto service = IORegistryGetRootEntry(kIOMasterPortDefault);
+  for (auto& entry : entries) {
+    auto depth = getIOKitDepth(entry, plane) + 1;
+    genIOKitDeviceChildren(
+        entry, plane, depth, false, filter, context, results);
+    IOObjectRelease(entry);
+  }
+  return true;
+}
 
-  // Begin recursing along the IODeviceTree "plane".
-  genIOKitDeviceChildren(service, kIODeviceTreePlane, 0, results);
+/// Generate the IOService entries matching each class constraint.
+static void genIOKitClasses(const IOKitRegistryFilter& filter,
+                            QueryContext& context,
+                            QueryData& results) {
+  for (const auto& device_class : filter.classes) {
+    // Matching includes subclasses, genIOKitDevice keeps the exact class.
+    io_iterator_t it;
+    auto matching = IOServiceMatching(device_class.c_str());
+    auto kr =
+        IOServiceGetMatchingServices(kIOMasterPortDefault, matching, &it);
+    if (kr != KERN_SUCCESS) {
+      continue;
+    }
 
-  IOObjectRelease(service);
-  return results;
+    io_service_t device;
+    while ((device = IOIteratorNext(it))) {
+      io_registry_entry_t parent = 0;
+      IORegistryEntryGetParentEntry(device, kIOServicePlane, &parent);
+      int depth = 0;
+      if (context.isColumnUsed("depth")) {
+        depth = getIOKitDepth(device, kIOServicePlane);
+      }
+      genIOKitDevice(
+          device, parent, kIOServicePlane, depth, filter, context, results);
+      if (parent != 0) {
+        IOObjectRelease(parent);
+      }
+      IOObjectRelease(device);
+    }
+    IOObjectRelease(it);
+  }
 }
 
-QueryData genIOKitRegistry(QueryContext& context) {
-  QueryData results;
+/**
+ * @brief Generate the entries of a registry plane.
+ *
+ * Equality constraints guide the traversal: a parent constraint only reads
+ * the children of that entry, a class constraint on the IOService plane uses
+ * service matching instead of walking the plane, and name and class
+ * constraints skip the rows of other entries.
+ */
+static void genIOKitPlane(const io_name_t plane,
+                          QueryContext& context,
+                          QueryData& results) {
+  IOKitRegistryFilter filter;
+  filter.names = context.constraints["name"].getAll(EQUALS);
+  filter.classes = context.constraints["class"].getAll(EQUALS);
+
+  if (context.hasConstraint("parent", EQUALS) &&
+      genIOKitParents(plane, filter, context, results)) {
+    return;
+  }
+
+  if (!filter.classes.empty() && strcmp(plane, kIOServicePlane) == 0) {
+    genIOKitClasses(filter, context, results);
+    return;
+  }
 
   // Get the IO registry root node.
   auto service = IORegistryGetRootEntry(kIOMasterPortDefault);
 
-  // Begin recursing along the IODeviceTree "plane".
-  genIOKitDeviceChildren(service, kIOServicePlane, 0, results);
+  // Begin recursing along the requested "plane".
+  genIOKitDeviceChildren(service, plane, 0, true, filter, context, results);
 
   IOObjectRelease(service);
+}
+
+QueryData genIOKitDeviceTree(QueryContext& context) {
+  QueryData results;
+  genIOKitPlane(kIODeviceTreePlane, context, results);
+  return results;
+}
+
+QueryData genIOKitRegistry(QueryContext& context) {
+  QueryData results;
+  genIOKitPlane(kIOServicePlane, context, results);
   return results;
 }
 }
@@ -125,7 +125,7 @@ QueryData genLaunchd(QueryContext& context) {
       continue;
     }
 
-    if (!osquery::parsePlist(path, tree).ok()) {
+    if (!osquery::cachedParsePlist(path, tree).ok()) {
       TLOG << "Error parsing launch daemon/agent plist: " << path;
       continue;
     }
@@ -145,7 +145,7 @@ void genLaunchdOverride(const fs::path& path, QueryData& results) {
   r["uid"] = (group.size() == 5) ? BIGINT(group.at(4)) : "0";
 
   pt::ptree tree;
-  if (!osquery::parsePlist(path, tree).ok()) {
+  if (!osquery::cachedParsePlist(path, tree).ok()) {
     return;
   }
 
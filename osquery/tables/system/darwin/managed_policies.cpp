@@ -36,7 +36,7 @@ void genPolicy(const std::string& path,
 
   r["manual"] = "0";
   pt::ptree tree;
-  if (!osquery::parsePlist(path, tree).ok()) {
+  if (!osquery::cachedParsePlist(path, tree).ok()) {
     return;
   }
 
@@ -46,6 +46,7 @@ QueryData genMounts(QueryContext& context) {
     r["inodes"] = BIGINT(mnt[i].f_files);
     r["inodes_free"] = BIGINT(mnt[i].f_ffree);
     r["owner"] = INTEGER(mnt[i].f_owner);
+    r["stale"] = INTEGER(0);
     results.push_back(r);
   }
   return results;
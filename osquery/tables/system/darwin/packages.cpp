@@ -359,7 +359,7 @@ QueryData genPackageInstallHistory(QueryContext& context) {
   // The osquery::parsePlist method will reset/clear a property tree.
   // Keeping the data structure in a larger scope preserves allocations
   // between similar-sized trees.
-  if (!osquery::parsePlist(kPkgInstallHistoryPath, tree).ok()) {
+  if (!osquery::cachedParsePlist(kPkgInstallHistoryPath, tree).ok()) {
     TLOG << "Error parsing install history plist: " << kPkgInstallHistoryPath;
     return results;
   }
@@ -19,6 +19,8 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/darwin/processes.h"
+
 namespace osquery {
 namespace tables {
 
@@ -32,9 +34,6 @@ enum descriptor_type {
   DESCRIPTORS_TYPE_VNODE,
 };
 
-// From processes.cpp
-std::set<int> getProcList(const QueryContext &context);
-
 inline std::string socketIpAsString(const struct in_sockinfo *in,
                                     int type,
                                     int family) {
@@ -154,18 +153,12 @@ void genSocketDescriptor(int pid, int descriptor, QueryData &results) {
   }
 }
 
-void genOpenDescriptors(int pid, descriptor_type type, QueryData &results) {
-  int bufsize = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, 0, 0);
-  if (bufsize == -1) {
-    VLOG(1) << "Could not list descriptors for pid: " << pid;
-    return;
-  }
-
-  // Allocate structs for each descriptor.
-  proc_fdinfo fds[bufsize / PROC_PIDLISTFD_SIZE];
-  proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fds, bufsize);
-
-  for (auto fd_info : fds) {
+void genOpenDescriptors(DarwinProcSnapshot &snapshot,
+                        int pid,
+                        descriptor_type type,
+                        QueryData &results) {
+  // The descriptor list is shared by the sockets and files tables.
+  for (const auto &fd_info : snapshot.descriptors(pid)) {
     if (type == DESCRIPTORS_TYPE_VNODE &&
         fd_info.proc_fdtype == PROX_FDTYPE_VNODE) {
       genFileDescriptor(pid, fd_info.proc_fd, results);
@@ -179,13 +172,14 @@ void genOpenDescriptors(int pid, descriptor_type type, QueryData &results) {
 QueryData genOpenSockets(QueryContext &context) {
   QueryData results;
 
+  auto snapshot = DarwinProcSnapshot::get();
   auto pidlist = getProcList(context);
   for (auto &pid : pidlist) {
     if (!context.constraints["pid"].matches(pid)) {
       // Optimize by not searching when a pid is a constraint.
       continue;
     }
-    genOpenDescriptors(pid, DESCRIPTORS_TYPE_SOCKET, results);
+    genOpenDescriptors(*snapshot, pid, DESCRIPTORS_TYPE_SOCKET, results);
   }
 
   return results;
@@ -194,6 +188,7 @@ QueryData genOpenSockets(QueryContext &context) {
 QueryData genOpenFiles(QueryContext &context) {
   QueryData results;
 
+  auto snapshot = DarwinProcSnapshot::get();
   auto pidlist = getProcList(context);
   for (auto &pid : pidlist) {
     if (!context.constraints["pid"].matches(pid)) {
@@ -201,7 +196,7 @@ QueryData genOpenFiles(QueryContext &context) {
       continue;
     }
 
-    genOpenDescriptors(pid, DESCRIPTORS_TYPE_VNODE, results);
+    genOpenDescriptors(*snapshot, pid, DESCRIPTORS_TYPE_VNODE, results);
   }
 
   return results;
@@ -8,8 +8,10 @@
  *
  */
 
+#include <cstring>
 #include <map>
 #include <set>
+#include <vector>
 
 #include <libproc.h>
 #include <mach/mach.h>
@@ -23,8 +25,11 @@
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
+#include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/darwin/processes.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
@@ -44,50 +49,6 @@ namespace tables {
 // SZOMB  (5) Awaiting collection by parent
 const char kProcessStateMapping[] = {' ', 'I', 'R', 'S', 'T', 'Z'};
 
-std::set<int> getProcList(const QueryContext &context) {
-  std::set<int> pidlist;
-  if (context.constraints.count("pid") > 0 &&
-      context.constraints.at("pid").exists(EQUALS)) {
-    for (const auto &pid : context.constraints.at("pid").getAll<int>(EQUALS)) {
-      if (pid > 0) {
-        pidlist.insert(pid);
-      }
-    }
-    return pidlist;
-  }
-
-  int bufsize = proc_listpids(PROC_ALL_PIDS, 0, nullptr, 0);
-  if (bufsize <= 0) {
-    VLOG(1) << "An error occurred retrieving the process list";
-    return pidlist;
-  }
-
-  // arbitrarily create a list with 2x capacity in case more processes have
-  // been loaded since the last proc_listpids was executed
-  pid_t pids[2 * bufsize / sizeof(pid_t)];
-
-  // now that we've allocated "pids", let's overwrite num_pids with the actual
-  // amount of data that was returned for proc_listpids when we populate the
-  // pids data structure
-  bufsize = proc_listpids(PROC_ALL_PIDS, 0, pids, sizeof(pids));
-  if (bufsize <= 0) {
-    VLOG(1) << "An error occurred retrieving the process list";
-    return pidlist;
-  }
-
-  size_t num_pids = bufsize / sizeof(pid_t);
-  for (size_t i = 0; i < num_pids; ++i) {
-    // if the pid is negative or 0, it doesn't represent a real process so
-    // continue the iterations so that we don't add it to the results set
-    if (pids[i] <= 0) {
-      continue;
-    }
-    pidlist.insert(pids[i]);
-  }
-
-  return pidlist;
-}
-
 inline std::string getProcPath(int pid) {
   char path[PROC_PIDPATHINFO_MAXSIZE] = {0};
   int bufsize = proc_pidpath(pid, path, sizeof(path));
@@ -179,11 +140,6 @@ void genProcRootAndCWD(int pid, Row &r) {
   }
 }
 
-struct proc_args {
-  std::vector<std::string> args;
-  std::map<std::string, std::string> env;
-};
-
 proc_args getProcRawArgs(int pid, size_t argmax) {
   proc_args args;
   uid_t euid = geteuid();
@@ -231,62 +187,231 @@ proc_args getProcRawArgs(int pid, size_t argmax) {
   return args;
 }
 
-QueryData genProcesses(QueryContext &context) {
-  QueryData results;
+/// List every process, a pid of 0 or less is not a real process.
+static void listProcesses(std::set<int> &pidlist) {
+  int bufsize = proc_listpids(PROC_ALL_PIDS, 0, nullptr, 0);
+  if (bufsize <= 0) {
+    VLOG(1) << "An error occurred retrieving the process list";
+    return;
+  }
 
-  // Initialize time conversions.
-  static mach_timebase_info_data_t time_base;
-  if (time_base.denom == 0) {
-    mach_timebase_info(&time_base);
+  // arbitrarily create a list with 2x capacity in case more processes have
+  // been loaded since the last proc_listpids was executed
+  std::vector<pid_t> pids(2 * bufsize / sizeof(pid_t));
+
+  // now that we've allocated "pids", let's overwrite num_pids with the actual
+  // amount of data that was returned for proc_listpids when we populate the
+  // pids data structure
+  bufsize = proc_listpids(
+      PROC_ALL_PIDS, 0, pids.data(), pids.size() * sizeof(pid_t));
+  if (bufsize <= 0) {
+    VLOG(1) << "An error occurred retrieving the process list";
+    return;
   }
 
-  auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
+  size_t num_pids = bufsize / sizeof(pid_t);
+  for (size_t i = 0; i < num_pids; ++i) {
+    // if the pid is negative or 0, it doesn't represent a real process so
+    // continue the iterations so that we don't add it to the results set
+    if (pids[i] <= 0) {
+      continue;
+    }
+    pidlist.insert(pids[i]);
+  }
+}
+
+/// The current snapshot, see DarwinProcSnapshot::get.
+static std::shared_ptr<DarwinProcSnapshot> kProcSnapshot{nullptr};
 
-  for (auto &pid : pidlist) {
-    Row r;
-    r["pid"] = INTEGER(pid);
+/// Protect the current snapshot.
+static Mutex kProcSnapshotMutex;
+
+std::shared_ptr<DarwinProcSnapshot> DarwinProcSnapshot::get() {
+  auto now = getUnixTime();
+  WriteLock lock(kProcSnapshotMutex);
+  if (kProcSnapshot == nullptr || kProcSnapshot->time_ != now) {
+    kProcSnapshot =
+        std::shared_ptr<DarwinProcSnapshot>(new DarwinProcSnapshot(now));
+  }
+  return kProcSnapshot;
+}
+
+void DarwinProcSnapshot::reset() {
+  WriteLock lock(kProcSnapshotMutex);
+  kProcSnapshot = nullptr;
+}
+
+const std::set<int> &DarwinProcSnapshot::processes() {
+  WriteLock lock(mutex_);
+  if (!listed_) {
+    listed_ = true;
+    listProcesses(processes_);
+  }
+  return processes_;
+}
+
+bool DarwinProcSnapshot::taskInfo(int pid, struct proc_taskallinfo &info) {
+  {
+    WriteLock lock(mutex_);
+    auto it = info_.find(pid);
+    if (it != info_.end()) {
+      info = it->second.second;
+      return it->second.first;
+    }
+  }
+
+  // Request without holding the lock, a concurrent request stores the same.
+  memset(&info, 0, sizeof(info));
+  bool requested = (proc_pidinfo(pid,
+                                 PROC_PIDTASKALLINFO,
+                                 0,
+                                 &info,
+                                 PROC_PIDTASKALLINFO_SIZE) ==
+                    PROC_PIDTASKALLINFO_SIZE);
+  WriteLock lock(mutex_);
+  info_[pid] = std::make_pair(requested, info);
+  return requested;
+}
+
+const proc_args &DarwinProcSnapshot::arguments(int pid) {
+  {
+    WriteLock lock(mutex_);
+    auto it = args_.find(pid);
+    if (it != args_.end()) {
+      return it->second;
+    }
+  }
+
+  auto args = getProcRawArgs(pid, genMaxArgs());
+  WriteLock lock(mutex_);
+  // Entries are not removed, so the reference is valid with the snapshot.
+  return args_.emplace(pid, std::move(args)).first->second;
+}
+
+const std::vector<struct proc_fdinfo> &DarwinProcSnapshot::descriptors(
+    int pid) {
+  {
+    WriteLock lock(mutex_);
+    auto it = descriptors_.find(pid);
+    if (it != descriptors_.end()) {
+      return it->second;
+    }
+  }
+
+  std::vector<struct proc_fdinfo> fds;
+  int bufsize = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, 0, 0);
+  if (bufsize > 0) {
+    fds.resize(bufsize / PROC_PIDLISTFD_SIZE);
+    bufsize = proc_pidinfo(pid, PROC_PIDLISTFDS, 0, fds.data(), bufsize);
+    fds.resize((bufsize > 0) ? bufsize / PROC_PIDLISTFD_SIZE : 0);
+  } else {
+    VLOG(1) << "Could not list descriptors for pid: " << pid;
+  }
+
+  WriteLock lock(mutex_);
+  return descriptors_.emplace(pid, std::move(fds)).first->second;
+}
+
+std::set<int> getProcList(const QueryContext &context) {
+  std::set<int> pidlist;
+  if (context.constraints.count("pid") > 0 &&
+      context.constraints.at("pid").exists(EQUALS)) {
+    for (const auto &pid : context.constraints.at("pid").getAll<int>(EQUALS)) {
+      if (pid > 0) {
+        pidlist.insert(pid);
+      }
+    }
+    return pidlist;
+  }
+
+  return DarwinProcSnapshot::get()->processes();
+}
+
+/// Copy the credentials from PROC_PIDTASKALLINFO's BSD information.
+static void getTaskCred(const struct proc_bsdinfo &bsdinfo, proc_cred &cred) {
+  cred.parent = bsdinfo.pbi_ppid;
+  cred.group = bsdinfo.pbi_pgid;
+  cred.status = bsdinfo.pbi_status;
+  cred.nice = bsdinfo.pbi_nice;
+  cred.real.uid = bsdinfo.pbi_ruid;
+  cred.real.gid = bsdinfo.pbi_rgid;
+  cred.effective.uid = bsdinfo.pbi_uid;
+  cred.effective.gid = bsdinfo.pbi_gid;
+  cred.saved.uid = bsdinfo.pbi_svuid;
+  cred.saved.gid = bsdinfo.pbi_svgid;
+}
+
+/**
+ * @brief Generate a process row, requesting only what the columns use.
+ *
+ * A single PROC_PIDTASKALLINFO request provides the credentials, state, and
+ * thread count. The path, arguments, working directories, and resource usage
+ * are each requested only if their columns are used. Processes that cannot be
+ * inspected, such as another user's process when not running as root, fall
+ * back to the BSD information getProcCred requests.
+ */
+void genProcess(DarwinProcSnapshot &snapshot,
+                int pid,
+                const QueryContext &context,
+                const mach_timebase_info_data_t &time_base,
+                QueryData &results) {
+  proc_cred cred;
+  struct proc_taskallinfo info;
+  bool task = snapshot.taskInfo(pid, info);
+  if (task) {
+    getTaskCred(info.pbsd, cred);
+  } else if (!getProcCred(pid, cred)) {
+    return;
+  }
+
+  Row r;
+  r["pid"] = INTEGER(pid);
+  if (context.isAnyColumnUsed({"path", "name", "on_disk"})) {
     r["path"] = getProcPath(pid);
     // OS X proc_name only returns 16 bytes, use the basename of the path.
     r["name"] = fs::path(r["path"]).filename().string();
+  }
 
-    {
-      // The command line invocation including arguments.
-      auto args = getProcRawArgs(pid, argmax);
-      std::string cmdline = boost::algorithm::join(args.args, " ");
-      r["cmdline"] = cmdline;
-    }
+  if (context.isColumnUsed("cmdline")) {
+    // The command line invocation including arguments.
+    r["cmdline"] = boost::algorithm::join(snapshot.arguments(pid).args, " ");
+  }
 
-    // The process relative root and current working directory.
+  // The process relative root and current working directory.
+  if (context.isAnyColumnUsed({"cwd", "root"})) {
     genProcRootAndCWD(pid, r);
+  }
 
-    proc_cred cred;
-    if (getProcCred(pid, cred)) {
-      r["parent"] = BIGINT(cred.parent);
-      r["pgroup"] = BIGINT(cred.group);
-      // check if process state is one of the expected ones
-      r["state"] = (1 <= cred.status && cred.status <= 5)
-                       ? TEXT(kProcessStateMapping[cred.status])
-                       : TEXT('?');
-      r["nice"] = INTEGER(cred.nice);
-      r["uid"] = BIGINT(cred.real.uid);
-      r["gid"] = BIGINT(cred.real.gid);
-      r["euid"] = BIGINT(cred.effective.uid);
-      r["egid"] = BIGINT(cred.effective.gid);
-      r["suid"] = BIGINT(cred.saved.uid);
-      r["sgid"] = BIGINT(cred.saved.gid);
-    } else {
-      continue;
-    }
-
-    // If the path of the executable that started the process is available and
-    // the path exists on disk, set on_disk to 1. If the path is not
-    // available, set on_disk to -1. If, and only if, the path of the
-    // executable is available and the file does NOT exist on disk, set on_disk
-    // to 0.
+  r["parent"] = BIGINT(cred.parent);
+  r["pgroup"] = BIGINT(cred.group);
+  // check if process state is one of the expected ones
+  r["state"] = (1 <= cred.status && cred.status <= 5)
+                   ? TEXT(kProcessStateMapping[cred.status])
+                   : TEXT('?');
+  r["nice"] = INTEGER(cred.nice);
+  r["uid"] = BIGINT(cred.real.uid);
+  r["gid"] = BIGINT(cred.real.gid);
+  r["euid"] = BIGINT(cred.effective.uid);
+  r["egid"] = BIGINT(cred.effective.gid);
+  r["suid"] = BIGINT(cred.saved.uid);
+  r["sgid"] = BIGINT(cred.saved.gid);
+
+  // If the path of the executable that started the process is available and
+  // the path exists on disk, set on_disk to 1. If the path is not
+  // available, set on_disk to -1. If, and only if, the path of the
+  // executable is available and the file does NOT exist on disk, set on_disk
+  // to 0.
+  if (context.isColumnUsed("on_disk")) {
     r["on_disk"] = osquery::pathExists(r["path"]).toString();
+  }
 
-    // systems usage and time information
+  // systems usage and time information
+  if (context.isAnyColumnUsed({"wired_size",
+                               "resident_size",
+                               "total_size",
+                               "user_time",
+                               "system_time",
+                               "start_time"})) {
     struct rusage_info_v2 rusage_info_data;
     int status = proc_pid_rusage(
         pid, RUSAGE_INFO_V2, (rusage_info_t *)&rusage_info_data);
@@ -313,17 +438,25 @@ QueryData genProcesses(QueryContext &context) {
       r["system_time"] = "-1";
       r["start_time"] = "-1";
     }
+  }
 
-    struct proc_taskinfo task_info;
-    status =
-        proc_pidinfo(pid, PROC_PIDTASKINFO, 0, &task_info, sizeof(task_info));
-    if (status == 0) {
-      r["threads"] = task_info.pti_threadnum;
-    } else {
-      r["threads"] = "-1";
-    }
+  r["threads"] = (task) ? INTEGER(info.ptinfo.pti_threadnum) : "-1";
+  results.push_back(r);
+}
 
-    results.push_back(r);
+QueryData genProcesses(QueryContext &context) {
+  QueryData results;
+
+  // Initialize time conversions.
+  static mach_timebase_info_data_t time_base;
+  if (time_base.denom == 0) {
+    mach_timebase_info(&time_base);
+  }
+
+  auto snapshot = DarwinProcSnapshot::get();
+  auto pidlist = getProcList(context);
+  for (const auto &pid : pidlist) {
+    genProcess(*snapshot, pid, context, time_base, results);
   }
 
   return results;
@@ -332,11 +465,11 @@ QueryData genProcesses(QueryContext &context) {
 QueryData genProcessEnvs(QueryContext &context) {
   QueryData results;
 
+  // Arguments are parsed once per snapshot, shared with processes.cmdline.
+  auto snapshot = DarwinProcSnapshot::get();
   auto pidlist = getProcList(context);
-  int argmax = genMaxArgs();
   for (const auto &pid : pidlist) {
-    auto args = getProcRawArgs(pid, argmax);
-    for (const auto &env : args.env) {
+    for (const auto &env : snapshot->arguments(pid).env) {
       Row r;
       r["pid"] = INTEGER(pid);
       r["key"] = env.first;
@@ -0,0 +1,100 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <libproc.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/// The arguments and environment of a process, from KERN_PROCARGS2.
+struct proc_args {
+  std::vector<std::string> args;
+  std::map<std::string, std::string> env;
+};
+
+/**
+ * @brief Process information shared by the process tables within a second.
+ *
+ * The processes, process_envs, process_open_files, and process_open_sockets
+ * tables, and queries joining them, each listed the processes and requested
+ * the same information per pid. A snapshot lists the processes once, and
+ * requests each process's PROC_PIDTASKALLINFO, arguments, and descriptor list
+ * at most once, on first use. The snapshot is replaced when it is older than
+ * a second, so every table scanned within that second sees the same
+ * processes.
+ */
+class DarwinProcSnapshot : private boost::noncopyable {
+ public:
+  /// Get the snapshot for the current second, creating it if needed.
+  static std::shared_ptr<DarwinProcSnapshot> get();
+
+  /// Release the current snapshot, the next request lists processes again.
+  static void reset();
+
+  /// The pids of every process, listed on first use.
+  const std::set<int>& processes();
+
+  /**
+   * @brief The BSD and task information of a process.
+   *
+   * @param pid the process.
+   * @param info output, the information from PROC_PIDTASKALLINFO.
+   * @return false if the information could not be requested, such as for
+   * another user's process when not running as root.
+   */
+  bool taskInfo(int pid, struct proc_taskallinfo& info);
+
+  /// The arguments and environment, empty if they could not be read.
+  const proc_args& arguments(int pid);
+
+  /// The descriptors from PROC_PIDLISTFDS, empty if they could not be listed.
+  const std::vector<struct proc_fdinfo>& descriptors(int pid);
+
+ private:
+  explicit DarwinProcSnapshot(size_t time) : time_(time) {}
+
+ private:
+  /// The UNIX time the snapshot was created.
+  size_t time_{0};
+
+  /// Set after the process list is read.
+  bool listed_{false};
+
+  std::set<int> processes_;
+
+  /// Task information keyed by pid, the flag is set if it was requested.
+  std::map<int, std::pair<bool, struct proc_taskallinfo>> info_;
+
+  /// Parsed arguments keyed by pid.
+  std::map<int, proc_args> args_;
+
+  /// Descriptor lists keyed by pid.
+  std::map<int, std::vector<struct proc_fdinfo>> descriptors_;
+
+  Mutex mutex_;
+};
+
+/// The pids constrained by the query, or every process in the snapshot.
+std::set<int> getProcList(const QueryContext& context);
+}
+}
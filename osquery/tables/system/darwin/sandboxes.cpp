@@ -35,7 +35,7 @@ void genSandboxContainer(const fs::path& container, QueryData& results) {
     return;
   }
 
-  if (!osquery::parsePlist(path.string(), tree).ok()) {
+  if (!osquery::cachedParsePlist(path.string(), tree).ok()) {
     // Could not parse the container plist.
     return;
   }
@@ -9,6 +9,9 @@
  */
 
 #include <iomanip>
+#include <map>
+#include <mutex>
+#include <set>
 #include <sstream>
 
 #include <IOKit/IOKitLib.h>
@@ -296,22 +299,45 @@ class SMCHelper : private boost::noncopyable {
     }
   }
 
+  /**
+   * @brief The SMC session shared by the SMC and sensor tables.
+   *
+   * The session is opened by the first query and kept for the life of the
+   * process, along with the key index and the type of each key read.
+   */
+  static SMCHelper &get() {
+    static SMCHelper smc;
+    return smc;
+  }
+
   /**
    * @brief Open the IOKit master port, device driver, and service.
    *
    * This will find the userland SMC interface driver and open the service.
-   * It will remain open until the helper is deleted.
+   * It will remain open until the helper is deleted, an open helper returns
+   * true without opening the service again.
    */
   bool open();
 
   /// Shutdown the IOKit connection.
-  void close() { IOServiceClose(connection_); }
+  void close() {
+    IOServiceClose(connection_);
+    connection_ = 0;
+  }
+
+  /**
+   * @brief Read a given SMC key into an output parameter value.
+   *
+   * The key's size and type are requested once and cached, later reads of
+   * the key are a single service call.
+   */
+  bool read(const std::string &key, SMCValue_t *val);
 
-  /// Read a given SMC key into an output parameter value.
-  bool read(const std::string &key, SMCValue_t *val) const;
+  /// Read all keys (a service API call per key) into a string vector.
+  std::vector<std::string> getKeys();
 
-  /// Read all keys (a service API call) into a string vector.
-  std::vector<std::string> getKeys() const;
+  /// Check if the SMC key index includes a key, true if there is no index.
+  bool hasKey(const std::string &key);
 
  private:
   /// Perform an API call to the IOKit AppleSMC service.
@@ -320,16 +346,39 @@ class SMCHelper : private boost::noncopyable {
                      SMCKeyData_t *out) const;
 
   /// Read the size of the internal SMC key structure.
-  size_t getKeysCount() const;
+  size_t getKeysCount();
+
+  /// Read and cache the key index, the lock must be held.
+  void loadKeys();
 
  private:
   /// IOKit master port.
   mach_port_t master_port_{0};
   /// IOKit service connection.
   io_connect_t connection_{0};
+
+  /// The size and type of each key read, a size of 0 if the key is missing.
+  std::map<UInt32, SMCKeyDataKeyInfo_t> key_info_;
+
+  /// The SMC key index, enumerated once.
+  std::vector<std::string> keys_;
+
+  /// The keys in the index, for lookups.
+  std::set<std::string> key_set_;
+
+  /// Set when the key index was enumerated.
+  bool keys_loaded_{false};
+
+  /// Serialize service calls and the caches.
+  std::recursive_mutex mutex_;
 };
 
 bool SMCHelper::open() {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  if (connection_ != 0) {
+    return true;
+  }
+
   auto result = IOMasterPort(MACH_PORT_NULL, &master_port_);
   if (result != kIOReturnSuccess) {
     return false;
@@ -421,32 +470,47 @@ float getConvertedValue(const std::string &smcType, const std::string &smcVal) {
   return convertedVal;
 }
 
-bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
+bool SMCHelper::read(const std::string &key, SMCValue_t *val) {
   SMCKeyData_t in;
   SMCKeyData_t out;
 
   memset(&in, 0, sizeof(SMCKeyData_t));
   memset(&out, 0, sizeof(SMCKeyData_t));
   memset(val, 0, sizeof(SMCValue_t));
+  if (key.size() < 4) {
+    return false;
+  }
 
   in.key = strtoul(key.c_str(), 4, 16);
   memcpy(val->key.bytes, key.c_str(), 4);
-  in.data8 = SMCCMDType::READ_KEYINFO;
 
-  auto result = call(KERNEL_INDEX_SMC, &in, &out);
-  if (result != kIOReturnSuccess) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  auto info = key_info_.find(in.key);
+  if (info == key_info_.end()) {
+    in.data8 = SMCCMDType::READ_KEYINFO;
+    auto result = call(KERNEL_INDEX_SMC, &in, &out);
+    if (result != kIOReturnSuccess) {
+      return false;
+    }
+    info = key_info_.insert(std::make_pair(in.key, out.keyInfo)).first;
+    memset(&out, 0, sizeof(SMCKeyData_t));
+  }
+
+  const auto &key_info = info->second;
+  val->dataSize = key_info.dataSize;
+  val->dataType.bytes[0] = (uint32_t)key_info.dataType >> 24;
+  val->dataType.bytes[1] = (uint32_t)key_info.dataType >> 16;
+  val->dataType.bytes[2] = (uint32_t)key_info.dataType >> 8;
+  val->dataType.bytes[3] = (uint32_t)key_info.dataType;
+  if (val->dataSize == 0) {
+    // The key does not exist, there are no bytes to read.
     return false;
   }
 
-  val->dataSize = out.keyInfo.dataSize;
-  val->dataType.bytes[0] = (uint32_t)out.keyInfo.dataType >> 24;
-  val->dataType.bytes[1] = (uint32_t)out.keyInfo.dataType >> 16;
-  val->dataType.bytes[2] = (uint32_t)out.keyInfo.dataType >> 8;
-  val->dataType.bytes[3] = (uint32_t)out.keyInfo.dataType;
   in.keyInfo.dataSize = val->dataSize;
   in.data8 = SMCCMDType::READ_BYTES;
 
-  result = call(KERNEL_INDEX_SMC, &in, &out);
+  auto result = call(KERNEL_INDEX_SMC, &in, &out);
   if (result != kIOReturnSuccess) {
     return false;
   }
@@ -455,14 +519,32 @@ bool SMCHelper::read(const std::string &key, SMCValue_t *val) const {
   return true;
 }
 
-size_t SMCHelper::getKeysCount() const {
+size_t SMCHelper::getKeysCount() {
   SMCValue_t val;
   read("#KEY", &val);
   return ((int)val.bytes.bytes[2] << 8) + ((unsigned)val.bytes.bytes[3] & 0xff);
 }
 
-std::vector<std::string> SMCHelper::getKeys() const {
-  std::vector<std::string> keys;
+std::vector<std::string> SMCHelper::getKeys() {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  loadKeys();
+  return keys_;
+}
+
+bool SMCHelper::hasKey(const std::string &key) {
+  std::lock_guard<std::recursive_mutex> lock(mutex_);
+  loadKeys();
+  // Without an index every key is read.
+  return (key_set_.empty() || key_set_.count(key) > 0);
+}
+
+void SMCHelper::loadKeys() {
+  if (keys_loaded_) {
+    return;
+  }
+
+  // The key index does not change while the system runs.
+  auto &keys = keys_;
   size_t totalKeys = getKeysCount();
   for (size_t i = 0; i < totalKeys; i++) {
     SMCKeyData_t in;
@@ -487,11 +569,12 @@ std::vector<std::string> SMCHelper::getKeys() const {
     key.bytes[4] = 0;
     keys.push_back(key.bytes);
   }
-  return keys;
+  key_set_.insert(keys_.begin(), keys_.end());
+  keys_loaded_ = !keys_.empty();
 }
 
 void genSMCKey(const std::string &key,
-               const SMCHelper &smc,
+               SMCHelper &smc,
                QueryData &results,
                bool hidden = false) {
   Row r;
@@ -519,7 +602,7 @@ void genSMCKey(const std::string &key,
 QueryData genSMCKeys(QueryContext &context) {
   QueryData results;
 
-  SMCHelper smc;
+  auto &smc = SMCHelper::get();
   if (!smc.open()) {
     return {};
   }
@@ -554,7 +637,7 @@ inline QueryData getSMCKeysUsingPredicate(
     const QueryContext &context,
     const std::set<std::string> &keys,
     std::function<void(const Row &r, QueryData &results)> predicate) {
-  SMCHelper smc;
+  auto &smc = SMCHelper::get();
   if (!smc.open()) {
     return {};
   }
@@ -577,9 +660,12 @@ inline QueryData getSMCKeysUsingPredicate(
   if (context.hasConstraint("key", EQUALS)) {
     context.forEachConstraint("key", EQUALS, wrapped);
   } else {
-    // Perform a full scan of the keys category.
+    // Perform a full scan of the keys category, only reading the keys this
+    // SMC reports in its index.
     for (const auto &key : keys) {
-      wrapped(key);
+      if (smc.hasKey(key)) {
+        wrapped(key);
+      }
     }
   }
 
@@ -681,7 +767,7 @@ std::string getFanName(const std::string &smcVal) {
 QueryData genFanSpeedSensors(QueryContext &context) {
   QueryData results;
 
-  SMCHelper smc;
+  auto &smc = SMCHelper::get();
   if (!smc.open()) {
     return {};
   }
@@ -106,7 +106,7 @@ void genLoginItems(const fs::path& homedir, QueryData& results) {
     return;
   }
 
-  if (!osquery::parsePlist(sipath.string(), tree).ok()) {
+  if (!osquery::cachedParsePlist(sipath.string(), tree).ok()) {
     // Could not parse the user's startup items plist.
     return;
   }
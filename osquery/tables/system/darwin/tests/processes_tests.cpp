@@ -0,0 +1,60 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include "osquery/tables/system/darwin/processes.h"
+
+namespace osquery {
+namespace tables {
+
+class ProcessesTests : public testing::Test {
+ protected:
+  void TearDown() override {
+    DarwinProcSnapshot::reset();
+  }
+};
+
+TEST_F(ProcessesTests, test_proc_snapshot) {
+  auto snapshot = DarwinProcSnapshot::get();
+  EXPECT_EQ(snapshot->processes().count(getpid()), 1U);
+
+  // The task information of this process is always available.
+  struct proc_taskallinfo info;
+  ASSERT_TRUE(snapshot->taskInfo(getpid(), info));
+  EXPECT_EQ(static_cast<pid_t>(info.pbsd.pbi_pid), getpid());
+  EXPECT_GT(info.ptinfo.pti_threadnum, 0);
+
+  // A second request returns the stored information.
+  struct proc_taskallinfo again;
+  ASSERT_TRUE(snapshot->taskInfo(getpid(), again));
+  EXPECT_EQ(info.pbsd.pbi_ppid, again.pbsd.pbi_ppid);
+
+  // The descriptor list is stored, so the same list is returned.
+  const auto& fds = snapshot->descriptors(getpid());
+  EXPECT_FALSE(fds.empty());
+  EXPECT_EQ(&fds, &snapshot->descriptors(getpid()));
+
+  // The arguments are parsed once and the same result is returned.
+  const auto& args = snapshot->arguments(getpid());
+  EXPECT_EQ(&args, &snapshot->arguments(getpid()));
+}
+
+TEST_F(ProcessesTests, test_proc_list_constraint) {
+  QueryContext context;
+  context.constraints["pid"].add(Constraint(EQUALS, std::to_string(getpid())));
+  auto pidlist = getProcList(context);
+  ASSERT_EQ(pidlist.size(), 1U);
+  EXPECT_EQ(*pidlist.begin(), getpid());
+}
+}
+}
@@ -107,7 +107,7 @@ inline std::vector<std::string> getXProtectReportFiles(
 inline void genXProtectReport(const std::string& path, QueryData& results) {
   pt::ptree report;
 
-  if (!osquery::parsePlist(path, report).ok()) {
+  if (!osquery::cachedParsePlist(path, report).ok()) {
     // Failed to read the XProtect plist format.
     return;
   }
@@ -154,7 +154,7 @@ QueryData genXProtectEntries(QueryContext& context) {
     return results;
   }
 
-  if (!osquery::parsePlist(xprotect_path, tree).ok()) {
+  if (!osquery::cachedParsePlist(xprotect_path, tree).ok()) {
     VLOG(1) << "Could not parse the XProtect.plist";
     return results;
   }
@@ -178,7 +178,7 @@ QueryData genXProtectMeta(QueryContext& context) {
     return results;
   }
 
-  if (!osquery::parsePlist(xprotect_meta, tree).ok()) {
+  if (!osquery::cachedParsePlist(xprotect_meta, tree).ok()) {
     VLOG(1) << "Could not parse the XProtect.meta.plist";
     return results;
   }
@@ -0,0 +1,192 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/stat.h>
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/filesystem.h>
+#include <osquery/flags.h>
+
+#include "osquery/tables/system/line_cache.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     line_cache_max_rows,
+     1000000,
+     "Maximum rows kept from parsed history and key files (0 disables)");
+
+namespace tables {
+
+/// The bytes kept from the end of the parsed content to detect rewrites.
+const size_t kLineCacheTailSize = 64;
+
+/// Stat a file, returning the (device, inode) and the full identity.
+static bool getFileIdentity(const std::string& path,
+                            std::string& file,
+                            std::string& identity,
+                            size_t& size) {
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+
+  file = std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+  size = static_cast<size_t>(st.st_size);
+#if defined(__linux__)
+  identity = file + ":" + std::to_string(size) + ":" +
+             std::to_string(st.st_mtim.tv_sec) + "." +
+             std::to_string(st.st_mtim.tv_nsec) + ":" +
+             std::to_string(st.st_ctim.tv_sec) + "." +
+             std::to_string(st.st_ctim.tv_nsec);
+#elif defined(__APPLE__)
+  identity = file + ":" + std::to_string(size) + ":" +
+             std::to_string(st.st_mtimespec.tv_sec) + "." +
+             std::to_string(st.st_mtimespec.tv_nsec) + ":" +
+             std::to_string(st.st_ctimespec.tv_sec) + "." +
+             std::to_string(st.st_ctimespec.tv_nsec);
+#else
+  identity = file + ":" + std::to_string(size) + ":" +
+             std::to_string(st.st_mtime) + ":" + std::to_string(st.st_ctime);
+#endif
+  return true;
+}
+
+/// Parse a line as osquery::split would tokenize it, skipping empty lines.
+static inline void parseLine(const LineParser& parser,
+                             std::string line,
+                             std::string& state,
+                             QueryData& rows) {
+  if (line.empty()) {
+    return;
+  }
+  boost::algorithm::trim(line);
+  parser(line, state, rows);
+}
+
+Status FileLineCache::get(const std::string& key,
+                          const std::string& path,
+                          const LineParser& parser,
+                          QueryData& results) {
+  std::string file, identity;
+  size_t size = 0;
+  if (!getFileIdentity(path, file, identity, size)) {
+    return Status(1, "Cannot stat file: " + path);
+  }
+
+  WriteLock lock(mutex_);
+  auto& entry = entries_[std::make_pair(key, path)];
+  entry.used = ++requests_;
+  if (entry.identity == identity) {
+    results.insert(results.end(), entry.rows.begin(), entry.rows.end());
+    results.insert(results.end(), entry.partial.begin(), entry.partial.end());
+    return Status(0, "OK");
+  }
+
+  // Read only the appended bytes, and the last parsed bytes to compare, if
+  // the file was not replaced and did not shrink.
+  bool appended = (entry.file == file && entry.offset > 0 &&
+                   size >= entry.offset);
+  size_t start = (appended) ? entry.offset - entry.tail.size() : 0;
+
+  std::string content;
+  auto status = readFileBlocks(path,
+                               4096 * 16,
+                               true,
+                               ([&content](const char* buffer, size_t size) {
+                                 content.append(buffer, size);
+                               }),
+                               start);
+  if (!status.ok()) {
+    rows_ -= entry.rows.size();
+    entries_.erase(std::make_pair(key, path));
+    return status;
+  }
+
+  if (appended && content.compare(0, entry.tail.size(), entry.tail) != 0) {
+    // The parsed content was rewritten, parse the file from the start.
+    appended = false;
+    content.clear();
+    status = readFileBlocks(path,
+                            4096 * 16,
+                            true,
+                            ([&content](const char* buffer, size_t size) {
+                              content.append(buffer, size);
+                            }));
+    if (!status.ok()) {
+      rows_ -= entry.rows.size();
+      entries_.erase(std::make_pair(key, path));
+      return status;
+    }
+  }
+
+  size_t position = 0;
+  if (appended) {
+    position = entry.tail.size();
+  } else {
+    rows_ -= entry.rows.size();
+    entry.rows.clear();
+    entry.state.clear();
+    entry.offset = 0;
+  }
+
+  // Parse each complete line, then the last line without its newline.
+  auto rows = entry.rows.size();
+  size_t newline = 0;
+  while ((newline = content.find('\n', position)) != std::string::npos) {
+    parseLine(parser,
+              content.substr(position, newline - position),
+              entry.state,
+              entry.rows);
+    parsed_lines_++;
+    position = newline + 1;
+  }
+
+  entry.partial.clear();
+  if (position < content.size()) {
+    auto state = entry.state;
+    parseLine(parser, content.substr(position), state, entry.partial);
+  }
+
+  auto base = (appended) ? entry.offset - entry.tail.size() : 0;
+  entry.offset = base + position;
+  auto tail = std::min(position, kLineCacheTailSize);
+  entry.tail = content.substr(position - tail, tail);
+  entry.file = std::move(file);
+  entry.identity = std::move(identity);
+  rows_ += entry.rows.size() - rows;
+
+  results.insert(results.end(), entry.rows.begin(), entry.rows.end());
+  results.insert(results.end(), entry.partial.begin(), entry.partial.end());
+  evict();
+  return Status(0, "OK");
+}
+
+void FileLineCache::evict() {
+  while (rows_ > FLAGS_line_cache_max_rows && !entries_.empty()) {
+    auto oldest = entries_.begin();
+    for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+      if (it->second.used < oldest->second.used) {
+        oldest = it;
+      }
+    }
+    rows_ -= oldest->second.rows.size();
+    entries_.erase(oldest);
+  }
+}
+
+void FileLineCache::clear() {
+  WriteLock lock(mutex_);
+  entries_.clear();
+  rows_ = 0;
+}
+}
+}
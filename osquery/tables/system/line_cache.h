@@ -0,0 +1,122 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief Parse a single line of a file into rows.
+ *
+ * Lines are given trimmed, empty lines are skipped. The state is kept for the
+ * next line of the same file, such as a preceding history timestamp.
+ */
+using LineParser = std::function<void(
+    const std::string& line, std::string& state, QueryData& rows)>;
+
+/// The rows parsed from a file, see FileLineCache.
+struct FileLineCacheEntry {
+  /// The device, inode, size, and modification and change times.
+  std::string identity;
+
+  /// The device and inode, a file appended to keeps its identity.
+  std::string file;
+
+  /// The bytes parsed into complete lines.
+  size_t offset{0};
+
+  /// The last parsed bytes, compared again before parsing appended bytes.
+  std::string tail;
+
+  /// Parser state after the last complete line.
+  std::string state;
+
+  /// Rows from complete lines.
+  QueryData rows;
+
+  /// Rows from a last line without a newline, parsed again if appended to.
+  QueryData partial;
+
+  /// The request count when the entry was last used.
+  size_t used{0};
+};
+
+/**
+ * @brief Parsed rows of line-oriented files such as histories and key files.
+ *
+ * Tables reading a file in every user's home directory, such as
+ * shell_history and authorized_keys, parse each file again for every query.
+ * The cache keeps each file's rows until the file changes. If a file keeps
+ * its inode and grows, and the last parsed bytes are unchanged, only the
+ * appended bytes are read and parsed.
+ */
+class FileLineCache : private boost::noncopyable {
+ public:
+  static FileLineCache& instance() {
+    static FileLineCache cache;
+    return cache;
+  }
+
+  /**
+   * @brief Get the rows parsed from each line of a file.
+   *
+   * @param key identifies the parser and any values it adds to rows.
+   * @param path the file to read, using readFileBlocks.
+   * @param parser called for each new line.
+   * @param results output, the rows are appended.
+   * @return failure if the file could not be read.
+   */
+  Status get(const std::string& key,
+             const std::string& path,
+             const LineParser& parser,
+             QueryData& results);
+
+  /// The number of complete lines parsed, used to inspect the cache.
+  size_t parsedLines() {
+    WriteLock lock(mutex_);
+    return parsed_lines_;
+  }
+
+  /// Remove every entry.
+  void clear();
+
+ private:
+  FileLineCache() {}
+
+  /// Remove the least recently used entries beyond the row limit.
+  void evict();
+
+ private:
+  /// Parsed files keyed by the caller's key and the path.
+  std::map<std::pair<std::string, std::string>, FileLineCacheEntry> entries_;
+
+  /// The rows held across all entries.
+  size_t rows_{0};
+
+  /// The number of requests, used to order entries by use.
+  size_t requests_{0};
+
+  /// The number of complete lines parsed.
+  size_t parsed_lines_{0};
+
+  Mutex mutex_;
+};
+}
+}
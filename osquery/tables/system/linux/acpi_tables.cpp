@@ -11,10 +11,13 @@
 #include <boost/filesystem.hpp>
 
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/filesystem.h>
 #include <osquery/hash.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/linux/boot_cache.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
@@ -22,6 +25,9 @@ namespace tables {
 
 const std::string kLinuxACPIPath = "/sys/firmware/acpi/tables";
 
+/// The table rows are kept for the remainder of the boot with this key.
+const std::string kACPIBootCacheKey = "acpi_tables";
+
 void genACPITable(const std::string& table, QueryData& results) {
   fs::path table_path = table;
 
@@ -58,6 +64,14 @@ void genACPITable(const std::string& table, QueryData& results) {
 QueryData genACPITables(QueryContext& context) {
   QueryData results;
 
+  // The firmware tables cannot change without a reboot.
+  std::string content;
+  if (BootCache::instance().get(kACPIBootCacheKey, content) &&
+      deserializeQueryDataJSON(content, results).ok()) {
+    return results;
+  }
+  results.clear();
+
   // In Linux, hopefully the ACPI tables are parsed and exposed as nodes.
   std::vector<std::string> tables;
   auto status = osquery::listFilesInDirectory(kLinuxACPIPath, tables);
@@ -70,6 +84,17 @@ QueryData genACPITables(QueryContext& context) {
     genACPITable(table, results);
   }
 
+  // Tables that could not be read are not stored, they may be readable later.
+  bool complete = true;
+  for (const auto& row : results) {
+    if (row.at("size") == "-1") {
+      complete = false;
+    }
+  }
+
+  if (complete && serializeQueryDataJSON(results, content).ok()) {
+    BootCache::instance().set(kACPIBootCacheKey, content);
+  }
   return results;
 }
 }
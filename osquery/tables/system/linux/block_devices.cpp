@@ -19,6 +19,8 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/linux/hardware_cache.h"
+
 namespace osquery {
 namespace tables {
 
@@ -81,11 +83,7 @@ static void getBlockDevice(struct udev_device *dev, QueryData &results) {
   results.push_back(r);
 }
 
-QueryData genBlockDevs(QueryContext &context) {
-  if (getuid() || geteuid()) {
-    VLOG(1) << "Not running as root, some column data not available";
-  }
-
+static QueryData enumerateBlockDevs() {
   QueryData results;
 
   struct udev *udev = udev_new();
@@ -113,5 +111,13 @@ QueryData genBlockDevs(QueryContext &context) {
 
   return results;
 }
+
+QueryData genBlockDevs(QueryContext &context) {
+  if (getuid() || geteuid()) {
+    VLOG(1) << "Not running as root, some column data not available";
+  }
+
+  return HardwareCache::instance().get("block", enumerateBlockDevs);
+}
 }
 }
@@ -0,0 +1,92 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <boost/algorithm/string/trim.hpp>
+
+#include <osquery/database.h>
+#include <osquery/filesystem.h>
+
+#include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/boot_cache.h"
+
+namespace osquery {
+namespace tables {
+
+/// A random UUID generated by the kernel at boot.
+const std::string kLinuxBootIDPath = "/proc/sys/kernel/random/boot_id";
+
+/// Boot-scoped values are stored in the settings domain with this prefix.
+const std::string kBootCacheKeyPrefix = "boot_cache.";
+
+const std::string& BootCache::getBootID() {
+  if (!read_boot_id_) {
+    read_boot_id_ = true;
+    if (readFile(kLinuxBootIDPath, boot_id_).ok()) {
+      boost::algorithm::trim(boot_id_);
+    } else {
+      boot_id_.clear();
+    }
+  }
+  return boot_id_;
+}
+
+bool BootCache::get(const std::string& key, std::string& value) {
+  WriteLock lock(mutex_);
+  auto it = values_.find(key);
+  if (it != values_.end()) {
+    value = it->second;
+    return true;
+  }
+
+  const auto& boot_id = getBootID();
+  if (boot_id.empty()) {
+    return false;
+  }
+
+  // The stored value is the boot_id, a newline, then the encoded value.
+  std::string content;
+  if (!getDatabaseValue(kPersistentSettings, kBootCacheKeyPrefix + key, content)
+           .ok()) {
+    return false;
+  }
+
+  auto delimiter = content.find('\n');
+  if (delimiter == std::string::npos ||
+      content.compare(0, delimiter, boot_id) != 0) {
+    // Stored during a previous boot.
+    return false;
+  }
+
+  value = base64Decode(content.substr(delimiter + 1));
+  values_[key] = value;
+  return true;
+}
+
+void BootCache::set(const std::string& key, const std::string& value) {
+  WriteLock lock(mutex_);
+  values_[key] = value;
+
+  const auto& boot_id = getBootID();
+  if (boot_id.empty()) {
+    // The value cannot be associated with a boot, keep it in memory only.
+    return;
+  }
+
+  setDatabaseValue(kPersistentSettings,
+                   kBootCacheKeyPrefix + key,
+                   boot_id + "\n" + base64Encode(value));
+}
+
+void BootCache::clear() {
+  WriteLock lock(mutex_);
+  values_.clear();
+}
+}
+}
@@ -0,0 +1,73 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief Values that are constant for the life of a boot.
+ *
+ * Firmware structures such as the SMBIOS and ACPI tables cannot change
+ * without a reboot. Values are kept in memory and in the database, tagged
+ * with the kernel's boot_id, so each boot reads the firmware at most once
+ * across osqueryd restarts and osqueryi invocations.
+ */
+class BootCache : private boost::noncopyable {
+ public:
+  static BootCache& instance() {
+    static BootCache cache;
+    return cache;
+  }
+
+  /**
+   * @brief Get a value stored during this boot.
+   *
+   * @param key the cache key, unique to the value's producer.
+   * @param value output, the stored value, which may be binary.
+   * @return false if the value was not stored during this boot.
+   */
+  bool get(const std::string& key, std::string& value);
+
+  /// Store a value for the remainder of this boot.
+  void set(const std::string& key, const std::string& value);
+
+  /// Drop the values kept in memory, the database copies are kept.
+  void clear();
+
+ private:
+  BootCache() = default;
+
+  /// Read the boot_id on first use, empty if the kernel does not expose it.
+  const std::string& getBootID();
+
+ private:
+  /// The boot_id, read once since it cannot change within a process.
+  std::string boot_id_;
+
+  /// Set after the boot_id is read.
+  bool read_boot_id_{false};
+
+  /// Values read or stored by this process.
+  std::map<std::string, std::string> values_;
+
+  /// Protect the values.
+  Mutex mutex_;
+};
+}
+}
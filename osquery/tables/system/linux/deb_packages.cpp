@@ -24,11 +24,16 @@ extern "C" {
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/package_cache.h"
+
 namespace osquery {
 namespace tables {
 
 static const std::string kDPKGPath{"/var/lib/dpkg"};
 
+/// The DPKG status database, replaced when packages change.
+static const std::string kDPKGStatus{kDPKGPath + "/status"};
+
 /// A comparator used to sort the packages array.
 int pkg_sorter(const void *a, const void *b) {
   const struct pkginfo *pa = *(const struct pkginfo **)a;
@@ -153,14 +158,9 @@ void extractDebPackageInfo(const struct pkginfo *pkg, QueryData &results) {
   results.push_back(r);
 }
 
-QueryData genDebPackages(QueryContext &context) {
+/// Read every installed package from the DPKG database.
+static QueryData genDebPackagesFromDatabase() {
   QueryData results;
-
-  if (!osquery::isDirectory(kDPKGPath)) {
-    TLOG << "Cannot find DPKG database: " << kDPKGPath;
-    return results;
-  }
-
   struct pkg_array packages;
   dpkg_setup(&packages);
 
@@ -179,5 +179,16 @@ QueryData genDebPackages(QueryContext &context) {
   dpkg_teardown(&packages);
   return results;
 }
+
+QueryData genDebPackages(QueryContext &context) {
+  if (!osquery::isDirectory(kDPKGPath)) {
+    TLOG << "Cannot find DPKG database: " << kDPKGPath;
+    return {};
+  }
+
+  // The status database is parsed again only if it changed.
+  static PackageInventoryCache cache(kDPKGStatus);
+  return cache.get(genDebPackagesFromDatabase);
+}
 }
 }
@@ -8,39 +8,41 @@
  *
  */
 
-#include <set>
-#include <mutex>
-
-#include <grp.h>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/nss_cache.h"
+
 namespace osquery {
 namespace tables {
 
-std::mutex grpEnumerationMutex;
+void genGroup(const GroupEntry &group, QueryData &results) {
+  Row r;
+  r["gid"] = INTEGER(group.gid);
+  r["gid_signed"] = INTEGER((int32_t)group.gid);
+  r["groupname"] = group.groupname;
+  results.push_back(r);
+}
 
 QueryData genGroups(QueryContext &context) {
-  std::lock_guard<std::mutex> lock(grpEnumerationMutex);
   QueryData results;
-  struct group *grp = nullptr;
-  std::set<long> groups_in;
 
-  setgrent();
-  while ((grp = getgrent()) != nullptr) {
-    if (std::find(groups_in.begin(), groups_in.end(), grp->gr_gid) ==
-        groups_in.end()) {
-      Row r;
-      r["gid"] = INTEGER(grp->gr_gid);
-      r["gid_signed"] = INTEGER((int32_t) grp->gr_gid);
-      r["groupname"] = TEXT(grp->gr_name);
-      results.push_back(r);
-      groups_in.insert(grp->gr_gid);
+  auto &cache = NSSCache::instance();
+  if (context.constraints["gid"].exists(EQUALS)) {
+    GroupEntry group;
+    auto gids = context.constraints["gid"].getAll(EQUALS);
+    for (const auto &gid : gids) {
+      long agid{0};
+      if (safeStrtol(gid, 10, agid) && cache.getGroup(agid, group)) {
+        genGroup(group, results);
+      }
+    }
+  } else {
+    for (const auto &group : *cache.getGroups()) {
+      genGroup(group, results);
     }
   }
-  endgrent();
-  groups_in.clear();
 
   return results;
 }
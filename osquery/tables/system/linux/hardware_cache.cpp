@@ -0,0 +1,41 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include "osquery/events/linux/udev.h"
+#include "osquery/tables/system/linux/hardware_cache.h"
+
+namespace osquery {
+namespace tables {
+
+QueryData HardwareCache::get(const std::string& subsystem,
+                             const std::function<QueryData()>& generate) {
+  // Read the generation first, an event during the enumeration invalidates.
+  size_t generation = 0;
+  if (!UdevEventPublisher::getDeviceGeneration(generation)) {
+    return generate();
+  }
+
+  WriteLock lock(mutex_);
+  auto it = rows_.find(subsystem);
+  if (it != rows_.end() && it->second.first == generation) {
+    return it->second.second;
+  }
+
+  auto results = generate();
+  rows_[subsystem] = std::make_pair(generation, results);
+  return results;
+}
+
+void HardwareCache::clear() {
+  WriteLock lock(mutex_);
+  rows_.clear();
+}
+}
+}
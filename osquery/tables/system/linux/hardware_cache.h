@@ -0,0 +1,67 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief Device inventory rows shared by the hardware tables.
+ *
+ * The block_devices, pci_devices, and usb_devices tables enumerate every
+ * device of a udev subsystem and read its properties and attributes. The
+ * inventory rarely changes, so the rows are kept until the udev publisher
+ * receives a device add or remove event.
+ *
+ * If the publisher is not receiving, for example with --disable_events, the
+ * rows are generated for each query.
+ */
+class HardwareCache : private boost::noncopyable {
+ public:
+  static HardwareCache& instance() {
+    static HardwareCache cache;
+    return cache;
+  }
+
+  /**
+   * @brief Get the rows of a subsystem's devices.
+   *
+   * @param subsystem the udev subsystem, such as "block".
+   * @param generate called to enumerate the devices if no rows are current.
+   * @return the current rows.
+   */
+  QueryData get(const std::string& subsystem,
+                const std::function<QueryData()>& generate);
+
+  /// Drop every subsystem's rows.
+  void clear();
+
+ private:
+  HardwareCache() = default;
+
+ private:
+  /// Rows keyed by subsystem, with the device generation when enumerated.
+  std::map<std::string, std::pair<size_t, QueryData>> rows_;
+
+  /// Protect the rows, enumerations are serialized per cache.
+  Mutex mutex_;
+};
+}
+}
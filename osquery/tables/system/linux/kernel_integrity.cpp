@@ -1,9 +1,6 @@
 // Copyright 2004-present Facebook. All Rights Reserved.
 
-#include <fstream>
-
 #include <boost/algorithm/string/trim.hpp>
-#include <boost/lexical_cast.hpp>
 
 #include <osquery/core.h>
 #include <osquery/database.h>
@@ -11,44 +8,68 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/linux/kernel_modules.h"
+
 namespace osquery {
 namespace tables {
 
-const std::string kKernelSyscallAddrModifiedPath = "/sys/kernel/camb/syscall_addr_modified";
+const std::string kKernelSyscallAddrModifiedPath =
+    "/sys/kernel/camb/syscall_addr_modified";
 const std::string kKernelTextHashPath = "/sys/kernel/camb/text_segment_hash";
 
-QueryData genKernelIntegrity(QueryContext &context) {
-  QueryData results;
-  Row r;
+/// The last check and the loaded modules when it was performed.
+static Row kKernelIntegrityRow;
+static std::string kKernelIntegrityModules;
+
+/// Protect the last check.
+static Mutex kKernelIntegrityMutex;
+
+static Status checkKernelIntegrity(Row &r) {
   std::string content;
-  std::string text_segment_hash;
-  std::string syscall_addr_modified;
-
-  // Get an integral value, 0 or 1, for whether a syscall table pointer is modified.
-  auto f1 = osquery::readFile(kKernelSyscallAddrModifiedPath, content);
-  if (f1.ok()) {
-    boost::trim(content);
-    syscall_addr_modified = content;
-  } else {
-    VLOG(1) << "Cannot read file: " << kKernelSyscallAddrModifiedPath;
-    return results;
+
+  // Get an integral value, 0 or 1, for whether a syscall table pointer is
+  // modified.
+  if (!osquery::readFile(kKernelSyscallAddrModifiedPath, content).ok()) {
+    return Status(1, "Cannot read file: " + kKernelSyscallAddrModifiedPath);
   }
+  boost::trim(content);
+  r["sycall_addr_modified"] = content;
 
   // Get the hash value for the kernel's .text memory segment
-  auto f2 = osquery::readFile(kKernelTextHashPath, content);
-  if (f2.ok()) {
-    boost::trim(content);
-    text_segment_hash = content;
-  } else {
-    VLOG(1) << "Cannot read file: " << kKernelTextHashPath;
-    return results;
+  if (!osquery::readFile(kKernelTextHashPath, content).ok()) {
+    return Status(1, "Cannot read file: " + kKernelTextHashPath);
   }
+  boost::trim(content);
+  r["text_segment_hash"] = content;
+  return Status(0, "OK");
+}
 
-  r["sycall_addr_modified"] = syscall_addr_modified;
-  r["text_segment_hash"] = text_segment_hash;
-  results.push_back(r);
+QueryData genKernelIntegrity(QueryContext &context) {
+  // Patching the syscall table or kernel text requires loading a module.
+  // The check is performed again only when the loaded modules change.
+  std::vector<KernelModule> modules;
+  std::string identity;
+  if (readKernelModules(modules).ok()) {
+    identity = getKernelModulesIdentity(modules);
+  }
+
+  WriteLock lock(kKernelIntegrityMutex);
+  if (!identity.empty() && identity == kKernelIntegrityModules &&
+      !kKernelIntegrityRow.empty()) {
+    return {kKernelIntegrityRow};
+  }
+
+  Row r;
+  auto status = checkKernelIntegrity(r);
+  if (!status.ok()) {
+    VLOG(1) << status.getMessage();
+    kKernelIntegrityRow.clear();
+    return {};
+  }
 
-  return results;
+  kKernelIntegrityRow = r;
+  kKernelIntegrityModules = std::move(identity);
+  return {r};
 }
 }
 }
@@ -10,59 +10,108 @@
 
 #include <fstream>
 
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
-#include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/kernel_modules.h"
 
 namespace osquery {
 namespace tables {
 
 static const std::string kKernelModulePath = "/proc/modules";
 
-QueryData genKernelModules(QueryContext& context) {
-  QueryData results;
+/// Get the next space-delimited field of a line.
+static bool nextModuleField(const std::string& line,
+                            size_t& offset,
+                            std::string& field) {
+  while (offset < line.size() && line[offset] == ' ') {
+    offset++;
+  }
+  if (offset >= line.size()) {
+    return false;
+  }
 
-  if (!pathExists(kKernelModulePath).ok()) {
-    VLOG(1) << "Cannot find kernel modules proc file: " << kKernelModulePath;
-    return {};
+  auto end = line.find(' ', offset);
+  if (end == std::string::npos) {
+    end = line.size();
   }
+  field.assign(line, offset, end - offset);
+  offset = end;
 
-  // Cannot seek to the end of procfs.
-  std::ifstream fd(kKernelModulePath, std::ios::in);
-  if (!fd) {
-    VLOG(1) << "Cannot read kernel modules from: " << kKernelModulePath;
-    return {};
+  // Clean up the dependency delimiters.
+  if (!field.empty() && field.back() == ',') {
+    field.pop_back();
   }
+  return true;
+}
 
-  auto module_info = std::string(std::istreambuf_iterator<char>(fd),
-                                 std::istreambuf_iterator<char>());
+void parseKernelModules(const std::string& content,
+                        std::vector<KernelModule>& modules) {
+  size_t start = 0;
+  while (start < content.size()) {
+    auto end = content.find('\n', start);
+    if (end == std::string::npos) {
+      end = content.size();
+    }
+    auto line = content.substr(start, end - start);
+    start = end + 1;
 
-  for (const auto& module : osquery::split(module_info, "\n")) {
-    Row r;
-    auto module_info = osquery::split(module, " ");
-    if (module_info.size() < 6) {
+    // Each line is: name size refcount used_by status address [taints].
+    KernelModule module;
+    std::string refcount;
+    size_t offset = 0;
+    if (!nextModuleField(line, offset, module.name) ||
+        !nextModuleField(line, offset, module.size) ||
+        !nextModuleField(line, offset, refcount) ||
+        !nextModuleField(line, offset, module.used_by) ||
+        !nextModuleField(line, offset, module.status) ||
+        !nextModuleField(line, offset, module.address)) {
       // Interesting error case, this module line is not well formed.
       continue;
     }
+    modules.push_back(std::move(module));
+  }
+}
 
-    for (auto& detail : module_info) {
-      // Clean up the delimiters
-      boost::trim(detail);
-      if (detail.back() == ',') {
-        detail.pop_back();
-      }
-    }
+Status readKernelModules(std::vector<KernelModule>& modules) {
+  // Cannot seek to the end of procfs.
+  std::ifstream fd(kKernelModulePath, std::ios::in);
+  if (!fd) {
+    return Status(1, "Cannot read kernel modules from: " + kKernelModulePath);
+  }
 
-    r["name"] = module_info[0];
-    r["size"] = module_info[1];
-    r["used_by"] = module_info[3];
-    r["status"] = module_info[4];
-    r["address"] = module_info[5];
+  auto content = std::string(std::istreambuf_iterator<char>(fd),
+                             std::istreambuf_iterator<char>());
+  parseKernelModules(content, modules);
+  return Status(0, "OK");
+}
+
+std::string getKernelModulesIdentity(const std::vector<KernelModule>& modules) {
+  std::string identity;
+  for (const auto& module : modules) {
+    identity += module.name + "@" + module.address + "\n";
+  }
+  return identity;
+}
+
+QueryData genKernelModules(QueryContext& context) {
+  std::vector<KernelModule> modules;
+  auto status = readKernelModules(modules);
+  if (!status.ok()) {
+    VLOG(1) << status.getMessage();
+    return {};
+  }
+
+  QueryData results;
+  for (const auto& module : modules) {
+    Row r;
+    r["name"] = module.name;
+    r["size"] = module.size;
+    r["used_by"] = module.used_by;
+    r["status"] = module.status;
+    r["address"] = module.address;
     results.push_back(r);
   }
 
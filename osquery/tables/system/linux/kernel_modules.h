@@ -0,0 +1,45 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <osquery/status.h>
+
+namespace osquery {
+namespace tables {
+
+/// A loaded module's line from /proc/modules.
+struct KernelModule {
+  std::string name;
+  std::string size;
+  std::string used_by;
+  std::string status;
+  std::string address;
+};
+
+/// Parse the content of /proc/modules, malformed lines are skipped.
+void parseKernelModules(const std::string& content,
+                        std::vector<KernelModule>& modules);
+
+/// Read and parse /proc/modules.
+Status readKernelModules(std::vector<KernelModule>& modules);
+
+/**
+ * @brief Identify the set of loaded modules.
+ *
+ * The identity is the module names and load addresses. It changes when a
+ * module is loaded or unloaded, but not when reference counts change.
+ */
+std::string getKernelModulesIdentity(const std::vector<KernelModule>& modules);
+}
+}
@@ -9,23 +9,61 @@
  */
 
 #include <mntent.h>
-#include <sys/vfs.h>
+
+#include <chrono>
+#include <map>
+#include <memory>
 
 #include <osquery/core.h>
 #include <osquery/filesystem.h>
+#include <osquery/flags.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/linux/statfs_pool.h"
+
 namespace osquery {
+
+FLAG(uint64,
+     mounts_statfs_timeout,
+     1000,
+     "Milliseconds a mounts query waits for the statfs of all mounts (0 waits "
+     "forever)");
+
+FLAG(uint64,
+     mounts_stale_interval,
+     300,
+     "Seconds to skip the statfs of a mount that timed out");
+
 namespace tables {
 
+/// Reuse the rows of a scan within the same scheduler tick.
+const std::chrono::seconds kMountsCacheDuration{1};
+
+using Clock = std::chrono::steady_clock;
+
+/// The most recent scan, shared by the scans within the same tick.
+static Mutex kMountsCacheMutex;
+static Clock::time_point kMountsCacheTime;
+static QueryData kMountsCache;
+
 QueryData genMounts(QueryContext &context) {
-  QueryData results;
+  WriteLock lock(kMountsCacheMutex);
+  auto start = Clock::now();
+  if (!kMountsCache.empty() &&
+      start < kMountsCacheTime + kMountsCacheDuration) {
+    return kMountsCache;
+  }
 
+  QueryData results;
   FILE *mounts = setmntent("/proc/mounts", "r");
   if (mounts == nullptr) {
     return {};
   }
 
+  // Request every statfs first, a query waits for one timeout at most.
+  auto& pool = StatfsPool::instance();
+  std::vector<std::shared_ptr<StatfsRequest>> requests;
+  std::map<std::string, std::shared_ptr<StatfsRequest>> paths;
   char real_path[PATH_MAX + 1] = {0};
   struct mntent *ent = nullptr;
   while ((ent = getmntent(mounts))) {
@@ -38,20 +76,43 @@ QueryData genMounts(QueryContext &context) {
     r["type"] = std::string(ent->mnt_type);
     r["flags"] = std::string(ent->mnt_opts);
 
-    struct statfs st;
-    if (!statfs(ent->mnt_dir, &st)) {
-      r["blocks_size"] = BIGINT(st.f_bsize);
-      r["blocks"] = BIGINT(st.f_blocks);
-      r["blocks_free"] = BIGINT(st.f_bfree);
-      r["blocks_available"] = BIGINT(st.f_bavail);
-      r["inodes"] = BIGINT(st.f_files);
-      r["inodes_free"] = BIGINT(st.f_ffree);
+    // A path mounted over several times is requested once.
+    auto path = paths.find(r.at("path"));
+    if (path == paths.end()) {
+      path = paths.emplace(r.at("path"), pool.request(r.at("path"))).first;
     }
-
+    requests.push_back(path->second);
     results.push_back(std::move(r));
   }
   endmntent(mounts);
 
+  auto deadline =
+      start + std::chrono::milliseconds(FLAGS_mounts_statfs_timeout);
+  for (size_t i = 0; i < results.size(); i++) {
+    auto& r = results[i];
+    auto& request = requests[i];
+    if (request == nullptr || !pool.wait(request, deadline)) {
+      // A mount that did not answer in time has no capacity columns.
+      r["stale"] = INTEGER(1);
+      continue;
+    }
+
+    r["stale"] = INTEGER(0);
+    if (!request->ok) {
+      continue;
+    }
+
+    const auto& st = request->st;
+    r["blocks_size"] = BIGINT(st.f_bsize);
+    r["blocks"] = BIGINT(st.f_blocks);
+    r["blocks_free"] = BIGINT(st.f_bfree);
+    r["blocks_available"] = BIGINT(st.f_bavail);
+    r["inodes"] = BIGINT(st.f_files);
+    r["inodes_free"] = BIGINT(st.f_ffree);
+  }
+
+  kMountsCache = results;
+  kMountsCacheTime = Clock::now();
   return results;
 }
 }
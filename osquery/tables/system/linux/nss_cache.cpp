@@ -0,0 +1,326 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <errno.h>
+#include <grp.h>
+#include <pwd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <functional>
+#include <set>
+
+#include <osquery/flags.h>
+#include <osquery/system.h>
+
+#include "osquery/tables/system/linux/nss_cache.h"
+
+namespace osquery {
+
+FLAG(uint64,
+     nss_cache_ttl,
+     60,
+     "Seconds NSS user and group entries are reused (default 60)");
+
+namespace tables {
+
+const std::string kNSSUsersPath = "/etc/passwd";
+const std::string kNSSGroupsPath = "/etc/group";
+
+/// The reentrant lookup buffer size if the system does not suggest one.
+const size_t kNSSBufferSize = 16384;
+
+/// Serialize enumerations, getpwent and getgrent are not reentrant.
+static Mutex kPasswdEnumerationMutex;
+static Mutex kGroupEnumerationMutex;
+
+/// An entry map value, the time the entry was read and the entry or nullptr.
+template <typename T>
+using NSSEntry = std::pair<size_t, std::shared_ptr<T>>;
+
+/// The inode, size, and modification time of a local database file.
+static std::string getFileIdentity(const std::string& path) {
+  struct stat file;
+  if (::stat(path.c_str(), &file) != 0) {
+    return "";
+  }
+  return std::to_string(file.st_ino) + ":" + std::to_string(file.st_size) +
+         ":" + std::to_string(file.st_mtim.tv_sec) + "." +
+         std::to_string(file.st_mtim.tv_nsec);
+}
+
+static inline bool isCurrent(size_t time) {
+  return time + FLAGS_nss_cache_ttl > getUnixTime();
+}
+
+static std::shared_ptr<UserEntry> getUserEntry(const struct passwd* pwd) {
+  auto user = std::make_shared<UserEntry>();
+  user->uid = pwd->pw_uid;
+  user->gid = pwd->pw_gid;
+  if (pwd->pw_name != nullptr) {
+    user->username = pwd->pw_name;
+  }
+  if (pwd->pw_gecos != nullptr) {
+    user->description = pwd->pw_gecos;
+  }
+  if (pwd->pw_dir != nullptr) {
+    user->directory = pwd->pw_dir;
+  }
+  if (pwd->pw_shell != nullptr) {
+    user->shell = pwd->pw_shell;
+  }
+  return user;
+}
+
+static std::shared_ptr<GroupEntry> getGroupEntry(const struct group* grp) {
+  auto group = std::make_shared<GroupEntry>();
+  group->gid = grp->gr_gid;
+  if (grp->gr_name != nullptr) {
+    group->groupname = grp->gr_name;
+  }
+  return group;
+}
+
+/**
+ * @brief Call a reentrant NSS lookup, growing the buffer as needed.
+ *
+ * @param lookup calls a getpwuid_r-style function with a buffer and size.
+ */
+static void lookupNSS(size_t hint,
+                      const std::function<int(char*, size_t)>& lookup) {
+  std::vector<char> buffer((hint > 0) ? hint : kNSSBufferSize);
+  while (lookup(buffer.data(), buffer.size()) == ERANGE) {
+    buffer.resize(buffer.size() * 2);
+  }
+}
+
+static size_t getNSSBufferSize(int name) {
+  auto size = sysconf(name);
+  return (size > 0) ? static_cast<size_t>(size) : 0;
+}
+
+/// Find a current entry, or look it up and keep the result.
+template <typename K, typename T>
+static bool findEntry(Mutex& mutex,
+                      std::map<K, NSSEntry<T>>& entries,
+                      const K& key,
+                      const std::function<std::shared_ptr<T>()>& lookup,
+                      T& entry) {
+  {
+    WriteLock lock(mutex);
+    auto it = entries.find(key);
+    if (it != entries.end() && isCurrent(it->second.first)) {
+      if (it->second.second == nullptr) {
+        return false;
+      }
+      entry = *it->second.second;
+      return true;
+    }
+  }
+
+  // Request the entry without holding the lock, backends may be remote.
+  auto found = lookup();
+  WriteLock lock(mutex);
+  entries[key] = std::make_pair(getUnixTime(), found);
+  if (found == nullptr) {
+    return false;
+  }
+  entry = *found;
+  return true;
+}
+
+void NSSCache::checkLookups() {
+  auto users_identity = getFileIdentity(kNSSUsersPath);
+  if (users_identity != lookup_users_identity_) {
+    uids_.clear();
+    names_.clear();
+    lookup_users_identity_ = std::move(users_identity);
+  }
+
+  auto groups_identity = getFileIdentity(kNSSGroupsPath);
+  if (groups_identity != lookup_groups_identity_) {
+    gids_.clear();
+    lookup_groups_identity_ = std::move(groups_identity);
+  }
+}
+
+std::shared_ptr<const std::vector<UserEntry>> NSSCache::getUsers() {
+  auto identity = getFileIdentity(kNSSUsersPath);
+  {
+    WriteLock lock(mutex_);
+    if (users_ != nullptr && isCurrent(users_time_) &&
+        identity == users_identity_) {
+      return users_;
+    }
+  }
+
+  auto time = getUnixTime();
+  auto users = std::make_shared<std::vector<UserEntry>>();
+  std::vector<std::shared_ptr<UserEntry>> entries;
+  {
+    WriteLock lock(kPasswdEnumerationMutex);
+    setpwent();
+    struct passwd* pwd = nullptr;
+    while ((pwd = getpwent()) != nullptr) {
+      entries.push_back(getUserEntry(pwd));
+      users->push_back(*entries.back());
+    }
+    endpwent();
+  }
+
+  WriteLock lock(mutex_);
+  users_ = users;
+  users_time_ = time;
+  users_identity_ = identity;
+
+  // Later lookups are answered from the enumeration, the first entry of a
+  // duplicated uid or name is the entry a lookup returns.
+  checkLookups();
+  std::set<uid_t> uids_in;
+  std::set<std::string> names_in;
+  for (const auto& entry : entries) {
+    if (uids_in.insert(entry->uid).second) {
+      uids_[entry->uid] = std::make_pair(time, entry);
+    }
+    if (names_in.insert(entry->username).second) {
+      names_[entry->username] = std::make_pair(time, entry);
+    }
+  }
+  return users_;
+}
+
+std::shared_ptr<const std::vector<GroupEntry>> NSSCache::getGroups() {
+  auto identity = getFileIdentity(kNSSGroupsPath);
+  {
+    WriteLock lock(mutex_);
+    if (groups_ != nullptr && isCurrent(groups_time_) &&
+        identity == groups_identity_) {
+      return groups_;
+    }
+  }
+
+  auto time = getUnixTime();
+  auto groups = std::make_shared<std::vector<GroupEntry>>();
+  std::vector<std::shared_ptr<GroupEntry>> entries;
+  {
+    WriteLock lock(kGroupEnumerationMutex);
+    std::set<gid_t> groups_in;
+    setgrent();
+    struct group* grp = nullptr;
+    while ((grp = getgrent()) != nullptr) {
+      if (groups_in.insert(grp->gr_gid).second) {
+        entries.push_back(getGroupEntry(grp));
+        groups->push_back(*entries.back());
+      }
+    }
+    endgrent();
+  }
+
+  WriteLock lock(mutex_);
+  groups_ = groups;
+  groups_time_ = time;
+  groups_identity_ = identity;
+
+  checkLookups();
+  for (const auto& entry : entries) {
+    gids_[entry->gid] = std::make_pair(time, entry);
+  }
+  return groups_;
+}
+
+bool NSSCache::getUser(uid_t uid, UserEntry& user) {
+  {
+    WriteLock lock(mutex_);
+    checkLookups();
+  }
+
+  return findEntry<uid_t, UserEntry>(
+      mutex_,
+      uids_,
+      uid,
+      [uid]() {
+        std::shared_ptr<UserEntry> entry;
+        lookupNSS(getNSSBufferSize(_SC_GETPW_R_SIZE_MAX),
+                  [uid, &entry](char* buffer, size_t size) {
+                    struct passwd pwd, *result = nullptr;
+                    auto error = getpwuid_r(uid, &pwd, buffer, size, &result);
+                    if (error == 0 && result != nullptr) {
+                      entry = getUserEntry(result);
+                    }
+                    return error;
+                  });
+        return entry;
+      },
+      user);
+}
+
+bool NSSCache::getUser(const std::string& username, UserEntry& user) {
+  {
+    WriteLock lock(mutex_);
+    checkLookups();
+  }
+
+  return findEntry<std::string, UserEntry>(
+      mutex_,
+      names_,
+      username,
+      [&username]() {
+        std::shared_ptr<UserEntry> entry;
+        lookupNSS(getNSSBufferSize(_SC_GETPW_R_SIZE_MAX),
+                  [&username, &entry](char* buffer, size_t size) {
+                    struct passwd pwd, *result = nullptr;
+                    auto error = getpwnam_r(
+                        username.c_str(), &pwd, buffer, size, &result);
+                    if (error == 0 && result != nullptr) {
+                      entry = getUserEntry(result);
+                    }
+                    return error;
+                  });
+        return entry;
+      },
+      user);
+}
+
+bool NSSCache::getGroup(gid_t gid, GroupEntry& group) {
+  {
+    WriteLock lock(mutex_);
+    checkLookups();
+  }
+
+  return findEntry<gid_t, GroupEntry>(
+      mutex_,
+      gids_,
+      gid,
+      [gid]() {
+        std::shared_ptr<GroupEntry> entry;
+        lookupNSS(getNSSBufferSize(_SC_GETGR_R_SIZE_MAX),
+                  [gid, &entry](char* buffer, size_t size) {
+                    struct group grp, *result = nullptr;
+                    auto error = getgrgid_r(gid, &grp, buffer, size, &result);
+                    if (error == 0 && result != nullptr) {
+                      entry = getGroupEntry(result);
+                    }
+                    return error;
+                  });
+        return entry;
+      },
+      group);
+}
+
+void NSSCache::clear() {
+  WriteLock lock(mutex_);
+  users_ = nullptr;
+  groups_ = nullptr;
+  uids_.clear();
+  names_.clear();
+  gids_.clear();
+}
+}
+}
@@ -0,0 +1,112 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+
+namespace osquery {
+namespace tables {
+
+/// A passwd entry from the NSS user directory.
+struct UserEntry {
+  uid_t uid{0};
+  gid_t gid{0};
+  std::string username;
+  std::string description;
+  std::string directory;
+  std::string shell;
+};
+
+/// A group entry from the NSS group directory.
+struct GroupEntry {
+  gid_t gid{0};
+  std::string groupname;
+};
+
+/**
+ * @brief NSS user and group entries shared by the user tables.
+ *
+ * The users, groups, and user_groups tables, and every query joining them,
+ * enumerated the NSS databases. With an LDAP or SSSD backend each
+ * enumeration is a remote request for every entry. Enumerations are kept
+ * for --nss_cache_ttl seconds, and enumerated again sooner when the local
+ * /etc/passwd or /etc/group file changes.
+ *
+ * Lookups by uid, username, or gid use the enumerated entries if they are
+ * current, otherwise a single entry is requested and kept for the same TTL.
+ */
+class NSSCache : private boost::noncopyable {
+ public:
+  static NSSCache& instance() {
+    static NSSCache cache;
+    return cache;
+  }
+
+  /// Every user, in enumeration order.
+  std::shared_ptr<const std::vector<UserEntry>> getUsers();
+
+  /// Every group, unique by gid, in enumeration order.
+  std::shared_ptr<const std::vector<GroupEntry>> getGroups();
+
+  /// Find a user without enumerating the directory.
+  bool getUser(uid_t uid, UserEntry& user);
+
+  /// Find a user by name without enumerating the directory.
+  bool getUser(const std::string& username, UserEntry& user);
+
+  /// Find a group without enumerating the directory.
+  bool getGroup(gid_t gid, GroupEntry& group);
+
+  /// Drop every entry, the next request reads the NSS databases.
+  void clear();
+
+ private:
+  NSSCache() = default;
+
+  /// Drop point lookups made before /etc/passwd or /etc/group changed.
+  void checkLookups();
+
+ private:
+  /// Enumerated users and the time and /etc/passwd identity when read.
+  std::shared_ptr<const std::vector<UserEntry>> users_;
+  size_t users_time_{0};
+  std::string users_identity_;
+
+  /// Enumerated groups and the time and /etc/group identity when read.
+  std::shared_ptr<const std::vector<GroupEntry>> groups_;
+  size_t groups_time_{0};
+  std::string groups_identity_;
+
+  /// Entries by uid, username, and gid, with the time they were read.
+  /// Enumerations fill these, and a point lookup adds its entry. A missing
+  /// entry is kept so repeated lookups do not reach the backend.
+  std::map<uid_t, std::pair<size_t, std::shared_ptr<UserEntry>>> uids_;
+  std::map<std::string, std::pair<size_t, std::shared_ptr<UserEntry>>> names_;
+  std::map<gid_t, std::pair<size_t, std::shared_ptr<GroupEntry>>> gids_;
+
+  /// The identities of the files when the point lookups were made.
+  std::string lookup_users_identity_;
+  std::string lookup_groups_identity_;
+
+  /// Protect the entries, enumerations are serialized by their own locks.
+  Mutex mutex_;
+};
+}
+}
@@ -16,6 +16,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/events/linux/udev.h"
+#include "osquery/tables/system/linux/hardware_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -27,7 +28,7 @@ const std::string kPCIKeyModel = "ID_MODEL_FROM_DATABASE";
 const std::string kPCIKeyID = "PCI_ID";
 const std::string kPCIKeyDriver = "DRIVER";
 
-QueryData genPCIDevices(QueryContext &context) {
+static QueryData enumeratePCIDevices() {
   QueryData results;
 
   auto udev_handle = udev_new();
@@ -84,5 +85,9 @@ QueryData genPCIDevices(QueryContext &context) {
 
   return results;
 }
+
+QueryData genPCIDevices(QueryContext &context) {
+  return HardwareCache::instance().get("pci", enumeratePCIDevices);
+}
 }
 }
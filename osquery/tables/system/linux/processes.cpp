@@ -25,6 +25,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/filesystem/linux/proc.h"
 
 namespace osquery {
 namespace tables {
@@ -34,11 +35,10 @@ inline std::string getProcAttr(const std::string& attr,
   return "/proc/" + pid + "/" + attr;
 }
 
-inline std::string readProcCMDLine(const std::string& pid) {
-  auto attr = getProcAttr("cmdline", pid);
-
+inline std::string readProcCMDLine(ProcSnapshot& snapshot,
+                                   const std::string& pid) {
   std::string content;
-  readFile(attr, content);
+  snapshot.attribute(pid, "cmdline", content);
   // Remove \0 delimiters.
   std::replace_if(content.begin(),
                   content.end(),
@@ -97,7 +97,8 @@ Status deletedMatchesInode(const std::string& path, const std::string& pid) {
   }
 }
 
-std::set<std::string> getProcList(const QueryContext& context) {
+std::set<std::string> getProcList(const QueryContext& context,
+                                  ProcSnapshot& snapshot) {
   std::set<std::string> pidlist;
   if (context.constraints.count("pid") > 0 &&
       context.constraints.at("pid").exists(EQUALS)) {
@@ -107,7 +108,7 @@ std::set<std::string> getProcList(const QueryContext& context) {
       }
     }
   } else {
-    osquery::procProcesses(pidlist);
+    pidlist = snapshot.processes();
   }
 
   return pidlist;
@@ -185,7 +186,6 @@ void genProcessMap(const std::string& pid, QueryData& results) {
 
 struct SimpleProcStat {
   // Output from string parsing /proc/<pid>/status.
-  std::string name; // Name:
   std::string real_uid; // Uid: * - - -
   std::string real_gid; // Gid: * - - -
   std::string effective_uid; // Uid: - * - -
@@ -196,7 +196,8 @@ struct SimpleProcStat {
   std::string resident_size; // VmRSS:
   std::string total_size; // VmSize:
 
-  // Output from sring parsing /proc/<pid>/stat.
+  // Output from string parsing /proc/<pid>/stat.
+  std::string name; // (comm)
   std::string state;
   std::string parent;
   std::string group;
@@ -208,93 +209,163 @@ struct SimpleProcStat {
   std::string start_time;
 };
 
-static inline SimpleProcStat getProcStat(const std::string& pid) {
-  SimpleProcStat stat;
+/// Parse /proc/<pid>/stat, the process name is read from the comm field.
+static inline void readProcStat(ProcSnapshot& snapshot,
+                                const std::string& pid,
+                                SimpleProcStat& stat) {
   std::string content;
+  if (!snapshot.attribute(pid, "stat", content).ok()) {
+    return;
+  }
 
-  if (readFile(getProcAttr("stat", pid), content).ok()) {
-    auto start = content.find_last_of(")");
-    // Start parsing stats from ") <MODE>..."
-    if (start == std::string::npos || content.size() <= start + 2) {
-      return stat;
-    }
-    auto details = osquery::split(content.substr(start + 2), " ");
-    if (details.size() <= 19) {
-      return stat;
-    }
+  // The name is within parentheses and may itself include ") ".
+  auto name = content.find("(");
+  auto start = content.find_last_of(")");
+  // Start parsing stats from ") <MODE>..."
+  if (name == std::string::npos || start == std::string::npos ||
+      start < name || content.size() <= start + 2) {
+    return;
+  }
+  stat.name = content.substr(name + 1, start - name - 1);
 
-    stat.state = details.at(0);
-    stat.parent = details.at(1);
-    stat.group = details.at(2);
-    stat.user_time = details.at(11);
-    stat.system_time = details.at(12);
-    stat.nice = details.at(16);
-    stat.threads = details.at(20);
-    try {
-      stat.start_time = TEXT(AS_LITERAL(BIGINT_LITERAL, details.at(19)) / 100);
-    } catch (const boost::bad_lexical_cast& e) {
-      stat.start_time = "-1";
-    }
+  auto details = osquery::split(content.substr(start + 2), " ");
+  if (details.size() <= 19) {
+    return;
   }
 
-  if (readFile(getProcAttr("status", pid), content).ok()) {
-    for (const auto& line : osquery::split(content, "\n")) {
-      // Status lines are formatted: Key: Value....\n.
-      auto detail = osquery::split(line, ":", 1);
-      if (detail.size() != 2) {
-        continue;
-      }
+  stat.state = details.at(0);
+  stat.parent = details.at(1);
+  stat.group = details.at(2);
+  stat.user_time = details.at(11);
+  stat.system_time = details.at(12);
+  stat.nice = details.at(16);
+  stat.threads = details.at(17);
+  try {
+    stat.start_time = TEXT(AS_LITERAL(BIGINT_LITERAL, details.at(19)) / 100);
+  } catch (const boost::bad_lexical_cast& e) {
+    stat.start_time = "-1";
+  }
+}
 
-      // There are specific fields from each detail.
-      if (detail.at(0) == "Name") {
-        stat.name = detail.at(1);
-      } else if (detail.at(0) == "VmRSS") {
-        detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
-        // Memory is reported in kB.
-        stat.resident_size = detail.at(1) + "000";
-      } else if (detail.at(0) == "VmSize") {
-        detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
-        // Memory is reported in kB.
-        stat.total_size = detail.at(1) + "000";
-      } else if (detail.at(0) == "Gid") {
-        // Format is: R E - -
-        auto gid_detail = osquery::split(detail.at(1), "\t");
-        if (gid_detail.size() == 4) {
-          stat.real_gid = gid_detail.at(0);
-          stat.effective_gid = gid_detail.at(1);
-          stat.saved_gid = gid_detail.at(2);
-        }
-      } else if (detail.at(0) == "Uid") {
-        auto uid_detail = osquery::split(detail.at(1), "\t");
-        if (uid_detail.size() == 4) {
-          stat.real_uid = uid_detail.at(0);
-          stat.effective_uid = uid_detail.at(1);
-          stat.saved_uid = uid_detail.at(2);
-        }
+/// Parse the user, group, and memory details from /proc/<pid>/status.
+static inline void readProcStatus(ProcSnapshot& snapshot,
+                                  const std::string& pid,
+                                  SimpleProcStat& stat) {
+  std::string content;
+  if (!snapshot.attribute(pid, "status", content).ok()) {
+    return;
+  }
+
+  for (const auto& line : osquery::split(content, "\n")) {
+    // Status lines are formatted: Key: Value....\n.
+    auto detail = osquery::split(line, ":", 1);
+    if (detail.size() != 2) {
+      continue;
+    }
+
+    // There are specific fields from each detail.
+    if (detail.at(0) == "VmRSS") {
+      detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
+      // Memory is reported in kB.
+      stat.resident_size = detail.at(1) + "000";
+    } else if (detail.at(0) == "VmSize") {
+      detail[1].erase(detail.at(1).end() - 3, detail.at(1).end());
+      // Memory is reported in kB.
+      stat.total_size = detail.at(1) + "000";
+    } else if (detail.at(0) == "Gid") {
+      // Format is: R E - -
+      auto gid_detail = osquery::split(detail.at(1), "\t");
+      if (gid_detail.size() == 4) {
+        stat.real_gid = gid_detail.at(0);
+        stat.effective_gid = gid_detail.at(1);
+        stat.saved_gid = gid_detail.at(2);
+      }
+    } else if (detail.at(0) == "Uid") {
+      auto uid_detail = osquery::split(detail.at(1), "\t");
+      if (uid_detail.size() == 4) {
+        stat.real_uid = uid_detail.at(0);
+        stat.effective_uid = uid_detail.at(1);
+        stat.saved_uid = uid_detail.at(2);
       }
     }
   }
+}
 
-  return stat;
+/// Check a value against a column's equality constraints, if any exist.
+static inline bool matchesEquals(const QueryContext& context,
+                                 const std::string& column,
+                                 const std::string& value) {
+  auto constraints = context.constraints.find(column);
+  if (constraints == context.constraints.end() ||
+      !constraints->second.exists(EQUALS)) {
+    return true;
+  }
+  return constraints->second.getAll(EQUALS).count(value) > 0;
 }
 
-void genProcess(const std::string& pid, QueryData& results) {
-  // Parse the process stat and status.
-  auto proc_stat = getProcStat(pid);
+/**
+ * @brief Generate a process row in stages, each stage only if it is used.
+ *
+ * The first stage reads /proc/<pid>/stat and drops processes that do not
+ * match the name or parent constraints. The status file and the links are
+ * then only read for the columns selected.
+ */
+void genProcess(ProcSnapshot& snapshot,
+                const std::string& pid,
+                const QueryContext& context,
+                QueryData& results) {
+  bool filtered = context.constraints.count("name") > 0 ||
+                  context.constraints.count("parent") > 0;
+
+  SimpleProcStat proc_stat;
+  if (filtered || context.isAnyColumnUsed({"name",
+                                           "parent",
+                                           "pgroup",
+                                           "state",
+                                           "nice",
+                                           "threads",
+                                           "user_time",
+                                           "system_time",
+                                           "start_time"})) {
+    readProcStat(snapshot, pid, proc_stat);
+    if (!matchesEquals(context, "name", proc_stat.name) ||
+        !matchesEquals(context, "parent", proc_stat.parent)) {
+      return;
+    }
+  }
+
+  if (context.isAnyColumnUsed({"uid",
+                               "euid",
+                               "suid",
+                               "gid",
+                               "egid",
+                               "sgid",
+                               "resident_size",
+                               "total_size"})) {
+    readProcStatus(snapshot, pid, proc_stat);
+  }
 
   Row r;
   r["pid"] = pid;
   r["parent"] = proc_stat.parent;
-  r["path"] = readProcLink("exe", pid);
+  if (context.isAnyColumnUsed({"path", "on_disk"})) {
+    r["path"] = readProcLink("exe", pid);
+  }
   r["name"] = proc_stat.name;
   r["pgroup"] = proc_stat.group;
   r["state"] = proc_stat.state;
   r["nice"] = proc_stat.nice;
   r["threads"] = proc_stat.threads;
   // Read/parse cmdline arguments.
-  r["cmdline"] = readProcCMDLine(pid);
-  r["cwd"] = readProcLink("cwd", pid);
-  r["root"] = readProcLink("root", pid);
+  if (context.isColumnUsed("cmdline")) {
+    r["cmdline"] = readProcCMDLine(snapshot, pid);
+  }
+  if (context.isColumnUsed("cwd")) {
+    r["cwd"] = readProcLink("cwd", pid);
+  }
+  if (context.isColumnUsed("root")) {
+    r["root"] = readProcLink("root", pid);
+  }
   r["uid"] = proc_stat.real_uid;
   r["euid"] = proc_stat.effective_uid;
   r["suid"] = proc_stat.saved_uid;
@@ -306,38 +377,40 @@ void genProcess(const std::string& pid, QueryData& results) {
   // the path exists on disk, set on_disk to 1. If the path is not
   // available, set on_disk to -1. If, and only if, the path of the
   // executable is available and the file does NOT exist on disk, set on_disk
-  // to 0.
-  if (r["path"].empty()) {
-    r["on_disk"] = "-1";
-  } else {
-    // The string appended to the exe path when the binary is deleted
-    const std::string kDeletedString = " (deleted)";
-    if (!boost::algorithm::ends_with(r["path"], kDeletedString)) {
-      r["on_disk"] = osquery::pathExists(r["path"]) ? "1" : "0";
+  // to 0. This also removes a " (deleted)" suffix from the path.
+  if (context.isAnyColumnUsed({"path", "on_disk"})) {
+    if (r["path"].empty()) {
+      r["on_disk"] = "-1";
     } else {
-      if (!osquery::pathExists(r["path"])) {
-        // No file exists with the path including " (deleted)", so we can strip
-        // this from the path and set on_disk = 0
-        r["path"].erase(r["path"].size() - kDeletedString.size());
-        r["on_disk"] = "0";
+      // The string appended to the exe path when the binary is deleted
+      const std::string kDeletedString = " (deleted)";
+      if (!boost::algorithm::ends_with(r["path"], kDeletedString)) {
+        r["on_disk"] = osquery::pathExists(r["path"]) ? "1" : "0";
       } else {
-        // Special case in which we have to check the inode to see whether the
-        // process is actually running from a binary file ending with
-        // " (deleted)". See #1607
-        std::string maps_contents;
-        Status deleted = deletedMatchesInode(r["path"], r["pid"]);
-        if (deleted.getCode() == -1) {
-          LOG(ERROR) << deleted.getMessage();
-          r["on_disk"] = "";
-        } else if (deleted.getCode() == 0) {
-          // The process is actually running from a binary ending with
-          // " (deleted)"
-          r["on_disk"] = "1";
-        } else {
-          // There is a collision with a file name ending in " (deleted)", but
-          // that file is not the binary for this process
+        if (!osquery::pathExists(r["path"])) {
+          // No file exists with the path including " (deleted)", so we can
+          // strip this from the path and set on_disk = 0
           r["path"].erase(r["path"].size() - kDeletedString.size());
           r["on_disk"] = "0";
+        } else {
+          // Special case in which we have to check the inode to see whether
+          // the process is actually running from a binary file ending with
+          // " (deleted)". See #1607
+          std::string maps_contents;
+          Status deleted = deletedMatchesInode(r["path"], r["pid"]);
+          if (deleted.getCode() == -1) {
+            LOG(ERROR) << deleted.getMessage();
+            r["on_disk"] = "";
+          } else if (deleted.getCode() == 0) {
+            // The process is actually running from a binary ending with
+            // " (deleted)"
+            r["on_disk"] = "1";
+          } else {
+            // There is a collision with a file name ending in " (deleted)",
+            // but that file is not the binary for this process
+            r["path"].erase(r["path"].size() - kDeletedString.size());
+            r["on_disk"] = "0";
+          }
         }
       }
     }
@@ -353,15 +426,31 @@ void genProcess(const std::string& pid, QueryData& results) {
   r["system_time"] = proc_stat.system_time;
   r["start_time"] = proc_stat.start_time;
 
+  // Container identity, the cgroup file of each container is parsed once.
+  if (context.isAnyColumnUsed({"cgroup_path", "container_id"})) {
+    ProcCgroup cgroup;
+    if (snapshot.cgroup(pid, cgroup).ok()) {
+      r["cgroup_path"] = cgroup.path;
+      r["container_id"] = cgroup.container_id;
+    }
+  }
+  for (const auto& ns : {"pid", "mnt", "net"}) {
+    auto column = std::string(ns) + "_namespace";
+    if (context.isColumnUsed(column)) {
+      snapshot.namespaceInode(pid, ns, r[column]);
+    }
+  }
+
   results.push_back(r);
 }
 
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
+  auto snapshot = ProcSnapshot::get();
+  auto pidlist = getProcList(context, *snapshot);
   for (const auto& pid : pidlist) {
-    genProcess(pid, results);
+    genProcess(*snapshot, pid, context, results);
   }
 
   return results;
@@ -370,7 +459,8 @@ QueryData genProcesses(QueryContext& context) {
 QueryData genProcessEnvs(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
+  // Environments and maps are read directly, only the process list is shared.
+  auto pidlist = getProcList(context, *ProcSnapshot::get());
   for (const auto& pid : pidlist) {
     genProcessEnvironment(pid, results);
   }
@@ -381,7 +471,8 @@ QueryData genProcessEnvs(QueryContext& context) {
 QueryData genProcessMemoryMap(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
+  // Environments and maps are read directly, only the process list is shared.
+  auto pidlist = getProcList(context, *ProcSnapshot::get());
   for (const auto& pid : pidlist) {
     genProcessMap(pid, results);
   }
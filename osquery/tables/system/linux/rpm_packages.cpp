@@ -21,12 +21,17 @@
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/tables/system/package_cache.h"
+
 namespace osquery {
 namespace tables {
 
 // Maximum number of files per RPM.
 #define MAX_RPM_FILES 2048
 
+/// The RPM database file rewritten when packages change.
+const std::string kRpmDatabase{"/var/lib/rpm/Packages"};
+
 /**
  * @brief Return a string representation of the RPM tag type.
  *
@@ -84,7 +89,8 @@ class RpmEnvironmentManager : public boost::noncopyable {
   boost::optional<std::string> config_;
 };
 
-QueryData genRpmPackages(QueryContext& context) {
+/// Read every installed package from the RPM database.
+static QueryData genRpmPackagesFromDatabase() {
   QueryData results;
 
   // Isolate RPM/package inspection to the canonical: /usr/lib/rpm.
@@ -98,13 +104,7 @@ QueryData genRpmPackages(QueryContext& context) {
   }
 
   rpmts ts = rpmtsCreate();
-  rpmdbMatchIterator matches;
-  if (context.constraints["name"].exists(EQUALS)) {
-    auto name = (*context.constraints["name"].getAll(EQUALS).begin());
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
-  } else {
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
-  }
+  auto matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
 
   Header header;
   while ((header = rpmdbNextIterator(matches)) != nullptr) {
@@ -130,6 +130,53 @@ QueryData genRpmPackages(QueryContext& context) {
   return results;
 }
 
+QueryData genRpmPackages(QueryContext& context) {
+  // The inventory is read again only if the database changed.
+  static PackageInventoryCache cache(kRpmDatabase);
+  return cache.get(genRpmPackagesFromDatabase);
+}
+
+/// Add a row for each file of a package header.
+static void genRpmPackageFilesFromHeader(rpmts ts,
+                                         Header header,
+                                         QueryData& results) {
+  rpmtd td = rpmtdNew();
+  auto package = getRpmAttribute(header, RPMTAG_NAME, td);
+  rpmtdFree(td);
+
+  rpmfi fi = rpmfiNew(ts, header, RPMTAG_BASENAMES, RPMFI_NOHEADER);
+  auto file_count = rpmfiFC(fi);
+  if (file_count <= 0 || file_count > MAX_RPM_FILES) {
+    // This package contains no or too many files.
+    rpmfiFree(fi);
+    return;
+  }
+
+  // Iterate over every file in this package.
+  for (size_t i = 0; rpmfiNext(fi) >= 0 && i < file_count; i++) {
+    Row r;
+    r["package"] = package;
+    auto path = rpmfiFN(fi);
+    r["path"] = (path != nullptr) ? path : "";
+    auto username = rpmfiFUser(fi);
+    r["username"] = (username != nullptr) ? username : "";
+    auto groupname = rpmfiFGroup(fi);
+    r["groupname"] = (groupname != nullptr) ? groupname : "";
+    r["mode"] = lsperms(rpmfiFMode(fi));
+    r["size"] = BIGINT(rpmfiFSize(fi));
+
+    int digest_algo;
+    auto digest = rpmfiFDigestHex(fi, &digest_algo);
+    if (digest_algo == PGPHASHALGO_SHA256) {
+      r["sha256"] = (digest != nullptr) ? digest : "";
+    }
+
+    results.push_back(r);
+  }
+
+  rpmfiFree(fi);
+}
+
 QueryData genRpmPackageFiles(QueryContext& context) {
   QueryData results;
 
@@ -142,52 +189,26 @@ QueryData genRpmPackageFiles(QueryContext& context) {
   }
 
   rpmts ts = rpmtsCreate();
-  rpmdbMatchIterator matches;
   if (context.constraints["package"].exists(EQUALS)) {
-    auto name = (*context.constraints["package"].getAll(EQUALS).begin());
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
-  } else {
-    matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
-  }
-
-  Header header;
-  while ((header = rpmdbNextIterator(matches)) != nullptr) {
-    rpmtd td = rpmtdNew();
-    rpmfi fi = rpmfiNew(ts, header, RPMTAG_BASENAMES, RPMFI_NOHEADER);
-    auto file_count = rpmfiFC(fi);
-    if (file_count <= 0 || file_count > MAX_RPM_FILES) {
-      // This package contains no or too many files.
-      rpmfiFree(fi);
-      continue;
-    }
-
-    // Iterate over every file in this package.
-    for (size_t i = 0; rpmfiNext(fi) >= 0 && i < file_count; i++) {
-      Row r;
-      r["package"] = getRpmAttribute(header, RPMTAG_NAME, td);
-      auto path = rpmfiFN(fi);
-      r["path"] = (path != nullptr) ? path : "";
-      auto username = rpmfiFUser(fi);
-      r["username"] = (username != nullptr) ? username : "";
-      auto groupname = rpmfiFGroup(fi);
-      r["groupname"] = (groupname != nullptr) ? groupname : "";
-      r["mode"] = lsperms(rpmfiFMode(fi));
-      r["size"] = BIGINT(rpmfiFSize(fi));
-
-      int digest_algo;
-      auto digest = rpmfiFDigestHex(fi, &digest_algo);
-      if (digest_algo == PGPHASHALGO_SHA256) {
-        r["sha256"] = (digest != nullptr) ? digest : "";
+    // Look up each requested package using the database's name index.
+    for (const auto& name : context.constraints["package"].getAll(EQUALS)) {
+      auto matches =
+          rpmtsInitIterator(ts, RPMTAG_NAME, name.c_str(), name.size());
+      Header header;
+      while ((header = rpmdbNextIterator(matches)) != nullptr) {
+        genRpmPackageFilesFromHeader(ts, header, results);
       }
-
-      results.push_back(r);
+      rpmdbFreeIterator(matches);
     }
-
-    rpmfiFree(fi);
-    rpmtdFree(td);
+  } else {
+    auto matches = rpmtsInitIterator(ts, RPMTAG_NAME, nullptr, 0);
+    Header header;
+    while ((header = rpmdbNextIterator(matches)) != nullptr) {
+      genRpmPackageFilesFromHeader(ts, header, results);
+    }
+    rpmdbFreeIterator(matches);
   }
 
-  rpmdbFreeIterator(matches);
   rpmtsFree(ts);
   rpmFreeRpmrc();
 
@@ -17,6 +17,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/boot_cache.h"
 #include "osquery/tables/system/linux/smbios_utils.h"
 
 namespace osquery {
@@ -27,22 +28,31 @@ namespace tables {
 
 const std::string kLinuxEFISystabPath = "/sys/firmware/efi/systab";
 
+/// The DMI tables are kept for the remainder of the boot with this key.
+const std::string kSMBIOSBootCacheKey = "smbios_tables";
+
 void LinuxSMBIOSParser::readFromAddress(size_t address, size_t length) {
-  auto status = osquery::readRawMem(address, length, (void**)&data_);
-  if (!status.ok() || data_ == nullptr) {
+  const uint8_t* data = nullptr;
+  auto status = memory_.read(address, length, data);
+  if (!status.ok() || data == nullptr) {
     return;
   }
 
   // Search for the SMBIOS/DMI tables magic header string.
   size_t offset;
-  for (offset = 0; offset <= 0xFFF0; offset += 16) {
+  for (offset = 0; offset + sizeof(DMIEntryPoint) <= length; offset += 16) {
     // Could look for "_SM_" for the SMBIOS header, but the DMI header exists
     // in both SMBIOS and the legacy DMI spec.
-    if (memcmp(data_ + offset, "_DMI_", 5) == 0) {
-      auto dmi_data = (DMIEntryPoint*)(data_ + offset);
+    if (memcmp(data + offset, "_DMI_", 5) == 0) {
+      auto dmi_data = (const DMIEntryPoint*)(data + offset);
       if (discoverTables(dmi_data->tableAddress, dmi_data->tableLength)) {
         break;
       }
+
+      // The search memory may have been replaced by the table read.
+      if (!memory_.read(address, length, data).ok()) {
+        break;
+      }
     }
   }
 }
@@ -79,22 +89,56 @@ bool LinuxSMBIOSParser::discoverTables(size_t address, size_t length) {
   // Linux will expose the SMBIOS/DMI entry point structures, which contain
   // a member variable with the DMI tables start address and size.
   // This applies to both the EFI-variable and physical memory search.
-  auto status = osquery::readRawMem(address, length, (void**)&table_data_);
-  if (!status.ok() || table_data_ == nullptr) {
+  const uint8_t* data = nullptr;
+  auto status = memory_.read(address, length, data);
+  if (!status.ok() || data == nullptr) {
     return false;
   }
 
-  // The read was successful, save the size and wait for requests to parse.
+  // The read was successful, keep the tables for requests to parse.
+  table_data_ = static_cast<uint8_t*>(malloc(length));
+  if (table_data_ == nullptr) {
+    return false;
+  }
+  memcpy(table_data_, data, length);
   table_size_ = length;
   return true;
 }
 
+bool LinuxSMBIOSParser::readFromCache(const std::string& tables) {
+  if (tables.empty()) {
+    return false;
+  }
+
+  // The parser owns and frees the table memory.
+  table_data_ = static_cast<uint8_t*>(malloc(tables.size()));
+  if (table_data_ == nullptr) {
+    return false;
+  }
+  memcpy(table_data_, tables.data(), tables.size());
+  table_size_ = tables.size();
+  return true;
+}
+
 bool LinuxSMBIOSParser::discover() {
+  // The firmware tables cannot change without a reboot.
+  std::string tables;
+  if (BootCache::instance().get(kSMBIOSBootCacheKey, tables)) {
+    return readFromCache(tables);
+  }
+
   if (osquery::isReadable(kLinuxEFISystabPath)) {
     readFromSystab(kLinuxEFISystabPath);
   } else {
     readFromAddress(kLinuxSMBIOSRawAddress_, kLinuxSMBIOSRawLength_);
   }
+
+  // A failed read is not stored, it may succeed with more privileges.
+  if (valid()) {
+    BootCache::instance().set(
+        kSMBIOSBootCacheKey,
+        std::string(reinterpret_cast<char*>(table_data_), table_size_));
+  }
   return valid();
 }
 
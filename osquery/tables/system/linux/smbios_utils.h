@@ -10,6 +10,7 @@
 
 #pragma once
 
+#include "osquery/filesystem/linux/mem.h"
 #include "osquery/tables/system/smbios_utils.h"
 
 namespace osquery {
@@ -33,17 +34,14 @@ class LinuxSMBIOSParser : public SMBIOSParser {
   /// Parse the SMBIOS address from an EFI systab file.
   void readFromSystab(const std::string& systab);
 
-  /// Cross version/boot read initializer.
+  /// Cross version/boot read initializer, tables are read once per boot.
   bool discover();
 
   /// Check if the read was successful.
-  bool valid() { return (data_ != nullptr && table_data_ != nullptr); }
+  bool valid() { return (table_data_ != nullptr); }
 
  public:
   virtual ~LinuxSMBIOSParser() {
-    if (data_ != nullptr) {
-      free(data_);
-    }
     if (table_data_ != nullptr) {
       free(table_data_);
     }
@@ -52,8 +50,11 @@ class LinuxSMBIOSParser : public SMBIOSParser {
  private:
   bool discoverTables(size_t address, size_t length);
 
-  /// Hold the raw SMBIOS memory read.
-  uint8_t* data_{nullptr};
+  /// Use tables read earlier during this boot, see BootCache.
+  bool readFromCache(const std::string& tables);
+
+  /// Entry points are searched in place, within the mapped memory.
+  PhysicalMemory memory_;
 };
 }
 }
@@ -0,0 +1,104 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <thread>
+
+#include <osquery/flags.h>
+
+#include "osquery/tables/system/linux/statfs_pool.h"
+
+namespace osquery {
+
+DECLARE_uint64(mounts_statfs_timeout);
+DECLARE_uint64(mounts_stale_interval);
+
+namespace tables {
+
+const size_t kMaxStatfsWorkers = 8;
+
+using Clock = std::chrono::steady_clock;
+
+std::shared_ptr<StatfsRequest> StatfsPool::request(const std::string& path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto now = Clock::now();
+  auto skipped = skip_until_.find(path);
+  if (skipped != skip_until_.end()) {
+    if (skipped->second > now || in_flight_.count(path) > 0) {
+      return nullptr;
+    }
+    skip_until_.erase(skipped);
+  }
+  if (in_flight_.count(path) > 0) {
+    return nullptr;
+  }
+
+  auto request = std::make_shared<StatfsRequest>();
+  request->path = path;
+  queue_.push_back(request);
+  in_flight_[path] = request;
+  if (queue_.size() > idle_ && workers_ < kMaxStatfsWorkers + blocked_) {
+    workers_++;
+    std::thread(&StatfsPool::work, this).detach();
+  } else {
+    pending_.notify_one();
+  }
+  return request;
+}
+
+bool StatfsPool::wait(const std::shared_ptr<StatfsRequest>& request,
+                      Clock::time_point deadline) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto done = [&request]() { return request->done; };
+  if (FLAGS_mounts_statfs_timeout == 0) {
+    finished_.wait(lock, done);
+  } else if (!finished_.wait_until(lock, deadline, done)) {
+    if (!request->stale) {
+      // The helper running, or later taking, the statfs is not available.
+      request->stale = true;
+      blocked_++;
+    }
+    skip_until_[request->path] =
+        Clock::now() + std::chrono::seconds(FLAGS_mounts_stale_interval);
+    return false;
+  }
+  return true;
+}
+
+size_t StatfsPool::workers() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return workers_;
+}
+
+void StatfsPool::work() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    idle_++;
+    pending_.wait(lock, [this]() { return !queue_.empty(); });
+    idle_--;
+    auto request = queue_.front();
+    queue_.pop_front();
+
+    lock.unlock();
+    struct statfs st = {};
+    bool ok = (statfs_(request->path.c_str(), &st) == 0);
+    lock.lock();
+
+    if (request->stale) {
+      blocked_--;
+    }
+    request->st = st;
+    request->ok = ok;
+    request->done = true;
+    in_flight_.erase(request->path);
+    finished_.notify_all();
+  }
+}
+}
+}
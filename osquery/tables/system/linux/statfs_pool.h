@@ -0,0 +1,103 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <sys/vfs.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+namespace osquery {
+namespace tables {
+
+/// Helper threads for statfs, not counting those blocked on a stale mount.
+extern const size_t kMaxStatfsWorkers;
+
+/// A statfs requested from a helper thread.
+struct StatfsRequest {
+  std::string path;
+  bool done{false};
+  bool ok{false};
+  struct statfs st;
+
+  /// Set when a wait timed out, the mount is skipped as stale.
+  bool stale{false};
+};
+
+/**
+ * @brief Run statfs on helper threads, bounding the time a query waits.
+ *
+ * A statfs against a hung NFS or FUSE mount cannot be interrupted. The
+ * helper stays blocked while the query returns without the capacity of that
+ * mount, and the mount is skipped until --mounts_stale_interval passes. A
+ * mount with a statfs still in flight is never requested again, so each
+ * hung mount blocks at most one helper. Blocked helpers do not count toward
+ * kMaxStatfsWorkers, the other mounts are still answered.
+ */
+class StatfsPool : private boost::noncopyable {
+ public:
+  using StatfsFunction = std::function<int(const char*, struct statfs*)>;
+
+  static StatfsPool& instance() {
+    // The helpers are detached and may outlive the pool at exit.
+    static auto pool = new StatfsPool(::statfs);
+    return *pool;
+  }
+
+  /// A pool calling func from its helpers, it must outlive the helpers.
+  explicit StatfsPool(StatfsFunction func) : statfs_(std::move(func)) {}
+
+  /// Queue a statfs, nullptr if the mount is skipped as stale.
+  std::shared_ptr<StatfsRequest> request(const std::string& path);
+
+  /// Wait until the deadline, marking the mount stale if it is not done.
+  /// The request is not changed after it is done.
+  bool wait(const std::shared_ptr<StatfsRequest>& request,
+            std::chrono::steady_clock::time_point deadline);
+
+  /// The number of helpers started, including those blocked.
+  size_t workers();
+
+ private:
+  void work();
+
+ private:
+  /// The statfs implementation, replaced by tests.
+  StatfsFunction statfs_;
+
+  /// Requests not yet taken by a helper.
+  std::deque<std::shared_ptr<StatfsRequest>> queue_;
+
+  /// Mounts with a statfs queued or running.
+  std::map<std::string, std::shared_ptr<StatfsRequest>> in_flight_;
+
+  /// Mounts that timed out, and when they are requested again.
+  std::map<std::string, std::chrono::steady_clock::time_point> skip_until_;
+
+  /// Helpers started, those waiting for a request, and stale requests.
+  size_t workers_{0};
+  size_t idle_{0};
+  size_t blocked_{0};
+
+  std::mutex mutex_;
+  std::condition_variable pending_;
+  std::condition_variable finished_;
+};
+}
+}
@@ -13,6 +13,7 @@
 #include <osquery/tables.h>
 
 #include "osquery/events/linux/udev.h"
+#include "osquery/tables/system/linux/hardware_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -27,7 +28,7 @@ const std::string kUSBKeySerial = "ID_SERIAL_SHORT";
 const std::string kUSBKeyAddress = "BUSNUM";
 const std::string kUSBKeyPort = "DEVNUM";
 
-QueryData genUSBDevices(QueryContext &context) {
+static QueryData enumerateUSBDevices() {
   QueryData results;
 
   auto udev_handle = udev_new();
@@ -83,5 +84,9 @@ QueryData genUSBDevices(QueryContext &context) {
 
   return results;
 }
+
+QueryData genUSBDevices(QueryContext &context) {
+  return HardwareCache::instance().get("usb", enumerateUSBDevices);
+}
 }
 }
@@ -9,45 +9,40 @@
  */
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/nss_cache.h"
 #include "osquery/tables/system/user_groups.h"
 
 namespace osquery {
 namespace tables {
 
-extern std::mutex pwdEnumerationMutex;
+void genUserGroups(const UserEntry &entry, QueryData &results) {
+  user_t<uid_t, gid_t> user;
+  user.name = entry.username.c_str();
+  user.uid = entry.uid;
+  user.gid = entry.gid;
+  getGroupsForUser<uid_t, gid_t>(results, user);
+}
 
 QueryData genUserGroups(QueryContext &context) {
   QueryData results;
-  struct passwd *pwd = nullptr;
 
+  auto &cache = NSSCache::instance();
   if (context.constraints["uid"].exists(EQUALS)) {
+    UserEntry entry;
     std::set<std::string> uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto &uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid) && (pwd = getpwuid(auid)) != nullptr) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
+      if (safeStrtol(uid, 10, auid) && cache.getUser(auid, entry)) {
+        genUserGroups(entry, results);
       }
     }
   } else {
-    std::lock_guard<std::mutex> lock(pwdEnumerationMutex);
-    std::set<gid_t> users_in;
-    while ((pwd = getpwent()) != nullptr) {
-      if (std::find(users_in.begin(), users_in.end(), pwd->pw_uid) ==
-          users_in.end()) {
-        user_t<uid_t, gid_t> user;
-        user.name = pwd->pw_name;
-        user.uid = pwd->pw_uid;
-        user.gid = pwd->pw_gid;
-        getGroupsForUser<uid_t, gid_t>(results, user);
-        users_in.insert(pwd->pw_uid);
+    std::set<uid_t> users_in;
+    for (const auto &entry : *cache.getUsers()) {
+      if (users_in.insert(entry.uid).second) {
+        genUserGroups(entry, results);
       }
     }
-    endpwent();
-    users_in.clear();
   }
 
   return results;
@@ -8,41 +8,35 @@
  *
  */
 
-#include <pwd.h>
-
-#include <mutex>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/linux/nss_cache.h"
 
 namespace osquery {
 namespace tables {
 
-std::mutex pwdEnumerationMutex;
-
-void genUser(const struct passwd* pwd, QueryData& results) {
+void genUser(const UserEntry& user,
+             const QueryContext& context,
+             QueryData& results) {
   Row r;
-  r["uid"] = BIGINT(pwd->pw_uid);
-  r["gid"] = BIGINT(pwd->pw_gid);
-  r["uid_signed"] = BIGINT((int32_t)pwd->pw_uid);
-  r["gid_signed"] = BIGINT((int32_t)pwd->pw_gid);
+  r["uid"] = BIGINT(user.uid);
+  r["gid"] = BIGINT(user.gid);
+  r["uid_signed"] = BIGINT((int32_t)user.uid);
+  r["gid_signed"] = BIGINT((int32_t)user.gid);
+  r["username"] = user.username;
 
-  if (pwd->pw_name != nullptr) {
-    r["username"] = TEXT(pwd->pw_name);
+  if (context.isColumnUsed("description")) {
+    r["description"] = user.description;
   }
 
-  if (pwd->pw_gecos != nullptr) {
-    r["description"] = TEXT(pwd->pw_gecos);
+  if (context.isColumnUsed("directory")) {
+    r["directory"] = user.directory;
   }
 
-  if (pwd->pw_dir != nullptr) {
-    r["directory"] = TEXT(pwd->pw_dir);
-  }
-
-  if (pwd->pw_shell != nullptr) {
-    r["shell"] = TEXT(pwd->pw_shell);
+  if (context.isColumnUsed("shell")) {
+    r["shell"] = user.shell;
   }
   results.push_back(r);
 }
@@ -50,27 +44,27 @@ void genUser(const struct passwd* pwd, QueryData& results) {
 QueryData genUsers(QueryContext& context) {
   QueryData results;
 
-  struct passwd* pwd = nullptr;
+  auto& cache = NSSCache::instance();
+  UserEntry user;
   if (context.constraints["uid"].exists(EQUALS)) {
     auto uids = context.constraints["uid"].getAll(EQUALS);
     for (const auto& uid : uids) {
       long auid{0};
-      if (safeStrtol(uid, 10, auid)) {
-        WriteLock lock(pwdEnumerationMutex);
-        pwd = getpwuid(auid);
-        if (pwd != nullptr) {
-          genUser(pwd, results);
-        }
+      if (safeStrtol(uid, 10, auid) && cache.getUser(auid, user)) {
+        genUser(user, context, results);
+      }
+    }
+  } else if (context.constraints["username"].exists(EQUALS)) {
+    auto usernames = context.constraints["username"].getAll(EQUALS);
+    for (const auto& username : usernames) {
+      if (cache.getUser(username, user)) {
+        genUser(user, context, results);
       }
     }
   } else {
-    WriteLock lock(pwdEnumerationMutex);
-    pwd = getpwent();
-    while (pwd != nullptr) {
-      genUser(pwd, results);
-      pwd = getpwent();
+    for (const auto& entry : *cache.getUsers()) {
+      genUser(entry, context, results);
     }
-    endpwent();
   }
 
   return results;
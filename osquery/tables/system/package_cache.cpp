@@ -0,0 +1,75 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <sys/stat.h>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/system.h>
+
+#include "osquery/tables/system/package_cache.h"
+
+namespace osquery {
+namespace tables {
+
+/// Databases modified this recently may change again within the same time.
+const uint64_t kPackageCacheSettleNanos = 1000000000ULL;
+
+/// Stat a package database, the modification time is in nanoseconds.
+static bool getDatabaseIdentity(const std::string& path,
+                                std::string& identity,
+                                uint64_t& mtime) {
+  struct stat file;
+  if (::stat(path.c_str(), &file) != 0) {
+    return false;
+  }
+
+#if defined(__linux__)
+  mtime = file.st_mtim.tv_sec * 1000000000ULL + file.st_mtim.tv_nsec;
+#elif defined(__APPLE__)
+  mtime = file.st_mtimespec.tv_sec * 1000000000ULL + file.st_mtimespec.tv_nsec;
+#else
+  mtime = static_cast<uint64_t>(file.st_mtime) * 1000000000ULL;
+#endif
+  identity = std::to_string(file.st_ino) + ":" +
+             std::to_string(file.st_size) + ":" + std::to_string(mtime);
+  return true;
+}
+
+QueryData PackageInventoryCache::get(
+    const std::function<QueryData()>& generate) {
+  std::string identity;
+  uint64_t mtime = 0;
+  if (!getDatabaseIdentity(path_, identity, mtime)) {
+    return generate();
+  }
+
+  WriteLock lock(mutex_);
+  if (valid_ && identity == identity_) {
+    return rows_;
+  }
+
+  rows_ = generate();
+  // A database written within the last second may be written again without
+  // a change to its identity, generate again until it settles.
+  auto now = static_cast<uint64_t>(getUnixTime()) * 1000000000ULL;
+  valid_ = (mtime + kPackageCacheSettleNanos <= now);
+  identity_ = std::move(identity);
+  return rows_;
+}
+
+void PackageInventoryCache::clear() {
+  WriteLock lock(mutex_);
+  valid_ = false;
+  rows_.clear();
+}
+}
+}
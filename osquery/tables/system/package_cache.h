@@ -0,0 +1,61 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <functional>
+#include <string>
+
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
+#include <osquery/tables.h>
+
+namespace osquery {
+namespace tables {
+
+/**
+ * @brief Package inventory rows kept until the package database changes.
+ *
+ * Package managers rewrite a database file when packages are installed or
+ * removed. The rows generated from the database are reused while the file's
+ * inode, size, and modification time are unchanged.
+ */
+class PackageInventoryCache : private boost::noncopyable {
+ public:
+  explicit PackageInventoryCache(const std::string& path) : path_(path) {}
+
+  /**
+   * @brief Get the inventory, calling generate if the database changed.
+   *
+   * If the database cannot be inspected the rows are always generated.
+   */
+  QueryData get(const std::function<QueryData()>& generate);
+
+  /// Drop the stored rows, the next request generates the inventory.
+  void clear();
+
+ private:
+  /// The package database file.
+  std::string path_;
+
+  /// Set if the rows were generated from the current identity.
+  bool valid_{false};
+
+  /// The database inode, size, and modification time in nanoseconds.
+  std::string identity_;
+
+  QueryData rows_;
+
+  /// Protect the rows, the generator is only called by one query at a time.
+  Mutex mutex_;
+};
+}
+}
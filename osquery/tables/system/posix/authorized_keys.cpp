@@ -16,6 +16,7 @@
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/line_cache.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace osquery {
@@ -31,23 +32,24 @@ void genSSHkeysForUser(const std::string& uid,
     boost::filesystem::path keys_file = directory;
     keys_file /= kfile;
 
-    std::string keys_content;
-    if (!osquery::forensicReadFile(keys_file, keys_content).ok()) {
-      // Cannot read a specific keys file.
-      continue;
-    }
     // Protocol 1 public key consist of: options, bits, exponent, modulus,
     // comment; Protocol 2 public key consist of: options, keytype,
     // base64-encoded key, comment.
-    for (const auto& line : split(keys_content, "\n")) {
+    auto parser = [&](const std::string& line,
+                      std::string& /* state */,
+                      QueryData& rows) {
       if (!line.empty() && line[0] != '#') {
         Row r;
         r["uid"] = uid;
         r["key"] = line;
         r["key_file"] = keys_file.string();
-        results.push_back(r);
+        rows.push_back(r);
       }
-    }
+    };
+
+    // A keys file is parsed again only if it changed.
+    FileLineCache::instance().get(
+        "authorized_keys:" + uid, keys_file.string(), parser, results);
   }
 }
 
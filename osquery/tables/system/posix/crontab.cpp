@@ -10,14 +10,13 @@
 
 #include <vector>
 
-#include <boost/algorithm/string/trim.hpp>
-
 #include <osquery/core.h>
 #include <osquery/tables.h>
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/line_cache.h"
 
 namespace osquery {
 namespace tables {
@@ -28,31 +27,6 @@ const std::vector<std::string> kUserCronPaths = {
     "/var/at/tabs/", "/var/spool/cron/", "/var/spool/cron/crontabs/",
 };
 
-std::vector<std::string> cronFromFile(const std::string& path) {
-  std::string content;
-  std::vector<std::string> cron_lines;
-  if (!isReadable(path).ok()) {
-    return cron_lines;
-  }
-
-  if (!forensicReadFile(path, content).ok()) {
-    return cron_lines;
-  }
-
-  auto lines = split(content, "\n");
-
-  // Only populate the lines that are not comments or blank.
-  for (auto& line : lines) {
-    // Cheat and use a non-const iteration, to inline trim.
-    boost::trim(line);
-    if (line.size() > 0 && line.at(0) != '#') {
-      cron_lines.push_back(line);
-    }
-  }
-
-  return cron_lines;
-}
-
 void genCronLine(const std::string& path,
                  const std::string& line,
                  QueryData& results) {
@@ -97,13 +71,23 @@ void genCronLine(const std::string& path,
   results.push_back(r);
 }
 
+/// Parse the lines of a crontab that are not comments or blank.
+static void genCronFile(const std::string& path, QueryData& results) {
+  FileLineCache::instance().get(
+      "crontab",
+      path,
+      ([&path](const std::string& line, std::string& /* state */,
+               QueryData& rows) {
+        if (line.size() > 0 && line.at(0) != '#') {
+          genCronLine(path, line, rows);
+        }
+      }),
+      results);
+}
+
 QueryData genCronTab(QueryContext& context) {
   QueryData results;
-
-  auto system_lines = cronFromFile(kSystemCron);
-  for (const auto& line : system_lines) {
-    genCronLine(kSystemCron, line, results);
-  }
+  genCronFile(kSystemCron, results);
 
   std::vector<std::string> user_crons;
   for (const auto cron_path : kUserCronPaths) {
@@ -112,10 +96,7 @@ QueryData genCronTab(QueryContext& context) {
 
   // The user-based crons are identified by their path.
   for (const auto& user_path : user_crons) {
-    auto user_lines = cronFromFile(user_path);
-    for (const auto& line : user_lines) {
-      genCronLine(user_path, line, results);
-    }
+    genCronFile(user_path, results);
   }
 
   return results;
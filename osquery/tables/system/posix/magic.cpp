@@ -9,50 +9,211 @@
  */
 
 #include <stdio.h>
+#include <sys/stat.h>
+
 #include <magic.h>
 
+#include <algorithm>
+#include <vector>
+
+#include <boost/algorithm/string/classification.hpp>
+#include <boost/algorithm/string/split.hpp>
+
+#include <osquery/core.h>
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
 namespace osquery {
+
+DECLARE_uint64(table_workers);
+
 namespace tables {
 
-QueryData genMagicData(QueryContext& context) {
-  QueryData results;
-  magic_t magic_cookie = nullptr;
+/**
+ * @brief Loaded libmagic cookies, reused across queries.
+ *
+ * Loading compiles the whole magic database, which costs far more than
+ * classifying a path. A cookie is not thread safe, so each table worker
+ * checks one out. Cookies loaded before the database files changed are
+ * closed instead of being returned.
+ */
+class MagicCookiePool : private boost::noncopyable {
+ public:
+  static MagicCookiePool& instance() {
+    static MagicCookiePool pool;
+    return pool;
+  }
+
+  /// Check out a loaded cookie, nullptr if libmagic could not load.
+  magic_t acquire(size_t& generation) {
+    {
+      WriteLock lock(mutex_);
+      auto signature = getDatabaseSignature();
+      if (signature != signature_) {
+        signature_ = std::move(signature);
+        generation_++;
+        for (auto cookie : cookies_) {
+          magic_close(cookie);
+        }
+        cookies_.clear();
+      }
 
-  // No default flags
-  magic_cookie = magic_open(MAGIC_NONE);
+      generation = generation_;
+      if (!cookies_.empty()) {
+        auto cookie = cookies_.back();
+        cookies_.pop_back();
+        return cookie;
+      }
+    }
 
-  if (magic_cookie == nullptr) {
-    VLOG(1) << "Unable to initialize magic library";
-    return results;
+    // No default flags
+    auto cookie = magic_open(MAGIC_NONE);
+    if (cookie == nullptr) {
+      VLOG(1) << "Unable to initialize magic library";
+      return nullptr;
+    }
+    if (magic_load(cookie, nullptr) != 0) {
+      VLOG(1) << "Unable to load magic database : " << magic_error(cookie);
+      magic_close(cookie);
+      return nullptr;
+    }
+    return cookie;
   }
-  if (magic_load(magic_cookie, nullptr) != 0) {
-    VLOG(1) << "Unable to load magic database : " << magic_error(magic_cookie);
-    magic_close(magic_cookie);
-    return results;
+
+  /// Return a cookie, keeping at most one for each table worker.
+  void release(magic_t cookie, size_t generation) {
+    {
+      WriteLock lock(mutex_);
+      auto limit = std::max(static_cast<size_t>(FLAGS_table_workers),
+                            static_cast<size_t>(1));
+      if (generation == generation_ && cookies_.size() < limit) {
+        cookies_.push_back(cookie);
+        return;
+      }
+    }
+    magic_close(cookie);
   }
 
-  // Iterate through all the provided paths
-  auto paths = context.constraints["path"].getAll(EQUALS);
-  for (const auto& path_string : paths) {
-    Row r;
-    r["path"] = path_string;
-    r["data"] = magic_file(magic_cookie, path_string.c_str());
+ private:
+  MagicCookiePool() {}
 
-    // Retrieve MIME type
-    magic_setflags(magic_cookie, MAGIC_MIME_TYPE);
-    r["mime_type"] = magic_file(magic_cookie, path_string.c_str());
+  ~MagicCookiePool() {
+    for (auto cookie : cookies_) {
+      magic_close(cookie);
+    }
+  }
 
-    // Retrieve MIME encoding
-    magic_setflags(magic_cookie, MAGIC_MIME_ENCODING);
-    r["mime_encoding"] = magic_file(magic_cookie, path_string.c_str());
+  /**
+   * @brief The size and modification time of each default database file.
+   *
+   * The default path may list several files, each optionally compiled with a
+   * .mgc suffix. A missing file is part of the signature too.
+   */
+  static std::string getDatabaseSignature() {
+    auto path = magic_getpath(nullptr, 0);
+    if (path == nullptr) {
+      return "";
+    }
 
-    results.push_back(r);
+    std::string signature;
+    std::vector<std::string> files;
+    boost::split(files, std::string(path), boost::is_any_of(":"));
+    for (const auto& file : files) {
+      for (const auto& candidate : {file, file + ".mgc"}) {
+        struct stat info;
+        if (::stat(candidate.c_str(), &info) == 0) {
+          signature += std::to_string(info.st_size) + ":" +
+                       std::to_string(info.st_mtime) + ",";
+        } else {
+          signature += "-,";
+        }
+      }
+    }
+    return signature;
   }
 
-  magic_close(magic_cookie);
+ private:
+  /// Idle loaded cookies.
+  std::vector<magic_t> cookies_;
+
+  /// The database files the idle cookies were loaded from.
+  std::string signature_;
+
+  /// Incremented each time the database files change.
+  size_t generation_{0};
+
+  Mutex mutex_;
+};
+
+/// libmagic returns nullptr if a path cannot be classified.
+static inline std::string getMagic(magic_t cookie,
+                                   int flags,
+                                   const std::string& path) {
+  magic_setflags(cookie, flags);
+  auto result = magic_file(cookie, path.c_str());
+  return (result == nullptr) ? "" : result;
+}
+
+static void genMagicForPath(magic_t cookie,
+                            const std::string& path,
+                            Row& r) {
+  r["path"] = path;
+  // A reused cookie keeps the flags of its last request.
+  r["data"] = getMagic(cookie, MAGIC_NONE, path);
+
+  // Retrieve MIME type
+  r["mime_type"] = getMagic(cookie, MAGIC_MIME_TYPE, path);
+
+  // Retrieve MIME encoding
+  r["mime_encoding"] = getMagic(cookie, MAGIC_MIME_ENCODING, path);
+}
+
+/// The cookie checked out by a thread generating the rows of a query.
+struct MagicCookieLease {
+  /// Set once the thread tried to check out a cookie.
+  bool acquired{false};
+
+  magic_t cookie{nullptr};
+  size_t generation{0};
+};
+
+static thread_local MagicCookieLease kMagicCookieLease;
+
+/// Return the calling thread's cookie to the pool.
+static void releaseMagicCookie() {
+  auto& lease = kMagicCookieLease;
+  if (lease.cookie != nullptr) {
+    MagicCookiePool::instance().release(lease.cookie, lease.generation);
+  }
+  lease = MagicCookieLease();
+}
+
+QueryData genMagicData(QueryContext& context) {
+  QueryData results;
+  // Each table worker checks out a cookie for its first path and returns it
+  // when the paths are classified.
+  context.generateEach(
+      context.constraints["path"].getAll(EQUALS),
+      [](const std::string& path, QueryData& rows) {
+        auto& lease = kMagicCookieLease;
+        if (!lease.acquired) {
+          lease.cookie = MagicCookiePool::instance().acquire(lease.generation);
+          lease.acquired = true;
+        }
+        if (lease.cookie == nullptr) {
+          return;
+        }
+
+        Row r;
+        genMagicForPath(lease.cookie, path, r);
+        rows.push_back(std::move(r));
+      },
+      results,
+      releaseMagicCookie);
+
+  // The calling thread generates paths too.
+  releaseMagicCookie();
   return results;
 }
 }
@@ -18,6 +18,7 @@
 #include <osquery/filesystem.h>
 
 #include "osquery/core/conversions.h"
+#include "osquery/tables/system/line_cache.h"
 #include "osquery/tables/system/system_utils.h"
 
 namespace xp = boost::xpressive;
@@ -42,18 +43,14 @@ void genShellHistoryForUser(const std::string& uid,
     boost::filesystem::path history_file = directory;
     history_file /= hfile;
 
-    std::string history_content;
-    if (!forensicReadFile(history_file, history_content).ok()) {
-      // Cannot read a specific history file.
-      continue;
-    }
-
-    std::string prev_bash_timestamp;
-    for (const auto& line : split(history_content, "\n")) {
+    // The parse state is a bash timestamp preceding the next command.
+    auto parser = [&](const std::string& line,
+                      std::string& prev_bash_timestamp,
+                      QueryData& rows) {
       if (prev_bash_timestamp.empty() &&
           xp::regex_search(line, bash_timestamp_matches, bash_timestamp_rx)) {
         prev_bash_timestamp = bash_timestamp_matches["timestamp"];
-        continue;
+        return;
       }
 
       Row r;
@@ -72,8 +69,12 @@ void genShellHistoryForUser(const std::string& uid,
 
       r["uid"] = uid;
       r["history_file"] = history_file.string();
-      results.push_back(r);
-    }
+      rows.push_back(r);
+    };
+
+    // Only lines appended since the last query are parsed.
+    FileLineCache::instance().get(
+        "shell_history:" + uid, history_file.string(), parser, results);
   }
 }
 
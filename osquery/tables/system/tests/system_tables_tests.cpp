@@ -8,15 +8,38 @@
  *
  */
 
+#include <ctime>
+
 #include <gtest/gtest.h>
 
+#include <boost/filesystem/operations.hpp>
+
+#include <osquery/flags.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 #include <osquery/sql.h>
 
+#include "osquery/core/process.h"
+#include "osquery/tables/system/line_cache.h"
+#ifdef __linux__
+#include "osquery/events/linux/udev.h"
+#include "osquery/tables/system/linux/boot_cache.h"
+#include "osquery/tables/system/linux/hardware_cache.h"
+#include "osquery/tables/system/linux/kernel_modules.h"
+#include "osquery/tables/system/linux/nss_cache.h"
+#include "osquery/tables/system/linux/statfs_pool.h"
+#endif
+#include "osquery/tables/system/package_cache.h"
 #include "osquery/tests/test_util.h"
 
+#include "generated/rows/uptime.h"
+
 namespace osquery {
+
+#ifdef __linux__
+DECLARE_uint64(mounts_statfs_timeout);
+#endif
+
 namespace tables {
 
 QueryData genOSVersion(QueryContext& context);
@@ -89,5 +112,351 @@ TEST_F(SystemsTablesTests, test_abstract_joins) {
       SQL("select path from file where path = '/etc/' or path LIKE '/dev/%'");
   ASSERT_GT(results.rows().size(), 1U);
 }
+TEST_F(SystemsTablesTests, test_file_directory) {
+  auto directory = kTestWorkingDirectory + "file_directory";
+  boost::filesystem::create_directories(directory + "/subdirectory");
+  writeTextFile(directory + "/file.txt", "file");
+
+  auto results = SQL("select path, filename, type, size from file where "
+                     "directory = '" +
+                     directory + "' order by filename");
+  ASSERT_EQ(results.rows().size(), 2U);
+  EXPECT_EQ(results.rows()[0].at("path"), directory + "/file.txt");
+  EXPECT_EQ(results.rows()[0].at("filename"), "file.txt");
+  EXPECT_EQ(results.rows()[0].at("type"), "regular");
+  EXPECT_EQ(results.rows()[0].at("size"), "4");
+  EXPECT_EQ(results.rows()[1].at("filename"), "subdirectory");
+  EXPECT_EQ(results.rows()[1].at("type"), "directory");
+}
+
+#ifndef WIN32
+TEST_F(SystemsTablesTests, test_magic_reload) {
+  auto database = kTestWorkingDirectory + "magic_database";
+  auto path = kTestWorkingDirectory + "magic_file";
+  writeTextFile(database, "0\tstring\tOSQUERYMAGIC\tosquery first\n");
+  writeTextFile(path, "OSQUERYMAGIC content");
+
+  // The default database path is read from the environment.
+  auto magic = getEnvVar("MAGIC");
+  setEnvVar("MAGIC", database);
+  auto results = SQL::selectAllFrom("magic", "path", EQUALS, path);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["data"], "osquery first");
+
+  // The loaded cookies are reused while the database is unchanged.
+  results = SQL::selectAllFrom("magic", "path", EQUALS, path);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["data"], "osquery first");
+
+  // A changed database is loaded again.
+  writeTextFile(database, "0\tstring\tOSQUERYMAGIC\tosquery second type\n");
+  results = SQL::selectAllFrom("magic", "path", EQUALS, path);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["data"], "osquery second type");
+
+  if (magic.is_initialized()) {
+    setEnvVar("MAGIC", *magic);
+  } else {
+    unsetEnvVar("MAGIC");
+  }
+}
+#endif
+
+TEST_F(SystemsTablesTests, test_file_line_cache) {
+  auto path = kTestWorkingDirectory + "line_cache_history";
+  writeTextFile(path, "first\n\nsecond\n");
+
+  auto parser = [](const std::string& line, std::string& state,
+                   QueryData& rows) {
+    // The state counts the lines of the file.
+    state += "+";
+    Row r = {{"line", line}, {"count", TEXT(state.size())}};
+    rows.push_back(r);
+  };
+
+  auto& cache = FileLineCache::instance();
+  cache.clear();
+  auto lines = cache.parsedLines();
+  QueryData results;
+  EXPECT_TRUE(cache.get("test", path, parser, results));
+  ASSERT_EQ(results.size(), 2U);
+  EXPECT_EQ(results[1]["line"], "second");
+  EXPECT_EQ(cache.parsedLines(), lines + 3);
+
+  // The unchanged file is not parsed.
+  results.clear();
+  EXPECT_TRUE(cache.get("test", path, parser, results));
+  EXPECT_EQ(results.size(), 2U);
+  EXPECT_EQ(cache.parsedLines(), lines + 3);
+
+  // Only appended lines are parsed, the state continues.
+  writeTextFile(path, "first\n\nsecond\nthird\nfour");
+  results.clear();
+  EXPECT_TRUE(cache.get("test", path, parser, results));
+  ASSERT_EQ(results.size(), 4U);
+  EXPECT_EQ(results[2]["line"], "third");
+  EXPECT_EQ(results[3]["line"], "four");
+  EXPECT_EQ(results[3]["count"], "4");
+  EXPECT_EQ(cache.parsedLines(), lines + 4);
+
+  // A rewritten file is parsed from the start.
+  writeTextFile(path, "rewritten\n");
+  results.clear();
+  EXPECT_TRUE(cache.get("test", path, parser, results));
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["line"], "rewritten");
+
+  results.clear();
+  EXPECT_FALSE(cache.get("test", path + "_missing", parser, results));
+  EXPECT_TRUE(results.empty());
+}
+
+TEST_F(SystemsTablesTests, test_package_inventory_cache) {
+  auto path = kTestWorkingDirectory + "package_database";
+  writeTextFile(path, "0");
+  boost::filesystem::last_write_time(path, std::time(nullptr) - 10);
+
+  size_t generated = 0;
+  auto generate = [&generated]() {
+    generated++;
+    Row r = {{"name", "package"}};
+    return QueryData{r};
+  };
+
+  PackageInventoryCache cache(path);
+  auto results = cache.get(generate);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0]["name"], "package");
+  EXPECT_EQ(generated, 1U);
+
+  // The unchanged database's inventory is reused.
+  results = cache.get(generate);
+  EXPECT_EQ(results.size(), 1U);
+  EXPECT_EQ(generated, 1U);
+
+  // A changed database is read again.
+  writeTextFile(path, "10");
+  boost::filesystem::last_write_time(path, std::time(nullptr) - 5);
+  cache.get(generate);
+  EXPECT_EQ(generated, 2U);
+
+  // A missing database is always read.
+  PackageInventoryCache missing(path + "_missing");
+  missing.get(generate);
+  missing.get(generate);
+  EXPECT_EQ(generated, 4U);
+}
+
+#ifdef __linux__
+TEST_F(SystemsTablesTests, test_nss_cache) {
+  auto& cache = NSSCache::instance();
+  cache.clear();
+
+  // Point lookups do not require an enumeration.
+  UserEntry user;
+  EXPECT_TRUE(cache.getUser(0, user));
+  EXPECT_EQ(user.username, "root");
+  EXPECT_TRUE(cache.getUser("root", user));
+  EXPECT_EQ(user.uid, 0U);
+
+  GroupEntry group;
+  EXPECT_TRUE(cache.getGroup(0, group));
+
+  // A missing entry is reported, and reported again from the cache.
+  EXPECT_FALSE(cache.getUser(static_cast<uid_t>(-2), user));
+  EXPECT_FALSE(cache.getUser(static_cast<uid_t>(-2), user));
+
+  // Enumerations are shared until they expire or the local files change.
+  auto users = cache.getUsers();
+  EXPECT_FALSE(users->empty());
+  EXPECT_EQ(users, cache.getUsers());
+  EXPECT_FALSE(cache.getGroups()->empty());
+
+  cache.clear();
+  EXPECT_NE(users, cache.getUsers());
+}
+
+TEST_F(SystemsTablesTests, test_boot_cache) {
+  auto& cache = BootCache::instance();
+  cache.clear();
+
+  std::string value;
+  EXPECT_FALSE(cache.get("test_missing", value));
+
+  // Values may be binary.
+  std::string content("\x00\x01table\xff", 8);
+  cache.set("test_value", content);
+  EXPECT_TRUE(cache.get("test_value", value));
+  EXPECT_EQ(value, content);
+
+  // The database copy is used by a new process during the same boot.
+  cache.clear();
+  if (isReadable("/proc/sys/kernel/random/boot_id")) {
+    value.clear();
+    EXPECT_TRUE(cache.get("test_value", value));
+    EXPECT_EQ(value, content);
+  }
+}
+
+TEST_F(SystemsTablesTests, test_kernel_modules) {
+  std::string content =
+      "nf_nat 24576 2 nf_nat_ipv4,xt_nat, Live 0xffffffffc0350000\n"
+      "crc32_pclmul 16384 0 - Live 0xffffffffc0340000 (E)\n"
+      "truncated 16384 0\n";
+
+  std::vector<KernelModule> modules;
+  parseKernelModules(content, modules);
+  ASSERT_EQ(modules.size(), 2U);
+  EXPECT_EQ(modules[0].name, "nf_nat");
+  EXPECT_EQ(modules[0].size, "24576");
+  EXPECT_EQ(modules[0].used_by, "nf_nat_ipv4,xt_nat");
+  EXPECT_EQ(modules[0].status, "Live");
+  EXPECT_EQ(modules[0].address, "0xffffffffc0350000");
+  EXPECT_EQ(modules[1].used_by, "-");
+
+  // Reference counts do not change the identity, a load does.
+  auto identity = getKernelModulesIdentity(modules);
+  std::vector<KernelModule> referenced;
+  parseKernelModules(
+      "nf_nat 24576 3 nf_nat_ipv4,xt_nat, Live 0xffffffffc0350000\n"
+      "crc32_pclmul 16384 0 - Live 0xffffffffc0340000 (E)\n",
+      referenced);
+  EXPECT_EQ(identity, getKernelModulesIdentity(referenced));
+
+  parseKernelModules("rootkit 4096 0 - Live 0xffffffffc0360000\n", modules);
+  EXPECT_NE(identity, getKernelModulesIdentity(modules));
+}
+
+TEST_F(SystemsTablesTests, test_hardware_cache) {
+  auto& cache = HardwareCache::instance();
+  cache.clear();
+
+  size_t generated = 0;
+  auto generate = [&generated]() {
+    generated++;
+    return QueryData{{{"name", "device"}}};
+  };
+
+  // Without a receiving monitor device changes are unknown.
+  size_t generation = 0;
+  if (!UdevEventPublisher::getDeviceGeneration(generation)) {
+    cache.get("test", generate);
+    cache.get("test", generate);
+    EXPECT_EQ(generated, 2U);
+  }
+
+  auto pub = std::make_shared<UdevEventPublisher>();
+  if (!pub->setUp().ok()) {
+    // The udev monitor is not available.
+    return;
+  }
+
+  generated = 0;
+  auto results = cache.get("test", generate);
+  EXPECT_EQ(results.size(), 1U);
+  cache.get("test", generate);
+  EXPECT_EQ(generated, 1U);
+
+  // Each subsystem is enumerated separately.
+  cache.get("other", generate);
+  EXPECT_EQ(generated, 2U);
+
+  // Events are not received once the monitor stops.
+  pub->tearDown();
+  cache.get("test", generate);
+  cache.get("test", generate);
+  EXPECT_EQ(generated, 4U);
+}
+
+TEST_F(SystemsTablesTests, test_statfs_pool_blocked) {
+  auto timeout = FLAGS_mounts_statfs_timeout;
+  FLAGS_mounts_statfs_timeout = 20;
+
+  // A statfs of a hung mount blocks until released.
+  std::mutex mutex;
+  std::condition_variable released;
+  bool hung = true;
+  auto func = [&mutex, &released, &hung](const char* path, struct statfs* st) {
+    if (std::string(path).find("/hung") == 0) {
+      std::unique_lock<std::mutex> lock(mutex);
+      released.wait(lock, [&hung]() { return !hung; });
+    }
+    st->f_blocks = 1;
+    return 0;
+  };
+
+  // The helpers are detached, the pool outlives them.
+  auto pool = new StatfsPool(func);
+  auto deadline = []() {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(20);
+  };
+
+  // Block more helpers than the limit.
+  std::vector<std::shared_ptr<StatfsRequest>> requests;
+  for (size_t i = 0; i < kMaxStatfsWorkers + 2; i++) {
+    auto request = pool->request("/hung/" + std::to_string(i));
+    ASSERT_NE(request, nullptr);
+    EXPECT_FALSE(pool->wait(request, deadline()));
+    requests.push_back(request);
+  }
+
+  // A stale mount is skipped.
+  EXPECT_EQ(pool->request("/hung/0"), nullptr);
+
+  // A responsive mount is still answered by a helper that is not blocked.
+  auto request = pool->request("/ok");
+  ASSERT_NE(request, nullptr);
+  EXPECT_TRUE(pool->wait(request, deadline() + std::chrono::seconds(1)));
+  EXPECT_TRUE(request->ok);
+  EXPECT_EQ(request->st.f_blocks, 1U);
+  EXPECT_GT(pool->workers(), kMaxStatfsWorkers);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    hung = false;
+  }
+  released.notify_all();
+  for (const auto& hung_request : requests) {
+    FLAGS_mounts_statfs_timeout = 0;
+    EXPECT_TRUE(pool->wait(hung_request, deadline()));
+  }
+  FLAGS_mounts_statfs_timeout = timeout;
+}
+#endif
+
+TEST_F(SystemsTablesTests, test_typed_rows) {
+  static_assert(UptimeRow::kColumnCount == 5, "uptime has 5 columns");
+  static_assert(UptimeRow::kTotalSeconds == 4, "ordinals follow the spec");
+  EXPECT_STREQ(UptimeRow::columnName(UptimeRow::kHours), "hours");
+
+  UptimeRow row;
+  row.days = 1;
+  row.total_seconds = 90000;
+  row.nulls.set(UptimeRow::kMinutes);
+
+  // The JSON matches the JSON of the equivalent Row.
+  std::string json;
+  RowStructTraits<UptimeRow>::serializeJSON(row, json);
+
+  TableColumns columns;
+  for (size_t i = 0; i < UptimeRow::kColumnCount; ++i) {
+    columns.push_back(std::make_tuple(
+        UptimeRow::columnName(i), BIGINT_TYPE, ColumnOptions::DEFAULT));
+  }
+  std::vector<UptimeRow> rows = {row};
+  auto results = toQueryData(rows, columns);
+  ASSERT_EQ(results.size(), 1U);
+  EXPECT_EQ(results[0].count("minutes"), 0U);
+  EXPECT_EQ(results[0]["total_seconds"], "90000");
+
+  std::string expected;
+  serializeRowJSON(results[0], expected);
+  EXPECT_EQ(json, expected);
+
+  // The table's typed rows are read by the virtual table cursor.
+  auto uptime = SQL("select total_seconds from uptime");
+  ASSERT_EQ(uptime.rows().size(), 1U);
+  EXPECT_FALSE(uptime.rows()[0].at("total_seconds").empty());
+}
 }
 }
@@ -10,6 +10,8 @@
 
 #include <osquery/tables.h>
 
+#include "generated/rows/uptime.h"
+
 #if defined(__APPLE__)
 #include <time.h>
 #include <errno.h>
@@ -48,17 +50,17 @@ long getUptime() {
   return -1;
 }
 
-QueryData genUptime(QueryContext& context) {
-  Row r;
-  QueryData results;
+std::vector<UptimeRow> genUptime(QueryContext& context) {
+  std::vector<UptimeRow> results;
   long uptime_in_seconds = getUptime();
 
   if (uptime_in_seconds >= 0) {
-    r["days"] = INTEGER(uptime_in_seconds / 60 / 60 / 24);
-    r["hours"] = INTEGER((uptime_in_seconds / 60 / 60) % 24);
-    r["minutes"] = INTEGER((uptime_in_seconds / 60) % 60);
-    r["seconds"] = INTEGER(uptime_in_seconds % 60);
-    r["total_seconds"] = BIGINT(uptime_in_seconds);
+    UptimeRow r;
+    r.days = uptime_in_seconds / 60 / 60 / 24;
+    r.hours = (uptime_in_seconds / 60 / 60) % 24;
+    r.minutes = (uptime_in_seconds / 60) % 60;
+    r.seconds = uptime_in_seconds % 60;
+    r.total_seconds = uptime_in_seconds;
     results.push_back(r);
   }
 
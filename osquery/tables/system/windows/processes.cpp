@@ -9,8 +9,10 @@
  */
 
 #include <map>
+#include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <stdlib.h>
 
@@ -27,64 +29,330 @@
 namespace osquery {
 namespace tables {
 
-std::set<long> getProcList(const QueryContext& context) {
-  std::set<long> pidlist;
+/// The SystemInformationClass of a process and thread snapshot.
+const ULONG kSystemProcessInformation = 5;
+
+/// Returned if the snapshot buffer is too small.
+const LONG kStatusInfoLengthMismatch = static_cast<LONG>(0xC0000004L);
+
+/// The documented prefix of UNICODE_STRING.
+struct SystemUnicodeString {
+  USHORT Length;
+  USHORT MaximumLength;
+  PWSTR Buffer;
+};
+
+/**
+* @brief A process entry of a SystemProcessInformation snapshot
+*
+* The winternl.h declaration reserves the times and most counters, this is
+* the complete layout of the leading members.
+*/
+struct SystemProcessInformation {
+  ULONG NextEntryOffset;
+  ULONG NumberOfThreads;
+  LARGE_INTEGER WorkingSetPrivateSize;
+  ULONG HardFaultCount;
+  ULONG NumberOfThreadsHighWatermark;
+  ULONGLONG CycleTime;
+  LARGE_INTEGER CreateTime;
+  LARGE_INTEGER UserTime;
+  LARGE_INTEGER KernelTime;
+  SystemUnicodeString ImageName;
+  LONG BasePriority;
+  HANDLE UniqueProcessId;
+  HANDLE InheritedFromUniqueProcessId;
+  ULONG HandleCount;
+  ULONG SessionId;
+  ULONG_PTR UniqueProcessKey;
+  SIZE_T PeakVirtualSize;
+  SIZE_T VirtualSize;
+  ULONG PageFaultCount;
+  SIZE_T PeakWorkingSetSize;
+  SIZE_T WorkingSetSize;
+  SIZE_T QuotaPeakPagedPoolUsage;
+  SIZE_T QuotaPagedPoolUsage;
+  SIZE_T QuotaPeakNonPagedPoolUsage;
+  SIZE_T QuotaNonPagedPoolUsage;
+  SIZE_T PagefileUsage;
+  SIZE_T PeakPagefileUsage;
+  SIZE_T PrivatePageCount;
+};
+
+using NtQuerySystemInformationFn = LONG(WINAPI*)(ULONG, PVOID, ULONG, PULONG);
+
+/// The Win32_Process property read for each column.
+const std::map<std::string, std::string> kWmiProcessProperties = {
+    {"pid", "ProcessId"},
+    {"name", "Name"},
+    {"path", "ExecutablePath"},
+    {"on_disk", "ExecutablePath"},
+    {"cmdline", "CommandLine"},
+    {"state", "ExecutionState"},
+    {"parent", "ParentProcessId"},
+    {"nice", "Priority"},
+};
+
+/**
+* @brief Build a single Win32_Process query for every requested process
+*
+* Only the properties of the columns used by the query are selected, and
+* pid constraints are applied by WMI.
+*/
+std::string getProcessQuery(const QueryContext& context,
+                            const std::set<std::string>& properties) {
+  std::string query =
+      "SELECT " +
+      osquery::join(
+          std::vector<std::string>(properties.begin(), properties.end()),
+          ", ") +
+      " FROM Win32_Process";
   if (context.constraints.count("pid") > 0 &&
       context.constraints.at("pid").exists(EQUALS)) {
+    std::vector<std::string> pids;
     for (const auto& pid : context.constraints.at("pid").getAll<int>(EQUALS)) {
       if (pid > 0) {
-        pidlist.insert(pid);
+        pids.push_back("ProcessId=" + std::to_string(pid));
       }
     }
-    return pidlist;
-  } else {
-    WmiRequest request("SELECT ProcessId FROM Win32_Process");
-    if (request.getStatus().ok()) {
-      long placeHolder;
-      Status s;
-      for (auto const& result : request.results()) {
-        s = result.GetLong("ProcessId", placeHolder);
-        if (!s.ok()) {
-          continue;
-        }
-        pidlist.insert(placeHolder);
-      }
+    // Process IDs are positive, constraints on others select no processes.
+    if (pids.empty()) {
+      return "";
     }
-    return pidlist;
+    query += " WHERE " + osquery::join(pids, " OR ");
   }
+  return query;
 }
 
-void genProcess(long pid, QueryData& results_data) {
-  std::stringstream ss;
-  ss << "SELECT * FROM Win32_Process WHERE ProcessId=" << pid;
+void genProcess(const WmiResultItem& result, QueryData& results_data) {
+  Row r;
+  Status s;
+  long lPlaceHolder = -1;
+  std::string sPlaceHolder;
+
+  s = result.GetLong("ProcessId", lPlaceHolder);
+  r["pid"] = s.ok() ? BIGINT(lPlaceHolder) : BIGINT(-1);
+  s = result.GetString("Name", sPlaceHolder);
+  r["name"] = SQL_TEXT(sPlaceHolder);
+  s = result.GetString("ExecutablePath", sPlaceHolder);
+  r["path"] = SQL_TEXT(sPlaceHolder);
+  s = result.GetString("CommandLine", sPlaceHolder);
+  r["cmdline"] = SQL_TEXT(sPlaceHolder);
+  s = result.GetString("ExecutionState", sPlaceHolder);
+  r["state"] = SQL_TEXT(sPlaceHolder);
+  lPlaceHolder = -1;
+  s = result.GetLong("ParentProcessId", lPlaceHolder);
+  r["parent"] = BIGINT(lPlaceHolder);
+  lPlaceHolder = 0;
+  s = result.GetLong("Priority", lPlaceHolder);
+  r["nice"] = INTEGER(lPlaceHolder);
+  r["on_disk"] = osquery::pathExists(r["path"]).toString();
 
-  WmiRequest request(ss.str());
+  // TODO: some of these such as cwd, wired_size, phys_footprint
+  // should be retrievable either via Windows API or WMI
+  r["cwd"] = "";
+  r["root"] = "";
+
+  r["pgroup"] = "-1";
+  r["uid"] = "-1";
+  r["euid"] = "-1";
+  r["suid"] = "-1";
+  r["gid"] = "-1";
+  r["egid"] = "-1";
+  r["sgid"] = "-1";
+
+  r["wired_size"] = "0";
+  r["resident_size"] = "0"; // Populate with WorkingSetSize (VT_BSTR)
+  r["phys_footprint"] = "0";
+
+  r["user_time"] = "0";
+  r["system_time"] = "0";
+  r["start_time"] = "0";
+
+  results_data.push_back(r);
+}
+
+/// Generate process rows from Win32_Process, the fallback backend.
+void genProcessesFromWmi(const QueryContext& context, QueryData& results) {
+  std::set<std::string> properties = {"ProcessId"};
+  for (const auto& column : kWmiProcessProperties) {
+    if (context.isColumnUsed(column.first)) {
+      properties.insert(column.second);
+    }
+  }
+
+  auto query = getProcessQuery(context, properties);
+  if (query.empty()) {
+    return;
+  }
+
+  WmiRequest request(query);
   if (request.getStatus().ok()) {
-    std::vector<WmiResultItem>& results = request.results();
-    if (results.size() == 1) {
+    for (const auto& result : request.results()) {
+      genProcess(result, results);
+    }
+  }
+}
+
+/// Convert a counted wide string, such as a process image name, to UTF-8.
+static std::string wideToString(const wchar_t* src, size_t length) {
+  if (src == nullptr || length == 0) {
+    return "";
+  }
+
+  auto size = ::WideCharToMultiByte(CP_UTF8,
+                                    0,
+                                    src,
+                                    static_cast<int>(length),
+                                    nullptr,
+                                    0,
+                                    nullptr,
+                                    nullptr);
+  std::string narrow(size, '\0');
+  ::WideCharToMultiByte(CP_UTF8,
+                        0,
+                        src,
+                        static_cast<int>(length),
+                        &narrow[0],
+                        size,
+                        nullptr,
+                        nullptr);
+  return narrow;
+}
+
+/**
+* @brief Get the command line of each process from a single WMI request
+*
+* The command line is within the memory of each process, Win32_Process reads
+* it for every selected process in one request.
+*/
+static std::map<long, std::string> getProcessCommandLines(
+    const QueryContext& context) {
+  std::map<long, std::string> cmdlines;
+  auto query = getProcessQuery(context, {"ProcessId", "CommandLine"});
+  if (query.empty()) {
+    return cmdlines;
+  }
+
+  WmiRequest request(query);
+  if (request.getStatus().ok()) {
+    for (const auto& result : request.results()) {
+      long pid = -1;
+      std::string cmdline;
+      if (result.GetLong("ProcessId", pid).ok()) {
+        result.GetString("CommandLine", cmdline);
+        cmdlines[pid] = std::move(cmdline);
+      }
+    }
+  }
+  return cmdlines;
+}
+
+/// Get the full path of a process image, opening the process.
+static std::string getProcessPath(long pid) {
+  auto process = ::OpenProcess(
+      PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>(pid));
+  if (process == nullptr) {
+    return "";
+  }
+
+  std::string path;
+  char buffer[MAX_PATH + 1] = {0};
+  DWORD size = MAX_PATH;
+  if (::QueryFullProcessImageNameA(process, 0, buffer, &size)) {
+    path = std::string(buffer, size);
+  }
+  ::CloseHandle(process);
+  return path;
+}
+
+/// Convert a 100-nanosecond interval into milliseconds.
+static inline long long intervalToMillis(const LARGE_INTEGER& interval) {
+  return interval.QuadPart / 10000;
+}
+
+/**
+* @brief Generate process rows from a single system process snapshot
+*
+* NtQuerySystemInformation returns the pid, parent, threads, priority,
+* memory, and CPU times of every process in one call. Processes are only
+* opened for the path, and the command lines are read with one WMI request.
+*
+* @return false if the snapshot is not available.
+*/
+bool genProcessesFromSnapshot(const QueryContext& context, QueryData& results) {
+  static auto query_information = reinterpret_cast<NtQuerySystemInformationFn>(
+      ::GetProcAddress(::GetModuleHandleA("ntdll.dll"),
+                       "NtQuerySystemInformation"));
+  if (query_information == nullptr) {
+    return false;
+  }
+
+  // The process list may grow between calls, retry with the returned size.
+  std::vector<unsigned char> buffer(512 * 1024);
+  ULONG size = 0;
+  LONG status = kStatusInfoLengthMismatch;
+  for (size_t attempt = 0; attempt < 8; attempt++) {
+    status = query_information(kSystemProcessInformation,
+                               buffer.data(),
+                               static_cast<ULONG>(buffer.size()),
+                               &size);
+    if (status != kStatusInfoLengthMismatch) {
+      break;
+    }
+    buffer.resize(size + 64 * 1024);
+  }
+  if (status < 0) {
+    return false;
+  }
+
+  std::set<long> pids;
+  if (context.constraints.count("pid") > 0 &&
+      context.constraints.at("pid").exists(EQUALS)) {
+    for (const auto& pid : context.constraints.at("pid").getAll<int>(EQUALS)) {
+      if (pid > 0) {
+        pids.insert(pid);
+      }
+    }
+    if (pids.empty()) {
+      return true;
+    }
+  }
+
+  std::map<long, std::string> cmdlines;
+  if (context.isColumnUsed("cmdline")) {
+    cmdlines = getProcessCommandLines(context);
+  }
+  bool read_path = context.isAnyColumnUsed({"path", "on_disk"});
+
+  // Start times are reported in seconds since boot.
+  FILETIME now;
+  ::GetSystemTimeAsFileTime(&now);
+  ULARGE_INTEGER boot;
+  boot.LowPart = now.dwLowDateTime;
+  boot.HighPart = now.dwHighDateTime;
+  boot.QuadPart -= ::GetTickCount64() * 10000;
+
+  size_t offset = 0;
+  while (offset + sizeof(SystemProcessInformation) <= buffer.size()) {
+    const auto* process = reinterpret_cast<const SystemProcessInformation*>(
+        buffer.data() + offset);
+    auto pid = static_cast<long>(
+        reinterpret_cast<ULONG_PTR>(process->UniqueProcessId));
+    if (pids.empty() || pids.count(pid) > 0) {
       Row r;
-      Status s;
-      long lPlaceHolder;
-      std::string sPlaceHolder;
-
-      s = results[0].GetLong("ProcessId", lPlaceHolder);
-      r["pid"] = s.ok() ? BIGINT(lPlaceHolder) : BIGINT(-1);
-      s = results[0].GetString("Name", sPlaceHolder);
-      r["name"] = SQL_TEXT(sPlaceHolder);
-      s = results[0].GetString("ExecutablePath", sPlaceHolder);
-      r["path"] = SQL_TEXT(sPlaceHolder);
-      s = results[0].GetString("CommandLine", sPlaceHolder);
-      r["cmdline"] = SQL_TEXT(sPlaceHolder);
-      s = results[0].GetString("ExecutionState", sPlaceHolder);
-      r["state"] = SQL_TEXT(sPlaceHolder);
-      s = results[0].GetLong("ParentProcessId", lPlaceHolder);
-      r["parent"] = BIGINT(lPlaceHolder);
-      s = results[0].GetLong("Priority", lPlaceHolder);
-      r["nice"] = INTEGER(lPlaceHolder);
+      r["pid"] = BIGINT(pid);
+      r["parent"] = BIGINT(static_cast<long>(reinterpret_cast<ULONG_PTR>(
+          process->InheritedFromUniqueProcessId)));
+      r["name"] = wideToString(process->ImageName.Buffer,
+                               process->ImageName.Length / sizeof(wchar_t));
+      r["threads"] = INTEGER(process->NumberOfThreads);
+      r["nice"] = INTEGER(process->BasePriority);
+      r["path"] = (read_path) ? getProcessPath(pid) : "";
+      r["cmdline"] = (cmdlines.count(pid) > 0) ? cmdlines.at(pid) : "";
+      r["state"] = "";
       r["on_disk"] = osquery::pathExists(r["path"]).toString();
 
-      // TODO: some of these such as cwd, wired_size, phys_footprint
-      // should be retrievable either via Windows API or WMI
       r["cwd"] = "";
       r["root"] = "";
 
@@ -97,24 +365,31 @@ void genProcess(long pid, QueryData& results_data) {
       r["sgid"] = "-1";
 
       r["wired_size"] = "0";
-      r["resident_size"] = "0"; // Populate with WorkingSetSize (VT_BSTR)
-      r["phys_footprint"] = "0";
+      r["resident_size"] = BIGINT(process->WorkingSetSize);
+      r["phys_footprint"] = BIGINT(process->VirtualSize);
 
-      r["user_time"] = "0";
-      r["system_time"] = "0";
-      r["start_time"] = "0";
+      r["user_time"] = BIGINT(intervalToMillis(process->UserTime));
+      r["system_time"] = BIGINT(intervalToMillis(process->KernelTime));
+      auto start = static_cast<ULONGLONG>(process->CreateTime.QuadPart);
+      r["start_time"] = (start > boot.QuadPart)
+                            ? BIGINT((start - boot.QuadPart) / 10000000)
+                            : "0";
+      results.push_back(std::move(r));
+    }
 
-      results_data.push_back(r);
+    if (process->NextEntryOffset == 0) {
+      break;
     }
+    offset += process->NextEntryOffset;
   }
+  return true;
 }
 
 QueryData genProcesses(QueryContext& context) {
   QueryData results;
 
-  auto pidlist = getProcList(context);
-  for (const auto& pid : pidlist) {
-    genProcess(pid, results);
+  if (!genProcessesFromSnapshot(context, results)) {
+    genProcessesFromWmi(context, results);
   }
 
   return results;
@@ -14,13 +14,18 @@
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
 
+#include <ctype.h>
+
 #include <iterator>
 #include <map>
+#include <set>
 #include <string>
+#include <vector>
 
 #include <boost/algorithm/hex.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
 
 #include <osquery/core.h>
 #include <osquery/tables.h>
@@ -68,125 +73,284 @@ static LONGLONG filetimeToUnixtime(FILETIME ft) {
   return date.QuadPart / 10000000;
 };
 
-/// Microsoft helper function for getting the contents of a registry key
-void queryKey(const std::string& hive,
-              const std::string& key,
-              QueryData& results) {
+/// The subkey depth walked below the literal prefix of a key pattern.
+const size_t kRegistryMaxDepth = 32;
+
+/**
+ * @brief Registry keys opened by a single query
+ *
+ * A key is opened relative to its parent when the parent is already open,
+ * and each key is opened once. Every handle is closed with the cache.
+ */
+class RegistryKeyCache : private boost::noncopyable {
+ public:
+  ~RegistryKeyCache() {
+    for (auto& key : keys_) {
+      if (key.second != nullptr) {
+        RegCloseKey(key.second);
+      }
+    }
+  }
+
+  /// Open a key of a hive for reading, nullptr if it cannot be opened.
+  HKEY open(const std::string& hive, const std::string& key);
+
+ private:
+  /// Opened, or failed, keys by hive and key.
+  std::map<std::pair<std::string, std::string>, HKEY> keys_;
+};
+
+HKEY RegistryKeyCache::open(const std::string& hive, const std::string& key) {
   if (kRegistryHives.count(hive) != 1) {
-    return;
+    return nullptr;
   }
 
-  HKEY hRegistryHandle;
-  auto ret = RegOpenKeyEx(kRegistryHives.at(hive),
-                          TEXT(key.c_str()),
-                          0,
-                          KEY_READ,
-                          &hRegistryHandle);
+  if (key.empty()) {
+    return kRegistryHives.at(hive);
+  }
 
-  if (ret != ERROR_SUCCESS) {
+  auto id = std::make_pair(hive, key);
+  auto cached = keys_.find(id);
+  if (cached != keys_.end()) {
+    return cached->second;
+  }
+
+  HKEY parent = kRegistryHives.at(hive);
+  auto leaf = key;
+  auto separator = key.rfind('\\');
+  if (separator != std::string::npos) {
+    auto opened = keys_.find(std::make_pair(hive, key.substr(0, separator)));
+    if (opened != keys_.end() && opened->second != nullptr) {
+      parent = opened->second;
+      leaf = key.substr(separator + 1);
+    }
+  }
+
+  HKEY handle = nullptr;
+  if (RegOpenKeyEx(parent, TEXT(leaf.c_str()), 0, KEY_READ, &handle) !=
+      ERROR_SUCCESS) {
+    handle = nullptr;
+  }
+  keys_[id] = handle;
+  return handle;
+}
+
+/// Match a SQL LIKE pattern, ignoring case as SQLite and the registry do.
+static bool matchesLike(const std::string& value, const std::string& pattern) {
+  size_t v = 0;
+  size_t p = 0;
+  size_t star = std::string::npos;
+  size_t resume = 0;
+  while (v < value.size()) {
+    if (p < pattern.size() &&
+        (pattern[p] == '_' || ::tolower(pattern[p]) == ::tolower(value[v]))) {
+      v++;
+      p++;
+    } else if (p < pattern.size() && pattern[p] == '%') {
+      star = p++;
+      resume = v;
+    } else if (star != std::string::npos) {
+      p = star + 1;
+      v = ++resume;
+    } else {
+      return false;
+    }
+  }
+
+  while (p < pattern.size() && pattern[p] == '%') {
+    p++;
+  }
+  return p == pattern.size();
+}
+
+/// Enumerate the names of a key's subkeys.
+static std::vector<std::string> getSubkeys(HKEY handle) {
+  std::vector<std::string> subkeys;
+  DWORD cSubKeys = 0;
+  DWORD cchMaxSubKey = 0;
+  if (RegQueryInfoKey(handle,
+                      nullptr,
+                      nullptr,
+                      nullptr,
+                      &cSubKeys,
+                      &cchMaxSubKey,
+                      nullptr,
+                      nullptr,
+                      nullptr,
+                      nullptr,
+                      nullptr,
+                      nullptr) != ERROR_SUCCESS) {
+    return subkeys;
+  }
+
+  std::vector<TCHAR> achKey(cchMaxSubKey + 1);
+  for (DWORD i = 0; i < cSubKeys; i++) {
+    DWORD cchName = static_cast<DWORD>(achKey.size());
+    if (RegEnumKeyEx(handle,
+                     i,
+                     achKey.data(),
+                     &cchName,
+                     nullptr,
+                     nullptr,
+                     nullptr,
+                     nullptr) == ERROR_SUCCESS) {
+      subkeys.push_back(std::string(achKey.data(), cchName));
+    }
+  }
+  return subkeys;
+}
+
+/**
+ * @brief Find the keys of a hive matching a LIKE pattern
+ *
+ * Only the subtree below the pattern's literal prefix is walked. A pattern
+ * without a '%' cannot match keys longer than itself.
+ */
+static void expandKeyPattern(RegistryKeyCache& cache,
+                             const std::string& hive,
+                             const std::string& pattern,
+                             std::set<std::string>& keys) {
+  auto wildcard = pattern.find_first_of("%_");
+  if (wildcard == std::string::npos) {
+    keys.insert(pattern);
     return;
   }
 
-  const DWORD maxKeyLength = 255;
-  const DWORD maxValueName = 16383;
-  TCHAR achClass[MAX_PATH] = TEXT("");
-  DWORD cchClassName = MAX_PATH;
+  auto prefix = pattern.substr(0, wildcard);
+  auto separator = prefix.rfind('\\');
+  auto root =
+      (separator == std::string::npos) ? "" : prefix.substr(0, separator);
+  bool bounded = (pattern.find('%') == std::string::npos);
+
+  std::vector<std::pair<std::string, size_t>> pending = {{root, 0}};
+  while (!pending.empty()) {
+    auto current = pending.back();
+    pending.pop_back();
+    if (matchesLike(current.first, pattern)) {
+      keys.insert(current.first);
+    }
+
+    if (current.second >= kRegistryMaxDepth) {
+      continue;
+    }
+
+    auto handle = cache.open(hive, current.first);
+    if (handle == nullptr) {
+      continue;
+    }
+
+    for (const auto& subkey : getSubkeys(handle)) {
+      auto child =
+          (current.first.empty()) ? subkey : current.first + "\\" + subkey;
+      // Skip subkeys that diverge from the literal prefix.
+      auto length = std::min(child.size(), prefix.size());
+      if (!boost::iequals(child.substr(0, length), prefix.substr(0, length))) {
+        continue;
+      }
+
+      if (bounded && child.size() > pattern.size()) {
+        continue;
+      }
+      pending.push_back(std::make_pair(child, current.second + 1));
+    }
+  }
+}
+
+/// Microsoft helper function for getting the contents of a registry key
+static void queryKey(HKEY hRegistryHandle,
+                     const std::string& hive,
+                     const std::string& key,
+                     QueryData& results) {
   DWORD cSubKeys = 0;
-  DWORD cbMaxSubKey;
-  DWORD cchMaxClass;
-  DWORD cValues;
-  DWORD cchMaxValueName;
-  DWORD cbMaxValueData;
-  DWORD cbSecurityDescriptor;
+  DWORD cchMaxSubKey = 0;
+  DWORD cValues = 0;
+  DWORD cchMaxValueName = 0;
+  DWORD cbMaxValueData = 0;
   DWORD retCode;
   FILETIME ftLastWriteTime;
   retCode = RegQueryInfoKey(hRegistryHandle,
-                            achClass,
-                            &cchClassName,
+                            nullptr,
+                            nullptr,
                             nullptr,
                             &cSubKeys,
-                            &cbMaxSubKey,
-                            &cchMaxClass,
+                            &cchMaxSubKey,
+                            nullptr,
                             &cValues,
                             &cchMaxValueName,
                             &cbMaxValueData,
-                            &cbSecurityDescriptor,
+                            nullptr,
                             &ftLastWriteTime);
+  if (retCode != ERROR_SUCCESS) {
+    return;
+  }
 
-  TCHAR achKey[maxKeyLength];
-  DWORD cbName;
+  // Buffers are sized once from the key's longest names and data.
+  std::vector<TCHAR> achKey(cchMaxSubKey + 1);
+  DWORD cchName;
 
   // Process registry subkeys
-  if (cSubKeys > 0) {
-    for (DWORD i = 0; i < cSubKeys; i++) {
-      cbName = maxKeyLength;
-      retCode = RegEnumKeyEx(hRegistryHandle,
-                             i,
-                             achKey,
-                             &cbName,
-                             nullptr,
-                             nullptr,
-                             nullptr,
-                             &ftLastWriteTime);
-      if (retCode != ERROR_SUCCESS) {
-        continue;
-      }
-      Row r;
-      fs::path keyPath(key);
-      r["hive"] = hive;
-      r["key"] = keyPath.string();
-      r["subkey"] = (keyPath / achKey).string();
-      r["name"] = "(Default)";
-      r["type"] = "REG_SZ";
-      r["data"] = "(value not set)";
-      r["mtime"] = std::to_string(filetimeToUnixtime(ftLastWriteTime));
-      results.push_back(r);
+  fs::path keyPath(key);
+  for (DWORD i = 0; i < cSubKeys; i++) {
+    cchName = static_cast<DWORD>(achKey.size());
+    FILETIME ftSubKeyWriteTime;
+    retCode = RegEnumKeyEx(hRegistryHandle,
+                           i,
+                           achKey.data(),
+                           &cchName,
+                           nullptr,
+                           nullptr,
+                           nullptr,
+                           &ftSubKeyWriteTime);
+    if (retCode != ERROR_SUCCESS) {
+      continue;
     }
+    Row r;
+    r["hive"] = hive;
+    r["key"] = keyPath.string();
+    r["subkey"] = (keyPath / std::string(achKey.data(), cchName)).string();
+    r["name"] = "(Default)";
+    r["type"] = "REG_SZ";
+    r["data"] = "(value not set)";
+    r["mtime"] = std::to_string(filetimeToUnixtime(ftSubKeyWriteTime));
+    results.push_back(r);
   }
 
   if (cValues <= 0) {
     return;
   }
 
-  BYTE* bpDataBuff = new BYTE[cbMaxValueData];
-  DWORD cchValue = maxKeyLength;
-  TCHAR achValue[maxValueName];
+  // The data buffer has room for terminators of string and multi-string
+  // values stored without them.
+  std::vector<BYTE> dataBuff(cbMaxValueData + 2 * sizeof(wchar_t));
+  BYTE* bpDataBuff = dataBuff.data();
+  std::vector<TCHAR> achValue(cchMaxValueName + 1);
 
-  // Process registry values
-  for (size_t i = 0, retCode = ERROR_SUCCESS; i < cValues; i++) {
-    size_t cnt = 0;
-    ZeroMemory(bpDataBuff, cbMaxValueData);
-    cchValue = maxValueName;
+  // Process registry values, the name, type, and data are read together.
+  for (DWORD i = 0; i < cValues; i++) {
+    ZeroMemory(bpDataBuff, dataBuff.size());
+    DWORD cchValue = static_cast<DWORD>(achValue.size());
+    DWORD lpData = cbMaxValueData;
+    DWORD lpType;
     achValue[0] = '\0';
 
     retCode = RegEnumValue(hRegistryHandle,
-                           static_cast<DWORD>(i),
-                           achValue,
+                           i,
+                           achValue.data(),
                            &cchValue,
                            nullptr,
-                           nullptr,
-                           nullptr,
-                           nullptr);
-
-    if (retCode != ERROR_SUCCESS) {
-      continue;
-    }
-
-    DWORD lpData = cbMaxValueData;
-    DWORD lpType;
-    retCode = RegQueryValueEx(
-        hRegistryHandle, achValue, 0, &lpType, bpDataBuff, &lpData);
+                           &lpType,
+                           bpDataBuff,
+                           &lpData);
 
     if (retCode != ERROR_SUCCESS) {
       continue;
     }
 
     Row r;
-    fs::path keyPath(key);
     r["hive"] = hive;
     r["key"] = keyPath.string();
     r["subkey"] = keyPath.string();
-    r["name"] = achValue;
+    r["name"] = std::string(achValue.data(), cchValue);
     if (kRegistryTypes.count(lpType) > 0) {
       r["type"] = kRegistryTypes.at(lpType);
     } else {
@@ -194,35 +358,28 @@ void queryKey(const std::string& hive,
     }
     r["mtime"] = std::to_string(filetimeToUnixtime(ftLastWriteTime));
 
-    bpDataBuff[cbMaxValueData - 1] = 0x00;
-
     /// REG_LINK is a Unicode string, which in Windows is wchar_t
-    char* regLinkStr = nullptr;
+    std::vector<char> regLinkStr;
     if (lpType == REG_LINK) {
-      regLinkStr = new char[cbMaxValueData];
-      const size_t newSize = cbMaxValueData;
+      regLinkStr.resize(dataBuff.size());
       size_t convertedChars = 0;
       wcstombs_s(&convertedChars,
-                 regLinkStr,
-                 newSize,
+                 regLinkStr.data(),
+                 regLinkStr.size(),
                  (wchar_t*)bpDataBuff,
                  _TRUNCATE);
     }
 
     BYTE* bpDataBuffTmp = bpDataBuff;
     std::vector<std::string> multiSzStrs;
-    std::vector<char> regBinary;
     std::string data;
 
     switch (lpType) {
     case REG_FULL_RESOURCE_DESCRIPTOR:
     case REG_RESOURCE_LIST:
     case REG_BINARY:
-      for (unsigned int i = 0; i < cbMaxValueData; i++) {
-        regBinary.push_back((char)bpDataBuff[i]);
-      }
       boost::algorithm::hex(
-          regBinary.begin(), regBinary.end(), std::back_inserter(data));
+          bpDataBuff, bpDataBuff + lpData, std::back_inserter(data));
       r["data"] = data;
       break;
     case REG_DWORD:
@@ -235,7 +392,7 @@ void queryKey(const std::string& hive,
       r["data"] = std::string((char*)bpDataBuff);
       break;
     case REG_LINK:
-      r["data"] = std::string(regLinkStr);
+      r["data"] = std::string(regLinkStr.data());
       break;
     case REG_MULTI_SZ:
       while (*bpDataBuffTmp != 0x00) {
@@ -259,18 +416,22 @@ void queryKey(const std::string& hive,
       break;
     }
     results.push_back(r);
-    if (regLinkStr != nullptr) {
-      delete[](regLinkStr);
-    }
   }
-  delete[](bpDataBuff);
-  RegCloseKey(hRegistryHandle);
-};
+}
+
+void queryKey(const std::string& hive,
+              const std::string& key,
+              QueryData& results) {
+  RegistryKeyCache cache;
+  auto handle = cache.open(hive, key);
+  if (handle != nullptr) {
+    queryKey(handle, hive, key, results);
+  }
+}
 
 QueryData genRegistry(QueryContext& context) {
   QueryData results;
   std::set<std::string> rHives;
-  std::set<std::string> rKeys;
 
   /// By default, we display all HIVEs
   if (context.constraints["hive"].exists(EQUALS) &&
@@ -282,17 +443,29 @@ QueryData genRegistry(QueryContext& context) {
     }
   }
 
-  /// By default, we display all keys in each HIVE
-  if (context.constraints["key"].exists(EQUALS) &&
-      context.constraints["key"].getAll(EQUALS).size() > 0) {
-    rKeys = context.constraints["key"].getAll(EQUALS);
-  } else {
-    rKeys.insert("");
-  }
-
+  auto& constraints = context.constraints["key"];
+  auto patterns = constraints.getAll(LIKE);
   for (const auto& hive : rHives) {
+    // Keys, and the parents of LIKE matches, are opened once per hive.
+    RegistryKeyCache cache;
+    std::set<std::string> rKeys;
+
+    /// By default, we display all keys in each HIVE
+    if (constraints.exists(EQUALS) && constraints.getAll(EQUALS).size() > 0) {
+      rKeys = constraints.getAll(EQUALS);
+    } else if (!patterns.empty()) {
+      for (const auto& pattern : patterns) {
+        expandKeyPattern(cache, hive, pattern, rKeys);
+      }
+    } else {
+      rKeys.insert("");
+    }
+
     for (const auto& key : rKeys) {
-      queryKey(hive, key, results);
+      auto handle = cache.open(hive, key);
+      if (handle != nullptr) {
+        queryKey(handle, hive, key, results);
+      }
     }
   }
   return results;
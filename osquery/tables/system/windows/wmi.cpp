@@ -17,6 +17,9 @@
 namespace osquery {
 namespace tables {
 
+/// The number of result objects read from WMI at a time.
+const ULONG kWmiBatchSize = 64;
+
 /**
 * @brief Helper object used by Wide/Narrow converter functions
 *
@@ -219,59 +222,121 @@ Status WmiResultItem::GetVectorOfStrings(const std::string& name,
   return Status(0);
 }
 
-WmiRequest::WmiRequest(const std::string& query) {
-  std::wstring wql = string_to_wstring(query);
+/**
+* @brief Initialize COM once for each thread making WMI requests
+*
+* COM is uninitialized when the thread exits, keeping the multithreaded
+* apartment, and the shared connection, alive between requests.
+*/
+class WmiThreadInitializer {
+ public:
+  WmiThreadInitializer() {
+    ::CoInitializeEx(0, COINIT_MULTITHREADED);
+    // Security may only be initialized once per process, later calls fail.
+    ::CoInitializeSecurity(nullptr,
+                           -1,
+                           nullptr,
+                           nullptr,
+                           RPC_C_AUTHN_LEVEL_DEFAULT,
+                           RPC_C_IMP_LEVEL_IMPERSONATE,
+                           nullptr,
+                           EOAC_NONE,
+                           nullptr);
+  }
 
-  HRESULT hr = E_FAIL;
+  ~WmiThreadInitializer() {
+    ::CoUninitialize();
+  }
+};
+
+Status WmiConnection::get(IWbemServices** services) {
+  WriteLock lock(mutex_);
+  if (services_ == nullptr) {
+    HRESULT hr = E_FAIL;
+    if (locator_ == nullptr) {
+      hr = ::CoCreateInstance(CLSID_WbemLocator,
+                              0,
+                              CLSCTX_INPROC_SERVER,
+                              IID_IWbemLocator,
+                              (LPVOID*)&locator_);
+      if (hr != S_OK) {
+        locator_ = nullptr;
+        return Status(1, "Cannot create WMI locator");
+      }
+    }
 
-  hr = ::CoInitializeEx(0, COINIT_MULTITHREADED);
-  hr = ::CoInitializeSecurity(nullptr,
-                              -1,
-                              nullptr,
-                              nullptr,
-                              RPC_C_AUTHN_LEVEL_DEFAULT,
-                              RPC_C_IMP_LEVEL_IMPERSONATE,
-                              nullptr,
-                              EOAC_NONE,
-                              nullptr);
-  hr = ::CoCreateInstance(CLSID_WbemLocator,
-                          0,
-                          CLSCTX_INPROC_SERVER,
-                          IID_IWbemLocator,
-                          (LPVOID*)&locator_);
-  if (hr != S_OK) {
-    locator_ = nullptr;
-    return;
+    hr = locator_->ConnectServer(L"ROOT\\CIMV2",
+                                 nullptr,
+                                 nullptr,
+                                 nullptr,
+                                 0,
+                                 nullptr,
+                                 nullptr,
+                                 &services_);
+    if (hr != S_OK) {
+      services_ = nullptr;
+      return Status(1, "Cannot connect to WMI");
+    }
   }
 
-  hr = locator_->ConnectServer(L"ROOT\\CIMV2",
-                               nullptr,
-                               nullptr,
-                               nullptr,
-                               0,
-                               nullptr,
-                               nullptr,
-                               &services_);
-  if (hr != S_OK) {
+  services_->AddRef();
+  *services = services_;
+  return Status(0, "OK");
+}
+
+void WmiConnection::reset(IWbemServices* services) {
+  WriteLock lock(mutex_);
+  if (services_ != nullptr && services_ == services) {
+    services_->Release();
     services_ = nullptr;
-    return;
   }
+}
 
-  hr = services_->ExecQuery(
-      L"WQL", (BSTR)wql.c_str(), WBEM_FLAG_FORWARD_ONLY, nullptr, &enum_);
-  if (hr != S_OK) {
-    enum_ = nullptr;
+WmiRequest::WmiRequest(const std::string& query) {
+  static thread_local WmiThreadInitializer initializer;
+  std::wstring wql = string_to_wstring(query);
+
+  // A failed query may be a broken connection, reconnect and try once more.
+  HRESULT hr = E_FAIL;
+  auto& connection = WmiConnection::instance();
+  for (size_t attempt = 0; attempt < 2 && enum_ == nullptr; attempt++) {
+    status_ = connection.get(&services_);
+    if (!status_.ok()) {
+      services_ = nullptr;
+      return;
+    }
+
+    hr = services_->ExecQuery(
+        L"WQL",
+        (BSTR)wql.c_str(),
+        WBEM_FLAG_FORWARD_ONLY | WBEM_FLAG_RETURN_IMMEDIATELY,
+        nullptr,
+        &enum_);
+    if (hr != S_OK) {
+      enum_ = nullptr;
+      connection.reset(services_);
+      services_->Release();
+      services_ = nullptr;
+    }
+  }
+
+  if (enum_ == nullptr) {
+    status_ = Status(1, "WMI query failed: " + query);
     return;
   }
 
+  // Results are returned in batches, the last batch may be partial.
+  IWbemClassObject* objects[kWmiBatchSize];
   hr = WBEM_S_NO_ERROR;
   while (hr == WBEM_S_NO_ERROR) {
-    IWbemClassObject* result = nullptr;
     ULONG result_count = 0;
+    hr = enum_->Next(WBEM_INFINITE, kWmiBatchSize, objects, &result_count);
+    if (FAILED(hr)) {
+      break;
+    }
 
-    hr = enum_->Next(WBEM_INFINITE, 1, &result, &result_count);
-    if (SUCCEEDED(hr) && result_count > 0) {
-      results_.push_back(WmiResultItem(result));
+    for (ULONG i = 0; i < result_count; i++) {
+      results_.push_back(WmiResultItem(objects[i]));
     }
   }
 
@@ -279,8 +344,8 @@ WmiRequest::WmiRequest(const std::string& query) {
 }
 
 WmiRequest::WmiRequest(WmiRequest&& src) {
-  locator_ = nullptr;
-  std::swap(locator_, src.locator_);
+  status_ = src.status_;
+  std::swap(results_, src.results_);
 
   services_ = nullptr;
   std::swap(services_, src.services_);
@@ -301,13 +366,6 @@ WmiRequest::~WmiRequest() {
     services_->Release();
     services_ = nullptr;
   }
-
-  if (locator_ != nullptr) {
-    locator_->Release();
-    locator_ = nullptr;
-  }
-
-  ::CoUninitialize();
 }
 }
 }
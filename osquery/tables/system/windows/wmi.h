@@ -20,6 +20,9 @@
 
 #include <WbemIdl.h>
 
+#include <boost/noncopyable.hpp>
+
+#include <osquery/core.h>
 #include <osquery/tables.h>
 
 namespace osquery {
@@ -115,11 +118,55 @@ class WmiResultItem {
   IWbemClassObject* result_{nullptr};
 };
 
+/**
+* @brief A connection to the local WMI service shared by requests
+*
+* Initializing COM and connecting to ROOT\CIMV2 can take longer than
+* the query itself. Requests initialize COM once for each thread, in the
+* multithreaded apartment, and every thread in that apartment may use
+* the same services interface.
+*/
+class WmiConnection : private boost::noncopyable {
+ public:
+  static WmiConnection& instance() {
+    static WmiConnection connection;
+    return connection;
+  }
+
+  /**
+  * @brief Get the services interface, connecting if needed
+  *
+  * The caller must Release the returned reference.
+  *
+  * @returns Status indicating the success of the connection
+  */
+  Status get(IWbemServices** services);
+
+  /**
+  * @brief Drop a connection that failed, the next request reconnects
+  *
+  * The connection is only dropped if it is still the failed services.
+  */
+  void reset(IWbemServices* services);
+
+ private:
+  WmiConnection() {}
+
+ private:
+  IWbemLocator* locator_{nullptr};
+  IWbemServices* services_{nullptr};
+  Mutex mutex_;
+};
+
 /**
 * @brief Windows wrapper class for querying WMI
 *
 * This class abstracts away the WMI querying logic and
 * will return WMI results given a query string.
+*
+* Queries are semi-synchronous and forward-only, results are read in
+* batches as WMI produces them. Select only the properties used by a
+* table, WMI builds every property of a class for a "SELECT *".
 */
 class WmiRequest {
  public:
@@ -143,7 +190,6 @@ class WmiRequest {
  private:
   Status status_;
   std::vector<WmiResultItem> results_;
-  IWbemLocator* locator_{nullptr};
   IWbemServices* services_{nullptr};
   IEnumWbemClassObject* enum_{nullptr};
 };
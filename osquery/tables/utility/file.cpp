@@ -10,17 +10,24 @@
 
 #include <sys/stat.h>
 
+#if !defined(WIN32)
+#include <dirent.h>
+#endif
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/logger.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/work_shard.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
 namespace tables {
 
+#if defined(WIN32)
 const std::map<fs::file_type, std::string> kTypeNames{
     {fs::regular_file, "regular"},
     {fs::directory_file, "directory"},
@@ -32,37 +39,55 @@ const std::map<fs::file_type, std::string> kTypeNames{
     {fs::type_unknown, "unknown"},
     {fs::status_error, "error"},
 };
+#endif
 
-void genFileInfo(const fs::path& path,
-                 const fs::path& parent,
-                 const std::string& pattern,
-                 QueryData& results) {
-  // Must provide the path, filename, directory separate from boost path->string
-  // helpers to match any explicit (query-parsed) predicate constraints.
+/// The type of a file, from the mode of a stat following links.
+static std::string getFileType(const fs::path& path,
+                               const struct stat& file_stat) {
 #if !defined(WIN32)
-  // On POSIX systems, first check the link state.
-  struct stat link_stat;
-  if (lstat(path.string().c_str(), &link_stat) < 0) {
-    // Path was not real, had too may links, or could not be accessed.
-    return;
+  if (S_ISREG(file_stat.st_mode)) {
+    return "regular";
+  } else if (S_ISDIR(file_stat.st_mode)) {
+    return "directory";
+  } else if (S_ISLNK(file_stat.st_mode)) {
+    return "symlink";
+  } else if (S_ISBLK(file_stat.st_mode)) {
+    return "block";
+  } else if (S_ISCHR(file_stat.st_mode)) {
+    return "character";
+  } else if (S_ISFIFO(file_stat.st_mode)) {
+    return "fifo";
+  } else if (S_ISSOCK(file_stat.st_mode)) {
+    return "socket";
   }
-#endif
-
-  struct stat file_stat;
-  if (stat(path.string().c_str(), &file_stat)) {
-    // Path was not real, had too may links, or could not be accessed.
-    return;
+  return "unknown";
+#else
+  boost::system::error_code ec;
+  auto status = fs::status(path, ec);
+  if (kTypeNames.count(status.type())) {
+    return kTypeNames.at(status.type());
   }
+  return "unknown";
+#endif
+}
 
+void genFileInfo(const fs::path& path,
+                 const std::string& filename,
+                 const std::string& directory,
+                 const struct stat& file_stat,
+                 const QueryContext& context,
+                 QueryData& results) {
   Row r;
   r["path"] = path.string();
-  r["filename"] = path.filename().string();
-  r["directory"] = parent.string();
+  r["filename"] = filename;
+  r["directory"] = directory;
 
   r["inode"] = BIGINT(file_stat.st_ino);
   r["uid"] = BIGINT(file_stat.st_uid);
   r["gid"] = BIGINT(file_stat.st_gid);
-  r["mode"] = lsperms(file_stat.st_mode);
+  if (context.isColumnUsed("mode")) {
+    r["mode"] = lsperms(file_stat.st_mode);
+  }
   r["device"] = BIGINT(file_stat.st_rdev);
   r["size"] = BIGINT(file_stat.st_size);
 
@@ -82,18 +107,70 @@ void genFileInfo(const fs::path& path,
   r["btime"] = BIGINT(file_stat.st_birthtimespec.tv_sec);
 #endif
 
-  // Type booleans
-  boost::system::error_code ec;
-  auto status = fs::status(path, ec);
-  if (kTypeNames.count(status.type())) {
-    r["type"] = kTypeNames.at(status.type());
-  } else {
-    r["type"] = "unknown";
+  if (context.isColumnUsed("type")) {
+    r["type"] = getFileType(path, file_stat);
   }
 
   results.push_back(r);
 }
 
+void genFileInfo(const fs::path& path,
+                 const fs::path& parent,
+                 const std::string& pattern,
+                 const QueryContext& context,
+                 QueryData& results) {
+  // Must provide the path, filename, directory separate from boost path->string
+  // helpers to match any explicit (query-parsed) predicate constraints.
+  struct stat file_stat;
+  if (stat(path.string().c_str(), &file_stat)) {
+    // Path was not real, had too may links, or could not be accessed.
+    return;
+  }
+
+  genFileInfo(path,
+              path.filename().string(),
+              parent.string(),
+              file_stat,
+              context,
+              results);
+}
+
+#if !defined(WIN32)
+/// Generate each file in a directory, stat-ing entries relative to it.
+static void genFileInfoInDirectory(const std::string& directory,
+                                   const QueryContext& context,
+                                   QueryData& results) {
+  auto dir = opendir(directory.c_str());
+  if (dir == nullptr) {
+    return;
+  }
+
+  // Entries are resolved from the open directory, not their full paths.
+  auto prefix = directory;
+  if (prefix.empty() || prefix.back() != '/') {
+    prefix += '/';
+  }
+
+  struct dirent* entry = nullptr;
+  while (!context.isCancelled() && (entry = readdir(dir)) != nullptr) {
+    std::string filename = entry->d_name;
+    if (filename == "." || filename == ".." ||
+        !inWorkShard(prefix + filename)) {
+      continue;
+    }
+
+    struct stat file_stat;
+    if (fstatat(dirfd(dir), entry->d_name, &file_stat, 0) != 0) {
+      // Path was not real, had too may links, or could not be accessed.
+      continue;
+    }
+    genFileInfo(
+        prefix + filename, filename, directory, file_stat, context, results);
+  }
+  closedir(dir);
+}
+#endif
+
 QueryData genFile(QueryContext& context) {
   QueryData results;
 
@@ -115,11 +192,17 @@ QueryData genFile(QueryContext& context) {
         return status;
       }));
 
-  // Iterate through each of the resolved/supplied paths.
-  for (const auto& path_string : paths) {
-    fs::path path = path_string;
-    genFileInfo(path, path.parent_path(), "", results);
-  }
+  // Stat each of the resolved/supplied paths, several at once.
+  // A split query only inspects the paths within this host's slice.
+  context.generateEach(
+      paths,
+      ([&context](const std::string& path_string, QueryData& rows) {
+        if (inWorkShard(path_string)) {
+          fs::path path = path_string;
+          genFileInfo(path, path.parent_path(), "", context, rows);
+        }
+      }),
+      results);
 
   // Resolve directories for EQUALS and LIKE operations.
   auto directories = context.constraints["directory"].getAll(EQUALS);
@@ -139,22 +222,31 @@ QueryData genFile(QueryContext& context) {
         return status;
       }));
 
-  // Now loop through constraints using the directory column constraint.
-  for (const auto& directory_string : directories) {
-    if (!isReadable(directory_string) || !isDirectory(directory_string)) {
-      continue;
-    }
+  // Now list each directory from the directory column constraint.
+  context.generateEach(
+      directories,
+      ([&context](const std::string& directory_string, QueryData& rows) {
+        if (!isReadable(directory_string) || !isDirectory(directory_string)) {
+          return;
+        }
 
-    try {
-      // Iterate over the directory and generate info for each regular file.
-      fs::directory_iterator begin(directory_string), end;
-      for (; begin != end; ++begin) {
-        genFileInfo(begin->path(), directory_string, "", results);
-      }
-    } catch (const fs::filesystem_error& /* e */) {
-      continue;
-    }
-  }
+#if !defined(WIN32)
+        genFileInfoInDirectory(directory_string, context, rows);
+#else
+        try {
+          // Iterate over the directory and generate info for each file.
+          fs::directory_iterator begin(directory_string), end;
+          for (; begin != end && !context.isCancelled(); ++begin) {
+            if (inWorkShard(begin->path().string())) {
+              genFileInfo(begin->path(), directory_string, "", context, rows);
+            }
+          }
+        } catch (const fs::filesystem_error& /* e */) {
+          return;
+        }
+#endif
+      }),
+      results);
 
   return results;
 }
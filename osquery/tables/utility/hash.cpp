@@ -8,38 +8,78 @@
  *
  */
 
+#include <map>
+#include <set>
+#include <vector>
+
 #include <boost/filesystem.hpp>
 
 #include <osquery/filesystem.h>
 #include <osquery/hash.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/work_shard.h"
+
 namespace fs = boost::filesystem;
 
 namespace osquery {
 namespace tables {
 
-void genHashForFile(const std::string& path,
-                    const std::string& dir,
-                    QueryContext& context,
-                    QueryData& results) {
+/// A file to hash and the directory constraint it matched.
+using HashTarget = std::pair<std::string, std::string>;
+
+void genHashForFiles(const std::vector<HashTarget>& targets,
+                     QueryContext& context,
+                     QueryData& results) {
   // Must provide the path, filename, directory separate from boost path->string
   // helpers to match any explicit (query-parsed) predicate constraints.
-  Row r;
-  if (context.isCached(path)) {
-    r = context.getCache(path);
-  } else {
-    auto hashes = hashMultiFromFile(
-        HASH_TYPE_MD5 | HASH_TYPE_SHA1 | HASH_TYPE_SHA256, path);
-
-    r["path"] = path;
-    r["directory"] = dir;
-    r["md5"] = std::move(hashes.md5);
-    r["sha1"] = std::move(hashes.sha1);
-    r["sha256"] = std::move(hashes.sha256);
-    context.setCache(path, r);
+  // Only compute the hash types used by the query.
+  int mask = 0;
+  mask |= (context.isColumnUsed("md5")) ? HASH_TYPE_MD5 : 0;
+  mask |= (context.isColumnUsed("sha1")) ? HASH_TYPE_SHA1 : 0;
+  mask |= (context.isColumnUsed("sha256")) ? HASH_TYPE_SHA256 : 0;
+  mask |= (context.isColumnUsed("xxh64")) ? HASH_TYPE_XXH64 : 0;
+
+  // Cursors within the same query may use different hash columns.
+  auto suffix = ":" + std::to_string(mask);
+  std::vector<std::string> paths;
+  std::set<std::string> unique;
+  for (const auto& target : targets) {
+    if (mask != 0 && !context.isCached(target.first + suffix) &&
+        unique.insert(target.first).second) {
+      paths.push_back(target.first);
+    }
+  }
+
+  // Hash the uncached files together, these may be spread across threads.
+  std::map<std::string, MultiHashes> hashes;
+  if (!paths.empty()) {
+    auto digests = cachedHashMultiFromFiles(mask, paths);
+    for (size_t i = 0; i < paths.size(); i++) {
+      hashes[paths[i]] = std::move(digests[i]);
+    }
+  }
+
+  for (const auto& target : targets) {
+    auto index = target.first + suffix;
+    Row r;
+    if (context.isCached(index)) {
+      r = context.getCache(index);
+    } else {
+      r["path"] = target.first;
+      r["directory"] = target.second;
+      auto file_hashes = hashes.find(target.first);
+      if (file_hashes != hashes.end()) {
+        r["md5"] = std::move(file_hashes->second.md5);
+        r["sha1"] = std::move(file_hashes->second.sha1);
+        r["sha256"] = std::move(file_hashes->second.sha256);
+        r["xxh64"] = std::move(file_hashes->second.xxh64);
+        hashes.erase(file_hashes);
+      }
+      context.setCache(index, r);
+    }
+    results.push_back(r);
   }
-  results.push_back(r);
 }
 
 QueryData genHash(QueryContext& context) {
@@ -49,14 +89,22 @@ QueryData genHash(QueryContext& context) {
   // The query must provide a predicate with constraints including path or
   // directory. We search for the parsed predicate constraints with the equals
   // operator.
+  std::vector<HashTarget> targets;
   auto paths = context.constraints["path"].getAll(EQUALS);
   for (const auto& path_string : paths) {
+    if (context.isCancelled()) {
+      return results;
+    }
+
+    // A split query only hashes the files within this host's slice.
     boost::filesystem::path path = path_string;
-    if (!boost::filesystem::is_regular_file(path, ec)) {
+    if (!inWorkShard(path_string) ||
+        !boost::filesystem::is_regular_file(path, ec)) {
       continue;
     }
 
-    genHashForFile(path_string, path.parent_path().string(), context, results);
+    targets.push_back(
+        std::make_pair(path_string, path.parent_path().string()));
   }
 
   // Now loop through constraints using the directory column constraint.
@@ -69,14 +117,16 @@ QueryData genHash(QueryContext& context) {
 
     // Iterate over the directory and generate a hash for each regular file.
     boost::filesystem::directory_iterator begin(directory), end;
-    for (; begin != end; ++begin) {
-      if (boost::filesystem::is_regular_file(begin->path(), ec)) {
-        genHashForFile(
-            begin->path().string(), directory_string, context, results);
+    for (; begin != end && !context.isCancelled(); ++begin) {
+      if (inWorkShard(begin->path().string()) &&
+          boost::filesystem::is_regular_file(begin->path(), ec)) {
+        targets.push_back(
+            std::make_pair(begin->path().string(), directory_string));
       }
     }
   }
 
+  genHashForFiles(targets, context, results);
   return results;
 }
 }
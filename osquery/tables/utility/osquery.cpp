@@ -10,10 +10,12 @@
 
 #include <osquery/config.h>
 #include <osquery/core.h>
+#include <osquery/database.h>
 #include <osquery/events.h>
 #include <osquery/extensions.h>
 #include <osquery/filesystem.h>
 #include <osquery/flags.h>
+#include <osquery/hash.h>
 #include <osquery/logger.h>
 #include <osquery/packs.h>
 #include <osquery/registry.h>
@@ -21,12 +23,17 @@
 #include <osquery/system.h>
 #include <osquery/tables.h>
 
+#include "osquery/core/perf.h"
 #include "osquery/core/process.h"
+#include "osquery/logger/pipeline.h"
+#include "osquery/sql/sqlite_util.h"
+#include "osquery/sql/table_stats.h"
 
 namespace osquery {
 
 DECLARE_bool(disable_logging);
 DECLARE_bool(disable_events);
+DECLARE_uint64(hash_cache_max);
 
 namespace tables {
 
@@ -39,17 +46,23 @@ QueryData genOsqueryEvents(QueryContext& context) {
     r["name"] = publisher;
     r["publisher"] = publisher;
     r["type"] = "publisher";
+    // Publishers do not store events.
+    r["forward_only"] = "0";
 
     auto pubref = EventFactory::getEventPublisher(publisher);
     if (pubref != nullptr) {
       r["subscriptions"] = INTEGER(pubref->numSubscriptions());
       r["events"] = INTEGER(pubref->numEvents());
       r["refreshes"] = INTEGER(pubref->restartCount());
+      r["backlogged"] = INTEGER(pubref->backlogCount());
+      r["dropped"] = "0";
       r["active"] = (pubref->hasStarted() && !pubref->isEnding()) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
       r["refreshes"] = "0";
+      r["backlogged"] = "0";
+      r["dropped"] = "0";
       r["active"] = "-1";
     }
     results.push_back(r);
@@ -62,18 +75,23 @@ QueryData genOsqueryEvents(QueryContext& context) {
     r["type"] = "subscriber";
     // Subscribers will never 'restart'.
     r["refreshes"] = "0";
+    r["backlogged"] = "0";
 
     auto subref = EventFactory::getEventSubscriber(subscriber);
     if (subref != nullptr) {
       r["publisher"] = subref->getType();
       r["subscriptions"] = INTEGER(subref->numSubscriptions());
       r["events"] = INTEGER(subref->numEvents());
+      r["dropped"] = INTEGER(subref->numDropped());
+      r["forward_only"] = (subref->isForwardOnly()) ? "1" : "0";
 
       // Subscribers are always active, even if their publisher is not.
       r["active"] = (subref->state() == SUBSCRIBER_RUNNING) ? "1" : "0";
     } else {
       r["subscriptions"] = "0";
       r["events"] = "0";
+      r["dropped"] = "0";
+      r["forward_only"] = "0";
       r["active"] = "-1";
     }
     results.push_back(r);
@@ -96,6 +114,16 @@ QueryData genOsqueryPacks(QueryContext& context) {
     auto stats = pack->getStats();
     r["discovery_cache_hits"] = INTEGER(stats.hits);
     r["discovery_executions"] = INTEGER(stats.misses);
+
+    const auto& budget = pack->getBudget();
+    r["cpu_budget"] = BIGINT(budget.cpu_seconds);
+    r["result_budget"] = BIGINT(budget.result_bytes);
+
+    // The usage is of the last hour the pack's queries were due.
+    auto usage = pack->getUsage();
+    r["cpu_time"] = BIGINT(usage.cpu_ms);
+    r["peak_result_bytes"] = BIGINT(usage.peak_result_bytes);
+    r["budget_skips"] = INTEGER(usage.skipped);
     results.push_back(r);
   });
 
@@ -173,6 +201,41 @@ QueryData genOsqueryRegistry(QueryContext& context) {
   return results;
 }
 
+QueryData genOsqueryDatabase(QueryContext& context) {
+  QueryData results;
+
+  PluginResponse stats;
+  auto status = getDatabaseStats(stats);
+  if (!status.ok()) {
+    VLOG(1) << "Could not get database stats: " << status.getMessage();
+  }
+
+  for (const auto& stat : stats) {
+    Row r;
+    r["domain"] = (stat.count("domain") > 0) ? stat.at("domain") : "";
+    r["name"] = (stat.count("name") > 0) ? stat.at("name") : "";
+    r["value"] = (stat.count("value") > 0) ? stat.at("value") : "";
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryLogPipeline(QueryContext& context) {
+  auto stats = LogPipeline::get().stats();
+
+  Row r;
+  r["threads"] = INTEGER(stats.threads);
+  r["capacity"] = INTEGER(stats.capacity);
+  r["depth"] = INTEGER(stats.depth);
+  r["max_depth"] = INTEGER(stats.max_depth);
+  r["enqueued"] = BIGINT(stats.enqueued);
+  r["logged"] = BIGINT(stats.logged);
+  r["failed"] = BIGINT(stats.failed);
+  r["blocked"] = BIGINT(stats.blocked);
+  r["blocked_ms"] = BIGINT(stats.blocked_ms);
+  return {r};
+}
+
 QueryData genOsqueryExtensions(QueryContext& context) {
   QueryData results;
 
@@ -221,6 +284,7 @@ QueryData genOsqueryInfo(QueryContext& context) {
   r["build_platform"] = STR(OSQUERY_BUILD_PLATFORM);
   r["build_distro"] = STR(OSQUERY_BUILD_DISTRO);
   r["start_time"] = INTEGER(Config::getInstance().getStartTime());
+  r["ready_time"] = INTEGER(Initializer::getReadyTime());
   if (Initializer::isWorker()) {
     r["watcher"] = INTEGER(PlatformProcess::getLauncherProcess()->pid());
   } else {
@@ -248,6 +312,10 @@ QueryData genOsquerySchedule(QueryContext& context) {
         r["system_time"] = "0";
         r["average_memory"] = "0";
         r["last_executed"] = "0";
+        r["cache_hits"] = "0";
+        r["cache_misses"] = "0";
+        r["suppressed_rows"] = "0";
+        r["timeouts"] = "0";
 
         // Report optional performance information.
         Config::getInstance().getPerformanceStats(
@@ -259,11 +327,96 @@ QueryData genOsquerySchedule(QueryContext& context) {
               r["user_time"] = BIGINT(perf.user_time);
               r["system_time"] = BIGINT(perf.system_time);
               r["average_memory"] = BIGINT(perf.average_memory);
+              r["cache_hits"] = BIGINT(perf.cache_hits);
+              r["cache_misses"] = BIGINT(perf.cache_misses);
+              r["suppressed_rows"] = BIGINT(perf.suppressed_rows);
+              r["timeouts"] = BIGINT(perf.timeouts);
             });
 
         results.push_back(r);
       });
   return results;
 }
+
+QueryData genOsqueryTableStats(QueryContext& context) {
+  QueryData results;
+
+  TableStats::instance().forEach(
+      [&results](const std::string& name, const TableGenerateStats& stats) {
+        Row r;
+        r["name"] = SQL_TEXT(name);
+        r["scans"] = BIGINT(stats.scans);
+        r["rows"] = BIGINT(stats.rows);
+        r["total_time"] = BIGINT(stats.total_time);
+        r["max_time"] = BIGINT(stats.max_time);
+        r["under_1ms"] = BIGINT(stats.histogram[0]);
+        r["under_10ms"] = BIGINT(stats.histogram[1]);
+        r["under_100ms"] = BIGINT(stats.histogram[2]);
+        r["under_1s"] = BIGINT(stats.histogram[3]);
+        r["over_1s"] = BIGINT(stats.histogram[4]);
+        results.push_back(r);
+      });
+  return results;
+}
+
+QueryData genOsquerySQLiteStats(QueryContext& context) {
+  QueryData results;
+  for (const auto& stat : getSQLiteMemoryStats()) {
+    Row r;
+    r["name"] = stat.name;
+    r["scope"] = stat.scope;
+    r["connection"] = INTEGER(stat.connection);
+    r["current"] = BIGINT(stat.current);
+    r["highwater"] = BIGINT(stat.highwater);
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryPerf(QueryContext& context) {
+  // A distributed query may switch stage timing on or off.
+  auto enabled = context.constraints["enabled"].getAll(EQUALS);
+  if (enabled.size() == 1) {
+    const auto& value = *enabled.begin();
+    if (value == "0" || value == "1") {
+      Flag::updateValue("perf_counters", (value == "1") ? "true" : "false");
+    }
+  }
+
+  QueryData results;
+  size_t threads = 0;
+  auto stats = getPerfStats(threads);
+  for (size_t i = 0; i < stats.size(); i++) {
+    const auto& stage = stats[i];
+    Row r;
+    r["stage"] = kPerfStageNames[i];
+    r["calls"] = BIGINT(stage.calls);
+    r["total_time"] = BIGINT(stage.total_time);
+    r["max_time"] = BIGINT(stage.max_time);
+    r["under_10us"] = BIGINT(stage.histogram[0]);
+    r["under_100us"] = BIGINT(stage.histogram[1]);
+    r["under_1ms"] = BIGINT(stage.histogram[2]);
+    r["under_10ms"] = BIGINT(stage.histogram[3]);
+    r["under_100ms"] = BIGINT(stage.histogram[4]);
+    r["over_100ms"] = BIGINT(stage.histogram[5]);
+    r["threads"] = INTEGER(threads);
+    r["enabled"] = INTEGER(FLAGS_perf_counters ? 1 : 0);
+    results.push_back(r);
+  }
+  return results;
+}
+
+QueryData genOsqueryHashCache(QueryContext& context) {
+  auto stats = getHashCacheStats();
+  Row r;
+  r["entries"] = BIGINT(stats.entries);
+  r["max_entries"] = BIGINT(FLAGS_hash_cache_max);
+  r["hits"] = BIGINT(stats.hits);
+  r["misses"] = BIGINT(stats.misses);
+  r["stale"] = BIGINT(stats.stale);
+  r["unchanged"] = BIGINT(stats.unchanged);
+  r["evictions"] = BIGINT(stats.evictions);
+  return {r};
+}
 }
 }
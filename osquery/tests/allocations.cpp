@@ -0,0 +1,116 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__FreeBSD__)
+#include <malloc_np.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "osquery/tests/allocations.h"
+
+/// Counters for every heap allocation made with operator new.
+static std::atomic<size_t> kAllocations{0};
+static std::atomic<size_t> kAllocatedBytes{0};
+static std::atomic<size_t> kLiveBytes{0};
+static std::atomic<size_t> kPeakBytes{0};
+
+/// The usable size of an allocation, used to count the bytes freed.
+static inline size_t allocationSize(void* p) {
+#if defined(__APPLE__)
+  return malloc_size(p);
+#elif defined(WIN32)
+  return _msize(p);
+#else
+  return malloc_usable_size(p);
+#endif
+}
+
+void* operator new(size_t size) {
+  void* p = std::malloc((size == 0) ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+
+  kAllocations++;
+  kAllocatedBytes += size;
+  // Live bytes use the usable size, so the same size is removed on delete.
+  auto live = kLiveBytes.fetch_add(allocationSize(p)) + allocationSize(p);
+  auto peak = kPeakBytes.load();
+  while (live > peak && !kPeakBytes.compare_exchange_weak(peak, live)) {
+  }
+  return p;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return operator new(size);
+  } catch (const std::bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept {
+  if (p != nullptr) {
+    kLiveBytes -= allocationSize(p);
+    std::free(p);
+  }
+}
+
+void operator delete[](void* p) noexcept {
+  operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+  // Sized deletes count the usable size, as the unsized delete does.
+  operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+  operator delete(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  operator delete(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  operator delete(p);
+}
+
+namespace osquery {
+
+AllocationCounts getAllocationCounts() {
+  AllocationCounts counts;
+  counts.allocations = kAllocations.load();
+  counts.bytes = kAllocatedBytes.load();
+  counts.live = kLiveBytes.load();
+  counts.peak = kPeakBytes.load();
+  return counts;
+}
+
+void resetAllocationPeak() {
+  kPeakBytes = kLiveBytes.load();
+}
+}
@@ -0,0 +1,43 @@
+/*
+ *  Copyright (c) 2014-present, Facebook, Inc.
+ *  All rights reserved.
+ *
+ *  This source code is licensed under the BSD-style license found in the
+ *  LICENSE file in the root directory of this source tree. An additional grant
+ *  of patent rights can be found in the PATENTS file in the same directory.
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace osquery {
+
+/// Heap usage counted by the benchmark allocation hooks.
+struct AllocationCounts {
+  /// Calls to operator new.
+  size_t allocations{0};
+
+  /// Bytes requested from operator new.
+  size_t bytes{0};
+
+  /// Bytes allocated and not yet deleted.
+  size_t live{0};
+
+  /// The most live bytes since the last resetAllocationPeak.
+  size_t peak{0};
+};
+
+/**
+ * @brief Read the counts of the operator new and delete hooks.
+ *
+ * The hooks replace the global operators, so they are only linked into the
+ * benchmark executables that report allocations: the table benchmarks and
+ * osquery_alloc_benchmarks.
+ */
+AllocationCounts getAllocationCounts();
+
+/// Restart the peak live bytes from the current live bytes.
+void resetAllocationPeak();
+}
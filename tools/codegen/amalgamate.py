@@ -19,6 +19,7 @@ import sys
 
 
 TEMPLATE_NAME = "amalgamation.cpp.in"
+BENCHMARK_TEMPLATE_NAME = "benchmark_amalgamation.cpp.in"
 BEGIN_LINE = "/// BEGIN[GENTABLE]"
 END_LINE = "/// END[GENTABLE]"
 
@@ -45,6 +46,8 @@ def main(argc, argv):
         "Generate C++ amalgamation from C++ Table Plugin targets")
     parser.add_argument("--foreign", default=False, action="store_true",
         help="Generate a foreign table set amalgamation")
+    parser.add_argument("--benchmark", default=False, action="store_true",
+        help="Generate a table benchmark amalgamation")
     parser.add_argument("codegen", help="Path to this codegen folder")
     parser.add_argument("generated", help="Path to generated build folder")
     parser.add_argument("category", help="Category name of generated tables")
@@ -52,7 +55,10 @@ def main(argc, argv):
 
     tables = []
     # Discover the output template, usually a black cpp file with includes.
-    template = os.path.join(args.codegen, "templates", TEMPLATE_NAME)
+    template_name = TEMPLATE_NAME
+    if args.benchmark:
+        template_name = BENCHMARK_TEMPLATE_NAME
+    template = os.path.join(args.codegen, "templates", template_name)
     with open(template, "rU") as fh:
         template_data = fh.read()
 
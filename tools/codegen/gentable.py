@@ -17,6 +17,7 @@ import ast
 import jinja2
 import logging
 import os
+import re
 import sys
 
 SCRIPT_DIR = os.path.dirname(os.path.realpath(__file__))
@@ -72,6 +73,7 @@ COLUMN_OPTIONS = {
     "additional": "ADDITIONAL",
     "required": "REQUIRED",
     "optimized": "OPTIMIZED",
+    "unique": "UNIQUE",
 }
 
 # Column options that render tables uncacheable.
@@ -87,8 +89,26 @@ TABLE_ATTRIBUTES = {
     "cacheable": "CACHEABLE",
     "utility": "UTILITY",
     "kernel_required": "KERNEL_REQUIRED",
+    "deterministic": "DETERMINISTIC",
 }
 
+# C++ keywords that cannot name a typed row member.
+CPP_KEYWORDS = [
+    "auto", "bool", "break", "case", "catch", "char", "class", "const",
+    "continue", "default", "delete", "do", "double", "else", "enum",
+    "explicit", "export", "extern", "false", "float", "for", "friend", "goto",
+    "if", "inline", "int", "long", "mutable", "namespace", "new", "operator",
+    "private", "protected", "public", "register", "return", "short", "signed",
+    "sizeof", "static", "struct", "switch", "template", "this", "throw",
+    "true", "try", "typedef", "typename", "union", "unsigned", "using",
+    "virtual", "void", "volatile", "while",
+]
+
+
+# Simple equality constraints within example queries, used for benchmarks.
+EXAMPLE_CONSTRAINT = re.compile(
+    r"(\w+)\s*=\s*('(?:[^']*)'|\"(?:[^\"]*)\"|-?\d+)", re.IGNORECASE)
+
 
 def to_camel_case(snake_case):
     """ convert a snake_case string to camelCase """
@@ -96,6 +116,11 @@ def to_camel_case(snake_case):
     return components[0] + "".join(x.title() for x in components[1:])
 
 
+def to_pascal_case(snake_case):
+    """ convert a snake_case string to PascalCase """
+    return "".join(x.title() for x in snake_case.split('_'))
+
+
 def lightred(msg):
     return "\033[1;31m %s \033[0m" % str(msg)
 
@@ -190,6 +215,72 @@ class TableState(Singleton):
     def foreign_keys(self):
         return [i for i in self.schema if isinstance(i, ForeignKey)]
 
+    def example_constraints(self):
+        """Find the equality constraints of the first usable example.
+
+        Return None if the table requires columns that no example constrains.
+        """
+        names = [column.name for column in self.columns()]
+        required = set([column.name for column in self.columns()
+                        if "required" in column.options])
+        for example in self.examples + [""]:
+            where = re.split(r"\bwhere\b", example, 1, flags=re.IGNORECASE)
+            constraints = []
+            if len(where) == 2:
+                for column, value in EXAMPLE_CONSTRAINT.findall(where[1]):
+                    if column in names:
+                        value = value.strip("'\"").replace("\\", "\\\\")
+                        constraints.append((column, value.replace('"', '\\"')))
+            # Tables requiring several columns accept any one of them.
+            if not required or required & set([c[0] for c in constraints]):
+                return constraints
+        return None
+
+    def typed_row(self):
+        """Set the typed row layout of each column, return the struct name.
+
+        Columns are members of the generated struct, named as the column, and
+        addressed by an enumerated ordinal in the order of the schema.
+        """
+        for column in self.columns():
+            affinity = column.type.affinity
+            column.member = column.name
+            if column.name in CPP_KEYWORDS:
+                column.member += "_"
+            column.ordinal = "k" + to_pascal_case(column.name)
+            member = "row." + column.member
+            if affinity in ["TEXT_TYPE", "BLOB_TYPE"]:
+                column.cpp_type = "std::string"
+                column.setter = "setText"
+                column.typed_value = "std::move(%s)" % member
+                column.json_value = member
+            elif affinity == "DOUBLE_TYPE":
+                column.cpp_type = column.type.type
+                column.setter = "setDouble"
+                column.typed_value = member
+                column.json_value = "DOUBLE(%s)" % member
+            else:
+                column.cpp_type = column.type.type
+                column.setter = "setInteger"
+                column.typed_value = "static_cast<long long>(%s)" % member
+                column.json_value = "%s(%s)" % (affinity[:-5], member)
+        return to_pascal_case(self.table_name) + "Row"
+
+    def render_typed_row(self):
+        """Render the typed row struct and its RowStructTraits."""
+        if "typed_rows" not in self.attributes:
+            return ""
+        if self.class_name != "":
+            print(lightred("Event subscriber tables cannot use typed_rows: %s" %
+                           (self.table_name)))
+            exit(1)
+        return jinja2.Template(TEMPLATES["typed_row"]).render(
+            table_name=self.table_name,
+            row_name=self.typed_row(),
+            schema=self.columns(),
+            json_schema=sorted(self.columns(), key=lambda c: c.name),
+        )
+
     def generate(self, path, template="default"):
         """Generate the virtual table files"""
         logging.debug("TableState.generate")
@@ -244,12 +335,20 @@ class TableState(Singleton):
             impl=self.impl,
             function=self.function,
             class_name=self.class_name,
+            row_name=(self.typed_row() if "typed_rows" in self.attributes
+                      else ""),
+            typed_row=(self.render_typed_row()
+                       if template in ["default", "typed_row_header"]
+                       else ""),
             attributes=self.attributes,
             examples=self.examples,
             aliases=self.aliases,
             has_options=self.has_options,
             has_column_aliases=self.has_column_aliases,
-            attribute_set=[TABLE_ATTRIBUTES[attr] for attr in self.attributes],
+            attribute_set=[TABLE_ATTRIBUTES[attr] for attr in self.attributes
+                           if attr in TABLE_ATTRIBUTES],
+            constraints=(self.example_constraints()
+                         if template == "benchmark" else None),
         )
 
         with open(path, "w+") as file_h:
@@ -390,6 +489,10 @@ def main(argc, argv):
         action="store_true")
     parser.add_argument("--foreign", default=False, action="store_true",
         help="Generate a foreign table")
+    parser.add_argument("--benchmark", default=False, action="store_true",
+        help="Generate a benchmark of the table's generate method")
+    parser.add_argument("--header", default=False, action="store_true",
+        help="Generate the typed row header of a typed_rows table")
     parser.add_argument("--templates", default=SCRIPT_DIR + "/templates",
                         help="Path to codegen output .cpp.in templates")
     parser.add_argument("spec_file", help="Path to input .table spec file")
@@ -411,8 +514,13 @@ def main(argc, argv):
             tree = ast.parse(file_handle.read())
             exec(compile(tree, "<string>", "exec"))
             blacklisted = is_blacklisted(table.table_name, path=filename)
-            if not args.disable_blacklist and blacklisted:
+            if args.header:
+                # Implementations are compiled even if the table is blacklisted.
+                table.generate(output, template="typed_row_header")
+            elif not args.disable_blacklist and blacklisted:
                 table.blacklist(output)
+            elif args.benchmark:
+                table.generate(output, template="benchmark")
             else:
                 template_type = "default" if not args.foreign else "foreign"
                 table.generate(output, template=template_type)
@@ -104,6 +104,10 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
             self.distributed_read(request)
         elif self.path == '/distributed_write':
             self.distributed_write(request)
+        elif self.path == '/carve_init':
+            self.carve_init(request)
+        elif self.path == '/carve_block':
+            self.carve_block(request)
         else:
             self._reply(TEST_RESPONSE)
 
@@ -160,6 +164,23 @@ class RealSimpleHandler(BaseHTTPRequestHandler):
         '''A basic distributed write endpoint'''
         self._reply({})
 
+    def carve_init(self, request):
+        '''A basic carve session endpoint'''
+        if "node_key" not in request or request["node_key"] not in NODE_KEYS:
+            self._reply(FAILED_ENROLL_RESPONSE)
+            return
+        self._reply({"session_id": "session_" + request["carve_id"]})
+
+    def carve_block(self, request):
+        '''A basic carve block endpoint'''
+
+        # Each block's data is base64 encoded and optionally gzip compressed.
+        # A server appends the decoded blocks in block_id order.
+        if "session_id" not in request or "data" not in request:
+            self._reply({"error": "Missing carve block"})
+            return
+        self._reply({})
+
     def log(self, request):
         self._reply({})
 